@@ -6,13 +6,16 @@
 #include "Compiler/GPUKernelCompiler.h"
 #include "Compiler/GPUKernel.h"
 #include "Compiler/GPUKernelCompilerOptions.h"
+#include "Compiler/KernelLaunchAutotuner.h"
 #include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiKernelGraph.h"
 #include "Threads/ThreadFunctions.h"
 #include "Threads/ThreadManager.h"
 #include "UI/ImGui/ImGuiLogger.h"
 
 extern GPUKernelCompiler g_gpu_kernel_compiler;
 extern ImGuiLogger g_imgui_logger;
+extern KernelLaunchAutotuner g_kernel_launch_autotuner;
 
 const std::vector<std::string> GPUKernel::COMMON_ADDITIONAL_KERNEL_INCLUDE_DIRS =
 {
@@ -76,6 +79,9 @@ void GPUKernel::compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_ctx, std::vector<h
 
 	std::string cache_key = g_gpu_kernel_compiler.get_additional_cache_key(*this);
 	m_kernel_function = g_gpu_kernel_compiler.compile_kernel(*this, m_compiler_options, hiprt_ctx, func_name_sets.data(), use_cache, cache_key);
+	m_device_name = hiprt_ctx->device_properties.name;
+	m_compiled_macros = m_compiler_options.get_relevant_macros_as_std_vector_string(this);
+	m_compiled_cache_key = cache_key;
 }
 
 void GPUKernel::compile_silent(std::shared_ptr<HIPRTOrochiCtx> hiprt_ctx, std::vector<hiprtFuncNameSet> func_name_sets, bool use_cache)
@@ -85,6 +91,40 @@ void GPUKernel::compile_silent(std::shared_ptr<HIPRTOrochiCtx> hiprt_ctx, std::v
 
 	std::string cache_key = g_gpu_kernel_compiler.get_additional_cache_key(*this);
 	m_kernel_function = g_gpu_kernel_compiler.compile_kernel(*this, m_compiler_options, hiprt_ctx, func_name_sets.data(), use_cache, cache_key, /* silent */ true);
+	m_device_name = hiprt_ctx->device_properties.name;
+	m_compiled_macros = m_compiler_options.get_relevant_macros_as_std_vector_string(this);
+	m_compiled_cache_key = cache_key;
+}
+
+bool GPUKernel::take_compiled_function(const GPUKernel& compiled_copy)
+{
+	if (compiled_copy.m_kernel_function == nullptr)
+		return false;
+
+	// The macros used by the copy, its sources may not use the same macros as the ones this kernel was parsed with
+	if (m_compiler_options.get_relevant_macros_as_std_vector_string(&compiled_copy) != compiled_copy.m_compiled_macros)
+		return false;
+
+	m_kernel_function = compiled_copy.m_kernel_function;
+	m_device_name = compiled_copy.m_device_name;
+	m_used_option_macros = compiled_copy.m_used_option_macros;
+	m_option_macro_invalidated = false;
+	m_compiled_macros = compiled_copy.m_compiled_macros;
+	m_compiled_cache_key = compiled_copy.m_compiled_cache_key;
+
+	return true;
+}
+
+bool GPUKernel::needs_recompilation()
+{
+	if (m_kernel_function == nullptr || m_compiled_macros.empty())
+		return true;
+
+	if (m_option_macro_invalidated)
+		parse_option_macros_used();
+
+	return m_compiler_options.get_relevant_macros_as_std_vector_string(this) != m_compiled_macros
+		|| g_gpu_kernel_compiler.get_additional_cache_key(*this) != m_compiled_cache_key;
 }
 
 int GPUKernel::get_kernel_attribute(oroFunction compiled_kernel, oroFunction_attribute attribute)
@@ -114,7 +154,7 @@ int GPUKernel::get_kernel_attribute(oroFunction_attribute attribute)
 		return 0;
 	}
 
-	OROCHI_CHECK_ERROR(oroFuncGetAttribute(&numRegs, ORO_FUNC_ATTRIBUTE_NUM_REGS, m_kernel_function));
+	OROCHI_CHECK_ERROR(oroFuncGetAttribute(&numRegs, attribute, m_kernel_function));
 
 	return numRegs;
 }
@@ -155,11 +195,83 @@ void GPUKernel::synchronize_options_with(const GPUKernelCompilerOptions& other_o
 
 void GPUKernel::launch(int tile_size_x, int tile_size_y, int res_x, int res_y, void** launch_args, oroStream_t stream)
 {
+	int requested_tile_size_x = tile_size_x;
+	int requested_tile_size_y = tile_size_y;
+	int tuning_candidate_index = -1;
+	OrochiKernelGraph* kernel_graph = OrochiKernelGraph::get_current();
+	if (m_launch_tuning_allowed && g_kernel_launch_autotuner.is_enabled())
+	{
+		resolve_launch_tuning_timings();
+
+		if (kernel_graph != nullptr && kernel_graph->is_building_or_replaying())
+			// The launches of a graph cannot be timed, only using the block size tuned so far
+			g_kernel_launch_autotuner.get_tuned_block_size(m_device_name, m_kernel_function_name, res_y, tile_size_x, tile_size_y);
+		else
+			// Replaces the tile size by the best one for that device or by one of
+			// the candidates to time if the launch is being tuned
+			tuning_candidate_index = g_kernel_launch_autotuner.get_block_size(m_device_name, m_kernel_function_name, res_y, tile_size_x, tile_size_y);
+	}
+
 	hiprtInt2 nb_groups;
 	nb_groups.x = std::ceil(static_cast<float>(res_x) / tile_size_x);
 	nb_groups.y = std::ceil(static_cast<float>(res_y) / tile_size_y);
 
-	OROCHI_CHECK_ERROR(oroModuleLaunchKernel(m_kernel_function, nb_groups.x, nb_groups.y, 1, tile_size_x, tile_size_y, 1, 0, stream, launch_args, 0));
+	LaunchTuningTiming timing;
+	if (tuning_candidate_index != -1)
+	{
+		if (m_free_launch_tuning_events.empty())
+		{
+			std::pair<oroEvent_t, oroEvent_t> events;
+			OROCHI_CHECK_ERROR(oroEventCreate(&events.first));
+			OROCHI_CHECK_ERROR(oroEventCreate(&events.second));
+
+			m_free_launch_tuning_events.push_back(events);
+		}
+
+		timing.candidate_index = tuning_candidate_index;
+		timing.requested_block_size_x = requested_tile_size_x;
+		timing.requested_block_size_y = requested_tile_size_y;
+		timing.start = m_free_launch_tuning_events.back().first;
+		timing.stop = m_free_launch_tuning_events.back().second;
+		m_free_launch_tuning_events.pop_back();
+
+		OROCHI_CHECK_ERROR(oroEventRecord(timing.start, stream));
+	}
+
+	if (kernel_graph != nullptr)
+		kernel_graph->launch_kernel(m_kernel_function, nb_groups.x, nb_groups.y, tile_size_x, tile_size_y, launch_args, stream);
+	else
+		OROCHI_CHECK_ERROR(oroModuleLaunchKernel(m_kernel_function, nb_groups.x, nb_groups.y, 1, tile_size_x, tile_size_y, 1, 0, stream, launch_args, 0));
+
+	if (tuning_candidate_index != -1)
+	{
+		OROCHI_CHECK_ERROR(oroEventRecord(timing.stop, stream));
+		// Same workaround as in launch_timed_asynchronous() for HIP 5.7 + Windows
+		oroLaunchHostFunc(stream, [](void*) {}, nullptr);
+
+		m_pending_launch_tuning_timings.push_back(timing);
+	}
+}
+
+void GPUKernel::resolve_launch_tuning_timings()
+{
+	// The timings complete in order on the stream, stopping at the first one that isn't complete
+	while (!m_pending_launch_tuning_timings.empty() && oroEventQuery(m_pending_launch_tuning_timings.front().stop) == oroSuccess)
+	{
+		LaunchTuningTiming& timing = m_pending_launch_tuning_timings.front();
+
+		float time;
+		OROCHI_CHECK_ERROR(oroEventElapsedTime(&time, timing.start, timing.stop));
+		g_kernel_launch_autotuner.add_timing(m_device_name, m_kernel_function_name, timing.requested_block_size_x, timing.requested_block_size_y, timing.candidate_index, time);
+
+		m_free_launch_tuning_events.push_back(std::make_pair(timing.start, timing.stop));
+		m_pending_launch_tuning_timings.pop_front();
+	}
+}
+
+void GPUKernel::set_launch_tuning_allowed(bool allowed)
+{
+	m_launch_tuning_allowed = allowed;
 }
 
 void GPUKernel::launch_timed_synchronous(int tile_size_x, int tile_size_y, int res_x, int res_y, void** launch_args, float* execution_time_out)
@@ -202,6 +314,18 @@ void GPUKernel::set_precompiled(bool precompiled)
 	m_is_precompiled_kernel = precompiled;
 }
 
+oroFunction GPUKernel::get_kernel_function() const
+{
+	return m_kernel_function;
+}
+
+void GPUKernel::set_kernel_function(oroFunction kernel_function)
+{
+	m_kernel_function = kernel_function;
+	// Compiled for other options than the ones of this kernel
+	m_compiled_macros.clear();
+}
+
 void GPUKernel::launch_timed_asynchronous(int tile_size_x, int tile_size_y, int res_x, int res_y, void** launch_args, oroStream_t stream)
 {
 	OROCHI_CHECK_ERROR(oroEventRecord(m_execution_start_event, stream));
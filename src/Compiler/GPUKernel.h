@@ -11,6 +11,7 @@
 
 #include <hiprt/hiprt.h>
 #include <Orochi/Orochi.h>
+#include <deque>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -68,6 +69,21 @@ public:
 	 */
 	bool uses_macro(const std::string& macro_name) const;
 
+	/**
+	 * Returns true if the macros relevant to this kernel (see GPUKernelCompilerOptions::get_relevant_macros_as_std_vector_string())
+	 * or its additional cache key changed since its last compilation, or if the kernel was never compiled.
+	 * 
+	 * A kernel whose function was swapped with set_kernel_function() always needs to be recompiled
+	 */
+	bool needs_recompilation();
+	/**
+	 * Takes the compiled function of 'compiled_copy', a copy of this kernel compiled in the background.
+	 * 
+	 * Returns false and leaves this kernel untouched if the compilation of the copy failed or if
+	 * the options relevant to the copy changed in this kernel since the copy was compiled
+	 */
+	bool take_compiled_function(const GPUKernel& compiled_copy);
+
 	/**
 	 * Returns the number of GPU register that this kernel is using. This function
 	 * must be called after the kernel has been compiled. 
@@ -125,6 +141,19 @@ public:
 	bool is_precompiled() const;
 	void set_precompiled(bool precompiled);
 
+	/**
+	 * The compiled function launched by this kernel. Setting it swaps the function
+	 * launched by this kernel without recompiling (see GPURenderer::set_runtime_kernel_option())
+	 */
+	oroFunction get_kernel_function() const;
+	void set_kernel_function(oroFunction kernel_function);
+
+	/**
+	 * Whether or not the block size of the launches of this kernel can be changed by the KernelLaunchAutotuner.
+	 * Must be false for kernels whose code relies on the block size that they are launched with
+	 */
+	void set_launch_tuning_allowed(bool allowed);
+
 private:
 	std::string m_kernel_file_path = "";
 	std::string m_kernel_function_name = "";
@@ -158,6 +187,33 @@ private:
 	GPUKernelCompilerOptions m_compiler_options;
 
 	oroFunction m_kernel_function = nullptr;
+	// Relevant macros and additional cache key that 'm_kernel_function' was compiled with, see needs_recompilation()
+	std::vector<std::string> m_compiled_macros;
+	std::string m_compiled_cache_key;
+	// Name of the device that the kernel was compiled for, the block
+	// sizes found by the KernelLaunchAutotuner are per device
+	std::string m_device_name;
+
+	/**
+	 * Gives the times of the launches timed for the KernelLaunchAutotuner
+	 * that have completed on the GPU to the autotuner
+	 */
+	void resolve_launch_tuning_timings();
+
+	bool m_launch_tuning_allowed = true;
+	struct LaunchTuningTiming
+	{
+		int candidate_index;
+		int requested_block_size_x;
+		int requested_block_size_y;
+
+		oroEvent_t start;
+		oroEvent_t stop;
+	};
+	// Launches timed for the autotuner whose time hasn't been read yet
+	std::deque<LaunchTuningTiming> m_pending_launch_tuning_timings;
+	// Events of the timings that have been read, reused for the next timed launches
+	std::vector<std::pair<oroEvent_t, oroEvent_t>> m_free_launch_tuning_events;
 
 	// If true, this means that this kernel is only used for precompilation and will be
 	// discarded after it's been compiled
@@ -7,16 +7,23 @@
 #include "Compiler/GPUKernelCompiler.h"
 #include "HIPRT-Orochi/HIPRTOrochiUtils.h"
 #include "UI/ImGui/ImGuiLogger.h"
+#include "Utils/TraceRecorder.h"
 #include "Utils/Utils.h"
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <filesystem>
+#include <fstream>
 #include <mutex>
+#include <sstream>
 
 GPUKernelCompiler g_gpu_kernel_compiler;
 extern ImGuiLogger g_imgui_logger;
 
+const std::string GPUKernelCompiler::SOURCE_FILES_GRAPH_FILE_PATH = "shader_cache_dependencies.txt";
+
 // This variable will be initialized before the main function by the main thread
 std::thread::id g_main_thread_id = std::this_thread::get_id();
 // Whether or not the main thread is currently compiling. Used in the condition variable.
@@ -24,12 +31,17 @@ std::thread::id g_main_thread_id = std::this_thread::get_id();
 // other threads may not compile to give the user the priority for the compilation
 bool g_main_thread_compiling = false;
 bool g_background_shader_compilation_enabled = true;
+// If true, the background precompilation stops at the first option combination that the
+// user never switched to (see GPURenderer::cancel_unused_background_shader_compilation())
+bool g_background_shader_compilation_cancel_unused = false;
 std::condition_variable g_condition_for_compilation;
 
 oroFunction_t GPUKernelCompiler::compile_kernel(GPUKernel& kernel, const GPUKernelCompilerOptions& kernel_compiler_options, std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, hiprtFuncNameSet* function_name_sets, bool use_cache, const std::string& additional_cache_key, bool silent)
 {
 	std::string kernel_file_path = kernel.get_kernel_file_path();
 	std::string kernel_function_name = kernel.get_kernel_function_name();
+	TraceZone trace_zone(kernel_function_name + " compilation", "Compilation");
+
 	const std::vector<std::string>& additional_include_dirs = GPUKernel::COMMON_ADDITIONAL_KERNEL_INCLUDE_DIRS;
 	std::vector<std::string> compiler_options = kernel_compiler_options.get_relevant_macros_as_std_vector_string(&kernel);
 
@@ -73,7 +85,23 @@ oroFunction_t GPUKernelCompiler::compile_kernel(GPUKernel& kernel, const GPUKern
 	else
 		use_shader_cache = use_cache;
 
-	if (HIPPTOrochiUtils::build_trace_kernel(hiprt_orochi_ctx->hiprt_ctx, kernel_file_path, kernel_function_name, trace_function_out, additional_include_dirs, compiler_options, 1, 1, use_shader_cache, function_name_sets, additional_cache_key) != hiprtError::hiprtSuccess)
+	// Copying the binaries of the kernel bundle (if any) in the shader cache before the first
+	// compilation on that device so that the compiler finds them
+	if (use_shader_cache)
+		m_kernel_bundle.seed_shader_cache(hiprt_orochi_ctx->device_properties.name, HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY);
+
+	// The shared shader cache may have the binaries of that kernel under another additional cache key
+	std::string kernel_cache_key;
+	std::string sources_hash;
+	std::string compilation_cache_key = additional_cache_key;
+	if (use_shader_cache)
+	{
+		kernel_cache_key = ShaderCacheManager::get_kernel_key(hiprt_orochi_ctx->device_properties.name, kernel_file_path, kernel_function_name, compiler_options);
+		sources_hash = get_sources_hash(kernel);
+		compilation_cache_key = m_shader_cache.prepare_compilation(kernel_cache_key, sources_hash, additional_cache_key);
+	}
+
+	if (HIPPTOrochiUtils::build_trace_kernel(hiprt_orochi_ctx->hiprt_ctx, kernel_file_path, kernel_function_name, trace_function_out, additional_include_dirs, compiler_options, HIPRT_GEOMETRY_TYPE_COUNT, 1, use_shader_cache, function_name_sets, compilation_cache_key) != hiprtError::hiprtSuccess)
 	{
 		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Unable to compile kernel \"%s\". Cannot continue.", kernel_function_name.c_str());
 		int ignored = std::getchar();
@@ -81,6 +109,8 @@ oroFunction_t GPUKernelCompiler::compile_kernel(GPUKernel& kernel, const GPUKern
 	}
 
 	oroFunction kernel_function = reinterpret_cast<oroFunction>(trace_function_out);
+	if (use_shader_cache)
+		m_shader_cache.record_compilation(kernel_cache_key, kernel_function_name, sources_hash, compilation_cache_key);
 
 	if (kernel.is_precompiled())
 	{
@@ -132,47 +162,11 @@ void GPUKernelCompiler::read_includes_of_file(const std::string& include_file_pa
 		std::string line;
 		while (std::getline(include_file, line))
 		{
-			if (line.starts_with("#include "))
-			{
-				size_t find_start = line.find('<');
-				if (find_start == std::string::npos)
-				{
-					// Trying to find a quote instead
-					find_start = line.find('"');
-					if (find_start == std::string::npos)
-						// Couldn't find a quote either, ill-formed include
-						continue;
-				}
-
-				size_t find_end = line.rfind('>');
-				if (find_end == std::string::npos)
-				{
-					// Trying to find a quote instead
-					find_end = line.rfind('"');
-					if (find_end == std::string::npos)
-						// Couldn't find a quote either, ill-formed include
-						continue;
-				}
-
-				// We found the include string, now we're going to check whether it can be found
-				// in the given includes directories (which contain the only includes that we're
-				// interested in)
-
-				// Include file with leading Device/includes/... or whatever folder the include may come from
-				std::string full_include_name = line.substr(find_start + 1, find_end - find_start - 1);
-
-				// We have only the file name (which looks like "MyInclude.h" for example), let's see
-				// if it can be found in the include directories
-				std::string include_file_path = find_in_include_directories(full_include_name, include_directories);
-
-				if (!include_file_path.empty())
-					// Adding to file path that can directly be opened in an std::ifstream
-					output_includes.insert(include_file_path);
-			}
-			else
-				continue;
+			std::string include_file_path = parse_include_line(line, include_directories);
+			if (!include_file_path.empty())
+				// Adding to file path that can directly be opened in an std::ifstream
+				output_includes.insert(include_file_path);
 		}
-
 	}
 	else
 	{
@@ -182,7 +176,53 @@ void GPUKernelCompiler::read_includes_of_file(const std::string& include_file_pa
 	}
 }
 
+std::string GPUKernelCompiler::parse_include_line(const std::string& line, const std::vector<std::string>& include_directories)
+{
+	if (!line.starts_with("#include "))
+		return "";
+
+	size_t find_start = line.find('<');
+	if (find_start == std::string::npos)
+	{
+		// Trying to find a quote instead
+		find_start = line.find('"');
+		if (find_start == std::string::npos)
+			// Couldn't find a quote either, ill-formed include
+			return "";
+	}
+
+	size_t find_end = line.rfind('>');
+	if (find_end == std::string::npos)
+	{
+		// Trying to find a quote instead
+		find_end = line.rfind('"');
+		if (find_end == std::string::npos)
+			// Couldn't find a quote either, ill-formed include
+			return "";
+	}
+
+	// We found the include string, now we're going to check whether it can be found
+	// in the given includes directories (which contain the only includes that we're
+	// interested in)
+
+	// Include file with leading Device/includes/... or whatever folder the include may come from
+	std::string full_include_name = line.substr(find_start + 1, find_end - find_start - 1);
+
+	// We have only the file name (which looks like "MyInclude.h" for example), let's see
+	// if it can be found in the include directories
+	return find_in_include_directories(full_include_name, include_directories);
+}
+
 std::unordered_set<std::string> GPUKernelCompiler::read_option_macro_of_file(const std::string& filepath)
+{
+	SourceFileNode node;
+	if (!get_source_file_node(filepath, node))
+		return std::unordered_set<std::string>();
+
+	return node.option_macros;
+}
+
+bool GPUKernelCompiler::get_source_file_node(const std::string& filepath, SourceFileNode& node_out)
 {
 	std::string file_modification_time;
 
@@ -194,99 +234,236 @@ std::unordered_set<std::string> GPUKernelCompiler::read_option_macro_of_file(con
 	}
 	catch (std::filesystem::filesystem_error e)
 	{
-		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "HIPKernelCompiler - Unable to open include file \"%s\" for option macros analyzing: %s", filepath.c_str(), e.what());
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "HIPKernelCompiler - Unable to open include file \"%s\" for shader cache validation: %s", filepath.c_str(), e.what());
 
-		return std::unordered_set<std::string>();
+		return false;
 	}
 
 	{
-		// We don't to read into the cache while someone may be writing to it (at the end of this function)
-		// so we lock
-		std::lock_guard<std::mutex> lock(m_option_macro_cache_mutex);
+		// The graph is shared by all the threads compiling kernels
+		std::lock_guard<std::mutex> lock(m_source_files_mutex);
+		load_source_files_graph_if_needed();
 
-		auto cache_timestamp_find = m_filepath_to_options_macros_cache_timestamp.find(filepath);
-		if (cache_timestamp_find != m_filepath_to_options_macros_cache_timestamp.end() && cache_timestamp_find->second == file_modification_time)
+		auto find = m_source_files.find(filepath);
+		if (find != m_source_files.end() && find->second.modification_time == file_modification_time)
 		{
-			// Cache hit
-			return m_filepath_to_option_macros_cache[filepath];
+			// Cache hit, the file hasn't been modified since it was parsed
+			node_out = find->second;
+
+			return true;
 		}
 	}
 
-	std::unordered_set<std::string> option_macros;
-	std::ifstream include_file(filepath);
-	if (include_file.is_open())
+	// Parsing the file: the includes, the option macros and the hash of its content, all in one read
+	SourceFileNode node;
+	node.modification_time = file_modification_time;
+
+	std::ifstream source_file(filepath);
+	if (!source_file.is_open())
 	{
-		std::string line;
-		while (std::getline(include_file, line))
-			for (const std::string& existing_macro_option : GPUKernelCompilerOptions::ALL_MACROS_NAMES)
-				if (line.find(existing_macro_option) != std::string::npos)
-					option_macros.insert(existing_macro_option);
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not open file \"%s\" for reading its includes and option macros: %s", filepath.c_str(), strerror(errno));
 
+		return false;
 	}
-	else
-		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not open file \"%s\" for reading option macros used by that file: %s", filepath.c_str(), strerror(errno));
 
-	// The cache is shared to all threads using this GPUKernelCompiler so we're locking that operation
-	// The lock is destroyed when the function returns
-	std::lock_guard<std::mutex> lock(m_option_macro_cache_mutex);
+	// FNV-1a of the lines of the file
+	unsigned long long hash = 14695981039346656037ull;
+	std::string line;
+	while (std::getline(source_file, line))
+	{
+		for (char character : line)
+		{
+			hash ^= static_cast<unsigned char>(character);
+			hash *= 1099511628211ull;
+		}
+		hash ^= '\n';
+		hash *= 1099511628211ull;
+
+		std::string include_file_path = parse_include_line(line, GPUKernel::COMMON_ADDITIONAL_KERNEL_INCLUDE_DIRS);
+		if (!include_file_path.empty())
+			node.includes.push_back(include_file_path);
+
+		for (const std::string& existing_macro_option : GPUKernelCompilerOptions::ALL_MACROS_NAMES)
+			if (line.find(existing_macro_option) != std::string::npos)
+				node.option_macros.insert(existing_macro_option);
+	}
+	node.content_hash = std::to_string(hash);
+
+	std::lock_guard<std::mutex> lock(m_source_files_mutex);
+	m_source_files[filepath] = node;
+	m_source_files_graph_dirty = true;
 
-	// Updating the cache
-	m_filepath_to_option_macros_cache[filepath] = option_macros;
-	m_filepath_to_options_macros_cache_timestamp[filepath] = file_modification_time;
+	node_out = node;
 
-	return option_macros;
+	return true;
 }
 
-std::string GPUKernelCompiler::get_additional_cache_key(GPUKernel& kernel)
+void GPUKernelCompiler::load_source_files_graph_if_needed()
 {
-	m_additional_cache_key_started++;
+	if (m_source_files_graph_loaded)
+		return;
+	m_source_files_graph_loaded = true;
+
+	std::ifstream graph_file(GPUKernelCompiler::SOURCE_FILES_GRAPH_FILE_PATH);
+	if (!graph_file.is_open())
+		// First launch
+		return;
+
+	// A "file" line followed by the "include" and "macro" lines of that file
+	SourceFileNode* current_node = nullptr;
+	std::string line;
+	while (std::getline(graph_file, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream line_stream(line);
+		std::string field;
+		while (std::getline(line_stream, field, '\t'))
+			fields.push_back(field);
 
-	std::unordered_set<std::string> already_processed_includes;
+		if (fields.size() == 4 && fields[0] == "file")
+		{
+			current_node = &m_source_files[fields[1]];
+			current_node->modification_time = fields[2];
+			current_node->content_hash = fields[3];
+		}
+		else if (fields.size() == 2 && fields[0] == "include" && current_node != nullptr)
+			current_node->includes.push_back(fields[1]);
+		else if (fields.size() == 2 && fields[0] == "macro" && current_node != nullptr)
+			current_node->option_macros.insert(fields[1]);
+	}
+}
+
+void GPUKernelCompiler::save_source_files_graph_if_dirty()
+{
+	std::lock_guard<std::mutex> lock(m_source_files_mutex);
+	if (!m_source_files_graph_dirty)
+		return;
+	m_source_files_graph_dirty = false;
+
+	std::ofstream graph_file(GPUKernelCompiler::SOURCE_FILES_GRAPH_FILE_PATH);
+	if (!graph_file.is_open())
+		// Not critical, the files will be parsed again at the next launch
+		return;
+
+	for (auto& path_to_node : m_source_files)
+	{
+		const SourceFileNode& node = path_to_node.second;
+
+		graph_file << "file\t" << path_to_node.first << '\t' << node.modification_time << '\t' << node.content_hash << '\n';
+		for (const std::string& include : node.includes)
+			graph_file << "include\t" << include << '\n';
+		for (const std::string& option_macro : node.option_macros)
+			graph_file << "macro\t" << option_macro << '\n';
+	}
+}
+
+bool GPUKernelCompiler::get_kernel_source_files(const std::string& kernel_file_path, std::unordered_map<std::string, SourceFileNode>& source_files)
+{
 	std::deque<std::string> yet_to_process_includes;
-	yet_to_process_includes.push_back(kernel.get_kernel_file_path());
+	yet_to_process_includes.push_back(kernel_file_path);
 
+	bool all_files_found = true;
 	while (!yet_to_process_includes.empty())
 	{
 		std::string current_file = yet_to_process_includes.front();
 		yet_to_process_includes.pop_front();
 
-		if (already_processed_includes.find(current_file) != already_processed_includes.end())
+		if (source_files.find(current_file) != source_files.end())
 			// We've already processed that file
 			continue;
 
-		already_processed_includes.insert(current_file);
+		SourceFileNode node;
+		if (!get_source_file_node(current_file, node))
+		{
+			all_files_found = false;
 
-		std::unordered_set<std::string> new_includes;
-		read_includes_of_file(current_file, GPUKernel::COMMON_ADDITIONAL_KERNEL_INCLUDE_DIRS, new_includes);
+			continue;
+		}
 
-		for (const std::string& new_include : new_includes)
-			yet_to_process_includes.push_back(new_include);
+		for (const std::string& include : node.includes)
+			yet_to_process_includes.push_back(include);
+
+		source_files[current_file] = node;
 	}
 
-	// The cache key is going to be the concatenation of the last modified times of all the includes
-	// that the kernel file we just parsed depends on. That way, if any dependency of this kernel has
-	// been modified, the cache key will be different and the cache will be invalidated.
-	std::string final_cache_key = "";
-	for (const std::string& include : already_processed_includes)
+	save_source_files_graph_if_dirty();
+
+	return all_files_found;
+}
+
+std::string GPUKernelCompiler::hash_source_files(const std::unordered_map<std::string, SourceFileNode>& source_files)
+{
+	// Sorting so that the hash doesn't depend on the order of the unordered_map
+	std::vector<std::string> sorted_source_files;
+	for (auto& path_to_node : source_files)
+		sorted_source_files.push_back(path_to_node.first);
+	std::sort(sorted_source_files.begin(), sorted_source_files.end());
+
+	// FNV-1a of the paths and the content hashes of all the files
+	unsigned long long hash = 14695981039346656037ull;
+	for (const std::string& source_file : sorted_source_files)
 	{
-		// TODO this exception here should probably go up a level so that we can know that the kernel compilation failed --> set the kernel function to nullptr --> do try to launch the kernel (otherwise this will probably crash the driver)
-		try
+		std::string path_and_hash = source_file + source_files.at(source_file).content_hash;
+		for (char character : path_and_hash)
 		{
-			std::chrono::time_point modification_time = std::filesystem::last_write_time(include);
-
-			final_cache_key += std::to_string(modification_time.time_since_epoch().count());
+			hash ^= static_cast<unsigned char>(character);
+			hash *= 1099511628211ull;
 		}
-		catch (std::filesystem::filesystem_error e)
-		{
-			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "HIPKernelCompiler - Unable to open include file \"%s\" for shader cache validation: %s", include.c_str(), e.what());
+	}
 
-			m_additional_cache_key_ended++;
-			// Notifying the condition variable that's used to
-			// avoid exiting the application with ongoing IO operations
-			m_read_macros_cv.notify_all();
+	return std::to_string(hash);
+}
 
-			return "";
-		}
+std::string GPUKernelCompiler::get_sources_hash(GPUKernel& kernel)
+{
+	std::unordered_map<std::string, SourceFileNode> source_files;
+	get_kernel_source_files(kernel.get_kernel_file_path(), source_files);
+
+	return hash_source_files(source_files);
+}
+
+bool GPUKernelCompiler::load_kernel_bundle(const std::string& bundle_directory)
+{
+	return m_kernel_bundle.load(bundle_directory);
+}
+
+ShaderCacheManager& GPUKernelCompiler::get_shader_cache()
+{
+	return m_shader_cache;
+}
+
+std::string GPUKernelCompiler::get_additional_cache_key(GPUKernel& kernel)
+{
+	m_additional_cache_key_started++;
+
+	// Only stats the files whose dependencies are known, the files are only read if they were modified
+	std::unordered_map<std::string, SourceFileNode> source_files;
+	bool all_files_found = get_kernel_source_files(kernel.get_kernel_file_path(), source_files);
+
+	std::string final_cache_key = "";
+	if (!all_files_found)
+	{
+		// TODO this error here should probably go up a level so that we can know that the kernel compilation failed --> set the kernel function to nullptr --> do try to launch the kernel (otherwise this will probably crash the driver)
+	}
+	else if (m_kernel_bundle.is_loaded() && !(final_cache_key = m_kernel_bundle.get_additional_cache_key(kernel.get_kernel_file_path(), hash_source_files(source_files))).empty())
+	{
+		// The sources of the kernel are the same as when the kernel bundle was built,
+		// using the cache key of the bundle so that the binaries of the bundle are used
+	}
+	else
+	{
+		// The cache key is going to be the concatenation of the last modified times of all the includes
+		// that the kernel file we just parsed depends on. That way, if any dependency of this kernel has
+		// been modified, the cache key will be different and the cache will be invalidated.
+		//
+		// Sorted so that the key doesn't depend on the order of the unordered_map
+		std::vector<std::string> sorted_source_files;
+		for (auto& path_to_node : source_files)
+			sorted_source_files.push_back(path_to_node.first);
+		std::sort(sorted_source_files.begin(), sorted_source_files.end());
+
+		for (const std::string& source_file : sorted_source_files)
+			final_cache_key += source_files.at(source_file).modification_time;
 	}
 
 	m_additional_cache_key_ended++;
@@ -309,6 +486,7 @@ std::unordered_set<std::string> GPUKernelCompiler::get_option_macros_used_by_ker
 	m_read_macros_semaphore.acquire();
 
 	std::unordered_set<std::string> already_processed_includes;
+	std::unordered_set<std::string> option_macro_names;
 	std::deque<std::string> yet_to_process_includes;
 	yet_to_process_includes.push_back(kernel.get_kernel_file_path());
 
@@ -330,22 +508,18 @@ std::unordered_set<std::string> GPUKernelCompiler::get_option_macros_used_by_ker
 
 		already_processed_includes.insert(current_file);
 
-		std::unordered_set<std::string> new_includes;
-		read_includes_of_file(current_file, GPUKernel::COMMON_ADDITIONAL_KERNEL_INCLUDE_DIRS, new_includes);
-
-		for (const std::string& new_include : new_includes)
-			yet_to_process_includes.push_back(new_include);
-	}
-
-	std::unordered_set<std::string> option_macro_names;
-	for (const std::string& include : already_processed_includes)
-	{
-		std::unordered_set<std::string> include_option_macros = read_option_macro_of_file(include);
+		SourceFileNode node;
+		if (!get_source_file_node(current_file, node))
+			continue;
 
-		for (const std::string& option_macro : include_option_macros)
+		for (const std::string& option_macro : node.option_macros)
 			option_macro_names.insert(option_macro);
+		for (const std::string& include : node.includes)
+			yet_to_process_includes.push_back(include);
 	}
 
+	save_source_files_graph_if_dirty();
+
 	m_read_macros_semaphore.release();
 	m_read_macros_cv.notify_all();
 
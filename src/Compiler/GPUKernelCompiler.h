@@ -7,11 +7,14 @@
 #define GPU_KERNEL_COMPILER_H
 
 #include "Compiler/GPUKernel.h"
+#include "Compiler/KernelBinaryBundle.h"
+#include "Compiler/ShaderCacheManager.h"
 
 #include <mutex>
 #include <semaphore>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <condition_variable>
 
 
@@ -73,6 +76,23 @@ public:
 	 */
 	std::string get_additional_cache_key(GPUKernel& kernel);
 
+	/**
+	 * Hash of the content of the files of the given kernel (same files as get_additional_cache_key()).
+	 * Unlike the additional cache key, it is the same on all the machines with the same sources
+	 */
+	std::string get_sources_hash(GPUKernel& kernel);
+
+	/**
+	 * Loads the kernel bundle of 'bundle_directory' (see KernelBinaryBundle), if any, whose binaries
+	 * are then used instead of compiling the kernels whose sources didn't change since the bundle was built
+	 */
+	bool load_kernel_bundle(const std::string& bundle_directory);
+
+	/**
+	 * Size limit, shared shader cache and statistics of the shader cache, see ShaderCacheManager
+	 */
+	ShaderCacheManager& get_shader_cache();
+
 	/**
 	 * Returns a list of the option macro names used by the given kernel.
 	 * 
@@ -110,18 +130,70 @@ public:
 	ShaderCacheUsageOverride get_shader_cache_usage_override() const;
 
 private:
-	// Cache that maps a filepath to the option macros that it contains.
-	// This saves us having to reparse the file to find the options macros
-	// if the file was already parsed for another kernel by this GPUKernelCompiler
-	std::unordered_map<std::string, std::unordered_set<std::string>> m_filepath_to_option_macros_cache;
-	// Maps filepath to the last modification time of the file pointed by the filepath. 
-	// Useful to invalidate the cache if the file was modified (meaning that the option
-	// macros used by that file may have changed so we have to reparse the file)
-	std::unordered_map<std::string, std::string> m_filepath_to_options_macros_cache_timestamp;
+	/**
+	 * What the GPUKernelCompiler knows about a source file of the kernels after having parsed it once
+	 */
+	struct SourceFileNode
+	{
+		// Last modification time of the file when it was parsed. The node
+		// is only valid as long as the file on the disk has that modification time
+		std::string modification_time;
+		// Includes of the file that can be found in the include directories of the kernels
+		std::vector<std::string> includes;
+		// Option macros used by the file
+		std::unordered_set<std::string> option_macros;
+		// Hash of the content of the file
+		std::string content_hash;
+	};
+
+	/**
+	 * Returns the node of 'filepath' in the dependency graph of the kernel sources. The file is
+	 * only read if it isn't in the graph yet or if it was modified since it was parsed,
+	 * otherwise, this is only a 'last_write_time' of the file.
+	 *
+	 * Returns false if the file couldn't be found
+	 */
+	bool get_source_file_node(const std::string& filepath, SourceFileNode& node_out);
+
+	/**
+	 * If 'line' is an include that can be found in 'include_directories', returns the path
+	 * to that include. Returns the empty string otherwise
+	 */
+	std::string parse_include_line(const std::string& line, const std::vector<std::string>& include_directories);
+
+	/**
+	 * The dependency graph is persisted in SOURCE_FILES_GRAPH_FILE_PATH so that the
+	 * kernel files don't have to be parsed again on every launch of the application
+	 */
+	void load_source_files_graph_if_needed();
+	void save_source_files_graph_if_dirty();
+
+	/**
+	 * The kernel file and all the files it includes recursively that can be
+	 * found in the include directories of the kernels.
+	 *
+	 * Returns false if some of the files couldn't be found
+	 */
+	bool get_kernel_source_files(const std::string& kernel_file_path, std::unordered_map<std::string, SourceFileNode>& source_files);
+	static std::string hash_source_files(const std::unordered_map<std::string, SourceFileNode>& source_files);
+
+	KernelBinaryBundle m_kernel_bundle;
+	ShaderCacheManager m_shader_cache;
+
+	// Next to the shader cache but not in it so that "Clear shader cache" doesn't clear it
+	static const std::string SOURCE_FILES_GRAPH_FILE_PATH;
+
+	// Maps a filepath to what its parsing found. This saves us having to reparse the file
+	// to find its includes or options macros if the file was already parsed for another kernel
+	// by this GPUKernelCompiler, or by a previous launch of the application
+	std::unordered_map<std::string, SourceFileNode> m_source_files;
+	bool m_source_files_graph_loaded = false;
+	// Whether some files were parsed since the graph was last written to the disk
+	bool m_source_files_graph_dirty = false;
 
 	// Because this GPUKernelCompiler may be used by multiple threads at the same time,
 	// we may use that mutex sometimes to protect from race conditions
-	std::mutex m_option_macro_cache_mutex;
+	std::mutex m_source_files_mutex;
 	std::mutex m_compile_mutex;
 
 	// Semaphore used by 'get_option_macros_used_by_kernel' so that not too many threads
@@ -17,15 +17,31 @@
  */
 const std::string GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL = "UseSharedStackBVHTraversal";
 const std::string GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE = "SharedStackBVHTraversalSize";
+const std::string GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS = "SharedStackBVHTraversalSizeShadowRays";
 const std::string GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE = "SharedStackBVHTraversalBlockSize";
+const std::string GPUKernelCompilerOptions::DYNAMIC_BVH_TRAVERSAL_STACK = "DynamicBVHTraversalStack";
+
+const std::string GPUKernelCompilerOptions::MATERIAL_TEXTURES_RAY_CONES_LOD = "MaterialTexturesRayConesLOD";
+const std::string GPUKernelCompilerOptions::WAVEFRONT_DEFERRED_MATERIALS = "WavefrontDeferredMaterials";
+const std::string GPUKernelCompilerOptions::GBUFFER_TILED_LAYOUT = "GBufferTiledLayout";
 
 const std::string GPUKernelCompilerOptions::BSDF_OVERRIDE = "BSDFOverride";
+const std::string GPUKernelCompilerOptions::DEEP_BOUNCES_SIMPLIFIED_BSDF = "DeepBouncesSimplifiedBSDF";
+const std::string GPUKernelCompilerOptions::MATERIAL_FEATURES = "MaterialFeatures";
+const std::string GPUKernelCompilerOptions::PATH_SAMPLER = "PathSampler";
 const std::string GPUKernelCompilerOptions::INTERIOR_STACK_STRATEGY = "InteriorStackStrategy";
 const std::string GPUKernelCompilerOptions::NESTED_DIELETRCICS_STACK_SIZE_OPTION = "NestedDielectricsStackSize";
+const std::string GPUKernelCompilerOptions::NESTED_DIELECTRICS_STACK_USE_SHARED_MEMORY = "NestedDielectricsStackUseSharedMemory";
 
 const std::string GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY = "DirectLightSamplingStrategy";
+const std::string GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY = "IndirectLightSamplingStrategy";
 const std::string GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY = "EnvmapSamplingStrategy";
 const std::string GPUKernelCompilerOptions::ENVMAP_SAMPLING_DO_BSDF_MIS = "EnvmapSamplingDoBSDFMIS";
+const std::string GPUKernelCompilerOptions::ENVMAP_STORAGE_FORMAT = "EnvmapStorageFormat";
+const std::string GPUKernelCompilerOptions::ENVMAP_COMPACT_ALIAS_TABLE = "EnvmapCompactAliasTable";
+const std::string GPUKernelCompilerOptions::EMISSIVE_TRIANGLES_SAMPLING_STRATEGY = "EmissiveTrianglesSamplingStrategy";
+const std::string GPUKernelCompilerOptions::MIS_BSDF_RAY_INTERSECTION = "MISBSDFRayIntersection";
+const std::string GPUKernelCompilerOptions::REUSE_MIS_BSDF_SAMPLE_FOR_BOUNCE = "ReuseMISBSDFSampleForBounce";
 
 const std::string GPUKernelCompilerOptions::RIS_USE_VISIBILITY_TARGET_FUNCTION = "RISUseVisiblityTargetFunction";
 const std::string GPUKernelCompilerOptions::GGX_SAMPLE_FUNCTION = "GGXAnisotropicSampleFunction";
@@ -33,23 +49,51 @@ const std::string GPUKernelCompilerOptions::GGX_SAMPLE_FUNCTION = "GGXAnisotropi
 const std::string GPUKernelCompilerOptions::RESTIR_DI_INITIAL_TARGET_FUNCTION_VISIBILITY = "ReSTIR_DI_InitialTargetFunctionVisibility";
 const std::string GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_TARGET_FUNCTION_VISIBILITY = "ReSTIR_DI_SpatialTargetFunctionVisibility";
 const std::string GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE = "ReSTIR_DI_DoVisibilityReuse";
+const std::string GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS = "ReSTIR_DI_BatchedVisibilityRays";
 const std::string GPUKernelCompilerOptions::RESTIR_DI_BIAS_CORRECTION_USE_VISIBILITY = "ReSTIR_DI_BiasCorrectionUseVisibility";
 const std::string GPUKernelCompilerOptions::RESTIR_DI_BIAS_CORRECTION_WEIGHTS = "ReSTIR_DI_BiasCorrectionWeights";
 const std::string GPUKernelCompilerOptions::RESTIR_DI_LATER_BOUNCES_SAMPLING_STRATEGY = "ReSTIR_DI_LaterBouncesSamplingStrategy";
 const std::string GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING = "ReSTIR_DI_DoLightsPresampling";
+const std::string GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_USE_LIGHT_BVH = "ReSTIR_DI_InitialCandidatesUseLightBVH";
+const std::string GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_REUSE_SHARED_MEMORY_TILE = "ReSTIR_DI_SpatialReuseSharedMemoryTile";
+const std::string GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_SHARED_MEMORY_LIGHTS = "ReSTIR_DI_InitialCandidatesSharedMemoryLights";
+
+const std::string GPUKernelCompilerOptions::KERNEL_OPTIONS_RUNTIME_BRANCHES = "KernelOptionsRuntimeBranches";
+const std::string GPUKernelCompilerOptions::USE_DEVICE_RESIDENT_RENDER_DATA = "UseDeviceResidentRenderData";
+const std::string GPUKernelCompilerOptions::PIXEL_COST_INSTRUMENTATION = "PixelCostInstrumentation";
+const std::string GPUKernelCompilerOptions::KERNEL_DIAGNOSTICS = "KernelDiagnostics";
+const std::string GPUKernelCompilerOptions::PACKED_DENOISER_AOVS = "PackedDenoiserAOVs";
+const std::string GPUKernelCompilerOptions::DENOISER_AOVS_FROM_G_BUFFER = "DenoiserAOVsFromGBuffer";
+const std::string GPUKernelCompilerOptions::RESTIR_DI_TARGET_FUNCTION_PACKED_HALF = "ReSTIR_DI_TargetFunctionPackedHalf";
 
 const std::unordered_set<std::string> GPUKernelCompilerOptions::ALL_MACROS_NAMES = {
 	GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL,
 	GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE,
+	GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS,
 	GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE,
+	GPUKernelCompilerOptions::DYNAMIC_BVH_TRAVERSAL_STACK,
+
+	GPUKernelCompilerOptions::MATERIAL_TEXTURES_RAY_CONES_LOD,
+	GPUKernelCompilerOptions::WAVEFRONT_DEFERRED_MATERIALS,
+	GPUKernelCompilerOptions::GBUFFER_TILED_LAYOUT,
 
 	GPUKernelCompilerOptions::BSDF_OVERRIDE,
+	GPUKernelCompilerOptions::DEEP_BOUNCES_SIMPLIFIED_BSDF,
+	GPUKernelCompilerOptions::MATERIAL_FEATURES,
+	GPUKernelCompilerOptions::PATH_SAMPLER,
 	GPUKernelCompilerOptions::INTERIOR_STACK_STRATEGY,
 	GPUKernelCompilerOptions::NESTED_DIELETRCICS_STACK_SIZE_OPTION,
+	GPUKernelCompilerOptions::NESTED_DIELECTRICS_STACK_USE_SHARED_MEMORY,
 
 	GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY,
+	GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY,
 	GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY,
 	GPUKernelCompilerOptions::ENVMAP_SAMPLING_DO_BSDF_MIS,
+	GPUKernelCompilerOptions::ENVMAP_STORAGE_FORMAT,
+	GPUKernelCompilerOptions::ENVMAP_COMPACT_ALIAS_TABLE,
+	GPUKernelCompilerOptions::EMISSIVE_TRIANGLES_SAMPLING_STRATEGY,
+	GPUKernelCompilerOptions::MIS_BSDF_RAY_INTERSECTION,
+	GPUKernelCompilerOptions::REUSE_MIS_BSDF_SAMPLE_FOR_BOUNCE,
 
 	GPUKernelCompilerOptions::RIS_USE_VISIBILITY_TARGET_FUNCTION,
 	GPUKernelCompilerOptions::GGX_SAMPLE_FUNCTION,
@@ -57,10 +101,22 @@ const std::unordered_set<std::string> GPUKernelCompilerOptions::ALL_MACROS_NAMES
 	GPUKernelCompilerOptions::RESTIR_DI_INITIAL_TARGET_FUNCTION_VISIBILITY,
 	GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_TARGET_FUNCTION_VISIBILITY,
 	GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE,
+	GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS,
 	GPUKernelCompilerOptions::RESTIR_DI_BIAS_CORRECTION_USE_VISIBILITY,
 	GPUKernelCompilerOptions::RESTIR_DI_BIAS_CORRECTION_WEIGHTS,
 	GPUKernelCompilerOptions::RESTIR_DI_LATER_BOUNCES_SAMPLING_STRATEGY,
 	GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING,
+	GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_USE_LIGHT_BVH,
+	GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_REUSE_SHARED_MEMORY_TILE,
+	GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_SHARED_MEMORY_LIGHTS,
+
+	GPUKernelCompilerOptions::KERNEL_OPTIONS_RUNTIME_BRANCHES,
+	GPUKernelCompilerOptions::USE_DEVICE_RESIDENT_RENDER_DATA,
+	GPUKernelCompilerOptions::PIXEL_COST_INSTRUMENTATION,
+	GPUKernelCompilerOptions::KERNEL_DIAGNOSTICS,
+	GPUKernelCompilerOptions::PACKED_DENOISER_AOVS,
+	GPUKernelCompilerOptions::DENOISER_AOVS_FROM_G_BUFFER,
+	GPUKernelCompilerOptions::RESTIR_DI_TARGET_FUNCTION_PACKED_HALF,
 };
 
 GPUKernelCompilerOptions::GPUKernelCompilerOptions()
@@ -69,15 +125,31 @@ GPUKernelCompilerOptions::GPUKernelCompilerOptions()
 	// adding them here with their default values
 	m_options_macro_map[GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL] = std::make_shared<int>(UseSharedStackBVHTraversal);
 	m_options_macro_map[GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE] = std::make_shared<int>(SharedStackBVHTraversalSize);
+	m_options_macro_map[GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS] = std::make_shared<int>(SharedStackBVHTraversalSizeShadowRays);
 	m_options_macro_map[GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE] = std::make_shared<int>(SharedStackBVHTraversalBlockSize);
+	m_options_macro_map[GPUKernelCompilerOptions::DYNAMIC_BVH_TRAVERSAL_STACK] = std::make_shared<int>(DynamicBVHTraversalStack);
+
+	m_options_macro_map[GPUKernelCompilerOptions::MATERIAL_TEXTURES_RAY_CONES_LOD] = std::make_shared<int>(MaterialTexturesRayConesLOD);
+	m_options_macro_map[GPUKernelCompilerOptions::WAVEFRONT_DEFERRED_MATERIALS] = std::make_shared<int>(WavefrontDeferredMaterials);
+	m_options_macro_map[GPUKernelCompilerOptions::GBUFFER_TILED_LAYOUT] = std::make_shared<int>(GBufferTiledLayout);
 
 	m_options_macro_map[GPUKernelCompilerOptions::BSDF_OVERRIDE] = std::make_shared<int>(BSDFOverride);
+	m_options_macro_map[GPUKernelCompilerOptions::DEEP_BOUNCES_SIMPLIFIED_BSDF] = std::make_shared<int>(DeepBouncesSimplifiedBSDF);
+	m_options_macro_map[GPUKernelCompilerOptions::MATERIAL_FEATURES] = std::make_shared<int>(MaterialFeatures);
+	m_options_macro_map[GPUKernelCompilerOptions::PATH_SAMPLER] = std::make_shared<int>(PathSampler);
 	m_options_macro_map[GPUKernelCompilerOptions::INTERIOR_STACK_STRATEGY] = std::make_shared<int>(InteriorStackStrategy);
 	m_options_macro_map[GPUKernelCompilerOptions::NESTED_DIELETRCICS_STACK_SIZE_OPTION] = std::make_shared<int>(NestedDielectricsStackSize);
+	m_options_macro_map[GPUKernelCompilerOptions::NESTED_DIELECTRICS_STACK_USE_SHARED_MEMORY] = std::make_shared<int>(NestedDielectricsStackUseSharedMemory);
 
 	m_options_macro_map[GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY] = std::make_shared<int>(DirectLightSamplingStrategy);
+	m_options_macro_map[GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY] = std::make_shared<int>(IndirectLightSamplingStrategy);
 	m_options_macro_map[GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY] = std::make_shared<int>(EnvmapSamplingStrategy);
 	m_options_macro_map[GPUKernelCompilerOptions::ENVMAP_SAMPLING_DO_BSDF_MIS] = std::make_shared<int>(EnvmapSamplingDoBSDFMIS);
+	m_options_macro_map[GPUKernelCompilerOptions::ENVMAP_STORAGE_FORMAT] = std::make_shared<int>(EnvmapStorageFormat);
+	m_options_macro_map[GPUKernelCompilerOptions::ENVMAP_COMPACT_ALIAS_TABLE] = std::make_shared<int>(EnvmapCompactAliasTable);
+	m_options_macro_map[GPUKernelCompilerOptions::EMISSIVE_TRIANGLES_SAMPLING_STRATEGY] = std::make_shared<int>(EmissiveTrianglesSamplingStrategy);
+	m_options_macro_map[GPUKernelCompilerOptions::MIS_BSDF_RAY_INTERSECTION] = std::make_shared<int>(MISBSDFRayIntersection);
+	m_options_macro_map[GPUKernelCompilerOptions::REUSE_MIS_BSDF_SAMPLE_FOR_BOUNCE] = std::make_shared<int>(ReuseMISBSDFSampleForBounce);
 
 	m_options_macro_map[GPUKernelCompilerOptions::RIS_USE_VISIBILITY_TARGET_FUNCTION] = std::make_shared<int>(RISUseVisiblityTargetFunction);
 	m_options_macro_map[GPUKernelCompilerOptions::GGX_SAMPLE_FUNCTION] = std::make_shared<int>(GGXAnisotropicSampleFunction);
@@ -85,10 +157,22 @@ GPUKernelCompilerOptions::GPUKernelCompilerOptions()
 	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_INITIAL_TARGET_FUNCTION_VISIBILITY] = std::make_shared<int>(ReSTIR_DI_InitialTargetFunctionVisibility);
 	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_TARGET_FUNCTION_VISIBILITY] = std::make_shared<int>(ReSTIR_DI_SpatialTargetFunctionVisibility);
 	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE] = std::make_shared<int>(ReSTIR_DI_DoVisibilityReuse);
+	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS] = std::make_shared<int>(ReSTIR_DI_BatchedVisibilityRays);
 	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_BIAS_CORRECTION_USE_VISIBILITY] = std::make_shared<int>(ReSTIR_DI_BiasCorrectionUseVisibility);
 	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_BIAS_CORRECTION_WEIGHTS] = std::make_shared<int>(ReSTIR_DI_BiasCorrectionWeights);
 	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_LATER_BOUNCES_SAMPLING_STRATEGY] = std::make_shared<int>(ReSTIR_DI_LaterBouncesSamplingStrategy);
 	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING] = std::make_shared<int>(ReSTIR_DI_DoLightsPresampling);
+	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_USE_LIGHT_BVH] = std::make_shared<int>(ReSTIR_DI_InitialCandidatesUseLightBVH);
+	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_REUSE_SHARED_MEMORY_TILE] = std::make_shared<int>(ReSTIR_DI_SpatialReuseSharedMemoryTile);
+	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_SHARED_MEMORY_LIGHTS] = std::make_shared<int>(ReSTIR_DI_InitialCandidatesSharedMemoryLights);
+
+	m_options_macro_map[GPUKernelCompilerOptions::KERNEL_OPTIONS_RUNTIME_BRANCHES] = std::make_shared<int>(KernelOptionsRuntimeBranches);
+	m_options_macro_map[GPUKernelCompilerOptions::USE_DEVICE_RESIDENT_RENDER_DATA] = std::make_shared<int>(UseDeviceResidentRenderData);
+	m_options_macro_map[GPUKernelCompilerOptions::PIXEL_COST_INSTRUMENTATION] = std::make_shared<int>(PixelCostInstrumentation);
+	m_options_macro_map[GPUKernelCompilerOptions::KERNEL_DIAGNOSTICS] = std::make_shared<int>(KernelDiagnostics);
+	m_options_macro_map[GPUKernelCompilerOptions::PACKED_DENOISER_AOVS] = std::make_shared<int>(PackedDenoiserAOVs);
+	m_options_macro_map[GPUKernelCompilerOptions::DENOISER_AOVS_FROM_G_BUFFER] = std::make_shared<int>(DenoiserAOVsFromGBuffer);
+	m_options_macro_map[GPUKernelCompilerOptions::RESTIR_DI_TARGET_FUNCTION_PACKED_HALF] = std::make_shared<int>(ReSTIR_DI_TargetFunctionPackedHalf);
 
 	// Making sure we didn't forget to fill the ALL_MACROS_NAMES vector with all the options that exist
 	assert(GPUKernelCompilerOptions::ALL_MACROS_NAMES.size() == m_options_macro_map.size());
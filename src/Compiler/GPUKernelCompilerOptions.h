@@ -20,14 +20,30 @@ public:
 	static const std::string USE_SHARED_STACK_BVH_TRAVERSAL;
 	static const std::string SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE;
 	static const std::string SHARED_STACK_BVH_TRAVERSAL_SIZE;
+	static const std::string SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS;
+	static const std::string DYNAMIC_BVH_TRAVERSAL_STACK;
+
+	static const std::string MATERIAL_TEXTURES_RAY_CONES_LOD;
+	static const std::string WAVEFRONT_DEFERRED_MATERIALS;
+	static const std::string GBUFFER_TILED_LAYOUT;
 
 	static const std::string BSDF_OVERRIDE;
+	static const std::string DEEP_BOUNCES_SIMPLIFIED_BSDF;
+	static const std::string MATERIAL_FEATURES;
+	static const std::string PATH_SAMPLER;
 	static const std::string INTERIOR_STACK_STRATEGY;
 	static const std::string NESTED_DIELETRCICS_STACK_SIZE_OPTION;
+	static const std::string NESTED_DIELECTRICS_STACK_USE_SHARED_MEMORY;
 
 	static const std::string DIRECT_LIGHT_SAMPLING_STRATEGY;
+	static const std::string INDIRECT_LIGHT_SAMPLING_STRATEGY;
 	static const std::string ENVMAP_SAMPLING_STRATEGY;
 	static const std::string ENVMAP_SAMPLING_DO_BSDF_MIS;
+	static const std::string ENVMAP_STORAGE_FORMAT;
+	static const std::string ENVMAP_COMPACT_ALIAS_TABLE;
+	static const std::string EMISSIVE_TRIANGLES_SAMPLING_STRATEGY;
+	static const std::string MIS_BSDF_RAY_INTERSECTION;
+	static const std::string REUSE_MIS_BSDF_SAMPLE_FOR_BOUNCE;
 
 	static const std::string RIS_USE_VISIBILITY_TARGET_FUNCTION;
 	static const std::string GGX_SAMPLE_FUNCTION;
@@ -35,10 +51,22 @@ public:
 	static const std::string RESTIR_DI_INITIAL_TARGET_FUNCTION_VISIBILITY;
 	static const std::string RESTIR_DI_SPATIAL_TARGET_FUNCTION_VISIBILITY;
 	static const std::string RESTIR_DI_DO_VISIBILITY_REUSE;
+	static const std::string RESTIR_DI_BATCHED_VISIBILITY_RAYS;
 	static const std::string RESTIR_DI_BIAS_CORRECTION_USE_VISIBILITY;
 	static const std::string RESTIR_DI_BIAS_CORRECTION_WEIGHTS;
 	static const std::string RESTIR_DI_LATER_BOUNCES_SAMPLING_STRATEGY;
 	static const std::string RESTIR_DI_DO_LIGHTS_PRESAMPLING;
+	static const std::string RESTIR_DI_INITIAL_CANDIDATES_USE_LIGHT_BVH;
+	static const std::string RESTIR_DI_SPATIAL_REUSE_SHARED_MEMORY_TILE;
+	static const std::string RESTIR_DI_INITIAL_CANDIDATES_SHARED_MEMORY_LIGHTS;
+
+	static const std::string KERNEL_OPTIONS_RUNTIME_BRANCHES;
+	static const std::string USE_DEVICE_RESIDENT_RENDER_DATA;
+	static const std::string PIXEL_COST_INSTRUMENTATION;
+	static const std::string KERNEL_DIAGNOSTICS;
+	static const std::string PACKED_DENOISER_AOVS;
+	static const std::string DENOISER_AOVS_FROM_G_BUFFER;
+	static const std::string RESTIR_DI_TARGET_FUNCTION_PACKED_HALF;
 
 	static const std::unordered_set<std::string> ALL_MACROS_NAMES;
 
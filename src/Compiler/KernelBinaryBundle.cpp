@@ -0,0 +1,185 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/GPUKernelCompiler.h"
+#include "Compiler/KernelBinaryBundle.h"
+#include "Compiler/KernelCompileFarm.h"
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "Renderer/GPURenderer.h"
+#include "Threads/ThreadManager.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <hiprt/hiprt.h>
+
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+extern GPUKernelCompiler g_gpu_kernel_compiler;
+extern ImGuiLogger g_imgui_logger;
+extern KernelCompileFarm g_kernel_compile_farm;
+
+const std::string KernelBinaryBundle::MANIFEST_FILE_NAME = "manifest.txt";
+const std::string KernelBinaryBundle::BUILD_COMMANDLINE_ARGUMENT = "--build-kernel-bundle=";
+
+bool KernelBinaryBundle::load(const std::string& bundle_directory)
+{
+	std::ifstream manifest(std::filesystem::path(bundle_directory) / KernelBinaryBundle::MANIFEST_FILE_NAME);
+	if (!manifest.is_open())
+		// No bundle shipped
+		return false;
+
+	std::string line;
+	std::getline(manifest, line);
+	if (line != "HIPRTPathTracerKernelBundle\t" + get_version_string())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "The kernel bundle in \"%s\" was built by another version of the application and cannot be used.", bundle_directory.c_str());
+
+		return false;
+	}
+
+	m_kernel_files.clear();
+	while (std::getline(manifest, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream line_stream(line);
+		std::string field;
+		while (std::getline(line_stream, field, '\t'))
+			fields.push_back(field);
+
+		if (fields.size() == 4 && fields[0] == "kernel")
+			m_kernel_files[fields[1]] = { fields[2], fields[3] };
+	}
+
+	m_bundle_directory = bundle_directory;
+	m_loaded = true;
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Kernel bundle loaded from \"%s\"", bundle_directory.c_str());
+
+	return true;
+}
+
+bool KernelBinaryBundle::is_loaded() const
+{
+	return m_loaded;
+}
+
+std::string KernelBinaryBundle::get_additional_cache_key(const std::string& kernel_file_path, const std::string& sources_hash)
+{
+	auto find = m_kernel_files.find(kernel_file_path);
+	if (find == m_kernel_files.end() || find->second.sources_hash != sources_hash)
+		// Not in the bundle or the sources were modified since the bundle was built
+		return "";
+
+	return find->second.additional_cache_key;
+}
+
+void KernelBinaryBundle::seed_shader_cache(const std::string& device_name, const std::string& shader_cache_directory)
+{
+	if (!m_loaded)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_seed_mutex);
+	if (m_seeded_devices.find(device_name) != m_seeded_devices.end())
+		return;
+	m_seeded_devices.insert(device_name);
+
+	std::filesystem::path device_directory = std::filesystem::path(m_bundle_directory) / get_device_directory_name(device_name);
+	if (!std::filesystem::exists(device_directory))
+		// The bundle wasn't built for that GPU
+		return;
+
+	std::error_code error;
+	std::filesystem::create_directories(shader_cache_directory, error);
+	// Not overwriting the binaries that the application already compiled
+	std::filesystem::copy(device_directory, shader_cache_directory, std::filesystem::copy_options::recursive | std::filesystem::copy_options::skip_existing, error);
+	if (error)
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not copy the kernel bundle of \"%s\" to the shader cache: %s", device_name.c_str(), error.message().c_str());
+}
+
+int KernelBinaryBundle::build(const std::string& bundle_directory, const std::vector<int>& device_indices)
+{
+	// Running the threads of the renderer and of the background precompilation serially so that all
+	// the kernels are compiled when the GPURenderer constructor and precompile_kernels() return.
+	// The worker processes would write to the shader cache of the application, not the bundle
+	ThreadManager::set_monothread(true);
+	g_kernel_compile_farm.set_worker_count(0);
+
+	std::error_code error;
+	std::filesystem::create_directories(bundle_directory, error);
+	if (error)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not create the kernel bundle directory \"%s\": %s", bundle_directory.c_str(), error.message().c_str());
+
+		return 1;
+	}
+
+	std::map<std::string, KernelFileEntry> kernel_files;
+	std::vector<std::string> device_names;
+	for (int device_index : device_indices)
+	{
+		std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(device_index);
+		std::string device_name = hiprt_orochi_ctx->device_properties.name;
+
+		// The compiled binaries go to the directory of that device in the bundle
+		std::filesystem::path device_directory = std::filesystem::path(bundle_directory) / get_device_directory_name(device_name);
+		std::filesystem::create_directories(device_directory, error);
+		hiprtSetCacheDirPath(hiprt_orochi_ctx->hiprt_ctx, device_directory.string().c_str());
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Building the kernel bundle for \"%s\"...", device_name.c_str());
+
+		// The constructor compiles the kernels with their default options
+		GPURenderer renderer(hiprt_orochi_ctx, /* headless */ true);
+		ThreadManager::join_all_threads();
+		renderer.precompile_kernels();
+
+		for (auto& id_to_kernel : renderer.get_kernels())
+		{
+			GPUKernel& kernel = *id_to_kernel.second;
+
+			KernelFileEntry& entry = kernel_files[kernel.get_kernel_file_path()];
+			entry.sources_hash = g_gpu_kernel_compiler.get_sources_hash(kernel);
+			entry.additional_cache_key = g_gpu_kernel_compiler.get_additional_cache_key(kernel);
+		}
+
+		device_names.push_back(device_name);
+	}
+
+	std::ofstream manifest(std::filesystem::path(bundle_directory) / KernelBinaryBundle::MANIFEST_FILE_NAME);
+	if (!manifest.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the manifest of the kernel bundle in \"%s\"", bundle_directory.c_str());
+
+		return 1;
+	}
+
+	manifest << "HIPRTPathTracerKernelBundle\t" << get_version_string() << '\n';
+	for (const std::string& device_name : device_names)
+		manifest << "device\t" << device_name << '\n';
+	for (auto& path_to_entry : kernel_files)
+		manifest << "kernel\t" << path_to_entry.first << '\t' << path_to_entry.second.sources_hash << '\t' << path_to_entry.second.additional_cache_key << '\n';
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Kernel bundle written to \"%s\"", bundle_directory.c_str());
+
+	return 0;
+}
+
+std::string KernelBinaryBundle::get_device_directory_name(const std::string& device_name)
+{
+	std::string directory_name = device_name;
+	for (char& character : directory_name)
+		if (!std::isalnum(static_cast<unsigned char>(character)))
+			character = '_';
+
+	return directory_name;
+}
+
+std::string KernelBinaryBundle::get_version_string()
+{
+	// The binaries of a bundle can only be loaded by the same HIPRT
+	return std::to_string(KernelBinaryBundle::BUNDLE_VERSION) + "_" + HIPRT_VERSION_STR;
+}
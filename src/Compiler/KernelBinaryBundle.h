@@ -0,0 +1,94 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNEL_BINARY_BUNDLE_H
+#define KERNEL_BINARY_BUNDLE_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Kernel binaries compiled ahead of time and shipped with the application so that
+ * a fresh install doesn't have to compile the kernels on its first launch.
+ *
+ * A bundle is a directory with:
+ *	- a manifest (MANIFEST_FILE_NAME) with the version of the bundle and, for each kernel file, the hash of
+ *		its sources and the additional cache key (see GPUKernelCompiler::get_additional_cache_key()) that
+ *		the kernels were compiled with
+ *	- one directory per device name containing the shader cache that the compilation
+ *		of the kernels produced on that device
+ *
+ * The additional cache key of a kernel is built from the modification times of its files, which are different
+ * on every install. When the sources of a kernel are the same as when the bundle was built (same hash),
+ * the GPUKernelCompiler uses the additional cache key of the manifest instead so that the shader cache
+ * of the bundle is hit. The shader cache of the bundle is copied in the shader cache of the application the
+ * first time a kernel is compiled on a device whose name is in the bundle.
+ *
+ * The bundle is built by the application started with BUILD_COMMANDLINE_ARGUMENT (the "KernelBundle" CMake target)
+ * which compiles the default kernels of the renderer as well as the kernels of the background precompilation
+ * on all the given devices. The kernels can only be compiled for the GPUs present on the machine that builds the bundle
+ */
+class KernelBinaryBundle
+{
+public:
+	// Bumped whenever the layout of the bundle changes
+	static constexpr int BUNDLE_VERSION = 1;
+	static const std::string MANIFEST_FILE_NAME;
+	// Argument that makes the application build a bundle in the given directory and exit
+	static const std::string BUILD_COMMANDLINE_ARGUMENT;
+
+	/**
+	 * Reads the manifest of the bundle in 'bundle_directory'. Does nothing if there is no bundle
+	 * there or if the bundle was built by another version of the application / HIPRT.
+	 *
+	 * Returns true if the bundle was loaded
+	 */
+	bool load(const std::string& bundle_directory);
+	bool is_loaded() const;
+
+	/**
+	 * Returns the additional cache key that the kernel file 'kernel_file_path' was compiled with when the
+	 * bundle was built if its sources hash is 'sources_hash'. Returns the empty string otherwise
+	 */
+	std::string get_additional_cache_key(const std::string& kernel_file_path, const std::string& sources_hash);
+
+	/**
+	 * Copies the shader cache of the bundle for 'device_name' in 'shader_cache_directory'.
+	 * Only does it once per device, the next calls return immediately
+	 */
+	void seed_shader_cache(const std::string& device_name, const std::string& shader_cache_directory);
+
+	/**
+	 * Compiles the kernels on the devices 'device_indices' and writes the bundle to 'bundle_directory'.
+	 * Returns the exit code of the application
+	 */
+	static int build(const std::string& bundle_directory, const std::vector<int>& device_indices);
+
+	/**
+	 * Name of the directory of the shader cache of a device in the bundle
+	 */
+	static std::string get_device_directory_name(const std::string& device_name);
+
+private:
+	static std::string get_version_string();
+
+	std::string m_bundle_directory;
+	bool m_loaded = false;
+
+	struct KernelFileEntry
+	{
+		std::string sources_hash;
+		std::string additional_cache_key;
+	};
+	std::unordered_map<std::string, KernelFileEntry> m_kernel_files;
+
+	std::unordered_set<std::string> m_seeded_devices;
+	std::mutex m_seed_mutex;
+};
+
+#endif
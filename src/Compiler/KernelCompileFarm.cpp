@@ -0,0 +1,216 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/GPUKernel.h"
+#include "Compiler/GPUKernelCompiler.h"
+#include "Compiler/KernelCompileFarm.h"
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+KernelCompileFarm g_kernel_compile_farm;
+extern GPUKernelCompiler g_gpu_kernel_compiler;
+extern ImGuiLogger g_imgui_logger;
+
+const std::string KernelCompileFarm::WORKER_COMMANDLINE_ARGUMENT = "--compile-worker=";
+const std::string KernelCompileFarm::WORKER_DEVICE_COMMANDLINE_ARGUMENT = "--compile-worker-device=";
+
+void KernelCompileFarm::set_executable_path(const std::string& executable_path)
+{
+	m_executable_path = executable_path;
+}
+
+void KernelCompileFarm::set_worker_count(int worker_count)
+{
+	m_worker_count = worker_count < 0 ? 0 : worker_count;
+}
+
+int KernelCompileFarm::get_worker_count() const
+{
+	return m_worker_count;
+}
+
+bool KernelCompileFarm::is_enabled() const
+{
+	return m_worker_count > 0 && !m_executable_path.empty();
+}
+
+void KernelCompileFarm::add_job(const std::string& kernel_file_path, const std::string& kernel_function_name, const GPUKernelCompilerOptions& options)
+{
+	CompileJob job;
+	job.kernel_file_path = kernel_file_path;
+	job.kernel_function_name = kernel_function_name;
+	for (auto& macro_key_value : options.get_options_macro_map())
+		job.macros.push_back(macro_key_value.first + "=" + std::to_string(*macro_key_value.second));
+	for (auto& macro_key_value : options.get_custom_macro_map())
+		job.macros.push_back(macro_key_value.first + "=" + std::to_string(*macro_key_value.second));
+
+	std::lock_guard<std::mutex> lock(m_jobs_mutex);
+	m_jobs.push_back(job);
+}
+
+bool KernelCompileFarm::run(int device_index)
+{
+	std::vector<CompileJob> jobs;
+	{
+		std::lock_guard<std::mutex> lock(m_jobs_mutex);
+		std::swap(jobs, m_jobs);
+	}
+
+	if (jobs.empty())
+		return true;
+
+	int worker_count = std::min(m_worker_count, static_cast<int>(jobs.size()));
+
+	// Round robin so that every worker gets a mix of the expensive
+	// (path tracing) and cheap (camera rays) kernels
+	std::vector<std::vector<CompileJob>> worker_jobs(worker_count);
+	for (size_t i = 0; i < jobs.size(); i++)
+		worker_jobs[i % worker_count].push_back(jobs[i]);
+
+	std::filesystem::path farm_directory = std::filesystem::temp_directory_path() / "HIPRTPathTracerCompileFarm";
+	std::error_code error;
+	std::filesystem::create_directories(farm_directory, error);
+	if (error)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not create the compile farm directory \"%s\": %s", farm_directory.string().c_str(), error.message().c_str());
+
+		return false;
+	}
+
+	// Unique per run so that multiple instances of the application don't overwrite each other's jobs
+	std::string run_id = std::to_string(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+
+	g_imgui_logger.update_line(ImGuiLogger::BACKGROUND_KERNEL_COMPILATION_LINE_NAME, "Compiling kernels in the background on %d processes... [%d / %d]", worker_count, 0, static_cast<int>(jobs.size()));
+
+	std::atomic<int> compiled_job_count = 0;
+	std::atomic<bool> all_workers_succeeded = true;
+	std::vector<std::thread> worker_threads;
+	for (int worker_index = 0; worker_index < worker_count; worker_index++)
+	{
+		std::string base_path = (farm_directory / (run_id + "_" + std::to_string(worker_index))).string();
+		std::string job_file_path = base_path + ".jobs";
+		std::string log_file_path = base_path + ".log";
+		if (!write_job_file(job_file_path, worker_jobs[worker_index]))
+		{
+			all_workers_succeeded = false;
+
+			continue;
+		}
+
+		// The output of the worker goes to its log file, otherwise all the workers
+		// would print their logs in the console of the application
+		std::string command = "\"" + m_executable_path + "\" \"" + KernelCompileFarm::WORKER_COMMANDLINE_ARGUMENT + job_file_path + "\" "
+			+ KernelCompileFarm::WORKER_DEVICE_COMMANDLINE_ARGUMENT + std::to_string(device_index);
+		if (!g_gpu_kernel_compiler.get_shader_cache().get_shared_directory().empty())
+			// The workers look up the shared shader cache too
+			command += " \"" + ShaderCacheManager::SHARED_DIRECTORY_COMMANDLINE_ARGUMENT + g_gpu_kernel_compiler.get_shader_cache().get_shared_directory() + "\"";
+		command += " > \"" + log_file_path + "\" 2>&1";
+#ifdef _WIN32
+		// cmd.exe strips the first and last quotes of the command
+		command = "\"" + command + "\"";
+#endif
+
+		int job_count = static_cast<int>(worker_jobs[worker_index].size());
+		int total_job_count = static_cast<int>(jobs.size());
+		worker_threads.push_back(std::thread([command, job_file_path, log_file_path, job_count, total_job_count, worker_count, &compiled_job_count, &all_workers_succeeded]() {
+			int exit_code = std::system(command.c_str());
+			if (exit_code != 0)
+			{
+				g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Kernel compile worker exited with code %d. See \"%s\"", exit_code, log_file_path.c_str());
+				all_workers_succeeded = false;
+			}
+			else
+				// Only keeping the logs of the workers that failed
+				std::filesystem::remove(log_file_path);
+
+			std::filesystem::remove(job_file_path);
+
+			compiled_job_count += job_count;
+			g_imgui_logger.update_line(ImGuiLogger::BACKGROUND_KERNEL_COMPILATION_LINE_NAME, "Compiling kernels in the background on %d processes... [%d / %d]", worker_count, compiled_job_count.load(), total_job_count);
+		}));
+	}
+
+	for (std::thread& worker_thread : worker_threads)
+		worker_thread.join();
+
+	return all_workers_succeeded;
+}
+
+bool KernelCompileFarm::write_job_file(const std::string& job_file_path, const std::vector<CompileJob>& jobs)
+{
+	std::ofstream job_file(job_file_path);
+	if (!job_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the kernel compile jobs to \"%s\": %s", job_file_path.c_str(), strerror(errno));
+
+		return false;
+	}
+
+	// One job per line, tab separated: kernel file, kernel function, macros
+	for (const CompileJob& job : jobs)
+	{
+		job_file << job.kernel_file_path << '\t' << job.kernel_function_name;
+		for (const std::string& macro : job.macros)
+			job_file << '\t' << macro;
+		job_file << '\n';
+	}
+
+	return true;
+}
+
+int KernelCompileFarm::run_worker(const std::string& job_file_path, int device_index)
+{
+	std::ifstream job_file(job_file_path);
+	if (!job_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not read the kernel compile jobs of \"%s\": %s", job_file_path.c_str(), strerror(errno));
+
+		return 1;
+	}
+
+	std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(device_index);
+	// Same function names as GPURenderer::setup_kernels(), they are part of the cache key of the kernels
+	std::vector<hiprtFuncNameSet> func_name_sets = { { nullptr, "alpha_testing" }, { nullptr, nullptr }, { "intersect_sphere", nullptr } };
+
+	std::string line;
+	while (std::getline(job_file, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream line_stream(line);
+		std::string field;
+		while (std::getline(line_stream, field, '\t'))
+			fields.push_back(field);
+
+		if (fields.size() < 2)
+			continue;
+
+		GPUKernel kernel(fields[0], fields[1]);
+		GPUKernelCompilerOptions& options = kernel.get_kernel_options();
+		options.clear();
+		for (size_t i = 2; i < fields.size(); i++)
+		{
+			size_t equal_position = fields[i].find('=');
+			if (equal_position == std::string::npos)
+				continue;
+
+			options.set_macro_value(fields[i].substr(0, equal_position), std::atoi(fields[i].substr(equal_position + 1).c_str()));
+		}
+
+		// Compiling with the shader cache is what writes the binary to the cache
+		kernel.compile_silent(hiprt_orochi_ctx, func_name_sets, true);
+	}
+
+	return 0;
+}
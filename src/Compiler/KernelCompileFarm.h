@@ -0,0 +1,90 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNEL_COMPILE_FARM_H
+#define KERNEL_COMPILE_FARM_H
+
+#include "Compiler/GPUKernelCompilerOptions.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Compiles kernels in separate processes to fill the shader cache.
+ *
+ * The GPUKernelCompiler compiles one kernel at a time because the drivers cannot compile
+ * on multiple threads of the same process. The background precompilation of all
+ * the kernel option combinations is thus very long on a cold cache.
+ *
+ * Instead, the background precompilation adds its kernels to this farm which splits them
+ * between 'worker count' processes. These processes are the application itself started with
+ * the WORKER_COMMANDLINE_ARGUMENT: they only create a context on the same device, compile
+ * their kernels (which writes the binaries to the shader cache) and exit. The interactive
+ * process then only has to load the binaries from the shader cache when switching options.
+ *
+ * The workers cannot be paused by GPURenderer::stop_background_shader_compilation() but
+ * they don't compete with the interactive process for the GPUKernelCompiler
+ */
+class KernelCompileFarm
+{
+public:
+	// Argument that makes the application start as a worker. Followed by the path to the job file
+	static const std::string WORKER_COMMANDLINE_ARGUMENT;
+	// Argument that gives the device index to a worker
+	static const std::string WORKER_DEVICE_COMMANDLINE_ARGUMENT;
+
+	/**
+	 * Path to the executable of the application, started as the workers
+	 */
+	void set_executable_path(const std::string& executable_path);
+	/**
+	 * 0 to disable the farm: the kernels are then precompiled in the background
+	 * threads of the interactive process
+	 */
+	void set_worker_count(int worker_count);
+	int get_worker_count() const;
+	bool is_enabled() const;
+
+	/**
+	 * Queues the compilation of a kernel for the next run()
+	 */
+	void add_job(const std::string& kernel_file_path, const std::string& kernel_function_name, const GPUKernelCompilerOptions& options);
+
+	/**
+	 * Splits the queued jobs between the workers, starts them for the device 'device_index'
+	 * and blocks until they all exited.
+	 *
+	 * Meant to be called from a background thread. Returns false if a worker failed
+	 */
+	bool run(int device_index);
+
+	/**
+	 * Entry point of a worker process: compiles all the jobs of 'job_file_path' on the device 'device_index'.
+	 * Returns the exit code of the worker
+	 */
+	static int run_worker(const std::string& job_file_path, int device_index);
+
+private:
+	struct CompileJob
+	{
+		std::string kernel_file_path;
+		std::string kernel_function_name;
+		// "Macro=Value" of all the options of the kernel
+		std::vector<std::string> macros;
+	};
+
+	bool write_job_file(const std::string& job_file_path, const std::vector<CompileJob>& jobs);
+
+	std::string m_executable_path;
+	int m_worker_count = 0;
+
+	std::vector<CompileJob> m_jobs;
+	// add_job() and run() are called from the background precompilation thread
+	// but the farm is shared by all the renderers
+	std::mutex m_jobs_mutex;
+};
+
+#endif
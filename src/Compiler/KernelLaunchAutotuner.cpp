@@ -0,0 +1,195 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/KernelLaunchAutotuner.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+KernelLaunchAutotuner g_kernel_launch_autotuner;
+extern ImGuiLogger g_imgui_logger;
+
+const std::string KernelLaunchAutotuner::CONFIGURATIONS_FILE_PATH = "kernel_launch_configurations.txt";
+
+void KernelLaunchAutotuner::set_enabled(bool enabled)
+{
+	m_enabled = enabled;
+}
+
+bool KernelLaunchAutotuner::is_enabled() const
+{
+	return m_enabled;
+}
+
+int KernelLaunchAutotuner::get_block_size(const std::string& device_name, const std::string& kernel_function_name, int thread_count_y, int& block_size_x, int& block_size_y)
+{
+	if (!m_enabled || thread_count_y <= 1)
+		// Nothing to tune for launches over one row
+		return -1;
+
+	load_if_needed();
+
+	LaunchTuning& tuning = m_launch_tunings[get_key(device_name, kernel_function_name, block_size_x, block_size_y)];
+	if (tuning.best_block_size_x != -1)
+	{
+		block_size_x = tuning.best_block_size_x;
+		block_size_y = tuning.best_block_size_y;
+
+		return -1;
+	}
+
+	if (tuning.candidates.empty())
+	{
+		tuning.candidates = get_candidates(block_size_x, block_size_y);
+		tuning.total_times.resize(tuning.candidates.size(), 0.0f);
+		tuning.timed_launches.resize(tuning.candidates.size(), 0);
+	}
+
+	if (tuning.candidates.size() == 1)
+		return -1;
+
+	int candidate_index = tuning.next_candidate;
+	// Cycling through the candidates so that they are all timed in the same conditions
+	// (the cost of a frame changes as the render converges)
+	tuning.next_candidate = (tuning.next_candidate + 1) % tuning.candidates.size();
+
+	block_size_x = tuning.candidates[candidate_index].first;
+	block_size_y = tuning.candidates[candidate_index].second;
+
+	return candidate_index;
+}
+
+void KernelLaunchAutotuner::get_tuned_block_size(const std::string& device_name, const std::string& kernel_function_name, int thread_count_y, int& block_size_x, int& block_size_y)
+{
+	if (!m_enabled || thread_count_y <= 1)
+		return;
+
+	load_if_needed();
+
+	auto find = m_launch_tunings.find(get_key(device_name, kernel_function_name, block_size_x, block_size_y));
+	if (find == m_launch_tunings.end() || find->second.best_block_size_x == -1)
+		return;
+
+	block_size_x = find->second.best_block_size_x;
+	block_size_y = find->second.best_block_size_y;
+}
+
+void KernelLaunchAutotuner::add_timing(const std::string& device_name, const std::string& kernel_function_name, int requested_block_size_x, int requested_block_size_y, int candidate_index, float time)
+{
+	auto find = m_launch_tunings.find(get_key(device_name, kernel_function_name, requested_block_size_x, requested_block_size_y));
+	if (find == m_launch_tunings.end())
+		// The tunings were reset since that launch
+		return;
+
+	LaunchTuning& tuning = find->second;
+	if (tuning.best_block_size_x != -1 || candidate_index >= tuning.candidates.size())
+		return;
+
+	tuning.total_times[candidate_index] += time;
+	tuning.timed_launches[candidate_index]++;
+
+	for (int timed_launches : tuning.timed_launches)
+		if (timed_launches < KernelLaunchAutotuner::TIMED_LAUNCHES_PER_CANDIDATE)
+			// Not all the candidates have been timed enough
+			return;
+
+	int best_candidate = 0;
+	for (int i = 1; i < tuning.candidates.size(); i++)
+		if (tuning.total_times[i] / tuning.timed_launches[i] < tuning.total_times[best_candidate] / tuning.timed_launches[best_candidate])
+			best_candidate = i;
+
+	tuning.best_block_size_x = tuning.candidates[best_candidate].first;
+	tuning.best_block_size_y = tuning.candidates[best_candidate].second;
+
+	float requested_time = 0.0f;
+	for (int i = 0; i < tuning.candidates.size(); i++)
+		if (tuning.candidates[i] == std::make_pair(requested_block_size_x, requested_block_size_y))
+			requested_time = tuning.total_times[i] / tuning.timed_launches[i];
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Kernel \"%s\" tuned: %dx%d blocks (%.3fms) instead of %dx%d (%.3fms)", kernel_function_name.c_str(),
+		tuning.best_block_size_x, tuning.best_block_size_y, tuning.total_times[best_candidate] / tuning.timed_launches[best_candidate],
+		requested_block_size_x, requested_block_size_y, requested_time);
+
+	save();
+}
+
+void KernelLaunchAutotuner::reset()
+{
+	m_launch_tunings.clear();
+	// Not loading the file again, the launches are going to be tuned again
+	m_loaded = true;
+
+	save();
+}
+
+std::string KernelLaunchAutotuner::get_key(const std::string& device_name, const std::string& kernel_function_name, int requested_block_size_x, int requested_block_size_y)
+{
+	return device_name + '\t' + kernel_function_name + '\t' + std::to_string(requested_block_size_x) + '\t' + std::to_string(requested_block_size_y);
+}
+
+std::vector<std::pair<int, int>> KernelLaunchAutotuner::get_candidates(int requested_block_size_x, int requested_block_size_y)
+{
+	int thread_count = requested_block_size_x * requested_block_size_y;
+
+	std::vector<std::pair<int, int>> candidates;
+	// Rows of less than 4 threads access the buffers too sparsely to be worth timing
+	for (int block_size_x = thread_count; block_size_x >= 4; block_size_x /= 2)
+		if (thread_count % block_size_x == 0)
+			candidates.push_back(std::make_pair(block_size_x, thread_count / block_size_x));
+
+	if (std::find(candidates.begin(), candidates.end(), std::make_pair(requested_block_size_x, requested_block_size_y)) == candidates.end())
+		// Not a power of 2, the requested block size is still a candidate
+		candidates.push_back(std::make_pair(requested_block_size_x, requested_block_size_y));
+
+	return candidates;
+}
+
+void KernelLaunchAutotuner::load_if_needed()
+{
+	if (m_loaded)
+		return;
+	m_loaded = true;
+
+	std::ifstream configurations_file(KernelLaunchAutotuner::CONFIGURATIONS_FILE_PATH);
+	if (!configurations_file.is_open())
+		// Nothing tuned yet
+		return;
+
+	// One launch per line: device name, kernel function, requested block size x, y, best block size x, y
+	std::string line;
+	while (std::getline(configurations_file, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream line_stream(line);
+		std::string field;
+		while (std::getline(line_stream, field, '\t'))
+			fields.push_back(field);
+
+		if (fields.size() != 6)
+			continue;
+
+		LaunchTuning& tuning = m_launch_tunings[get_key(fields[0], fields[1], std::atoi(fields[2].c_str()), std::atoi(fields[3].c_str()))];
+		tuning.best_block_size_x = std::atoi(fields[4].c_str());
+		tuning.best_block_size_y = std::atoi(fields[5].c_str());
+	}
+}
+
+void KernelLaunchAutotuner::save()
+{
+	std::ofstream configurations_file(KernelLaunchAutotuner::CONFIGURATIONS_FILE_PATH);
+	if (!configurations_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not write the kernel launch configurations to \"%s\"", KernelLaunchAutotuner::CONFIGURATIONS_FILE_PATH.c_str());
+
+		return;
+	}
+
+	for (auto& key_to_tuning : m_launch_tunings)
+		if (key_to_tuning.second.best_block_size_x != -1)
+			configurations_file << key_to_tuning.first << '\t' << key_to_tuning.second.best_block_size_x << '\t' << key_to_tuning.second.best_block_size_y << '\n';
+}
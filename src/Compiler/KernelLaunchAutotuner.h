@@ -0,0 +1,90 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNEL_LAUNCH_AUTOTUNER_H
+#define KERNEL_LAUNCH_AUTOTUNER_H
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Finds the fastest block size of the launches of the kernels on each device.
+ * 
+ * The candidates of a launch are all the block shapes that have the same number of threads as the
+ * block size that the launch is requested with (the kernels are compiled with __launch_bounds__ and
+ * the shared stack BVH traversal is sized for that number of threads): 64x1, 32x2, 16x4, 8x8 and 4x16
+ * for an 8x8 launch for example. Launches over one row of threads only have one candidate and are not tuned.
+ * 
+ * The tuning is done on the real launches of the kernels while rendering: the launches of a kernel cycle
+ * through the candidates, are timed (see GPUKernel::launch()) and, once each candidate has been timed
+ * TIMED_LAUNCHES_PER_CANDIDATE times, the candidate with the lowest average time is used for the next launches.
+ * All the candidates compute the same pixels so the image isn't affected.
+ * 
+ * The best block sizes are persisted in CONFIGURATIONS_FILE_PATH, per device name, kernel
+ * function and requested block size
+ */
+class KernelLaunchAutotuner
+{
+public:
+	static const std::string CONFIGURATIONS_FILE_PATH;
+	static constexpr int TIMED_LAUNCHES_PER_CANDIDATE = 16;
+
+	void set_enabled(bool enabled);
+	bool is_enabled() const;
+
+	/**
+	 * 'block_size_x' and 'block_size_y' must contain the block size that the launch is requested with and
+	 * are set to the block size to launch with. 'thread_count_y' is the number of rows of threads of the launch.
+	 * 
+	 * Returns the index of the candidate to give to add_timing() if the launch must be timed, -1 otherwise
+	 */
+	int get_block_size(const std::string& device_name, const std::string& kernel_function_name, int thread_count_y, int& block_size_x, int& block_size_y);
+
+	/**
+	 * Same as get_block_size() but never returns a candidate to time: the block size
+	 * is left untouched if the launch hasn't been tuned yet
+	 */
+	void get_tuned_block_size(const std::string& device_name, const std::string& kernel_function_name, int thread_count_y, int& block_size_x, int& block_size_y);
+
+	/**
+	 * Adds the time in milliseconds of a launch done with the candidate 'candidate_index'
+	 * returned by get_block_size() for the requested block size 'requested_block_size_x/y'
+	 */
+	void add_timing(const std::string& device_name, const std::string& kernel_function_name, int requested_block_size_x, int requested_block_size_y, int candidate_index, float time);
+
+	/**
+	 * Forgets the best block sizes found so far, the launches are tuned again
+	 */
+	void reset();
+
+private:
+	struct LaunchTuning
+	{
+		std::vector<std::pair<int, int>> candidates;
+		std::vector<float> total_times;
+		std::vector<int> timed_launches;
+		// Candidate that the next launch is going to use while tuning
+		int next_candidate = 0;
+
+		// -1 while not tuned yet
+		int best_block_size_x = -1;
+		int best_block_size_y = -1;
+	};
+
+	static std::string get_key(const std::string& device_name, const std::string& kernel_function_name, int requested_block_size_x, int requested_block_size_y);
+	static std::vector<std::pair<int, int>> get_candidates(int requested_block_size_x, int requested_block_size_y);
+
+	void load_if_needed();
+	void save();
+
+	bool m_enabled = true;
+	bool m_loaded = false;
+
+	std::unordered_map<std::string, LaunchTuning> m_launch_tunings;
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/KernelOptionsUsageHistory.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+KernelOptionsUsageHistory g_kernel_options_usage_history;
+extern ImGuiLogger g_imgui_logger;
+
+const std::string KernelOptionsUsageHistory::HISTORY_FILE_PATH = "shader_cache_usage.txt";
+
+void KernelOptionsUsageHistory::record(const GPUKernelCompilerOptions& options)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	load_if_needed();
+
+	// Only the option macros, the custom macros are specific to some kernels
+	std::map<std::string, int> combination;
+	for (auto& macro_key_value : options.get_options_macro_map())
+		combination[macro_key_value.first] = *macro_key_value.second;
+
+	m_combination_counts[combination]++;
+
+	save();
+}
+
+std::pair<int, int> KernelOptionsUsageHistory::get_usage_score(const GPUKernelCompilerOptions& partial_options)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	load_if_needed();
+
+	int exact_count = 0;
+	int macro_match_count = 0;
+	for (auto& combination_to_count : m_combination_counts)
+	{
+		const std::map<std::string, int>& combination = combination_to_count.first;
+
+		bool all_macros_match = true;
+		for (auto& macro_key_value : partial_options.get_options_macro_map())
+		{
+			auto find = combination.find(macro_key_value.first);
+			if (find != combination.end() && find->second == *macro_key_value.second)
+				macro_match_count += combination_to_count.second;
+			else
+				all_macros_match = false;
+		}
+
+		if (all_macros_match)
+			exact_count += combination_to_count.second;
+	}
+
+	return std::make_pair(exact_count, macro_match_count);
+}
+
+void KernelOptionsUsageHistory::load_if_needed()
+{
+	if (m_loaded)
+		return;
+	m_loaded = true;
+
+	std::ifstream history_file(KernelOptionsUsageHistory::HISTORY_FILE_PATH);
+	if (!history_file.is_open())
+		// No history yet
+		return;
+
+	// One combination per line: count then tab separated "Macro=Value"
+	std::string line;
+	while (std::getline(history_file, line))
+	{
+		std::stringstream line_stream(line);
+		std::string field;
+		if (!std::getline(line_stream, field, '\t'))
+			continue;
+
+		int count = std::atoi(field.c_str());
+		std::map<std::string, int> combination;
+		while (std::getline(line_stream, field, '\t'))
+		{
+			size_t equal_position = field.find('=');
+			if (equal_position != std::string::npos)
+				combination[field.substr(0, equal_position)] = std::atoi(field.substr(equal_position + 1).c_str());
+		}
+
+		if (count > 0 && !combination.empty())
+			m_combination_counts[combination] += count;
+	}
+}
+
+void KernelOptionsUsageHistory::save()
+{
+	std::ofstream history_file(KernelOptionsUsageHistory::HISTORY_FILE_PATH);
+	if (!history_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not write the kernel options usage history to \"%s\"", KernelOptionsUsageHistory::HISTORY_FILE_PATH.c_str());
+
+		return;
+	}
+
+	for (auto& combination_to_count : m_combination_counts)
+	{
+		history_file << combination_to_count.second;
+		for (auto& macro_key_value : combination_to_count.first)
+			history_file << '\t' << macro_key_value.first << '=' << macro_key_value.second;
+		history_file << '\n';
+	}
+}
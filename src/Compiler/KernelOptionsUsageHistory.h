@@ -0,0 +1,57 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNEL_OPTIONS_USAGE_HISTORY_H
+#define KERNEL_OPTIONS_USAGE_HISTORY_H
+
+#include "Compiler/GPUKernelCompilerOptions.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+/**
+ * Keeps track of the kernel option combinations that the renderer recompiled its kernels with,
+ * i.e. the combinations that the user actually switched to, and how many times.
+ *
+ * The history is persisted in HISTORY_FILE_PATH, next to the shader cache (but not in
+ * the shader cache so that "Clear shader cache" doesn't clear it). The background precompilation
+ * uses it to precompile the most likely combinations first (see GPURenderer::precompile_kernels())
+ */
+class KernelOptionsUsageHistory
+{
+public:
+	static const std::string HISTORY_FILE_PATH;
+
+	/**
+	 * Records that the kernels were compiled with 'options' and writes the history to the disk
+	 */
+	void record(const GPUKernelCompilerOptions& options);
+
+	/**
+	 * How likely it is for the user to switch to 'partial_options'.
+	 *
+	 * The first element is how many times the user switched to a combination whose macros are the
+	 * same as all the macros of 'partial_options' (0 if the user never did). The second element counts
+	 * the switches to combinations that share each macro of 'partial_options', used to order the
+	 * combinations that the user never switched to
+	 */
+	std::pair<int, int> get_usage_score(const GPUKernelCompilerOptions& partial_options);
+
+private:
+	void load_if_needed();
+	void save();
+
+	// "Macro=Value" of all the option macros of a combination (sorted, see std::map) to how many
+	// times the kernels were compiled with that combination
+	std::map<std::map<std::string, int>, int> m_combination_counts;
+	bool m_loaded = false;
+
+	// record() is called by the main thread and get_usage_score() by the background precompilation thread
+	std::mutex m_mutex;
+};
+
+#endif
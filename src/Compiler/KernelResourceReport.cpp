@@ -0,0 +1,232 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/GPUKernel.h"
+#include "Compiler/KernelCompileFarm.h"
+#include "Compiler/KernelResourceReport.h"
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "Renderer/GPURenderer.h"
+#include "Threads/ThreadManager.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+extern ImGuiLogger g_imgui_logger;
+extern KernelCompileFarm g_kernel_compile_farm;
+
+const std::string KernelResourceReport::BENCH_COMMANDLINE_ARGUMENT = "--kernel-resource-bench=";
+const std::string KernelResourceReport::THRESHOLD_COMMANDLINE_ARGUMENT = "--kernel-resource-threshold=";
+
+const std::vector<std::string> KernelResourceReport::REPORTED_VARIANT_OPTIONS =
+{
+	GPUKernelCompilerOptions::NESTED_DIELECTRICS_STACK_USE_SHARED_MEMORY,
+	GPUKernelCompilerOptions::KERNEL_DIAGNOSTICS,
+};
+
+KernelResourceUsage KernelResourceReport::get_resource_usage(oroFunction kernel_function, int block_size, const oroDeviceProp& device_properties)
+{
+	KernelResourceUsage usage;
+	if (kernel_function == nullptr)
+		return usage;
+
+	usage.registers = GPUKernel::get_kernel_attribute(kernel_function, ORO_FUNC_ATTRIBUTE_NUM_REGS);
+	usage.shared_bytes = GPUKernel::get_kernel_attribute(kernel_function, ORO_FUNC_ATTRIBUTE_SHARED_SIZE_BYTES);
+	usage.local_bytes = GPUKernel::get_kernel_attribute(kernel_function, ORO_FUNC_ATTRIBUTE_LOCAL_SIZE_BYTES);
+	usage.block_size = block_size;
+
+	int active_blocks = 0;
+	OROCHI_CHECK_ERROR(oroModuleOccupancyMaxActiveBlocksPerMultiprocessor(&active_blocks, kernel_function, block_size, 0));
+	if (device_properties.maxThreadsPerMultiProcessor > 0)
+		usage.theoretical_occupancy = std::min(1.0f, active_blocks * block_size / static_cast<float>(device_properties.maxThreadsPerMultiProcessor));
+
+	return usage;
+}
+
+KernelResourceUsage KernelResourceReport::get_resource_usage(GPUKernel& kernel, const oroDeviceProp& device_properties)
+{
+	int block_size = kernel.get_kernel_options().get_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE);
+
+	return KernelResourceReport::get_resource_usage(kernel.get_kernel_function(), block_size, device_properties);
+}
+
+int KernelResourceReport::run_bench(const std::string& baseline_file_path, float threshold_percent, int device_index)
+{
+	// Same as when building a kernel bundle, all the kernels are compiled when the constructor of the
+	// GPURenderer returns and the shader cache is the one of the application
+	ThreadManager::set_monothread(true);
+	g_kernel_compile_farm.set_worker_count(0);
+
+	std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(device_index);
+	std::string device_name = hiprt_orochi_ctx->device_properties.name;
+
+	// The constructor compiles the kernels with their default options
+	GPURenderer renderer(hiprt_orochi_ctx, /* headless */ true);
+	ThreadManager::join_all_threads();
+
+	std::map<std::string, KernelResourceUsage> usages;
+	for (auto& id_to_kernel : renderer.get_kernels())
+	{
+		if (id_to_kernel.second->get_kernel_function() == nullptr)
+			continue;
+
+		usages[id_to_kernel.first] = KernelResourceReport::get_resource_usage(*id_to_kernel.second, hiprt_orochi_ctx->device_properties);
+	}
+
+	for (auto& id_to_usage : usages)
+	{
+		const KernelResourceUsage& usage = id_to_usage.second;
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%s: [Reg, Shared, Local] = [%d, %d, %d], occupancy %.0f%% at %d threads per block",
+			id_to_usage.first.c_str(), usage.registers, usage.shared_bytes, usage.local_bytes, usage.theoretical_occupancy * 100.0f, usage.block_size);
+	}
+
+	// The other values of the REPORTED_VARIANT_OPTIONS are only reported, not compared with the baseline
+	for (const std::string& option_name : KernelResourceReport::REPORTED_VARIANT_OPTIONS)
+	{
+		std::shared_ptr<GPUKernelCompilerOptions> global_options = renderer.get_global_compiler_options();
+		int default_value = global_options->get_macro_value(option_name);
+		int variant_value = default_value == KERNEL_OPTION_TRUE ? KERNEL_OPTION_FALSE : KERNEL_OPTION_TRUE;
+
+		global_options->set_macro_value(option_name, variant_value);
+		renderer.recompile_kernels();
+
+		for (auto& id_to_kernel : renderer.get_kernels())
+		{
+			auto find = usages.find(id_to_kernel.first);
+			if (find == usages.end() || id_to_kernel.second->get_kernel_function() == nullptr)
+				continue;
+
+			const KernelResourceUsage& usage = find->second;
+			KernelResourceUsage variant_usage = KernelResourceReport::get_resource_usage(*id_to_kernel.second, hiprt_orochi_ctx->device_properties);
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%s with %s=%d: [Reg, Shared, Local] = [%d, %d, %d], occupancy %.0f%% (%.0f%% with %s=%d)",
+				id_to_kernel.first.c_str(), option_name.c_str(), variant_value, variant_usage.registers, variant_usage.shared_bytes, variant_usage.local_bytes,
+				variant_usage.theoretical_occupancy * 100.0f, usage.theoretical_occupancy * 100.0f, option_name.c_str(), default_value);
+		}
+
+		global_options->set_macro_value(option_name, default_value);
+		renderer.recompile_kernels();
+	}
+
+	std::string baseline_device_name;
+	std::map<std::string, KernelResourceUsage> baseline_usages;
+	if (!KernelResourceReport::read_report(baseline_file_path, baseline_device_name, baseline_usages))
+	{
+		// First run of the bench
+		if (!KernelResourceReport::write_report(baseline_file_path, device_name, usages))
+			return 1;
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "No kernel resource baseline found, baseline written to \"%s\"", baseline_file_path.c_str());
+
+		return 0;
+	}
+
+	if (baseline_device_name != device_name)
+	{
+		// The registers allocated to the kernels depend on the architecture
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The kernel resource baseline \"%s\" was made on \"%s\", not on \"%s\". Delete it to make a new baseline.",
+			baseline_file_path.c_str(), baseline_device_name.c_str(), device_name.c_str());
+
+		return 1;
+	}
+
+	int regression_count = 0;
+	for (auto& id_to_usage : usages)
+	{
+		auto find = baseline_usages.find(id_to_usage.first);
+		if (find == baseline_usages.end())
+			// New kernel, nothing to compare with
+			continue;
+
+		const KernelResourceUsage& baseline = find->second;
+		const KernelResourceUsage& usage = id_to_usage.second;
+		if (KernelResourceReport::is_regression(baseline.registers, usage.registers, threshold_percent))
+		{
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "%s: registers regressed from %d to %d", id_to_usage.first.c_str(), baseline.registers, usage.registers);
+			regression_count++;
+		}
+
+		if (KernelResourceReport::is_regression(baseline.local_bytes, usage.local_bytes, threshold_percent))
+		{
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "%s: spilled bytes regressed from %d to %d", id_to_usage.first.c_str(), baseline.local_bytes, usage.local_bytes);
+			regression_count++;
+		}
+	}
+
+	// Next to the baseline so that it can replace the baseline if the regressions are expected
+	KernelResourceReport::write_report(baseline_file_path + ".last", device_name, usages);
+
+	if (regression_count > 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "%d kernel resource regression(s) above %.1f%%.", regression_count, threshold_percent);
+
+		return 1;
+	}
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "No kernel resource regression above %.1f%%.", threshold_percent);
+
+	return 0;
+}
+
+bool KernelResourceReport::read_report(const std::string& file_path, std::string& device_name, std::map<std::string, KernelResourceUsage>& usages)
+{
+	std::ifstream report_file(file_path);
+	if (!report_file.is_open())
+		return false;
+
+	std::string line;
+	while (std::getline(report_file, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream line_stream(line);
+		std::string field;
+		while (std::getline(line_stream, field, '\t'))
+			fields.push_back(field);
+
+		if (fields.size() == 2 && fields[0] == "device")
+			device_name = fields[1];
+		else if (fields.size() == 7 && fields[0] == "kernel")
+		{
+			KernelResourceUsage& usage = usages[fields[1]];
+			usage.registers = std::stoi(fields[2]);
+			usage.shared_bytes = std::stoi(fields[3]);
+			usage.local_bytes = std::stoi(fields[4]);
+			usage.block_size = std::stoi(fields[5]);
+			usage.theoretical_occupancy = std::stof(fields[6]);
+		}
+	}
+
+	return true;
+}
+
+bool KernelResourceReport::write_report(const std::string& file_path, const std::string& device_name, const std::map<std::string, KernelResourceUsage>& usages)
+{
+	std::ofstream report_file(file_path);
+	if (!report_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the kernel resource report \"%s\"", file_path.c_str());
+
+		return false;
+	}
+
+	report_file << "device\t" << device_name << '\n';
+	for (auto& id_to_usage : usages)
+	{
+		const KernelResourceUsage& usage = id_to_usage.second;
+
+		report_file << "kernel\t" << id_to_usage.first << '\t' << usage.registers << '\t' << usage.shared_bytes << '\t' << usage.local_bytes << '\t' << usage.block_size << '\t' << usage.theoretical_occupancy << '\n';
+	}
+
+	return true;
+}
+
+bool KernelResourceReport::is_regression(int baseline_value, int value, float threshold_percent)
+{
+	// A kernel that didn't spill at all and now spills always regresses
+	return value > baseline_value * (1.0f + threshold_percent / 100.0f);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNEL_RESOURCE_REPORT_H
+#define KERNEL_RESOURCE_REPORT_H
+
+#include <Orochi/Orochi.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class GPUKernel;
+
+struct KernelResourceUsage
+{
+	int registers = 0;
+	int shared_bytes = 0;
+	// Per thread local memory of the kernel. This is mostly registers spilled by the compiler
+	int local_bytes = 0;
+
+	// Number of threads per block that the occupancy is computed for
+	int block_size = 0;
+	// Active threads per multiprocessor / maximum threads per multiprocessor of the device
+	// with the registers and shared memory used by the kernel. In [0, 1]
+	float theoretical_occupancy = 0.0f;
+};
+
+/**
+ * Registers, spills, shared memory and theoretical occupancy of the compiled kernels.
+ *
+ * The usage of the kernels is shown in the "Performance Metrics" panel next to their execution times.
+ *
+ * The application started with BENCH_COMMANDLINE_ARGUMENT compiles all the kernels of the renderer with their
+ * default options and compares their usage with the baseline file given to the argument: the bench fails
+ * (exit code 1) if the registers or the spilled bytes of a kernel increased by more than the
+ * threshold percentage given with THRESHOLD_COMMANDLINE_ARGUMENT (DEFAULT_REGRESSION_THRESHOLD by default).
+ * The baseline file is written instead if it doesn't exist yet. The "KernelResourceBench" CMake target does this.
+ * The kernels are then compiled again with the other value of each of the REPORTED_VARIANT_OPTIONS and their
+ * usage is logged next to the usage with the default value
+ */
+class KernelResourceReport
+{
+public:
+	static const std::string BENCH_COMMANDLINE_ARGUMENT;
+	static const std::string THRESHOLD_COMMANDLINE_ARGUMENT;
+	static constexpr float DEFAULT_REGRESSION_THRESHOLD = 5.0f;
+	// KERNEL_OPTION_TRUE / KERNEL_OPTION_FALSE kernel options whose other value is also compiled
+	// and reported by the bench so that the variant with the best occupancy can be chosen per GPU
+	static const std::vector<std::string> REPORTED_VARIANT_OPTIONS;
+
+	/**
+	 * Usage of the compiled kernel 'kernel_function' launched with blocks of 'block_size' threads on the device 'device_properties'
+	 */
+	static KernelResourceUsage get_resource_usage(oroFunction kernel_function, int block_size, const oroDeviceProp& device_properties);
+	/**
+	 * Usage of 'kernel' launched with the block size that it is compiled for (SharedStackBVHTraversalBlockSize)
+	 */
+	static KernelResourceUsage get_resource_usage(GPUKernel& kernel, const oroDeviceProp& device_properties);
+
+	/**
+	 * Compiles the kernels on the device 'device_index' and compares their usage against
+	 * 'baseline_file_path'. Returns the exit code of the application
+	 */
+	static int run_bench(const std::string& baseline_file_path, float threshold_percent, int device_index);
+
+private:
+	static bool read_report(const std::string& file_path, std::string& device_name, std::map<std::string, KernelResourceUsage>& usages);
+	static bool write_report(const std::string& file_path, const std::string& device_name, const std::map<std::string, KernelResourceUsage>& usages);
+
+	static bool is_regression(int baseline_value, int value, float threshold_percent);
+};
+
+#endif
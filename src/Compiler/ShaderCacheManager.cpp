@@ -0,0 +1,439 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/ShaderCacheManager.h"
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+extern ImGuiLogger g_imgui_logger;
+
+const std::string ShaderCacheManager::INDEX_FILE_NAME = "shader_cache_index.txt";
+const std::string ShaderCacheManager::SIZE_LIMIT_COMMANDLINE_ARGUMENT = "--shader-cache-size=";
+const std::string ShaderCacheManager::SHARED_DIRECTORY_COMMANDLINE_ARGUMENT = "--shared-shader-cache=";
+
+static const std::string INDEX_HEADER = "HIPRTPathTracerShaderCacheIndex\t1";
+
+void ShaderCacheManager::set_size_limit(std::uint64_t size_limit_bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_size_limit_bytes = size_limit_bytes;
+
+	load_if_needed();
+	evict_if_needed({});
+}
+
+std::uint64_t ShaderCacheManager::get_size_limit() const
+{
+	return m_size_limit_bytes;
+}
+
+void ShaderCacheManager::set_shared_directory(const std::string& shared_directory)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_shared_directory = shared_directory;
+	m_shared_index_loaded = false;
+	m_shared_entries.clear();
+}
+
+const std::string& ShaderCacheManager::get_shared_directory() const
+{
+	return m_shared_directory;
+}
+
+std::string ShaderCacheManager::prepare_compilation(const std::string& kernel_key, const std::string& sources_hash, const std::string& additional_cache_key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	load_if_needed();
+	m_files_before_compilation = list_cache_files();
+	m_shared_hit_files.clear();
+
+	auto local_entry = m_entries.find(get_entry_key(kernel_key, additional_cache_key));
+	if (local_entry != m_entries.end())
+	{
+		bool all_files_present = true;
+		for (const std::string& file : local_entry->second.files)
+			all_files_present &= m_files_before_compilation.find(file) != m_files_before_compilation.end();
+
+		if (all_files_present)
+			// The local shader cache is going to be hit
+			return additional_cache_key;
+	}
+
+	load_shared_index_if_needed();
+	auto shared_entry = m_shared_entries.find(kernel_key + "\t" + sources_hash);
+	if (shared_entry == m_shared_entries.end())
+		return additional_cache_key;
+
+	std::error_code error;
+	std::filesystem::create_directories(HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY, error);
+	for (const std::string& file : shared_entry->second.files)
+	{
+		std::filesystem::copy_file(std::filesystem::path(m_shared_directory) / file, std::filesystem::path(HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY) / file, std::filesystem::copy_options::skip_existing, error);
+		if (error)
+		{
+			// Compiling locally instead
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not copy \"%s\" from the shared shader cache: %s", file.c_str(), error.message().c_str());
+
+			return additional_cache_key;
+		}
+	}
+
+	// Listing again so that the copied files aren't taken for files written by the compilation
+	m_files_before_compilation = list_cache_files();
+	m_shared_hit_files = shared_entry->second.files;
+
+	return shared_entry->second.additional_cache_key;
+}
+
+void ShaderCacheManager::record_compilation(const std::string& kernel_key, const std::string& kernel_function_name, const std::string& sources_hash, const std::string& additional_cache_key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_files = list_cache_files();
+
+	IndexEntry entry;
+	entry.kernel_key = kernel_key;
+	entry.kernel_function_name = kernel_function_name;
+	entry.sources_hash = sources_hash;
+	entry.additional_cache_key = additional_cache_key;
+
+	std::string entry_key = get_entry_key(kernel_key, additional_cache_key);
+	if (!m_shared_hit_files.empty())
+	{
+		entry.files = m_shared_hit_files;
+
+		m_shared_hit_count++;
+		m_hit_count++;
+	}
+	else
+	{
+		for (auto& name_to_file : m_files)
+			if (m_files_before_compilation.find(name_to_file.first) == m_files_before_compilation.end())
+				entry.files.push_back(name_to_file.first);
+
+		if (entry.files.empty())
+		{
+			m_hit_count++;
+
+			auto find = m_entries.find(entry_key);
+			if (find == m_entries.end())
+				// Hit on binaries that aren't in the index, nothing to update
+				return;
+
+			entry.files = find->second.files;
+		}
+		else
+			m_miss_count++;
+	}
+
+	std::int64_t time = now();
+	for (const std::string& file : entry.files)
+	{
+		auto find = m_files.find(file);
+		if (find != m_files.end())
+			find->second.last_use = time;
+	}
+
+	m_entries[entry_key] = entry;
+	append_to_index(serialize_entry(entry, time));
+
+	evict_if_needed(entry.files);
+}
+
+std::string ShaderCacheManager::get_kernel_key(const std::string& device_name, const std::string& kernel_file_path, const std::string& kernel_function_name, const std::vector<std::string>& compiler_options)
+{
+	std::string kernel_key = device_name + "|" + kernel_file_path + "|" + kernel_function_name + "|";
+	for (const std::string& option : compiler_options)
+		kernel_key += option + " ";
+
+	return kernel_key;
+}
+
+ShaderCacheStatistics ShaderCacheManager::get_statistics()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	load_if_needed();
+
+	ShaderCacheStatistics statistics;
+	statistics.hit_count = m_hit_count;
+	statistics.miss_count = m_miss_count;
+	statistics.shared_hit_count = m_shared_hit_count;
+	statistics.size_limit_bytes = m_size_limit_bytes;
+	statistics.file_count = static_cast<int>(m_files.size());
+	statistics.evicted_file_count = m_evicted_file_count;
+	for (auto& name_to_file : m_files)
+		statistics.size_bytes += name_to_file.second.size;
+
+	std::unordered_map<std::string, bool> indexed_files;
+	for (auto& key_to_entry : m_entries)
+	{
+		statistics.entries_per_kernel[key_to_entry.second.kernel_function_name]++;
+		for (const std::string& file : key_to_entry.second.files)
+			indexed_files[file] = true;
+	}
+
+	for (auto& name_to_file : m_files)
+		if (indexed_files.find(name_to_file.first) == indexed_files.end())
+			statistics.entries_per_kernel["Unknown"]++;
+
+	return statistics;
+}
+
+void ShaderCacheManager::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::error_code error;
+	std::filesystem::remove_all(HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY, error);
+
+	m_entries.clear();
+	m_files.clear();
+}
+
+void ShaderCacheManager::load_if_needed()
+{
+	if (m_loaded)
+		return;
+	m_loaded = true;
+
+	m_files = list_cache_files();
+
+	std::unordered_map<std::string, std::int64_t> last_uses;
+	read_index((std::filesystem::path(HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY) / INDEX_FILE_NAME).string(), m_entries, &last_uses);
+
+	// Dropping the entries whose files were removed
+	for (auto it = m_entries.begin(); it != m_entries.end();)
+	{
+		bool all_files_present = true;
+		for (const std::string& file : it->second.files)
+			all_files_present &= m_files.find(file) != m_files.end();
+
+		if (all_files_present)
+			it++;
+		else
+			it = m_entries.erase(it);
+	}
+
+	for (auto& name_to_last_use : last_uses)
+	{
+		auto find = m_files.find(name_to_last_use.first);
+		if (find != m_files.end())
+			find->second.last_use = name_to_last_use.second;
+	}
+}
+
+void ShaderCacheManager::load_shared_index_if_needed()
+{
+	if (m_shared_index_loaded || m_shared_directory.empty())
+		return;
+	m_shared_index_loaded = true;
+
+	std::unordered_map<std::string, IndexEntry> entries;
+	if (!read_index((std::filesystem::path(m_shared_directory) / INDEX_FILE_NAME).string(), entries, nullptr))
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "No shader cache index found in the shared shader cache \"%s\", it will not be used.", m_shared_directory.c_str());
+
+		return;
+	}
+
+	for (auto& key_to_entry : entries)
+		m_shared_entries[key_to_entry.second.kernel_key + "\t" + key_to_entry.second.sources_hash] = key_to_entry.second;
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Shared shader cache \"%s\" loaded with %zu entries.", m_shared_directory.c_str(), m_shared_entries.size());
+}
+
+bool ShaderCacheManager::read_index(const std::string& index_file_path, std::unordered_map<std::string, IndexEntry>& entries, std::unordered_map<std::string, std::int64_t>* last_uses)
+{
+	std::ifstream index_file(index_file_path);
+	if (!index_file.is_open())
+		return false;
+
+	std::string line;
+	std::getline(index_file, line);
+	if (line != INDEX_HEADER)
+		// Written by another version of the application
+		return false;
+
+	while (std::getline(index_file, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream line_stream(line);
+		std::string field;
+		while (std::getline(line_stream, field, '\t'))
+			fields.push_back(field);
+
+		// Written by a process that exited in the middle of the line otherwise
+		if (fields.size() != 7 || fields[0] != "entry")
+			continue;
+
+		IndexEntry entry;
+		entry.kernel_key = fields[2];
+		entry.kernel_function_name = fields[3];
+		entry.sources_hash = fields[4];
+		entry.additional_cache_key = fields[5];
+
+		std::stringstream files_stream(fields[6]);
+		std::string file;
+		while (std::getline(files_stream, file, ','))
+			if (!file.empty())
+				entry.files.push_back(file);
+
+		// The last line of an entry is the most recent use
+		std::int64_t time = std::atoll(fields[1].c_str());
+		if (last_uses != nullptr)
+			for (const std::string& entry_file : entry.files)
+				(*last_uses)[entry_file] = std::max((*last_uses)[entry_file], time);
+
+		entries[get_entry_key(entry.kernel_key, entry.additional_cache_key)] = entry;
+	}
+
+	return true;
+}
+
+std::string ShaderCacheManager::get_entry_key(const std::string& kernel_key, const std::string& additional_cache_key)
+{
+	return kernel_key + "\t" + additional_cache_key;
+}
+
+std::string ShaderCacheManager::serialize_entry(const IndexEntry& entry, std::int64_t time)
+{
+	std::string files;
+	for (const std::string& file : entry.files)
+		files += (files.empty() ? "" : ",") + file;
+
+	return "entry\t" + std::to_string(time) + "\t" + entry.kernel_key + "\t" + entry.kernel_function_name + "\t" + entry.sources_hash + "\t" + entry.additional_cache_key + "\t" + files;
+}
+
+void ShaderCacheManager::append_to_index(const std::string& line)
+{
+	std::filesystem::path index_path = std::filesystem::path(HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY) / INDEX_FILE_NAME;
+	bool write_header = !std::filesystem::exists(index_path);
+
+	// One write per line so that the lines of the worker processes of the KernelCompileFarm don't interleave
+	std::ofstream index_file(index_path, std::ios::app);
+	index_file << (write_header ? INDEX_HEADER + "\n" : "") + line + "\n";
+}
+
+void ShaderCacheManager::rewrite_index()
+{
+	std::filesystem::path index_path = std::filesystem::path(HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY) / INDEX_FILE_NAME;
+	std::filesystem::path temporary_path = index_path;
+	temporary_path += ".tmp";
+
+	{
+		std::ofstream index_file(temporary_path);
+		if (!index_file.is_open())
+			return;
+
+		index_file << INDEX_HEADER << "\n";
+		for (auto& key_to_entry : m_entries)
+		{
+			std::int64_t time = 0;
+			for (const std::string& file : key_to_entry.second.files)
+			{
+				auto find = m_files.find(file);
+				if (find != m_files.end())
+					time = std::max(time, find->second.last_use);
+			}
+
+			index_file << serialize_entry(key_to_entry.second, time) << "\n";
+		}
+	}
+
+	// The lines appended by the workers in the meantime are lost, these entries are
+	// then only counted in "Unknown" by the statistics until their next use
+	std::error_code error;
+	std::filesystem::rename(temporary_path, index_path, error);
+}
+
+std::unordered_map<std::string, ShaderCacheManager::CacheFile> ShaderCacheManager::list_cache_files()
+{
+	std::unordered_map<std::string, CacheFile> files;
+
+	std::error_code error;
+	for (std::filesystem::directory_iterator it(HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY, error), end; !error && it != end; it.increment(error))
+	{
+		std::string file_name = it->path().filename().string();
+		if (!it->is_regular_file(error) || file_name.starts_with(INDEX_FILE_NAME))
+			continue;
+
+		CacheFile file;
+		file.size = it->file_size(error);
+		// Same clock as now()
+		file.last_use = std::chrono::duration_cast<std::chrono::seconds>(it->last_write_time(error).time_since_epoch()).count();
+		files[file_name] = file;
+	}
+
+	return files;
+}
+
+std::int64_t ShaderCacheManager::now()
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(std::filesystem::file_time_type::clock::now().time_since_epoch()).count();
+}
+
+void ShaderCacheManager::evict_if_needed(const std::vector<std::string>& protected_files)
+{
+	if (m_size_limit_bytes == 0)
+		return;
+
+	std::uint64_t cache_size = 0;
+	for (auto& name_to_file : m_files)
+		cache_size += name_to_file.second.size;
+	if (cache_size <= m_size_limit_bytes)
+		return;
+
+	std::vector<std::string> files_by_last_use;
+	for (auto& name_to_file : m_files)
+		if (std::find(protected_files.begin(), protected_files.end(), name_to_file.first) == protected_files.end())
+			files_by_last_use.push_back(name_to_file.first);
+	std::sort(files_by_last_use.begin(), files_by_last_use.end(), [this](const std::string& a, const std::string& b) { return m_files[a].last_use < m_files[b].last_use; });
+
+	std::unordered_map<std::string, bool> evicted_files;
+	for (const std::string& file : files_by_last_use)
+	{
+		if (cache_size <= m_size_limit_bytes)
+			break;
+
+		std::error_code error;
+		if (!std::filesystem::remove(std::filesystem::path(HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY) / file, error))
+			continue;
+
+		cache_size -= m_files[file].size;
+		m_files.erase(file);
+		evicted_files[file] = true;
+		m_evicted_file_count++;
+	}
+
+	if (evicted_files.empty())
+		return;
+
+	// The entries with an evicted file would miss anyway
+	for (auto it = m_entries.begin(); it != m_entries.end();)
+	{
+		bool evicted = false;
+		for (const std::string& file : it->second.files)
+			evicted |= evicted_files.find(file) != evicted_files.end();
+
+		if (evicted)
+			it = m_entries.erase(it);
+		else
+			it++;
+	}
+
+	rewrite_index();
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%zu least recently used file(s) evicted from the shader cache.", evicted_files.size());
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef SHADER_CACHE_MANAGER_H
+#define SHADER_CACHE_MANAGER_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ShaderCacheStatistics
+{
+	// Compilations of this process that found their binaries in the shader cache / that had to compile
+	int hit_count = 0;
+	int miss_count = 0;
+	// Hits whose binaries were copied from the shared shader cache
+	int shared_hit_count = 0;
+
+	std::uint64_t size_bytes = 0;
+	// 0 for no limit
+	std::uint64_t size_limit_bytes = 0;
+	int file_count = 0;
+	int evicted_file_count = 0;
+
+	// Number of cache entries (option combinations) of each kernel function. The files
+	// that aren't in the index (compiled by an older version of the application or copied
+	// from a kernel bundle) are counted in "Unknown"
+	std::map<std::string, int> entries_per_kernel;
+};
+
+/**
+ * Keeps an index of the files of the HIPRT shader cache (HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY) to manage it.
+ *
+ * HIPRT names the files of the cache with a hash so the GPUKernelCompiler tells the manager before and after each
+ * compilation which kernel (device, file, function, options, additional cache key) it compiles: the files that appear
+ * in the cache during the compilation are the binaries of that kernel. No new file means that the cache was hit.
+ *
+ * The index is the file INDEX_FILE_NAME in the shader cache. It is only appended to when a kernel is compiled,
+ * the worker processes of the KernelCompileFarm append to it too, and is only rewritten by the eviction.
+ * With it, the manager:
+ *	- keeps statistics of the cache, see get_statistics()
+ *	- evicts the least recently used files of the cache when its size is above the limit given to set_size_limit()
+ *	- looks up the shared shader cache given to set_shared_directory() before compiling. That's a read-only copy of the
+ *		shader cache of another machine (a network share typically, filled by copying the shader cache of a machine
+ *		that compiled the kernels). Its entries are matched by the hash of the sources of the kernel since the additional
+ *		cache keys are built from the modification times of the files, which are different on every machine (see
+ *		KernelBinaryBundle, same thing)
+ */
+class ShaderCacheManager
+{
+public:
+	static const std::string INDEX_FILE_NAME;
+	static const std::string SIZE_LIMIT_COMMANDLINE_ARGUMENT;
+	static const std::string SHARED_DIRECTORY_COMMANDLINE_ARGUMENT;
+
+	/**
+	 * 0 for no limit. Evicts the least recently used files right away if the cache is above the limit
+	 */
+	void set_size_limit(std::uint64_t size_limit_bytes);
+	std::uint64_t get_size_limit() const;
+
+	/**
+	 * Empty for no shared shader cache
+	 */
+	void set_shared_directory(const std::string& shared_directory);
+	const std::string& get_shared_directory() const;
+
+	/**
+	 * Called before compiling the kernel 'kernel_key' (see get_kernel_key()) whose sources hash is 'sources_hash'
+	 * with the additional cache key 'additional_cache_key'.
+	 *
+	 * If the binaries of that kernel aren't in the shader cache but are in the shared shader cache, they
+	 * are copied in the shader cache and the additional cache key that they were compiled with is returned:
+	 * the kernel must be compiled with it for HIPRT to find them. Returns 'additional_cache_key' otherwise
+	 */
+	std::string prepare_compilation(const std::string& kernel_key, const std::string& sources_hash, const std::string& additional_cache_key);
+	/**
+	 * Called after the compilation of prepare_compilation() with the additional
+	 * cache key that prepare_compilation() returned
+	 */
+	void record_compilation(const std::string& kernel_key, const std::string& kernel_function_name, const std::string& sources_hash, const std::string& additional_cache_key);
+
+	static std::string get_kernel_key(const std::string& device_name, const std::string& kernel_file_path, const std::string& kernel_function_name, const std::vector<std::string>& compiler_options);
+
+	ShaderCacheStatistics get_statistics();
+
+	/**
+	 * Removes the whole shader cache from the disk
+	 */
+	void clear();
+
+private:
+	struct IndexEntry
+	{
+		std::string kernel_key;
+		std::string kernel_function_name;
+		std::string sources_hash;
+		std::string additional_cache_key;
+		// Files of the shader cache that the compilation of the kernel wrote
+		std::vector<std::string> files;
+	};
+
+	struct CacheFile
+	{
+		std::uint64_t size = 0;
+		// Seconds since epoch of the last compilation that used the file. Last write time of
+		// the file if it isn't in the index
+		std::int64_t last_use = 0;
+	};
+
+	void load_if_needed();
+	void load_shared_index_if_needed();
+
+	/**
+	 * Reads the index 'index_file_path' into 'entries' (indexed by get_entry_key()) and the last
+	 * use times of the files it mentions into 'last_uses'. Returns false if there is no index
+	 */
+	static bool read_index(const std::string& index_file_path, std::unordered_map<std::string, IndexEntry>& entries, std::unordered_map<std::string, std::int64_t>* last_uses);
+	static std::string get_entry_key(const std::string& kernel_key, const std::string& additional_cache_key);
+	static std::string serialize_entry(const IndexEntry& entry, std::int64_t time);
+	void append_to_index(const std::string& line);
+	void rewrite_index();
+
+	/**
+	 * Sizes and last write times of the files of the shader cache (the index excluded)
+	 */
+	static std::unordered_map<std::string, CacheFile> list_cache_files();
+	static std::int64_t now();
+
+	/**
+	 * Removes the least recently used files, except 'protected_files', until
+	 * the size of the shader cache is below the size limit
+	 */
+	void evict_if_needed(const std::vector<std::string>& protected_files);
+
+	std::uint64_t m_size_limit_bytes = 0;
+	std::string m_shared_directory;
+
+	bool m_loaded = false;
+	std::unordered_map<std::string, IndexEntry> m_entries;
+	std::unordered_map<std::string, CacheFile> m_files;
+
+	bool m_shared_index_loaded = false;
+	// Entries of the shared shader cache indexed by kernel key + sources hash
+	std::unordered_map<std::string, IndexEntry> m_shared_entries;
+
+	// Files of the shader cache just before the compilation of prepare_compilation()
+	std::unordered_map<std::string, CacheFile> m_files_before_compilation;
+	// Files copied from the shared shader cache by prepare_compilation(), empty if the shared cache wasn't hit
+	std::vector<std::string> m_shared_hit_files;
+
+	int m_hit_count = 0;
+	int m_miss_count = 0;
+	int m_shared_hit_count = 0;
+	int m_evicted_file_count = 0;
+
+	std::mutex m_mutex;
+};
+
+#endif
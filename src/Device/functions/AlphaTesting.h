@@ -8,8 +8,11 @@
 
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Material.h"
+#include "Device/includes/RayStatistics.h"
+#include "Device/includes/SceneInstances.h"
 
 #include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/TriangleOpacity.h"
 
 struct AlphaTestingPayload
 {
@@ -23,8 +26,23 @@ HIPRT_DEVICE HIPRT_INLINE bool alpha_testing(const hiprtRay&, const void*, void*
 	if (!payload->render_data->render_settings.do_alpha_testing)
 		return false;
 
-	int material_index = payload->render_data->buffers.material_indices[hit.primID];
-	RendererMaterial material = payload->render_data->buffers.materials_buffer[material_index];
+	count_ray_statistic(*payload->render_data, RAY_STATISTIC_ALPHA_TESTS);
+
+	int mesh_triangle_index = get_hit_mesh_triangle(*payload->render_data, hit);
+	// Most triangles are classified at load time, without having to read their material or texture
+	int triangle_opacity = get_triangle_opacity(payload->render_data->buffers.triangle_opacities, mesh_triangle_index);
+	if (triangle_opacity == TRIANGLE_OPACITY_MICROMAP)
+		// The foliage triangles are mostly opaque or transparent micro-triangles,
+		// only their borders need the texture
+		triangle_opacity = get_opacity_micromap_opacity(payload->render_data->buffers.opacity_micromaps, payload->render_data->buffers.triangle_opacity_micromap_indices[mesh_triangle_index], hit.uv);
+
+	if (triangle_opacity == TRIANGLE_OPACITY_OPAQUE)
+		return false;
+	else if (triangle_opacity == TRIANGLE_OPACITY_TRANSPARENT)
+		return true;
+
+	int material_index = payload->render_data->buffers.material_indices[mesh_triangle_index];
+	RendererMaterial material = payload->render_data->buffers.materials_buffer[material_index].unpack();
 
 	// Composition both the alpha of the base color texture and the material
 	float base_color_alpha = get_hit_base_color_alpha(*payload->render_data, material, hit);
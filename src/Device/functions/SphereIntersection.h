@@ -0,0 +1,73 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_FUNCTIONS_SPHERE_INTERSECTION_H
+#define DEVICE_FUNCTIONS_SPHERE_INTERSECTION_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/functions/AlphaTesting.h"
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Texture coordinates of the point of a sphere of world space normal 'normal'. The same
+ * equirectangular mapping as the envmap: U around the Y axis, V from the bottom to the top
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float2 get_sphere_texcoords(const float3& normal)
+{
+	float u = 0.5f + atan2(normal.z, normal.x) / M_TWO_PI;
+	float v = 0.5f + asin(hippt::clamp(-1.0f, 1.0f, normal.y)) * M_INV_PI;
+
+	return make_float2(u, v);
+}
+
+/**
+ * Intersection function of the analytic spheres of the scene (custom primitive of
+ * the geometry type HIPRT_GEOMETRY_TYPE_SPHERES), called by HIPRT for each bounding box
+ * of a sphere that the ray traverses. 'hit.primID' is the index of the sphere.
+ *
+ * Fills the distance, the (object space, which is the world space of the spheres) normal and the
+ * texture coordinates (see get_sphere_texcoords()) of 'hit'. Returns false if the ray misses the sphere
+ * in [minT, maxT]
+ */
+HIPRT_DEVICE HIPRT_INLINE bool intersect_sphere(const hiprtRay& ray, const void*, void* payld, hiprtHit& hit)
+{
+	// Same payload as the filter function of the alpha tested meshes, only the scene is read here
+	AlphaTestingPayload* payload = reinterpret_cast<AlphaTestingPayload*>(payld);
+
+	float4 sphere = payload->render_data->buffers.spheres[hit.primID];
+	float3 center = make_float3(sphere.x, sphere.y, sphere.z);
+	float radius = sphere.w;
+
+	// The direction of the rays isn't necessarily normalized
+	float3 center_to_origin = ray.origin - center;
+	float a = hippt::dot(ray.direction, ray.direction);
+	float half_b = hippt::dot(ray.direction, center_to_origin);
+	float c = hippt::dot(center_to_origin, center_to_origin) - radius * radius;
+
+	float delta = half_b * half_b - a * c;
+	if (delta < 0.0f)
+		return false;
+
+	float sqrt_delta = sqrt(delta);
+	// Closest of the two intersections in the interval of the ray, the far one
+	// if the origin of the ray is inside the sphere
+	float t = (-half_b - sqrt_delta) / a;
+	if (t <= ray.minT || t >= ray.maxT)
+	{
+		t = (-half_b + sqrt_delta) / a;
+		if (t <= ray.minT || t >= ray.maxT)
+			return false;
+	}
+
+	hit.t = t;
+	hit.normal = (ray.origin + ray.direction * t - center) / radius;
+	hit.uv = get_sphere_texcoords(hit.normal);
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_ACTIVE_PIXELS_H
+#define DEVICE_ACTIVE_PIXELS_H
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Adds the pixel 'pixel_index' (x + y * res.x, not affected by the low resolution
+ * rendering) to the list of the active pixels of the sample
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void append_active_pixel(const HIPRTRenderData& render_data, uint32_t pixel_index)
+{
+    unsigned int list_index = hippt::atomic_add(&render_data.aux_buffers.active_pixel_counters[0], 1u);
+
+    render_data.aux_buffers.active_pixel_indices[list_index] = pixel_index;
+}
+
+#ifdef __KERNELCC__
+/**
+ * Coordinates of the pixel processed by the calling thread of a per-pixel kernel.
+ *
+ * If render_settings.launch_over_active_pixels is true, the kernel is launched over one row of
+ * threads (see RenderPass::launch_kernel_over_active_pixels_timed()) and the thread 'i' processes the
+ * i-th pixel of the active pixel list built by the ActivePixelCompaction kernel. The active threads are
+ * packed at the beginning of the launch: the blocks past the end of the list return immediately.
+ *
+ * Otherwise, the kernel is launched over the whole image in 2D blocks.
+ *
+ * Returns false if the thread has no pixel to process
+ */
+HIPRT_DEVICE HIPRT_INLINE bool get_thread_pixel(const HIPRTRenderData& render_data, int2 res, uint32_t& x, uint32_t& y)
+{
+    if (render_data.render_settings.launch_over_active_pixels)
+    {
+        uint32_t list_index = blockIdx.x * blockDim.x + threadIdx.x;
+        if (list_index >= render_data.aux_buffers.active_pixel_counters[0])
+            return false;
+
+        uint32_t pixel_index = render_data.aux_buffers.active_pixel_indices[list_index];
+        x = pixel_index % res.x;
+        y = pixel_index / res.x;
+
+        return true;
+    }
+
+    x = blockIdx.x * blockDim.x + threadIdx.x;
+    y = blockIdx.y * blockDim.y + threadIdx.y;
+
+    return x < res.x && y < res.y;
+}
+
+/**
+ * Full resolution pixel of the calling thread of a kernel launched over the low resolution grid (see
+ * HIPRTRenderSettings::get_pixel_launch_resolution()): the thread (i, j) is given the full resolution
+ * pixel (i, j) * render_low_resolution_scaling + temporal_upscaling_jitter, whose camera ray is traced.
+ *
+ * The low resolution pixel of a thread whose full resolution pixel is outside of the image
+ * (the jitter pushed it past the last column or row) is marked inactive and false is returned
+ */
+HIPRT_DEVICE HIPRT_INLINE bool get_thread_low_resolution_pixel(const HIPRTRenderData& render_data, int2 res, uint32_t& x, uint32_t& y)
+{
+    const HIPRTRenderSettings& render_settings = render_data.render_settings;
+
+    int2 launch_resolution = render_settings.get_pixel_launch_resolution(res);
+    uint32_t low_resolution_x = blockIdx.x * blockDim.x + threadIdx.x;
+    uint32_t low_resolution_y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (low_resolution_x >= launch_resolution.x || low_resolution_y >= launch_resolution.y)
+        return false;
+
+    x = low_resolution_x * render_settings.render_low_resolution_scaling + render_settings.temporal_upscaling_jitter.x;
+    y = low_resolution_y * render_settings.render_low_resolution_scaling + render_settings.temporal_upscaling_jitter.y;
+    if (x >= res.x || y >= res.y)
+    {
+        render_data.aux_buffers.pixel_status[low_resolution_x + low_resolution_y * res.x].set_active(false);
+
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Same as get_thread_pixel() for the kernels that trace the camera rays: launched over
+ * the low resolution grid when rendering at low resolution without the active pixel list
+ */
+HIPRT_DEVICE HIPRT_INLINE bool get_thread_camera_ray_pixel(const HIPRTRenderData& render_data, int2 res, uint32_t& x, uint32_t& y)
+{
+    if (render_data.render_settings.launch_over_active_pixels || !render_data.render_settings.do_render_low_resolution())
+        return get_thread_pixel(render_data, res, x, y);
+
+    return get_thread_low_resolution_pixel(render_data, res, x, y);
+}
+#endif
+
+#endif
@@ -8,6 +8,16 @@
 
 #include "HostDeviceCommon/RenderData.h"
 
+/**
+ * Sets the converged sample count of the pixel (-1 if not converged) in its
+ * status and in the converged sample count buffer displayed by the adaptive sampling heatmap
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void set_pixel_converged_sample_count(const HIPRTRenderData& render_data, int pixel_index, int converged_sample_count)
+{
+    render_data.aux_buffers.pixel_status[pixel_index].set_converged_sample_count(converged_sample_count);
+    render_data.aux_buffers.pixel_converged_sample_count[pixel_index] = converged_sample_count;
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE float get_pixel_confidence_interval(const HIPRTRenderData& render_data, int pixel_index, int pixel_sample_count, float& average_luminance)
 {
     float luminance = render_data.buffers.pixels[pixel_index].luminance();
@@ -19,6 +29,22 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float get_pixel_confidence_interval(const HIPRTRe
     return 1.96f * sqrtf(pixel_variance) / sqrtf(pixel_sample_count + 1);
 }
 
+/**
+ * Sensitivity in [adaptive_sampling_perceptual_min_sensitivity, 1] of the eye to the noise of a pixel
+ * of average luminance 'average_luminance'.
+ *
+ * The luminance is tonemapped the same way as the display (exposure + gamma). The sensitivity
+ * is maximal for the mid-tones and falls off towards black and towards white where the noise
+ * is either too dark to see or saturated by the tonemapping
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float get_perceptual_sensitivity(const HIPRTRenderSettings& render_settings, float average_luminance)
+{
+    float tonemapped = 1.0f - expf(-average_luminance * render_settings.adaptive_sampling_perceptual_exposure);
+    float display_value = powf(hippt::clamp(0.0f, 1.0f, tonemapped), 1.0f / render_settings.adaptive_sampling_perceptual_gamma);
+
+    return hippt::max(render_settings.adaptive_sampling_perceptual_min_sensitivity, 4.0f * display_value * (1.0f - display_value));
+}
+
 /**
  * pixel_converged is set to true if the given pixel has reached the noise
  * threshold given in render_data.render_settings.stop_pixel_percentage_converged. It 
@@ -42,26 +68,32 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool adaptive_sampling(const HIPRTRenderData& ren
         // Computing pixel convergence according to adaptive sampling to
         // know whether to keep sampling that pixel or not
 
-        if (aux_buffers.pixel_converged_sample_count[pixel_index] != -1)
-            // Pixel is already converged because we have a value != -1 in the
-            // pixels converged sample count buffer
+        PixelStatus pixel_status = aux_buffers.pixel_status[pixel_index];
+        if (pixel_status.is_converged())
+            // Pixel is already converged
             return false;
 
-        int pixel_sample_count = aux_buffers.pixel_sample_count[pixel_index];
+        if (render_settings.adaptive_sampling_tile_based)
+            // The convergence of the pixels is decided per tile by the
+            // AdaptiveSamplingTileError kernel
+            return true;
+
+        int pixel_sample_count = pixel_status.get_sample_count();
         if (pixel_sample_count > render_settings.adaptive_sampling_min_samples)
         {
             bool pixel_needs_sampling;
             float average_luminance;
             float confidence_interval;
             confidence_interval = get_pixel_confidence_interval(render_data, pixel_index, pixel_sample_count, average_luminance);
+            if (render_settings.adaptive_sampling_perceptual)
+                confidence_interval *= get_perceptual_sensitivity(render_settings, average_luminance);
 
             pixel_needs_sampling = confidence_interval > render_settings.adaptive_sampling_noise_threshold * average_luminance;
             if (!pixel_needs_sampling)
             {
-                if (aux_buffers.pixel_converged_sample_count[pixel_index] == -1)
-                    // Indicates no need to sample anymore by indicating that this pixel has converged
-                    // only if we hadn't indicated the convergence before already
-                    aux_buffers.pixel_converged_sample_count[pixel_index] = pixel_sample_count;
+                // Indicates no need to sample anymore by indicating that this pixel has converged.
+                // We know that we hadn't indicated the convergence before already from the check above
+                set_pixel_converged_sample_count(render_data, pixel_index, pixel_sample_count);
 
                 return false;
             }
@@ -78,7 +110,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool adaptive_sampling(const HIPRTRenderData& ren
     // "stop pixel noise threshold" but only the "stop pixel convergence proportion"
     else if (render_settings.stop_pixel_noise_threshold > 0.0f && render_settings.enable_pixel_stop_noise_threshold)
     {
-        int pixel_sample_count = aux_buffers.pixel_sample_count[pixel_index];
+        PixelStatus pixel_status = aux_buffers.pixel_status[pixel_index];
+        int pixel_sample_count = pixel_status.get_sample_count();
 
         float average_luminance;
         float confidence_interval = get_pixel_confidence_interval(render_data, pixel_index, pixel_sample_count, average_luminance);
@@ -90,17 +123,105 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool adaptive_sampling(const HIPRTRenderData& ren
             // At least 2 samples because we can't evaluate the variance with only 1 sample
             && (render_settings.sample_number > 1);
 
-        int current_converged_count = aux_buffers.pixel_converged_sample_count[pixel_index];
-        if (pixel_converged && current_converged_count == -1)
+        bool already_converged = pixel_status.is_converged();
+        if (pixel_converged && !already_converged)
             // If the pixel has converged, storing the number of samples at which it has converged.
-            // We're only storing the number of samples if we hadn't already (if the value in the buffer is -1)
-            aux_buffers.pixel_converged_sample_count[pixel_index] = pixel_sample_count;
-        else if (!pixel_converged)
-            // If the pixel hasn't converged
-            aux_buffers.pixel_converged_sample_count[pixel_index] = -1;
+            // We're only storing the number of samples if we hadn't already
+            set_pixel_converged_sample_count(render_data, pixel_index, pixel_sample_count);
+        else if (!pixel_converged && already_converged)
+            // If the pixel hasn't converged (anymore)
+            set_pixel_converged_sample_count(render_data, pixel_index, -1);
     }
 
     return true;
 }
 
+/**
+ * Marks the pixel as having fallen back from ReSTIR DI to the sampling strategy
+ * of the later bounces if its noise is below ReSTIRDISettings::fallback_noise_threshold
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void update_ReSTIR_DI_fallback(const HIPRTRenderData& render_data, int pixel_index)
+{
+    const HIPRTRenderSettings& render_settings = render_data.render_settings;
+    if (render_settings.restir_di_settings.fallback_noise_threshold <= 0.0f || !render_settings.has_access_to_adaptive_sampling_buffers() || render_settings.adaptive_sampling_tile_based)
+        return;
+
+    PixelStatus pixel_status = render_data.aux_buffers.pixel_status[pixel_index];
+    int pixel_sample_count = pixel_status.get_sample_count();
+    if (pixel_status.is_ReSTIR_DI_fallback() || pixel_sample_count <= render_settings.adaptive_sampling_min_samples)
+        return;
+
+    float average_luminance;
+    float confidence_interval = get_pixel_confidence_interval(render_data, pixel_index, pixel_sample_count, average_luminance);
+    if (confidence_interval <= render_settings.restir_di_settings.fallback_noise_threshold * average_luminance)
+        render_data.aux_buffers.pixel_status[pixel_index].set_ReSTIR_DI_fallback(true);
+}
+
+/**
+ * Accumulates the luminance of the sample of the pixel in the buffers of the adaptive sampling.
+ * 
+ * The samples whose index (for that pixel, 1-based) is even also go in the half buffer
+ * of the tile based adaptive sampling: the half buffer and the full image are two
+ * estimates of the pixel whose difference is the error estimate of AdaptiveSamplingTileError
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void accumulate_adaptive_sampling_buffers(const HIPRTRenderData& render_data, int pixel_index, float luminance, float squared_luminance)
+{
+    render_data.aux_buffers.pixel_squared_luminance[pixel_index] += squared_luminance;
+
+    if (render_data.render_settings.adaptive_sampling_tile_based && (render_data.aux_buffers.pixel_status[pixel_index].get_sample_count() & 1) == 0)
+        render_data.aux_buffers.pixel_half_luminance[pixel_index] += luminance;
+}
+
+/**
+ * Average luminance of the pixel 'pixel_index' and difference with the average luminance
+ * of its half buffer, for the error estimate of the tile of the pixel.
+ * 
+ * Returns false if the pixel can't be used for the error estimate yet: not enough samples
+ * or already converged
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool get_adaptive_sampling_tile_pixel_error(const HIPRTRenderData& render_data, int pixel_index, float& out_luminance, float& out_difference)
+{
+    PixelStatus pixel_status = render_data.aux_buffers.pixel_status[pixel_index];
+    if (pixel_status.is_converged())
+        return false;
+
+    int pixel_sample_count = pixel_status.get_sample_count();
+    if (pixel_sample_count < hippt::max(2, render_data.render_settings.adaptive_sampling_tile_min_samples))
+        return false;
+
+    out_luminance = render_data.buffers.pixels[pixel_index].luminance() / pixel_sample_count;
+    float half_luminance = render_data.aux_buffers.pixel_half_luminance[pixel_index] / (pixel_sample_count / 2);
+    out_difference = hippt::abs(out_luminance - half_luminance);
+
+    return true;
+}
+
+/**
+ * Whether a tile has converged given the sums over each of its 4 quadrants of the luminances and
+ * differences of get_adaptive_sampling_tile_pixel_error().
+ * 
+ * The relative error (mean difference over mean luminance) of the whole tile and of each of its quadrants
+ * must be below the threshold: a small noisy feature of the tile doesn't average out in the error of the tile
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool adaptive_sampling_tile_converged(const HIPRTRenderData& render_data, const float* quadrant_luminances, const float* quadrant_differences)
+{
+    // Avoids black tiles never converging
+    constexpr float LUMINANCE_EPSILON = 1.0e-6f;
+
+    float threshold = render_data.render_settings.adaptive_sampling_tile_error_threshold;
+
+    float tile_luminance = 0.0f;
+    float tile_difference = 0.0f;
+    for (int quadrant = 0; quadrant < 4; quadrant++)
+    {
+        if (quadrant_differences[quadrant] > threshold * (quadrant_luminances[quadrant] + LUMINANCE_EPSILON))
+            return false;
+
+        tile_luminance += quadrant_luminances[quadrant];
+        tile_difference += quadrant_differences[quadrant];
+    }
+
+    return tile_difference <= threshold * (tile_luminance + LUMINANCE_EPSILON);
+}
+
 #endif
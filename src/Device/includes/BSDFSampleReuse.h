@@ -0,0 +1,108 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_BSDF_SAMPLE_REUSE_H
+#define DEVICE_BSDF_SAMPLE_REUSE_H
+
+#include "Device/includes/Intersect.h"
+#include "Device/includes/RayCone.h"
+#include "Device/includes/RayPayload.h"
+#include "Device/includes/RayStatistics.h"
+#include "Device/includes/RayVolumeState.h"
+#include "Device/includes/SceneInstances.h"
+
+#include "HostDeviceCommon/HitInfo.h"
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * BSDF sample of the direct lighting that becomes the next bounce of the path
+ * when ReuseMISBSDFSampleForBounce is true, see trace_reused_BSDF_sample()
+ */
+struct BSDFSampleReuse
+{
+    /**
+     * Keeps a BSDF sample of PDF 0 so that the path is terminated
+     * as if it had sampled that invalid direction itself
+     */
+    HIPRT_HOST_DEVICE void reject()
+    {
+        filled = true;
+        bsdf_pdf = 0.0f;
+    }
+
+    // Whether the direct lighting sampled the BSDF for the next bounce.
+    // If not, the path tracer samples the next bounce itself
+    bool filled = false;
+    // Whether 'ray' hit the scene
+    bool hit_found = false;
+
+    hiprtRay ray;
+    ColorRGB32F bsdf_color;
+    float bsdf_pdf = 0.0f;
+
+    // Intersection of 'ray' and the state of the path after that intersection
+    HitInfo hit_info;
+    SimplifiedRendererMaterial material;
+    RayVolumeState volume_state;
+    RayCone ray_cone;
+};
+
+/**
+ * Traces the BSDF sample 'bsdf_ray' of the direct lighting with a closest hit traversal of the whole
+ * scene (as trace_ray() would for the next bounce) and stores it in 'out_reuse'.
+ *
+ * 'sample_volume_state' is the volume state updated by the bsdf_dispatcher_sample() call that sampled
+ * 'bsdf_ray'. Returns true if the scene is hit, in which case 'out_light_hit_info' is filled the same
+ * way as evaluate_shadow_light_ray() would, for the MIS / RIS weights of the BSDF sample
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool trace_reused_BSDF_sample(const HIPRTRenderData& render_data, const hiprtRay& bsdf_ray, const RayPayload& ray_payload, const RayVolumeState& sample_volume_state,
+    const ColorRGB32F& bsdf_color, float bsdf_pdf, BSDFSampleReuse& out_reuse, ShadowLightRayHitInfo& out_light_hit_info, Xorshift32Generator& random_number_generator)
+{
+    count_ray_statistic(render_data, RAY_STATISTIC_INDIRECT_RAYS);
+
+    // Same state as the path when it traces its next bounce
+    RayPayload bounce_payload;
+    // The BSDF sample is also the light sample of the current bounce so it sees the same LODs as its shadow rays
+    bounce_payload.geometry_lod_ray_mask = ray_payload.geometry_lod_ray_mask;
+    bounce_payload.volume_state = sample_volume_state;
+    bounce_payload.ray_cone = ray_payload.ray_cone;
+    bounce_payload.ray_cone.scatter(ray_payload.material.roughness);
+
+    out_reuse.filled = true;
+    out_reuse.ray = bsdf_ray;
+    out_reuse.bsdf_color = bsdf_color;
+    out_reuse.bsdf_pdf = bsdf_pdf;
+    out_reuse.hit_found = trace_ray(render_data, bsdf_ray, bounce_payload, out_reuse.hit_info, random_number_generator);
+    out_reuse.material = bounce_payload.material;
+    out_reuse.volume_state = bounce_payload.volume_state;
+    out_reuse.ray_cone = bounce_payload.ray_cone;
+
+    if (!out_reuse.hit_found)
+        return false;
+
+    // Not 'hit_info.t' that only covers the last segment of the ray if volume boundaries were skipped
+    out_light_hit_info.hit_distance = hippt::length(out_reuse.hit_info.inter_point - bsdf_ray.origin);
+    out_light_hit_info.hit_shading_normal = out_reuse.hit_info.shading_normal;
+    if (is_sphere_instance(render_data, out_reuse.hit_info.instance_index))
+    {
+        // Same as read_shadow_light_ray_hit(): the spheres aren't light sampled
+        out_light_hit_info.hit_prim_index = -1;
+        out_light_hit_info.hit_emission = ColorRGB32F(0.0f);
+
+        return true;
+    }
+
+    const SceneInstance& instance = render_data.buffers.instances[out_reuse.hit_info.instance_index];
+    // Same as read_shadow_light_ray_hit() for the LODs
+    out_light_hit_info.hit_prim_index = is_geometry_lod_instance(render_data, out_reuse.hit_info.instance_index) ? -1 : get_scene_primitive_index(instance, out_reuse.hit_info.primitive_index);
+    // Already read from the emissive texture if any by trace_ray()
+    out_light_hit_info.hit_emission = out_reuse.material.get_emission();
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_DENOISER_AOVS_H
+#define DEVICE_DENOISER_AOVS_H
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/Octahedral.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/RGB9E5.h"
+
+/**
+ * Value of the packed denoiser normals buffer for a pixel whose accumulated normal
+ * is the zero vector (only camera rays that missed the scene so far).
+ *
+ * octahedral_encode_32() never produces it because the snorm components are clamped to [-32767, 32767]
+ */
+#define DENOISER_NORMAL_PACKED_ZERO 0x8000u
+
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int pack_denoiser_normal(const float3& normal)
+{
+    if (normal.x == 0.0f && normal.y == 0.0f && normal.z == 0.0f)
+        return DENOISER_NORMAL_PACKED_ZERO;
+
+    return octahedral_encode_32(normal);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 unpack_denoiser_normal(unsigned int packed)
+{
+    if (packed == DENOISER_NORMAL_PACKED_ZERO)
+        return make_float3(0.0f, 0.0f, 0.0f);
+
+    return octahedral_decode_32(packed);
+}
+
+/**
+ * Running average of the denoiser normal of a pixel with the normal of the new sample.
+ * 'accumulated_normal' is returned as is if the average is the zero vector
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 average_denoiser_normal(const float3& accumulated_normal, const float3& new_normal, float accumulation_counter)
+{
+    float3 average = (accumulated_normal * accumulation_counter + new_normal) / (accumulation_counter + 1.0f);
+    float normal_length = hippt::length(average);
+    if (normal_length != 0.0f)
+        // Checking that it is non-zero otherwise we would accumulate a persistent NaN in the buffer when normalizing by the 0-length
+        return average / normal_length;
+
+    return accumulated_normal;
+}
+
+/**
+ * Accumulates the albedo and normal of the sample of the pixel in the denoiser AOVs.
+ *
+ * With PackedDenoiserAOVs, the accumulation happens in the 32 bits per pixel
+ * 'packed_denoiser_albedo' (RGB9E5) and 'packed_denoiser_normals' (octahedral) buffers
+ * which are expanded to 'denoiser_albedo' and 'denoiser_normals' by the UnpackDenoiserAOVs
+ * kernel once per frame
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void accumulate_denoiser_AOVs(const HIPRTRenderData& render_data, uint32_t pixel_index, const ColorRGB32F& denoiser_albedo, const float3& denoiser_normal)
+{
+    float accumulation_counter = render_data.render_settings.denoiser_AOV_accumulation_counter;
+
+#if PackedDenoiserAOVs == KERNEL_OPTION_TRUE
+    if (render_data.render_settings.sample_number == 0)
+    {
+        render_data.aux_buffers.packed_denoiser_albedo[pixel_index] = rgb9e5_encode(denoiser_albedo);
+        render_data.aux_buffers.packed_denoiser_normals[pixel_index] = pack_denoiser_normal(denoiser_normal);
+    }
+    else
+    {
+        ColorRGB32F accumulated_albedo = rgb9e5_decode(render_data.aux_buffers.packed_denoiser_albedo[pixel_index]);
+        accumulated_albedo = (accumulated_albedo * accumulation_counter + denoiser_albedo) / (accumulation_counter + 1.0f);
+        render_data.aux_buffers.packed_denoiser_albedo[pixel_index] = rgb9e5_encode(accumulated_albedo);
+
+        unsigned int packed_normal = render_data.aux_buffers.packed_denoiser_normals[pixel_index];
+        float3 accumulated_normal = average_denoiser_normal(unpack_denoiser_normal(packed_normal), denoiser_normal, accumulation_counter);
+        render_data.aux_buffers.packed_denoiser_normals[pixel_index] = pack_denoiser_normal(accumulated_normal);
+    }
+#else
+    if (render_data.render_settings.sample_number == 0)
+    {
+        render_data.aux_buffers.denoiser_albedo[pixel_index] = denoiser_albedo;
+        render_data.aux_buffers.denoiser_normals[pixel_index] = denoiser_normal;
+    }
+    else
+    {
+        render_data.aux_buffers.denoiser_albedo[pixel_index] = (render_data.aux_buffers.denoiser_albedo[pixel_index] * accumulation_counter + denoiser_albedo) / (accumulation_counter + 1.0f);
+        render_data.aux_buffers.denoiser_normals[pixel_index] = average_denoiser_normal(render_data.aux_buffers.denoiser_normals[pixel_index], denoiser_normal, accumulation_counter);
+    }
+#endif
+}
+
+#endif
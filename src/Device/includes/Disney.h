@@ -13,6 +13,7 @@
 #include "Device/includes/Sampling.h"
 #include "HostDeviceCommon/Math.h"
 #include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/PackedMaterial.h"
 #include "HostDeviceCommon/Xorshift.h"
 
 /** References:
@@ -167,7 +168,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float3 disney_clearcoat_sample(const SimplifiedRe
 }
 
 // TODO have materials_buffer as a global variable to avoid having to pass it around like that?
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_glass_eval(const RendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& local_view_direction, const float3& local_to_light_direction, float& pdf)
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_glass_eval(const PackedRendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& local_view_direction, const float3& local_to_light_direction, float& pdf)
 {
     float NoV = local_view_direction.z;
     float NoL = local_to_light_direction.z;
@@ -180,8 +181,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_glass_eval(const RendererMater
     bool reflecting = NoL * NoV > 0;
 
     // Relative eta = eta_t / eta_i
-    float eta_t = ray_volume_state.outgoing_mat_index == InteriorStackImpl<InteriorStackStrategy>::MAX_MATERIAL_INDEX ? 1.0 : materials_buffer[ray_volume_state.outgoing_mat_index].ior;
-    float eta_i = ray_volume_state.incident_mat_index == InteriorStackImpl<InteriorStackStrategy>::MAX_MATERIAL_INDEX ? 1.0 : materials_buffer[ray_volume_state.incident_mat_index].ior;
+    float eta_t = ray_volume_state.outgoing_mat_index == InteriorStackImpl<InteriorStackStrategy>::MAX_MATERIAL_INDEX ? 1.0 : materials_buffer[ray_volume_state.outgoing_mat_index].get_ior();
+    float eta_i = ray_volume_state.incident_mat_index == InteriorStackImpl<InteriorStackStrategy>::MAX_MATERIAL_INDEX ? 1.0 : materials_buffer[ray_volume_state.incident_mat_index].get_ior();
     float relative_eta = eta_t / eta_i;
 
     // relative_eta can be 1 when refracting from a volume into another volume of the same IOR.
@@ -271,11 +272,11 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_glass_eval(const RendererMater
             // by this material that the ray has been absorbed. The ray has been absorded by the volume
             // it was in before refracting here, so it's the incident mat index
 
-            const SimplifiedRendererMaterial& incident_material = materials_buffer[ray_volume_state.incident_mat_index];
+            const PackedRendererMaterial& incident_material = materials_buffer[ray_volume_state.incident_mat_index];
             // Remapping the absorption coefficient so that it is more intuitive to manipulate
             // according to Burley, 2015 [5].
             // This effectively gives us a "at distance" absorption coefficient.
-            ColorRGB32F absorption_coefficient = log(incident_material.absorption_color) / incident_material.absorption_at_distance;
+            ColorRGB32F absorption_coefficient = log(incident_material.get_absorption_color()) / incident_material.get_absorption_at_distance();
             color = color * exp(absorption_coefficient * ray_volume_state.distance_in_volume);
 
             // We changed volume so we're resetting the distance
@@ -292,11 +293,11 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_glass_eval(const RendererMater
 /**
  * The sampled direction is returned in the local shading frame of the basis used for 'local_view_direction'
  */
-HIPRT_HOST_DEVICE HIPRT_INLINE float3 disney_glass_sample(const RendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& local_view_direction, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 disney_glass_sample(const PackedRendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& local_view_direction, Xorshift32Generator& random_number_generator)
 {
     // Relative eta = eta_t / eta_i
-    float eta_t = ray_volume_state.outgoing_mat_index == InteriorStackImpl<InteriorStackStrategy>::MAX_MATERIAL_INDEX ? 1.0 : materials_buffer[ray_volume_state.outgoing_mat_index].ior;
-    float eta_i = ray_volume_state.incident_mat_index == InteriorStackImpl<InteriorStackStrategy>::MAX_MATERIAL_INDEX ? 1.0 : materials_buffer[ray_volume_state.incident_mat_index].ior;
+    float eta_t = ray_volume_state.outgoing_mat_index == InteriorStackImpl<InteriorStackStrategy>::MAX_MATERIAL_INDEX ? 1.0 : materials_buffer[ray_volume_state.outgoing_mat_index].get_ior();
+    float eta_i = ray_volume_state.incident_mat_index == InteriorStackImpl<InteriorStackStrategy>::MAX_MATERIAL_INDEX ? 1.0 : materials_buffer[ray_volume_state.incident_mat_index].get_ior();
     float relative_eta = eta_t / eta_i;
     // To avoid sampling directions that would lead to a null half_vector. 
     // Explained in more details in glass_eval.
@@ -349,7 +350,38 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_sheen_eval(const SimplifiedRen
     return sheen_color * hippt::pow5(1.0f - HoL);
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_eval(const RendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, float3 shading_normal, const float3& to_light_direction, float& pdf)
+/**
+ * Parameters of the lobes that MaterialFeatures can compile out: 0 if the lobe isn't compiled in
+ * so that the lobe is eliminated from disney_bsdf_eval() and disney_bsdf_sample()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float disney_clearcoat(const SimplifiedRendererMaterial& material)
+{
+#if MaterialFeatures & MATERIAL_FEATURE_CLEARCOAT
+    return material.clearcoat;
+#else
+    return 0.0f;
+#endif
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float disney_sheen(const SimplifiedRendererMaterial& material)
+{
+#if MaterialFeatures & MATERIAL_FEATURE_SHEEN
+    return material.sheen;
+#else
+    return 0.0f;
+#endif
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float disney_specular_transmission(const SimplifiedRendererMaterial& material)
+{
+#if MaterialFeatures & MATERIAL_FEATURE_SPECULAR_TRANSMISSION
+    return material.specular_transmission;
+#else
+    return 0.0f;
+#endif
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_eval(const PackedRendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, float3 shading_normal, const float3& to_light_direction, float& pdf)
 {
     pdf = 0.0f;
 
@@ -368,18 +400,25 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_eval(const RendererMateri
     float3 local_to_light_direction = world_to_local_frame(T, B, shading_normal, to_light_direction);
     float3 local_half_vector = hippt::normalize(local_view_direction + local_to_light_direction);
 
+#if MaterialFeatures & MATERIAL_FEATURE_ANISOTROPY
     // Rotated ONB for the anisotropic GTR2 evaluation (metallic and glass only)
     float3 TR, BR;
     build_rotated_ONB(shading_normal, TR, BR, material.anisotropic_rotation * M_PI);
     float3 local_view_direction_rotated = world_to_local_frame(TR, BR, shading_normal, view_direction);
     float3 local_to_light_direction_rotated = world_to_local_frame(TR, BR, shading_normal, to_light_direction);
     float3 local_half_vector_rotated = hippt::normalize(local_view_direction_rotated + local_to_light_direction_rotated);
+#else
+    // No anisotropic material in the scene, the lobes are isotropic in any frame
+    float3 local_view_direction_rotated = local_view_direction;
+    float3 local_to_light_direction_rotated = local_to_light_direction;
+    float3 local_half_vector_rotated = local_half_vector;
+#endif
 
-    float glass_weight = (1.0f - material.metallic) * material.specular_transmission;
-    float diffuse_weight = (1.0f - material.metallic) * (1.0f - material.specular_transmission) * outside_object;
-    float metal_weight = (1.0f - material.specular_transmission * (1.0f - material.metallic)) * outside_object;
-    float clearcoat_weight = 0.25f * material.clearcoat * outside_object;
-    float sheen_weight = (1.0f - material.metallic) * material.sheen * outside_object;
+    float glass_weight = (1.0f - material.metallic) * disney_specular_transmission(material);
+    float diffuse_weight = (1.0f - material.metallic) * (1.0f - disney_specular_transmission(material)) * outside_object;
+    float metal_weight = (1.0f - disney_specular_transmission(material) * (1.0f - material.metallic)) * outside_object;
+    float clearcoat_weight = 0.25f * disney_clearcoat(material) * outside_object;
+    float sheen_weight = (1.0f - material.metallic) * disney_sheen(material) * outside_object;
 
     float weight_sum = (diffuse_weight + metal_weight + clearcoat_weight + glass_weight + sheen_weight);
 
@@ -401,7 +440,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_eval(const RendererMateri
     // Metallic
     // Computing a custom fresnel term based on the material specular, specular tint, ... coefficients
     ColorRGB32F metallic_fresnel = disney_metallic_fresnel(material, local_half_vector, local_to_light_direction);
-    metal_weight = (1.0f - material.specular_transmission * (1.0f - material.metallic));
+    metal_weight = (1.0f - disney_specular_transmission(material) * (1.0f - material.metallic));
     final_color += metal_weight > 0 && outside_object ? metal_weight * disney_metallic_eval(material, local_view_direction_rotated, local_to_light_direction_rotated, local_half_vector_rotated, metallic_fresnel, tmp_pdf) : ColorRGB32F(0.0f);
     pdf += tmp_pdf * metal_proba;
     tmp_pdf = 0.0f;
@@ -423,13 +462,13 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_eval(const RendererMateri
     return final_color;
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_sample(const RendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, const float3& shading_normal, const float3& geometric_normal, float3& output_direction, float& pdf, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_sample(const PackedRendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, const float3& shading_normal, const float3& geometric_normal, float3& output_direction, float& pdf, Xorshift32Generator& random_number_generator)
 {
     pdf = 0.0f;
 
     float3 normal = shading_normal;
 
-    float glass_weight = (1.0f - material.metallic) * material.specular_transmission;
+    float glass_weight = (1.0f - material.metallic) * disney_specular_transmission(material);
     bool outside_object = hippt::dot(view_direction, normal) > 0;
     if (hippt::isZERO(glass_weight) && !outside_object)
     {
@@ -453,9 +492,9 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_sample(const RendererMate
         outside_object = true;
     }
 
-    float diffuse_weight = (1.0f - material.metallic) * (1.0f - material.specular_transmission) * outside_object;
-    float metal_weight = (1.0f - material.specular_transmission * (1.0f - material.metallic)) * outside_object;
-    float clearcoat_weight = 0.25f * material.clearcoat * outside_object;
+    float diffuse_weight = (1.0f - material.metallic) * (1.0f - disney_specular_transmission(material)) * outside_object;
+    float metal_weight = (1.0f - disney_specular_transmission(material) * (1.0f - material.metallic)) * outside_object;
+    float clearcoat_weight = 0.25f * disney_clearcoat(material) * outside_object;
 
     // No sheen weight here because we're not importance sampling the sheen weight,
     // it's pretty weak of a lobe so there's no need to bother
@@ -511,19 +550,32 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F disney_bsdf_sample(const RendererMate
     // Rotated ONB for the anisotropic GTR2 evaluation (metallic and glass only)
     float3 local_view_direction_rotated;
     float3 TR, BR;
+#if MaterialFeatures & MATERIAL_FEATURE_ANISOTROPY
     build_rotated_ONB(normal, TR, BR, material.anisotropic_rotation * M_PI);
+#else
+    build_ONB(normal, TR, BR);
+#endif
     local_view_direction_rotated = world_to_local_frame(TR, BR, normal, view_direction);
 
     if (rand_1 < cdf[0])
         output_direction = disney_diffuse_sample(normal, random_number_generator);
     else if (rand_1 < cdf[1])
         output_direction = local_to_world_frame(TR, BR, normal, disney_metallic_sample(material, local_view_direction_rotated, random_number_generator));
+#if MaterialFeatures & MATERIAL_FEATURE_CLEARCOAT
     else if (rand_1 < cdf[2])
         output_direction = local_to_world_frame(TR, BR, normal, disney_clearcoat_sample(material, local_view_direction_rotated, random_number_generator));
+#endif
+#if MaterialFeatures & MATERIAL_FEATURE_SPECULAR_TRANSMISSION
     else
         // When sampling the glass lobe, if we're reflecting off the glass, we're going to have to pop the stack.
         // This is handled inside glass_sample because we cannot know from here if we refracted or reflected
         output_direction = local_to_world_frame(TR, BR, normal, disney_glass_sample(materials_buffer, material, ray_volume_state, local_view_direction_rotated, random_number_generator));
+#else
+    else
+        // Only reached because of the float rounding of the CDF when the scene has no glass,
+        // the PDF of the direction is given by the evaluation of the BSDF anyways
+        output_direction = local_to_world_frame(TR, BR, normal, disney_metallic_sample(material, local_view_direction_rotated, random_number_generator));
+#endif
 
     if (hippt::dot(output_direction, shading_normal) < 0 && !(rand_1 > cdf[2]))
         // It can happen that the light direction sampled is below the surface. 
@@ -10,8 +10,9 @@
 #include "Device/includes/Lambertian.h"
 #include "Device/includes/OrenNayar.h"
 #include "Device/includes/RayPayload.h"
+#include "Device/includes/SimplifiedBSDF.h"
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F bsdf_dispatcher_eval(const RendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, const float3& surface_normal, const float3& to_light_direction, float& pdf)
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F bsdf_dispatcher_eval(const PackedRendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, const float3& surface_normal, const float3& to_light_direction, float& pdf)
 {
 #if BSDFOverride == BSDF_NONE
 	/*switch (switch_on)
@@ -21,6 +22,11 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F bsdf_dispatcher_eval(const RendererMa
 	default:
 		break;
 	}*/
+#if DeepBouncesSimplifiedBSDF == KERNEL_OPTION_TRUE
+    if (material.brdf_type == BRDF::SimplifiedLambertGGX)
+        return simplified_bsdf_eval(material, view_direction, surface_normal, to_light_direction, pdf);
+#endif
+
     return disney_bsdf_eval(materials_buffer, material, ray_volume_state, view_direction, surface_normal, to_light_direction, pdf);
 #elif BSDFOverride == BSDF_LAMBERTIAN
 	return lambertian_brdf_eval(material, view_direction, surface_normal, to_light_direction, pdf);
@@ -31,7 +37,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F bsdf_dispatcher_eval(const RendererMa
 #endif
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F bsdf_dispatcher_sample(const RendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, const float3& surface_normal, const float3& geometric_normal, float3& sampled_direction, float& pdf, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F bsdf_dispatcher_sample(const PackedRendererMaterial* materials_buffer, const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, const float3& surface_normal, const float3& geometric_normal, float3& sampled_direction, float& pdf, Xorshift32Generator& random_number_generator)
 {
 #if BSDFOverride == BSDF_NONE
 	/*switch (switch_on)
@@ -41,6 +47,11 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F bsdf_dispatcher_sample(const Renderer
 	default:
 		break;
 	}*/
+#if DeepBouncesSimplifiedBSDF == KERNEL_OPTION_TRUE
+    if (material.brdf_type == BRDF::SimplifiedLambertGGX)
+        return simplified_bsdf_sample(material, ray_volume_state, view_direction, surface_normal, geometric_normal, sampled_direction, pdf, random_number_generator);
+#endif
+
     return disney_bsdf_sample(materials_buffer, material, ray_volume_state, view_direction, surface_normal, geometric_normal, sampled_direction, pdf, random_number_generator);
 #elif BSDFOverride == BSDF_LAMBERTIAN
 	return lambertian_brdf_sample(material, view_direction, surface_normal, sampled_direction, pdf, random_number_generator);
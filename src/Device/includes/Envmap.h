@@ -9,8 +9,10 @@
 #include "Device/includes/Dispatcher.h"
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Intersect.h"
+#include "Device/includes/RuntimeOptions.h"
 #include "Device/includes/Sampling.h"
 #include "Device/includes/Texture.h"
+#include "Device/includes/VisibilityCache.h"
 #include "HostDeviceCommon/Math.h"
 #include "HostDeviceCommon/Color.h"
 #include "HostDeviceCommon/HitInfo.h"
@@ -42,62 +44,81 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void envmap_cdf_search(const WorldSettings& world
 {
     //First searching a line to sample
     unsigned int lower = 0;
-    int upper = world_settings.envmap_height - 1;
+    int upper = world_settings.envmap_sampling_height - 1;
 
-    int x_index = world_settings.envmap_width - 1;
+    int x_index = world_settings.envmap_sampling_width - 1;
     while (lower < upper)
     {
         int y_index = (lower + upper) / 2;
-        int env_map_index = y_index * world_settings.envmap_width + x_index;
+        int env_map_index = y_index * world_settings.envmap_sampling_width + x_index;
 
         if (value < world_settings.envmap_cdf[env_map_index])
             upper = y_index;
         else
             lower = y_index + 1;
     }
-    y = hippt::max(hippt::min(lower, world_settings.envmap_height), 0u);
+    y = hippt::max(hippt::min(lower, world_settings.envmap_sampling_height), 0u);
 
     //Then sampling the line itself
     lower = 0;
-    upper = world_settings.envmap_width - 1;
+    upper = world_settings.envmap_sampling_width - 1;
 
     int y_index = y;
     while (lower < upper)
     {
         int x_idx = (lower + upper) / 2;
-        int env_map_index = y_index * world_settings.envmap_width + x_idx;
+        int env_map_index = y_index * world_settings.envmap_sampling_width + x_idx;
 
         if (value < world_settings.envmap_cdf[env_map_index])
             upper = x_idx;
         else
             lower = x_idx + 1;
     }
-    x = hippt::max(hippt::min(lower, world_settings.envmap_width), 0u);
+    x = hippt::max(hippt::min(lower, world_settings.envmap_sampling_width), 0u);
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_sample(const WorldSettings& world_settings, float3& sampled_direction, float& envmap_pdf, Xorshift32Generator& random_number_generator)
+/**
+ * Binary search of the first element of the 'count' first elements of 'cdf' that is
+ * strictly greater than 'value'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int envmap_cdf_upper_bound(const float* cdf, int count, float value)
 {
-    int x, y;
-    float env_map_total_sum = world_settings.envmap_total_sum;
+    int lower = 0;
+    int upper = count - 1;
+    while (lower < upper)
+    {
+        int middle = (lower + upper) / 2;
 
-#if EnvmapSamplingStrategy == ESS_BINARY_SEARCH
-    // Importance sampling a texel of the envmap with a binary search on the CDF
-    envmap_cdf_search(world_settings, random_number_generator() * env_map_total_sum, x, y);
-#else
-    int random_index = random_number_generator.random_index(world_settings.envmap_height * world_settings.envmap_width);
-    float probability = world_settings.alias_table_probas[random_index];
-    if (random_number_generator() > probability)
-        // Picking the alias
-        random_index = world_settings.alias_table_alias[random_index];
-
-    y = static_cast<int>(random_index / world_settings.envmap_width);
-    x = static_cast<int>(random_index - y * world_settings.envmap_width);
-#endif
+        if (value < cdf[middle])
+            upper = middle;
+        else
+            lower = middle + 1;
+    }
 
-    // Converting to UV coordinates
-    float u = static_cast<float>(x) / world_settings.envmap_width;
-    float v = static_cast<float>(y) / world_settings.envmap_height;
+    return lower;
+}
 
+/**
+ * Samples a texel of the envmap by first sampling a row with the marginal CDF
+ * and then a column in that row with the conditional CDF of the row
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void envmap_marginal_conditional_search(const WorldSettings& world_settings, Xorshift32Generator& random_number_generator, int& x, int& y)
+{
+    int width = world_settings.envmap_sampling_width;
+    int height = world_settings.envmap_sampling_height;
+
+    y = envmap_cdf_upper_bound(world_settings.envmap_marginal_cdf, height, random_number_generator() * world_settings.envmap_marginal_cdf[height - 1]);
+
+    const float* row_cdf = &world_settings.envmap_conditional_cdfs[y * width];
+    x = envmap_cdf_upper_bound(row_cdf, width, random_number_generator() * row_cdf[width - 1]);
+}
+
+/**
+ * Returns the world space direction of the point 'u', 'v' of the envmap
+ * (with v = 0 at the top of the envmap) and the sine of its theta in envmap space
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 envmap_uv_to_world_direction(const WorldSettings& world_settings, float u, float v, float& sin_theta)
+{
     // Converting to polar coordinates
     float phi = u * M_TWO_PI;
     // Clamping because a theta of 0.0f would mean straight up which means singularity
@@ -106,13 +127,83 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_sample(const WorldSettings& wo
 
     // Convert to cartesian coordinates
     float cos_theta = cos(theta);
-    float sin_theta = sin(theta);
+    sin_theta = sin(theta);
     // Using this formula here instead of the usual (sin_theta * cos(phi), sin_theta * sin(phi), cos_theta)
     // because we want our envmap to be Y-up
-    sampled_direction = make_float3(-sin_theta * cos(phi), -cos_theta, -sin_theta * sin(phi));
+    float3 direction = make_float3(-sin_theta * cos(phi), -cos_theta, -sin_theta * sin(phi));
 
     // Taking envmap rotation into account to bring the direction in world space
-    sampled_direction = matrix_X_vec(world_settings.envmap_to_world_matrix, sampled_direction);
+    return matrix_X_vec(world_settings.envmap_to_world_matrix, direction);
+}
+
+/**
+ * Inverse of envmap_uv_to_world_direction()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float2 envmap_world_direction_to_uv(const WorldSettings& world_settings, const float3& direction, float& sin_theta)
+{
+    float3 rotated_direction = matrix_X_vec(world_settings.world_to_envmap_matrix, direction);
+
+    float theta = acos(hippt::clamp(-1.0f, 1.0f, -rotated_direction.y));
+    float u = atan2(-rotated_direction.z, -rotated_direction.x) / M_TWO_PI;
+    sin_theta = hippt::max(1.0e-5f, sin(theta));
+
+    return make_float2(u < 0.0f ? u + 1.0f : u, theta / M_PI);
+}
+
+/**
+ * Solid angle PDF of sampling the texel 'x', 'y' of the downscaled importance map of the envmap
+ * (see WorldSettings::envmap_sampling_luminance) and a point uniformly in it
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float envmap_importance_map_pdf(const WorldSettings& world_settings, int x, int y, float sin_theta)
+{
+    float pdf = world_settings.envmap_sampling_luminance[y * world_settings.envmap_sampling_width + x] / world_settings.envmap_total_sum;
+    pdf *= world_settings.envmap_sampling_width * world_settings.envmap_sampling_height;
+
+    return pdf / (M_TWO_PIPI * sin_theta);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_sample(const WorldSettings& world_settings, float3& sampled_direction, float& envmap_pdf, Xorshift32Generator& random_number_generator)
+{
+    int x, y;
+    float env_map_total_sum = world_settings.envmap_total_sum;
+
+#if EnvmapSamplingStrategy == ESS_BINARY_SEARCH
+    // Importance sampling a texel of the envmap with a binary search on the CDF
+    envmap_cdf_search(world_settings, random_number_generator() * env_map_total_sum, x, y);
+#elif EnvmapSamplingStrategy == ESS_MARGINAL_CONDITIONAL
+    envmap_marginal_conditional_search(world_settings, random_number_generator, x, y);
+#elif EnvmapCompactAliasTable == KERNEL_OPTION_TRUE
+    int random_index = sample_alias_table(world_settings.alias_table_probas_16bit, world_settings.alias_table_alias, world_settings.envmap_sampling_height * world_settings.envmap_sampling_width, random_number_generator);
+
+    y = static_cast<int>(random_index / world_settings.envmap_sampling_width);
+    x = static_cast<int>(random_index - y * world_settings.envmap_sampling_width);
+#else
+    int random_index = sample_alias_table(world_settings.alias_table_probas, world_settings.alias_table_alias, world_settings.envmap_sampling_height * world_settings.envmap_sampling_width, random_number_generator);
+
+    y = static_cast<int>(random_index / world_settings.envmap_sampling_width);
+    x = static_cast<int>(random_index - y * world_settings.envmap_sampling_width);
+#endif
+
+    if (world_settings.envmap_sampling_luminance != nullptr)
+    {
+        // Downscaled importance map, sampling a point uniformly in the sampled texel
+        // so that the full resolution envmap is looked up everywhere
+        float u = (x + random_number_generator()) / world_settings.envmap_sampling_width;
+        float v = (y + random_number_generator()) / world_settings.envmap_sampling_height;
+
+        float sin_theta;
+        sampled_direction = envmap_uv_to_world_direction(world_settings, u, v, sin_theta);
+        envmap_pdf = envmap_importance_map_pdf(world_settings, x, y, sin_theta);
+
+        return sample_environment_map_texture(world_settings, make_float2(u, 1.0f - v));
+    }
+
+    // Converting to UV coordinates
+    float u = static_cast<float>(x) / world_settings.envmap_width;
+    float v = static_cast<float>(y) / world_settings.envmap_height;
+
+    float sin_theta;
+    sampled_direction = envmap_uv_to_world_direction(world_settings, u, v, sin_theta);
 
     ColorRGB32F env_map_radiance = sample_environment_map_texture(world_settings, make_float2(u, 1.0f - v));
     // Computing envmap PDF
@@ -124,6 +215,42 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_sample(const WorldSettings& wo
     return env_map_radiance;
 }
 
+/**
+ * Solid angle PDF of sampling the world space 'direction' with envmap_sample(),
+ * 'radiance' being the envmap radiance in that direction
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float envmap_luminance_pdf(const WorldSettings& world_settings, const ColorRGB32F& radiance, const float3& direction)
+{
+    if (world_settings.envmap_sampling_luminance != nullptr)
+    {
+        // The PDF is the one of the texel of the downscaled importance map the direction falls in
+        float importance_map_sin_theta;
+        float2 uv = envmap_world_direction_to_uv(world_settings, direction, importance_map_sin_theta);
+
+        int sampling_width = world_settings.envmap_sampling_width;
+        int sampling_height = world_settings.envmap_sampling_height;
+        int x = hippt::min(static_cast<int>(uv.x * sampling_width), sampling_width - 1);
+        int y = hippt::min(static_cast<int>(uv.y * sampling_height), sampling_height - 1);
+
+        return envmap_importance_map_pdf(world_settings, x, y, importance_map_sin_theta);
+    }
+
+    // The theta of the texel is in envmap space, not in world space
+    float3 rotated_direction = matrix_X_vec(world_settings.world_to_envmap_matrix, direction);
+
+    float theta = acos(hippt::clamp(-1.0f, 1.0f, -rotated_direction.y));
+    float sin_theta = sin(theta);
+
+    // Probability of sampling that texel on the envmap
+    float pdf = radiance.luminance() / (world_settings.envmap_total_sum * world_settings.envmap_intensity);
+    pdf *= world_settings.envmap_width * world_settings.envmap_height;
+
+    // Converting from "texel on envmap measure" to solid angle
+    pdf /= (M_TWO_PIPI * sin_theta);
+
+    return pdf;
+}
+
 /**
  * This function expects the given direction to be in world space i.e.
  * the direction is already rotated by the envmap rotation matrix
@@ -133,31 +260,502 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_eval(const HIPRTRenderData& re
     const WorldSettings& world_settings = render_data.world_settings;
 
     ColorRGB32F envmap_radiance = eval_envmap_no_pdf(world_settings, direction);
+    pdf = envmap_luminance_pdf(world_settings, envmap_radiance, direction);
+
+    return envmap_radiance;
+}
 
-    float envmap_total_sum = world_settings.envmap_total_sum;
+HIPRT_HOST_DEVICE HIPRT_INLINE bool envmap_portals_used(const WorldSettings& world_settings)
+{
+    return world_settings.envmap_portal_count > 0 && world_settings.envmap_portal_sampling_probability > 0.0f;
+}
 
-    float theta_bsdf_dir = acos(-direction.y);
-    float sin_theta = sin(theta_bsdf_dir);
+/**
+ * Solid angle PDF of sampling 'direction' from 'point' with envmap_sample_portal_direction().
+ *
+ * A portal is picked uniformly and then a point uniformly on its area so the PDF of a direction
+ * is the average over all the portals crossed by the direction of the area PDF converted to solid angle
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float envmap_portals_pdf(const WorldSettings& world_settings, const float3& point, const float3& direction)
+{
+    float pdf = 0.0f;
+    for (int i = 0; i < world_settings.envmap_portal_count; i++)
+    {
+        const EnvmapPortal& portal = world_settings.envmap_portals[i];
 
-    // Probability of sampling that texel on the envmap
-    pdf = envmap_radiance.luminance() / (envmap_total_sum * render_data.world_settings.envmap_intensity);
-    pdf *= world_settings.envmap_width * world_settings.envmap_height;
+        float cos_portal = hippt::dot(direction, portal.normal);
+        if (hippt::abs(cos_portal) < 1.0e-6f || portal.area <= 0.0f)
+            continue;
 
-    // Converting from "texel on envmap measure" to solid angle
-    pdf /= (M_TWO_PIPI * sin_theta);
+        float t = hippt::dot(portal.corner - point, portal.normal) / cos_portal;
+        if (t <= 0.0f)
+            continue;
+
+        float3 local_point = point + direction * t - portal.corner;
+        float a = hippt::dot(local_point, portal.edge_u) / hippt::length2(portal.edge_u);
+        float b = hippt::dot(local_point, portal.edge_v) / hippt::length2(portal.edge_v);
+        if (a < 0.0f || a > 1.0f || b < 0.0f || b > 1.0f)
+            continue;
+
+        pdf += t * t / (hippt::abs(cos_portal) * portal.area);
+    }
+
+    return pdf / world_settings.envmap_portal_count;
+}
+
+/**
+ * Samples a direction from 'point' towards a uniformly chosen point of a uniformly chosen portal
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void envmap_sample_portal_direction(const WorldSettings& world_settings, const float3& point, float3& sampled_direction, Xorshift32Generator& random_number_generator)
+{
+    const EnvmapPortal& portal = world_settings.envmap_portals[random_number_generator.random_index(world_settings.envmap_portal_count)];
+
+    float r1 = random_number_generator();
+    float r2 = random_number_generator();
+    float3 point_on_portal = portal.corner + portal.edge_u * r1 + portal.edge_v * r2;
+
+    sampled_direction = hippt::normalize(point_on_portal - point);
+}
+
+/**
+ * Same as envmap_sample() but the direction may also be sampled towards the envmap portals as
+ * seen from 'point' (see WorldSettings::envmap_portal_sampling_probability).
+ *
+ * The returned PDF is the PDF of the mixture of the two strategies (the one that envmap_eval_at_point()
+ * returns) so that the directions of the envmap that aren't seen through a portal can still
+ * be sampled by luminance: scenes with portals that don't cover all openings stay unbiased
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_sample_at_point(const WorldSettings& world_settings, const float3& point, float3& sampled_direction, float& envmap_pdf, Xorshift32Generator& random_number_generator)
+{
+    if (!envmap_portals_used(world_settings))
+        return envmap_sample(world_settings, sampled_direction, envmap_pdf, random_number_generator);
+
+    float portal_probability = world_settings.envmap_portal_sampling_probability;
+
+    ColorRGB32F envmap_radiance;
+    float luminance_pdf;
+    if (random_number_generator() < portal_probability)
+    {
+        envmap_sample_portal_direction(world_settings, point, sampled_direction, random_number_generator);
+
+        envmap_radiance = eval_envmap_no_pdf(world_settings, sampled_direction);
+        luminance_pdf = envmap_luminance_pdf(world_settings, envmap_radiance, sampled_direction);
+    }
+    else
+        envmap_radiance = envmap_sample(world_settings, sampled_direction, luminance_pdf, random_number_generator);
+
+    envmap_pdf = (1.0f - portal_probability) * luminance_pdf + portal_probability * envmap_portals_pdf(world_settings, point, sampled_direction);
 
     return envmap_radiance;
 }
 
+/**
+ * Same as envmap_eval() but returns the PDF of envmap_sample_at_point() from 'point'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_eval_at_point(const HIPRTRenderData& render_data, const float3& point, const float3& direction, float& pdf)
+{
+    const WorldSettings& world_settings = render_data.world_settings;
+
+    ColorRGB32F envmap_radiance = envmap_eval(render_data, direction, pdf);
+    if (envmap_portals_used(world_settings))
+    {
+        float portal_probability = world_settings.envmap_portal_sampling_probability;
+
+        pdf = (1.0f - portal_probability) * pdf + portal_probability * envmap_portals_pdf(world_settings, point, direction);
+    }
+
+    return envmap_radiance;
+}
+
+/**
+ * Coarse approximation of the BSDF * cosine of a shading point for the product sampling
+ * of the envmap (ESS_PRODUCT_SAMPLING): a clamped cosine lobe for the diffuse part and
+ * a spherical gaussian around the reflected direction for the specular part
+ */
+struct EnvmapProductLobe
+{
+    float3 normal;
+    float3 reflected_direction;
+
+    float diffuse_weight = 0.0f;
+    float specular_weight = 0.0f;
+    // Sharpness of the spherical gaussian of the specular lobe
+    float specular_sharpness = 1.0f;
+    // Lobe value added everywhere so that all the directions of the envmap with
+    // some luminance can be sampled, even if the approximation misses them
+    float defensive_value = 0.0f;
+};
+
+HIPRT_HOST_DEVICE HIPRT_INLINE EnvmapProductLobe envmap_product_lobe_from_material(const SimplifiedRendererMaterial& material, const float3& shading_normal, const float3& view_direction)
+{
+    EnvmapProductLobe lobe;
+
+    float NoV = hippt::max(0.1f, hippt::dot(shading_normal, view_direction));
+
+    lobe.normal = shading_normal;
+    lobe.reflected_direction = hippt::normalize(shading_normal * 2.0f * hippt::dot(shading_normal, view_direction) - view_direction);
+
+    // Rough split of the energy of the BSDF between the diffuse and the specular lobes
+    float dielectric = (1.0f - material.metallic) * (1.0f - material.specular_transmission);
+    lobe.diffuse_weight = dielectric * material.base_color.luminance();
+    lobe.specular_weight = material.metallic * material.base_color.luminance() + dielectric * material.specular * 0.04f + material.clearcoat * 0.04f;
+
+    // Spherical gaussian approximation of the GGX lobe, brought from the half vector
+    // domain to the reflected direction domain
+    float alpha = hippt::max(1.0e-3f, material.roughness * material.roughness);
+    lobe.specular_sharpness = hippt::min(1.0e4f, 2.0f / (alpha * alpha) / (4.0f * NoV));
+
+    lobe.defensive_value = 0.1f * (lobe.diffuse_weight + lobe.specular_weight) / (2.0f * M_TWO_PI) + 1.0e-6f;
+
+    return lobe;
+}
+
+/**
+ * Value of the lobe averaged over a cell of the envmap of center 'direction' and of angular
+ * radius 'cell_radius'. The lobes are widened by the size of the cell so that the coarse
+ * cells that the lobe only partly covers still get their share
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float envmap_product_lobe_eval(const EnvmapProductLobe& lobe, const float3& direction, float cell_radius)
+{
+    float cosine_term = hippt::clamp(0.0f, 1.0f, hippt::dot(lobe.normal, direction) + cell_radius);
+
+    float sharpness = lobe.specular_sharpness / (1.0f + lobe.specular_sharpness * cell_radius * cell_radius);
+    float spherical_gaussian = exp(sharpness * (hippt::dot(lobe.reflected_direction, direction) - 1.0f));
+
+    float lobe_value = lobe.diffuse_weight * M_INV_PI + lobe.specular_weight * sharpness * spherical_gaussian / M_TWO_PI;
+
+    return lobe_value * cosine_term + lobe.defensive_value;
+}
+
+/**
+ * Index of the first cell of the level 'level' in WorldSettings::envmap_luminance_pyramid
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int envmap_pyramid_level_offset(int level)
+{
+    return 2 * ((1 << (2 * level)) - 1) / 3;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float envmap_pyramid_cell(const WorldSettings& world_settings, int level, int x, int y)
+{
+    return world_settings.envmap_luminance_pyramid[envmap_pyramid_level_offset(level) + y * (2 << level) + x];
+}
+
+/**
+ * Weight of the cell 'x', 'y' of the level 'level' of the pyramid for the hierarchical warping:
+ * the luminance of the cell times the lobe on the coarse levels, the luminance only on the finer levels
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float envmap_product_cell_weight(const WorldSettings& world_settings, const EnvmapProductLobe& lobe, int level, int x, int y)
+{
+    float luminance = envmap_pyramid_cell(world_settings, level, x, y);
+    if (level >= world_settings.envmap_product_sampling_lobe_levels || luminance <= 0.0f)
+        return luminance;
+
+    float cell_size = M_PI / (1 << level);
+
+    float sin_theta;
+    float3 cell_center = envmap_uv_to_world_direction(world_settings, (x + 0.5f) / (2 << level), (y + 0.5f) / (1 << level), sin_theta);
+
+    return luminance * envmap_product_lobe_eval(lobe, cell_center, cell_size * 0.5f);
+}
+
+/**
+ * Samples a direction proportionally to the product of the envmap and of 'lobe' (ESS_PRODUCT_SAMPLING)
+ * by descending the luminance pyramid from its 2 root cells. The direction is then sampled uniformly
+ * in the leaf cell reached
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_product_sample(const WorldSettings& world_settings, const EnvmapProductLobe& lobe, float3& sampled_direction, float& envmap_pdf, Xorshift32Generator& random_number_generator)
+{
+    float cell_probability = 1.0f;
+
+    // Picking one of the 2 root cells
+    int x;
+    int y = 0;
+    float left_weight = envmap_product_cell_weight(world_settings, lobe, 0, 0, 0);
+    float right_weight = envmap_product_cell_weight(world_settings, lobe, 0, 1, 0);
+    if (left_weight + right_weight <= 0.0f)
+    {
+        envmap_pdf = 0.0f;
+
+        return ColorRGB32F(0.0f);
+    }
+
+    x = random_number_generator() * (left_weight + right_weight) < left_weight ? 0 : 1;
+    cell_probability = (x == 0 ? left_weight : right_weight) / (left_weight + right_weight);
+
+    for (int level = 1; level <= world_settings.envmap_luminance_pyramid_leaf_level; level++)
+    {
+        float weights[4];
+        float weight_sum = 0.0f;
+        for (int child = 0; child < 4; child++)
+        {
+            weights[child] = envmap_product_cell_weight(world_settings, lobe, level, x * 2 + (child & 1), y * 2 + (child >> 1));
+            weight_sum += weights[child];
+        }
+
+        if (weight_sum <= 0.0f)
+        {
+            envmap_pdf = 0.0f;
+
+            return ColorRGB32F(0.0f);
+        }
+
+        float random = random_number_generator() * weight_sum;
+        int picked_child = 0;
+        while (picked_child < 3 && (random >= weights[picked_child] || weights[picked_child] <= 0.0f))
+        {
+            random -= weights[picked_child];
+            picked_child++;
+        }
+
+        cell_probability *= weights[picked_child] / weight_sum;
+        x = x * 2 + (picked_child & 1);
+        y = y * 2 + (picked_child >> 1);
+    }
+
+    int leaf_width = 2 << world_settings.envmap_luminance_pyramid_leaf_level;
+    int leaf_height = 1 << world_settings.envmap_luminance_pyramid_leaf_level;
+
+    float u = (x + random_number_generator()) / leaf_width;
+    float v = (y + random_number_generator()) / leaf_height;
+
+    float sin_theta;
+    sampled_direction = envmap_uv_to_world_direction(world_settings, u, v, sin_theta);
+
+    // Uniform in the UVs of the leaf cell, converted to solid angle
+    envmap_pdf = cell_probability * leaf_width * leaf_height / (M_TWO_PIPI * sin_theta);
+
+    return sample_environment_map_texture(world_settings, make_float2(u, 1.0f - v));
+}
+
+/**
+ * Solid angle PDF of sampling the world space 'direction' with envmap_product_sample()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float envmap_product_pdf(const WorldSettings& world_settings, const EnvmapProductLobe& lobe, const float3& direction)
+{
+    float sin_theta;
+    float2 uv = envmap_world_direction_to_uv(world_settings, direction, sin_theta);
+    float u = uv.x;
+    float v = uv.y;
+
+    int leaf_level = world_settings.envmap_luminance_pyramid_leaf_level;
+    int leaf_width = 2 << leaf_level;
+    int leaf_height = 1 << leaf_level;
+    int leaf_x = hippt::min(static_cast<int>(u * leaf_width), leaf_width - 1);
+    int leaf_y = hippt::min(static_cast<int>(v * leaf_height), leaf_height - 1);
+
+    // Probability of the descent down to the last level warped by the lobe
+    float cell_probability = 1.0f;
+    // The root level is always part of the loop, its weights are the luminance only if there are no lobe levels
+    int lobe_levels = hippt::max(1, hippt::min(leaf_level + 1, world_settings.envmap_product_sampling_lobe_levels));
+    for (int level = 0; level < lobe_levels; level++)
+    {
+        int x = leaf_x >> (leaf_level - level);
+        int y = leaf_y >> (leaf_level - level);
+
+        float weight_sum = 0.0f;
+        if (level == 0)
+            weight_sum = envmap_product_cell_weight(world_settings, lobe, 0, 0, 0) + envmap_product_cell_weight(world_settings, lobe, 0, 1, 0);
+        else
+        {
+            int parent_x = x >> 1;
+            int parent_y = y >> 1;
+            for (int child = 0; child < 4; child++)
+                weight_sum += envmap_product_cell_weight(world_settings, lobe, level, parent_x * 2 + (child & 1), parent_y * 2 + (child >> 1));
+        }
+
+        if (weight_sum <= 0.0f)
+            return 0.0f;
+
+        cell_probability *= envmap_product_cell_weight(world_settings, lobe, level, x, y) / weight_sum;
+    }
+
+    // The finer levels are warped by the luminance only, their probabilities simplify
+    // to the luminance of the leaf over the luminance of its ancestor on the last lobe level
+    if (lobe_levels <= leaf_level)
+    {
+        float ancestor_luminance = envmap_pyramid_cell(world_settings, lobe_levels - 1, leaf_x >> (leaf_level - lobe_levels + 1), leaf_y >> (leaf_level - lobe_levels + 1));
+        if (ancestor_luminance <= 0.0f)
+            return 0.0f;
+
+        cell_probability *= envmap_pyramid_cell(world_settings, leaf_level, leaf_x, leaf_y) / ancestor_luminance;
+    }
+
+    return cell_probability * leaf_width * leaf_height / (M_TWO_PIPI * sin_theta);
+}
+
+/**
+ * Same as envmap_sample_at_point() but with the product sampling instead of the
+ * luminance sampling of the envmap
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_product_sample_at_point(const WorldSettings& world_settings, const EnvmapProductLobe& lobe, const float3& point, float3& sampled_direction, float& envmap_pdf, Xorshift32Generator& random_number_generator)
+{
+    if (!envmap_portals_used(world_settings))
+        return envmap_product_sample(world_settings, lobe, sampled_direction, envmap_pdf, random_number_generator);
+
+    float portal_probability = world_settings.envmap_portal_sampling_probability;
+
+    ColorRGB32F envmap_radiance;
+    float product_pdf;
+    if (random_number_generator() < portal_probability)
+    {
+        envmap_sample_portal_direction(world_settings, point, sampled_direction, random_number_generator);
+
+        envmap_radiance = eval_envmap_no_pdf(world_settings, sampled_direction);
+        product_pdf = envmap_product_pdf(world_settings, lobe, sampled_direction);
+    }
+    else
+        envmap_radiance = envmap_product_sample(world_settings, lobe, sampled_direction, product_pdf, random_number_generator);
+
+    envmap_pdf = (1.0f - portal_probability) * product_pdf + portal_probability * envmap_portals_pdf(world_settings, point, sampled_direction);
+
+    return envmap_radiance;
+}
+
+/**
+ * Same as envmap_eval_at_point() but returns the PDF of envmap_product_sample_at_point()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F envmap_product_eval_at_point(const HIPRTRenderData& render_data, const EnvmapProductLobe& lobe, const float3& point, const float3& direction, float& pdf)
+{
+    const WorldSettings& world_settings = render_data.world_settings;
+
+    ColorRGB32F envmap_radiance = eval_envmap_no_pdf(world_settings, direction);
+    pdf = envmap_product_pdf(world_settings, lobe, direction);
+    if (envmap_portals_used(world_settings))
+    {
+        float portal_probability = world_settings.envmap_portal_sampling_probability;
+
+        pdf = (1.0f - portal_probability) * pdf + portal_probability * envmap_portals_pdf(world_settings, point, direction);
+    }
+
+    return envmap_radiance;
+}
+
+/**
+ * Envmap sampling used instead of sample_environment_map_with_mis() when the visibility cache is used.
+ *
+ * VisibilityCacheSettings::envmap_candidates envmap candidates and one BSDF candidate (if EnvmapSamplingDoBSDFMIS)
+ * are resampled, with MIS between the two, with a target function weighted by the visibility that the cache
+ * estimates in the direction of the candidates: the directions of the sky hidden from the cell of the shading
+ * point are rarely picked and only the picked candidate traces a shadow ray
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map_visibility_RIS(const HIPRTRenderData& render_data, const SimplifiedRendererMaterial& material, const RayVolumeState& volume_state, HitInfo& closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator)
+{
+    const float3& shading_point = closest_hit_info.inter_point;
+    const float3& shading_normal = closest_hit_info.shading_normal;
+
+    bool do_bsdf_mis = RUNTIME_KERNEL_OPTION(render_data.render_settings, EnvmapSamplingDoBSDFMIS, envmap_sampling_do_bsdf_mis) == KERNEL_OPTION_TRUE;
+    int nb_envmap_candidates = hippt::max(1, render_data.render_settings.visibility_cache_settings.envmap_candidates);
+    int nb_bsdf_candidates = do_bsdf_mis ? 1 : 0;
+
+    float weight_sum = 0.0f;
+    // Direction picked by the resampling, its BSDF * radiance * cosine and its target function
+    float3 picked_direction;
+    ColorRGB32F picked_contribution;
+    float picked_target_function = 0.0f;
+    // The BSDF candidates already traced their ray
+    bool picked_is_unoccluded = false;
+
+    for (int i = 0; i < nb_envmap_candidates; i++)
+    {
+        float envmap_pdf;
+        float3 sampled_direction;
+        ColorRGB32F envmap_radiance = envmap_sample_at_point(render_data.world_settings, shading_point, sampled_direction, envmap_pdf, random_number_generator);
+
+        float cosine_term = hippt::dot(shading_normal, sampled_direction);
+        if (envmap_pdf <= 0.0f || cosine_term <= 0.0f)
+            continue;
+
+        float bsdf_pdf;
+        RayVolumeState trash_state = volume_state;
+        ColorRGB32F bsdf_color = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, material, trash_state, view_direction, shading_normal, sampled_direction, bsdf_pdf);
+
+        ColorRGB32F contribution = bsdf_color * envmap_radiance * cosine_term;
+        float target_function = contribution.luminance() * visibility_cache_sampling_weight(render_data, shading_point, shading_normal, sampled_direction);
+        float mis_weight = balance_heuristic(envmap_pdf, nb_envmap_candidates, bsdf_pdf, nb_bsdf_candidates);
+        float candidate_weight = mis_weight * target_function / envmap_pdf;
+
+        weight_sum += candidate_weight;
+        if (candidate_weight > 0.0f && random_number_generator() < candidate_weight / weight_sum)
+        {
+            picked_direction = sampled_direction;
+            picked_contribution = contribution;
+            picked_target_function = target_function;
+            picked_is_unoccluded = false;
+        }
+    }
+
+    for (int i = 0; i < nb_bsdf_candidates; i++)
+    {
+        float bsdf_pdf;
+        float3 sampled_direction;
+        RayVolumeState trash_state = volume_state;
+        ColorRGB32F bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, material, trash_state, view_direction, shading_normal, closest_hit_info.geometric_normal, sampled_direction, bsdf_pdf, random_number_generator);
+
+        float cosine_term = hippt::dot(shading_normal, sampled_direction);
+        if (bsdf_pdf <= 0.0f || cosine_term <= 0.0f)
+            continue;
+
+        hiprtRay shadow_ray;
+        shadow_ray.origin = shading_point + shading_normal * 1.0e-4f;
+        shadow_ray.direction = sampled_direction;
+
+        bool in_shadow = evaluate_shadow_ray(render_data, shadow_ray, 1.0e35f, random_number_generator);
+        visibility_cache_record(render_data, shading_point, shading_normal, sampled_direction, !in_shadow);
+        if (in_shadow)
+            // The candidate has no contribution, it can be given a weight of 0
+            // without changing the expected value of the resampling
+            continue;
+
+        float envmap_pdf;
+        ColorRGB32F envmap_radiance = envmap_eval_at_point(render_data, shading_point, sampled_direction, envmap_pdf);
+
+        ColorRGB32F contribution = bsdf_color * envmap_radiance * cosine_term;
+        float target_function = contribution.luminance() * visibility_cache_sampling_weight(render_data, shading_point, shading_normal, sampled_direction);
+        float mis_weight = balance_heuristic(bsdf_pdf, nb_bsdf_candidates, envmap_pdf, nb_envmap_candidates);
+        float candidate_weight = mis_weight * target_function / bsdf_pdf;
+
+        weight_sum += candidate_weight;
+        if (candidate_weight > 0.0f && random_number_generator() < candidate_weight / weight_sum)
+        {
+            picked_direction = sampled_direction;
+            picked_contribution = contribution;
+            picked_target_function = target_function;
+            picked_is_unoccluded = true;
+        }
+    }
+
+    if (picked_target_function <= 0.0f)
+        return ColorRGB32F(0.0f);
+
+    if (!picked_is_unoccluded)
+    {
+        hiprtRay shadow_ray;
+        shadow_ray.origin = shading_point + shading_normal * 1.0e-4f;
+        shadow_ray.direction = picked_direction;
+
+        if (visibility_cache_evaluate_shadow_ray(render_data, shading_point, shading_normal, shadow_ray, 1.0e35f, random_number_generator))
+            return ColorRGB32F(0.0f);
+    }
+
+    return picked_contribution * weight_sum / picked_target_function;
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map_with_mis(const HIPRTRenderData& render_data, const SimplifiedRendererMaterial& material, const RayVolumeState& volume_state, HitInfo& closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator)
 {
+    if (visibility_cache_available(render_data.render_settings.visibility_cache_settings))
+        return sample_environment_map_visibility_RIS(render_data, material, volume_state, closest_hit_info, view_direction, random_number_generator);
+
     float envmap_pdf;
     float3 sampled_direction;
-    ColorRGB32F envmap_color = envmap_sample(render_data.world_settings, sampled_direction, envmap_pdf, random_number_generator);
+#if EnvmapSamplingStrategy == ESS_PRODUCT_SAMPLING
+    EnvmapProductLobe product_lobe = envmap_product_lobe_from_material(material, closest_hit_info.shading_normal, view_direction);
+    ColorRGB32F envmap_color = envmap_product_sample_at_point(render_data.world_settings, product_lobe, closest_hit_info.inter_point, sampled_direction, envmap_pdf, random_number_generator);
+#else
+    ColorRGB32F envmap_color = envmap_sample_at_point(render_data.world_settings, closest_hit_info.inter_point, sampled_direction, envmap_pdf, random_number_generator);
+#endif
     ColorRGB32F envmap_mis_contribution;
 
-    float eval_pdf;
-    envmap_eval(render_data, sampled_direction, eval_pdf);
+    bool do_bsdf_mis = RUNTIME_KERNEL_OPTION(render_data.render_settings, EnvmapSamplingDoBSDFMIS, envmap_sampling_do_bsdf_mis) == KERNEL_OPTION_TRUE;
 
     // Sampling the envmap with MIS
     float cosine_term = hippt::dot(closest_hit_info.shading_normal, sampled_direction);
@@ -174,11 +772,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map_with_mis(const
             RayVolumeState trash_state = volume_state;
             ColorRGB32F bsdf_color = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, material, trash_state, view_direction, closest_hit_info.shading_normal, sampled_direction, bsdf_pdf);
 
-#if EnvmapSamplingDoBSDFMIS
-            float mis_weight = balance_heuristic(envmap_pdf, bsdf_pdf);
-#else
-            float mis_weight = 1.0f;
-#endif
+            float mis_weight = do_bsdf_mis ? balance_heuristic(envmap_pdf, bsdf_pdf) : 1.0f;
 
             envmap_mis_contribution = bsdf_color * cosine_term * mis_weight * envmap_color / envmap_pdf;
         }
@@ -187,7 +781,9 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map_with_mis(const
 
 
 
-#if EnvmapSamplingDoBSDFMIS
+    if (!do_bsdf_mis)
+        return envmap_mis_contribution;
+
     float bsdf_sample_pdf;
     float3 bsdf_sampled_dir;
     RayVolumeState trash_state = volume_state;
@@ -206,7 +802,11 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map_with_mis(const
         if (!in_shadow)
         {
             float envmap_eval_pdf;
-            ColorRGB32F envmap_radiance = envmap_eval(render_data, bsdf_sampled_dir, envmap_eval_pdf);
+#if EnvmapSamplingStrategy == ESS_PRODUCT_SAMPLING
+            ColorRGB32F envmap_radiance = envmap_product_eval_at_point(render_data, product_lobe, closest_hit_info.inter_point, bsdf_sampled_dir, envmap_eval_pdf);
+#else
+            ColorRGB32F envmap_radiance = envmap_eval_at_point(render_data, closest_hit_info.inter_point, bsdf_sampled_dir, envmap_eval_pdf);
+#endif
             if (envmap_eval_pdf > 0.0f)
             {
                 float mis_weight = balance_heuristic(bsdf_sample_pdf, envmap_eval_pdf);
@@ -216,9 +816,6 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map_with_mis(const
     }
 
     return bsdf_mis_contribution + envmap_mis_contribution;
-#else
-    return envmap_mis_contribution;
-#endif
 }
 
 HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map(const HIPRTRenderData& render_data, const RayPayload& ray_payload, HitInfo& closest_hit_info, const float3& view_direction, int bounce, Xorshift32Generator& random_number_generator)
@@ -8,27 +8,178 @@
 
 #include "Device/includes/RayVolumeState.h"
 
-#include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/Octahedral.h"
 
 // Structure of arrays for the data contained in the pixels of the GBuffer
 // 
-// If you want the roughness of the pixel (X, Y) = [50, 0] for example,
-// get it at materials[50].roughness
+// If you want the depth of the pixel (X, Y) = [50, 0] for example,
+// get it at first_hit_distances[50]
+//
+// The layout is compact: the material isn't stored but re-evaluated from its index
+// and the texture coordinates of the hit (see get_g_buffer_material()), the normals are
+// octahedral encoded and the position of the first hit is reconstructed from the view direction
+// and the distance to the camera (see get_first_hit())
+//
+// With GBufferTiledLayout, the pixels are not stored row-major but
+// by tiles of GBUFFER_TILE_SIZE x GBUFFER_TILE_SIZE pixels, the size of the thread blocks
+// of the per-pixel kernels, so that a block reads contiguous memory instead of
+// GBUFFER_TILE_SIZE separate rows of every buffer. The functions of this structure take
+// the row-major 'pixel_index' of the pixel and find it in the buffers with get_storage_index()
 struct GBuffer
 {
-	SimplifiedRendererMaterial* materials = nullptr;
+	static constexpr int GBUFFER_TILE_SIZE = 8;
+
+	/**
+	 * Number of elements to allocate for each buffer of a GBuffer of that resolution.
+	 * The resolution is rounded up to a whole number of tiles whatever the layout
+	 * so that the layout can be changed without reallocating
+	 */
+	HIPRT_HOST_DEVICE static int get_storage_element_count(int width, int height)
+	{
+		int tile_count_x = (width + GBUFFER_TILE_SIZE - 1) / GBUFFER_TILE_SIZE;
+		int tile_count_y = (height + GBUFFER_TILE_SIZE - 1) / GBUFFER_TILE_SIZE;
+
+		return tile_count_x * tile_count_y * GBUFFER_TILE_SIZE * GBUFFER_TILE_SIZE;
+	}
+
+	/**
+	 * Index in the buffers of the pixel at the row-major index 'pixel_index'
+	 */
+	HIPRT_HOST_DEVICE int get_storage_index(int pixel_index) const
+	{
+#if GBufferTiledLayout == KERNEL_OPTION_TRUE
+		int x = pixel_index % width;
+		int y = pixel_index / width;
+		int tile_count_x = (width + GBUFFER_TILE_SIZE - 1) / GBUFFER_TILE_SIZE;
+
+		int tile_index = (y / GBUFFER_TILE_SIZE) * tile_count_x + x / GBUFFER_TILE_SIZE;
+		int index_in_tile = (y % GBUFFER_TILE_SIZE) * GBUFFER_TILE_SIZE + x % GBUFFER_TILE_SIZE;
+
+		return tile_index * GBUFFER_TILE_SIZE * GBUFFER_TILE_SIZE + index_in_tile;
+#else
+		return pixel_index;
+#endif
+	}
+
+	HIPRT_HOST_DEVICE void set_first_hit(int pixel_index, int material_index, float2 texcoords, const float3& shading_normal, const float3& geometric_normal, const float3& view_direction, float distance) const
+	{
+		pixel_index = get_storage_index(pixel_index);
+
+		material_indices[pixel_index] = material_index;
+		this->texcoords[pixel_index] = texcoords;
+
+		shading_normals[pixel_index] = octahedral_encode_32(shading_normal);
+		geometric_normals[pixel_index] = octahedral_encode_32(geometric_normal);
+
+		view_directions[pixel_index] = octahedral_encode(view_direction);
+		first_hit_distances[pixel_index] = distance;
+	}
+
+	/**
+	 * 'previous_position' is the position in pixels (the center of the pixel (X, Y) is at
+	 * [X, Y]) in the previous frame of the point seen by the pixel in this frame
+	 */
+	HIPRT_HOST_DEVICE void set_previous_position(int pixel_index, float2 previous_position) const
+	{
+		float2 pixel_position = make_float2(static_cast<float>(pixel_index % width), static_cast<float>(pixel_index / width));
+
+		motion_vectors[get_storage_index(pixel_index)] = previous_position - pixel_position;
+	}
+
+	/**
+	 * Position in pixels in the previous frame of the point seen by the pixel
+	 * in this frame, read from its motion vector
+	 */
+	HIPRT_HOST_DEVICE float2 get_previous_position(int pixel_index) const
+	{
+		float2 pixel_position = make_float2(static_cast<float>(pixel_index % width), static_cast<float>(pixel_index / width));
+
+		return pixel_position + motion_vectors[get_storage_index(pixel_index)];
+	}
+
+	/**
+	 * Copies all the data of the given pixel from 'other' to this GBuffer.
+	 * 
+	 * const because only the pointed buffers are written, this allows calling
+	 * it on the GBuffers of a const HIPRTRenderData
+	 */
+	HIPRT_HOST_DEVICE void copy_pixel(const GBuffer& other, int pixel_index) const
+	{
+		// Both GBuffers have the same resolution and layout
+		pixel_index = get_storage_index(pixel_index);
+
+		material_indices[pixel_index] = other.material_indices[pixel_index];
+		texcoords[pixel_index] = other.texcoords[pixel_index];
+		shading_normals[pixel_index] = other.shading_normals[pixel_index];
+		geometric_normals[pixel_index] = other.geometric_normals[pixel_index];
+		view_directions[pixel_index] = other.view_directions[pixel_index];
+		first_hit_distances[pixel_index] = other.first_hit_distances[pixel_index];
+		motion_vectors[pixel_index] = other.motion_vectors[pixel_index];
+		texture_footprints[pixel_index] = other.texture_footprints[pixel_index];
+		ray_cone_spread_angles[pixel_index] = other.ray_cone_spread_angles[pixel_index];
+		camera_ray_hit[pixel_index] = other.camera_ray_hit[pixel_index];
+		ray_volume_states[pixel_index] = other.ray_volume_states[pixel_index];
+	}
+
+	HIPRT_HOST_DEVICE float3 get_shading_normal(int pixel_index) const
+	{
+		return octahedral_decode_32(shading_normals[get_storage_index(pixel_index)]);
+	}
+
+	HIPRT_HOST_DEVICE float3 get_geometric_normal(int pixel_index) const
+	{
+		return octahedral_decode_32(geometric_normals[get_storage_index(pixel_index)]);
+	}
+
+	HIPRT_HOST_DEVICE float3 get_view_direction(int pixel_index) const
+	{
+		return octahedral_decode(view_directions[get_storage_index(pixel_index)]);
+	}
+
+	/**
+	 * Reconstructs the world space position of the first hit of the pixel.
+	 * 
+	 * 'camera_position' must be the position of the camera this GBuffer was filled with
+	 */
+	HIPRT_HOST_DEVICE float3 get_first_hit(int pixel_index, const float3& camera_position) const
+	{
+		// The view direction points towards the camera
+		return camera_position - get_view_direction(pixel_index) * first_hit_distances[get_storage_index(pixel_index)];
+	}
+
+	int* material_indices = nullptr;
+	float2* texcoords = nullptr;
 
 	// We need both normals to correct the blakc fringes from the microfacet
-	// model when used with smooth normals / normal mapping
-	float3* shading_normals = nullptr;
-	float3* geometric_normals = nullptr;
+	// model when used with smooth normals / normal mapping.
+	// Octahedral encoded on 2x16 bits
+	unsigned int* shading_normals = nullptr;
+	unsigned int* geometric_normals = nullptr;
 
-	float3* view_directions = nullptr;
-	float3* first_hits = nullptr;
+	// Octahedral encoded at full precision because the position of the
+	// first hit is reconstructed from it
+	float2* view_directions = nullptr;
+	// Distance from the camera to the first hit
+	float* first_hit_distances = nullptr;
+	// Screen space motion in pixels of the first hit (of the background for the pixels that missed)
+	// since the previous frame, written once per sample by the camera rays for all the temporal passes.
+	// Relative to the center of the pixel, see get_previous_position()
+	float2* motion_vectors = nullptr;
+	// Footprint of the camera ray cone at the first hit for evaluating
+	// the material at the right mip level, see HitInfo::texture_footprint
+	float* texture_footprints = nullptr;
+	// Spread angle of the camera ray cone after it curved off the first hit, see RayCone::curve().
+	// The width of the cone at the first hit is recomputed from 'first_hit_distances'
+	float* ray_cone_spread_angles = nullptr;
 
 	unsigned char* camera_ray_hit = nullptr;
 
-	RayVolumeState* ray_volume_states = nullptr;
+	StoredRayVolumeState* ray_volume_states = nullptr;
+
+	// Width of the render, for finding the pixels in the tiled layout
+	int width = 0;
 };
 
 #endif
@@ -10,46 +10,80 @@
 #include "Device/includes/Material.h"
 #include "Device/includes/ONB.h"
 #include "Device/includes/RayPayload.h"
+#include "Device/includes/RayStatistics.h"
+#include "Device/includes/RussianRoulette.h"
+#include "Device/includes/SceneInstances.h"
 #include "Device/includes/Texture.h"
+#include "Device/includes/VertexAttributes.h"
 #include "Device/functions/AlphaTesting.h"
+#include "Device/functions/SphereIntersection.h"
 
+#include "HostDeviceCommon/GeometryLOD.h"
 #include "HostDeviceCommon/RenderData.h"
 #include "HostDeviceCommon/Math.h"
 
-#if SharedStackBVHTraversalSize > 0
-__shared__ static int shared_stack_cache[SharedStackBVHTraversalSize * SharedStackBVHTraversalBlockSize];
+// Size of the shared stack of the shadow rays traversals
+#if SharedStackBVHTraversalSizeShadowRays >= 0
+#define SHADOW_RAYS_SHARED_STACK_SIZE SharedStackBVHTraversalSizeShadowRays
+#else
+#define SHADOW_RAYS_SHARED_STACK_SIZE SharedStackBVHTraversalSize
+#endif
+
+// The shadow rays traversals use the same shared memory as the other traversals,
+// the cache is as big as the largest of the two stacks
+#if SHADOW_RAYS_SHARED_STACK_SIZE > SharedStackBVHTraversalSize
+#define SHARED_STACK_CACHE_SIZE SHADOW_RAYS_SHARED_STACK_SIZE
+#else
+#define SHARED_STACK_CACHE_SIZE SharedStackBVHTraversalSize
+#endif
+
+#if SHARED_STACK_CACHE_SIZE > 0
+__shared__ static int shared_stack_cache[SHARED_STACK_CACHE_SIZE * SharedStackBVHTraversalBlockSize];
+#endif
+
+#ifdef __KERNELCC__
+// Global part of the traversal stacks: one stack per pixel or stack slots
+// acquired by the warps from a buffer sized to the resident threads of the GPU
+#if DynamicBVHTraversalStack == KERNEL_OPTION_TRUE
+typedef hiprtDynamicStack BVHTraversalGlobalStack;
+#else
+typedef hiprtGlobalStack BVHTraversalGlobalStack;
+#endif
 #endif
 
 /* References:
  * 
  * [1] [Foundations of Game Engine Development: Rendering - Tangent/Bitangent calculation] http://foundationsofgameenginedev.com/#fged2
  */
-HIPRT_HOST_DEVICE HIPRT_INLINE float3 normal_mapping(const HIPRTRenderData& render_data, int normal_map_texture_index, int primitive_index, const float2& interpolated_texcoords, const float3& surface_normal)
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 normal_mapping(const HIPRTRenderData& render_data, int normal_map_texture_index, const SceneInstance& instance, int primitive_index, const float2& interpolated_texcoords, const float3& surface_normal, float texture_footprint = 0.0f)
 {
     int vertex_A_index = render_data.buffers.triangles_indices[primitive_index * 3 + 0];
     int vertex_B_index = render_data.buffers.triangles_indices[primitive_index * 3 + 1];
     int vertex_C_index = render_data.buffers.triangles_indices[primitive_index * 3 + 2];
 
     // Calculating tangents and bitangents aligned with texture U and V coordinates
-    float2 P0_texcoords = render_data.buffers.texcoords[vertex_A_index];
-    float2 P1_texcoords = render_data.buffers.texcoords[vertex_B_index];
-    float2 P2_texcoords = render_data.buffers.texcoords[vertex_C_index];
+    const MeshVertexAttributes& mesh_attributes = get_mesh_vertex_attributes(render_data, instance);
+    float2 P0_texcoords = get_vertex_texcoords(render_data, mesh_attributes, vertex_A_index);
+    float2 P1_texcoords = get_vertex_texcoords(render_data, mesh_attributes, vertex_B_index);
+    float2 P2_texcoords = get_vertex_texcoords(render_data, mesh_attributes, vertex_C_index);
 
     float2 delta_P1P0_texcoords = P1_texcoords - P0_texcoords;
     float2 delta_P2P0_texcoords = P2_texcoords - P0_texcoords;
 
-    float3 P0 = render_data.buffers.vertices_positions[vertex_A_index];
-    float3 P1 = render_data.buffers.vertices_positions[vertex_B_index];
-    float3 P2 = render_data.buffers.vertices_positions[vertex_C_index];
+    float3 P0 = get_vertex_position(render_data, instance, vertex_A_index);
+    float3 P1 = get_vertex_position(render_data, instance, vertex_B_index);
+    float3 P2 = get_vertex_position(render_data, instance, vertex_C_index);
 
     float3 edge_P0P1 = P1 - P0;
     float3 edge_P0P2 = P2 - P0;
 
     float det_inverse = 1.0f / (delta_P1P0_texcoords.x * delta_P2P0_texcoords.y - delta_P1P0_texcoords.y * delta_P2P0_texcoords.x);
-    float3 T = (edge_P0P1 * delta_P2P0_texcoords.y - edge_P0P2 * delta_P1P0_texcoords.y) * det_inverse;
-    float3 B = (edge_P0P2 * delta_P1P0_texcoords.x - edge_P0P1 * delta_P2P0_texcoords.x) * det_inverse;
+    // The positions are in object space, bringing the tangent and bitangent to world space
+    float3 T = matrix_X_vec(instance.object_to_world, (edge_P0P1 * delta_P2P0_texcoords.y - edge_P0P2 * delta_P1P0_texcoords.y) * det_inverse);
+    float3 B = matrix_X_vec(instance.object_to_world, (edge_P0P2 * delta_P1P0_texcoords.x - edge_P0P1 * delta_P2P0_texcoords.x) * det_inverse);
 
-    ColorRGB32F normal = sample_texture_rgb_8bits(render_data.buffers.material_textures, normal_map_texture_index, render_data.buffers.textures_dims[normal_map_texture_index], /* is_srgb */ false, interpolated_texcoords);
+    ColorRGBA32F normal_rgba = sample_material_texture_rgba(render_data, normal_map_texture_index, /* is_srgb */ false, interpolated_texcoords, texture_footprint);
+    ColorRGB32F normal = ColorRGB32F(normal_rgba.r, normal_rgba.g, normal_rgba.b);
     // Bringing the normal in [-x, x]. x doesn't really matter since we normalize the result anyway
     normal -= ColorRGB32F(0.5f);
 
@@ -58,27 +92,169 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float3 normal_mapping(const HIPRTRenderData& rend
     return local_to_world_frame(hippt::normalize(T), hippt::normalize(B), surface_normal, normal_tangent_space);
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE float3 get_shading_normal(const HIPRTRenderData& render_data, const float3& geometric_normal, int primitive_index, const float2& uv, const float2& interpolated_texcoords)
+/**
+ * Returns the world space shading normal at a point of the triangle 'primitive_index' of
+ * the mesh of 'instance'. 'geometric_normal' must be in world space
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 get_shading_normal(const HIPRTRenderData& render_data, const float3& geometric_normal, const SceneInstance& instance, int primitive_index, const float2& uv, const float2& interpolated_texcoords, float texture_footprint = 0.0f)
 {
     int mat_index = render_data.buffers.material_indices[primitive_index];
-    RendererMaterial& material = render_data.buffers.materials_buffer[mat_index];
+    int normal_map_texture_index = render_data.buffers.materials_buffer[mat_index].get_texture_index(PackedRendererMaterial::NORMAL_MAP_TEXTURE);
 
     // Do smooth shading first if we have vertex normals
     float3 surface_normal;
-    int vertex_A_index = render_data.buffers.triangles_indices[primitive_index * 3 + 0];
-    if (render_data.buffers.has_vertex_normals[vertex_A_index])
+    const MeshVertexAttributes& mesh_attributes = get_mesh_vertex_attributes(render_data, instance);
+    if (has_vertex_normals(mesh_attributes))
         // Smooth normal available for the triangle
-        surface_normal = hippt::normalize(uv_interpolate(render_data.buffers.triangles_indices, primitive_index, render_data.buffers.vertex_normals, uv));
+        surface_normal = hippt::normalize(matrix_X_vec(instance.normal_to_world, interpolate_vertex_normal(render_data, mesh_attributes, primitive_index, uv)));
     else
         surface_normal = geometric_normal;
 
     // Do normal mapping if we have a normal map
-    if (material.normal_map_texture_index != RendererMaterial::NO_TEXTURE)
-        surface_normal = normal_mapping(render_data, material.normal_map_texture_index, primitive_index, interpolated_texcoords, surface_normal);
+    if (normal_map_texture_index != RendererMaterial::NO_TEXTURE)
+        surface_normal = normal_mapping(render_data, normal_map_texture_index, instance, primitive_index, interpolated_texcoords, surface_normal, texture_footprint);
 
     return surface_normal;
 }
 
+/**
+ * Returns the footprint, in texture space (UV units), of a ray cone of width 'cone_width'
+ * hitting the triangle 'primitive_index' of 'instance'. This is the value used to select
+ * the mip level of the material textures.
+ *
+ * Always 0 (full resolution) if the ray cones texture LOD is disabled.
+ *
+ * Reference:
+ * [1] [Texture Level of Detail Strategies for Real-Time Ray Tracing, Akenine-Moller et al., 2019] https://www.realtimerendering.com/raytracinggems/rtg/index.html
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float get_texture_footprint(const HIPRTRenderData& render_data, const SceneInstance& instance, int primitive_index, const float3& ray_direction, const float3& geometric_normal, float cone_width)
+{
+#if defined(__KERNELCC__) && MaterialTexturesRayConesLOD == KERNEL_OPTION_TRUE
+    int vertex_A_index = render_data.buffers.triangles_indices[primitive_index * 3 + 0];
+    int vertex_B_index = render_data.buffers.triangles_indices[primitive_index * 3 + 1];
+    int vertex_C_index = render_data.buffers.triangles_indices[primitive_index * 3 + 2];
+
+    const MeshVertexAttributes& mesh_attributes = get_mesh_vertex_attributes(render_data, instance);
+    if (mesh_attributes.first_texcoords == -1)
+        return 0.0f;
+
+    float2 P0_texcoords = get_vertex_texcoords(render_data, mesh_attributes, vertex_A_index);
+    float2 delta_P1P0_texcoords = get_vertex_texcoords(render_data, mesh_attributes, vertex_B_index) - P0_texcoords;
+    float2 delta_P2P0_texcoords = get_vertex_texcoords(render_data, mesh_attributes, vertex_C_index) - P0_texcoords;
+    float texcoords_area = hippt::abs(delta_P1P0_texcoords.x * delta_P2P0_texcoords.y - delta_P1P0_texcoords.y * delta_P2P0_texcoords.x);
+
+    float3 P0 = get_vertex_position(render_data, instance, vertex_A_index);
+    float3 edge_P0P1 = matrix_X_vec(instance.object_to_world, get_vertex_position(render_data, instance, vertex_B_index) - P0);
+    float3 edge_P0P2 = matrix_X_vec(instance.object_to_world, get_vertex_position(render_data, instance, vertex_C_index) - P0);
+    float world_area = hippt::length(hippt::cross(edge_P0P1, edge_P0P2));
+    if (world_area == 0.0f)
+        return 0.0f;
+
+    // Grazing angles stretch the footprint on the surface. Clamped to avoid
+    // selecting absurdly blurry levels at silhouettes
+    float cos_theta = hippt::max(1.0e-2f, hippt::abs(hippt::dot(geometric_normal, ray_direction)));
+
+    return cone_width / cos_theta * sqrtf(texcoords_area / world_area);
+#else
+    return 0.0f;
+#endif
+}
+
+/**
+ * Returns the angle by which a ray cone of width 'cone_width' reflected off the triangle
+ * 'primitive_index' of 'instance' spreads because of the curvature of the surface.
+ * Positive for convex surfaces (as seen from 'ray_direction'), negative for concave ones.
+ *
+ * The curvature is estimated from the variation of the vertex normals along the edges of the
+ * triangle. Flat shaded triangles have no curvature.
+ *
+ * Always 0 if the ray cones texture LOD is disabled.
+ *
+ * Reference: same as get_texture_footprint()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float get_surface_spread_angle(const HIPRTRenderData& render_data, const SceneInstance& instance, int primitive_index, const float3& ray_direction, float cone_width)
+{
+#if defined(__KERNELCC__) && MaterialTexturesRayConesLOD == KERNEL_OPTION_TRUE
+    int vertex_indices[3];
+    for (int i = 0; i < 3; i++)
+        vertex_indices[i] = render_data.buffers.triangles_indices[primitive_index * 3 + i];
+
+    const MeshVertexAttributes& mesh_attributes = get_mesh_vertex_attributes(render_data, instance);
+    if (!has_vertex_normals(mesh_attributes))
+        return 0.0f;
+
+    float3 positions[3];
+    float3 normals[3];
+    for (int i = 0; i < 3; i++)
+    {
+        positions[i] = matrix_X_point(instance.object_to_world, get_vertex_position(render_data, instance, vertex_indices[i]));
+        normals[i] = hippt::normalize(matrix_X_vec(instance.normal_to_world, get_vertex_normal(render_data, mesh_attributes, vertex_indices[i])));
+    }
+
+    // Average of the normal curvatures along the 3 edges
+    float curvature = 0.0f;
+    for (int i = 0; i < 3; i++)
+    {
+        float3 delta_position = positions[(i + 1) % 3] - positions[i];
+        float3 delta_normal = normals[(i + 1) % 3] - normals[i];
+
+        float edge_length2 = hippt::dot(delta_position, delta_position);
+        if (edge_length2 > 0.0f)
+            curvature += hippt::dot(delta_normal, delta_position) / edge_length2;
+    }
+    curvature /= 3.0f;
+
+    // A sphere is convex when hit from the outside but concave when hit from the inside
+    if (hippt::dot(normals[0] + normals[1] + normals[2], ray_direction) > 0.0f)
+        curvature = -curvature;
+
+    // The normal turns by 'curvature * cone_width' radians across the footprint
+    // of the cone and the reflected directions turn twice as much
+    return 2.0f * curvature * cone_width;
+#else
+    return 0.0f;
+#endif
+}
+
+/**
+ * Same as get_surface_spread_angle() for the analytic sphere 'sphere_index' hit at 'point'.
+ * The curvature of a sphere is exact: the inverse of its radius
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float get_sphere_spread_angle(const HIPRTRenderData& render_data, int sphere_index, const float3& point, const float3& ray_direction, float cone_width)
+{
+#if defined(__KERNELCC__) && MaterialTexturesRayConesLOD == KERNEL_OPTION_TRUE
+    float4 sphere = render_data.buffers.spheres[sphere_index];
+    float3 outward_normal = point - make_float3(sphere.x, sphere.y, sphere.z);
+
+    float curvature = 1.0f / sphere.w;
+    // Concave when hit from the inside
+    if (hippt::dot(outward_normal, ray_direction) > 0.0f)
+        curvature = -curvature;
+
+    return 2.0f * curvature * cone_width;
+#else
+    return 0.0f;
+#endif
+}
+
+/**
+ * Returns the normalized world space geometric normal of a hit of the scene
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 get_hit_geometric_normal(const HIPRTRenderData& render_data, const hiprtHit& hit)
+{
+#ifdef __KERNELCC__
+    if (is_sphere_instance(render_data, hit.instanceID))
+        // The spheres are in world space, see intersect_sphere()
+        return hippt::normalize(hit.normal);
+
+    // HIPRT gives the normal in the object space of the instance hit
+    return hippt::normalize(matrix_X_vec(render_data.buffers.instances[hit.instanceID].normal_to_world, hit.normal));
+#else
+    // The CPU BVH is built over the world space triangles, the normal is already in world space
+    return hippt::normalize(hit.normal);
+#endif
+}
+
 #ifndef __KERNELCC__
 #include "Renderer/BVH.h"
 HIPRT_HOST_DEVICE HIPRT_INLINE hiprtHit intersect_scene_cpu(const HIPRTRenderData& render_data, const hiprtRay& ray, Xorshift32Generator& random_number_generator)
@@ -92,7 +268,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE hiprtHit intersect_scene_cpu(const HIPRTRenderDat
     filter_function_payload.random_number_generator = &random_number_generator;
     if (render_data.cpu_only.bvh->intersect(ray, closest_hit_info, &filter_function_payload))
     {
-        hiprtHit.primID = closest_hit_info.primitive_index;
+        // The CPU BVH is built over the scene primitives
+        set_hit_scene_primitive(render_data, closest_hit_info.primitive_index, hiprtHit);
         hiprtHit.normal = closest_hit_info.geometric_normal;
         hiprtHit.t = closest_hit_info.t;
         hiprtHit.uv = closest_hit_info.uv;
@@ -100,51 +277,142 @@ HIPRT_HOST_DEVICE HIPRT_INLINE hiprtHit intersect_scene_cpu(const HIPRTRenderDat
 
     return hiprtHit;
 }
-#endif
 
 /**
- * Returns true if a hit was found, false otherwise
+ * Returns true if 'ray' hits something closer than 't_max' that isn't filtered out by alpha testing.
+ * Any-hit traversal of the CPU BVH for the shadow rays, see BVH::intersect_any()
  */
-HIPRT_HOST_DEVICE HIPRT_INLINE bool trace_ray(const HIPRTRenderData& render_data, hiprtRay ray, RayPayload& in_out_ray_payload, HitInfo& out_hit_info, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE bool intersect_scene_cpu_any_hit(const HIPRTRenderData& render_data, const hiprtRay& ray, float t_max, Xorshift32Generator& random_number_generator)
 {
-    hiprtHit hit;
-    bool skipping_volume_boundary = false;
-    do
+    AlphaTestingPayload filter_function_payload;
+    filter_function_payload.render_data = &render_data;
+    filter_function_payload.random_number_generator = &random_number_generator;
+
+    return render_data.cpu_only.bvh->intersect_any(ray, t_max, &filter_function_payload);
+}
+
+/**
+ * Same as intersect_scene_cpu() but for a packet of coherent rays traversing the BVH together
+ * (see BVH::intersect_ray_packet()). 'random_number_generators[i]' is used for the alpha testing
+ * of 'rays[i]'. At most BVHConstants::RAY_PACKET_MAX_SIZE rays can be given
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void intersect_scene_cpu_packet(const HIPRTRenderData& render_data, const hiprtRay* rays, int ray_count, Xorshift32Generator* random_number_generators, hiprtHit* out_hits)
+{
+    HitInfo closest_hit_infos[BVHConstants::RAY_PACKET_MAX_SIZE];
+    AlphaTestingPayload filter_function_payloads[BVHConstants::RAY_PACKET_MAX_SIZE];
+    void* filter_function_payloads_pointers[BVHConstants::RAY_PACKET_MAX_SIZE];
+    bool intersections_found[BVHConstants::RAY_PACKET_MAX_SIZE];
+    for (int i = 0; i < ray_count; i++)
     {
-#ifdef __KERNELCC__
-#if UseSharedStackBVHTraversal == KERNEL_OPTION_TRUE
-        // Payload for the alpha testing filter function
-        AlphaTestingPayload payload;
-        payload.render_data = &render_data;
-        payload.random_number_generator = &random_number_generator;
+        closest_hit_infos[i].t = -1.0f;
+
+        filter_function_payloads[i].render_data = &render_data;
+        filter_function_payloads[i].random_number_generator = &random_number_generators[i];
+        filter_function_payloads_pointers[i] = &filter_function_payloads[i];
+    }
+
+    render_data.cpu_only.bvh->intersect_ray_packet(rays, ray_count, closest_hit_infos, filter_function_payloads_pointers, intersections_found);
 
+    for (int i = 0; i < ray_count; i++)
+    {
+        out_hits[i] = hiprtHit();
+        if (!intersections_found[i])
+            continue;
+
+        set_hit_scene_primitive(render_data, closest_hit_infos[i].primitive_index, out_hits[i]);
+        out_hits[i].normal = closest_hit_infos[i].geometric_normal;
+        out_hits[i].t = closest_hit_infos[i].t;
+        out_hits[i].uv = closest_hit_infos[i].uv;
+    }
+}
+#else
+/**
+ * Closest hit traversal of the BVH of the scene, through the shared stack if UseSharedStackBVHTraversal
+ * is true. The alpha transparent hits are skipped by the alpha testing filter of the traversal.
+ *
+ * Only the instances of 'ray_mask' are hit, see HostDeviceCommon/GeometryLOD.h
+ */
+HIPRT_DEVICE HIPRT_INLINE hiprtHit intersect_scene_gpu(const HIPRTRenderData& render_data, const hiprtRay& ray, Xorshift32Generator& random_number_generator, unsigned int ray_mask = GEOMETRY_LOD_PRIMARY_RAY_MASK)
+{
+    // Payload for the alpha testing filter function
+    AlphaTestingPayload payload;
+    payload.render_data = &render_data;
+    payload.random_number_generator = &random_number_generator;
+
+#if UseSharedStackBVHTraversal == KERNEL_OPTION_TRUE
 #if SharedStackBVHTraversalSize > 0
-        hiprtSharedStackBuffer shared_stack_buffer { SharedStackBVHTraversalSize, shared_stack_cache };
+    hiprtSharedStackBuffer shared_stack_buffer { SharedStackBVHTraversalSize, shared_stack_cache };
 #else
-        hiprtSharedStackBuffer shared_stack_buffer{ 0, nullptr };
+    hiprtSharedStackBuffer shared_stack_buffer{ 0, nullptr };
 #endif
-        hiprtGlobalStack global_stack(render_data.global_traversal_stack_buffer, shared_stack_buffer);
+    BVHTraversalGlobalStack global_stack(render_data.global_traversal_stack_buffer, shared_stack_buffer);
+    // Only one level of instancing, no stack needed for the instances
+    hiprtEmptyInstanceStack instance_stack;
 
-        hiprtGeomTraversalClosestCustomStack<hiprtGlobalStack> traversal(render_data.geom, ray, global_stack, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
+    hiprtSceneTraversalClosestCustomStack<BVHTraversalGlobalStack, hiprtEmptyInstanceStack> traversal(render_data.geom, ray, global_stack, instance_stack, ray_mask, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
 #else
-        hiprtGeomTraversalClosest traversal(render_data.geom, ray, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
+    hiprtSceneTraversalClosest traversal(render_data.geom, ray, ray_mask, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
+#endif
+
+    return traversal.getNextHit();
+}
 #endif
 
-        hit = traversal.getNextHit();
+/**
+ * Returns true if a hit was found, false otherwise.
+ * 
+ * 'precomputed_first_hit' is only used on the CPU: if not nullptr, it is used as the result of the
+ * first traversal of the scene instead of tracing 'ray' (the camera rays of the CPU renderer are
+ * traced in packets beforehand for example)
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool trace_ray(const HIPRTRenderData& render_data, hiprtRay ray, RayPayload& in_out_ray_payload, HitInfo& out_hit_info, Xorshift32Generator& random_number_generator, const hiprtHit* precomputed_first_hit = nullptr)
+{
+    hiprtHit hit;
+    bool skipping_volume_boundary = false;
+    do
+    {
+#ifdef __KERNELCC__
+        hit = intersect_scene_gpu(render_data, ray, random_number_generator, in_out_ray_payload.geometry_lod_ray_mask);
     #else
-        hit = intersect_scene_cpu(render_data, ray, random_number_generator);
+        if (precomputed_first_hit != nullptr)
+        {
+            hit = *precomputed_first_hit;
+            // Only for the first traversal, the next ones (when skipping volume boundaries) are traced normally
+            precomputed_first_hit = nullptr;
+        }
+        else
+            hit = intersect_scene_cpu(render_data, ray, random_number_generator);
     #endif
 
         if (!hit.hasHit())
             return false;
 
         out_hit_info.inter_point = ray.origin + hit.t * ray.direction;
-        out_hit_info.primitive_index = hit.primID;
-        out_hit_info.texcoords = uv_interpolate(render_data.buffers.triangles_indices, out_hit_info.primitive_index, render_data.buffers.texcoords, hit.uv);
-        // TODO hit.normal is in object space, this simple approach will not work if using
-        // multiple-levels BVH (TLAS/BLAS)
-        out_hit_info.geometric_normal = hippt::normalize(hit.normal);
-        out_hit_info.shading_normal = get_shading_normal(render_data, out_hit_info.geometric_normal, out_hit_info.primitive_index, hit.uv, out_hit_info.texcoords);
+        out_hit_info.instance_index = hit.instanceID;
+        out_hit_info.geometric_normal = get_hit_geometric_normal(render_data, hit);
+        in_out_ray_payload.ray_cone.propagate(hit.t);
+
+        if (is_sphere_instance(render_data, hit.instanceID))
+        {
+            // The materials of the spheres are after the ones of the triangles
+            out_hit_info.primitive_index = render_data.buffers.sphere_first_primitive + hit.primID;
+            // Already computed by intersect_sphere()
+            out_hit_info.texcoords = hit.uv;
+            // No vertex normals nor normal map on the spheres and the texture footprint isn't estimated,
+            // the textures are sampled at their finest level
+            out_hit_info.texture_footprint = 0.0f;
+            out_hit_info.shading_normal = out_hit_info.geometric_normal;
+        }
+        else
+        {
+            const SceneInstance& instance = render_data.buffers.instances[hit.instanceID];
+
+            // Index of the triangle hit in the triangles of the meshes
+            out_hit_info.primitive_index = get_hit_mesh_triangle(render_data, hit);
+            out_hit_info.texcoords = interpolate_vertex_texcoords(render_data, get_mesh_vertex_attributes(render_data, instance), out_hit_info.primitive_index, hit.uv);
+            out_hit_info.texture_footprint = get_texture_footprint(render_data, instance, out_hit_info.primitive_index, ray.direction, out_hit_info.geometric_normal, in_out_ray_payload.ray_cone.width);
+            out_hit_info.shading_normal = get_shading_normal(render_data, out_hit_info.geometric_normal, instance, out_hit_info.primitive_index, hit.uv, out_hit_info.texcoords, out_hit_info.texture_footprint);
+        }
 
         out_hit_info.t = hit.t;
         out_hit_info.uv = hit.uv;
@@ -152,8 +420,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool trace_ray(const HIPRTRenderData& render_data
         if (in_out_ray_payload.is_inside_volume())
             in_out_ray_payload.volume_state.distance_in_volume += hit.t;
 
-        int material_index = render_data.buffers.material_indices[hit.primID];
-        in_out_ray_payload.material = get_intersection_material(render_data, material_index, out_hit_info.texcoords);
+        int material_index = render_data.buffers.material_indices[out_hit_info.primitive_index];
+        in_out_ray_payload.material = get_intersection_material(render_data, material_index, out_hit_info.texcoords, out_hit_info.texture_footprint);
 
         if (!in_out_ray_payload.is_inside_volume() || hippt::isZERO(in_out_ray_payload.material.specular_transmission))
         {
@@ -180,8 +448,12 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool trace_ray(const HIPRTRenderData& render_data
 
         if (skipping_volume_boundary)
         {
+            count_ray_statistic(render_data, RAY_STATISTIC_VOLUME_BOUNDARY_SKIPS);
+
             // If we're skipping, the boundary, the ray just keeps going on its way
             ray.origin = out_hit_info.inter_point + ray.direction * 3.0e-3f;
+            // and its maximum distance (if any) accounts for the distance already traveled
+            ray.maxT -= hit.t + 3.0e-3f;
 
             // Don't forget to increment the distance traveled
             // TODO: Are we not double counting the distance here and a few lines above (where we set the .t, .uv, .geometric_normal, ...)
@@ -190,34 +462,65 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool trace_ray(const HIPRTRenderData& render_data
 
     } while ((skipping_volume_boundary && hit.hasHit()));
 
+    // Only the surface the path scatters off curves the cone, not the skipped volume boundaries
+    if (is_sphere_instance(render_data, hit.instanceID))
+        in_out_ray_payload.ray_cone.curve(get_sphere_spread_angle(render_data, hit.primID, out_hit_info.inter_point, ray.direction, in_out_ray_payload.ray_cone.width));
+    else
+        in_out_ray_payload.ray_cone.curve(get_surface_spread_angle(render_data, render_data.buffers.instances[hit.instanceID], out_hit_info.primitive_index, ray.direction, in_out_ray_payload.ray_cone.width));
+
     return hit.hasHit();
 }
 
 /**
- * Returns true if in shadow, false otherwise
+ * Returns the maximum distance of the ray of the bounce 'bounce' (> 0) given by
+ * HIPRTRenderSettings::indirect_rays_max_distance. 1.0e35f if there's no maximum distance
  */
-HIPRT_HOST_DEVICE HIPRT_INLINE bool evaluate_shadow_ray(const HIPRTRenderData& render_data, hiprtRay ray, float t_max, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE float get_indirect_ray_max_distance(const HIPRTRenderData& render_data, int bounce)
 {
+    if (render_data.render_settings.indirect_rays_max_distance <= 0.0f)
+        return 1.0e35f;
+
+    return render_data.render_settings.indirect_rays_max_distance * pow(render_data.render_settings.indirect_rays_max_distance_bounce_factor, static_cast<float>(bounce - 1));
+}
+
+/**
+ * Mask of the instances that the rays of the bounce 'bounce' (0 for the camera rays) and
+ * their shadow rays are traced against, see HostDeviceCommon/GeometryLOD.h
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int get_geometry_lod_ray_mask(const HIPRTRenderData& render_data, int bounce)
+{
+    return bounce < render_data.render_settings.geometry_lod_secondary_bounce ? GEOMETRY_LOD_PRIMARY_RAY_MASK : GEOMETRY_LOD_SECONDARY_RAY_MASK;
+}
+
+/**
+ * Returns true if in shadow, false otherwise. Only the instances of 'ray_mask' occlude
+ * the ray, see HostDeviceCommon/GeometryLOD.h
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool evaluate_shadow_ray(const HIPRTRenderData& render_data, hiprtRay ray, float t_max, Xorshift32Generator& random_number_generator, unsigned int ray_mask = GEOMETRY_LOD_PRIMARY_RAY_MASK)
+{
+    count_ray_statistic(render_data, RAY_STATISTIC_SHADOW_RAYS);
+
 #ifdef __KERNELCC__
     ray.maxT = t_max - 1.0e-4f;
 
-#if UseSharedStackBVHTraversal == KERNEL_OPTION_TRUE
     // Payload for the alpha testing filter function
     AlphaTestingPayload payload;
     payload.render_data = &render_data;
     payload.random_number_generator = &random_number_generator;
 
-#if SharedStackBVHTraversalSize > 0
-    hiprtSharedStackBuffer shared_stack_buffer{ SharedStackBVHTraversalSize, shared_stack_cache };
+#if UseSharedStackBVHTraversal == KERNEL_OPTION_TRUE
+#if SHADOW_RAYS_SHARED_STACK_SIZE > 0
+    hiprtSharedStackBuffer shared_stack_buffer{ SHADOW_RAYS_SHARED_STACK_SIZE, shared_stack_cache };
 #else
     hiprtSharedStackBuffer shared_stack_buffer{ 0, nullptr };
 #endif
-    hiprtGlobalStack global_stack(render_data.global_traversal_stack_buffer, shared_stack_buffer);
+    BVHTraversalGlobalStack global_stack(render_data.global_traversal_stack_buffer, shared_stack_buffer);
+    hiprtEmptyInstanceStack instance_stack;
 
-    hiprtGeomTraversalAnyHitCustomStack<hiprtGlobalStack> traversal(render_data.geom, ray, global_stack, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
-    //hiprtGeomTraversalAnyHitCustomStack<hiprtGlobalStack> traversal()
+    // The traversal stops at the first hit not filtered out by alpha testing
+    hiprtSceneTraversalAnyHitCustomStack<BVHTraversalGlobalStack, hiprtEmptyInstanceStack> traversal(render_data.geom, ray, global_stack, instance_stack, ray_mask, hiprtTraversalHintShadowRays, &payload, render_data.func_table, 0);
 #else
-    hiprtGeomTraversalClosest traversal(render_data.geom, ray, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
+    hiprtSceneTraversalAnyHit traversal(render_data.geom, ray, ray_mask, hiprtTraversalHintShadowRays, &payload, render_data.func_table, 0);
 #endif
 
     hiprtHit shadow_ray_hit = traversal.getNextHit();
@@ -226,63 +529,105 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool evaluate_shadow_ray(const HIPRTRenderData& r
 
     return true;
 #else
-    float alpha = 1.0f;
-    // The total distance of our ray. Incremented after each hit
-    // (we may find multiple hits if we hit transparent texture
-    // and keep intersecting the scene)
-    float cumulative_t = 0.0f;
+    // The alpha transparent hits are skipped by the alpha testing filter of the BVH traversal
+    return intersect_scene_cpu_any_hit(render_data, ray, t_max - 1.0e-4f, random_number_generator);
+#endif // __KERNELCC__
+}
 
-    hiprtHit hit;
-    do
+/**
+ * Same as evaluate_shadow_ray() for the shadow ray of a light sample but the shadow rays
+ * of the far away light samples go through the shadow_ray_distance_roulette() first.
+ *
+ * Returns true if in shadow (or discarded by the roulette). If not in shadow, the contribution
+ * of the light sample must be multiplied by 'out_roulette_weight'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool evaluate_shadow_ray_distance_roulette(const HIPRTRenderData& render_data, const hiprtRay& ray, float t_max, float& out_roulette_weight, Xorshift32Generator& random_number_generator, unsigned int ray_mask = GEOMETRY_LOD_PRIMARY_RAY_MASK)
+{
+    out_roulette_weight = shadow_ray_distance_roulette(render_data, t_max, random_number_generator);
+    if (out_roulette_weight == 0.0f)
+        return true;
+
+    return evaluate_shadow_ray(render_data, ray, t_max, random_number_generator, ray_mask);
+}
+
+/**
+ * Fills the emission, shading normal and scene primitive index of 'out_light_hit_info'
+ * for the hit 'shadow_ray_hit' of a shadow ray whose world space geometric normal is
+ * 'geometric_normal'. The hit distance isn't filled
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void read_shadow_light_ray_hit(const HIPRTRenderData& render_data, const hiprtHit& shadow_ray_hit, const float3& geometric_normal, ShadowLightRayHitInfo& out_light_hit_info)
+{
+    if (is_sphere_instance(render_data, shadow_ray_hit.instanceID))
     {
-        // We should use ray tracing fitler functions here instead of re-tracing new rays
-        hit = intersect_scene_cpu(render_data, ray, random_number_generator);
-        if (!hit.hasHit())
-            return false;
+        // The spheres aren't in the light sampling structures, the light sampling strategies can't
+        // weight the hits of emissive spheres so they're only occluders for the shadow rays
+        out_light_hit_info.hit_emission = ColorRGB32F(0.0f);
+        out_light_hit_info.hit_shading_normal = geometric_normal;
+        out_light_hit_info.hit_prim_index = -1;
 
-        if (render_data.render_settings.do_alpha_testing)
-            alpha = get_hit_base_color_alpha(render_data, hit);
-        else
-            alpha = 1.0f;
+        return;
+    }
 
-        float3 inter_point = ray.origin + ray.direction * hit.t;
-        ray.origin = inter_point + ray.direction * 3.0e-3f;
-        cumulative_t += hit.t;
+    const SceneInstance& instance = render_data.buffers.instances[shadow_ray_hit.instanceID];
+    int mesh_triangle_index = get_hit_mesh_triangle(render_data, shadow_ray_hit);
 
-        // We keep going as long as the alpha is < 1.0f meaning that we hit texture transparency
-    } while (alpha < 1.0f && cumulative_t < t_max - 1.0e-4f);
+    const PackedRendererMaterial& material = render_data.buffers.materials_buffer[render_data.buffers.material_indices[mesh_triangle_index]];
+    int emission_texture_index = material.get_texture_index(PackedRendererMaterial::EMISSION_TEXTURE);
 
-    // If we found a hit and that it is close enough
-    return hit.hasHit() && cumulative_t < t_max - 1.0e-4f;
-#endif // __KERNELCC__
+    float2 texcoords = interpolate_vertex_texcoords(render_data, get_mesh_vertex_attributes(render_data, instance), mesh_triangle_index, shadow_ray_hit.uv);
+    if (emission_texture_index >= 0)
+    {
+        // Same emission as get_emissive_triangle_emission() for the light samples on that triangle
+        get_material_property(render_data, out_light_hit_info.hit_emission, false, texcoords, emission_texture_index);
+        out_light_hit_info.hit_emission *= material.get_emission_strength();
+    }
+    else
+        out_light_hit_info.hit_emission = material.get_emission();
+
+    // Using the already computed texcoords to get the shading normal
+    out_light_hit_info.hit_shading_normal = get_shading_normal(render_data, geometric_normal, instance, mesh_triangle_index, shadow_ray_hit.uv, texcoords);
+    // The emissive triangles are identified by their scene primitive index. The LODs
+    // (never emissive, see MeshLODBuilder) have no scene primitives
+    out_light_hit_info.hit_prim_index = is_geometry_lod_instance(render_data, shadow_ray_hit.instanceID) ? -1 : get_scene_primitive_index(instance, mesh_triangle_index);
 }
 
 /**
- * Returns true if in shadow, false otherwise.
+ * Same as above for a hit returned by the traversal of the scene
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void read_shadow_light_ray_hit(const HIPRTRenderData& render_data, const hiprtHit& shadow_ray_hit, ShadowLightRayHitInfo& out_light_hit_info)
+{
+    read_shadow_light_ray_hit(render_data, shadow_ray_hit, get_hit_geometric_normal(render_data, shadow_ray_hit), out_light_hit_info);
+}
+
+/**
+ * Returns true if in shadow, false otherwise. Only the instances of 'ray_mask' are hit, see HostDeviceCommon/GeometryLOD.h
  * 
  * Also, if a hit was found, outputs the emission of the material at the hit point in 'out_hit_emission'
  */
-HIPRT_HOST_DEVICE HIPRT_INLINE bool evaluate_shadow_light_ray(const HIPRTRenderData& render_data, hiprtRay ray, float t_max, ShadowLightRayHitInfo& out_light_hit_info, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE bool evaluate_shadow_light_ray(const HIPRTRenderData& render_data, hiprtRay ray, float t_max, ShadowLightRayHitInfo& out_light_hit_info, Xorshift32Generator& random_number_generator, unsigned int ray_mask = GEOMETRY_LOD_PRIMARY_RAY_MASK)
 {
+    count_ray_statistic(render_data, RAY_STATISTIC_SHADOW_RAYS);
+
 #ifdef __KERNELCC__
     ray.maxT = t_max - 1.0e-4f;
 
-#if UseSharedStackBVHTraversal == KERNEL_OPTION_TRUE
     // Payload for the alpha testing filter function
     AlphaTestingPayload payload;
     payload.render_data = &render_data;
     payload.random_number_generator = &random_number_generator;
 
-#if SharedStackBVHTraversalSize > 0
-    hiprtSharedStackBuffer shared_stack_buffer{ SharedStackBVHTraversalSize, shared_stack_cache };
+#if UseSharedStackBVHTraversal == KERNEL_OPTION_TRUE
+#if SHADOW_RAYS_SHARED_STACK_SIZE > 0
+    hiprtSharedStackBuffer shared_stack_buffer{ SHADOW_RAYS_SHARED_STACK_SIZE, shared_stack_cache };
 #else
     hiprtSharedStackBuffer shared_stack_buffer{ 0, nullptr };
 #endif
-    hiprtGlobalStack global_stack(render_data.global_traversal_stack_buffer, shared_stack_buffer);
+    BVHTraversalGlobalStack global_stack(render_data.global_traversal_stack_buffer, shared_stack_buffer);
+    hiprtEmptyInstanceStack instance_stack;
 
-    hiprtGeomTraversalClosestCustomStack<hiprtGlobalStack> traversal(render_data.geom, ray, global_stack, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
+    hiprtSceneTraversalClosestCustomStack<BVHTraversalGlobalStack, hiprtEmptyInstanceStack> traversal(render_data.geom, ray, global_stack, instance_stack, ray_mask, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
 #else
-    hiprtGeomTraversalClosest traversal(render_data.geom, ray, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
+    hiprtSceneTraversalClosest traversal(render_data.geom, ray, ray_mask, hiprtTraversalHintDefault, &payload, render_data.func_table, 0);
 #endif
 
     hiprtHit shadow_ray_hit = traversal.getNextHit();
@@ -293,88 +638,21 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool evaluate_shadow_light_ray(const HIPRTRenderD
     // alpha-transparent with a distance < t_max so that's a hit and we're shadowed.
 
     // Reading the emission of the material
-    int material_index = render_data.buffers.material_indices[shadow_ray_hit.primID];
-    int emission_texture_index = render_data.buffers.materials_buffer[material_index].emission_texture_index;
-
-    if (emission_texture_index != RendererMaterial::NO_TEXTURE)
-    {
-        float2 texcoords = uv_interpolate(render_data.buffers.triangles_indices, shadow_ray_hit.primID, render_data.buffers.texcoords, shadow_ray_hit.uv);
-        get_material_property(render_data, out_light_hit_info.hit_emission, false, texcoords, emission_texture_index);
-
-        // Using the already computed texcoords to get the shading normal
-        out_light_hit_info.hit_shading_normal = get_shading_normal(render_data, hippt::normalize(shadow_ray_hit.normal), shadow_ray_hit.primID, shadow_ray_hit.uv, texcoords);
-    }
-    else
-    {
-        out_light_hit_info.hit_emission = render_data.buffers.materials_buffer[material_index].get_emission();
-
-        float2 texcoords = uv_interpolate(render_data.buffers.triangles_indices, shadow_ray_hit.primID, render_data.buffers.texcoords, shadow_ray_hit.uv);
-        out_light_hit_info.hit_shading_normal = get_shading_normal(render_data, hippt::normalize(shadow_ray_hit.normal), shadow_ray_hit.primID, shadow_ray_hit.uv, texcoords);
-    }
-    
+    read_shadow_light_ray_hit(render_data, shadow_ray_hit, out_light_hit_info);
     out_light_hit_info.hit_distance = shadow_ray_hit.t;
-    out_light_hit_info.hit_prim_index = shadow_ray_hit.primID;
 
     return true;
 #else
-    float alpha = 1.0f;
-    // The total distance of our ray. Incremented after each hit
-    // (we may find multiple hits if we hit transparent texture
-    // and keep intersecting the scene)
-    float cumulative_t = 0.0f;
-
-    hiprtHit shadow_ray_hit;
-    do
-    {
-        // We should use ray tracing fitler functions here instead of re-tracing new rays
-        shadow_ray_hit = intersect_scene_cpu(render_data, ray, random_number_generator);
-        if (!shadow_ray_hit.hasHit())
-            return false;
-
-        if (render_data.render_settings.do_alpha_testing)
-            alpha = get_hit_base_color_alpha(render_data, shadow_ray_hit);
-        else
-            alpha = 1.0f;
-
-        float3 inter_point = ray.origin + ray.direction * shadow_ray_hit.t;
-        ray.origin = inter_point + ray.direction * 3.0e-3f;
-        cumulative_t += shadow_ray_hit.t;
-
-        // We keep going as long as the alpha is < 1.0f meaning that we hit texture transparency
-    } while (alpha < 1.0f && cumulative_t < t_max - 1.0e-4f);
-
-    bool hit_found = shadow_ray_hit.hasHit() && cumulative_t < t_max - 1.0e-4f;
-
-    if (hit_found)
-    {
-        // If we found a hit and that it is close enough (hit_found conditions)
-
-        int material_index = render_data.buffers.material_indices[shadow_ray_hit.primID];
-        int emission_texture_index = render_data.buffers.materials_buffer[material_index].emission_texture_index;
-
-        if (emission_texture_index != RendererMaterial::NO_TEXTURE)
-        {
-            float2 texcoords = uv_interpolate(render_data.buffers.triangles_indices, shadow_ray_hit.primID, render_data.buffers.texcoords, shadow_ray_hit.uv);
-            get_material_property(render_data, out_light_hit_info.hit_emission, false, texcoords, emission_texture_index);
-
-            // Using the already computed texcoords to get the shading normal
-            out_light_hit_info.hit_shading_normal = get_shading_normal(render_data, hippt::normalize(shadow_ray_hit.normal), shadow_ray_hit.primID, shadow_ray_hit.uv, texcoords);
-        }
-        else
-        {
-            out_light_hit_info.hit_emission = render_data.buffers.materials_buffer[material_index].get_emission();
-
-            float2 texcoords = uv_interpolate(render_data.buffers.triangles_indices, shadow_ray_hit.primID, render_data.buffers.texcoords, shadow_ray_hit.uv);
-            out_light_hit_info.hit_shading_normal = get_shading_normal(render_data, hippt::normalize(shadow_ray_hit.normal), shadow_ray_hit.primID, shadow_ray_hit.uv, texcoords);
-        }
+    // Closest hit and not any-hit because the emission of the first surface hit is needed.
+    // The alpha transparent hits are skipped by the alpha testing filter of the BVH traversal
+    hiprtHit shadow_ray_hit = intersect_scene_cpu(render_data, ray, random_number_generator);
+    if (!shadow_ray_hit.hasHit() || shadow_ray_hit.t >= t_max - 1.0e-4f)
+        return false;
 
-        out_light_hit_info.hit_prim_index = shadow_ray_hit.primID;
-        out_light_hit_info.hit_distance = cumulative_t;
+    read_shadow_light_ray_hit(render_data, shadow_ray_hit, out_light_hit_info);
+    out_light_hit_info.hit_distance = shadow_ray_hit.t;
 
-        return true;
-    }
-    else
-        return false;
+    return true;
 #endif // __KERNELCC__
 }
 
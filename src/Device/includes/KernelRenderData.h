@@ -0,0 +1,32 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_KERNEL_RENDER_DATA_H
+#define DEVICE_KERNEL_RENDER_DATA_H
+
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Parameters of the GPU kernels that take the render data, before their 'int2 res' parameter.
+ *
+ * With UseDeviceResidentRenderData, the kernel receives a pointer to the render data uploaded
+ * by the GPURenderer and the fields of the render data that change every sample. KERNEL_RENDER_DATA_PROLOGUE,
+ * at the start of the kernel, then rebuilds the usual 'render_data' from these two so that
+ * the rest of the kernel doesn't depend on the option.
+ *
+ * The CPU kernels always take the render data by value
+ */
+#ifdef __KERNELCC__
+#if UseDeviceResidentRenderData == KERNEL_OPTION_TRUE
+#define KERNEL_RENDER_DATA_PARAMETERS const HIPRTRenderData* __restrict__ device_render_data, HIPRTPerSampleData per_sample_data
+#define KERNEL_RENDER_DATA_PROLOGUE HIPRTRenderData render_data = *device_render_data; set_per_sample_data(render_data, per_sample_data);
+#else
+#define KERNEL_RENDER_DATA_PARAMETERS HIPRTRenderData render_data
+#define KERNEL_RENDER_DATA_PROLOGUE
+#endif
+#endif
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_LIGHT_BVH_H
+#define DEVICE_LIGHT_BVH_H
+
+#include "Device/includes/LightUtils.h"
+
+#include "HostDeviceCommon/HitInfo.h"
+#include "HostDeviceCommon/LightBVHNode.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Returns cos(max(0, theta_a - theta_b)) given the sine and cosine of theta_a and theta_b
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float light_bvh_cos_sub_clamped(float sin_theta_a, float cos_theta_a, float sin_theta_b, float cos_theta_b)
+{
+    if (cos_theta_a > cos_theta_b)
+        // theta_a < theta_b, the difference is clamped to 0
+        return 1.0f;
+
+    return cos_theta_a * cos_theta_b + sin_theta_a * sin_theta_b;
+}
+
+/**
+ * Returns sin(max(0, theta_a - theta_b)) given the sine and cosine of theta_a and theta_b
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float light_bvh_sin_sub_clamped(float sin_theta_a, float cos_theta_a, float sin_theta_b, float cos_theta_b)
+{
+    if (cos_theta_a > cos_theta_b)
+        // theta_a < theta_b, the difference is clamped to 0
+        return 0.0f;
+
+    return sin_theta_a * cos_theta_b - cos_theta_a * sin_theta_b;
+}
+
+/**
+ * Returns a conservative estimate of the contribution of the emissive
+ * triangles below 'node' to the given shading point.
+ *
+ * The estimate accounts for the power of the node, its distance to the shading point and
+ * the orientation of the emitters (bounded by the cone of normals of the node) as seen from the
+ * shading point as well as the cosine term at the shading point.
+ *
+ * Reference: [Importance Sampling of Many Lights with Adaptive Tree Splitting, Conty Estevez, Kulla, 2018]
+ * and pbrt-v4's LightBounds::Importance()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float light_bvh_node_importance(const LightBVHNode& node, const float3& shading_point, const float3& shading_normal)
+{
+    if (node.power <= 0.0f)
+        return 0.0f;
+
+    float3 center = (node.bbox_min + node.bbox_max) * 0.5f;
+    float3 to_point = shading_point - center;
+    float distance_squared = hippt::length2(to_point);
+    // Radius of the sphere that bounds the AABB of the node
+    float radius_squared = hippt::length2(node.bbox_max - center);
+
+    float3 direction_to_point = distance_squared > 0.0f ? to_point / sqrt(distance_squared) : make_float3(0.0f, 0.0f, 1.0f);
+
+    // abs() here because the emissive triangles are two-sided
+    float cos_theta_w = hippt::abs(hippt::dot(node.cone_axis, direction_to_point));
+    float sin_theta_w = sqrt(hippt::max(0.0f, 1.0f - cos_theta_w * cos_theta_w));
+
+    // Half-angle of the cone of directions that the bounding sphere of
+    // the node subtends as seen from the shading point
+    float cos_theta_b = -1.0f;
+    if (distance_squared > radius_squared)
+        cos_theta_b = sqrt(hippt::max(0.0f, 1.0f - radius_squared / distance_squared));
+    float sin_theta_b = sqrt(hippt::max(0.0f, 1.0f - cos_theta_b * cos_theta_b));
+
+    // Minimum angle between the emitters normals and the direction to the shading point
+    float sin_theta_o = sqrt(hippt::max(0.0f, 1.0f - node.cos_theta_o * node.cos_theta_o));
+    float cos_theta_x = light_bvh_cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    float sin_theta_x = light_bvh_sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    float cos_theta_p = light_bvh_cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_p <= node.cos_theta_e)
+        // The shading point is outside of the emission cone of all the emitters of the node
+        return 0.0f;
+
+    // Clamping the distance to the radius of the node so that the importance
+    // doesn't go to infinity for shading points that are very close to / inside the node
+    float importance = node.power * cos_theta_p / hippt::max(distance_squared, radius_squared);
+
+    // Minimum angle between the shading normal and the directions towards the node.
+    // abs() to account for refractions
+    float cos_theta_i = hippt::abs(hippt::dot(-direction_to_point, shading_normal));
+    float sin_theta_i = sqrt(hippt::max(0.0f, 1.0f - cos_theta_i * cos_theta_i));
+    importance *= light_bvh_cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+
+    return importance;
+}
+
+/**
+ * Returns the probability of choosing the left child of the inner node 'node'
+ * for the given shading point. Returns a negative value if none of the two children
+ * have any importance for that shading point
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float light_bvh_left_child_probability(const LightBVHNode* nodes, const LightBVHNode& node, const float3& shading_point, const float3& shading_normal)
+{
+    float importance_left = light_bvh_node_importance(nodes[node.first_child_index], shading_point, shading_normal);
+    float importance_right = light_bvh_node_importance(nodes[node.first_child_index + 1], shading_point, shading_normal);
+    float importance_sum = importance_left + importance_right;
+    if (importance_sum <= 0.0f)
+        return -1.0f;
+
+    return importance_left / importance_sum;
+}
+
+/**
+ * Samples one emissive triangle of the scene by traversing the light hierarchy
+ * from the root, choosing stochastically one of the two children at each inner node
+ * proportionally to their importance for the given shading point. A point is then sampled
+ * uniformly on the surface of the emissive triangle of the leaf reached.
+ *
+ * The returned 'pdf' is in area measure and accounts for the choice of the triangle.
+ * 'pdf' is 0.0f if no triangle could be sampled
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 light_bvh_sample_one_emissive_triangle(const HIPRTRenderData& render_data, const float3& shading_point, const float3& shading_normal, Xorshift32Generator& random_number_generator, float& pdf, LightSourceInformation& light_info)
+{
+    const LightBVHNode* nodes = render_data.buffers.light_bvh_nodes;
+
+    int node_index = 0;
+    float triangle_probability = 1.0f;
+    while (nodes[node_index].first_child_index != -1)
+    {
+        const LightBVHNode& node = nodes[node_index];
+
+        float left_probability = light_bvh_left_child_probability(nodes, node, shading_point, shading_normal);
+        if (left_probability < 0.0f)
+        {
+            // No light below this node can contribute to the shading point
+            pdf = 0.0f;
+
+            return make_float3(0.0f, 0.0f, 0.0f);
+        }
+
+        if (random_number_generator() < left_probability)
+        {
+            node_index = node.first_child_index;
+            triangle_probability *= left_probability;
+        }
+        else
+        {
+            node_index = node.first_child_index + 1;
+            triangle_probability *= 1.0f - left_probability;
+        }
+    }
+
+    float3 random_point_on_triangle = sample_point_on_emissive_triangle(render_data, nodes[node_index].emissive_triangle_index, random_number_generator, pdf, light_info);
+    pdf *= triangle_probability;
+
+    return random_point_on_triangle;
+}
+
+/**
+ * Returns the probability that light_bvh_sample_one_emissive_triangle() chooses
+ * the emissive triangle 'triangle_index' (scene primitive index of the triangle)
+ * for the given shading point.
+ *
+ * The probability is computed by walking up the light hierarchy from the leaf of the triangle
+ * to the root. 0.0f is returned if the triangle isn't an emissive triangle of the hierarchy
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float light_bvh_emissive_triangle_probability(const HIPRTRenderData& render_data, int triangle_index, const float3& shading_point, const float3& shading_normal)
+{
+    // Looking for the index of the triangle in the emissive triangles buffer.
+    // The emissive triangles buffer is sorted by increasing triangle index
+    // so we can binary search it
+    int emissive_index = -1;
+    int low = 0;
+    int high = render_data.buffers.emissive_triangles_count - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        int middle_triangle_index = render_data.buffers.emissive_triangles_indices[middle];
+
+        if (middle_triangle_index == triangle_index)
+        {
+            emissive_index = middle;
+            break;
+        }
+        else if (middle_triangle_index < triangle_index)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+
+    if (emissive_index == -1)
+        return 0.0f;
+
+    const LightBVHNode* nodes = render_data.buffers.light_bvh_nodes;
+
+    int node_index = render_data.buffers.light_bvh_leaf_indices[emissive_index];
+    float triangle_probability = 1.0f;
+    while (nodes[node_index].parent_index != -1)
+    {
+        const LightBVHNode& parent = nodes[nodes[node_index].parent_index];
+
+        float left_probability = light_bvh_left_child_probability(nodes, parent, shading_point, shading_normal);
+        if (left_probability < 0.0f)
+            return 0.0f;
+
+        triangle_probability *= (node_index == parent.first_child_index) ? left_probability : 1.0f - left_probability;
+        node_index = nodes[node_index].parent_index;
+    }
+
+    return triangle_probability;
+}
+
+/**
+ * Returns true if 'ray' intersects the AABB of 'node' before 't_max'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool light_bvh_node_hit(const LightBVHNode& node, const float3& ray_origin, const float3& inverse_direction, float t_max)
+{
+    float3 t_1 = (node.bbox_min - ray_origin) * inverse_direction;
+    float3 t_2 = (node.bbox_max - ray_origin) * inverse_direction;
+
+    float t_near = hippt::max(hippt::max(hippt::min(t_1.x, t_2.x), hippt::min(t_1.y, t_2.y)), hippt::min(t_1.z, t_2.z));
+    float t_far = hippt::min(hippt::min(hippt::max(t_1.x, t_2.x), hippt::max(t_1.y, t_2.y)), hippt::max(t_1.z, t_2.z));
+
+    return t_near <= t_far && t_far >= 0.0f && t_near < t_max;
+}
+
+/**
+ * Finds the closest emissive triangle hit by 'ray' before 't_max' by traversing the light hierarchy
+ * as a BVH over the emissive triangles only: this answers "does this direction hit a light" without
+ * traversing the whole scene. The occlusion of that light by the rest of the scene isn't evaluated.
+ * 
+ * Returns true if an emissive triangle was hit, in which case 'out_hit' and 'out_geometric_normal'
+ * are filled as by intersect_emissive_triangle().
+ * 
+ * The traversal is stackless: the children of a node are next to each other and the nodes
+ * know their parent so the next node to visit can always be found from the current one
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool light_bvh_intersect_closest(const HIPRTRenderData& render_data, const hiprtRay& ray, float t_max, hiprtHit& out_hit, float3& out_geometric_normal)
+{
+    if (render_data.buffers.emissive_triangles_count == 0)
+        return false;
+
+    const LightBVHNode* nodes = render_data.buffers.light_bvh_nodes;
+    float3 inverse_direction = make_float3(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+
+    float closest_t = t_max;
+    bool hit_found = false;
+
+    int node_index = 0;
+    while (true)
+    {
+        const LightBVHNode& node = nodes[node_index];
+        if (light_bvh_node_hit(node, ray.origin, inverse_direction, closest_t))
+        {
+            if (node.first_child_index != -1)
+            {
+                // Going down in the left child first
+                node_index = node.first_child_index;
+
+                continue;
+            }
+
+            hiprtHit triangle_hit;
+            float3 triangle_geometric_normal;
+            if (intersect_emissive_triangle(render_data, ray, node.emissive_triangle_index, closest_t, triangle_hit, triangle_geometric_normal))
+            {
+                closest_t = triangle_hit.t;
+                out_hit = triangle_hit;
+                out_geometric_normal = triangle_geometric_normal;
+                hit_found = true;
+            }
+        }
+
+        // Going back up until we're on a left child whose right sibling hasn't been visited yet
+        while (node_index != 0 && node_index != nodes[nodes[node_index].parent_index].first_child_index)
+            node_index = nodes[node_index].parent_index;
+
+        if (node_index == 0)
+            // Back to the root, everything has been visited
+            return hit_found;
+
+        node_index++;
+    }
+}
+
+/**
+ * Same as pdf_of_emissive_triangle_hit() but for the light hierarchy sampler.
+ *
+ * 'shading_point' and 'shading_normal' must be the same as the ones given to
+ * light_bvh_sample_one_emissive_triangle() for the PDFs to match
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float light_bvh_pdf_of_emissive_triangle_hit(const HIPRTRenderData& render_data, const ShadowLightRayHitInfo& light_hit_info, float3 ray_direction, const float3& shading_point, const float3& shading_normal)
+{
+    float triangle_probability = light_bvh_emissive_triangle_probability(render_data, light_hit_info.hit_prim_index, shading_point, shading_normal);
+    if (triangle_probability == 0.0f)
+        return 0.0f;
+
+    // Surface area PDF of hitting that point on that triangle in the scene
+    float pdf = triangle_probability / triangle_area(render_data, light_hit_info.hit_prim_index);
+
+    // abs() here to allow backfacing lights
+    float cosine_light_source = hippt::abs(hippt::dot(light_hit_info.hit_shading_normal, -ray_direction));
+
+    // Conversion to solid angle from surface area measure
+    pdf *= light_hit_info.hit_distance * light_hit_info.hit_distance;
+    pdf /= cosine_light_source;
+
+    return pdf;
+}
+
+#endif
@@ -6,18 +6,105 @@
 #ifndef DEVICE_LIGHT_UTILS_H
 #define DEVICE_LIGHT_UTILS_H
 
+#include "Device/includes/Material.h"
+#include "Device/includes/Sampling.h"
+#include "Device/includes/SceneInstances.h"
+#include "Device/includes/VertexAttributes.h"
+
 #include "HostDeviceCommon/Color.h"
 #include "HostDeviceCommon/HitInfo.h"
 #include "HostDeviceCommon/RenderData.h"
 
-HIPRT_HOST_DEVICE HIPRT_INLINE float3 uniform_sample_one_emissive_triangle(const HIPRTRenderData& render_data, Xorshift32Generator& random_number_generator, float& pdf, LightSourceInformation& light_info)
+/**
+ * Luminance of the emission of the emissive triangle 'triangle_index' (scene primitive index) that
+ * its power is computed with for the power sampling of the lights: the luminance of the emission of its
+ * material or, if the material has an emission texture, the average luminance of the texture over the
+ * triangle times the emission strength (see EmissiveTextureIntegrator).
+ *
+ * The probability of the power sampling of a triangle is this luminance times the area of the triangle
+ * over the total power of the emissive triangles
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float get_emissive_triangle_power_luminance(const SceneInstance* instances, int instance_count, const int* material_indices, const PackedRendererMaterial* materials, const float* triangle_emission_texture_luminances, int triangle_index)
 {
-    int random_index = random_number_generator.random_index(render_data.buffers.emissive_triangles_count);
-    int triangle_index = render_data.buffers.emissive_triangles_indices[random_index];
+    const SceneInstance& instance = instances[get_scene_primitive_instance_index(instances, instance_count, triangle_index)];
+    int mesh_triangle_index = get_scene_primitive_mesh_triangle(instance, triangle_index);
+
+    // The luminance of a white texture if the textures weren't integrated
+    float texture_luminance = triangle_emission_texture_luminances == nullptr ? 1.0f : triangle_emission_texture_luminances[mesh_triangle_index];
+
+    return materials[material_indices[mesh_triangle_index]].get_emission_power_luminance(texture_luminance);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float get_emissive_triangle_power_luminance(const HIPRTRenderData& render_data, int triangle_index)
+{
+    return get_emissive_triangle_power_luminance(render_data.buffers.instances, render_data.buffers.instance_count, render_data.buffers.material_indices, render_data.buffers.materials_buffer, render_data.buffers.triangle_emission_texture_luminances, triangle_index);
+}
+
+/**
+ * Emission of the emissive triangle 'triangle_index' (scene primitive index) at the point of
+ * barycentric coordinates 'uv' on the triangle, read from the emission texture of its material if any
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F get_emissive_triangle_emission(const HIPRTRenderData& render_data, int triangle_index, float2 uv)
+{
+    const SceneInstance& instance = render_data.buffers.instances[get_scene_primitive_instance_index(render_data.buffers.instances, render_data.buffers.instance_count, triangle_index)];
+    int mesh_triangle_index = get_scene_primitive_mesh_triangle(instance, triangle_index);
 
-    float3 vertex_A = render_data.buffers.vertices_positions[render_data.buffers.triangles_indices[triangle_index * 3 + 0]];
-    float3 vertex_B = render_data.buffers.vertices_positions[render_data.buffers.triangles_indices[triangle_index * 3 + 1]];
-    float3 vertex_C = render_data.buffers.vertices_positions[render_data.buffers.triangles_indices[triangle_index * 3 + 2]];
+    const PackedRendererMaterial& material = render_data.buffers.materials_buffer[render_data.buffers.material_indices[mesh_triangle_index]];
+    int emission_texture_index = material.get_texture_index(PackedRendererMaterial::EMISSION_TEXTURE);
+    if (emission_texture_index < 0)
+        // No texture or constant emissive texture
+        return material.get_emission();
+
+    // Same as get_intersection_material(): the emission of the texture replaces the emission of the material
+    ColorRGB32F emission;
+    float2 texcoords = interpolate_vertex_texcoords(render_data, get_mesh_vertex_attributes(render_data, instance), mesh_triangle_index, uv);
+    get_material_property(render_data, emission, false, texcoords, emission_texture_index);
+
+    return emission * material.get_emission_strength();
+}
+
+/**
+ * Same as above for a point 'point_on_triangle' on the triangle
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F get_emissive_triangle_emission(const HIPRTRenderData& render_data, int triangle_index, float3 point_on_triangle)
+{
+    const PackedRendererMaterial& material = render_data.buffers.materials_buffer[get_scene_primitive_material_index(render_data, triangle_index)];
+    if (material.get_texture_index(PackedRendererMaterial::EMISSION_TEXTURE) < 0)
+        // Quick exit without the barycentric coordinates
+        return material.get_emission();
+
+    float3 vertex_A, vertex_B, vertex_C;
+    get_scene_primitive_vertices(render_data, triangle_index, vertex_A, vertex_B, vertex_C);
+
+    // Barycentric coordinates of the point, in the plane of the triangle
+    float3 AB = vertex_B - vertex_A;
+    float3 AC = vertex_C - vertex_A;
+    float3 AP = point_on_triangle - vertex_A;
+    float AB_AB = hippt::dot(AB, AB);
+    float AB_AC = hippt::dot(AB, AC);
+    float AC_AC = hippt::dot(AC, AC);
+    float AP_AB = hippt::dot(AP, AB);
+    float AP_AC = hippt::dot(AP, AC);
+    float denominator = AB_AB * AC_AC - AB_AC * AB_AC;
+
+    float2 uv = make_float2(0.0f, 0.0f);
+    if (denominator > 0.0f)
+        uv = make_float2((AC_AC * AP_AB - AB_AC * AP_AC) / denominator, (AB_AB * AP_AC - AB_AC * AP_AB) / denominator);
+
+    return get_emissive_triangle_emission(render_data, triangle_index, uv);
+}
+
+/**
+ * Samples a point uniformly on the surface of the emissive triangle 'triangle_index'
+ * (scene primitive index of the triangle, see SceneInstance).
+ * 
+ * The returned 'pdf' is in area measure and only accounts for the choice of the point on the
+ * triangle, not for the choice of the triangle itself. 'pdf' is 0.0f if the triangle is degenerate
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 sample_point_on_emissive_triangle(const HIPRTRenderData& render_data, int triangle_index, Xorshift32Generator& random_number_generator, float& pdf, LightSourceInformation& light_info)
+{
+    float3 vertex_A, vertex_B, vertex_C;
+    get_scene_primitive_vertices(render_data, triangle_index, vertex_A, vertex_B, vertex_C);
 
     float rand_1 = random_number_generator();
     float rand_2 = random_number_generator();
@@ -44,19 +131,177 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float3 uniform_sample_one_emissive_triangle(const
     light_info.emissive_triangle_index = triangle_index;
     light_info.light_source_normal = normal / length_normal; // Normalization
     light_info.light_area = length_normal * 0.5f;
-    light_info.emission = render_data.buffers.materials_buffer[render_data.buffers.material_indices[triangle_index]].get_emission();
+    light_info.emission = get_emissive_triangle_emission(render_data, triangle_index, make_float2(u, v));
 
     pdf = 1.0f / light_info.light_area;
+
+    return random_point_on_triangle;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 uniform_sample_one_emissive_triangle(const HIPRTRenderData& render_data, Xorshift32Generator& random_number_generator, float& pdf, LightSourceInformation& light_info)
+{
+    int random_index = random_number_generator.random_index(render_data.buffers.emissive_triangles_count);
+    int triangle_index = render_data.buffers.emissive_triangles_indices[random_index];
+
+    float3 random_point_on_triangle = sample_point_on_emissive_triangle(render_data, triangle_index, random_number_generator, pdf, light_info);
     pdf /= render_data.buffers.emissive_triangles_count;
 
     return random_point_on_triangle;
 }
 
+/**
+ * Samples one emissive triangle of the scene proportionally to its power (area * luminance
+ * of the emission) with the alias table of the emissive triangles and then samples a point
+ * uniformly on that triangle.
+ * 
+ * The returned 'pdf' is in area measure and accounts for the choice of the triangle.
+ * 'pdf' is 0.0f if no triangle could be sampled
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 power_sample_one_emissive_triangle(const HIPRTRenderData& render_data, Xorshift32Generator& random_number_generator, float& pdf, LightSourceInformation& light_info)
+{
+    if (render_data.buffers.emissive_triangles_total_power <= 0.0f)
+    {
+        // None of the emissive triangles emit any light
+        pdf = 0.0f;
+
+        return make_float3(0.0f, 0.0f, 0.0f);
+    }
+
+    int random_index = sample_alias_table(render_data.buffers.emissive_triangles_alias_table_probas, render_data.buffers.emissive_triangles_alias_table_alias, render_data.buffers.emissive_triangles_count, random_number_generator);
+    int triangle_index = render_data.buffers.emissive_triangles_indices[random_index];
+
+    float3 random_point_on_triangle = sample_point_on_emissive_triangle(render_data, triangle_index, random_number_generator, pdf, light_info);
+    if (pdf == 0.0f)
+        return random_point_on_triangle;
+
+    // Probability of the triangle (area * luminance / total_power) times the probability of the
+    // point on the triangle (1 / area): the area cancels out
+    pdf = get_emissive_triangle_power_luminance(render_data, triangle_index) / render_data.buffers.emissive_triangles_total_power;
+
+    return random_point_on_triangle;
+}
+
+/**
+ * Returns the index of the cell of the light clusters grid whose light list is sampled for the
+ * shading point 'shading_point', -1 if the global alias table of the emissive triangles
+ * is sampled instead (outside of the grid or cell without a light list)
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_light_cluster_of_point(const HIPRTRenderData& render_data, const float3& shading_point)
+{
+    const LightClustersGrid& light_clusters = render_data.buffers.light_clusters;
+
+    int cell_index = light_clusters_get_cell_index(light_clusters, shading_point);
+    if (cell_index == -1 || light_clusters.cells_offsets[cell_index] == light_clusters.cells_offsets[cell_index + 1])
+        return -1;
+
+    return cell_index;
+}
+
+/**
+ * Samples one emissive triangle of the light cluster of 'shading_point' proportionally to its power
+ * and then samples a point uniformly on that triangle (ETSS_LIGHT_CLUSTERS). Same as
+ * power_sample_one_emissive_triangle() where the shading point has no light cluster.
+ * 
+ * The returned 'pdf' is in area measure and accounts for the choice of the triangle.
+ * 'pdf' is 0.0f if no triangle could be sampled
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 light_clusters_sample_one_emissive_triangle(const HIPRTRenderData& render_data, const float3& shading_point, Xorshift32Generator& random_number_generator, float& pdf, LightSourceInformation& light_info)
+{
+    int cell_index = get_light_cluster_of_point(render_data, shading_point);
+    if (cell_index == -1)
+        return power_sample_one_emissive_triangle(render_data, random_number_generator, pdf, light_info);
+
+    const LightClustersGrid& light_clusters = render_data.buffers.light_clusters;
+    float cell_total_power = light_clusters.cells_total_power[cell_index];
+    if (cell_total_power <= 0.0f)
+    {
+        pdf = 0.0f;
+
+        return make_float3(0.0f, 0.0f, 0.0f);
+    }
+
+    int cell_offset = light_clusters.cells_offsets[cell_index];
+    int cell_light_count = light_clusters.cells_offsets[cell_index + 1] - cell_offset;
+
+    int random_index = sample_alias_table(light_clusters.cells_alias_table_probas + cell_offset, light_clusters.cells_alias_table_alias + cell_offset, cell_light_count, random_number_generator);
+    int triangle_index = light_clusters.cells_emissive_triangles[cell_offset + random_index];
+
+    float3 random_point_on_triangle = sample_point_on_emissive_triangle(render_data, triangle_index, random_number_generator, pdf, light_info);
+    if (pdf == 0.0f)
+        return random_point_on_triangle;
+
+    // Same as in power_sample_one_emissive_triangle() but with the power of the cell
+    pdf = get_emissive_triangle_power_luminance(render_data, triangle_index) / cell_total_power;
+
+    return random_point_on_triangle;
+}
+
+/**
+ * Returns the probability (area measure, the area of the triangle cancels out as in
+ * power_sample_one_emissive_triangle()) that light_clusters_sample_one_emissive_triangle()
+ * samples the point hit on the emissive triangle 'triangle_index' from 'shading_point'.
+ * 
+ * 0.0f if the triangle isn't in the light list of the cluster of 'shading_point'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float light_clusters_pdf_of_emissive_triangle(const HIPRTRenderData& render_data, const float3& shading_point, int triangle_index)
+{
+    int cell_index = get_light_cluster_of_point(render_data, shading_point);
+    if (cell_index == -1)
+    {
+        if (render_data.buffers.emissive_triangles_total_power <= 0.0f)
+            return 0.0f;
+
+        return get_emissive_triangle_power_luminance(render_data, triangle_index) / render_data.buffers.emissive_triangles_total_power;
+    }
+
+    const LightClustersGrid& light_clusters = render_data.buffers.light_clusters;
+    float cell_total_power = light_clusters.cells_total_power[cell_index];
+    if (cell_total_power <= 0.0f)
+        return 0.0f;
+
+    // Binary search of the triangle in the sorted list of the cell
+    int begin = light_clusters.cells_offsets[cell_index];
+    int end = light_clusters.cells_offsets[cell_index + 1];
+    while (begin < end)
+    {
+        int middle = (begin + end) / 2;
+        if (light_clusters.cells_emissive_triangles[middle] < triangle_index)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+
+    if (begin == light_clusters.cells_offsets[cell_index + 1] || light_clusters.cells_emissive_triangles[begin] != triangle_index)
+        // Culled from this cluster, only the BSDF samples can find this light from here
+        return 0.0f;
+
+    return get_emissive_triangle_power_luminance(render_data, triangle_index) / cell_total_power;
+}
+
+/**
+ * Samples one emissive triangle of the scene (and a point on it) with the strategy given by
+ * EmissiveTrianglesSamplingStrategy.
+ * 
+ * 'shading_point' is only used by ETSS_LIGHT_CLUSTERS, for the light cluster to sample.
+ * The same point must be given to pdf_of_emissive_triangle_hit() by the MIS of the caller.
+ * 
+ * The returned 'pdf' is in area measure and accounts for the choice of the triangle
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 sample_one_emissive_triangle(const HIPRTRenderData& render_data, const float3& shading_point, Xorshift32Generator& random_number_generator, float& pdf, LightSourceInformation& light_info)
+{
+#if EmissiveTrianglesSamplingStrategy == ETSS_POWER_ALIAS_TABLE
+    return power_sample_one_emissive_triangle(render_data, random_number_generator, pdf, light_info);
+#elif EmissiveTrianglesSamplingStrategy == ETSS_LIGHT_CLUSTERS
+    return light_clusters_sample_one_emissive_triangle(render_data, shading_point, random_number_generator, pdf, light_info);
+#else
+    return uniform_sample_one_emissive_triangle(render_data, random_number_generator, pdf, light_info);
+#endif
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE float3 get_triangle_normal_non_normalized(const HIPRTRenderData& render_data, int triangle_index)
 {
-    float3 vertex_A = render_data.buffers.vertices_positions[render_data.buffers.triangles_indices[triangle_index * 3 + 0]];
-    float3 vertex_B = render_data.buffers.vertices_positions[render_data.buffers.triangles_indices[triangle_index * 3 + 1]];
-    float3 vertex_C = render_data.buffers.vertices_positions[render_data.buffers.triangles_indices[triangle_index * 3 + 2]];
+    float3 vertex_A, vertex_B, vertex_C;
+    get_scene_primitive_vertices(render_data, triangle_index, vertex_A, vertex_B, vertex_C);
 
     float3 AB = vertex_B - vertex_A;
     float3 AC = vertex_C - vertex_A;
@@ -70,6 +315,51 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float triangle_area(const HIPRTRenderData& render
     return hippt::length(normal) * 0.5f;
 }
 
+/**
+ * Intersects 'ray' with the emissive triangle 'triangle_index' (scene primitive index) only.
+ * 
+ * Returns true if the triangle is hit closer than 't_max'. 'out_hit' is then filled like the traversal
+ * of the scene would (instance, primitive, barycentric coordinates and distance) except for its normal:
+ * the normalized world space geometric normal of the triangle is returned in 'out_geometric_normal' instead.
+ * Alpha testing isn't done
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool intersect_emissive_triangle(const HIPRTRenderData& render_data, const hiprtRay& ray, int triangle_index, float t_max, hiprtHit& out_hit, float3& out_geometric_normal)
+{
+    float3 vertex_A, vertex_B, vertex_C;
+    get_scene_primitive_vertices(render_data, triangle_index, vertex_A, vertex_B, vertex_C);
+
+    // Moller-Trumbore
+    float3 edge_1 = vertex_B - vertex_A;
+    float3 edge_2 = vertex_C - vertex_A;
+    float3 h = hippt::cross(ray.direction, edge_2);
+    float a = hippt::dot(edge_1, h);
+    if (hippt::abs(a) < 1.0e-7f)
+        // Ray parallel to the triangle
+        return false;
+
+    float f = 1.0f / a;
+    float3 s = ray.origin - vertex_A;
+    float u = f * hippt::dot(s, h);
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    float3 q = hippt::cross(s, edge_1);
+    float v = f * hippt::dot(ray.direction, q);
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    float t = f * hippt::dot(edge_2, q);
+    if (t <= 1.0e-7f || t >= t_max)
+        return false;
+
+    set_hit_scene_primitive(render_data, triangle_index, out_hit);
+    out_hit.t = t;
+    out_hit.uv = make_float2(u, v);
+    out_geometric_normal = hippt::normalize(hippt::cross(edge_1, edge_2));
+
+    return true;
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F clamp_light_contribution(ColorRGB32F light_contribution, float clamp_max_value, bool clamp_condition)
 {
     if (!light_contribution.has_NaN() && clamp_max_value > 0.0f && clamp_condition)
@@ -87,13 +377,26 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F clamp_light_contribution(ColorRGB32F
  * 'shading_normal' is the shading normal at the intersection point of the emissive triangle hit
  * 'hit_distance' is the distance to the intersection point on the hit triangle
  * 'ray_direction' is the direction of the ray that hit the triangle. The direction points towards the triangle.
+ * 'shading_point' is the point given to sample_one_emissive_triangle() for the light samples
  */
-HIPRT_HOST_DEVICE HIPRT_INLINE float pdf_of_emissive_triangle_hit(const HIPRTRenderData& render_data, const ShadowLightRayHitInfo& light_hit_info, float3 ray_direction)
+HIPRT_HOST_DEVICE HIPRT_INLINE float pdf_of_emissive_triangle_hit(const HIPRTRenderData& render_data, const ShadowLightRayHitInfo& light_hit_info, float3 ray_direction, const float3& shading_point)
 {
     // Surface area PDF of hitting that point on that triangle in the scene
+#if EmissiveTrianglesSamplingStrategy == ETSS_POWER_ALIAS_TABLE
+    if (render_data.buffers.emissive_triangles_total_power <= 0.0f)
+        return 0.0f;
+
+    // Same as in power_sample_one_emissive_triangle(), the area of the triangle cancels out
+    float pdf = get_emissive_triangle_power_luminance(render_data, light_hit_info.hit_prim_index) / render_data.buffers.emissive_triangles_total_power;
+#elif EmissiveTrianglesSamplingStrategy == ETSS_LIGHT_CLUSTERS
+    float pdf = light_clusters_pdf_of_emissive_triangle(render_data, shading_point, light_hit_info.hit_prim_index);
+    if (pdf == 0.0f)
+        return 0.0f;
+#else
     float light_area = triangle_area(render_data, light_hit_info.hit_prim_index);
     float pdf = 1.0f / light_area;
     pdf /= render_data.buffers.emissive_triangles_count;
+#endif
     
     // abs() here to allow backfacing lights
     // Without abs() here:
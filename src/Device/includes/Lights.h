@@ -6,9 +6,11 @@
 #ifndef DEVICE_LIGHTS_H
 #define DEVICE_LIGHTS_H
 
+#include "Device/includes/BSDFSampleReuse.h"
 #include "Device/includes/Dispatcher.h"
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Intersect.h"
+#include "Device/includes/LightBVH.h"
 #include "Device/includes/LightUtils.h"
 #include "Device/includes/ReSTIR/DI/Reservoir.h"
 #include "Device/includes/ReSTIR/DI/FinalShading.h"
@@ -24,7 +26,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_no_MIS(const HIPRTRe
     float light_sample_pdf;
     LightSourceInformation light_source_info;
     ColorRGB32F light_source_radiance;
-    float3 random_light_point = uniform_sample_one_emissive_triangle(render_data, random_number_generator, light_sample_pdf, light_source_info);
+    float3 random_light_point = sample_one_emissive_triangle(render_data, closest_hit_info.inter_point, random_number_generator, light_sample_pdf, light_source_info);
     if (!(light_sample_pdf > 0.0f))
         // Can happen for very small triangles
         return ColorRGB32F(0.0f);
@@ -42,7 +44,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_no_MIS(const HIPRTRe
     float dot_light_source = hippt::abs(hippt::dot(light_source_info.light_source_normal, -shadow_ray.direction));
     if (dot_light_source > 0.0f)
     {
-        bool in_shadow = evaluate_shadow_ray(render_data, shadow_ray, distance_to_light, random_number_generator);
+        float shadow_roulette_weight;
+        bool in_shadow = evaluate_shadow_ray_distance_roulette(render_data, shadow_ray, distance_to_light, shadow_roulette_weight, random_number_generator, ray_payload.geometry_lod_ray_mask);
 
         if (!in_shadow)
         {
@@ -56,7 +59,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_no_MIS(const HIPRTRe
                 light_sample_pdf /= dot_light_source;
 
                 float cosine_term = hippt::max(hippt::dot(closest_hit_info.shading_normal, shadow_ray.direction), 0.0f);
-                light_source_radiance = light_source_info.emission * cosine_term * bsdf_color / light_sample_pdf;
+                light_source_radiance = light_source_info.emission * cosine_term * bsdf_color * shadow_roulette_weight / light_sample_pdf;
             }
         }
     }
@@ -64,6 +67,62 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_no_MIS(const HIPRTRe
     return light_source_radiance;
 }
 
+/**
+ * Same as sample_one_light_no_MIS() but the visibility of the light sample isn't evaluated.
+ *
+ * The shadow ray that needs to be traced to evaluate the visibility is returned in
+ * 'out_shadow_ray' / 'out_distance_to_light' and the returned contribution is the
+ * contribution of the light sample assuming that it is unoccluded.
+ *
+ * This is used by the wavefront path tracer to defer the tracing of the shadow rays
+ * to a separate kernel. 'out_distance_to_light' is set to 0.0f if there is no need to
+ * trace a shadow ray (the contribution of the light sample is 0 anyways)
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_no_MIS_unoccluded(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator, hiprtRay& out_shadow_ray, float& out_distance_to_light)
+{
+    out_distance_to_light = 0.0f;
+
+    float light_sample_pdf;
+    LightSourceInformation light_source_info;
+    float3 random_light_point = sample_one_emissive_triangle(render_data, closest_hit_info.inter_point, random_number_generator, light_sample_pdf, light_source_info);
+    if (!(light_sample_pdf > 0.0f))
+        // Can happen for very small triangles
+        return ColorRGB32F(0.0f);
+
+    float3 shadow_ray_origin = closest_hit_info.inter_point + closest_hit_info.shading_normal * 1.0e-4f;
+    float3 shadow_ray_direction = random_light_point - shadow_ray_origin;
+    float distance_to_light = hippt::length(shadow_ray_direction);
+    float3 shadow_ray_direction_normalized = shadow_ray_direction / distance_to_light;
+
+    // abs() here to allow backfacing light sources
+    float dot_light_source = hippt::abs(hippt::dot(light_source_info.light_source_normal, -shadow_ray_direction_normalized));
+    if (dot_light_source <= 0.0f)
+        return ColorRGB32F(0.0f);
+
+    float brdf_pdf;
+    RayVolumeState trash_volume_state = ray_payload.volume_state;
+    ColorRGB32F bsdf_color = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, ray_payload.material, trash_volume_state, view_direction, closest_hit_info.shading_normal, shadow_ray_direction_normalized, brdf_pdf);
+    if (brdf_pdf == 0.0f)
+        return ColorRGB32F(0.0f);
+
+    // Conversion to solid angle from surface area measure
+    light_sample_pdf *= distance_to_light * distance_to_light;
+    light_sample_pdf /= dot_light_source;
+
+    float cosine_term = hippt::max(hippt::dot(closest_hit_info.shading_normal, shadow_ray_direction_normalized), 0.0f);
+
+    float shadow_roulette_weight = shadow_ray_distance_roulette(render_data, distance_to_light, random_number_generator);
+    if (shadow_roulette_weight == 0.0f)
+        // No shadow ray to trace for that light sample
+        return ColorRGB32F(0.0f);
+
+    out_shadow_ray.origin = shadow_ray_origin;
+    out_shadow_ray.direction = shadow_ray_direction_normalized;
+    out_distance_to_light = distance_to_light;
+
+    return light_source_info.emission * cosine_term * bsdf_color * shadow_roulette_weight / light_sample_pdf;
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_bsdf(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator)
 {
     // Pushing the intersection point outside the surface (if we're already outside)
@@ -98,7 +157,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_bsdf(const HIPRTRend
         }
 
         ShadowLightRayHitInfo shadow_light_ray_hit_info;
-        bool inter_found = evaluate_shadow_light_ray(render_data, new_ray, 1.0e35f, shadow_light_ray_hit_info, random_number_generator);
+        bool inter_found = evaluate_shadow_light_ray(render_data, new_ray, 1.0e35f, shadow_light_ray_hit_info, random_number_generator, ray_payload.geometry_lod_ray_mask);
 
         // Checking that we did hit something and if we hit something,
         // it needs to be emissive
@@ -112,7 +171,57 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_bsdf(const HIPRTRend
     return bsdf_radiance;
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_MIS(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator)
+/**
+ * Traces the BSDF ray 'ray' of the light / BSDF MIS strategies and returns true if it hits an
+ * emissive surface that isn't occluded, in which case 'out_light_hit_info' is filled.
+ *
+ * How the light hit is found depends on MISBSDFRayIntersection. 'chosen_light_info' is the light
+ * of the light sample of the MIS and is only used by MIS_BSDF_RAY_CHOSEN_LIGHT. 'ray_mask' is the
+ * mask of the occluders, see HostDeviceCommon/GeometryLOD.h
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool evaluate_MIS_BSDF_ray(const HIPRTRenderData& render_data, const hiprtRay& ray, const LightSourceInformation& chosen_light_info, ShadowLightRayHitInfo& out_light_hit_info, Xorshift32Generator& random_number_generator, unsigned int ray_mask = GEOMETRY_LOD_PRIMARY_RAY_MASK)
+{
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_SCENE
+    return evaluate_shadow_light_ray(render_data, ray, 1.0e35f, out_light_hit_info, random_number_generator, ray_mask);
+#else
+    hiprtHit light_hit;
+    float3 light_geometric_normal;
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_CHOSEN_LIGHT
+    if (!intersect_emissive_triangle(render_data, ray, chosen_light_info.emissive_triangle_index, 1.0e35f, light_hit, light_geometric_normal))
+#else
+    if (!light_bvh_intersect_closest(render_data, ray, 1.0e35f, light_hit, light_geometric_normal))
+#endif
+        return false;
+
+    // The light is hit, only its visibility is left to evaluate: any-hit
+    // shadow ray instead of a closest hit traversal of the whole scene
+    if (evaluate_shadow_ray(render_data, ray, light_hit.t, random_number_generator, ray_mask))
+        return false;
+
+    read_shadow_light_ray_hit(render_data, light_hit, light_geometric_normal, out_light_hit_info);
+    out_light_hit_info.hit_distance = light_hit.t;
+
+    return true;
+#endif
+}
+
+/**
+ * Solid angle PDF of the light sample of the MIS_BSDF_RAY_CHOSEN_LIGHT MIS for 'light_hit_info',
+ * a hit of the chosen light, given that the light has been chosen
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float chosen_light_pdf_of_hit(const HIPRTRenderData& render_data, const ShadowLightRayHitInfo& light_hit_info, float3 ray_direction)
+{
+    // abs() here to allow backfacing lights, see pdf_of_emissive_triangle_hit()
+    float cosine_light_source = hippt::abs(hippt::dot(light_hit_info.hit_shading_normal, -ray_direction));
+
+    return light_hit_info.hit_distance * light_hit_info.hit_distance / (cosine_light_source * triangle_area(render_data, light_hit_info.hit_prim_index));
+}
+
+/**
+ * If 'out_bsdf_sample_reuse' isn't nullptr (and ReuseMISBSDFSampleForBounce is true with MIS_BSDF_RAY_SCENE),
+ * the BSDF sample is traced with trace_reused_BSDF_sample() and given to the caller for its next bounce
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_MIS(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator, BSDFSampleReuse* out_bsdf_sample_reuse = nullptr)
 {
     // Pushing the intersection point outside the surface (if we're already outside)
     // or inside the surface (if we're inside the surface)
@@ -124,11 +233,16 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_MIS(const HIPRTRende
     float light_sample_pdf;
     ColorRGB32F light_source_radiance_mis;
     LightSourceInformation light_source_info;
-    float3 random_light_point = uniform_sample_one_emissive_triangle(render_data, random_number_generator, light_sample_pdf, light_source_info);
+    float3 random_light_point = sample_one_emissive_triangle(render_data, closest_hit_info.inter_point, random_number_generator, light_sample_pdf, light_source_info);
     if (light_sample_pdf <= 0.0f)
         // Can happen for very small triangles
         return ColorRGB32F(0.0f);
 
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_CHOSEN_LIGHT
+    // The area PDF of the point on the triangle is 1 / area, what's left is the probability of the triangle
+    float light_choice_probability = light_sample_pdf * light_source_info.light_area;
+#endif
+
     float3 shadow_ray_direction = random_light_point - evaluated_point;
     float distance_to_light = hippt::length(shadow_ray_direction);
     float3 shadow_ray_direction_normalized = shadow_ray_direction / distance_to_light;
@@ -141,7 +255,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_MIS(const HIPRTRende
     float dot_light_source = hippt::abs(hippt::dot(light_source_info.light_source_normal, -shadow_ray.direction));
     if (dot_light_source > 0.0f)
     {
-        bool in_shadow = evaluate_shadow_ray(render_data, shadow_ray, distance_to_light, random_number_generator);
+        float shadow_roulette_weight;
+        bool in_shadow = evaluate_shadow_ray_distance_roulette(render_data, shadow_ray, distance_to_light, shadow_roulette_weight, random_number_generator, ray_payload.geometry_lod_ray_mask);
 
         if (!in_shadow)
         {
@@ -154,10 +269,16 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_MIS(const HIPRTRende
                 light_sample_pdf *= distance_to_light * distance_to_light;
                 light_sample_pdf /= dot_light_source;
 
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_CHOSEN_LIGHT
+                // The BSDF ray can only hit the chosen light: the MIS is between the two samples of that
+                // light and the choice of the light is left out of the weights
+                float mis_weight = balance_heuristic(light_sample_pdf / light_choice_probability, bsdf_pdf);
+#else
                 float mis_weight = balance_heuristic(light_sample_pdf, bsdf_pdf);
+#endif
 
                 float cosine_term = hippt::max(hippt::dot(closest_hit_info.shading_normal, shadow_ray.direction), 0.0f);
-                light_source_radiance_mis = bsdf_color * cosine_term * light_source_info.emission * mis_weight / light_sample_pdf;
+                light_source_radiance_mis = bsdf_color * cosine_term * light_source_info.emission * mis_weight * shadow_roulette_weight / light_sample_pdf;
             }
         }
     }
@@ -167,8 +288,13 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_MIS(const HIPRTRende
     float direction_pdf;
     float3 sampled_bsdf_direction;
     float3 bsdf_shadow_ray_origin = evaluated_point;
-    RayVolumeState trash_volume_state = ray_payload.volume_state;
-    ColorRGB32F bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, trash_volume_state, view_direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, sampled_bsdf_direction, direction_pdf, random_number_generator);
+    // Only kept if the BSDF sample is reused for the next bounce
+    RayVolumeState sample_volume_state = ray_payload.volume_state;
+    ColorRGB32F bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, sample_volume_state, view_direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, sampled_bsdf_direction, direction_pdf, random_number_generator);
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE && MISBSDFRayIntersection == MIS_BSDF_RAY_SCENE
+    if (out_bsdf_sample_reuse != nullptr && direction_pdf <= 0.0f)
+        out_bsdf_sample_reuse->reject();
+#endif
     bool refraction_sampled = hippt::dot(sampled_bsdf_direction, closest_hit_info.shading_normal * inside_surface_multiplier) < 0;
     if (refraction_sampled)
     {
@@ -188,14 +314,25 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_MIS(const HIPRTRende
         new_ray.direction = sampled_bsdf_direction;
 
         ShadowLightRayHitInfo shadow_light_ray_hit_info;
-        bool inter_found = evaluate_shadow_light_ray(render_data, new_ray, 1.0e35f, shadow_light_ray_hit_info, random_number_generator);
+        bool inter_found;
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE && MISBSDFRayIntersection == MIS_BSDF_RAY_SCENE
+        if (out_bsdf_sample_reuse != nullptr)
+            inter_found = trace_reused_BSDF_sample(render_data, new_ray, ray_payload, sample_volume_state, bsdf_color, direction_pdf, *out_bsdf_sample_reuse, shadow_light_ray_hit_info, random_number_generator);
+        else
+#endif
+            inter_found = evaluate_MIS_BSDF_ray(render_data, new_ray, light_source_info, shadow_light_ray_hit_info, random_number_generator, ray_payload.geometry_lod_ray_mask);
 
         // Checking that we did hit something and if we hit something,
         // it needs to be emissive
         if (inter_found && !shadow_light_ray_hit_info.hit_emission.is_black())
         {
-            float light_pdf = pdf_of_emissive_triangle_hit(render_data, shadow_light_ray_hit_info, sampled_bsdf_direction);
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_CHOSEN_LIGHT
+            float light_pdf = chosen_light_pdf_of_hit(render_data, shadow_light_ray_hit_info, sampled_bsdf_direction);
+            float mis_weight = balance_heuristic(direction_pdf, light_pdf) / light_choice_probability;
+#else
+            float light_pdf = pdf_of_emissive_triangle_hit(render_data, shadow_light_ray_hit_info, sampled_bsdf_direction, closest_hit_info.inter_point);
             float mis_weight = balance_heuristic(direction_pdf, light_pdf);
+#endif
 
             // Using abs here because we want the dot product to be positive.
             // You may be thinking that if we're doing this, then we're not going to discard BSDF
@@ -219,7 +356,135 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_MIS(const HIPRTRende
     return light_source_radiance_mis + bsdf_radiance_mis;
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator, int2 pixel_coords, int2 resolution, int bounce)
+/**
+ * Same as sample_one_light_MIS() but the light sample is chosen with the light hierarchy
+ * (power, distance and orientation aware) instead of uniformly among the emissive triangles.
+ * 'out_bsdf_sample_reuse' is the same as for sample_one_light_MIS()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light_light_BVH_MIS(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator, BSDFSampleReuse* out_bsdf_sample_reuse = nullptr)
+{
+    bool inside_surface = hippt::dot(view_direction, closest_hit_info.geometric_normal) < 0;
+    float inside_surface_multiplier = inside_surface ? -1.0f : 1.0f;
+    float3 evaluated_point = closest_hit_info.inter_point + closest_hit_info.shading_normal * 1.0e-4f * inside_surface_multiplier;
+
+    float light_sample_pdf;
+    ColorRGB32F light_source_radiance_mis;
+    LightSourceInformation light_source_info;
+    float3 random_light_point = light_bvh_sample_one_emissive_triangle(render_data, evaluated_point, closest_hit_info.shading_normal, random_number_generator, light_sample_pdf, light_source_info);
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_CHOSEN_LIGHT
+    // See sample_one_light_MIS(). 0 if no light was chosen, the BSDF
+    // sample then has no light to hit either
+    float light_choice_probability = light_sample_pdf * light_source_info.light_area;
+#endif
+    if (light_sample_pdf > 0.0f)
+    {
+        // The light hierarchy may not find any light that contributes to this point
+        // or the triangle sampled may be too small, skipping the light sample in these cases
+        // but still doing the BSDF sample
+
+        float3 shadow_ray_direction = random_light_point - evaluated_point;
+        float distance_to_light = hippt::length(shadow_ray_direction);
+        float3 shadow_ray_direction_normalized = shadow_ray_direction / distance_to_light;
+
+        hiprtRay shadow_ray;
+        shadow_ray.origin = evaluated_point;
+        shadow_ray.direction = shadow_ray_direction_normalized;
+
+        // abs() here to allow backfacing light sources
+        float dot_light_source = hippt::abs(hippt::dot(light_source_info.light_source_normal, -shadow_ray.direction));
+        if (dot_light_source > 0.0f)
+        {
+            float shadow_roulette_weight;
+            bool in_shadow = evaluate_shadow_ray_distance_roulette(render_data, shadow_ray, distance_to_light, shadow_roulette_weight, random_number_generator, ray_payload.geometry_lod_ray_mask);
+
+            if (!in_shadow)
+            {
+                float bsdf_pdf;
+                RayVolumeState trash_volume_state = ray_payload.volume_state;
+                ColorRGB32F bsdf_color = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, ray_payload.material, trash_volume_state, view_direction, closest_hit_info.shading_normal, shadow_ray.direction, bsdf_pdf);
+                if (bsdf_pdf != 0.0f)
+                {
+                    // Conversion to solid angle from surface area measure
+                    light_sample_pdf *= distance_to_light * distance_to_light;
+                    light_sample_pdf /= dot_light_source;
+
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_CHOSEN_LIGHT
+                    float mis_weight = balance_heuristic(light_sample_pdf / light_choice_probability, bsdf_pdf);
+#else
+                    float mis_weight = balance_heuristic(light_sample_pdf, bsdf_pdf);
+#endif
+
+                    float cosine_term = hippt::max(hippt::dot(closest_hit_info.shading_normal, shadow_ray.direction), 0.0f);
+                    light_source_radiance_mis = bsdf_color * cosine_term * light_source_info.emission * mis_weight * shadow_roulette_weight / light_sample_pdf;
+                }
+            }
+        }
+    }
+
+    ColorRGB32F bsdf_radiance_mis;
+
+    float direction_pdf;
+    float3 sampled_bsdf_direction;
+    float3 bsdf_shadow_ray_origin = evaluated_point;
+    // Only kept if the BSDF sample is reused for the next bounce
+    RayVolumeState sample_volume_state = ray_payload.volume_state;
+    ColorRGB32F bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, sample_volume_state, view_direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, sampled_bsdf_direction, direction_pdf, random_number_generator);
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE && MISBSDFRayIntersection == MIS_BSDF_RAY_SCENE
+    if (out_bsdf_sample_reuse != nullptr && direction_pdf <= 0.0f)
+        out_bsdf_sample_reuse->reject();
+#endif
+    bool refraction_sampled = hippt::dot(sampled_bsdf_direction, closest_hit_info.shading_normal * inside_surface_multiplier) < 0;
+    if (refraction_sampled)
+        // See sample_one_light_MIS()
+        bsdf_shadow_ray_origin = closest_hit_info.inter_point + closest_hit_info.shading_normal * 1.0e-4f * inside_surface_multiplier * -1.0f;
+
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_CHOSEN_LIGHT
+    if (direction_pdf > 0 && light_sample_pdf > 0.0f)
+#else
+    if (direction_pdf > 0)
+#endif
+    {
+        hiprtRay new_ray;
+        new_ray.origin = bsdf_shadow_ray_origin;
+        new_ray.direction = sampled_bsdf_direction;
+
+        ShadowLightRayHitInfo shadow_light_ray_hit_info;
+        bool inter_found;
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE && MISBSDFRayIntersection == MIS_BSDF_RAY_SCENE
+        if (out_bsdf_sample_reuse != nullptr)
+            inter_found = trace_reused_BSDF_sample(render_data, new_ray, ray_payload, sample_volume_state, bsdf_color, direction_pdf, *out_bsdf_sample_reuse, shadow_light_ray_hit_info, random_number_generator);
+        else
+#endif
+            inter_found = evaluate_MIS_BSDF_ray(render_data, new_ray, light_source_info, shadow_light_ray_hit_info, random_number_generator, ray_payload.geometry_lod_ray_mask);
+
+        // Checking that we did hit something and if we hit something,
+        // it needs to be emissive
+        if (inter_found && !shadow_light_ray_hit_info.hit_emission.is_black())
+        {
+#if MISBSDFRayIntersection == MIS_BSDF_RAY_CHOSEN_LIGHT
+            float light_pdf = chosen_light_pdf_of_hit(render_data, shadow_light_ray_hit_info, sampled_bsdf_direction);
+            float mis_weight = balance_heuristic(direction_pdf, light_pdf) / light_choice_probability;
+#else
+            // Same shading point and normal as for the light sample for the PDFs to match
+            float light_pdf = light_bvh_pdf_of_emissive_triangle_hit(render_data, shadow_light_ray_hit_info, sampled_bsdf_direction, evaluated_point, closest_hit_info.shading_normal);
+            float mis_weight = balance_heuristic(direction_pdf, light_pdf);
+#endif
+
+            // abs() for the refractions, see sample_one_light_MIS()
+            float cosine_term = hippt::abs(hippt::dot(closest_hit_info.shading_normal, sampled_bsdf_direction));
+            bsdf_radiance_mis = bsdf_color * cosine_term * shadow_light_ray_hit_info.hit_emission * mis_weight / direction_pdf;
+        }
+    }
+
+    return light_source_radiance_mis + bsdf_radiance_mis;
+}
+
+/**
+ * 'out_bsdf_sample_reuse', if not nullptr, receives the BSDF sample of the direct lighting
+ * for the next bounce of the path when ReuseMISBSDFSampleForBounce is true. Its 'filled' member
+ * is left to false by the strategies that don't trace any BSDF sample that can be reused
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator, int2 pixel_coords, int2 resolution, int bounce, BSDFSampleReuse* out_bsdf_sample_reuse = nullptr)
 {
     if (render_data.buffers.emissive_triangles_count == 0 
         && !(render_data.world_settings.ambient_light_type == AmbientLightType::ENVMAP && DirectLightSamplingStrategy == LSS_RESTIR_DI))
@@ -228,19 +493,9 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light(const HIPRTRenderDat
         return ColorRGB32F(0.0f);
 
     if (ray_payload.material.is_emissive())
-    {
-        if (ray_payload.material.emissive_texture_used && bounce > 0)
-            // If the material is using an emissive texture, we can return its emission when hitting
-            // it because we're not importance sampling emissive textures so doing it the brute force
-            // way is the only way
-            //
-            // We're already doing that externally for the first bounce so not doing it again here
-            return ray_payload.material.get_emission();
-        else
-            // We're not sampling direct lighting if we're already on an
-            // emissive surface
-            return ColorRGB32F(0.0f);
-    }
+        // We're not sampling direct lighting if we're already on an emissive surface.
+        // The emissive textures are sampled as the other emissive triangles, see EmissiveTextureIntegrator
+        return ColorRGB32F(0.0f);
 
     ColorRGB32F direct_light_contribution;
 #if DirectLightSamplingStrategy == LSS_NO_DIRECT_LIGHT_SAMPLING
@@ -250,13 +505,16 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light(const HIPRTRenderDat
 #elif DirectLightSamplingStrategy == LSS_BSDF
     direct_light_contribution = sample_one_light_bsdf(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator);
 #elif DirectLightSamplingStrategy == LSS_MIS_LIGHT_BSDF
-    direct_light_contribution = sample_one_light_MIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator);
+    direct_light_contribution = sample_one_light_MIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator, out_bsdf_sample_reuse);
 #elif DirectLightSamplingStrategy == LSS_RIS_BSDF_AND_LIGHT
-    direct_light_contribution = sample_lights_RIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator);
+    direct_light_contribution = sample_lights_RIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator, pixel_coords, out_bsdf_sample_reuse);
+#elif DirectLightSamplingStrategy == LSS_LIGHT_BVH
+    direct_light_contribution = sample_one_light_light_BVH_MIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator, out_bsdf_sample_reuse);
 #elif DirectLightSamplingStrategy == LSS_RESTIR_DI
 
-    if (bounce == 0)
-        // Can only do ReSTIR DI on the first bounce
+    if (bounce == 0 && !render_data.aux_buffers.pixel_status[pixel_coords.x + pixel_coords.y * resolution.x].is_ReSTIR_DI_fallback())
+        // Can only do ReSTIR DI on the first bounce.
+        // The pixels that have fallen back use the strategy of the later bounces, see ReSTIRDISettings::fallback_noise_threshold
         direct_light_contribution = sample_light_ReSTIR_DI(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator, pixel_coords, resolution);
     else
     {
@@ -265,9 +523,9 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_one_light(const HIPRTRenderDat
 #elif ReSTIR_DI_LaterBouncesSamplingStrategy == RESTIR_DI_LATER_BOUNCES_BSDF
     direct_light_contribution = sample_one_light_bsdf(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator);
 #elif ReSTIR_DI_LaterBouncesSamplingStrategy == RESTIR_DI_LATER_BOUNCES_MIS_LIGHT_BSDF
-    direct_light_contribution = sample_one_light_MIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator);
+    direct_light_contribution = sample_one_light_MIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator, out_bsdf_sample_reuse);
 #elif ReSTIR_DI_LaterBouncesSamplingStrategy == RESTIR_DI_LATER_BOUNCES_RIS_BSDF_AND_LIGHT
-    direct_light_contribution = sample_lights_RIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator);
+    direct_light_contribution = sample_lights_RIS(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator, pixel_coords, out_bsdf_sample_reuse);
 #endif
     }
 #endif
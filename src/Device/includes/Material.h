@@ -6,19 +6,22 @@
 #ifndef DEVICE_MATERIAL_H
 #define DEVICE_MATERIAL_H
 
+#include "Device/includes/SceneInstances.h"
 #include "Device/includes/Texture.h"
+#include "Device/includes/VertexAttributes.h"
 
 #include "HostDeviceCommon/HitInfo.h"
 #include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/TriangleOpacity.h"
 
 #ifndef __KERNELCC__
 #include "Image/Image.h"
 #endif
 
 template <typename T>
-HIPRT_HOST_DEVICE HIPRT_INLINE void get_material_property(const HIPRTRenderData& render_data, T& output_data, bool is_srgb, const float2& texcoords, int texture_index);
-HIPRT_HOST_DEVICE HIPRT_INLINE void get_metallic_roughness(const HIPRTRenderData& render_data, float& metallic, float& roughness, const float2& texcoords, int metallic_texture_index, int roughness_texture_index, int metallic_roughness_texture_index);
-HIPRT_HOST_DEVICE HIPRT_INLINE void get_base_color(const HIPRTRenderData& render_data, ColorRGB32F& base_color, float& out_alpha, const float2& texcoords, int base_color_texture_index);
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_material_property(const HIPRTRenderData& render_data, T& output_data, bool is_srgb, const float2& texcoords, int texture_index, float texture_footprint = 0.0f);
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_metallic_roughness(const HIPRTRenderData& render_data, float& metallic, float& roughness, const float2& texcoords, int metallic_texture_index, int roughness_texture_index, int metallic_roughness_texture_index, float texture_footprint = 0.0f);
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_base_color(const HIPRTRenderData& render_data, ColorRGB32F& base_color, float& out_alpha, const float2& texcoords, int base_color_texture_index, float texture_footprint = 0.0f);
 
 HIPRT_HOST_DEVICE HIPRT_INLINE float get_hit_base_color_alpha(const HIPRTRenderData& render_data, const RendererMaterial& material, hiprtHit hit)
 {
@@ -26,7 +29,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float get_hit_base_color_alpha(const HIPRTRenderD
         // Quick exit if no texture
         return 1.0f;
 
-    float2 texcoords = uv_interpolate(render_data.buffers.triangles_indices, hit.primID, render_data.buffers.texcoords, hit.uv);
+    const MeshVertexAttributes& mesh_attributes = get_mesh_vertex_attributes(render_data, render_data.buffers.instances[hit.instanceID]);
+    float2 texcoords = interpolate_vertex_texcoords(render_data, mesh_attributes, get_hit_mesh_triangle(render_data, hit), hit.uv);
 
     // Getting the alpha for transparency check to see if we need to pass the ray through or not
     float alpha;
@@ -38,43 +42,53 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float get_hit_base_color_alpha(const HIPRTRenderD
 
 HIPRT_HOST_DEVICE HIPRT_INLINE float get_hit_base_color_alpha(const HIPRTRenderData& render_data, hiprtHit hit)
 {
-    int material_index = render_data.buffers.material_indices[hit.primID];
-    RendererMaterial material = render_data.buffers.materials_buffer[material_index];
+    int mesh_triangle_index = get_hit_mesh_triangle(render_data, hit);
+    int triangle_opacity = get_triangle_opacity(render_data.buffers.triangle_opacities, mesh_triangle_index);
+    if (triangle_opacity == TRIANGLE_OPACITY_MICROMAP)
+        triangle_opacity = get_opacity_micromap_opacity(render_data.buffers.opacity_micromaps, render_data.buffers.triangle_opacity_micromap_indices[mesh_triangle_index], hit.uv);
+
+    if (triangle_opacity == TRIANGLE_OPACITY_OPAQUE)
+        return 1.0f;
+    else if (triangle_opacity == TRIANGLE_OPACITY_TRANSPARENT)
+        return 0.0f;
+
+    int material_index = render_data.buffers.material_indices[mesh_triangle_index];
+    RendererMaterial material = render_data.buffers.materials_buffer[material_index].unpack();
 
     return get_hit_base_color_alpha(render_data, material, hit);
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE SimplifiedRendererMaterial get_intersection_material(const HIPRTRenderData& render_data, int material_index, float2 texcoords)
+HIPRT_HOST_DEVICE HIPRT_INLINE SimplifiedRendererMaterial get_intersection_material(const HIPRTRenderData& render_data, int material_index, float2 texcoords, float texture_footprint = 0.0f)
 {
-	RendererMaterial material = render_data.buffers.materials_buffer[material_index];
+	RendererMaterial material = render_data.buffers.materials_buffer[material_index].unpack();
 
     ColorRGB32F emission = material.get_emission() / material.emission_strength;
-    get_material_property(render_data, emission, false, texcoords, material.emission_texture_index);
+    get_material_property(render_data, emission, false, texcoords, material.emission_texture_index, texture_footprint);
     material.set_emission(emission);
 
     float trash_alpha;
-    get_base_color(render_data, material.base_color, trash_alpha, texcoords, material.base_color_texture_index);
+    get_base_color(render_data, material.base_color, trash_alpha, texcoords, material.base_color_texture_index, texture_footprint);
 
-    get_metallic_roughness(render_data, material.metallic, material.roughness, texcoords, material.metallic_texture_index, material.roughness_texture_index, material.roughness_metallic_texture_index);
-    get_material_property(render_data, material.oren_nayar_sigma, false, texcoords, material.oren_sigma_texture_index);
-    get_material_property(render_data, material.subsurface, false, texcoords, material.subsurface_texture_index);
+    get_metallic_roughness(render_data, material.metallic, material.roughness, texcoords, material.metallic_texture_index, material.roughness_texture_index, material.roughness_metallic_texture_index, texture_footprint);
+    get_material_property(render_data, material.oren_nayar_sigma, false, texcoords, material.oren_sigma_texture_index, texture_footprint);
+    get_material_property(render_data, material.subsurface, false, texcoords, material.subsurface_texture_index, texture_footprint);
     
-    get_material_property(render_data, material.specular, false, texcoords, material.specular_texture_index);
-    get_material_property(render_data, material.specular_tint, false, texcoords, material.specular_tint_texture_index);
-    get_material_property(render_data, material.specular_color, false, texcoords, material.specular_color_texture_index);
+    get_material_property(render_data, material.specular, false, texcoords, material.specular_texture_index, texture_footprint);
+    get_material_property(render_data, material.specular_tint, false, texcoords, material.specular_tint_texture_index, texture_footprint);
+    get_material_property(render_data, material.specular_color, false, texcoords, material.specular_color_texture_index, texture_footprint);
     
-    get_material_property(render_data, material.anisotropic, false, texcoords, material.anisotropic_texture_index);
-    get_material_property(render_data, material.anisotropic_rotation, false, texcoords, material.anisotropic_rotation_texture_index);
+    get_material_property(render_data, material.anisotropic, false, texcoords, material.anisotropic_texture_index, texture_footprint);
+    get_material_property(render_data, material.anisotropic_rotation, false, texcoords, material.anisotropic_rotation_texture_index, texture_footprint);
     
-    get_material_property(render_data, material.clearcoat, false, texcoords, material.clearcoat_texture_index);
-    get_material_property(render_data, material.clearcoat_roughness, false, texcoords, material.clearcoat_roughness_texture_index);
-    get_material_property(render_data, material.clearcoat_ior, false, texcoords, material.clearcoat_ior_texture_index);
+    get_material_property(render_data, material.clearcoat, false, texcoords, material.clearcoat_texture_index, texture_footprint);
+    get_material_property(render_data, material.clearcoat_roughness, false, texcoords, material.clearcoat_roughness_texture_index, texture_footprint);
+    get_material_property(render_data, material.clearcoat_ior, false, texcoords, material.clearcoat_ior_texture_index, texture_footprint);
     
-    get_material_property(render_data, material.sheen, false, texcoords, material.sheen_texture_index);
-    get_material_property(render_data, material.sheen_tint, false, texcoords, material.sheen_tint_color_texture_index);
-    get_material_property(render_data, material.sheen_color, false, texcoords, material.sheen_color_texture_index);
+    get_material_property(render_data, material.sheen, false, texcoords, material.sheen_texture_index, texture_footprint);
+    get_material_property(render_data, material.sheen_tint, false, texcoords, material.sheen_tint_color_texture_index, texture_footprint);
+    get_material_property(render_data, material.sheen_color, false, texcoords, material.sheen_color_texture_index, texture_footprint);
     
-    get_material_property(render_data, material.specular_transmission, false, texcoords, material.specular_transmission_texture_index);
+    get_material_property(render_data, material.specular_transmission, false, texcoords, material.specular_transmission_texture_index, texture_footprint);
 
     // If the oren nayar microfacet normal standard deviation is spatially varying on the
     // surface, we'll need to make sure that the A and B precomputed coefficient are actually
@@ -93,29 +107,39 @@ HIPRT_HOST_DEVICE HIPRT_INLINE SimplifiedRendererMaterial get_intersection_mater
     return simplified_material;
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE void get_metallic_roughness(const HIPRTRenderData& render_data, float& metallic, float& roughness, const float2& texcoords, int metallic_texture_index, int roughness_texture_index, int metallic_roughness_texture_index)
+/**
+ * Re-evaluates the material of the first hit of the given pixel of the GBuffer
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE SimplifiedRendererMaterial get_g_buffer_material(const HIPRTRenderData& render_data, const GBuffer& g_buffer, int pixel_index)
+{
+    return get_intersection_material(render_data, g_buffer.material_indices[g_buffer.get_storage_index(pixel_index)], g_buffer.texcoords[g_buffer.get_storage_index(pixel_index)], g_buffer.texture_footprints[g_buffer.get_storage_index(pixel_index)]);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_metallic_roughness(const HIPRTRenderData& render_data, float& metallic, float& roughness, const float2& texcoords, int metallic_texture_index, int roughness_texture_index, int metallic_roughness_texture_index, float texture_footprint)
 {
     if (metallic_roughness_texture_index != RendererMaterial::NO_TEXTURE)
     {
-        ColorRGB32F rgb = sample_texture_rgb_8bits(render_data.buffers.material_textures, metallic_roughness_texture_index, render_data.buffers.textures_dims[metallic_roughness_texture_index], false, texcoords);
+        ColorRGBA32F rgba = sample_material_texture_rgba(render_data, metallic_roughness_texture_index, false, texcoords, texture_footprint);
 
         // Not converting to linear here because material properties (roughness and metallic) here are assumed to be linear already
-        roughness = rgb.g;
-        metallic = rgb.b;
+        //
+        // The texture only has the G (roughness) and B (metallic) channels of the file, in R and G
+        roughness = rgba.r;
+        metallic = rgba.g;
     }
     else
     {
-        get_material_property(render_data, metallic, false, texcoords, metallic_texture_index);
-        get_material_property(render_data, roughness, false, texcoords, roughness_texture_index);
+        get_material_property(render_data, metallic, false, texcoords, metallic_texture_index, texture_footprint);
+        get_material_property(render_data, roughness, false, texcoords, roughness_texture_index, texture_footprint);
     }
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE void get_base_color(const HIPRTRenderData& render_data, ColorRGB32F& base_color, float& out_alpha, const float2& texcoords, int base_color_texture_index)
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_base_color(const HIPRTRenderData& render_data, ColorRGB32F& base_color, float& out_alpha, const float2& texcoords, int base_color_texture_index, float texture_footprint)
 {
     ColorRGBA32F rgba;
 
     out_alpha = 1.0;
-    get_material_property(render_data, rgba, true, texcoords, base_color_texture_index);
+    get_material_property(render_data, rgba, true, texcoords, base_color_texture_index, texture_footprint);
     if (base_color_texture_index != RendererMaterial::NO_TEXTURE)
     {
         base_color = ColorRGB32F(rgba.r, rgba.g, rgba.b);
@@ -147,12 +171,12 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void read_data(const ColorRGBA32F& rgba, float& d
 }
 
 template <typename T>
-HIPRT_HOST_DEVICE HIPRT_INLINE void get_material_property(const HIPRTRenderData& render_data, T& output_data, bool is_srgb, const float2& texcoords, int texture_index)
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_material_property(const HIPRTRenderData& render_data, T& output_data, bool is_srgb, const float2& texcoords, int texture_index, float texture_footprint)
 {
     if (texture_index == RendererMaterial::NO_TEXTURE || texture_index == RendererMaterial::CONSTANT_EMISSIVE_TEXTURE)
         return;
 
-    ColorRGBA32F rgba = sample_texture_rgba(render_data.buffers.material_textures, texture_index, render_data.buffers.textures_dims[texture_index], is_srgb, texcoords);
+    ColorRGBA32F rgba = sample_material_texture_rgba(render_data, texture_index, is_srgb, texcoords, texture_footprint);
     read_data(rgba, output_data);
 }
 
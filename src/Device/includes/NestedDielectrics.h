@@ -29,9 +29,128 @@ struct StackEntry
 	int material_index = -1;
 };
 
+/**
+ * Entry of the interior stack with priorities, explicitly packed in a single 32 bits word:
+ * 
+ *	- bits [0, PRIORITY_BITS[: priority of the material
+ *	- next TOPMOST_BITS bit: topmost flag
+ *	- next ODD_PARITY_BITS bit: odd_parity flag
+ *	- the remaining MATERIAL_INDEX_BITS bits: material index
+ * 
+ * The layout of bitfields being implementation defined, the packing is done by hand
+ * so that the layout is the same for the CPU and GPU compilers
+ */
+struct StackPriorityEntry
+{
+	// How many bits for encoding the packed priority
+	static constexpr unsigned int PRIORITY_BITS = 4;
+	static constexpr unsigned int PRIORITY_MAXIMUM = (1 << PRIORITY_BITS) - 1;
+	// How many bits for encoding the topmost flag
+	static constexpr unsigned int TOPMOST_BITS = 1;
+	// How many bits for encoding the odd_parity flag
+	static constexpr unsigned int ODD_PARITY_BITS = 1;
+
+	// How many bits for encoding the material_index flag
+	// 
+	// This is the rest of the bits after we've added the other 
+	// flags
+	static constexpr unsigned int MATERIAL_INDEX_BITS = 32 - PRIORITY_BITS - TOPMOST_BITS - ODD_PARITY_BITS;
+	static constexpr unsigned int MATERIAL_INDEX_MAXIMUM = (1 << MATERIAL_INDEX_BITS) - 1;
+
+	static constexpr unsigned int PRIORITY_SHIFT = 0;
+	static constexpr unsigned int TOPMOST_SHIFT = PRIORITY_SHIFT + PRIORITY_BITS;
+	static constexpr unsigned int ODD_PARITY_SHIFT = TOPMOST_SHIFT + TOPMOST_BITS;
+	static constexpr unsigned int MATERIAL_INDEX_SHIFT = ODD_PARITY_SHIFT + ODD_PARITY_BITS;
+
+	HIPRT_HOST_DEVICE StackPriorityEntry()
+	{
+		// Priority 0, odd parity, topmost and the material index set to the maximum
+		packed = (1u << TOPMOST_SHIFT) | (1u << ODD_PARITY_SHIFT) | (MATERIAL_INDEX_MAXIMUM << MATERIAL_INDEX_SHIFT);
+	}
+
+	HIPRT_HOST_DEVICE int get_priority() const { return get_bits(PRIORITY_SHIFT, PRIORITY_BITS); }
+	HIPRT_HOST_DEVICE bool get_topmost() const { return get_bits(TOPMOST_SHIFT, TOPMOST_BITS); }
+	HIPRT_HOST_DEVICE bool get_odd_parity() const { return get_bits(ODD_PARITY_SHIFT, ODD_PARITY_BITS); }
+	HIPRT_HOST_DEVICE int get_material_index() const { return get_bits(MATERIAL_INDEX_SHIFT, MATERIAL_INDEX_BITS); }
+
+	/**
+	 * Priorities above PRIORITY_MAXIMUM are clamped to PRIORITY_MAXIMUM
+	 */
+	HIPRT_HOST_DEVICE void set_priority(unsigned int priority) { set_bits(PRIORITY_SHIFT, PRIORITY_BITS, priority > PRIORITY_MAXIMUM ? PRIORITY_MAXIMUM : priority); }
+	HIPRT_HOST_DEVICE void set_topmost(bool topmost) { set_bits(TOPMOST_SHIFT, TOPMOST_BITS, topmost ? 1 : 0); }
+	HIPRT_HOST_DEVICE void set_odd_parity(bool odd_parity) { set_bits(ODD_PARITY_SHIFT, ODD_PARITY_BITS, odd_parity ? 1 : 0); }
+	HIPRT_HOST_DEVICE void set_material_index(unsigned int material_index) { set_bits(MATERIAL_INDEX_SHIFT, MATERIAL_INDEX_BITS, material_index); }
+
+	unsigned int packed;
+
+private:
+	HIPRT_HOST_DEVICE unsigned int get_bits(unsigned int shift, unsigned int bit_count) const
+	{
+		return (packed >> shift) & ((1u << bit_count) - 1);
+	}
+
+	HIPRT_HOST_DEVICE void set_bits(unsigned int shift, unsigned int bit_count, unsigned int value)
+	{
+		unsigned int mask = ((1u << bit_count) - 1) << shift;
+
+		packed = (packed & ~mask) | ((value << shift) & mask);
+	}
+};
+
+#if defined(__KERNELCC__) && NestedDielectricsStackUseSharedMemory == KERNEL_OPTION_TRUE
+// Entries of the interior stacks of all the threads of a block. Entry 'i' of the thread 't' of the
+// block is at index [i * SharedStackBVHTraversalBlockSize + t] so that the threads of a warp access
+// consecutive words. Raw words because __shared__ variables cannot have constructors
+__shared__ static unsigned int nested_dielectrics_shared_stack[NestedDielectricsStackSize * SharedStackBVHTraversalBlockSize * (sizeof(StackEntry) > sizeof(StackPriorityEntry) ? sizeof(StackEntry) : sizeof(StackPriorityEntry)) / sizeof(unsigned int)];
+#endif
+
+/**
+ * Storage of the entries of an interior stack.
+ * 
+ * The entries are in the structure itself (registers / local memory) unless NestedDielectricsStackUseSharedMemory
+ * is KERNEL_OPTION_TRUE in which case they are in shared memory, one slot per thread of the block. All the interior
+ * stacks of a thread then share the same entries: the copies of an interior stack (the 'trash' copies of the
+ * RayVolumeState given to the BSDF evaluations) only read the entries of the path and their pop() leaves the entries
+ * untouched. Only the stacks constructed by default (the one of the RayPayload, of the ReSTIR surfaces, ...) modify them,
+ * which is fine since the kernels only use the stack of one path at a time.
+ * 
+ * The G-buffer and the ray queues always store the entries in the structure, see StoredRayVolumeState
+ */
+template <typename EntryType>
+struct InteriorStackEntries
+{
+#if defined(__KERNELCC__) && NestedDielectricsStackUseSharedMemory == KERNEL_OPTION_TRUE
+	HIPRT_HOST_DEVICE EntryType& operator[](int index)
+	{
+		return reinterpret_cast<EntryType*>(nested_dielectrics_shared_stack)[index * SharedStackBVHTraversalBlockSize + threadIdx.x + threadIdx.y * blockDim.x];
+	}
+
+	HIPRT_HOST_DEVICE const EntryType& operator[](int index) const
+	{
+		return reinterpret_cast<const EntryType*>(nested_dielectrics_shared_stack)[index * SharedStackBVHTraversalBlockSize + threadIdx.x + threadIdx.y * blockDim.x];
+	}
+#else
+	HIPRT_HOST_DEVICE EntryType& operator[](int index) { return entries[index]; }
+	HIPRT_HOST_DEVICE const EntryType& operator[](int index) const { return entries[index]; }
+
+	EntryType entries[NestedDielectricsStackSize];
+#endif
+};
+
 template <>
 struct InteriorStackImpl<ISS_AUTOMATIC>
 {
+	using EntryType = StackEntry;
+
+#if defined(__KERNELCC__) && NestedDielectricsStackUseSharedMemory == KERNEL_OPTION_TRUE
+	// The entries are shared by all the interior stacks of the thread, see InteriorStackEntries
+	HIPRT_HOST_DEVICE InteriorStackImpl() { stack[0] = StackEntry(); }
+	HIPRT_HOST_DEVICE InteriorStackImpl(const InteriorStackImpl& other) : is_copy(true), stack_position(other.stack_position) {}
+	HIPRT_HOST_DEVICE InteriorStackImpl& operator=(const InteriorStackImpl& other) { stack_position = other.stack_position; return *this; }
+
+	bool is_copy = false;
+#endif
+
 	// TODO leaving material never used ? Or used only where we already know its value so not needed
 	// Unused parameter at the end here to have the same signature as InteriorStackPriority
 	HIPRT_HOST_DEVICE bool push(int& incident_material_index, int& outgoing_material_index, bool& leaving_material, int material_index, int)
@@ -100,6 +219,16 @@ struct InteriorStackImpl<ISS_AUTOMATIC>
 
 	HIPRT_HOST_DEVICE void pop(bool leaving_material)
 	{
+#if defined(__KERNELCC__) && NestedDielectricsStackUseSharedMemory == KERNEL_OPTION_TRUE
+		if (is_copy)
+		{
+			// A copy must not modify the entries of the path
+			stack_position -= leaving_material ? 2 : 1;
+
+			return;
+		}
+#endif
+
 		int stack_top_mat_index = stack[stack_position].material_index;
 		stack_position--;
 
@@ -127,47 +256,47 @@ struct InteriorStackImpl<ISS_AUTOMATIC>
 		}
 	}
 
-	StackEntry stack[NestedDielectricsStackSize];
-
-	int stack_position = 0;
-};
-
-struct StackPriorityEntry
-{
-	// How many bits for encoding the packed priority
-	static constexpr unsigned int PRIORITY_BITS = 4;
-	static constexpr unsigned int PRIORITY_MAXIMUM = (1 << PRIORITY_BITS) - 1;
-	// How many bits for encoding the topmost flag
-	static constexpr unsigned int TOPMOST_BITS = 1;
-	// How many bits for encoding the odd_parity flag
-	static constexpr unsigned int ODD_PARTIY_BITS = 1;
-
-	// How many bits for encoding the material_index flag
-	// 
-	// This is the rest of the bits after we've added the other 
-	// flags
-	static constexpr unsigned int MATERIAL_INDEX_BITS = 32 - PRIORITY_BITS - TOPMOST_BITS - ODD_PARTIY_BITS;
-	static constexpr unsigned int MATERIAL_INDEX_MAXIMUM = (1 << MATERIAL_INDEX_BITS) - 1;
+	/**
+	 * Copies the entries of this stack that are in use to 'out_entries'. Entry 0 (the air) is
+	 * never modified by push() / pop() so it isn't copied: nothing is copied for the
+	 * paths that are not inside of any volume
+	 */
+	HIPRT_HOST_DEVICE void store_used_entries(EntryType* out_entries, int& out_stack_position) const
+	{
+		out_stack_position = stack_position;
+		for (int i = 1; i <= stack_position; i++)
+			out_entries[i] = stack[i];
+	}
 
-	HIPRT_HOST_DEVICE StackPriorityEntry()
+	/**
+	 * Reads entries written by store_used_entries()
+	 */
+	HIPRT_HOST_DEVICE void load_used_entries(const EntryType* entries, int entries_stack_position)
 	{
-		priority = 0;
-		odd_parity = true;
-		topmost = true;
-		// Setting the material index to the maximum
-		material_index = MATERIAL_INDEX_MAXIMUM;
+		stack_position = entries_stack_position;
+		for (int i = 1; i <= stack_position; i++)
+			stack[i] = entries[i];
 	}
 
-	// Using bitfields to pack the data in a single 32 bits variable and still keep a nice syntax
-	unsigned int priority : ODD_PARTIY_BITS;
-	bool odd_parity : PRIORITY_BITS;
-	bool topmost : TOPMOST_BITS;
-	unsigned int material_index : MATERIAL_INDEX_BITS;
+	InteriorStackEntries<StackEntry> stack;
+
+	int stack_position = 0;
 };
 
 template <>
 struct InteriorStackImpl<ISS_WITH_PRIORITIES>
 {
+	using EntryType = StackPriorityEntry;
+
+#if defined(__KERNELCC__) && NestedDielectricsStackUseSharedMemory == KERNEL_OPTION_TRUE
+	// The entries are shared by all the interior stacks of the thread, see InteriorStackEntries
+	HIPRT_HOST_DEVICE InteriorStackImpl() { stack[0] = StackPriorityEntry(); }
+	HIPRT_HOST_DEVICE InteriorStackImpl(const InteriorStackImpl& other) : is_copy(true), stack_position(other.stack_position) {}
+	HIPRT_HOST_DEVICE InteriorStackImpl& operator=(const InteriorStackImpl& other) { stack_position = other.stack_position; return *this; }
+
+	bool is_copy = false;
+#endif
+
 	HIPRT_HOST_DEVICE bool push(int& incident_material_index, int& outgoing_material_index, bool& leaving_material, int material_index, int material_priority)
 	{
 		// Index of the material we last entered before intersecting the
@@ -180,7 +309,7 @@ struct InteriorStackImpl<ISS_WITH_PRIORITIES>
 			//	- The entry of that material in the stack is odd_parity = we've entered that material but haven't left it yet
 			//
 			//	= the last entered material
-			if (stack[last_entered_mat_index].material_index != material_index && stack[last_entered_mat_index].topmost && stack[last_entered_mat_index].odd_parity)
+			if (stack[last_entered_mat_index].get_material_index() != material_index && stack[last_entered_mat_index].get_topmost() && stack[last_entered_mat_index].get_odd_parity())
 				break;
 
 		// Parity of the material we're inserting in the stack
@@ -191,12 +320,12 @@ struct InteriorStackImpl<ISS_WITH_PRIORITIES>
 
 		for (previous_same_mat_index = stack_position; previous_same_mat_index >= 0; previous_same_mat_index--)
 		{
-			if (stack[previous_same_mat_index].material_index == material_index)
+			if (stack[previous_same_mat_index].get_material_index() == material_index)
 			{
 				// The previous stack entry of the same material is not the topmost anymore
-				stack[previous_same_mat_index].topmost = false;
+				stack[previous_same_mat_index].set_topmost(false);
 				// The current parity is the inverse of the previous one
-				odd_parity = !stack[previous_same_mat_index].odd_parity;
+				odd_parity = !stack[previous_same_mat_index].get_odd_parity();
 
 				break;
 			}
@@ -207,12 +336,12 @@ struct InteriorStackImpl<ISS_WITH_PRIORITIES>
 		// Inserting the material in the stack
 		if (stack_position < NestedDielectricsStackSize - 1)
 			stack_position++;
-		stack[stack_position].material_index = material_index;
-		stack[stack_position].odd_parity = odd_parity;
-		stack[stack_position].topmost = true;
-		stack[stack_position].priority = material_priority;
+		stack[stack_position].set_material_index(material_index);
+		stack[stack_position].set_odd_parity(odd_parity);
+		stack[stack_position].set_topmost(true);
+		stack[stack_position].set_priority(material_priority);
 
-		if (material_priority < stack[last_entered_mat_index].priority)
+		if (stack[stack_position].get_priority() < stack[last_entered_mat_index].get_priority())
 		{
 			// Skipping the boundary because the intersected material has a
 			// lower priority than the material we're currently in
@@ -223,14 +352,14 @@ struct InteriorStackImpl<ISS_WITH_PRIORITIES>
 			if (odd_parity)
 			{
 				// We are entering the material
-				incident_material_index = stack[last_entered_mat_index].material_index;
+				incident_material_index = stack[last_entered_mat_index].get_material_index();
 				outgoing_material_index = material_index;
 			}
 			else
 			{
 				// Exiting material
 				incident_material_index = material_index;
-				outgoing_material_index = stack[last_entered_mat_index].material_index;
+				outgoing_material_index = stack[last_entered_mat_index].get_material_index();
 			}
 
 			// Not skipping the boundary
@@ -240,7 +369,19 @@ struct InteriorStackImpl<ISS_WITH_PRIORITIES>
 
 	HIPRT_HOST_DEVICE void pop(bool leaving_material)
 	{
-		int stack_top_mat_index = stack[stack_position].material_index;
+#if defined(__KERNELCC__) && NestedDielectricsStackUseSharedMemory == KERNEL_OPTION_TRUE
+		if (is_copy)
+		{
+			// A copy must not modify the entries of the path
+			stack_position -= leaving_material ? 2 : 1;
+			if (stack_position < 0)
+				stack_position = 0;
+
+			return;
+		}
+#endif
+
+		int stack_top_mat_index = stack[stack_position].get_material_index();
 		if (stack_position > 0)
 			// Checking that we have room to pop.
 			// For a very small stack (size of 2) that overflown 
@@ -253,7 +394,7 @@ struct InteriorStackImpl<ISS_WITH_PRIORITIES>
 		{
 			int previous_same_mat_index;
 			for (previous_same_mat_index = stack_position; previous_same_mat_index >= 0; previous_same_mat_index--)
-				if (stack[previous_same_mat_index].material_index == stack_top_mat_index)
+				if (stack[previous_same_mat_index].get_material_index() == stack_top_mat_index)
 					break;
 
 			if (previous_same_mat_index >= 0)
@@ -268,18 +409,40 @@ struct InteriorStackImpl<ISS_WITH_PRIORITIES>
 
 		for (int i = stack_position; i >= 0; i--)
 		{
-			if (stack[i].material_index == stack_top_mat_index)
+			if (stack[i].get_material_index() == stack_top_mat_index)
 			{
-				stack[i].topmost = true;
+				stack[i].set_topmost(true);
 				break;
 			}
 		}
 	}
 
+	/**
+	 * Copies the entries of this stack that are in use to 'out_entries'. Entry 0 (the air) is
+	 * never modified by push() / pop() so it isn't copied: nothing is copied for the
+	 * paths that are not inside of any volume
+	 */
+	HIPRT_HOST_DEVICE void store_used_entries(EntryType* out_entries, int& out_stack_position) const
+	{
+		out_stack_position = stack_position;
+		for (int i = 1; i <= stack_position; i++)
+			out_entries[i] = stack[i];
+	}
+
+	/**
+	 * Reads entries written by store_used_entries()
+	 */
+	HIPRT_HOST_DEVICE void load_used_entries(const EntryType* entries, int entries_stack_position)
+	{
+		stack_position = entries_stack_position;
+		for (int i = 1; i <= stack_position; i++)
+			stack[i] = entries[i];
+	}
+
 	// We only need all of this if the stack size is actually > 0,
 	// otherwise, we're just not going to do the nested dielectrics handling at all
 
-	StackPriorityEntry stack[NestedDielectricsStackSize];
+	InteriorStackEntries<StackPriorityEntry> stack;
 	static constexpr unsigned int MAX_MATERIAL_INDEX = StackPriorityEntry::MATERIAL_INDEX_MAXIMUM;
 
 	// Stack position is pointing at the last valid entry.
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_PATH_GUIDING_H
+#define DEVICE_PATH_GUIDING_H
+
+#include "Device/includes/Dispatcher.h"
+#include "Device/includes/RayPayload.h"
+
+#include "HostDeviceCommon/HitInfo.h"
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Path guiding used when IndirectLightSamplingStrategy is ILS_PATH_GUIDING.
+ *
+ * The bounding box of the scene is split in a uniform grid and each cell holds a histogram of the
+ * incident radiance over the sphere of directions. The directions are binned with the cylindrical
+ * equal-area mapping (cos(theta), phi) so that all the bins subtend the same solid angle and the
+ * pdf of a direction sampled uniformly in a bin is simply the probability of the bin over the solid
+ * angle of the bin.
+ *
+ * The histograms are trained with the contributions of the paths of the first samples
+ * (PathGuidingTrainingPath) and the bounces sample them with one-sample MIS against the BSDF.
+ *
+ * References:
+ * [1] [Practical Path Guiding for Efficient Light-Transport Simulation, Muller et al., 2017]
+ * [2] [Optimally Combining Sampling Techniques for Monte Carlo Rendering, Veach, Guibas, 1995]
+ */
+
+#define PATH_GUIDING_INVALID_BIN_ADDRESS 0xFFFFFFFFu
+
+HIPRT_HOST_DEVICE HIPRT_INLINE bool path_guiding_available(const PathGuidingSettings& path_guiding_settings)
+{
+    // The buffers are only allocated by the GPURenderer
+    return path_guiding_settings.sampling_cdfs != nullptr;
+}
+
+/**
+ * Index of the cell of the grid that contains 'point'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int path_guiding_get_cell_index(const PathGuidingSettings& path_guiding_settings, const float3& point)
+{
+    int resolution = path_guiding_settings.grid_resolution;
+    float3 extent = path_guiding_settings.grid_max - path_guiding_settings.grid_min;
+    float3 relative = point - path_guiding_settings.grid_min;
+
+    int cell_x = static_cast<int>(hippt::clamp(0.0f, resolution - 1.0f, relative.x / extent.x * resolution));
+    int cell_y = static_cast<int>(hippt::clamp(0.0f, resolution - 1.0f, relative.y / extent.y * resolution));
+    int cell_z = static_cast<int>(hippt::clamp(0.0f, resolution - 1.0f, relative.z / extent.z * resolution));
+
+    return cell_x + (cell_y + cell_z * resolution) * resolution;
+}
+
+/**
+ * Bin of the directional histograms that contains the unit vector 'direction'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int path_guiding_get_bin_index(const float3& direction)
+{
+    float u = (hippt::clamp(-1.0f, 1.0f, direction.z) + 1.0f) * 0.5f;
+    float v = (atan2f(direction.y, direction.x) + M_PI) / M_TWO_PI;
+
+    int bin_x = static_cast<int>(hippt::clamp(0.0f, PATH_GUIDING_DIRECTIONAL_RESOLUTION - 1.0f, u * PATH_GUIDING_DIRECTIONAL_RESOLUTION));
+    int bin_y = static_cast<int>(hippt::clamp(0.0f, PATH_GUIDING_DIRECTIONAL_RESOLUTION - 1.0f, v * PATH_GUIDING_DIRECTIONAL_RESOLUTION));
+
+    return bin_x + bin_y * PATH_GUIDING_DIRECTIONAL_RESOLUTION;
+}
+
+/**
+ * Direction of the point (u, v) of [0, 1]^2 of the cylindrical mapping of the histograms
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 path_guiding_uv_to_direction(float u, float v)
+{
+    float cos_theta = u * 2.0f - 1.0f;
+    float sin_theta = sqrt(hippt::max(0.0f, 1.0f - cos_theta * cos_theta));
+    float phi = v * M_TWO_PI - M_PI;
+
+    return make_float3(cos(phi) * sin_theta, sin(phi) * sin_theta, cos_theta);
+}
+
+/**
+ * Whether or not the cell has received some contribution during the training and can be sampled
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool path_guiding_cell_trained(const PathGuidingSettings& path_guiding_settings, unsigned int cell_index)
+{
+    // The CDF is normalized, its last value is 1 if the cell has been trained, 0 otherwise
+    return path_guiding_settings.sampling_cdfs[cell_index * PATH_GUIDING_BIN_COUNT + PATH_GUIDING_BIN_COUNT - 1] > 0.0f;
+}
+
+/**
+ * Solid angle pdf of sampling 'direction' with the distribution of the cell
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float path_guiding_pdf(const PathGuidingSettings& path_guiding_settings, unsigned int cell_index, const float3& direction)
+{
+    const float* cdf = &path_guiding_settings.sampling_cdfs[cell_index * PATH_GUIDING_BIN_COUNT];
+
+    unsigned int bin_index = path_guiding_get_bin_index(direction);
+    float bin_probability = cdf[bin_index] - (bin_index > 0 ? cdf[bin_index - 1] : 0.0f);
+
+    // All the bins subtend 4PI / PATH_GUIDING_BIN_COUNT steradians
+    return bin_probability * PATH_GUIDING_BIN_COUNT / (4.0f * M_PI);
+}
+
+/**
+ * Samples a direction with the distribution of the (trained) cell and returns its solid angle pdf
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float path_guiding_sample(const PathGuidingSettings& path_guiding_settings, unsigned int cell_index, float3& sampled_direction, Xorshift32Generator& random_number_generator)
+{
+    const float* cdf = &path_guiding_settings.sampling_cdfs[cell_index * PATH_GUIDING_BIN_COUNT];
+
+    float random_bin = random_number_generator();
+    unsigned int bin_index = 0;
+    // Few enough bins that a linear search is as fast as a binary search
+    while (bin_index < PATH_GUIDING_BIN_COUNT - 1 && random_bin >= cdf[bin_index])
+        bin_index++;
+
+    // Uniform sample in the bin
+    float u = (bin_index % PATH_GUIDING_DIRECTIONAL_RESOLUTION + random_number_generator()) / PATH_GUIDING_DIRECTIONAL_RESOLUTION;
+    float v = (bin_index / PATH_GUIDING_DIRECTIONAL_RESOLUTION + random_number_generator()) / PATH_GUIDING_DIRECTIONAL_RESOLUTION;
+    sampled_direction = path_guiding_uv_to_direction(u, v);
+
+    float bin_probability = cdf[bin_index] - (bin_index > 0 ? cdf[bin_index - 1] : 0.0f);
+
+    return bin_probability * PATH_GUIDING_BIN_COUNT / (4.0f * M_PI);
+}
+
+/**
+ * Samples the bounce direction at the given hit with one-sample MIS between the BSDF and the guiding
+ * distribution of the cell of the hit [2]. 'pdf' is the combined pdf of both strategies.
+ *
+ * 'bin_address' is set to the bin of the grid that the sampled direction falls into,
+ * where the training splats the contribution of the bounce (PATH_GUIDING_INVALID_BIN_ADDRESS if
+ * the guiding isn't available)
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F path_guiding_sample_bounce(const HIPRTRenderData& render_data, RayPayload& ray_payload, const HitInfo& closest_hit_info, const float3& view_direction, float3& sampled_direction, float& pdf, unsigned int& bin_address, Xorshift32Generator& random_number_generator)
+{
+    const PathGuidingSettings& path_guiding_settings = render_data.render_settings.path_guiding_settings;
+    if (!path_guiding_available(path_guiding_settings))
+    {
+        bin_address = PATH_GUIDING_INVALID_BIN_ADDRESS;
+
+        return bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, ray_payload.volume_state, view_direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, sampled_direction, pdf, random_number_generator);
+    }
+
+    unsigned int cell_index = path_guiding_get_cell_index(path_guiding_settings, closest_hit_info.inter_point);
+    // Not guiding the refractions: the BSDF sampling updates the volume state of the ray, the evaluation doesn't
+    bool guide = ray_payload.material.roughness >= path_guiding_settings.minimum_roughness
+        && ray_payload.material.specular_transmission == 0.0f
+        && path_guiding_cell_trained(path_guiding_settings, cell_index);
+
+    ColorRGB32F bsdf_color;
+    if (!guide)
+        bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, ray_payload.volume_state, view_direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, sampled_direction, pdf, random_number_generator);
+    else
+    {
+        float guiding_probability = path_guiding_settings.guiding_probability;
+
+        float bsdf_pdf;
+        float guiding_pdf;
+        if (random_number_generator() < guiding_probability)
+        {
+            guiding_pdf = path_guiding_sample(path_guiding_settings, cell_index, sampled_direction, random_number_generator);
+
+            RayVolumeState trash_volume_state = ray_payload.volume_state;
+            bsdf_color = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, ray_payload.material, trash_volume_state, view_direction, closest_hit_info.shading_normal, sampled_direction, bsdf_pdf);
+            if (bsdf_pdf == 0.0f)
+                // The BSDF doesn't scatter in that direction (below the surface for example),
+                // the path is terminated by the caller
+                guiding_pdf = 0.0f;
+        }
+        else
+        {
+            bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, ray_payload.volume_state, view_direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, sampled_direction, bsdf_pdf, random_number_generator);
+            guiding_pdf = bsdf_pdf > 0.0f ? path_guiding_pdf(path_guiding_settings, cell_index, sampled_direction) : 0.0f;
+        }
+
+        if (bsdf_pdf == 0.0f)
+            pdf = 0.0f;
+        else
+            pdf = guiding_probability * guiding_pdf + (1.0f - guiding_probability) * bsdf_pdf;
+    }
+
+    bin_address = cell_index * PATH_GUIDING_BIN_COUNT + path_guiding_get_bin_index(sampled_direction);
+
+    return bsdf_color;
+}
+
+/**
+ * Vertices of a path that splat their incident radiance into the directional
+ * histograms of the grid once the path is complete
+ */
+struct PathGuidingTrainingPath
+{
+    /**
+     * Records the bounce of the path that was just sampled. 'ray_color' is the color gathered by the path
+     * up to this vertex (the direct lighting of the vertex included) and 'throughput' is the throughput of
+     * the path after the bounce.
+     *
+     * Only the first PATH_GUIDING_MAX_TRAINING_VERTICES bounces are recorded
+     */
+    HIPRT_HOST_DEVICE void add_vertex(const HIPRTRenderData& render_data, unsigned int bin_address, float pdf, const ColorRGB32F& throughput, const ColorRGB32F& ray_color)
+    {
+        if (!render_data.render_settings.path_guiding_settings.do_training || bin_address == PATH_GUIDING_INVALID_BIN_ADDRESS || vertex_count == PATH_GUIDING_MAX_TRAINING_VERTICES)
+            return;
+
+        float throughput_luminance = throughput.luminance();
+        if (throughput_luminance <= 0.0f || pdf <= 0.0f)
+            return;
+
+        bin_addresses[vertex_count] = bin_address;
+        // The radiance incident to the vertex from the sampled direction is the color that the
+        // path gathers after this vertex divided by the throughput after the bounce. That radiance
+        // is divided by the pdf of the direction for the estimate of the integral of the bin [1]
+        inverse_weights[vertex_count] = 1.0f / (pdf * throughput_luminance);
+        color_luminances[vertex_count] = ray_color.luminance();
+        vertex_count++;
+    }
+
+    /**
+     * Adds the contributions of the recorded vertices to the grid. 'final_color' is the color of the complete path
+     */
+    HIPRT_HOST_DEVICE void splat(const HIPRTRenderData& render_data, const ColorRGB32F& final_color)
+    {
+        float final_luminance = final_color.luminance();
+        for (int i = 0; i < vertex_count; i++)
+        {
+            float incident_luminance = final_luminance - color_luminances[i];
+            if (incident_luminance <= 0.0f)
+                continue;
+
+            hippt::atomic_add(&render_data.render_settings.path_guiding_settings.training_bins[bin_addresses[i]], incident_luminance * inverse_weights[i]);
+        }
+    }
+
+    unsigned int bin_addresses[PATH_GUIDING_MAX_TRAINING_VERTICES];
+    float inverse_weights[PATH_GUIDING_MAX_TRAINING_VERTICES];
+    float color_luminances[PATH_GUIDING_MAX_TRAINING_VERTICES];
+
+    int vertex_count = 0;
+};
+
+#endif
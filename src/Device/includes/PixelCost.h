@@ -0,0 +1,111 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_PIXEL_COST_H
+#define DEVICE_PIXEL_COST_H
+
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/RenderData.h"
+
+#ifndef __KERNELCC__
+#include <chrono>
+#endif
+
+/**
+ * Per pixel cost instrumentation of the kernels, only compiled in with PixelCostInstrumentation.
+ *
+ * The cycles spent by a pixel in each category are accumulated in one component of
+ * 'aux_buffers.pixel_costs' over the samples of the render, see PixelCostCategory
+ */
+
+enum PixelCostCategory
+{
+    // Generation and tracing of the camera ray, G-buffer writes
+    PIXEL_COST_CAMERA_RAYS = 0,
+    // All the per pixel ReSTIR DI and ReSTIR GI passes
+    PIXEL_COST_RESTIR = 1,
+    // Tracing of the bounce rays of the FullPathTracer
+    PIXEL_COST_PATH_TRAVERSAL = 2,
+    // Everything else in the FullPathTracer: materials, BSDFs, lights sampling. The
+    // shadow rays of the direct lighting are counted here too
+    PIXEL_COST_PATH_SHADING = 3,
+};
+
+/**
+ * Clock cycles counter of the GPU. Nanoseconds on the CPU
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE long long int pixel_cost_clock()
+{
+#if PixelCostInstrumentation == KERNEL_OPTION_TRUE
+#ifdef __KERNELCC__
+    return clock64();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+#else
+    return 0;
+#endif
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void pixel_cost_reset(const HIPRTRenderData& render_data, uint32_t pixel_index)
+{
+#if PixelCostInstrumentation == KERNEL_OPTION_TRUE
+    if (render_data.aux_buffers.pixel_costs != nullptr)
+        render_data.aux_buffers.pixel_costs[pixel_index] = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+#endif
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void pixel_cost_add(const HIPRTRenderData& render_data, uint32_t pixel_index, PixelCostCategory category, long long int cycles)
+{
+#if PixelCostInstrumentation == KERNEL_OPTION_TRUE
+    if (render_data.aux_buffers.pixel_costs == nullptr)
+        return;
+
+    // Each kernel only writes the component of its category so the kernels
+    // running concurrently on different streams don't race with each other
+    float* pixel_costs = reinterpret_cast<float*>(&render_data.aux_buffers.pixel_costs[pixel_index]);
+    pixel_costs[category] += static_cast<float>(cycles);
+#endif
+}
+
+/**
+ * Adds the cycles between its construction and its destruction to the
+ * category of the pixel, whatever the return path of the kernel.
+ *
+ * If 'parent' isn't null, these cycles are also excluded from the cost of 'parent'
+ * (the traversal of the bounce rays is excluded from the shading of the path tracer for example)
+ */
+struct PixelCostScope
+{
+    HIPRT_HOST_DEVICE PixelCostScope(const HIPRTRenderData& render_data, uint32_t pixel_index, PixelCostCategory category, PixelCostScope* parent = nullptr)
+#if PixelCostInstrumentation == KERNEL_OPTION_TRUE
+        : m_render_data(render_data), m_pixel_index(pixel_index), m_category(category), m_parent(parent), m_start(pixel_cost_clock())
+#endif
+    {
+    }
+
+    HIPRT_HOST_DEVICE ~PixelCostScope()
+    {
+#if PixelCostInstrumentation == KERNEL_OPTION_TRUE
+        long long int elapsed = pixel_cost_clock() - m_start;
+        if (m_parent != nullptr)
+            m_parent->m_excluded += elapsed;
+
+        pixel_cost_add(m_render_data, m_pixel_index, m_category, elapsed - m_excluded);
+#endif
+    }
+
+#if PixelCostInstrumentation == KERNEL_OPTION_TRUE
+    const HIPRTRenderData& m_render_data;
+    uint32_t m_pixel_index;
+    PixelCostCategory m_category;
+    PixelCostScope* m_parent;
+
+    long long int m_start;
+    long long int m_excluded = 0;
+#endif
+};
+
+#endif
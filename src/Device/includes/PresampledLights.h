@@ -0,0 +1,109 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_PRESAMPLED_LIGHTS_H
+#define DEVICE_PRESAMPLED_LIGHTS_H
+
+#include "Device/includes/LightUtils.h"
+#include "Device/includes/ReSTIR/DI/PresampledLight.h"
+
+#include "HostDeviceCommon/HitInfo.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Reference: https://en.wikipedia.org/wiki/Pairing_function
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int cantor_pairing_function(int x, int y)
+{
+    return (x + y + 1) * (x + y) / 2 + y;
+}
+
+/**
+ * Random generator shared by all the pixels of the light_presampling.tile_size * light_presampling.tile_size
+ * tile of 'pixel_coords'. Its first random index is the subset of presampled lights of the tile
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE Xorshift32Generator get_presampled_lights_tile_rng(const HIPRTRenderData& render_data, int2 pixel_coords)
+{
+    const LightPresamplingSettings& light_presampling_settings = render_data.render_settings.restir_di_settings.light_presampling;
+
+    // We compute a unique number per each light_presampling_settings.tile_size * light_presampling_settings.tile_size
+    // tile of pixels and use that unique number as seed for our random number generator
+    int tile_index_seed = cantor_pairing_function(pixel_coords.x / light_presampling_settings.tile_size, pixel_coords.y / light_presampling_settings.tile_size);
+
+    return Xorshift32Generator(render_data.random_seed * (tile_index_seed + 1));
+}
+
+/**
+ * Index in light_presampling.light_samples of a random presampled light of the subset
+ * of the tile of 'pixel_coords'.
+ *
+ * All the pixels of a light_presampling.tile_size * light_presampling.tile_size tile read the
+ * same subset of lights: the reads of a warp hit the same few cache lines instead of being
+ * scattered all over the emissive triangles, the vertices and the materials of the scene
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_presampled_light_index(const HIPRTRenderData& render_data, int2 pixel_coords, Xorshift32Generator& random_number_generator)
+{
+    const LightPresamplingSettings& light_presampling_settings = render_data.render_settings.restir_di_settings.light_presampling;
+
+    Xorshift32Generator subset_rng = get_presampled_lights_tile_rng(render_data, pixel_coords);
+    int random_subset_index = subset_rng.random_index(light_presampling_settings.number_of_subsets);
+    int random_light_index_in_subset = random_number_generator.random_index(light_presampling_settings.subset_size);
+
+    return random_subset_index * light_presampling_settings.subset_size + random_light_index_in_subset;
+}
+
+/**
+ * Whether or not the RIS light candidates are drawn from the presampled lights with
+ * sample_one_presampled_emissive_triangle() instead of sample_one_emissive_triangle().
+ * 
+ * Never with ETSS_LIGHT_CLUSTERS: the presampled lights are drawn from the global
+ * set of lights, not from the light cluster of the shading point
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool RIS_uses_presampled_lights(const HIPRTRenderData& render_data)
+{
+#if EmissiveTrianglesSamplingStrategy == ETSS_LIGHT_CLUSTERS
+    return false;
+#else
+    const LightPresamplingSettings& light_presampling_settings = render_data.render_settings.restir_di_settings.light_presampling;
+
+    return light_presampling_settings.use_for_RIS_light_candidates && light_presampling_settings.light_samples != nullptr;
+#endif
+}
+
+/**
+ * Same as sample_one_emissive_triangle() but the triangle and the point on it are taken from
+ * the presampled lights of the tile of 'pixel_coords'.
+ *
+ * The presampled lights are distributed as sample_one_emissive_triangle() so the returned PDF is the
+ * same, times light_presampling.emissive_triangle_probability. The presampled envmap samples (if the
+ * presampling pass also presamples the envmap for ReSTIR DI) are returned with a PDF of 0.0f, the
+ * caller skips them as it skips the degenerate triangles.
+ *
+ * 'light_info.light_area' isn't available
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 sample_one_presampled_emissive_triangle(const HIPRTRenderData& render_data, int2 pixel_coords, Xorshift32Generator& random_number_generator, float& pdf, LightSourceInformation& light_info)
+{
+    int light_sample_index = get_presampled_light_index(render_data, pixel_coords, random_number_generator);
+    ReSTIRDIPresampledLight presampled_light = render_data.render_settings.restir_di_settings.light_presampling.light_samples[light_sample_index];
+    if (presampled_light.flags & ReSTIRDISampleFlags::RESTIR_DI_FLAGS_ENVMAP_SAMPLE)
+    {
+        pdf = 0.0f;
+
+        return make_float3(0.0f, 0.0f, 0.0f);
+    }
+
+    light_info.emissive_triangle_index = presampled_light.emissive_triangle_index;
+    light_info.light_source_normal = presampled_light.light_source_normal;
+    if (presampled_light.flags & ReSTIRDISampleFlags::RESTIR_DI_FLAGS_EMISSION_TEXTURE)
+        light_info.emission = get_emissive_triangle_emission(render_data, presampled_light.emissive_triangle_index, presampled_light.point_on_light_source);
+    else
+        light_info.emission = presampled_light.radiance;
+    pdf = presampled_light.pdf;
+
+    return presampled_light.point_on_light_source;
+}
+
+#endif
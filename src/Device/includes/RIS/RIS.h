@@ -6,10 +6,14 @@
 #ifndef DEVICE_RIS_H
 #define DEVICE_RIS_H
 
+#include "Device/includes/BSDFSampleReuse.h"
 #include "Device/includes/Dispatcher.h"
 #include "Device/includes/Intersect.h"
 #include "Device/includes/LightUtils.h"
+#include "Device/includes/PresampledLights.h"
+#include "Device/includes/RayStatistics.h"
 #include "Device/includes/RIS/RIS_Reservoir.h"
+#include "Device/includes/VisibilityCache.h"
 
 #include "HostDeviceCommon/Color.h"
 #include "HostDeviceCommon/HitInfo.h"
@@ -42,7 +46,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F evaluate_reservoir_sample(const HIPRT
         shadow_ray.origin = evaluated_point;
         shadow_ray.direction = shadow_ray_direction_normalized;
 
-        in_shadow = evaluate_shadow_ray(render_data, shadow_ray, distance_to_light, random_number_generator);
+        in_shadow = visibility_cache_evaluate_shadow_ray(render_data, shading_point, shading_normal, shadow_ray, distance_to_light, random_number_generator);
     }
 
     if (!in_shadow)
@@ -69,8 +73,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F evaluate_reservoir_sample(const HIPRT
 
         if (cosine_at_evaluated_point > 0.0f)
         {
-            int material_index = render_data.buffers.material_indices[sample.emissive_triangle_index];
-            ColorRGB32F sample_emission = render_data.buffers.materials_buffer[material_index].get_emission();
+            ColorRGB32F sample_emission = get_emissive_triangle_emission(render_data, sample.emissive_triangle_index, sample.point_on_light_source);
 
             final_color = bsdf_color * reservoir.UCW * sample_emission * cosine_at_evaluated_point;
         }
@@ -79,7 +82,41 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F evaluate_reservoir_sample(const HIPRT
     return final_color;
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator)
+/**
+ * Number of light candidates for RIS at a hit on 'material' when
+ * ris_settings.adapt_light_candidates_to_roughness is true.
+ * 
+ * The light candidates are wasted on the near-specular lobes: almost none of them
+ * land in the lobe and the BSDF candidates are going to be picked anyways. Only the
+ * specular lobes that are rough enough and the diffuse part of the material
+ * (what isn't metallic or transmissive) get the full number of light candidates.
+ * 
+ * The count is the maximum over the active lanes of the warp: the lanes of a warp loop
+ * over the candidates together so a lane with less candidates wouldn't save anything,
+ * it would only get a noisier estimate
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int compute_RIS_light_candidate_count(const RISSettings& ris_settings, const SimplifiedRendererMaterial& material)
+{
+    int maximum_candidates = ris_settings.number_of_light_candidates;
+    int minimum_candidates = hippt::min(ris_settings.minimum_light_candidates, maximum_candidates);
+
+    float specular_roughness = ris_settings.adaptive_candidates_specular_roughness;
+    float specular_lobe_factor = hippt::clamp(0.0f, 1.0f, (material.roughness - specular_roughness) / hippt::max(1.0e-4f, specular_roughness));
+    float diffuse_lobe_factor = (1.0f - material.metallic) * (1.0f - material.specular_transmission);
+    float light_sampling_factor = hippt::max(specular_lobe_factor, diffuse_lobe_factor);
+
+    int light_candidates = minimum_candidates + static_cast<int>(roundf(light_sampling_factor * (maximum_candidates - minimum_candidates)));
+
+    // 6 bits, the ImGui slider goes up to 32 light candidates
+    return hippt::warp_max(hippt::min(light_candidates, 63), 6);
+}
+
+/**
+ * If 'out_bsdf_sample_reuse' isn't nullptr (and ReuseMISBSDFSampleForBounce is true), the first BSDF candidate
+ * is traced with trace_reused_BSDF_sample() and given to the caller for its next bounce. That candidate is
+ * a plain BSDF sample whether or not RIS picks it so the next bounce stays unbiased
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator, int2 pixel_coords, BSDFSampleReuse* out_bsdf_sample_reuse = nullptr)
 {
     // Pushing the intersection point outside the surface (if we're already outside)
     // or inside the surface (if we're inside the surface)
@@ -92,11 +129,24 @@ HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir
     // for better interactive framerates
     int nb_light_candidates = render_data.render_settings.do_render_low_resolution() ? 1 : render_data.render_settings.ris_settings.number_of_light_candidates;
     int nb_bsdf_candidates = render_data.render_settings.do_render_low_resolution() ? 1 : render_data.render_settings.ris_settings.number_of_bsdf_candidates;
+    if (!render_data.render_settings.do_render_low_resolution() && render_data.render_settings.ris_settings.adapt_light_candidates_to_roughness)
+    {
+        nb_light_candidates = compute_RIS_light_candidate_count(render_data.render_settings.ris_settings, ray_payload.material);
+        if (nb_bsdf_candidates == 0)
+            // Still sampling the lights if they are the only candidates
+            nb_light_candidates = hippt::max(1, nb_light_candidates);
+    }
+
+    // The light candidates come from the presampled subset of the tile of the pixel if
+    // light_presampling.use_for_RIS_light_candidates, see sample_one_presampled_emissive_triangle()
+    bool use_presampled_lights = RIS_uses_presampled_lights(render_data);
 
     // Sampling candidates with weighted reservoir sampling
     RISReservoir reservoir;
     for (int i = 0; i < nb_light_candidates; i++)
     {
+        count_ray_statistic(render_data, RAY_STATISTIC_RIS_LIGHT_CANDIDATES);
+
         float light_sample_pdf;
         float distance_to_light;
         float cosine_at_light_source;
@@ -106,7 +156,11 @@ HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir
         ColorRGB32F bsdf_color;
         float target_function = 0.0f;
         float candidate_weight = 0.0f;
-        float3 random_light_point = uniform_sample_one_emissive_triangle(render_data, random_number_generator, light_sample_pdf, light_source_info);
+        float3 random_light_point;
+        if (use_presampled_lights)
+            random_light_point = sample_one_presampled_emissive_triangle(render_data, pixel_coords, random_number_generator, light_sample_pdf, light_source_info);
+        else
+            random_light_point = sample_one_emissive_triangle(render_data, closest_hit_info.inter_point, random_number_generator, light_sample_pdf, light_source_info);
         if (light_sample_pdf > 0.0f)
         {
             // It can happen that the light PDF returned by the emissive triangle
@@ -155,7 +209,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir
                         // create, we may as well evaluate the light for all threads and not loose that much performance anyways
                         target_function = 0.0f;
                     else
-                        target_function = light_contribution.luminance();
+                        // Favoring the lights that are visible from the nearby shading points
+                        target_function = light_contribution.luminance() * visibility_cache_sampling_weight(render_data, closest_hit_info.inter_point, closest_hit_info.shading_normal, to_light_direction);
                 }
 
 #if RISUseVisiblityTargetFunction == KERNEL_OPTION_TRUE
@@ -168,7 +223,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir
                     shadow_ray.origin = evaluated_point;
                     shadow_ray.direction = to_light_direction;
 
-                    bool visible = !evaluate_shadow_ray(render_data, shadow_ray, distance_to_light, random_number_generator);
+                    bool visible = !visibility_cache_evaluate_shadow_ray(render_data, closest_hit_info.inter_point, closest_hit_info.shading_normal, shadow_ray, distance_to_light, random_number_generator);
 
                     target_function *= visible;
                 }
@@ -200,6 +255,12 @@ HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir
         ColorRGB32F bsdf_color;
 
         bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, trash_ray_volume_state, view_direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, sampled_direction, bsdf_sample_pdf, random_number_generator);
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE
+        // The volume state isn't trashed for the reused candidate
+        bool reuse_candidate = i == 0 && out_bsdf_sample_reuse != nullptr;
+        if (reuse_candidate && bsdf_sample_pdf <= 0.0f)
+            out_bsdf_sample_reuse->reject();
+#endif
 
         bool refraction_sampled = hippt::dot(sampled_direction, closest_hit_info.shading_normal * inside_surface_multiplier) < 0;
         if (refraction_sampled)
@@ -222,7 +283,13 @@ HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir
             bsdf_ray.direction = sampled_direction;
 
             ShadowLightRayHitInfo shadow_light_ray_hit_info;
-            bool hit_found = evaluate_shadow_light_ray(render_data, bsdf_ray, 1.0e35f, shadow_light_ray_hit_info, random_number_generator);
+            bool hit_found;
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE
+            if (reuse_candidate)
+                hit_found = trace_reused_BSDF_sample(render_data, bsdf_ray, ray_payload, trash_ray_volume_state, bsdf_color, bsdf_sample_pdf, *out_bsdf_sample_reuse, shadow_light_ray_hit_info, random_number_generator);
+            else
+#endif
+                hit_found = evaluate_shadow_light_ray(render_data, bsdf_ray, 1.0e35f, shadow_light_ray_hit_info, random_number_generator, ray_payload.geometry_lod_ray_mask);
             if (hit_found && !shadow_light_ray_hit_info.hit_emission.is_black())
             {
                 // If we intersected an emissive material, compute the weight. 
@@ -243,9 +310,13 @@ HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir
                 // in solid angle. The geometry term in the target function ( / in the integrand) is only
                 // for surface area direct lighting integration
                 ColorRGB32F light_contribution = bsdf_color * shadow_light_ray_hit_info.hit_emission * cosine_at_evaluated_point;
-                target_function = light_contribution.luminance();
+                // Same target function as the light candidates
+                target_function = light_contribution.luminance() * visibility_cache_sampling_weight(render_data, closest_hit_info.inter_point, closest_hit_info.shading_normal, sampled_direction);
 
-                float light_pdf = pdf_of_emissive_triangle_hit(render_data, shadow_light_ray_hit_info, sampled_direction);
+                float light_pdf = pdf_of_emissive_triangle_hit(render_data, shadow_light_ray_hit_info, sampled_direction, closest_hit_info.inter_point);
+                if (use_presampled_lights)
+                    // The presampled envmap samples are wasted light candidates
+                    light_pdf *= render_data.render_settings.restir_di_settings.light_presampling.emissive_triangle_probability;
                 // If we refracting, drop the light PDF to 0
                 // 
                 // Why?
@@ -287,9 +358,9 @@ HIPRT_HOST_DEVICE HIPRT_INLINE RISReservoir sample_bsdf_and_lights_RIS_reservoir
     return reservoir;
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_lights_RIS(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_lights_RIS(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator, int2 pixel_coords, BSDFSampleReuse* out_bsdf_sample_reuse = nullptr)
 {
-    RISReservoir reservoir = sample_bsdf_and_lights_RIS_reservoir(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator);
+    RISReservoir reservoir = sample_bsdf_and_lights_RIS_reservoir(render_data, ray_payload, closest_hit_info, view_direction, random_number_generator, pixel_coords, out_bsdf_sample_reuse);
 
     return evaluate_reservoir_sample(render_data, ray_payload, 
         closest_hit_info.inter_point, closest_hit_info.shading_normal, view_direction, 
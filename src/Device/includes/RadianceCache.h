@@ -0,0 +1,211 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RADIANCE_CACHE_H
+#define DEVICE_RADIANCE_CACHE_H
+
+#include "Device/includes/Hash.h"
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * World space radiance cache of the megakernel path tracer, see RadianceCacheSettings.
+ *
+ * The cache is a hash table whose entries are cells of a uniform grid over the scene, further split by
+ * the dominant axis of the normal of the surfaces so that the two sides of a wall don't share their radiance.
+ * An entry holds the average radiance reflected by the surfaces of its cell (the emission excluded, it is
+ * accounted for by the light sampling of the previous vertex).
+ *
+ * Most paths terminate into the cache at RadianceCacheSettings::termination_bounce. The other paths (the training
+ * paths) are traced completely and add the radiance that their vertices reflect to the cache, these radiances
+ * include the cached radiance at the end of the training paths that cross the cells of valid entries so that the cache
+ * propagates multiple bounces over the frames. The RadianceCacheResolve kernel then averages the samples of the frame
+ * in the entries.
+ *
+ * Reference:
+ * [1] [SHARC: Spatially Hashed Radiance Cache, NVIDIA RTX Global Illumination SDK, 2023]
+ */
+
+#define RADIANCE_CACHE_INVALID_ENTRY 0xFFFFFFFFu
+
+struct RadianceCacheKey
+{
+    // Start of the probing in the hash table
+    unsigned int hash;
+    // Identifies the cell among the cells that collide in the hash table, never 0
+    unsigned int checksum;
+};
+
+HIPRT_HOST_DEVICE HIPRT_INLINE bool radiance_cache_available(const RadianceCacheSettings& radiance_cache_settings)
+{
+    // The buffers are only allocated by the GPURenderer
+    return radiance_cache_settings.use_radiance_cache && radiance_cache_settings.keys != nullptr;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE RadianceCacheKey radiance_cache_get_key(const RadianceCacheSettings& radiance_cache_settings, const float3& point, const float3& normal)
+{
+    float inverse_cell_size = 1.0f / radiance_cache_settings.cell_size;
+    int cell_x = static_cast<int>(floorf(point.x * inverse_cell_size));
+    int cell_y = static_cast<int>(floorf(point.y * inverse_cell_size));
+    int cell_z = static_cast<int>(floorf(point.z * inverse_cell_size));
+
+    // Dominant axis of the normal and its sign, one of 6 values
+    float3 abs_normal = hippt::abs(normal);
+    unsigned int normal_axis;
+    if (abs_normal.x >= abs_normal.y && abs_normal.x >= abs_normal.z)
+        normal_axis = normal.x >= 0.0f ? 0 : 1;
+    else if (abs_normal.y >= abs_normal.z)
+        normal_axis = normal.y >= 0.0f ? 2 : 3;
+    else
+        normal_axis = normal.z >= 0.0f ? 4 : 5;
+
+    unsigned int hash = wang_hash(static_cast<unsigned int>(cell_x));
+    hash = wang_hash(hash ^ static_cast<unsigned int>(cell_y));
+    hash = wang_hash(hash ^ static_cast<unsigned int>(cell_z));
+    hash = wang_hash(hash ^ normal_axis);
+
+    RadianceCacheKey key;
+    key.hash = hash;
+    // Different hash of the same cell for the checksum so that the cells that
+    // collide in the table don't collide on their checksum too
+    key.checksum = wang_hash(hash ^ 0x9E3779B9u) | 1u;
+
+    return key;
+}
+
+/**
+ * Index in the hash table of the entry of 'key', RADIANCE_CACHE_INVALID_ENTRY if the cell isn't in the cache
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int radiance_cache_find_entry(const RadianceCacheSettings& radiance_cache_settings, const RadianceCacheKey& key)
+{
+    // The evictions leave holes in the probing sequences so not stopping at the first empty entry
+    for (unsigned int probe = 0; probe < RADIANCE_CACHE_PROBE_COUNT; probe++)
+    {
+        unsigned int entry_index = (key.hash + probe) & (radiance_cache_settings.entry_count - 1);
+        if (radiance_cache_settings.keys[entry_index] == key.checksum)
+            return entry_index;
+    }
+
+    return RADIANCE_CACHE_INVALID_ENTRY;
+}
+
+/**
+ * Same as radiance_cache_find_entry() but inserts the cell in the cache if it isn't in it yet.
+ * RADIANCE_CACHE_INVALID_ENTRY if the probed entries are all taken by other cells
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int radiance_cache_insert_entry(const RadianceCacheSettings& radiance_cache_settings, const RadianceCacheKey& key)
+{
+    for (unsigned int probe = 0; probe < RADIANCE_CACHE_PROBE_COUNT; probe++)
+    {
+        unsigned int entry_index = (key.hash + probe) & (radiance_cache_settings.entry_count - 1);
+        unsigned int previous_key = hippt::atomic_compare_exchange(&radiance_cache_settings.keys[entry_index], 0u, key.checksum);
+        if (previous_key == 0u || previous_key == key.checksum)
+            return entry_index;
+    }
+
+    return RADIANCE_CACHE_INVALID_ENTRY;
+}
+
+/**
+ * Whether or not the path of the pixel is a training path this sample, see RadianceCacheSettings::training_path_probability
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool radiance_cache_is_training_path(const HIPRTRenderData& render_data, Xorshift32Generator& random_number_generator)
+{
+    const RadianceCacheSettings& radiance_cache_settings = render_data.render_settings.radiance_cache_settings;
+    if (!radiance_cache_available(radiance_cache_settings))
+        return false;
+
+    // Not consuming a low discrepancy dimension of the path
+    return random_number_generator.xorshift32() / static_cast<float>(XORSHIFT_MAX) < radiance_cache_settings.training_path_probability;
+}
+
+/**
+ * Looks up the cached radiance reflected at the hit towards the path. Returns false
+ * if the cell of the hit isn't in the cache or hasn't accumulated enough samples yet
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool radiance_cache_lookup(const HIPRTRenderData& render_data, const float3& point, const float3& normal, ColorRGB32F& out_radiance)
+{
+    const RadianceCacheSettings& radiance_cache_settings = render_data.render_settings.radiance_cache_settings;
+    if (!radiance_cache_available(radiance_cache_settings))
+        return false;
+
+    unsigned int entry_index = radiance_cache_find_entry(radiance_cache_settings, radiance_cache_get_key(radiance_cache_settings, point, normal));
+    if (entry_index == RADIANCE_CACHE_INVALID_ENTRY)
+        return false;
+
+    const RadianceCacheEntry& entry = radiance_cache_settings.entries[entry_index];
+    if (entry.sample_count < radiance_cache_settings.min_sample_count)
+        return false;
+
+    out_radiance = entry.radiance;
+
+    return true;
+}
+
+/**
+ * Vertices of a training path that update the radiance cache once the path is complete
+ */
+struct RadianceCacheTrainingPath
+{
+    /**
+     * Records the vertex that the path just hit. 'throughput' is the throughput of the path arriving at the
+     * vertex and 'ray_color' the color gathered by the path before the lighting of the vertex.
+     *
+     * Only the first RADIANCE_CACHE_MAX_TRAINING_VERTICES vertices are recorded
+     */
+    HIPRT_HOST_DEVICE void add_vertex(const HIPRTRenderData& render_data, const float3& point, const float3& normal, const ColorRGB32F& throughput, const ColorRGB32F& ray_color)
+    {
+        if (vertex_count == RADIANCE_CACHE_MAX_TRAINING_VERTICES)
+            return;
+
+        keys[vertex_count] = radiance_cache_get_key(render_data.render_settings.radiance_cache_settings, point, normal);
+        throughputs[vertex_count] = throughput;
+        colors[vertex_count] = ray_color;
+        vertex_count++;
+    }
+
+    /**
+     * Adds the radiance reflected by the recorded vertices to the accumulation of the frame of their entries.
+     * 'final_color' is the color of the complete path
+     */
+    HIPRT_HOST_DEVICE void splat(const HIPRTRenderData& render_data, const ColorRGB32F& final_color)
+    {
+        const RadianceCacheSettings& radiance_cache_settings = render_data.render_settings.radiance_cache_settings;
+
+        if (final_color.has_NaN())
+            return;
+
+        for (int i = 0; i < vertex_count; i++)
+        {
+            const ColorRGB32F& throughput = throughputs[i];
+            if (throughput.r <= 0.0f || throughput.g <= 0.0f || throughput.b <= 0.0f)
+                // Can't recover the radiance of the vertex from the color of the path
+                continue;
+
+            unsigned int entry_index = radiance_cache_insert_entry(radiance_cache_settings, keys[i]);
+            if (entry_index == RADIANCE_CACHE_INVALID_ENTRY)
+                continue;
+
+            // Radiance that the path gathered from this vertex on, divided by the throughput up to the vertex
+            ColorRGB32F gathered = final_color - colors[i];
+            AtomicType<float>* accumulation = &radiance_cache_settings.frame_accumulation[entry_index * 4];
+            hippt::atomic_add(&accumulation[0], hippt::max(0.0f, gathered.r / throughput.r));
+            hippt::atomic_add(&accumulation[1], hippt::max(0.0f, gathered.g / throughput.g));
+            hippt::atomic_add(&accumulation[2], hippt::max(0.0f, gathered.b / throughput.b));
+            hippt::atomic_add(&accumulation[3], 1.0f);
+        }
+    }
+
+    RadianceCacheKey keys[RADIANCE_CACHE_MAX_TRAINING_VERTICES];
+    ColorRGB32F throughputs[RADIANCE_CACHE_MAX_TRAINING_VERTICES];
+    ColorRGB32F colors[RADIANCE_CACHE_MAX_TRAINING_VERTICES];
+
+    int vertex_count = 0;
+};
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RAY_CONE_H
+#define DEVICE_RAY_CONE_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * Cone around a ray used to choose the mip level of the textures
+ * 
+ * Reference:
+ * [1] [Texture Level of Detail Strategies for Real-Time Ray Tracing, Akenine-Moller et al., Ray Tracing Gems 1, 2019]
+ */
+struct RayCone
+{
+    /**
+     * Grows the cone by the distance traveled by the ray
+     */
+    HIPRT_HOST_DEVICE void propagate(float distance)
+    {
+        width += spread_angle * distance;
+    }
+
+    /**
+     * Widens (or narrows if negative) the cone by the spread angle of the surface
+     * it just hit, see get_surface_spread_angle(). The cone never converges
+     * (negative spread angle) past a cylinder: that would select mip levels sharper
+     * than the full resolution, which doesn't exist anyway
+     */
+    HIPRT_HOST_DEVICE void curve(float surface_spread_angle)
+    {
+        spread_angle = hippt::max(0.0f, spread_angle + surface_spread_angle);
+    }
+
+    /**
+     * Widens the cone after a bounce on a surface of the given roughness
+     * 
+     * This approximates the angular width of the lobe of the BSDF (about 2 * alpha radians 
+     * for a GGX lobe). The curvature of the surface is accounted for separately by curve().
+     * Rough bounces then quickly read coarse mip levels
+     */
+    HIPRT_HOST_DEVICE void scatter(float roughness)
+    {
+        spread_angle += 2.0f * roughness * roughness;
+    }
+
+    // Width of the cone at the last vertex of the path
+    float width = 0.0f;
+    // Angle in radians of the cone
+    float spread_angle = 0.0f;
+};
+
+#endif
@@ -6,9 +6,11 @@
 #ifndef DEVICE_RAY_PAYLOAD_H
 #define DEVICE_RAY_PAYLOAD_H
 
+#include "Device/includes/RayCone.h"
 #include "Device/includes/RayVolumeState.h"
 
 #include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/GeometryLOD.h"
 #include "HostDeviceCommon/KernelOptions.h"
 #include "HostDeviceCommon/Material.h"
 
@@ -32,6 +34,13 @@ struct RayPayload
 
 	RayVolumeState volume_state;
 
+	// Footprint of the path, for choosing the mip level of the textures
+	RayCone ray_cone;
+
+	// Mask of the instances that the rays of the current bounce of the path (and their shadow rays)
+	// are traced against, see get_geometry_lod_ray_mask()
+	unsigned int geometry_lod_ray_mask = GEOMETRY_LOD_PRIMARY_RAY_MASK;
+
 	HIPRT_HOST_DEVICE bool is_inside_volume() const
 	{
 		return volume_state.interior_stack.stack_position > 0;
@@ -0,0 +1,27 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RAY_STATISTICS_H
+#define DEVICE_RAY_STATISTICS_H
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RayStatistics.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Counts one more event 'statistic' in aux_buffers.ray_statistics.
+ *
+ * Contrary to count_bounce_active_ray(), all the samples of the frame are counted
+ * so that the counts can be divided by the time of the frame to get rays per second
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void count_ray_statistic(const HIPRTRenderData& render_data, RayStatistic statistic)
+{
+    if (render_data.aux_buffers.ray_statistics == nullptr)
+        return;
+
+    hippt::aggregated_atomic_add(&render_data.aux_buffers.ray_statistics[statistic], 1u);
+}
+
+#endif
@@ -8,6 +8,58 @@
 
 #include "Device/includes/NestedDielectrics.h"
 
+/**
+ * RayVolumeState as stored in the G-buffer and in the ray queues of the wavefront path tracer.
+ * 
+ * The entries of the interior stack are always in the structure here, even if they are in shared memory in
+ * the kernels (NestedDielectricsStackUseSharedMemory) so that the stack can be handed from one kernel to the next.
+ * Written and read with RayVolumeState::store() / load(). Entry 0 of the stack isn't written
+ *
+ * Templated by the interior stack strategy and size so that the host can compute the size of
+ * the structure for the options the kernels are compiled with, see get_stored_ray_volume_state_byte_size()
+ */
+template <int Strategy, int StackSize>
+struct StoredRayVolumeStateImpl
+{
+	float distance_in_volume = 0.0f;
+	typename InteriorStackImpl<Strategy>::EntryType interior_stack_entries[StackSize];
+	int interior_stack_position = 0;
+	int incident_mat_index = -1, outgoing_mat_index = -1;
+	bool leaving_mat = false;
+};
+
+using StoredRayVolumeState = StoredRayVolumeStateImpl<InteriorStackStrategy, NestedDielectricsStackSize>;
+
+#ifndef __KERNELCC__
+template <int Strategy>
+size_t get_stored_ray_volume_state_byte_size(int stack_size)
+{
+	using EntryType = typename InteriorStackImpl<Strategy>::EntryType;
+
+	// All the members are 4-byte aligned so every additional entry of the stack
+	// adds exactly one entry to the size of the structure
+	static_assert(sizeof(StoredRayVolumeStateImpl<Strategy, 8>) == sizeof(StoredRayVolumeStateImpl<Strategy, 1>) + 7 * sizeof(EntryType),
+		"The size of StoredRayVolumeStateImpl isn't linear in the size of the stack anymore");
+
+	return sizeof(StoredRayVolumeStateImpl<Strategy, 1>) + (stack_size - 1) * sizeof(EntryType);
+}
+
+/**
+ * Returns sizeof(StoredRayVolumeState) as seen by kernels compiled with "-D InteriorStackStrategy=interior_stack_strategy"
+ * and "-D NestedDielectricsStackSize=stack_size".
+ *
+ * The layout of the structure being the same for the CPU and GPU compilers, the host doesn't need to query the
+ * size from a kernel when these options change at runtime
+ */
+inline size_t get_stored_ray_volume_state_byte_size(int interior_stack_strategy, int stack_size)
+{
+	if (interior_stack_strategy == ISS_AUTOMATIC)
+		return get_stored_ray_volume_state_byte_size<ISS_AUTOMATIC>(stack_size);
+	else
+		return get_stored_ray_volume_state_byte_size<ISS_WITH_PRIORITIES>(stack_size);
+}
+#endif
+
 struct RayVolumeState
 {
 	// How far has the ray traveled in the current volume.
@@ -18,6 +70,35 @@ struct RayVolumeState
 	int incident_mat_index = -1, outgoing_mat_index = -1;
 	// Whether or not we're exiting a material
 	bool leaving_mat = false;
+
+	/**
+	 * Copies this volume state to 'destination' (a slot of the G-buffer or of the wavefront queues).
+	 * 
+	 * Only the interior stack entries that are in use are copied (see InteriorStackImpl::store_used_entries()) so most
+	 * paths, that never enter a dielectric, only carry the few scalars of the state and none of the stack.
+	 * 'destination' must then only be read with load()
+	 */
+	HIPRT_HOST_DEVICE void store(StoredRayVolumeState& destination) const
+	{
+		destination.distance_in_volume = distance_in_volume;
+		interior_stack.store_used_entries(destination.interior_stack_entries, destination.interior_stack_position);
+		destination.incident_mat_index = incident_mat_index;
+		destination.outgoing_mat_index = outgoing_mat_index;
+		destination.leaving_mat = leaving_mat;
+	}
+
+	/**
+	 * Reads a volume state written by store() into this one. The air
+	 * entry at the bottom of the interior stack is the one of this volume state
+	 */
+	HIPRT_HOST_DEVICE void load(const StoredRayVolumeState& source)
+	{
+		distance_in_volume = source.distance_in_volume;
+		interior_stack.load_used_entries(source.interior_stack_entries, source.interior_stack_position);
+		incident_mat_index = source.incident_mat_index;
+		outgoing_mat_index = source.outgoing_mat_index;
+		leaving_mat = source.leaving_mat;
+	}
 };
 
 #endif
@@ -7,6 +7,9 @@
 #define DEVICE_RESTIR_DI_FINAL_SHADING_H
 
 #include "Device/includes/Envmap.h"
+#include "Device/includes/ReSTIR/DI/ReservoirPacking.h"
+#include "Device/includes/ReSTIR/DI/Utils.h"
+#include "Device/includes/SceneInstances.h"
 
 #include "HostDeviceCommon/Color.h"
 #include "HostDeviceCommon/HitInfo.h"
@@ -72,8 +75,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F evaluate_ReSTIR_DI_reservoir(const HI
             }
             else
             {
-                int material_index = render_data.buffers.material_indices[sample.emissive_triangle_index];
-                sample_emission = render_data.buffers.materials_buffer[material_index].get_emission();
+                sample_emission = get_emissive_triangle_emission(render_data, sample.emissive_triangle_index, sample.point_on_light_source);
             }
 
             final_color = bsdf_color * reservoir.UCW * sample_emission * cosine_at_evaluated_point;
@@ -90,17 +92,67 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void validate_reservoir(const HIPRTRenderData& re
         reservoir.UCW = 0.0f;
 }
 
+/**
+ * Index of the pixel whose reservoir is shaded at 'pixel_coords'.
+ *
+ * This is the pixel itself except if ReSTIRDISettings::do_checkerboard is true and the passes
+ * didn't run on this pixel this frame. The reservoir of the most similar of the 4 direct neighbors
+ * (which all ran the passes) is then used: the neighbor that passes the normal similarity and
+ * that is the closest to the plane of the shading point according to the G-buffer.
+ *
+ * The reservoir of the neighbor is shaded at our shading point without any jacobian or
+ * reweighting, this is biased in the same way as reusing a neighbor without MIS weights
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int ReSTIR_DI_get_checkerboard_shading_pixel_index(const HIPRTRenderData& render_data, const float3& shading_point, const float3& shading_normal, int2 pixel_coords, int2 resolution)
+{
+    const ReSTIRDISettings& restir_di_settings = render_data.render_settings.restir_di_settings;
+    if (ReSTIR_DI_checkerboard_is_active(restir_di_settings, pixel_coords, restir_di_settings.checkerboard_parity))
+        return pixel_coords.x + pixel_coords.y * resolution.x;
+
+    // Defaults to the horizontal neighbor if none of the neighbors is similar enough
+    int2 fallback_coords = ReSTIR_DI_checkerboard_snap(restir_di_settings, pixel_coords, resolution, restir_di_settings.checkerboard_parity);
+    int best_pixel_index = fallback_coords.x + fallback_coords.y * resolution.x;
+    float best_plane_distance = 1.0e35f;
+
+    const int2 offsets[4] = { make_int2(-1, 0), make_int2(1, 0), make_int2(0, -1), make_int2(0, 1) };
+    for (int i = 0; i < 4; i++)
+    {
+        int2 neighbor_coords = pixel_coords + offsets[i];
+        if (neighbor_coords.x < 0 || neighbor_coords.x >= resolution.x || neighbor_coords.y < 0 || neighbor_coords.y >= resolution.y)
+            continue;
+
+        int neighbor_pixel_index = neighbor_coords.x + neighbor_coords.y * resolution.x;
+        if (!render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(neighbor_pixel_index)])
+            continue;
+
+        if (hippt::dot(shading_normal, render_data.g_buffer.get_shading_normal(neighbor_pixel_index)) < restir_di_settings.normal_similarity_angle_precomp)
+            continue;
+
+        float plane_distance = hippt::abs(hippt::dot(shading_normal, render_data.g_buffer.get_first_hit(neighbor_pixel_index, render_data.get_camera(neighbor_pixel_index).get_position()) - shading_point));
+        if (plane_distance < best_plane_distance)
+        {
+            best_plane_distance = plane_distance;
+            best_pixel_index = neighbor_pixel_index;
+        }
+    }
+
+    return best_pixel_index;
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_light_ReSTIR_DI(const HIPRTRenderData& render_data, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator, int2 pixel_coords, int2 resolution)
 {
-	int pixel_index = pixel_coords.x + pixel_coords.y * resolution.x;
+	int pixel_index = ReSTIR_DI_get_checkerboard_shading_pixel_index(render_data, closest_hit_info.inter_point, closest_hit_info.shading_normal, pixel_coords, resolution);
 
 	// Because the spatial reuse pass runs last, the output buffer of the spatial
 	// pass contains the reservoir whose sample we're going to shade
-	ReSTIRDIReservoir& reservoir = render_data.render_settings.restir_di_settings.restir_output_reservoirs[pixel_index];
+	ReSTIRDIReservoir reservoir = unpack_ReSTIR_DI_reservoir(render_data, render_data.render_settings.restir_di_settings.restir_output_reservoirs[pixel_index]);
 
     // Validates the reservoir i.e. kills the reservoir if it isn't valid
     // anymore i.e. if it refers to a light that doesn't exist anymore
     validate_reservoir(render_data, reservoir);
+    if (reservoir.UCW == 0.0f)
+        // Killing the stored reservoir too so that the temporal reuse of the next frame doesn't reuse it
+        render_data.render_settings.restir_di_settings.restir_output_reservoirs[pixel_index].UCW = 0.0f;
 
 	return evaluate_ReSTIR_DI_reservoir(render_data, ray_payload, 
         closest_hit_info.inter_point, closest_hit_info.shading_normal, view_direction, 
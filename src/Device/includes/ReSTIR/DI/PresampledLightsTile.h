@@ -0,0 +1,114 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RESTIR_DI_PRESAMPLED_LIGHTS_TILE_H
+#define DEVICE_RESTIR_DI_PRESAMPLED_LIGHTS_TILE_H
+
+#include "Device/includes/PresampledLights.h"
+#include "Device/includes/ReSTIR/DI/PresampledLight.h"
+
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * ReSTIRDIPresampledLight without the default member initializers
+ * and constructors that shared memory variables cannot have (48 bytes)
+ */
+struct ReSTIRDISharedPresampledLight
+{
+	HIPRT_HOST_DEVICE void set_presampled_light(const ReSTIRDIPresampledLight& presampled_light)
+	{
+		emissive_triangle_index = presampled_light.emissive_triangle_index;
+		point_on_light_source = presampled_light.point_on_light_source;
+		light_source_normal = presampled_light.light_source_normal;
+		radiance = make_float3(presampled_light.radiance.r, presampled_light.radiance.g, presampled_light.radiance.b);
+		pdf = presampled_light.pdf;
+		flags = presampled_light.flags;
+	}
+
+	HIPRT_HOST_DEVICE ReSTIRDIPresampledLight get_presampled_light() const
+	{
+		ReSTIRDIPresampledLight presampled_light;
+		presampled_light.emissive_triangle_index = emissive_triangle_index;
+		presampled_light.point_on_light_source = point_on_light_source;
+		presampled_light.light_source_normal = light_source_normal;
+		presampled_light.radiance = ColorRGB32F(radiance);
+		presampled_light.pdf = pdf;
+		presampled_light.flags = flags;
+
+		return presampled_light;
+	}
+
+	int emissive_triangle_index;
+	float3 point_on_light_source;
+	float3 light_source_normal;
+	float3 radiance;
+	float pdf;
+	unsigned char flags;
+};
+
+/**
+ * Presampled lights of the subset of a thread block of the initial candidates pass, cooperatively
+ * loaded in shared memory by the threads of the block (see load_presampled_lights_tile()).
+ *
+ * 'lights' is nullptr if the tile isn't used (CPU, ReSTIR_DI_InitialCandidatesSharedMemoryLights
+ * false, or the pixels of the block don't share a subset), the presampled lights are then read
+ * from the global light_presampling.light_samples
+ */
+struct ReSTIRDIPresampledLightsTile
+{
+	ReSTIRDISharedPresampledLight* lights = nullptr;
+	int light_count = 0;
+};
+
+#ifdef __KERNELCC__
+/**
+ * Loads the presampled lights of the subset of the thread block. Must be called by all the threads
+ * of the block (including the threads outside of the viewport) before any of them returns.
+ *
+ * The block, of dimensions RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE * RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE,
+ * must be laid over the image, not over the active pixels, for all its pixels to be in the same presampling tile
+ */
+HIPRT_DEVICE HIPRT_INLINE void load_presampled_lights_tile(const HIPRTRenderData& render_data, ReSTIRDIPresampledLightsTile& tile, ReSTIRDISharedPresampledLight* tile_lights)
+{
+	const LightPresamplingSettings& light_presampling_settings = render_data.render_settings.restir_di_settings.light_presampling;
+	if (light_presampling_settings.light_samples == nullptr || light_presampling_settings.tile_size % blockDim.x != 0 || light_presampling_settings.tile_size % blockDim.y != 0)
+		// The pixels of the block don't all read the same subset, the same for the whole block
+		// so no thread waits at a __syncthreads() that the others skip
+		return;
+
+	// The subset and the window of the subset are drawn by the tile random generator: the
+	// same for all the blocks of the presampling tile
+	Xorshift32Generator subset_rng = get_presampled_lights_tile_rng(render_data, make_int2(blockIdx.x * blockDim.x, blockIdx.y * blockDim.y));
+	int subset_index = subset_rng.random_index(light_presampling_settings.number_of_subsets);
+	int light_count = hippt::min(light_presampling_settings.subset_size, RESTIR_DI_SHARED_PRESAMPLED_LIGHT_COUNT);
+	int first_light = subset_index * light_presampling_settings.subset_size;
+	if (light_count < light_presampling_settings.subset_size)
+		first_light += subset_rng.random_index(light_presampling_settings.subset_size - light_count + 1);
+
+	tile.lights = tile_lights;
+	tile.light_count = light_count;
+
+	int thread_index = threadIdx.x + threadIdx.y * blockDim.x;
+	for (int light_index = thread_index; light_index < light_count; light_index += blockDim.x * blockDim.y)
+		tile_lights[light_index].set_presampled_light(light_presampling_settings.light_samples[first_light + light_index]);
+
+	__syncthreads();
+}
+#endif
+
+/**
+ * Random presampled light of the subset of the tile of 'pixel_coords', read from 'tile' if it's loaded
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIPresampledLight get_tile_presampled_light(const HIPRTRenderData& render_data, const ReSTIRDIPresampledLightsTile& tile, int2 pixel_coords, Xorshift32Generator& random_number_generator)
+{
+	if (tile.lights == nullptr)
+		return render_data.render_settings.restir_di_settings.light_presampling.light_samples[get_presampled_light_index(render_data, pixel_coords, random_number_generator)];
+	else
+		return tile.lights[random_number_generator.random_index(tile.light_count)].get_presampled_light();
+}
+
+#endif
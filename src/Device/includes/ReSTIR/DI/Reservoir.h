@@ -10,6 +10,7 @@
 
 #include "HostDeviceCommon/Math.h"
 #include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/KernelOptions.h"
 #include "HostDeviceCommon/Xorshift.h"
 
 #ifndef __KERNELCC__
@@ -35,6 +36,33 @@ struct ReSTIRDISample
     unsigned char flags = RESTIR_DI_FLAGS_NONE;
 };
 
+/**
+ * Compact storage format of the ReSTIR DI reservoirs in the reservoir buffers in between
+ * the passes. The passes read and write full reservoirs buffers so this is 20 bytes instead
+ * of the 36 bytes of a ReSTIRDIReservoir.
+ *
+ * The point on the light is stored as the barycentric coordinates of the point on the emissive triangle
+ * (or as the octahedral encoding of the direction for envmap samples) in 2 16-bit unorms.
+ * The weight sum isn't stored: it's only used while resampling, before end() computes the UCW.
+ *
+ * See pack_ReSTIR_DI_reservoir() and unpack_ReSTIR_DI_reservoir() in ReSTIR/DI/ReservoirPacking.h
+ */
+struct ReSTIRDIPackedReservoir
+{
+    static constexpr int MAX_M = 65535;
+
+    int emissive_triangle_index = -1;
+    // Barycentric coordinates on the emissive triangle or octahedral envmap direction
+    unsigned int packed_point_on_light_source = 0;
+    float target_function = 0.0f;
+    float UCW = 0.0f;
+
+    // Same name as in ReSTIRDIReservoir so that the passes that
+    // only need the M of a reservoir don't have to unpack it
+    unsigned short M = 0;
+    unsigned char flags = RESTIR_DI_FLAGS_NONE;
+};
+
 struct ReSTIRDIReservoir
 {
     HIPRT_HOST_DEVICE void add_one_candidate(ReSTIRDISample new_sample, float weight, Xorshift32Generator& random_number_generator)
@@ -102,13 +130,14 @@ struct ReSTIRDIReservoir
         else
             UCW = 1.0f / sample.target_function * weight_sum * normalization_numerator / normalization_denominator;
 
-        // Hard limiting M to avoid explosions if the user decides not to use any M-cap (M-cap == 0)
-        M = hippt::min(M, 1000000);
+        // Hard limiting M to avoid explosions if the user decides not to use any M-cap (M-cap == 0).
+        // This is also the largest M that fits in a ReSTIRDIPackedReservoir
+        M = hippt::min(M, ReSTIRDIPackedReservoir::MAX_M);
     }
 
     HIPRT_HOST_DEVICE HIPRT_INLINE void sanity_check(int2 pixel_coords)
     {
-#ifndef __KERNELCC__
+#if !defined(__KERNELCC__) && KernelDiagnostics == KERNEL_OPTION_TRUE
         if (M < 0)
         {
             std::lock_guard<std::mutex> lock(log_mutex);
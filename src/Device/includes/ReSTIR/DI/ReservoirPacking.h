@@ -0,0 +1,104 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RESTIR_DI_RESERVOIR_PACKING_H
+#define DEVICE_RESTIR_DI_RESERVOIR_PACKING_H
+
+#include "Device/includes/ReSTIR/DI/Reservoir.h"
+#include "Device/includes/SceneInstances.h"
+
+#include "HostDeviceCommon/Octahedral.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Packs two values of [0, 1] in 16-bit unorms, 'a' in the low bits
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int pack_unorm16x2(float a, float b)
+{
+    unsigned int packed_a = static_cast<unsigned int>(hippt::clamp(0.0f, 1.0f, a) * 65535.0f + 0.5f);
+    unsigned int packed_b = static_cast<unsigned int>(hippt::clamp(0.0f, 1.0f, b) * 65535.0f + 0.5f);
+
+    return packed_a | (packed_b << 16);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float2 unpack_unorm16x2(unsigned int packed)
+{
+    return make_float2((packed & 0xFFFF) / 65535.0f, (packed >> 16) / 65535.0f);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIPackedReservoir pack_ReSTIR_DI_reservoir(const HIPRTRenderData& render_data, const ReSTIRDIReservoir& reservoir)
+{
+    ReSTIRDIPackedReservoir packed;
+
+    packed.emissive_triangle_index = reservoir.sample.emissive_triangle_index;
+    packed.target_function = reservoir.sample.target_function;
+    packed.UCW = reservoir.UCW;
+    packed.M = static_cast<unsigned short>(reservoir.M < ReSTIRDIPackedReservoir::MAX_M ? reservoir.M : ReSTIRDIPackedReservoir::MAX_M);
+    packed.flags = reservoir.sample.flags;
+
+    if (reservoir.sample.flags & ReSTIRDISampleFlags::RESTIR_DI_FLAGS_ENVMAP_SAMPLE)
+    {
+        float2 octahedral = octahedral_encode(reservoir.sample.point_on_light_source);
+
+        packed.packed_point_on_light_source = pack_unorm16x2(octahedral.x * 0.5f + 0.5f, octahedral.y * 0.5f + 0.5f);
+    }
+    else if (reservoir.sample.emissive_triangle_index != -1)
+    {
+        float3 vertex_A, vertex_B, vertex_C;
+        get_scene_primitive_vertices(render_data, reservoir.sample.emissive_triangle_index, vertex_A, vertex_B, vertex_C);
+
+        // Barycentric coordinates of the point with respect to the edges AB and AC
+        float3 AB = vertex_B - vertex_A;
+        float3 AC = vertex_C - vertex_A;
+        float3 AP = reservoir.sample.point_on_light_source - vertex_A;
+
+        float dot_AB_AB = hippt::dot(AB, AB);
+        float dot_AB_AC = hippt::dot(AB, AC);
+        float dot_AC_AC = hippt::dot(AC, AC);
+        float dot_AP_AB = hippt::dot(AP, AB);
+        float dot_AP_AC = hippt::dot(AP, AC);
+
+        float denominator = dot_AB_AB * dot_AC_AC - dot_AB_AC * dot_AB_AC;
+        float u = 0.0f, v = 0.0f;
+        if (denominator != 0.0f)
+        {
+            u = (dot_AC_AC * dot_AP_AB - dot_AB_AC * dot_AP_AC) / denominator;
+            v = (dot_AB_AB * dot_AP_AC - dot_AB_AC * dot_AP_AB) / denominator;
+        }
+
+        packed.packed_point_on_light_source = pack_unorm16x2(u, v);
+    }
+
+    return packed;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIReservoir unpack_ReSTIR_DI_reservoir(const HIPRTRenderData& render_data, const ReSTIRDIPackedReservoir& packed)
+{
+    ReSTIRDIReservoir reservoir;
+
+    reservoir.sample.emissive_triangle_index = packed.emissive_triangle_index;
+    reservoir.sample.target_function = packed.target_function;
+    reservoir.sample.flags = packed.flags;
+    reservoir.UCW = packed.UCW;
+    reservoir.M = packed.M;
+    // The weight sum that would give this UCW with end(). It isn't
+    // used by the passes once the reservoir has been stored anyways
+    reservoir.weight_sum = packed.UCW * packed.target_function;
+
+    float2 packed_point = unpack_unorm16x2(packed.packed_point_on_light_source);
+    if (packed.flags & ReSTIRDISampleFlags::RESTIR_DI_FLAGS_ENVMAP_SAMPLE)
+        reservoir.sample.point_on_light_source = octahedral_decode(make_float2(packed_point.x * 2.0f - 1.0f, packed_point.y * 2.0f - 1.0f));
+    else if (packed.emissive_triangle_index != -1)
+    {
+        float3 vertex_A, vertex_B, vertex_C;
+        get_scene_primitive_vertices(render_data, packed.emissive_triangle_index, vertex_A, vertex_B, vertex_C);
+
+        reservoir.sample.point_on_light_source = vertex_A + (vertex_B - vertex_A) * packed_point.x + (vertex_C - vertex_A) * packed_point.y;
+    }
+
+    return reservoir;
+}
+
+#endif
@@ -14,7 +14,11 @@ enum ReSTIRDISampleFlags
     RESTIR_DI_FLAGS_ENVMAP_SAMPLE = 1 << 0,
     // This sample *AT ITS OWN PIXEL* is unoccluded. This can be used to avoid tracing
     // rays for visibility since we know it's unoccluded already
-    RESTIR_DI_FLAGS_UNOCCLUDED = 1 << 1
+    RESTIR_DI_FLAGS_UNOCCLUDED = 1 << 1,
+    // Only used by the presampled lights: the light is on a triangle with an emission texture and
+    // its 'radiance' is left to be read from the texture by the kernel that uses it, the light
+    // presampling kernel doesn't have the textures. See get_emissive_triangle_emission()
+    RESTIR_DI_FLAGS_EMISSION_TEXTURE = 1 << 2
 };
 
 #endif
@@ -40,6 +40,12 @@ struct ReSTIRDISpatialResamplingMISWeight<RESTIR_DI_BIAS_CORRECTION_MIS_LIKE>
 	}
 };
 
+/**
+ * 'neighbor_heuristics_cache' is the cache of the similarity heuristics filled by count_valid_spatial_neighbors()
+ * 
+ * 'cached_target_function_at_center' is the target function of 'reservoir_being_resampled' at the center pixel
+ * if the caller already evaluated it with the same visibility as the MIS weights, negative otherwise
+ */
 template <>
 struct ReSTIRDISpatialResamplingMISWeight<RESTIR_DI_BIAS_CORRECTION_MIS_GBH>
 {
@@ -48,6 +54,7 @@ struct ReSTIRDISpatialResamplingMISWeight<RESTIR_DI_BIAS_CORRECTION_MIS_GBH>
 		const ReSTIRDISurface& center_pixel_surface,
 		int current_neighbor,
 		int2 center_pixel_coords, int2 res, float2 cos_sin_theta_rotation,
+		int neighbor_heuristics_cache, float cached_target_function_at_center,
 		Xorshift32Generator& random_number_generator)
 	{
 		if (reservoir_being_resampled.UCW <= 0.0f)
@@ -66,14 +73,20 @@ struct ReSTIRDISpatialResamplingMISWeight<RESTIR_DI_BIAS_CORRECTION_MIS_GBH>
 				// Invalid neighbor, skipping
 				continue;
 
-			int center_pixel_index = center_pixel_coords.x + center_pixel_coords.y * res.x;
-			if (!check_neighbor_similarity_heuristics(render_data, neighbor_index_j, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal))
+			if (!check_cached_neighbor_similarity_heuristics(render_data, neighbor_heuristics_cache, j, reused_neighbors_count, neighbor_index_j, center_pixel_surface))
 				// Neighbor too dissimilar according to heuristics, skipping
 				continue;
 
-			ReSTIRDISurface neighbor_surface = get_pixel_surface(render_data, neighbor_index_j);
+			float target_function_at_j;
+			if (j == reused_neighbors_count && cached_target_function_at_center >= 0.0f)
+				// The spatial reuse pass already evaluated the target function of the sample at the center pixel
+				target_function_at_j = cached_target_function_at_center;
+			else
+			{
+				ReSTIRDISurface neighbor_surface = get_pixel_surface(render_data, neighbor_index_j);
 
-			float target_function_at_j = ReSTIR_DI_evaluate_target_function<ReSTIR_DI_BiasCorrectionUseVisibility>(render_data, reservoir_being_resampled.sample, neighbor_surface, random_number_generator);
+				target_function_at_j = ReSTIR_DI_evaluate_target_function<ReSTIR_DI_BiasCorrectionUseVisibility>(render_data, reservoir_being_resampled.sample, neighbor_surface, random_number_generator);
+			}
 
 			int M = 1;
 			if (render_data.render_settings.restir_di_settings.use_confidence_weights)
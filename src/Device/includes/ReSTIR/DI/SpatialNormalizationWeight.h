@@ -17,7 +17,7 @@ struct ReSTIRDISpatialNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVER_M>
 	HIPRT_HOST_DEVICE void get_normalization(const HIPRTRenderData& render_data,
 		const ReSTIRDIReservoir& final_reservoir, const ReSTIRDISurface& center_pixel_surface,
 		int2 center_pixel_coords, int2 res,
-		float2 cos_sin_theta_rotation, float& out_normalization_nume, float& out_normalization_denom)
+		float2 cos_sin_theta_rotation, int neighbor_heuristics_cache, float& out_normalization_nume, float& out_normalization_denom)
 	{
 		if (final_reservoir.weight_sum <= 0)
 		{
@@ -44,11 +44,11 @@ struct ReSTIRDISpatialNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVER_M>
 				// Neighbor out of the viewport
 				continue;
 
-			int center_pixel_index = center_pixel_coords.x + center_pixel_coords.y * res.x;
-			if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal))
+			if (!check_cached_neighbor_similarity_heuristics(render_data, neighbor_heuristics_cache, neighbor, reused_neighbors_count, neighbor_pixel_index, center_pixel_surface))
 				continue;
 
-			ReSTIRDIReservoir neighbor_reservoir = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index];
+			// Only the M of the neighbor is needed, no need to unpack the whole reservoir
+			const ReSTIRDIPackedReservoir& neighbor_reservoir = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index];
 			out_normalization_denom += neighbor_reservoir.M;
 		}
 	}
@@ -60,7 +60,7 @@ struct ReSTIRDISpatialNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVER_Z>
 	HIPRT_HOST_DEVICE void get_normalization(const HIPRTRenderData& render_data,
 		const ReSTIRDIReservoir& final_reservoir, const ReSTIRDISurface& center_pixel_surface,
 		int2 center_pixel_coords, int2 res,
-		float2 cos_sin_theta_rotation, float& out_normalization_nume, float& out_normalization_denom,
+		float2 cos_sin_theta_rotation, int neighbor_heuristics_cache, float& out_normalization_nume, float& out_normalization_denom,
 		Xorshift32Generator& random_number_generator)
 	{
 		if (final_reservoir.weight_sum <= 0)
@@ -85,8 +85,7 @@ struct ReSTIRDISpatialNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVER_Z>
 				// Invalid neighbor
 				continue;
 
-			int center_pixel_index = center_pixel_coords.x + center_pixel_coords.y * res.x;
-			if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal))
+			if (!check_cached_neighbor_similarity_heuristics(render_data, neighbor_heuristics_cache, neighbor, reused_neighbors_count, neighbor_pixel_index, center_pixel_surface))
 				continue;
 
 			// Getting the surface data at the neighbor
@@ -97,7 +96,8 @@ struct ReSTIRDISpatialNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVER_Z>
 			if (target_function_at_neighbor > 0.0f)
 			{
 				// If the neighbor could have produced this sample...
-				ReSTIRDIReservoir neighbor_reservoir = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index];
+				// Only the M of the neighbor is needed, no need to unpack the whole reservoir
+				const ReSTIRDIPackedReservoir& neighbor_reservoir = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index];
 
 				out_normalization_denom += neighbor_reservoir.M;
 			}
@@ -112,7 +112,7 @@ struct ReSTIRDISpatialNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_MIS_LIKE>
 		const ReSTIRDIReservoir& final_reservoir, const ReSTIRDISurface& center_pixel_surface,
 		int selected_neighbor,
 		int2 center_pixel_coords, int2 res,
-		float2 cos_sin_theta_rotation,
+		float2 cos_sin_theta_rotation, int neighbor_heuristics_cache,
 		float& out_normalization_nume, float& out_normalization_denom,
 		Xorshift32Generator& random_number_generator)
 	{
@@ -136,8 +136,7 @@ struct ReSTIRDISpatialNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_MIS_LIKE>
 				// Invalid neighbor
 				continue;
 
-			int center_pixel_index = center_pixel_coords.x + center_pixel_coords.y * res.x;
-			if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal))
+			if (!check_cached_neighbor_similarity_heuristics(render_data, neighbor_heuristics_cache, neighbor, reused_neighbors_count, neighbor_pixel_index, center_pixel_surface))
 				continue;
 
 			// Getting the surface data at the neighbor
@@ -148,7 +147,8 @@ struct ReSTIRDISpatialNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_MIS_LIKE>
 			if (target_function_at_neighbor > 0.0f)
 			{
 				// If the neighbor could have produced this sample...
-				ReSTIRDIReservoir neighbor_reservoir = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index];
+				// Only the M of the neighbor is needed, no need to unpack the whole reservoir
+				const ReSTIRDIPackedReservoir& neighbor_reservoir = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index];
 
 				int M = 1;
 				if (render_data.render_settings.restir_di_settings.use_confidence_weights)
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RESTIR_DI_SPATIAL_REUSE_TILE_H
+#define DEVICE_RESTIR_DI_SPATIAL_REUSE_TILE_H
+
+#include "Device/includes/ReSTIR/DI/Reservoir.h"
+#include "Device/includes/ReSTIR/DI/Surface.h"
+#include "Device/includes/ReSTIR/DI/Utils.h"
+
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/Octahedral.h"
+#include "HostDeviceCommon/RenderData.h"
+
+// RESTIR_DI_SPATIAL_TILE_SIZE and RESTIR_DI_SPATIAL_TILE_APRON are in KernelOptions.h
+#define RESTIR_DI_SPATIAL_TILE_STRIDE (RESTIR_DI_SPATIAL_TILE_SIZE + RESTIR_DI_SPATIAL_TILE_APRON * 2)
+#define RESTIR_DI_SPATIAL_TILE_PIXEL_COUNT (RESTIR_DI_SPATIAL_TILE_STRIDE * RESTIR_DI_SPATIAL_TILE_STRIDE)
+
+/**
+ * What the spatial reuse pass reads of a neighbor: its reservoir and the data of its
+ * surface needed by the similarity heuristics and the jacobian of the reconnection shift.
+ *
+ * The fields of the packed reservoir are copied here instead of storing a ReSTIRDIPackedReservoir
+ * because shared memory variables cannot have default member initializers (40 bytes)
+ */
+struct ReSTIRDISpatialTilePixel
+{
+	HIPRT_HOST_DEVICE void set_reservoir(const ReSTIRDIPackedReservoir& reservoir)
+	{
+		emissive_triangle_index = reservoir.emissive_triangle_index;
+		packed_point_on_light_source = reservoir.packed_point_on_light_source;
+		target_function = reservoir.target_function;
+		UCW = reservoir.UCW;
+		M = reservoir.M;
+		flags = reservoir.flags;
+	}
+
+	HIPRT_HOST_DEVICE ReSTIRDIPackedReservoir get_reservoir() const
+	{
+		ReSTIRDIPackedReservoir reservoir;
+		reservoir.emissive_triangle_index = emissive_triangle_index;
+		reservoir.packed_point_on_light_source = packed_point_on_light_source;
+		reservoir.target_function = target_function;
+		reservoir.UCW = UCW;
+		reservoir.M = M;
+		reservoir.flags = flags;
+
+		return reservoir;
+	}
+
+	int emissive_triangle_index;
+	unsigned int packed_point_on_light_source;
+	float target_function;
+	float UCW;
+	unsigned short M;
+	unsigned char flags;
+	// In the padding of the reservoir
+	unsigned char is_emissive;
+
+	float3 first_hit;
+	// Octahedral encoded
+	unsigned int shading_normal;
+	float roughness;
+};
+
+/**
+ * Pixels of a thread block and of its apron, cooperatively loaded in shared memory by the
+ * threads of the block (see load_spatial_reuse_tile()). The neighbors of the spatial
+ * reuse are then read from there instead of from the global reservoirs and G-buffer.
+ *
+ * 'pixels' is nullptr if the tile isn't used (CPU or ReSTIR_DI_SpatialReuseSharedMemoryTile false),
+ * all the neighbors are then read from global memory
+ */
+struct ReSTIRDISpatialTile
+{
+	/**
+	 * Index of the pixel in 'pixels', -1 if it isn't in the tile
+	 */
+	HIPRT_HOST_DEVICE int get_tile_index(int pixel_index, int2 res) const
+	{
+		if (pixels == nullptr)
+			return -1;
+
+		int tile_x = pixel_index % res.x - origin.x;
+		int tile_y = pixel_index / res.x - origin.y;
+		if (tile_x < 0 || tile_x >= RESTIR_DI_SPATIAL_TILE_STRIDE || tile_y < 0 || tile_y >= RESTIR_DI_SPATIAL_TILE_STRIDE)
+			return -1;
+
+		return tile_x + tile_y * RESTIR_DI_SPATIAL_TILE_STRIDE;
+	}
+
+	ReSTIRDISpatialTilePixel* pixels = nullptr;
+	// Pixel coordinates of the first pixel of the apron
+	int2 origin = { 0, 0 };
+};
+
+#ifdef __KERNELCC__
+/**
+ * Loads the pixels of the tile of the thread block. Must be called by all the threads of the block
+ * (including the threads outside of the viewport) before any of them returns.
+ *
+ * The block, of dimensions RESTIR_DI_SPATIAL_TILE_SIZE * RESTIR_DI_SPATIAL_TILE_SIZE, is
+ * at the center of the tile
+ */
+HIPRT_DEVICE HIPRT_INLINE void load_spatial_reuse_tile(const HIPRTRenderData& render_data, ReSTIRDISpatialTile& tile, ReSTIRDISpatialTilePixel* tile_pixels, int2 res)
+{
+	tile.pixels = tile_pixels;
+	tile.origin = make_int2(blockIdx.x * RESTIR_DI_SPATIAL_TILE_SIZE - RESTIR_DI_SPATIAL_TILE_APRON, blockIdx.y * RESTIR_DI_SPATIAL_TILE_SIZE - RESTIR_DI_SPATIAL_TILE_APRON);
+
+	const ReSTIRDIPackedReservoir* input_reservoirs = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs;
+	int thread_index = threadIdx.x + threadIdx.y * blockDim.x;
+	for (int tile_index = thread_index; tile_index < RESTIR_DI_SPATIAL_TILE_PIXEL_COUNT; tile_index += blockDim.x * blockDim.y)
+	{
+		int x = tile.origin.x + tile_index % RESTIR_DI_SPATIAL_TILE_STRIDE;
+		int y = tile.origin.y + tile_index / RESTIR_DI_SPATIAL_TILE_STRIDE;
+		if (x < 0 || x >= res.x || y < 0 || y >= res.y)
+			// Outside of the viewport, these pixels are never read since
+			// get_spatial_neighbor_pixel_index() rejects them
+			continue;
+
+		int pixel_index = x + y * res.x;
+
+		ReSTIRDISpatialTilePixel pixel;
+		pixel.set_reservoir(input_reservoirs[pixel_index]);
+		pixel.first_hit = render_data.g_buffer.get_first_hit(pixel_index, render_data.get_camera(pixel_index).get_position());
+		pixel.shading_normal = render_data.g_buffer.shading_normals[render_data.g_buffer.get_storage_index(pixel_index)];
+
+		// Same material as check_neighbor_similarity_heuristics(), the default
+		// one if the camera ray of the pixel didn't hit anything
+		SimplifiedRendererMaterial material;
+		if (render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(pixel_index)])
+			material = get_g_buffer_material(render_data, render_data.g_buffer, pixel_index);
+		pixel.roughness = material.roughness;
+		pixel.is_emissive = material.is_emissive();
+
+		tile_pixels[tile_index] = pixel;
+	}
+
+	__syncthreads();
+}
+#endif
+
+HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIPackedReservoir get_spatial_neighbor_reservoir(const HIPRTRenderData& render_data, const ReSTIRDISpatialTile& tile, int neighbor_pixel_index, int2 res)
+{
+	int tile_index = tile.get_tile_index(neighbor_pixel_index, res);
+	if (tile_index == -1)
+		return render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index];
+	else
+		return tile.pixels[tile_index].get_reservoir();
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 get_spatial_neighbor_first_hit(const HIPRTRenderData& render_data, const ReSTIRDISpatialTile& tile, int neighbor_pixel_index, int2 res)
+{
+	int tile_index = tile.get_tile_index(neighbor_pixel_index, res);
+	if (tile_index == -1)
+		return render_data.g_buffer.get_first_hit(neighbor_pixel_index, render_data.get_camera(neighbor_pixel_index).get_position());
+	else
+		return tile.pixels[tile_index].first_hit;
+}
+
+/**
+ * Same as check_neighbor_similarity_heuristics() for the current frame but reads the neighbor from the tile when it's in it
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool check_spatial_neighbor_similarity_heuristics(const HIPRTRenderData& render_data, const ReSTIRDISpatialTile& tile, int neighbor_pixel_index, const ReSTIRDISurface& center_pixel_surface, int2 res)
+{
+	int tile_index = tile.get_tile_index(neighbor_pixel_index, res);
+	if (tile_index == -1)
+		return check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_surface);
+
+	const ReSTIRDISettings& restir_di_settings = render_data.render_settings.restir_di_settings;
+	const ReSTIRDISpatialTilePixel& neighbor = tile.pixels[tile_index];
+
+	bool plane_distance_passed = plane_distance_heuristic(restir_di_settings, neighbor.first_hit, center_pixel_surface.shading_point, center_pixel_surface.shading_normal, restir_di_settings.plane_distance_threshold);
+	bool normal_similarity_passed = normal_similarity_heuristic(restir_di_settings, center_pixel_surface.shading_normal, octahedral_decode_32(neighbor.shading_normal), restir_di_settings.normal_similarity_angle_precomp);
+	bool roughness_similarity_passed = roughness_similarity_heuristic(restir_di_settings, neighbor.roughness, center_pixel_surface.material.roughness, restir_di_settings.roughness_similarity_threshold);
+
+	return plane_distance_passed && normal_similarity_passed && roughness_similarity_passed && !neighbor.is_emissive;
+}
+
+/**
+ * Same as count_valid_spatial_neighbors() but reads the neighbors from the tile when they're in it
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void count_valid_spatial_neighbors(const HIPRTRenderData& render_data, const ReSTIRDISpatialTile& tile, const ReSTIRDISurface& center_pixel_surface, int2 center_pixel_coords, int2 res, float2 cos_sin_theta_rotation, int& out_valid_neighbor_count, int& out_valid_neighbor_M_sum, int& out_neighbor_heuristics_cache)
+{
+	int center_pixel_index = center_pixel_coords.x + center_pixel_coords.y * res.x;
+	int reused_neighbors_count = render_data.render_settings.restir_di_settings.spatial_pass.reuse_neighbor_count;
+
+	out_valid_neighbor_count = 0;
+	for (int neighbor_index = 0; neighbor_index < reused_neighbors_count; neighbor_index++)
+	{
+		int neighbor_pixel_index = get_spatial_neighbor_pixel_index(render_data, neighbor_index, reused_neighbors_count, render_data.render_settings.restir_di_settings.spatial_pass.reuse_radius, center_pixel_coords, res, cos_sin_theta_rotation, Xorshift32Generator(render_data.random_seed));
+		if (neighbor_pixel_index == -1)
+			// Neighbor out of the viewport / invalid
+			continue;
+
+		if (!check_spatial_neighbor_similarity_heuristics(render_data, tile, neighbor_pixel_index, center_pixel_surface, res))
+			continue;
+
+		int tile_index = tile.get_tile_index(neighbor_pixel_index, res);
+		if (tile_index == -1)
+			out_valid_neighbor_M_sum += render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index].M;
+		else
+			out_valid_neighbor_M_sum += tile.pixels[tile_index].M;
+		out_valid_neighbor_count++;
+		out_neighbor_heuristics_cache |= (1 << neighbor_index);
+	}
+}
+
+#endif
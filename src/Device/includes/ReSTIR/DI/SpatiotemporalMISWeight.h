@@ -42,6 +42,12 @@ struct ReSTIRDISpatiotemporalResamplingMISWeight<RESTIR_DI_BIAS_CORRECTION_MIS_L
 	}
 }; 
 
+/**
+ * 'neighbor_heuristics_cache' is the cache of the similarity heuristics filled by count_valid_spatiotemporal_neighbors()
+ * 
+ * 'cached_target_function_at_center' is the target function of 'reservoir_being_resampled' at the center pixel
+ * if the caller already evaluated it with the same visibility as the MIS weights, negative otherwise
+ */
 template <>
 struct ReSTIRDISpatiotemporalResamplingMISWeight<RESTIR_DI_BIAS_CORRECTION_MIS_GBH>
 {
@@ -50,6 +56,7 @@ struct ReSTIRDISpatiotemporalResamplingMISWeight<RESTIR_DI_BIAS_CORRECTION_MIS_G
 		const ReSTIRDISurface& center_pixel_surface, const ReSTIRDISurface& temporal_neighbor_surface,
 		int current_neighbor, int initial_candidates_M, int temporal_neighbor_M,
 		int center_pixel_index, int2 temporal_neighbor_coords, int2 res, float2 cos_sin_theta_rotation,
+		int neighbor_heuristics_cache, float cached_target_function_at_center,
 		Xorshift32Generator& random_number_generator)
 	{
 		if (reservoir_being_resampled.UCW <= 0.0f)
@@ -73,18 +80,25 @@ struct ReSTIRDISpatiotemporalResamplingMISWeight<RESTIR_DI_BIAS_CORRECTION_MIS_G
 					// Invalid neighbor, skipping
 					continue;
 
-				if (!check_neighbor_similarity_heuristics(render_data, neighbor_index_j, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal, render_data.render_settings.use_prev_frame_g_buffer()))
+				if (!check_cached_neighbor_similarity_heuristics(render_data, neighbor_heuristics_cache, j, reused_neighbors_count, neighbor_index_j, center_pixel_surface, render_data.render_settings.use_prev_frame_g_buffer()))
 					// Neighbor too dissimilar according to heuristics, skipping
 					continue;
 			}
 
-			ReSTIRDISurface neighbor_surface;
-			if (j == reused_neighbors_count)
-				neighbor_surface = center_pixel_surface;
+			float target_function_at_j;
+			if (j == reused_neighbors_count && cached_target_function_at_center >= 0.0f)
+				// The spatiotemporal reuse pass already evaluated the target function of the sample at the center pixel
+				target_function_at_j = cached_target_function_at_center;
 			else
-				neighbor_surface = get_pixel_surface(render_data, neighbor_index_j, render_data.render_settings.use_prev_frame_g_buffer());
+			{
+				ReSTIRDISurface neighbor_surface;
+				if (j == reused_neighbors_count)
+					neighbor_surface = center_pixel_surface;
+				else
+					neighbor_surface = get_pixel_surface(render_data, neighbor_index_j, render_data.render_settings.use_prev_frame_g_buffer());
 
-			float target_function_at_j = ReSTIR_DI_evaluate_target_function<ReSTIR_DI_BiasCorrectionUseVisibility>(render_data, reservoir_being_resampled.sample, neighbor_surface, random_number_generator);
+				target_function_at_j = ReSTIR_DI_evaluate_target_function<ReSTIR_DI_BiasCorrectionUseVisibility>(render_data, reservoir_being_resampled.sample, neighbor_surface, random_number_generator);
+			}
 
 			int M = 1;
 			if (render_data.render_settings.restir_di_settings.use_confidence_weights)
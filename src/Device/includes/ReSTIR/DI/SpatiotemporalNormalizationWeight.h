@@ -19,7 +19,7 @@ struct ReSTIRDISpatiotemporalNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVE
 	HIPRT_HOST_DEVICE void get_normalization(const HIPRTRenderData& render_data,
 		const ReSTIRDIReservoir& final_reservoir, const ReSTIRDIReservoir& initial_candidates_reservoir, const ReSTIRDISurface& center_pixel_surface,
 		int temporal_neighbor_M, int center_pixel_index, int2 temporal_neighbor_coords, 
-		int2 res, float2 cos_sin_theta_rotation, float& out_normalization_nume, float& out_normalization_denom)
+		int2 res, float2 cos_sin_theta_rotation, int neighbor_heuristics_cache, float& out_normalization_nume, float& out_normalization_denom)
 	{
 		if (final_reservoir.weight_sum <= 0)
 		{
@@ -53,7 +53,7 @@ struct ReSTIRDISpatiotemporalNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVE
 					// Neighbor out of the viewport
 					continue;
 
-				if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal, render_data.render_settings.use_prev_frame_g_buffer()))
+				if (!check_cached_neighbor_similarity_heuristics(render_data, neighbor_heuristics_cache, neighbor, reused_neighbors_count, neighbor_pixel_index, center_pixel_surface, render_data.render_settings.use_prev_frame_g_buffer()))
 					continue;
 			}
 
@@ -87,7 +87,7 @@ struct ReSTIRDISpatiotemporalNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVE
 	HIPRT_HOST_DEVICE void get_normalization(const HIPRTRenderData& render_data,
 		const ReSTIRDIReservoir& final_reservoir, const ReSTIRDISurface& center_pixel_surface, const ReSTIRDISurface& temporal_neighbor_surface,
 		int center_pixel_M, int temporal_neighbor_M, int center_pixel_index, int2 temporal_neighbor_position, int2 res,
-		float2 cos_sin_theta_rotation, float& out_normalization_nume, float& out_normalization_denom,
+		float2 cos_sin_theta_rotation, int neighbor_heuristics_cache, float& out_normalization_nume, float& out_normalization_denom,
 		Xorshift32Generator& random_number_generator)
 	{
 		if (final_reservoir.weight_sum <= 0)
@@ -119,7 +119,7 @@ struct ReSTIRDISpatiotemporalNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_1_OVE
 					// Invalid neighbor
 					continue;
 
-				if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal, render_data.render_settings.use_prev_frame_g_buffer()))
+				if (!check_cached_neighbor_similarity_heuristics(render_data, neighbor_heuristics_cache, neighbor, reused_neighbors_count, neighbor_pixel_index, center_pixel_surface, render_data.render_settings.use_prev_frame_g_buffer()))
 					continue;
 			}
 
@@ -163,7 +163,7 @@ struct ReSTIRDISpatiotemporalNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_MIS_L
 		const ReSTIRDIReservoir& final_reservoir, const ReSTIRDISurface& center_pixel_surface, const ReSTIRDISurface& temporal_neighbor_surface,
 		int selected_neighbor,
 		int center_pixel_M, int temporal_neighbor_M, int center_pixel_index, int2 temporal_neighbor_coords, int2 res,
-		float2 cos_sin_theta_rotation,
+		float2 cos_sin_theta_rotation, int neighbor_heuristics_cache,
 		float& out_normalization_nume, float& out_normalization_denom,
 		Xorshift32Generator& random_number_generator)
 	{
@@ -193,7 +193,7 @@ struct ReSTIRDISpatiotemporalNormalizationWeight<RESTIR_DI_BIAS_CORRECTION_MIS_L
 					// Invalid neighbor
 					continue;
 
-				if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal, render_data.render_settings.use_prev_frame_g_buffer()))
+				if (!check_cached_neighbor_similarity_heuristics(render_data, neighbor_heuristics_cache, neighbor, reused_neighbors_count, neighbor_pixel_index, center_pixel_surface, render_data.render_settings.use_prev_frame_g_buffer()))
 					continue;
 			}
 
@@ -6,6 +6,8 @@
 #ifndef DEVICE_RESTIR_DI_SURFACE_H
 #define DEVICE_RESTIR_DI_SURFACE_H
 
+#include "Device/includes/Material.h"
+
 #include "HostDeviceCommon/RenderData.h"
 #include "HostDeviceCommon/Material.h"
 
@@ -22,11 +24,13 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDISurface get_pixel_surface(const HIPRTRend
 {
 	ReSTIRDISurface surface;
 
-	surface.material = render_data.g_buffer.materials[pixel_index];
-	surface.ray_volume_state = render_data.g_buffer.ray_volume_states[pixel_index];
-	surface.view_direction = render_data.g_buffer.view_directions[pixel_index];
-	surface.shading_normal = render_data.g_buffer.shading_normals[pixel_index];
-	surface.shading_point = render_data.g_buffer.first_hits[pixel_index] + surface.shading_normal * 1.0e-4f;
+	if (render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(pixel_index)])
+		// The material index of the GBuffer is only valid if the camera ray hit something
+		surface.material = get_g_buffer_material(render_data, render_data.g_buffer, pixel_index);
+	surface.ray_volume_state.load(render_data.g_buffer.ray_volume_states[render_data.g_buffer.get_storage_index(pixel_index)]);
+	surface.view_direction = render_data.g_buffer.get_view_direction(pixel_index);
+	surface.shading_normal = render_data.g_buffer.get_shading_normal(pixel_index);
+	surface.shading_point = render_data.g_buffer.get_first_hit(pixel_index, render_data.get_camera(pixel_index).get_position()) + surface.shading_normal * 1.0e-4f;
 
 	return surface;
 }
@@ -41,11 +45,12 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDISurface get_pixel_surface_previous_frame(
 {
 	ReSTIRDISurface surface;
 
-	surface.material = render_data.g_buffer_prev_frame.materials[pixel_index];
-	surface.ray_volume_state = render_data.g_buffer_prev_frame.ray_volume_states[pixel_index];
-	surface.view_direction = render_data.g_buffer_prev_frame.view_directions[pixel_index];
-	surface.shading_normal = render_data.g_buffer_prev_frame.shading_normals[pixel_index];
-	surface.shading_point = render_data.g_buffer_prev_frame.first_hits[pixel_index] + surface.shading_normal * 1.0e-4f;
+	if (render_data.g_buffer_prev_frame.camera_ray_hit[render_data.g_buffer_prev_frame.get_storage_index(pixel_index)])
+		surface.material = get_g_buffer_material(render_data, render_data.g_buffer_prev_frame, pixel_index);
+	surface.ray_volume_state.load(render_data.g_buffer_prev_frame.ray_volume_states[render_data.g_buffer_prev_frame.get_storage_index(pixel_index)]);
+	surface.view_direction = render_data.g_buffer_prev_frame.get_view_direction(pixel_index);
+	surface.shading_normal = render_data.g_buffer_prev_frame.get_shading_normal(pixel_index);
+	surface.shading_point = render_data.g_buffer_prev_frame.get_first_hit(pixel_index, render_data.prev_camera.get_position()) + surface.shading_normal * 1.0e-4f;
 
 	return surface;
 }
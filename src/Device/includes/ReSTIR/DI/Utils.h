@@ -10,11 +10,58 @@
 #include "Device/includes/Envmap.h"
 #include "Device/includes/Intersect.h"
 #include "Device/includes/LightUtils.h"
+#include "Device/includes/ReSTIR/DI/ReservoirPacking.h"
 #include "Device/includes/ReSTIR/DI/Surface.h"
 
+#include "HostDeviceCommon/KernelOptions.h"
 #include "HostDeviceCommon/Math.h"
 #include "HostDeviceCommon/RenderData.h"
 
+#if ReSTIR_DI_TargetFunctionPackedHalf == KERNEL_OPTION_TRUE && defined(__KERNELCC__)
+#if defined(__CUDACC__)
+#include <cuda_fp16.h>
+#else
+#include <hip/hip_fp16.h>
+#endif
+#endif
+
+/**
+ * Luminance of 'bsdf_color' * 'radiance' * 'cosine_term', the target function of ReSTIR DI
+ * without its visibility term. All the target functions of ReSTIR DI go through this function
+ * so that they are the same function for all the passes.
+ *
+ * Computed with packed half2 math on the GPU if ReSTIR_DI_TargetFunctionPackedHalf is true
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float ReSTIR_DI_target_function_luminance(const ColorRGB32F& bsdf_color, const ColorRGB32F& radiance, float cosine_term)
+{
+#if ReSTIR_DI_TargetFunctionPackedHalf == KERNEL_OPTION_TRUE && defined(__KERNELCC__)
+	// Normalizing the colors by their largest channel so that the products of the
+	// channels are in [0, 1] and can't overflow the 65504 maximum of the halves
+	float bsdf_scale = hippt::max(bsdf_color.r, hippt::max(bsdf_color.g, bsdf_color.b));
+	float radiance_scale = hippt::max(radiance.r, hippt::max(radiance.g, radiance.b));
+	if (bsdf_scale <= 0.0f || radiance_scale <= 0.0f)
+		return 0.0f;
+
+	float bsdf_normalization = 1.0f / bsdf_scale;
+	float radiance_normalization = 1.0f / radiance_scale;
+
+	// R and G in one half2, B and a zero in the other
+	__half2 bsdf_rg = __floats2half2_rn(bsdf_color.r * bsdf_normalization, bsdf_color.g * bsdf_normalization);
+	__half2 bsdf_b = __floats2half2_rn(bsdf_color.b * bsdf_normalization, 0.0f);
+	__half2 radiance_rg = __floats2half2_rn(radiance.r * radiance_normalization, radiance.g * radiance_normalization);
+	__half2 radiance_b = __floats2half2_rn(radiance.b * radiance_normalization, 0.0f);
+
+	// Same weights as ColorRGB32F::luminance()
+	__half2 luminance_rg = __hmul2(__hmul2(bsdf_rg, radiance_rg), __floats2half2_rn(0.3086f, 0.6094f));
+	__half2 luminance = __hfma2(__hmul2(bsdf_b, radiance_b), __floats2half2_rn(0.0820f, 0.0f), luminance_rg);
+
+	// The low half holds R + B, the high half G
+	return (__low2float(luminance) + __high2float(luminance)) * bsdf_scale * radiance_scale * cosine_term;
+#else
+	return (bsdf_color * radiance * cosine_term).luminance();
+#endif
+}
+
 template <bool withVisiblity>
 HIPRT_HOST_DEVICE HIPRT_INLINE float ReSTIR_DI_evaluate_target_function(const HIPRTRenderData& render_data, const ReSTIRDISample& sample, const ReSTIRDISurface& surface, Xorshift32Generator& random_number_generator)
 {
@@ -60,11 +107,10 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float ReSTIR_DI_evaluate_target_function<KERNEL_O
 	}
 	else
 	{
-		int material_index = render_data.buffers.material_indices[sample.emissive_triangle_index];
-		sample_emission = render_data.buffers.materials_buffer[material_index].get_emission();
+		sample_emission = get_emissive_triangle_emission(render_data, sample.emissive_triangle_index, sample.point_on_light_source);
 	}
 
-	float target_function = (bsdf_color * sample_emission * cosine_term).luminance();
+	float target_function = ReSTIR_DI_target_function_luminance(bsdf_color, sample_emission, cosine_term);
 	if (hippt::isZERO(target_function))
 		// Quick exit because computing the visiblity that follows isn't going
 		// to change anything to the fact that we have 0.0f target function here
@@ -111,11 +157,10 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float ReSTIR_DI_evaluate_target_function<KERNEL_O
 	}
 	else
 	{
-		int material_index = render_data.buffers.material_indices[sample.emissive_triangle_index];
-		sample_emission = render_data.buffers.materials_buffer[material_index].get_emission();
+		sample_emission = get_emissive_triangle_emission(render_data, sample.emissive_triangle_index, sample.point_on_light_source);
 	}
 
-	float target_function = (bsdf_color * sample_emission * cosine_term).luminance();
+	float target_function = ReSTIR_DI_target_function_luminance(bsdf_color, sample_emission, cosine_term);
 	if (hippt::isZERO(target_function))
 		// Quick exit because computing the visiblity that follows isn't going
 		// to change anything to the fact that we have 0.0f target function here
@@ -132,30 +177,42 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float ReSTIR_DI_evaluate_target_function<KERNEL_O
 	return target_function;
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE void ReSTIR_DI_visibility_reuse(const HIPRTRenderData& render_data, ReSTIRDIReservoir& reservoir, float3 shading_point, Xorshift32Generator& random_number_generator)
+/**
+ * Returns false if the reservoir doesn't need a visibility reuse ray (empty or already unoccluded),
+ * true otherwise in which case 'out_shadow_ray' and 'out_distance_to_light' are the visibility ray to trace
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool ReSTIR_DI_get_visibility_reuse_ray(const HIPRTRenderData& render_data, const ReSTIRDIReservoir& reservoir, float3 shading_point, hiprtRay& out_shadow_ray, float& out_distance_to_light)
 {
 	if (reservoir.UCW <= 0.0f)
-		return;
+		return false;
 	else if (reservoir.sample.flags & ReSTIRDISampleFlags::RESTIR_DI_FLAGS_UNOCCLUDED)
 		// The sample is already unoccluded, no need to test for visibility reuse
-		return;
+		return false;
 
-	float distance_to_light;
 	float3 sample_direction;
 	if (reservoir.sample.flags & ReSTIRDISampleFlags::RESTIR_DI_FLAGS_ENVMAP_SAMPLE)
 	{
 		sample_direction = matrix_X_vec(render_data.world_settings.envmap_to_world_matrix, reservoir.sample.point_on_light_source);
-		distance_to_light = 1.0e35f;
+		out_distance_to_light = 1.0e35f;
 	}
 	else
 	{
 		sample_direction = reservoir.sample.point_on_light_source - shading_point;
-		sample_direction /= (distance_to_light = hippt::length(sample_direction));
+		sample_direction /= (out_distance_to_light = hippt::length(sample_direction));
 	}
 
+	out_shadow_ray.origin = shading_point;
+	out_shadow_ray.direction = sample_direction;
+
+	return true;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void ReSTIR_DI_visibility_reuse(const HIPRTRenderData& render_data, ReSTIRDIReservoir& reservoir, float3 shading_point, Xorshift32Generator& random_number_generator)
+{
 	hiprtRay shadow_ray;
-	shadow_ray.origin = shading_point;
-	shadow_ray.direction = sample_direction;
+	float distance_to_light;
+	if (!ReSTIR_DI_get_visibility_reuse_ray(render_data, reservoir, shading_point, shadow_ray, distance_to_light))
+		return;
 
 	bool visible = !evaluate_shadow_ray(render_data, shadow_ray, distance_to_light, random_number_generator);
 	if (!visible)
@@ -166,6 +223,29 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void ReSTIR_DI_visibility_reuse(const HIPRTRender
 		reservoir.sample.flags |= RESTIR_DI_FLAGS_UNOCCLUDED;
 }
 
+/**
+ * Same as ReSTIR_DI_visibility_reuse() but the visibility ray is queued in
+ * 'render_data.render_settings.restir_di_settings.visibility_rays' instead of being traced.
+ * 
+ * The ray is traced by the ReSTIR_DI_VisibilityRays kernel once the pass is done, which then
+ * updates the reservoir of 'pixel_index' in the output buffer of the pass. See ReSTIR_DI_BatchedVisibilityRays
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void ReSTIR_DI_queue_visibility_reuse_ray(const HIPRTRenderData& render_data, const ReSTIRDIReservoir& reservoir, float3 shading_point, int pixel_index)
+{
+	hiprtRay shadow_ray;
+	float distance_to_light;
+	if (!ReSTIR_DI_get_visibility_reuse_ray(render_data, reservoir, shading_point, shadow_ray, distance_to_light))
+		return;
+
+	const VisibilityRaysSettings& visibility_rays = render_data.render_settings.restir_di_settings.visibility_rays;
+
+	unsigned int ray_index = hippt::atomic_add(visibility_rays.ray_count, 1u);
+	visibility_rays.pixel_indices[ray_index] = pixel_index;
+	visibility_rays.ray_origins[ray_index] = shadow_ray.origin;
+	visibility_rays.ray_directions[ray_index] = shadow_ray.direction;
+	visibility_rays.ray_distances[ray_index] = distance_to_light;
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE float get_jacobian_determinant_reconnection_shift(const HIPRTRenderData& render_data, const ReSTIRDIReservoir& neighbor_reservoir, const float3& center_pixel_shading_point, const float3& neighbor_shading_point)
 {
 	float distance_to_light_at_center;
@@ -193,9 +273,15 @@ HIPRT_HOST_DEVICE HIPRT_INLINE float get_jacobian_determinant_reconnection_shift
 		return jacobian;
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE float get_jacobian_determinant_reconnection_shift(const HIPRTRenderData& render_data, const ReSTIRDIReservoir& neighbor_reservoir, const float3& center_pixel_shading_point, int neighbor_pixel_index)
+/**
+ * Reads the point of the neighbor from the G-buffer of the previous frame if 'previous_frame' is true
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float get_jacobian_determinant_reconnection_shift(const HIPRTRenderData& render_data, const ReSTIRDIReservoir& neighbor_reservoir, const float3& center_pixel_shading_point, int neighbor_pixel_index, bool previous_frame = false)
 {
-	return get_jacobian_determinant_reconnection_shift(render_data, neighbor_reservoir, center_pixel_shading_point, render_data.g_buffer.first_hits[neighbor_pixel_index]);
+	const GBuffer& neighbor_g_buffer = previous_frame ? render_data.g_buffer_prev_frame : render_data.g_buffer;
+	float3 neighbor_camera_position = previous_frame ? render_data.prev_camera.get_position() : render_data.get_camera(neighbor_pixel_index).get_position();
+
+	return get_jacobian_determinant_reconnection_shift(render_data, neighbor_reservoir, center_pixel_shading_point, neighbor_g_buffer.get_first_hit(neighbor_pixel_index, neighbor_camera_position));
 }
 
 /**
@@ -237,38 +323,120 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool roughness_similarity_heuristic(const ReSTIRD
 	return hippt::abs(neighbor_roughness - center_pixel_roughness) < threshold;
 }
 
+/**
+ * 'current_material_roughness' is the roughness of the material of the center pixel, only used by the roughness heuristic
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool check_neighbor_similarity_heuristics(const HIPRTRenderData& render_data, int neighbor_pixel_index, const float3& current_shading_point, const float3& current_normal, float current_material_roughness, bool previous_frame)
+{
+	const GBuffer& neighbor_g_buffer = previous_frame ? render_data.g_buffer_prev_frame : render_data.g_buffer;
+	float3 neighbor_camera_position = previous_frame ? render_data.prev_camera.get_position() : render_data.get_camera(neighbor_pixel_index).get_position();
+
+	float3 neighbor_world_space_point = { 0.0f, 0.0f, 0.0f };
+	if (render_data.render_settings.restir_di_settings.use_plane_distance_heuristic || !previous_frame)
+		// Only getting the point for the plane distance heuristic, otherwise it's never used
+		neighbor_world_space_point = neighbor_g_buffer.get_first_hit(neighbor_pixel_index, neighbor_camera_position);
+
+	// The material of the neighbor is needed for the emissive check and the roughness heuristic.
+	// The material index of the GBuffer is only valid if the camera ray hit something
+	SimplifiedRendererMaterial neighbor_material;
+	if (neighbor_g_buffer.camera_ray_hit[neighbor_g_buffer.get_storage_index(neighbor_pixel_index)])
+		neighbor_material = get_g_buffer_material(render_data, neighbor_g_buffer, neighbor_pixel_index);
+
+	bool plane_distance_passed = plane_distance_heuristic(render_data.render_settings.restir_di_settings, neighbor_world_space_point, current_shading_point, current_normal, render_data.render_settings.restir_di_settings.plane_distance_threshold);
+	bool normal_similarity_passed = normal_similarity_heuristic(render_data.render_settings.restir_di_settings, current_normal, render_data.g_buffer.get_shading_normal(neighbor_pixel_index), render_data.render_settings.restir_di_settings.normal_similarity_angle_precomp);
+	bool roughness_similarity_passed = roughness_similarity_heuristic(render_data.render_settings.restir_di_settings, neighbor_material.roughness, current_material_roughness, render_data.render_settings.restir_di_settings.roughness_similarity_threshold);
+	bool neighbor_is_emissive = neighbor_material.is_emissive();
+
+	return plane_distance_passed && normal_similarity_passed && roughness_similarity_passed && !neighbor_is_emissive;
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE bool check_neighbor_similarity_heuristics(const HIPRTRenderData& render_data, int neighbor_pixel_index, int center_pixel_index, const float3& current_shading_point, const float3& current_normal, bool previous_frame = false)
 {
-	float3 neighbor_world_space_point;
-	float neighbor_roughness = 0.0f;
 	float current_material_roughness = 0.0f;
+	if (render_data.render_settings.restir_di_settings.use_roughness_similarity_heuristic && render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(center_pixel_index)])
+		// Getting the roughness at the current point
+		current_material_roughness = get_g_buffer_material(render_data, render_data.g_buffer, center_pixel_index).roughness;
 
-	if (previous_frame)
-	{
-		if (render_data.render_settings.restir_di_settings.use_plane_distance_heuristic)
-			// Only getting the point plane distance heuristic, otherwise it's never used
-			neighbor_world_space_point = render_data.g_buffer_prev_frame.first_hits[neighbor_pixel_index];
+	return check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, current_shading_point, current_normal, current_material_roughness, previous_frame);
+}
 
-		if (render_data.render_settings.restir_di_settings.use_roughness_similarity_heuristic)
-			// Only getting the roughness for the roughness heuristic otherwise it's not going to be used
-			neighbor_roughness = render_data.g_buffer_prev_frame.materials[neighbor_pixel_index].roughness;
-	}
+/**
+ * Overload for when the surface of the center pixel is already known: the roughness of the center
+ * pixel is read from its material instead of evaluating the material of the G-buffer again.
+ *
+ * The camera ray of the center pixel must have hit something
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool check_neighbor_similarity_heuristics(const HIPRTRenderData& render_data, int neighbor_pixel_index, const ReSTIRDISurface& center_pixel_surface, bool previous_frame = false)
+{
+	return check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal, center_pixel_surface.material.roughness, previous_frame);
+}
+
+/**
+ * Whether or not the 'neighbor_index'th spatial neighbor (at 'neighbor_pixel_index') passes the similarity heuristics,
+ * read from the cache filled by count_valid_spatial_neighbors() / count_valid_spatiotemporal_neighbors().
+ *
+ * The cache only holds 32 neighbors, the heuristics are evaluated for the neighbors after that.
+ * The center pixel ('neighbor_index' == 'reused_neighbors_count') always passes
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool check_cached_neighbor_similarity_heuristics(const HIPRTRenderData& render_data, int neighbor_heuristics_cache, int neighbor_index, int reused_neighbors_count, int neighbor_pixel_index, const ReSTIRDISurface& center_pixel_surface, bool previous_frame = false)
+{
+	if (neighbor_index == reused_neighbors_count)
+		return true;
+	else if (reused_neighbors_count <= 32)
+		return neighbor_heuristics_cache & (1 << neighbor_index);
 	else
-	{
-		neighbor_world_space_point = render_data.g_buffer.first_hits[neighbor_pixel_index];
-		neighbor_roughness = render_data.g_buffer.materials[neighbor_pixel_index].roughness;
-	}
+		return check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_surface, previous_frame);
+}
 
-	if (render_data.render_settings.restir_di_settings.use_roughness_similarity_heuristic)
-		// Getting the roughness at the current point
-		current_material_roughness = render_data.g_buffer.materials[center_pixel_index].roughness;
+/**
+ * Whether or not the pixel at 'pixel_coords' is one of the pixels of the checkerboard
+ * with the given parity (see ReSTIRDISettings::do_checkerboard).
+ *
+ * All the pixels are active if the checkerboard isn't used
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool ReSTIR_DI_checkerboard_is_active(const ReSTIRDISettings& restir_di_settings, int2 pixel_coords, int parity)
+{
+	if (!restir_di_settings.do_checkerboard)
+		return true;
 
-	bool plane_distance_passed = plane_distance_heuristic(render_data.render_settings.restir_di_settings, neighbor_world_space_point, current_shading_point, current_normal, render_data.render_settings.restir_di_settings.plane_distance_threshold);
-	bool normal_similarity_passed = normal_similarity_heuristic(render_data.render_settings.restir_di_settings, current_normal, render_data.g_buffer.shading_normals[neighbor_pixel_index], render_data.render_settings.restir_di_settings.normal_similarity_angle_precomp);
-	bool roughness_similarity_passed = roughness_similarity_heuristic(render_data.render_settings.restir_di_settings, neighbor_roughness, current_material_roughness, render_data.render_settings.restir_di_settings.roughness_similarity_threshold);
-	bool neighbor_is_emissive = previous_frame ? render_data.g_buffer_prev_frame.materials[neighbor_pixel_index].is_emissive() : render_data.g_buffer.materials[neighbor_pixel_index].is_emissive();
+	return ((pixel_coords.x + pixel_coords.y) & 1) == parity;
+}
 
-	return plane_distance_passed && normal_similarity_passed && roughness_similarity_passed && !neighbor_is_emissive;
+/**
+ * Moves 'pixel_coords' by one pixel horizontally if it isn't a pixel of the checkerboard
+ * with the given parity so that the reservoir read there was written by the passes.
+ *
+ * 'pixel_coords' must be in the viewport and stays in it
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int2 ReSTIR_DI_checkerboard_snap(const ReSTIRDISettings& restir_di_settings, int2 pixel_coords, int2 res, int parity)
+{
+	if (ReSTIR_DI_checkerboard_is_active(restir_di_settings, pixel_coords, parity))
+		return pixel_coords;
+
+	pixel_coords.x += pixel_coords.x + 1 < res.x ? 1 : -1;
+
+	return pixel_coords;
+}
+
+/**
+ * Number of neighbors that the spatial reuse of a pixel resamples given the number of
+ * samples 'history_M' of its temporal history, see SpatialPassSettings::do_adaptive_neighbor_count
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int ReSTIR_DI_get_spatial_reuse_neighbor_count(const ReSTIRDISettings& restir_di_settings, int history_M)
+{
+	const SpatialPassSettings& spatial_pass = restir_di_settings.spatial_pass;
+
+	if (history_M <= 1 && spatial_pass.do_disocclusion_reuse_boost)
+		// Increasing the number of spatial samples for disoclussions
+		return spatial_pass.disocclusion_reuse_count;
+
+	if (!spatial_pass.do_adaptive_neighbor_count || restir_di_settings.m_cap <= 0)
+		return spatial_pass.reuse_neighbor_count;
+
+	float confidence = hippt::clamp(0.0f, 1.0f, history_M / static_cast<float>(restir_di_settings.m_cap));
+	int min_neighbor_count = hippt::min(spatial_pass.adaptive_min_neighbor_count, spatial_pass.reuse_neighbor_count);
+
+	return static_cast<int>(roundf(spatial_pass.reuse_neighbor_count + (min_neighbor_count - spatial_pass.reuse_neighbor_count) * confidence));
 }
 
 /**
@@ -323,15 +491,23 @@ HIPRT_HOST_DEVICE HIPRT_INLINE int get_spatial_neighbor_pixel_index(const HIPRTR
 		int2 neighbor_offset_int = make_int2(static_cast<int>(neighbor_offset_rotated.x), static_cast<int>(neighbor_offset_rotated.y));
 
 		int2 neighbor_pixel_coords;
+#if KernelDiagnostics == KERNEL_OPTION_TRUE
 		if (render_data.render_settings.restir_di_settings.spatial_pass.debug_neighbor_location)
 			neighbor_pixel_coords = center_pixel_coords + make_int2(15, 0);
 		else
+#endif
 			neighbor_pixel_coords = center_pixel_coords + neighbor_offset_int;
 		if (neighbor_pixel_coords.x < 0 || neighbor_pixel_coords.x >= res.x || neighbor_pixel_coords.y < 0 || neighbor_pixel_coords.y >= res.y)
 			// Rejecting the sample if it's outside of the viewport
 			return -1;
 
+		// Only the pixels of the checkerboard written by the last pass hold a reservoir
+		neighbor_pixel_coords = ReSTIR_DI_checkerboard_snap(render_data.render_settings.restir_di_settings, neighbor_pixel_coords, res, render_data.render_settings.restir_di_settings.spatial_pass.input_checkerboard_parity);
 		neighbor_pixel_index = neighbor_pixel_coords.x + neighbor_pixel_coords.y * res.x;
+		if (render_data.aux_buffers.pixel_status[neighbor_pixel_index].is_ReSTIR_DI_fallback())
+			// The ReSTIR DI passes don't run on that neighbor anymore, its reservoir is outdated
+			return -1;
+
 		if (render_data.render_settings.enable_adaptive_sampling && render_data.render_settings.sample_number >= render_data.render_settings.adaptive_sampling_min_samples)
 		{
 			// If adaptive sampling is enabled, we only want to reuse a converged neighbor if the user allowed it
@@ -347,12 +523,12 @@ HIPRT_HOST_DEVICE HIPRT_INLINE int get_spatial_neighbor_pixel_index(const HIPRTR
 					// We didn't pass the probability check, we are not allowed to reuse the neighbor if it
 					// has converged
 
-					if (render_data.aux_buffers.pixel_converged_sample_count[neighbor_pixel_index] != -1)
+					if (render_data.aux_buffers.pixel_status[neighbor_pixel_index].is_converged())
 						// The neighbor is indeed converged, returning invalid neighbor with -1
 						return -1;
 				}
 			}
-			else if (render_data.aux_buffers.pixel_converged_sample_count[neighbor_pixel_index] != -1)
+			else if (render_data.aux_buffers.pixel_status[neighbor_pixel_index].is_converged())
 				// The user doesn't allow reusing converged neighbors and the neighbor is indeed converged
 				// Returning -1 for invalid neighbor
 				return -1;
@@ -389,7 +565,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void count_valid_spatial_neighbors(const HIPRTRen
 			// Neighbor out of the viewport / invalid
 			continue;
 
-		if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal))
+		if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_surface))
 			continue;
 
 		out_valid_neighbor_M_sum += render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index].M;
@@ -422,16 +598,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE int2 apply_permutation_sampling(int2 pixel_positi
  */
 HIPRT_HOST_DEVICE HIPRT_INLINE int3 find_temporal_neighbor_index(const HIPRTRenderData& render_data, const float3& current_shading_point, const float3& current_normal, int2 resolution, int center_pixel_index, Xorshift32Generator& random_number_generator)
 {
-	float3 previous_screen_space_point_xyz = matrix_X_point(render_data.prev_camera.view_projection, current_shading_point);
-	float2 previous_screen_space_point = make_float2(previous_screen_space_point_xyz.x, previous_screen_space_point_xyz.y);
-
-	// Bringing back in [0, 1] from [-1, 1]
-	previous_screen_space_point += make_float2(1.0f, 1.0f);
-	previous_screen_space_point *= make_float2(0.5f, 0.5f);
-
-	float2 prev_pixel_float = make_float2(previous_screen_space_point.x * resolution.x, previous_screen_space_point.y * resolution.y);
-	// Bringing back in the center of the pixel
-	prev_pixel_float -= make_float2(0.5f, 0.5f);
+	// Back-projected by the camera rays, see GBuffer::motion_vectors
+	float2 prev_pixel_float = render_data.g_buffer.get_previous_position(center_pixel_index);
 
 	// We're going to randomly look for an acceptable neighbor around the back-projected pixel location to find
 	// in a given radius
@@ -454,6 +622,9 @@ HIPRT_HOST_DEVICE HIPRT_INLINE int3 find_temporal_neighbor_index(const HIPRTRend
 			// Previous pixel is out of the current viewport
 			continue;
 
+		// Last frame, the ReSTIR DI passes ran on the other half of the checkerboard
+		temporal_neighbor_screen_pixel_pos = ReSTIR_DI_checkerboard_snap(render_data.render_settings.restir_di_settings, temporal_neighbor_screen_pixel_pos, resolution, render_data.render_settings.restir_di_settings.checkerboard_parity ^ 1);
+
 		temporal_neighbor_index = temporal_neighbor_screen_pixel_pos.x + temporal_neighbor_screen_pixel_pos.y * resolution.x;
 
 		// We always want to read from the previous frame g-buffer for temporal neighbors
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RESTIR_GI_RESERVOIR_H
+#define DEVICE_RESTIR_GI_RESERVOIR_H
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * A ReSTIR GI sample is the second vertex of a path, as in
+ * [ReSTIR GI: Path Resampling for Real-Time Path Tracing, Ouyang et al., 2021]
+ *
+ * The sample is reconnected to the visible point of the pixel that reuses it (reconnection shift)
+ * so the radiance that the second vertex scatters towards the visible point is assumed to not depend
+ * on the visible point. This is only exact for diffuse second vertices but that is the usual approximation
+ */
+struct ReSTIRGISample
+{
+    float3 sample_point = { 0.0f, 0.0f, 0.0f };
+    float3 sample_normal = { 0.0f, 0.0f, 0.0f };
+    // Radiance that leaves 'sample_point' towards the visible point of the
+    // pixel that traced the path (emission + everything that the rest of the path gathered)
+    ColorRGB32F outgoing_radiance;
+
+    float target_function = 0.0f;
+
+    // True if the path escaped to the sky after the visible point. 'sample_point' is then a
+    // point very far along the direction of the sky and the samples have no jacobian
+    bool sky_sample = false;
+};
+
+struct ReSTIRGIReservoir
+{
+    HIPRT_HOST_DEVICE void add_one_candidate(ReSTIRGISample new_sample, float weight, Xorshift32Generator& random_number_generator)
+    {
+        M++;
+        weight_sum += weight;
+
+        if (random_number_generator() < weight / weight_sum)
+            sample = new_sample;
+    }
+
+    /**
+     * Same as ReSTIRDIReservoir::combine_with(). 'jacobian_determinant' converts the
+     * solid angle UCW of 'other_reservoir' to the solid angle at the visible point of 'this' reservoir
+     */
+    HIPRT_HOST_DEVICE bool combine_with(ReSTIRGIReservoir other_reservoir, float mis_weight, float target_function, float jacobian_determinant, Xorshift32Generator& random_number_generator)
+    {
+        M += other_reservoir.M;
+        if (other_reservoir.UCW <= 0.0f)
+            // Not going to be resampled anyways because of invalid UCW so quit exit
+            return false;
+
+        float reservoir_sample_weight = mis_weight * target_function * other_reservoir.UCW * jacobian_determinant;
+        weight_sum += reservoir_sample_weight;
+
+        if (random_number_generator() < reservoir_sample_weight / weight_sum)
+        {
+            sample = other_reservoir.sample;
+            sample.target_function = target_function;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    HIPRT_HOST_DEVICE void end_with_normalization(float normalization_numerator, float normalization_denominator)
+    {
+        if (hippt::isZERO(weight_sum) || weight_sum > 1.0e10f || hippt::isZERO(normalization_denominator) || hippt::isZERO(sample.target_function))
+            UCW = 0.0f;
+        else
+            UCW = 1.0f / sample.target_function * weight_sum * normalization_numerator / normalization_denominator;
+    }
+
+    int M = 0;
+    float weight_sum = 0.0f;
+    float UCW = 0.0f;
+
+    ReSTIRGISample sample;
+};
+
+#endif
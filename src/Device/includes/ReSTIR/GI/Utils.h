@@ -0,0 +1,121 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RESTIR_GI_UTILS_H
+#define DEVICE_RESTIR_GI_UTILS_H
+
+#include "Device/includes/Dispatcher.h"
+#include "Device/includes/Intersect.h"
+#include "Device/includes/ReSTIR/DI/Surface.h"
+// For the neighbor similarity heuristics, shared with ReSTIR DI
+#include "Device/includes/ReSTIR/DI/Utils.h"
+#include "Device/includes/ReSTIR/GI/Reservoir.h"
+#include "Device/includes/Sampling.h"
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+
+// How far along the sky direction the sample point of the samples that escaped to the sky is
+#define RESTIR_GI_SKY_SAMPLE_DISTANCE 1.0e6f
+
+/**
+ * Target function of ReSTIR GI: the luminance of the radiance reflected at 'surface'
+ * towards the camera by the sample (BSDF * outgoing radiance of the sample * cosine).
+ *
+ * No visibility: the final shading traces it instead (see ReSTIRGISettings::do_final_shading_visibility)
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float ReSTIR_GI_evaluate_target_function(const HIPRTRenderData& render_data, const ReSTIRGISample& sample, const ReSTIRDISurface& surface)
+{
+	if (sample.outgoing_radiance.is_black())
+		return 0.0f;
+
+	float3 sample_direction = hippt::normalize(sample.sample_point - surface.shading_point);
+	float cosine_term = hippt::max(0.0f, hippt::dot(surface.shading_normal, sample_direction));
+	if (hippt::isZERO(cosine_term))
+		return 0.0f;
+
+	float bsdf_pdf;
+	RayVolumeState trash_volume_state = surface.ray_volume_state;
+	ColorRGB32F bsdf_color = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, surface.material, trash_volume_state, surface.view_direction, surface.shading_normal, sample_direction, bsdf_pdf);
+
+	return (bsdf_color * sample.outgoing_radiance * cosine_term).luminance();
+}
+
+/**
+ * Jacobian determinant of the reconnection shift of the sample of a neighbor (whose visible point
+ * is 'neighbor_shading_point') to the visible point of the center pixel
+ *
+ * Returns -1.0f if the jacobian is above the rejection threshold of the settings (or below its inverse),
+ * the neighbor must not be reused in this case
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float ReSTIR_GI_get_jacobian_determinant(const HIPRTRenderData& render_data, const ReSTIRGISample& neighbor_sample, const float3& center_pixel_shading_point, const float3& neighbor_shading_point)
+{
+	if (neighbor_sample.sky_sample)
+		// A direction, the solid angle at the center and at the neighbor is the same
+		return 1.0f;
+
+	float distance_at_center;
+	float distance_at_neighbor;
+	float3 to_center_direction = center_pixel_shading_point - neighbor_sample.sample_point;
+	float3 to_neighbor_direction = neighbor_shading_point - neighbor_sample.sample_point;
+	to_center_direction /= (distance_at_center = hippt::length(to_center_direction));
+	to_neighbor_direction /= (distance_at_neighbor = hippt::length(to_neighbor_direction));
+
+	float cosine_at_center = hippt::abs(hippt::dot(to_center_direction, neighbor_sample.sample_normal));
+	float cosine_at_neighbor = hippt::abs(hippt::dot(to_neighbor_direction, neighbor_sample.sample_normal));
+
+	float cosine_ratio = cosine_at_center / cosine_at_neighbor;
+	float distance_squared_ratio = (distance_at_neighbor * distance_at_neighbor) / (distance_at_center * distance_at_center);
+
+	float jacobian = cosine_ratio * distance_squared_ratio;
+
+	float jacobian_threshold = render_data.render_settings.restir_gi_settings.jacobian_rejection_threshold;
+	if (jacobian > jacobian_threshold || jacobian < 1.0f / jacobian_threshold || hippt::isNaN(jacobian))
+		return -1.0f;
+	else
+		return jacobian;
+}
+
+/**
+ * Back-projects the visible point of the center pixel in the previous frame and returns the index
+ * of the pixel there if it passes the neighbor similarity heuristics (against the previous frame G-buffer),
+ * -1 otherwise
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int ReSTIR_GI_find_temporal_neighbor_index(const HIPRTRenderData& render_data, const ReSTIRDISurface& center_pixel_surface, int center_pixel_index, int2 resolution)
+{
+	// Back-projected by the camera rays, see GBuffer::motion_vectors
+	float2 previous_position = render_data.g_buffer.get_previous_position(center_pixel_index);
+	int2 temporal_neighbor_pixel_pos = make_int2(round(previous_position.x), round(previous_position.y));
+	if (temporal_neighbor_pixel_pos.x < 0 || temporal_neighbor_pixel_pos.x >= resolution.x || temporal_neighbor_pixel_pos.y < 0 || temporal_neighbor_pixel_pos.y >= resolution.y)
+		// Previous pixel is out of the current viewport
+		return -1;
+
+	int temporal_neighbor_index = temporal_neighbor_pixel_pos.x + temporal_neighbor_pixel_pos.y * resolution.x;
+	// The previous frame G-buffer is deallocated when accumulating, the
+	// camera isn't moving then and the current G-buffer is the same
+	bool use_previous_frame_g_buffer = render_data.render_settings.use_prev_frame_g_buffer();
+	if (!check_neighbor_similarity_heuristics(render_data, temporal_neighbor_index, center_pixel_surface, use_previous_frame_g_buffer))
+		return -1;
+
+	return temporal_neighbor_index;
+}
+
+/**
+ * Index of a random pixel in the spatial reuse radius around the center pixel, -1 if
+ * that pixel is outside of the viewport or is the center pixel
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int ReSTIR_GI_get_spatial_neighbor_pixel_index(const HIPRTRenderData& render_data, int2 center_pixel_coords, int2 resolution, Xorshift32Generator& random_number_generator)
+{
+	float2 offset = sample_in_disk(render_data.render_settings.restir_gi_settings.spatial_pass.reuse_radius, random_number_generator);
+	int2 neighbor_pixel_coords = center_pixel_coords + make_int2(static_cast<int>(offset.x), static_cast<int>(offset.y));
+	if (neighbor_pixel_coords.x < 0 || neighbor_pixel_coords.x >= resolution.x || neighbor_pixel_coords.y < 0 || neighbor_pixel_coords.y >= resolution.y)
+		return -1;
+	else if (neighbor_pixel_coords.x == center_pixel_coords.x && neighbor_pixel_coords.y == center_pixel_coords.y)
+		return -1;
+
+	return neighbor_pixel_coords.x + neighbor_pixel_coords.y * resolution.x;
+}
+
+#endif
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RUNTIME_OPTIONS_H
+#define DEVICE_RUNTIME_OPTIONS_H
+
+#include "HostDeviceCommon/KernelOptions.h"
+
+/**
+ * Value of an option macro that can be toggled without recompiling the kernels.
+ * 
+ * The value is read from 'render_settings.runtime_kernel_options.runtime_member' if the kernel is
+ * compiled with KernelOptionsRuntimeBranches, from the macro otherwise. The value is then a compile-time
+ * constant and the branches on it are removed by the compiler, which yields the same code as an #if.
+ * 
+ * Example:
+ * 
+ *		if (RUNTIME_KERNEL_OPTION(render_data.render_settings, EnvmapSamplingDoBSDFMIS, envmap_sampling_do_bsdf_mis) == KERNEL_OPTION_TRUE)
+ * 
+ * The option macro must still be named in the kernel code (and not only in this file) so that
+ * the GPUKernelCompiler sees that the kernel uses that option macro
+ */
+#if KernelOptionsRuntimeBranches == KERNEL_OPTION_TRUE
+#define RUNTIME_KERNEL_OPTION(render_settings, option_macro, runtime_member) ((render_settings).runtime_kernel_options.runtime_member)
+#else
+#define RUNTIME_KERNEL_OPTION(render_settings, option_macro, runtime_member) (option_macro)
+#endif
+
+#endif
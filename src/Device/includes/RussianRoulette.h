@@ -0,0 +1,87 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RUSSIAN_ROULETTE_H
+#define DEVICE_RUSSIAN_ROULETTE_H
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/RayStatistics.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Randomly terminates the path after the throughput of its next bounce has been computed.
+ *
+ * The path survives with a probability equal to the largest component of its throughput,
+ * clamped to [russian_roulette_min_survival_probability, 1]: paths that can't carry much
+ * light anymore are likely to be terminated. The throughput of the surviving paths is divided
+ * by the survival probability to keep the estimator unbiased.
+ *
+ * Returns true if the path should be terminated
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool russian_roulette_terminate(const HIPRTRenderData& render_data, int bounce, ColorRGB32F& throughput, Xorshift32Generator& random_number_generator)
+{
+    if (!render_data.render_settings.do_russian_roulette || bounce < render_data.render_settings.russian_roulette_min_bounce)
+        return false;
+
+    float max_throughput = hippt::max(throughput.r, hippt::max(throughput.g, throughput.b));
+    float survival_probability = hippt::clamp(render_data.render_settings.russian_roulette_min_survival_probability, 1.0f, max_throughput);
+    if (random_number_generator() > survival_probability)
+        return true;
+
+    throughput /= survival_probability;
+
+    return false;
+}
+
+/**
+ * Russian roulette on the shadow ray of a light sample at 'distance_to_light' of the shading point.
+ *
+ * Beyond shadow_rays_roulette_distance, the light sample survives with the probability
+ * (shadow_rays_roulette_distance / distance_to_light)^2, clamped to [shadow_rays_roulette_min_survival_probability, 1]:
+ * this follows the falloff of the contribution of the light with the distance so the far away light samples,
+ * which contribute little but whose shadow rays are the longest to traverse, are the most likely to be discarded.
+ *
+ * Returns 0.0f if the light sample is discarded (its shadow ray shouldn't be traced). Otherwise, returns the
+ * weight (1 / survival probability) that the contribution of the light sample must be multiplied by to keep
+ * the estimator unbiased
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float shadow_ray_distance_roulette(const HIPRTRenderData& render_data, float distance_to_light, Xorshift32Generator& random_number_generator)
+{
+    float roulette_distance = render_data.render_settings.shadow_rays_roulette_distance;
+    if (roulette_distance <= 0.0f || distance_to_light <= roulette_distance)
+        return 1.0f;
+
+    float distance_ratio = roulette_distance / distance_to_light;
+    float survival_probability = hippt::max(render_data.render_settings.shadow_rays_roulette_min_survival_probability, distance_ratio * distance_ratio);
+    if (random_number_generator() > survival_probability)
+        return 0.0f;
+
+    return 1.0f / survival_probability;
+}
+
+/**
+ * Counts one more path for which 'event' happened at the bounce 'bounce' in aux_buffers.bounce_active_ray_counts.
+ *
+ * Only counts on the last sample of the frame (do_update_status_buffers) so that the
+ * counts are those of one sample, whatever the number of samples per frame
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void count_bounce_path_event(const HIPRTRenderData& render_data, int bounce, BouncePathEvent event)
+{
+    if (render_data.aux_buffers.bounce_active_ray_counts == nullptr || !render_data.render_settings.do_update_status_buffers)
+        return;
+
+    hippt::aggregated_atomic_add(&render_data.aux_buffers.bounce_active_ray_counts[bounce * BOUNCE_PATH_EVENT_COUNT + event], 1u);
+}
+
+/**
+ * Counts one more ray traced at the bounce 'bounce'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void count_bounce_active_ray(const HIPRTRenderData& render_data, int bounce)
+{
+    count_bounce_path_event(render_data, bounce, BOUNCE_PATH_ALIVE);
+}
+
+#endif
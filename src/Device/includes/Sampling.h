@@ -13,6 +13,34 @@
 #include "HostDeviceCommon/Material.h"
 #include "HostDeviceCommon/Xorshift.h"
 
+/**
+ * Samples an index in [0, element_count - 1] from the alias table given
+ * by 'alias_table_probas' and 'alias_table_alias' (see Utils::compute_alias_table())
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int sample_alias_table(const float* alias_table_probas, const int* alias_table_alias, int element_count, Xorshift32Generator& random_number_generator)
+{
+    int random_index = random_number_generator.random_index(element_count);
+    if (random_number_generator() > alias_table_probas[random_index])
+        // Picking the alias
+        random_index = alias_table_alias[random_index];
+
+    return random_index;
+}
+
+/**
+ * Same as above but the probabilities of the alias table are
+ * 16-bit unsigned normalized integers
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int sample_alias_table(const unsigned short* alias_table_probas, const int* alias_table_alias, int element_count, Xorshift32Generator& random_number_generator)
+{
+    int random_index = random_number_generator.random_index(element_count);
+    if (random_number_generator() > alias_table_probas[random_index] * (1.0f / 65535.0f))
+        // Picking the alias
+        random_index = alias_table_alias[random_index];
+
+    return random_index;
+}
+
 /**
  * Returns the radical inverse base 2 of a given number.
  * Used for generating 2D points following the Hammersley point set
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_SANITY_CHECK_H
+#define DEVICE_SANITY_CHECK_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/RayPayload.h"
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/RenderData.h"
+
+#ifndef __KERNELCC__
+#include "Utils/Utils.h" // For debugbreak in sanity_check()
+
+// For logging stuff on the CPU and avoid everything being mixed
+// up in the terminal because of multithreading.
+// Inline because the kernels are included by several translation units (CPURenderer, CPUKernelExecutor)
+#include <mutex>
+inline std::mutex g_mutex;
+#endif
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void debug_set_final_color(const HIPRTRenderData& render_data, int x, int y, int res_x, ColorRGB32F final_color)
+{
+    if (render_data.render_settings.sample_number == 0)
+        render_data.buffers.pixels[y * res_x + x] = final_color;
+    else
+        render_data.buffers.pixels[y * res_x + x] = final_color * render_data.render_settings.sample_number;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE bool check_for_negative_color(ColorRGB32F ray_color, int x, int y, int sample)
+{
+    (void)x;
+    (void)y;
+    (void)sample;
+
+    if (ray_color.r < 0 || ray_color.g < 0 || ray_color.b < 0)
+    {
+#ifndef __KERNELCC__
+        std::cout << "Negative color at [" << x << ", " << y << "], sample " << sample << std::endl;
+#endif
+
+        return true;
+    }
+
+    return false;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE bool check_for_nan(ColorRGB32F ray_color, int x, int y, int sample)
+{
+    (void)x;
+    (void)y;
+    (void)sample;
+
+    if (hippt::isNaN(ray_color.r) || hippt::isNaN(ray_color.g) || hippt::isNaN(ray_color.b))
+    {
+#ifndef __KERNELCC__
+        std::lock_guard<std::mutex> logging_lock(g_mutex);
+        std::cout << "NaN at [" << x << ", " << y << "], sample" << sample << std::endl;
+#endif
+        return true;
+    }
+
+    return false;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE bool sanity_check(const HIPRTRenderData& render_data, RayPayload& ray_payload, int x, int y, int2& res, int sample)
+{
+#if KernelDiagnostics == KERNEL_OPTION_FALSE
+    (void)render_data;
+    (void)x;
+    (void)y;
+    (void)res;
+    (void)sample;
+
+    // No logging and no NaN display, the invalid samples are only discarded so that
+    // they don't stay in the accumulation buffer forever
+    ColorRGB32F& ray_color = ray_payload.ray_color;
+    bool invalid = hippt::isNaN(ray_color.r + ray_color.g + ray_color.b) || ray_color.r < 0.0f || ray_color.g < 0.0f || ray_color.b < 0.0f;
+    if (invalid)
+        ray_color = ColorRGB32F(0.0f);
+
+    return !invalid;
+#else
+    bool invalid = false;
+    invalid |= check_for_negative_color(ray_payload.ray_color, x, y, sample);
+    invalid |= check_for_nan(ray_payload.ray_color, x, y, sample);
+
+    if (invalid)
+    {
+#ifndef __KERNELCC__
+        Utils::debugbreak();
+#endif
+
+        if (render_data.render_settings.display_NaNs)
+            debug_set_final_color(render_data, x, y, res.x, ColorRGB32F(1.0e15f, 0.0f, 1.0e15f));
+        else
+            ray_payload.ray_color = ColorRGB32F(0.0f);
+    }
+
+    return !invalid;
+#endif
+}
+
+#endif
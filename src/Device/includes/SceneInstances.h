@@ -0,0 +1,130 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_SCENE_INSTANCES_H
+#define DEVICE_SCENE_INSTANCES_H
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/MeshVertexAttributes.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/SceneInstance.h"
+
+/**
+ * Returns the index of the instance that contains the given scene primitive (see SceneInstance).
+ *
+ * The instances are sorted by increasing 'first_scene_primitive' so this is a binary search
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_scene_primitive_instance_index(const SceneInstance* instances, int instance_count, int scene_primitive_index)
+{
+    // Looking for the last instance whose first primitive is <= scene_primitive_index
+    int low = 0;
+    int high = instance_count - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+
+        if (instances[middle].first_scene_primitive <= scene_primitive_index)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    return low;
+}
+
+/**
+ * Returns the index of the triangle (in the triangle buffers of the meshes) that
+ * 'instance' places in the world as the scene primitive 'scene_primitive_index'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_scene_primitive_mesh_triangle(const SceneInstance& instance, int scene_primitive_index)
+{
+    return instance.mesh_first_triangle + scene_primitive_index - instance.first_scene_primitive;
+}
+
+/**
+ * Inverse of get_scene_primitive_mesh_triangle()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_scene_primitive_index(const SceneInstance& instance, int mesh_triangle_index)
+{
+    return instance.first_scene_primitive + mesh_triangle_index - instance.mesh_first_triangle;
+}
+
+/**
+ * Returns the world space positions of the vertices of the given scene primitive.
+ *
+ * The positions are read from 'quantized_vertices_positions' if it's not null, see get_vertex_position()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_scene_primitive_vertices(const SceneInstance* instances, int instance_count, const int* triangles_indices, const float3* vertices_positions, const unsigned short* quantized_vertices_positions, const MeshVertexAttributes* mesh_vertex_attributes, int scene_primitive_index, float3& out_vertex_A, float3& out_vertex_B, float3& out_vertex_C)
+{
+    const SceneInstance& instance = instances[get_scene_primitive_instance_index(instances, instance_count, scene_primitive_index)];
+    int triangle_index = get_scene_primitive_mesh_triangle(instance, scene_primitive_index);
+
+    out_vertex_A = matrix_X_point(instance.object_to_world, get_vertex_position(vertices_positions, quantized_vertices_positions, mesh_vertex_attributes, instance.mesh_index, triangles_indices[triangle_index * 3 + 0]));
+    out_vertex_B = matrix_X_point(instance.object_to_world, get_vertex_position(vertices_positions, quantized_vertices_positions, mesh_vertex_attributes, instance.mesh_index, triangles_indices[triangle_index * 3 + 1]));
+    out_vertex_C = matrix_X_point(instance.object_to_world, get_vertex_position(vertices_positions, quantized_vertices_positions, mesh_vertex_attributes, instance.mesh_index, triangles_indices[triangle_index * 3 + 2]));
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_scene_primitive_vertices(const HIPRTRenderData& render_data, int scene_primitive_index, float3& out_vertex_A, float3& out_vertex_B, float3& out_vertex_C)
+{
+    get_scene_primitive_vertices(render_data.buffers.instances, render_data.buffers.instance_count, render_data.buffers.triangles_indices, render_data.buffers.vertices_positions, render_data.buffers.quantized_vertices_positions, render_data.buffers.mesh_vertex_attributes, scene_primitive_index, out_vertex_A, out_vertex_B, out_vertex_C);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_scene_primitive_material_index(const SceneInstance* instances, int instance_count, const int* material_indices, int scene_primitive_index)
+{
+    const SceneInstance& instance = instances[get_scene_primitive_instance_index(instances, instance_count, scene_primitive_index)];
+
+    return material_indices[get_scene_primitive_mesh_triangle(instance, scene_primitive_index)];
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_scene_primitive_material_index(const HIPRTRenderData& render_data, int scene_primitive_index)
+{
+    return get_scene_primitive_material_index(render_data.buffers.instances, render_data.buffers.instance_count, render_data.buffers.material_indices, scene_primitive_index);
+}
+
+/**
+ * Whether the hits of the instance 'instance_index' are on the analytic spheres of the
+ * scene, see RenderBuffers::spheres. The SceneInstance of that instance is unused
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool is_sphere_instance(const HIPRTRenderData& render_data, int instance_index)
+{
+    return instance_index == render_data.buffers.sphere_instance_index;
+}
+
+/**
+ * Whether the instance 'instance_index' of the BVH is a level of detail of an instance of a mesh, see
+ * HostDeviceCommon/GeometryLOD.h. The LOD instances are after the instance of the spheres, their
+ * SceneInstance places the triangles of the LOD in the world but they have no scene primitives
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool is_geometry_lod_instance(const HIPRTRenderData& render_data, int instance_index)
+{
+    return instance_index >= render_data.buffers.instance_count && !is_sphere_instance(render_data, instance_index);
+}
+
+/**
+ * Returns the index of the triangle (in the triangle buffers of the meshes) of a hit
+ * returned by the traversal of the scene.
+ *
+ * 'hit.primID' is the index of the triangle in the mesh of the instance 'hit.instanceID'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_hit_mesh_triangle(const HIPRTRenderData& render_data, const hiprtHit& hit)
+{
+    return render_data.buffers.instances[hit.instanceID].mesh_first_triangle + hit.primID;
+}
+
+/**
+ * Fills 'hit.instanceID' and 'hit.primID' like the traversal of the scene would
+ * for a hit on the given scene primitive.
+ *
+ * Used by the CPU BVH which is built over the scene primitives directly
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void set_hit_scene_primitive(const HIPRTRenderData& render_data, int scene_primitive_index, hiprtHit& hit)
+{
+    int instance_index = get_scene_primitive_instance_index(render_data.buffers.instances, render_data.buffers.instance_count, scene_primitive_index);
+
+    hit.instanceID = instance_index;
+    hit.primID = scene_primitive_index - render_data.buffers.instances[instance_index].first_scene_primitive;
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_SIMPLIFIED_BSDF_H
+#define DEVICE_SIMPLIFIED_BSDF_H
+
+#include "Device/includes/Disney.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/ONB.h"
+#include "Device/includes/RayPayload.h"
+#include "Device/includes/Sampling.h"
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Lambertian diffuse + single GGX specular lobe used instead of the Disney BSDF for the
+ * deep bounces when DeepBouncesSimplifiedBSDF is KERNEL_OPTION_TRUE.
+ *
+ * The GGX lobe is the metallic lobe of the Disney BSDF (same fresnel so the energy is close)
+ * but without the rotated frame of the anisotropy. The clearcoat, sheen and fake subsurface
+ * lobes are dropped. Glass materials never use this BSDF, see use_simplified_bsdf()
+ *
+ * As for the Disney BSDF, the cosine term isn't included
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F simplified_bsdf_eval(const SimplifiedRendererMaterial& material, const float3& view_direction, float3 shading_normal, const float3& to_light_direction, float& pdf)
+{
+    pdf = 0.0f;
+
+    if (hippt::dot(view_direction, shading_normal) < 0)
+        // Normal in the same hemisphere as the view direction, see disney_bsdf_eval()
+        shading_normal = -shading_normal;
+
+    if (hippt::dot(to_light_direction, shading_normal) <= 0.0f)
+        // Only reflective lobes
+        return ColorRGB32F(0.0f);
+
+    float3 T, B;
+    build_ONB(shading_normal, T, B);
+    float3 local_view_direction = world_to_local_frame(T, B, shading_normal, view_direction);
+    float3 local_to_light_direction = world_to_local_frame(T, B, shading_normal, to_light_direction);
+    float3 local_half_vector = hippt::normalize(local_view_direction + local_to_light_direction);
+
+    float diffuse_weight = 1.0f - material.metallic;
+    float diffuse_proba = diffuse_weight / (diffuse_weight + 1.0f);
+    float specular_proba = 1.0f - diffuse_proba;
+
+    ColorRGB32F final_color = ColorRGB32F(0.0f);
+    if (diffuse_weight > 0.0f)
+    {
+        final_color += diffuse_weight * material.base_color * M_INV_PI;
+        pdf += local_to_light_direction.z * M_INV_PI * diffuse_proba;
+    }
+
+    float specular_pdf;
+    ColorRGB32F F = disney_metallic_fresnel(material, local_half_vector, local_to_light_direction);
+    final_color += disney_metallic_eval(material, local_view_direction, local_to_light_direction, local_half_vector, F, specular_pdf);
+    pdf += specular_pdf * specular_proba;
+
+    return final_color;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F simplified_bsdf_sample(const SimplifiedRendererMaterial& material, RayVolumeState& ray_volume_state, const float3& view_direction, const float3& shading_normal, const float3& geometric_normal, float3& output_direction, float& pdf, Xorshift32Generator& random_number_generator)
+{
+    pdf = 0.0f;
+
+    float3 normal = shading_normal;
+    if (hippt::dot(view_direction, normal) < 0)
+        // Same quick fix for the view direction below the shading normal
+        // as in disney_bsdf_sample()
+        normal = reflect_ray(shading_normal, geometric_normal);
+    if (hippt::dot(view_direction, normal) < 0)
+        normal = -normal;
+
+    // Both lobes are reflective
+    ray_volume_state.interior_stack.pop(false);
+
+    float diffuse_weight = 1.0f - material.metallic;
+    float diffuse_proba = diffuse_weight / (diffuse_weight + 1.0f);
+    if (random_number_generator() < diffuse_proba)
+        output_direction = cosine_weighted_sample(normal, random_number_generator);
+    else
+    {
+        float3 T, B;
+        build_ONB(normal, T, B);
+        float3 local_view_direction = world_to_local_frame(T, B, normal, view_direction);
+        output_direction = local_to_world_frame(T, B, normal, disney_metallic_sample(material, local_view_direction, random_number_generator));
+    }
+
+    if (hippt::dot(output_direction, shading_normal) < 0)
+        return ColorRGB32F(0.0f);
+
+    return simplified_bsdf_eval(material, view_direction, shading_normal, output_direction, pdf);
+}
+
+/**
+ * Switches 'material' to the simplified BSDF if DeepBouncesSimplifiedBSDF is enabled and 'bounce'
+ * is at least 'render_settings.simplified_bsdf_start_bounce'.
+ *
+ * Materials with some specular transmission keep their BSDF: the refractions
+ * and the nested dielectrics can't be approximated by the reflective lobes
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void use_simplified_bsdf(const HIPRTRenderData& render_data, SimplifiedRendererMaterial& material, int bounce)
+{
+#if DeepBouncesSimplifiedBSDF == KERNEL_OPTION_TRUE
+    if (bounce >= render_data.render_settings.simplified_bsdf_start_bounce && material.specular_transmission == 0.0f)
+        material.brdf_type = BRDF::SimplifiedLambertGGX;
+#else
+    (void)render_data;
+    (void)material;
+    (void)bounce;
+#endif
+}
+
+#endif
@@ -10,9 +10,11 @@
 
 #include "HostDeviceCommon/Color.h"
 #include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/RGB9E5.h"
 
 #ifndef __KERNELCC__
 #include "Image/Image.h"
+#include "Image/TiledTexture.h"
 #endif
 
 #ifdef __KERNELCC__
@@ -57,6 +59,8 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGBA32F sample_texture_rgba(const void* text
     // sRGB to linear conversion
     // Doing the conversion manually instead of using the hardware
     // because it's unavailable in Orochi (again) :(
+    // The GPU renderer can store the sRGB textures already converted
+    // instead, see SceneParserOptions::linearize_srgb_textures
     if (is_srgb)
         return pow(rgba, 2.2f);
     else
@@ -77,8 +81,241 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_texture_rgb_32bits(const void*
     return ColorRGB32F(rgba.r, rgba.g, rgba.b);
 }
 
+/**
+ * Dimensions of the given mip level of a texture whose full resolution is 'texture_dims'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int2 get_mip_level_dims(int2 texture_dims, int level)
+{
+    int width = texture_dims.x >> level;
+    int height = texture_dims.y >> level;
+
+    return make_int2(width > 0 ? width : 1, height > 0 ? height : 1);
+}
+
+/**
+ * Bilinearly samples the given mip level of a virtual texture in repeat mode.
+ *
+ * If the tile that contains the texels isn't resident, it is requested through the feedback
+ * buffer and the next coarser level is tried until a resident tile is found. The coarsest level
+ * is always resident.
+ *
+ * Same texel coordinates convention as sample_texture_rgb9e5()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGBA32F sample_virtual_texture_rgba(const VirtualTexturingBuffers& virtual_textures, int texture_index, bool is_srgb, float2 uv, int level)
+{
+    const VirtualTextureDesc& texture = virtual_textures.textures[texture_index];
+
+    float u = uv.x - static_cast<int>(uv.x);
+    float v = uv.y - static_cast<int>(uv.y);
+    u = u < 0 ? 1.0f + u : u;
+    v = v < 0 ? 1.0f + v : v;
+    v = 1.0f - v;
+
+    // The levels coarser than the tail tile aren't stored
+    if (level > texture.level_count - 1)
+        level = texture.level_count - 1;
+
+    for (; level < texture.level_count; level++)
+    {
+        int2 level_dims = get_mip_level_dims(texture.dims, level);
+
+        float x = u * (level_dims.x - 1) - 0.5f;
+        float y = v * (level_dims.y - 1) - 0.5f;
+        float x_floor = floor(x);
+        float y_floor = floor(y);
+        float fractional_x = x - x_floor;
+        float fractional_y = y - y_floor;
+
+        int x0 = (static_cast<int>(x_floor) + level_dims.x) % level_dims.x;
+        int y0 = (static_cast<int>(y_floor) + level_dims.y) % level_dims.y;
+
+        int tiles_per_row = (level_dims.x + VirtualTextureTile::TILE_SIZE - 1) / VirtualTextureTile::TILE_SIZE;
+        int page = texture.first_pages[level] + (y0 / VirtualTextureTile::TILE_SIZE) * tiles_per_row + x0 / VirtualTextureTile::TILE_SIZE;
+
+        // Reading first to avoid writing to the same cache lines from all the threads
+        if (virtual_textures.feedback[page] == 0)
+            virtual_textures.feedback[page] = 1;
+
+        int tile_index = virtual_textures.page_table[page];
+        if (tile_index < 0)
+            continue;
+
+        // The +1 texels are in the border of the tile
+        int tile_x = x0 % VirtualTextureTile::TILE_SIZE;
+        int tile_y = y0 % VirtualTextureTile::TILE_SIZE;
+        const unsigned int* texels = virtual_textures.tile_pool[tile_index].texels + tile_y * VirtualTextureTile::TILE_STRIDE + tile_x;
+
+        ColorRGBA32F texel_00 = ColorRGBA32F::from_rgba8(texels[0]);
+        ColorRGBA32F texel_10 = ColorRGBA32F::from_rgba8(texels[1]);
+        ColorRGBA32F texel_01 = ColorRGBA32F::from_rgba8(texels[VirtualTextureTile::TILE_STRIDE]);
+        ColorRGBA32F texel_11 = ColorRGBA32F::from_rgba8(texels[VirtualTextureTile::TILE_STRIDE + 1]);
+
+        ColorRGBA32F bottom = texel_00 * (1.0f - fractional_x) + texel_10 * fractional_x;
+        ColorRGBA32F top = texel_01 * (1.0f - fractional_x) + texel_11 * fractional_x;
+        ColorRGBA32F rgba = bottom * (1.0f - fractional_y) + top * fractional_y;
+
+        if (is_srgb)
+            return pow(rgba, 2.2f);
+        else
+            return rgba;
+    }
+
+    // Only reached if the tail tile of the texture isn't resident, which shouldn't happen
+    return ColorRGBA32F(1.0f, 0.0f, 1.0f, 1.0f);
+}
+
+/**
+ * Samples the material texture 'texture_index' at the mip level matching 'texture_footprint', the size
+ * of the footprint of the ray cone in texture coordinates space (see get_texture_footprint()).
+ * The two closest mip levels are blended.
+ * 
+ * A footprint of 0.0f samples the full resolution level. The material textures of the
+ * CPU renderer are TiledTextures, with the same mip chains
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGBA32F sample_material_texture_rgba(const HIPRTRenderData& render_data, int texture_index, bool is_srgb, float2 uv, float texture_footprint)
+{
+    int2 texture_dims = render_data.buffers.textures_dims[texture_index];
+
+#ifdef __KERNELCC__
+    float level = 0.0f;
+#if MaterialTexturesRayConesLOD == KERNEL_OPTION_TRUE
+    // log2 of the number of texels of the full resolution level covered by the footprint
+    level = hippt::max(0.0f, log2f(texture_footprint * sqrtf(static_cast<float>(texture_dims.x) * texture_dims.y)));
+#endif
+
+    if (render_data.buffers.virtual_textures.textures != nullptr)
+        // No blending between the levels of the virtual textures, that would
+        // be twice as many tiles to keep resident
+        return sample_virtual_texture_rgba(render_data.buffers.virtual_textures, texture_index, is_srgb, uv, static_cast<int>(level + 0.5f));
+
+    if (render_data.buffers.linearized_srgb_textures)
+        // The scene was loaded with SceneParserOptions::linearize_srgb_textures,
+        // the sRGB textures are already linear (see OrochiTexture::init_from_srgb_image())
+        is_srgb = false;
+#endif
+
+#if defined(__KERNELCC__) && MaterialTexturesRayConesLOD == KERNEL_OPTION_TRUE
+    int2 mip_range = render_data.buffers.material_textures_mip_ranges[texture_index];
+    level = hippt::min(static_cast<float>(mip_range.y), level);
+
+    if (level > 0.0f)
+    {
+        int coarse_level = static_cast<int>(ceilf(level));
+        int fine_level = coarse_level - 1;
+        float coarse_weight = level - fine_level;
+
+        // The sRGB conversion is done once on the blended color
+        ColorRGBA32F fine_rgba;
+        if (fine_level == 0)
+            fine_rgba = sample_texture_rgba(render_data.buffers.material_textures, texture_index, texture_dims, false, uv);
+        else
+            fine_rgba = sample_texture_rgba(render_data.buffers.material_textures_mips, mip_range.x + fine_level - 1, get_mip_level_dims(texture_dims, fine_level), false, uv);
+        ColorRGBA32F coarse_rgba = sample_texture_rgba(render_data.buffers.material_textures_mips, mip_range.x + coarse_level - 1, get_mip_level_dims(texture_dims, coarse_level), false, uv);
+
+        ColorRGBA32F rgba = fine_rgba * (1.0f - coarse_weight) + coarse_rgba * coarse_weight;
+        if (is_srgb)
+            return pow(rgba, 2.2f);
+        else
+            return rgba;
+    }
+#endif
+
+#ifdef __KERNELCC__
+    return sample_texture_rgba(render_data.buffers.material_textures, texture_index, texture_dims, is_srgb, uv);
+#else
+    float level = 0.0f;
+#if MaterialTexturesRayConesLOD == KERNEL_OPTION_TRUE
+    level = hippt::max(0.0f, log2f(texture_footprint * sqrtf(static_cast<float>(texture_dims.x) * texture_dims.y)));
+#endif
+
+    // The sRGB conversion is done once on the filtered color, as on the GPU
+    ColorRGBA32F rgba = reinterpret_cast<const TiledTexture*>(render_data.buffers.material_textures)[texture_index].sample_rgba32f(uv, level);
+    if (is_srgb)
+        return pow(rgba, 2.2f);
+    else
+        return rgba;
+#endif
+}
+
+/**
+ * Computes the indices of the 4 texels and the bilinear weights for sampling a texture
+ * stored in a buffer in repeat mode.
+ * 
+ * The texel coordinates follow the same convention as sample_texture_rgba() on the GPU
+ * so that the result matches a hardware filtered texture
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void get_bilinear_texels(int2 texture_dims, float2 uv, int& out_texel_00, int& out_texel_10, int& out_texel_01, int& out_texel_11, float& out_fractional_x, float& out_fractional_y)
+{
+    float u = uv.x - static_cast<int>(uv.x);
+    float v = uv.y - static_cast<int>(uv.y);
+    u = u < 0 ? 1.0f + u : u;
+    v = v < 0 ? 1.0f + v : v;
+    v = 1.0f - v;
+
+    // -0.5f because the hardware filters around the center of the texels
+    float x = u * (texture_dims.x - 1) - 0.5f;
+    float y = v * (texture_dims.y - 1) - 0.5f;
+    float x_floor = floor(x);
+    float y_floor = floor(y);
+    out_fractional_x = x - x_floor;
+    out_fractional_y = y - y_floor;
+
+    int x0 = (static_cast<int>(x_floor) + texture_dims.x) % texture_dims.x;
+    int y0 = (static_cast<int>(y_floor) + texture_dims.y) % texture_dims.y;
+    int x1 = (x0 + 1) % texture_dims.x;
+    int y1 = (y0 + 1) % texture_dims.y;
+
+    out_texel_00 = y0 * texture_dims.x + x0;
+    out_texel_10 = y0 * texture_dims.x + x1;
+    out_texel_01 = y1 * texture_dims.x + x0;
+    out_texel_11 = y1 * texture_dims.x + x1;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F bilinear_interpolate(const ColorRGB32F& texel_00, const ColorRGB32F& texel_10, const ColorRGB32F& texel_01, const ColorRGB32F& texel_11, float fractional_x, float fractional_y)
+{
+    ColorRGB32F bottom = texel_00 * (1.0f - fractional_x) + texel_10 * fractional_x;
+    ColorRGB32F top = texel_01 * (1.0f - fractional_x) + texel_11 * fractional_x;
+
+    return bottom * (1.0f - fractional_y) + top * fractional_y;
+}
+
+/**
+ * Bilinearly samples a texture stored as a buffer of RGB9E5 texels in repeat mode
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_texture_rgb9e5(const unsigned int* texels, int2 texture_dims, float2 uv)
+{
+    int texel_00, texel_10, texel_01, texel_11;
+    float fractional_x, fractional_y;
+    get_bilinear_texels(texture_dims, uv, texel_00, texel_10, texel_01, texel_11, fractional_x, fractional_y);
+
+    return bilinear_interpolate(rgb9e5_decode(texels[texel_00]), rgb9e5_decode(texels[texel_10]), rgb9e5_decode(texels[texel_01]), rgb9e5_decode(texels[texel_11]), fractional_x, fractional_y);
+}
+
+/**
+ * Bilinearly samples a texture stored as a buffer of 3 floats texels in repeat mode
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_texture_rgb32f(const float* texels, int2 texture_dims, float2 uv)
+{
+    int texel_00, texel_10, texel_01, texel_11;
+    float fractional_x, fractional_y;
+    get_bilinear_texels(texture_dims, uv, texel_00, texel_10, texel_01, texel_11, fractional_x, fractional_y);
+
+    ColorRGB32F color_00 = ColorRGB32F(texels[texel_00 * 3 + 0], texels[texel_00 * 3 + 1], texels[texel_00 * 3 + 2]);
+    ColorRGB32F color_10 = ColorRGB32F(texels[texel_10 * 3 + 0], texels[texel_10 * 3 + 1], texels[texel_10 * 3 + 2]);
+    ColorRGB32F color_01 = ColorRGB32F(texels[texel_01 * 3 + 0], texels[texel_01 * 3 + 1], texels[texel_01 * 3 + 2]);
+    ColorRGB32F color_11 = ColorRGB32F(texels[texel_11 * 3 + 0], texels[texel_11 * 3 + 1], texels[texel_11 * 3 + 2]);
+
+    return bilinear_interpolate(color_00, color_10, color_01, color_11, fractional_x, fractional_y);
+}
+
 HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map_texture(const WorldSettings& world_settings, float2 uv)
 {
+#if defined(__KERNELCC__) && EnvmapStorageFormat == ESF_RGB9E5
+    // The CPU renderer always keeps the envmap in float32 so this is GPU only
+    return sample_texture_rgb9e5(reinterpret_cast<const unsigned int*>(world_settings.envmap), make_int2(world_settings.envmap_width, world_settings.envmap_height), uv) * world_settings.envmap_intensity;
+#elif defined(__KERNELCC__) && EnvmapStorageFormat == ESF_RGB32F
+    return sample_texture_rgb32f(reinterpret_cast<const float*>(world_settings.envmap), make_int2(world_settings.envmap_width, world_settings.envmap_height), uv) * world_settings.envmap_intensity;
+#else
     const void* envmap_pointer;
 #ifdef __KERNELCC__
     envmap_pointer = &world_settings.envmap;
@@ -87,6 +324,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F sample_environment_map_texture(const
 #endif
 
     return sample_texture_rgb_32bits(envmap_pointer, 0, make_int2(world_settings.envmap_width, world_settings.envmap_height), /* is_srgb */ false, uv) * world_settings.envmap_intensity;
+#endif
 }
 
 template <typename T>
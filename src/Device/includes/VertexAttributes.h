@@ -0,0 +1,82 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_VERTEX_ATTRIBUTES_H
+#define DEVICE_VERTEX_ATTRIBUTES_H
+
+#include "HostDeviceCommon/MeshVertexAttributes.h"
+#include "HostDeviceCommon/Octahedral.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/SceneInstance.h"
+
+/**
+ * Accessors of the vertex normals and texture coordinates of the meshes, see MeshVertexAttributes
+ */
+
+HIPRT_HOST_DEVICE HIPRT_INLINE const MeshVertexAttributes& get_mesh_vertex_attributes(const HIPRTRenderData& render_data, const SceneInstance& instance)
+{
+    return render_data.buffers.mesh_vertex_attributes[instance.mesh_index];
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE bool has_vertex_normals(const MeshVertexAttributes& mesh_attributes)
+{
+    return mesh_attributes.first_normal != -1;
+}
+
+/**
+ * Object space position of the vertex 'vertex_index' of the mesh of 'instance', from the
+ * quantized positions of the scene if it has them
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 get_vertex_position(const HIPRTRenderData& render_data, const SceneInstance& instance, int vertex_index)
+{
+    return get_vertex_position(render_data.buffers.vertices_positions, render_data.buffers.quantized_vertices_positions, render_data.buffers.mesh_vertex_attributes, instance.mesh_index, vertex_index);
+}
+
+/**
+ * Object space normal of the vertex 'vertex_index' of a mesh that has vertex normals
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 get_vertex_normal(const HIPRTRenderData& render_data, const MeshVertexAttributes& mesh_attributes, int vertex_index)
+{
+    return octahedral_decode_32(render_data.buffers.vertex_normals[mesh_attributes.first_normal + vertex_index - mesh_attributes.first_vertex]);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float2 get_vertex_texcoords(const HIPRTRenderData& render_data, const MeshVertexAttributes& mesh_attributes, int vertex_index)
+{
+    if (mesh_attributes.first_texcoords == -1)
+        return make_float2(0.0f, 0.0f);
+
+    int texcoords_index = mesh_attributes.first_texcoords + vertex_index - mesh_attributes.first_vertex;
+    if (render_data.buffers.texcoords_half != nullptr)
+        return texcoords_half_decode(render_data.buffers.texcoords_half[texcoords_index]);
+    else
+        return render_data.buffers.texcoords[texcoords_index];
+}
+
+/**
+ * Object space normal at the barycentric coordinates 'uv' of the triangle 'primitive_index', not normalized.
+ * Same interpolation as uv_interpolate()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 interpolate_vertex_normal(const HIPRTRenderData& render_data, const MeshVertexAttributes& mesh_attributes, int primitive_index, const float2& uv)
+{
+    float3 normal_A = get_vertex_normal(render_data, mesh_attributes, render_data.buffers.triangles_indices[primitive_index * 3 + 0]);
+    float3 normal_B = get_vertex_normal(render_data, mesh_attributes, render_data.buffers.triangles_indices[primitive_index * 3 + 1]);
+    float3 normal_C = get_vertex_normal(render_data, mesh_attributes, render_data.buffers.triangles_indices[primitive_index * 3 + 2]);
+
+    return normal_B * uv.x + normal_C * uv.y + normal_A * (1.0f - uv.x - uv.y);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float2 interpolate_vertex_texcoords(const HIPRTRenderData& render_data, const MeshVertexAttributes& mesh_attributes, int primitive_index, const float2& uv)
+{
+    if (mesh_attributes.first_texcoords == -1)
+        return make_float2(0.0f, 0.0f);
+
+    float2 texcoords_A = get_vertex_texcoords(render_data, mesh_attributes, render_data.buffers.triangles_indices[primitive_index * 3 + 0]);
+    float2 texcoords_B = get_vertex_texcoords(render_data, mesh_attributes, render_data.buffers.triangles_indices[primitive_index * 3 + 1]);
+    float2 texcoords_C = get_vertex_texcoords(render_data, mesh_attributes, render_data.buffers.triangles_indices[primitive_index * 3 + 2]);
+
+    return texcoords_B * uv.x + texcoords_C * uv.y + texcoords_A * (1.0f - uv.x - uv.y);
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_VISIBILITY_CACHE_H
+#define DEVICE_VISIBILITY_CACHE_H
+
+#include "Device/includes/Hash.h"
+#include "Device/includes/Intersect.h"
+#include "Device/includes/RayStatistics.h"
+
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * World space cache of the visibility of the envmap and of the lights, see VisibilityCacheSettings.
+ *
+ * Like the radiance cache, the cache is a hash table whose entries are the cells of a uniform grid over the
+ * scene split by the dominant axis of the normal of the surfaces. Each entry counts, for each bin of directions
+ * (same cylindrical equal-area mapping as the path guiding), how many of the shadow rays that left the cell in
+ * that bin were unoccluded. The counts of a bin are halved when they reach VisibilityCacheSettings::max_accumulated_samples
+ * so the cache progressively follows the changes of the scene.
+ *
+ * The cache is trained by the shadow rays of the envmap sampling and of the RIS light sampling and the samplers
+ * multiply their resampling target functions by the visibility of the bins: the candidates that are occluded from
+ * the nearby shading points are rarely picked and their shadow ray isn't wasted. The cached visibility only ever
+ * weights the resampling so this stays unbiased, only skipping the shadow rays (VisibilityCacheSettings::skip_occluded_shadow_rays) is biased.
+ *
+ * References:
+ * [1] [Exploiting Visibility Correlation in Direct Illumination, Clarberg, Akenine-Moller, 2008]
+ * [2] [Progressive Visibility Caching for Fast Indirect Illumination, Popov et al., 2013]
+ */
+
+#define VISIBILITY_CACHE_INVALID_ENTRY 0xFFFFFFFFu
+
+struct VisibilityCacheKey
+{
+    // Start of the probing in the hash table
+    unsigned int hash;
+    // Identifies the cell among the cells that collide in the hash table, never 0
+    unsigned int checksum;
+};
+
+HIPRT_HOST_DEVICE HIPRT_INLINE bool visibility_cache_available(const VisibilityCacheSettings& visibility_cache_settings)
+{
+    // The buffers are only allocated by the GPURenderer
+    return visibility_cache_settings.use_visibility_cache && visibility_cache_settings.keys != nullptr;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE VisibilityCacheKey visibility_cache_get_key(const VisibilityCacheSettings& visibility_cache_settings, const float3& point, const float3& normal)
+{
+    float inverse_cell_size = 1.0f / visibility_cache_settings.cell_size;
+    int cell_x = static_cast<int>(floorf(point.x * inverse_cell_size));
+    int cell_y = static_cast<int>(floorf(point.y * inverse_cell_size));
+    int cell_z = static_cast<int>(floorf(point.z * inverse_cell_size));
+
+    // Dominant axis of the normal and its sign, one of 6 values
+    float3 abs_normal = hippt::abs(normal);
+    unsigned int normal_axis;
+    if (abs_normal.x >= abs_normal.y && abs_normal.x >= abs_normal.z)
+        normal_axis = normal.x >= 0.0f ? 0 : 1;
+    else if (abs_normal.y >= abs_normal.z)
+        normal_axis = normal.y >= 0.0f ? 2 : 3;
+    else
+        normal_axis = normal.z >= 0.0f ? 4 : 5;
+
+    unsigned int hash = wang_hash(static_cast<unsigned int>(cell_x));
+    hash = wang_hash(hash ^ static_cast<unsigned int>(cell_y));
+    hash = wang_hash(hash ^ static_cast<unsigned int>(cell_z));
+    hash = wang_hash(hash ^ normal_axis);
+
+    VisibilityCacheKey key;
+    key.hash = hash;
+    key.checksum = wang_hash(hash ^ 0x9E3779B9u) | 1u;
+
+    return key;
+}
+
+/**
+ * Bin of the directions of an entry that contains the unit vector 'direction'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int visibility_cache_get_bin_index(const float3& direction)
+{
+    float u = (hippt::clamp(-1.0f, 1.0f, direction.z) + 1.0f) * 0.5f;
+    float v = (atan2f(direction.y, direction.x) + M_PI) / M_TWO_PI;
+
+    int bin_x = static_cast<int>(hippt::clamp(0.0f, VISIBILITY_CACHE_DIRECTIONAL_RESOLUTION - 1.0f, u * VISIBILITY_CACHE_DIRECTIONAL_RESOLUTION));
+    int bin_y = static_cast<int>(hippt::clamp(0.0f, VISIBILITY_CACHE_DIRECTIONAL_RESOLUTION - 1.0f, v * VISIBILITY_CACHE_DIRECTIONAL_RESOLUTION));
+
+    return bin_x + bin_y * VISIBILITY_CACHE_DIRECTIONAL_RESOLUTION;
+}
+
+/**
+ * Index in the hash table of the entry of 'key', VISIBILITY_CACHE_INVALID_ENTRY if the cell isn't in the cache
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int visibility_cache_find_entry(const VisibilityCacheSettings& visibility_cache_settings, const VisibilityCacheKey& key)
+{
+    for (unsigned int probe = 0; probe < VISIBILITY_CACHE_PROBE_COUNT; probe++)
+    {
+        unsigned int entry_index = (key.hash + probe) & (visibility_cache_settings.entry_count - 1);
+        unsigned int entry_key = visibility_cache_settings.keys[entry_index];
+        if (entry_key == key.checksum)
+            return entry_index;
+        else if (entry_key == 0u)
+            // The entries are never evicted so the cell would have been inserted here
+            return VISIBILITY_CACHE_INVALID_ENTRY;
+    }
+
+    return VISIBILITY_CACHE_INVALID_ENTRY;
+}
+
+/**
+ * Same as visibility_cache_find_entry() but inserts the cell in the cache if it isn't in it yet.
+ * VISIBILITY_CACHE_INVALID_ENTRY if the probed entries are all taken by other cells
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int visibility_cache_insert_entry(const VisibilityCacheSettings& visibility_cache_settings, const VisibilityCacheKey& key)
+{
+    for (unsigned int probe = 0; probe < VISIBILITY_CACHE_PROBE_COUNT; probe++)
+    {
+        unsigned int entry_index = (key.hash + probe) & (visibility_cache_settings.entry_count - 1);
+        unsigned int previous_key = hippt::atomic_compare_exchange(&visibility_cache_settings.keys[entry_index], 0u, key.checksum);
+        if (previous_key == 0u || previous_key == key.checksum)
+            return entry_index;
+    }
+
+    return VISIBILITY_CACHE_INVALID_ENTRY;
+}
+
+/**
+ * Counter of the bin of 'direction' of the cell of 'point' / 'normal', 0 if the cell isn't in the cache.
+ * The number of unoccluded shadow rays is in the 16 high bits, the number of shadow rays in the 16 low bits
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int visibility_cache_get_bin(const VisibilityCacheSettings& visibility_cache_settings, const float3& point, const float3& normal, const float3& direction)
+{
+    unsigned int entry_index = visibility_cache_find_entry(visibility_cache_settings, visibility_cache_get_key(visibility_cache_settings, point, normal));
+    if (entry_index == VISIBILITY_CACHE_INVALID_ENTRY)
+        return 0u;
+
+    return visibility_cache_settings.bins[entry_index * VISIBILITY_CACHE_BIN_COUNT + visibility_cache_get_bin_index(direction)];
+}
+
+/**
+ * Factor that the samplers multiply the resampling target function of a sample in 'direction' from
+ * 'point' with: the estimated probability that the direction is unoccluded, clamped to
+ * VisibilityCacheSettings::min_sampling_weight. 1.0f if the cache isn't used
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float visibility_cache_sampling_weight(const HIPRTRenderData& render_data, const float3& point, const float3& normal, const float3& direction)
+{
+    const VisibilityCacheSettings& visibility_cache_settings = render_data.render_settings.visibility_cache_settings;
+    if (!visibility_cache_available(visibility_cache_settings))
+        return 1.0f;
+
+    unsigned int bin = visibility_cache_get_bin(visibility_cache_settings, point, normal, direction);
+    float unoccluded_count = static_cast<float>(bin >> 16);
+    float sample_count = static_cast<float>(bin & 0xFFFFu);
+
+    // The directions that haven't been tested yet are visible with probability 0.5f
+    return hippt::max(visibility_cache_settings.min_sampling_weight, (unoccluded_count + 1.0f) / (sample_count + 2.0f));
+}
+
+/**
+ * Counts the result of a shadow ray in 'direction' from 'point' in its bin
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void visibility_cache_record(const HIPRTRenderData& render_data, const float3& point, const float3& normal, const float3& direction, bool unoccluded)
+{
+    const VisibilityCacheSettings& visibility_cache_settings = render_data.render_settings.visibility_cache_settings;
+    if (!visibility_cache_available(visibility_cache_settings))
+        return;
+
+    unsigned int entry_index = visibility_cache_insert_entry(visibility_cache_settings, visibility_cache_get_key(visibility_cache_settings, point, normal));
+    if (entry_index == VISIBILITY_CACHE_INVALID_ENTRY)
+        return;
+
+    AtomicType<unsigned int>* bin = &visibility_cache_settings.bins[entry_index * VISIBILITY_CACHE_BIN_COUNT + visibility_cache_get_bin_index(direction)];
+    unsigned int max_sample_count = static_cast<unsigned int>(hippt::min(visibility_cache_settings.max_accumulated_samples, 0xFFFF));
+
+    // Both counts are in the same word so that they're always updated together
+    unsigned int current_bin = *bin;
+    unsigned int previous_bin;
+    do
+    {
+        previous_bin = current_bin;
+
+        unsigned int unoccluded_count = (previous_bin >> 16) + (unoccluded ? 1u : 0u);
+        unsigned int sample_count = (previous_bin & 0xFFFFu) + 1u;
+        if (sample_count > max_sample_count)
+        {
+            // Forgetting half of the past shadow rays
+            unoccluded_count /= 2;
+            sample_count /= 2;
+        }
+
+        current_bin = hippt::atomic_compare_exchange(bin, previous_bin, (unoccluded_count << 16) | sample_count);
+    } while (current_bin != previous_bin);
+}
+
+/**
+ * Traces the shadow ray 'shadow_ray' that leaves the surface at 'point' and trains the cache with it.
+ * Returns true if in shadow.
+ *
+ * If VisibilityCacheSettings::skip_occluded_shadow_rays, the shadow rays of the directions that the cache confidently
+ * sees as occluded aren't traced (except with probability VisibilityCacheSettings::occluded_retest_probability) and are in shadow
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool visibility_cache_evaluate_shadow_ray(const HIPRTRenderData& render_data, const float3& point, const float3& normal, const hiprtRay& shadow_ray, float t_max, Xorshift32Generator& random_number_generator)
+{
+    const VisibilityCacheSettings& visibility_cache_settings = render_data.render_settings.visibility_cache_settings;
+    if (!visibility_cache_available(visibility_cache_settings))
+        return evaluate_shadow_ray(render_data, shadow_ray, t_max, random_number_generator);
+
+    if (visibility_cache_settings.skip_occluded_shadow_rays)
+    {
+        unsigned int bin = visibility_cache_get_bin(visibility_cache_settings, point, normal, shadow_ray.direction);
+        unsigned int unoccluded_count = bin >> 16;
+        unsigned int sample_count = bin & 0xFFFFu;
+
+        bool confidently_occluded = sample_count >= static_cast<unsigned int>(visibility_cache_settings.min_sample_count) && unoccluded_count < visibility_cache_settings.occluded_threshold * sample_count;
+        if (confidently_occluded && random_number_generator() >= visibility_cache_settings.occluded_retest_probability)
+        {
+            count_ray_statistic(render_data, RAY_STATISTIC_VISIBILITY_CACHE_SKIPPED_SHADOW_RAYS);
+
+            return true;
+        }
+    }
+
+    bool in_shadow = evaluate_shadow_ray(render_data, shadow_ray, t_max, random_number_generator);
+    visibility_cache_record(render_data, point, normal, shadow_ray.direction, !in_shadow);
+
+    return in_shadow;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_WAVEFRONT_QUEUES_H
+#define DEVICE_WAVEFRONT_QUEUES_H
+
+#include "Device/includes/RayCone.h"
+#include "Device/includes/RayVolumeState.h"
+
+#include "HostDeviceCommon/AtomicType.h"
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/Material.h"
+
+// Structure of arrays holding the state of the paths between the kernels
+// of the wavefront path tracer (extend, shade, shadow rays, accumulate).
+//
+// Each array contains one slot per pixel of the render resolution and is
+// indexed by the pixel index: the state of the path of the pixel
+// (X, Y) = [50, 0] is at ray_origins[50], throughputs[50], ...
+struct WavefrontQueues
+{
+	// Bounce currently being processed by the wavefront kernels.
+	// This is set by the CPU before each launch of the kernels of a bounce
+	int current_bounce = 0;
+
+	// Rays to be traced by the extend kernel
+	float3* ray_origins = nullptr;
+	float3* ray_directions = nullptr;
+
+	// Throughput and accumulated radiance of the path
+	ColorRGB32F* throughputs = nullptr;
+	ColorRGB32F* ray_colors = nullptr;
+	// RayState of the path stored as an unsigned char
+	unsigned char* ray_states = nullptr;
+
+	// Output of the extend kernel, consumed by the shade kernel
+	unsigned char* hit_found = nullptr;
+	float3* inter_points = nullptr;
+	float3* shading_normals = nullptr;
+	float3* geometric_normals = nullptr;
+	// Material of the hit, evaluated by the extend kernel.
+	// nullptr if WavefrontDeferredMaterials is KERNEL_OPTION_TRUE
+	SimplifiedRendererMaterial* materials = nullptr;
+	// Texture coordinates and texture footprint of the hit from which the shade kernel
+	// evaluates the material of 'material_ids' if WavefrontDeferredMaterials is KERNEL_OPTION_TRUE.
+	// nullptr otherwise
+	float2* texcoords = nullptr;
+	float* texture_footprints = nullptr;
+	StoredRayVolumeState* volume_states = nullptr;
+	RayCone* ray_cones = nullptr;
+	// Index of the material of the hit (index in render_data.buffers.materials_buffer).
+	// Only written from the second bounce on since the hits of the camera rays aren't sorted,
+	// unless WavefrontDeferredMaterials is KERNEL_OPTION_TRUE in which case the shade kernel
+	// needs it at every bounce and it is copied from the G-buffer for the camera rays hits
+	int* material_ids = nullptr;
+
+	// State of the random number generator of each path so that
+	// the sequence of random numbers is continued from one kernel to the next
+	unsigned int* random_states = nullptr;
+
+	// Shadow rays queued by the shade kernel and traced by the shadow rays kernel.
+	// A distance of 0.0f (or less) means that no shadow ray is queued for that pixel.
+	// 'shadow_ray_contributions' is the unoccluded contribution of the light sample,
+	// already multiplied by the throughput of the path
+	float3* shadow_ray_origins = nullptr;
+	float3* shadow_ray_directions = nullptr;
+	float* shadow_ray_distances = nullptr;
+	ColorRGB32F* shadow_ray_contributions = nullptr;
+
+	// Denoiser AOVs of the current sample, written by the shade kernel
+	// at the first bounce and accumulated by the accumulate kernel
+	ColorRGB32F* denoiser_albedo = nullptr;
+	float3* denoiser_normals = nullptr;
+
+	// Whether or not the shade kernel of the current bounce should process the
+	// hits in the order given by 'sorted_pixel_indices'. Set by the CPU per bounce
+	bool use_material_sort = false;
+	// Whether or not the extend kernel of the current bounce should trace the
+	// rays in the order given by 'sorted_pixel_indices'. Set by the CPU per bounce
+	bool use_ray_sort = false;
+
+	// Number of bits of the Morton code of the origin of the rays per axis
+	// in the key of the ray sort
+	static constexpr int RAY_SORT_MORTON_BITS_PER_AXIS = 3;
+	// 8 direction octants for each cell of the Morton grid + one key for the terminated paths
+	static constexpr int RAY_SORT_KEY_COUNT = (8 << (3 * RAY_SORT_MORTON_BITS_PER_AXIS)) + 1;
+
+	// Bounds of the scene in which the origins of the rays are quantized for the ray sort
+	float3 ray_sort_grid_min = make_float3(0.0f, 0.0f, 0.0f);
+	float3 ray_sort_grid_max = make_float3(1.0f, 1.0f, 1.0f);
+
+	// Number of keys of the sort currently being done, set by the CPU before each sort.
+	//
+	// For the material sort, this is the number of materials of the scene + 2.
+	// Key 'material_count' is used for the rays that missed the scene and key
+	// 'material_count + 1' for the paths that are terminated / pixels that are inactive.
+	//
+	// For the ray sort, this is RAY_SORT_KEY_COUNT
+	int sort_key_count = 0;
+	// Sort key of each pixel, computed by the histogram kernel
+	unsigned int* sort_keys = nullptr;
+	// Number of pixels per key, computed by the histogram kernel.
+	// Cleared back to 0 by the scan kernel for the next sort
+	AtomicType<unsigned int>* sort_histogram = nullptr;
+	// Starting offset of each key in 'sorted_pixel_indices', computed by the scan kernel
+	// and incremented by the scatter kernel
+	AtomicType<unsigned int>* sort_offsets = nullptr;
+	// Pixel indices sorted by material index (or by ray for the ray sort). The shade kernel
+	// (extend kernel for the ray sort) at thread index 'i' processes the path of the
+	// pixel 'sorted_pixel_indices[i]'
+	unsigned int* sorted_pixel_indices = nullptr;
+};
+
+#endif
@@ -9,9 +9,12 @@
 #include "Device/includes/ReSTIR/DI/PresampledLight.h"
 #include "Device/includes/ReSTIR/DI/Reservoir.h"
 
+#include "HostDeviceCommon/MeshVertexAttributes.h"
+#include "HostDeviceCommon/PackedMaterial.h"
 #include "HostDeviceCommon/WorldSettings.h"
 
 struct RendererMaterial;
+struct SceneInstance;
 
 struct LightPresamplingParameters
 {
@@ -31,10 +34,18 @@ struct LightPresamplingParameters
 	 */
 	int emissive_triangles_count = 0;
 	int* emissive_triangles_indices = nullptr;
+	float* emissive_triangles_alias_table_probas = nullptr;
+	int* emissive_triangles_alias_table_alias = nullptr;
+	float emissive_triangles_total_power = 0.0f;
 	int* triangles_indices = nullptr;
 	float3* vertices_positions = nullptr;
+	unsigned short* quantized_vertices_positions = nullptr;
+	MeshVertexAttributes* mesh_vertex_attributes = nullptr;
 	int* material_indices = nullptr;
-	RendererMaterial* materials = nullptr;
+	float* triangle_emission_texture_luminances = nullptr;
+	SceneInstance* instances = nullptr;
+	int instance_count = 0;
+	PackedRendererMaterial* materials = nullptr;
 
 	// World settings for sampling the envmap
 	WorldSettings world_settings;
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_ACTIVE_PIXEL_COMPACTION_H
+#define KERNELS_ACTIVE_PIXEL_COMPACTION_H
+
+#include "Device/includes/ActivePixels.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/kernels/CameraRays.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Updates the adaptive sampling state of all the pixels of the image and builds the list
+ * of the pixels that need a sample (render_data.aux_buffers.active_pixel_indices).
+ *
+ * The kernels that follow (camera rays, ReSTIR, path tracing) are then launched over that list
+ * instead of over the whole image (see get_thread_pixel()): late in an adaptive render where
+ * most of the pixels have converged, their threads are packed in a few blocks
+ * instead of being spread between blocks that mostly do nothing.
+ *
+ * The pixels are appended to the list in no particular order.
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ActivePixelCompaction(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline ActivePixelCompaction(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    // Launched over the low resolution grid when rendering at low resolution
+    uint32_t x, y;
+    if (render_data.render_settings.do_render_low_resolution())
+    {
+        if (!get_thread_low_resolution_pixel(render_data, res, x, y))
+            return;
+    }
+    else
+    {
+        x = blockIdx.x * blockDim.x + threadIdx.x;
+        y = blockIdx.y * blockDim.y + threadIdx.y;
+    }
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index;
+    if (!update_pixel_sampling_state(render_data, res, x, y, pixel_index))
+        return;
+
+    // The camera rays of the low resolution pixels use (x, y), not 'pixel_index'
+    append_active_pixel(render_data, x + y * res.x);
+}
+
+#endif
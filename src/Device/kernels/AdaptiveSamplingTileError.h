@@ -0,0 +1,117 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_ADAPTIVE_SAMPLING_TILE_ERROR_H
+#define KERNELS_ADAPTIVE_SAMPLING_TILE_ERROR_H
+
+#include "Device/includes/AdaptiveSampling.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Error estimate of the tile based adaptive sampling (render_settings.adaptive_sampling_tile_based).
+ *
+ * One block of ADAPTIVE_SAMPLING_TILE_SIZE x ADAPTIVE_SAMPLING_TILE_SIZE threads per tile of the image
+ * reduces the luminances of the pixels of the tile and their difference with the half buffer
+ * (see accumulate_adaptive_sampling_buffers()) per quadrant of the tile. If the tile has converged
+ * (adaptive_sampling_tile_converged()), all its pixels are marked as converged in
+ * aux_buffers.pixel_status and they aren't sampled anymore.
+ *
+ * The tiles with a pixel that doesn't have enough samples yet aren't evaluated.
+ *
+ * Reference:
+ * [1] [A Hierarchical Automatic Stopping Condition for Monte Carlo Global Illumination, Dammertz et al., 2010]
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(ADAPTIVE_SAMPLING_TILE_SIZE * ADAPTIVE_SAMPLING_TILE_SIZE) AdaptiveSamplingTileError(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline AdaptiveSamplingTileError(HIPRTRenderData render_data, int2 res, int tile_x, int tile_y)
+#endif
+{
+    constexpr int QUADRANT_SIZE = ADAPTIVE_SAMPLING_TILE_SIZE / 2;
+
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+
+    __shared__ float quadrant_luminances[4];
+    __shared__ float quadrant_differences[4];
+    __shared__ int tile_evaluated;
+    __shared__ int tile_converged;
+
+    if (threadIdx.x == 0 && threadIdx.y == 0)
+    {
+        for (int quadrant = 0; quadrant < 4; quadrant++)
+        {
+            quadrant_luminances[quadrant] = 0.0f;
+            quadrant_differences[quadrant] = 0.0f;
+        }
+
+        tile_evaluated = 1;
+    }
+    __syncthreads();
+
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+    // No early return for the pixels outside of the image, they still take part in the __syncthreads()
+    bool inside_image = x < res.x && y < res.y;
+    uint32_t pixel_index = x + y * res.x;
+
+    if (inside_image)
+    {
+        float luminance, difference;
+        if (get_adaptive_sampling_tile_pixel_error(render_data, pixel_index, luminance, difference))
+        {
+            int quadrant = threadIdx.x / QUADRANT_SIZE + 2 * (threadIdx.y / QUADRANT_SIZE);
+
+            atomicAdd(&quadrant_luminances[quadrant], luminance);
+            atomicAdd(&quadrant_differences[quadrant], difference);
+        }
+        else
+            tile_evaluated = 0;
+    }
+    __syncthreads();
+
+    if (threadIdx.x == 0 && threadIdx.y == 0)
+        tile_converged = tile_evaluated && adaptive_sampling_tile_converged(render_data, quadrant_luminances, quadrant_differences);
+    __syncthreads();
+
+    if (inside_image && tile_converged)
+        set_pixel_converged_sample_count(render_data, pixel_index, render_data.aux_buffers.pixel_status[pixel_index].get_sample_count());
+#else
+    float quadrant_luminances[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float quadrant_differences[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    int start_x = tile_x * ADAPTIVE_SAMPLING_TILE_SIZE;
+    int start_y = tile_y * ADAPTIVE_SAMPLING_TILE_SIZE;
+    int stop_x = hippt::min(start_x + ADAPTIVE_SAMPLING_TILE_SIZE, res.x);
+    int stop_y = hippt::min(start_y + ADAPTIVE_SAMPLING_TILE_SIZE, res.y);
+
+    for (int y = start_y; y < stop_y; y++)
+    {
+        for (int x = start_x; x < stop_x; x++)
+        {
+            float luminance, difference;
+            if (!get_adaptive_sampling_tile_pixel_error(render_data, x + y * res.x, luminance, difference))
+                return;
+
+            int quadrant = (x - start_x) / QUADRANT_SIZE + 2 * ((y - start_y) / QUADRANT_SIZE);
+            quadrant_luminances[quadrant] += luminance;
+            quadrant_differences[quadrant] += difference;
+        }
+    }
+
+    if (!adaptive_sampling_tile_converged(render_data, quadrant_luminances, quadrant_differences))
+        return;
+
+    for (int y = start_y; y < stop_y; y++)
+        for (int x = start_x; x < stop_x; x++)
+            set_pixel_converged_sample_count(render_data, x + y * res.x, render_data.aux_buffers.pixel_status[x + y * res.x].get_sample_count());
+#endif
+}
+
+#endif
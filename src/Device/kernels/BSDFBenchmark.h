@@ -0,0 +1,187 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_BSDF_BENCHMARK_H
+#define KERNELS_BSDF_BENCHMARK_H
+
+#include "Device/includes/CookTorrance.h"
+#include "Device/includes/Disney.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/Glass.h"
+#include "Device/includes/Hash.h"
+#include "Device/includes/Lambertian.h"
+#include "Device/includes/OrenNayar.h"
+#include "Device/includes/RayVolumeState.h"
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+// BSDFs of the benchmark
+#define BSDF_BENCHMARK_LAMBERTIAN 0
+#define BSDF_BENCHMARK_OREN_NAYAR 1
+#define BSDF_BENCHMARK_COOK_TORRANCE 2
+#define BSDF_BENCHMARK_GLASS 3
+#define BSDF_BENCHMARK_DISNEY 4
+
+// Operations measured by the benchmark
+#define BSDF_BENCHMARK_EVAL 0
+#define BSDF_BENCHMARK_SAMPLE 1
+// Only for the BSDFs that have a standalone PDF function (Cook Torrance), the other
+// BSDFs return their PDF from their eval function
+#define BSDF_BENCHMARK_PDF 2
+
+/**
+ * Runs 'sample_count' times the operation 'operation' of the BSDF 'bsdf' with the material and view direction
+ * of the item 'item_index'. The shading normal is +Z.
+ *
+ * BSDF_BENCHMARK_SAMPLE: 'out_values[item_index * 2]' and 'out_values[item_index * 2 + 1]' are the mean and the
+ * variance of the luminance of the sample weights (BSDF * cos / PDF), i.e. the estimate of the directional albedo
+ * of the material and the variance of one sample of that estimate: the lower, the better the importance sampling.
+ *
+ * BSDF_BENCHMARK_EVAL / BSDF_BENCHMARK_PDF: 'out_values[item_index * 2]' is the sum of the luminance of the evaluations
+ * (PDF included) / of the PDFs in cosine distributed directions, only so that the compiler can't optimize them away
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void bsdf_benchmark_item(const SimplifiedRendererMaterial* materials, const float3* view_directions, int item_index, int bsdf, int operation, int sample_count, float* out_values)
+{
+    const SimplifiedRendererMaterial& material = materials[item_index];
+    float3 view_direction = view_directions[item_index];
+    float3 normal = make_float3(0.0f, 0.0f, 1.0f);
+
+    Xorshift32Generator random_number_generator(wang_hash(item_index + 1));
+
+    float sum = 0.0f;
+    float sum_squared = 0.0f;
+    for (int sample_index = 0; sample_index < sample_count; sample_index++)
+    {
+        // The benchmark materials are opaque for the Disney BSDF, no materials buffer is
+        // needed for the nested dielectrics
+        RayVolumeState ray_volume_state;
+
+        float value = 0.0f;
+        if (operation == BSDF_BENCHMARK_SAMPLE)
+        {
+            float3 sampled_direction = make_float3(0.0f, 0.0f, 0.0f);
+            float pdf = 0.0f;
+            ColorRGB32F bsdf_color;
+
+            switch (bsdf)
+            {
+            case BSDF_BENCHMARK_LAMBERTIAN:
+                bsdf_color = lambertian_brdf_sample(material, view_direction, normal, sampled_direction, pdf, random_number_generator);
+                break;
+
+            case BSDF_BENCHMARK_OREN_NAYAR:
+                bsdf_color = oren_nayar_brdf_sample(material, view_direction, normal, sampled_direction, pdf, random_number_generator);
+                break;
+
+            case BSDF_BENCHMARK_COOK_TORRANCE:
+                bsdf_color = cook_torrance_brdf_importance_sample(material, view_direction, normal, sampled_direction, pdf, random_number_generator);
+                break;
+
+            case BSDF_BENCHMARK_GLASS:
+            {
+                // Flipped by the BSDF on refraction
+                float3 glass_normal = normal;
+                bsdf_color = smooth_glass_bsdf(material, sampled_direction, -view_direction, glass_normal, 1.0f, material.ior, pdf, random_number_generator);
+                break;
+            }
+
+            case BSDF_BENCHMARK_DISNEY:
+                bsdf_color = disney_bsdf_sample(nullptr, material, ray_volume_state, view_direction, normal, normal, sampled_direction, pdf, random_number_generator);
+                break;
+
+            default:
+                break;
+            }
+
+            if (pdf > 0.0f)
+                value = (bsdf_color * hippt::abs(hippt::dot(normal, sampled_direction)) / pdf).luminance();
+        }
+        else
+        {
+            float3 to_light_direction = cosine_weighted_sample(normal, random_number_generator);
+            float pdf = 0.0f;
+
+            if (operation == BSDF_BENCHMARK_PDF)
+                pdf = cook_torrance_brdf_pdf(material, view_direction, to_light_direction, normal);
+            else
+            {
+                ColorRGB32F bsdf_color;
+                switch (bsdf)
+                {
+                case BSDF_BENCHMARK_LAMBERTIAN:
+                    bsdf_color = lambertian_brdf_eval(material, view_direction, normal, to_light_direction, pdf);
+                    break;
+
+                case BSDF_BENCHMARK_OREN_NAYAR:
+                    bsdf_color = oren_nayar_brdf_eval(material, view_direction, normal, to_light_direction, pdf);
+                    break;
+
+                case BSDF_BENCHMARK_COOK_TORRANCE:
+                    bsdf_color = cook_torrance_brdf(material, to_light_direction, view_direction, normal);
+                    pdf = cook_torrance_brdf_pdf(material, view_direction, to_light_direction, normal);
+                    break;
+
+                case BSDF_BENCHMARK_DISNEY:
+                    bsdf_color = disney_bsdf_eval(nullptr, material, ray_volume_state, view_direction, normal, to_light_direction, pdf);
+                    break;
+
+                default:
+                    // The smooth glass is a delta distribution, it can only be sampled
+                    break;
+                }
+
+                value = bsdf_color.luminance();
+            }
+
+            value += pdf;
+        }
+
+        sum += value;
+        sum_squared += value * value;
+    }
+
+    if (operation == BSDF_BENCHMARK_SAMPLE)
+    {
+        float mean = sum / sample_count;
+        float variance = sample_count > 1 ? (sum_squared - sum * mean) / (sample_count - 1) : 0.0f;
+
+        out_values[item_index * 2 + 0] = mean;
+        out_values[item_index * 2 + 1] = hippt::max(0.0f, variance);
+    }
+    else
+    {
+        out_values[item_index * 2 + 0] = sum;
+        out_values[item_index * 2 + 1] = 0.0f;
+    }
+}
+
+/**
+ * Kernel of the BSDFMicrobenchmark, one thread per item of the randomized material / view direction set.
+ *
+ * The GPU benchmark compiles the kernel with BSDFBenchmarkBSDF defined to the BSDF measured so that the
+ * other BSDFs are compiled out and their registers don't lower the occupancy of the launch
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) BSDFBenchmark(const SimplifiedRendererMaterial* materials, const float3* view_directions, int item_count, int bsdf, int operation, int sample_count, float* out_values)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline BSDFBenchmark(const SimplifiedRendererMaterial* materials, const float3* view_directions, int item_count, int bsdf, int operation, int sample_count, float* out_values, int x)
+#endif
+{
+#ifdef __KERNELCC__
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+#endif
+    if (x >= item_count)
+        return;
+
+#ifdef BSDFBenchmarkBSDF
+    bsdf = BSDFBenchmarkBSDF;
+#endif
+
+    bsdf_benchmark_item(materials, view_directions, x, bsdf, operation, sample_count, out_values);
+}
+
+#endif
@@ -6,11 +6,15 @@
 #ifndef KERNELS_CAMERA_RAY_H
 #define KERNELS_CAMERA_RAY_H
 
+#include "Device/includes/ActivePixels.h"
 #include "Device/includes/AdaptiveSampling.h"
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Hash.h"
 #include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/PixelCost.h"
 #include "Device/includes/RayPayload.h"
+#include "Device/includes/RayStatistics.h"
 
 #include "HostDeviceCommon/HIPRTCamera.h"
 #include "HostDeviceCommon/HitInfo.h"
@@ -28,69 +32,140 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void reset_render(const HIPRTRenderData& render_d
         // if ReSTIR DI is currently disabled (using another direct lighting strategy).
         // We only need to check 1 buffer for that.
 
-        render_data.aux_buffers.restir_reservoir_buffer_1[pixel_index] = ReSTIRDIReservoir();
-        render_data.aux_buffers.restir_reservoir_buffer_2[pixel_index] = ReSTIRDIReservoir();
-        render_data.aux_buffers.restir_reservoir_buffer_3[pixel_index] = ReSTIRDIReservoir();
+        render_data.aux_buffers.restir_reservoir_buffer_1[pixel_index] = ReSTIRDIPackedReservoir();
+        render_data.aux_buffers.restir_reservoir_buffer_2[pixel_index] = ReSTIRDIPackedReservoir();
+        render_data.aux_buffers.restir_reservoir_buffer_3[pixel_index] = ReSTIRDIPackedReservoir();
+    }
+
+    if (render_data.render_settings.accumulate && render_data.aux_buffers.restir_gi_reservoir_buffer_1 != nullptr)
+    {
+        // Same for ReSTIR GI
+        render_data.aux_buffers.restir_gi_reservoir_buffer_1[pixel_index] = ReSTIRGIReservoir();
+        render_data.aux_buffers.restir_gi_reservoir_buffer_2[pixel_index] = ReSTIRGIReservoir();
+        render_data.aux_buffers.restir_gi_reservoir_buffer_3[pixel_index] = ReSTIRGIReservoir();
     }
 
     if (render_data.render_settings.has_access_to_adaptive_sampling_buffers())
     {
         // These buffers are only available when either the adaptive sampling or the stop noise threshold is enabled
-        render_data.aux_buffers.pixel_sample_count[pixel_index] = 0;
+        render_data.aux_buffers.pixel_status[pixel_index].set_sample_count(0);
         render_data.aux_buffers.pixel_squared_luminance[pixel_index] = 0;
-        render_data.aux_buffers.pixel_converged_sample_count[pixel_index] = -1;
+        set_pixel_converged_sample_count(render_data, pixel_index, -1);
+        if (render_data.render_settings.adaptive_sampling_tile_based)
+            render_data.aux_buffers.pixel_half_luminance[pixel_index] = 0.0f;
     }
+
+    if (render_data.render_settings.temporal_reprojection_history_sample_count > 0 && render_data.aux_buffers.temporal_reprojection_history != nullptr)
+        // The framebuffer still contains the accumulation of the last render at this point, it
+        // is only overwritten by the path tracing of this sample
+        render_data.aux_buffers.temporal_reprojection_history[pixel_index] = render_data.buffers.pixels[pixel_index] / render_data.render_settings.temporal_reprojection_history_sample_count;
+
+    render_data.aux_buffers.pixel_status[pixel_index].set_ReSTIR_DI_fallback(false);
+
+    pixel_cost_reset(render_data, pixel_index);
 }
 
-#ifdef __KERNELCC__
-GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) CameraRays(HIPRTRenderData render_data, int2 res)
-#else
-GLOBAL_KERNEL_SIGNATURE(void) inline CameraRays(HIPRTRenderData render_data, int2 res, int x, int y)
-#endif
+/**
+ * Index of the pixel (x, y) in the buffers written by the camera rays
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE uint32_t get_camera_ray_pixel_index(const HIPRTRenderData& render_data, int2 res, uint32_t x, uint32_t y)
 {
-#ifdef __KERNELCC__
-    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
-    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
-#endif
-    if (x >= res.x || y >= res.y)
-        return;
-
     uint32_t pixel_index = (x + y * res.x);
 
     // 'Render low resolution' means that the user is moving the camera for example
     // so we're going to reduce the quality of the render for increased framerates
     // while moving
+    if (render_data.render_settings.do_render_low_resolution())
+    {
+        // The rendered pixel of each block is offset by the jitter of the temporal upscaling.
+        // The low resolution pixels are stored in the top left corner of the buffers either way
+        uint32_t jitter_x = render_data.render_settings.temporal_upscaling_jitter.x;
+        uint32_t jitter_y = render_data.render_settings.temporal_upscaling_jitter.y;
+        uint32_t jittered_x = x >= jitter_x ? x - jitter_x : 0;
+        uint32_t jittered_y = y >= jitter_y ? y - jitter_y : 0;
+
+        pixel_index = (jittered_x + jittered_y * res.x) / render_data.render_settings.render_low_resolution_scaling;
+    }
+
+    return pixel_index;
+}
+
+/**
+ * Returns true if the pixel (x, y) is outside of the region of interest
+ * and doesn't get a sample this time. See 'enable_region_of_interest' in HIPRTRenderSettings
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool skipped_by_region_of_interest(const HIPRTRenderSettings& render_settings, uint32_t x, uint32_t y)
+{
+    if (!render_settings.enable_region_of_interest || !render_settings.accumulate)
+        return false;
+
+    if (render_settings.has_access_to_adaptive_sampling_buffers())
+        // The per pixel statistics of the adaptive sampling assume that the pixels
+        // are sampled every sample until they converge
+        return false;
+
+    bool inside_region = x >= render_settings.region_of_interest_min.x && x < render_settings.region_of_interest_max.x
+                      && y >= render_settings.region_of_interest_min.y && y < render_settings.region_of_interest_max.y;
+    if (inside_region)
+        return false;
+
+    // The first sample of the render is always sampled so that the whole image is initialized
+    return render_settings.sample_number % hippt::max(1, render_settings.region_of_interest_outside_sample_interval) != 0;
+}
+
+/**
+ * Rescales the accumulated color of a pixel that doesn't receive this sample. The framebuffer
+ * is divided by the sample number at display time so the color of the pixels that don't receive a
+ * sample would get darker otherwise.
+ *
+ * Also marks the pixel as inactive
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void skip_pixel_sample(const HIPRTRenderData& render_data, uint32_t pixel_index)
+{
+    render_data.buffers.pixels[pixel_index] = render_data.buffers.pixels[pixel_index] / render_data.render_settings.sample_number * (render_data.render_settings.sample_number + 1);
+    render_data.aux_buffers.pixel_status[pixel_index].set_active(false);
+
+    if (render_data.render_settings.use_prev_frame_g_buffer())
+        // The renderer swaps the two GBuffers before each sample instead of copying the
+        // whole GBuffer to the previous frame one. Pixels that aren't traced this sample must
+        // still carry their last first hit in the current GBuffer
+        render_data.g_buffer.copy_pixel(render_data.g_buffer_prev_frame, pixel_index);
+}
+
+/**
+ * Updates the adaptive sampling state of the pixel (x, y) for the sample.
+ * Done by the ActivePixelCompaction kernel when the kernels are launched over
+ * the active pixels, by the CameraRays kernel otherwise
+ * 
+ * Returns false if no camera ray needs to be traced for that pixel this sample
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool update_pixel_sampling_state(const HIPRTRenderData& render_data, int2 res, uint32_t x, uint32_t y, uint32_t& out_pixel_index)
+{
+    uint32_t pixel_index = get_camera_ray_pixel_index(render_data, res, x, y);
+    out_pixel_index = pixel_index;
+
     if (render_data.render_settings.do_render_low_resolution())
     {
         int res_scaling = render_data.render_settings.render_low_resolution_scaling;
-        pixel_index /= res_scaling;
 
         // If rendering at low resolution, only one pixel out of res_scaling^2 will be rendered
-        if (x % res_scaling != 0 || y % res_scaling != 0)
+        int2 jitter = render_data.render_settings.temporal_upscaling_jitter;
+        if (x % res_scaling != jitter.x || y % res_scaling != jitter.y)
         {
-            render_data.aux_buffers.pixel_active[pixel_index] = false;
+            render_data.aux_buffers.pixel_status[pixel_index].set_active(false);
 
-            return;
+            return false;
         }
     }
 
-    if (render_data.render_settings.use_prev_frame_g_buffer())
-    {
-        render_data.g_buffer_prev_frame.geometric_normals[pixel_index] = render_data.g_buffer.geometric_normals[pixel_index];
-        render_data.g_buffer_prev_frame.shading_normals[pixel_index] = render_data.g_buffer.shading_normals[pixel_index];
-        render_data.g_buffer_prev_frame.materials[pixel_index] = render_data.g_buffer.materials[pixel_index];
-        render_data.g_buffer_prev_frame.first_hits[pixel_index] = render_data.g_buffer.first_hits[pixel_index];
-        render_data.g_buffer_prev_frame.ray_volume_states[pixel_index] = render_data.g_buffer.ray_volume_states[pixel_index];
-        render_data.g_buffer_prev_frame.view_directions[pixel_index] = render_data.g_buffer.view_directions[pixel_index];
-        render_data.g_buffer_prev_frame.camera_ray_hit[pixel_index] = render_data.g_buffer.camera_ray_hit[pixel_index];
-    }
-
     if (render_data.render_settings.sample_number == 0 || render_data.render_settings.need_to_reset)
         reset_render(render_data, pixel_index);
 
     bool sampling_needed = true;
     bool pixel_converged = false;
     sampling_needed = adaptive_sampling(render_data, pixel_index, pixel_converged);
+    if (sampling_needed)
+        update_ReSTIR_DI_fallback(render_data, pixel_index);
     
     if (pixel_converged || !sampling_needed)
     {
@@ -99,7 +174,14 @@ GLOBAL_KERNEL_SIGNATURE(void) inline CameraRays(HIPRTRenderData render_data, int
             // do_update_status_buffers is only true on the last sample of a frame
             // 
             // Indicating that this pixel has reached the threshold in render_settings.stop_noise_threshold
-            hippt::atomic_add(render_data.aux_buffers.stop_noise_threshold_converged_count, 1u);
+            hippt::aggregated_atomic_add(render_data.aux_buffers.stop_noise_threshold_converged_count, 1u);
+    }
+
+    if (sampling_needed && skipped_by_region_of_interest(render_data.render_settings, x, y))
+    {
+        skip_pixel_sample(render_data, pixel_index);
+
+        return false;
     }
 
     if (render_data.render_settings.has_access_to_adaptive_sampling_buffers())
@@ -112,11 +194,9 @@ GLOBAL_KERNEL_SIGNATURE(void) inline CameraRays(HIPRTRenderData render_data, int
             // The pixels that only received 10 samples are going to be divided by 100 at display time, making them
             // appear too dark.
             // We're rescaling the color of the pixels that stopped sampling here for correct display
+            skip_pixel_sample(render_data, pixel_index);
 
-            render_data.buffers.pixels[pixel_index] = render_data.buffers.pixels[pixel_index] / render_data.render_settings.sample_number * (render_data.render_settings.sample_number + 1);
-            render_data.aux_buffers.pixel_active[pixel_index] = false;
-
-            return;
+            return false;
         }
         else
         {
@@ -126,33 +206,113 @@ GLOBAL_KERNEL_SIGNATURE(void) inline CameraRays(HIPRTRenderData render_data, int
                 // We have the pixel stop noise threshold enabled and the pixel hasn't converged, meaning
                 // that we should increase the number of relevant sample count for that pixel
                 // so that the adaptive sampling heatmap can display the convergence properly
-                render_data.aux_buffers.pixel_sample_count[pixel_index]++;
+                render_data.aux_buffers.pixel_status[pixel_index].increment_sample_count();
         }
     }
 
+    return true;
+}
+
+/**
+ * Generates the camera ray of the pixel (x, y) whose index is 'pixel_index'
+ * (given by get_camera_ray_pixel_index())
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void make_camera_ray(const HIPRTRenderData& render_data, int2 res, uint32_t x, uint32_t y, uint32_t pixel_index, Xorshift32Generator& out_random_number_generator, hiprtRay& out_ray)
+{
     unsigned int seed;
     if (render_data.render_settings.freeze_random)
         seed = wang_hash(pixel_index + 1);
     else
         seed = wang_hash((pixel_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
-    Xorshift32Generator random_number_generator(seed);
+    out_random_number_generator = Xorshift32Generator(seed);
+    out_random_number_generator.init_low_discrepancy(x, y, render_data.render_settings.freeze_random ? 0 : render_data.render_settings.sample_number);
+    out_random_number_generator.set_dimension_block(0);
+
+    // The ray is generated in the view of the pixel, in the coordinates of the pixel in that view
+    const HIPRTCamera& camera = render_data.get_camera(pixel_index);
+    int2 view_res = render_data.get_view_resolution(res);
+    int view_y = y - render_data.get_view_index(pixel_index) * view_res.y;
 
     // Direction to the center of the pixel
     float x_ray_point_direction = (x + 0.5f);
-    float y_ray_point_direction = (y + 0.5f);
-    if (render_data.current_camera.do_jittering)
+    float y_ray_point_direction = (view_y + 0.5f);
+    if (camera.do_jittering)
     {
         // Jitter randomly around the center
-        x_ray_point_direction += random_number_generator() - 0.5f;
-        y_ray_point_direction += random_number_generator() - 0.5f;
+        x_ray_point_direction += out_random_number_generator() - 0.5f;
+        y_ray_point_direction += out_random_number_generator() - 0.5f;
     }
 
-    hiprtRay ray = render_data.current_camera.get_camera_ray(x_ray_point_direction, y_ray_point_direction, res);
-    RayPayload ray_payload;
+    out_ray = camera.get_camera_ray(x_ray_point_direction, y_ray_point_direction, view_res);
+}
 
-    HitInfo closest_hit_info;
-    bool intersection_found = trace_ray(render_data, ray, ray_payload, closest_hit_info, random_number_generator);
+/**
+ * First half of the CameraRays kernel: updates the adaptive sampling state of the pixel
+ * and generates its camera ray.
+ * 
+ * Returns false if no camera ray needs to be traced for that pixel this sample
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool generate_camera_ray(const HIPRTRenderData& render_data, int2 res, uint32_t x, uint32_t y, uint32_t& out_pixel_index, Xorshift32Generator& out_random_number_generator, hiprtRay& out_ray)
+{
+    if (!update_pixel_sampling_state(render_data, res, x, y, out_pixel_index))
+        return false;
+
+    make_camera_ray(render_data, res, x, y, out_pixel_index, out_random_number_generator, out_ray);
+
+    return true;
+}
+
+/**
+ * Position in pixels in the previous frame of the world space 'point', the center of the pixel (X, Y) is at [X, Y].
+ * 
+ * This is where the motion of the instances would go if they could move
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float2 get_previous_frame_pixel_position(const HIPRTRenderData& render_data, int2 res, const float3& point)
+{
+    float3 previous_screen_space_point = matrix_X_point(render_data.prev_camera.view_projection, point);
+
+    // From [-1, 1] to pixels, back to the center of the pixel
+    return make_float2((previous_screen_space_point.x + 1.0f) * 0.5f * res.x - 0.5f, (previous_screen_space_point.y + 1.0f) * 0.5f * res.y - 0.5f);
+}
+
+/**
+ * Material index of the hit of the camera ray of the pixel on the triangle 'primitive_index':
+ * the material of the view of the pixel for the material previewed by the batched
+ * material previews, see GPURenderer::set_material_previews()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_camera_ray_hit_material_index(const HIPRTRenderData& render_data, uint32_t pixel_index, int primitive_index)
+{
+    int material_index = render_data.buffers.material_indices[primitive_index];
+    if (material_index == render_data.material_preview_target_index)
+        return render_data.material_preview_first_index + render_data.get_view_index(pixel_index);
+
+    return material_index;
+}
+
+/**
+ * Replaces the material of the ray payload by the previewed material of the view of the pixel
+ * if the camera ray hit the material of the batched material previews.
+ * 
+ * Only the camera rays see the previewed materials, the secondary rays that hit the
+ * previewed object again still see its material in the scene
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void apply_material_preview(const HIPRTRenderData& render_data, uint32_t pixel_index, bool intersection_found, const HitInfo& closest_hit_info, RayPayload& ray_payload)
+{
+    if (render_data.material_preview_target_index == -1 || !intersection_found)
+        return;
+
+    int material_index = get_camera_ray_hit_material_index(render_data, pixel_index, closest_hit_info.primitive_index);
+    if (material_index != render_data.buffers.material_indices[closest_hit_info.primitive_index])
+        ray_payload.material = get_intersection_material(render_data, material_index, closest_hit_info.texcoords, closest_hit_info.texture_footprint);
+}
 
+/**
+ * Second half of the CameraRays kernel: fills the G-buffer (and the motion vector)
+ * of the pixel with the result of the tracing of its camera ray
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void store_camera_ray_hit(const HIPRTRenderData& render_data, int2 res, uint32_t pixel_index, const hiprtRay& ray, bool intersection_found, const RayPayload& ray_payload, HitInfo& closest_hit_info)
+{
+    int g_buffer_index = render_data.g_buffer.get_storage_index(pixel_index);
     if (intersection_found)
     {
         if (ray_payload.material.is_emissive() && hippt::dot(-ray.direction, closest_hit_info.geometric_normal) < 0)
@@ -161,24 +321,123 @@ GLOBAL_KERNEL_SIGNATURE(void) inline CameraRays(HIPRTRenderData render_data, int
             closest_hit_info.shading_normal = -closest_hit_info.shading_normal;
         }
 
-        render_data.g_buffer.geometric_normals[pixel_index] = closest_hit_info.geometric_normal;
-        render_data.g_buffer.shading_normals[pixel_index] = closest_hit_info.shading_normal;
-        render_data.g_buffer.materials[pixel_index] = ray_payload.material;
-        render_data.g_buffer.first_hits[pixel_index] = closest_hit_info.inter_point;
-        render_data.g_buffer.ray_volume_states[pixel_index] = ray_payload.volume_state;
+        int material_index = get_camera_ray_hit_material_index(render_data, pixel_index, closest_hit_info.primitive_index);
+        // Distance from the camera and not 't' of the hit because the ray may have skipped volume boundaries
+        float distance_to_camera = hippt::length(closest_hit_info.inter_point - render_data.get_camera(pixel_index).get_position());
+
+        render_data.g_buffer.set_first_hit(pixel_index, material_index, closest_hit_info.texcoords, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, -ray.direction, distance_to_camera);
+        ray_payload.volume_state.store(render_data.g_buffer.ray_volume_states[g_buffer_index]);
+        render_data.g_buffer.texture_footprints[g_buffer_index] = closest_hit_info.texture_footprint;
+        render_data.g_buffer.ray_cone_spread_angles[g_buffer_index] = ray_payload.ray_cone.spread_angle;
     }
+    else
+        render_data.g_buffer.view_directions[g_buffer_index] = octahedral_encode(-ray.direction);
+
+    // The background is reprojected far away, only the rotation of the camera moves it
+    float3 first_hit = intersection_found ? closest_hit_info.inter_point : ray.origin + ray.direction * 1.0e6f;
+    render_data.g_buffer.set_previous_position(pixel_index, get_previous_frame_pixel_position(render_data, res, first_hit));
 
-    render_data.g_buffer.view_directions[pixel_index] = -ray.direction;
-    render_data.g_buffer.camera_ray_hit[pixel_index] = intersection_found;
-    render_data.aux_buffers.pixel_active[pixel_index] = true;
+    render_data.g_buffer.camera_ray_hit[g_buffer_index] = intersection_found;
+    render_data.aux_buffers.pixel_status[pixel_index].set_active(true);
 
     // If we got here, this means that we still have at least one ray active
     if (render_data.render_settings.do_update_status_buffers)
     {
         // Updating if we have the right to (when do_update_status_buffers is true).
         // do_update_status_buffers is only true on the last sample of a frame
-        render_data.aux_buffers.still_one_ray_active[0] = 1;
+        hippt::warp_aggregated_store(render_data.aux_buffers.still_one_ray_active, static_cast<unsigned char>(1));
     }
 }
 
+/**
+ * Returns true if the G-buffer already holds the first hit the camera ray of this sample would
+ * find, see 'reuse_primary_hits' in HIPRTRenderSettings
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool can_reuse_primary_hits(const HIPRTRenderData& render_data)
+{
+    const HIPRTRenderSettings& render_settings = render_data.render_settings;
+    if (!render_settings.reuse_primary_hits || render_data.current_camera.do_jittering)
+        return false;
+
+    // The pixel traced in each block of pixels changes every sample when rendering at low resolution
+    if (!render_settings.accumulate || render_settings.need_to_reset || render_settings.do_render_low_resolution())
+        return false;
+
+    // The two G-buffers are swapped every sample when the previous frame G-buffer is used:
+    // the current G-buffer was filled by the sample before the last one
+    int first_reusing_sample = render_settings.use_prev_frame_g_buffer() ? 2 : 1;
+
+    return render_settings.sample_number >= first_reusing_sample;
+}
+
+/**
+ * Replaces the tracing of the camera ray and store_camera_ray_hit() when the first hit
+ * of the G-buffer is reused: only what changes between the samples is updated
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void reuse_camera_ray_hit(const HIPRTRenderData& render_data, int2 res, uint32_t pixel_index)
+{
+    int g_buffer_index = render_data.g_buffer.get_storage_index(pixel_index);
+
+    // The motion vector of the first sample was computed against the camera before the reset
+    float3 camera_position = render_data.get_camera(pixel_index).get_position();
+    float3 first_hit;
+    if (render_data.g_buffer.camera_ray_hit[g_buffer_index])
+        first_hit = render_data.g_buffer.get_first_hit(pixel_index, camera_position);
+    else
+        first_hit = camera_position - render_data.g_buffer.get_view_direction(pixel_index) * 1.0e6f;
+    render_data.g_buffer.set_previous_position(pixel_index, get_previous_frame_pixel_position(render_data, res, first_hit));
+
+    render_data.aux_buffers.pixel_status[pixel_index].set_active(true);
+    if (render_data.render_settings.do_update_status_buffers)
+        hippt::warp_aggregated_store(render_data.aux_buffers.still_one_ray_active, static_cast<unsigned char>(1));
+}
+
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) CameraRays(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline CameraRays(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    uint32_t x, y;
+    if (!get_thread_camera_ray_pixel(render_data, res, x, y))
+        return;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index;
+    Xorshift32Generator random_number_generator;
+    hiprtRay ray;
+    if (render_data.render_settings.launch_over_active_pixels)
+    {
+        // The ActivePixelCompaction kernel already updated the adaptive
+        // sampling state of the pixels and only kept the ones that need a ray
+        pixel_index = get_camera_ray_pixel_index(render_data, res, x, y);
+        make_camera_ray(render_data, res, x, y, pixel_index, random_number_generator, ray);
+    }
+    else if (!generate_camera_ray(render_data, res, x, y, pixel_index, random_number_generator, ray))
+        return;
+
+    PixelCostScope pixel_cost(render_data, pixel_index, PIXEL_COST_CAMERA_RAYS);
+
+    if (can_reuse_primary_hits(render_data))
+    {
+        reuse_camera_ray_hit(render_data, res, pixel_index);
+
+        return;
+    }
+
+    RayPayload ray_payload;
+    ray_payload.ray_cone.spread_angle = render_data.get_camera(pixel_index).get_pixel_spread_angle(render_data.get_view_resolution(res));
+
+    HitInfo closest_hit_info;
+    count_ray_statistic(render_data, RAY_STATISTIC_CAMERA_RAYS);
+    bool intersection_found = trace_ray(render_data, ray, ray_payload, closest_hit_info, random_number_generator);
+    apply_material_preview(render_data, pixel_index, intersection_found, closest_hit_info, ray_payload);
+
+    store_camera_ray_hit(render_data, res, pixel_index, ray, intersection_found, ray_payload, closest_hit_info);
+}
+
 #endif
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_DENOISER_AOVS_RESOLVE_H
+#define KERNELS_DENOISER_AOVS_RESOLVE_H
+
+#include "Device/includes/DenoiserAOVs.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/Material.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Accumulates the albedo and shading normal of the first hit of the camera ray of
+ * the pixel in the denoiser AOVs, read from the G-buffer filled by the CameraRays kernel.
+ *
+ * Used instead of the accumulation of the AOVs by the path tracers when the kernels
+ * are compiled with DenoiserAOVsFromGBuffer. Launched after the camera rays of every sample
+ * if the camera rays are jittered and only on the first sample of the render otherwise since
+ * the G-buffer is then the same for all the samples
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) DenoiserAOVsResolve(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline DenoiserAOVsResolve(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = (x + y * res.x);
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active())
+        // The G-buffer of that pixel wasn't filled this sample
+        return;
+
+    ColorRGB32F denoiser_albedo = ColorRGB32F(0.0f, 0.0f, 0.0f);
+    float3 denoiser_normal = make_float3(0.0f, 0.0f, 0.0f);
+
+    int g_buffer_index = render_data.g_buffer.get_storage_index(pixel_index);
+    if (render_data.g_buffer.camera_ray_hit[g_buffer_index])
+    {
+        // Same AOVs as the ones of the first bounce of the path tracers
+        denoiser_albedo = get_g_buffer_material(render_data, render_data.g_buffer, pixel_index).base_color;
+        denoiser_normal = render_data.g_buffer.get_shading_normal(pixel_index);
+    }
+
+    accumulate_denoiser_AOVs(render_data, pixel_index, denoiser_albedo, denoiser_normal);
+}
+
+#endif
@@ -6,112 +6,45 @@
 #ifndef KERNELS_FULL_PATH_TRACER_H
 #define KERNELS_FULL_PATH_TRACER_H
 
+#include "Device/includes/ActivePixels.h"
 #include "Device/includes/AdaptiveSampling.h"
+#include "Device/includes/BSDFSampleReuse.h"
+#include "Device/includes/DenoiserAOVs.h"
 #include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
 #include "Device/includes/Lights.h"
 #include "Device/includes/Envmap.h"
 #include "Device/includes/Hash.h"
 #include "Device/includes/Material.h"
+#include "Device/includes/PathGuiding.h"
+#include "Device/includes/PixelCost.h"
+#include "Device/includes/RadianceCache.h"
 #include "Device/includes/RayPayload.h"
+#include "Device/includes/RayStatistics.h"
+#include "Device/includes/ReSTIR/GI/Utils.h"
+#include "Device/includes/RussianRoulette.h"
+#include "Device/includes/SanityCheck.h"
 #include "Device/includes/Sampling.h"
 #include "HostDeviceCommon/Xorshift.h"
 
-#ifndef __KERNELCC__
-#include "Utils/Utils.h" // For debugbreak in sanity_check()
-
-// For logging stuff on the CPU and avoid everything being mixed
-// up in the terminal because of multithreading
-#include <mutex>
-std::mutex g_mutex;
-#endif
-
-HIPRT_HOST_DEVICE HIPRT_INLINE void debug_set_final_color(const HIPRTRenderData& render_data, int x, int y, int res_x, ColorRGB32F final_color)
-{
-    if (render_data.render_settings.sample_number == 0)
-        render_data.buffers.pixels[y * res_x + x] = final_color;
-    else
-        render_data.buffers.pixels[y * res_x + x] = final_color * render_data.render_settings.sample_number;
-}
-
-HIPRT_HOST_DEVICE HIPRT_INLINE bool check_for_negative_color(ColorRGB32F ray_color, int x, int y, int sample)
-{
-    (void)x;
-    (void)y;
-    (void)sample;
-
-    if (ray_color.r < 0 || ray_color.g < 0 || ray_color.b < 0)
-    {
-#ifndef __KERNELCC__
-        std::cout << "Negative color at [" << x << ", " << y << "], sample " << sample << std::endl;
-#endif
-
-        return true;
-    }
-
-    return false;
-}
-
-HIPRT_HOST_DEVICE HIPRT_INLINE bool check_for_nan(ColorRGB32F ray_color, int x, int y, int sample)
-{
-    (void)x;
-    (void)y;
-    (void)sample;
-
-    if (hippt::isNaN(ray_color.r) || hippt::isNaN(ray_color.g) || hippt::isNaN(ray_color.b))
-    {
-#ifndef __KERNELCC__
-        std::lock_guard<std::mutex> logging_lock(g_mutex);
-        std::cout << "NaN at [" << x << ", " << y << "], sample" << sample << std::endl;
-#endif
-        return true;
-    }
-
-    return false;
-}
-
-HIPRT_HOST_DEVICE HIPRT_INLINE bool sanity_check(const HIPRTRenderData& render_data, RayPayload& ray_payload, int x, int y, int2& res, int sample)
-{
-    bool invalid = false;
-    invalid |= check_for_negative_color(ray_payload.ray_color, x, y, sample);
-    invalid |= check_for_nan(ray_payload.ray_color, x, y, sample);
-
-    if (invalid)
-    {
-#ifndef __KERNELCC__
-        Utils::debugbreak();
-#endif
-
-        if (render_data.render_settings.display_NaNs)
-            debug_set_final_color(render_data, x, y, res.x, ColorRGB32F(1.0e15f, 0.0f, 1.0e15f));
-        else
-            ray_payload.ray_color = ColorRGB32F(0.0f);
-    }
-
-    return !invalid;
-}
-
-#ifdef __KERNELCC__
-GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) FullPathTracer(HIPRTRenderData render_data, int2 res)
-#else
-GLOBAL_KERNEL_SIGNATURE(void) inline FullPathTracer(HIPRTRenderData render_data, int2 res, int x, int y)
-#endif
+/**
+ * Traces the path of the pixel (x, y) and accumulates it in the framebuffer.
+ * Shared by the FullPathTracer megakernel and its persistent threads variant FullPathTracerPersistent
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void path_trace_pixel(HIPRTRenderData& render_data, int2 res, uint32_t x, uint32_t y)
 {
-#ifdef __KERNELCC__
-    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
-    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
-#endif
-    if (x >= res.x || y >= res.y)
-        return;
-
     uint32_t pixel_index = (x + y * res.x);
-    if (!render_data.aux_buffers.pixel_active[pixel_index])
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active())
         return;
 
+    // The traversal of the bounce rays is measured on its own and excluded from this one
+    PixelCostScope shading_cost(render_data, pixel_index, PIXEL_COST_PATH_SHADING);
+
     if (render_data.render_settings.do_render_low_resolution())
     {
-        // Reducing the number of bounces to 3 if rendering at low resolution
+        // Reducing the number of bounces if rendering at low resolution
         // for better interactivity
-        render_data.render_settings.nb_bounces = hippt::min(3, render_data.render_settings.nb_bounces);
+        render_data.render_settings.nb_bounces = hippt::min(render_data.render_settings.render_low_resolution_max_bounces, render_data.render_settings.nb_bounces);
     }
 
     unsigned int seed;
@@ -120,47 +53,108 @@ GLOBAL_KERNEL_SIGNATURE(void) inline FullPathTracer(HIPRTRenderData render_data,
     else
         seed = wang_hash((pixel_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
     Xorshift32Generator random_number_generator(seed);
+    random_number_generator.init_low_discrepancy(x, y, render_data.render_settings.freeze_random ? 0 : render_data.render_settings.sample_number);
 
     float squared_luminance_of_samples = 0.0f;
     ColorRGB32F final_color = ColorRGB32F(0.0f, 0.0f, 0.0f);
+#if DenoiserAOVsFromGBuffer == KERNEL_OPTION_FALSE
     ColorRGB32F denoiser_albedo = ColorRGB32F(0.0f, 0.0f, 0.0f);
     float3 denoiser_normal = make_float3(0.0f, 0.0f, 0.0f);
+#endif
 
     // Initializing the closest hit info the information from the camera ray pass
     HitInfo closest_hit_info;
-    closest_hit_info.inter_point = render_data.g_buffer.first_hits[pixel_index];
-    closest_hit_info.geometric_normal = hippt::normalize(render_data.g_buffer.geometric_normals[pixel_index]);
-    closest_hit_info.shading_normal = hippt::normalize(render_data.g_buffer.shading_normals[pixel_index]);
+    closest_hit_info.inter_point = render_data.g_buffer.get_first_hit(pixel_index, render_data.get_camera(pixel_index).get_position());
+    closest_hit_info.geometric_normal = render_data.g_buffer.get_geometric_normal(pixel_index);
+    closest_hit_info.shading_normal = render_data.g_buffer.get_shading_normal(pixel_index);
 
     // Initializing the ray with the information from the camera ray pass
     hiprtRay ray;
-    ray.direction = hippt::normalize(-render_data.g_buffer.view_directions[pixel_index]);
+    ray.direction = -render_data.g_buffer.get_view_direction(pixel_index);
 
-    bool intersection_found = render_data.g_buffer.camera_ray_hit[pixel_index] == 1;
+    int g_buffer_index = render_data.g_buffer.get_storage_index(pixel_index);
+    bool intersection_found = render_data.g_buffer.camera_ray_hit[g_buffer_index] == 1;
 
     RayPayload ray_payload;
     ray_payload.next_ray_state = RayState::BOUNCE;
-    ray_payload.material = render_data.g_buffer.materials[pixel_index];
-    ray_payload.volume_state = render_data.g_buffer.ray_volume_states[pixel_index];
+    if (intersection_found)
+        // The material index of the GBuffer is only valid if the camera ray hit something
+        ray_payload.material = get_g_buffer_material(render_data, render_data.g_buffer, pixel_index);
+    ray_payload.volume_state.load(render_data.g_buffer.ray_volume_states[g_buffer_index]);
+    // The camera ray pass already propagated its cone up to the first hit and curved it off the surface
+    ray_payload.ray_cone.width = render_data.get_camera(pixel_index).get_pixel_spread_angle(render_data.get_view_resolution(res)) * render_data.g_buffer.first_hit_distances[g_buffer_index];
+    ray_payload.ray_cone.spread_angle = render_data.g_buffer.ray_cone_spread_angles[g_buffer_index];
+
+#if IndirectLightSamplingStrategy == ILS_RESTIR_GI
+    // With ReSTIR GI, the path is split at the visible point: the path tracer only outputs the
+    // emission + direct lighting of the visible point and the rest of the path becomes the
+    // initial candidate of ReSTIR GI, which is then shaded by the ReSTIR GI passes
+    bool restir_gi_path_split = false;
+    float restir_gi_sample_pdf = 0.0f;
+    ColorRGB32F restir_gi_visible_point_color;
+    ReSTIRGISample restir_gi_initial_sample;
+#elif IndirectLightSamplingStrategy == ILS_PATH_GUIDING
+    PathGuidingTrainingPath path_guiding_training_path;
+#endif
+
+    // The training paths are traced completely and update the radiance cache, the other
+    // paths terminate into the cache, see RadianceCacheSettings
+    bool radiance_cache_training_path = radiance_cache_is_training_path(render_data, random_number_generator);
+    RadianceCacheTrainingPath radiance_cache_path;
+
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE && IndirectLightSamplingStrategy != ILS_PATH_GUIDING
+    // BSDF sample of the direct lighting of the previous bounce, already traced, see ReuseMISBSDFSampleForBounce
+    BSDFSampleReuse bsdf_sample_reuse;
+#endif
 
     for (int bounce = 0; bounce < render_data.render_settings.nb_bounces; bounce++)
     {
         if (ray_payload.next_ray_state == RayState::BOUNCE)
         {
+            count_bounce_active_ray(render_data, bounce);
+            // Block 0 is the camera ray
+            random_number_generator.set_dimension_block(bounce + 1);
+            // The rays of this bounce and the shadow rays of its hit
+            ray_payload.geometry_lod_ray_mask = get_geometry_lod_ray_mask(render_data, bounce);
+
             if (bounce > 0)
             {
                 // Not tracing for the primary ray because this has already been done in the camera ray pass
 
-                intersection_found = trace_ray(render_data, ray, ray_payload, closest_hit_info, random_number_generator);
+                ray.maxT = get_indirect_ray_max_distance(render_data, bounce);
+
+                PixelCostScope traversal_cost(render_data, pixel_index, PIXEL_COST_PATH_TRAVERSAL, &shading_cost);
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE && IndirectLightSamplingStrategy != ILS_PATH_GUIDING
+                if (bsdf_sample_reuse.filled)
+                {
+                    // The ray of this bounce was traced by the direct lighting of the previous bounce
+                    intersection_found = bsdf_sample_reuse.hit_found && bsdf_sample_reuse.hit_info.t <= ray.maxT;
+                    closest_hit_info = bsdf_sample_reuse.hit_info;
+                    ray_payload.material = bsdf_sample_reuse.material;
+                    ray_payload.volume_state = bsdf_sample_reuse.volume_state;
+                    ray_payload.ray_cone = bsdf_sample_reuse.ray_cone;
+
+                    bsdf_sample_reuse.filled = false;
+                }
+                else
+#endif
+                {
+                    count_ray_statistic(render_data, RAY_STATISTIC_INDIRECT_RAYS);
+                    intersection_found = trace_ray(render_data, ray, ray_payload, closest_hit_info, random_number_generator);
+                }
             }
 
             if (intersection_found)
             {
+#if DenoiserAOVsFromGBuffer == KERNEL_OPTION_FALSE
                 if (bounce == 0)
                 {
                     denoiser_normal += closest_hit_info.shading_normal;
                     denoiser_albedo += ray_payload.material.base_color;
                 }
+#endif
+
+                use_simplified_bsdf(render_data, ray_payload.material, bounce);
 
                 // For the BRDF calculations, bounces, ... to be correct, we need the normal to be in the same hemisphere as
                 // the view direction. One thing that can go wrong is when we have an emissive triangle (typical area light)
@@ -175,11 +169,44 @@ GLOBAL_KERNEL_SIGNATURE(void) inline FullPathTracer(HIPRTRenderData render_data,
                     closest_hit_info.shading_normal = -closest_hit_info.shading_normal;
                 }
 
+#if IndirectLightSamplingStrategy == ILS_RESTIR_GI
+                if (bounce == 1)
+                {
+                    // Second vertex of the path, that's the ReSTIR GI sample
+                    restir_gi_initial_sample.sample_point = closest_hit_info.inter_point;
+                    restir_gi_initial_sample.sample_normal = closest_hit_info.shading_normal;
+                }
+#endif
+
+                if (bounce > 0)
+                {
+                    if (radiance_cache_training_path)
+                        radiance_cache_path.add_vertex(render_data, closest_hit_info.inter_point, closest_hit_info.shading_normal, ray_payload.throughput, ray_payload.ray_color);
+                    else if (bounce == render_data.render_settings.radiance_cache_settings.termination_bounce)
+                    {
+                        ColorRGB32F cached_radiance;
+                        if (radiance_cache_lookup(render_data, closest_hit_info.inter_point, closest_hit_info.shading_normal, cached_radiance))
+                        {
+                            // The cache replaces the rest of the path
+                            ray_payload.ray_color += cached_radiance * ray_payload.throughput;
+                            ray_payload.next_ray_state = RayState::MISSED;
+
+                            break;
+                        }
+                    }
+                }
+
                 // --------------------------------------------------- //
                 // ----------------- Direct lighting ----------------- //
                 // --------------------------------------------------- //
 
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE && IndirectLightSamplingStrategy != ILS_PATH_GUIDING
+                // No need for the BSDF sample if there's no next bounce
+                BSDFSampleReuse* out_bsdf_sample_reuse = bounce + 1 < render_data.render_settings.nb_bounces ? &bsdf_sample_reuse : nullptr;
+                ColorRGB32F light_direct_contribution = sample_one_light(render_data, ray_payload, closest_hit_info, -ray.direction, random_number_generator, make_int2(x, y), res, bounce, out_bsdf_sample_reuse);
+#else
                 ColorRGB32F light_direct_contribution = sample_one_light(render_data, ray_payload, closest_hit_info, -ray.direction, random_number_generator, make_int2(x, y), res, bounce);
+#endif
                 ColorRGB32F envmap_direct_contribution = sample_environment_map(render_data, ray_payload, closest_hit_info, -ray.direction, bounce, random_number_generator);
 
                 // Clamping direct lighting
@@ -216,24 +243,86 @@ GLOBAL_KERNEL_SIGNATURE(void) inline FullPathTracer(HIPRTRenderData render_data,
                     // Only sampling the next bounce if we actually need it
                     float brdf_pdf;
                     float3 bounce_direction;
+#if IndirectLightSamplingStrategy == ILS_PATH_GUIDING
+                    unsigned int path_guiding_bin_address;
+                    ColorRGB32F bsdf_color = path_guiding_sample_bounce(render_data, ray_payload, closest_hit_info, -ray.direction, bounce_direction, brdf_pdf, path_guiding_bin_address, random_number_generator);
+#elif ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE
+                    ColorRGB32F bsdf_color;
+                    if (bsdf_sample_reuse.filled)
+                    {
+                        // The volume state of the sample is restored with its hit on the next bounce
+                        bsdf_color = bsdf_sample_reuse.bsdf_color;
+                        brdf_pdf = bsdf_sample_reuse.bsdf_pdf;
+                        bounce_direction = bsdf_sample_reuse.ray.direction;
+                    }
+                    else
+                        bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, ray_payload.volume_state, -ray.direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, bounce_direction, brdf_pdf, random_number_generator);
+#else
                     ColorRGB32F bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, ray_payload.volume_state, -ray.direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, bounce_direction, brdf_pdf, random_number_generator);
+#endif
 
                     ray_payload.throughput *= bsdf_color * hippt::abs(hippt::dot(bounce_direction, closest_hit_info.shading_normal)) / brdf_pdf;
                     ray_payload.next_ray_state = RayState::BOUNCE;
+                    ray_payload.ray_cone.scatter(ray_payload.material.roughness);
 
                     // Terminate ray if bad sampling
                     if (brdf_pdf <= 0.0f)
+                    {
+                        count_bounce_path_event(render_data, bounce, BOUNCE_PATH_ABSORBED);
+
                         break;
+                    }
+
+#if IndirectLightSamplingStrategy == ILS_RESTIR_GI
+                    if (bounce == 0)
+                    {
+                        // The BSDF of the visible point is applied by the ReSTIR GI shading pass, only
+                        // gathering the radiance that leaves the second vertex from here on
+                        restir_gi_path_split = true;
+                        restir_gi_sample_pdf = brdf_pdf;
+                        restir_gi_visible_point_color = ray_payload.ray_color;
+
+                        ray_payload.ray_color = ColorRGB32F(0.0f);
+                        ray_payload.throughput = ColorRGB32F(1.0f);
+                    }
+#endif
+
+                    if (russian_roulette_terminate(render_data, bounce, ray_payload.throughput, random_number_generator))
+                    {
+                        count_bounce_path_event(render_data, bounce, BOUNCE_PATH_ABSORBED);
+
+                        break;
+                    }
+
+#if IndirectLightSamplingStrategy == ILS_PATH_GUIDING
+                    // After the russian roulette because the throughput of the surviving paths is scaled
+                    path_guiding_training_path.add_vertex(render_data, path_guiding_bin_address, brdf_pdf, ray_payload.throughput, ray_payload.ray_color);
+#endif
 
                     int outside_surface = hippt::dot(bounce_direction, closest_hit_info.shading_normal) < 0 ? -1.0f : 1.0f;
                     ray.origin = closest_hit_info.inter_point + closest_hit_info.shading_normal * 3.0e-3f * outside_surface;
                     ray.direction = bounce_direction;
+#if ReuseMISBSDFSampleForBounce == KERNEL_OPTION_TRUE && IndirectLightSamplingStrategy != ILS_PATH_GUIDING
+                    if (bsdf_sample_reuse.filled)
+                        // Origin of the ray that was actually traced
+                        ray.origin = bsdf_sample_reuse.ray.origin;
+#endif
                 }
             }
             else
             {
                 ColorRGB32F skysphere_color;
 
+#if IndirectLightSamplingStrategy == ILS_RESTIR_GI
+                if (bounce == 1)
+                {
+                    // The path escaped right after the visible point, the sample is a direction
+                    restir_gi_initial_sample.sample_point = ray.origin + ray.direction * RESTIR_GI_SKY_SAMPLE_DISTANCE;
+                    restir_gi_initial_sample.sample_normal = -ray.direction;
+                    restir_gi_initial_sample.sky_sample = true;
+                }
+#endif
+
                 if (render_data.world_settings.ambient_light_type == AmbientLightType::UNIFORM)
                     skysphere_color = render_data.world_settings.uniform_light_color;
                 else if (render_data.world_settings.ambient_light_type == AmbientLightType::ENVMAP)
@@ -266,26 +355,56 @@ GLOBAL_KERNEL_SIGNATURE(void) inline FullPathTracer(HIPRTRenderData render_data,
 
                 ray_payload.ray_color += skysphere_color * ray_payload.throughput;
                 ray_payload.next_ray_state = RayState::MISSED;
+                count_bounce_path_event(render_data, bounce, BOUNCE_PATH_MISSED);
             }
         }
         else if (ray_payload.next_ray_state == RayState::MISSED)
             break;
     }
 
+    if (radiance_cache_training_path)
+        // Before the ReSTIR GI split below replaces the color of the path
+        radiance_cache_path.splat(render_data, ray_payload.ray_color);
+
+#if IndirectLightSamplingStrategy == ILS_RESTIR_GI
+    // Always writing a reservoir, even an empty one, so that the ReSTIR GI passes
+    // never read the initial candidate of a previous frame
+    ReSTIRGIReservoir restir_gi_initial_reservoir;
+    if (restir_gi_path_split)
+    {
+        if (!ray_payload.ray_color.has_NaN() && ray_payload.ray_color.r >= 0.0f && ray_payload.ray_color.g >= 0.0f && ray_payload.ray_color.b >= 0.0f)
+            restir_gi_initial_sample.outgoing_radiance = ray_payload.ray_color;
+
+        ReSTIRDISurface visible_point_surface = get_pixel_surface(render_data, pixel_index);
+        restir_gi_initial_sample.target_function = ReSTIR_GI_evaluate_target_function(render_data, restir_gi_initial_sample, visible_point_surface);
+
+        restir_gi_initial_reservoir.add_one_candidate(restir_gi_initial_sample, restir_gi_initial_sample.target_function / restir_gi_sample_pdf, random_number_generator);
+        restir_gi_initial_reservoir.end_with_normalization(1.0f, 1.0f);
+
+        // Only the visible point goes through the accumulation of the path tracer
+        ray_payload.ray_color = restir_gi_visible_point_color;
+    }
+    render_data.render_settings.restir_gi_settings.initial_candidates.output_reservoirs[pixel_index] = restir_gi_initial_reservoir;
+#endif
+
     // Checking for NaNs / negative value samples. Output 
     if (!sanity_check(render_data, ray_payload, x, y, res, render_data.render_settings.sample_number))
         return;
 
+#if IndirectLightSamplingStrategy == ILS_PATH_GUIDING
+    path_guiding_training_path.splat(render_data, ray_payload.ray_color);
+#endif
+
     squared_luminance_of_samples += ray_payload.ray_color.luminance() * ray_payload.ray_color.luminance();
     final_color += ray_payload.ray_color;
 
     // If we got here, this means that we still have at least one ray active
-    render_data.aux_buffers.still_one_ray_active[0] = 1;
+    hippt::warp_aggregated_store(render_data.aux_buffers.still_one_ray_active, static_cast<unsigned char>(1));
 
     if (render_data.render_settings.has_access_to_adaptive_sampling_buffers())
         // We can only use these buffers if the adaptive sampling or the stop noise threshold is enabled.
         // Otherwise, the buffers are destroyed to save some VRAM so they are not accessible
-        render_data.aux_buffers.pixel_squared_luminance[pixel_index] += squared_luminance_of_samples;
+        accumulate_adaptive_sampling_buffers(render_data, pixel_index, ray_payload.ray_color.luminance(), squared_luminance_of_samples);
 
     if (render_data.render_settings.sample_number == 0)
         render_data.buffers.pixels[pixel_index] = final_color;
@@ -293,21 +412,58 @@ GLOBAL_KERNEL_SIGNATURE(void) inline FullPathTracer(HIPRTRenderData render_data,
         // If we are at a sample that is not 0, this means that we are accumulating
         render_data.buffers.pixels[pixel_index] += final_color;
 
-    if (render_data.render_settings.sample_number == 0)
-        render_data.aux_buffers.denoiser_albedo[pixel_index] = denoiser_albedo;
-    else
-        render_data.aux_buffers.denoiser_albedo[pixel_index] = (render_data.aux_buffers.denoiser_albedo[pixel_index] * render_data.render_settings.denoiser_AOV_accumulation_counter + denoiser_albedo) / (render_data.render_settings.denoiser_AOV_accumulation_counter + 1.0f);
+#if DenoiserAOVsFromGBuffer == KERNEL_OPTION_FALSE
+    // Accumulated by the DenoiserAOVsResolve kernel otherwise
+    accumulate_denoiser_AOVs(render_data, pixel_index, denoiser_albedo, denoiser_normal);
+#endif
+}
 
-    if (render_data.render_settings.sample_number == 0)
-        render_data.aux_buffers.denoiser_normals[pixel_index] = denoiser_normal;
-    else
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) FullPathTracer(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline FullPathTracer(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    uint32_t x, y;
+    if (!get_thread_pixel(render_data, res, x, y))
+        return;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    path_trace_pixel(render_data, res, x, y);
+}
+
+#ifdef __KERNELCC__
+/**
+ * Persistent threads variant of the FullPathTracer: only enough blocks to fill the GPU are launched
+ * (see GPURenderer::launch_path_tracing()) and each thread fetches the next pixel to trace from the list of
+ * the active pixels built by the ActivePixelCompaction kernel (render_data.aux_buffers.active_pixel_indices) until
+ * the list is empty. A thread that is done with a short path immediately starts tracing another pixel instead of
+ * idling until the longest path of its warp is done, and the converged pixels of the adaptive sampling
+ * are not in the list at all.
+ *
+ * GPU only, the CPU renderer already schedules its pixels dynamically
+ */
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) FullPathTracerPersistent(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+{
+    KERNEL_RENDER_DATA_PROLOGUE
+
+    unsigned int active_pixel_count = render_data.aux_buffers.active_pixel_counters[0];
+
+    while (true)
     {
-        float3 accumulated_normal = (render_data.aux_buffers.denoiser_normals[pixel_index] * render_data.render_settings.denoiser_AOV_accumulation_counter + denoiser_normal) / (render_data.render_settings.denoiser_AOV_accumulation_counter + 1.0f);
-        float normal_length = hippt::length(accumulated_normal);
-        if (normal_length != 0.0f)
-            // Checking that it is non-zero otherwise we would accumulate a persistent NaN in the buffer when normalizing by the 0-length
-            render_data.aux_buffers.denoiser_normals[pixel_index] = accumulated_normal / normal_length;
+        unsigned int list_index = hippt::atomic_add(&render_data.aux_buffers.active_pixel_counters[1], 1u);
+        if (list_index >= active_pixel_count)
+            // No pixel left
+            return;
+
+        uint32_t pixel_index = render_data.aux_buffers.active_pixel_indices[list_index];
+        path_trace_pixel(render_data, res, pixel_index % res.x, pixel_index / res.x);
     }
 }
+#endif
 
 #endif
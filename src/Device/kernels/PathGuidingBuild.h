@@ -0,0 +1,55 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_PATH_GUIDING_BUILD_H
+#define KERNELS_PATH_GUIDING_BUILD_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/PathGuiding.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Builds the normalized CDF of the directional histogram of one cell of the path guiding grid from
+ * the contributions accumulated by the training paths so far. One thread per cell.
+ *
+ * Launched after each training frame, see PathGuidingRenderPass
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) PathGuidingBuild(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline PathGuidingBuild(HIPRTRenderData render_data, unsigned int cell_index)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t cell_index = blockIdx.x * blockDim.x + threadIdx.x;
+#endif
+    const PathGuidingSettings& path_guiding_settings = render_data.render_settings.path_guiding_settings;
+
+    int resolution = path_guiding_settings.grid_resolution;
+    if (cell_index >= resolution * resolution * resolution)
+        return;
+
+    const AtomicType<float>* bins = &path_guiding_settings.training_bins[cell_index * PATH_GUIDING_BIN_COUNT];
+    float* cdf = &path_guiding_settings.sampling_cdfs[cell_index * PATH_GUIDING_BIN_COUNT];
+
+    float sum = 0.0f;
+    for (int bin = 0; bin < PATH_GUIDING_BIN_COUNT; bin++)
+    {
+        sum += bins[bin];
+        cdf[bin] = sum;
+    }
+
+    // Untrained cells keep a CDF of 0, see path_guiding_cell_trained()
+    float inverse_sum = sum > 0.0f ? 1.0f / sum : 0.0f;
+    for (int bin = 0; bin < PATH_GUIDING_BIN_COUNT - 1; bin++)
+        cdf[bin] *= inverse_sum;
+    // Exactly 1 so that the sampling always finds a bin
+    cdf[PATH_GUIDING_BIN_COUNT - 1] = sum > 0.0f ? 1.0f : 0.0f;
+}
+
+#endif
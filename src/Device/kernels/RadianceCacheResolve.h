@@ -0,0 +1,68 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_RADIANCE_CACHE_RESOLVE_H
+#define KERNELS_RADIANCE_CACHE_RESOLVE_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/RadianceCache.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Averages the samples that the training paths of the frame accumulated in one entry of the
+ * radiance cache with the radiance of the entry and evicts the entries that haven't been
+ * updated for RadianceCacheSettings::max_entry_age frames. One thread per entry.
+ *
+ * Launched after the last sample of each frame, see RadianceCacheRenderPass
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) RadianceCacheResolve(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline RadianceCacheResolve(HIPRTRenderData render_data, unsigned int entry_index)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t entry_index = blockIdx.x * blockDim.x + threadIdx.x;
+#endif
+    const RadianceCacheSettings& radiance_cache_settings = render_data.render_settings.radiance_cache_settings;
+    if (entry_index >= radiance_cache_settings.entry_count)
+        return;
+
+    if (radiance_cache_settings.keys[entry_index] == 0u)
+        // Empty entry
+        return;
+
+    AtomicType<float>* accumulation = &radiance_cache_settings.frame_accumulation[entry_index * 4];
+    RadianceCacheEntry& entry = radiance_cache_settings.entries[entry_index];
+
+    float frame_sample_count = accumulation[3];
+    if (frame_sample_count > 0.0f)
+    {
+        // Capping the weight of the history so that the cache follows the changes of the lighting
+        float history_sample_count = hippt::min(entry.sample_count, static_cast<float>(radiance_cache_settings.max_accumulated_samples));
+        float new_sample_count = history_sample_count + frame_sample_count;
+
+        ColorRGB32F frame_radiance(accumulation[0], accumulation[1], accumulation[2]);
+        entry.radiance = (entry.radiance * history_sample_count + frame_radiance) / new_sample_count;
+        entry.sample_count = new_sample_count;
+        entry.age = 0;
+    }
+    else if (++entry.age > radiance_cache_settings.max_entry_age)
+    {
+        // Frees the entry for the other cells
+        entry = RadianceCacheEntry();
+        radiance_cache_settings.keys[entry_index] = 0u;
+    }
+
+    accumulation[0] = 0.0f;
+    accumulation[1] = 0.0f;
+    accumulation[2] = 0.0f;
+    accumulation[3] = 0.0f;
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_H
+#define KERNELS_RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_H
+
+#include "Device/kernels/CameraRays.h"
+#include "Device/kernels/ReSTIR/DI/InitialCandidates.h"
+
+/**
+ * The CameraRays kernel followed by the ReSTIR DI initial candidates of the pixel, in the same thread,
+ * see 'fuse_with_camera_rays' in InitialCandidatesSettings.
+ *
+ * The G-buffer is still filled for the path tracer and the reuse passes but the initial candidates
+ * are sampled on the first hit kept in registers instead of reading it back from the G-buffer
+ * (and the textures of its material) in another kernel.
+ *
+ * The presampled lights are always read from the global buffer, the subsets of the blocks aren't
+ * loaded in shared memory (ReSTIR_DI_InitialCandidatesSharedMemoryLights) since the camera rays
+ * can be launched over the active pixels
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_CameraRaysInitialCandidates(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_CameraRaysInitialCandidates(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    uint32_t x, y;
+    if (!get_thread_camera_ray_pixel(render_data, res, x, y))
+        return;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index;
+    Xorshift32Generator random_number_generator;
+    hiprtRay ray;
+    if (render_data.render_settings.launch_over_active_pixels)
+    {
+        pixel_index = get_camera_ray_pixel_index(render_data, res, x, y);
+        make_camera_ray(render_data, res, x, y, pixel_index, random_number_generator, ray);
+    }
+    else if (!generate_camera_ray(render_data, res, x, y, pixel_index, random_number_generator, ray))
+        return;
+
+    bool has_lights = render_data.buffers.emissive_triangles_count > 0 || render_data.world_settings.ambient_light_type == AmbientLightType::ENVMAP;
+    // Not rendering at low resolution with this kernel, see ReSTIRDIRenderPass::uses_fused_camera_rays(),
+    // so the pixel coordinates are those of the pixel index
+    int2 pixel_coords = make_int2(x, y);
+    unsigned int initial_candidates_seed = render_data.render_settings.restir_di_settings.initial_candidates.random_seed;
+    ReSTIRDIPresampledLightsTile presampled_lights_tile;
+
+    if (can_reuse_primary_hits(render_data))
+    {
+        {
+            PixelCostScope pixel_cost(render_data, pixel_index, PIXEL_COST_CAMERA_RAYS);
+            reuse_camera_ray_hit(render_data, res, pixel_index);
+        }
+
+        // The first hit wasn't traced this sample, reading it from the G-buffer like the InitialCandidates kernel
+        if (has_lights)
+        {
+            PixelCostScope pixel_cost(render_data, pixel_index, PIXEL_COST_RESTIR);
+            ReSTIR_DI_initial_candidates_from_g_buffer(render_data, presampled_lights_tile, pixel_coords, pixel_index, initial_candidates_seed);
+        }
+
+        return;
+    }
+
+    RayPayload ray_payload;
+    HitInfo closest_hit_info;
+    bool intersection_found;
+    {
+        PixelCostScope pixel_cost(render_data, pixel_index, PIXEL_COST_CAMERA_RAYS);
+
+        ray_payload.ray_cone.spread_angle = render_data.get_camera(pixel_index).get_pixel_spread_angle(render_data.get_view_resolution(res));
+
+        count_ray_statistic(render_data, RAY_STATISTIC_CAMERA_RAYS);
+        intersection_found = trace_ray(render_data, ray, ray_payload, closest_hit_info, random_number_generator);
+        apply_material_preview(render_data, pixel_index, intersection_found, closest_hit_info, ray_payload);
+
+        store_camera_ray_hit(render_data, res, pixel_index, ray, intersection_found, ray_payload, closest_hit_info);
+    }
+
+    if (!intersection_found || !has_lights)
+        return;
+
+    PixelCostScope pixel_cost(render_data, pixel_index, PIXEL_COST_RESTIR);
+    if (!ReSTIR_DI_initial_candidates_needed(render_data, pixel_coords, pixel_index))
+        return;
+
+    ReSTIR_DI_initial_candidates_at_surface(render_data, presampled_lights_tile, pixel_coords, pixel_index, ray_payload, closest_hit_info, -ray.direction, initial_candidates_seed);
+}
+
+#endif
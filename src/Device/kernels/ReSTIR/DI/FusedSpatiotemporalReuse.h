@@ -6,15 +6,19 @@
 #ifndef DEVICE_RESTIR_DI_SPATIOTEMPORAL_REUSE_H
 #define DEVICE_RESTIR_DI_SPATIOTEMPORAL_REUSE_H
 
+#include "Device/includes/ActivePixels.h"
 #include "Device/includes/Dispatcher.h"
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Hash.h"
 #include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
 #include "Device/includes/LightUtils.h"
+#include "Device/includes/PixelCost.h"
 #include "Device/includes/ReSTIR/DI/SpatiotemporalMISWeight.h"
 #include "Device/includes/ReSTIR/DI/SpatiotemporalNormalizationWeight.h"
 #include "Device/includes/ReSTIR/DI/Surface.h"
 #include "Device/includes/ReSTIR/DI/Utils.h"
+#include "Device/includes/RuntimeOptions.h"
 #include "Device/includes/Sampling.h"
 
 #include "HostDeviceCommon/Math.h"
@@ -70,7 +74,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool do_include_spatial_visibility_term_or_not(co
 HIPRT_HOST_DEVICE HIPRT_INLINE int3 load_temporal_neighbor_data(const HIPRTRenderData& render_data, const ReSTIRDISurface& center_pixel_surface, int center_pixel_index, int2 res, 
 	ReSTIRDIReservoir& out_temporal_neighbor_reservoir, ReSTIRDISurface& out_temporal_neighbor_surface, Xorshift32Generator& random_number_generator)
 {
-	int3 temporal_neighbor_pixel_index_and_pos = find_temporal_neighbor_index(render_data, render_data.g_buffer.first_hits[center_pixel_index], center_pixel_surface.shading_normal, res, center_pixel_index, random_number_generator);
+	int3 temporal_neighbor_pixel_index_and_pos = find_temporal_neighbor_index(render_data, render_data.g_buffer.get_first_hit(center_pixel_index, render_data.get_camera(center_pixel_index).get_position()), center_pixel_surface.shading_normal, res, center_pixel_index, random_number_generator);
 	if (temporal_neighbor_pixel_index_and_pos.x == -1 || render_data.render_settings.freeze_random)
 		// Temporal occlusion / disoccusion --> temporal neighbor is invalid,
 		// we're only going to resample the initial candidates so let's set that as
@@ -81,7 +85,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE int3 load_temporal_neighbor_data(const HIPRTRende
 		// performance measurements (which we're probably trying to measure since we froze the random)
 		return temporal_neighbor_pixel_index_and_pos;
 
-	out_temporal_neighbor_reservoir = render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs[temporal_neighbor_pixel_index_and_pos.x];
+	out_temporal_neighbor_reservoir = unpack_ReSTIR_DI_reservoir(render_data, render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs[temporal_neighbor_pixel_index_and_pos.x]);
 	if (out_temporal_neighbor_reservoir.M == 0)
 		// No temporal neighbor
 		return temporal_neighbor_pixel_index_and_pos;
@@ -123,7 +127,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void count_valid_spatiotemporal_neighbors(const H
 			// Neighbor out of the viewport / invalid
 			continue;
 
-		if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal, render_data.render_settings.use_prev_frame_g_buffer()))
+		if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_surface, render_data.render_settings.use_prev_frame_g_buffer()))
 			continue;
 
 		out_valid_neighbor_M_sum += render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs[neighbor_pixel_index].M;
@@ -133,24 +137,35 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void count_valid_spatiotemporal_neighbors(const H
 }
 
 #ifdef __KERNELCC__
-GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderData render_data, int2 res)
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_SpatiotemporalReuse(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
 #else
 GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderData render_data, int2 res, int x, int y)
 #endif
 {
 #ifdef __KERNELCC__
-	const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
-	const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+	KERNEL_RENDER_DATA_PROLOGUE
+	uint32_t x, y;
+	if (!get_thread_pixel(render_data, res, x, y))
+		return;
 #endif
 	if (x >= res.x || y >= res.y)
 		return;
 
 	uint32_t center_pixel_index = (x + y * res.x);
+	PixelCostScope pixel_cost(render_data, center_pixel_index, PIXEL_COST_RESTIR);
 
-	if (!render_data.aux_buffers.pixel_active[center_pixel_index] || !render_data.g_buffer.camera_ray_hit[center_pixel_index])
+	if (!render_data.aux_buffers.pixel_status[center_pixel_index].is_active() || !render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(center_pixel_index)])
 		// Pixel inactive because of adaptive sampling, returning
 		return;
 
+	if (!ReSTIR_DI_checkerboard_is_active(render_data.render_settings.restir_di_settings, make_int2(x, y), render_data.render_settings.restir_di_settings.checkerboard_parity))
+		// Not this pixel's turn on the checkerboard, the final shading reuses a neighbor
+		return;
+
+	if (render_data.aux_buffers.pixel_status[center_pixel_index].is_ReSTIR_DI_fallback())
+		// Converged enough for the cheaper direct lighting of the later bounces, see ReSTIRDISettings::fallback_noise_threshold
+		return;
+
 	// Initializing the random generator
 	unsigned int seed;
 	if (render_data.render_settings.freeze_random)
@@ -169,14 +184,14 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 
 	if (render_data.render_settings.restir_di_settings.temporal_pass.temporal_buffer_clear_requested)
 		// We requested a temporal buffer clear for ReSTIR DI
-		render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs[center_pixel_index] = ReSTIRDIReservoir();
+		render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs[center_pixel_index] = ReSTIRDIPackedReservoir();
 
 	ReSTIRDIReservoir temporal_neighbor_reservoir;
 	ReSTIRDISurface temporal_neighbor_surface;
 	int3 temporal_neighbor_pixel_index_and_pos = load_temporal_neighbor_data(render_data, center_pixel_surface, center_pixel_index, res, temporal_neighbor_reservoir, temporal_neighbor_surface, random_number_generator);
-	if ((temporal_neighbor_pixel_index_and_pos.x == -1 || temporal_neighbor_reservoir.M <= 1) && render_data.render_settings.restir_di_settings.spatial_pass.do_disocclusion_reuse_boost)
-		// Increasing the number of spatial samples for disoclussions
-		render_data.render_settings.restir_di_settings.spatial_pass.reuse_neighbor_count = render_data.render_settings.restir_di_settings.spatial_pass.disocclusion_reuse_count;
+	// Disocclusion boost / adaptive neighbor count of this pixel
+	int history_M = temporal_neighbor_pixel_index_and_pos.x == -1 ? 0 : temporal_neighbor_reservoir.M;
+	render_data.render_settings.restir_di_settings.spatial_pass.reuse_neighbor_count = ReSTIR_DI_get_spatial_reuse_neighbor_count(render_data.render_settings.restir_di_settings, history_M);
 
 	// Rotation that is going to be used to rotate the points generated by the Hammersley sampler
 	// for generating the spatial neighbors location to resample
@@ -207,7 +222,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 	}
 
 	ReSTIRDIReservoir spatiotemporal_output_reservoir;
-	ReSTIRDIReservoir initial_candidates_reservoir = render_data.render_settings.restir_di_settings.initial_candidates.output_reservoirs[center_pixel_index];
+	ReSTIRDIReservoir initial_candidates_reservoir = unpack_ReSTIR_DI_reservoir(render_data, render_data.render_settings.restir_di_settings.initial_candidates.output_reservoirs[center_pixel_index]);
 	ReSTIRDISpatiotemporalResamplingMISWeight<ReSTIR_DI_BiasCorrectionWeights> mis_weight_function;
 	if (temporal_neighbor_pixel_index_and_pos.x != -1)
 	{
@@ -270,7 +285,9 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 				temporal_neighbor_reservoir, center_pixel_surface, temporal_neighbor_surface,
 				TEMPORAL_NEIGHBOR_ID, initial_candidates_reservoir.M, temporal_neighbor_reservoir.M, 
 				center_pixel_index, make_int2(temporal_neighbor_pixel_index_and_pos.y, temporal_neighbor_pixel_index_and_pos.z),
-				res, cos_sin_theta_rotation, random_number_generator);
+				res, cos_sin_theta_rotation, neighbor_heuristics_cache, 
+				/* the target function at the center was evaluated with the same visibility as the MIS weights */ target_function_at_center,
+				random_number_generator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS
 			bool update_mc = initial_candidates_reservoir.M > 0 && initial_candidates_reservoir.UCW > 0.0f;
 
@@ -327,7 +344,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 
 
 
-	ReSTIRDIReservoir* spatial_input_reservoir_buffer = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs;
+	ReSTIRDIPackedReservoir* spatial_input_reservoir_buffer = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs;
 
 	// Resampling the neighbors. Using neighbors + 1 here so that
 	// we can use the last iteration of the loop to resample the *initial candidates reservoir*
@@ -369,7 +386,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 			// 
 			// Only checking the heuristic if we have more than 32 neighbors (does not fit in the heuristic cache)
 			// If we have less than 32 neighbors, we've already checked the cache at the beginning of this for loop
-			if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal, render_data.render_settings.use_prev_frame_g_buffer()))
+			if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_surface, render_data.render_settings.use_prev_frame_g_buffer()))
 				continue;
 
 		// Neighbor surface needed for roughness m-capping and jacobian determinant
@@ -378,7 +395,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 			// Last iteration, resampling the initial candidates
 			neighbor_reservoir = initial_candidates_reservoir;
 		else
-			neighbor_reservoir = spatial_input_reservoir_buffer[neighbor_pixel_index];
+			neighbor_reservoir = unpack_ReSTIR_DI_reservoir(render_data, spatial_input_reservoir_buffer[neighbor_pixel_index]);
 
 		float target_function_at_center = 0.0f;
 		bool do_neighbor_target_function_visibility = do_include_spatial_visibility_term_or_not(render_data, spatial_neighbor_index);
@@ -415,9 +432,9 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 			// "solid angle PDF at the neighbor" to the solid angle at the center pixel and we do
 			// that by multiplying by the jacobian determinant of the reconnection shift in solid
 			// angle, Eq. 52 of 2022, "Generalized Resampled Importance Sampling".
-			ReSTIRDISurface neighbor_surface = get_pixel_surface(render_data, neighbor_pixel_index, render_data.render_settings.use_prev_frame_g_buffer());
-
-			jacobian_determinant = get_jacobian_determinant_reconnection_shift(render_data, neighbor_reservoir, center_pixel_surface.shading_point, neighbor_surface.shading_point);
+			//
+			// Only the point of the neighbor is needed, reading it from the G-buffer instead of evaluating the whole surface
+			jacobian_determinant = get_jacobian_determinant_reconnection_shift(render_data, neighbor_reservoir, center_pixel_surface.shading_point, neighbor_pixel_index, render_data.render_settings.use_prev_frame_g_buffer());
 
 			if (jacobian_determinant == -1.0f)
 			{
@@ -436,12 +453,19 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_LIKE
 		float mis_weight = mis_weight_function.get_resampling_MIS_weight(render_data, neighbor_reservoir.M);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_GBH
+		// The target function at the center that we just evaluated can be reused by the MIS weight
+		// if it was evaluated with the same visibility. The target function of the initial candidates
+		// reservoir may not have been evaluated with the same visibility
+		float cached_target_function_at_center = -1.0f;
+		if (neighbor_reservoir.UCW > 0.0f && spatial_neighbor_index != reused_neighbors_count && do_neighbor_target_function_visibility == (ReSTIR_DI_BiasCorrectionUseVisibility == KERNEL_OPTION_TRUE))
+			cached_target_function_at_center = target_function_at_center;
+
 		// Using 'spatial_neighbor_index + 1' in this function call because the index
 		// 0 is for the temporal neighbor so we start at 1 by using '+ 1'
 		float mis_weight = mis_weight_function.get_resampling_MIS_weight(render_data, neighbor_reservoir, center_pixel_surface, temporal_neighbor_surface,
 			spatial_neighbor_index + 1, initial_candidates_reservoir.M, temporal_neighbor_reservoir.M, 
 			center_pixel_index, make_int2(temporal_neighbor_pixel_index_and_pos.y, temporal_neighbor_pixel_index_and_pos.z),
-			res, cos_sin_theta_rotation, random_number_generator);
+			res, cos_sin_theta_rotation, neighbor_heuristics_cache, cached_target_function_at_center, random_number_generator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS
 		bool update_mc = initial_candidates_reservoir.M > 0 && initial_candidates_reservoir.UCW > 0.0f;
 
@@ -501,17 +525,17 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 #if ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_1_OVER_M
 	normalization_function.get_normalization(render_data, spatiotemporal_output_reservoir, initial_candidates_reservoir, center_pixel_surface, 
 		temporal_neighbor_reservoir.M, center_pixel_index, make_int2(temporal_neighbor_pixel_index_and_pos.y, temporal_neighbor_pixel_index_and_pos.z),
-		res, cos_sin_theta_rotation, normalization_numerator, normalization_denominator);
+		res, cos_sin_theta_rotation, neighbor_heuristics_cache, normalization_numerator, normalization_denominator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_1_OVER_Z
 	normalization_function.get_normalization(render_data, 
 		spatiotemporal_output_reservoir, center_pixel_surface, temporal_neighbor_surface,
 		initial_candidates_reservoir.M, temporal_neighbor_reservoir.M, center_pixel_index, 
-		make_int2(temporal_neighbor_pixel_index_and_pos.y, temporal_neighbor_pixel_index_and_pos.z), res, cos_sin_theta_rotation, 
+		make_int2(temporal_neighbor_pixel_index_and_pos.y, temporal_neighbor_pixel_index_and_pos.z), res, cos_sin_theta_rotation, neighbor_heuristics_cache, 
 		normalization_numerator, normalization_denominator, random_number_generator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_LIKE
 	normalization_function.get_normalization(render_data, spatiotemporal_output_reservoir, center_pixel_surface, temporal_neighbor_surface, 
 		selected_neighbor, initial_candidates_reservoir.M, temporal_neighbor_reservoir.M, center_pixel_index, make_int2(temporal_neighbor_pixel_index_and_pos.y, temporal_neighbor_pixel_index_and_pos.z),
-		res, cos_sin_theta_rotation, normalization_numerator, normalization_denominator, 
+		res, cos_sin_theta_rotation, neighbor_heuristics_cache, normalization_numerator, normalization_denominator, 
 		random_number_generator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_GBH
 	normalization_function.get_normalization(normalization_numerator, normalization_denominator);
@@ -531,7 +555,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 	|| ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS \
 	|| ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE) \
 	&& ReSTIR_DI_BiasCorrectionUseVisibility == KERNEL_OPTION_TRUE \
-	&& (ReSTIR_DI_DoVisibilityReuse == KERNEL_OPTION_TRUE || (ReSTIR_DI_InitialTargetFunctionVisibility == KERNEL_OPTION_TRUE && ReSTIR_DI_SpatialTargetFunctionVisibility == KERNEL_OPTION_TRUE))
+	&& (ReSTIR_DI_DoVisibilityReuse == KERNEL_OPTION_TRUE || KernelOptionsRuntimeBranches == KERNEL_OPTION_TRUE || (ReSTIR_DI_InitialTargetFunctionVisibility == KERNEL_OPTION_TRUE && ReSTIR_DI_SpatialTargetFunctionVisibility == KERNEL_OPTION_TRUE))
 	// Why is this needed?
 	//
 	// Picture the case where we have visibility reuse (at the end of the initial candidates sampling pass),
@@ -572,16 +596,26 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatiotemporalReuse(HIPRTRenderDa
 	//
 	// We only need this if we're going to temporally reuse (because then the output of the spatial reuse must be correct
 	// for the temporal reuse pass) or if we have multiple spatial reuse passes and this is not the last spatial pass
-	if (render_data.render_settings.restir_di_settings.temporal_pass.do_temporal_reuse_pass || render_data.render_settings.restir_di_settings.spatial_pass.number_of_passes - 1 != render_data.render_settings.restir_di_settings.spatial_pass.spatial_pass_index)
+	//
+	// With the runtime branches, whether the initial candidates have been through the visibility reuse is only known here
+	bool initial_candidates_have_visibility = RUNTIME_KERNEL_OPTION(render_data.render_settings, ReSTIR_DI_DoVisibilityReuse, restir_di_do_visibility_reuse) == KERNEL_OPTION_TRUE
+		|| (ReSTIR_DI_InitialTargetFunctionVisibility == KERNEL_OPTION_TRUE && ReSTIR_DI_SpatialTargetFunctionVisibility == KERNEL_OPTION_TRUE);
+	if (initial_candidates_have_visibility && (render_data.render_settings.restir_di_settings.temporal_pass.do_temporal_reuse_pass || render_data.render_settings.restir_di_settings.spatial_pass.number_of_passes - 1 != render_data.render_settings.restir_di_settings.spatial_pass.spatial_pass_index))
+	{
+#if ReSTIR_DI_BatchedVisibilityRays == KERNEL_OPTION_TRUE
+		ReSTIR_DI_queue_visibility_reuse_ray(render_data, spatiotemporal_output_reservoir, center_pixel_surface.shading_point, center_pixel_index);
+#else
 		ReSTIR_DI_visibility_reuse(render_data, spatiotemporal_output_reservoir, center_pixel_surface.shading_point, random_number_generator);
 #endif
+	}
+#endif
 
 	// M-capping so that we don't have to M-cap when reading reservoirs on the next frame
 	if (render_data.render_settings.restir_di_settings.m_cap > 0)
 		// M-capping the temporal neighbor if an M-cap has been given
 		spatiotemporal_output_reservoir.M = hippt::min(spatiotemporal_output_reservoir.M, render_data.render_settings.restir_di_settings.m_cap);
 
-	render_data.render_settings.restir_di_settings.spatial_pass.output_reservoirs[center_pixel_index] = spatiotemporal_output_reservoir;
+	render_data.render_settings.restir_di_settings.spatial_pass.output_reservoirs[center_pixel_index] = pack_ReSTIR_DI_reservoir(render_data, spatiotemporal_output_reservoir);
 }
 
 #endif
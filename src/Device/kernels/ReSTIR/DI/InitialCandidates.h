@@ -6,52 +6,42 @@
 #ifndef KERNELS_RESTIR_DI_INITIAL_CANDIDATES_H
 #define KERNELS_RESTIR_DI_INITIAL_CANDIDATES_H
 
+#include "Device/includes/ActivePixels.h"
 #include "Device/includes/Dispatcher.h"
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Hash.h"
 #include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/LightBVH.h"
 #include "Device/includes/LightUtils.h"
+#include "Device/includes/PixelCost.h"
+#include "Device/includes/PresampledLights.h"
 #include "Device/includes/ReSTIR/DI/Utils.h"
 #include "Device/includes/ReSTIR/DI/PresampledLight.h"
+#include "Device/includes/ReSTIR/DI/PresampledLightsTile.h"
+#include "Device/includes/RuntimeOptions.h"
 
 #include "HostDeviceCommon/HIPRTCamera.h"
 #include "HostDeviceCommon/Math.h"
 #include "HostDeviceCommon/RenderData.h"
 
-/**
- * Reference: https://en.wikipedia.org/wiki/Pairing_function
- */
-HIPRT_HOST_DEVICE HIPRT_INLINE int cantor_pairing_function(int x, int y)
-{
-    return (x + y + 1) * (x + y) / 2 + y;
-}
-
-HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDISample use_presampled_light_candidate(const HIPRTRenderData& render_data, const int2& pixel_coords,
+HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDISample use_presampled_light_candidate(const HIPRTRenderData& render_data, const ReSTIRDIPresampledLightsTile& presampled_lights_tile, const int2& pixel_coords,
     const float3& evaluated_point, const float3& shading_normal,
     ColorRGB32F& out_sample_radiance, float& out_sample_cosine_term, float& out_sample_pdf, float& out_distance_to_light, float3& out_to_light_direction,
     Xorshift32Generator& random_number_generator)
 {
     ReSTIRDISample light_sample;
-    const LightPresamplingSettings& light_presampling_settings = render_data.render_settings.restir_di_settings.light_presampling;
 
-    // We want all threads in a block of light_presampling_settings.tile_size * light_presampling_settings.tile_size
-    // pixels to sample from the same random subset of lights.
-    // We compute a unique number per each light_presampling_settings.tile_size * light_presampling_settings.tile_size
-    // tile of pixels and use that unique number as seed for our random number generator
-    int tile_index_seed = cantor_pairing_function(pixel_coords.x / light_presampling_settings.tile_size, pixel_coords.y / light_presampling_settings.tile_size);
-
-    Xorshift32Generator subset_rng(render_data.random_seed * (tile_index_seed + 1));
-    int random_subset_index = subset_rng.random_index(light_presampling_settings.number_of_subsets);
-    int random_light_index_in_subset = random_number_generator.random_index(light_presampling_settings.subset_size);
-    int light_sample_index = random_subset_index * light_presampling_settings.subset_size + random_light_index_in_subset;
-
-    ReSTIRDIPresampledLight presampled_light_sample = light_presampling_settings.light_samples[light_sample_index];
+    ReSTIRDIPresampledLight presampled_light_sample = get_tile_presampled_light(render_data, presampled_lights_tile, pixel_coords, random_number_generator);
 
     light_sample.emissive_triangle_index = presampled_light_sample.emissive_triangle_index;
     light_sample.point_on_light_source = presampled_light_sample.point_on_light_source;
-    light_sample.flags = presampled_light_sample.flags;
+    light_sample.flags = presampled_light_sample.flags & ~ReSTIRDISampleFlags::RESTIR_DI_FLAGS_EMISSION_TEXTURE;
 
-    out_sample_radiance = presampled_light_sample.radiance;
+    if (presampled_light_sample.flags & ReSTIRDISampleFlags::RESTIR_DI_FLAGS_EMISSION_TEXTURE)
+        out_sample_radiance = get_emissive_triangle_emission(render_data, presampled_light_sample.emissive_triangle_index, presampled_light_sample.point_on_light_source);
+    else
+        out_sample_radiance = presampled_light_sample.radiance;
     out_sample_pdf = presampled_light_sample.pdf;
 
     if (light_sample.flags & ReSTIRDISampleFlags::RESTIR_DI_FLAGS_ENVMAP_SAMPLE)
@@ -103,7 +93,11 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDISample sample_fresh_light_candidate(const
         // Light sample
 
         LightSourceInformation light_source_info;
-        light_sample.point_on_light_source = uniform_sample_one_emissive_triangle(render_data, random_number_generator, out_sample_pdf, light_source_info);
+#if ReSTIR_DI_InitialCandidatesUseLightBVH == KERNEL_OPTION_TRUE
+        light_sample.point_on_light_source = light_bvh_sample_one_emissive_triangle(render_data, evaluated_point, closest_hit_info.shading_normal, random_number_generator, out_sample_pdf, light_source_info);
+#else
+        light_sample.point_on_light_source = sample_one_emissive_triangle(render_data, closest_hit_info.inter_point, random_number_generator, out_sample_pdf, light_source_info);
+#endif
         light_sample.emissive_triangle_index = light_source_info.emissive_triangle_index;
 
         if (out_sample_pdf > 0.0f)
@@ -152,7 +146,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDISample sample_fresh_light_candidate(const
         // Envmap sample
 
         float3 envmap_sampled_direction;
-        out_sample_radiance = envmap_sample(render_data.world_settings, envmap_sampled_direction, out_sample_pdf, random_number_generator);
+        out_sample_radiance = envmap_sample_at_point(render_data.world_settings, closest_hit_info.inter_point, envmap_sampled_direction, out_sample_pdf, random_number_generator);
         out_sample_cosine_term = hippt::max(0.0f, hippt::dot(envmap_sampled_direction, closest_hit_info.shading_normal));
 
         bool contributes_enough = check_minimum_light_contribution(render_data.render_settings.minimum_light_contribution, out_sample_radiance * out_sample_cosine_term / out_sample_pdf);
@@ -182,7 +176,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDISample sample_fresh_light_candidate(const
 }
 
 // Try passing only volume state in here, not ray payload
-HIPRT_HOST_DEVICE HIPRT_INLINE void sample_light_candidates(const HIPRTRenderData& render_data, const int2& pixel_coords, ReSTIRDIReservoir& reservoir, int nb_light_candidates, int nb_bsdf_candidates, float envmap_candidate_probability, const float3& view_direction, const HitInfo& closest_hit_info, const RayPayload& ray_payload, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE void sample_light_candidates(const HIPRTRenderData& render_data, const ReSTIRDIPresampledLightsTile& presampled_lights_tile, const int2& pixel_coords, ReSTIRDIReservoir& reservoir, int nb_light_candidates, int nb_bsdf_candidates, float envmap_candidate_probability, const float3& view_direction, const HitInfo& closest_hit_info, const RayPayload& ray_payload, Xorshift32Generator& random_number_generator)
 {
     bool inside_surface = false;// hippt::dot(view_direction, closest_hit_info.geometric_normal) < 0;
     float inside_surface_multiplier = inside_surface ? -1.0f : 1.0f;
@@ -196,8 +190,10 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void sample_light_candidates(const HIPRTRenderDat
 
         float distance_to_light = 0.0f;
         float3 to_light_direction{ 0.0f, 0.0f, 0.0f };
-#if ReSTIR_DI_DoLightsPresampling == KERNEL_OPTION_TRUE
-        ReSTIRDISample light_sample = use_presampled_light_candidate(render_data, pixel_coords, 
+#if ReSTIR_DI_DoLightsPresampling == KERNEL_OPTION_TRUE && ReSTIR_DI_InitialCandidatesUseLightBVH == KERNEL_OPTION_FALSE && EmissiveTrianglesSamplingStrategy != ETSS_LIGHT_CLUSTERS
+        // Presampled lights are shared by the pixels of a tile so they cannot be used with
+        // the light hierarchy or the light clusters which sample per shading point
+        ReSTIRDISample light_sample = use_presampled_light_candidate(render_data, presampled_lights_tile, pixel_coords, 
             evaluated_point, closest_hit_info.shading_normal * inside_surface_multiplier, 
             sample_radiance, sample_cosine_term, sample_pdf, distance_to_light, to_light_direction, 
             random_number_generator);
@@ -232,7 +228,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void sample_light_candidates(const HIPRTRenderDat
             ColorRGB32F bsdf_contribution = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, ray_payload.material, volume_state, view_direction, closest_hit_info.shading_normal, to_light_direction, bsdf_pdf);
 
             ColorRGB32F light_contribution = bsdf_contribution * sample_radiance * sample_cosine_term;
-            float target_function = light_contribution.luminance();
+            float target_function = ReSTIR_DI_target_function_luminance(bsdf_contribution, sample_radiance, sample_cosine_term);
 
             if (!check_minimum_light_contribution(render_data.render_settings.minimum_light_contribution, light_contribution / sample_pdf / bsdf_pdf))
                 target_function = 0.0f;
@@ -331,7 +327,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void sample_bsdf_candidates(const HIPRTRenderData
                 float cosine_at_evaluated_point = hippt::abs(hippt::dot(closest_hit_info.shading_normal, sampled_direction));
 
                 ColorRGB32F light_contribution = bsdf_color * shadow_light_ray_hit_info.hit_emission * cosine_at_evaluated_point;
-                float target_function = light_contribution.luminance();
+                float target_function = ReSTIR_DI_target_function_luminance(bsdf_color, shadow_light_ray_hit_info.hit_emission, cosine_at_evaluated_point);
 
                 float light_pdf = 0.0f;
                 if (!refraction_sampled)
@@ -349,7 +345,12 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void sample_bsdf_candidates(const HIPRTRenderData
                     // (because the BSDF sample, that should have weight 1 [or to be precise: 1 / nb_bsdf_samples]
                     // will have weight 1 / (1 + nb_light_samples) [or to be precise: 1 / (nb_bsdf_samples + nb_light_samples)]
                     // and this is going to cause darkening as the number of light samples grows)
-                    light_pdf = pdf_of_emissive_triangle_hit(render_data, shadow_light_ray_hit_info, sampled_direction);
+#if ReSTIR_DI_InitialCandidatesUseLightBVH == KERNEL_OPTION_TRUE
+                    // Same shading point and normal as the light candidates for the PDFs to match
+                    light_pdf = light_bvh_pdf_of_emissive_triangle_hit(render_data, shadow_light_ray_hit_info, sampled_direction, evaluated_point, closest_hit_info.shading_normal);
+#else
+                    light_pdf = pdf_of_emissive_triangle_hit(render_data, shadow_light_ray_hit_info, sampled_direction, closest_hit_info.inter_point);
+#endif
 
                 if (!check_minimum_light_contribution(render_data.render_settings.minimum_light_contribution, light_contribution / light_pdf / bsdf_sample_pdf))
                 {
@@ -385,7 +386,13 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void sample_bsdf_candidates(const HIPRTRenderData
                 if (cosine_at_evaluated_point > 0.0f)
                 {
                     float envmap_pdf;
+#if ReSTIR_DI_DoLightsPresampling == KERNEL_OPTION_TRUE && ReSTIR_DI_InitialCandidatesUseLightBVH == KERNEL_OPTION_FALSE
+                    // The presampled envmap samples are the same for all the pixels so they're
+                    // not sampled through the envmap portals as seen from the shading point
                     ColorRGB32F envmap_radiance = envmap_eval(render_data, sampled_direction, envmap_pdf);
+#else
+                    ColorRGB32F envmap_radiance = envmap_eval_at_point(render_data, closest_hit_info.inter_point, sampled_direction, envmap_pdf);
+#endif
 
                     ColorRGB32F envmap_contribution = bsdf_color * envmap_radiance * cosine_at_evaluated_point;
                     // Not taking the light sampling PDF into account in the balance heuristic because a envmap hit
@@ -399,7 +406,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void sample_bsdf_candidates(const HIPRTRenderData
                         continue;
                     }
 
-                    float target_function = envmap_contribution.luminance();
+                    float target_function = ReSTIR_DI_target_function_luminance(bsdf_color, envmap_radiance, cosine_at_evaluated_point);
 
                     // We're evaluating the probability of choosing that BSDF-sample direction with the envmap sampler.
                     // Because our envmap sampler is chosen only with probability 'envmap_candidate_probability', we multiply
@@ -424,7 +431,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE void sample_bsdf_candidates(const HIPRTRenderData
     }
 }
 
-HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIReservoir sample_initial_candidates(const HIPRTRenderData& render_data, const int2& pixel_coords, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator)
+HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIReservoir sample_initial_candidates(const HIPRTRenderData& render_data, const ReSTIRDIPresampledLightsTile& presampled_lights_tile, const int2& pixel_coords, const RayPayload& ray_payload, const HitInfo closest_hit_info, const float3& view_direction, Xorshift32Generator& random_number_generator)
 {
     // If we're rendering at low resolution, only doing 1 candidate of each
     // for better interactive framerates
@@ -446,7 +453,7 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIReservoir sample_initial_candidates(const
     // Sampling candidates with weighted reservoir sampling
     ReSTIRDIReservoir reservoir;
 
-    sample_light_candidates(render_data, pixel_coords, reservoir, nb_light_candidates, nb_bsdf_candidates, envmap_candidate_probability, view_direction, closest_hit_info, ray_payload, random_number_generator);
+    sample_light_candidates(render_data, presampled_lights_tile, pixel_coords, reservoir, nb_light_candidates, nb_bsdf_candidates, envmap_candidate_probability, view_direction, closest_hit_info, ray_payload, random_number_generator);
     sample_bsdf_candidates(render_data, reservoir, nb_light_candidates, nb_bsdf_candidates, envmap_candidate_probability, view_direction, closest_hit_info, ray_payload, random_number_generator);
 
     reservoir.end();
@@ -459,27 +466,35 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIReservoir sample_initial_candidates(const
     return reservoir;
 }
 
-#ifdef __KERNELCC__
-GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_InitialCandidates(HIPRTRenderData render_data, int2 res)
-#else
-GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_InitialCandidates(HIPRTRenderData render_data, int2 res, int x, int y)
-#endif
+/**
+ * Returns false if the pixel doesn't sample initial candidates this frame
+ * because of the checkerboard or the fallback of ReSTIR DI
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE bool ReSTIR_DI_initial_candidates_needed(const HIPRTRenderData& render_data, int2 pixel_coords, uint32_t pixel_index)
 {
-    if (render_data.buffers.emissive_triangles_count == 0 && render_data.world_settings.ambient_light_type != AmbientLightType::ENVMAP)
-        // No initial candidates to sample since no lights
-        return;
+    if (!ReSTIR_DI_checkerboard_is_active(render_data.render_settings.restir_di_settings, pixel_coords, render_data.render_settings.restir_di_settings.checkerboard_parity))
+        // Not this pixel's turn on the checkerboard, the final shading reuses a neighbor
+        return false;
 
-#ifdef __KERNELCC__
-    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
-    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
-#endif
-    if (x >= res.x || y >= res.y)
-        return;
+    if (render_data.aux_buffers.pixel_status[pixel_index].is_ReSTIR_DI_fallback())
+        // Converged enough for the cheaper direct lighting of the later bounces, see ReSTIRDISettings::fallback_noise_threshold
+        return false;
 
-    uint32_t pixel_index = (x + y * res.x);
-    SimplifiedRendererMaterial material = render_data.g_buffer.materials[pixel_index];
+    return true;
+}
 
-    if (material.is_emissive())
+/**
+ * Samples, and stores into 'initial_candidates.output_reservoirs', the initial candidates reservoir
+ * of the pixel whose first hit is described by 'ray_payload', 'hit_info' and 'view_direction'.
+ * The pixel must pass ReSTIR_DI_initial_candidates_needed().
+ * 
+ * 'random_seed' seeds the random generator of the pixel, different from the seed of the camera ray when
+ * called by the fused camera rays kernel (see ReSTIR_DI_CameraRaysInitialCandidates())
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void ReSTIR_DI_initial_candidates_at_surface(const HIPRTRenderData& render_data, const ReSTIRDIPresampledLightsTile& presampled_lights_tile, int2 pixel_coords, uint32_t pixel_index,
+    const RayPayload& ray_payload, const HitInfo& hit_info, const float3& view_direction, unsigned int random_seed)
+{
+    if (ray_payload.material.is_emissive())
         // If this pixel is on an emissive material, indicating that the reservoir is emissive
         // with the flag so that the temporal and spatial reuse can avoir resampling on those.
         // We're not resampling on emissive materials because there is no point, we're not trying
@@ -490,34 +505,89 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_InitialCandidates(HIPRTRenderData
     if (render_data.render_settings.freeze_random)
         seed = wang_hash(pixel_index + 1);
     else
-        seed = wang_hash((pixel_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
+        seed = wang_hash((pixel_index + 1) * (render_data.render_settings.sample_number + 1) * random_seed);
 
     Xorshift32Generator random_number_generator(seed);
 
-    if (!render_data.aux_buffers.pixel_active[pixel_index] || !render_data.g_buffer.camera_ray_hit[pixel_index])
+    // Producing and storing the reservoir
+    ReSTIRDIReservoir initial_candidates_reservoir = sample_initial_candidates(render_data, presampled_lights_tile, pixel_coords, ray_payload, hit_info, view_direction, random_number_generator);
+
+    if (RUNTIME_KERNEL_OPTION(render_data.render_settings, ReSTIR_DI_DoVisibilityReuse, restir_di_do_visibility_reuse) == KERNEL_OPTION_TRUE)
+    {
+#if ReSTIR_DI_BatchedVisibilityRays == KERNEL_OPTION_TRUE
+        ReSTIR_DI_queue_visibility_reuse_ray(render_data, initial_candidates_reservoir, hit_info.inter_point + hit_info.shading_normal * 1.0e-4f, pixel_index);
+#else
+        ReSTIR_DI_visibility_reuse(render_data, initial_candidates_reservoir, hit_info.inter_point + hit_info.shading_normal * 1.0e-4f, random_number_generator);
+#endif
+    }
+
+    render_data.render_settings.restir_di_settings.initial_candidates.output_reservoirs[pixel_index] = pack_ReSTIR_DI_reservoir(render_data, initial_candidates_reservoir);
+}
+
+/**
+ * Same as ReSTIR_DI_initial_candidates_at_surface() but with the first hit of the pixel read back from the G-buffer
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE void ReSTIR_DI_initial_candidates_from_g_buffer(const HIPRTRenderData& render_data, const ReSTIRDIPresampledLightsTile& presampled_lights_tile, int2 pixel_coords, uint32_t pixel_index, unsigned int random_seed)
+{
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active() || !render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(pixel_index)])
         // Pixel inactive because of adaptive sampling, returning
         return;
 
-    HitInfo hit_info;
-    hit_info.geometric_normal = render_data.g_buffer.geometric_normals[pixel_index];
-    hit_info.shading_normal = render_data.g_buffer.shading_normals[pixel_index];
-    hit_info.inter_point = render_data.g_buffer.first_hits[pixel_index];
+    if (!ReSTIR_DI_initial_candidates_needed(render_data, pixel_coords, pixel_index))
+        return;
 
+    HitInfo hit_info;
+    hit_info.geometric_normal = render_data.g_buffer.get_geometric_normal(pixel_index);
+    hit_info.shading_normal = render_data.g_buffer.get_shading_normal(pixel_index);
+    hit_info.inter_point = render_data.g_buffer.get_first_hit(pixel_index, render_data.get_camera(pixel_index).get_position());
 
-    float3 view_direction = render_data.g_buffer.view_directions[pixel_index];
+    float3 view_direction = render_data.g_buffer.get_view_direction(pixel_index);
 
     RayPayload ray_payload;
-    ray_payload.material = material;
-    ray_payload.volume_state = render_data.g_buffer.ray_volume_states[pixel_index];
+    ray_payload.material = get_g_buffer_material(render_data, render_data.g_buffer, pixel_index);
+    ray_payload.volume_state.load(render_data.g_buffer.ray_volume_states[render_data.g_buffer.get_storage_index(pixel_index)]);
 
-    // Producing and storing the reservoir
-    ReSTIRDIReservoir initial_candidates_reservoir = sample_initial_candidates(render_data, make_int2(x, y), ray_payload, hit_info, view_direction, random_number_generator);
+    ReSTIR_DI_initial_candidates_at_surface(render_data, presampled_lights_tile, pixel_coords, pixel_index, ray_payload, hit_info, view_direction, random_seed);
+}
 
-#if ReSTIR_DI_DoVisibilityReuse == KERNEL_OPTION_TRUE
-    ReSTIR_DI_visibility_reuse(render_data, initial_candidates_reservoir, hit_info.inter_point + hit_info.shading_normal * 1.0e-4f, random_number_generator);
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_InitialCandidates(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_InitialCandidates(HIPRTRenderData render_data, int2 res, int x, int y)
 #endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+#endif
+
+    if (render_data.buffers.emissive_triangles_count == 0 && render_data.world_settings.ambient_light_type != AmbientLightType::ENVMAP)
+        // No initial candidates to sample since no lights
+        return;
+
+    ReSTIRDIPresampledLightsTile presampled_lights_tile;
+#ifdef __KERNELCC__
+#if ReSTIR_DI_InitialCandidatesSharedMemoryLights == KERNEL_OPTION_TRUE && ReSTIR_DI_DoLightsPresampling == KERNEL_OPTION_TRUE && ReSTIR_DI_InitialCandidatesUseLightBVH == KERNEL_OPTION_FALSE && EmissiveTrianglesSamplingStrategy != ETSS_LIGHT_CLUSTERS
+    // The subset of presampled lights is shared by the 2D blocks of the image, this kernel is then
+    // never launched over the active pixels (see ReSTIRDIRenderPass::launch_initial_candidates_pass())
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+
+    __shared__ ReSTIRDISharedPresampledLight tile_lights[RESTIR_DI_SHARED_PRESAMPLED_LIGHT_COUNT];
+    // Before any thread returns, all the threads of the block load the subset
+    load_presampled_lights_tile(render_data, presampled_lights_tile, tile_lights);
+#else
+    uint32_t x, y;
+    if (!get_thread_pixel(render_data, res, x, y))
+        return;
+#endif
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = (x + y * res.x);
+    PixelCostScope pixel_cost(render_data, pixel_index, PIXEL_COST_RESTIR);
 
-    render_data.render_settings.restir_di_settings.initial_candidates.output_reservoirs[pixel_index] = initial_candidates_reservoir;
+    ReSTIR_DI_initial_candidates_from_g_buffer(render_data, presampled_lights_tile, make_int2(x, y), pixel_index, render_data.random_seed);
 }
 
 #endif
@@ -10,6 +10,7 @@
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Hash.h"
 #include "Device/includes/LightUtils.h"
+#include "Device/includes/SceneInstances.h"
 #include "Device/kernel_parameters/ReSTIR/DI/LightPresamplingParameters.h"
 
 #include "HostDeviceCommon/RenderData.h"
@@ -38,12 +39,19 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIPresampledLight presample_emissive_triang
 {
     ReSTIRDIPresampledLight presampled_light;
 
+#if EmissiveTrianglesSamplingStrategy == ETSS_POWER_ALIAS_TABLE
+    if (parameters.emissive_triangles_total_power <= 0.0f)
+        // No emissive triangle has any power, the presampled light is left with a 0 PDF
+        return presampled_light;
+
+    int random_index = sample_alias_table(parameters.emissive_triangles_alias_table_probas, parameters.emissive_triangles_alias_table_alias, parameters.emissive_triangles_count, random_number_generator);
+#else
     int random_index = random_number_generator.random_index(parameters.emissive_triangles_count);
+#endif
     int triangle_index = parameters.emissive_triangles_indices[random_index];
 
-    float3 vertex_A = parameters.vertices_positions[parameters.triangles_indices[triangle_index * 3 + 0]];
-    float3 vertex_B = parameters.vertices_positions[parameters.triangles_indices[triangle_index * 3 + 1]];
-    float3 vertex_C = parameters.vertices_positions[parameters.triangles_indices[triangle_index * 3 + 2]];
+    float3 vertex_A, vertex_B, vertex_C;
+    get_scene_primitive_vertices(parameters.instances, parameters.instance_count, parameters.triangles_indices, parameters.vertices_positions, parameters.quantized_vertices_positions, parameters.mesh_vertex_attributes, triangle_index, vertex_A, vertex_B, vertex_C);
 
     float rand_1 = random_number_generator();
     float rand_2 = random_number_generator();
@@ -67,10 +75,21 @@ HIPRT_HOST_DEVICE HIPRT_INLINE ReSTIRDIPresampledLight presample_emissive_triang
         presampled_light.point_on_light_source = random_point_on_triangle;
         presampled_light.light_source_normal = normal / length_normal;
         presampled_light.emissive_triangle_index = triangle_index;
+
+        const PackedRendererMaterial& material = parameters.materials[get_scene_primitive_material_index(parameters.instances, parameters.instance_count, parameters.material_indices, triangle_index)];
+        if (material.get_texture_index(PackedRendererMaterial::EMISSION_TEXTURE) >= 0)
+            presampled_light.flags |= ReSTIRDISampleFlags::RESTIR_DI_FLAGS_EMISSION_TEXTURE;
+        else
+            presampled_light.radiance = material.get_emission();
+#if EmissiveTrianglesSamplingStrategy == ETSS_POWER_ALIAS_TABLE
+        // Probability of the triangle (area * luminance / total_power) times the probability of the
+        // point on the triangle (1 / area): the area cancels out
+        presampled_light.pdf = get_emissive_triangle_power_luminance(parameters.instances, parameters.instance_count, parameters.material_indices, parameters.materials, parameters.triangle_emission_texture_luminances, triangle_index) / parameters.emissive_triangles_total_power;
+#else
         presampled_light.pdf = 1.0f / triangle_area;
         presampled_light.pdf /= parameters.emissive_triangles_count;
+#endif
         presampled_light.pdf *= light_sampling_probability;
-        presampled_light.radiance = parameters.materials[parameters.material_indices[triangle_index]].get_emission();
     }
 
     return presampled_light;
@@ -6,15 +6,20 @@
 #ifndef DEVICE_RESTIR_DI_SPATIAL_REUSE_H
 #define DEVICE_RESTIR_DI_SPATIAL_REUSE_H 
 
+#include "Device/includes/ActivePixels.h"
 #include "Device/includes/Dispatcher.h"
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Hash.h"
 #include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
 #include "Device/includes/LightUtils.h"
+#include "Device/includes/PixelCost.h"
 #include "Device/includes/ReSTIR/DI/SpatialMISWeight.h"
 #include "Device/includes/ReSTIR/DI/SpatialNormalizationWeight.h"
+#include "Device/includes/ReSTIR/DI/SpatialReuseTile.h"
 #include "Device/includes/ReSTIR/DI/Surface.h"
 #include "Device/includes/ReSTIR/DI/Utils.h"
+#include "Device/includes/RuntimeOptions.h"
 #include "Device/includes/Sampling.h"
 
 #include "HostDeviceCommon/Math.h"
@@ -62,24 +67,55 @@ HIPRT_HOST_DEVICE HIPRT_INLINE bool do_include_visibility_term_or_not(const HIPR
 }
 
 #ifdef __KERNELCC__
-GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_SpatialReuse(HIPRTRenderData render_data, int2 res)
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_SpatialReuse(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
 #else
 GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData render_data, int2 res, int x, int y)
 #endif
 {
 #ifdef __KERNELCC__
+	KERNEL_RENDER_DATA_PROLOGUE
+#if ReSTIR_DI_SpatialReuseSharedMemoryTile == KERNEL_OPTION_TRUE
+	// The tile is loaded by the 2D blocks of the image, this kernel is then
+	// never launched over the active pixels (see ReSTIRDIRenderPass::launch_spatial_reuse_kernel())
 	const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
 	const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#else
+	uint32_t x, y;
+	if (!get_thread_pixel(render_data, res, x, y))
+		return;
+#endif
+#endif
+
+	ReSTIRDISpatialTile tile;
+#if ReSTIR_DI_SpatialReuseSharedMemoryTile == KERNEL_OPTION_TRUE
+	// The neighbors must all be in the tile
+	render_data.render_settings.restir_di_settings.spatial_pass.reuse_radius = hippt::min(render_data.render_settings.restir_di_settings.spatial_pass.reuse_radius, RESTIR_DI_SPATIAL_TILE_APRON);
+
+#ifdef __KERNELCC__
+	__shared__ ReSTIRDISpatialTilePixel tile_pixels[RESTIR_DI_SPATIAL_TILE_PIXEL_COUNT];
+	// Before any thread returns, all the threads of the block load the tile
+	load_spatial_reuse_tile(render_data, tile, tile_pixels, res);
+#endif
 #endif
+
 	if (x >= res.x || y >= res.y)
 		return;
 
 	uint32_t center_pixel_index = (x + y * res.x);
+	PixelCostScope pixel_cost(render_data, center_pixel_index, PIXEL_COST_RESTIR);
 
-	if (!render_data.aux_buffers.pixel_active[center_pixel_index] || !render_data.g_buffer.camera_ray_hit[center_pixel_index])
+	if (!render_data.aux_buffers.pixel_status[center_pixel_index].is_active() || !render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(center_pixel_index)])
 		// Pixel inactive because of adaptive sampling, returning
 		return;
 
+	if (!ReSTIR_DI_checkerboard_is_active(render_data.render_settings.restir_di_settings, make_int2(x, y), render_data.render_settings.restir_di_settings.checkerboard_parity))
+		// Not this pixel's turn on the checkerboard, the final shading reuses a neighbor
+		return;
+
+	if (render_data.aux_buffers.pixel_status[center_pixel_index].is_ReSTIR_DI_fallback())
+		// Converged enough for the cheaper direct lighting of the later bounces, see ReSTIRDISettings::fallback_noise_threshold
+		return;
+
 	// Initializing the random generator
 	unsigned int seed;
 	if (render_data.render_settings.freeze_random)
@@ -88,7 +124,6 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 		seed = wang_hash((center_pixel_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
 	Xorshift32Generator random_number_generator(seed);
 
-	ReSTIRDIReservoir* input_reservoir_buffer = render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs;
 	ReSTIRDIReservoir spatial_reuse_output_reservoir;
 
 	int2 center_pixel_coords = make_int2(x, y);
@@ -109,10 +144,9 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 
 	float2 cos_sin_theta_rotation = make_float2(cos(rotation_theta), sin(rotation_theta));
 
-	ReSTIRDIReservoir center_pixel_reservoir = input_reservoir_buffer[center_pixel_index];
-	if ((center_pixel_reservoir.M <= 1) && render_data.render_settings.restir_di_settings.spatial_pass.do_disocclusion_reuse_boost)
-		// Increasing the number of spatial samples for disoclussions
-		render_data.render_settings.restir_di_settings.spatial_pass.reuse_neighbor_count = render_data.render_settings.restir_di_settings.spatial_pass.disocclusion_reuse_count;
+	ReSTIRDIReservoir center_pixel_reservoir = unpack_ReSTIR_DI_reservoir(render_data, get_spatial_neighbor_reservoir(render_data, tile, center_pixel_index, res));
+	// Disocclusion boost / adaptive neighbor count of this pixel
+	render_data.render_settings.restir_di_settings.spatial_pass.reuse_neighbor_count = ReSTIR_DI_get_spatial_reuse_neighbor_count(render_data.render_settings.restir_di_settings, center_pixel_reservoir.M);
 
 #if ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_LIKE
 	// Only used with MIS-like weight
@@ -121,7 +155,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 	int neighbor_heuristics_cache = 0;
 	int valid_neighbors_count = 0;
 	int valid_neighbors_M_sum = 0;
-	count_valid_spatial_neighbors(render_data, center_pixel_surface, center_pixel_coords, res, cos_sin_theta_rotation, valid_neighbors_count, valid_neighbors_M_sum, neighbor_heuristics_cache);
+	count_valid_spatial_neighbors(render_data, tile, center_pixel_surface, center_pixel_coords, res, cos_sin_theta_rotation, valid_neighbors_count, valid_neighbors_M_sum, neighbor_heuristics_cache);
 
 
 	ReSTIRDISpatialResamplingMISWeight<ReSTIR_DI_BiasCorrectionWeights> mis_weight_function;
@@ -158,10 +192,10 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 			// 
 			// Only checking the heuristic if we have more than 32 neighbors (does not fit in the heuristic cache)
 			// If we have less than 32 neighbors, we've already checked the cache at the beginning of this for loop
-			if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_index, center_pixel_surface.shading_point, center_pixel_surface.shading_normal))
+			if (!check_spatial_neighbor_similarity_heuristics(render_data, tile, neighbor_pixel_index, center_pixel_surface, res))
 			 	continue;
 
-		ReSTIRDIReservoir neighbor_reservoir = input_reservoir_buffer[neighbor_pixel_index];
+		ReSTIRDIReservoir neighbor_reservoir = unpack_ReSTIR_DI_reservoir(render_data, get_spatial_neighbor_reservoir(render_data, tile, neighbor_pixel_index, res));
 		float target_function_at_center = 0.0f;
 
 		bool do_neighbor_target_function_visibility = do_include_visibility_term_or_not(render_data, neighbor_index);
@@ -198,7 +232,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 			// "solid angle PDF at the neighbor" to the solid angle at the center pixel and we do
 			// that by multiplying by the jacobian determinant of the reconnection shift in solid
 			// angle, Eq. 52 of 2022, "Generalized Resampled Importance Sampling".
-			jacobian_determinant = get_jacobian_determinant_reconnection_shift(render_data, neighbor_reservoir, center_pixel_surface.shading_point, neighbor_pixel_index);
+			jacobian_determinant = get_jacobian_determinant_reconnection_shift(render_data, neighbor_reservoir, center_pixel_surface.shading_point, get_spatial_neighbor_first_hit(render_data, tile, neighbor_pixel_index, res));
 
 			if (jacobian_determinant == -1.0f)
 			{
@@ -216,8 +250,16 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_LIKE
 		float mis_weight = mis_weight_function.get_resampling_MIS_weight(render_data, neighbor_reservoir.M);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_GBH
+		// The target function at the center that we just evaluated can be reused by the MIS weight
+		// if it was evaluated with the same visibility. The target function of the center reservoir
+		// comes from the previous passes and may not have been evaluated with the same visibility
+		float cached_target_function_at_center = -1.0f;
+		if (neighbor_reservoir.UCW > 0.0f && neighbor_index != reused_neighbors_count && do_neighbor_target_function_visibility == (ReSTIR_DI_BiasCorrectionUseVisibility == KERNEL_OPTION_TRUE))
+			cached_target_function_at_center = target_function_at_center;
+
 		float mis_weight = mis_weight_function.get_resampling_MIS_weight(render_data, neighbor_reservoir,
-			center_pixel_surface, neighbor_index, center_pixel_coords, res, cos_sin_theta_rotation, random_number_generator);
+			center_pixel_surface, neighbor_index, center_pixel_coords, res, cos_sin_theta_rotation,
+			neighbor_heuristics_cache, cached_target_function_at_center, random_number_generator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS
 		bool update_mc = center_pixel_reservoir.M > 0 && center_pixel_reservoir.UCW > 0.0f;
 
@@ -266,15 +308,15 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 	ReSTIRDISpatialNormalizationWeight<ReSTIR_DI_BiasCorrectionWeights> normalization_function;
 #if ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_1_OVER_M
 	normalization_function.get_normalization(render_data, spatial_reuse_output_reservoir,
-		center_pixel_surface, center_pixel_coords, res, cos_sin_theta_rotation, normalization_numerator, normalization_denominator);
+		center_pixel_surface, center_pixel_coords, res, cos_sin_theta_rotation, neighbor_heuristics_cache, normalization_numerator, normalization_denominator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_1_OVER_Z
 	normalization_function.get_normalization(render_data,
 		spatial_reuse_output_reservoir, center_pixel_surface,
-		center_pixel_coords, res, cos_sin_theta_rotation, normalization_numerator, normalization_denominator, random_number_generator);
+		center_pixel_coords, res, cos_sin_theta_rotation, neighbor_heuristics_cache, normalization_numerator, normalization_denominator, random_number_generator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_LIKE
 	normalization_function.get_normalization(render_data, spatial_reuse_output_reservoir,
 		center_pixel_surface, selected_neighbor, 
-		center_pixel_coords, res, cos_sin_theta_rotation, normalization_numerator, normalization_denominator, random_number_generator);
+		center_pixel_coords, res, cos_sin_theta_rotation, neighbor_heuristics_cache, normalization_numerator, normalization_denominator, random_number_generator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_MIS_GBH
 	normalization_function.get_normalization(normalization_numerator, normalization_denominator);
 #elif ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS
@@ -293,7 +335,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 	|| ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS \
 	|| ReSTIR_DI_BiasCorrectionWeights == RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE) \
 	&& ReSTIR_DI_BiasCorrectionUseVisibility == KERNEL_OPTION_TRUE \
-	&& (ReSTIR_DI_DoVisibilityReuse == KERNEL_OPTION_TRUE || (ReSTIR_DI_InitialTargetFunctionVisibility == KERNEL_OPTION_TRUE && ReSTIR_DI_SpatialTargetFunctionVisibility == KERNEL_OPTION_TRUE))
+	&& (ReSTIR_DI_DoVisibilityReuse == KERNEL_OPTION_TRUE || KernelOptionsRuntimeBranches == KERNEL_OPTION_TRUE || (ReSTIR_DI_InitialTargetFunctionVisibility == KERNEL_OPTION_TRUE && ReSTIR_DI_SpatialTargetFunctionVisibility == KERNEL_OPTION_TRUE))
 	// Why is this needed?
 	//
 	// Picture the case where we have visibility reuse (at the end of the initial candidates sampling pass),
@@ -334,16 +376,26 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_SpatialReuse(HIPRTRenderData rend
 	//
 	// We only need this if we're going to temporally reuse (because then the output of the spatial reuse must be correct
 	// for the temporal reuse pass) or if we have multiple spatial reuse passes and this is not the last spatial pass
-	if (render_data.render_settings.restir_di_settings.temporal_pass.do_temporal_reuse_pass || render_data.render_settings.restir_di_settings.spatial_pass.number_of_passes - 1 != render_data.render_settings.restir_di_settings.spatial_pass.spatial_pass_index)
+	//
+	// With the runtime branches, whether the initial candidates have been through the visibility reuse is only known here
+	bool initial_candidates_have_visibility = RUNTIME_KERNEL_OPTION(render_data.render_settings, ReSTIR_DI_DoVisibilityReuse, restir_di_do_visibility_reuse) == KERNEL_OPTION_TRUE
+		|| (ReSTIR_DI_InitialTargetFunctionVisibility == KERNEL_OPTION_TRUE && ReSTIR_DI_SpatialTargetFunctionVisibility == KERNEL_OPTION_TRUE);
+	if (initial_candidates_have_visibility && (render_data.render_settings.restir_di_settings.temporal_pass.do_temporal_reuse_pass || render_data.render_settings.restir_di_settings.spatial_pass.number_of_passes - 1 != render_data.render_settings.restir_di_settings.spatial_pass.spatial_pass_index))
+	{
+#if ReSTIR_DI_BatchedVisibilityRays == KERNEL_OPTION_TRUE
+		ReSTIR_DI_queue_visibility_reuse_ray(render_data, spatial_reuse_output_reservoir, center_pixel_surface.shading_point, center_pixel_index);
+#else
 		ReSTIR_DI_visibility_reuse(render_data, spatial_reuse_output_reservoir, center_pixel_surface.shading_point, random_number_generator);
 #endif
+	}
+#endif
 
 	// M-capping so that we don't have to M-cap when reading reservoirs on the next frame
 	if (render_data.render_settings.restir_di_settings.m_cap > 0)
 		// M-capping the temporal neighbor if an M-cap has been given
 		spatial_reuse_output_reservoir.M = hippt::min(spatial_reuse_output_reservoir.M, render_data.render_settings.restir_di_settings.m_cap);
 
-	render_data.render_settings.restir_di_settings.spatial_pass.output_reservoirs[center_pixel_index] = spatial_reuse_output_reservoir;
+	render_data.render_settings.restir_di_settings.spatial_pass.output_reservoirs[center_pixel_index] = pack_ReSTIR_DI_reservoir(render_data, spatial_reuse_output_reservoir);
 }
 
 #endif
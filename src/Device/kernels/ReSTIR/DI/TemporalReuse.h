@@ -6,11 +6,14 @@
 #ifndef DEVICE_RESTIR_DI_TEMPORAL_REUSE_H
 #define DEVICE_RESTIR_DI_TEMPORAL_REUSE_H 
 
+#include "Device/includes/ActivePixels.h"
 #include "Device/includes/Dispatcher.h"
 #include "Device/includes/FixIntellisense.h"
 #include "Device/includes/Hash.h"
 #include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
 #include "Device/includes/LightUtils.h"
+#include "Device/includes/PixelCost.h"
 #include "Device/includes/ReSTIR/DI/TemporalMISWeight.h"
 #include "Device/includes/ReSTIR/DI/TemporalNormalizationWeight.h"
 #include "Device/includes/ReSTIR/DI/Surface.h"
@@ -45,24 +48,35 @@
 #define INITIAL_CANDIDATES_ID 1
 
 #ifdef __KERNELCC__
-GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_TemporalReuse(HIPRTRenderData render_data, int2 res)
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_TemporalReuse(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
 #else
 GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_TemporalReuse(HIPRTRenderData render_data, int2 res, int x, int y)
 #endif
 {
 #ifdef __KERNELCC__
-	const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
-	const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+	KERNEL_RENDER_DATA_PROLOGUE
+	uint32_t x, y;
+	if (!get_thread_pixel(render_data, res, x, y))
+		return;
 #endif
 	if (x >= res.x || y >= res.y)
 		return;
 
 	uint32_t center_pixel_index = (x + y * res.x);
+	PixelCostScope pixel_cost(render_data, center_pixel_index, PIXEL_COST_RESTIR);
 
-	if (!render_data.aux_buffers.pixel_active[center_pixel_index] || !render_data.g_buffer.camera_ray_hit[center_pixel_index])
+	if (!render_data.aux_buffers.pixel_status[center_pixel_index].is_active() || !render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(center_pixel_index)])
 		// Pixel inactive because of adaptive sampling, returning
 		return;
 
+	if (!ReSTIR_DI_checkerboard_is_active(render_data.render_settings.restir_di_settings, make_int2(x, y), render_data.render_settings.restir_di_settings.checkerboard_parity))
+		// Not this pixel's turn on the checkerboard, the final shading reuses a neighbor
+		return;
+
+	if (render_data.aux_buffers.pixel_status[center_pixel_index].is_ReSTIR_DI_fallback())
+		// Converged enough for the cheaper direct lighting of the later bounces, see ReSTIRDISettings::fallback_noise_threshold
+		return;
+
 	// Initializing the random generator
 	unsigned int seed;
 	if (render_data.render_settings.freeze_random)
@@ -73,7 +87,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_TemporalReuse(HIPRTRenderData ren
 
 	if (render_data.render_settings.restir_di_settings.temporal_pass.temporal_buffer_clear_requested)
 		// We requested a temporal buffer clear for ReSTIR DI
-		render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs[center_pixel_index] = ReSTIRDIReservoir();
+		render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs[center_pixel_index] = ReSTIRDIPackedReservoir();
 
 	// Surface data of the center pixel
 	ReSTIRDISurface center_pixel_surface = get_pixel_surface(render_data, center_pixel_index);
@@ -81,7 +95,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_TemporalReuse(HIPRTRenderData ren
 		// Not doing ReSTIR on directly visible emissive materials
 		return;
 
-	int temporal_neighbor_pixel_index = find_temporal_neighbor_index(render_data, render_data.g_buffer.first_hits[center_pixel_index], center_pixel_surface.shading_normal, res, center_pixel_index, random_number_generator).x;
+	int temporal_neighbor_pixel_index = find_temporal_neighbor_index(render_data, render_data.g_buffer.get_first_hit(center_pixel_index, render_data.get_camera(center_pixel_index).get_position()), center_pixel_surface.shading_normal, res, center_pixel_index, random_number_generator).x;
 	if (temporal_neighbor_pixel_index == -1 || render_data.render_settings.freeze_random)
 	{
 		// Temporal occlusion / disoccusion, temporal neighbor is invalid,
@@ -98,7 +112,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_TemporalReuse(HIPRTRenderData ren
 		return;
 	}
 
-	ReSTIRDIReservoir temporal_neighbor_reservoir = render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs[temporal_neighbor_pixel_index];
+	ReSTIRDIReservoir temporal_neighbor_reservoir = unpack_ReSTIR_DI_reservoir(render_data, render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs[temporal_neighbor_pixel_index]);
 	if (temporal_neighbor_reservoir.M == 0)
 	{
 		// No temporal neighbor, the output of this temporal pass is just the initial candidates reservoir
@@ -134,7 +148,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_TemporalReuse(HIPRTRenderData ren
 	// Resampling the temporal neighbor
 	// /* ------------------------------- */
 	
-	ReSTIRDIReservoir initial_candidates_reservoir = render_data.render_settings.restir_di_settings.initial_candidates.output_reservoirs[center_pixel_index];
+	ReSTIRDIReservoir initial_candidates_reservoir = unpack_ReSTIR_DI_reservoir(render_data, render_data.render_settings.restir_di_settings.initial_candidates.output_reservoirs[center_pixel_index]);
 	if (temporal_neighbor_reservoir.M > 0)
 	{
 		float target_function_at_center = 0.0f;
@@ -300,7 +314,7 @@ GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_TemporalReuse(HIPRTRenderData ren
 		// M-capping the temporal neighbor if an M-cap has been given
 		temporal_reuse_output_reservoir.M = hippt::min(temporal_reuse_output_reservoir.M, render_data.render_settings.restir_di_settings.m_cap);
 
-	render_data.render_settings.restir_di_settings.temporal_pass.output_reservoirs[center_pixel_index] = temporal_reuse_output_reservoir;
+	render_data.render_settings.restir_di_settings.temporal_pass.output_reservoirs[center_pixel_index] = pack_ReSTIR_DI_reservoir(render_data, temporal_reuse_output_reservoir);
 }
 
 #endif
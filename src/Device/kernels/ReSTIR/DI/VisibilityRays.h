@@ -0,0 +1,63 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_RESTIR_DI_VISIBILITY_RAYS_H
+#define KERNELS_RESTIR_DI_VISIBILITY_RAYS_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/Hash.h"
+#include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/ReSTIR/DI/Reservoir.h"
+
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Traces the visibility reuse rays queued by the last ReSTIR DI pass when
+ * ReSTIR_DI_BatchedVisibilityRays is true (see ReSTIR_DI_queue_visibility_reuse_ray()).
+ *
+ * One thread per queued ray: the queue is compacted so the threads past the number of
+ * queued rays exit right away. The reservoirs whose sample is occluded are discarded
+ * and the others are marked as unoccluded, exactly as ReSTIR_DI_visibility_reuse() does
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_DI_VisibilityRays(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_DI_VisibilityRays(HIPRTRenderData render_data, int2 res, unsigned int ray_index)
+#endif
+{
+#ifdef __KERNELCC__
+	KERNEL_RENDER_DATA_PROLOGUE
+	const uint32_t ray_index = blockIdx.x * blockDim.x + threadIdx.x;
+#endif
+	const VisibilityRaysSettings& visibility_rays = render_data.render_settings.restir_di_settings.visibility_rays;
+	if (ray_index >= *visibility_rays.ray_count)
+		return;
+
+	unsigned int seed;
+	if (render_data.render_settings.freeze_random)
+		seed = wang_hash(ray_index + 1);
+	else
+		seed = wang_hash((ray_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
+
+	Xorshift32Generator random_number_generator(seed);
+
+	hiprtRay shadow_ray;
+	shadow_ray.origin = visibility_rays.ray_origins[ray_index];
+	shadow_ray.direction = visibility_rays.ray_directions[ray_index];
+
+	bool visible = !evaluate_shadow_ray(render_data, shadow_ray, visibility_rays.ray_distances[ray_index], random_number_generator);
+
+	ReSTIRDIPackedReservoir& reservoir = visibility_rays.reservoirs[visibility_rays.pixel_indices[ray_index]];
+	if (!visible)
+		// Setting to -1 here so that we know when debugging that this is because of visibility reuse
+		reservoir.UCW = -1.0f;
+	else
+		// Visible so the sample is unoccluded
+		reservoir.flags |= ReSTIRDISampleFlags::RESTIR_DI_FLAGS_UNOCCLUDED;
+}
+
+#endif
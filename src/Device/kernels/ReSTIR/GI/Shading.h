@@ -0,0 +1,99 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RESTIR_GI_SHADING_H
+#define DEVICE_RESTIR_GI_SHADING_H 
+
+#include "Device/includes/ActivePixels.h"
+#include "Device/includes/Dispatcher.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/Hash.h"
+#include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/LightUtils.h"
+#include "Device/includes/PixelCost.h"
+#include "Device/includes/ReSTIR/DI/Surface.h"
+#include "Device/includes/ReSTIR/GI/Reservoir.h"
+#include "Device/includes/ReSTIR/GI/Utils.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Shades the visible point of the pixel with the sample of the reservoir output by the
+ * last ReSTIR GI pass of the frame and adds that indirect lighting to the
+ * pixel (on top of what the path tracer output for the visible point)
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_GI_Shading(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_GI_Shading(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+	KERNEL_RENDER_DATA_PROLOGUE
+	uint32_t x, y;
+	if (!get_thread_pixel(render_data, res, x, y))
+		return;
+#endif
+	if (x >= res.x || y >= res.y)
+		return;
+
+	uint32_t pixel_index = (x + y * res.x);
+	PixelCostScope pixel_cost(render_data, pixel_index, PIXEL_COST_RESTIR);
+
+	if (!render_data.aux_buffers.pixel_status[pixel_index].is_active() || !render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(pixel_index)])
+		// Pixel inactive because of adaptive sampling, returning
+		return;
+
+	ReSTIRGISettings& restir_gi_settings = render_data.render_settings.restir_gi_settings;
+	ReSTIRGIReservoir reservoir = restir_gi_settings.restir_output_reservoirs[pixel_index];
+	if (reservoir.UCW <= 0.0f)
+		return;
+
+	// Initializing the random generator
+	unsigned int seed;
+	if (render_data.render_settings.freeze_random)
+		seed = wang_hash(pixel_index + 1);
+	else
+		seed = wang_hash((pixel_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
+	Xorshift32Generator random_number_generator(seed);
+
+	ReSTIRDISurface surface = get_pixel_surface(render_data, pixel_index);
+
+	float distance_to_sample;
+	float3 sample_direction = reservoir.sample.sample_point - surface.shading_point;
+	sample_direction /= (distance_to_sample = hippt::length(sample_direction));
+
+	if (restir_gi_settings.do_final_shading_visibility)
+	{
+		hiprtRay shadow_ray;
+		shadow_ray.origin = surface.shading_point;
+		shadow_ray.direction = sample_direction;
+
+		if (evaluate_shadow_ray(render_data, shadow_ray, distance_to_sample - 1.0e-4f, random_number_generator))
+		{
+			// The sample is occluded from the visible point, invalidating it so that
+			// the next frame doesn't reuse it temporally
+			restir_gi_settings.restir_output_reservoirs[pixel_index].UCW = 0.0f;
+
+			return;
+		}
+	}
+
+	float bsdf_pdf;
+	RayVolumeState trash_volume_state = surface.ray_volume_state;
+	ColorRGB32F bsdf_color = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, surface.material, trash_volume_state, surface.view_direction, surface.shading_normal, sample_direction, bsdf_pdf);
+	float cosine_term = hippt::max(0.0f, hippt::dot(surface.shading_normal, sample_direction));
+
+	ColorRGB32F indirect_lighting = bsdf_color * reservoir.sample.outgoing_radiance * cosine_term * reservoir.UCW;
+	indirect_lighting = clamp_light_contribution(indirect_lighting, render_data.render_settings.indirect_contribution_clamp, true);
+	if (indirect_lighting.has_NaN())
+		return;
+
+	// The path tracer already wrote (or accumulated in) the pixel this frame
+	render_data.buffers.pixels[pixel_index] += indirect_lighting;
+}
+
+#endif
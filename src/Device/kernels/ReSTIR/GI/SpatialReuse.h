@@ -0,0 +1,104 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RESTIR_GI_SPATIAL_REUSE_H
+#define DEVICE_RESTIR_GI_SPATIAL_REUSE_H 
+
+#include "Device/includes/ActivePixels.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/Hash.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/PixelCost.h"
+#include "Device/includes/ReSTIR/DI/Surface.h"
+#include "Device/includes/ReSTIR/GI/Reservoir.h"
+#include "Device/includes/ReSTIR/GI/Utils.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+ /** References:
+ *
+ * [1] [ReSTIR GI: Path Resampling for Real-Time Path Tracing] https://research.nvidia.com/publication/2021-06_restir-gi-path-resampling-real-time-path-tracing
+ * [2] [A Gentle Introduction to ReSTIR: Path Reuse in Real-time] https://intro-to-restir.cwyman.org/
+ */
+
+/**
+ * Resamples the reservoir of the center pixel with the reservoirs of 'reuse_neighbor_count'
+ * random neighbors in the reuse radius. The neighbors that do not pass the similarity heuristics
+ * or whose sample would be shifted with a too large jacobian are not reused.
+ *
+ * MIS weights are the confidence weights (M) of the reservoirs, normalized by the sum of M
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_GI_SpatialReuse(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_GI_SpatialReuse(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+	KERNEL_RENDER_DATA_PROLOGUE
+	uint32_t x, y;
+	if (!get_thread_pixel(render_data, res, x, y))
+		return;
+#endif
+	if (x >= res.x || y >= res.y)
+		return;
+
+	uint32_t center_pixel_index = (x + y * res.x);
+	PixelCostScope pixel_cost(render_data, center_pixel_index, PIXEL_COST_RESTIR);
+
+	if (!render_data.aux_buffers.pixel_status[center_pixel_index].is_active() || !render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(center_pixel_index)])
+		// Pixel inactive because of adaptive sampling, returning
+		return;
+
+	// Initializing the random generator
+	unsigned int seed;
+	if (render_data.render_settings.freeze_random)
+		seed = wang_hash(center_pixel_index + 1);
+	else
+		seed = wang_hash((center_pixel_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
+	Xorshift32Generator random_number_generator(seed);
+
+	ReSTIRGISettings& restir_gi_settings = render_data.render_settings.restir_gi_settings;
+	ReSTIRDISurface center_pixel_surface = get_pixel_surface(render_data, center_pixel_index);
+
+	ReSTIRGIReservoir center_pixel_reservoir = restir_gi_settings.spatial_pass.input_reservoirs[center_pixel_index];
+	ReSTIRGIReservoir spatial_reuse_output_reservoir;
+	spatial_reuse_output_reservoir.combine_with(center_pixel_reservoir, center_pixel_reservoir.M, center_pixel_reservoir.sample.target_function, 1.0f, random_number_generator);
+
+	int2 center_pixel_coords = make_int2(x, y);
+	for (int neighbor = 0; neighbor < restir_gi_settings.spatial_pass.reuse_neighbor_count; neighbor++)
+	{
+		int neighbor_pixel_index = ReSTIR_GI_get_spatial_neighbor_pixel_index(render_data, center_pixel_coords, res, random_number_generator);
+		if (neighbor_pixel_index == -1)
+			// Outside of the viewport
+			continue;
+
+		if (!check_neighbor_similarity_heuristics(render_data, neighbor_pixel_index, center_pixel_surface))
+			continue;
+
+		ReSTIRGIReservoir neighbor_reservoir = restir_gi_settings.spatial_pass.input_reservoirs[neighbor_pixel_index];
+		if (neighbor_reservoir.M == 0)
+			continue;
+
+		float3 neighbor_shading_point = get_pixel_surface(render_data, neighbor_pixel_index).shading_point;
+		float jacobian_determinant = ReSTIR_GI_get_jacobian_determinant(render_data, neighbor_reservoir.sample, center_pixel_surface.shading_point, neighbor_shading_point);
+		if (jacobian_determinant < 0.0f)
+			// The sample of that neighbor would be a firefly at the center pixel
+			continue;
+
+		float target_function_at_center = ReSTIR_GI_evaluate_target_function(render_data, neighbor_reservoir.sample, center_pixel_surface);
+		spatial_reuse_output_reservoir.combine_with(neighbor_reservoir, neighbor_reservoir.M, target_function_at_center, jacobian_determinant, random_number_generator);
+	}
+
+	spatial_reuse_output_reservoir.end_with_normalization(1.0f, spatial_reuse_output_reservoir.M);
+	if (restir_gi_settings.m_cap > 0 && spatial_reuse_output_reservoir.M > restir_gi_settings.m_cap)
+		// Capping the confidence of the output so that the next frames' temporal reuse can still
+		// react to changes: the reservoirs of the temporal neighbors are capped there too
+		spatial_reuse_output_reservoir.M = restir_gi_settings.m_cap;
+
+	restir_gi_settings.spatial_pass.output_reservoirs[center_pixel_index] = spatial_reuse_output_reservoir;
+}
+
+#endif
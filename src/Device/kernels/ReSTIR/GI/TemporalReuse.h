@@ -0,0 +1,108 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DEVICE_RESTIR_GI_TEMPORAL_REUSE_H
+#define DEVICE_RESTIR_GI_TEMPORAL_REUSE_H 
+
+#include "Device/includes/ActivePixels.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/Hash.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/PixelCost.h"
+#include "Device/includes/ReSTIR/DI/Surface.h"
+#include "Device/includes/ReSTIR/GI/Reservoir.h"
+#include "Device/includes/ReSTIR/GI/Utils.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+ /** References:
+ *
+ * [1] [ReSTIR GI: Path Resampling for Real-Time Path Tracing] https://research.nvidia.com/publication/2021-06_restir-gi-path-resampling-real-time-path-tracing
+ * [2] [A Gentle Introduction to ReSTIR: Path Reuse in Real-time] https://intro-to-restir.cwyman.org/
+ */
+
+/**
+ * Resamples the initial candidate of the pixel (output by the path tracer) with the output
+ * reservoir of the back-projected pixel of last frame.
+ *
+ * MIS weights are the confidence weights (M) of the reservoirs, normalized by the sum of M
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) ReSTIR_GI_TemporalReuse(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline ReSTIR_GI_TemporalReuse(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+	KERNEL_RENDER_DATA_PROLOGUE
+	uint32_t x, y;
+	if (!get_thread_pixel(render_data, res, x, y))
+		return;
+#endif
+	if (x >= res.x || y >= res.y)
+		return;
+
+	uint32_t center_pixel_index = (x + y * res.x);
+	PixelCostScope pixel_cost(render_data, center_pixel_index, PIXEL_COST_RESTIR);
+
+	if (!render_data.aux_buffers.pixel_status[center_pixel_index].is_active() || !render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(center_pixel_index)])
+		// Pixel inactive because of adaptive sampling, returning
+		return;
+
+	ReSTIRGISettings& restir_gi_settings = render_data.render_settings.restir_gi_settings;
+	ReSTIRGIReservoir initial_candidates_reservoir = restir_gi_settings.initial_candidates.output_reservoirs[center_pixel_index];
+	if (restir_gi_settings.temporal_pass.input_reservoirs == nullptr || render_data.render_settings.freeze_random)
+	{
+		// No usable reservoirs from last frame (or the random is frozen and a temporal
+		// reuse would only accumulate correlations), the output is the initial candidate
+		restir_gi_settings.temporal_pass.output_reservoirs[center_pixel_index] = initial_candidates_reservoir;
+
+		return;
+	}
+
+	// Initializing the random generator
+	unsigned int seed;
+	if (render_data.render_settings.freeze_random)
+		seed = wang_hash(center_pixel_index + 1);
+	else
+		seed = wang_hash((center_pixel_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
+	Xorshift32Generator random_number_generator(seed);
+
+	ReSTIRDISurface center_pixel_surface = get_pixel_surface(render_data, center_pixel_index);
+
+	int temporal_neighbor_pixel_index = ReSTIR_GI_find_temporal_neighbor_index(render_data, center_pixel_surface, center_pixel_index, res);
+	if (temporal_neighbor_pixel_index == -1)
+	{
+		// Disocclusion, only the initial candidate
+		restir_gi_settings.temporal_pass.output_reservoirs[center_pixel_index] = initial_candidates_reservoir;
+
+		return;
+	}
+
+	ReSTIRGIReservoir temporal_neighbor_reservoir = restir_gi_settings.temporal_pass.input_reservoirs[temporal_neighbor_pixel_index];
+	if (restir_gi_settings.m_cap > 0 && temporal_neighbor_reservoir.M > restir_gi_settings.m_cap)
+		temporal_neighbor_reservoir.M = restir_gi_settings.m_cap;
+
+	ReSTIRGIReservoir temporal_reuse_output_reservoir;
+	temporal_reuse_output_reservoir.combine_with(initial_candidates_reservoir, initial_candidates_reservoir.M, initial_candidates_reservoir.sample.target_function, 1.0f, random_number_generator);
+
+	if (temporal_neighbor_reservoir.M > 0)
+	{
+		// The sample of the temporal neighbor was generated from the visible point of last frame
+		float3 temporal_neighbor_shading_point = get_pixel_surface(render_data, temporal_neighbor_pixel_index, render_data.render_settings.use_prev_frame_g_buffer()).shading_point;
+		float jacobian_determinant = ReSTIR_GI_get_jacobian_determinant(render_data, temporal_neighbor_reservoir.sample, center_pixel_surface.shading_point, temporal_neighbor_shading_point);
+		if (jacobian_determinant > 0.0f)
+		{
+			float target_function_at_center = ReSTIR_GI_evaluate_target_function(render_data, temporal_neighbor_reservoir.sample, center_pixel_surface);
+			temporal_reuse_output_reservoir.combine_with(temporal_neighbor_reservoir, temporal_neighbor_reservoir.M, target_function_at_center, jacobian_determinant, random_number_generator);
+		}
+	}
+
+	temporal_reuse_output_reservoir.end_with_normalization(1.0f, temporal_reuse_output_reservoir.M);
+
+	restir_gi_settings.temporal_pass.output_reservoirs[center_pixel_index] = temporal_reuse_output_reservoir;
+}
+
+#endif
@@ -415,15 +415,19 @@ GLOBAL_KERNEL_SIGNATURE(void) inline TestFunction(HIPRTRenderData render_data, i
 
     float pdf;
     int mat_index = (int)(threadId * randomGenerator() * 50);
-    RendererMaterial mat = render_data.buffers.materials_buffer[(int)(threadId * randomGenerator() * 50) % 10];
-    ColorRGB32F eval_out = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, mat, render_data.g_buffer.ray_volume_states[threadId], make_float3(0.5, 1.0, 2), make_float3(0.5, 1.0, 2), make_float3(0.5, 1.0, 2), pdf);
+    RendererMaterial mat = render_data.buffers.materials_buffer[(int)(threadId * randomGenerator() * 50) % 10].unpack();
+    RayVolumeState volume_state;
+    volume_state.load(render_data.g_buffer.ray_volume_states[render_data.g_buffer.get_storage_index(threadId)]);
+    ColorRGB32F eval_out = bsdf_dispatcher_eval(render_data.buffers.materials_buffer, mat, volume_state, make_float3(0.5, 1.0, 2), make_float3(0.5, 1.0, 2), make_float3(0.5, 1.0, 2), pdf);
 
     int incident, outgoing;
     bool leaving;
-    render_data.g_buffer.ray_volume_states[threadId].interior_stack.push(incident, outgoing, leaving, mat_index, render_data.buffers.materials_buffer[mat_index].dielectric_priority);
-    render_data.g_buffer.ray_volume_states[threadId].interior_stack.push(incident, outgoing, leaving, mat_index + 5, render_data.buffers.materials_buffer[mat_index + 5].dielectric_priority);
-    render_data.g_buffer.ray_volume_states[threadId].interior_stack.push(incident, outgoing, leaving, mat_index * 5, render_data.buffers.materials_buffer[mat_index * 5].dielectric_priority);
-    render_data.g_buffer.ray_volume_states[threadId].interior_stack.push(incident, outgoing, leaving, mat_index * 25, render_data.buffers.materials_buffer[mat_index * 25].dielectric_priority);
+    volume_state.interior_stack.push(incident, outgoing, leaving, mat_index, render_data.buffers.materials_buffer[mat_index].get_dielectric_priority());
+    volume_state.interior_stack.push(incident, outgoing, leaving, mat_index + 5, render_data.buffers.materials_buffer[mat_index + 5].get_dielectric_priority());
+    volume_state.interior_stack.push(incident, outgoing, leaving, mat_index * 5, render_data.buffers.materials_buffer[mat_index * 5].get_dielectric_priority());
+    volume_state.interior_stack.push(incident, outgoing, leaving, mat_index * 25, render_data.buffers.materials_buffer[mat_index * 25].get_dielectric_priority());
 
-    render_data.buffers.pixels[threadId] = ColorRGB32F(render_data.g_buffer.ray_volume_states[threadId].interior_stack.stack[1].odd_parity) * eval_out;
+    volume_state.store(render_data.g_buffer.ray_volume_states[render_data.g_buffer.get_storage_index(threadId)]);
+
+    render_data.buffers.pixels[threadId] = ColorRGB32F(volume_state.interior_stack.stack[1].get_odd_parity()) * eval_out;
 }
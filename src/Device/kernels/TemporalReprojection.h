@@ -0,0 +1,89 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_TEMPORAL_REPROJECTION_H
+#define KERNELS_TEMPORAL_REPROJECTION_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Returns the index of the pixel of the previous frame that saw the first hit 'shading_point' of the pixel
+ * 'pixel_index' of the current frame, -1 if that point was outside of the previous viewport or disoccluded.
+ * The previous position of the point is given by the motion vector of the pixel, see GBuffer::motion_vectors
+ *
+ * The disocclusion checks are the plane distance and normal similarity heuristics of the ReSTIR temporal reuse
+ * with the thresholds of the temporal reprojection
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_temporal_reprojection_pixel(const HIPRTRenderData& render_data, int2 res, uint32_t pixel_index, const float3& shading_point, const float3& shading_normal)
+{
+    const HIPRTRenderSettings& render_settings = render_data.render_settings;
+
+    float2 previous_position = render_data.g_buffer.get_previous_position(pixel_index);
+    int prev_x = static_cast<int>(roundf(previous_position.x));
+    int prev_y = static_cast<int>(roundf(previous_position.y));
+    if (prev_x < 0 || prev_x >= res.x || prev_y < 0 || prev_y >= res.y)
+        return -1;
+
+    int prev_pixel_index = prev_x + prev_y * res.x;
+    if (!render_data.g_buffer_prev_frame.camera_ray_hit[render_data.g_buffer_prev_frame.get_storage_index(prev_pixel_index)])
+        return -1;
+
+    float3 prev_shading_point = render_data.g_buffer_prev_frame.get_first_hit(prev_pixel_index, render_data.prev_camera.get_position());
+    float distance_to_plane = hippt::abs(hippt::dot(prev_shading_point - shading_point, shading_normal));
+    if (distance_to_plane >= render_settings.temporal_reprojection_plane_distance_threshold)
+        return -1;
+
+    float3 prev_shading_normal = render_data.g_buffer_prev_frame.get_shading_normal(prev_pixel_index);
+    if (hippt::dot(shading_normal, prev_shading_normal) <= render_settings.temporal_reprojection_normal_similarity_threshold)
+        return -1;
+
+    return prev_pixel_index;
+}
+
+/**
+ * Blends the first sample after a reset of the render with the average color of the
+ * last render (aux_buffers.temporal_reprojection_history) reprojected in the current view.
+ *
+ * Must be launched after all the passes that write the framebuffer, only for the first
+ * sample after a reset and if temporal_reprojection_history_sample_count > 0
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) TemporalReprojection(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline TemporalReprojection(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = x + y * res.x;
+    if (!render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(pixel_index)])
+        // The background doesn't need the history, it isn't noisy
+        return;
+
+    float3 shading_point = render_data.g_buffer.get_first_hit(pixel_index, render_data.get_camera(pixel_index).get_position());
+    float3 shading_normal = render_data.g_buffer.get_shading_normal(pixel_index);
+
+    int prev_pixel_index = get_temporal_reprojection_pixel(render_data, res, pixel_index, shading_point, shading_normal);
+    if (prev_pixel_index == -1)
+        // Disocclusion, only keeping the new sample
+        return;
+
+    float history_weight = render_data.render_settings.temporal_reprojection_history_weight;
+    ColorRGB32F history = render_data.aux_buffers.temporal_reprojection_history[prev_pixel_index];
+
+    render_data.buffers.pixels[pixel_index] = render_data.buffers.pixels[pixel_index] * (1.0f - history_weight) + history * history_weight;
+}
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_TEMPORAL_UPSCALING_H
+#define KERNELS_TEMPORAL_UPSCALING_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Color of the low resolution sample (i, j) of this frame. The low resolution
+ * samples are stored in the top left corner of the framebuffer, see get_camera_ray_pixel_index()
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F get_low_resolution_sample(const HIPRTRenderData& render_data, int2 res, int i, int j)
+{
+    return render_data.buffers.pixels[i + j * res.x] / (render_data.render_settings.sample_number + 1);
+}
+
+/**
+ * Bilinear fetch of the history of the temporal upscaling at the pixel coordinates 'position'.
+ * 'position' must be in [0, res - 1]
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F fetch_temporal_upscaling_history(const HIPRTRenderData& render_data, int2 res, float2 position)
+{
+    int x0 = static_cast<int>(position.x);
+    int y0 = static_cast<int>(position.y);
+    int x1 = hippt::min(x0 + 1, res.x - 1);
+    int y1 = hippt::min(y0 + 1, res.y - 1);
+    float tx = position.x - x0;
+    float ty = position.y - y0;
+
+    const ColorRGB32F* history = render_data.aux_buffers.temporal_upscaling_history;
+    ColorRGB32F bottom = history[x0 + y0 * res.x] * (1.0f - tx) + history[x1 + y0 * res.x] * tx;
+    ColorRGB32F top = history[x0 + y1 * res.x] * (1.0f - tx) + history[x1 + y1 * res.x] * tx;
+
+    return bottom * (1.0f - ty) + top * ty;
+}
+
+/**
+ * Upscales the low resolution frame to aux_buffers.temporal_upscaling_output at the full resolution.
+ * See render_settings.use_temporal_upscaling.
+ *
+ * Each pixel reprojects the output of the last frame (aux_buffers.temporal_upscaling_history) with the
+ * depth of its nearest low resolution sample and clamps it to the colors of the 3x3 low resolution samples
+ * around it (neighborhood clamp) so that the disocclusions and the lighting changes don't ghost.
+ * The pixels rendered this frame then blend the clamped history with their new sample.
+ *
+ * Launched over the full resolution after the passes that write the framebuffer, before TemporalUpscalingResolve
+ *
+ * Reference:
+ * [1] [High Quality Temporal Supersampling, Karis, SIGGRAPH 2014 Advances in Real-Time Rendering]
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) TemporalUpscaling(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline TemporalUpscaling(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const int x = blockIdx.x * blockDim.x + threadIdx.x;
+    const int y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    const HIPRTRenderSettings& render_settings = render_data.render_settings;
+    int scaling = render_settings.render_low_resolution_scaling;
+    int2 jitter = render_settings.temporal_upscaling_jitter;
+
+    // Number of low resolution samples in each dimension, the sample (i, j)
+    // is at the pixel (i * scaling + jitter.x, j * scaling + jitter.y)
+    int low_resolution_width = (res.x - jitter.x + scaling - 1) / scaling;
+    int low_resolution_height = (res.y - jitter.y + scaling - 1) / scaling;
+
+    // Nearest low resolution sample
+    int i = hippt::clamp(0, low_resolution_width - 1, static_cast<int>(floorf((x - jitter.x) / static_cast<float>(scaling) + 0.5f)));
+    int j = hippt::clamp(0, low_resolution_height - 1, static_cast<int>(floorf((y - jitter.y) / static_cast<float>(scaling) + 0.5f)));
+    ColorRGB32F current = get_low_resolution_sample(render_data, res, i, j);
+
+    ColorRGB32F neighborhood_min = current;
+    ColorRGB32F neighborhood_max = current;
+    for (int offset_y = -1; offset_y <= 1; offset_y++)
+    {
+        for (int offset_x = -1; offset_x <= 1; offset_x++)
+        {
+            int neighbor_i = i + offset_x;
+            int neighbor_j = j + offset_y;
+            if (neighbor_i < 0 || neighbor_i >= low_resolution_width || neighbor_j < 0 || neighbor_j >= low_resolution_height)
+                continue;
+
+            ColorRGB32F neighbor = get_low_resolution_sample(render_data, res, neighbor_i, neighbor_j);
+            neighborhood_min = ColorRGB32F::min(neighborhood_min, neighbor);
+            neighborhood_max = ColorRGB32F::max(neighborhood_max, neighbor);
+        }
+    }
+
+    ColorRGB32F output = current;
+    if (render_settings.temporal_upscaling_history_valid)
+    {
+        // Point seen by the pixel at the depth of its nearest sample. The background
+        // is reprojected far away, only the rotation of the camera moves it
+        uint32_t sample_index = i + j * res.x;
+        float distance = render_data.g_buffer.camera_ray_hit[render_data.g_buffer.get_storage_index(sample_index)] ? render_data.g_buffer.first_hit_distances[render_data.g_buffer.get_storage_index(sample_index)] : 1.0e6f;
+        hiprtRay ray = render_data.current_camera.get_camera_ray(x + 0.5f, y + 0.5f, res);
+        float3 point = ray.origin + ray.direction * distance;
+
+        float3 previous_screen_space_point = matrix_X_point(render_data.prev_camera.view_projection, point);
+        float2 previous_position = make_float2((previous_screen_space_point.x + 1.0f) * 0.5f * res.x - 0.5f, (previous_screen_space_point.y + 1.0f) * 0.5f * res.y - 0.5f);
+        if (previous_position.x >= 0.0f && previous_position.x <= res.x - 1 && previous_position.y >= 0.0f && previous_position.y <= res.y - 1)
+        {
+            ColorRGB32F history = fetch_temporal_upscaling_history(render_data, res, previous_position);
+            history = ColorRGB32F::max(neighborhood_min, ColorRGB32F::min(neighborhood_max, history));
+
+            bool rendered_this_frame = x % scaling == jitter.x && y % scaling == jitter.y;
+            if (rendered_this_frame)
+                output = history * (1.0f - render_settings.temporal_upscaling_current_weight) + current * render_settings.temporal_upscaling_current_weight;
+            else
+                output = history;
+        }
+    }
+
+    render_data.aux_buffers.temporal_upscaling_output[x + y * res.x] = output;
+}
+
+/**
+ * Copies the output of the TemporalUpscaling kernel to the framebuffer, scaled by the
+ * number of samples the framebuffer is divided by when it is displayed
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) TemporalUpscalingResolve(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline TemporalUpscalingResolve(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const int x = blockIdx.x * blockDim.x + threadIdx.x;
+    const int y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = x + y * res.x;
+    render_data.buffers.pixels[pixel_index] = render_data.aux_buffers.temporal_upscaling_output[pixel_index] * (render_data.render_settings.sample_number + 1);
+}
+
+#endif
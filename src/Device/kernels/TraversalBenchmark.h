@@ -0,0 +1,63 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_TRAVERSAL_BENCHMARK_H
+#define KERNELS_TRAVERSAL_BENCHMARK_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/Hash.h"
+#include "Device/includes/Intersect.h"
+
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Kernel of the RayCastingBenchmark: traces the 'ray_count' rays of a ray set, without any shading,
+ * so that only the cost of the BVH traversal is measured.
+ *
+ * The rays are traced with the traversals of the renderer (intersect_scene_gpu() or, if 'any_hit' is
+ * true, the shadow rays traversal of evaluate_shadow_ray()) and so with the shared stack options
+ * the kernel is compiled with. One thread per ray, launched in blocks of SharedStackBVHTraversalBlockSize threads.
+ *
+ * 'out_hit_distances[i]' is the distance to the closest hit of the ray 'i' and -1 if it missed.
+ * For the any hit rays, 1 if occluded, -1 otherwise: the output only keeps the compiler from
+ * optimizing the traversal away and lets the benchmark check that the configurations agree
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(SharedStackBVHTraversalBlockSize) TraversalBenchmark(HIPRTRenderData render_data, const float3* ray_origins, const float3* ray_directions, const float* ray_max_distances, int ray_count, int any_hit, float* out_hit_distances)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline TraversalBenchmark(HIPRTRenderData render_data, const float3* ray_origins, const float3* ray_directions, const float* ray_max_distances, int ray_count, int any_hit, float* out_hit_distances, int x)
+#endif
+{
+#ifdef __KERNELCC__
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+#endif
+    uint32_t ray_index = x;
+    if (ray_index >= ray_count)
+        return;
+
+    // Only consumed by the alpha testing filter
+    Xorshift32Generator random_number_generator(wang_hash(ray_index + 1));
+
+    hiprtRay ray;
+    ray.origin = ray_origins[ray_index];
+    ray.direction = ray_directions[ray_index];
+    ray.maxT = ray_max_distances[ray_index];
+
+    if (any_hit)
+        out_hit_distances[ray_index] = evaluate_shadow_ray(render_data, ray, ray.maxT, random_number_generator) ? 1.0f : -1.0f;
+    else
+    {
+#ifdef __KERNELCC__
+        hiprtHit hit = intersect_scene_gpu(render_data, ray, random_number_generator);
+#else
+        hiprtHit hit = intersect_scene_cpu(render_data, ray, random_number_generator);
+#endif
+
+        out_hit_distances[ray_index] = hit.hasHit() ? hit.t : -1.0f;
+    }
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_UNPACK_DENOISER_AOVS_H
+#define KERNELS_UNPACK_DENOISER_AOVS_H
+
+#include "Device/includes/DenoiserAOVs.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Expands the packed denoiser albedo and normals in which the path tracer accumulates
+ * the AOVs with PackedDenoiserAOVs into the float buffers read by the denoiser and the display.
+ *
+ * Launched after the last sample of each frame
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) UnpackDenoiserAOVs(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline UnpackDenoiserAOVs(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = (x + y * res.x);
+
+    render_data.aux_buffers.denoiser_albedo[pixel_index] = rgb9e5_decode(render_data.aux_buffers.packed_denoiser_albedo[pixel_index]);
+    render_data.aux_buffers.denoiser_normals[pixel_index] = unpack_denoiser_normal(render_data.aux_buffers.packed_denoiser_normals[pixel_index]);
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_WAVEFRONT_ACCUMULATE_H
+#define KERNELS_WAVEFRONT_ACCUMULATE_H
+
+#include "Device/includes/AdaptiveSampling.h"
+#include "Device/includes/DenoiserAOVs.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/RayPayload.h"
+#include "Device/includes/SanityCheck.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Accumulate kernel of the wavefront path tracer.
+ *
+ * Launched once all the bounces of the paths have been computed. Accumulates
+ * the radiance of the paths and the denoiser AOVs into the framebuffers
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) WavefrontAccumulate(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline WavefrontAccumulate(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = (x + y * res.x);
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active())
+        return;
+
+    WavefrontQueues& queues = render_data.wavefront_queues;
+
+    RayPayload ray_payload;
+    ray_payload.ray_color = queues.ray_colors[pixel_index];
+
+    // Checking for NaNs / negative value samples
+    if (!sanity_check(render_data, ray_payload, x, y, res, render_data.render_settings.sample_number))
+        return;
+
+    ColorRGB32F final_color = ray_payload.ray_color;
+
+    // If we got here, this means that we still have at least one ray active
+    hippt::warp_aggregated_store(render_data.aux_buffers.still_one_ray_active, static_cast<unsigned char>(1));
+
+    if (render_data.render_settings.has_access_to_adaptive_sampling_buffers())
+        // We can only use these buffers if the adaptive sampling or the stop noise threshold is enabled.
+        // Otherwise, the buffers are destroyed to save some VRAM so they are not accessible
+        accumulate_adaptive_sampling_buffers(render_data, pixel_index, final_color.luminance(), final_color.luminance() * final_color.luminance());
+
+    if (render_data.render_settings.sample_number == 0)
+        render_data.buffers.pixels[pixel_index] = final_color;
+    else
+        // If we are at a sample that is not 0, this means that we are accumulating
+        render_data.buffers.pixels[pixel_index] += final_color;
+
+#if DenoiserAOVsFromGBuffer == KERNEL_OPTION_FALSE
+    // Accumulated by the DenoiserAOVsResolve kernel otherwise
+    accumulate_denoiser_AOVs(render_data, pixel_index, queues.denoiser_albedo[pixel_index], queues.denoiser_normals[pixel_index]);
+#endif
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_WAVEFRONT_EXTEND_H
+#define KERNELS_WAVEFRONT_EXTEND_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/Hash.h"
+#include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/RayPayload.h"
+#include "Device/includes/RayStatistics.h"
+
+#include "HostDeviceCommon/HitInfo.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Extend kernel of the wavefront path tracer.
+ *
+ * For the first bounce, the paths are initialized from the G-buffer filled by the camera
+ * rays pass (no ray is traced). For the following bounces, the rays queued by the
+ * shade kernel are traced and the hit information is stored in the queues for the
+ * shade kernel to consume.
+ *
+ * If the ray sort is enabled for the current bounce, the thread at index 'i'
+ * traces the ray of the pixel 'queues.sorted_pixel_indices[i]' instead of the pixel 'i'
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) WavefrontExtend(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline WavefrontExtend(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    WavefrontQueues& queues = render_data.wavefront_queues;
+
+    uint32_t pixel_index = (x + y * res.x);
+    if (queues.use_ray_sort)
+        // The rays have been sorted by origin and direction, the threads of a
+        // same warp trace rays that traverse the same parts of the BVH
+        pixel_index = queues.sorted_pixel_indices[pixel_index];
+
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active())
+        return;
+
+    if (queues.current_bounce == 0)
+    {
+        // Not tracing for the primary ray because this has already been done in the camera ray pass.
+        // Initializing the path from the G-buffer instead
+        unsigned int seed;
+        if (render_data.render_settings.freeze_random)
+            seed = wang_hash(pixel_index + 1);
+        else
+            seed = wang_hash((pixel_index + 1) * (render_data.render_settings.sample_number + 1) * render_data.random_seed);
+
+        queues.random_states[pixel_index] = seed;
+        queues.throughputs[pixel_index] = ColorRGB32F(1.0f);
+        queues.ray_colors[pixel_index] = ColorRGB32F(0.0f);
+        queues.ray_states[pixel_index] = RayState::BOUNCE;
+        queues.shadow_ray_distances[pixel_index] = 0.0f;
+#if DenoiserAOVsFromGBuffer == KERNEL_OPTION_FALSE
+        queues.denoiser_albedo[pixel_index] = ColorRGB32F(0.0f);
+        queues.denoiser_normals[pixel_index] = make_float3(0.0f, 0.0f, 0.0f);
+#endif
+
+        queues.ray_directions[pixel_index] = -render_data.g_buffer.get_view_direction(pixel_index);
+        int g_buffer_index = render_data.g_buffer.get_storage_index(pixel_index);
+        queues.hit_found[pixel_index] = render_data.g_buffer.camera_ray_hit[g_buffer_index];
+        queues.inter_points[pixel_index] = render_data.g_buffer.get_first_hit(pixel_index, render_data.get_camera(pixel_index).get_position());
+        queues.geometric_normals[pixel_index] = render_data.g_buffer.get_geometric_normal(pixel_index);
+        queues.shading_normals[pixel_index] = render_data.g_buffer.get_shading_normal(pixel_index);
+        if (render_data.g_buffer.camera_ray_hit[g_buffer_index])
+        {
+            // The material index of the GBuffer is only valid if the camera ray hit something
+#if WavefrontDeferredMaterials == KERNEL_OPTION_TRUE
+            queues.material_ids[pixel_index] = render_data.g_buffer.material_indices[g_buffer_index];
+            queues.texcoords[pixel_index] = render_data.g_buffer.texcoords[g_buffer_index];
+            queues.texture_footprints[pixel_index] = render_data.g_buffer.texture_footprints[g_buffer_index];
+#else
+            queues.materials[pixel_index] = get_g_buffer_material(render_data, render_data.g_buffer, pixel_index);
+#endif
+        }
+        queues.volume_states[pixel_index] = render_data.g_buffer.ray_volume_states[g_buffer_index];
+
+        // The camera ray pass already propagated the cone up to the first hit and curved it off the surface
+        RayCone ray_cone;
+        ray_cone.width = render_data.get_camera(pixel_index).get_pixel_spread_angle(render_data.get_view_resolution(res)) * render_data.g_buffer.first_hit_distances[g_buffer_index];
+        ray_cone.spread_angle = render_data.g_buffer.ray_cone_spread_angles[g_buffer_index];
+        queues.ray_cones[pixel_index] = ray_cone;
+
+        return;
+    }
+
+    if (queues.ray_states[pixel_index] != RayState::BOUNCE)
+        return;
+
+    Xorshift32Generator random_number_generator(queues.random_states[pixel_index]);
+
+    hiprtRay ray;
+    ray.origin = queues.ray_origins[pixel_index];
+    ray.direction = queues.ray_directions[pixel_index];
+    ray.maxT = get_indirect_ray_max_distance(render_data, queues.current_bounce);
+
+    RayPayload ray_payload;
+    ray_payload.volume_state.load(queues.volume_states[pixel_index]);
+    ray_payload.ray_cone = queues.ray_cones[pixel_index];
+    ray_payload.geometry_lod_ray_mask = get_geometry_lod_ray_mask(render_data, queues.current_bounce);
+
+    HitInfo closest_hit_info;
+    count_ray_statistic(render_data, RAY_STATISTIC_INDIRECT_RAYS);
+    bool intersection_found = trace_ray(render_data, ray, ray_payload, closest_hit_info, random_number_generator);
+
+    queues.hit_found[pixel_index] = intersection_found ? 1 : 0;
+    if (intersection_found)
+    {
+        queues.inter_points[pixel_index] = closest_hit_info.inter_point;
+        queues.shading_normals[pixel_index] = closest_hit_info.shading_normal;
+        queues.geometric_normals[pixel_index] = closest_hit_info.geometric_normal;
+#if WavefrontDeferredMaterials == KERNEL_OPTION_TRUE
+        // The shade kernel evaluates the material again from the texture coordinates
+        queues.texcoords[pixel_index] = closest_hit_info.texcoords;
+        queues.texture_footprints[pixel_index] = closest_hit_info.texture_footprint;
+#else
+        queues.materials[pixel_index] = ray_payload.material;
+#endif
+        queues.material_ids[pixel_index] = render_data.buffers.material_indices[closest_hit_info.primitive_index];
+    }
+
+    // The volume state may have been updated when traversing the nested dielectrics
+    ray_payload.volume_state.store(queues.volume_states[pixel_index]);
+    queues.ray_cones[pixel_index] = ray_payload.ray_cone;
+    queues.random_states[pixel_index] = random_number_generator.m_state.seed;
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_WAVEFRONT_MATERIAL_SORT_HISTOGRAM_H
+#define KERNELS_WAVEFRONT_MATERIAL_SORT_HISTOGRAM_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/RayPayload.h"
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * First kernel of the material sort of the wavefront path tracer.
+ *
+ * Computes the sort key (material index of the hit) of each pixel and counts
+ * how many pixels use each key.
+ *
+ * Every pixel gets a key (including inactive pixels) so that the sorted
+ * pixel indices are a permutation of all the pixels of the image
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) WavefrontMaterialSortHistogram(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline WavefrontMaterialSortHistogram(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = (x + y * res.x);
+    WavefrontQueues& queues = render_data.wavefront_queues;
+
+    unsigned int key;
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active() || queues.ray_states[pixel_index] != RayState::BOUNCE)
+        // Terminated paths are put at the very end
+        key = queues.sort_key_count - 1;
+    else if (!queues.hit_found[pixel_index])
+        // Misses all together so that they evaluate the envmap in the same warps
+        key = queues.sort_key_count - 2;
+    else
+        key = queues.material_ids[pixel_index];
+
+    queues.sort_keys[pixel_index] = key;
+    hippt::atomic_add(&queues.sort_histogram[key], 1u);
+}
+
+#endif
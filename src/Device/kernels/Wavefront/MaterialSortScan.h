@@ -0,0 +1,53 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_WAVEFRONT_MATERIAL_SORT_SCAN_H
+#define KERNELS_WAVEFRONT_MATERIAL_SORT_SCAN_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Second kernel of the material sort (and of the ray sort) of the wavefront path tracer.
+ *
+ * Exclusive prefix sum of the histogram of the keys to get the starting offset
+ * of each key in the sorted pixel indices. The histogram is also reset to 0 for
+ * the next sort.
+ *
+ * The number of keys is the number of materials of the scene (+ 2) or
+ * WavefrontQueues::RAY_SORT_KEY_COUNT which is small compared to the number
+ * of pixels so this is done by a single thread
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) WavefrontMaterialSortScan(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline WavefrontMaterialSortScan(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x != 0 || y != 0)
+        return;
+
+    WavefrontQueues& queues = render_data.wavefront_queues;
+
+    unsigned int offset = 0;
+    for (int key = 0; key < queues.sort_key_count; key++)
+    {
+        unsigned int key_count = queues.sort_histogram[key];
+
+        queues.sort_offsets[key] = offset;
+        queues.sort_histogram[key] = 0;
+
+        offset += key_count;
+    }
+}
+
+#endif
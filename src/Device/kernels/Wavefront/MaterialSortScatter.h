@@ -0,0 +1,43 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_WAVEFRONT_MATERIAL_SORT_SCATTER_H
+#define KERNELS_WAVEFRONT_MATERIAL_SORT_SCATTER_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Last kernel of the material sort (and of the ray sort) of the wavefront path tracer.
+ *
+ * Writes the index of each pixel in the slot of its key in the sorted pixel indices.
+ * The order of the pixels within a key isn't deterministic but that doesn't matter
+ * since only the grouping by key is of interest for the shade / extend kernels
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) WavefrontMaterialSortScatter(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline WavefrontMaterialSortScatter(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = (x + y * res.x);
+    WavefrontQueues& queues = render_data.wavefront_queues;
+
+    unsigned int slot = hippt::atomic_add(&queues.sort_offsets[queues.sort_keys[pixel_index]], 1u);
+    queues.sorted_pixel_indices[slot] = pixel_index;
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_WAVEFRONT_RAY_SORT_HISTOGRAM_H
+#define KERNELS_WAVEFRONT_RAY_SORT_HISTOGRAM_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/RayPayload.h"
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+
+/**
+ * Spreads the lowest WavefrontQueues::RAY_SORT_MORTON_BITS_PER_AXIS bits of 'value'
+ * so that there are two zero bits between each of them
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int ray_sort_expand_bits(unsigned int value)
+{
+    unsigned int expanded = 0;
+    for (int bit = 0; bit < WavefrontQueues::RAY_SORT_MORTON_BITS_PER_AXIS; bit++)
+        expanded |= ((value >> bit) & 1u) << (bit * 3);
+
+    return expanded;
+}
+
+/**
+ * Key of the ray sort: octant of the direction of the ray in the high bits
+ * and Morton code of its origin quantized in the bounds of the scene in the low bits
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int get_ray_sort_key(const WavefrontQueues& queues, float3 origin, float3 direction)
+{
+    constexpr unsigned int cells_per_axis = 1u << WavefrontQueues::RAY_SORT_MORTON_BITS_PER_AXIS;
+
+    float3 extent = queues.ray_sort_grid_max - queues.ray_sort_grid_min;
+    float3 relative = origin - queues.ray_sort_grid_min;
+    // Clamping for the origins that are slightly outside of the scene because of the offset along the normal
+    unsigned int cell_x = static_cast<unsigned int>(hippt::clamp(0.0f, cells_per_axis - 1.0f, relative.x / extent.x * cells_per_axis));
+    unsigned int cell_y = static_cast<unsigned int>(hippt::clamp(0.0f, cells_per_axis - 1.0f, relative.y / extent.y * cells_per_axis));
+    unsigned int cell_z = static_cast<unsigned int>(hippt::clamp(0.0f, cells_per_axis - 1.0f, relative.z / extent.z * cells_per_axis));
+    unsigned int morton_code = ray_sort_expand_bits(cell_x) | (ray_sort_expand_bits(cell_y) << 1) | (ray_sort_expand_bits(cell_z) << 2);
+
+    unsigned int octant = (direction.x < 0.0f ? 1u : 0u) | (direction.y < 0.0f ? 2u : 0u) | (direction.z < 0.0f ? 4u : 0u);
+
+    return (octant << (3 * WavefrontQueues::RAY_SORT_MORTON_BITS_PER_AXIS)) | morton_code;
+}
+
+/**
+ * First kernel of the ray sort of the wavefront path tracer, the scan and
+ * scatter kernels are the same as for the material sort.
+ *
+ * Computes the sort key (direction octant + Morton code of the origin, see get_ray_sort_key())
+ * of the ray queued for the extend kernel of each pixel and counts how many pixels use each key.
+ *
+ * Every pixel gets a key (including inactive pixels) so that the sorted
+ * pixel indices are a permutation of all the pixels of the image
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) WavefrontRaySortHistogram(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline WavefrontRaySortHistogram(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = (x + y * res.x);
+    WavefrontQueues& queues = render_data.wavefront_queues;
+
+    unsigned int key;
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active() || queues.ray_states[pixel_index] != RayState::BOUNCE)
+        // Terminated paths are put at the very end so that the
+        // threads of the extend kernel that have no ray to trace are grouped
+        key = queues.sort_key_count - 1;
+    else
+        key = get_ray_sort_key(queues, queues.ray_origins[pixel_index], queues.ray_directions[pixel_index]);
+
+    queues.sort_keys[pixel_index] = key;
+    hippt::atomic_add(&queues.sort_histogram[key], 1u);
+}
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_WAVEFRONT_SHADE_H
+#define KERNELS_WAVEFRONT_SHADE_H
+
+#include "Device/includes/Dispatcher.h"
+#include "Device/includes/Envmap.h"
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/KernelRenderData.h"
+#include "Device/includes/Lights.h"
+#include "Device/includes/LightUtils.h"
+#include "Device/includes/Material.h"
+#include "Device/includes/RayPayload.h"
+#include "Device/includes/RussianRoulette.h"
+#include "Device/includes/Sampling.h"
+
+#include "HostDeviceCommon/HitInfo.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Shade kernel of the wavefront path tracer.
+ *
+ * Consumes the hits produced by the extend kernel: evaluates the emission and the direct
+ * lighting at the hit point and samples the BSDF for the next bounce (whose ray is
+ * queued for the next extend kernel). Rays that missed the scene gather the ambient light.
+ *
+ * With the LSS_UNIFORM_ONE_LIGHT direct lighting strategy, the shadow ray of the light
+ * sample isn't traced here but queued for the shadow rays kernel. The other strategies
+ * evaluate their visibility inline.
+ *
+ * If the material sort is enabled for the current bounce, the thread at index 'i'
+ * shades the pixel 'queues.sorted_pixel_indices[i]' instead of the pixel 'i'
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) WavefrontShade(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline WavefrontShade(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    WavefrontQueues& queues = render_data.wavefront_queues;
+
+    uint32_t pixel_index = (x + y * res.x);
+    if (queues.use_material_sort)
+        // The hits have been sorted by material, this thread is shading
+        // whichever pixel was sorted at its index so that the threads of a
+        // same warp evaluate the same material
+        pixel_index = queues.sorted_pixel_indices[pixel_index];
+
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active())
+        return;
+
+    if (queues.ray_states[pixel_index] != RayState::BOUNCE)
+        return;
+
+    // Coordinates of the pixel that is actually shaded
+    int2 pixel_coords = make_int2(pixel_index % res.x, pixel_index / res.x);
+
+    int bounce = queues.current_bounce;
+    count_bounce_active_ray(render_data, bounce);
+
+    Xorshift32Generator random_number_generator(queues.random_states[pixel_index]);
+
+    hiprtRay ray;
+    ray.direction = queues.ray_directions[pixel_index];
+
+    RayPayload ray_payload;
+    ray_payload.throughput = queues.throughputs[pixel_index];
+    ray_payload.ray_color = queues.ray_colors[pixel_index];
+    ray_payload.next_ray_state = RayState::BOUNCE;
+    ray_payload.volume_state.load(queues.volume_states[pixel_index]);
+    ray_payload.geometry_lod_ray_mask = get_geometry_lod_ray_mask(render_data, bounce);
+
+    if (queues.hit_found[pixel_index])
+    {
+#if WavefrontDeferredMaterials == KERNEL_OPTION_TRUE
+        ray_payload.material = get_intersection_material(render_data, queues.material_ids[pixel_index], queues.texcoords[pixel_index], queues.texture_footprints[pixel_index]);
+#else
+        ray_payload.material = queues.materials[pixel_index];
+#endif
+        use_simplified_bsdf(render_data, ray_payload.material, bounce);
+
+        HitInfo closest_hit_info;
+        closest_hit_info.inter_point = queues.inter_points[pixel_index];
+        closest_hit_info.shading_normal = queues.shading_normals[pixel_index];
+        closest_hit_info.geometric_normal = queues.geometric_normals[pixel_index];
+
+#if DenoiserAOVsFromGBuffer == KERNEL_OPTION_FALSE
+        if (bounce == 0)
+        {
+            queues.denoiser_normals[pixel_index] = closest_hit_info.shading_normal;
+            queues.denoiser_albedo[pixel_index] = ray_payload.material.base_color;
+        }
+#endif
+
+        // Making backfacing emissive geometry face the view direction.
+        // See FullPathTracer for more details
+        if (ray_payload.material.is_emissive() && hippt::dot(-ray.direction, closest_hit_info.geometric_normal) < 0)
+        {
+            closest_hit_info.geometric_normal = -closest_hit_info.geometric_normal;
+            closest_hit_info.shading_normal = -closest_hit_info.shading_normal;
+        }
+
+        // --------------------------------------------------- //
+        // ----------------- Direct lighting ----------------- //
+        // --------------------------------------------------- //
+
+        ColorRGB32F light_direct_contribution;
+#if DirectLightSamplingStrategy == LSS_UNIFORM_ONE_LIGHT
+        if (render_data.buffers.emissive_triangles_count > 0 && !ray_payload.material.is_emissive())
+        {
+            // Deferring the visibility of the light sample to the shadow rays kernel
+            hiprtRay shadow_ray;
+            float distance_to_light;
+            ColorRGB32F unoccluded_contribution = sample_one_light_no_MIS_unoccluded(render_data, ray_payload, closest_hit_info, -ray.direction, random_number_generator, shadow_ray, distance_to_light);
+
+            unoccluded_contribution = clamp_light_contribution(unoccluded_contribution, render_data.render_settings.direct_contribution_clamp, bounce == 0);
+            unoccluded_contribution = clamp_light_contribution(unoccluded_contribution, render_data.render_settings.indirect_contribution_clamp, bounce > 0);
+
+            if (distance_to_light > 0.0f && !unoccluded_contribution.is_black())
+            {
+                queues.shadow_ray_origins[pixel_index] = shadow_ray.origin;
+                queues.shadow_ray_directions[pixel_index] = shadow_ray.direction;
+                queues.shadow_ray_distances[pixel_index] = distance_to_light;
+                queues.shadow_ray_contributions[pixel_index] = unoccluded_contribution * ray_payload.throughput;
+            }
+        }
+        else
+            // Handles the emissive material / no emissive geometry cases
+            light_direct_contribution = sample_one_light(render_data, ray_payload, closest_hit_info, -ray.direction, random_number_generator, pixel_coords, res, bounce);
+#else
+        light_direct_contribution = sample_one_light(render_data, ray_payload, closest_hit_info, -ray.direction, random_number_generator, pixel_coords, res, bounce);
+#endif
+        ColorRGB32F envmap_direct_contribution = sample_environment_map(render_data, ray_payload, closest_hit_info, -ray.direction, bounce, random_number_generator);
+
+        // Clamping direct lighting
+        light_direct_contribution = clamp_light_contribution(light_direct_contribution, render_data.render_settings.direct_contribution_clamp, bounce == 0);
+        envmap_direct_contribution = clamp_light_contribution(envmap_direct_contribution, render_data.render_settings.envmap_contribution_clamp, bounce == 0);
+
+        // Clamping indirect lighting
+        light_direct_contribution = clamp_light_contribution(light_direct_contribution, render_data.render_settings.indirect_contribution_clamp, bounce > 0);
+        envmap_direct_contribution = clamp_light_contribution(envmap_direct_contribution, render_data.render_settings.indirect_contribution_clamp, bounce > 0);
+
+#if DirectLightSamplingStrategy == LSS_NO_DIRECT_LIGHT_SAMPLING // No direct light sampling
+        ColorRGB32F hit_emission = ray_payload.material.get_emission();
+        hit_emission = clamp_light_contribution(hit_emission, render_data.render_settings.indirect_contribution_clamp, bounce > 0);
+
+        ray_payload.ray_color += hit_emission * ray_payload.throughput;
+#else
+        if (bounce == 0)
+            // Only taking emission into account on the first bounce, see FullPathTracer
+            ray_payload.ray_color += ray_payload.material.get_emission() * ray_payload.throughput;
+
+        ray_payload.ray_color += (light_direct_contribution + envmap_direct_contribution) * ray_payload.throughput;
+#endif
+
+        // --------------------------------------- //
+        // ---------- Indirect lighting ---------- //
+        // --------------------------------------- //
+
+        // 'nb_bounces' has already been clamped by the CPU if rendering at low resolution
+        if (bounce + 1 < render_data.render_settings.nb_bounces)
+        {
+            float brdf_pdf;
+            float3 bounce_direction;
+            ColorRGB32F bsdf_color = bsdf_dispatcher_sample(render_data.buffers.materials_buffer, ray_payload.material, ray_payload.volume_state, -ray.direction, closest_hit_info.shading_normal, closest_hit_info.geometric_normal, bounce_direction, brdf_pdf, random_number_generator);
+
+            ray_payload.throughput *= bsdf_color * hippt::abs(hippt::dot(bounce_direction, closest_hit_info.shading_normal)) / brdf_pdf;
+
+            if (brdf_pdf <= 0.0f || russian_roulette_terminate(render_data, bounce, ray_payload.throughput, random_number_generator))
+            {
+                // Terminate ray if bad sampling or killed by the roulette
+                ray_payload.next_ray_state = RayState::MISSED;
+                count_bounce_path_event(render_data, bounce, BOUNCE_PATH_ABSORBED);
+            }
+            else
+            {
+                int outside_surface = hippt::dot(bounce_direction, closest_hit_info.shading_normal) < 0 ? -1.0f : 1.0f;
+                queues.ray_origins[pixel_index] = closest_hit_info.inter_point + closest_hit_info.shading_normal * 3.0e-3f * outside_surface;
+                queues.ray_directions[pixel_index] = bounce_direction;
+                queues.ray_cones[pixel_index].scatter(ray_payload.material.roughness);
+            }
+        }
+    }
+    else
+    {
+        ColorRGB32F skysphere_color;
+
+        if (render_data.world_settings.ambient_light_type == AmbientLightType::UNIFORM)
+            skysphere_color = render_data.world_settings.uniform_light_color;
+        else if (render_data.world_settings.ambient_light_type == AmbientLightType::ENVMAP)
+        {
+#if EnvmapSamplingStrategy != ESS_NO_SAMPLING
+            // If we have sampling, only taking envmap into account on camera ray miss
+            if (bounce == 0)
+#endif
+            {
+                skysphere_color = eval_envmap_no_pdf(render_data.world_settings, ray.direction);
+
+#if EnvmapSamplingStrategy == ESS_NO_SAMPLING
+                if (!render_data.world_settings.envmap_scale_background_intensity && bounce == 0)
+#else
+                if (!render_data.world_settings.envmap_scale_background_intensity)
+#endif
+                    // Un-scaling the envmap if the user doesn't want to scale the background
+                    skysphere_color /= render_data.world_settings.envmap_intensity;
+            }
+        }
+
+        skysphere_color = clamp_light_contribution(skysphere_color, render_data.render_settings.envmap_contribution_clamp, /* clamp condition */ true);
+
+        ray_payload.ray_color += skysphere_color * ray_payload.throughput;
+        ray_payload.next_ray_state = RayState::MISSED;
+        count_bounce_path_event(render_data, bounce, BOUNCE_PATH_MISSED);
+    }
+
+    queues.throughputs[pixel_index] = ray_payload.throughput;
+    queues.ray_colors[pixel_index] = ray_payload.ray_color;
+    queues.ray_states[pixel_index] = ray_payload.next_ray_state;
+    ray_payload.volume_state.store(queues.volume_states[pixel_index]);
+    queues.random_states[pixel_index] = random_number_generator.m_state.seed;
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef KERNELS_WAVEFRONT_SHADOW_RAYS_H
+#define KERNELS_WAVEFRONT_SHADOW_RAYS_H
+
+#include "Device/includes/FixIntellisense.h"
+#include "Device/includes/Intersect.h"
+#include "Device/includes/KernelRenderData.h"
+
+#include "HostDeviceCommon/RenderData.h"
+#include "HostDeviceCommon/Xorshift.h"
+
+/**
+ * Shadow rays kernel of the wavefront path tracer.
+ *
+ * Traces the shadow rays queued by the shade kernel and adds the contribution
+ * of the light sample to the path if the light sample is unoccluded
+ */
+#ifdef __KERNELCC__
+GLOBAL_KERNEL_SIGNATURE(void) __launch_bounds__(64) WavefrontShadowRays(KERNEL_RENDER_DATA_PARAMETERS, int2 res)
+#else
+GLOBAL_KERNEL_SIGNATURE(void) inline WavefrontShadowRays(HIPRTRenderData render_data, int2 res, int x, int y)
+#endif
+{
+#ifdef __KERNELCC__
+    KERNEL_RENDER_DATA_PROLOGUE
+    const uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+#endif
+    if (x >= res.x || y >= res.y)
+        return;
+
+    uint32_t pixel_index = (x + y * res.x);
+    if (!render_data.aux_buffers.pixel_status[pixel_index].is_active())
+        return;
+
+    WavefrontQueues& queues = render_data.wavefront_queues;
+
+    float distance_to_light = queues.shadow_ray_distances[pixel_index];
+    if (distance_to_light <= 0.0f)
+        // No shadow ray queued for this pixel
+        return;
+
+    Xorshift32Generator random_number_generator(queues.random_states[pixel_index]);
+
+    hiprtRay shadow_ray;
+    shadow_ray.origin = queues.shadow_ray_origins[pixel_index];
+    shadow_ray.direction = queues.shadow_ray_directions[pixel_index];
+
+    // Queued by the shade kernel of the same bounce
+    bool in_shadow = evaluate_shadow_ray(render_data, shadow_ray, distance_to_light, random_number_generator, get_geometry_lod_ray_mask(render_data, queues.current_bounce));
+    if (!in_shadow)
+        queues.ray_colors[pixel_index] += queues.shadow_ray_contributions[pixel_index];
+
+    // The shadow ray has been consumed
+    queues.shadow_ray_distances[pixel_index] = 0.0f;
+    queues.random_states[pixel_index] = random_number_generator.m_state.seed;
+}
+
+#endif
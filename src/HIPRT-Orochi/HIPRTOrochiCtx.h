@@ -19,6 +19,9 @@ extern ImGuiLogger g_imgui_logger;
 
 struct HIPRTOrochiCtx
 {
+	// Directory, relative to the working directory, where HIPRT caches the compiled kernels
+	static constexpr const char* SHADER_CACHE_DIRECTORY = "shader_cache/";
+
 	HIPRTOrochiCtx() {}
 
 	HIPRTOrochiCtx(int device_index)
@@ -38,6 +41,7 @@ struct HIPRTOrochiCtx
 
 		OROCHI_CHECK_ERROR(oroInit(0));
 		OROCHI_CHECK_ERROR(oroDeviceGet(&orochi_device, device_index));
+		this->device_index = device_index;
 		OROCHI_CHECK_ERROR(oroCtxCreate(&orochi_ctx, 0, orochi_device));
 
 		OROCHI_CHECK_ERROR(oroGetDeviceProperties(&device_properties, orochi_device));
@@ -54,12 +58,16 @@ struct HIPRTOrochiCtx
 		hiprtSetLogLevel(hiprtLogLevelError);
 
 		HIPRT_CHECK_ERROR(hiprtCreateContext(HIPRT_API_VERSION, hiprt_ctx_input, hiprt_ctx));
+		// Set explicitly so that the kernel bundle knows where to copy its binaries (see KernelBinaryBundle)
+		hiprtSetCacheDirPath(hiprt_ctx, HIPRTOrochiCtx::SHADER_CACHE_DIRECTORY);
 	}
 
 	hiprtContextCreationInput hiprt_ctx_input = { nullptr, -1, hiprtDeviceAMD };
 
 	oroCtx orochi_ctx = nullptr;
 	oroDevice orochi_device = -1;
+	// Index given to init()
+	int device_index = -1;
 	oroDeviceProp device_properties = {};
 
 	hiprtContext hiprt_ctx = nullptr;
@@ -21,6 +21,23 @@
 // [0, width[
 #define ORO_TRSF_NORMALIZED_COORDINATES 0x02
 
+/**
+ * Geometry types of the scene in the function table of HIPRT, see HIPRTGeometry.
+ * The alpha test filter function is only registered for the alpha tested type so that HIPRT
+ * doesn't call it at all for the hits on opaque meshes.
+ * 
+ * The analytic spheres of the scene are a custom primitive (a list of bounding boxes) intersected
+ * by the intersection function of their type, see HIPRTScene::spheres_geometry
+ */
+enum HIPRTGeometryType
+{
+	HIPRT_GEOMETRY_TYPE_ALPHA_TESTED = 0,
+	HIPRT_GEOMETRY_TYPE_OPAQUE = 1,
+	HIPRT_GEOMETRY_TYPE_SPHERES = 2,
+
+	HIPRT_GEOMETRY_TYPE_COUNT = 3,
+};
+
 namespace HIPPTOrochiUtils
 {
 	/*
@@ -7,118 +7,851 @@
 #define HIPRT_SCENE_H
 
 #include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiBuffer.h"
 #include "HIPRT-Orochi/OrochiTexture.h"
+#include "HostDeviceCommon/GeometryLOD.h"
+#include "HostDeviceCommon/LightBVHNode.h"
+#include "HostDeviceCommon/LightClusters.h"
 #include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/MeshVertexAttributes.h"
+#include "HostDeviceCommon/PackedMaterial.h"
+#include "HostDeviceCommon/SceneInstance.h"
 #include "UI/ImGui/ImGuiLogger.h"
 
 #include "hiprt/hiprt.h"
 #include "Orochi/Orochi.h"
 
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
 extern ImGuiLogger g_imgui_logger;
 
+/**
+ * Trade-off between the time it takes to build the BVH of the scene
+ * and the performance of the rays traced against it
+ */
+enum BVHBuildQuality
+{
+	BVH_BUILD_QUALITY_FAST = 0,
+	BVH_BUILD_QUALITY_BALANCED = 1,
+	BVH_BUILD_QUALITY_HIGH = 2,
+};
+
+/**
+ * Bottom level BVH of one mesh of the scene.
+ * 
+ * The index and vertex buffers of the mesh are owned by the HIPRTScene, this structure only
+ * references them. The BVH itself is built and destroyed by the HIPRTScene
+ */
 struct HIPRTGeometry
 {
-	HIPRTGeometry() : m_hiprt_ctx(nullptr) {}
-	HIPRTGeometry(hiprtContext ctx) : m_hiprt_ctx(ctx) {}
+	hiprtGeometryBuildInput get_build_input() const
+	{
+		hiprtGeometryBuildInput geometry_build_input;
+		geometry_build_input.type = hiprtPrimitiveTypeTriangleMesh;
+		geometry_build_input.primitive.triangleMesh = m_mesh;
+		geometry_build_input.geomType = m_alpha_tested ? HIPRT_GEOMETRY_TYPE_ALPHA_TESTED : HIPRT_GEOMETRY_TYPE_OPAQUE;
+
+		return geometry_build_input;
+	}
+
+	hiprtTriangleMeshPrimitive m_mesh = { nullptr };
+	hiprtGeometry m_geometry = nullptr;
+
+	// Whether some triangles of the mesh may need the alpha test. The geometry type is part
+	// of the BVH of the mesh so the BVH must be rebuilt when this changes
+	bool m_alpha_tested = true;
+	// Triangles of the mesh in the triangles of the scene. 'm_mesh' doesn't
+	// reference them while the mesh is replaced by its bounding box
+	int m_first_triangle = 0;
+	int m_triangle_count = 0;
+};
+
+/**
+ * Bottom level BVH of a level of detail of a mesh, see Scene::mesh_lods
+ */
+struct HIPRTGeometryLOD
+{
+	HIPRTGeometry geometry;
+
+	int mesh_index = -1;
+	// 1 for the first coarser level, see SceneMeshLOD::level
+	int level = 1;
+	// See SceneMeshLOD::error
+	float error = 0.0f;
+};
+
+/**
+ * Instance of the top level BVH for the LOD 'lod_index' (in HIPRTScene::lod_geometries)
+ * of the instance 'instance_index' of the scene, at the same place as that instance
+ */
+struct HIPRTLODInstance
+{
+	int instance_index = -1;
+	int lod_index = -1;
+};
 
-	~HIPRTGeometry()
+struct HIPRTScene
+{
+	~HIPRTScene()
 	{
-		if (m_mesh.triangleIndices)
-			OROCHI_CHECK_ERROR(oroFree(reinterpret_cast<oroDeviceptr>(m_mesh.triangleIndices)));
+		destroy_bvh();
+	}
 
-		if (m_mesh.vertices)
-			OROCHI_CHECK_ERROR(oroFree(reinterpret_cast<oroDeviceptr>(m_mesh.vertices)));
+	void print_statistics(std::ostream& stream)
+	{
+		stream << "Scene statistics: " << std::endl;
+		stream << "\t" << (quantized_vertices_positions.get_element_count() > 0 ? quantized_vertices_positions.get_element_count() / 3 : vertices_positions.get_element_count()) << " vertices" << std::endl;
+		stream << "\t" << triangles_indices.get_element_count() / 3 << " triangles" << std::endl;
+		stream << "\t" << geometries.size() << " meshes" << std::endl;
+		if (has_geometry_lods())
+			stream << "\t" << lod_geometries.size() << " mesh LODs (" << lod_instances.size() << " LOD instances)" << std::endl;
+		stream << "\t" << host_instances.size() << " instances" << std::endl;
+		stream << "\t" << spheres.get_element_count() << " analytic spheres" << std::endl;
+		stream << "\t" << emissive_triangles_indices.get_element_count() << " emissive triangles" << std::endl;
+		stream << "\t" << materials_buffer.get_element_count() << " materials" << std::endl;
+		stream << "\t" << orochi_materials_textures.size() << " textures" << std::endl;
 
-		if (m_geometry)
-			HIPRT_CHECK_ERROR(hiprtDestroyGeometry(m_hiprt_ctx, m_geometry));
+		size_t free_memory, total_memory;
+		OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory, &total_memory));
+		OrochiDeviceMemoryPool::print_usage(stream, total_memory);
 	}
 
-	void upload_indices(const std::vector<int>& triangles_indices)
+	void log_bvh_building(BVHBuildQuality build_quality)
 	{
-		int triangle_count = triangles_indices.size() / 3;
-		// Allocating and initializing the indices buffer
-		m_mesh.triangleCount = triangle_count;
-		m_mesh.triangleStride = sizeof(int3);
-		OROCHI_CHECK_ERROR(oroMalloc(reinterpret_cast<oroDeviceptr*>(&m_mesh.triangleIndices), triangle_count * sizeof(int3)));
-		OROCHI_CHECK_ERROR(oroMemcpy(reinterpret_cast<oroDeviceptr>(m_mesh.triangleIndices), triangles_indices.data(), triangle_count * sizeof(int3), oroMemcpyHostToDevice));
+		const char* quality_names[] = { "fast", "balanced", "high quality" };
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Compiling BVH building kernels & building scene BVH (%s build)...", quality_names[build_quality]);
 	}
 
-	void upload_vertices(const std::vector<float3>& vertices_positions)
+	static hiprtBuildFlags get_build_flags(BVHBuildQuality build_quality)
 	{
-		// Allocating and initializing the vertices positions buiffer
-		m_mesh.vertexCount = vertices_positions.size();
-		m_mesh.vertexStride = sizeof(float3);
-		OROCHI_CHECK_ERROR(oroMalloc(reinterpret_cast<oroDeviceptr*>(&m_mesh.vertices), m_mesh.vertexCount * sizeof(float3)));
-		OROCHI_CHECK_ERROR(oroMemcpy(reinterpret_cast<oroDeviceptr>(m_mesh.vertices), vertices_positions.data(), m_mesh.vertexCount * sizeof(float3), oroMemcpyHostToDevice));
+		switch (build_quality)
+		{
+		case BVH_BUILD_QUALITY_FAST:
+			return hiprtBuildFlagBitPreferFastBuild;
+
+		case BVH_BUILD_QUALITY_BALANCED:
+			return hiprtBuildFlagBitPreferBalancedBuild;
+
+		case BVH_BUILD_QUALITY_HIGH:
+		default:
+			return hiprtBuildFlagBitPreferHighQualityBuild;
+		}
+	}
+
+	/**
+	 * Converts a (column major) object to world matrix to the (row major) frame matrix of HIPRT
+	 */
+	static hiprtFrameMatrix get_frame_matrix(const float4x4& object_to_world)
+	{
+		hiprtFrameMatrix frame;
+		for (int row = 0; row < 3; row++)
+			for (int column = 0; column < 4; column++)
+				frame.matrix[row][column] = object_to_world.m[column][row];
+		frame.time = 0.0f;
+
+		return frame;
+	}
+
+	/**
+	 * Rough upper bound of the device memory that the BVH of 'triangle_count' triangles
+	 * and its build need, for deciding of the placement of the other buffers before the BVH is built
+	 */
+	static size_t estimate_bvh_memory_size(size_t triangle_count)
+	{
+		return triangle_count * BVH_MEMORY_BYTES_PER_TRIANGLE_ESTIMATE;
+	}
+
+	/**
+	 * Grows the temporary buffer used for the BVH builds if it's smaller than 'size' bytes.
+	 * The temporary buffer is kept around between builds
+	 */
+	void ensure_build_temp_buffer_size(size_t size)
+	{
+		if (bvh_build_temp_buffer.get_element_count() < size)
+			bvh_build_temp_buffer.resize(static_cast<int>(size));
 	}
 
-	void log_bvh_building(hiprtBuildFlags build_flags)
+	/**
+	 * Geometries of the meshes followed by the geometries of their LODs
+	 */
+	std::vector<HIPRTGeometry*> get_triangle_geometries()
 	{
-		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Compiling BVH building kernels & building scene BVH...");
+		std::vector<HIPRTGeometry*> triangle_geometries;
+		triangle_geometries.reserve(geometries.size() + lod_geometries.size());
+		for (HIPRTGeometry& geometry : geometries)
+			triangle_geometries.push_back(&geometry);
+		for (HIPRTGeometryLOD& lod : lod_geometries)
+			triangle_geometries.push_back(&lod.geometry);
+
+		return triangle_geometries;
+	}
+
+	/**
+	 * Points the geometries of all the meshes and of their LODs to 'vertices_positions'. The triangles
+	 * of the meshes use global vertex indices so they all reference the whole buffer
+	 */
+	void set_geometries_vertices()
+	{
+		for (HIPRTGeometry* geometry : get_triangle_geometries())
+		{
+			geometry->m_mesh.vertices = vertices_positions.get_device_pointer();
+			geometry->m_mesh.vertexCount = static_cast<uint32_t>(vertices_positions.get_element_count());
+		}
+	}
+
+	bool has_geometry_lods() const
+	{
+		return !lod_instances.empty();
+	}
+
+	/**
+	 * The LODs of the meshes must have been added to 'lod_geometries', level after level for each mesh,
+	 * and 'host_instances' must be set. Adds one instance to the top level BVH per LOD of each instance
+	 * of the meshes that have LODs and selects the full meshes for all the rays, see set_instance_lods()
+	 */
+	void set_geometry_lods()
+	{
+		mesh_lod_indices.assign(geometries.size(), std::vector<int>());
+		for (int lod_index = 0; lod_index < lod_geometries.size(); lod_index++)
+			mesh_lod_indices[lod_geometries[lod_index].mesh_index].push_back(lod_index);
+
+		lod_instances.clear();
+		for (int instance_index = 0; instance_index < host_instances.size(); instance_index++)
+			for (int lod_index : mesh_lod_indices[host_instances[instance_index].mesh_index])
+				lod_instances.push_back({ instance_index, lod_index });
+
+		instances_primary_lod.assign(host_instances.size(), 0);
+		instances_secondary_lod.assign(host_instances.size(), 0);
+		std::vector<uint32_t> masks = get_bvh_instance_masks();
+		instance_masks.resize(masks.size());
+		instance_masks.upload_data(masks.data());
+	}
+
+	/**
+	 * Selects the levels of detail that the primary and the secondary rays see for each instance of
+	 * 'host_instances', 0 for the full mesh, 'i' for the LOD of level 'i' of its mesh. The levels are
+	 * clamped to the LODs of the mesh.
+	 *
+	 * Returns true if the selection changed, the top level BVH must then be
+	 * rebuilt with rebuild_top_level() before tracing rays again
+	 */
+	bool set_instance_lods(const std::vector<int>& primary_lods, const std::vector<int>& secondary_lods)
+	{
+		bool changed = false;
+		for (int instance_index = 0; instance_index < host_instances.size(); instance_index++)
+		{
+			int level_count = static_cast<int>(mesh_lod_indices[host_instances[instance_index].mesh_index].size());
+			int primary_lod = std::clamp(primary_lods[instance_index], 0, level_count);
+			int secondary_lod = std::clamp(secondary_lods[instance_index], 0, level_count);
+
+			changed |= primary_lod != instances_primary_lod[instance_index] || secondary_lod != instances_secondary_lod[instance_index];
+			instances_primary_lod[instance_index] = primary_lod;
+			instances_secondary_lod[instance_index] = secondary_lod;
+		}
+
+		if (changed)
+		{
+			std::vector<uint32_t> masks = get_bvh_instance_masks();
+			instance_masks.upload_data(masks.data());
+		}
+
+		return changed;
+	}
+
+	/**
+	 * Masks of the instances of get_bvh_instances() for the LODs selected
+	 * by set_instance_lods(), see HostDeviceCommon/GeometryLOD.h
+	 */
+	std::vector<uint32_t> get_bvh_instance_masks()
+	{
+		std::vector<uint32_t> masks(get_bvh_instance_count(), GEOMETRY_LOD_ALL_RAYS_MASK);
+		for (int instance_index = 0; instance_index < host_instances.size(); instance_index++)
+		{
+			if (mesh_lod_indices[host_instances[instance_index].mesh_index].empty())
+				continue;
+
+			masks[instance_index] = (instances_primary_lod[instance_index] == 0 ? GEOMETRY_LOD_PRIMARY_RAY_MASK : 0) | (instances_secondary_lod[instance_index] == 0 ? GEOMETRY_LOD_SECONDARY_RAY_MASK : 0);
+		}
+
+		int first_lod_instance = static_cast<int>(host_instances.size()) + (has_spheres() ? 1 : 0);
+		for (int i = 0; i < lod_instances.size(); i++)
+		{
+			const HIPRTLODInstance& lod_instance = lod_instances[i];
+			int level = lod_geometries[lod_instance.lod_index].level;
+
+			masks[first_lod_instance + i] = (instances_primary_lod[lod_instance.instance_index] == level ? GEOMETRY_LOD_PRIMARY_RAY_MASK : 0) | (instances_secondary_lod[lod_instance.instance_index] == level ? GEOMETRY_LOD_SECONDARY_RAY_MASK : 0);
+		}
+
+		return masks;
+	}
+
+	/**
+	 * Build input of the BVH of the analytic spheres: the spheres are a custom primitive
+	 * given to HIPRT as their bounding boxes, intersected by intersect_sphere()
+	 */
+	hiprtGeometryBuildInput get_spheres_build_input()
+	{
+		hiprtAABBListPrimitive aabb_list;
+		aabb_list.aabbs = spheres_aabbs.get_device_pointer();
+		aabb_list.aabbCount = static_cast<uint32_t>(spheres.get_element_count());
+		// Min and max corners as two float4
+		aabb_list.aabbStride = 2 * sizeof(float4);
+
+		hiprtGeometryBuildInput geometry_build_input;
+		geometry_build_input.type = hiprtPrimitiveTypeAABBList;
+		geometry_build_input.primitive.aabbList = aabb_list;
+		geometry_build_input.geomType = HIPRT_GEOMETRY_TYPE_SPHERES;
+
+		return geometry_build_input;
+	}
+
+	bool has_spheres() const
+	{
+		return spheres.get_element_count() > 0;
+	}
+
+	int get_bvh_instance_count() const
+	{
+		return static_cast<int>(host_instances.size() + (has_spheres() ? 1 : 0) + lod_instances.size());
+	}
+
+	/**
+	 * Instances of the top level BVH: one per instance of 'host_instances', then, if the scene has analytic
+	 * spheres, the instance of the geometry of all the spheres and then the instances of 'lod_instances'
+	 */
+	std::vector<hiprtInstance> get_bvh_instances()
+	{
+		std::vector<hiprtInstance> bvh_instances_data(get_bvh_instance_count());
+		for (int i = 0; i < host_instances.size(); i++)
+		{
+			bvh_instances_data[i].type = hiprtInstanceTypeGeometry;
+			bvh_instances_data[i].geometry = geometries[host_instances[i].mesh_index].m_geometry;
+		}
+
+		int first_lod_instance = static_cast<int>(host_instances.size());
+		if (has_spheres())
+		{
+			bvh_instances_data[first_lod_instance].type = hiprtInstanceTypeGeometry;
+			bvh_instances_data[first_lod_instance].geometry = spheres_geometry;
+			first_lod_instance++;
+		}
+
+		for (int i = 0; i < lod_instances.size(); i++)
+		{
+			bvh_instances_data[first_lod_instance + i].type = hiprtInstanceTypeGeometry;
+			bvh_instances_data[first_lod_instance + i].geometry = lod_geometries[lod_instances[i].lod_index].geometry.m_geometry;
+		}
+
+		return bvh_instances_data;
+	}
+
+	/**
+	 * Frames of the instances of get_bvh_instances(), the spheres are already in world space
+	 */
+	std::vector<hiprtFrameMatrix> get_bvh_instance_frames()
+	{
+		std::vector<hiprtFrameMatrix> frames(get_bvh_instance_count());
+		for (int i = 0; i < host_instances.size(); i++)
+			frames[i] = get_frame_matrix(host_instances[i].object_to_world);
+
+		int first_lod_instance = static_cast<int>(host_instances.size());
+		if (has_spheres())
+		{
+			float4x4 identity;
+			for (int i = 0; i < 4; i++)
+				identity.m[i][i] = 1.0f;
+
+			frames[first_lod_instance++] = get_frame_matrix(identity);
+		}
+
+		for (int i = 0; i < lod_instances.size(); i++)
+			frames[first_lod_instance + i] = frames[lod_instances[i].instance_index];
+
+		return frames;
 	}
 
-	void build_bvh()
+	/**
+	 * The SceneInstance of each instance of get_bvh_instances() for the shaders, indexed by 'hit.instanceID'.
+	 * The SceneInstance of the spheres is unused and the ones of the LODs place the triangles of their LOD
+	 * where their instance is
+	 */
+	std::vector<SceneInstance> get_device_instances()
+	{
+		std::vector<SceneInstance> device_instances = host_instances;
+		if (has_spheres())
+			device_instances.push_back(SceneInstance());
+
+		for (const HIPRTLODInstance& lod_instance : lod_instances)
+		{
+			const HIPRTGeometry& lod_geometry = lod_geometries[lod_instance.lod_index].geometry;
+
+			SceneInstance device_instance = host_instances[lod_instance.instance_index];
+			device_instance.mesh_first_triangle = lod_geometry.m_first_triangle;
+			device_instance.triangle_count = lod_geometry.m_triangle_count;
+			device_instances.push_back(device_instance);
+		}
+
+		return device_instances;
+	}
+
+	/**
+	 * Builds the BVH of each mesh and the top level BVH over the instances of the scene
+	 * on the given stream. The meshes and the instances must have been uploaded before.
+	 * 
+	 * If 'compact' is true, the BVHs of the meshes are compacted once built: HIPRT allocates them for
+	 * the worst case and their final size is only known after the build. The temporary build buffer is
+	 * then also freed, only the (much smaller) temporary buffer of the top level refits is allocated again.
+	 *
+	 * If a BVH was already built, it is destroyed and rebuilt with the new quality.
+	 * This function returns once the BVH is fully built
+	 */
+	void build_bvh(BVHBuildQuality build_quality, oroStream_t stream, bool compact = false)
 	{
 		auto start = std::chrono::high_resolution_clock::now();
 
+		destroy_bvh();
+
 		hiprtBuildOptions build_options;
-		hiprtGeometryBuildInput geometry_build_input;
-		size_t geometry_temp_size;
-		hiprtDevicePtr geometry_temp;
+		build_options.buildFlags = get_build_flags(build_quality);
 
-		build_options.buildFlags = hiprtBuildFlagBitPreferHighQualityBuild;
-		geometry_build_input.type = hiprtPrimitiveTypeTriangleMesh;
-		geometry_build_input.primitive.triangleMesh = m_mesh;
-		// Geom type 0 here 
-		geometry_build_input.geomType = 0;
+		log_bvh_building(build_quality);
+
+		// HIPRT doesn't expose the size of the BVHs so we're estimating it
+		// with the amount of VRAM that the hiprtCreateXXX() functions allocated
+		size_t free_memory_before, free_memory_after, total_memory;
+		bvh_memory_size = 0;
+
+		// Bottom level: one BVH per mesh and per LOD of the meshes
+		std::vector<HIPRTGeometry*> triangle_geometries = get_triangle_geometries();
+		size_t temp_size = 0;
+		for (HIPRTGeometry* geometry : triangle_geometries)
+		{
+			if (geometry->m_mesh.triangleCount == 0)
+				continue;
+
+			size_t geometry_temp_size;
+			hiprtGeometryBuildInput geometry_build_input = geometry->get_build_input();
+			HIPRT_CHECK_ERROR(hiprtGetGeometryBuildTemporaryBufferSize(hiprt_ctx, geometry_build_input, build_options, geometry_temp_size));
 
-		log_bvh_building(build_options.buildFlags);
-		// Getting the buffer sizes for the construction of the BVH
-		HIPRT_CHECK_ERROR(hiprtGetGeometryBuildTemporaryBufferSize(m_hiprt_ctx, geometry_build_input, build_options, geometry_temp_size));
-		OROCHI_CHECK_ERROR(oroMalloc(reinterpret_cast<oroDeviceptr*>(&geometry_temp), geometry_temp_size));
+			OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory_before, &total_memory));
+			HIPRT_CHECK_ERROR(hiprtCreateGeometry(hiprt_ctx, geometry_build_input, build_options, geometry->m_geometry));
+			OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory_after, &total_memory));
+			bvh_memory_size += free_memory_before > free_memory_after ? free_memory_before - free_memory_after : 0;
 
-		HIPRT_CHECK_ERROR(hiprtCreateGeometry(m_hiprt_ctx, geometry_build_input, build_options, m_geometry));
-		HIPRT_CHECK_ERROR(hiprtBuildGeometry(m_hiprt_ctx, hiprtBuildOperationBuild, geometry_build_input, build_options, geometry_temp, /* stream */ 0, m_geometry));
+			temp_size = std::max(temp_size, geometry_temp_size);
+		}
 
-		OROCHI_CHECK_ERROR(oroFree(reinterpret_cast<oroDeviceptr>(geometry_temp)));
+		// and one BVH for all the spheres
+		if (has_spheres())
+		{
+			size_t spheres_temp_size;
+			hiprtGeometryBuildInput spheres_build_input = get_spheres_build_input();
+			HIPRT_CHECK_ERROR(hiprtGetGeometryBuildTemporaryBufferSize(hiprt_ctx, spheres_build_input, build_options, spheres_temp_size));
+
+			OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory_before, &total_memory));
+			HIPRT_CHECK_ERROR(hiprtCreateGeometry(hiprt_ctx, spheres_build_input, build_options, spheres_geometry));
+			OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory_after, &total_memory));
+			bvh_memory_size += free_memory_before > free_memory_after ? free_memory_before - free_memory_after : 0;
+
+			temp_size = std::max(temp_size, spheres_temp_size);
+		}
+
+		// Top level over the instances of the meshes, the spheres and the LODs
+		std::vector<hiprtInstance> instances = get_bvh_instances();
+		bvh_instances.resize(instances.size());
+		bvh_instances.upload_data(instances.data());
+
+		hiprtSceneBuildInput scene_build_input = get_scene_build_input();
+		size_t scene_temp_size;
+		HIPRT_CHECK_ERROR(hiprtGetSceneBuildTemporaryBufferSize(hiprt_ctx, scene_build_input, build_options, scene_temp_size));
+
+		OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory_before, &total_memory));
+		HIPRT_CHECK_ERROR(hiprtCreateScene(hiprt_ctx, scene_build_input, build_options, scene));
+		OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory_after, &total_memory));
+		bvh_memory_size += free_memory_before > free_memory_after ? free_memory_before - free_memory_after : 0;
+
+		// All the geometries are built one after the other with the same temporary buffer.
+		// The geometries must be done building before the top level can be built
+		ensure_build_temp_buffer_size(std::max(temp_size, scene_temp_size));
+		for (HIPRTGeometry* geometry : triangle_geometries)
+			if (geometry->m_geometry != nullptr)
+				HIPRT_CHECK_ERROR(hiprtBuildGeometry(hiprt_ctx, hiprtBuildOperationBuild, geometry->get_build_input(), build_options, bvh_build_temp_buffer.get_device_pointer(), stream, geometry->m_geometry));
+		if (spheres_geometry != nullptr)
+			HIPRT_CHECK_ERROR(hiprtBuildGeometry(hiprt_ctx, hiprtBuildOperationBuild, get_spheres_build_input(), build_options, bvh_build_temp_buffer.get_device_pointer(), stream, spheres_geometry));
+		HIPRT_CHECK_ERROR(hiprtBuildScene(hiprt_ctx, hiprtBuildOperationBuild, scene_build_input, build_options, bvh_build_temp_buffer.get_device_pointer(), stream, scene));
+		OROCHI_CHECK_ERROR(oroStreamSynchronize(stream));
+
+		if (compact)
+		{
+			OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory_before, &total_memory));
+
+			// The top level BVH references the geometries so it's rebuilt over the compacted ones.
+			// The compaction frees the uncompacted geometry
+			for (HIPRTGeometry* geometry : triangle_geometries)
+				if (geometry->m_geometry != nullptr)
+					HIPRT_CHECK_ERROR(hiprtCompactGeometry(hiprt_ctx, stream, geometry->m_geometry, geometry->m_geometry));
+			if (spheres_geometry != nullptr)
+				HIPRT_CHECK_ERROR(hiprtCompactGeometry(hiprt_ctx, stream, spheres_geometry, spheres_geometry));
+
+			instances = get_bvh_instances();
+			bvh_instances.upload_data(instances.data());
+			HIPRT_CHECK_ERROR(hiprtBuildScene(hiprt_ctx, hiprtBuildOperationBuild, scene_build_input, build_options, bvh_build_temp_buffer.get_device_pointer(), stream, scene));
+			OROCHI_CHECK_ERROR(oroStreamSynchronize(stream));
+
+			OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory_after, &total_memory));
+			size_t reclaimed_memory = free_memory_after > free_memory_before ? free_memory_after - free_memory_before : 0;
+			bvh_memory_size -= std::min(bvh_memory_size, reclaimed_memory);
+
+			bvh_build_temp_buffer.free();
+		}
 
 		auto stop = std::chrono::high_resolution_clock::now();
-		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "BVH built in %ldms", std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+		bvh_build_quality = build_quality;
+		bvh_last_build_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0f;
+		bvh_build_count++;
+
+		OrochiDeviceMemoryPool::set_external_usage(this, "BVH", bvh_memory_size);
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "BVH built in %ldms (%.2fMB, %zu meshes, %zu mesh LODs, %zu instances)", std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count(), bvh_memory_size / 1000000.0f, geometries.size(), lod_geometries.size(), host_instances.size());
 	}
 
-	hiprtContext m_hiprt_ctx = nullptr;
-	hiprtTriangleMeshPrimitive m_mesh = { nullptr };
-	hiprtGeometry m_geometry = nullptr;
-};
+	/**
+	 * Creates and builds, on the given stream, the BVH of a single mesh with its own temporary
+	 * buffer, independently of the BVH of the scene. Used for streaming the BVHs of the meshes
+	 * into the scene while it's being rendered, see GPURenderer::set_progressive_loading().
+	 * 
+	 * The geometry returned replaces the one of its mesh with replace_geometry(). 'alpha_tested' gives
+	 * its geometry type, see HIPRTGeometry::m_alpha_tested. This function returns once the BVH is built
+	 */
+	hiprtGeometry build_geometry(const hiprtTriangleMeshPrimitive& mesh, bool alpha_tested, BVHBuildQuality build_quality, oroStream_t stream, OrochiBuffer<unsigned char>& temp_buffer, bool compact = false)
+	{
+		hiprtBuildOptions build_options;
+		build_options.buildFlags = get_build_flags(build_quality);
 
-struct HIPRTScene
-{
-	void print_statistics(std::ostream& stream)
+		HIPRTGeometry geometry;
+		geometry.m_mesh = mesh;
+		geometry.m_alpha_tested = alpha_tested;
+		hiprtGeometryBuildInput geometry_build_input = geometry.get_build_input();
+
+		size_t temp_size;
+		HIPRT_CHECK_ERROR(hiprtGetGeometryBuildTemporaryBufferSize(hiprt_ctx, geometry_build_input, build_options, temp_size));
+		if (temp_buffer.get_element_count() < temp_size)
+			temp_buffer.resize(static_cast<int>(temp_size));
+
+		HIPRT_CHECK_ERROR(hiprtCreateGeometry(hiprt_ctx, geometry_build_input, build_options, geometry.m_geometry));
+		HIPRT_CHECK_ERROR(hiprtBuildGeometry(hiprt_ctx, hiprtBuildOperationBuild, geometry_build_input, build_options, temp_buffer.get_device_pointer(), stream, geometry.m_geometry));
+		if (compact)
+			HIPRT_CHECK_ERROR(hiprtCompactGeometry(hiprt_ctx, stream, geometry.m_geometry, geometry.m_geometry));
+		OROCHI_CHECK_ERROR(oroStreamSynchronize(stream));
+
+		return geometry.m_geometry;
+	}
+
+	/**
+	 * Destroys the BVH of the mesh 'mesh_index' and replaces it with 'geometry', built from 'mesh'.
+	 * The top level BVH must be rebuilt with rebuild_top_level() before tracing rays again
+	 */
+	void replace_geometry(int mesh_index, const hiprtTriangleMeshPrimitive& mesh, hiprtGeometry geometry)
 	{
-		stream << "Scene statistics: " << std::endl;
-		stream << "\t" << geometry.m_mesh.vertexCount << " vertices" << std::endl;
-		stream << "\t" << geometry.m_mesh.triangleCount << " vertices" << std::endl;
-		stream << "\t" << emissive_triangles_indices.get_element_count() << " emissive triangles" << std::endl;
-		stream << "\t" << materials_buffer.get_element_count() << " materials" << std::endl;
-		stream << "\t" << orochi_materials_textures.size() << " textures" << std::endl;
+		HIPRTGeometry& replaced = geometries[mesh_index];
+		if (replaced.m_geometry != nullptr)
+			HIPRT_CHECK_ERROR(hiprtDestroyGeometry(hiprt_ctx, replaced.m_geometry));
+
+		replaced.m_mesh = mesh;
+		replaced.m_geometry = geometry;
 	}
 
-	HIPRTGeometry geometry;
+	/**
+	 * Same as replace_geometry() for the LOD 'lod_index' of 'lod_geometries'
+	 */
+	void replace_lod_geometry(int lod_index, hiprtGeometry geometry)
+	{
+		HIPRTGeometry& replaced = lod_geometries[lod_index].geometry;
+		if (replaced.m_geometry != nullptr)
+			HIPRT_CHECK_ERROR(hiprtDestroyGeometry(hiprt_ctx, replaced.m_geometry));
+
+		replaced.m_geometry = geometry;
+	}
+
+	/**
+	 * Rebuilds the top level BVH over the current geometries of the meshes, after some have been
+	 * replaced with replace_geometry() or after the LODs of the instances changed (set_instance_lods()).
+	 * The top level BVH keeps the pointers to the geometries so it can't just be refit. The BVHs of the
+	 * meshes are left untouched.
+	 * 
+	 * The BVH must have been built with build_bvh() and the number of instances
+	 * must not have changed since. This function returns once the BVH is rebuilt
+	 */
+	void rebuild_top_level(oroStream_t stream)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::vector<hiprtInstance> instances = get_bvh_instances();
+		bvh_instances.upload_data(instances.data());
+
+		hiprtBuildOptions build_options;
+		build_options.buildFlags = get_build_flags(bvh_build_quality);
+
+		hiprtSceneBuildInput scene_build_input = get_scene_build_input();
+		size_t scene_temp_size;
+		HIPRT_CHECK_ERROR(hiprtGetSceneBuildTemporaryBufferSize(hiprt_ctx, scene_build_input, build_options, scene_temp_size));
+		ensure_build_temp_buffer_size(scene_temp_size);
+
+		HIPRT_CHECK_ERROR(hiprtBuildScene(hiprt_ctx, hiprtBuildOperationBuild, scene_build_input, build_options, bvh_build_temp_buffer.get_device_pointer(), stream, scene));
+		OROCHI_CHECK_ERROR(oroStreamSynchronize(stream));
+
+		auto stop = std::chrono::high_resolution_clock::now();
+		bvh_last_update_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0f;
+	}
+
+	/**
+	 * Uploads the instances 'host_instances' after their transforms have been modified and
+	 * refits the top level BVH with the new transforms instead of rebuilding it from scratch.
+	 * The BVHs of the meshes are left untouched.
+	 * 
+	 * The BVH must have been built with build_bvh() and the number of instances
+	 * must not have changed since. This function returns once the BVH is refit
+	 */
+	void update_instance_transforms(oroStream_t stream)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::vector<hiprtFrameMatrix> frames = get_bvh_instance_frames();
+		instance_frames.upload_data(frames.data());
+		std::vector<SceneInstance> device_instances = get_device_instances();
+		instances.upload_data(device_instances.data());
+
+		hiprtBuildOptions build_options;
+		build_options.buildFlags = get_build_flags(bvh_build_quality);
+
+		hiprtSceneBuildInput scene_build_input = get_scene_build_input();
+		size_t scene_temp_size;
+		HIPRT_CHECK_ERROR(hiprtGetSceneBuildTemporaryBufferSize(hiprt_ctx, scene_build_input, build_options, scene_temp_size));
+		ensure_build_temp_buffer_size(scene_temp_size);
+
+		HIPRT_CHECK_ERROR(hiprtBuildScene(hiprt_ctx, hiprtBuildOperationUpdate, scene_build_input, build_options, bvh_build_temp_buffer.get_device_pointer(), stream, scene));
+		OROCHI_CHECK_ERROR(oroStreamSynchronize(stream));
+
+		auto stop = std::chrono::high_resolution_clock::now();
+		bvh_last_update_time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0f;
+	}
+
+	hiprtSceneBuildInput get_scene_build_input()
+	{
+		hiprtSceneBuildInput scene_build_input;
+		scene_build_input.instances = bvh_instances.get_device_pointer();
+		// One frame per instance, no motion blur
+		scene_build_input.instanceTransformHeaders = nullptr;
+		scene_build_input.instanceFrames = instance_frames.get_device_pointer();
+		// All the instances are hit by all the rays without LODs
+		scene_build_input.instanceMasks = has_geometry_lods() ? instance_masks.get_device_pointer() : nullptr;
+		scene_build_input.instanceCount = static_cast<uint32_t>(get_bvh_instance_count());
+		scene_build_input.frameCount = scene_build_input.instanceCount;
+		scene_build_input.frameType = hiprtFrameTypeMatrix;
+
+		return scene_build_input;
+	}
+
+	void destroy_bvh()
+	{
+		if (scene)
+			HIPRT_CHECK_ERROR(hiprtDestroyScene(hiprt_ctx, scene));
+		scene = nullptr;
+
+		for (HIPRTGeometry* geometry : get_triangle_geometries())
+		{
+			if (geometry->m_geometry)
+				HIPRT_CHECK_ERROR(hiprtDestroyGeometry(hiprt_ctx, geometry->m_geometry));
+
+			geometry->m_geometry = nullptr;
+		}
+
+		if (spheres_geometry)
+			HIPRT_CHECK_ERROR(hiprtDestroyGeometry(hiprt_ctx, spheres_geometry));
+		spheres_geometry = nullptr;
+
+		OrochiDeviceMemoryPool::remove_external_usage(this);
+	}
+
+	/**
+	 * Destroys the BVH and frees all the buffers of the scene, before
+	 * another scene is set, see GPURenderer::update_pending_scene()
+	 */
+	void release_scene()
+	{
+		destroy_bvh();
+
+		geometries.clear();
+		lod_geometries.clear();
+		mesh_lod_indices.clear();
+		lod_instances.clear();
+		instances_primary_lod.clear();
+		instances_secondary_lod.clear();
+		host_instances.clear();
+		host_mesh_vertex_attributes.clear();
+
+		triangles_indices.free();
+		vertices_positions.free();
+		quantized_vertices_positions.free();
+		proxy_vertices_positions.free();
+		proxy_triangles_indices.free();
+		spheres.free();
+		spheres_aabbs.free();
+		instances.free();
+		bvh_instances.free();
+		instance_frames.free();
+		instance_masks.free();
+		bvh_build_temp_buffer.free();
+
+		mesh_vertex_attributes.free();
+		vertex_normals.free();
+		material_indices.free();
+		triangle_opacities.free();
+		triangle_opacity_micromap_indices.free();
+		opacity_micromaps.free();
+		materials_buffer.free();
+
+		emissive_triangles_count = 0;
+		emissive_triangles_total_power = 0.0f;
+		emissive_triangles_indices.free();
+		emissive_triangles_alias_table_probas.free();
+		emissive_triangles_alias_table_alias.free();
+		triangle_emission_texture_luminances.free();
+		light_bvh_nodes.free();
+		light_bvh_leaf_indices.free();
+		light_clusters = LightClustersGrid();
+		light_clusters_cells_offsets.free();
+		light_clusters_cells_emissive_triangles.free();
+		light_clusters_cells_alias_table_probas.free();
+		light_clusters_cells_alias_table_alias.free();
+		light_clusters_cells_total_power.free();
+
+		orochi_materials_textures.clear();
+		gpu_materials_textures.free();
+		textures_dims.free();
+		orochi_materials_textures_mips.clear();
+		gpu_materials_textures_mips.free();
+		textures_mip_ranges.free();
+		linearized_srgb_textures = false;
+		texcoords_buffer.free();
+		texcoords_half_buffer.free();
+	}
+
+	hiprtContext hiprt_ctx = nullptr;
+
+	// Top level BVH of the scene
+	hiprtScene scene = nullptr;
+	// Bottom level BVHs, indexed by mesh index
+	std::vector<HIPRTGeometry> geometries;
+	// Bottom level BVHs of the LODs of the meshes, see Scene::mesh_lods. Empty if the
+	// scene has no LODs or if they aren't used, see GPURenderer::set_hiprt_scene_from_scene()
+	std::vector<HIPRTGeometryLOD> lod_geometries;
+	// Indices in 'lod_geometries' of the LODs of each mesh, coarser and coarser
+	std::vector<std::vector<int>> mesh_lod_indices;
+	// Instances of the LODs in the top level BVH, after the instance of the spheres, see get_bvh_instances()
+	std::vector<HIPRTLODInstance> lod_instances;
+	// LOD that the primary / secondary rays see for each instance of 'host_instances', see set_instance_lods()
+	std::vector<int> instances_primary_lod;
+	std::vector<int> instances_secondary_lod;
+	// Bottom level BVH of all the analytic spheres of the scene, nullptr if there's no sphere.
+	// Instanced once, after the instances of the meshes, see get_bvh_instances()
+	hiprtGeometry spheres_geometry = nullptr;
+
+	// Triangles of all the meshes with global vertex indices, used for shading and
+	// for building the geometries of the meshes
+	OrochiBuffer<int> triangles_indices { "Scene geometry" };
+	// Object space vertices of all the meshes. If the positions are quantized,
+	// only allocated while the BVH is being built
+	OrochiBuffer<float3> vertices_positions { "Scene geometry" };
+	// See HIPRTRenderData::buffers.quantized_vertices_positions
+	OrochiBuffer<unsigned short> quantized_vertices_positions { "Scene geometry" };
+
+	// Bounding boxes standing in for the meshes whose BVH is still being streamed in, 8 vertices
+	// per box. All the boxes use the same 12 triangles, see GPURenderer::set_progressive_loading()
+	OrochiBuffer<float3> proxy_vertices_positions { "Scene geometry" };
+	OrochiBuffer<int> proxy_triangles_indices { "Scene geometry" };
+
+	// See HIPRTRenderData::buffers.spheres
+	OrochiBuffer<float4> spheres { "Scene geometry" };
+	// Bounding box of each sphere (min and max corners), the BVH of the spheres is built from them
+	OrochiBuffer<float4> spheres_aabbs { "Scene geometry" };
+
+	std::vector<SceneInstance> host_instances;
+	OrochiBuffer<SceneInstance> instances { "Scene instances" };
+	OrochiBuffer<hiprtInstance> bvh_instances { "Scene instances" };
+	OrochiBuffer<hiprtFrameMatrix> instance_frames { "Scene instances" };
+	// See get_bvh_instance_masks(), only allocated if the scene has LODs
+	OrochiBuffer<uint32_t> instance_masks { "Scene instances" };
+
+	OrochiBuffer<unsigned char> bvh_build_temp_buffer { "BVH build" };
+
+	// Nodes of the BVH, triangles data and temporary build buffer, see estimate_bvh_memory_size()
+	static constexpr size_t BVH_MEMORY_BYTES_PER_TRIANGLE_ESTIMATE = 256;
+
+	BVHBuildQuality bvh_build_quality = BVH_BUILD_QUALITY_HIGH;
+	// Time in milliseconds it took to build the BVH the last time build_bvh() was called
+	float bvh_last_build_time = 0.0f;
+	// Estimated VRAM used by the BVHs in bytes
+	size_t bvh_memory_size = 0;
+	// How many times the BVH has been built. Used to detect rebuilds
+	int bvh_build_count = 0;
+	// Time in milliseconds it took to refit the top level BVH the last
+	// time update_instance_transforms() was called
+	float bvh_last_update_time = 0.0f;
 
-	OrochiBuffer<bool> has_vertex_normals;
-	OrochiBuffer<float3> vertex_normals;
-	OrochiBuffer<int> material_indices;
-	OrochiBuffer<RendererMaterial> materials_buffer;
+	// See HIPRTRenderData::buffers.mesh_vertex_attributes
+	std::vector<MeshVertexAttributes> host_mesh_vertex_attributes;
+	OrochiBuffer<MeshVertexAttributes> mesh_vertex_attributes { "Scene geometry" };
+	// The shading attributes of the triangles are only read once per hit and go to host mapped
+	// memory if they don't fit in VRAM next to the BVH, see GPURenderer::set_hiprt_scene_from_scene()
+	//
+	// Octahedral encoded
+	OrochiBuffer<unsigned int> vertex_normals { "Scene geometry", BUFFER_PLACEMENT_AUTOMATIC };
+	OrochiBuffer<int> material_indices { "Scene geometry", BUFFER_PLACEMENT_AUTOMATIC };
+	// See HostDeviceCommon/TriangleOpacity.h
+	OrochiBuffer<unsigned char> triangle_opacities { "Scene geometry" };
+	OrochiBuffer<int> triangle_opacity_micromap_indices { "Scene geometry" };
+	OrochiBuffer<unsigned char> opacity_micromaps { "Scene geometry" };
+	OrochiBuffer<PackedRendererMaterial> materials_buffer { "Materials" };
 
 	int emissive_triangles_count = 0;
-	OrochiBuffer<int> emissive_triangles_indices;
+	OrochiBuffer<int> emissive_triangles_indices { "Emissive triangles" };
+	// Alias table for sampling the emissive triangles proportionally to their power
+	OrochiBuffer<float> emissive_triangles_alias_table_probas { "Emissive triangles" };
+	OrochiBuffer<int> emissive_triangles_alias_table_alias { "Emissive triangles" };
+	float emissive_triangles_total_power = 0.0f;
+	// See EmissiveTextureIntegrator, empty if no material has an emission texture
+	OrochiBuffer<float> triangle_emission_texture_luminances { "Emissive triangles" };
+	// Light hierarchy over the emissive triangles, see LightBVHBuilder
+	OrochiBuffer<LightBVHNode> light_bvh_nodes { "Light BVH" };
+	OrochiBuffer<int> light_bvh_leaf_indices { "Light BVH" };
+	// Light clusters of the ETSS_LIGHT_CLUSTERS strategy, see LightClustersBuilder. The
+	// buffer pointers of 'light_clusters' are set from the buffers below in the render data
+	LightClustersGrid light_clusters;
+	OrochiBuffer<int> light_clusters_cells_offsets { "Light clusters" };
+	OrochiBuffer<int> light_clusters_cells_emissive_triangles { "Light clusters" };
+	OrochiBuffer<float> light_clusters_cells_alias_table_probas { "Light clusters" };
+	OrochiBuffer<int> light_clusters_cells_alias_table_alias { "Light clusters" };
+	OrochiBuffer<float> light_clusters_cells_total_power { "Light clusters" };
 
 	// Vector to keep the textures data alive otherwise the OrochiTexture objects would
 	// be destroyed which means that the underlying textures would be destroyed
 	std::vector<OrochiTexture> orochi_materials_textures;
-	OrochiBuffer<oroTextureObject_t> gpu_materials_textures;
-	OrochiBuffer<int2> textures_dims;
-	OrochiBuffer<float2> texcoords_buffer;
+	OrochiBuffer<oroTextureObject_t> gpu_materials_textures { "Materials" };
+	OrochiBuffer<int2> textures_dims { "Materials" };
+	// Levels 1 and beyond of the mip chains of the material textures, kept alive the same way
+	std::vector<OrochiTexture> orochi_materials_textures_mips;
+	OrochiBuffer<oroTextureObject_t> gpu_materials_textures_mips { "Materials" };
+	// See HIPRTRenderData::buffers.material_textures_mip_ranges
+	OrochiBuffer<int2> textures_mip_ranges { "Materials" };
+	// See HIPRTRenderData::buffers.linearized_srgb_textures
+	bool linearized_srgb_textures = false;
+	// Only one of the two is allocated, see GPURenderer::set_half_precision_texcoords()
+	OrochiBuffer<float2> texcoords_buffer { "Scene geometry", BUFFER_PLACEMENT_AUTOMATIC };
+	OrochiBuffer<unsigned int> texcoords_half_buffer { "Scene geometry", BUFFER_PLACEMENT_AUTOMATIC };
 };
 
 #endif
@@ -8,31 +8,81 @@
 
 #include "hiprt/hiprt.h"
 #include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiDeviceMemoryPool.h"
+#include "HIPRT-Orochi/OrochiStagingPool.h"
 #include "Orochi/Orochi.h"
 #include "UI/ImGui/ImGuiLogger.h"
 #include "Utils/Utils.h"
 
+#include <algorithm>
+#include <cstring>
+
 extern ImGuiLogger g_imgui_logger;
 
+/**
+ * Where the allocation of an OrochiBuffer lives
+ */
+enum OrochiBufferPlacement
+{
+	// Device memory
+	BUFFER_PLACEMENT_DEVICE = 0,
+	// Pinned host memory mapped in the address space of the device: the kernels read the
+	// buffer over PCIe. For the buffers that don't fit in VRAM, see OrochiDeviceMemoryPool::allocate_host_mapped()
+	BUFFER_PLACEMENT_HOST_MAPPED = 1,
+	// Device memory if the allocation fits in the VRAM budget (see OrochiDeviceMemoryPool::fits_in_device_budget()),
+	// host mapped memory otherwise. Only for the buffers that the kernels don't read often (shading attributes for
+	// example), the BVH and the buffers read by every ray should stay on the device
+	BUFFER_PLACEMENT_AUTOMATIC = 2,
+};
+
 template <typename T>
 class OrochiBuffer
 {
 public:
 	OrochiBuffer() : m_data_pointer(nullptr) {}
 	OrochiBuffer(int element_count);
+	/**
+	 * Creates an empty buffer whose allocations are accounted for in the
+	 * given usage category of the OrochiDeviceMemoryPool
+	 */
+	OrochiBuffer(const std::string& usage_category) : m_data_pointer(nullptr), m_usage_category(usage_category) {}
+	OrochiBuffer(const std::string& usage_category, OrochiBufferPlacement placement) : m_data_pointer(nullptr), m_usage_category(usage_category), m_placement(placement) {}
 	OrochiBuffer(OrochiBuffer<T>&& other);
 	~OrochiBuffer();
 
 	void operator=(OrochiBuffer<T>&& other);
 
+	/**
+	 * Resizes the buffer. The content of the buffer is lost.
+	 * 
+	 * The allocation of the buffer is kept if it is big enough for the new size (it is never
+	 * shrunk) so that going back and forth between sizes doesn't reallocate. free() gives the
+	 * allocation back to the OrochiDeviceMemoryPool
+	 */
 	void resize(int new_element_count, size_t type_size_override = 0);
 	size_t get_element_count();
 
+	/**
+	 * Takes effect at the next resize()
+	 */
+	void set_placement(OrochiBufferPlacement placement);
+	OrochiBufferPlacement get_placement() const;
+	/**
+	 * Whether the current allocation of the buffer is in host mapped memory
+	 */
+	bool is_host_mapped() const;
+
 	T* get_device_pointer();
 	T** get_pointer_address();
 
 	std::vector<T> download_data() const;
 	void download_data_async(void* out, oroStream_t stream) const;
+	/**
+	 * Queues the download of the whole buffer on 'stream' into a pinned block of 'staging_pool'.
+	 * The downloaded data can be read with OrochiAsyncTransfer::get_downloaded_data() once the
+	 * returned transfer is done
+	 */
+	OrochiAsyncTransfer download_data_async(oroStream_t stream, OrochiStagingPool& staging_pool) const;
 	/**
 	 * Uploads as many elements as returned by get_element_count from the data std::vector into the buffer.
 	 * The given std::vector must therefore contain at least get_element_count() elements.
@@ -43,6 +93,20 @@ public:
 	 */
 	void upload_data(const std::vector<T>& data);
 	void upload_data(const void* data);
+	/**
+	 * Same as upload_data() but the copy is queued on 'stream' and this function doesn't
+	 * wait for it.
+	 * 
+	 * 'data' is first copied to pinned blocks of 'staging_pool' (in chunks of at most
+	 * OrochiStagingPool::MAX_CHUNK_SIZE bytes) so 'data' can be freed / modified
+	 * as soon as this function returns
+	 */
+	OrochiAsyncTransfer upload_data_async(const void* data, oroStream_t stream, OrochiStagingPool& staging_pool);
+	/**
+	 * Same as upload_data_async() but only uploads the 'element_count' elements pointed to by 'data'
+	 * to the elements [element_offset, element_offset + element_count[ of the buffer
+	 */
+	OrochiAsyncTransfer upload_data_partial_async(const void* data, size_t element_offset, size_t element_count, oroStream_t stream, OrochiStagingPool& staging_pool);
 
 	/**
 	 * Frees the buffer. No effect if already freed / not allocated yet
@@ -53,12 +117,19 @@ private:
 	T* m_data_pointer = nullptr;
 
 	size_t m_element_count = 0;
+	// Size in bytes of the allocation of the buffer, may be bigger than the size of the elements
+	size_t m_allocation_byte_size = 0;
+
+	std::string m_usage_category = OrochiDeviceMemoryPool::DEFAULT_USAGE_CATEGORY;
+
+	OrochiBufferPlacement m_placement = BUFFER_PLACEMENT_DEVICE;
+	bool m_host_mapped = false;
 };
 
 template <typename T>
 OrochiBuffer<T>::OrochiBuffer(int element_count) : m_element_count(element_count)
 {
-	OROCHI_CHECK_ERROR(oroMalloc(reinterpret_cast<oroDeviceptr*>(&m_data_pointer), sizeof(T) * element_count));
+	m_data_pointer = static_cast<T*>(OrochiDeviceMemoryPool::allocate(sizeof(T) * element_count, m_usage_category, m_allocation_byte_size));
 }
 
 template <typename T>
@@ -66,9 +137,15 @@ OrochiBuffer<T>::OrochiBuffer(OrochiBuffer<T>&& other)
 {
 	m_data_pointer = other.m_data_pointer;
 	m_element_count = other.m_element_count;
+	m_allocation_byte_size = other.m_allocation_byte_size;
+	m_usage_category = other.m_usage_category;
+	m_placement = other.m_placement;
+	m_host_mapped = other.m_host_mapped;
 
 	other.m_data_pointer = nullptr;
 	other.m_element_count = 0;
+	other.m_allocation_byte_size = 0;
+	other.m_host_mapped = false;
 }
 
 template <typename T>
@@ -80,21 +157,48 @@ OrochiBuffer<T>::~OrochiBuffer()
 template <typename T>
 void OrochiBuffer<T>::operator=(OrochiBuffer&& other)
 {
+	free();
+
 	m_data_pointer = other.m_data_pointer;
 	m_element_count = other.m_element_count;
+	m_allocation_byte_size = other.m_allocation_byte_size;
+	m_usage_category = other.m_usage_category;
+	m_placement = other.m_placement;
+	m_host_mapped = other.m_host_mapped;
 
 	other.m_data_pointer = nullptr;
 	other.m_element_count = 0;
+	other.m_allocation_byte_size = 0;
+	other.m_host_mapped = false;
 }
 
 template <typename T>
 void OrochiBuffer<T>::resize(int new_element_count, size_t type_size_override)
 {
-	if (m_data_pointer)
-		OROCHI_CHECK_ERROR(oroFree(reinterpret_cast<oroDeviceptr>(m_data_pointer)));
-
 	size_t buffer_size = type_size_override != 0 ? (type_size_override * new_element_count) : (sizeof(T) * new_element_count);
-	OROCHI_CHECK_ERROR(oroMalloc(reinterpret_cast<oroDeviceptr*>(&m_data_pointer), buffer_size));
+
+	bool reallocate = m_data_pointer == nullptr || buffer_size > m_allocation_byte_size;
+	// The placement was changed with set_placement()
+	reallocate |= (m_placement == BUFFER_PLACEMENT_DEVICE && m_host_mapped) || (m_placement == BUFFER_PLACEMENT_HOST_MAPPED && !m_host_mapped);
+	if (reallocate)
+	{
+		OrochiDeviceMemoryPool::release(m_data_pointer);
+		m_data_pointer = nullptr;
+
+		bool host_mapped = m_placement == BUFFER_PLACEMENT_HOST_MAPPED;
+		if (m_placement == BUFFER_PLACEMENT_AUTOMATIC && !OrochiDeviceMemoryPool::fits_in_device_budget(buffer_size))
+		{
+			host_mapped = true;
+
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "%.1fMB of \"%s\" don't fit in the VRAM budget, they are read from host memory over PCIe.", buffer_size / 1000000.0f, m_usage_category.c_str());
+		}
+
+		if (host_mapped)
+			m_data_pointer = static_cast<T*>(OrochiDeviceMemoryPool::allocate_host_mapped(buffer_size, m_usage_category, m_allocation_byte_size));
+		else
+			m_data_pointer = static_cast<T*>(OrochiDeviceMemoryPool::allocate(buffer_size, m_usage_category, m_allocation_byte_size));
+		m_host_mapped = host_mapped;
+	}
 
 	m_element_count = new_element_count;
 }
@@ -105,6 +209,24 @@ size_t OrochiBuffer<T>::get_element_count()
 	return m_element_count;
 }
 
+template <typename T>
+void OrochiBuffer<T>::set_placement(OrochiBufferPlacement placement)
+{
+	m_placement = placement;
+}
+
+template <typename T>
+OrochiBufferPlacement OrochiBuffer<T>::get_placement() const
+{
+	return m_placement;
+}
+
+template <typename T>
+bool OrochiBuffer<T>::is_host_mapped() const
+{
+	return m_host_mapped;
+}
+
 template <typename T>
 T* OrochiBuffer<T>::get_device_pointer()
 {
@@ -146,6 +268,19 @@ void OrochiBuffer<T>::download_data_async(void* out, oroStream_t stream) const
 	//oroMemcpyDtoHAsync(out, m_data_pointer, m_element_count * sizeof(T), stream);
 }
 
+template <typename T>
+OrochiAsyncTransfer OrochiBuffer<T>::download_data_async(oroStream_t stream, OrochiStagingPool& staging_pool) const
+{
+	if (m_data_pointer == nullptr)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Trying to download data async from a non-allocated buffer!");
+
+		return OrochiAsyncTransfer();
+	}
+
+	return staging_pool.download_async(m_data_pointer, sizeof(T) * m_element_count, stream);
+}
+
 template <typename T>
 void OrochiBuffer<T>::upload_data(const std::vector<T>& data)
 {
@@ -162,14 +297,56 @@ void OrochiBuffer<T>::upload_data(const void* data)
 		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Trying to upload data to an OrochiBuffer that hasn't been allocated yet!");
 }
 
+template <typename T>
+OrochiAsyncTransfer OrochiBuffer<T>::upload_data_async(const void* data, oroStream_t stream, OrochiStagingPool& staging_pool)
+{
+	return upload_data_partial_async(data, 0, m_element_count, stream, staging_pool);
+}
+
+template <typename T>
+OrochiAsyncTransfer OrochiBuffer<T>::upload_data_partial_async(const void* data, size_t element_offset, size_t element_count, oroStream_t stream, OrochiStagingPool& staging_pool)
+{
+	OrochiAsyncTransfer transfer;
+	if (m_data_pointer == nullptr)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Trying to upload data to an OrochiBuffer that hasn't been allocated yet!");
+
+		return transfer;
+	}
+	else if (element_offset + element_count > m_element_count)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Trying to upload elements [%zu, %zu[ to an OrochiBuffer of %zu elements!", element_offset, element_offset + element_count, m_element_count);
+
+		return transfer;
+	}
+
+	unsigned char* destination = reinterpret_cast<unsigned char*>(m_data_pointer + element_offset);
+	size_t byte_count = sizeof(T) * element_count;
+	for (size_t byte_offset = 0; byte_offset < byte_count; byte_offset += OrochiStagingPool::MAX_CHUNK_SIZE)
+	{
+		size_t chunk_byte_count = std::min(OrochiStagingPool::MAX_CHUNK_SIZE, byte_count - byte_offset);
+
+		std::shared_ptr<OrochiStagingBlock> block = staging_pool.acquire(chunk_byte_count);
+		std::memcpy(block->host_pointer, static_cast<const unsigned char*>(data) + byte_offset, chunk_byte_count);
+
+		OROCHI_CHECK_ERROR(oroMemcpyAsync(destination + byte_offset, block->host_pointer, chunk_byte_count, oroMemcpyHostToDevice, stream));
+		OROCHI_CHECK_ERROR(oroEventRecord(block->copy_done_event, stream));
+
+		transfer.add_block(block);
+	}
+
+	return transfer;
+}
+
 template <typename T>
 void OrochiBuffer<T>::free()
 {
-	if (m_data_pointer)
-		OROCHI_CHECK_ERROR(oroFree(reinterpret_cast<oroDeviceptr>(m_data_pointer)));
+	OrochiDeviceMemoryPool::release(m_data_pointer);
 
 	m_element_count = 0;
+	m_allocation_byte_size = 0;
 	m_data_pointer = nullptr;
+	m_host_mapped = false;
 }
 
 #endif
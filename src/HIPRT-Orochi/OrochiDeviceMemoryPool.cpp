@@ -0,0 +1,209 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiDeviceMemoryPool.h"
+
+#include <algorithm>
+
+std::mutex OrochiDeviceMemoryPool::m_mutex;
+std::unordered_map<oroCtx, std::multimap<size_t, void*>> OrochiDeviceMemoryPool::m_free_allocations;
+std::unordered_map<void*, OrochiDeviceMemoryPool::Allocation> OrochiDeviceMemoryPool::m_used_allocations;
+std::unordered_map<const void*, OrochiDeviceMemoryPool::Allocation> OrochiDeviceMemoryPool::m_external_allocations;
+std::unordered_map<oroCtx, size_t> OrochiDeviceMemoryPool::m_device_memory_reserves;
+
+size_t OrochiDeviceMemoryPool::get_allocation_size(size_t byte_size)
+{
+	const size_t granularity = byte_size > 1024 * 1024 ? 64 * 1024 : 256;
+
+	return std::max(granularity, (byte_size + granularity - 1) / granularity * granularity);
+}
+
+oroCtx OrochiDeviceMemoryPool::get_current_context()
+{
+	oroCtx context;
+	OROCHI_CHECK_ERROR(oroCtxGetCurrent(&context));
+
+	return context;
+}
+
+void* OrochiDeviceMemoryPool::allocate(size_t byte_size, const std::string& usage_category, size_t& out_allocation_size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	oroCtx context = get_current_context();
+	size_t allocation_size = get_allocation_size(byte_size);
+
+	void* device_pointer = nullptr;
+
+	// Smallest unused allocation that is big enough
+	std::multimap<size_t, void*>& free_allocations = m_free_allocations[context];
+	auto best_fit = free_allocations.lower_bound(allocation_size);
+	if (best_fit != free_allocations.end() && best_fit->first <= allocation_size * MAX_REUSE_SIZE_FACTOR)
+	{
+		allocation_size = best_fit->first;
+		device_pointer = best_fit->second;
+
+		free_allocations.erase(best_fit);
+	}
+	else
+	{
+		if (oroMalloc(reinterpret_cast<oroDeviceptr*>(&device_pointer), allocation_size) != oroSuccess)
+		{
+			// Probably out of memory, giving the unused allocations
+			// back to the driver and trying again
+			for (auto& size_and_pointer : free_allocations)
+				OROCHI_CHECK_ERROR(oroFree(reinterpret_cast<oroDeviceptr>(size_and_pointer.second)));
+			free_allocations.clear();
+
+			OROCHI_CHECK_ERROR(oroMalloc(reinterpret_cast<oroDeviceptr*>(&device_pointer), allocation_size));
+		}
+	}
+
+	m_used_allocations[device_pointer] = { context, allocation_size, usage_category };
+	out_allocation_size = allocation_size;
+
+	return device_pointer;
+}
+
+void* OrochiDeviceMemoryPool::allocate_host_mapped(size_t byte_size, const std::string& usage_category, size_t& out_allocation_size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	size_t allocation_size = get_allocation_size(byte_size);
+
+	void* host_pointer = nullptr;
+	void* device_pointer = nullptr;
+	OROCHI_CHECK_ERROR(oroHostMalloc(&host_pointer, allocation_size, OrochiDeviceMemoryPool::HOST_MALLOC_MAPPED_FLAG));
+	OROCHI_CHECK_ERROR(oroHostGetDevicePointer(reinterpret_cast<oroDeviceptr*>(&device_pointer), host_pointer, 0));
+
+	m_used_allocations[device_pointer] = { get_current_context(), allocation_size, usage_category + OrochiDeviceMemoryPool::HOST_MAPPED_CATEGORY_SUFFIX, host_pointer };
+	out_allocation_size = allocation_size;
+
+	return device_pointer;
+}
+
+bool OrochiDeviceMemoryPool::fits_in_device_budget(size_t byte_size)
+{
+	size_t free_memory, total_memory;
+	OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory, &total_memory));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	oroCtx context = get_current_context();
+	for (const auto& size_and_pointer : m_free_allocations[context])
+		free_memory += size_and_pointer.first;
+
+	size_t kept_free = m_device_memory_reserves[context] + static_cast<size_t>(total_memory * (1.0f - BUDGET_WARNING_THRESHOLD));
+
+	return free_memory > kept_free && byte_size <= free_memory - kept_free;
+}
+
+void OrochiDeviceMemoryPool::set_device_memory_reserve(size_t byte_size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_device_memory_reserves[get_current_context()] = byte_size;
+}
+
+void OrochiDeviceMemoryPool::release(void* device_pointer)
+{
+	if (device_pointer == nullptr)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto find = m_used_allocations.find(device_pointer);
+	if (find == m_used_allocations.end())
+		return;
+
+	if (find->second.host_pointer != nullptr)
+	{
+		// Not pooled, the pinned host memory is a scarce resource for the other applications.
+		// oroHostFree() waits for the device to be done with the allocation
+		OROCHI_CHECK_ERROR(oroHostFree(find->second.host_pointer));
+		m_used_allocations.erase(find);
+
+		return;
+	}
+
+	m_free_allocations[find->second.context].insert(std::make_pair(find->second.byte_size, device_pointer));
+	m_used_allocations.erase(find);
+}
+
+void OrochiDeviceMemoryPool::set_external_usage(const void* owner, const std::string& usage_category, size_t byte_size)
+{
+	if (byte_size == 0)
+	{
+		remove_external_usage(owner);
+
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_external_allocations[owner] = { get_current_context(), byte_size, usage_category };
+}
+
+void OrochiDeviceMemoryPool::remove_external_usage(const void* owner)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_external_allocations.erase(owner);
+}
+
+void OrochiDeviceMemoryPool::trim()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::multimap<size_t, void*>& free_allocations = m_free_allocations[get_current_context()];
+	for (auto& size_and_pointer : free_allocations)
+		OROCHI_CHECK_ERROR(oroFree(reinterpret_cast<oroDeviceptr>(size_and_pointer.second)));
+
+	free_allocations.clear();
+}
+
+std::map<std::string, size_t> OrochiDeviceMemoryPool::get_usage(size_t& out_pooled_byte_size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	oroCtx context = get_current_context();
+
+	std::map<std::string, size_t> usage;
+	for (const auto& pointer_and_allocation : m_used_allocations)
+		if (pointer_and_allocation.second.context == context)
+			usage[pointer_and_allocation.second.usage_category] += pointer_and_allocation.second.byte_size;
+	for (const auto& owner_and_allocation : m_external_allocations)
+		if (owner_and_allocation.second.context == context)
+			usage[owner_and_allocation.second.usage_category] += owner_and_allocation.second.byte_size;
+
+	out_pooled_byte_size = 0;
+	for (const auto& size_and_pointer : m_free_allocations[context])
+		out_pooled_byte_size += size_and_pointer.first;
+
+	return usage;
+}
+
+void OrochiDeviceMemoryPool::print_usage(std::ostream& stream, size_t device_total_memory)
+{
+	size_t pooled_byte_size;
+	std::map<std::string, size_t> usage = get_usage(pooled_byte_size);
+
+	size_t total_byte_size = pooled_byte_size;
+	stream << "Device memory usage: " << std::endl;
+	for (const auto& category_and_byte_size : usage)
+	{
+		stream << "\t" << category_and_byte_size.first << ": " << category_and_byte_size.second / 1000000.0f << "MB" << std::endl;
+
+		if (!category_and_byte_size.first.ends_with(OrochiDeviceMemoryPool::HOST_MAPPED_CATEGORY_SUFFIX))
+			// Not in the device memory
+			total_byte_size += category_and_byte_size.second;
+	}
+	stream << "\tPooled (unused): " << pooled_byte_size / 1000000.0f << "MB" << std::endl;
+	stream << "\tTotal: " << total_byte_size / 1000000.0f << "MB / " << device_total_memory / 1000000.0f << "MB" << std::endl;
+
+	if (total_byte_size > device_total_memory * BUDGET_WARNING_THRESHOLD)
+		stream << "WARNING: The renderer is using more than " << static_cast<int>(BUDGET_WARNING_THRESHOLD * 100.0f) << "% of the device memory" << std::endl;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef OROCHI_DEVICE_MEMORY_POOL_H
+#define OROCHI_DEVICE_MEMORY_POOL_H
+
+#include "Orochi/Orochi.h"
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Pool of device allocations that the OrochiBuffer draw from.
+ *
+ * Freed buffers give their allocation back to the pool instead of calling oroFree() so
+ * that toggling a setting that frees and reallocates buffers (or resizing the window back
+ * and forth) reuses these allocations instead of going through oroMalloc() every time.
+ *
+ * The pool also keeps track of how much memory is used per usage category
+ * (see OrochiBuffer::OrochiBuffer(const std::string&)) for displaying in ImGui.
+ * Device memory that isn't allocated through the pool (textures, BVHs, denoiser buffers, ...)
+ * is reported to it with set_external_usage() so that get_usage() accounts for everything.
+ *
+ * Allocations are pooled per Orochi context (the context current
+ * when calling allocate() / release())
+ *
+ * The OrochiBuffer whose placement is host mapped (see OrochiBufferPlacement) are allocated in pinned host memory
+ * mapped in the address space of the device with allocate_host_mapped(): the kernels read them over PCIe. These
+ * allocations aren't pooled and their usage is reported in their category suffixed with HOST_MAPPED_CATEGORY_SUFFIX
+ */
+class OrochiDeviceMemoryPool
+{
+public:
+	// Category of the buffers that weren't given one
+	static constexpr const char* DEFAULT_USAGE_CATEGORY = "Other";
+	// Fraction of the device memory above which get_usage() users should warn that the
+	// device is running out of memory
+	static constexpr float BUDGET_WARNING_THRESHOLD = 0.9f;
+	static constexpr const char* HOST_MAPPED_CATEGORY_SUFFIX = " (host mapped)";
+
+	/**
+	 * Returns a device allocation of at least 'byte_size' bytes. 'out_allocation_size' is set
+	 * to the actual size of the allocation, which may be bigger than requested if
+	 * a pooled allocation was reused
+	 */
+	static void* allocate(size_t byte_size, const std::string& usage_category, size_t& out_allocation_size);
+	/**
+	 * Same as allocate() but the allocation is in pinned host memory mapped in the address space of the device of the
+	 * current context. The returned pointer is the device pointer of the allocation. Given back with release() too
+	 */
+	static void* allocate_host_mapped(size_t byte_size, const std::string& usage_category, size_t& out_allocation_size);
+
+	/**
+	 * Whether an allocation of 'byte_size' bytes still leaves the device memory reserve (see set_device_memory_reserve())
+	 * and 1 - BUDGET_WARNING_THRESHOLD of the device memory free in the current context. The unused allocations of
+	 * the pool count as free memory
+	 */
+	static bool fits_in_device_budget(size_t byte_size);
+	/**
+	 * Device memory that is going to be allocated in the current context but isn't allocated yet (the BVH
+	 * of a scene before it is built for example), kept free by fits_in_device_budget(). 0 for none
+	 */
+	static void set_device_memory_reserve(size_t byte_size);
+
+	/**
+	 * Gives an allocation returned by allocate() back to the pool.
+	 * 
+	 * Contrary to oroFree(), this doesn't wait for the device so the allocation must not be in use
+	 * by any kernel anymore. The renderers only reallocate their buffers between frames
+	 */
+	static void release(void* device_pointer);
+
+	/**
+	 * Reports 'byte_size' bytes of device memory that were allocated outside of the pool by 'owner'
+	 * in the current context. Calling this function again with the same owner replaces the previous value
+	 */
+	static void set_external_usage(const void* owner, const std::string& usage_category, size_t byte_size);
+	/**
+	 * Removes the memory reported by 'owner' with set_external_usage(). Does nothing if
+	 * 'owner' didn't report anything
+	 */
+	static void remove_external_usage(const void* owner);
+
+	/**
+	 * oroFree() all the unused allocations of the pool of the current context
+	 */
+	static void trim();
+
+	/**
+	 * Returns the number of bytes allocated per usage category in the current context,
+	 * external usages included. The unused allocations held by the pool are in 'out_pooled_byte_size'
+	 */
+	static std::map<std::string, size_t> get_usage(size_t& out_pooled_byte_size);
+	/**
+	 * Prints the usage per category of the current context to 'stream' and
+	 * a warning if it is above BUDGET_WARNING_THRESHOLD of 'device_total_memory'
+	 */
+	static void print_usage(std::ostream& stream, size_t device_total_memory);
+
+private:
+	struct Allocation
+	{
+		oroCtx context;
+		size_t byte_size;
+		std::string usage_category;
+
+		// Host pointer of an allocation of allocate_host_mapped(), nullptr for device allocations
+		void* host_pointer = nullptr;
+	};
+
+	// oroHostMalloc() flag of the pinned host allocations mapped in the address
+	// space of the device. Same value for hipHostMallocMapped and CU_MEMHOSTALLOC_DEVICEMAP
+	static constexpr unsigned int HOST_MALLOC_MAPPED_FLAG = 0x2;
+
+	/**
+	 * Rounds the requested size up so that allocations of slightly different sizes
+	 * (resizing the window by a few pixels for example) can reuse each other
+	 */
+	static size_t get_allocation_size(size_t byte_size);
+
+	static oroCtx get_current_context();
+
+	// A pooled allocation is only reused for a request if it is not more than this
+	// factor bigger than the request. Avoids wasting a lot of VRAM on small buffers
+	static constexpr float MAX_REUSE_SIZE_FACTOR = 1.5f;
+
+	static std::mutex m_mutex;
+
+	// Unused allocations per context. Maps the size of the allocations to their pointer
+	static std::unordered_map<oroCtx, std::multimap<size_t, void*>> m_free_allocations;
+	// All the allocations in use, by device pointer
+	static std::unordered_map<void*, Allocation> m_used_allocations;
+	// Memory reported with set_external_usage(), by owner
+	static std::unordered_map<const void*, Allocation> m_external_allocations;
+	// See set_device_memory_reserve(), per context
+	static std::unordered_map<oroCtx, size_t> m_device_memory_reserves;
+};
+
+#endif
@@ -4,18 +4,29 @@
  */
 
 #include "HIPRT-Orochi/OrochiEnvmap.h"
+#include "HostDeviceCommon/RGB9E5.h"
 #include "UI/ImGui/ImGuiLogger.h"
+#include "Utils/Utils.h"
+
+#include "glm/gtc/packing.hpp"
 
 extern ImGuiLogger g_imgui_logger;
 
-OrochiEnvmap::OrochiEnvmap(Image32Bit& image) : OrochiTexture(image)
+OrochiEnvmap::OrochiEnvmap(Image32Bit& image) : OrochiEnvmap()
 {
-	
+	init_from_image(image);
 }
 
 OrochiEnvmap::OrochiEnvmap(OrochiEnvmap&& other) noexcept : OrochiTexture(std::move(other))
 {
 	m_cdf = std::move(other.m_cdf);
+	m_rgb9e5_texels = std::move(other.m_rgb9e5_texels);
+	m_rgb32f_texels = std::move(other.m_rgb32f_texels);
+	m_luminance_pyramid = std::move(other.m_luminance_pyramid);
+	m_luminance_pyramid_leaf_level = other.m_luminance_pyramid_leaf_level;
+	m_importance_map_luminance = std::move(other.m_importance_map_luminance);
+	m_importance_map_width = other.m_importance_map_width;
+	m_importance_map_height = other.m_importance_map_height;
 }
 
 void OrochiEnvmap::operator=(OrochiEnvmap&& other) noexcept
@@ -23,11 +34,86 @@ void OrochiEnvmap::operator=(OrochiEnvmap&& other) noexcept
 	OrochiTexture::operator=(std::move(other));
 
 	m_cdf = std::move(other.m_cdf);
+	m_rgb9e5_texels = std::move(other.m_rgb9e5_texels);
+	m_rgb32f_texels = std::move(other.m_rgb32f_texels);
+	m_luminance_pyramid = std::move(other.m_luminance_pyramid);
+	m_luminance_pyramid_leaf_level = other.m_luminance_pyramid_leaf_level;
+	m_importance_map_luminance = std::move(other.m_importance_map_luminance);
+	m_importance_map_width = other.m_importance_map_width;
+	m_importance_map_height = other.m_importance_map_height;
 }
 
-void OrochiEnvmap::init_from_image(const Image32Bit& image)
+void OrochiEnvmap::init_from_image(const Image32Bit& image, int storage_format)
 {
-	OrochiTexture::init_from_image(image);
+	m_rgb9e5_texels.free();
+	m_rgb32f_texels.free();
+
+	if (storage_format == ESF_RGBA16F)
+	{
+		std::vector<unsigned short> half_texels(image.width * image.height * 4);
+
+#pragma omp parallel for
+		for (int i = 0; i < image.width * image.height; i++)
+			for (int channel = 0; channel < 4; channel++)
+				// Alpha defaults to 1 if the image has less than 4 channels
+				half_texels[i * 4 + channel] = glm::packHalf1x16(channel < image.channels ? image[i * image.channels + channel] : 1.0f);
+
+		// X, Y, Z and W in oroCreateChannelDesc are the number of *bits* of each component
+		oroChannelFormatDesc channel_descriptor = oroCreateChannelDesc(16, 16, 16, 16, oroChannelFormatKindFloat);
+		OrochiTexture::init_from_data(half_texels.data(), image.width, image.height, image.width * sizeof(unsigned short) * 4, channel_descriptor);
+	}
+	else if (storage_format == ESF_RGB9E5)
+	{
+		// The envmap is decoded and filtered by the shader, no texture needed
+		OrochiTexture::free();
+		width = image.width;
+		height = image.height;
+
+		std::vector<unsigned int> packed_texels(image.width * image.height);
+
+#pragma omp parallel for
+		for (int i = 0; i < image.width * image.height; i++)
+		{
+			ColorRGB32F color;
+			color.r = image[i * image.channels + 0];
+			color.g = image.channels > 1 ? image[i * image.channels + 1] : color.r;
+			color.b = image.channels > 2 ? image[i * image.channels + 2] : color.r;
+
+			packed_texels[i] = rgb9e5_encode(color);
+		}
+
+		m_rgb9e5_texels.resize(packed_texels.size());
+		m_rgb9e5_texels.upload_data(packed_texels.data());
+	}
+	else if (storage_format == ESF_RGB32F)
+	{
+		// Filtered by the shader too, HIP/CUDA textures can't have 3 channels
+		OrochiTexture::free();
+		width = image.width;
+		height = image.height;
+
+		std::vector<float> rgb_texels(image.width * image.height * 3);
+
+#pragma omp parallel for
+		for (int i = 0; i < image.width * image.height; i++)
+			for (int channel = 0; channel < 3; channel++)
+				rgb_texels[i * 3 + channel] = image[i * image.channels + (channel < image.channels ? channel : 0)];
+
+		m_rgb32f_texels.resize(rgb_texels.size());
+		m_rgb32f_texels.upload_data(rgb_texels.data());
+	}
+	else
+		OrochiTexture::init_from_image(image);
+}
+
+void* OrochiEnvmap::get_device_envmap()
+{
+	if (m_rgb9e5_texels.get_element_count() > 0)
+		return m_rgb9e5_texels.get_device_pointer();
+	else if (m_rgb32f_texels.get_element_count() > 0)
+		return m_rgb32f_texels.get_device_pointer();
+
+	return get_device_texture();
 }
 
 void OrochiEnvmap::compute_cdf(const Image32Bit& image)
@@ -53,16 +139,26 @@ void OrochiEnvmap::free_cdf()
 	m_cdf.free();
 }
 
-void OrochiEnvmap::compute_alias_table(const Image32Bit& image)
+void OrochiEnvmap::compute_alias_table(const Image32Bit& image, bool compact_probabilities)
 {
 	std::vector<float> probas;
 	std::vector<int> alias;
 	image.compute_alias_table(probas, alias, &m_luminance_total_sum);
 
-	m_alias_table_probas.resize(width * height);
-	m_alias_table_alias.resize(width * height);
+	if (compact_probabilities)
+	{
+		m_alias_table_probas.free();
+		m_alias_table_probas_16bit.resize(width * height);
+		m_alias_table_probas_16bit.upload_data(Utils::quantize_unorm16(probas).data());
+	}
+	else
+	{
+		m_alias_table_probas_16bit.free();
+		m_alias_table_probas.resize(width * height);
+		m_alias_table_probas.upload_data(probas.data());
+	}
 
-	m_alias_table_probas.upload_data(probas.data());
+	m_alias_table_alias.resize(width * height);
 	m_alias_table_alias.upload_data(alias.data());
 }
 
@@ -72,12 +168,106 @@ void OrochiEnvmap::get_alias_table_device_pointers(float*& probas, int*& aliases
 	aliases = m_alias_table_alias.get_device_pointer();
 }
 
+unsigned short* OrochiEnvmap::get_alias_table_16bit_probas_device_pointer()
+{
+	return m_alias_table_probas_16bit.get_device_pointer();
+}
+
 void OrochiEnvmap::free_alias_table()
 {
 	m_alias_table_probas.free();
+	m_alias_table_probas_16bit.free();
 	m_alias_table_alias.free();
 }
 
+void OrochiEnvmap::compute_marginal_conditional_cdf(const Image32Bit& image)
+{
+	std::vector<float> marginal_cdf;
+	std::vector<float> conditional_cdfs;
+	image.compute_marginal_conditional_cdf(marginal_cdf, conditional_cdfs);
+	// Same as for the CDF, the last element of the marginal CDF is the total sum
+	m_luminance_total_sum = marginal_cdf.back();
+
+	m_marginal_cdf.resize(height);
+	m_conditional_cdfs.resize(width * height);
+
+	m_marginal_cdf.upload_data(marginal_cdf.data());
+	m_conditional_cdfs.upload_data(conditional_cdfs.data());
+}
+
+void OrochiEnvmap::get_marginal_conditional_cdf_device_pointers(float*& marginal_cdf, float*& conditional_cdfs)
+{
+	marginal_cdf = m_marginal_cdf.get_device_pointer();
+	conditional_cdfs = m_conditional_cdfs.get_device_pointer();
+}
+
+void OrochiEnvmap::free_marginal_conditional_cdf()
+{
+	m_marginal_cdf.free();
+	m_conditional_cdfs.free();
+}
+
+void OrochiEnvmap::compute_luminance_pyramid(const Image32Bit& image)
+{
+	std::vector<float> luminance_pyramid;
+	m_luminance_pyramid_leaf_level = image.compute_luminance_pyramid(luminance_pyramid, OrochiEnvmap::LUMINANCE_PYRAMID_MAX_LEAF_HEIGHT);
+
+	m_luminance_pyramid.resize(luminance_pyramid.size());
+	m_luminance_pyramid.upload_data(luminance_pyramid.data());
+}
+
+float* OrochiEnvmap::get_luminance_pyramid_device_pointer()
+{
+	return m_luminance_pyramid.get_device_pointer();
+}
+
+int OrochiEnvmap::get_luminance_pyramid_leaf_level() const
+{
+	return m_luminance_pyramid_leaf_level;
+}
+
+void OrochiEnvmap::free_luminance_pyramid()
+{
+	m_luminance_pyramid.free();
+}
+
+void OrochiEnvmap::upload_importance_map(const Image32Bit* importance_map)
+{
+	if (importance_map == nullptr)
+	{
+		m_importance_map_luminance.free();
+		m_importance_map_width = width;
+		m_importance_map_height = height;
+
+		return;
+	}
+
+	std::vector<float> luminance(importance_map->width * importance_map->height);
+	for (int y = 0; y < importance_map->height; y++)
+		for (int x = 0; x < importance_map->width; x++)
+			luminance[y * importance_map->width + x] = importance_map->luminance_of_pixel(x, y);
+
+	m_importance_map_luminance.resize(luminance.size());
+	m_importance_map_luminance.upload_data(luminance.data());
+	m_importance_map_width = importance_map->width;
+	m_importance_map_height = importance_map->height;
+}
+
+float* OrochiEnvmap::get_importance_map_luminance_device_pointer()
+{
+	return m_importance_map_luminance.get_element_count() > 0 ? m_importance_map_luminance.get_device_pointer() : nullptr;
+}
+
+int OrochiEnvmap::get_importance_map_width() const
+{
+	return m_importance_map_width;
+}
+
+int OrochiEnvmap::get_importance_map_height() const
+{
+	return m_importance_map_height;
+}
+
 float OrochiEnvmap::get_luminance_total_sum() const
 {
 	return m_luminance_total_sum;
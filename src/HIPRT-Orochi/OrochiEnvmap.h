@@ -7,11 +7,12 @@
 #define OROCHI_ENVMAP_H
 
 #include "HIPRT-Orochi/OrochiTexture.h"
+#include "HostDeviceCommon/KernelOptions.h"
 
 class OrochiEnvmap : public OrochiTexture
 {
 public:
-	OrochiEnvmap () : OrochiTexture() {}
+	OrochiEnvmap () : OrochiTexture() { m_usage_category = "Envmap"; }
 	OrochiEnvmap(Image32Bit& image);
 	OrochiEnvmap(const OrochiEnvmap& other) = delete;
 	OrochiEnvmap(OrochiEnvmap&& other) noexcept;
@@ -20,20 +21,57 @@ public:
 	void operator=(const OrochiEnvmap& other) = delete;
 	void operator=(OrochiEnvmap&& other) noexcept;
 
-	void init_from_image(const Image32Bit& image);
+	/**
+	 * Uploads the envmap to the GPU in the given format (one of the ESF_XXX values of KernelOptions.h)
+	 */
+	void init_from_image(const Image32Bit& image, int storage_format = ESF_RGBA32F);
+	/**
+	 * Returns the pointer to give to WorldSettings::envmap for the format
+	 * the envmap was uploaded with
+	 */
+	void* get_device_envmap();
 
 	void compute_cdf(const Image32Bit& image);
 	float* get_cdf_device_pointer();
 	void free_cdf();
 
-	void compute_alias_table(const Image32Bit& image);
+	/**
+	 * If 'compact_probabilities' is true, the probabilities of the alias table are stored
+	 * as 16-bit unsigned normalized integers (see get_alias_table_16bit_probas_device_pointer())
+	 * and the float probabilities returned by get_alias_table_device_pointers() are nullptr
+	 */
+	void compute_alias_table(const Image32Bit& image, bool compact_probabilities = false);
 	void get_alias_table_device_pointers(float*& probas, int*& aliases);
+	unsigned short* get_alias_table_16bit_probas_device_pointer();
 	void free_alias_table();
 
+	void compute_marginal_conditional_cdf(const Image32Bit& image);
+	void get_marginal_conditional_cdf_device_pointers(float*& marginal_cdf, float*& conditional_cdfs);
+	void free_marginal_conditional_cdf();
+
+	/**
+	 * Luminance pyramid of the envmap for the product sampling strategy (ESS_PRODUCT_SAMPLING),
+	 * see WorldSettings::envmap_luminance_pyramid
+	 */
+	void compute_luminance_pyramid(const Image32Bit& image);
+	float* get_luminance_pyramid_device_pointer();
+	int get_luminance_pyramid_leaf_level() const;
+	void free_luminance_pyramid();
+
+	/**
+	 * Uploads the luminance of the downscaled importance map that the sampling data structures are
+	 * computed on, see WorldSettings::envmap_sampling_luminance. If 'importance_map' is nullptr, the
+	 * sampling data structures are computed on the envmap itself and nothing is uploaded
+	 */
+	void upload_importance_map(const Image32Bit* importance_map);
+	float* get_importance_map_luminance_device_pointer();
+	int get_importance_map_width() const;
+	int get_importance_map_height() const;
+
 	/**
 	 * Returns the sum of the luminance of all the texels of the envmap.
-	 * This value is not computed by this function but is computed by compute_cdf()
-	 * and compute_alias_table() so one of these two functions must be
+	 * This value is not computed by this function but is computed by compute_cdf(),
+	 * compute_alias_table() and compute_marginal_conditional_cdf() so one of these functions must be
 	 * called before calling 'get_luminance_total_sum' or 'get_luminance_total_sum'
 	 * will return 0.0f
 	 */
@@ -42,10 +80,29 @@ public:
 private:
 	float m_luminance_total_sum = 0.0f;
 
-	OrochiBuffer<float> m_cdf;
+	// Texels of the envmap if stored in the ESF_RGB9E5 format,
+	// the texture of the parent OrochiTexture is unused in that case
+	OrochiBuffer<unsigned int> m_rgb9e5_texels { "Envmap" };
+	// Same for the ESF_RGB32F format, 3 floats per texel
+	OrochiBuffer<float> m_rgb32f_texels { "Envmap" };
+
+	OrochiBuffer<float> m_cdf { "Envmap" };
+
+	OrochiBuffer<float> m_alias_table_probas { "Envmap" };
+	OrochiBuffer<unsigned short> m_alias_table_probas_16bit { "Envmap" };
+	OrochiBuffer<int> m_alias_table_alias { "Envmap" };
+
+	OrochiBuffer<float> m_marginal_cdf { "Envmap" };
+	OrochiBuffer<float> m_conditional_cdfs { "Envmap" };
+
+	// Rows of the finest level of the luminance pyramid at most
+	static constexpr int LUMINANCE_PYRAMID_MAX_LEAF_HEIGHT = 1024;
+	OrochiBuffer<float> m_luminance_pyramid { "Envmap" };
+	int m_luminance_pyramid_leaf_level = 0;
 
-	OrochiBuffer<float> m_alias_table_probas;
-	OrochiBuffer<int> m_alias_table_alias;
+	OrochiBuffer<float> m_importance_map_luminance { "Envmap" };
+	int m_importance_map_width = 0;
+	int m_importance_map_height = 0;
 };
 
 #endif
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiKernelGraph.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+extern ImGuiLogger g_imgui_logger;
+
+thread_local OrochiKernelGraph* OrochiKernelGraph::m_current = nullptr;
+
+OrochiKernelGraph::~OrochiKernelGraph()
+{
+	invalidate();
+}
+
+OrochiKernelGraph* OrochiKernelGraph::get_current()
+{
+	return m_current;
+}
+
+bool OrochiKernelGraph::is_building_or_replaying() const
+{
+	return m_mode == Mode::BUILD || m_mode == Mode::REPLAY;
+}
+
+bool OrochiKernelGraph::launches_directly() const
+{
+	return m_mode == Mode::NONE || m_mode == Mode::RECORD || m_replay_mismatch;
+}
+
+void OrochiKernelGraph::begin(bool first_of_batch)
+{
+	m_current = this;
+	m_next_operation = 0;
+	m_replay_mismatch = false;
+
+	if (first_of_batch)
+	{
+		m_mode = Mode::RECORD;
+		m_recorded_operations.clear();
+	}
+	else if (m_graph_exec != nullptr && m_graph_operations == m_recorded_operations)
+		m_mode = Mode::REPLAY;
+	else
+	{
+		invalidate();
+
+		m_mode = Mode::BUILD;
+		OROCHI_CHECK_ERROR(oroGraphCreate(&m_graph, 0));
+	}
+}
+
+void OrochiKernelGraph::end(oroStream_t stream)
+{
+	if (m_mode == Mode::BUILD)
+	{
+		OROCHI_CHECK_ERROR(oroGraphInstantiate(&m_graph_exec, m_graph, nullptr, nullptr, 0));
+
+		// The next repetitions of the batch replay what was just built
+		m_recorded_operations = m_graph_operations;
+	}
+	else if (m_mode == Mode::REPLAY && !m_replay_mismatch && m_next_operation != m_graph_nodes.size())
+		// Launches of the graph left out by this repetition, they would run with the arguments of the previous one
+		report_replay_mismatch();
+
+	if (m_mode == Mode::BUILD || (m_mode == Mode::REPLAY && !m_replay_mismatch))
+		OROCHI_CHECK_ERROR(oroGraphLaunch(m_graph_exec, stream));
+
+	if (m_replay_mismatch)
+		invalidate();
+
+	m_mode = Mode::NONE;
+	m_current = nullptr;
+}
+
+void OrochiKernelGraph::invalidate()
+{
+	if (m_graph_exec != nullptr)
+		OROCHI_CHECK_ERROR(oroGraphExecDestroy(m_graph_exec));
+	if (m_graph != nullptr)
+		OROCHI_CHECK_ERROR(oroGraphDestroy(m_graph));
+
+	m_graph_exec = nullptr;
+	m_graph = nullptr;
+	m_graph_nodes.clear();
+	m_graph_operations.clear();
+}
+
+void OrochiKernelGraph::launch_kernel(oroFunction function, int nb_groups_x, int nb_groups_y, int block_size_x, int block_size_y, void** launch_args, oroStream_t stream)
+{
+	GraphOperation operation;
+	operation.function = function;
+
+	check_replayed_operation(operation);
+	if (launches_directly())
+	{
+		if (m_mode == Mode::RECORD)
+			m_recorded_operations.push_back(operation);
+
+		OROCHI_CHECK_ERROR(oroModuleLaunchKernel(function, nb_groups_x, nb_groups_y, 1, block_size_x, block_size_y, 1, 0, stream, launch_args, 0));
+
+		return;
+	}
+
+	oroKernelNodeParams node_parameters = {};
+	node_parameters.func = reinterpret_cast<void*>(function);
+	node_parameters.gridDim.x = nb_groups_x;
+	node_parameters.gridDim.y = nb_groups_y;
+	node_parameters.gridDim.z = 1;
+	node_parameters.blockDim.x = block_size_x;
+	node_parameters.blockDim.y = block_size_y;
+	node_parameters.blockDim.z = 1;
+	node_parameters.sharedMemBytes = 0;
+	// The values of the arguments are copied by the graph
+	node_parameters.kernelParams = launch_args;
+	node_parameters.extra = nullptr;
+
+	if (m_mode == Mode::BUILD)
+	{
+		oroGraphNode_t node;
+		OROCHI_CHECK_ERROR(oroGraphAddKernelNode(&node, m_graph, m_graph_nodes.empty() ? nullptr : &m_graph_nodes.back(), m_graph_nodes.empty() ? 0 : 1, &node_parameters));
+
+		m_graph_nodes.push_back(node);
+		m_graph_operations.push_back(operation);
+	}
+	else
+		OROCHI_CHECK_ERROR(oroGraphExecKernelNodeSetParams(m_graph_exec, m_graph_nodes[m_next_operation], &node_parameters));
+
+	m_next_operation++;
+}
+
+void OrochiKernelGraph::memset_d32_async(oroDeviceptr destination, unsigned int value, size_t count, oroStream_t stream)
+{
+	GraphOperation operation;
+	operation.is_memset = true;
+	operation.memset_destination = destination;
+	operation.memset_value = value;
+	operation.memset_count = count;
+
+	check_replayed_operation(operation);
+	if (launches_directly())
+	{
+		if (m_mode == Mode::RECORD)
+			m_recorded_operations.push_back(operation);
+
+		OROCHI_CHECK_ERROR(oroMemsetD32Async(destination, value, count, stream));
+
+		return;
+	}
+
+	if (m_mode == Mode::BUILD)
+	{
+		oroMemsetParams memset_parameters = {};
+		memset_parameters.dst = reinterpret_cast<void*>(destination);
+		memset_parameters.elementSize = sizeof(unsigned int);
+		memset_parameters.value = value;
+		memset_parameters.width = count;
+		memset_parameters.height = 1;
+		memset_parameters.pitch = 0;
+
+		oroGraphNode_t node;
+		OROCHI_CHECK_ERROR(oroGraphAddMemsetNode(&node, m_graph, m_graph_nodes.empty() ? nullptr : &m_graph_nodes.back(), m_graph_nodes.empty() ? 0 : 1, &memset_parameters));
+
+		m_graph_nodes.push_back(node);
+		m_graph_operations.push_back(operation);
+	}
+	// Nothing to update when replaying, the memset is the same as the one of the graph
+
+	m_next_operation++;
+}
+
+void OrochiKernelGraph::memset_d32_async_current(oroDeviceptr destination, unsigned int value, size_t count, oroStream_t stream)
+{
+	if (m_current != nullptr)
+		m_current->memset_d32_async(destination, value, count, stream);
+	else
+		OROCHI_CHECK_ERROR(oroMemsetD32Async(destination, value, count, stream));
+}
+
+void OrochiKernelGraph::check_replayed_operation(const GraphOperation& operation)
+{
+	if (m_mode != Mode::REPLAY || m_replay_mismatch)
+		return;
+
+	if (m_next_operation >= m_graph_operations.size() || !(m_graph_operations[m_next_operation] == operation))
+		// The operations before this one have only been updated in the graph, they are lost
+		// for this repetition. This one and the next ones are launched directly
+		report_replay_mismatch();
+}
+
+void OrochiKernelGraph::report_replay_mismatch()
+{
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The launches of a kernel graph repetition didn't match the graph. The graph is going to be rebuilt.");
+
+	m_replay_mismatch = true;
+}
+
+bool OrochiKernelGraph::GraphOperation::operator==(const GraphOperation& other) const
+{
+	if (is_memset != other.is_memset)
+		return false;
+
+	if (is_memset)
+		return memset_destination == other.memset_destination && memset_value == other.memset_value && memset_count == other.memset_count;
+
+	return function == other.function;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef OROCHI_KERNEL_GRAPH_H
+#define OROCHI_KERNEL_GRAPH_H
+
+#include "Orochi/Orochi.h"
+
+#include <vector>
+
+/**
+ * Graph of a sequence of kernel launches and memsets that is repeated with the same kernels
+ * but different arguments: the samples of a frame of the GPURenderer for example.
+ *
+ * The sequence is submitted with a single graph launch instead of one launch per kernel.
+ * The arguments of the kernels are updated in the instantiated graph at each repetition
+ * (oroGraphExecKernelNodeSetParams) so the host code that launches the kernels runs as usual:
+ * GPUKernel::launch() and memset_d32_async() go through the graph current on the calling thread.
+ *
+ * Each repetition is between begin() and end():
+ *	- The first repetition of a batch ('first_of_batch') is launched directly and the sequence of its
+ *	  launches is recorded. The structure of the sequence can only change between batches
+ *	- If the recorded sequence differs from the one of the graph, the next repetition builds a new graph
+ *	- The following repetitions only update the arguments of the graph
+ *
+ * The GPU work recorded on the stream outside of GPUKernel::launch() and memset_d32_async()
+ * (events, host functions, ...) is not part of the graph. The timestamps of OrochiTimestampRing
+ * are not recorded while a graph is built or replayed
+ */
+class OrochiKernelGraph
+{
+public:
+	~OrochiKernelGraph();
+
+	/**
+	 * The graph between begin() and end() on the calling thread, nullptr if there is none
+	 */
+	static OrochiKernelGraph* get_current();
+
+	/**
+	 * Returns true if the current repetition builds or replays the graph. The GPU work
+	 * recorded on the stream at the same time would then run before the graph
+	 */
+	bool is_building_or_replaying() const;
+
+	void begin(bool first_of_batch);
+	/**
+	 * Launches the graph on 'stream' if this repetition built it or updated it
+	 */
+	void end(oroStream_t stream);
+
+	/**
+	 * Destroys the graph. It is built again by the next repetition that isn't the first of its batch
+	 */
+	void invalidate();
+
+	/**
+	 * Same as oroModuleLaunchKernel() with no shared memory but added to / updated in the graph
+	 */
+	void launch_kernel(oroFunction function, int nb_groups_x, int nb_groups_y, int block_size_x, int block_size_y, void** launch_args, oroStream_t stream);
+	/**
+	 * Same as oroMemsetD32Async() but added to the graph
+	 */
+	void memset_d32_async(oroDeviceptr destination, unsigned int value, size_t count, oroStream_t stream);
+
+	/**
+	 * Shorthand for the callers that don't know whether or not there is a current graph
+	 */
+	static void memset_d32_async_current(oroDeviceptr destination, unsigned int value, size_t count, oroStream_t stream);
+
+private:
+	enum class Mode
+	{
+		// No repetition in progress
+		NONE,
+		// Launching directly and recording the sequence
+		RECORD,
+		// Building the graph from the launches
+		BUILD,
+		// Updating the launches of the graph
+		REPLAY
+	};
+
+	/**
+	 * One launch or memset of the sequence
+	 */
+	struct GraphOperation
+	{
+		bool is_memset = false;
+
+		// Only the kernel function is compared when comparing the sequences,
+		// the launch dimensions are updated in the graph like the arguments
+		oroFunction function = nullptr;
+
+		oroDeviceptr memset_destination = 0;
+		unsigned int memset_value = 0;
+		size_t memset_count = 0;
+
+		bool operator==(const GraphOperation& other) const;
+	};
+
+	/**
+	 * Returns true if the launches done through this graph currently go directly to their stream
+	 */
+	bool launches_directly() const;
+	/**
+	 * Sets 'm_replay_mismatch' if 'operation' isn't the next operation of the replayed graph
+	 */
+	void check_replayed_operation(const GraphOperation& operation);
+	void report_replay_mismatch();
+
+	static thread_local OrochiKernelGraph* m_current;
+
+	Mode m_mode = Mode::NONE;
+
+	// Sequence of the last recorded repetition
+	std::vector<GraphOperation> m_recorded_operations;
+	// Sequence of the graph and its nodes, in launch order
+	std::vector<GraphOperation> m_graph_operations;
+	std::vector<oroGraphNode_t> m_graph_nodes;
+	// Index of the next operation of the repetition being built / replayed
+	size_t m_next_operation = 0;
+	// Set if a replayed repetition didn't launch the sequence of the graph,
+	// which shouldn't happen within a batch
+	bool m_replay_mismatch = false;
+
+	oroGraph_t m_graph = nullptr;
+	oroGraphExec_t m_graph_exec = nullptr;
+};
+
+#endif
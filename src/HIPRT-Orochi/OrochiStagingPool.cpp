@@ -0,0 +1,98 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiStagingPool.h"
+
+#include <algorithm>
+
+OrochiStagingBlock::OrochiStagingBlock(size_t byte_size) : byte_size(byte_size)
+{
+	OROCHI_CHECK_ERROR(oroHostMalloc(&host_pointer, byte_size, 0));
+	OROCHI_CHECK_ERROR(oroEventCreate(&copy_done_event));
+}
+
+OrochiStagingBlock::~OrochiStagingBlock()
+{
+	// The copy may still be reading from / writing to the pinned memory
+	OROCHI_CHECK_ERROR(oroEventSynchronize(copy_done_event));
+
+	OROCHI_CHECK_ERROR(oroHostFree(host_pointer));
+	OROCHI_CHECK_ERROR(oroEventDestroy(copy_done_event));
+}
+
+bool OrochiAsyncTransfer::is_done() const
+{
+	for (const std::shared_ptr<OrochiStagingBlock>& block : m_blocks)
+		if (oroEventQuery(block->copy_done_event) != oroSuccess)
+			return false;
+
+	return true;
+}
+
+void OrochiAsyncTransfer::wait() const
+{
+	for (const std::shared_ptr<OrochiStagingBlock>& block : m_blocks)
+		OROCHI_CHECK_ERROR(oroEventSynchronize(block->copy_done_event));
+}
+
+void OrochiAsyncTransfer::add_block(std::shared_ptr<OrochiStagingBlock> block)
+{
+	m_blocks.push_back(block);
+}
+
+std::shared_ptr<OrochiStagingBlock> OrochiStagingPool::acquire(size_t byte_size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::shared_ptr<OrochiStagingBlock> best_block = nullptr;
+	for (std::shared_ptr<OrochiStagingBlock>& block : m_blocks)
+	{
+		// use_count() == 1: only referenced by the pool
+		if (block.use_count() != 1 || block->byte_size < byte_size)
+			continue;
+
+		if (oroEventQuery(block->copy_done_event) != oroSuccess)
+			// Still being copied
+			continue;
+
+		// Smallest block that fits to keep the big blocks for the big copies
+		if (best_block == nullptr || block->byte_size < best_block->byte_size)
+			best_block = block;
+	}
+
+	if (best_block != nullptr)
+		return best_block;
+
+	// Rounding the allocations up to limit the number of different block sizes
+	size_t block_size = 4096;
+	while (block_size < byte_size)
+		block_size *= 2;
+
+	m_blocks.push_back(std::make_shared<OrochiStagingBlock>(block_size));
+
+	return m_blocks.back();
+}
+
+OrochiAsyncTransfer OrochiStagingPool::download_async(const void* device_pointer, size_t byte_size, oroStream_t stream)
+{
+	std::shared_ptr<OrochiStagingBlock> block = acquire(byte_size);
+	OROCHI_CHECK_ERROR(oroMemcpyAsync(block->host_pointer, const_cast<void*>(device_pointer), byte_size, oroMemcpyDeviceToHost, stream));
+	OROCHI_CHECK_ERROR(oroEventRecord(block->copy_done_event, stream));
+
+	OrochiAsyncTransfer transfer;
+	transfer.add_block(block);
+
+	return transfer;
+}
+
+void OrochiStagingPool::trim()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_blocks.erase(std::remove_if(m_blocks.begin(), m_blocks.end(), [](const std::shared_ptr<OrochiStagingBlock>& block) {
+		return block.use_count() == 1 && oroEventQuery(block->copy_done_event) == oroSuccess;
+	}), m_blocks.end());
+}
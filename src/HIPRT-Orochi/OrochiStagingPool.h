@@ -0,0 +1,114 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef OROCHI_STAGING_POOL_H
+#define OROCHI_STAGING_POOL_H
+
+#include "Orochi/Orochi.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Pinned host allocation of an OrochiStagingPool and the event
+ * that signals the end of the last copy that used it
+ */
+struct OrochiStagingBlock
+{
+	OrochiStagingBlock(size_t byte_size);
+	OrochiStagingBlock(const OrochiStagingBlock& other) = delete;
+	~OrochiStagingBlock();
+
+	void operator=(const OrochiStagingBlock& other) = delete;
+
+	void* host_pointer = nullptr;
+	size_t byte_size = 0;
+
+	oroEvent_t copy_done_event = nullptr;
+};
+
+/**
+ * Completion handle of an asynchronous copy queued by an OrochiBuffer (upload_data_async()
+ * or download_data_async()).
+ *
+ * The staging blocks used by the copy go back to their pool once the copy is done
+ * and all the OrochiAsyncTransfer that reference them are destroyed
+ */
+class OrochiAsyncTransfer
+{
+public:
+	/**
+	 * Returns true if the copy is done. Doesn't block.
+	 * A default constructed transfer is always done
+	 */
+	bool is_done() const;
+
+	/**
+	 * Blocks until the copy is done
+	 */
+	void wait() const;
+
+	/**
+	 * Returns the data downloaded by download_data_async().
+	 * Only valid once is_done() returns true or after a call to wait()
+	 */
+	template <typename T>
+	const T* get_downloaded_data() const
+	{
+		if (m_blocks.empty())
+			return nullptr;
+
+		return static_cast<const T*>(m_blocks.front()->host_pointer);
+	}
+
+	void add_block(std::shared_ptr<OrochiStagingBlock> block);
+
+private:
+	std::vector<std::shared_ptr<OrochiStagingBlock>> m_blocks;
+};
+
+/**
+ * Reusable pinned host memory used by the asynchronous copies of the OrochiBuffer.
+ *
+ * Copies from / to pinned memory can be truly asynchronous (the copies from pageable memory
+ * go through a driver staging buffer and block). The blocks of the pool are recycled once their
+ * copy is done so that pinned memory, which is slow to allocate, isn't allocated every copy.
+ *
+ * The events of the blocks are created in the Orochi context current when the block
+ * is allocated so a pool must only be used with one context
+ */
+class OrochiStagingPool
+{
+public:
+	// Maximum size in bytes of the staging copy of an upload. Bigger uploads
+	// are split in several copies of this size
+	static constexpr size_t MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+	/**
+	 * Returns a block of at least 'byte_size' bytes whose previous copy is done
+	 * and that isn't referenced by any OrochiAsyncTransfer anymore.
+	 * A new block is allocated if there is none
+	 */
+	std::shared_ptr<OrochiStagingBlock> acquire(size_t byte_size);
+
+	/**
+	 * Queues on 'stream' the copy of 'byte_size' bytes of device memory at 'device_pointer' into
+	 * a block of the pool. The data can be read with OrochiAsyncTransfer::get_downloaded_data()
+	 */
+	OrochiAsyncTransfer download_async(const void* device_pointer, size_t byte_size, oroStream_t stream);
+
+	/**
+	 * Frees all the blocks of the pool that aren't in use
+	 */
+	void trim();
+
+private:
+	std::mutex m_mutex;
+
+	std::vector<std::shared_ptr<OrochiStagingBlock>> m_blocks;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiStagingUploader.h"
+
+#include <algorithm>
+#include <cstring>
+
+OrochiStagingUploader::OrochiStagingUploader(size_t chunk_size) : m_chunk_size(chunk_size)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		OROCHI_CHECK_ERROR(oroHostMalloc(&m_chunks[i], m_chunk_size, 0));
+		OROCHI_CHECK_ERROR(oroEventCreate(&m_chunk_copied_events[i]));
+	}
+}
+
+OrochiStagingUploader::~OrochiStagingUploader()
+{
+	// The chunks cannot be freed while the device is still reading from them
+	synchronize();
+
+	for (int i = 0; i < 2; i++)
+	{
+		OROCHI_CHECK_ERROR(oroHostFree(m_chunks[i]));
+		OROCHI_CHECK_ERROR(oroEventDestroy(m_chunk_copied_events[i]));
+	}
+}
+
+bool OrochiStagingUploader::upload(void* device_pointer, size_t byte_count, oroStream_t stream, const ChunkFillFunction& fill_function)
+{
+	for (size_t byte_offset = 0; byte_offset < byte_count; byte_offset += m_chunk_size)
+	{
+		size_t chunk_byte_count = std::min(m_chunk_size, byte_count - byte_offset);
+
+		int chunk_index = m_next_chunk;
+		m_next_chunk = 1 - m_next_chunk;
+
+		// Waiting for the previous copy from that chunk before overwriting it.
+		// The copy from the other chunk keeps going meanwhile
+		if (m_chunk_in_flight[chunk_index])
+			OROCHI_CHECK_ERROR(oroEventSynchronize(m_chunk_copied_events[chunk_index]));
+		m_chunk_in_flight[chunk_index] = false;
+
+		if (!fill_function(m_chunks[chunk_index], byte_offset, chunk_byte_count))
+			return false;
+
+		OROCHI_CHECK_ERROR(oroMemcpyAsync(static_cast<unsigned char*>(device_pointer) + byte_offset, m_chunks[chunk_index], chunk_byte_count, oroMemcpyHostToDevice, stream));
+		OROCHI_CHECK_ERROR(oroEventRecord(m_chunk_copied_events[chunk_index], stream));
+		m_chunk_in_flight[chunk_index] = true;
+	}
+
+	return true;
+}
+
+bool OrochiStagingUploader::upload(void* device_pointer, const void* data, size_t byte_count, oroStream_t stream)
+{
+	return upload(device_pointer, byte_count, stream, [data](void* chunk, size_t byte_offset, size_t chunk_byte_count) {
+		std::memcpy(chunk, static_cast<const unsigned char*>(data) + byte_offset, chunk_byte_count);
+
+		return true;
+	});
+}
+
+bool OrochiStagingUploader::upload(void* device_pointer, std::ifstream& file, size_t byte_count, oroStream_t stream)
+{
+	return upload(device_pointer, byte_count, stream, [&file](void* chunk, size_t byte_offset, size_t chunk_byte_count) {
+		return static_cast<bool>(file.read(static_cast<char*>(chunk), chunk_byte_count));
+	});
+}
+
+void OrochiStagingUploader::synchronize()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		if (m_chunk_in_flight[i])
+			OROCHI_CHECK_ERROR(oroEventSynchronize(m_chunk_copied_events[i]));
+
+		m_chunk_in_flight[i] = false;
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef OROCHI_STAGING_UPLOADER_H
+#define OROCHI_STAGING_UPLOADER_H
+
+#include "Orochi/Orochi.h"
+
+#include <fstream>
+#include <functional>
+
+/**
+ * Uploads data to the device through two small pinned host buffers ("chunks")
+ * with asynchronous copies on a given stream.
+ *
+ * While one chunk is being copied to the device, the other one is being filled on the host
+ * so the reads (from a file for example) and the copies overlap. Because the data only ever
+ * goes through the chunks, it doesn't need to exist as a whole on the host: the uploaded data
+ * can be read from a file or computed on the fly, chunk by chunk
+ */
+class OrochiStagingUploader
+{
+public:
+	// Size in bytes of each of the two pinned chunks
+	static constexpr size_t DEFAULT_CHUNK_SIZE = 16 * 1024 * 1024;
+
+	/**
+	 * Function that writes 'byte_count' bytes to 'chunk'. These bytes are the bytes
+	 * [byte_offset, byte_offset + byte_count[ of the data being uploaded.
+	 *
+	 * Returns false if the data couldn't be produced, which aborts the upload
+	 */
+	using ChunkFillFunction = std::function<bool(void* chunk, size_t byte_offset, size_t byte_count)>;
+
+	OrochiStagingUploader(size_t chunk_size = DEFAULT_CHUNK_SIZE);
+	OrochiStagingUploader(const OrochiStagingUploader& other) = delete;
+	~OrochiStagingUploader();
+
+	void operator=(const OrochiStagingUploader& other) = delete;
+
+	/**
+	 * Uploads 'byte_count' bytes produced by 'fill_function' to 'device_pointer' on 'stream'.
+	 *
+	 * The function returns as soon as the last chunk is queued, synchronize() must be called before
+	 * using the uploaded data on another stream. Returns false if 'fill_function' failed
+	 */
+	bool upload(void* device_pointer, size_t byte_count, oroStream_t stream, const ChunkFillFunction& fill_function);
+	/**
+	 * Uploads 'byte_count' bytes of contiguous host data
+	 */
+	bool upload(void* device_pointer, const void* data, size_t byte_count, oroStream_t stream);
+	/**
+	 * Uploads the next 'byte_count' bytes read from 'file'
+	 */
+	bool upload(void* device_pointer, std::ifstream& file, size_t byte_count, oroStream_t stream);
+
+	/**
+	 * Blocks until all the copies queued by this uploader are done
+	 */
+	void synchronize();
+
+private:
+	size_t m_chunk_size;
+
+	void* m_chunks[2] = { nullptr, nullptr };
+	oroEvent_t m_chunk_copied_events[2];
+	// Whether or not a copy from the chunk to the device may still be running
+	bool m_chunk_in_flight[2] = { false, false };
+
+	// Chunk that is going to be filled next
+	int m_next_chunk = 0;
+};
+
+#endif
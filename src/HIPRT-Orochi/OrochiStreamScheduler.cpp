@@ -0,0 +1,65 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiStreamScheduler.h"
+
+OrochiStreamScheduler::~OrochiStreamScheduler()
+{
+	if (m_async_stream != nullptr)
+	{
+		oroStreamDestroy(m_async_stream);
+		oroEventDestroy(m_fork_event);
+		oroEventDestroy(m_join_event);
+	}
+}
+
+void OrochiStreamScheduler::begin_async(oroStream_t main_stream, bool enabled)
+{
+	if (!enabled)
+		return;
+
+	if (m_async_stream == nullptr)
+	{
+		OROCHI_CHECK_ERROR(oroStreamCreate(&m_async_stream));
+		OROCHI_CHECK_ERROR(oroEventCreate(&m_fork_event));
+		OROCHI_CHECK_ERROR(oroEventCreate(&m_join_event));
+	}
+
+	// The secondary stream may still be running the last section: the main stream
+	// waits for it first so that the work of the sections stays in order with the main stream
+	join(main_stream);
+
+	OROCHI_CHECK_ERROR(oroEventRecord(m_fork_event, main_stream));
+	OROCHI_CHECK_ERROR(oroStreamWaitEvent(m_async_stream, m_fork_event, 0));
+
+	m_in_async_section = true;
+}
+
+void OrochiStreamScheduler::end_async()
+{
+	if (!m_in_async_section)
+		return;
+
+	OROCHI_CHECK_ERROR(oroEventRecord(m_join_event, m_async_stream));
+
+	m_in_async_section = false;
+	m_join_pending = true;
+}
+
+void OrochiStreamScheduler::join(oroStream_t main_stream)
+{
+	if (!m_join_pending)
+		return;
+
+	OROCHI_CHECK_ERROR(oroStreamWaitEvent(main_stream, m_join_event, 0));
+
+	m_join_pending = false;
+}
+
+oroStream_t OrochiStreamScheduler::get_stream(oroStream_t main_stream) const
+{
+	return m_in_async_section ? m_async_stream : main_stream;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef OROCHI_STREAM_SCHEDULER_H
+#define OROCHI_STREAM_SCHEDULER_H
+
+#include "Orochi/Orochi.h"
+
+/**
+ * Runs GPU work that doesn't depend on the work queued just before it on a secondary
+ * stream so that independent kernels overlap instead of running one after the other on the main stream.
+ *
+ * The work launched on get_stream() between begin_async() and end_async() (an "async section")
+ * runs on the secondary stream, after all the work queued on the main stream before begin_async().
+ * The main stream keeps going with the work launched after begin_async() and only waits for the
+ * async section when join() is called, at the first point where its results are needed.
+ *
+ * The dependencies are expressed with events, nothing ever waits on the CPU.
+ * If the async section isn't enabled in begin_async(), everything stays on the main stream
+ * and join() does nothing
+ */
+class OrochiStreamScheduler
+{
+public:
+	~OrochiStreamScheduler();
+
+	/**
+	 * Starts an async section after the work queued so far on 'main_stream'.
+	 * The work of the section is launched on the main stream if 'enabled' is false
+	 */
+	void begin_async(oroStream_t main_stream, bool enabled);
+	void end_async();
+	/**
+	 * Makes 'main_stream' wait for the work of the last async section if it hasn't already
+	 */
+	void join(oroStream_t main_stream);
+
+	/**
+	 * Stream to launch the work on: the secondary stream inside an enabled async section, 'main_stream' otherwise
+	 */
+	oroStream_t get_stream(oroStream_t main_stream) const;
+
+private:
+	// Created by the first enabled async section, on the thread that renders
+	oroStream_t m_async_stream = nullptr;
+	oroEvent_t m_fork_event = nullptr;
+	oroEvent_t m_join_event = nullptr;
+
+	bool m_in_async_section = false;
+	// Whether the main stream still has to wait for the last async section
+	bool m_join_pending = false;
+};
+
+#endif
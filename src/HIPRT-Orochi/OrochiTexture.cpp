@@ -4,9 +4,12 @@
  */
 
 #include "HIPRT-Orochi/OrochiTexture.h"
+#include "HostDeviceCommon/PackedMaterial.h"
 
 #include <Orochi/Orochi.h>
 
+#include <vector>
+
 OrochiTexture::OrochiTexture(const Image8Bit& image)
 {
 	init_from_image(image);
@@ -21,64 +24,135 @@ OrochiTexture::OrochiTexture(OrochiTexture&& other) noexcept
 {
 	m_texture_array = std::move(other.m_texture_array);
 	m_texture = std::move(other.m_texture);
+	width = other.width;
+	height = other.height;
+	m_usage_category = other.m_usage_category;
+	m_texel_byte_size = other.m_texel_byte_size;
 
 	other.m_texture = nullptr;
 	other.m_texture_array = nullptr;
+
+	// The memory is now owned by this texture
+	OrochiDeviceMemoryPool::remove_external_usage(&other);
+	if (m_texture_array != nullptr)
+		OrochiDeviceMemoryPool::set_external_usage(this, m_usage_category, get_byte_size());
 }
 
 OrochiTexture::~OrochiTexture()
 {
-	if (m_texture)
-		oroDestroyTextureObject(m_texture);
-
-	if (m_texture_array)
-		oroFree(m_texture_array);
+	free();
 }
 
 void OrochiTexture::operator=(OrochiTexture&& other)
 {
+	free();
+
 	m_texture_array = std::move(other.m_texture_array);
 	m_texture = std::move(other.m_texture);
+	width = other.width;
+	height = other.height;
+	m_usage_category = other.m_usage_category;
+	m_texel_byte_size = other.m_texel_byte_size;
 
 	other.m_texture = nullptr;
 	other.m_texture_array = nullptr;
+
+	OrochiDeviceMemoryPool::remove_external_usage(&other);
+	if (m_texture_array != nullptr)
+		OrochiDeviceMemoryPool::set_external_usage(this, m_usage_category, get_byte_size());
 }
 
-void OrochiTexture::init_from_image(const Image8Bit& image)
+/**
+ * Channel descriptor of a texture with 'channel_count' channels of 'channel_bits' bits each.
+ * 3 channels textures aren't supported by HIP/CUDA, they are stored with 4 channels (see pad_to_4_channels())
+ */
+static oroChannelFormatDesc create_channel_descriptor(int channel_count, int channel_bits, oroChannelFormatKind format_kind)
 {
-	width = image.width;
-	height = image.height;
+	if (channel_count == 3)
+		channel_count = 4;
 
 	// X, Y, Z and W in oroCreateChannelDesc are the number of *bits* of each component
-	oroChannelFormatDesc channel_descriptor = oroCreateChannelDesc(sizeof(unsigned char) * 8, sizeof(unsigned char) * 8, sizeof(unsigned char) * 8, sizeof(unsigned char) * 8, oroChannelFormatKindUnsigned);
-	OROCHI_CHECK_ERROR(oroMallocArray(&m_texture_array, &channel_descriptor, image.width, image.height, oroArrayDefault));
-	OROCHI_CHECK_ERROR(oroMemcpy2DToArray(m_texture_array, 0, 0, image.data().data(), image.width * image.channels * sizeof(unsigned char), image.width * sizeof(unsigned char) * image.channels, image.height, oroMemcpyHostToDevice));
-
-	// Resource descriptor
-	ORO_RESOURCE_DESC resource_descriptor;
-	std::memset(&resource_descriptor, 0, sizeof(resource_descriptor));
-	resource_descriptor.resType = ORO_RESOURCE_TYPE_ARRAY;
-	resource_descriptor.res.array.hArray = m_texture_array;
+	return oroCreateChannelDesc(channel_bits, channel_count > 1 ? channel_bits : 0, channel_count > 2 ? channel_bits : 0, channel_count > 3 ? channel_bits : 0, format_kind);
+}
 
-	ORO_TEXTURE_DESC texture_descriptor;
-	std::memset(&texture_descriptor, 0, sizeof(texture_descriptor));
-	texture_descriptor.addressMode[0] = ORO_TR_ADDRESS_MODE_WRAP;
-	texture_descriptor.addressMode[1] = ORO_TR_ADDRESS_MODE_WRAP;
-	texture_descriptor.addressMode[2] = ORO_TR_ADDRESS_MODE_WRAP;
-	texture_descriptor.filterMode = ORO_TR_FILTER_MODE_LINEAR;
+/**
+ * Returns the texels of a 3 channels image with an additional alpha channel set to 'alpha'
+ */
+template <typename T>
+static std::vector<T> pad_to_4_channels(const std::vector<T>& texels, int texel_count, T alpha)
+{
+	std::vector<T> padded_texels(static_cast<size_t>(texel_count) * 4);
+
+#pragma omp parallel for
+	for (int i = 0; i < texel_count; i++)
+	{
+		padded_texels[i * 4 + 0] = texels[i * 3 + 0];
+		padded_texels[i * 4 + 1] = texels[i * 3 + 1];
+		padded_texels[i * 4 + 2] = texels[i * 3 + 2];
+		padded_texels[i * 4 + 3] = alpha;
+	}
+
+	return padded_texels;
+}
 
-	OROCHI_CHECK_ERROR(oroTexObjectCreate(&m_texture, &resource_descriptor, &texture_descriptor, nullptr));
+void OrochiTexture::init_from_image(const Image8Bit& image)
+{
+	// Single channel (scalar material properties), two channels (packed roughness/metallic)
+	// and four channels textures are stored with as many channels on the GPU
+	oroChannelFormatDesc channel_descriptor = create_channel_descriptor(image.channels, sizeof(unsigned char) * 8, oroChannelFormatKindUnsigned);
+
+	if (image.channels == 3)
+		init_from_data(pad_to_4_channels<unsigned char>(image.data(), image.width * image.height, 255).data(), image.width, image.height, image.width * sizeof(unsigned char) * 4, channel_descriptor);
+	else
+		init_from_data(image.data().data(), image.width, image.height, image.width * sizeof(unsigned char) * image.channels, channel_descriptor);
 }
 
 void OrochiTexture::init_from_image(const Image32Bit& image)
 {
-	width = image.width;
-	height = image.height;
+	oroChannelFormatDesc channel_descriptor = create_channel_descriptor(image.channels, sizeof(float) * 8, oroChannelFormatKindFloat);
 
-	// X, Y, Z and W in oroCreateChannelDesc are the number of *bits* of each component
-	oroChannelFormatDesc channel_descriptor = oroCreateChannelDesc(sizeof(float) * 8, sizeof(float) * 8, sizeof(float) * 8, sizeof(float) * 8, oroChannelFormatKindFloat);
-	OROCHI_CHECK_ERROR(oroMallocArray(&m_texture_array, &channel_descriptor, image.width, image.height, oroArrayDefault));
-	OROCHI_CHECK_ERROR(oroMemcpy2DToArray(m_texture_array, 0, 0, image.data().data(), image.width * image.channels * sizeof(float), image.width * sizeof(float) * image.channels, image.height, oroMemcpyHostToDevice));
+	if (image.channels == 3)
+		init_from_data(pad_to_4_channels<float>(image.data(), image.width * image.height, 1.0f).data(), image.width, image.height, image.width * sizeof(float) * 4, channel_descriptor);
+	else
+		init_from_data(image.data().data(), image.width, image.height, image.width * sizeof(float) * image.channels, channel_descriptor);
+}
+
+void OrochiTexture::init_from_srgb_image(const Image8Bit& image)
+{
+	// sRGB to linear conversion of the 256 values of a channel
+	unsigned short linear_values[256];
+	for (int i = 0; i < 256; i++)
+		linear_values[i] = half_encode(powf(i / 255.0f, 2.2f));
+
+	// The 3 channels images are padded to 4 channels, there's no 3 channels texture format
+	int channel_count = image.channels == 3 ? 4 : image.channels;
+	int texel_count = image.width * image.height;
+	std::vector<unsigned short> texels(static_cast<size_t>(texel_count) * channel_count);
+
+#pragma omp parallel for
+	for (int i = 0; i < texel_count; i++)
+	{
+		for (int channel = 0; channel < channel_count; channel++)
+			// The padded alpha is opaque
+			texels[i * channel_count + channel] = linear_values[channel < image.channels ? image[i * image.channels + channel] : 255];
+	}
+
+	oroChannelFormatDesc channel_descriptor = create_channel_descriptor(image.channels, sizeof(unsigned short) * 8, oroChannelFormatKindFloat);
+	init_from_data(texels.data(), image.width, image.height, image.width * sizeof(unsigned short) * channel_count, channel_descriptor);
+}
+
+void OrochiTexture::init_from_data(const void* data, int data_width, int data_height, size_t row_byte_size, const oroChannelFormatDesc& channel_descriptor)
+{
+	// Releasing the previous texture if this texture was already initialized
+	free();
+
+	width = data_width;
+	height = data_height;
+
+	OROCHI_CHECK_ERROR(oroMallocArray(&m_texture_array, &channel_descriptor, width, height, oroArrayDefault));
+	m_texel_byte_size = (channel_descriptor.x + channel_descriptor.y + channel_descriptor.z + channel_descriptor.w) / 8;
+	OrochiDeviceMemoryPool::set_external_usage(this, m_usage_category, get_byte_size());
+	OROCHI_CHECK_ERROR(oroMemcpy2DToArray(m_texture_array, 0, 0, data, row_byte_size, row_byte_size, height, oroMemcpyHostToDevice));
 
 	// Resource descriptor
 	ORO_RESOURCE_DESC resource_descriptor;
@@ -96,6 +170,30 @@ void OrochiTexture::init_from_image(const Image32Bit& image)
 	OROCHI_CHECK_ERROR(oroTexObjectCreate(&m_texture, &resource_descriptor, &texture_descriptor, nullptr));
 }
 
+void OrochiTexture::free()
+{
+	if (m_texture)
+		oroDestroyTextureObject(m_texture);
+
+	if (m_texture_array)
+	{
+		oroFree(m_texture_array);
+
+		OrochiDeviceMemoryPool::remove_external_usage(this);
+	}
+
+	m_texture = nullptr;
+	m_texture_array = nullptr;
+}
+
+size_t OrochiTexture::get_byte_size() const
+{
+	if (m_texture_array == nullptr)
+		return 0;
+
+	return static_cast<size_t>(width) * height * m_texel_byte_size;
+}
+
 oroTextureObject_t OrochiTexture::get_device_texture()
 {
 	return m_texture;
@@ -7,8 +7,11 @@
 #define OROCHI_TEXTURE_H
 
 #include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HIPRT-Orochi/OrochiDeviceMemoryPool.h"
 #include "Image/Image.h"
 
+#include <string>
+
 class OrochiTexture
 {
 public:
@@ -24,14 +27,44 @@ public:
 
 	void init_from_image(const Image8Bit& image);
 	void init_from_image(const Image32Bit& image);
+	/**
+	 * Creates a half float texture with the texels of the sRGB 'image' converted to linear
+	 * the same way as the shaders convert the sRGB textures (see sample_texture_rgba()),
+	 * for the shaders to sample it without any conversion.
+	 *
+	 * Twice the VRAM of init_from_image() but the 8 bits sRGB texels converted to
+	 * linear need more precision than 8 bits in the dark values
+	 */
+	void init_from_srgb_image(const Image8Bit& image);
+	/**
+	 * Creates a 2D texture of 'data_width' * 'data_height' texels from the given host data.
+	 * 'row_byte_size' is the size in bytes of one row of texels in 'data' and
+	 * 'channel_descriptor' the format of the texels
+	 */
+	void init_from_data(const void* data, int data_width, int data_height, size_t row_byte_size, const oroChannelFormatDesc& channel_descriptor);
+
+	/**
+	 * Destroys the texture. Does nothing if the texture wasn't initialized
+	 */
+	void free();
+
+	/**
+	 * Size in bytes of the texels of the texture. 0 if the texture isn't initialized
+	 */
+	size_t get_byte_size() const;
 
 	oroTextureObject_t get_device_texture();
 	oroTextureObject_t* get_device_texture_pointer();
 
 	unsigned int width = 0, height = 0;
 
+protected:
+	// Category the VRAM of the texture is reported in, see OrochiDeviceMemoryPool::set_external_usage()
+	std::string m_usage_category = "Textures";
+
 private:
 	oroArray_t m_texture_array = nullptr;
+	size_t m_texel_byte_size = 0;
 
 	oroTextureObject_t m_texture = nullptr;
 };
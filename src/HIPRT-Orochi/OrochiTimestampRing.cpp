@@ -0,0 +1,194 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiKernelGraph.h"
+#include "HIPRT-Orochi/OrochiTimestampRing.h"
+#include "Utils/TraceRecorder.h"
+
+#include <cstdint>
+
+OrochiTimestampRing::~OrochiTimestampRing()
+{
+	for (FrameSlot& slot : m_slots)
+	{
+		for (auto& key_to_events : slot.events)
+		{
+			for (std::pair<oroEvent_t, oroEvent_t>& events : key_to_events.second)
+			{
+				oroEventDestroy(events.first);
+				oroEventDestroy(events.second);
+			}
+		}
+	}
+
+	if (m_trace_calibration_event != nullptr)
+		oroEventDestroy(m_trace_calibration_event);
+}
+
+void OrochiTimestampRing::begin_frame()
+{
+	if (OrochiTimestampRing::is_paused())
+		return;
+
+	m_current_slot = (m_current_slot + 1) % OrochiTimestampRing::FRAMES_IN_FLIGHT;
+
+	// If that slot wasn't resolved yet, its frame is lost. Re-recording its events is
+	// fine even if the GPU hasn't reached them yet, the events then track the new records
+	FrameSlot& slot = m_slots[m_current_slot];
+	for (auto& key_to_count : slot.interval_counts)
+		key_to_count.second = 0;
+
+	slot.pending = true;
+	slot.frame_index = m_frame_index++;
+	slot.trace_recording_index = 0;
+}
+
+void OrochiTimestampRing::record_start(const std::string& key, oroStream_t stream)
+{
+	if (OrochiTimestampRing::is_paused())
+		return;
+
+	FrameSlot& slot = m_slots[m_current_slot];
+
+	int interval_index = slot.interval_counts[key];
+	std::vector<std::pair<oroEvent_t, oroEvent_t>>& key_events = slot.events[key];
+	if (key_events.size() <= static_cast<size_t>(interval_index))
+	{
+		// First time that frame records that many intervals for that key
+		std::pair<oroEvent_t, oroEvent_t> events;
+		OROCHI_CHECK_ERROR(oroEventCreate(&events.first));
+		OROCHI_CHECK_ERROR(oroEventCreate(&events.second));
+
+		key_events.push_back(events);
+		slot.streams[key].push_back(stream);
+	}
+	slot.streams[key][interval_index] = stream;
+
+	if (g_trace_recorder.is_recording())
+	{
+		if (m_trace_calibration_index != g_trace_recorder.get_recording_index())
+			calibrate_trace_clock(stream);
+
+		slot.trace_recording_index = m_trace_calibration_index;
+	}
+
+	OROCHI_CHECK_ERROR(oroEventRecord(key_events[interval_index].first, stream));
+}
+
+void OrochiTimestampRing::record_stop(const std::string& key, oroStream_t stream)
+{
+	if (OrochiTimestampRing::is_paused())
+		return;
+
+	FrameSlot& slot = m_slots[m_current_slot];
+
+	int& interval_index = slot.interval_counts[key];
+	OROCHI_CHECK_ERROR(oroEventRecord(slot.events[key][interval_index].second, stream));
+
+	// Same workaround as in GPUKernel::launch_timed_asynchronous() for HIP 5.7 + Windows
+	oroLaunchHostFunc(stream, [](void*) {}, nullptr);
+
+	interval_index++;
+}
+
+bool OrochiTimestampRing::resolve(std::unordered_map<std::string, float>& times)
+{
+	// Most recent pending frame that is done
+	FrameSlot* resolved_slot = nullptr;
+	for (FrameSlot& slot : m_slots)
+	{
+		if (!slot.pending || (resolved_slot != nullptr && slot.frame_index < resolved_slot->frame_index))
+			continue;
+
+		if (is_slot_done(slot))
+			resolved_slot = &slot;
+	}
+
+	if (resolved_slot == nullptr)
+		return false;
+
+	if (resolved_slot->trace_recording_index != 0 && resolved_slot->trace_recording_index == g_trace_recorder.get_recording_index())
+		add_trace_zones(*resolved_slot);
+
+	for (auto& key_to_count : resolved_slot->interval_counts)
+	{
+		if (key_to_count.second == 0)
+			// Not recorded during that frame
+			continue;
+
+		std::vector<std::pair<oroEvent_t, oroEvent_t>>& key_events = resolved_slot->events[key_to_count.first];
+
+		float sum = 0.0f;
+		for (int i = 0; i < key_to_count.second; i++)
+		{
+			float interval_time = 0.0f;
+			oroEventElapsedTime(&interval_time, key_events[i].first, key_events[i].second);
+
+			sum += interval_time;
+		}
+
+		times[key_to_count.first] = sum;
+	}
+
+	// The frames older than the resolved one are not interesting anymore
+	unsigned long long resolved_frame_index = resolved_slot->frame_index;
+	for (FrameSlot& slot : m_slots)
+		if (slot.frame_index <= resolved_frame_index)
+			slot.pending = false;
+
+	return true;
+}
+
+bool OrochiTimestampRing::is_paused()
+{
+	OrochiKernelGraph* kernel_graph = OrochiKernelGraph::get_current();
+
+	return kernel_graph != nullptr && kernel_graph->is_building_or_replaying();
+}
+
+bool OrochiTimestampRing::is_slot_done(FrameSlot& slot)
+{
+	// The events of a slot are all recorded on the same stream so checking the last
+	// stop event would be enough but the stream isn't known here, the query is cheap anyways
+	for (auto& key_to_count : slot.interval_counts)
+		for (int i = 0; i < key_to_count.second; i++)
+			if (oroEventQuery(slot.events[key_to_count.first][i].second) != oroSuccess)
+				return false;
+
+	return true;
+}
+
+void OrochiTimestampRing::calibrate_trace_clock(oroStream_t stream)
+{
+	if (m_trace_calibration_event == nullptr)
+		OROCHI_CHECK_ERROR(oroEventCreate(&m_trace_calibration_event));
+
+	OROCHI_CHECK_ERROR(oroEventRecord(m_trace_calibration_event, stream));
+	OROCHI_CHECK_ERROR(oroEventSynchronize(m_trace_calibration_event));
+
+	m_trace_calibration_us = g_trace_recorder.now();
+	m_trace_calibration_index = g_trace_recorder.get_recording_index();
+}
+
+void OrochiTimestampRing::add_trace_zones(FrameSlot& slot)
+{
+	for (auto& key_to_count : slot.interval_counts)
+	{
+		std::vector<std::pair<oroEvent_t, oroEvent_t>>& key_events = slot.events[key_to_count.first];
+		std::vector<oroStream_t>& key_streams = slot.streams[key_to_count.first];
+
+		for (int i = 0; i < key_to_count.second; i++)
+		{
+			float start_ms = 0.0f;
+			float stop_ms = 0.0f;
+			oroEventElapsedTime(&start_ms, m_trace_calibration_event, key_events[i].first);
+			oroEventElapsedTime(&stop_ms, m_trace_calibration_event, key_events[i].second);
+
+			std::string track_name = "Stream " + std::to_string(reinterpret_cast<std::uintptr_t>(key_streams[i]));
+			g_trace_recorder.add_gpu_zone(key_to_count.first, track_name, m_trace_calibration_us + start_ms * 1000.0, m_trace_calibration_us + stop_ms * 1000.0);
+		}
+	}
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef OROCHI_TIMESTAMP_RING_H
+#define OROCHI_TIMESTAMP_RING_H
+
+#include "Orochi/Orochi.h"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Ring of start / stop events for timing GPU work without ever waiting for the GPU.
+ *
+ * Each frame records its events in its own slot of the ring. The timings of a frame are
+ * resolved by resolve() only once all of its events have completed (queried with oroEventQuery(),
+ * which doesn't block) so the timings are a few frames late but recording them doesn't
+ * stall the CPU or the stream.
+ *
+ * Several intervals can be recorded under the same key during a frame (one per bounce,
+ * one per spatial reuse pass, ...), their times are summed.
+ *
+ * Nothing is recorded while an OrochiKernelGraph is built or replayed on the calling thread:
+ * the kernels of the graph don't run between the events recorded on the stream
+ *
+ * While the TraceRecorder is recording, the intervals of the resolved frames are also added to the trace
+ * as GPU zones. The GPU clock is calibrated against the clock of the trace at the first interval recorded by
+ * each recording: that waits for the stream once
+ */
+class OrochiTimestampRing
+{
+public:
+	// How many frames can be recorded before the oldest unresolved one is overwritten
+	static constexpr int FRAMES_IN_FLIGHT = 4;
+
+	~OrochiTimestampRing();
+
+	/**
+	 * Moves to the next slot of the ring. The intervals recorded until the next
+	 * call to begin_frame() belong to that frame
+	 */
+	void begin_frame();
+
+	/**
+	 * Records the start / stop of an interval of 'key' on 'stream'
+	 */
+	void record_start(const std::string& key, oroStream_t stream);
+	void record_stop(const std::string& key, oroStream_t stream);
+
+	/**
+	 * Fills 'times' (in milliseconds) with the times of the most recent frame whose events
+	 * have all completed, if that frame hasn't already been resolved. The keys that
+	 * weren't recorded during that frame are not touched.
+	 *
+	 * Doesn't block. Returns false if no new frame could be resolved
+	 */
+	bool resolve(std::unordered_map<std::string, float>& times);
+
+private:
+	struct FrameSlot
+	{
+		// Start / stop events of the intervals of each key. The events are created on
+		// the first frame that records that many intervals and reused afterwards
+		std::unordered_map<std::string, std::vector<std::pair<oroEvent_t, oroEvent_t>>> events;
+		// How many intervals were recorded per key during that frame
+		std::unordered_map<std::string, int> interval_counts;
+		// Stream of each interval of 'events', for the tracks of the trace
+		std::unordered_map<std::string, std::vector<oroStream_t>> streams;
+		// Recording of the TraceRecorder during which that frame was recorded, 0 if none
+		unsigned int trace_recording_index = 0;
+
+		// Whether or not this slot holds a frame that hasn't been resolved yet
+		bool pending = false;
+		unsigned long long frame_index = 0;
+	};
+
+	/**
+	 * True if the calls to begin_frame() and record_start/stop() are ignored, see OrochiKernelGraph
+	 */
+	static bool is_paused();
+	bool is_slot_done(FrameSlot& slot);
+
+	/**
+	 * Records an event on 'stream', waits for it and takes the time of the trace at which it completed
+	 * as the GPU time origin of the current recording of the TraceRecorder
+	 */
+	void calibrate_trace_clock(oroStream_t stream);
+	/**
+	 * Adds the intervals of 'slot' to the trace
+	 */
+	void add_trace_zones(FrameSlot& slot);
+
+	FrameSlot m_slots[FRAMES_IN_FLIGHT];
+	int m_current_slot = 0;
+	unsigned long long m_frame_index = 0;
+
+	// Event whose completion is at 'm_trace_calibration_us' in the trace, for the
+	// recording 'm_trace_calibration_index'. See calibrate_trace_clock()
+	oroEvent_t m_trace_calibration_event = nullptr;
+	double m_trace_calibration_us = 0.0;
+	unsigned int m_trace_calibration_index = 0;
+};
+
+#endif
@@ -76,6 +76,8 @@ struct ColorRGBA32F
 
     HIPRT_HOST_DEVICE static ColorRGBA32F max(const ColorRGBA32F& a, const ColorRGBA32F& b) { return ColorRGBA32F(hippt::max(a.r, b.r), hippt::max(a.g, b.g), hippt::max(a.b, b.b), hippt::max(a.a, b.a)); }
     HIPRT_HOST_DEVICE static ColorRGBA32F min(const ColorRGBA32F& a, const ColorRGBA32F& b) { return ColorRGBA32F(hippt::min(a.r, b.r), hippt::min(a.g, b.g), hippt::min(a.b, b.b), hippt::min(a.a, b.a)); }
+    // Unpacks 4 bytes RGBA (R in the lowest byte) to [0, 1]
+    HIPRT_HOST_DEVICE static ColorRGBA32F from_rgba8(unsigned int packed) { return ColorRGBA32F((packed & 0xFF) / 255.0f, ((packed >> 8) & 0xFF) / 255.0f, ((packed >> 16) & 0xFF) / 255.0f, (packed >> 24) / 255.0f); }
 
     HIPRT_HOST_DEVICE float& operator[](int index) { return *(&r + index); }
 
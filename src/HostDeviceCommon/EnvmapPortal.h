@@ -0,0 +1,29 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_ENVMAP_PORTAL_H
+#define HOST_DEVICE_COMMON_ENVMAP_PORTAL_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * World space rectangle (a window, a door, ...) that the envmap
+ * lighting of an interior comes through.
+ *
+ * The points of the portal are 'corner' + a * 'edge_u' + b * 'edge_v'
+ * with a and b in [0, 1]. 'edge_u' and 'edge_v' are orthogonal
+ */
+struct EnvmapPortal
+{
+	float3 corner = make_float3(0.0f, 0.0f, 0.0f);
+	float3 edge_u = make_float3(0.0f, 0.0f, 0.0f);
+	float3 edge_v = make_float3(0.0f, 0.0f, 0.0f);
+
+	// Normalized cross(edge_u, edge_v)
+	float3 normal = make_float3(0.0f, 0.0f, 0.0f);
+	float area = 0.0f;
+};
+
+#endif
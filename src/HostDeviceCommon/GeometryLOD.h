@@ -0,0 +1,23 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_GEOMETRY_LOD_H
+#define HOST_DEVICE_COMMON_GEOMETRY_LOD_H
+
+/**
+ * Masks of the instances of the BVH of the scene for the geometry levels of detail of the meshes (see
+ * Scene::mesh_lods and GPURenderer::set_geometry_lod()).
+ *
+ * An instance of a mesh that has LODs is in the BVH once per level of detail of the mesh, all at the same place.
+ * The level that the primary rays see (selected by distance to the camera) has the primary mask and the level that
+ * the secondary rays see (coarser) has the secondary mask, the other levels have no mask and aren't hit by any ray.
+ * The rays are traced with the primary mask before HIPRTRenderSettings::geometry_lod_secondary_bounce and with the
+ * secondary mask after, see get_geometry_lod_ray_mask(). The instances without LODs are hit by all the rays
+ */
+#define GEOMETRY_LOD_PRIMARY_RAY_MASK 0x1u
+#define GEOMETRY_LOD_SECONDARY_RAY_MASK 0x2u
+#define GEOMETRY_LOD_ALL_RAYS_MASK 0xFFFFFFFFu
+
+#endif
@@ -21,6 +21,24 @@ struct HIPRTCamera
 
     bool do_jittering = true;
 
+    // tan(vertical_fov / 2) scaled to the band of the image rendered by the camera
+    // (see Camera::set_vertical_crop()). Used for the ray cones of the camera rays
+    float tan_half_vertical_fov = 1.0f;
+
+    HIPRT_HOST_DEVICE float3 get_position() const
+    {
+        return matrix_X_point(inverse_view, make_float3(0.0f, 0.0f, 0.0f));
+    }
+
+    /**
+     * Returns the angle in radians between the camera rays of two vertically
+     * adjacent pixels at the given render resolution
+     */
+    HIPRT_HOST_DEVICE float get_pixel_spread_angle(int2 res) const
+    {
+        return atanf(2.0f * tan_half_vertical_fov / res.y);
+    }
+
     HIPRT_HOST_DEVICE hiprtRay get_camera_ray(float x, float y, int2 res)
     {
         float x_ndc_space = x / res.x * 2 - 1;
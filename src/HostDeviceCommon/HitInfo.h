@@ -28,7 +28,13 @@ struct HitInfo
     // Distance along ray
     float t = -1.0f;
 
+    // Size of the footprint of the ray cone on the surface in texture coordinates space
+    // (see get_texture_footprint()). 0.0f samples the full resolution of the textures
+    float texture_footprint = 0.0f;
+
     int primitive_index = -1;
+    // Index of the instance hit in the instances of the scene, see get_scene_primitive_index()
+    int instance_index = -1;
 };
 
 /**
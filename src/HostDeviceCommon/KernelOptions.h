@@ -51,10 +51,30 @@
 #define LSS_MIS_LIGHT_BSDF 3
 #define LSS_RIS_BSDF_AND_LIGHT 4
 #define LSS_RESTIR_DI 5
+#define LSS_LIGHT_BVH 6
+
+#define ILS_PATH_TRACING 0
+#define ILS_RESTIR_GI 1
+#define ILS_PATH_GUIDING 2
 
 #define ESS_NO_SAMPLING 0
 #define ESS_BINARY_SEARCH 1
 #define ESS_ALIAS_TABLE 2
+#define ESS_MARGINAL_CONDITIONAL 3
+#define ESS_PRODUCT_SAMPLING 4
+
+#define ESF_RGBA32F 0
+#define ESF_RGBA16F 1
+#define ESF_RGB9E5 2
+#define ESF_RGB32F 3
+
+#define ETSS_UNIFORM 0
+#define ETSS_POWER_ALIAS_TABLE 1
+#define ETSS_LIGHT_CLUSTERS 2
+
+#define MIS_BSDF_RAY_SCENE 0
+#define MIS_BSDF_RAY_CHOSEN_LIGHT 1
+#define MIS_BSDF_RAY_LIGHT_BVH 2
 
 #define RESTIR_DI_BIAS_CORRECTION_1_OVER_M 0
 #define RESTIR_DI_BIAS_CORRECTION_1_OVER_Z 1
@@ -68,11 +88,51 @@
 #define RESTIR_DI_LATER_BOUNCES_MIS_LIGHT_BSDF 2
 #define RESTIR_DI_LATER_BOUNCES_RIS_BSDF_AND_LIGHT 3
 
+// Width and height of the thread blocks of the ReSTIR DI spatial reuse kernel and number of pixels
+// loaded around them in shared memory with ReSTIR_DI_SpatialReuseSharedMemoryTile
+#define RESTIR_DI_SPATIAL_TILE_SIZE 8
+#define RESTIR_DI_SPATIAL_TILE_APRON 8
+
+// Width and height of the thread blocks of the ReSTIR DI initial candidates kernel and maximum number of presampled
+// lights of the subset of a block loaded in shared memory with ReSTIR_DI_InitialCandidatesSharedMemoryLights
+#define RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE 8
+#define RESTIR_DI_SHARED_PRESAMPLED_LIGHT_COUNT 256
+
+// Size in pixels of the tiles of the tile based adaptive sampling, see AdaptiveSamplingTileError
+#define ADAPTIVE_SAMPLING_TILE_SIZE 16
+
+// Number of bins along each axis of the directional histograms of the cells of the path guiding grid
+// and maximum number of vertices of a path that record their contribution for the training of the grid
+#define PATH_GUIDING_DIRECTIONAL_RESOLUTION 8
+#define PATH_GUIDING_BIN_COUNT (PATH_GUIDING_DIRECTIONAL_RESOLUTION * PATH_GUIDING_DIRECTIONAL_RESOLUTION)
+#define PATH_GUIDING_MAX_TRAINING_VERTICES 8
+
+// Number of consecutive entries of the hash table of the radiance cache where an entry can be
+// stored and maximum number of vertices of a training path that update the cache
+#define RADIANCE_CACHE_PROBE_COUNT 8
+#define RADIANCE_CACHE_MAX_TRAINING_VERTICES 4
+
+// Number of consecutive entries of the hash table of the visibility cache where an entry can be
+// stored and number of bins along each axis of the directions of an entry
+#define VISIBILITY_CACHE_PROBE_COUNT 8
+#define VISIBILITY_CACHE_DIRECTIONAL_RESOLUTION 6
+#define VISIBILITY_CACHE_BIN_COUNT (VISIBILITY_CACHE_DIRECTIONAL_RESOLUTION * VISIBILITY_CACHE_DIRECTIONAL_RESOLUTION)
+
 #define GGX_NO_VNDF 0
 #define GGX_VNDF_SAMPLING 1
 #define GGX_VNDF_SPHERICAL_CAPS 2
 #define GGX_VNDF_BOUNDED 3
 
+#define PATH_SAMPLER_XORSHIFT32 0
+#define PATH_SAMPLER_SOBOL_OWEN 1
+#define PATH_SAMPLER_BLUE_NOISE_RANK1 2
+
+#define MATERIAL_FEATURE_CLEARCOAT (1 << 0)
+#define MATERIAL_FEATURE_SHEEN (1 << 1)
+#define MATERIAL_FEATURE_SPECULAR_TRANSMISSION (1 << 2)
+#define MATERIAL_FEATURE_ANISOTROPY (1 << 3)
+#define MATERIAL_FEATURES_ALL (MATERIAL_FEATURE_CLEARCOAT | MATERIAL_FEATURE_SHEEN | MATERIAL_FEATURE_SPECULAR_TRANSMISSION | MATERIAL_FEATURE_ANISOTROPY)
+
 /**
  * Options are defined in a #ifndef __KERNELCC__ block because:
  *	- If they were not, the would be defined on the GPU side. However, the -D <macro>=<value> compiler option
@@ -100,6 +160,67 @@
   */
 #define SharedStackBVHTraversalSize 16
 
+/**
+ * Size of the shared memory stack for the BVH traversal of shadow rays. These are any-hit traversals
+ * that stop at the first opaque hit and so usually don't go as deep in the BVH as the closest hit traversals:
+ * a kernel can give them a smaller stack than SharedStackBVHTraversalSize.
+ * 
+ * -1 to use SharedStackBVHTraversalSize
+ */
+#define SharedStackBVHTraversalSizeShadowRays -1
+
+/**
+ * If true, the global stack buffer that complements the shared memory stack of the BVH traversal
+ * (UseSharedStackBVHTraversal) only has one stack per thread that can be resident on the GPU at
+ * the same time instead of one stack per pixel of the render. The warps take a free stack slot
+ * from the buffer when they start traversing and give it back when they're done (hiprtDynamicStack).
+ *
+ * This saves a lot of VRAM at high resolutions with deep stacks at the cost of the atomic
+ * operations that acquire and release the slots.
+ *
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define DynamicBVHTraversalStack KERNEL_OPTION_FALSE
+
+/**
+ * If true, the material textures are sampled at the mip level that matches the footprint
+ * of a ray cone propagated along the path: camera rays start with the spread angle of a pixel
+ * and the cone is widened at each bounce according to the roughness and the curvature of the surface.
+ * Distant geometry and rough secondary bounces then read the coarse mip levels.
+ * 
+ * If false, the full resolution level of the textures is always sampled.
+ * 
+ * GPU only, the CPU renderer always samples the full resolution textures
+ */
+#define MaterialTexturesRayConesLOD KERNEL_OPTION_TRUE
+
+/**
+ * If true, the queues of the wavefront path tracer only store the material index, the texture coordinates
+ * and the texture footprint of the hit of each path instead of the whole SimplifiedRendererMaterial
+ * (12 bytes per pixel instead of more than 100). The shade kernel then evaluates the textures of the
+ * material itself. This trades the memory traffic of the extend -> shade handoff for texture fetches.
+ * The camera rays hits are always deferred that way since the G-buffer only stores the material index
+ * and the texture coordinates (see get_g_buffer_material()).
+ * 
+ * The cost of both layouts can be compared with the "Wavefront Extend" and "Wavefront Shade" timings
+ * of the performance metrics or with the --benchmark command line argument.
+ * 
+ * Not used by the megakernel path tracer whose RayPayload material is consumed by the same thread
+ * right after the intersection
+ */
+#define WavefrontDeferredMaterials KERNEL_OPTION_FALSE
+
+/**
+ * If true, the buffers of the G-buffer store the pixels by 8x8 tiles, the size of the thread blocks
+ * of the per-pixel kernels, instead of row-major. The threads of a block then read a few contiguous
+ * cache lines of each buffer instead of 8 rows. See GBuffer::get_storage_index().
+ * 
+ * Only the G-buffer is tiled: the framebuffer, the denoiser AOVs and the other per-pixel buffers
+ * read back by the host stay row-major so that no detiling pass is needed for the display
+ * and the denoiser
+ */
+#define GBufferTiledLayout KERNEL_OPTION_FALSE
+
 /**
  * Allows the overriding of the BRDF/BSDF used by the path tracer. When an override is used,
  * the material retains its properties (color, roughness, ...) but only the parameters relevant
@@ -119,6 +240,46 @@
  */
 #define BSDFOverride BSDF_NONE
 
+/**
+ * If true, the materials hit at bounce 'render_settings.simplified_bsdf_start_bounce' and after use a
+ * Lambertian + GGX BSDF instead of their own BSDF (only when BSDFOverride is BSDF_NONE or BSDF_DISNEY).
+ * Materials with specular transmission keep their BSDF.
+ * 
+ * This is biased but the deep bounces contribute little to the image and evaluating / sampling the
+ * simplified BSDF is much cheaper than the full Disney BSDF. If false, the branch isn't compiled at all
+ */
+#define DeepBouncesSimplifiedBSDF KERNEL_OPTION_FALSE
+
+/**
+ * MATERIAL_FEATURE_XXX flags of the lobes of the Disney BSDF that are compiled in the kernels.
+ * The lobes of the features that aren't in the mask are compiled out (their parameters read as 0)
+ * so that the register usage of the kernels is the one of the lobes that the scene actually uses.
+ * 
+ * The GPURenderer sets this option to the features used by the materials of the scene
+ * (RendererMaterial::get_features()) and recompiles the kernels when the material
+ * editor enables a feature that isn't compiled in
+ */
+#define MaterialFeatures MATERIAL_FEATURES_ALL
+
+/**
+ * Random numbers used by the camera rays and the bounces of the paths of the megakernel path tracer.
+ * The other passes (ReSTIR, wavefront path tracer, ...) always use white noise.
+ * 
+ *	- PATH_SAMPLER_XORSHIFT32
+ *		White noise from a Xorshift32 generator seeded per pixel and per sample
+ * 
+ *	- PATH_SAMPLER_SOBOL_OWEN
+ *		Owen scrambled Sobol sequence, scrambled per pixel. Better stratification of the samples
+ *		of each pixel: lower noise at equal sample count
+ * 
+ *	- PATH_SAMPLER_BLUE_NOISE_RANK1
+ *		Rank-1 lattice shifted per pixel by a screen space blue-noise like mask: the error is
+ *		distributed as blue noise over the image at low sample counts
+ * 
+ * See Xorshift32Generator::set_dimension_block() for how the dimensions are given to the bounces
+ */
+#define PathSampler PATH_SAMPLER_XORSHIFT32
+
 /**
  * What nested dielectrics strategy to use.
  * 
@@ -137,6 +298,19 @@
  */
 #define NestedDielectricsStackSize NESTED_DIELECTRICS_STACK_SIZE
 
+/**
+ * If true, the entries of the nested dielectrics stack of the paths are kept in shared memory
+ * (one slot of NestedDielectricsStackSize entries per thread of the block, SharedStackBVHTraversalBlockSize threads)
+ * instead of in the registers / local memory of the threads. Same idea as UseSharedStackBVHTraversal for the BVH traversal
+ * stack: the stack is indexed dynamically and so is spilled to local memory by the compiler otherwise.
+ * 
+ * This lowers the registers / spills of the kernels at the cost of some shared memory: which variant gives the best
+ * occupancy depends on the GPU. Both are reported by the kernel resource bench, see KernelResourceReport
+ * 
+ * GPU only, the CPU renderer always keeps the stack in the RayVolumeState
+ */
+#define NestedDielectricsStackUseSharedMemory KERNEL_OPTION_FALSE
+
 /**
  * What direct lighting sampling strategy to use.
  * 
@@ -162,9 +336,36 @@
  *	- LSS_RESTIR_DI
  *		Uses ReSTIR DI to sample direct lighting at the first bounce in the scene.
  *		Later bounces use the strategy given by ReSTIR_DI_LaterBouncesSamplingStrategy
+ * 
+ *	- LSS_LIGHT_BVH
+ *		Samples one light in the scene with MIS (light sample + BSDF sample), the light
+ *		sample being chosen by traversing a light hierarchy that accounts for the power,
+ *		distance and orientation of the lights relative to the shading point.
+ *		Efficient in scenes with many lights of very different powers
  */
 #define DirectLightSamplingStrategy LSS_RESTIR_DI
 
+/**
+ * How to sample the indirect lighting of the visible points (camera ray hits)
+ *
+ * Possible values (the prefix ILS stands for "Indirect Light Sampling"):
+ *
+ *	- ILS_PATH_TRACING
+ *		The path traced by the path tracer is used as is
+ *
+ *	- ILS_RESTIR_GI
+ *		The second vertex of the path of each pixel is an initial candidate for ReSTIR GI
+ *		which resamples these second vertices temporally and spatially before shading the
+ *		visible point with the resampled vertex. Only supported by the megakernel path tracer
+ *
+ *	- ILS_PATH_GUIDING
+ *		The bounces sample either the BSDF or the incident radiance learnt by a spatial grid of
+ *		directional histograms (see Device/includes/PathGuiding.h), combined with one-sample MIS.
+ *		The grid is trained from the contributions of the paths of the first samples.
+ *		Only supported by the megakernel path tracer
+ */
+#define IndirectLightSamplingStrategy ILS_PATH_TRACING
+
 /**
  * What envmap sampling strategy to use
  * 
@@ -176,9 +377,114 @@
  *	- ESS_BINARY_SEARCH
  *		Importance samples the environment map using a binary search on the CDF
  *		distributions of the envmap
+ * 
+ *	- ESS_ALIAS_TABLE
+ *		Importance samples the environment map in O(1) using an alias table
+ * 
+ *	- ESS_MARGINAL_CONDITIONAL
+ *		Importance samples the environment map with a binary search on the marginal
+ *		CDF of the rows followed by a binary search on the conditional CDF of the
+ *		sampled row. Same distribution as ESS_BINARY_SEARCH but the searches are
+ *		bounded to log(height) + log(width) steps on smaller arrays
+ * 
+ *	- ESS_PRODUCT_SAMPLING
+ *		Importance samples the product of the envmap and of a coarse approximation of
+ *		the BSDF of the shading point (cosine lobe + spherical gaussian around the
+ *		reflected direction) by hierarchical warping over a luminance pyramid of the envmap.
+ *		The BSDF approximation is only evaluated on the coarse levels of the pyramid
+ *		(WorldSettings::envmap_product_sampling_lobe_levels). The envmap samples that
+ *		don't have a BSDF (ReSTIR DI, visibility cache, ...) use the alias table
  */
 #define EnvmapSamplingStrategy ESS_ALIAS_TABLE
 
+/**
+ * In which format the envmap is stored on the GPU. The CPU renderer always keeps the envmap in float32.
+ * 
+ * Possible values (the prefix ESF stands for "Envmap Storage Format"):
+ * 
+ *	- ESF_RGBA32F
+ *		4 floats per texel, 16 bytes
+ * 
+ *	- ESF_RGBA16F
+ *		4 half floats per texel, 8 bytes. Filtered by the hardware
+ * 
+ *	- ESF_RGB9E5
+ *		Shared exponent format, 4 bytes per texel. Decoded and filtered in the shader
+ * 
+ *	- ESF_RGB32F
+ *		3 floats per texel, 12 bytes. Lossless, stored in a linear buffer and filtered in
+ *		the shader since HIP/CUDA textures don't support 3 channels
+ */
+#define EnvmapStorageFormat ESF_RGBA32F
+
+/**
+ * If true, the probabilities of the alias table of the envmap (ESS_ALIAS_TABLE) are
+ * stored as 16-bit unsigned normalized integers instead of floats to save VRAM
+ */
+#define EnvmapCompactAliasTable KERNEL_OPTION_FALSE
+
+/**
+ * How to choose one emissive triangle of the scene when sampling a light
+ * (for the light sampling strategies that don't use the light hierarchy)
+ * 
+ * Possible values (the prefix ETSS stands for "Emissive Triangles Sampling Strategy"):
+ * 
+ *	- ETSS_UNIFORM
+ *		All emissive triangles have the same probability of being chosen
+ * 
+ *	- ETSS_POWER_ALIAS_TABLE
+ *		Emissive triangles are chosen proportionally to their power (area * luminance
+ *		of the emission) in O(1) with an alias table.
+ *		Efficient in scenes with lights of very different sizes / strengths
+ * 
+ *	- ETSS_LIGHT_CLUSTERS
+ *		Emissive triangles are chosen proportionally to their power among the lights
+ *		of the cell of the world space light clusters grid that contains the shading point
+ *		(see LightClustersGrid). Only the lights whose contribution at the shading point can
+ *		exceed 'minimum_light_contribution' are in the list of its cell: bounds the cost of the
+ *		scenes with many local emitters. Falls back to ETSS_POWER_ALIAS_TABLE when
+ *		'minimum_light_contribution' is 0
+ */
+#define EmissiveTrianglesSamplingStrategy ETSS_POWER_ALIAS_TABLE
+
+/**
+ * How the BSDF ray of the light / BSDF MIS strategies (LSS_MIS_LIGHT_BSDF and LSS_LIGHT_BVH)
+ * looks for the light it hits
+ * 
+ * Possible values (the prefix MIS_BSDF_RAY stands for "MIS BSDF Ray"):
+ * 
+ *	- MIS_BSDF_RAY_SCENE
+ *		Closest hit traversal of the whole scene, the BSDF ray contributes if the surface hit is emissive
+ * 
+ *	- MIS_BSDF_RAY_CHOSEN_LIGHT
+ *		The BSDF ray is intersected with the emissive triangle chosen for the light sample only and an
+ *		any-hit shadow ray is then traced up to that triangle. The MIS is done between the light sample
+ *		and the BSDF sample of the chosen light (the BSDF rays that hit other lights don't contribute).
+ *		Cheapest but noisier than the two others in scenes with many lights
+ * 
+ *	- MIS_BSDF_RAY_LIGHT_BVH
+ *		The closest emissive triangle along the BSDF ray is found by traversing the light hierarchy
+ *		(BVH of the emissive triangles only) and an any-hit shadow ray is then traced up to that triangle.
+ *		Same estimator as MIS_BSDF_RAY_SCENE but the BSDF rays that don't hit any light don't trace any ray
+ * 
+ * With the two last options, the alpha testing of the emissive triangles themselves is not done and the
+ * meshes with an emissive texture (which aren't part of the emissive triangles since emissive textures
+ * aren't importance sampled) aren't hit by the BSDF ray
+ */
+#define MISBSDFRayIntersection MIS_BSDF_RAY_SCENE
+
+/**
+ * If true, the BSDF sample of the direct lighting (the BSDF ray of LSS_MIS_LIGHT_BSDF / LSS_LIGHT_BVH
+ * and the first BSDF candidate of LSS_RIS_BSDF_AND_LIGHT) is traced with a full closest hit traversal
+ * and becomes the ray and the intersection of the next bounce of the path: the path tracer doesn't
+ * sample and trace another BSDF direction for the next bounce, saving one closest hit traversal per bounce.
+ * 
+ * Only for the megakernel path tracer and not with ILS_PATH_GUIDING (which samples the bounces
+ * with the guiding distribution). With LSS_MIS_LIGHT_BSDF / LSS_LIGHT_BVH, only reused if
+ * MISBSDFRayIntersection is MIS_BSDF_RAY_SCENE, the other modes don't find the closest hit of the scene
+ */
+#define ReuseMISBSDFSampleForBounce KERNEL_OPTION_FALSE
+
 /**
  * Whether or not to do Muliple Importance Sampling between the envmap sample and a BSDF
  * sample when importance sampling direct lighting contribution from the envmap
@@ -222,6 +528,22 @@
  */
 #define ReSTIR_DI_DoVisibilityReuse KERNEL_OPTION_TRUE
 
+/**
+ * If true, the visibility reuse of the initial candidates, spatial reuse and spatiotemporal
+ * reuse passes doesn't trace its shadow rays inline. The passes instead queue the rays in a
+ * compacted queue and a dedicated kernel traces all the queued rays at once after the pass and
+ * discards the occluded reservoirs.
+ * 
+ * This keeps the traversal out of the register-heavy resampling kernels so that the occupancy
+ * of the traversal can be tuned independently.
+ * 
+ * The visibility of the target functions and of the MIS weights is still traced inline since
+ * the resampling needs it right away.
+ * 
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define ReSTIR_DI_BatchedVisibilityRays KERNEL_OPTION_FALSE
+
 /**
  * Whether or not to use a visibility term in the MIS weights (MIS-like weights,
  * generalized balance heuristic, pairwise MIS, ...) used to remove bias when
@@ -299,6 +621,45 @@
  */
 #define ReSTIR_DI_DoLightsPresampling KERNEL_OPTION_TRUE
 
+/**
+ * If true, the light candidates of the initial candidates pass of ReSTIR DI are sampled
+ * with the light hierarchy (same as the LSS_LIGHT_BVH strategy) instead of uniformly.
+ * 
+ * The light hierarchy sample depends on the shading point so this option takes precedence
+ * over ReSTIR_DI_DoLightsPresampling: lights are not presampled if this option is true
+ * 
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define ReSTIR_DI_InitialCandidatesUseLightBVH KERNEL_OPTION_FALSE
+
+/**
+ * If true, the threads of a block of the spatial reuse pass of ReSTIR DI cooperatively load the
+ * reservoirs and the surfaces (position, normal, roughness) of their pixels plus an apron of
+ * RESTIR_DI_SPATIAL_TILE_APRON pixels around them in shared memory. The neighbors are then
+ * read from there instead of from the global reservoirs and G-buffer.
+ * 
+ * The spatial reuse radius is then bounded by the apron.
+ * 
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define ReSTIR_DI_SpatialReuseSharedMemoryTile KERNEL_OPTION_FALSE
+
+/**
+ * If true and if the lights are presampled (ReSTIR_DI_DoLightsPresampling), the threads of a block of the
+ * initial candidates pass of ReSTIR DI cooperatively load the subset of presampled lights of the block
+ * in shared memory and draw their light candidates from there instead of from the global presampled lights.
+ * 
+ * Only the first RESTIR_DI_SHARED_PRESAMPLED_LIGHT_COUNT lights of a random window of the subset are loaded
+ * if the subset is larger than that. The lights of a subset are independent samples of the lights of
+ * the scene so any window of them is still distributed as the whole subset.
+ * 
+ * The blocks read the global presampled lights as without this option if the presampling tile size isn't
+ * a multiple of RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE: their pixels don't all use the same subset then.
+ * 
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define ReSTIR_DI_InitialCandidatesSharedMemoryLights KERNEL_OPTION_FALSE
+
 /**
  * What sampling strategy to use for the GGX NDF
  * 
@@ -323,6 +684,105 @@
 //#define GGXAnisotropicSampleFunction GGX_VNDF_SPHERICAL_CAPS
 #define GGXAnisotropicSampleFunction GGX_VNDF_BOUNDED
 
+/**
+ * If true, the options that can be toggled interactively without recompiling (EnvmapSamplingDoBSDFMIS
+ * and ReSTIR_DI_DoVisibilityReuse, see HostDeviceCommon/RuntimeKernelOptions.h) are not read from their macro
+ * but from 'HIPRTRenderSettings::runtime_kernel_options' with regular branches.
+ * 
+ * Only used by the kernels that the GPURenderer swaps in while it compiles the kernels specialized for the new
+ * values of these options in the background (see GPURenderer::set_runtime_kernel_option()). This is never
+ * the default as the branches cost registers.
+ * 
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define KernelOptionsRuntimeBranches KERNEL_OPTION_FALSE
+
+/**
+ * If true, the kernels that take the render data don't receive the whole HIPRTRenderData as a kernel
+ * argument but a pointer to a copy of it in device memory plus a small HIPRTPerSampleData with the fields
+ * that change every sample (see Device/includes/KernelRenderData.h).
+ * 
+ * The GPURenderer only uploads that copy when the render data changed for something else than these
+ * per-sample fields (see GPURenderer::get_render_data_launch_args()): the arguments of each launch are a
+ * few dozen bytes instead of a few kilobytes, at the price of every thread copying the render data
+ * from (cached) global memory at the start of the kernel.
+ * 
+ * The samples aren't submitted as a graph when this is true (HIPRTRenderSettings::use_sample_graph)
+ * as the uploads of the render data would not be part of the graph.
+ * 
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define UseDeviceResidentRenderData KERNEL_OPTION_FALSE
+
+/**
+ * If true, the CameraRays, ReSTIR and FullPathTracer kernels measure how many clock cycles each
+ * pixel spends in them and accumulate these cycles, per category, in 'aux_buffers.pixel_costs'
+ * for the pixel cost heatmap display view (see Device/includes/PixelCost.h).
+ *
+ * Off by default as reading the clock and the read-modify-write of the buffer aren't free.
+ * The wavefront path tracer isn't instrumented.
+ *
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define PixelCostInstrumentation KERNEL_OPTION_FALSE
+
+/**
+ * If true, the kernels are compiled with their diagnostic code paths:
+ *	- the NaN / negative color checks of sanity_check() that log the faulty pixels on the CPU
+ *		and that display the NaNs in pink if 'render_settings.display_NaNs' is true
+ *	- the 'debug_neighbor_location' neighbor of the ReSTIR DI spatial reuse
+ *	- the sanity_check() of the ReSTIR DI reservoirs on the CPU
+ *
+ * If false, these are compiled out and sanity_check() only discards the invalid samples
+ * (an accumulated NaN would never leave the pixel otherwise).
+ * The register usage of both variants is logged in the kernel resource report.
+ *
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define KernelDiagnostics KERNEL_OPTION_FALSE
+
+/**
+ * If true, the denoiser albedo and normals are accumulated in 32 bits per pixel buffers
+ * (RGB9E5 albedo and octahedral normals, see Device/includes/DenoiserAOVs.h) instead of
+ * the 12 bytes per pixel float buffers read by the denoiser and the display.
+ * The float buffers are then only written once per frame by the UnpackDenoiserAOVs kernel.
+ *
+ * This cuts the memory traffic of the AOV accumulation of each sample by a factor of 3
+ * at the cost of the precision of the AOVs, which doesn't matter much to the denoiser.
+ * The accumulation of the beauty buffer always stays in float.
+ *
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define PackedDenoiserAOVs KERNEL_OPTION_FALSE
+
+/**
+ * If true, the denoiser albedo and normals are not accumulated by the path tracers at their
+ * first bounce but by the DenoiserAOVsResolve kernel from the G-buffer filled by the camera rays.
+ *
+ * The resolve is only launched every sample if the camera rays are jittered, the AOVs are
+ * resolved once at the first sample of the render otherwise. This removes the AOV writes
+ * from the path tracing kernels.
+ *
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define DenoiserAOVsFromGBuffer KERNEL_OPTION_FALSE
+
+/**
+ * If true, the color products of the target function of ReSTIR DI (BSDF * emission * cosine, see
+ * ReSTIR_DI_target_function_luminance()) are computed with packed half2 math on the GPU, for the
+ * GPUs that execute half2 operations at twice the rate of float operations.
+ *
+ * Only the color channels are in half precision: the directions, distances and cosine terms stay
+ * in float. The colors are normalized by their largest channel before being converted so the
+ * products can't overflow the range of the halves. The target function is still the same for all
+ * the passes of ReSTIR DI, the render stays unbiased, only the resampling weights are slightly less precise.
+ *
+ * The CPU renderer always computes the target function in float.
+ *
+ *	- KERNEL_OPTION_TRUE or KERNEL_OPTION_FALSE values are accepted. Self-explanatory
+ */
+#define ReSTIR_DI_TargetFunctionPackedHalf KERNEL_OPTION_FALSE
+
 #endif // #ifndef __KERNELCC__
 
 #endif
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_LIGHT_BVH_NODE_H
+#define HOST_DEVICE_COMMON_LIGHT_BVH_NODE_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * Node of the light hierarchy built over the emissive triangles of the scene
+ * and used by the LSS_LIGHT_BVH direct lighting strategy (and optionally by the
+ * initial candidates of ReSTIR DI).
+ *
+ * Each node bounds the position (AABB), the orientation (cone of normals) and the
+ * power of the emissive triangles below it such that a conservative importance of the node
+ * for a given shading point can be computed during the traversal.
+ *
+ * The two children of an inner node are always stored next to each other in the nodes
+ * buffer: the right child is at index 'first_child_index + 1'. The root is at index 0.
+ *
+ * Reference:
+ * [Importance Sampling of Many Lights with Adaptive Tree Splitting, Conty Estevez, Kulla, 2018]
+ */
+struct LightBVHNode
+{
+	float3 bbox_min = { 0.0f, 0.0f, 0.0f };
+	float3 bbox_max = { 0.0f, 0.0f, 0.0f };
+
+	// Axis of the cone that bounds the normals of the emissive triangles below this node.
+	// Emissive triangles are two-sided in this renderer so the cone bounds the normals up to their sign
+	float3 cone_axis = { 0.0f, 0.0f, 1.0f };
+	// Cosine of the half-angle of the cone of normals
+	float cos_theta_o = 1.0f;
+	// Cosine of the angle (around the normals) in which the triangles emit light.
+	// 0.0f (i.e. pi/2) for the diffuse emitters of this renderer
+	float cos_theta_e = 0.0f;
+
+	// Sum of the power of the emissive triangles below this node
+	float power = 0.0f;
+
+	// Index of the left child of this node. The right child is at 'first_child_index + 1'.
+	// -1 if this node is a leaf
+	int first_child_index = -1;
+	// For leaves, scene primitive index (see SceneInstance) of the emissive
+	// triangle of this leaf. -1 for inner nodes
+	int emissive_triangle_index = -1;
+	// -1 for the root
+	int parent_index = -1;
+};
+
+#endif
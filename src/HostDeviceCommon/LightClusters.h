@@ -0,0 +1,67 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_LIGHT_CLUSTERS_H
+#define HOST_DEVICE_COMMON_LIGHT_CLUSTERS_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * World space grid of light clusters used by the ETSS_LIGHT_CLUSTERS emissive triangles
+ * sampling strategy, built by LightClustersBuilder.
+ *
+ * Each cell lists the emissive triangles whose sphere of influence overlaps the cell: a triangle
+ * only influences the points closer than sqrt(power / minimum_light_contribution) to it, past that distance its
+ * contribution is below the 'minimum_light_contribution' of the render settings and its light samples would be
+ * discarded anyway. The lights of a cell are sampled proportionally to their power with the alias table of the cell.
+ *
+ * The cells whose list would be empty or contain all the emissive triangles of the scene don't store
+ * any list: the points in these cells, as well as the points outside of the grid, sample the
+ * global alias table of the emissive triangles instead
+ */
+struct LightClustersGrid
+{
+	// Bounds of the grid, the bounding box of the scene
+	float3 grid_min = make_float3(0.0f, 0.0f, 0.0f);
+	float3 grid_max = make_float3(1.0f, 1.0f, 1.0f);
+	// Number of cells along each axis of the grid. 0 if the grid hasn't been built
+	int grid_resolution = 0;
+
+	// The lights of the cell 'i' are at indices 'cells_offsets[i]' to 'cells_offsets[i + 1]' (excluded)
+	// of 'cells_emissive_triangles' and of the alias tables. 'grid_resolution^3 + 1' elements
+	int* cells_offsets = nullptr;
+	// Scene primitive indices (see SceneInstance) of the emissive triangles of the cells,
+	// sorted by index in each cell for the PDF evaluation to find a given triangle by binary search
+	int* cells_emissive_triangles = nullptr;
+	// Alias tables of the cells, indices relative to the first light of the cell
+	float* cells_alias_table_probas = nullptr;
+	int* cells_alias_table_alias = nullptr;
+	// Sum of the power (see get_emissive_triangle_power_luminance()) of the lights of each cell
+	float* cells_total_power = nullptr;
+};
+
+/**
+ * Index of the cell of the grid that contains 'point', -1 if the point is
+ * outside of the grid or if the grid hasn't been built
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int light_clusters_get_cell_index(const LightClustersGrid& grid, const float3& point)
+{
+	int resolution = grid.grid_resolution;
+	if (resolution == 0)
+		return -1;
+
+	float3 extent = grid.grid_max - grid.grid_min;
+	float3 relative = point - grid.grid_min;
+
+	float cell_x = relative.x / extent.x * resolution;
+	float cell_y = relative.y / extent.y * resolution;
+	float cell_z = relative.z / extent.z * resolution;
+	if (cell_x < 0.0f || cell_y < 0.0f || cell_z < 0.0f || cell_x >= resolution || cell_y >= resolution || cell_z >= resolution)
+		return -1;
+
+	return static_cast<int>(cell_x) + (static_cast<int>(cell_y) + static_cast<int>(cell_z) * resolution) * resolution;
+}
+
+#endif
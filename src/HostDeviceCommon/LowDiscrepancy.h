@@ -0,0 +1,119 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_LOW_DISCREPANCY_H
+#define HOST_DEVICE_COMMON_LOW_DISCREPANCY_H
+
+#include <hiprt/hiprt_device.h>
+
+/**
+ * Low discrepancy sequences used by the Xorshift32Generator when PathSampler
+ * isn't PATH_SAMPLER_XORSHIFT32.
+ *
+ * References:
+ * [1] [Practical Hash-based Owen Scrambling, Burley, 2020] https://jcgt.org/published/0009/04/01/
+ * [2] [The Unreasonable Effectiveness of Quasirandom Sequences, Roberts, 2018] https://extremelearning.com.au/unreasonable-effectiveness-of-quasirandom-sequences/
+ */
+
+// Generators of the R2 sequence of [2] in 0.32 fixed point: 1 / g and 1 / g^2 with g the plastic number
+#define R2_ALPHA_1_FIXED_POINT 3242174889u
+#define R2_ALPHA_2_FIXED_POINT 2447445414u
+
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int reverse_bits(unsigned int x)
+{
+#ifdef __KERNELCC__
+    return __brev(x);
+#else
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+
+    return (x >> 16) | (x << 16);
+#endif
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int hash_combine(unsigned int seed, unsigned int value)
+{
+    return seed ^ (value + (seed << 6) + (seed >> 2));
+}
+
+/**
+ * Hash based Owen scrambling of the bits of 'x', from the most significant bit. See [1]
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int nested_uniform_scramble(unsigned int x, unsigned int seed)
+{
+    x = reverse_bits(x);
+
+    // Laine-Karras permutation of [1]
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+
+    return reverse_bits(x);
+}
+
+/**
+ * Second dimension of the Sobol sequence (the first one is reverse_bits(index))
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int sobol_second_dimension(unsigned int index)
+{
+    unsigned int result = 0;
+    for (unsigned int direction = 1u << 31; index != 0; index >>= 1, direction ^= direction >> 1)
+        if (index & 1)
+            result ^= direction;
+
+    return result;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float fixed_point_to_float(unsigned int x)
+{
+    // 24 bits of mantissa, the result is in [0, 1[
+    return (x >> 8) * 5.96046448e-8f;
+}
+
+/**
+ * Dimension 'dimension' of the sample 'sample_index' of the Owen scrambled Sobol sequence.
+ *
+ * The dimensions are padded 2D Sobol: the samples of each pair of dimensions are shuffled
+ * independently ([1], section 5) so that the pairs aren't correlated with each other.
+ * 'seed' decorrelates the pixels
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float owen_scrambled_sobol(unsigned int sample_index, unsigned int dimension, unsigned int seed)
+{
+    unsigned int pair_seed = hash_combine(seed, dimension >> 1);
+    unsigned int shuffled_index = nested_uniform_scramble(sample_index, pair_seed);
+
+    unsigned int sobol = (dimension & 1) ? sobol_second_dimension(shuffled_index) : reverse_bits(shuffled_index);
+
+    return fixed_point_to_float(nested_uniform_scramble(sobol, hash_combine(pair_seed, dimension)));
+}
+
+/**
+ * Screen space offset of the pixel (x, y) for the rank-1 lattice: the R2 sequence over the pixel
+ * coordinates is a dithering mask with a blue-noise like spectrum [2]
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int blue_noise_pixel_offset(unsigned int x, unsigned int y)
+{
+    return x * R2_ALPHA_1_FIXED_POINT + y * R2_ALPHA_2_FIXED_POINT;
+}
+
+/**
+ * Dimension 'dimension' of the sample 'sample_index' of a rank-1 lattice (the R2 sequence for each
+ * pair of dimensions) shifted by 'pixel_offset' (see blue_noise_pixel_offset()) and by a random
+ * rotation per dimension so that the dimensions aren't correlated with each other
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float blue_noise_rank1_lattice(unsigned int sample_index, unsigned int dimension, unsigned int pixel_offset, unsigned int seed)
+{
+    unsigned int generator = (dimension & 1) ? R2_ALPHA_2_FIXED_POINT : R2_ALPHA_1_FIXED_POINT;
+    unsigned int dimension_rotation = hash_combine(seed, dimension) * 0x9E3779B9u;
+
+    // Wrapping around in fixed point is the fractional part
+    return fixed_point_to_float(pixel_offset + dimension_rotation + sample_index * generator);
+}
+
+#endif
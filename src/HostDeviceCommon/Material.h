@@ -16,7 +16,9 @@ enum BRDF
 {
     Uninitialized,
     Disney,
-    SpecularFresnel
+    SpecularFresnel,
+    // Lambertian + GGX used for the deep bounces, see DeepBouncesSimplifiedBSDF
+    SimplifiedLambertGGX
 };
 
 // A simplified material is the material effectively evaluated at a point in the scene.
@@ -62,7 +64,7 @@ struct SimplifiedRendererMaterial
 
         if (specular_transmission == 0.0f)
             // No transmission means that we should never skip this boundary --> max priority
-            dielectric_priority = (1 << StackPriorityEntry::PRIORITY_MAXIMUM) - 1;
+            dielectric_priority = StackPriorityEntry::PRIORITY_MAXIMUM;
     }
 
     HIPRT_HOST_DEVICE void precompute_anisotropic()
@@ -184,6 +186,91 @@ struct RendererMaterial : public SimplifiedRendererMaterial
     int sheen_color_texture_index = -1;
 
     int specular_transmission_texture_index = -1;
+
+    /**
+     * Same material but with the constant parameters of the
+     * material in place of all of its textures
+     */
+    HIPRT_HOST_DEVICE RendererMaterial without_textures() const
+    {
+        RendererMaterial material = *this;
+
+        material.normal_map_texture_index = NO_TEXTURE;
+        material.emission_texture_index = NO_TEXTURE;
+        material.base_color_texture_index = NO_TEXTURE;
+        material.roughness_metallic_texture_index = NO_TEXTURE;
+        material.roughness_texture_index = NO_TEXTURE;
+        material.oren_sigma_texture_index = NO_TEXTURE;
+        material.subsurface_texture_index = NO_TEXTURE;
+        material.metallic_texture_index = NO_TEXTURE;
+        material.specular_texture_index = NO_TEXTURE;
+        material.specular_tint_texture_index = NO_TEXTURE;
+        material.specular_color_texture_index = NO_TEXTURE;
+        material.anisotropic_texture_index = NO_TEXTURE;
+        material.anisotropic_rotation_texture_index = NO_TEXTURE;
+        material.clearcoat_texture_index = NO_TEXTURE;
+        material.clearcoat_roughness_texture_index = NO_TEXTURE;
+        material.clearcoat_ior_texture_index = NO_TEXTURE;
+        material.sheen_texture_index = NO_TEXTURE;
+        material.sheen_tint_color_texture_index = NO_TEXTURE;
+        material.sheen_color_texture_index = NO_TEXTURE;
+        material.specular_transmission_texture_index = NO_TEXTURE;
+
+        return material;
+    }
+
+    /**
+     * MATERIAL_FEATURE_XXX flags of the lobes that this material uses,
+     * with its parameters or with its textures, see MaterialFeatures
+     */
+    HIPRT_HOST_DEVICE int get_features() const
+    {
+        int features = 0;
+
+        if (clearcoat > 0.0f || clearcoat_texture_index != NO_TEXTURE)
+            features |= MATERIAL_FEATURE_CLEARCOAT;
+        if (sheen > 0.0f || sheen_texture_index != NO_TEXTURE)
+            features |= MATERIAL_FEATURE_SHEEN;
+        if (specular_transmission > 0.0f || specular_transmission_texture_index != NO_TEXTURE)
+            features |= MATERIAL_FEATURE_SPECULAR_TRANSMISSION;
+        if (anisotropic > 0.0f || anisotropic_texture_index != NO_TEXTURE)
+            features |= MATERIAL_FEATURE_ANISOTROPY;
+
+        return features;
+    }
+
+    /**
+     * Whether the emission of the material is read from its emission texture,
+     * its constant emission is then unused
+     */
+    HIPRT_HOST_DEVICE bool has_emission_texture() const
+    {
+        return emission_texture_index != NO_TEXTURE && emission_texture_index != CONSTANT_EMISSIVE_TEXTURE;
+    }
+
+    /**
+     * Whether the triangles of this material are part of the emissive triangles of the scene
+     * that the lights are sampled from (next event estimation, ReSTIR DI, ...)
+     */
+    HIPRT_HOST_DEVICE bool is_light_sampled() const
+    {
+        return is_emissive() || (has_emission_texture() && emission_strength > 0.0f);
+    }
+
+    /**
+     * Luminance of the emission of a triangle of this material that the power of the triangle
+     * is computed with for the light sampling structures (alias table, light hierarchy).
+     *
+     * 'texture_luminance' is the average luminance of the emission texture over the triangle,
+     * see EmissiveTextureIntegrator. Only used if the material has an emission texture
+     */
+    HIPRT_HOST_DEVICE float get_emission_power_luminance(float texture_luminance) const
+    {
+        if (has_emission_texture())
+            return texture_luminance * emission_strength;
+        else
+            return get_emission().luminance();
+    }
 };
 
 #endif
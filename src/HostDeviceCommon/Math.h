@@ -88,6 +88,74 @@ namespace hippt
 	template <typename T>
 	__device__ T atomic_add(T* address, T increment) { return atomicAdd(address, increment); }
 
+	/**
+	 * Writes 'value' at 'address' if the value at 'address' is 'compare'.
+	 * Returns the value that was at 'address' before the operation
+	 */
+	template <typename T>
+	__device__ T atomic_compare_exchange(T* address, T compare, T value) { return atomicCAS(address, compare, value); }
+
+	/**
+	 * Same as atomic_add() but with a single atomic operation for all the active lanes of the warp:
+	 * the first active lane adds 'increment' times the number of active lanes and the others get their
+	 * offset from the value it read, in the order of their lane index.
+	 * 
+	 * 'increment' must be the same for all the active lanes. Meant for the counters that a lot of
+	 * threads increment at the same address (status buffers, ray counts, ...)
+	 */
+	template <typename T>
+	__device__ T warp_aggregated_atomic_add(T* address, T increment)
+	{
+		unsigned long long active_mask = __ballot(1);
+		int leader_lane = __ffsll(active_mask) - 1;
+		int lane = __lane_id();
+
+		T warp_value;
+		if (lane == leader_lane)
+			warp_value = atomicAdd(address, increment * static_cast<T>(__popcll(active_mask)));
+		warp_value = __shfl(warp_value, leader_lane);
+
+		unsigned long long lower_lanes_mask = (1ull << lane) - 1ull;
+		return warp_value + increment * static_cast<T>(__popcll(active_mask & lower_lanes_mask));
+	}
+
+	/**
+	 * Stores 'value' at 'address' from the first active lane of the warp only.
+	 * 'value' must be the same for all the active lanes (flags of the status buffers)
+	 */
+	template <typename T>
+	__device__ void warp_aggregated_store(T* address, T value)
+	{
+		if (__lane_id() == __ffsll(__ballot(1)) - 1)
+			*address = value;
+	}
+
+	/**
+	 * Maximum of 'value' over the active lanes of the warp. 'value' must be in [0, 2^nb_bits[.
+	 * 
+	 * One ballot per bit, from the highest: this is a vote so the inactive lanes (terminated
+	 * paths of the megakernel) are simply left out, contrary to a reduction with shuffles
+	 */
+	__device__ int warp_max(int value, int nb_bits)
+	{
+		int warp_max_value = 0;
+		for (int bit = nb_bits - 1; bit >= 0; bit--)
+		{
+			int candidate_value = warp_max_value | (1 << bit);
+			if (__ballot(value >= candidate_value) != 0)
+				warp_max_value = candidate_value;
+		}
+
+		return warp_max_value;
+	}
+
+	/**
+	 * Status counters increments, warp_aggregated_atomic_add() on the GPU. See
+	 * the CPU version for the block-level reduction of the CPU renderer
+	 */
+	template <typename T>
+	__device__ void aggregated_atomic_add(T* address, T increment) { warp_aggregated_atomic_add(address, increment); }
+
 #else
 #undef M_PI
 #define M_PI		3.14159265358979323846f
@@ -127,6 +195,91 @@ namespace hippt
 
 	template <typename T>
 	T atomic_add(std::atomic<T>* atomic_address, T increment) { return atomic_address->fetch_add(increment); }
+
+	template <typename T>
+	T atomic_compare_exchange(std::atomic<T>* atomic_address, T compare, T value)
+	{
+		// 'compare' is overwritten with the current value if the exchange fails and
+		// is already the value before the operation if it succeeds
+		atomic_address->compare_exchange_strong(compare, value);
+
+		return compare;
+	}
+
+	// A CPU thread is a warp of one lane, nothing to aggregate
+	template <typename T>
+	T warp_aggregated_atomic_add(std::atomic<T>* atomic_address, T increment) { return atomic_address->fetch_add(increment); }
+
+	template <typename T>
+	void warp_aggregated_store(T* address, T value) { *address = value; }
+
+	inline int warp_max(int value, int nb_bits) { return value; }
+
+	/**
+	 * Increments of the status counters accumulated by a CPU thread over a block of pixels
+	 * (a tile of the CPUTileScheduler) before being added to the counters, see aggregated_atomic_add()
+	 */
+	struct BlockReducedAtomicAdds
+	{
+		static constexpr int MAX_COUNTERS = 16;
+
+		std::atomic<unsigned int>* addresses[MAX_COUNTERS];
+		unsigned int sums[MAX_COUNTERS];
+		int counter_count = 0;
+	};
+
+	inline BlockReducedAtomicAdds& get_block_reduced_atomic_adds()
+	{
+		thread_local BlockReducedAtomicAdds block_adds;
+
+		return block_adds;
+	}
+
+	/**
+	 * Adds the increments accumulated by the calling thread with aggregated_atomic_add() to their
+	 * counters. Must be called by each thread at the end of each block of pixels it rendered
+	 * (done by CPUTileScheduler::run())
+	 */
+	inline void flush_block_reduced_atomic_adds()
+	{
+		BlockReducedAtomicAdds& block_adds = get_block_reduced_atomic_adds();
+		for (int i = 0; i < block_adds.counter_count; i++)
+			block_adds.addresses[i]->fetch_add(block_adds.sums[i]);
+
+		block_adds.counter_count = 0;
+	}
+
+	/**
+	 * Block-level reduction of the increments of a status counter: the increments are summed
+	 * per thread and only added to the counter by flush_block_reduced_atomic_adds().
+	 * The counter doesn't hold the right value before the flush so the returned value of
+	 * atomic_add() isn't available
+	 */
+	inline void aggregated_atomic_add(std::atomic<unsigned int>* atomic_address, unsigned int increment)
+	{
+		BlockReducedAtomicAdds& block_adds = get_block_reduced_atomic_adds();
+		for (int i = 0; i < block_adds.counter_count; i++)
+		{
+			if (block_adds.addresses[i] == atomic_address)
+			{
+				block_adds.sums[i] += increment;
+
+				return;
+			}
+		}
+
+		if (block_adds.counter_count == BlockReducedAtomicAdds::MAX_COUNTERS)
+		{
+			// No slot left for another counter
+			atomic_address->fetch_add(increment);
+
+			return;
+		}
+
+		block_adds.addresses[block_adds.counter_count] = atomic_address;
+		block_adds.sums[block_adds.counter_count] = increment;
+		block_adds.counter_count++;
+	}
 #endif
 }
 
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_MESH_VERTEX_ATTRIBUTES_H
+#define HOST_DEVICE_COMMON_MESH_VERTEX_ATTRIBUTES_H
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/PackedMaterial.h"
+
+/**
+ * Where the vertex attributes of a mesh are in the vertex attributes buffers of the scene.
+ *
+ * Only the meshes that have vertex normals (resp. texture coordinates) have storage in the buffer of the
+ * vertex normals (resp. texcoords): the attribute of the vertex 'first_vertex + i' of the mesh is at
+ * 'first_normal + i' in that buffer. Indexed by SceneInstance::mesh_index
+ *
+ * The positions of the vertices may also be quantized on 3x16 bits relative to the bounding box of the mesh,
+ * see quantize_vertex_position()
+ */
+struct MeshVertexAttributes
+{
+	// First vertex of the mesh in the buffer of the vertex positions
+	int first_vertex = 0;
+	// -1 if the mesh has no vertex normals, its triangles are then flat shaded
+	int first_normal = -1;
+	// -1 if the mesh has no texture coordinates, they are then all (0, 0)
+	int first_texcoords = -1;
+
+	// Minimum corner of the bounding box of the mesh and size of a quantization step
+	// of the quantized positions of its vertices along each axis
+	float3 position_min = { 0.0f, 0.0f, 0.0f };
+	float3 position_step = { 0.0f, 0.0f, 0.0f };
+};
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void quantize_vertex_position(const MeshVertexAttributes& mesh_attributes, const float3& position, unsigned short* out_quantized)
+{
+	float3 relative_position = position - mesh_attributes.position_min;
+	float position_components[3] = { relative_position.x, relative_position.y, relative_position.z };
+	float step_components[3] = { mesh_attributes.position_step.x, mesh_attributes.position_step.y, mesh_attributes.position_step.z };
+
+	for (int i = 0; i < 3; i++)
+	{
+		// Flat meshes have a step of 0 along their flat axis
+		float quantized = step_components[i] == 0.0f ? 0.0f : position_components[i] / step_components[i] + 0.5f;
+
+		out_quantized[i] = static_cast<unsigned short>(hippt::clamp(0.0f, 65535.0f, quantized));
+	}
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 dequantize_vertex_position(const MeshVertexAttributes& mesh_attributes, const unsigned short* quantized)
+{
+	return mesh_attributes.position_min + make_float3(quantized[0], quantized[1], quantized[2]) * mesh_attributes.position_step;
+}
+
+/**
+ * Object space position of the vertex 'vertex_index' of the mesh 'mesh_index'. Read from the quantized
+ * positions if they're given, 'mesh_vertex_attributes' isn't used otherwise and may be null
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 get_vertex_position(const float3* vertices_positions, const unsigned short* quantized_vertices_positions, const MeshVertexAttributes* mesh_vertex_attributes, int mesh_index, int vertex_index)
+{
+	if (quantized_vertices_positions != nullptr)
+		return dequantize_vertex_position(mesh_vertex_attributes[mesh_index], quantized_vertices_positions + vertex_index * 3);
+	else
+		return vertices_positions[vertex_index];
+}
+
+/**
+ * Packs texture coordinates as two half floats (the texture coordinates of tiled textures can be negative)
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int texcoords_half_encode(const float2& texcoords)
+{
+	unsigned int x = half_encode(hippt::abs(texcoords.x)) | (texcoords.x < 0.0f ? 0x8000u : 0u);
+	unsigned int y = half_encode(hippt::abs(texcoords.y)) | (texcoords.y < 0.0f ? 0x8000u : 0u);
+
+	return x | (y << 16);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float2 texcoords_half_decode(unsigned int packed)
+{
+	float x = half_decode(packed & 0x7FFF);
+	float y = half_decode((packed >> 16) & 0x7FFF);
+
+	return make_float2(packed & 0x8000u ? -x : x, packed & 0x80000000u ? -y : y);
+}
+
+#endif
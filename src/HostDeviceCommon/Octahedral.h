@@ -0,0 +1,84 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_OCTAHEDRAL_H
+#define HOST_DEVICE_COMMON_OCTAHEDRAL_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * Octahedral mapping of unit vectors: the unit sphere is projected onto the octahedron
+ * |x| + |y| + |z| = 1 whose lower half is then folded over the upper half to give
+ * a point of the square [-1, 1]^2.
+ *
+ * Reference: [A Survey of Efficient Representations for Independent Unit Vectors, Cigolle et al., 2014]
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float octahedral_sign_not_zero(float value)
+{
+	return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+/**
+ * Encodes the given unit vector to a point of [-1, 1]^2
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float2 octahedral_encode(const float3& unit_vector)
+{
+	float inverse_l1_norm = 1.0f / (hippt::abs(unit_vector.x) + hippt::abs(unit_vector.y) + hippt::abs(unit_vector.z));
+	float2 encoded = make_float2(unit_vector.x * inverse_l1_norm, unit_vector.y * inverse_l1_norm);
+
+	if (unit_vector.z < 0.0f)
+	{
+		// Folding the lower hemisphere over the upper one
+		float folded_x = (1.0f - hippt::abs(encoded.y)) * octahedral_sign_not_zero(encoded.x);
+		float folded_y = (1.0f - hippt::abs(encoded.x)) * octahedral_sign_not_zero(encoded.y);
+
+		encoded = make_float2(folded_x, folded_y);
+	}
+
+	return encoded;
+}
+
+/**
+ * Decodes a point of [-1, 1]^2 given by octahedral_encode() back to a unit vector
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 octahedral_decode(const float2& encoded)
+{
+	float3 decoded = make_float3(encoded.x, encoded.y, 1.0f - hippt::abs(encoded.x) - hippt::abs(encoded.y));
+	if (decoded.z < 0.0f)
+	{
+		float unfolded_x = (1.0f - hippt::abs(decoded.y)) * octahedral_sign_not_zero(decoded.x);
+		float unfolded_y = (1.0f - hippt::abs(decoded.x)) * octahedral_sign_not_zero(decoded.y);
+
+		decoded.x = unfolded_x;
+		decoded.y = unfolded_y;
+	}
+
+	return hippt::normalize(decoded);
+}
+
+/**
+ * Encodes the given unit vector to 2x16 bits (snorm) packed in
+ * a single unsigned int. The maximum angular error is ~0.005 degrees
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int octahedral_encode_32(const float3& unit_vector)
+{
+	float2 encoded = octahedral_encode(unit_vector);
+
+	int x = static_cast<int>(floor(hippt::clamp(-1.0f, 1.0f, encoded.x) * 32767.0f + 0.5f));
+	int y = static_cast<int>(floor(hippt::clamp(-1.0f, 1.0f, encoded.y) * 32767.0f + 0.5f));
+
+	return (static_cast<unsigned int>(x) & 0xFFFF) | (static_cast<unsigned int>(y) << 16);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float3 octahedral_decode_32(unsigned int packed)
+{
+	// Sign extension of the two 16 bits snorm
+	int x = static_cast<int>(packed << 16) >> 16;
+	int y = static_cast<int>(packed) >> 16;
+
+	return octahedral_decode(make_float2(hippt::max(-1.0f, x / 32767.0f), hippt::max(-1.0f, y / 32767.0f)));
+}
+
+#endif
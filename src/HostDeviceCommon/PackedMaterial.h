@@ -0,0 +1,270 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_PACKED_MATERIAL_H
+#define HOST_DEVICE_COMMON_PACKED_MATERIAL_H
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/Math.h"
+
+// Largest value of a half float
+#define PACKED_MATERIAL_HALF_MAX 65504.0f
+// Texture indices are stored on 16 signed bits
+#define PACKED_MATERIAL_MAX_TEXTURE_COUNT 32767
+
+/**
+ * Half float of the non-negative 'value', without the sign bit
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned short half_encode(float value)
+{
+	value = hippt::clamp(0.0f, PACKED_MATERIAL_HALF_MAX, value);
+	if (value < 6.103515625e-05f)
+		// Subnormal, multiples of 2^-24
+		return static_cast<unsigned short>(floor(value * 16777216.0f + 0.5f));
+
+	int exponent = static_cast<int>(floor(log2(value)));
+	int mantissa = static_cast<int>(floor((value / ldexpf(1.0f, exponent) - 1.0f) * 1024.0f + 0.5f));
+	if (mantissa == 1024)
+	{
+		// The rounding overflows the mantissa
+		exponent++;
+		mantissa = 0;
+	}
+
+	return static_cast<unsigned short>(((exponent + 15) << 10) | mantissa);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float half_decode(unsigned short half)
+{
+	int exponent = (half >> 10) & 0x1F;
+	int mantissa = half & 0x3FF;
+	if (exponent == 0)
+		return mantissa * 5.9604644775390625e-08f;
+
+	return ldexpf(1.0f + mantissa / 1024.0f, exponent - 15);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned char unorm8_encode(float value)
+{
+	return static_cast<unsigned char>(floor(hippt::clamp(0.0f, 1.0f, value) * 255.0f + 0.5f));
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE float unorm8_decode(unsigned char value)
+{
+	return value * (1.0f / 255.0f);
+}
+
+/**
+ * Compact version of RendererMaterial that is in the material buffer read by the shaders:
+ *	- the parameters in [0, 1] are 8 bit unorms
+ *	- the colors are RGB half floats
+ *	- the texture indices are 16 bits, two per 32 bit integer
+ *	- the precomputed parameters (alpha_x / alpha_y, oren_nayar_A / oren_nayar_B) aren't stored,
+ *	  they are recomputed by unpack()
+ *
+ * About 100 bytes instead of the ~230 bytes of a RendererMaterial. The materials are still
+ * edited as RendererMaterial on the CPU and packed when they are uploaded
+ */
+struct PackedRendererMaterial
+{
+	enum TextureIndex
+	{
+		NORMAL_MAP_TEXTURE = 0,
+		EMISSION_TEXTURE,
+		BASE_COLOR_TEXTURE,
+		ROUGHNESS_METALLIC_TEXTURE,
+		ROUGHNESS_TEXTURE,
+		OREN_SIGMA_TEXTURE,
+		SUBSURFACE_TEXTURE,
+		METALLIC_TEXTURE,
+		SPECULAR_TEXTURE,
+		SPECULAR_TINT_TEXTURE,
+		SPECULAR_COLOR_TEXTURE,
+		ANISOTROPIC_TEXTURE,
+		ANISOTROPIC_ROTATION_TEXTURE,
+		CLEARCOAT_TEXTURE,
+		CLEARCOAT_ROUGHNESS_TEXTURE,
+		CLEARCOAT_IOR_TEXTURE,
+		SHEEN_TEXTURE,
+		SHEEN_TINT_COLOR_TEXTURE,
+		SHEEN_COLOR_TEXTURE,
+		SPECULAR_TRANSMISSION_TEXTURE,
+
+		TEXTURE_INDEX_COUNT
+	};
+
+	HIPRT_HOST_DEVICE static PackedRendererMaterial pack(const RendererMaterial& material)
+	{
+		PackedRendererMaterial packed;
+
+		pack_color(material.base_color, packed.base_color);
+		pack_color(material.specular_color, packed.specular_color);
+		pack_color(material.sheen_color, packed.sheen_color);
+		pack_color(material.absorption_color, packed.absorption_color);
+		pack_color(material.get_original_emission(), packed.emission);
+
+		packed.emission_strength = material.emission_strength;
+		packed.oren_nayar_sigma = material.oren_nayar_sigma;
+		packed.clearcoat_ior = material.clearcoat_ior;
+		packed.ior = material.ior;
+		packed.absorption_at_distance = material.absorption_at_distance;
+
+		packed.roughness = unorm8_encode(material.roughness);
+		packed.subsurface = unorm8_encode(material.subsurface);
+		packed.metallic = unorm8_encode(material.metallic);
+		packed.specular = unorm8_encode(material.specular);
+		packed.specular_tint = unorm8_encode(material.specular_tint);
+		packed.anisotropic = unorm8_encode(material.anisotropic);
+		packed.anisotropic_rotation = unorm8_encode(material.anisotropic_rotation);
+		packed.clearcoat = unorm8_encode(material.clearcoat);
+		packed.clearcoat_roughness = unorm8_encode(material.clearcoat_roughness);
+		packed.sheen = unorm8_encode(material.sheen);
+		packed.sheen_tint = unorm8_encode(material.sheen_tint);
+		packed.specular_transmission = unorm8_encode(material.specular_transmission);
+		packed.alpha_opacity = unorm8_encode(material.alpha_opacity);
+		packed.brdf_type = static_cast<unsigned char>(material.brdf_type);
+		packed.dielectric_priority = static_cast<unsigned short>(material.dielectric_priority);
+
+		int texture_indices[TEXTURE_INDEX_COUNT] = {
+			material.normal_map_texture_index, material.emission_texture_index, material.base_color_texture_index,
+			material.roughness_metallic_texture_index, material.roughness_texture_index, material.oren_sigma_texture_index,
+			material.subsurface_texture_index, material.metallic_texture_index, material.specular_texture_index,
+			material.specular_tint_texture_index, material.specular_color_texture_index, material.anisotropic_texture_index,
+			material.anisotropic_rotation_texture_index, material.clearcoat_texture_index, material.clearcoat_roughness_texture_index,
+			material.clearcoat_ior_texture_index, material.sheen_texture_index, material.sheen_tint_color_texture_index,
+			material.sheen_color_texture_index, material.specular_transmission_texture_index
+		};
+		for (int i = 0; i < TEXTURE_INDEX_COUNT; i += 2)
+			// The negative special indices (NO_TEXTURE, CONSTANT_EMISSIVE_TEXTURE) are kept by the 16 bits two's complement
+			packed.texture_indices[i / 2] = static_cast<unsigned short>(texture_indices[i]) | (static_cast<unsigned int>(static_cast<unsigned short>(texture_indices[i + 1])) << 16);
+
+		return packed;
+	}
+
+	HIPRT_HOST_DEVICE RendererMaterial unpack() const
+	{
+		RendererMaterial material;
+
+		material.base_color = unpack_color(base_color);
+		material.specular_color = unpack_color(specular_color);
+		material.sheen_color = unpack_color(sheen_color);
+		material.absorption_color = unpack_color(absorption_color);
+		material.set_emission(unpack_color(emission));
+
+		material.emission_strength = emission_strength;
+		material.oren_nayar_sigma = oren_nayar_sigma;
+		material.clearcoat_ior = clearcoat_ior;
+		material.ior = ior;
+		material.absorption_at_distance = absorption_at_distance;
+
+		material.roughness = unorm8_decode(roughness);
+		material.subsurface = unorm8_decode(subsurface);
+		material.metallic = unorm8_decode(metallic);
+		material.specular = unorm8_decode(specular);
+		material.specular_tint = unorm8_decode(specular_tint);
+		material.anisotropic = unorm8_decode(anisotropic);
+		material.anisotropic_rotation = unorm8_decode(anisotropic_rotation);
+		material.clearcoat = unorm8_decode(clearcoat);
+		material.clearcoat_roughness = unorm8_decode(clearcoat_roughness);
+		material.sheen = unorm8_decode(sheen);
+		material.sheen_tint = unorm8_decode(sheen_tint);
+		material.specular_transmission = unorm8_decode(specular_transmission);
+		material.alpha_opacity = unorm8_decode(alpha_opacity);
+		material.brdf_type = static_cast<BRDF>(brdf_type);
+		material.dielectric_priority = dielectric_priority;
+
+		material.normal_map_texture_index = get_texture_index(NORMAL_MAP_TEXTURE);
+		material.emission_texture_index = get_texture_index(EMISSION_TEXTURE);
+		material.base_color_texture_index = get_texture_index(BASE_COLOR_TEXTURE);
+		material.roughness_metallic_texture_index = get_texture_index(ROUGHNESS_METALLIC_TEXTURE);
+		material.roughness_texture_index = get_texture_index(ROUGHNESS_TEXTURE);
+		material.oren_sigma_texture_index = get_texture_index(OREN_SIGMA_TEXTURE);
+		material.subsurface_texture_index = get_texture_index(SUBSURFACE_TEXTURE);
+		material.metallic_texture_index = get_texture_index(METALLIC_TEXTURE);
+		material.specular_texture_index = get_texture_index(SPECULAR_TEXTURE);
+		material.specular_tint_texture_index = get_texture_index(SPECULAR_TINT_TEXTURE);
+		material.specular_color_texture_index = get_texture_index(SPECULAR_COLOR_TEXTURE);
+		material.anisotropic_texture_index = get_texture_index(ANISOTROPIC_TEXTURE);
+		material.anisotropic_rotation_texture_index = get_texture_index(ANISOTROPIC_ROTATION_TEXTURE);
+		material.clearcoat_texture_index = get_texture_index(CLEARCOAT_TEXTURE);
+		material.clearcoat_roughness_texture_index = get_texture_index(CLEARCOAT_ROUGHNESS_TEXTURE);
+		material.clearcoat_ior_texture_index = get_texture_index(CLEARCOAT_IOR_TEXTURE);
+		material.sheen_texture_index = get_texture_index(SHEEN_TEXTURE);
+		material.sheen_tint_color_texture_index = get_texture_index(SHEEN_TINT_COLOR_TEXTURE);
+		material.sheen_color_texture_index = get_texture_index(SHEEN_COLOR_TEXTURE);
+		material.specular_transmission_texture_index = get_texture_index(SPECULAR_TRANSMISSION_TEXTURE);
+
+		material.precompute_anisotropic();
+		material.precompute_oren_nayar();
+
+		return material;
+	}
+
+	HIPRT_HOST_DEVICE int get_texture_index(TextureIndex texture) const
+	{
+		unsigned int pair = texture_indices[texture / 2];
+
+		return static_cast<short>((texture & 1) ? (pair >> 16) : (pair & 0xFFFF));
+	}
+
+	/**
+	 * Accessors for the parameters that are read without the rest of the material
+	 */
+	HIPRT_HOST_DEVICE ColorRGB32F get_emission() const { return unpack_color(emission) * emission_strength; }
+	HIPRT_HOST_DEVICE float get_emission_strength() const { return emission_strength; }
+	// Same as RendererMaterial::get_emission_power_luminance()
+	HIPRT_HOST_DEVICE float get_emission_power_luminance(float texture_luminance) const { return get_texture_index(EMISSION_TEXTURE) >= 0 ? texture_luminance * emission_strength : get_emission().luminance(); }
+	HIPRT_HOST_DEVICE ColorRGB32F get_absorption_color() const { return unpack_color(absorption_color); }
+	HIPRT_HOST_DEVICE float get_absorption_at_distance() const { return absorption_at_distance; }
+	HIPRT_HOST_DEVICE float get_ior() const { return ior; }
+	HIPRT_HOST_DEVICE float get_alpha_opacity() const { return unorm8_decode(alpha_opacity); }
+	HIPRT_HOST_DEVICE int get_dielectric_priority() const { return dielectric_priority; }
+
+private:
+	HIPRT_HOST_DEVICE static void pack_color(const ColorRGB32F& color, unsigned short* out_packed)
+	{
+		out_packed[0] = half_encode(color.r);
+		out_packed[1] = half_encode(color.g);
+		out_packed[2] = half_encode(color.b);
+	}
+
+	HIPRT_HOST_DEVICE static ColorRGB32F unpack_color(const unsigned short* packed)
+	{
+		return ColorRGB32F(half_decode(packed[0]), half_decode(packed[1]), half_decode(packed[2]));
+	}
+
+	unsigned int texture_indices[TEXTURE_INDEX_COUNT / 2];
+
+	float emission_strength;
+	float oren_nayar_sigma;
+	float clearcoat_ior;
+	float ior;
+	float absorption_at_distance;
+
+	unsigned short base_color[3];
+	unsigned short specular_color[3];
+	unsigned short sheen_color[3];
+	unsigned short absorption_color[3];
+	unsigned short emission[3];
+	unsigned short dielectric_priority;
+
+	unsigned char roughness;
+	unsigned char subsurface;
+	unsigned char metallic;
+	unsigned char specular;
+	unsigned char specular_tint;
+	unsigned char anisotropic;
+	unsigned char anisotropic_rotation;
+	unsigned char clearcoat;
+	unsigned char clearcoat_roughness;
+	unsigned char sheen;
+	unsigned char sheen_tint;
+	unsigned char specular_transmission;
+	unsigned char alpha_opacity;
+	unsigned char brdf_type;
+};
+
+#endif
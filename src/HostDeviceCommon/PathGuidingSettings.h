@@ -0,0 +1,39 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_PATH_GUIDING_SETTINGS_H
+#define HOST_DEVICE_PATH_GUIDING_SETTINGS_H
+
+#include "HostDeviceCommon/AtomicType.h"
+#include "HostDeviceCommon/Math.h"
+
+struct PathGuidingSettings
+{
+	// Bounds of the spatial grid of the guiding, the bounding box of the scene. The points
+	// outside of the grid (moving instances) use the nearest cell
+	float3 grid_min = make_float3(0.0f, 0.0f, 0.0f);
+	float3 grid_max = make_float3(1.0f, 1.0f, 1.0f);
+	// Number of cells along each axis of the grid
+	int grid_resolution = 16;
+
+	// Probability of sampling the guiding distribution instead of the BSDF at a bounce
+	float guiding_probability = 0.5f;
+	// Only the materials at least this rough are guided. The lobes of the smoother materials
+	// are sharper than the bins of the guiding distribution, the BSDF samples them better
+	float minimum_roughness = 0.1f;
+
+	// Number of samples whose paths train the guiding grid
+	int training_sample_count = 128;
+	// Whether or not the paths of the current frame train the grid. Set by the PathGuidingRenderPass
+	bool do_training = false;
+
+	// Directional histograms of the cells, accumulated by the training paths
+	AtomicType<float>* training_bins = nullptr;
+	// Normalized CDFs of the histograms of the cells, built from 'training_bins' after
+	// each training frame. All 0 for the cells that haven't received any contribution
+	float* sampling_cdfs = nullptr;
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_PIXEL_STATUS_H
+#define HOST_DEVICE_COMMON_PIXEL_STATUS_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * Sampling state of a pixel packed in 64 bits so that the kernels that need to know
+ * whether a pixel is active and how many samples it has only touch a single buffer:
+ *
+ *	- bit 0: whether the pixel is active (needs a sample this sample)
+ *	- bits [1, 24]: number of samples of the pixel (adaptive sampling)
+ *	- bits [25, 48]: number of samples at which the pixel has converged + 1, 0 if it hasn't converged yet
+ *	- bit 49: whether the pixel has fallen back from ReSTIR DI to the sampling strategy of the later bounces
+ *		for its first bounce, see ReSTIRDISettings::fallback_noise_threshold
+ *	- bits [50, 63]: unused
+ *
+ * The sum of the squared luminance of the samples of the pixel isn't packed in there: it is a
+ * sum over all the samples of the pixel which a half float can't hold precisely enough for
+ * the variance estimate of the adaptive sampling. It stays in 'AuxiliaryBuffers::pixel_squared_luminance'
+ */
+struct PixelStatus
+{
+	static constexpr unsigned int COUNT_BITS = 24;
+	// Largest sample count / converged sample count that can be stored
+	static constexpr int MAX_SAMPLE_COUNT = (1 << COUNT_BITS) - 2;
+
+	HIPRT_HOST_DEVICE bool is_active() const
+	{
+		return packed & ACTIVE_MASK;
+	}
+
+	HIPRT_HOST_DEVICE void set_active(bool active)
+	{
+		packed = (packed & ~ACTIVE_MASK) | (active ? ACTIVE_MASK : 0ull);
+	}
+
+	HIPRT_HOST_DEVICE int get_sample_count() const
+	{
+		return static_cast<int>((packed >> SAMPLE_COUNT_SHIFT) & COUNT_MASK);
+	}
+
+	HIPRT_HOST_DEVICE void set_sample_count(int sample_count)
+	{
+		unsigned long long count = static_cast<unsigned long long>(hippt::min(sample_count, MAX_SAMPLE_COUNT));
+
+		packed = (packed & ~(COUNT_MASK << SAMPLE_COUNT_SHIFT)) | (count << SAMPLE_COUNT_SHIFT);
+	}
+
+	HIPRT_HOST_DEVICE void increment_sample_count()
+	{
+		set_sample_count(get_sample_count() + 1);
+	}
+
+	/**
+	 * Returns the number of samples that were necessary for the pixel to converge
+	 * or -1 if the pixel hasn't converged yet
+	 */
+	HIPRT_HOST_DEVICE int get_converged_sample_count() const
+	{
+		return static_cast<int>((packed >> CONVERGED_SAMPLE_COUNT_SHIFT) & COUNT_MASK) - 1;
+	}
+
+	HIPRT_HOST_DEVICE bool is_converged() const
+	{
+		return get_converged_sample_count() != -1;
+	}
+
+	/**
+	 * -1 to mark the pixel as not converged
+	 */
+	HIPRT_HOST_DEVICE void set_converged_sample_count(int converged_sample_count)
+	{
+		unsigned long long count = static_cast<unsigned long long>(hippt::min(converged_sample_count, MAX_SAMPLE_COUNT) + 1);
+
+		packed = (packed & ~(COUNT_MASK << CONVERGED_SAMPLE_COUNT_SHIFT)) | (count << CONVERGED_SAMPLE_COUNT_SHIFT);
+	}
+
+	HIPRT_HOST_DEVICE bool is_ReSTIR_DI_fallback() const
+	{
+		return packed & RESTIR_DI_FALLBACK_MASK;
+	}
+
+	HIPRT_HOST_DEVICE void set_ReSTIR_DI_fallback(bool fallback)
+	{
+		packed = (packed & ~RESTIR_DI_FALLBACK_MASK) | (fallback ? RESTIR_DI_FALLBACK_MASK : 0ull);
+	}
+
+	unsigned long long packed = 0;
+
+private:
+	static constexpr unsigned long long ACTIVE_MASK = 1ull;
+	static constexpr unsigned long long RESTIR_DI_FALLBACK_MASK = 1ull << 49;
+	static constexpr unsigned long long COUNT_MASK = (1ull << COUNT_BITS) - 1;
+	static constexpr unsigned int SAMPLE_COUNT_SHIFT = 1;
+	static constexpr unsigned int CONVERGED_SAMPLE_COUNT_SHIFT = SAMPLE_COUNT_SHIFT + COUNT_BITS;
+};
+
+#endif
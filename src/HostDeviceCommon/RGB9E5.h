@@ -0,0 +1,61 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_RGB9E5_H
+#define HOST_DEVICE_COMMON_RGB9E5_H
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * Shared exponent HDR color format: 9 bits of mantissa for each of the R, G and B channels
+ * and a common 5 bits exponent, 32 bits in total per color.
+ *
+ * Reference: [EXT_texture_shared_exponent] https://registry.khronos.org/OpenGL/extensions/EXT/EXT_texture_shared_exponent.txt
+ */
+#define RGB9E5_MANTISSA_BITS 9
+#define RGB9E5_EXPONENT_BIAS 15
+#define RGB9E5_MAX_VALUE 65408.0f // (2^9 - 1) / 2^9 * 2^(31 - 15)
+
+HIPRT_HOST_DEVICE HIPRT_INLINE unsigned int rgb9e5_encode(const ColorRGB32F& color)
+{
+	float r = hippt::clamp(0.0f, RGB9E5_MAX_VALUE, color.r);
+	float g = hippt::clamp(0.0f, RGB9E5_MAX_VALUE, color.g);
+	float b = hippt::clamp(0.0f, RGB9E5_MAX_VALUE, color.b);
+	float max_channel = hippt::max(r, hippt::max(g, b));
+
+	int shared_exponent = -RGB9E5_EXPONENT_BIAS - 1;
+	if (max_channel > 0.0f)
+	{
+		int max_channel_exponent = static_cast<int>(floor(log2(max_channel)));
+		if (max_channel_exponent > shared_exponent)
+			shared_exponent = max_channel_exponent;
+	}
+	shared_exponent += 1 + RGB9E5_EXPONENT_BIAS;
+
+	float scale = ldexpf(1.0f, shared_exponent - RGB9E5_EXPONENT_BIAS - RGB9E5_MANTISSA_BITS);
+	if (static_cast<int>(floor(max_channel / scale + 0.5f)) == (1 << RGB9E5_MANTISSA_BITS))
+	{
+		// The rounding of the largest channel overflows the mantissa
+		shared_exponent++;
+		scale *= 2.0f;
+	}
+
+	unsigned int r_mantissa = static_cast<unsigned int>(floor(r / scale + 0.5f));
+	unsigned int g_mantissa = static_cast<unsigned int>(floor(g / scale + 0.5f));
+	unsigned int b_mantissa = static_cast<unsigned int>(floor(b / scale + 0.5f));
+
+	return r_mantissa | (g_mantissa << 9) | (b_mantissa << 18) | (static_cast<unsigned int>(shared_exponent) << 27);
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE ColorRGB32F rgb9e5_decode(unsigned int packed)
+{
+	int shared_exponent = static_cast<int>(packed >> 27);
+	float scale = ldexpf(1.0f, shared_exponent - RGB9E5_EXPONENT_BIAS - RGB9E5_MANTISSA_BITS);
+
+	return ColorRGB32F(static_cast<float>(packed & 0x1FF), static_cast<float>((packed >> 9) & 0x1FF), static_cast<float>((packed >> 18) & 0x1FF)) * scale;
+}
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_RADIANCE_CACHE_SETTINGS_H
+#define HOST_DEVICE_RADIANCE_CACHE_SETTINGS_H
+
+#include "HostDeviceCommon/AtomicType.h"
+#include "HostDeviceCommon/Color.h"
+
+/**
+ * Resolved radiance of an entry of the radiance cache
+ */
+struct RadianceCacheEntry
+{
+	// Average radiance reflected by the surfaces of the cell of the entry
+	ColorRGB32F radiance = ColorRGB32F(0.0f);
+	// Number of path samples averaged in 'radiance', capped at RadianceCacheSettings::max_accumulated_samples
+	float sample_count = 0.0f;
+	// Number of frames since the entry last received a sample
+	int age = 0;
+};
+
+struct RadianceCacheSettings
+{
+	// Whether or not the paths terminate into the radiance cache. Biased,
+	// meant for the interactive preview
+	bool use_radiance_cache = false;
+	// Bounce at which the paths look up the cache and terminate with the cached radiance on a hit
+	int termination_bounce = 2;
+	// Probability for the path of a pixel to not terminate into the cache but to
+	// be traced completely and to update the cache with its contribution
+	float training_path_probability = 1.0f / 16.0f;
+
+	// Size of the cells of the cache in world units
+	float cell_size = 0.05f;
+	// Number of entries of the hash table of the cache, a power of 2. Set by the RadianceCacheRenderPass
+	unsigned int entry_count = 0;
+	// The entries are only used once they have accumulated that many samples
+	int min_sample_count = 8;
+	// The entries don't average more samples than this so that they follow
+	// the changes of lighting after that many samples
+	int max_accumulated_samples = 256;
+	// The entries that haven't been updated for that many frames are evicted
+	int max_entry_age = 128;
+
+	// Checksums of the positions / normals of the entries, 0 for the empty entries
+	AtomicType<unsigned int>* keys = nullptr;
+	// Radiance (RGB) and sample count accumulated in the entries by the training paths of the current frame
+	AtomicType<float>* frame_accumulation = nullptr;
+	RadianceCacheEntry* entries = nullptr;
+};
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_RAY_STATISTICS_H
+#define HOST_DEVICE_COMMON_RAY_STATISTICS_H
+
+/**
+ * Counters of aux_buffers.ray_statistics, only allocated when
+ * render_settings.count_ray_statistics is true. See count_ray_statistic()
+ */
+enum RayStatistic
+{
+	// Rays traced by the CameraRays kernel
+	RAY_STATISTIC_CAMERA_RAYS = 0,
+	// Rays of the bounces of the paths (FullPathTracer and Extend kernel)
+	RAY_STATISTIC_INDIRECT_RAYS = 1,
+	// Visibility rays: NEE, ReSTIR visibility / shading, BSDF samples towards the lights
+	RAY_STATISTIC_SHADOW_RAYS = 2,
+	// Invocations of the alpha testing filter function by the BVH traversals
+	RAY_STATISTIC_ALPHA_TESTS = 3,
+	// Boundaries of nested dielectrics skipped by trace_ray(), each one re-traces the ray
+	RAY_STATISTIC_VOLUME_BOUNDARY_SKIPS = 4,
+	// Light candidates sampled by RIS, to compare the adaptive candidate count with the fixed one
+	RAY_STATISTIC_RIS_LIGHT_CANDIDATES = 5,
+	// Shadow rays not traced because the visibility cache saw their direction as occluded
+	RAY_STATISTIC_VISIBILITY_CACHE_SKIPPED_SHADOW_RAYS = 6,
+
+	RAY_STATISTIC_COUNT = 7,
+};
+
+/**
+ * What happened to the paths at a bounce, counted in aux_buffers.bounce_active_ray_counts
+ * when render_settings.count_bounce_active_rays is true. See count_bounce_path_event()
+ */
+enum BouncePathEvent
+{
+	// The path traced a ray at this bounce
+	BOUNCE_PATH_ALIVE = 0,
+	// The ray of the bounce didn't hit anything, the path ends into the envmap / sky
+	BOUNCE_PATH_MISSED = 1,
+	// The path hit a surface but ended there: russian roulette or invalid BSDF sample
+	BOUNCE_PATH_ABSORBED = 2,
+
+	BOUNCE_PATH_EVENT_COUNT = 3,
+};
+
+#endif
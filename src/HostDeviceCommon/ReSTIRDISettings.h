@@ -6,7 +6,10 @@
 #ifndef HOST_DEVICE_RESTIR_DI_SETTINGS_H
 #define HOST_DEVICE_RESTIR_DI_SETTINGS_H
 
-struct ReSTIRDIReservoir;
+#include "HostDeviceCommon/AtomicType.h"
+#include "HostDeviceCommon/Math.h"
+
+struct ReSTIRDIPackedReservoir;
 struct ReSTIRDIPresampledLight;
 
 struct InitialCandidatesSettings
@@ -19,9 +22,18 @@ struct InitialCandidatesSettings
 	// will sample the envmap instead of a light in the scene
 	float envmap_candidate_probability = 0.25f;
 
+	// If true, the initial candidates are sampled by the camera rays kernel right after the tracing
+	// of the camera ray (ReSTIR_DI_CameraRaysInitialCandidates), on the first hit kept in registers,
+	// instead of reading it back from the G-buffer in a separate kernel.
+	// Not used when rendering at low resolution
+	bool fuse_with_camera_rays = false;
+	// Set by the CPU each frame: seed of the initial candidates of the fused camera rays
+	// kernel, which cannot use the seed of the camera rays
+	unsigned int random_seed = 42;
+
 	// Buffer that contains the reservoirs that will hold the reservoir
 	// for the initial candidates generated
-	ReSTIRDIReservoir* output_reservoirs = nullptr;
+	ReSTIRDIPackedReservoir* output_reservoirs = nullptr;
 };
 
 struct TemporalPassSettings
@@ -47,9 +59,9 @@ struct TemporalPassSettings
 
 	// The temporal reuse pass resamples the initial candidates as well as the last frame reservoirs which
 	// are accessed through this pointer
-	ReSTIRDIReservoir* input_reservoirs = nullptr;
+	ReSTIRDIPackedReservoir* input_reservoirs = nullptr;
 	// Buffer that holds the output of the temporal reuse pass
-	ReSTIRDIReservoir* output_reservoirs = nullptr;
+	ReSTIRDIPackedReservoir* output_reservoirs = nullptr;
 };
 
 struct SpatialPassSettings
@@ -76,6 +88,14 @@ struct SpatialPassSettings
 	// This reduces the increased variance of disoccluded regions
 	int disocclusion_reuse_count = 5;
 
+	// If true, the number of reused neighbors of each pixel goes from 'reuse_neighbor_count' for the
+	// pixels with no history down to 'adaptive_min_neighbor_count' for the pixels whose reservoir
+	// reached the M-cap: the reservoirs with a long history are already well converged and don't need
+	// as many neighbors. The disocclusion boost still applies to the pixels without history.
+	// Not used if ReSTIRDISettings::m_cap is 0
+	bool do_adaptive_neighbor_count = false;
+	int adaptive_min_neighbor_count = 1;
+
 	// If true, reused neighbors will be hardcoded to always be 15 pixels to the right,
 	// not in a circle around the center pixel.
 	bool debug_neighbor_location = false;
@@ -100,14 +120,47 @@ struct SpatialPassSettings
 	// 'neighbor_visibility_count' neighbors, not all.
 	int neighbor_visibility_count = DO_DISOCCLUSION_BOOST ? disocclusion_reuse_count : reuse_neighbor_count;
 
+	// If ReSTIRDISettings::do_checkerboard is true, the parity of the pixels that were written
+	// in 'input_reservoirs': the spatial neighbors are snapped onto these pixels.
+	// Set by the CPU for each spatial pass
+	int input_checkerboard_parity = 0;
+
 	// Buffer that contains the input reservoirs for the spatial reuse pass
-	ReSTIRDIReservoir* input_reservoirs = nullptr;
+	ReSTIRDIPackedReservoir* input_reservoirs = nullptr;
 	// Buffer that contains the output reservoir of the spatial reuse pass
-	ReSTIRDIReservoir* output_reservoirs = nullptr;
+	ReSTIRDIPackedReservoir* output_reservoirs = nullptr;
 };
 
 struct LightPresamplingSettings
 {
+	/**
+	 * Sizes 'number_of_subsets' and 'subset_size' from the scene and the resolution if 'auto_size' is true.
+	 *
+	 * A subset doesn't need more slots than there are lights to sample (but the envmap has no "light count"
+	 * and gets a minimum number of slots). There should be enough subsets that neighboring tiles rarely read the
+	 * same one (that's visible as blocky correlations), one subset per 256 tiles is about 128 subsets at 1080p
+	 */
+	HIPRT_HOST_DEVICE void update_auto_size(int emissive_triangles_count, bool envmap_sampled, int2 render_resolution)
+	{
+		if (!auto_size)
+			return;
+
+		int light_count = emissive_triangles_count;
+		if (envmap_sampled && light_count < 256)
+			light_count = 256;
+		// Multiple of 32 to keep the presampling launch free of idle threads
+		subset_size = (light_count + 31) / 32 * 32;
+		subset_size = subset_size < 32 ? 32 : (subset_size > 1024 ? 1024 : subset_size);
+
+		int tile_count = ((render_resolution.x + tile_size - 1) / tile_size) * ((render_resolution.y + tile_size - 1) / tile_size);
+		number_of_subsets = tile_count / 256;
+		number_of_subsets = number_of_subsets < 16 ? 16 : (number_of_subsets > 256 ? 256 : number_of_subsets);
+	}
+
+	// If true, 'number_of_subsets' and 'subset_size' are computed by update_auto_size()
+	// instead of being set by the user
+	bool auto_size = true;
+
 	// From all the lights of the scene, how many subsets to presample
 	int number_of_subsets = 128;
 	// How many lights to presample in each subset
@@ -115,8 +168,35 @@ struct LightPresamplingSettings
 	// All threads in a tile_size * tile_size block of pixels will sample from the same subset of light samples
 	int tile_size = 8;
 
+	// If true, the light candidates of RIS (LSS_RIS_BSDF_AND_LIGHT and the later bounces
+	// of ReSTIR DI with RESTIR_DI_LATER_BOUNCES_RIS_BSDF_AND_LIGHT) are also taken from the
+	// presampled subsets instead of the whole list of emissive triangles of the scene.
+	// The presampling pass then also runs without ReSTIR DI
+	bool use_for_RIS_light_candidates = false;
+	// Probability that a presampled light is an emissive triangle and not the envmap.
+	// Set by the presampling pass, the RIS light candidates skip the envmap samples
+	float emissive_triangle_probability = 1.0f;
+
 	// Buffer for the presampled light samples
-	ReSTIRDIPresampledLight* light_samples;
+	ReSTIRDIPresampledLight* light_samples = nullptr;
+};
+
+struct VisibilityRaysSettings
+{
+	// How many visibility rays the last pass queued. Reset
+	// to 0 by the CPU once the rays have been traced
+	AtomicType<unsigned int>* ray_count = nullptr;
+
+	// One slot per pixel, only the first 'ray_count' slots are used.
+	// 'pixel_indices' is the pixel whose reservoir queued the ray
+	int* pixel_indices = nullptr;
+	float3* ray_origins = nullptr;
+	float3* ray_directions = nullptr;
+	float* ray_distances = nullptr;
+
+	// Output reservoirs of the pass that queued the rays. The visibility rays
+	// kernel discards the occluded ones and marks the others as unoccluded
+	ReSTIRDIPackedReservoir* reservoirs = nullptr;
 };
 
 struct ReSTIRDISettings
@@ -129,6 +209,8 @@ struct ReSTIRDISettings
 	SpatialPassSettings spatial_pass;
 	// Settings for the light presampling pass
 	LightPresamplingSettings light_presampling;
+	// Queue of the visibility reuse rays if ReSTIR_DI_BatchedVisibilityRays is true
+	VisibilityRaysSettings visibility_rays;
 
 	// If true, the spatial and temporal pass will be fused into a single kernel call.
 	// This avois a synchronization barrier between the temporal pass and the spatial pass
@@ -138,6 +220,26 @@ struct ReSTIRDISettings
 	// (which is the output of the temporal pass). This is usually imperceptible.
 	bool do_fused_spatiotemporal = true;
 
+	// If true, the ReSTIR DI passes only run on half of the pixels each frame, in a checkerboard
+	// pattern that alternates every frame. The other pixels reuse the reservoir of their most similar
+	// direct neighbor (according to the G-buffer) for the final shading.
+	bool do_checkerboard = false;
+	// Set by the CPU each frame: the pixels with (x + y) % 2 == checkerboard_parity
+	// run the ReSTIR DI passes this frame
+	int checkerboard_parity = 0;
+
+	// If > 0, the pixels whose noise (same estimate as the adaptive sampling, relative to the luminance
+	// of the pixel) goes below this threshold after 'adaptive_sampling_min_samples' samples stop running
+	// the ReSTIR DI passes and use ReSTIR_DI_LaterBouncesSamplingStrategy for their first bounce too.
+	// This should be larger than the noise threshold of the adaptive sampling: the pixels spend their
+	// remaining samples until convergence with the cheaper strategy.
+	//
+	// A pixel that has fallen back stays so until the render is reset. Its neighbors don't reuse it
+	// in the spatial reuse since its reservoir isn't updated anymore.
+	// Needs the adaptive sampling or the pixel stop noise threshold for the noise estimate.
+	// Not used with the tile-based adaptive sampling
+	float fallback_noise_threshold = 0.0f;
+
 	// When finalizing the reservoir in the spatial reuse pass, what value
 	// to cap the reservoirs's M value to.
 	//
@@ -191,7 +293,7 @@ struct ReSTIRDISettings
 	// 
 	// This is handy to remember which buffer the temporal reuse pass is going to use
 	// as input on the next frame
-	ReSTIRDIReservoir* restir_output_reservoirs;
+	ReSTIRDIPackedReservoir* restir_output_reservoirs;
 };
 
 #endif
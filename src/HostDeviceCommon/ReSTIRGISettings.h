@@ -0,0 +1,64 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_RESTIR_GI_SETTINGS_H
+#define HOST_DEVICE_RESTIR_GI_SETTINGS_H
+
+struct ReSTIRGIReservoir;
+
+struct ReSTIRGIInitialCandidatesSettings
+{
+	// Buffer filled by the path tracer with one initial candidate per pixel: the
+	// second vertex of the path and the radiance that it scatters towards the first vertex
+	ReSTIRGIReservoir* output_reservoirs = nullptr;
+};
+
+struct ReSTIRGITemporalPassSettings
+{
+	bool do_temporal_reuse_pass = true;
+
+	// Last frame's output reservoirs, nullptr if they cannot be reused
+	// (the buffer was overwritten by this frame's initial candidates)
+	ReSTIRGIReservoir* input_reservoirs = nullptr;
+	ReSTIRGIReservoir* output_reservoirs = nullptr;
+};
+
+struct ReSTIRGISpatialPassSettings
+{
+	bool do_spatial_reuse_pass = true;
+
+	// The radius within which neighbor are going to be reused spatially
+	int reuse_radius = 20;
+	// How many neighbors to reuse during the spatial pass
+	int reuse_neighbor_count = 4;
+
+	ReSTIRGIReservoir* input_reservoirs = nullptr;
+	ReSTIRGIReservoir* output_reservoirs = nullptr;
+};
+
+struct ReSTIRGISettings
+{
+	ReSTIRGIInitialCandidatesSettings initial_candidates;
+	ReSTIRGITemporalPassSettings temporal_pass;
+	ReSTIRGISpatialPassSettings spatial_pass;
+
+	// M-cap of the temporal and spatial reuse, see ReSTIRDISettings::m_cap
+	int m_cap = 20;
+
+	// Neighbors whose sample would be shifted to the center pixel with a jacobian determinant
+	// above this value (or below its inverse) are not reused. Reusing the samples of these neighbors
+	// produces fireflies because the sample is so much farther / more grazing from the center pixel
+	float jacobian_rejection_threshold = 10.0f;
+
+	// Whether or not to trace a visibility ray from the visible point to the resampled
+	// sample point when shading. Without it, indirect lighting leaks through thin walls
+	bool do_final_shading_visibility = true;
+
+	// Buffer of the reservoirs output by the last pass of this frame, shaded by the
+	// ReSTIR GI shading pass and reused temporally by the next frame
+	ReSTIRGIReservoir* restir_output_reservoirs = nullptr;
+};
+
+#endif
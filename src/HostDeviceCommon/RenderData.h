@@ -7,27 +7,27 @@
 #define HOST_DEVICE_COMMON_RENDER_DATA_H
 
 #include "Device/includes/ReSTIR/DI/Reservoir.h"
+#include "Device/includes/ReSTIR/GI/Reservoir.h"
 #include "Device/includes/GBuffer.h"
+#include "Device/includes/WavefrontQueues.h"
 
+#include "HostDeviceCommon/AtomicType.h"
 #include "HostDeviceCommon/HIPRTCamera.h"
+#include "HostDeviceCommon/LightBVHNode.h"
+#include "HostDeviceCommon/LightClusters.h"
 #include "HostDeviceCommon/Material.h"
 #include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/MeshVertexAttributes.h"
+#include "HostDeviceCommon/PackedMaterial.h"
+#include "HostDeviceCommon/PixelStatus.h"
 #include "HostDeviceCommon/RenderSettings.h"
+#include "HostDeviceCommon/SceneInstance.h"
+#include "HostDeviceCommon/VirtualTexturing.h"
 #include "HostDeviceCommon/WorldSettings.h"
 
 #include <hiprt/hiprt_device.h>
 #include <Orochi/Orochi.h>
 
-#ifdef __KERNELCC__
-template <typename T>
-using AtomicType = T;
-#else
-#include <atomic>
-
-template <typename T>
-using AtomicType = std::atomic<T>;
-#endif
-
 struct RenderBuffers
 {
 	// Sum of samples color per pixel. Should not be
@@ -36,43 +36,121 @@ struct RenderBuffers
 
 	// A device pointer to the buffer of triangles vertex indices
 	// triangles_indices[0], triangles_indices[1] and triangles_indices[2]
-	// represent the indices of the vertices of the first triangle for example
+	// represent the indices of the vertices of the first triangle for example.
+	// 
+	// The triangles of all the meshes of the scene are in this buffer, see SceneInstance
 	int* triangles_indices = nullptr;
-	// A device pointer to the buffer of triangle vertices positions
+	// A device pointer to the buffer of triangle vertices positions.
+	// The positions are in the object space of the mesh of the vertex
 	float3* vertices_positions = nullptr;
-	// A device pointer to a buffer filled with 0s and 1s that
-	// indicates whether or not a vertex normal is available for
-	// the given vertex index
-	unsigned char* has_vertex_normals = nullptr;
-	// The smooth normal at each vertex of the scene
-	// Needs to be indexed by a vertex index
-	float3* vertex_normals = nullptr;
-	// Texture coordinates at each vertices
+	// If not null, the positions are read from these quantized positions (3x16 bits per vertex,
+	// see quantize_vertex_position()) instead and 'vertices_positions' is null
+	unsigned short* quantized_vertices_positions = nullptr;
+	// Ranges of the vertex attributes of each mesh in the buffers below, indexed by SceneInstance::mesh_index.
+	// The buffers below are thus not indexed by a vertex index directly, see Device/includes/VertexAttributes.h
+	MeshVertexAttributes* mesh_vertex_attributes = nullptr;
+	// Object space smooth normals of the vertices of the meshes that have vertex normals. Octahedral 2x16 bits,
+	// see octahedral_encode_32()
+	unsigned int* vertex_normals = nullptr;
+	// Texture coordinates of the vertices of the meshes that have texture coordinates.
+	// Only one of the two buffers is set: 'texcoords_half' (two half floats, see texcoords_half_encode())
+	// if the texture coordinates are quantized, 'texcoords' otherwise
 	float2* texcoords = nullptr;
+	unsigned int* texcoords_half = nullptr;
 
-	// Index of the material used by each triangle of the scene
+	// Index of the material used by each triangle of the meshes of the scene
 	int* material_indices = nullptr;
+	// Opacity of each triangle of the meshes for the alpha test, 2 bits per triangle,
+	// see HostDeviceCommon/TriangleOpacity.h. nullptr if the triangles weren't classified
+	unsigned char* triangle_opacities = nullptr;
+	// For the triangles of opacity TRIANGLE_OPACITY_MICROMAP, index of their opacity micromap in 'opacity_micromaps'
+	// (OPACITY_MICROMAP_BYTE_SIZE bytes per micromap). -1 for the other triangles
+	int* triangle_opacity_micromap_indices = nullptr;
+	unsigned char* opacity_micromaps = nullptr;
+	// Average luminance of the emission texture under each triangle of the meshes, see EmissiveTextureIntegrator.
+	// nullptr if no material has an emission texture
+	float* triangle_emission_texture_luminances = nullptr;
+
+	// Instances of the meshes of the scene, sorted by increasing 'first_scene_primitive'
+	SceneInstance* instances = nullptr;
+	int instance_count = 0;
+	// Analytic spheres of the scene: center in xyz, radius in w. Intersected by intersect_sphere().
+	// All the spheres are in a single instance of the BVH, after the instances of the meshes: the sphere
+	// 'hit.primID' of the instance 'sphere_instance_index' (-1 if there's no sphere). That instance isn't in 'instances'.
+	//
+	// The material of the sphere i is at 'material_indices[sphere_first_primitive + i]', after the triangles
+	float4* spheres = nullptr;
+	int sphere_instance_index = -1;
+	int sphere_first_primitive = 0;
 	// Materials array to be indexed by an index retrieved from the 
-	// material_indices array
-	RendererMaterial* materials_buffer = nullptr;
+	// material_indices array. Unpacked by get_intersection_material()
+	PackedRendererMaterial* materials_buffer = nullptr;
 	int emissive_triangles_count = 0;
+	// Scene primitive indices (see SceneInstance) of the emissive triangles, sorted
 	int* emissive_triangles_indices = nullptr;
+	// Alias table for sampling the emissive triangles 'emissive_triangles_indices'
+	// proportionally to their power (EmissiveTrianglesSamplingStrategy == ETSS_POWER_ALIAS_TABLE)
+	float* emissive_triangles_alias_table_probas = nullptr;
+	int* emissive_triangles_alias_table_alias = nullptr;
+	// Sum of the power (area * luminance of the emission, see get_emissive_triangle_power_luminance())
+	// of all the emissive triangles
+	float emissive_triangles_total_power = 0.0f;
+	// Nodes of the light hierarchy built over the emissive triangles. Root at index 0
+	LightBVHNode* light_bvh_nodes = nullptr;
+	// Index of the leaf of the light hierarchy that contains the emissive triangle
+	// 'emissive_triangles_indices[i]'. Used to evaluate the PDF of sampling a given
+	// emissive triangle with the light hierarchy
+	int* light_bvh_leaf_indices = nullptr;
+	// Per-cell light lists of the ETSS_LIGHT_CLUSTERS strategy
+	LightClustersGrid light_clusters;
 
-	// A pointer either to an array of Image8Bit or to an array of
+	// A pointer either to an array of TiledTexture or to an array of
 	// oroTextureObject_t whether if CPU or GPU rendering respectively
 	// This pointer can be cast for the textures to be be retrieved.
 	void* material_textures = nullptr;
 	// Widths of the textures. Necessary for using texel coordinates in [0, width - 1]
 	// in the shader (required because Orochi doesn't support normalized texture coordinates).
 	int2* textures_dims = nullptr;
+	// Levels 1 and beyond of the mip chains of the material textures (level 0 is in
+	// 'material_textures'), as oroTextureObject_t. GPU only, nullptr on the CPU
+	void* material_textures_mips = nullptr;
+	// For each material texture, the index in 'material_textures_mips' of its level 1 (x)
+	// and its number of levels without level 0 (y)
+	int2* material_textures_mip_ranges = nullptr;
+	// If true, the sRGB textures of 'material_textures' and 'material_textures_mips' (the base color
+	// textures) are stored already converted to linear and are sampled without any conversion.
+	// GPU only, see SceneParserOptions::linearize_srgb_textures
+	bool linearized_srgb_textures = false;
+	// If the scene was loaded with virtual texturing, the material textures are sampled from
+	// these buffers instead of 'material_textures'. GPU only, see VirtualTextureStreamer
+	VirtualTexturingBuffers virtual_textures;
 };
 
 struct AuxiliaryBuffers
 {
-	// Whether or not the pixel at a given index in the buffer is active or not. A pixel can be
-	// inactive when we're rendering at low resolution for example or when adaptive sampling has
-	// judged that the pixel was converged enough and doesn't need more samples
-	unsigned char* pixel_active = nullptr;
+	// Whether or not the pixel at a given index in the buffer is active or not, its sample count
+	// and the sample count at which it has converged, see PixelStatus.
+	//
+	// A pixel can be inactive when we're rendering at low resolution for example or when adaptive
+	// sampling has judged that the pixel was converged enough and doesn't need more samples.
+	//
+	// The sample count (useful when doing adaptive sampling where each pixel can have a different number of samples)
+	// and the converged sample count are only maintained when the adaptive sampling buffers are available
+	// (see HIPRTRenderSettings::has_access_to_adaptive_sampling_buffers())
+	PixelStatus* pixel_status = nullptr;
+	// Only filled when render_settings.launch_over_active_pixels is true, by the ActivePixelCompaction kernel.
+	// Indices (x + y * width) of the pixels that need a sample this sample, in no particular order.
+	// 'active_pixel_counters[0]' is the number of pixels in the list and 'active_pixel_counters[1]'
+	// the next index of the list to be traced by the FullPathTracerPersistent kernel
+	unsigned int* active_pixel_indices = nullptr;
+	AtomicType<unsigned int>* active_pixel_counters = nullptr;
+	// Only allocated when render_settings.count_bounce_active_rays is true.
+	// 'nb_bounces' * BOUNCE_PATH_EVENT_COUNT counters: number of paths alive / missed / absorbed
+	// at each bounce, index 'bounce * BOUNCE_PATH_EVENT_COUNT + event'. See count_bounce_path_event()
+	AtomicType<unsigned int>* bounce_active_ray_counts = nullptr;
+	// Only allocated when render_settings.count_ray_statistics is true.
+	// RAY_STATISTIC_COUNT counters of the frame, see RayStatistic and count_ray_statistic()
+	AtomicType<unsigned int>* ray_statistics = nullptr;
 
 	// World space normals for the denoiser
 	// These normals should already be divided by the number of samples
@@ -82,9 +160,11 @@ struct AuxiliaryBuffers
 	// The albedo should already be divided by the number of samples
 	ColorRGB32F* denoiser_albedo = nullptr;
 
-	// Per pixel sample count. Useful when doing adaptive sampling
-	// where each pixel can have a different number of sample
-	int* pixel_sample_count = nullptr;
+	// Only allocated when the kernels are compiled with PackedDenoiserAOVs.
+	// RGB9E5 albedo and octahedral normals (see Device/includes/DenoiserAOVs.h) in which
+	// the AOVs are accumulated. Unpacked to 'denoiser_albedo' and 'denoiser_normals' once per frame
+	unsigned int* packed_denoiser_albedo = nullptr;
+	unsigned int* packed_denoiser_normals = nullptr;
 
 	// Per pixel sum of squared luminance of samples. Used for adaptive sampling
 	// This buffer should not be pre-divided by the number of samples
@@ -93,7 +173,11 @@ struct AuxiliaryBuffers
 	// If a given pixel has converged, this buffer contains the number of samples
 	// that were necessary for the convergence. 
 	// 
-	// If the pixel hasn't converged yet, the buffer contains the -1 value
+	// If the pixel hasn't converged yet, the buffer contains the -1 value.
+	//
+	// This is only a copy of the converged sample count of 'pixel_status' for the display of the
+	// adaptive sampling heatmap, written whenever the converged sample count of a pixel changes.
+	// The kernels read the converged sample count from 'pixel_status'
 	int * pixel_converged_sample_count = nullptr;
 
 	// A single boolean (contained in a buffer, hence the pointer) 
@@ -102,6 +186,22 @@ struct AuxiliaryBuffers
 	// isn't standard
 	unsigned char* still_one_ray_active = nullptr;
 
+	// Luminance accumulated from every other sample of each pixel, see accumulate_adaptive_sampling_buffers().
+	// Only allocated when render_settings.adaptive_sampling_tile_based is true
+	float* pixel_half_luminance = nullptr;
+
+	// Average color of the pixels of the last render (before the last reset), in the view of
+	// the previous camera. Filled by the CameraRays kernel on the first sample after a reset
+	// and read by the TemporalReprojection kernel.
+	// Only allocated when render_settings.enable_temporal_reprojection is true
+	ColorRGB32F* temporal_reprojection_history = nullptr;
+
+	// Full resolution image of the last upscaled frame and of the current one, swapped between
+	// frames by the renderer. See render_settings.use_temporal_upscaling.
+	// Only allocated when the temporal upscaling is used
+	ColorRGB32F* temporal_upscaling_history = nullptr;
+	ColorRGB32F* temporal_upscaling_output = nullptr;
+
 	// If render_settings.stop_pixel_noise_threshold > 0.0f, this buffer
 	// (consisting of a single unsigned int) counts how many pixels have reached the
 	// noise threshold. If this value is equal to the number of pixels of the
@@ -109,15 +209,26 @@ struct AuxiliaryBuffers
 	// noise threshold.
 	AtomicType<unsigned int>* stop_noise_threshold_converged_count = nullptr;
 
+	// Clock cycles spent by each pixel in the camera rays (x), ReSTIR passes (y), traversal of the
+	// bounce rays of the path tracer (z) and the rest of the path tracer (w), summed over the samples
+	// of the render, see PixelCostCategory.
+	// Only allocated when the kernels are compiled with PixelCostInstrumentation
+	float4* pixel_costs = nullptr;
+
 	// Pointers to the buffers allocated on the GPU. These pointers
 	// exist basically only to be reset in reset_render(). They should not
 	// be manipulated directly in the ReSTIR passes. 
 	// The buffers that should be used by the ReSTIR passes kernels are the 
 	// 'input_reservoirs' / 'output_reservoirs' buffers of the 'initial_candidates',
 	// 'temporal_pass' and 'spatial_pass' settings
-	ReSTIRDIReservoir* restir_reservoir_buffer_1 = nullptr;
-	ReSTIRDIReservoir* restir_reservoir_buffer_2 = nullptr;
-	ReSTIRDIReservoir* restir_reservoir_buffer_3 = nullptr;
+	ReSTIRDIPackedReservoir* restir_reservoir_buffer_1 = nullptr;
+	ReSTIRDIPackedReservoir* restir_reservoir_buffer_2 = nullptr;
+	ReSTIRDIPackedReservoir* restir_reservoir_buffer_3 = nullptr;
+
+	// Same as above for the ReSTIR GI buffers, nullptr if ReSTIR GI isn't used
+	ReSTIRGIReservoir* restir_gi_reservoir_buffer_1 = nullptr;
+	ReSTIRGIReservoir* restir_gi_reservoir_buffer_2 = nullptr;
+	ReSTIRGIReservoir* restir_gi_reservoir_buffer_3 = nullptr;
 };
 
 /**
@@ -142,8 +253,8 @@ struct HIPRTRenderData
 	// random seed on the GPU for the random number generator to get started
 	unsigned int random_seed = 42;
 
-	// GPU BVH
-	hiprtGeometry geom = nullptr;
+	// GPU BVH: top level over the instances of the meshes of the scene
+	hiprtScene geom = nullptr;
 	// GPU Intersection functions (for alpha testing for example)
 	hiprtFuncTable func_table = nullptr;
 
@@ -155,6 +266,9 @@ struct HIPRTRenderData
 	AuxiliaryBuffers aux_buffers;
 	GBuffer g_buffer;
 	GBuffer g_buffer_prev_frame;
+	// Queues used by the kernels of the wavefront path tracer.
+	// Only allocated if render_settings.use_wavefront_path_tracing is true
+	WavefrontQueues wavefront_queues;
 
 	HIPRTRenderSettings render_settings;
 	WorldSettings world_settings;
@@ -164,8 +278,98 @@ struct HIPRTRenderData
 	// Camera of the last frame
 	HIPRTCamera prev_camera;
 
+	// Cameras of the views rendered together in the same launches, see GPURenderer::set_views().
+	// nullptr if only 'current_camera' is rendered.
+	//
+	// The views are stacked vertically in the buffers: the 'view_pixel_count' pixels
+	// of view 0 come first, then those of view 1, ...
+	HIPRTCamera* views = nullptr;
+	int view_count = 1;
+	int view_pixel_count = 0;
+
+	// Batched material previews, see GPURenderer::set_material_previews(): the camera rays of the view 'i'
+	// that hit the material 'material_preview_target_index' see the material 'material_preview_first_index + i'
+	// of 'buffers.materials_buffer' instead. -1 if no material previews are rendered
+	int material_preview_target_index = -1;
+	int material_preview_first_index = 0;
+
+	/**
+	 * Index of the view the pixel belongs to, see 'views'
+	 */
+	HIPRT_HOST_DEVICE int get_view_index(uint32_t pixel_index) const
+	{
+		if (views == nullptr)
+			return 0;
+
+		// The rows left over at the bottom of the image if the render height isn't a multiple
+		// of the view count are rendered with the last view
+		int view_index = pixel_index / view_pixel_count;
+
+		return view_index < view_count ? view_index : view_count - 1;
+	}
+
+	/**
+	 * Camera of the view the pixel belongs to. This is the camera the first hits of the G-buffer
+	 * of that pixel are relative to
+	 */
+	HIPRT_HOST_DEVICE const HIPRTCamera& get_camera(uint32_t pixel_index) const
+	{
+		if (views == nullptr)
+			return current_camera;
+
+		return views[get_view_index(pixel_index)];
+	}
+
+	/**
+	 * Resolution of one view for the render resolution 'res'
+	 */
+	HIPRT_HOST_DEVICE int2 get_view_resolution(int2 res) const
+	{
+		if (views == nullptr)
+			return res;
+
+		return make_int2(res.x, res.y / view_count);
+	}
+
 	// Data only used by the CPU
 	CPUData cpu_only;
 };
 
+/**
+ * The fields of HIPRTRenderData that change every sample. They are passed to the kernels
+ * separately from the rest of the render data when the render data is resident in
+ * device memory (UseDeviceResidentRenderData, see Device/includes/KernelRenderData.h)
+ */
+struct HIPRTPerSampleData
+{
+	unsigned int random_seed = 0;
+
+	int sample_number = 0;
+	int denoiser_AOV_accumulation_counter = 0;
+
+	bool need_to_reset = false;
+	bool do_update_status_buffers = false;
+};
+
+HIPRT_HOST_DEVICE HIPRT_INLINE HIPRTPerSampleData get_per_sample_data(const HIPRTRenderData& render_data)
+{
+	HIPRTPerSampleData per_sample_data;
+	per_sample_data.random_seed = render_data.random_seed;
+	per_sample_data.sample_number = render_data.render_settings.sample_number;
+	per_sample_data.denoiser_AOV_accumulation_counter = render_data.render_settings.denoiser_AOV_accumulation_counter;
+	per_sample_data.need_to_reset = render_data.render_settings.need_to_reset;
+	per_sample_data.do_update_status_buffers = render_data.render_settings.do_update_status_buffers;
+
+	return per_sample_data;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void set_per_sample_data(HIPRTRenderData& render_data, const HIPRTPerSampleData& per_sample_data)
+{
+	render_data.random_seed = per_sample_data.random_seed;
+	render_data.render_settings.sample_number = per_sample_data.sample_number;
+	render_data.render_settings.denoiser_AOV_accumulation_counter = per_sample_data.denoiser_AOV_accumulation_counter;
+	render_data.render_settings.need_to_reset = per_sample_data.need_to_reset;
+	render_data.render_settings.do_update_status_buffers = per_sample_data.do_update_status_buffers;
+}
+
 #endif
@@ -10,12 +10,16 @@
 #ifndef __KERNELCC__
 HIPRT_HOST bool HIPRTRenderSettings::use_prev_frame_g_buffer(GPURenderer* renderer) const
 {
-	// If ReSTIR DI isn't used, we don't need the last frame's g-buffer
+	// If neither ReSTIR DI nor ReSTIR GI are used, we don't need the last frame's g-buffer
 	// (as far as the codebase goes at the time of writing this function anyways)
 	bool need_g_buffer = renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) == LSS_RESTIR_DI;
 	// If the temporal reuse isn't used, don't need the G-buffer
 	need_g_buffer &= restir_di_settings.temporal_pass.do_temporal_reuse_pass;
 
-	return need_g_buffer;
+	bool need_g_buffer_gi = renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_RESTIR_GI;
+	need_g_buffer_gi &= restir_gi_settings.temporal_pass.do_temporal_reuse_pass;
+
+	// The temporal reprojection checks the disocclusions against the previous first hits
+	return need_g_buffer || need_g_buffer_gi || enable_temporal_reprojection;
 }
 #endif
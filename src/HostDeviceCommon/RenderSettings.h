@@ -7,12 +7,27 @@
 #define HOST_DEVICE_COMMON_RENDER_SETTINGS_H
 
 #include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/PathGuidingSettings.h"
+#include "HostDeviceCommon/RadianceCacheSettings.h"
 #include "HostDeviceCommon/ReSTIRDISettings.h"
+#include "HostDeviceCommon/ReSTIRGISettings.h"
+#include "HostDeviceCommon/VisibilityCacheSettings.h"
 
 #include <hiprt/hiprt_common.h>
 
 class GPURenderer;
 
+/**
+ * Values of the option macros that can be toggled without recompiling the kernels.
+ * Only read by the kernels compiled with the runtime branches (see Device/includes/RuntimeOptions.h),
+ * kept in sync with the global kernel options by the GPURenderer
+ */
+struct RuntimeKernelOptions
+{
+	int envmap_sampling_do_bsdf_mis = KERNEL_OPTION_TRUE;
+	int restir_di_do_visibility_reuse = KERNEL_OPTION_TRUE;
+};
+
 struct RISSettings
 {
 	// How many candidate lights to sample for RIS (Resampled Importance Sampling)
@@ -20,6 +35,17 @@ struct RISSettings
 	// How many candidates samples from the BSDF to use in combination
 	// with the light candidates for RIS
 	int number_of_bsdf_candidates = 1;
+
+	// If true, the number of light candidates of each hit is scaled down on the near-specular
+	// surfaces where the BSDF candidates find the lights much more efficiently than light sampling.
+	// See compute_RIS_light_candidate_count()
+	bool adapt_light_candidates_to_roughness = false;
+	// Roughness below which a specular lobe only gets 'minimum_light_candidates'.
+	// The light candidates grow linearly up to number_of_light_candidates from there to
+	// twice that roughness
+	float adaptive_candidates_specular_roughness = 0.1f;
+	// Light candidates of the hits on near-specular surfaces
+	int minimum_light_candidates = 1;
 };
 
 struct HIPRTRenderSettings
@@ -73,13 +99,83 @@ struct HIPRTRenderSettings
 	// 1 is direct light only.
 	int nb_bounces = 2;
 
+	// If true, paths are randomly terminated after 'russian_roulette_min_bounce' bounces
+	// with a probability that increases as their throughput decreases. See russian_roulette_terminate()
+	bool do_russian_roulette = false;
+	// First bounce where the russian roulette can terminate paths. At least 1
+	int russian_roulette_min_bounce = 3;
+	// Paths always survive the russian roulette with at least this probability. Too low a value
+	// terminates too many paths that would still bring light to the pixel and increases variance
+	float russian_roulette_min_survival_probability = 0.1f;
+
+	// First bounce where the materials use the simplified Lambertian + GGX BSDF instead of their own BSDF.
+	// Only used if DeepBouncesSimplifiedBSDF is KERNEL_OPTION_TRUE. See use_simplified_bsdf()
+	int simplified_bsdf_start_bounce = 3;
+
+	// Maximum distance of the rays of the bounces after the first hit. The surfaces further away than that
+	// aren't hit: the ray misses. The distance is multiplied by 'indirect_rays_max_distance_bounce_factor'
+	// at each bounce after the first one. 0.0f to disable. See get_indirect_ray_max_distance()
+	float indirect_rays_max_distance = 0.0f;
+	float indirect_rays_max_distance_bounce_factor = 1.0f;
+	// First bounce whose rays, and the shadow rays of the hits of that bounce, are traced against the coarser secondary
+	// levels of detail of the meshes. The rays of the bounces before use the levels selected by distance to the camera.
+	// Only has an effect if the meshes of the scene have LODs, see HostDeviceCommon/GeometryLOD.h
+	int geometry_lod_secondary_bounce = 1;
+	// The shadow rays of the light samples further away than this distance are randomly not traced with a
+	// probability that increases with the distance and the light samples that survive are weighted accordingly
+	// so this doesn't bias the render. 0.0f to disable. See shadow_ray_distance_roulette()
+	float shadow_rays_roulette_distance = 0.0f;
+	// The light samples always survive the shadow rays distance roulette with at least this probability
+	float shadow_rays_roulette_min_survival_probability = 0.05f;
+	// If true, the number of paths alive, missed and absorbed at each bounce of the last sample of
+	// each frame is counted and displayed in the UI. Quantifies how much work the russian roulette saves
+	bool count_bounce_active_rays = false;
+	// If true, the camera / indirect / shadow rays, the alpha tests and the nested dielectrics
+	// boundaries skipped by all the samples of each frame are counted, see RayStatistic
+	bool count_ray_statistics = false;
+
+	// If true, the path tracing pass is executed by the wavefront path tracer
+	// (separate extend / shade / shadow rays / accumulate kernels operating on
+	// ray queues) instead of the FullPathTracer megakernel
+	bool use_wavefront_path_tracing = false;
+	// If true (and using the wavefront path tracer), the hits are sorted by material
+	// index before the shade kernel of each bounce (except the first one whose hits are
+	// coherent already) so that the threads of a warp evaluate the same BSDF
+	bool wavefront_material_sort = false;
+	// If true (and using the wavefront path tracer), the rays are sorted by direction octant and
+	// by the Morton code of their origin before the extend kernel of each bounce (except the first
+	// one which doesn't trace any ray) so that the threads of a warp traverse the same parts of the BVH
+	bool wavefront_ray_sort = false;
+	// If true (and not using the wavefront path tracer), the path tracing pass is executed by the
+	// persistent threads variant of the megakernel (FullPathTracerPersistent) which only launches
+	// enough threads to fill the GPU and distributes the active pixels of the sample between them
+	bool use_persistent_threads_path_tracing = false;
+	// If true, the pixels that need a sample are compacted in a list at the beginning of each sample
+	// (ActivePixelCompaction kernel) and the camera rays, ReSTIR and megakernel path tracing kernels are
+	// launched over that list instead of over the whole image. Saves the cost of the threads of the pixels
+	// converged by the adaptive sampling. Always done with the persistent threads path tracing
+	bool compact_active_pixels = false;
+	// Set by the renderer: true if the kernels of this sample are launched over the active pixel list.
+	// See get_thread_pixel()
+	bool launch_over_active_pixels = false;
+	// If true, the samples of a frame (after the first one) are submitted as a single HIP/CUDA
+	// graph instead of launching each of their kernels. Saves the CPU cost of the launches, which
+	// dominates at low resolution with many samples per frame. See OrochiKernelGraph.
+	// The per-kernel timings are then only those of the first sample of each frame
+	bool use_sample_graph = false;
+	// If true, the passes of a frame that don't depend on each other are launched on two streams
+	// so that they overlap: the lights presampling of ReSTIR DI / RIS runs alongside the camera rays and
+	// the path guiding build / radiance cache resolve run alongside the temporal upscaling at the end of the frame.
+	// See OrochiStreamScheduler. The lights presampling stays on the main stream with the sample graph
+	bool use_multiple_streams = false;
+
 	// Whether or not to "freeze" random number generation so that each frame uses
 	// exactly the same random number. This allows every ray to follow the exact
 	// same path every frame, allowing for more stable benchmarking.
 	int freeze_random = false;
 
 	// If true, NaNs encountered during rendering will be rendered as very bright pink. 
-	// Useful for debugging only.
+	// Useful for debugging only. Only used if the kernels are compiled with KernelDiagnostics.
 	bool display_NaNs = false;
 
 	// If true, then rendering at low resolution will be performed if 'wants_render_low_resolution'
@@ -99,6 +195,52 @@ struct HIPRTRenderSettings
 	// How to divide the render resolution by when rendering at low resolution
 	// (when interacting with the camera)
 	int render_low_resolution_scaling = 2;
+	// Maximum number of bounces of the paths when rendering at low resolution
+	int render_low_resolution_max_bounces = 3;
+	// If true, the low resolution frames are upscaled to the full resolution by the TemporalUpscaling
+	// kernel instead of being displayed with one pixel per block of render_low_resolution_scaling^2 pixels.
+	//
+	// The pixel of each block that is rendered changes every frame (temporal_upscaling_jitter) and the
+	// full resolution image of the last frame is reprojected in the current view, clamped to the colors
+	// of the neighborhood of the current low resolution samples and blended with them
+	bool use_temporal_upscaling = false;
+	// Weight of the current low resolution sample of a pixel in the blend with the history
+	float temporal_upscaling_current_weight = 0.15f;
+	// Pixel of each block rendered this frame, set by the renderer. (0, 0) if the temporal upscaling isn't used
+	int2 temporal_upscaling_jitter = make_int2(0, 0);
+	// False if the last frame wasn't upscaled at the same resolution, set by the renderer
+	bool temporal_upscaling_history_valid = false;
+
+	// If true, only the pixels in the region of interest [region_of_interest_min, region_of_interest_max[
+	// (in pixels of the render resolution) are sampled every sample. The pixels outside of the region
+	// are only sampled once every 'region_of_interest_outside_sample_interval' samples so that
+	// most of the sample budget goes into the region of interest.
+	//
+	// The region of interest can be moved during the render without resetting the accumulation.
+	// It is ignored when the adaptive sampling or the pixel noise threshold is used
+	bool enable_region_of_interest = false;
+	int2 region_of_interest_min = make_int2(0, 0);
+	int2 region_of_interest_max = make_int2(0, 0);
+	int region_of_interest_outside_sample_interval = 8;
+
+	// If true, the accumulated color of the render isn't thrown away when the render is reset
+	// (when the camera moves for example): the first sample after the reset is blended with
+	// the average color of the last render, reprojected in the new view by the TemporalReprojection kernel.
+	// The pixels whose reprojection is disoccluded (the plane distance or normal similarity between the
+	// current and previous first hits don't match) only keep the new sample.
+	//
+	// The render isn't rendered at low resolution when interacting if this is enabled
+	bool enable_temporal_reprojection = false;
+	// Weight of the reprojected history in the first sample after a reset. While the camera keeps moving,
+	// the image is an exponential moving average of the samples with that weight
+	float temporal_reprojection_history_weight = 0.85f;
+	// Maximum distance between the current first hit of a pixel and the plane of its reprojected first hit
+	float temporal_reprojection_plane_distance_threshold = 0.1f;
+	// Minimum cosine between the current and reprojected shading normals
+	float temporal_reprojection_normal_similarity_threshold = 0.9f;
+	// Number of samples accumulated in the framebuffer before the last reset, set by the renderer.
+	// 0 if there's no usable history (the last render was at low resolution or has been resized, ...)
+	int temporal_reprojection_history_sample_count = 0;
 
 	bool enable_adaptive_sampling = false;
 	// How many samples before the adaptive sampling actually kicks in.
@@ -108,6 +250,29 @@ struct HIPRTRenderSettings
 	int adaptive_sampling_min_samples = 96;
 	// Adaptive sampling noise threshold
 	float adaptive_sampling_noise_threshold = 0.4f;
+	// If true, the convergence of adaptive sampling is decided per tile of ADAPTIVE_SAMPLING_TILE_SIZE x ADAPTIVE_SAMPLING_TILE_SIZE
+	// pixels instead of per pixel: the error of a tile is the difference between the image and the image of every
+	// other sample of the pixels (half buffer), see the AdaptiveSamplingTileError kernel. This estimate is
+	// much less noisy than the variance of a single pixel so the tiles can converge after fewer samples
+	bool adaptive_sampling_tile_based = false;
+	// Samples of the pixels of a tile before its error is evaluated
+	int adaptive_sampling_tile_min_samples = 16;
+	// A tile has converged when its relative error (mean difference between the image and the half buffer
+	// over the mean luminance) and the relative error of each of its quadrants is below this threshold
+	float adaptive_sampling_tile_error_threshold = 0.02f;
+	// If true, the per pixel confidence interval of the adaptive sampling is weighted by the
+	// sensitivity of the eye to the noise at the tonemapped luminance of the pixel: the noise of very dark
+	// and very bright (saturated after tonemapping) pixels isn't visible so these pixels converge earlier.
+	// See get_perceptual_sensitivity()
+	bool adaptive_sampling_perceptual = false;
+	// Minimum sensitivity of the perceptual adaptive sampling. The threshold of a pixel is at most
+	// 1 / adaptive_sampling_perceptual_min_sensitivity times the noise threshold so that the
+	// black and white pixels still converge at some point
+	float adaptive_sampling_perceptual_min_sensitivity = 0.1f;
+	// Tonemapping of the display, used by the perceptual adaptive sampling.
+	// Synchronized with the post-processing settings of the application
+	float adaptive_sampling_perceptual_gamma = 2.2f;
+	float adaptive_sampling_perceptual_exposure = 1.8f;
 
 	// If true, the rendering will stop after a certain proportion (defined by 'stop_pixel_percentage_converged')
 	// of pixels of the image have converged. "converged" here is defined according to the adaptive sampling if
@@ -142,12 +307,32 @@ struct HIPRTRenderSettings
 	// Whether or not to do alpha testing for geometry with transparent base color textures
 	bool do_alpha_testing = true;
 
+	// If true and the camera doesn't jitter its rays, the camera rays are only traced by the first samples
+	// after a reset (a camera or scene change resets the render). The following samples reuse the first hits
+	// already in the G-buffer: no traversal and no material evaluation for the camera rays.
+	// The stochastic alpha test of the first hits is the one of the first sample
+	bool reuse_primary_hits = false;
+
 	// Settings for RIS (direct light sampling)
 	RISSettings ris_settings;
 
 	// Settings for ReSTIR DI
 	ReSTIRDISettings restir_di_settings;
 
+	// Settings for ReSTIR GI, only used if IndirectLightSamplingStrategy is ILS_RESTIR_GI
+	ReSTIRGISettings restir_gi_settings;
+
+	// Settings for the path guiding, only used if IndirectLightSamplingStrategy is ILS_PATH_GUIDING
+	PathGuidingSettings path_guiding_settings;
+
+	// Settings for the world space radiance cache that the paths of the megakernel path tracer can terminate into
+	RadianceCacheSettings radiance_cache_settings;
+
+	// Settings for the world space cache of the visibility of the envmap and of the lights
+	VisibilityCacheSettings visibility_cache_settings;
+
+	RuntimeKernelOptions runtime_kernel_options;
+
 	/**
 	 * Returns true if the current frame should be renderer at low resolution, false otherwise.
 	 * 
@@ -156,7 +341,24 @@ struct HIPRTRenderSettings
 	 */
 	HIPRT_HOST_DEVICE bool do_render_low_resolution() const
 	{
-		return wants_render_low_resolution && allow_render_low_resolution && accumulate;
+		return wants_render_low_resolution && allow_render_low_resolution && accumulate && !enable_temporal_reprojection;
+	}
+
+	/**
+	 * Size of the 2D grid of threads of the per pixel kernels (camera rays, ReSTIR, path tracing).
+	 * 
+	 * When rendering at low resolution, only one pixel per block of render_low_resolution_scaling^2
+	 * pixels is rendered: the kernels are only launched over the low resolution pixels, stored in the
+	 * top left corner of the buffers. The camera rays map their thread back to the full resolution
+	 * pixel whose ray they trace (see get_thread_camera_ray_pixel())
+	 */
+	HIPRT_HOST_DEVICE int2 get_pixel_launch_resolution(int2 render_resolution) const
+	{
+		if (!do_render_low_resolution())
+			return render_resolution;
+
+		return make_int2((render_resolution.x + render_low_resolution_scaling - 1) / render_low_resolution_scaling,
+						 (render_resolution.y + render_low_resolution_scaling - 1) / render_low_resolution_scaling);
 	}
 
 	/**
@@ -198,13 +400,17 @@ struct HIPRTRenderSettings
 	 */
 	HIPRT_DEVICE bool use_prev_frame_g_buffer() const
 	{
-		// If ReSTIR DI isn't used, we don't need the last frame's g-buffer
+		// If neither ReSTIR DI nor ReSTIR GI are used, we don't need the last frame's g-buffer
 		// (as far as the codebase goes at the time of writing this function anyways)
 		bool need_g_buffer = DirectLightSamplingStrategy == LSS_RESTIR_DI;
 		// If the temporal reuse isn't used, don't need the G-buffer
 		need_g_buffer &= restir_di_settings.temporal_pass.do_temporal_reuse_pass;
 
-		return need_g_buffer;
+		bool need_g_buffer_gi = IndirectLightSamplingStrategy == ILS_RESTIR_GI;
+		need_g_buffer_gi &= restir_gi_settings.temporal_pass.do_temporal_reuse_pass;
+
+		// The temporal reprojection checks the disocclusions against the previous first hits
+		return need_g_buffer || need_g_buffer_gi || enable_temporal_reprojection;
 	}
 
 	// Only need this one on the host
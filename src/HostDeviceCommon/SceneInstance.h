@@ -0,0 +1,36 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_SCENE_INSTANCE_H
+#define HOST_DEVICE_COMMON_SCENE_INSTANCE_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * Instance of a mesh in the scene.
+ *
+ * The triangles of all the meshes of the scene are stored one after the other in the
+ * triangle buffers of the scene (triangles_indices, material_indices, ...), in the object
+ * space of their mesh. An instance places the triangles
+ * [mesh_first_triangle, mesh_first_triangle + triangle_count[ in the world.
+ *
+ * The "scene primitives" are the triangles of all the instances, instance after instance.
+ * The scene primitive 'first_scene_primitive + i' is the triangle 'mesh_first_triangle + i'
+ * placed in the world by this instance. Scene primitive indices are used wherever a triangle
+ * needs to be identified in world space: the emissive triangles, the light samples of ReSTIR, ...
+ */
+struct SceneInstance
+{
+	float4x4 object_to_world;
+	// Inverse transpose of 'object_to_world' for transforming normals
+	float4x4 normal_to_world;
+
+	int mesh_index = -1;
+	int mesh_first_triangle = 0;
+	int triangle_count = 0;
+	int first_scene_primitive = 0;
+};
+
+#endif
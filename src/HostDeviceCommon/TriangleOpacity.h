@@ -0,0 +1,86 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_TRIANGLE_OPACITY_H
+#define HOST_DEVICE_COMMON_TRIANGLE_OPACITY_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * Opacity of a triangle of the meshes of the scene for the alpha test, computed at load time by
+ * TriangleOpacityClassifier from the alpha of its material and from the alpha of the base color
+ * texture under its UVs.
+ *
+ * The opacities are stored on 2 bits, 4 triangles per byte: bits [2 * (i % 4), 2 * (i % 4) + 1]
+ * of byte i / 4 for the triangle i
+ */
+#define TRIANGLE_OPACITY_NEEDS_TEST 0
+// The alpha test of every point of the triangle passes, the hit is always kept
+#define TRIANGLE_OPACITY_OPAQUE 1
+// The alpha test of every point of the triangle fails, the hit is always filtered out
+#define TRIANGLE_OPACITY_TRANSPARENT 2
+// The opacity depends on the point of the triangle that is hit: the opacity micromap of the triangle gives
+// the opacity of the hit, TRIANGLE_OPACITY_NEEDS_TEST / OPAQUE / TRANSPARENT, before falling back to the texture
+#define TRIANGLE_OPACITY_MICROMAP 3
+
+/**
+ * An opacity micromap subdivides a triangle into 4^OPACITY_MICROMAP_SUBDIVISION_LEVEL micro-triangles whose
+ * opacities are stored on 2 bits, the same way as the opacities of the triangles.
+ *
+ * The barycentric triangle (the 'uv' of the hits) is cut into OPACITY_MICROMAP_SEGMENT_COUNT rows along v.
+ * The row j holds the 2 * (OPACITY_MICROMAP_SEGMENT_COUNT - j) - 1 micro-triangles between v = j / N and
+ * v = (j + 1) / N, alternating "upward" micro-triangles (2i) and "downward" micro-triangles (2i + 1) along u
+ */
+#define OPACITY_MICROMAP_SUBDIVISION_LEVEL 3
+#define OPACITY_MICROMAP_SEGMENT_COUNT (1 << OPACITY_MICROMAP_SUBDIVISION_LEVEL)
+#define OPACITY_MICROMAP_MICRO_TRIANGLE_COUNT (OPACITY_MICROMAP_SEGMENT_COUNT * OPACITY_MICROMAP_SEGMENT_COUNT)
+#define OPACITY_MICROMAP_BYTE_SIZE (OPACITY_MICROMAP_MICRO_TRIANGLE_COUNT / 4)
+
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_triangle_opacity(const unsigned char* triangle_opacities, int mesh_triangle_index)
+{
+	if (triangle_opacities == nullptr)
+		return TRIANGLE_OPACITY_NEEDS_TEST;
+
+	return (triangle_opacities[mesh_triangle_index >> 2] >> ((mesh_triangle_index & 3) * 2)) & 3;
+}
+
+HIPRT_HOST_DEVICE HIPRT_INLINE void set_triangle_opacity(unsigned char* triangle_opacities, int mesh_triangle_index, int opacity)
+{
+	int shift = (mesh_triangle_index & 3) * 2;
+
+	triangle_opacities[mesh_triangle_index >> 2] = (triangle_opacities[mesh_triangle_index >> 2] & ~(3 << shift)) | (opacity << shift);
+}
+
+/**
+ * Index of the micro-triangle of an opacity micromap that contains the barycentric coordinates 'uv'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_opacity_micromap_micro_triangle(float2 uv)
+{
+	constexpr int N = OPACITY_MICROMAP_SEGMENT_COUNT;
+
+	float u = uv.x * N;
+	float v = uv.y * N;
+	int i = static_cast<int>(u);
+	int j = static_cast<int>(v);
+	// For the hits on the edges of the triangle
+	i = i < 0 ? 0 : (i > N - 1 ? N - 1 : i);
+	j = j < 0 ? 0 : (j > N - 1 ? N - 1 : j);
+	i = i + j > N - 1 ? N - 1 - j : i;
+
+	bool downward = i + j < N - 1 && (u - i) + (v - j) > 1.0f;
+
+	// j * (2N - j) micro-triangles in the rows before the row j
+	return j * (2 * N - j) + 2 * i + (downward ? 1 : 0);
+}
+
+/**
+ * Opacity of the micro-triangle hit at 'uv' in the opacity micromap 'micromap_index' of 'opacity_micromaps'
+ */
+HIPRT_HOST_DEVICE HIPRT_INLINE int get_opacity_micromap_opacity(const unsigned char* opacity_micromaps, int micromap_index, float2 uv)
+{
+	return get_triangle_opacity(opacity_micromaps + micromap_index * OPACITY_MICROMAP_BYTE_SIZE, get_opacity_micromap_micro_triangle(uv));
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_COMMON_VIRTUAL_TEXTURING_H
+#define HOST_DEVICE_COMMON_VIRTUAL_TEXTURING_H
+
+#include "HostDeviceCommon/Math.h"
+
+/**
+ * Maximum number of mip levels of a virtual texture. Enough for 32768x32768 textures
+ */
+#define VIRTUAL_TEXTURE_MAX_LEVELS 16
+
+/**
+ * Tiles (pages) of virtual textures. Each tile holds TILE_SIZE * TILE_SIZE texels of a mip
+ * level of a texture plus a border column on the right and a border row on the top that
+ * duplicate the first texels of the neighboring tiles (wrapped around the texture). The border makes
+ * bilinear filtering possible without reading another tile.
+ *
+ * Texels are RGBA8 packed in an unsigned int, R in the lowest byte.
+ * Missing channels of the texture (1 or 2 channels textures) are 0 and alpha is 255
+ */
+struct VirtualTextureTile
+{
+	static constexpr int TILE_SIZE = 128;
+	static constexpr int TILE_STRIDE = TILE_SIZE + 1;
+
+	unsigned int texels[TILE_STRIDE * TILE_STRIDE];
+};
+
+/**
+ * Layout of the tiles of a virtual texture in the page table.
+ *
+ * The mip chain of a virtual texture stops at the first level that fits in a single tile:
+ * this "tail" tile is always resident so that there is always something to sample
+ */
+struct VirtualTextureDesc
+{
+	// Dimensions of the level 0
+	int2 dims = { 0, 0 };
+	int level_count = 0;
+	// Page of the first tile (first texels of the first row) of each mip level.
+	// The tiles of a level are stored row by row
+	int first_pages[VIRTUAL_TEXTURE_MAX_LEVELS];
+};
+
+struct VirtualTexturingBuffers
+{
+	// One per material texture. nullptr if the material textures
+	// aren't virtual textures (the default)
+	VirtualTextureDesc* textures = nullptr;
+	// Index in 'tile_pool' of each page, -1 if the page isn't resident
+	int* page_table = nullptr;
+	// Set to 1 for every page sampled by the shaders (resident or not). Read back
+	// and cleared by the host to know which tiles to stream in and which tiles are still in use
+	unsigned char* feedback = nullptr;
+	// Resident tiles
+	VirtualTextureTile* tile_pool = nullptr;
+};
+
+#endif
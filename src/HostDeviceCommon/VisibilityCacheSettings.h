@@ -0,0 +1,51 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef HOST_DEVICE_VISIBILITY_CACHE_SETTINGS_H
+#define HOST_DEVICE_VISIBILITY_CACHE_SETTINGS_H
+
+#include "HostDeviceCommon/AtomicType.h"
+
+struct VisibilityCacheSettings
+{
+	// Whether or not the shadow rays of the envmap and of the RIS light sampling train the visibility
+	// cache and whether or not these samplers favor the directions that the cache sees as visible
+	bool use_visibility_cache = false;
+	// If true, the shadow rays towards the directions that the cache confidently sees as
+	// occluded are not traced and the samples are considered occluded. Biased, meant
+	// for the interactive preview
+	bool skip_occluded_shadow_rays = false;
+	// A direction of a cell is confidently occluded if less than that fraction of its
+	// shadow rays were unoccluded...
+	float occluded_threshold = 0.05f;
+	// ... over at least that many shadow rays
+	int min_sample_count = 32;
+	// Probability to still trace the shadow rays of the confidently occluded directions so that
+	// the cache notices when they become visible
+	float occluded_retest_probability = 1.0f / 16.0f;
+
+	// The estimated visibility of a direction is clamped to this minimum when the samplers weight
+	// the directions with it so that the directions wrongly seen as occluded are still sampled
+	float min_sampling_weight = 0.1f;
+	// Number of envmap candidates that the envmap sampling resamples one direction from with
+	// the visibility of the cache, see sample_environment_map_visibility_RIS()
+	int envmap_candidates = 4;
+
+	// Size of the cells of the cache in world units
+	float cell_size = 0.05f;
+	// Number of entries of the hash table of the cache, a power of 2. Set by the VisibilityCacheRenderPass
+	unsigned int entry_count = 0;
+	// The directions of the entries don't count more shadow rays than this so that
+	// they follow the changes of the scene after that many shadow rays
+	int max_accumulated_samples = 256;
+
+	// Checksums of the positions / normals of the entries, 0 for the empty entries
+	AtomicType<unsigned int>* keys = nullptr;
+	// VISIBILITY_CACHE_BIN_COUNT counters per entry: the number of unoccluded shadow
+	// rays in the 16 high bits and the number of shadow rays in the 16 low bits
+	AtomicType<unsigned int>* bins = nullptr;
+};
+
+#endif
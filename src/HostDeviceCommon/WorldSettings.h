@@ -7,6 +7,7 @@
 #define HOST_DEVICE_COMMON_WORLD_SETTINGS_H
 
 #include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/EnvmapPortal.h"
 
 enum AmbientLightType
 {
@@ -31,24 +32,61 @@ struct WorldSettings
 	// become completely white and blown out.
 	int envmap_scale_background_intensity = false;
 	// This void pointer is a either a float* for the CPU
-	// or a oroTextureObject_t for the GPU.
+	// or a oroTextureObject_t for the GPU (an unsigned int* of RGB9E5
+	// texels if EnvmapStorageFormat is ESF_RGB9E5, a float* of RGB
+	// texels if EnvmapStorageFormat is ESF_RGB32F).
 	// Proper reinterpreting of the pointer is done in the kernel.
 	void* envmap = nullptr;
 
-	// Luminance sum of all the texels of the envmap
+	// Resolution of the importance map of the envmap that the sampling data structures (CDF,
+	// alias table, ...) are built on. The envmap resolution divided by RendererEnvmap::sampling_downscale
+	unsigned int envmap_sampling_width = 0, envmap_sampling_height = 0;
+	// Luminance of the texels of the importance map if it is downscaled, for the PDFs.
+	// nullptr if the importance map is the envmap itself, the luminance is then the one of the envmap texels
+	float* envmap_sampling_luminance = nullptr;
+
+	// Luminance sum of all the texels of the importance map of the envmap
 	float envmap_total_sum = 0.0f;
 
 	// Cumulative distribution function. 1D float array of length width * height for
 	// importance sampling the envmap with a binary search strategy
 	float* envmap_cdf = nullptr;
 
+	// Marginal and conditional CDFs for importance sampling the envmap with the marginal/conditional strategy.
+	// 'envmap_marginal_cdf' is of length height and is the CDF of the luminance sums of the rows
+	// of the envmap. 'envmap_conditional_cdfs' is of length width * height and contains the
+	// (non-normalized) CDF of the luminance of the texels of each row
+	float* envmap_marginal_cdf = nullptr;
+	float* envmap_conditional_cdfs = nullptr;
+
 	// Probabilities and aliases for sampling the envmap with the alias table strategy
 	int* alias_table_alias = nullptr;
 	float* alias_table_probas = nullptr;
+	// Probabilities of the alias table as 16-bit unsigned normalized integers, used
+	// instead of 'alias_table_probas' if EnvmapCompactAliasTable is true
+	unsigned short* alias_table_probas_16bit = nullptr;
+
+	// Luminance pyramid of the envmap for the product sampling strategy (ESS_PRODUCT_SAMPLING).
+	// Level l is a (2^(l+1)) * 2^l grid of cells over the UVs of the envmap, stored after the
+	// levels before it. The cells of the last level ('envmap_luminance_pyramid_leaf_level') hold
+	// the average luminance of their texels times the sine of their theta, each cell of the other
+	// levels is the sum of its 4 children
+	float* envmap_luminance_pyramid = nullptr;
+	int envmap_luminance_pyramid_leaf_level = 0;
+	// How many levels of the luminance pyramid, from the root, are warped by the product of
+	// the luminance and of the BSDF approximation. The finer levels only follow the luminance
+	int envmap_product_sampling_lobe_levels = 6;
 
 	// Rotation matrix for rotating the envmap around in the current frame
 	float4x4 envmap_to_world_matrix = float4x4{ { {1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 0.0f, 1.0f } } };
 	float4x4 world_to_envmap_matrix = float4x4{ { {1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 0.0f, 1.0f } } };
+
+	// Portals of the scene that the envmap lighting comes through (windows of an interior).
+	// If there are any, the envmap is sampled through the portals with a probability of
+	// 'envmap_portal_sampling_probability' and by luminance otherwise
+	EnvmapPortal* envmap_portals = nullptr;
+	int envmap_portal_count = 0;
+	float envmap_portal_sampling_probability = 0.5f;
 };
 
 #endif
@@ -8,8 +8,16 @@
 
 #include <hiprt/hiprt_device.h>
 
+#include "HostDeviceCommon/KernelOptions.h"
+#include "HostDeviceCommon/LowDiscrepancy.h"
 #include "HostDeviceCommon/Math.h"
 
+#include "Device/includes/Hash.h"
+
+// Number of dimensions of the low discrepancy sequence given to each block of
+// dimensions (camera ray, each bounce, ...), see Xorshift32Generator::set_dimension_block()
+#define SAMPLER_DIMENSIONS_PER_BLOCK 16
+
 struct Xorshift32State {
     unsigned int seed = 42;
 };
@@ -34,6 +42,11 @@ struct Xorshift32Generator
      */
     HIPRT_HOST_DEVICE int random_index(int array_size)
     {
+#if PathSampler != PATH_SAMPLER_XORSHIFT32
+        if (m_ld_dimension < m_ld_dimension_end)
+            return hippt::min(static_cast<int>((*this)() * array_size), array_size - 1);
+#endif
+
         int random_num = xorshift32() / static_cast<float>(XORSHIFT_MAX) * array_size;
         return hippt::min(random_num, array_size - 1);
     }
@@ -43,6 +56,11 @@ struct Xorshift32Generator
      */
     HIPRT_HOST_DEVICE float operator()()
     {
+#if PathSampler != PATH_SAMPLER_XORSHIFT32
+        if (m_ld_dimension < m_ld_dimension_end)
+            return low_discrepancy_sample(m_ld_dimension++);
+#endif
+
         //Float in [0, 1[
         float a = xorshift32() / static_cast<float>(XORSHIFT_MAX);
         return hippt::min(a, 1.0f - 1.0e-7f);
@@ -61,6 +79,70 @@ struct Xorshift32Generator
         return m_state.seed = x;
     }
 
+    /**
+     * Makes the generator return the samples of the low discrepancy sequence of PathSampler
+     * for the pixel (x, y) and the sample 'sample_index' of that pixel, from the dimension block
+     * given to set_dimension_block().
+     * 
+     * Does nothing if PathSampler is PATH_SAMPLER_XORSHIFT32. Generators that are never
+     * initialized this way (ReSTIR passes, wavefront path tracer, ...) stay white noise
+     */
+    HIPRT_HOST_DEVICE void init_low_discrepancy(unsigned int x, unsigned int y, unsigned int sample_index)
+    {
+#if PathSampler == PATH_SAMPLER_SOBOL_OWEN
+        m_ld_sample_index = sample_index;
+        // Decorrelating the pixels
+        m_ld_seed = wang_hash(hash_combine(x + 1, y + 1));
+#elif PathSampler == PATH_SAMPLER_BLUE_NOISE_RANK1
+        m_ld_sample_index = sample_index;
+        // Same rotations of the dimensions for all pixels, the pixels are
+        // decorrelated by the blue noise offset
+        m_ld_seed = 42;
+        m_ld_pixel_offset = blue_noise_pixel_offset(x, y);
+#else
+        (void)x;
+        (void)y;
+        (void)sample_index;
+#endif
+    }
+
+    /**
+     * The next samples of the generator are the SAMPLER_DIMENSIONS_PER_BLOCK dimensions
+     * of the block 'block' of the low discrepancy sequence (the first camera ray is block 0 and
+     * bounce N is block N + 1) so that the same decisions of the paths (light choice, BSDF lobe, ...)
+     * are made with the same dimensions at all samples. The generator goes back to white noise
+     * if more samples than that are needed in the block
+     */
+    HIPRT_HOST_DEVICE void set_dimension_block(unsigned int block)
+    {
+#if PathSampler != PATH_SAMPLER_XORSHIFT32
+        m_ld_dimension = block * SAMPLER_DIMENSIONS_PER_BLOCK;
+        m_ld_dimension_end = m_ld_dimension + SAMPLER_DIMENSIONS_PER_BLOCK;
+#else
+        (void)block;
+#endif
+    }
+
+#if PathSampler != PATH_SAMPLER_XORSHIFT32
+    HIPRT_HOST_DEVICE float low_discrepancy_sample(unsigned int dimension)
+    {
+#if PathSampler == PATH_SAMPLER_SOBOL_OWEN
+        float sample = owen_scrambled_sobol(m_ld_sample_index, dimension, m_ld_seed);
+#else
+        float sample = blue_noise_rank1_lattice(m_ld_sample_index, dimension, m_ld_pixel_offset, m_ld_seed);
+#endif
+
+        return hippt::min(sample, 1.0f - 1.0e-7f);
+    }
+
+    unsigned int m_ld_sample_index = 0;
+    unsigned int m_ld_seed = 0;
+    unsigned int m_ld_pixel_offset = 0;
+    // The generator returns white noise while 'm_ld_dimension' >= 'm_ld_dimension_end'
+    unsigned int m_ld_dimension = 0;
+    unsigned int m_ld_dimension_end = 0;
+#endif
+
     Xorshift32State m_state;
 };
 
@@ -0,0 +1,395 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Image/EXRReader.h"
+#include "Image/EXRWriter.h"
+#include "Image/Image.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include "glm/gtc/packing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+extern ImGuiLogger g_imgui_logger;
+
+// Pixel types of the channels of the file format, same as in EXRWriter.cpp
+#define EXR_PIXEL_TYPE_UINT 0
+#define EXR_PIXEL_TYPE_HALF 1
+#define EXR_PIXEL_TYPE_FLOAT 2
+
+// Compressions of the file format that can be read. EXR_COMPRESSION_NONE and EXR_COMPRESSION_RLE
+// come from EXRWriter.h. ZIPS compresses the scanlines one by one with zlib, ZIP 16 by 16
+#define EXR_COMPRESSION_ZIPS 2
+#define EXR_COMPRESSION_ZIP 3
+
+// Version flags of the file format
+#define EXR_VERSION_FLAG_TILED 0x200
+#define EXR_VERSION_FLAG_DEEP 0x800
+#define EXR_VERSION_FLAG_MULTIPART 0x1000
+
+struct EXRReadChannel
+{
+    std::string name;
+    int pixel_type;
+    // Offset of the values of the channel in a scanline of the image, in bytes per pixel
+    int scanline_offset;
+};
+
+/**
+ * Reads a little endian value of the file (as all the platforms the renderer runs on), false if the end of the data is reached
+ */
+template <typename T>
+static bool read_value(const std::vector<unsigned char>& data, size_t& position, T& out_value)
+{
+    if (position + sizeof(T) > data.size())
+        return false;
+
+    std::memcpy(&out_value, data.data() + position, sizeof(T));
+    position += sizeof(T);
+
+    return true;
+}
+
+static bool read_string(const std::vector<unsigned char>& data, size_t& position, std::string& out_string)
+{
+    const unsigned char* end = std::find(data.data() + position, data.data() + data.size(), '\0');
+    if (end == data.data() + data.size())
+        return false;
+
+    out_string.assign(reinterpret_cast<const char*>(data.data() + position), end - (data.data() + position));
+    position += out_string.size() + 1;
+
+    return true;
+}
+
+static bool parse_channel_list(const std::vector<unsigned char>& data, size_t position, size_t end, std::vector<EXRReadChannel>& out_channels)
+{
+    int scanline_offset = 0;
+    while (position < end && data[position] != '\0')
+    {
+        EXRReadChannel channel;
+        int pixel_type, linear_and_reserved, x_sampling, y_sampling;
+        if (!read_string(data, position, channel.name) || !read_value(data, position, pixel_type) || !read_value(data, position, linear_and_reserved)
+            || !read_value(data, position, x_sampling) || !read_value(data, position, y_sampling))
+            return false;
+
+        if (pixel_type < EXR_PIXEL_TYPE_UINT || pixel_type > EXR_PIXEL_TYPE_FLOAT || x_sampling != 1 || y_sampling != 1)
+            // Subsampled channels aren't supported
+            return false;
+
+        channel.pixel_type = pixel_type;
+        channel.scanline_offset = scanline_offset;
+        scanline_offset += pixel_type == EXR_PIXEL_TYPE_HALF ? 2 : 4;
+
+        out_channels.push_back(channel);
+    }
+
+    return !out_channels.empty();
+}
+
+static float read_channel_value(const unsigned char* value, int pixel_type)
+{
+    if (pixel_type == EXR_PIXEL_TYPE_HALF)
+    {
+        uint16_t half;
+        std::memcpy(&half, value, sizeof(half));
+
+        return glm::unpackHalf1x16(half);
+    }
+    else if (pixel_type == EXR_PIXEL_TYPE_FLOAT)
+    {
+        float float_value;
+        std::memcpy(&float_value, value, sizeof(float_value));
+
+        return float_value;
+    }
+    else
+    {
+        uint32_t uint_value;
+        std::memcpy(&uint_value, value, sizeof(uint_value));
+
+        return static_cast<float>(uint_value);
+    }
+}
+
+/**
+ * Inverse of rle_compress() of EXRWriter.cpp. Returns false if 'compressed' doesn't decompress to exactly 'out_size' bytes
+ */
+static bool rle_decompress(const unsigned char* compressed, size_t compressed_size, unsigned char* out_data, size_t out_size)
+{
+    size_t read = 0;
+    size_t written = 0;
+    while (read < compressed_size)
+    {
+        int count = static_cast<signed char>(compressed[read++]);
+        if (count < 0)
+        {
+            // -count literal bytes
+            size_t literal_count = -count;
+            if (read + literal_count > compressed_size || written + literal_count > out_size)
+                return false;
+
+            std::memcpy(out_data + written, compressed + read, literal_count);
+            read += literal_count;
+            written += literal_count;
+        }
+        else
+        {
+            // count + 1 copies of the next byte
+            size_t run_length = count + 1;
+            if (read >= compressed_size || written + run_length > out_size)
+                return false;
+
+            std::memset(out_data + written, compressed[read++], run_length);
+            written += run_length;
+        }
+    }
+
+    return written == out_size;
+}
+
+/**
+ * Inverse of the predictor and reordering of compress_scanline() of EXRWriter.cpp, that
+ * the RLE and ZIP compressions both apply to the data before compressing it
+ */
+static void undo_predictor_and_reorder(std::vector<unsigned char>& data, std::vector<unsigned char>& out_data)
+{
+    for (size_t i = 1; i < data.size(); i++)
+        data[i] = static_cast<unsigned char>(data[i - 1] + data[i] - 128);
+
+    size_t half_size = (data.size() + 1) / 2;
+    for (size_t i = 0; i < data.size(); i++)
+        out_data[i] = data[i % 2 == 0 ? i / 2 : half_size + i / 2];
+}
+
+bool read_image_exr(const std::string& filepath, int output_channels, bool flipY, Image32Bit& out_image)
+{
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not open the EXR file \"%s\".", filepath.c_str());
+
+        return false;
+    }
+
+    std::streamsize file_size = file.tellg();
+    std::vector<unsigned char> data(static_cast<size_t>(std::max<std::streamsize>(file_size, 0)));
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char*>(data.data()), data.size());
+
+    size_t position = 0;
+    int magic_number, version;
+    if (!read_value(data, position, magic_number) || !read_value(data, position, version) || magic_number != 20000630)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "\"%s\" isn't an EXR file.", filepath.c_str());
+
+        return false;
+    }
+    else if (version & (EXR_VERSION_FLAG_TILED | EXR_VERSION_FLAG_DEEP | EXR_VERSION_FLAG_MULTIPART))
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The EXR file \"%s\" is tiled, deep or multipart, only single part scanline EXR files are supported.", filepath.c_str());
+
+        return false;
+    }
+
+    std::vector<EXRReadChannel> channels;
+    int compression = -1;
+    int data_window[4] = { 0, 0, -1, -1 };
+    bool header_valid = true;
+    while (true)
+    {
+        std::string attribute_name, attribute_type;
+        int attribute_size;
+        if (!read_string(data, position, attribute_name))
+        {
+            header_valid = false;
+            break;
+        }
+        else if (attribute_name.empty())
+            // End of the header
+            break;
+
+        if (!read_string(data, position, attribute_type) || !read_value(data, position, attribute_size) || attribute_size < 0 || position + attribute_size > data.size())
+        {
+            header_valid = false;
+            break;
+        }
+
+        if (attribute_name == "channels")
+            header_valid &= parse_channel_list(data, position, position + attribute_size, channels);
+        else if (attribute_name == "compression" && attribute_size >= 1)
+            compression = data[position];
+        else if (attribute_name == "dataWindow" && attribute_size >= 16)
+            std::memcpy(data_window, data.data() + position, sizeof(data_window));
+
+        position += attribute_size;
+    }
+
+    int width = data_window[2] - data_window[0] + 1;
+    int height = data_window[3] - data_window[1] + 1;
+    if (!header_valid || channels.empty() || width <= 0 || height <= 0)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The header of the EXR file \"%s\" is invalid or uses subsampled channels.", filepath.c_str());
+
+        return false;
+    }
+    else if (compression != EXR_COMPRESSION_NONE && compression != EXR_COMPRESSION_RLE && compression != EXR_COMPRESSION_ZIPS && compression != EXR_COMPRESSION_ZIP)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The EXR file \"%s\" uses an unsupported compression (%d), only the NONE, RLE, ZIPS and ZIP compressions are supported.", filepath.c_str(), compression);
+
+        return false;
+    }
+
+    // R, G, B, A and Y channels, -1 if the file doesn't have them
+    int color_channels[5] = { -1, -1, -1, -1, -1 };
+    const char* color_channel_names[5] = { "R", "G", "B", "A", "Y" };
+    int scanline_size = 0;
+    for (int i = 0; i < channels.size(); i++)
+    {
+        for (int color_channel = 0; color_channel < 5; color_channel++)
+            if (channels[i].name == color_channel_names[color_channel])
+                color_channels[color_channel] = i;
+
+        scanline_size += (channels[i].pixel_type == EXR_PIXEL_TYPE_HALF ? 2 : 4) * width;
+    }
+
+    if (color_channels[0] == -1 && color_channels[1] == -1 && color_channels[2] == -1)
+    {
+        if (color_channels[4] == -1)
+        {
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The EXR file \"%s\" doesn't have R, G, B or Y channels.", filepath.c_str());
+
+            return false;
+        }
+
+        // Luminance image
+        color_channels[0] = color_channels[1] = color_channels[2] = color_channels[4];
+    }
+
+    int lines_per_chunk = compression == EXR_COMPRESSION_ZIP ? 16 : 1;
+    int chunk_count = (height + lines_per_chunk - 1) / lines_per_chunk;
+    std::vector<uint64_t> chunk_offsets(chunk_count);
+    for (int i = 0; i < chunk_count; i++)
+    {
+        if (!read_value(data, position, chunk_offsets[i]))
+        {
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The EXR file \"%s\" is truncated.", filepath.c_str());
+
+            return false;
+        }
+    }
+
+    out_image = Image32Bit(width, height, output_channels);
+    float* pixels = out_image.data().data();
+
+    std::atomic<bool> chunks_valid(true);
+#pragma omp parallel
+    {
+        std::vector<unsigned char> decompressed;
+        std::vector<unsigned char> chunk_pixels;
+
+#pragma omp for schedule(dynamic)
+        for (int chunk_index = 0; chunk_index < chunk_count; chunk_index++)
+        {
+            size_t chunk_position = chunk_offsets[chunk_index];
+            int chunk_y, packed_size;
+            if (!read_value(data, chunk_position, chunk_y) || !read_value(data, chunk_position, packed_size) || packed_size < 0 || chunk_position + packed_size > data.size())
+            {
+                chunks_valid = false;
+                continue;
+            }
+
+            int first_line = chunk_y - data_window[1];
+            if (first_line < 0 || first_line >= height || first_line % lines_per_chunk != 0)
+            {
+                chunks_valid = false;
+                continue;
+            }
+
+            int line_count = std::min(lines_per_chunk, height - first_line);
+            size_t chunk_size = static_cast<size_t>(scanline_size) * line_count;
+            const unsigned char* packed_data = data.data() + chunk_position;
+
+            const unsigned char* chunk_data = packed_data;
+            if (compression != EXR_COMPRESSION_NONE && static_cast<size_t>(packed_size) != chunk_size)
+            {
+                // The chunks that the compression doesn't make smaller are stored raw
+                decompressed.resize(chunk_size);
+                chunk_pixels.resize(chunk_size);
+
+                bool decompressed_valid;
+                if (compression == EXR_COMPRESSION_RLE)
+                    decompressed_valid = rle_decompress(packed_data, packed_size, decompressed.data(), chunk_size);
+                else
+                    decompressed_valid = stbi_zlib_decode_buffer(reinterpret_cast<char*>(decompressed.data()), static_cast<int>(chunk_size), reinterpret_cast<const char*>(packed_data), packed_size) == static_cast<int>(chunk_size);
+
+                if (!decompressed_valid)
+                {
+                    chunks_valid = false;
+                    continue;
+                }
+
+                undo_predictor_and_reorder(decompressed, chunk_pixels);
+                chunk_data = chunk_pixels.data();
+            }
+            else if (static_cast<size_t>(packed_size) != chunk_size)
+            {
+                chunks_valid = false;
+                continue;
+            }
+
+            for (int line = 0; line < line_count; line++)
+            {
+                // Channel after channel in the scanline
+                const unsigned char* scanline = chunk_data + static_cast<size_t>(line) * scanline_size;
+
+                int y = first_line + line;
+                int row = flipY ? height - 1 - y : y;
+                float* out_row = pixels + static_cast<size_t>(row) * width * output_channels;
+                for (int x = 0; x < width; x++)
+                {
+                    float rgba[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+                    for (int color_channel = 0; color_channel < 4; color_channel++)
+                    {
+                        if (color_channels[color_channel] == -1)
+                            continue;
+
+                        const EXRReadChannel& channel = channels[color_channels[color_channel]];
+                        int value_size = channel.pixel_type == EXR_PIXEL_TYPE_HALF ? 2 : 4;
+                        rgba[color_channel] = read_channel_value(scanline + static_cast<size_t>(channel.scanline_offset) * width + x * value_size, channel.pixel_type);
+                    }
+
+                    float* out_pixel = out_row + x * output_channels;
+                    if (output_channels <= 2)
+                    {
+                        out_pixel[0] = (rgba[0] + rgba[1] + rgba[2]) / 3.0f;
+                        if (output_channels == 2)
+                            out_pixel[1] = rgba[3];
+                    }
+                    else
+                    {
+                        for (int i = 0; i < output_channels; i++)
+                            out_pixel[i] = rgba[i];
+                    }
+                }
+            }
+        }
+    }
+
+    if (!chunks_valid)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The EXR file \"%s\" is corrupted.", filepath.c_str());
+        out_image = Image32Bit();
+
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef EXR_READER_H
+#define EXR_READER_H
+
+#include <string>
+
+class Image32Bit;
+
+/**
+ * Reads the R, G, B and A channels (or the Y channel of a luminance image) of the
+ * EXR file 'filepath' into 'out_image' with 'output_channels' float channels.
+ * Missing color channels are read as 0 and a missing alpha channel as 1. For 1 or
+ * 2 output channels, the first channel is the average of R, G and B.
+ *
+ * Only single part scanline files, with the NONE, RLE, ZIPS or ZIP compressions, are
+ * supported (that's what write_image_exr() and most of the envmaps out there use).
+ * The chunks of scanlines are decompressed and converted in parallel, straight into
+ * the image, the half channels converted to float on the way.
+ *
+ * Logs an error and returns false if the file cannot be read
+ */
+bool read_image_exr(const std::string& filepath, int output_channels, bool flipY, Image32Bit& out_image);
+
+#endif
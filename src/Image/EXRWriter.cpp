@@ -0,0 +1,275 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HostDeviceCommon/PackedMaterial.h"
+#include "Image/EXRWriter.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+extern ImGuiLogger g_imgui_logger;
+
+// Pixel types of the channels of the file format
+#define EXR_PIXEL_TYPE_UINT 0
+#define EXR_PIXEL_TYPE_HALF 1
+#define EXR_PIXEL_TYPE_FLOAT 2
+
+/**
+ * Channel of the file, the channels are stored in the alphabetical order of their names
+ */
+struct EXRChannel
+{
+    std::string name;
+    int pixel_type;
+
+    const EXRLayer* layer;
+    int channel_index;
+};
+
+// The file format is little endian, as all the platforms the renderer runs on
+template <typename T>
+static void append_value(std::vector<unsigned char>& out, T value)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void append_string(std::vector<unsigned char>& out, const std::string& string)
+{
+    out.insert(out.end(), string.begin(), string.end());
+    out.push_back('\0');
+}
+
+static void append_attribute_header(std::vector<unsigned char>& out, const char* name, const char* type, int size)
+{
+    append_string(out, name);
+    append_string(out, type);
+    append_value<int>(out, size);
+}
+
+static void append_box2i_attribute(std::vector<unsigned char>& out, const char* name, int width, int height)
+{
+    append_attribute_header(out, name, "box2i", 16);
+    append_value<int>(out, 0);
+    append_value<int>(out, 0);
+    append_value<int>(out, width - 1);
+    append_value<int>(out, height - 1);
+}
+
+static unsigned short float_to_half(float value)
+{
+    // half_encode() only encodes the magnitude
+    unsigned short sign = std::signbit(value) ? 0x8000 : 0;
+
+    return sign | half_encode(std::abs(value));
+}
+
+/**
+ * Run length encoding of OpenEXR: a run of N >= 3 identical bytes is stored as (N - 1, byte),
+ * N < 3 literal bytes as (-N, bytes...). Runs are at most 127 bytes long
+ */
+static std::vector<unsigned char> rle_compress(const std::vector<unsigned char>& data)
+{
+    const int min_run_length = 3;
+    const int max_run_length = 127;
+
+    std::vector<unsigned char> compressed;
+    compressed.reserve(data.size());
+
+    size_t run_start = 0;
+    size_t run_end = 1;
+    while (run_start < data.size())
+    {
+        while (run_end < data.size() && data[run_start] == data[run_end] && run_end - run_start - 1 < max_run_length)
+            run_end++;
+
+        if (run_end - run_start >= min_run_length)
+        {
+            compressed.push_back(static_cast<unsigned char>(run_end - run_start - 1));
+            compressed.push_back(data[run_start]);
+            run_start = run_end;
+        }
+        else
+        {
+            // Literal bytes until the next run of 3 identical bytes
+            while (run_end < data.size()
+                && (run_end + 1 >= data.size() || data[run_end] != data[run_end + 1] || run_end + 2 >= data.size() || data[run_end + 1] != data[run_end + 2])
+                && run_end - run_start < max_run_length)
+                run_end++;
+
+            compressed.push_back(static_cast<unsigned char>(-static_cast<int>(run_end - run_start)));
+            compressed.insert(compressed.end(), data.begin() + run_start, data.begin() + run_end);
+            run_start = run_end;
+        }
+
+        run_end++;
+    }
+
+    return compressed;
+}
+
+/**
+ * Compresses the data of a scanline as OpenEXR does before its run length encoding:
+ * the even and the odd bytes are split in two halves and replaced by their difference
+ * with the previous byte so that the slowly varying values give runs of identical bytes
+ */
+static std::vector<unsigned char> compress_scanline(const std::vector<unsigned char>& scanline, EXRCompression compression)
+{
+    if (compression == EXR_COMPRESSION_NONE)
+        return scanline;
+
+    std::vector<unsigned char> reordered(scanline.size());
+    size_t half_size = (scanline.size() + 1) / 2;
+    for (size_t i = 0; i < scanline.size(); i++)
+        reordered[i % 2 == 0 ? i / 2 : half_size + i / 2] = scanline[i];
+
+    for (size_t i = reordered.size() - 1; i > 0; i--)
+        reordered[i] = static_cast<unsigned char>(reordered[i] - reordered[i - 1] + 128);
+
+    std::vector<unsigned char> compressed = rle_compress(reordered);
+    if (compressed.size() >= scanline.size())
+        // The readers expect the raw scanline when the compression doesn't make it smaller
+        return scanline;
+
+    return compressed;
+}
+
+bool write_image_exr(const char* filepath, int width, int height, const std::vector<EXRLayer>& layers, const EXRWriteOptions& options)
+{
+    std::vector<EXRChannel> channels;
+    for (const EXRLayer& layer : layers)
+    {
+        size_t channel_count = layer.channel_names.size();
+        if (layer.pixels.size() != static_cast<size_t>(width) * height * channel_count)
+        {
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The layer \"%s\" of the EXR file \"%s\" doesn't have the resolution of the image.", layer.name.c_str(), filepath);
+
+            return false;
+        }
+
+        for (int i = 0; i < channel_count; i++)
+        {
+            EXRChannel channel;
+            channel.name = layer.name.empty() ? layer.channel_names[i] : layer.name + "." + layer.channel_names[i];
+            if (layer.unsigned_int)
+                channel.pixel_type = EXR_PIXEL_TYPE_UINT;
+            else
+                channel.pixel_type = options.half_float ? EXR_PIXEL_TYPE_HALF : EXR_PIXEL_TYPE_FLOAT;
+            channel.layer = &layer;
+            channel.channel_index = i;
+
+            channels.push_back(channel);
+        }
+    }
+    std::sort(channels.begin(), channels.end(), [](const EXRChannel& a, const EXRChannel& b) { return a.name < b.name; });
+
+    bool long_names = false;
+    int channel_list_size = 1;
+    for (const EXRChannel& channel : channels)
+    {
+        long_names |= channel.name.size() > 31;
+        channel_list_size += channel.name.size() + 1 + 16;
+    }
+
+    std::vector<unsigned char> header;
+    // Magic number and version 2, single part scanline file
+    append_value<int>(header, 20000630);
+    append_value<int>(header, 2 | (long_names ? 0x400 : 0));
+
+    append_attribute_header(header, "channels", "chlist", channel_list_size);
+    for (const EXRChannel& channel : channels)
+    {
+        append_string(header, channel.name);
+        append_value<int>(header, channel.pixel_type);
+        // pLinear and reserved bytes
+        append_value<int>(header, 0);
+        // x / y sampling
+        append_value<int>(header, 1);
+        append_value<int>(header, 1);
+    }
+    header.push_back('\0');
+
+    append_attribute_header(header, "compression", "compression", 1);
+    header.push_back(static_cast<unsigned char>(options.compression));
+    append_box2i_attribute(header, "dataWindow", width, height);
+    append_box2i_attribute(header, "displayWindow", width, height);
+    // Increasing Y
+    append_attribute_header(header, "lineOrder", "lineOrder", 1);
+    header.push_back(0);
+    append_attribute_header(header, "pixelAspectRatio", "float", 4);
+    append_value<float>(header, 1.0f);
+    append_attribute_header(header, "screenWindowCenter", "v2f", 8);
+    append_value<float>(header, 0.0f);
+    append_value<float>(header, 0.0f);
+    append_attribute_header(header, "screenWindowWidth", "float", 4);
+    append_value<float>(header, 1.0f);
+    // End of the header
+    header.push_back('\0');
+
+    // One scanline per chunk with these compressions
+    std::vector<std::vector<unsigned char>> chunks(height);
+    std::vector<unsigned char> scanline;
+    for (int y = 0; y < height; y++)
+    {
+        // The top row of the file is the last row of the layers
+        size_t row_start = static_cast<size_t>(height - 1 - y) * width;
+
+        scanline.clear();
+        for (const EXRChannel& channel : channels)
+        {
+            size_t channel_count = channel.layer->channel_names.size();
+            for (int x = 0; x < width; x++)
+            {
+                float value = channel.layer->pixels[(row_start + x) * channel_count + channel.channel_index];
+
+                if (channel.pixel_type == EXR_PIXEL_TYPE_UINT)
+                    append_value<uint32_t>(scanline, static_cast<uint32_t>(std::max(0.0f, value)));
+                else if (channel.pixel_type == EXR_PIXEL_TYPE_HALF)
+                    append_value<unsigned short>(scanline, float_to_half(value));
+                else
+                    append_value<float>(scanline, value);
+            }
+        }
+
+        chunks[y] = compress_scanline(scanline, options.compression);
+    }
+
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file.is_open())
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not open the EXR file \"%s\" for writing.", filepath);
+
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+    // Offsets of the chunks from the start of the file
+    uint64_t chunk_offset = header.size() + sizeof(uint64_t) * height;
+    std::vector<unsigned char> offset_table;
+    for (int y = 0; y < height; y++)
+    {
+        append_value<uint64_t>(offset_table, chunk_offset);
+        // Y coordinate and size of the chunk before its data
+        chunk_offset += sizeof(int) * 2 + chunks[y].size();
+    }
+    file.write(reinterpret_cast<const char*>(offset_table.data()), offset_table.size());
+
+    for (int y = 0; y < height; y++)
+    {
+        std::vector<unsigned char> chunk_header;
+        append_value<int>(chunk_header, y);
+        append_value<int>(chunk_header, static_cast<int>(chunks[y].size()));
+
+        file.write(reinterpret_cast<const char*>(chunk_header.data()), chunk_header.size());
+        file.write(reinterpret_cast<const char*>(chunks[y].data()), chunks[y].size());
+    }
+
+    return file.good();
+}
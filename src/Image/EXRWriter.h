@@ -0,0 +1,55 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef EXR_WRITER_H
+#define EXR_WRITER_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Compression of the scanlines of an EXR file. The values are the ones of the file format
+ */
+enum EXRCompression
+{
+    EXR_COMPRESSION_NONE = 0,
+    // Lossless run length encoding
+    EXR_COMPRESSION_RLE = 1,
+};
+
+/**
+ * Layer of a multi-layer EXR file. The channels of the layer are
+ * named "<name>.<channel_name>" in the file, or just "<channel_name>"
+ * if 'name' is empty (the beauty layer)
+ */
+struct EXRLayer
+{
+    std::string name;
+    // "R", "G", "B" for a color layer for example
+    std::vector<std::string> channel_names;
+
+    // Interleaved values of the channels, the rows are stored from the bottom
+    // of the image to the top as in the framebuffers of the renderers
+    std::vector<float> pixels;
+
+    // If true, the channels are stored as 32 bit unsigned integers
+    // instead of floats (pixel sample counts for example)
+    bool unsigned_int = false;
+};
+
+struct EXRWriteOptions
+{
+    // Whether the float channels are stored as half floats or as 32 bit floats
+    bool half_float = true;
+    EXRCompression compression = EXR_COMPRESSION_RLE;
+};
+
+/**
+ * Writes the given layers as a single part scanline EXR file. All the layers must
+ * have 'width' * 'height' pixels. Returns false if the file couldn't be written
+ */
+bool write_image_exr(const char* filepath, int width, int height, const std::vector<EXRLayer>& layers, const EXRWriteOptions& options = EXRWriteOptions());
+
+#endif
@@ -3,10 +3,16 @@
  * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
  */
 
+#include "Image/EXRReader.h"
 #include "Image/Image.h"
+#include "Image/RGBEReader.h"
 #include "UI/ImGui/ImGuiLogger.h"
 #include "Utils/Utils.h"
 
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+
 extern ImGuiLogger g_imgui_logger;
 
 // This CPP file is used to define the STBI implementation once and for all
@@ -16,8 +22,6 @@ extern ImGuiLogger g_imgui_logger;
 #include "stb_image.h"
 #include "stb_image_write.h"
 
-#include <deque>
-
 Image8Bit::Image8Bit(int width, int height, int channels) : Image8Bit(std::vector<unsigned char>(width * height * channels, 0), width, height, channels) {}
 
 Image8Bit::Image8Bit(unsigned char* data, int width, int height, int channels) : width(width), height(height), channels(channels)
@@ -58,6 +62,25 @@ Image8Bit Image8Bit::read_image(const std::string& filepath, int output_channels
     return output_image;
 }
 
+Image8Bit Image8Bit::read_image_from_memory(const std::vector<unsigned char>& file_data, const std::string& filepath, int output_channels, bool flipY)
+{
+    stbi_set_flip_vertically_on_load_thread(flipY);
+
+    int width, height, read_channels;
+    unsigned char* pixels = stbi_load_from_memory(file_data.data(), static_cast<int>(file_data.size()), &width, &height, &read_channels, output_channels);
+
+    if (!pixels)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Error reading image %s", filepath.c_str());
+        return Image8Bit();
+    }
+
+    Image8Bit output_image(std::vector<unsigned char>(pixels, pixels + static_cast<size_t>(width) * height * output_channels), width, height, output_channels);
+
+    stbi_image_free(pixels);
+    return output_image;
+}
+
 Image8Bit Image8Bit::read_image_hdr(const std::string& filepath, int output_channels, bool flipY)
 {
     stbi_set_flip_vertically_on_load(flipY);
@@ -256,6 +279,51 @@ bool Image8Bit::is_constant_color(int threshold) const
     return true;
 }
 
+Image8Bit Image8Bit::downsample_2x() const
+{
+    int half_width = std::max(1, width / 2);
+    int half_height = std::max(1, height / 2);
+
+    Image8Bit downsampled(half_width, half_height, channels);
+
+#pragma omp parallel for
+    for (int y = 0; y < half_height; y++)
+    {
+        // Clamping for the 1 texel wide/high images that can't be halved anymore in one direction
+        int y0 = std::min(y * 2, height - 1);
+        int y1 = std::min(y * 2 + 1, height - 1);
+
+        for (int x = 0; x < half_width; x++)
+        {
+            int x0 = std::min(x * 2, width - 1);
+            int x1 = std::min(x * 2 + 1, width - 1);
+
+            for (int i = 0; i < channels; i++)
+            {
+                int sum = m_pixel_data[(y0 * width + x0) * channels + i] + m_pixel_data[(y0 * width + x1) * channels + i]
+                        + m_pixel_data[(y1 * width + x0) * channels + i] + m_pixel_data[(y1 * width + x1) * channels + i];
+
+                // + 2 for rounding to the nearest
+                downsampled[(y * half_width + x) * channels + i] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+
+    return downsampled;
+}
+
+Image8Bit Image8Bit::extract_channels(int first_channel, int channel_count) const
+{
+    Image8Bit extracted(width, height, channel_count);
+
+#pragma omp parallel for
+    for (int i = 0; i < width * height; i++)
+        for (int channel = 0; channel < channel_count; channel++)
+            extracted[i * channel_count + channel] = m_pixel_data[i * channels + first_channel + channel];
+
+    return extracted;
+}
+
 void Image8Bit::free()
 {
     m_pixel_data.clear();
@@ -327,6 +395,21 @@ Image32Bit Image32Bit::read_image(const std::string& filepath, int output_channe
 
 Image32Bit Image32Bit::read_image_hdr(const std::string& filepath, int output_channels, bool flipY)
 {
+    std::string extension = std::filesystem::path(filepath).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char character) { return std::tolower(character); });
+
+    Image32Bit image;
+    if (extension == ".exr")
+    {
+        // read_image_exr() logs its errors
+        read_image_exr(filepath, output_channels, flipY, image);
+
+        return image;
+    }
+    else if ((extension == ".hdr" || extension == ".pic") && read_image_rgbe(filepath, output_channels, flipY, image))
+        // Decoded in parallel, stb_image is only used for the files that read_image_rgbe() doesn't handle
+        return image;
+
     stbi_set_flip_vertically_on_load_thread(flipY);
 
     int width, height, read_channels;
@@ -471,110 +554,124 @@ float& Image32Bit::operator[](int index)
 
 std::vector<float> Image32Bit::compute_cdf() const
 {
-    std::vector<float> out_cdf;
-    out_cdf.resize(height * width);
-    out_cdf[0] = 0.0f;
+    std::vector<float> out_cdf(height * width);
 
-    float max_radiance = 0.0f;
+#pragma omp parallel for
     for (int y = 0; y < height; y++)
-    {
         for (int x = 0; x < width; x++)
-        {
-            int index = y * width + x;
+            out_cdf[y * width + x] = luminance_of_pixel(x, y);
 
-            out_cdf[index] = out_cdf[std::max(index - 1, 0)] + luminance_of_pixel(x, y);
-
-            for (int i = 0; i < hippt::min(3, channels); i++)
-                max_radiance = hippt::max(max_radiance, m_pixel_data[(x + y * width) * channels + i]);
-        }
-    }
+    Utils::parallel_inclusive_scan(out_cdf);
 
     return out_cdf;
 }
 
-/**
- * Reference: Vose's Alias Method [https://www.keithschwarz.com/darts-dice-coins/]
- */
 void Image32Bit::compute_alias_table(std::vector<float>& out_probas, std::vector<int>& out_alias, float* out_luminance_total_sum) const
 {
-    // TODO try using floats here to reduce memory usage during the construction and see if precision is an issue or not
+    std::vector<float> luminance_of_pixels(width * height);
 
-    // A vector of the luminance of all the pixels of the envmap
-    // normalized such that the average of the elements of this vector is 'width*height'
-    std::vector<double> normalized_luminance_of_pixels(width * height);
-    double luminance_sum = 0.0f;
+#pragma omp parallel for
     for (int y = 0; y < height; y++)
-    {
         for (int x = 0; x < width; x++)
-        {
-            int index = y * width + x;
+            luminance_of_pixels[y * width + x] = luminance_of_pixel(x, y);
 
-            double luminance = static_cast<double>(luminance_of_pixel(x, y));
-            normalized_luminance_of_pixels[index] = luminance;
-            luminance_sum += luminance;
-        }
-    }
+    Utils::compute_alias_table(luminance_of_pixels, out_probas, out_alias, out_luminance_total_sum);
+}
 
-    if (out_luminance_total_sum != nullptr)
-        *out_luminance_total_sum = luminance_sum;
+void Image32Bit::compute_marginal_conditional_cdf(std::vector<float>& out_marginal_cdf, std::vector<float>& out_conditional_cdfs) const
+{
+    out_marginal_cdf.resize(height);
+    out_conditional_cdfs.resize(width * height);
 
-    for (double& luminance_value : normalized_luminance_of_pixels)
+#pragma omp parallel for
+    for (int y = 0; y < height; y++)
     {
-        // Normalize so that the sum of the elements is 1
-        luminance_value /= luminance_sum;
+        float row_sum = 0.0f;
+        for (int x = 0; x < width; x++)
+        {
+            row_sum += luminance_of_pixel(x, y);
+            out_conditional_cdfs[y * width + x] = row_sum;
+        }
 
-        // Scale for alias table construction such that the average of
-        // the elements is 1
-        luminance_value *= (width * height);
+        out_marginal_cdf[y] = row_sum;
     }
 
-    out_probas.resize(width * height);
-    out_alias.resize(width * height);
+    Utils::parallel_inclusive_scan(out_marginal_cdf);
+}
+
+int Image32Bit::compute_luminance_pyramid(std::vector<float>& out_pyramid, int max_leaf_height) const
+{
+    // Level l has 2 * 4^l cells
+    auto level_offset = [](int level) { return 2 * ((1 << (2 * level)) - 1) / 3; };
 
-    std::deque<int> small;
-    std::deque<int> large;
+    int leaf_level = 0;
+    while ((2 << leaf_level) <= hippt::min(height, max_leaf_height) && (4 << leaf_level) <= width)
+        leaf_level++;
 
-    for (int i = 0; i < normalized_luminance_of_pixels.size(); i++)
-    {
-        if (normalized_luminance_of_pixels[i] < 1.0)
-            small.push_back(i);
-        else
-            large.push_back(i);
-    }
+    int leaf_width = 2 << leaf_level;
+    int leaf_height = 1 << leaf_level;
+    out_pyramid.resize(level_offset(leaf_level + 1));
 
-    while (!small.empty() && !large.empty())
+    float* leaves = &out_pyramid[level_offset(leaf_level)];
+#pragma omp parallel for
+    for (int cell_y = 0; cell_y < leaf_height; cell_y++)
     {
-        int small_index = small.front();
-        int large_index = large.front();
-
-        small.pop_front();
-        large.pop_front();
+        int start_y = cell_y * height / leaf_height;
+        int stop_y = (cell_y + 1) * height / leaf_height;
+        // The cells are weighted by their solid angle
+        float sin_theta = sin((cell_y + 0.5f) / leaf_height * M_PI);
 
-        out_probas[small_index] = normalized_luminance_of_pixels[small_index];
-        out_alias[small_index] = large_index;
+        for (int cell_x = 0; cell_x < leaf_width; cell_x++)
+        {
+            int start_x = cell_x * width / leaf_width;
+            int stop_x = (cell_x + 1) * width / leaf_width;
 
-        normalized_luminance_of_pixels[large_index] = (normalized_luminance_of_pixels[large_index] + normalized_luminance_of_pixels[small_index]) - 1.0;
-        if (normalized_luminance_of_pixels[large_index] > 1.0)
-            large.push_back(large_index);
-        else
-            small.push_back(large_index);
+            float average_luminance = luminance_of_area(start_x, start_y, stop_x, stop_y) / ((stop_x - start_x) * (stop_y - start_y));
+            leaves[cell_y * leaf_width + cell_x] = average_luminance * sin_theta;
+        }
     }
 
-    while (!large.empty())
+    for (int level = leaf_level - 1; level >= 0; level--)
     {
-        int index = large.front();
-        large.pop_front();
-
-        out_probas[index] = 1.0;
+        int level_width = 2 << level;
+        int level_height = 1 << level;
+        float* cells = &out_pyramid[level_offset(level)];
+        const float* children = &out_pyramid[level_offset(level + 1)];
+
+        for (int y = 0; y < level_height; y++)
+            for (int x = 0; x < level_width; x++)
+                cells[y * level_width + x] = children[(2 * y) * level_width * 2 + 2 * x] + children[(2 * y) * level_width * 2 + 2 * x + 1]
+                                           + children[(2 * y + 1) * level_width * 2 + 2 * x] + children[(2 * y + 1) * level_width * 2 + 2 * x + 1];
     }
 
-    while (!small.empty())
+    return leaf_level;
+}
+
+Image32Bit Image32Bit::compute_downscaled_luminance(int downscale_factor) const
+{
+    int downscaled_width = (width + downscale_factor - 1) / downscale_factor;
+    int downscaled_height = (height + downscale_factor - 1) / downscale_factor;
+
+    Image32Bit downscaled(downscaled_width, downscaled_height, 3);
+#pragma omp parallel for
+    for (int y = 0; y < downscaled_height; y++)
     {
-        int index = small.front();
-        small.pop_front();
+        int start_y = y * downscale_factor;
+        int stop_y = hippt::min(start_y + downscale_factor, height);
+
+        for (int x = 0; x < downscaled_width; x++)
+        {
+            int start_x = x * downscale_factor;
+            int stop_x = hippt::min(start_x + downscale_factor, width);
 
-        out_probas[index] = 1.0;
+            float average_luminance = luminance_of_area(start_x, start_y, stop_x, stop_y) / ((stop_x - start_x) * (stop_y - start_y));
+            // The luminance weights sum to 1 so a gray pixel has the same luminance as its value
+            for (int channel = 0; channel < 3; channel++)
+                downscaled[(y * downscaled_width + x) * 3 + channel] = average_luminance;
+        }
     }
+
+    return downscaled;
 }
 
 size_t Image32Bit::byte_size() const
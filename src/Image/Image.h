@@ -31,6 +31,10 @@ public:
     Image8Bit(const char* filepath);
 
     static Image8Bit read_image(const std::string& filepath, int output_channels, bool flipY);
+    /**
+     * Decodes the image file already read in memory in 'file_data'. 'filepath' is only used for the error messages
+     */
+    static Image8Bit read_image_from_memory(const std::vector<unsigned char>& file_data, const std::string& filepath, int output_channels, bool flipY);
     static Image8Bit read_image_hdr(const std::string& filepath, int output_channels, bool flipY);
 
     bool write_image_png(const char* filename, const bool flipY = true) const;
@@ -63,6 +67,22 @@ public:
      */ 
      bool is_constant_color(int threshold = 0) const;
 
+    /**
+     * Returns the next level of the mip chain of this image: half the width and
+     * height (rounded down, at least 1) with each texel being the average of the
+     * 2x2 texels of this image it covers.
+     *
+     * The texels are averaged as they are stored so sRGB images are filtered in sRGB space
+     */
+    Image8Bit downsample_2x() const;
+
+    /**
+     * Returns an image with only the channels [first_channel, first_channel + channel_count[
+     * of this image. Used for keeping only the channels of a texture that the shaders read
+     * (the G and B channels of a packed roughness/metallic texture for example)
+     */
+    Image8Bit extract_channels(int first_channel, int channel_count) const;
+
     /**
      * Frees the data of this image and sets its width, height and channels back to 0
      */
@@ -110,6 +130,27 @@ public:
 
     std::vector<float> compute_cdf() const;
     void compute_alias_table(std::vector<float>& out_probas, std::vector<int>& out_alias, float* out_luminance_total_sum = nullptr) const;
+    /**
+     * Computes the marginal CDF (of length height) of the luminance sums of the rows
+     * of the image and the conditional CDF (of length width * height) of each row.
+     * The CDFs aren't normalized, the last element of the marginal CDF is the luminance
+     * sum of the whole image
+     */
+    void compute_marginal_conditional_cdf(std::vector<float>& out_marginal_cdf, std::vector<float>& out_conditional_cdfs) const;
+    /**
+     * Computes the luminance pyramid of the image for the envmap product sampling,
+     * see WorldSettings::envmap_luminance_pyramid for the layout.
+     * 
+     * The leaf level is the finest level whose cells all cover at least one pixel of the
+     * image, with at most 'max_leaf_height' rows. Returns the index of the leaf level
+     */
+    int compute_luminance_pyramid(std::vector<float>& out_pyramid, int max_leaf_height) const;
+    /**
+     * Returns a 3-channel gray image of size ceil(width / downscale_factor) * ceil(height / downscale_factor)
+     * whose pixels are the average luminance of the downscale_factor * downscale_factor pixels of this
+     * image that they cover. The luminance_of_pixel() of the returned image is that average luminance
+     */
+    Image32Bit compute_downscaled_luminance(int downscale_factor) const;
 
     size_t byte_size() const;
 
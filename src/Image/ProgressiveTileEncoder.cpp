@@ -0,0 +1,109 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Image/ProgressiveTileEncoder.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+static void append_jpeg_bytes(void* context, void* data, int size)
+{
+    std::vector<unsigned char>* jpeg = reinterpret_cast<std::vector<unsigned char>*>(context);
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(data);
+
+    jpeg->insert(jpeg->end(), bytes, bytes + size);
+}
+
+ProgressiveTileEncoder::ProgressiveTileEncoder(int jpeg_quality, float exposure, float gamma, int change_threshold)
+    : m_jpeg_quality(jpeg_quality), m_exposure(exposure), m_gamma(gamma), m_change_threshold(change_threshold) {}
+
+std::vector<EncodedTile> ProgressiveTileEncoder::encode_changed_tiles(const Image32Bit& image)
+{
+    int width = image.width;
+    int height = image.height;
+    bool all_tiles = width != m_last_width || height != m_last_height;
+    if (all_tiles)
+    {
+        m_last_encoded_image.assign(width * height * 3, 0);
+        m_last_width = width;
+        m_last_height = height;
+    }
+
+    // Same tone mapping as the display shaders
+    std::vector<unsigned char> tone_mapped(width * height * 3);
+    float inverse_gamma = 1.0f / m_gamma;
+    for (int y = 0; y < height; y++)
+    {
+        int source_row = height - 1 - y;
+        for (int x = 0; x < width * 3; x++)
+        {
+            float value = 1.0f - std::exp(-image[source_row * width * 3 + x] * m_exposure);
+            value = std::pow(std::max(0.0f, value), inverse_gamma);
+
+            tone_mapped[y * width * 3 + x] = static_cast<unsigned char>(std::min(255.0f, value * 255.0f + 0.5f));
+        }
+    }
+
+    // The tiles are given to stb row by row from the top
+    stbi_flip_vertically_on_write(false);
+
+    std::vector<EncodedTile> tiles;
+    std::vector<unsigned char> tile_pixels;
+    for (int tile_y = 0; tile_y < height; tile_y += TILE_SIZE)
+    {
+        for (int tile_x = 0; tile_x < width; tile_x += TILE_SIZE)
+        {
+            int tile_width = std::min(TILE_SIZE, width - tile_x);
+            int tile_height = std::min(TILE_SIZE, height - tile_y);
+
+            // Compared against the last version of the tile that was sent, not the last render,
+            // so that slow changes still end up being sent once they add up
+            bool changed = all_tiles;
+            for (int y = tile_y; y < tile_y + tile_height && !changed; y++)
+            {
+                int row_start = (y * width + tile_x) * 3;
+                for (int i = row_start; i < row_start + tile_width * 3; i++)
+                {
+                    if (std::abs(tone_mapped[i] - m_last_encoded_image[i]) > m_change_threshold)
+                    {
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+
+            if (!changed)
+                continue;
+
+            tile_pixels.resize(tile_width * tile_height * 3);
+            for (int y = 0; y < tile_height; y++)
+            {
+                int row_start = ((tile_y + y) * width + tile_x) * 3;
+
+                std::copy(tone_mapped.begin() + row_start, tone_mapped.begin() + row_start + tile_width * 3, tile_pixels.begin() + y * tile_width * 3);
+                std::copy(tone_mapped.begin() + row_start, tone_mapped.begin() + row_start + tile_width * 3, m_last_encoded_image.begin() + row_start);
+            }
+
+            EncodedTile tile;
+            tile.x = tile_x;
+            tile.y = tile_y;
+            tile.width = tile_width;
+            tile.height = tile_height;
+            stbi_write_jpg_to_func(append_jpeg_bytes, &tile.jpeg, tile_width, tile_height, 3, tile_pixels.data(), m_jpeg_quality);
+
+            tiles.push_back(std::move(tile));
+        }
+    }
+
+    return tiles;
+}
+
+void ProgressiveTileEncoder::reset()
+{
+    m_last_width = 0;
+    m_last_height = 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef PROGRESSIVE_TILE_ENCODER_H
+#define PROGRESSIVE_TILE_ENCODER_H
+
+#include "Image/Image.h"
+
+#include <vector>
+
+/**
+ * JPEG of a tile of the image. Coordinates in pixels from the top left corner of the image
+ */
+struct EncodedTile
+{
+    int x = 0, y = 0;
+    int width = 0, height = 0;
+
+    std::vector<unsigned char> jpeg;
+};
+
+/**
+ * Encodes the successive renders of a progressive render for a remote client: the renders are tone mapped
+ * as the display of the application does (exposure + gamma) and only the tiles that visibly changed since
+ * the last encoded render are compressed to JPEG. The client keeps the previous tiles, the first render
+ * after a reset() gives all the tiles.
+ *
+ * The converging parts of the image stop changing after a few samples so a progressive render costs less
+ * and less bandwidth as it converges
+ */
+class ProgressiveTileEncoder
+{
+public:
+    static constexpr int TILE_SIZE = 64;
+
+    /**
+     * 'change_threshold' is the difference of 8 bit value above which a pixel counts as changed
+     */
+    ProgressiveTileEncoder(int jpeg_quality = 80, float exposure = 1.0f, float gamma = 2.2f, int change_threshold = 2);
+
+    /**
+     * Tiles of 'image' (3 channels, rows from the bottom of the image to
+     * the top as in the framebuffers of the renderers) that changed
+     */
+    std::vector<EncodedTile> encode_changed_tiles(const Image32Bit& image);
+
+    /**
+     * The next encode_changed_tiles() gives all the tiles
+     */
+    void reset();
+
+private:
+    int m_jpeg_quality;
+    float m_exposure;
+    float m_gamma;
+    int m_change_threshold;
+
+    // Tone mapped 8 bit RGB of the last encoded render, rows from the top of the image to the bottom
+    std::vector<unsigned char> m_last_encoded_image;
+    int m_last_width = 0, m_last_height = 0;
+};
+
+#endif
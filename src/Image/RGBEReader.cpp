@@ -0,0 +1,236 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Image/Image.h"
+#include "Image/RGBEReader.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+static bool read_file(const std::string& filepath, std::vector<unsigned char>& out_data)
+{
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+
+    std::streamsize size = file.tellg();
+    if (size <= 0)
+        return false;
+
+    out_data.resize(static_cast<size_t>(size));
+    file.seekg(0, std::ios::beg);
+
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(out_data.data()), size));
+}
+
+/**
+ * Reads the line starting at 'position' (without its '\n') and moves 'position' past it.
+ * Returns false if the end of the data is reached before the end of the line
+ */
+static bool read_header_line(const std::vector<unsigned char>& data, size_t& position, std::string& out_line)
+{
+    out_line.clear();
+
+    while (position < data.size())
+    {
+        char character = static_cast<char>(data[position++]);
+        if (character == '\n')
+            return true;
+
+        out_line.push_back(character);
+    }
+
+    return false;
+}
+
+/**
+ * Same conversion as stbi__hdr_convert()
+ */
+static void rgbe_to_float(const unsigned char* rgbe, int output_channels, float* out_pixel)
+{
+    if (rgbe[3] != 0)
+    {
+        float scale = std::ldexp(1.0f, rgbe[3] - (128 + 8));
+
+        if (output_channels <= 2)
+            out_pixel[0] = (rgbe[0] + rgbe[1] + rgbe[2]) * scale / 3.0f;
+        else
+        {
+            out_pixel[0] = rgbe[0] * scale;
+            out_pixel[1] = rgbe[1] * scale;
+            out_pixel[2] = rgbe[2] * scale;
+        }
+    }
+    else
+    {
+        out_pixel[0] = 0.0f;
+        if (output_channels >= 3)
+        {
+            out_pixel[1] = 0.0f;
+            out_pixel[2] = 0.0f;
+        }
+    }
+
+    if (output_channels == 2)
+        out_pixel[1] = 1.0f;
+    else if (output_channels == 4)
+        out_pixel[3] = 1.0f;
+}
+
+/**
+ * Moves 'position' past the run length encoded scanline of 'width' pixels starting at 'position'.
+ * Returns false if the scanline is corrupted
+ */
+static bool skip_rle_scanline(const std::vector<unsigned char>& data, size_t& position, int width)
+{
+    // 2, 2, width high byte, width low byte
+    if (position + 4 > data.size() || data[position] != 2 || data[position + 1] != 2 || ((data[position + 2] << 8) | data[position + 3]) != width)
+        return false;
+    position += 4;
+
+    for (int component = 0; component < 4; component++)
+    {
+        int pixel_count = 0;
+        while (pixel_count < width)
+        {
+            if (position >= data.size())
+                return false;
+
+            int count = data[position++];
+            if (count > 128)
+            {
+                // Run of the next byte
+                count -= 128;
+                position++;
+            }
+            else
+                // 'count' literal bytes
+                position += count;
+
+            if (count == 0 || position > data.size())
+                return false;
+
+            pixel_count += count;
+        }
+
+        if (pixel_count != width)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Decodes the run length encoded scanline 'scanline_data', checked by skip_rle_scanline(), into 'rgbe_scanline' (4 bytes per pixel)
+ */
+static void decode_rle_scanline(const unsigned char* scanline_data, int width, unsigned char* rgbe_scanline)
+{
+    // The header of the scanline was checked by skip_rle_scanline()
+    const unsigned char* current = scanline_data + 4;
+    for (int component = 0; component < 4; component++)
+    {
+        int pixel = 0;
+        while (pixel < width)
+        {
+            int count = *current++;
+            if (count > 128)
+            {
+                count -= 128;
+
+                unsigned char value = *current++;
+                for (int i = 0; i < count; i++, pixel++)
+                    rgbe_scanline[pixel * 4 + component] = value;
+            }
+            else
+            {
+                for (int i = 0; i < count; i++, pixel++)
+                    rgbe_scanline[pixel * 4 + component] = *current++;
+            }
+        }
+    }
+}
+
+bool read_image_rgbe(const std::string& filepath, int output_channels, bool flipY, Image32Bit& out_image)
+{
+    if (output_channels < 1 || output_channels > 4)
+        return false;
+
+    std::vector<unsigned char> data;
+    if (!read_file(filepath, data))
+        return false;
+
+    size_t position = 0;
+    std::string line;
+    if (!read_header_line(data, position, line) || (line != "#?RADIANCE" && line != "#?RGBE"))
+        return false;
+
+    // Header variables until an empty line
+    while (true)
+    {
+        if (!read_header_line(data, position, line))
+            return false;
+
+        if (line.empty())
+            break;
+        else if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+            // XYZE
+            return false;
+    }
+
+    int width, height;
+    char ignored;
+    if (!read_header_line(data, position, line) || std::sscanf(line.c_str(), "-Y %d +X %d%c", &height, &width, &ignored) != 2 || width <= 0 || height <= 0)
+        return false;
+
+    // Offset of each scanline in the file, found sequentially since the scanlines
+    // are run length encoded. The whole image is flat if the first scanline is
+    std::vector<size_t> scanline_offsets(height);
+    bool rle = width >= 8 && width < 32768 && position + 2 <= data.size() && data[position] == 2 && data[position + 1] == 2;
+    if (rle)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            scanline_offsets[y] = position;
+            if (!skip_rle_scanline(data, position, width))
+                return false;
+        }
+    }
+    else
+    {
+        if (data.size() - position < static_cast<size_t>(width) * height * 4)
+            return false;
+
+        for (int y = 0; y < height; y++)
+            scanline_offsets[y] = position + static_cast<size_t>(y) * width * 4;
+    }
+
+    out_image = Image32Bit(width, height, output_channels);
+    float* pixels = out_image.data().data();
+
+#pragma omp parallel
+    {
+        std::vector<unsigned char> rgbe_scanline(rle ? width * 4 : 0);
+
+#pragma omp for schedule(static)
+        for (int y = 0; y < height; y++)
+        {
+            const unsigned char* rgbe = data.data() + scanline_offsets[y];
+            if (rle)
+            {
+                decode_rle_scanline(rgbe, width, rgbe_scanline.data());
+                rgbe = rgbe_scanline.data();
+            }
+
+            int row = flipY ? height - 1 - y : y;
+            float* out_row = pixels + static_cast<size_t>(row) * width * output_channels;
+            for (int x = 0; x < width; x++)
+                rgbe_to_float(rgbe + x * 4, output_channels, out_row + x * output_channels);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RGBE_READER_H
+#define RGBE_READER_H
+
+#include <string>
+
+class Image32Bit;
+
+/**
+ * Reads the Radiance RGBE (.hdr, .pic) file 'filepath' into 'out_image' with 'output_channels' float channels,
+ * converted the same way as stb_image does (the luminance average for 1 or 2 channels, an alpha of 1 for 2 or 4).
+ *
+ * The offsets of the scanlines are found with a quick sequential pass over the run lengths, the scanlines are
+ * then decoded in parallel, straight into the image. stbi_loadf() decodes on a single thread and is the
+ * bottleneck of the loading of large envmaps.
+ *
+ * Returns false, without logging anything, if the file isn't a 32 bit RGBE file with the standard
+ * "-Y height +X width" orientation: the caller falls back to stb_image for these
+ */
+bool read_image_rgbe(const std::string& filepath, int output_channels, bool flipY, Image32Bit& out_image);
+
+#endif
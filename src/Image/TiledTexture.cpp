@@ -0,0 +1,164 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Image/TiledTexture.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TILED_TEXTURE_SSE 1
+#include <emmintrin.h>
+#endif
+
+TiledTexture::TiledTexture(const Image8Bit& image)
+{
+    if (image.width == 0 || image.height == 0)
+        return;
+
+    m_levels.push_back(TiledTexture::create_level(image));
+
+    // Mip chain down to 1x1, the same levels as the GPU renderer
+    Image8Bit level = image;
+    while (level.width > 1 || level.height > 1)
+    {
+        level = level.downsample_2x();
+
+        m_levels.push_back(TiledTexture::create_level(level));
+    }
+}
+
+TiledTexture::Level TiledTexture::create_level(const Image8Bit& image)
+{
+    Level level;
+    level.width = image.width;
+    level.height = image.height;
+    level.tiles_per_row = (image.width + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_per_column = (image.height + TILE_SIZE - 1) / TILE_SIZE;
+    level.texels.resize(static_cast<size_t>(level.tiles_per_row) * tiles_per_column * TILE_SIZE * TILE_SIZE);
+
+#pragma omp parallel for
+    for (int y = 0; y < image.height; y++)
+    {
+        for (int x = 0; x < image.width; x++)
+        {
+            // The missing channels are read as the default color (0, 0, 0, 1)
+            unsigned char rgba[4] = { 0, 0, 0, 255 };
+            for (int channel = 0; channel < std::min(image.channels, 4); channel++)
+                rgba[channel] = image[(y * image.width + x) * image.channels + channel];
+
+            int tile_index = (y / TILE_SIZE) * level.tiles_per_row + x / TILE_SIZE;
+            int texel_index = tile_index * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+            level.texels[texel_index] = rgba[0] | (rgba[1] << 8) | (rgba[2] << 16) | (static_cast<unsigned int>(rgba[3]) << 24);
+        }
+    }
+
+    return level;
+}
+
+int TiledTexture::get_level_count() const
+{
+    return static_cast<int>(m_levels.size());
+}
+
+ColorRGBA32F TiledTexture::sample_rgba32f(float2 uv, float level) const
+{
+    if (m_levels.empty())
+        return ColorRGBA32F();
+
+    // Sampling in repeat mode so we're just keeping the fractional part
+    float u = uv.x - static_cast<int>(uv.x);
+    float v = uv.y - static_cast<int>(uv.y);
+    // For negative UVs, we also want to repeat and we want, for example,
+    // -0.1f to behave as 0.9f
+    u = u < 0 ? 1.0f + u : u;
+    v = v < 0 ? 1.0f + v : v;
+    // Sampling with [0, 0] bottom-left convention
+    v = 1.0f - v;
+
+    level = std::min(level, static_cast<float>(m_levels.size() - 1));
+    if (level <= 0.0f)
+        return sample_level(m_levels[0], u, v);
+
+    // Same blending of the two closest levels as the GPU renderer
+    int coarse_level = static_cast<int>(std::ceil(level));
+    int fine_level = coarse_level - 1;
+    float coarse_weight = level - fine_level;
+
+    ColorRGBA32F fine_rgba = sample_level(m_levels[fine_level], u, v);
+    ColorRGBA32F coarse_rgba = sample_level(m_levels[coarse_level], u, v);
+
+    return fine_rgba * (1.0f - coarse_weight) + coarse_rgba * coarse_weight;
+}
+
+#if TILED_TEXTURE_SSE
+/**
+ * The 4 channels of an RGBA8 texel in the 4 lanes, in [0, 255]
+ */
+static inline __m128 unpack_rgba8(unsigned int texel)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i bytes = _mm_cvtsi32_si128(static_cast<int>(texel));
+    __m128i words = _mm_unpacklo_epi8(bytes, zero);
+
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+#endif
+
+ColorRGBA32F TiledTexture::sample_level(const Level& level, float u, float v) const
+{
+    // Same texel coordinates as get_bilinear_texels()
+    float x = u * (level.width - 1) - 0.5f;
+    float y = v * (level.height - 1) - 0.5f;
+    float x_floor = std::floor(x);
+    float y_floor = std::floor(y);
+    float fractional_x = x - x_floor;
+    float fractional_y = y - y_floor;
+
+    int x0 = (static_cast<int>(x_floor) + level.width) % level.width;
+    int y0 = (static_cast<int>(y_floor) + level.height) % level.height;
+    int x1 = (x0 + 1) % level.width;
+    int y1 = (y0 + 1) % level.height;
+
+    auto get_texel = [&level](int texel_x, int texel_y)
+    {
+        int tile_index = (texel_y / TILE_SIZE) * level.tiles_per_row + texel_x / TILE_SIZE;
+
+        return level.texels[tile_index * TILE_SIZE * TILE_SIZE + (texel_y % TILE_SIZE) * TILE_SIZE + texel_x % TILE_SIZE];
+    };
+
+    // The weights include the normalization of the texels to [0, 1]
+    float weight_00 = (1.0f - fractional_x) * (1.0f - fractional_y) * (1.0f / 255.0f);
+    float weight_10 = fractional_x * (1.0f - fractional_y) * (1.0f / 255.0f);
+    float weight_01 = (1.0f - fractional_x) * fractional_y * (1.0f / 255.0f);
+    float weight_11 = fractional_x * fractional_y * (1.0f / 255.0f);
+
+    unsigned int texel_00 = get_texel(x0, y0);
+    unsigned int texel_10 = get_texel(x1, y0);
+    unsigned int texel_01 = get_texel(x0, y1);
+    unsigned int texel_11 = get_texel(x1, y1);
+
+#if TILED_TEXTURE_SSE
+    __m128 rgba = _mm_mul_ps(unpack_rgba8(texel_00), _mm_set1_ps(weight_00));
+    rgba = _mm_add_ps(rgba, _mm_mul_ps(unpack_rgba8(texel_10), _mm_set1_ps(weight_10)));
+    rgba = _mm_add_ps(rgba, _mm_mul_ps(unpack_rgba8(texel_01), _mm_set1_ps(weight_01)));
+    rgba = _mm_add_ps(rgba, _mm_mul_ps(unpack_rgba8(texel_11), _mm_set1_ps(weight_11)));
+
+    alignas(16) float channels[4];
+    _mm_store_ps(channels, rgba);
+
+    return ColorRGBA32F(channels[0], channels[1], channels[2], channels[3]);
+#else
+    ColorRGBA32F rgba;
+    for (int channel = 0; channel < 4; channel++)
+    {
+        int shift = channel * 8;
+        rgba[channel] = ((texel_00 >> shift) & 0xFF) * weight_00 + ((texel_10 >> shift) & 0xFF) * weight_10
+                      + ((texel_01 >> shift) & 0xFF) * weight_01 + ((texel_11 >> shift) & 0xFF) * weight_11;
+    }
+
+    return rgba;
+#endif
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef TILED_TEXTURE_H
+#define TILED_TEXTURE_H
+
+#include "HostDeviceCommon/Color.h"
+#include "Image/Image.h"
+
+#include <vector>
+
+/**
+ * Material texture of the CPU renderer: the mip chain of an Image8Bit with the texels of each level
+ * stored as RGBA8 in tiles of TILE_SIZE * TILE_SIZE texels instead of row after row.
+ *
+ * The 4 texels of a bilinear lookup are then in the same tile (same cache lines) most of the time, and
+ * so are the lookups of neighbouring hits, instead of being in rows that are a whole row of the image apart.
+ * The texels are filtered with SSE.
+ *
+ * Sampled with the same texel coordinates conventions as the hardware filtered textures of the
+ * GPU renderer (see get_bilinear_texels()) and the same mip levels (see Image8Bit::downsample_2x())
+ */
+class TiledTexture
+{
+public:
+    static constexpr int TILE_SIZE = 8;
+
+    TiledTexture() {}
+    TiledTexture(const Image8Bit& image);
+
+    /**
+     * Bilinearly samples the level 'level' of the texture in repeat mode. Fractional levels blend the
+     * two closest levels, levels beyond the coarsest one sample the coarsest one.
+     *
+     * The channels that the image of the texture doesn't have are 0 (1 for the alpha)
+     */
+    ColorRGBA32F sample_rgba32f(float2 uv, float level = 0.0f) const;
+
+    int get_level_count() const;
+
+private:
+    struct Level
+    {
+        int width = 0;
+        int height = 0;
+        int tiles_per_row = 0;
+
+        // RGBA8 texels, tile after tile
+        std::vector<unsigned int> texels;
+    };
+
+    static Level create_level(const Image8Bit& image);
+    ColorRGBA32F sample_level(const Level& level, float u, float v) const;
+
+    std::vector<Level> m_levels;
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/GPUKernel.h"
+#include "Compiler/GPUKernelCompilerOptions.h"
+#include "Compiler/KernelLaunchAutotuner.h"
+#include "Device/kernels/BSDFBenchmark.h"
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HostDeviceCommon/KernelOptions.h"
+#include "Renderer/BSDFMicrobenchmark.h"
+#include "Renderer/RenderBenchmark.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+extern ImGuiLogger g_imgui_logger;
+extern KernelLaunchAutotuner g_kernel_launch_autotuner;
+
+const std::string BSDFMicrobenchmark::BSDF_BENCHMARK_COMMANDLINE_ARGUMENT = "--bsdf-benchmark";
+
+// Threads per block of the launches, the __launch_bounds__ of the kernel
+static constexpr int BSDF_BENCHMARK_BLOCK_SIZE = 64;
+
+/**
+ * Result of one operation of one configuration
+ */
+struct BSDFMicrobenchmarkMeasure
+{
+	// False if the BSDF doesn't have that operation
+	bool measured = false;
+
+	double evaluations_per_second = 0.0;
+
+	// Only for the sample operation
+	double mean_albedo = 0.0;
+	double variance_per_sample = 0.0;
+};
+
+static bool bsdf_has_operation(int bsdf, int operation)
+{
+	if (operation == BSDF_BENCHMARK_PDF)
+		return bsdf == BSDF_BENCHMARK_COOK_TORRANCE;
+	else if (operation == BSDF_BENCHMARK_EVAL)
+		// Delta distribution
+		return bsdf != BSDF_BENCHMARK_GLASS;
+
+	return true;
+}
+
+/**
+ * Random materials and view directions (upper hemisphere of the +Z shading normal) of the items of the benchmark
+ */
+static void generate_items(std::vector<SimplifiedRendererMaterial>& out_materials, std::vector<float3>& out_view_directions)
+{
+	Xorshift32Generator random_number_generator(42);
+
+	out_materials.resize(BSDFMicrobenchmark::ITEM_COUNT);
+	out_view_directions.resize(BSDFMicrobenchmark::ITEM_COUNT);
+	for (int i = 0; i < BSDFMicrobenchmark::ITEM_COUNT; i++)
+	{
+		SimplifiedRendererMaterial& material = out_materials[i];
+		material.brdf_type = BRDF::Disney;
+		material.base_color = ColorRGB32F(random_number_generator(), random_number_generator(), random_number_generator());
+		// Not down to 0, the smooth surfaces are delta distributions the BSDFs don't all handle
+		material.roughness = 0.05f + 0.95f * random_number_generator();
+		material.oren_nayar_sigma = random_number_generator() * M_PI * 0.5f;
+		material.metallic = random_number_generator();
+		material.specular = random_number_generator();
+		material.specular_tint = random_number_generator();
+		material.anisotropic = random_number_generator() < 0.5f ? 0.0f : random_number_generator();
+		material.anisotropic_rotation = random_number_generator();
+		material.clearcoat = random_number_generator() < 0.5f ? 0.0f : random_number_generator();
+		material.clearcoat_roughness = 0.05f + 0.95f * random_number_generator();
+		material.sheen = random_number_generator() < 0.5f ? 0.0f : random_number_generator();
+		material.sheen_tint = random_number_generator();
+		material.ior = 1.1f + random_number_generator();
+		material.make_safe();
+		material.precompute_properties();
+
+		out_view_directions[i] = cosine_weighted_sample(make_float3(0.0f, 0.0f, 1.0f), random_number_generator);
+	}
+}
+
+/**
+ * Fills the albedo and variance of 'measure' from the per item outputs of the sample operation
+ */
+static void read_sample_statistics(const std::vector<float>& values, BSDFMicrobenchmarkMeasure& measure)
+{
+	double albedo_sum = 0.0;
+	double variance_sum = 0.0;
+	for (int i = 0; i < BSDFMicrobenchmark::ITEM_COUNT; i++)
+	{
+		albedo_sum += values[i * 2 + 0];
+		variance_sum += values[i * 2 + 1];
+	}
+
+	measure.mean_albedo = albedo_sum / BSDFMicrobenchmark::ITEM_COUNT;
+	measure.variance_per_sample = variance_sum / BSDFMicrobenchmark::ITEM_COUNT;
+}
+
+static std::vector<BSDFMicrobenchmarkMeasure> measure_gpu(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const BSDFMicrobenchmarkConfiguration& configuration, OrochiBuffer<SimplifiedRendererMaterial>& materials, OrochiBuffer<float3>& view_directions, OrochiBuffer<float>& values, const CommandlineArguments& arguments)
+{
+	GPUKernel kernel(DEVICE_KERNELS_DIRECTORY "/BSDFBenchmark.h", "BSDFBenchmark");
+	kernel.get_kernel_options().set_macro_value("BSDFBenchmarkBSDF", configuration.bsdf);
+	kernel.get_kernel_options().set_macro_value(GPUKernelCompilerOptions::GGX_SAMPLE_FUNCTION, configuration.ggx_sample_function);
+	kernel.set_launch_tuning_allowed(false);
+	kernel.compile(hiprt_orochi_ctx);
+
+	SimplifiedRendererMaterial* materials_pointer = materials.get_device_pointer();
+	float3* view_directions_pointer = view_directions.get_device_pointer();
+	float* values_pointer = values.get_device_pointer();
+	int item_count = BSDFMicrobenchmark::ITEM_COUNT;
+	int bsdf = configuration.bsdf;
+	int sample_count = BSDFMicrobenchmark::SAMPLES_PER_ITEM;
+
+	std::vector<BSDFMicrobenchmarkMeasure> measures(3);
+	for (int operation : { BSDF_BENCHMARK_EVAL, BSDF_BENCHMARK_SAMPLE, BSDF_BENCHMARK_PDF })
+	{
+		if (!bsdf_has_operation(configuration.bsdf, operation))
+			continue;
+
+		void* launch_args[] = { &materials_pointer, &view_directions_pointer, &item_count, &bsdf, &operation, &sample_count, &values_pointer };
+
+		std::vector<float> launch_times;
+		for (int launch = 0; launch < arguments.benchmark_warmup_frames + arguments.benchmark_frames; launch++)
+		{
+			float launch_time_ms;
+			kernel.launch_timed_synchronous(BSDF_BENCHMARK_BLOCK_SIZE, 1, item_count, 1, launch_args, &launch_time_ms);
+
+			if (launch >= arguments.benchmark_warmup_frames)
+				launch_times.push_back(launch_time_ms);
+		}
+
+		BSDFMicrobenchmarkMeasure& measure = measures[operation];
+		measure.measured = true;
+		measure.evaluations_per_second = static_cast<double>(item_count) * sample_count / (RenderBenchmark::compute_statistics(launch_times).mean / 1000.0);
+		if (operation == BSDF_BENCHMARK_SAMPLE)
+			read_sample_statistics(values.download_data(), measure);
+	}
+
+	return measures;
+}
+
+static std::vector<BSDFMicrobenchmarkMeasure> measure_cpu(const BSDFMicrobenchmarkConfiguration& configuration, const std::vector<SimplifiedRendererMaterial>& materials, const std::vector<float3>& view_directions)
+{
+	std::vector<float> values(BSDFMicrobenchmark::ITEM_COUNT * 2);
+
+	std::vector<BSDFMicrobenchmarkMeasure> measures(3);
+	for (int operation : { BSDF_BENCHMARK_EVAL, BSDF_BENCHMARK_SAMPLE, BSDF_BENCHMARK_PDF })
+	{
+		if (!bsdf_has_operation(configuration.bsdf, operation))
+			continue;
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+#pragma omp parallel for schedule(static, BSDFMicrobenchmark::CPU_BATCH_SIZE)
+		for (int item_index = 0; item_index < BSDFMicrobenchmark::ITEM_COUNT; item_index++)
+			BSDFBenchmark(materials.data(), view_directions.data(), BSDFMicrobenchmark::ITEM_COUNT, configuration.bsdf, operation, BSDFMicrobenchmark::SAMPLES_PER_ITEM, values.data(), item_index);
+		double elapsed_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		BSDFMicrobenchmarkMeasure& measure = measures[operation];
+		measure.measured = true;
+		measure.evaluations_per_second = static_cast<double>(BSDFMicrobenchmark::ITEM_COUNT) * BSDFMicrobenchmark::SAMPLES_PER_ITEM / elapsed_s;
+		if (operation == BSDF_BENCHMARK_SAMPLE)
+			read_sample_statistics(values, measure);
+	}
+
+	return measures;
+}
+
+static void write_measures(std::ofstream& output_file, const std::vector<BSDFMicrobenchmarkMeasure>& measures)
+{
+	output_file << "{ ";
+	output_file << "\"eval_per_second\": ";
+	if (measures[BSDF_BENCHMARK_EVAL].measured)
+		output_file << measures[BSDF_BENCHMARK_EVAL].evaluations_per_second;
+	else
+		output_file << "null";
+	output_file << ", \"sample_per_second\": " << measures[BSDF_BENCHMARK_SAMPLE].evaluations_per_second;
+	output_file << ", \"pdf_per_second\": ";
+	if (measures[BSDF_BENCHMARK_PDF].measured)
+		output_file << measures[BSDF_BENCHMARK_PDF].evaluations_per_second;
+	else
+		output_file << "null";
+	output_file << ", \"mean_albedo\": " << measures[BSDF_BENCHMARK_SAMPLE].mean_albedo;
+	output_file << ", \"variance_per_sample\": " << measures[BSDF_BENCHMARK_SAMPLE].variance_per_sample;
+	output_file << " }";
+}
+
+std::vector<BSDFMicrobenchmarkConfiguration> BSDFMicrobenchmark::get_configurations()
+{
+	std::vector<BSDFMicrobenchmarkConfiguration> configurations;
+	configurations.push_back({ "LAMBERTIAN", BSDF_BENCHMARK_LAMBERTIAN, GGXAnisotropicSampleFunction });
+	configurations.push_back({ "OREN_NAYAR", BSDF_BENCHMARK_OREN_NAYAR, GGXAnisotropicSampleFunction });
+	configurations.push_back({ "COOK_TORRANCE", BSDF_BENCHMARK_COOK_TORRANCE, GGXAnisotropicSampleFunction });
+	configurations.push_back({ "SMOOTH_GLASS", BSDF_BENCHMARK_GLASS, GGXAnisotropicSampleFunction });
+	configurations.push_back({ "DISNEY/GGX_NO_VNDF", BSDF_BENCHMARK_DISNEY, GGX_NO_VNDF });
+	configurations.push_back({ "DISNEY/GGX_VNDF_SAMPLING", BSDF_BENCHMARK_DISNEY, GGX_VNDF_SAMPLING });
+	configurations.push_back({ "DISNEY/GGX_VNDF_SPHERICAL_CAPS", BSDF_BENCHMARK_DISNEY, GGX_VNDF_SPHERICAL_CAPS });
+	configurations.push_back({ "DISNEY/GGX_VNDF_BOUNDED", BSDF_BENCHMARK_DISNEY, GGX_VNDF_BOUNDED });
+
+	return configurations;
+}
+
+int BSDFMicrobenchmark::run(const CommandlineArguments& arguments)
+{
+	if (arguments.benchmark_frames <= 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The BSDF benchmark needs at least one measured launch.");
+
+		return 1;
+	}
+
+	std::ofstream output_file(arguments.benchmark_output_file_path);
+	if (!output_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the BSDF benchmark results to \"%s\"", arguments.benchmark_output_file_path.c_str());
+
+		return 1;
+	}
+
+	// The launches all use BSDF_BENCHMARK_BLOCK_SIZE threads per block
+	g_kernel_launch_autotuner.set_enabled(false);
+
+	std::vector<SimplifiedRendererMaterial> materials;
+	std::vector<float3> view_directions;
+	generate_items(materials, view_directions);
+
+	std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(arguments.gpu_indices[0]);
+	OrochiBuffer<SimplifiedRendererMaterial> device_materials(BSDFMicrobenchmark::ITEM_COUNT);
+	OrochiBuffer<float3> device_view_directions(BSDFMicrobenchmark::ITEM_COUNT);
+	OrochiBuffer<float> device_values(BSDFMicrobenchmark::ITEM_COUNT * 2);
+	device_materials.upload_data(materials);
+	device_view_directions.upload_data(view_directions);
+
+	output_file << "{\n";
+	output_file << "\t\"device\": \"" << RenderBenchmark::escape_json_string(hiprt_orochi_ctx->device_properties.name) << "\",\n";
+	output_file << "\t\"items\": " << BSDFMicrobenchmark::ITEM_COUNT << ",\n";
+	output_file << "\t\"samples_per_item\": " << BSDFMicrobenchmark::SAMPLES_PER_ITEM << ",\n";
+	output_file << "\t\"warmup_launches\": " << arguments.benchmark_warmup_frames << ",\n";
+	output_file << "\t\"measured_launches\": " << arguments.benchmark_frames << ",\n";
+	output_file << "\t\"configurations\": [";
+
+	std::vector<BSDFMicrobenchmarkConfiguration> configurations = BSDFMicrobenchmark::get_configurations();
+	for (int configuration_index = 0; configuration_index < configurations.size(); configuration_index++)
+	{
+		const BSDFMicrobenchmarkConfiguration& configuration = configurations[configuration_index];
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "BSDF benchmark: %s", configuration.name.c_str());
+
+		output_file << (configuration_index == 0 ? "\n" : ",\n");
+		output_file << "\t\t{\n";
+		output_file << "\t\t\t\"name\": \"" << configuration.name << "\",\n";
+		output_file << "\t\t\t\"gpu\": ";
+		write_measures(output_file, measure_gpu(hiprt_orochi_ctx, configuration, device_materials, device_view_directions, device_values, arguments));
+		if (configuration.ggx_sample_function == GGXAnisotropicSampleFunction)
+		{
+			// The CPU is built with one GGX sample function only
+			output_file << ",\n\t\t\t\"cpu\": ";
+			write_measures(output_file, measure_cpu(configuration, materials, view_directions));
+		}
+		output_file << "\n\t\t}";
+	}
+
+	output_file << "\n\t]\n";
+	output_file << "}\n";
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "BSDF benchmark results written to \"%s\"", arguments.benchmark_output_file_path.c_str());
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef BSDF_MICROBENCHMARK_H
+#define BSDF_MICROBENCHMARK_H
+
+#include "Utils/CommandlineArguments.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * BSDF and GGX sample function one configuration of the BSDF microbenchmark measures
+ */
+struct BSDFMicrobenchmarkConfiguration
+{
+	std::string name;
+
+	// BSDF_BENCHMARK_LAMBERTIAN, ... of Device/kernels/BSDFBenchmark.h
+	int bsdf;
+	// GGXAnisotropicSampleFunction the kernel is compiled with. Only changes the Disney BSDF
+	int ggx_sample_function;
+};
+
+/**
+ * Microbenchmark of the BSDFs alone, without any scene: judges the changes to a BSDF by its cost and
+ * by the quality of its importance sampling instead of by full scene frame times.
+ *
+ * The application started with BSDF_BENCHMARK_COMMANDLINE_ARGUMENT generates ITEM_COUNT random materials
+ * (base color, roughness, metallic, anisotropy, clearcoat, sheen, IOR, ...) and view directions and, for every
+ * configuration of get_configurations(), runs SAMPLES_PER_ITEM times per item each operation of the BSDF:
+ * eval (the BSDF and its PDF in cosine distributed directions), sample and, for the BSDFs that have a standalone PDF
+ * function, the PDF. The operations run:
+ *	- on the first device of --gpus with the BSDFBenchmark kernel, compiled for the BSDF and GGX sample function of the
+ *	  configuration: 'benchmark_warmup_frames' launches not measured followed by 'benchmark_frames' timed launches
+ *	- on the CPU with the same function on all the threads, each thread running contiguous batches of CPU_BATCH_SIZE
+ *	  items. The GGX sample function of the CPU is the one it was built with, the other ones are only measured on the GPU
+ *
+ * The evaluations per second of every operation are written as JSON to 'benchmark_output_file_path' with the mean
+ * directional albedo estimated by the sample operation and its variance per sample (mean over the items of the
+ * variance of the BSDF * cos / PDF weight of one sample): the lower the variance the better the sampling.
+ * The "BSDFBenchmark" CMake target runs the benchmark.
+ *
+ * The Disney materials are opaque: the glass lobe of the Disney BSDF needs a materials buffer and the nested
+ * dielectrics state of a path. Refraction is measured with the smooth glass BSDF, which can only be sampled
+ */
+class BSDFMicrobenchmark
+{
+public:
+	static const std::string BSDF_BENCHMARK_COMMANDLINE_ARGUMENT;
+
+	static constexpr int ITEM_COUNT = 1 << 18;
+	static constexpr int SAMPLES_PER_ITEM = 32;
+	static constexpr int CPU_BATCH_SIZE = 256;
+
+	/**
+	 * Returns the exit code of the application
+	 */
+	static int run(const CommandlineArguments& arguments);
+
+	static std::vector<BSDFMicrobenchmarkConfiguration> get_configurations();
+};
+
+#endif
@@ -4,67 +4,885 @@
  */
 
 #include <algorithm>
-#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
 #include "Renderer/BVH.h"
 
-const float3 BoundingVolume::PLANE_NORMALS[BVHConstants::PLANES_COUNT] = {
-	make_float3(1, 0, 0),
-	make_float3(0, 1, 0),
-    make_float3(0, 0, 1),
-    make_float3(std::sqrt(3.0f) / 3, std::sqrt(3.0f) / 3, std::sqrt(3.0f) / 3),
-    make_float3(-std::sqrt(3.0f) / 3, std::sqrt(3.0f) / 3, std::sqrt(3.0f) / 3),
-    make_float3(-std::sqrt(3.0f) / 3, -std::sqrt(3.0f) / 3, std::sqrt(3.0f) / 3),
-    make_float3(std::sqrt(3.0f) / 3, -std::sqrt(3.0f) / 3, std::sqrt(3.0f) / 3),
-};
+static float bounding_box_surface_area(const BoundingBox& box)
+{
+	float3 extent = box.maxi - box.mini;
+	if (extent.x < 0.0f || extent.y < 0.0f || extent.z < 0.0f)
+		// Empty box
+		return 0.0f;
+
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static float float3_component(const float3& vector, int axis)
+{
+	return axis == 0 ? vector.x : (axis == 1 ? vector.y : vector.z);
+}
+
+static int get_bin_index(const float3& centroid, int axis, float axis_min, float axis_extent)
+{
+	int bin_index = static_cast<int>(BVHConstants::SAH_BIN_COUNT * (float3_component(centroid, axis) - axis_min) / axis_extent);
+
+	return hippt::clamp(0, BVHConstants::SAH_BIN_COUNT - 1, bin_index);
+}
+
+/**
+ * Slab test of a ray against all the children of a wide node at once.
+ * 
+ * Returns the mask of the children hit closer than 'closest_t' and stores
+ * the distance to the entry point in each child in 'out_t_near_values'
+ */
+static int wide_node_children_hit_mask(const BVH::WideNode& node, const SIMDFloat& origin_x, const SIMDFloat& origin_y, const SIMDFloat& origin_z, const SIMDFloat& inverse_direction_x, const SIMDFloat& inverse_direction_y, const SIMDFloat& inverse_direction_z, float closest_t, float* out_t_near_values)
+{
+	SIMDFloat t0_x = (SIMDFloat::load(node.bbox_min_x) - origin_x) * inverse_direction_x;
+	SIMDFloat t0_y = (SIMDFloat::load(node.bbox_min_y) - origin_y) * inverse_direction_y;
+	SIMDFloat t0_z = (SIMDFloat::load(node.bbox_min_z) - origin_z) * inverse_direction_z;
+	SIMDFloat t1_x = (SIMDFloat::load(node.bbox_max_x) - origin_x) * inverse_direction_x;
+	SIMDFloat t1_y = (SIMDFloat::load(node.bbox_max_y) - origin_y) * inverse_direction_y;
+	SIMDFloat t1_z = (SIMDFloat::load(node.bbox_max_z) - origin_z) * inverse_direction_z;
+
+	SIMDFloat t_near = simd_max(simd_max(simd_min(t0_x, t1_x), simd_min(t0_y, t1_y)), simd_max(simd_min(t0_z, t1_z), SIMDFloat(0.0f)));
+	SIMDFloat t_far = simd_min(simd_min(simd_max(t0_x, t1_x), simd_max(t0_y, t1_y)), simd_min(simd_max(t0_z, t1_z), SIMDFloat(closest_t)));
+
+	simd_store(out_t_near_values, t_near);
+
+	return (t_near <= t_far).to_int() & ((1 << node.child_count) - 1);
+}
 
-BVH::BVH() : m_root(nullptr), m_triangles(nullptr) {}
-BVH::BVH(std::vector<Triangle>* triangles, int max_depth, int leaf_max_obj_count) : m_triangles(triangles)
+BVH::BVH() : m_triangles(nullptr) {}
+BVH::BVH(std::vector<Triangle>* triangles, int leaf_max_obj_count) : m_triangles(triangles)
 {
-	BoundingVolume volume;
-	float3 minimum = make_float3(INFINITY, INFINITY, INFINITY);
-	float3 maximum = make_float3(-INFINITY, -INFINITY, -INFINITY);
+	if (triangles->empty())
+		return;
 
-	for (const Triangle& triangle : *triangles)
+	int triangle_count = static_cast<int>(triangles->size());
+	std::vector<BuildTriangle> build_triangles(triangle_count);
+	m_triangle_indices.resize(triangle_count);
+
+#pragma omp parallel for
+	for (int triangle_id = 0; triangle_id < triangle_count; triangle_id++)
 	{
-		volume.extend_volume(triangle);
+		const Triangle& triangle = (*triangles)[triangle_id];
 
+		BoundingBox bounds;
 		for (int i = 0; i < 3; i++)
+			bounds.extend(triangle[i]);
+
+		build_triangles[triangle_id].bounds = bounds;
+		build_triangles[triangle_id].centroid = (bounds.mini + bounds.maxi) * 0.5f;
+		m_triangle_indices[triangle_id] = triangle_id;
+	}
+
+	std::vector<FlattenedNode> top_nodes;
+	std::vector<PendingSubtree> pending_subtrees;
+	build_top_levels(build_triangles, 0, triangle_count, leaf_max_obj_count, top_nodes, pending_subtrees);
+
+	// Building the biggest subtrees first for a better load balancing between the threads
+	std::vector<int> subtrees_order(pending_subtrees.size());
+	for (int i = 0; i < subtrees_order.size(); i++)
+		subtrees_order[i] = i;
+	std::sort(subtrees_order.begin(), subtrees_order.end(), [&pending_subtrees](int a, int b)
+	{
+		return pending_subtrees[a].end - pending_subtrees[a].begin > pending_subtrees[b].end - pending_subtrees[b].begin;
+	});
+
+	// The subtrees are over disjoint ranges of 'm_triangle_indices' so they can be built concurrently
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < subtrees_order.size(); i++)
+	{
+		PendingSubtree& subtree = pending_subtrees[subtrees_order[i]];
+
+		// A binary tree with at least one triangle per leaf has at most 2 * N - 1 nodes
+		subtree.nodes.reserve((subtree.end - subtree.begin) * 2);
+		build_recursive(build_triangles, subtree.begin, subtree.end, leaf_max_obj_count, subtree.nodes);
+	}
+
+	size_t node_count = top_nodes.size();
+	for (const PendingSubtree& subtree : pending_subtrees)
+		node_count += subtree.nodes.size();
+
+	m_nodes.reserve(node_count);
+	flatten_top_levels(top_nodes, 0, pending_subtrees);
+
+	// A wide BVH has roughly (BVH_SIMD_WIDTH - 1) times less nodes than the binary one
+	m_wide_nodes.reserve(m_nodes.size() / (BVH_SIMD_WIDTH - 1) + 1);
+	collapse(0);
+
+	m_wide_nodes.shrink_to_fit();
+	m_triangle_packets.shrink_to_fit();
+	std::vector<FlattenedNode>().swap(m_nodes);
+	std::vector<int>().swap(m_triangle_indices);
+}
+
+void BVH::build_top_levels(std::vector<BuildTriangle>& build_triangles, int begin, int end, int leaf_max_obj_count, std::vector<FlattenedNode>& top_nodes, std::vector<PendingSubtree>& pending_subtrees)
+{
+	int node_index = static_cast<int>(top_nodes.size());
+	top_nodes.emplace_back();
+
+	if (end - begin < BVHConstants::PARALLEL_BUILD_THRESHOLD)
+	{
+		// Small enough to be built by a single thread
+		top_nodes[node_index].offset = static_cast<int>(pending_subtrees.size());
+		top_nodes[node_index].triangle_count = -1;
+
+		pending_subtrees.push_back({ begin, end, {} });
+
+		return;
+	}
+
+	BoundingBox node_bounds, centroid_bounds;
+	compute_bounds(build_triangles, begin, end, true, node_bounds, centroid_bounds);
+	top_nodes[node_index].bbox_min = node_bounds.mini;
+	top_nodes[node_index].bbox_max = node_bounds.maxi;
+
+	int split_index = split(build_triangles, begin, end, node_bounds, centroid_bounds, leaf_max_obj_count, true);
+	if (split_index == -1)
+	{
+		top_nodes[node_index].offset = begin;
+		top_nodes[node_index].triangle_count = end - begin;
+
+		return;
+	}
+
+	build_top_levels(build_triangles, begin, split_index, leaf_max_obj_count, top_nodes, pending_subtrees);
+	int right_child_index = static_cast<int>(top_nodes.size());
+	build_top_levels(build_triangles, split_index, end, leaf_max_obj_count, top_nodes, pending_subtrees);
+
+	top_nodes[node_index].offset = right_child_index;
+	top_nodes[node_index].triangle_count = 0;
+}
+
+int BVH::build_recursive(std::vector<BuildTriangle>& build_triangles, int begin, int end, int leaf_max_obj_count, std::vector<FlattenedNode>& out_nodes)
+{
+	BoundingBox node_bounds, centroid_bounds;
+	compute_bounds(build_triangles, begin, end, false, node_bounds, centroid_bounds);
+
+	int node_index = static_cast<int>(out_nodes.size());
+	out_nodes.emplace_back();
+	out_nodes[node_index].bbox_min = node_bounds.mini;
+	out_nodes[node_index].bbox_max = node_bounds.maxi;
+
+	int split_index = split(build_triangles, begin, end, node_bounds, centroid_bounds, leaf_max_obj_count, false);
+	if (split_index == -1)
+	{
+		out_nodes[node_index].offset = begin;
+		out_nodes[node_index].triangle_count = end - begin;
+
+		return node_index;
+	}
+
+	// The left child is always right after its parent in the nodes array
+	build_recursive(build_triangles, begin, split_index, leaf_max_obj_count, out_nodes);
+	int right_child_index = build_recursive(build_triangles, split_index, end, leaf_max_obj_count, out_nodes);
+
+	out_nodes[node_index].offset = right_child_index;
+	out_nodes[node_index].triangle_count = 0;
+
+	return node_index;
+}
+
+void BVH::flatten_top_levels(const std::vector<FlattenedNode>& top_nodes, int node_index, const std::vector<PendingSubtree>& pending_subtrees)
+{
+	const FlattenedNode& node = top_nodes[node_index];
+
+	if (node.triangle_count == -1)
+	{
+		// Placeholder, copying the subtree and offsetting the indices of its interior nodes' children
+		int subtree_offset = static_cast<int>(m_nodes.size());
+		for (FlattenedNode subtree_node : pending_subtrees[node.offset].nodes)
 		{
-			minimum = hippt::min(minimum, triangle[i]);
-			maximum = hippt::max(maximum, triangle[i]);
+			if (!subtree_node.is_leaf())
+				subtree_node.offset += subtree_offset;
+
+			m_nodes.push_back(subtree_node);
 		}
 	}
+	else if (node.is_leaf())
+		m_nodes.push_back(node);
+	else
+	{
+		int flattened_index = static_cast<int>(m_nodes.size());
+		m_nodes.push_back(node);
 
-	//We now have a bounding volume to work with
-	build_bvh(max_depth, leaf_max_obj_count, minimum, maximum, volume);
+		flatten_top_levels(top_nodes, node_index + 1, pending_subtrees);
+		m_nodes[flattened_index].offset = static_cast<int>(m_nodes.size());
+		flatten_top_levels(top_nodes, node.offset, pending_subtrees);
+	}
 }
 
-BVH::~BVH()
+void BVH::compute_bounds(const std::vector<BuildTriangle>& build_triangles, int begin, int end, bool parallel, BoundingBox& out_node_bounds, BoundingBox& out_centroid_bounds) const
 {
-	delete m_root;
+	out_node_bounds = BoundingBox();
+	out_centroid_bounds = BoundingBox();
+
+#pragma omp parallel if(parallel)
+	{
+		BoundingBox thread_node_bounds, thread_centroid_bounds;
+
+#pragma omp for nowait
+		for (int i = begin; i < end; i++)
+		{
+			const BuildTriangle& build_triangle = build_triangles[m_triangle_indices[i]];
+
+			thread_node_bounds.extend(build_triangle.bounds);
+			thread_centroid_bounds.extend(build_triangle.centroid);
+		}
+
+#pragma omp critical
+		{
+			out_node_bounds.extend(thread_node_bounds);
+			out_centroid_bounds.extend(thread_centroid_bounds);
+		}
+	}
+}
+
+int BVH::split(std::vector<BuildTriangle>& build_triangles, int begin, int end, const BoundingBox& node_bounds, const BoundingBox& centroid_bounds, int leaf_max_obj_count, bool parallel)
+{
+	int triangle_count = end - begin;
+	if (triangle_count == 1)
+		return -1;
+
+	struct Bin
+	{
+		BoundingBox bounds;
+		int triangle_count = 0;
+	};
+
+	// The bins are distributed over the extent of the centroids, not of the triangles
+	float3 centroid_extent = centroid_bounds.maxi - centroid_bounds.mini;
+
+	// Binning the triangles along the 3 axes at once
+	Bin bins[3][BVHConstants::SAH_BIN_COUNT];
+#pragma omp parallel if(parallel)
+	{
+		Bin thread_bins[3][BVHConstants::SAH_BIN_COUNT];
+
+#pragma omp for nowait
+		for (int i = begin; i < end; i++)
+		{
+			const BuildTriangle& build_triangle = build_triangles[m_triangle_indices[i]];
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float axis_extent = float3_component(centroid_extent, axis);
+				if (axis_extent <= 0.0f)
+					continue;
+
+				int bin_index = get_bin_index(build_triangle.centroid, axis, float3_component(centroid_bounds.mini, axis), axis_extent);
+				thread_bins[axis][bin_index].bounds.extend(build_triangle.bounds);
+				thread_bins[axis][bin_index].triangle_count++;
+			}
+		}
+
+#pragma omp critical
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				for (int bin = 0; bin < BVHConstants::SAH_BIN_COUNT; bin++)
+				{
+					bins[axis][bin].bounds.extend(thread_bins[axis][bin].bounds);
+					bins[axis][bin].triangle_count += thread_bins[axis][bin].triangle_count;
+				}
+			}
+		}
+	}
+
+	float node_area = bounding_box_surface_area(node_bounds);
+	float best_cost = std::numeric_limits<float>::max();
+	int best_axis = -1;
+	int best_bin = -1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (float3_component(centroid_extent, axis) <= 0.0f)
+			// All the centroids are on the same plane along that axis, can't split
+			continue;
+
+		// Sweeping from the right to get the area and count of the right
+		// side of each split plane
+		float right_areas[BVHConstants::SAH_BIN_COUNT - 1];
+		int right_counts[BVHConstants::SAH_BIN_COUNT - 1];
+		BoundingBox right_bounds;
+		int right_count = 0;
+		for (int bin = BVHConstants::SAH_BIN_COUNT - 1; bin > 0; bin--)
+		{
+			right_bounds.extend(bins[axis][bin].bounds);
+			right_count += bins[axis][bin].triangle_count;
+
+			right_areas[bin - 1] = bounding_box_surface_area(right_bounds);
+			right_counts[bin - 1] = right_count;
+		}
+
+		// Sweeping from the left and evaluating the cost of splitting after each bin
+		BoundingBox left_bounds;
+		int left_count = 0;
+		for (int bin = 0; bin < BVHConstants::SAH_BIN_COUNT - 1; bin++)
+		{
+			left_bounds.extend(bins[axis][bin].bounds);
+			left_count += bins[axis][bin].triangle_count;
+
+			if (left_count == 0 || right_counts[bin] == 0)
+				continue;
+
+			float cost = bounding_box_surface_area(left_bounds) * left_count + right_areas[bin] * right_counts[bin];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = bin;
+			}
+		}
+	}
+
+	if (best_axis == -1)
+	{
+		// All the centroids are at the same position
+		if (triangle_count <= leaf_max_obj_count)
+			return -1;
+
+		// Too many triangles for a single leaf, splitting in the middle of the range
+		// so that the leaves stay small
+		return begin + triangle_count / 2;
+	}
+
+	if (triangle_count <= leaf_max_obj_count)
+	{
+		// Only splitting if that's cheaper than intersecting all the triangles of the node
+		float split_cost = BVHConstants::SAH_TRAVERSAL_COST + (node_area > 0.0f ? best_cost / node_area : 0.0f);
+		if (split_cost >= triangle_count)
+			return -1;
+	}
+
+	float axis_min = float3_component(centroid_bounds.mini, best_axis);
+	float axis_extent = float3_component(centroid_extent, best_axis);
+	auto middle = std::partition(m_triangle_indices.begin() + begin, m_triangle_indices.begin() + end, [&](int triangle_id)
+	{
+		return get_bin_index(build_triangles[triangle_id].centroid, best_axis, axis_min, axis_extent) <= best_bin;
+	});
+
+	return static_cast<int>(middle - m_triangle_indices.begin());
+}
+
+int BVH::collapse(int node_index)
+{
+	int wide_node_index = static_cast<int>(m_wide_nodes.size());
+	m_wide_nodes.emplace_back();
+
+	int children[BVH_SIMD_WIDTH];
+	int child_count = 0;
+	if (m_nodes[node_index].is_leaf())
+		// Only happens if the root of the BVH is a leaf
+		children[child_count++] = node_index;
+	else
+	{
+		children[child_count++] = node_index + 1;
+		children[child_count++] = m_nodes[node_index].offset;
+	}
+
+	// Pulling the grandchildren up until the wide node is full,
+	// opening the interior child with the biggest surface area first
+	while (child_count < BVH_SIMD_WIDTH)
+	{
+		int best_child = -1;
+		float best_area = -1.0f;
+		for (int i = 0; i < child_count; i++)
+		{
+			const FlattenedNode& child = m_nodes[children[i]];
+			if (child.is_leaf())
+				continue;
+
+			float area = bounding_box_surface_area(BoundingBox(child.bbox_min, child.bbox_max));
+			if (area > best_area)
+			{
+				best_area = area;
+				best_child = i;
+			}
+		}
+
+		if (best_child == -1)
+			// Only leaves left
+			break;
+
+		int opened_node = children[best_child];
+		children[best_child] = opened_node + 1;
+		children[child_count++] = m_nodes[opened_node].offset;
+	}
+
+	for (int i = 0; i < BVH_SIMD_WIDTH; i++)
+	{
+		// Empty boxes for the unused lanes, they are masked out by 'child_count' during the traversal anyway
+		float3 bbox_min = i < child_count ? m_nodes[children[i]].bbox_min : make_float3(0.0f, 0.0f, 0.0f);
+		float3 bbox_max = i < child_count ? m_nodes[children[i]].bbox_max : make_float3(0.0f, 0.0f, 0.0f);
+
+		WideNode& wide_node = m_wide_nodes[wide_node_index];
+		wide_node.bbox_min_x[i] = bbox_min.x;
+		wide_node.bbox_min_y[i] = bbox_min.y;
+		wide_node.bbox_min_z[i] = bbox_min.z;
+		wide_node.bbox_max_x[i] = bbox_max.x;
+		wide_node.bbox_max_y[i] = bbox_max.y;
+		wide_node.bbox_max_z[i] = bbox_max.z;
+		wide_node.children[i] = -1;
+		wide_node.packet_counts[i] = 0;
+	}
+	m_wide_nodes[wide_node_index].child_count = child_count;
+
+	for (int i = 0; i < child_count; i++)
+	{
+		int child_index;
+		int packet_count = 0;
+		if (m_nodes[children[i]].is_leaf())
+		{
+			child_index = static_cast<int>(m_triangle_packets.size());
+			packet_count = build_triangle_packets(children[i]);
+		}
+		else
+			child_index = collapse(children[i]);
+
+		// Not keeping a reference on the wide node across the recursion, 'm_wide_nodes' may be reallocated
+		m_wide_nodes[wide_node_index].children[i] = child_index;
+		m_wide_nodes[wide_node_index].packet_counts[i] = packet_count;
+	}
+
+	return wide_node_index;
 }
 
-void BVH::operator=(BVH&& bvh)
+int BVH::build_triangle_packets(int leaf_index)
 {
-	m_triangles = bvh.m_triangles;
-	m_root = bvh.m_root;
+	const FlattenedNode& leaf = m_nodes[leaf_index];
+
+	int packet_count = (leaf.triangle_count + BVH_SIMD_WIDTH - 1) / BVH_SIMD_WIDTH;
+	for (int packet_index = 0; packet_index < packet_count; packet_index++)
+	{
+		TrianglePacket packet;
+		for (int lane = 0; lane < BVH_SIMD_WIDTH; lane++)
+		{
+			int leaf_triangle = packet_index * BVH_SIMD_WIDTH + lane;
+
+			int triangle_id = -1;
+			float3 vertex_A = make_float3(0.0f, 0.0f, 0.0f);
+			float3 edge_1 = make_float3(0.0f, 0.0f, 0.0f);
+			float3 edge_2 = make_float3(0.0f, 0.0f, 0.0f);
+			if (leaf_triangle < leaf.triangle_count)
+			{
+				triangle_id = m_triangle_indices[leaf.offset + leaf_triangle];
+
+				const Triangle& triangle = (*m_triangles)[triangle_id];
+				vertex_A = triangle.m_a;
+				edge_1 = triangle.m_b - triangle.m_a;
+				edge_2 = triangle.m_c - triangle.m_a;
+			}
+
+			packet.vertex_A_x[lane] = vertex_A.x;
+			packet.vertex_A_y[lane] = vertex_A.y;
+			packet.vertex_A_z[lane] = vertex_A.z;
+			packet.edge_1_x[lane] = edge_1.x;
+			packet.edge_1_y[lane] = edge_1.y;
+			packet.edge_1_z[lane] = edge_1.z;
+			packet.edge_2_x[lane] = edge_2.x;
+			packet.edge_2_y[lane] = edge_2.y;
+			packet.edge_2_z[lane] = edge_2.z;
+			packet.triangle_indices[lane] = triangle_id;
+		}
 
-	bvh.m_root = nullptr;
+		m_triangle_packets.push_back(packet);
+	}
+
+	return packet_count;
 }
 
-void BVH::build_bvh(int max_depth, int leaf_max_obj_count, float3 min, float3 max, const BoundingVolume& volume)
+bool BVH::intersect_triangle_packet(const TrianglePacket& packet, const hiprtRay& ray, float& closest_t, HitInfo& hit_info, void* filter_function_payload) const
 {
-	m_root = new OctreeNode(min, max);
+	// Same Moller-Trumbore as Triangle::intersect() but on BVH_SIMD_WIDTH triangles at once
+	const float EPSILON = 0.0000001f;
+
+	SIMDFloat direction_x(ray.direction.x), direction_y(ray.direction.y), direction_z(ray.direction.z);
+
+	SIMDFloat edge_1_x = SIMDFloat::load(packet.edge_1_x);
+	SIMDFloat edge_1_y = SIMDFloat::load(packet.edge_1_y);
+	SIMDFloat edge_1_z = SIMDFloat::load(packet.edge_1_z);
+	SIMDFloat edge_2_x = SIMDFloat::load(packet.edge_2_x);
+	SIMDFloat edge_2_y = SIMDFloat::load(packet.edge_2_y);
+	SIMDFloat edge_2_z = SIMDFloat::load(packet.edge_2_z);
+
+	// h = cross(direction, edge_2)
+	SIMDFloat h_x = direction_y * edge_2_z - direction_z * edge_2_y;
+	SIMDFloat h_y = direction_z * edge_2_x - direction_x * edge_2_z;
+	SIMDFloat h_z = direction_x * edge_2_y - direction_y * edge_2_x;
+	SIMDFloat a = edge_1_x * h_x + edge_1_y * h_y + edge_1_z * h_z;
+	SIMDFloat f = SIMDFloat(1.0f) / a;
+
+	SIMDFloat s_x = SIMDFloat(ray.origin.x) - SIMDFloat::load(packet.vertex_A_x);
+	SIMDFloat s_y = SIMDFloat(ray.origin.y) - SIMDFloat::load(packet.vertex_A_y);
+	SIMDFloat s_z = SIMDFloat(ray.origin.z) - SIMDFloat::load(packet.vertex_A_z);
+	SIMDFloat u = f * (s_x * h_x + s_y * h_y + s_z * h_z);
+
+	// q = cross(s, edge_1)
+	SIMDFloat q_x = s_y * edge_1_z - s_z * edge_1_y;
+	SIMDFloat q_y = s_z * edge_1_x - s_x * edge_1_z;
+	SIMDFloat q_z = s_x * edge_1_y - s_y * edge_1_x;
+	SIMDFloat v = f * (direction_x * q_x + direction_y * q_y + direction_z * q_z);
+	SIMDFloat t = f * (edge_2_x * q_x + edge_2_y * q_y + edge_2_z * q_z);
+
+	SIMDFloat zero(0.0f), one(1.0f);
+	// The degenerate triangles of the unused lanes are rejected by the first comparison
+	int hit_mask = (simd_abs(a) > SIMDFloat(EPSILON) & u >= zero & u <= one & v >= zero & u + v <= one 
+		& t > SIMDFloat(EPSILON) & t < SIMDFloat(closest_t)).to_int();
+	if (hit_mask == 0)
+		return false;
+
+	alignas(32) float t_values[BVH_SIMD_WIDTH];
+	alignas(32) float u_values[BVH_SIMD_WIDTH];
+	alignas(32) float v_values[BVH_SIMD_WIDTH];
+	simd_store(t_values, t);
+	simd_store(u_values, u);
+	simd_store(v_values, v);
+
+	bool intersection_found = false;
+	for (int lane = 0; lane < BVH_SIMD_WIDTH; lane++)
+	{
+		// 'closest_t' may have been updated by a previous lane
+		if (!(hit_mask & (1 << lane)) || t_values[lane] >= closest_t)
+			continue;
+
+		int triangle_id = packet.triangle_indices[lane];
+		float3 edge_1 = make_float3(packet.edge_1_x[lane], packet.edge_1_y[lane], packet.edge_1_z[lane]);
+		float3 edge_2 = make_float3(packet.edge_2_x[lane], packet.edge_2_y[lane], packet.edge_2_z[lane]);
+		float3 geometric_normal = hippt::normalize(hippt::cross(edge_1, edge_2));
+
+		hiprtHit hit;
+		hit.normal = geometric_normal;
+		hit.t = t_values[lane];
+		hit.uv = make_float2(u_values[lane], v_values[lane]);
+
+		set_hit_scene_primitive(*reinterpret_cast<AlphaTestingPayload*>(filter_function_payload)->render_data, triangle_id, hit);
+
+		if (alpha_testing(ray, nullptr, filter_function_payload, hit))
+			// Filtered out by alpha testing
+			continue;
+
+		closest_t = t_values[lane];
 
-    for (int triangle_id = 0; triangle_id < m_triangles->size(); triangle_id++)
-        m_root->insert(*m_triangles, triangle_id, 0, max_depth, leaf_max_obj_count);
+		hit_info.inter_point = ray.origin + ray.direction * closest_t;
+		hit_info.geometric_normal = geometric_normal;
+		hit_info.t = closest_t;
+		hit_info.uv = hit.uv;
+		hit_info.primitive_index = triangle_id;
 
-    m_root->compute_volume(*m_triangles);
+		intersection_found = true;
+	}
+
+	return intersection_found;
 }
 
 bool BVH::intersect(const hiprtRay& ray, HitInfo& hit_info, void* filter_function_payload) const
 {
-    return m_root->intersect(*m_triangles, ray, hit_info, filter_function_payload);
+	if (m_wide_nodes.empty())
+		return false;
+
+	struct StackEntry
+	{
+		// Index of the wide node or of the first triangle packet for leaves
+		int index;
+		// 0 for interior nodes
+		int packet_count;
+		// Distance to the entry point in the box of that node
+		float t_near;
+	};
+
+	SIMDFloat origin_x(ray.origin.x), origin_y(ray.origin.y), origin_z(ray.origin.z);
+	SIMDFloat inverse_direction_x(1.0f / ray.direction.x);
+	SIMDFloat inverse_direction_y(1.0f / ray.direction.y);
+	SIMDFloat inverse_direction_z(1.0f / ray.direction.z);
+
+	// Nothing is hit beyond the maximum distance of the ray
+	float closest_t = ray.maxT;
+	bool intersection_found = false;
+
+	StackEntry stack[BVHConstants::TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, 0.0f };
+
+	while (stack_size > 0)
+	{
+		StackEntry entry = stack[--stack_size];
+		if (entry.t_near > closest_t)
+			// A closer hit was found since that node was pushed
+			continue;
+
+		if (entry.packet_count > 0)
+		{
+			for (int i = 0; i < entry.packet_count; i++)
+				intersection_found |= intersect_triangle_packet(m_triangle_packets[entry.index + i], ray, closest_t, hit_info, filter_function_payload);
+
+			continue;
+		}
+
+		const WideNode& node = m_wide_nodes[entry.index];
+
+		alignas(32) float t_near_values[BVH_SIMD_WIDTH];
+		int hit_mask = wide_node_children_hit_mask(node, origin_x, origin_y, origin_z, inverse_direction_x, inverse_direction_y, inverse_direction_z, closest_t, t_near_values);
+		if (hit_mask == 0)
+			continue;
+
+		// Sorting the children hit by decreasing distance so that
+		// the nearest one is on top of the stack
+		int hit_children[BVH_SIMD_WIDTH];
+		int hit_count = 0;
+		for (int lane = 0; lane < BVH_SIMD_WIDTH; lane++)
+		{
+			if (!(hit_mask & (1 << lane)))
+				continue;
+
+			int insert_position = hit_count++;
+			while (insert_position > 0 && t_near_values[hit_children[insert_position - 1]] < t_near_values[lane])
+			{
+				hit_children[insert_position] = hit_children[insert_position - 1];
+				insert_position--;
+			}
+			hit_children[insert_position] = lane;
+		}
+
+		for (int i = 0; i < hit_count; i++)
+		{
+			int lane = hit_children[i];
+
+			stack[stack_size++] = { node.children[lane], node.packet_counts[lane], t_near_values[lane] };
+		}
+	}
+
+	return intersection_found;
+}
+
+bool BVH::intersect_any(const hiprtRay& ray, float t_max, void* filter_function_payload) const
+{
+	if (m_wide_nodes.empty())
+		return false;
+
+	struct StackEntry
+	{
+		// Index of the wide node or of the first triangle packet for leaves
+		int index;
+		// 0 for interior nodes
+		int packet_count;
+	};
+
+	SIMDFloat origin_x(ray.origin.x), origin_y(ray.origin.y), origin_z(ray.origin.z);
+	SIMDFloat inverse_direction_x(1.0f / ray.direction.x);
+	SIMDFloat inverse_direction_y(1.0f / ray.direction.y);
+	SIMDFloat inverse_direction_z(1.0f / ray.direction.z);
+
+	// Only needed by intersect_triangle_packet(), the hit itself isn't returned
+	HitInfo hit_info;
+	hit_info.t = -1.0f;
+
+	StackEntry stack[BVHConstants::TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0 };
+
+	while (stack_size > 0)
+	{
+		StackEntry entry = stack[--stack_size];
+
+		if (entry.packet_count > 0)
+		{
+			for (int i = 0; i < entry.packet_count; i++)
+			{
+				// 'closest_t' is reset for every packet: any hit before 't_max' ends the traversal
+				float closest_t = t_max;
+				if (intersect_triangle_packet(m_triangle_packets[entry.index + i], ray, closest_t, hit_info, filter_function_payload))
+					return true;
+			}
+
+			continue;
+		}
+
+		const WideNode& node = m_wide_nodes[entry.index];
+
+		alignas(32) float t_near_values[BVH_SIMD_WIDTH];
+		int hit_mask = wide_node_children_hit_mask(node, origin_x, origin_y, origin_z, inverse_direction_x, inverse_direction_y, inverse_direction_z, t_max, t_near_values);
+
+		// No sorting of the children, the first hit found is as good as the closest one
+		for (int lane = 0; lane < BVH_SIMD_WIDTH; lane++)
+			if (hit_mask & (1 << lane))
+				stack[stack_size++] = { node.children[lane], node.packet_counts[lane] };
+	}
+
+	return false;
+}
+
+void BVH::intersect_ray_packet(const hiprtRay* rays, int ray_count, HitInfo* hit_infos, void** filter_function_payloads, bool* out_hits) const
+{
+	for (int i = 0; i < ray_count; i++)
+		out_hits[i] = false;
+
+	if (m_wide_nodes.empty() || ray_count == 0)
+		return;
+
+	ray_count = hippt::min(ray_count, BVHConstants::RAY_PACKET_MAX_SIZE);
+
+	struct StackEntry
+	{
+		// Index of the wide node or of the first triangle packet for leaves
+		int index;
+		// 0 for interior nodes
+		int packet_count;
+		// Rays of the packet that hit the box of that node
+		uint64_t ray_mask;
+	};
+
+	float closest_t[BVHConstants::RAY_PACKET_MAX_SIZE];
+	float3 inverse_directions[BVHConstants::RAY_PACKET_MAX_SIZE];
+
+	// Bounds of the origins and of the inverse directions of the rays of the packet
+	float3 origin_min = rays[0].origin, origin_max = rays[0].origin;
+	float3 inverse_direction_min = make_float3(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	float3 inverse_direction_max = -inverse_direction_min;
+	// The interval arithmetic culling is only valid along the axes where all the direction of the
+	// rays have the same sign (the inverse of an interval that contains 0 isn't an interval)
+	bool axis_culling[3] = { true, true, true };
+	for (int i = 0; i < ray_count; i++)
+	{
+		closest_t[i] = std::numeric_limits<float>::max();
+		inverse_directions[i] = make_float3(1.0f / rays[i].direction.x, 1.0f / rays[i].direction.y, 1.0f / rays[i].direction.z);
+
+		origin_min = hippt::min(origin_min, rays[i].origin);
+		origin_max = hippt::max(origin_max, rays[i].origin);
+		inverse_direction_min = hippt::min(inverse_direction_min, inverse_directions[i]);
+		inverse_direction_max = hippt::max(inverse_direction_max, inverse_directions[i]);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float direction = float3_component(rays[i].direction, axis);
+			float first_direction = float3_component(rays[0].direction, axis);
+
+			// Also disabling the culling for rays (almost) parallel to the axis whose inverse is infinite
+			if (hippt::abs(direction) < 1.0e-8f || (direction > 0.0f) != (first_direction > 0.0f))
+				axis_culling[axis] = false;
+		}
+	}
+
+	SIMDFloat packet_origin_min[3] = { SIMDFloat(origin_min.x), SIMDFloat(origin_min.y), SIMDFloat(origin_min.z) };
+	SIMDFloat packet_origin_max[3] = { SIMDFloat(origin_max.x), SIMDFloat(origin_max.y), SIMDFloat(origin_max.z) };
+	SIMDFloat packet_inverse_min[3] = { SIMDFloat(inverse_direction_min.x), SIMDFloat(inverse_direction_min.y), SIMDFloat(inverse_direction_min.z) };
+	SIMDFloat packet_inverse_max[3] = { SIMDFloat(inverse_direction_max.x), SIMDFloat(inverse_direction_max.y), SIMDFloat(inverse_direction_max.z) };
+
+	StackEntry stack[BVHConstants::TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, ray_count == 64 ? ~0ull : (1ull << ray_count) - 1 };
+
+	while (stack_size > 0)
+	{
+		StackEntry entry = stack[--stack_size];
+
+		if (entry.packet_count > 0)
+		{
+			for (int ray_index = 0; ray_index < ray_count; ray_index++)
+			{
+				if (!(entry.ray_mask & (1ull << ray_index)))
+					continue;
+
+				for (int i = 0; i < entry.packet_count; i++)
+					out_hits[ray_index] |= intersect_triangle_packet(m_triangle_packets[entry.index + i], rays[ray_index], closest_t[ray_index], hit_infos[ray_index], filter_function_payloads[ray_index]);
+			}
+
+			continue;
+		}
+
+		const WideNode& node = m_wide_nodes[entry.index];
+
+		float packet_closest_t = 0.0f;
+		for (int ray_index = 0; ray_index < ray_count; ray_index++)
+			if (entry.ray_mask & (1ull << ray_index))
+				packet_closest_t = hippt::max(packet_closest_t, closest_t[ray_index]);
+
+		// Conservative slab test of the whole packet against the children: the interval of the distances
+		// to the slabs of a child is computed from the bounds of the origins and inverse directions of the rays
+		const float* bbox_mins[3] = { node.bbox_min_x, node.bbox_min_y, node.bbox_min_z };
+		const float* bbox_maxs[3] = { node.bbox_max_x, node.bbox_max_y, node.bbox_max_z };
+		SIMDFloat packet_t_near(0.0f);
+		SIMDFloat packet_t_far(packet_closest_t);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (!axis_culling[axis])
+				continue;
+
+			bool positive_direction = float3_component(rays[0].direction, axis) > 0.0f;
+			SIMDFloat near_plane = SIMDFloat::load(positive_direction ? bbox_mins[axis] : bbox_maxs[axis]);
+			SIMDFloat far_plane = SIMDFloat::load(positive_direction ? bbox_maxs[axis] : bbox_mins[axis]);
+
+			SIMDFloat near_low = near_plane - packet_origin_max[axis];
+			SIMDFloat near_high = near_plane - packet_origin_min[axis];
+			SIMDFloat far_low = far_plane - packet_origin_max[axis];
+			SIMDFloat far_high = far_plane - packet_origin_min[axis];
+
+			SIMDFloat t_near_lower_bound = simd_min(simd_min(near_low * packet_inverse_min[axis], near_low * packet_inverse_max[axis]), simd_min(near_high * packet_inverse_min[axis], near_high * packet_inverse_max[axis]));
+			SIMDFloat t_far_upper_bound = simd_max(simd_max(far_low * packet_inverse_min[axis], far_low * packet_inverse_max[axis]), simd_max(far_high * packet_inverse_min[axis], far_high * packet_inverse_max[axis]));
+
+			packet_t_near = simd_max(packet_t_near, t_near_lower_bound);
+			packet_t_far = simd_min(packet_t_far, t_far_upper_bound);
+		}
+
+		int packet_hit_mask = (packet_t_near <= packet_t_far).to_int() & ((1 << node.child_count) - 1);
+		if (packet_hit_mask == 0)
+			// No ray of the packet can hit any of the children
+			continue;
+
+		// Testing the rays individually against the children that survived the culling
+		uint64_t children_ray_masks[BVH_SIMD_WIDTH] = {};
+		float children_t_near[BVH_SIMD_WIDTH];
+		for (int lane = 0; lane < BVH_SIMD_WIDTH; lane++)
+			children_t_near[lane] = std::numeric_limits<float>::max();
+
+		for (int ray_index = 0; ray_index < ray_count; ray_index++)
+		{
+			if (!(entry.ray_mask & (1ull << ray_index)))
+				continue;
+
+			const float3& origin = rays[ray_index].origin;
+			const float3& inverse_direction = inverse_directions[ray_index];
+
+			alignas(32) float t_near_values[BVH_SIMD_WIDTH];
+			int hit_mask = packet_hit_mask & wide_node_children_hit_mask(node, SIMDFloat(origin.x), SIMDFloat(origin.y), SIMDFloat(origin.z),
+				SIMDFloat(inverse_direction.x), SIMDFloat(inverse_direction.y), SIMDFloat(inverse_direction.z), closest_t[ray_index], t_near_values);
+
+			for (int lane = 0; lane < BVH_SIMD_WIDTH; lane++)
+			{
+				if (!(hit_mask & (1 << lane)))
+					continue;
+
+				children_ray_masks[lane] |= 1ull << ray_index;
+				children_t_near[lane] = hippt::min(children_t_near[lane], t_near_values[lane]);
+			}
+		}
+
+		// Sorting the children hit by decreasing distance (to the closest ray of the packet) so
+		// that the nearest one is on top of the stack
+		int hit_children[BVH_SIMD_WIDTH];
+		int hit_count = 0;
+		for (int lane = 0; lane < BVH_SIMD_WIDTH; lane++)
+		{
+			if (children_ray_masks[lane] == 0)
+				continue;
+
+			int insert_position = hit_count++;
+			while (insert_position > 0 && children_t_near[hit_children[insert_position - 1]] < children_t_near[lane])
+			{
+				hit_children[insert_position] = hit_children[insert_position - 1];
+				insert_position--;
+			}
+			hit_children[insert_position] = lane;
+		}
+
+		for (int i = 0; i < hit_count; i++)
+		{
+			int lane = hit_children[i];
+
+			stack[stack_size++] = { node.children[lane], node.packet_counts[lane], children_ray_masks[lane] };
+		}
+	}
 }
@@ -8,259 +8,202 @@
 
 #include "Device/functions/AlphaTesting.h"
 
-#include "Renderer/BoundingVolume.h"
 #include "Renderer/BVHConstants.h"
+#include "Renderer/BVHSIMD.h"
 #include "Renderer/Triangle.h"
+#include "Scene/BoundingBox.h"
 
-#include <array>
-#include <atomic>
-#include <cmath>
-#include <deque>
-#include <limits>
-#include <queue>
+#include <vector>
 
 #include <hiprt/hiprt_types.h> // for hiprtRay
 
+/**
+ * BVH over the triangles of the scene used by the CPURenderer.
+ * 
+ * The BVH is built top-down with binned SAH splits and stored as a flat array of nodes in
+ * depth-first order: the first child of an interior node is always the node right after it
+ * so only the index of the second child needs to be stored.
+ * 
+ * The construction is parallelized with OpenMP: the top levels are built with parallel binning
+ * and the smaller subtrees below them are then built concurrently.
+ * 
+ * The binary BVH is then collapsed into a BVH4 or BVH8 (BVH_SIMD_WIDTH, see BVHSIMD.h) whose
+ * children boxes are tested against the ray with SIMD instructions. The triangles of the leaves are
+ * stored in packets of BVH_SIMD_WIDTH triangles that are also intersected at once.
+ */
 class BVH
 {
 public:
-    struct OctreeNode
+    struct alignas(32) FlattenedNode
     {
-        struct QueueElement
-        {
-            QueueElement(const BVH::OctreeNode* node, float t_near) : m_node(node), _t_near(t_near) {}
-
-            bool operator > (const QueueElement& a) const
-            {
-                return _t_near > a._t_near;
-            }
-
-            const OctreeNode* m_node;//Reference on the node
-
-            float _t_near;//Intersection distance used to order the elements in the priority queue used
-            //by the OctreeNode to compute the intersection with a ray
-        };
-
-        OctreeNode(float3 min, float3 max) : m_min(min), m_max(max) {}
-        ~OctreeNode()
-        {
-            if (m_is_leaf)
-                return;
-            else
-            {
-                for (int i = 0; i < 8; i++)
-                    delete m_children[i];
-            }
-        }
-
-        /*
-          * Once the objects have been inserted in the hierarchy, this function computes
-          * the bounding volume of all the node in the hierarchy
-          */
-        BoundingVolume compute_volume(const std::vector<Triangle>& triangles_geometry)
-        {
-            if (m_is_leaf)
-                for (int triangle_id : m_triangles)
-                    m_bounding_volume.extend_volume(triangles_geometry[triangle_id]);
-            else
-                for (int i = 0; i < 8; i++)
-                    m_bounding_volume.extend_volume(m_children[i]->compute_volume(triangles_geometry));
-
-            return m_bounding_volume;
-        }
-
-        void create_children(int max_depth, int leaf_max_obj_count)
-        {
-            float middle_x = (m_min.x + m_max.x) / 2;
-            float middle_y = (m_min.y + m_max.y) / 2;
-            float middle_z = (m_min.z + m_max.z) / 2;
-
-            m_children[0] = new OctreeNode(m_min, make_float3(middle_x, middle_y, middle_z));
-            m_children[1] = new OctreeNode(make_float3(middle_x, m_min.y, m_min.z), make_float3(m_max.x, middle_y, middle_z));
-            m_children[2] = new OctreeNode(m_min + make_float3(0, middle_y, 0), make_float3(middle_x, m_max.y, middle_z));
-            m_children[3] = new OctreeNode(make_float3(middle_x, middle_y, m_min.z), make_float3(m_max.x, m_max.y, middle_z));
-            m_children[4] = new OctreeNode(m_min + make_float3(0, 0, middle_z), make_float3(middle_x, middle_y, m_max.z));
-            m_children[5] = new OctreeNode(make_float3(middle_x, m_min.y, middle_z), make_float3(m_max.x, middle_y, m_max.z));
-            m_children[6] = new OctreeNode(m_min + make_float3(0, middle_y, middle_z), make_float3(middle_x, m_max.y, m_max.z));
-            m_children[7] = new OctreeNode(make_float3(middle_x, middle_y, middle_z), make_float3(m_max.x, m_max.y, m_max.z));
-        }
-
-        void insert(const std::vector<Triangle>& triangles_geometry, int triangle_id_to_insert, int current_depth, int max_depth, int leaf_max_obj_count)
-        {
-            bool depth_exceeded = max_depth != -1 && current_depth == max_depth;
-
-            if (m_is_leaf || depth_exceeded)
-            {
-                m_triangles.push_back(triangle_id_to_insert);
-
-                if (m_triangles.size() > leaf_max_obj_count && !depth_exceeded)
-                {
-                    m_is_leaf = false;//This node isn't a leaf anymore
-
-                    create_children(max_depth, leaf_max_obj_count);
-
-                    for (int triangle_id : m_triangles)
-                        insert_to_children(triangles_geometry, triangle_id, current_depth, max_depth, leaf_max_obj_count);
-
-                    m_triangles.clear();
-                    m_triangles.shrink_to_fit();
-                }
-            }
-            else
-                insert_to_children(triangles_geometry, triangle_id_to_insert, current_depth, max_depth, leaf_max_obj_count);
-
-        }
-
-        void insert_to_children(const std::vector<Triangle>& triangles_geometry, int triangle_id_to_insert, int current_depth, int max_depth, int leaf_max_obj_count)
-        {
-            const Triangle& triangle = triangles_geometry[triangle_id_to_insert];
-            float3 bbox_centroid = triangle.bbox_centroid();
-
-            float middle_x = (m_min.x + m_max.x) / 2;
-            float middle_y = (m_min.y + m_max.y) / 2;
-            float middle_z = (m_min.z + m_max.z) / 2;
-
-            int octant_index = 0;
-
-            if (bbox_centroid.x > middle_x) octant_index += 1;
-            if (bbox_centroid.y > middle_y) octant_index += 2;
-            if (bbox_centroid.z > middle_z) octant_index += 4;
-
-            m_children[octant_index]->insert(triangles_geometry, triangle_id_to_insert, current_depth + 1, max_depth, leaf_max_obj_count);
-        }
-
-        bool intersect(const std::vector<Triangle>& triangles_geometry, const hiprtRay& ray, HitInfo& hit_info, void* filter_function_payload) const
-        {
-            float trash;
-
-            float denoms[BVHConstants::PLANES_COUNT];
-            float numers[BVHConstants::PLANES_COUNT];
-
-            for (int i = 0; i < BVHConstants::PLANES_COUNT; i++)
-            {
-                denoms[i] = hippt::dot(BoundingVolume::PLANE_NORMALS[i], ray.direction);
-                numers[i] = hippt::dot(BoundingVolume::PLANE_NORMALS[i], float3(ray.origin));
-            }
-
-            return intersect(triangles_geometry, ray, hit_info, trash, denoms, numers, filter_function_payload);
-        }
-
-        bool intersect(const std::vector<Triangle>& triangles_geometry, const hiprtRay& ray, HitInfo& hit_info, float& t_near, float* denoms, float* numers, void* filter_function_payload) const
-        {
-            float t_far, trash;
-
-            if (!m_bounding_volume.intersect(trash, t_far, denoms, numers))
-                return false;
-
-            if (m_is_leaf)
-            {
-                for (int triangle_id : m_triangles)
-                {
-                    const Triangle& triangle = triangles_geometry[triangle_id];
-
-                    HitInfo local_hit_info;
-                    if (triangle.intersect(ray, local_hit_info))
-                    {
-                        hiprtHit hit;
-                        hit.normal = local_hit_info.geometric_normal;
-                        hit.primID = triangle_id;
-                        hit.t = local_hit_info.t;
-                        hit.uv = local_hit_info.uv;
-
-
-                        if (alpha_testing(ray, nullptr, filter_function_payload, hit))
-                            // Hit is filtered
-                            continue;
-
-                        if (local_hit_info.t < hit_info.t || hit_info.t == -1)
-                        {
-                            hit_info = local_hit_info;
-                            hit_info.primitive_index = triangle_id;
-                        }
-                    }
-                }
-
-                t_near = hit_info.t;
-
-                return t_near > 0;
-            }
-
-            std::priority_queue<QueueElement, std::vector<QueueElement>, std::greater<QueueElement>> intersection_queue;
-            for (int i = 0; i < 8; i++)
-            {
-                float inter_distance;
-                if (m_children[i]->m_bounding_volume.intersect(inter_distance, t_far, denoms, numers))
-                    intersection_queue.emplace(QueueElement(m_children[i], inter_distance));
-            }
-
-            bool intersection_found = false;
-            float closest_inter = 100000000, inter_distance = 100000000;
-            while (!intersection_queue.empty())
-            {
-                QueueElement top_element = intersection_queue.top();
-                intersection_queue.pop();
-
-                if (top_element.m_node->intersect(triangles_geometry, ray, hit_info, inter_distance, denoms, numers, filter_function_payload))
-                {
-                    closest_inter = std::min(closest_inter, inter_distance);
-                    intersection_found = true;
-
-                    //If we found an intersection that is closer than
-                    //the next element in the queue, we can stop intersecting further
-                    if (intersection_queue.empty() || closest_inter < intersection_queue.top()._t_near)
-                    {
-                        t_near = closest_inter;
-
-                        return true;
-                    }
-                }
-            }
+        bool is_leaf() const { return triangle_count > 0; }
+
+        float3 bbox_min;
+        // For leaves, index of the first triangle of the leaf in 'm_triangle_indices'.
+        // For interior nodes, index of the second child of the node
+        int offset;
+        float3 bbox_max;
+        // Number of triangles of the leaf, 0 for interior nodes
+        int triangle_count;
+    };
 
-            if (!intersection_found)
-                return false;
-            else
-            {
-                t_near = closest_inter;
+    /**
+     * Node of the wide BVH traversed by intersect(). The bounds of the
+     * children are stored in SoA so that they can be loaded in SIMD registers directly
+     */
+    struct alignas(32) WideNode
+    {
+        float bbox_min_x[BVH_SIMD_WIDTH];
+        float bbox_min_y[BVH_SIMD_WIDTH];
+        float bbox_min_z[BVH_SIMD_WIDTH];
+        float bbox_max_x[BVH_SIMD_WIDTH];
+        float bbox_max_y[BVH_SIMD_WIDTH];
+        float bbox_max_z[BVH_SIMD_WIDTH];
+
+        // For interior children, index of the child node in 'm_wide_nodes'.
+        // For leaf children, index of the first triangle packet of the leaf in 'm_triangle_packets'
+        int children[BVH_SIMD_WIDTH];
+        // Number of triangle packets of the leaf children, 0 for interior children
+        int packet_counts[BVH_SIMD_WIDTH];
+
+        int child_count;
+    };
 
-                return true;
-            }
-        }
+    /**
+     * BVH_SIMD_WIDTH triangles of a leaf stored in SoA. The unused lanes of the last packet
+     * of a leaf are degenerate triangles (null edges) that are never intersected
+     */
+    struct alignas(32) TrianglePacket
+    {
+        float vertex_A_x[BVH_SIMD_WIDTH];
+        float vertex_A_y[BVH_SIMD_WIDTH];
+        float vertex_A_z[BVH_SIMD_WIDTH];
+        float edge_1_x[BVH_SIMD_WIDTH];
+        float edge_1_y[BVH_SIMD_WIDTH];
+        float edge_1_z[BVH_SIMD_WIDTH];
+        float edge_2_x[BVH_SIMD_WIDTH];
+        float edge_2_y[BVH_SIMD_WIDTH];
+        float edge_2_z[BVH_SIMD_WIDTH];
+
+        // Indices of the triangles in the triangles given to the constructor of the BVH.
+        // -1 for the unused lanes
+        int triangle_indices[BVH_SIMD_WIDTH];
+    };
 
-        //If this node has been subdivided (and thus cannot accept any triangles),
-        //this boolean will be set to false
-        bool m_is_leaf = true;
+    BVH();
+    BVH(std::vector<Triangle>* triangles, int leaf_max_obj_count = BVHConstants::MAX_TRIANGLES_PER_LEAF);
+
+    /**
+     * Returns true if an intersection was found. The intersection found is the closest one
+     * along the ray, before 'ray.maxT', that isn't filtered out by alpha testing. 'hit_info.primitive_index' is
+     * the index of the triangle hit in the triangles given to the constructor.
+     * 
+     * 'hit_info.t' must be -1 when calling this function
+     */
+    bool intersect(const hiprtRay& ray, HitInfo& hit_info, void* filter_function_payload) const;
 
-        std::vector<int> m_triangles;
-        std::array<BVH::OctreeNode*, 8> m_children = 
-        {
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr,
-            nullptr
-        };
+    /**
+     * Returns true if there is an intersection closer than 't_max' along the ray that isn't
+     * filtered out by alpha testing. This is an any-hit traversal for shadow rays: the children
+     * of the nodes aren't sorted and the traversal stops at the first such intersection found
+     */
+    bool intersect_any(const hiprtRay& ray, float t_max, void* filter_function_payload) const;
+
+    /**
+     * Same as intersect() but for a packet of at most BVHConstants::RAY_PACKET_MAX_SIZE coherent
+     * rays (the camera rays of a tile of pixels for example) that traverse the BVH together.
+     * 
+     * The children of a node are first culled against the bounds of the whole packet (interval
+     * arithmetic on the origins and directions of the rays) and only then tested against the
+     * individual rays of the packet that are still active.
+     * 
+     * 'out_hits[i]' is set to whether or not an intersection was found for 'rays[i]', in which
+     * case 'hit_infos[i]' holds the closest intersection. 'filter_function_payloads[i]' is the
+     * alpha testing payload of 'rays[i]'. The 't' of the hit infos must be -1 when calling this function
+     */
+    void intersect_ray_packet(const hiprtRay* rays, int ray_count, HitInfo* hit_infos, void** filter_function_payloads, bool* out_hits) const;
 
-        float3 m_min, m_max;
-        BoundingVolume m_bounding_volume;
+private:
+    struct BuildTriangle
+    {
+        BoundingBox bounds;
+        float3 centroid;
     };
 
-public:
-    BVH();
-    BVH(std::vector<Triangle>* triangles, int max_depth = 32, int leaf_max_obj_count = 8);
-    ~BVH();
+    /**
+     * Subtree of less than BVHConstants::PARALLEL_BUILD_THRESHOLD triangles left to
+     * be built after the top levels of the BVH
+     */
+    struct PendingSubtree
+    {
+        int begin, end;
 
-    void operator=(BVH&& bvh);
-     
-    bool intersect(const hiprtRay& ray, HitInfo& hit_info, void* filter_function_payload) const;
+        // Nodes of the subtree in depth-first order, the indices of the children
+        // of the interior nodes are local to this vector
+        std::vector<FlattenedNode> nodes;
+    };
 
-private:
-    void build_bvh(int max_depth, int leaf_max_obj_count, float3 min, float3 max, const BoundingVolume& volume);
+    /**
+     * Builds the top levels of the BVH over the triangles 'm_triangle_indices[begin, end['
+     * using parallel binning and appends them to 'top_nodes'. Subtrees small enough are not
+     * built but referenced by a placeholder node (triangle_count == -1, offset = index of the
+     * subtree in 'pending_subtrees') so that they can be built in parallel afterwards
+     */
+    void build_top_levels(std::vector<BuildTriangle>& build_triangles, int begin, int end, int leaf_max_obj_count, std::vector<FlattenedNode>& top_nodes, std::vector<PendingSubtree>& pending_subtrees);
+
+    /**
+     * Builds the subtree of the triangles 'm_triangle_indices[begin, end[' in 'out_nodes'
+     * and returns the index of its root node
+     */
+    int build_recursive(std::vector<BuildTriangle>& build_triangles, int begin, int end, int leaf_max_obj_count, std::vector<FlattenedNode>& out_nodes);
+
+    /**
+     * Appends the subtree of 'top_nodes' rooted at 'node_index' to 'm_nodes' in depth-first order,
+     * replacing the placeholders nodes (see build_top_levels()) by their pending subtree
+     */
+    void flatten_top_levels(const std::vector<FlattenedNode>& top_nodes, int node_index, const std::vector<PendingSubtree>& pending_subtrees);
+
+    /**
+     * Computes the bounds of the triangles [begin, end[ and of their centroids
+     */
+    void compute_bounds(const std::vector<BuildTriangle>& build_triangles, int begin, int end, bool parallel, BoundingBox& out_node_bounds, BoundingBox& out_centroid_bounds) const;
+
+    /**
+     * Looks for the binned SAH split of the triangles [begin, end[ with the lowest cost.
+     * Returns the index of the first triangle of the right child after partitioning or
+     * -1 if not splitting is cheaper.
+     * 
+     * The triangles are binned with multiple threads if 'parallel' is true
+     */
+    int split(std::vector<BuildTriangle>& build_triangles, int begin, int end, const BoundingBox& node_bounds, const BoundingBox& centroid_bounds, int leaf_max_obj_count, bool parallel);
+
+    /**
+     * Collapses the subtree of the binary BVH 'm_nodes' rooted at 'node_index' into wide nodes
+     * appended to 'm_wide_nodes' and returns the index of the wide node created for 'node_index'
+     */
+    int collapse(int node_index);
+
+    /**
+     * Appends the triangle packets of the leaf 'm_nodes[leaf_index]' to 'm_triangle_packets'
+     * and returns the number of packets appended
+     */
+    int build_triangle_packets(int leaf_index);
+
+    /**
+     * Intersects the ray with the BVH_SIMD_WIDTH triangles of the packet and updates 'hit_info'
+     * and 'closest_t' with the closest hit that isn't filtered out by alpha testing.
+     * Returns true if such a hit was found
+     */
+    bool intersect_triangle_packet(const TrianglePacket& packet, const hiprtRay& ray, float& closest_t, HitInfo& hit_info, void* filter_function_payload) const;
 
 public:
-    OctreeNode* m_root;
+    // Binary BVH and indices of the triangles referenced by its leaves, in the order of the leaves.
+    // Only used during the construction, both are cleared once the wide BVH is built
+    std::vector<FlattenedNode> m_nodes;
+    std::vector<int> m_triangle_indices;
+
+    std::vector<WideNode> m_wide_nodes;
+    std::vector<TrianglePacket> m_triangle_packets;
 
     std::vector<Triangle>* m_triangles;
 };
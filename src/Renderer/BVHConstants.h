@@ -8,10 +8,22 @@
 
 struct BVHConstants
 {
-    static constexpr int FLATTENED_BVH_MAX_STACK_SIZE = 100000;
+    // Size of the stack of the traversal of the BVH. Each node visited pushes at most
+    // one entry per child and the depth of the binned SAH BVH is logarithmic in the number
+    // of triangles in practice so this is plenty
+    static constexpr int TRAVERSAL_STACK_SIZE = 256;
 
-    static constexpr int PLANES_COUNT = 7;
+    // Maximum number of rays traced together by BVH::intersect_ray_packet()
+    static constexpr int RAY_PACKET_MAX_SIZE = 64;
+
+    static constexpr int SAH_BIN_COUNT = 12;
     static constexpr int MAX_TRIANGLES_PER_LEAF = 8;
+    // Cost of traversing an interior node relative to the cost of intersecting a triangle
+    static constexpr float SAH_TRAVERSAL_COST = 1.0f;
+
+    // Nodes with more triangles than that are split with parallel binning during the construction
+    // of the BVH. The subtrees with less triangles are built concurrently, one per thread
+    static constexpr int PARALLEL_BUILD_THRESHOLD = 1 << 15;
 };
 
 #endif
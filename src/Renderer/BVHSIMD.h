@@ -0,0 +1,189 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef BVH_SIMD_H
+#define BVH_SIMD_H
+
+/**
+ * Minimal SIMD abstraction used by the traversal of the CPU BVH.
+ * 
+ * The width of the BVH is selected at compile time from the instruction sets available:
+ *  - AVX2: BVH8, 8 children boxes / 8 triangles tested at once
+ *  - SSE2: BVH4, 4 children boxes / 4 triangles tested at once
+ *  - Otherwise: BVH4 with a scalar fallback
+ * 
+ * AVX2 can be enabled with the HIPRT_PATH_TRACER_CPU_AVX2 CMake option
+ */
+
+#if defined(__AVX2__)
+#define BVH_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SIMD_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if BVH_SIMD_AVX2
+static constexpr int BVH_SIMD_WIDTH = 8;
+#else
+static constexpr int BVH_SIMD_WIDTH = 4;
+#endif
+
+struct SIMDFloat
+{
+#if BVH_SIMD_AVX2
+    SIMDFloat() {}
+    SIMDFloat(__m256 value) : m_value(value) {}
+    explicit SIMDFloat(float value) : m_value(_mm256_set1_ps(value)) {}
+
+    static SIMDFloat load(const float* aligned_data) { return _mm256_load_ps(aligned_data); }
+
+    __m256 m_value;
+#elif BVH_SIMD_SSE
+    SIMDFloat() {}
+    SIMDFloat(__m128 value) : m_value(value) {}
+    explicit SIMDFloat(float value) : m_value(_mm_set1_ps(value)) {}
+
+    static SIMDFloat load(const float* aligned_data) { return _mm_load_ps(aligned_data); }
+
+    __m128 m_value;
+#else
+    SIMDFloat() {}
+    explicit SIMDFloat(float value) { for (int i = 0; i < BVH_SIMD_WIDTH; i++) m_value[i] = value; }
+
+    static SIMDFloat load(const float* aligned_data)
+    {
+        SIMDFloat result;
+        for (int i = 0; i < BVH_SIMD_WIDTH; i++)
+            result.m_value[i] = aligned_data[i];
+
+        return result;
+    }
+
+    float m_value[BVH_SIMD_WIDTH];
+#endif
+};
+
+/**
+ * Result of a comparison between two SIMDFloat.
+ * 
+ * Can be converted to a bitmask with one bit per lane with 'to_int()'
+ */
+struct SIMDMask
+{
+#if BVH_SIMD_AVX2
+    SIMDMask(__m256 value) : m_value(value) {}
+
+    int to_int() const { return _mm256_movemask_ps(m_value); }
+
+    __m256 m_value;
+#elif BVH_SIMD_SSE
+    SIMDMask(__m128 value) : m_value(value) {}
+
+    int to_int() const { return _mm_movemask_ps(m_value); }
+
+    __m128 m_value;
+#else
+    SIMDMask() {}
+
+    int to_int() const { return m_value; }
+
+    int m_value = 0;
+#endif
+};
+
+#if BVH_SIMD_AVX2
+inline SIMDFloat operator+(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_add_ps(a.m_value, b.m_value); }
+inline SIMDFloat operator-(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_sub_ps(a.m_value, b.m_value); }
+inline SIMDFloat operator*(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_mul_ps(a.m_value, b.m_value); }
+inline SIMDFloat operator/(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_div_ps(a.m_value, b.m_value); }
+inline SIMDFloat simd_min(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_min_ps(a.m_value, b.m_value); }
+inline SIMDFloat simd_max(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_max_ps(a.m_value, b.m_value); }
+inline SIMDFloat simd_abs(const SIMDFloat& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.m_value); }
+
+inline SIMDMask operator<(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_cmp_ps(a.m_value, b.m_value, _CMP_LT_OQ); }
+inline SIMDMask operator<=(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_cmp_ps(a.m_value, b.m_value, _CMP_LE_OQ); }
+inline SIMDMask operator>(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_cmp_ps(a.m_value, b.m_value, _CMP_GT_OQ); }
+inline SIMDMask operator>=(const SIMDFloat& a, const SIMDFloat& b) { return _mm256_cmp_ps(a.m_value, b.m_value, _CMP_GE_OQ); }
+inline SIMDMask operator&(const SIMDMask& a, const SIMDMask& b) { return _mm256_and_ps(a.m_value, b.m_value); }
+
+inline void simd_store(float* aligned_data, const SIMDFloat& a) { _mm256_store_ps(aligned_data, a.m_value); }
+#elif BVH_SIMD_SSE
+inline SIMDFloat operator+(const SIMDFloat& a, const SIMDFloat& b) { return _mm_add_ps(a.m_value, b.m_value); }
+inline SIMDFloat operator-(const SIMDFloat& a, const SIMDFloat& b) { return _mm_sub_ps(a.m_value, b.m_value); }
+inline SIMDFloat operator*(const SIMDFloat& a, const SIMDFloat& b) { return _mm_mul_ps(a.m_value, b.m_value); }
+inline SIMDFloat operator/(const SIMDFloat& a, const SIMDFloat& b) { return _mm_div_ps(a.m_value, b.m_value); }
+inline SIMDFloat simd_min(const SIMDFloat& a, const SIMDFloat& b) { return _mm_min_ps(a.m_value, b.m_value); }
+inline SIMDFloat simd_max(const SIMDFloat& a, const SIMDFloat& b) { return _mm_max_ps(a.m_value, b.m_value); }
+inline SIMDFloat simd_abs(const SIMDFloat& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.m_value); }
+
+inline SIMDMask operator<(const SIMDFloat& a, const SIMDFloat& b) { return _mm_cmplt_ps(a.m_value, b.m_value); }
+inline SIMDMask operator<=(const SIMDFloat& a, const SIMDFloat& b) { return _mm_cmple_ps(a.m_value, b.m_value); }
+inline SIMDMask operator>(const SIMDFloat& a, const SIMDFloat& b) { return _mm_cmpgt_ps(a.m_value, b.m_value); }
+inline SIMDMask operator>=(const SIMDFloat& a, const SIMDFloat& b) { return _mm_cmpge_ps(a.m_value, b.m_value); }
+inline SIMDMask operator&(const SIMDMask& a, const SIMDMask& b) { return _mm_and_ps(a.m_value, b.m_value); }
+
+inline void simd_store(float* aligned_data, const SIMDFloat& a) { _mm_store_ps(aligned_data, a.m_value); }
+#else
+#define BVH_SIMD_SCALAR_BINARY_OP(name, expression)         \
+inline SIMDFloat name(const SIMDFloat& a, const SIMDFloat& b) \
+{                                                           \
+    SIMDFloat result;                                       \
+    for (int i = 0; i < BVH_SIMD_WIDTH; i++)                \
+        result.m_value[i] = expression;                     \
+                                                            \
+    return result;                                          \
+}
+
+#define BVH_SIMD_SCALAR_COMPARISON(name, op)                \
+inline SIMDMask name(const SIMDFloat& a, const SIMDFloat& b) \
+{                                                           \
+    SIMDMask result;                                        \
+    for (int i = 0; i < BVH_SIMD_WIDTH; i++)                \
+        result.m_value |= (a.m_value[i] op b.m_value[i]) << i; \
+                                                            \
+    return result;                                          \
+}
+
+BVH_SIMD_SCALAR_BINARY_OP(operator+, a.m_value[i] + b.m_value[i])
+BVH_SIMD_SCALAR_BINARY_OP(operator-, a.m_value[i] - b.m_value[i])
+BVH_SIMD_SCALAR_BINARY_OP(operator*, a.m_value[i] * b.m_value[i])
+BVH_SIMD_SCALAR_BINARY_OP(operator/, a.m_value[i] / b.m_value[i])
+BVH_SIMD_SCALAR_BINARY_OP(simd_min, a.m_value[i] < b.m_value[i] ? a.m_value[i] : b.m_value[i])
+BVH_SIMD_SCALAR_BINARY_OP(simd_max, a.m_value[i] > b.m_value[i] ? a.m_value[i] : b.m_value[i])
+
+BVH_SIMD_SCALAR_COMPARISON(operator<, <)
+BVH_SIMD_SCALAR_COMPARISON(operator<=, <=)
+BVH_SIMD_SCALAR_COMPARISON(operator>, >)
+BVH_SIMD_SCALAR_COMPARISON(operator>=, >=)
+
+#undef BVH_SIMD_SCALAR_BINARY_OP
+#undef BVH_SIMD_SCALAR_COMPARISON
+
+inline SIMDFloat simd_abs(const SIMDFloat& a)
+{
+    SIMDFloat result;
+    for (int i = 0; i < BVH_SIMD_WIDTH; i++)
+        result.m_value[i] = a.m_value[i] < 0.0f ? -a.m_value[i] : a.m_value[i];
+
+    return result;
+}
+
+inline SIMDMask operator&(const SIMDMask& a, const SIMDMask& b)
+{
+    SIMDMask result;
+    result.m_value = a.m_value & b.m_value;
+
+    return result;
+}
+
+inline void simd_store(float* aligned_data, const SIMDFloat& a)
+{
+    for (int i = 0; i < BVH_SIMD_WIDTH; i++)
+        aligned_data[i] = a.m_value[i];
+}
+#endif
+
+#endif
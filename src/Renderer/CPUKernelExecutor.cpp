@@ -0,0 +1,65 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Device/kernels/CameraRays.h"
+#include "Device/kernels/DenoiserAOVsResolve.h"
+#include "Device/kernels/FullPathTracer.h"
+#include "Device/kernels/ReSTIR/DI/InitialCandidates.h"
+#include "Device/kernels/ReSTIR/DI/TemporalReuse.h"
+#include "Device/kernels/ReSTIR/DI/SpatialReuse.h"
+#include "Device/kernels/ReSTIR/DI/FusedSpatiotemporalReuse.h"
+#include "Device/kernels/ReSTIR/GI/TemporalReuse.h"
+#include "Device/kernels/ReSTIR/GI/SpatialReuse.h"
+#include "Device/kernels/ReSTIR/GI/Shading.h"
+#include "Device/kernels/UnpackDenoiserAOVs.h"
+
+#include "Renderer/CPUKernelExecutor.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+extern ImGuiLogger g_imgui_logger;
+
+const std::unordered_map<std::string, CPUKernelExecutor::PixelKernelFunction> CPUKernelExecutor::PIXEL_KERNEL_FUNCTIONS =
+{
+	{ "CameraRays", CameraRays },
+	{ "FullPathTracer", FullPathTracer },
+	{ "ReSTIR_DI_InitialCandidates", ReSTIR_DI_InitialCandidates },
+	{ "ReSTIR_DI_TemporalReuse", ReSTIR_DI_TemporalReuse },
+	{ "ReSTIR_DI_SpatialReuse", ReSTIR_DI_SpatialReuse },
+	{ "ReSTIR_DI_SpatiotemporalReuse", ReSTIR_DI_SpatiotemporalReuse },
+	{ "ReSTIR_GI_TemporalReuse", ReSTIR_GI_TemporalReuse },
+	{ "ReSTIR_GI_SpatialReuse", ReSTIR_GI_SpatialReuse },
+	{ "ReSTIR_GI_Shading", ReSTIR_GI_Shading },
+	{ "UnpackDenoiserAOVs", UnpackDenoiserAOVs },
+	{ "DenoiserAOVsResolve", DenoiserAOVsResolve },
+};
+
+CPUKernelExecutor::CPUKernelExecutor(CPUTileScheduler* tile_scheduler) : m_tile_scheduler(tile_scheduler) {}
+
+CPUKernelExecutor::PixelKernelFunction CPUKernelExecutor::get_pixel_kernel_function(const std::string& kernel_function_name)
+{
+	auto find = PIXEL_KERNEL_FUNCTIONS.find(kernel_function_name);
+	if (find == PIXEL_KERNEL_FUNCTIONS.end())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The kernel \"%s\" isn't available on the CPU.", kernel_function_name.c_str());
+
+		return nullptr;
+	}
+
+	return find->second;
+}
+
+void CPUKernelExecutor::launch_pixel_kernel(const std::string& kernel_function_name, const HIPRTRenderData& render_data, int2 resolution)
+{
+	PixelKernelFunction kernel_function = get_pixel_kernel_function(kernel_function_name);
+	if (kernel_function == nullptr)
+		return;
+
+	// The tile scheduler flushes the block-level reductions at the end of each tile
+	m_tile_scheduler->run([kernel_function, &render_data, resolution](int start_x, int start_y, int stop_x, int stop_y) {
+		for (int y = start_y; y < stop_y; y++)
+			for (int x = start_x; x < stop_x; x++)
+				kernel_function(render_data, resolution, x, y);
+	});
+}
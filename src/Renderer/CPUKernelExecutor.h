@@ -0,0 +1,92 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef CPU_KERNEL_EXECUTOR_H
+#define CPU_KERNEL_EXECUTOR_H
+
+#include "HostDeviceCommon/Math.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "Renderer/CPUTileScheduler.h"
+
+#include <algorithm>
+#include <omp.h>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Runs the kernels of the Device/kernels folder on the CPU the way the GPU runs them:
+ * the threads of the grid are grouped in blocks, the blocks are distributed over the OpenMP
+ * threads and the block-level reductions of the status counters (see hippt::aggregated_atomic_add())
+ * are flushed at the end of each block.
+ *
+ * The per-pixel kernels are found by the name of their main function, the same name as in the
+ * KERNEL_FUNCTION_NAMES of the GPURenderer and of the render passes, so that the CPURenderer launches
+ * the same list of kernels as the GPU. Their blocks are the tiles of the CPUTileScheduler
+ */
+class CPUKernelExecutor
+{
+public:
+	/**
+	 * CPU signature of the kernels launched over the pixels of the image:
+	 *
+	 * GLOBAL_KERNEL_SIGNATURE(void) inline CameraRays(HIPRTRenderData render_data, int2 res, int x, int y)
+	 */
+	using PixelKernelFunction = void(*)(HIPRTRenderData, int2, int, int);
+
+	/**
+	 * Kernel function name --> CPU function of the kernel, for all the per-pixel kernels that
+	 * the CPURenderer supports
+	 */
+	static const std::unordered_map<std::string, PixelKernelFunction> PIXEL_KERNEL_FUNCTIONS;
+
+	/**
+	 * Threads per block of the linear kernels (visibility rays, light presampling, ...),
+	 * same as their __launch_bounds__ on the GPU
+	 */
+	static constexpr int LINEAR_BLOCK_SIZE = 64;
+
+	CPUKernelExecutor(CPUTileScheduler* tile_scheduler);
+
+	/**
+	 * Returns the CPU function of the kernel whose main function is 'kernel_function_name'.
+	 * nullptr (and an error is logged) if that kernel isn't available on the CPU
+	 */
+	static PixelKernelFunction get_pixel_kernel_function(const std::string& kernel_function_name);
+
+	/**
+	 * Launches the kernel 'kernel_function_name' over all the pixels of 'resolution',
+	 * one block per tile of the tile scheduler
+	 */
+	void launch_pixel_kernel(const std::string& kernel_function_name, const HIPRTRenderData& render_data, int2 resolution);
+
+	/**
+	 * Calls 'thread_function(thread_index)' for all thread_index in [0, thread_count[
+	 * in blocks of 'block_size' threads
+	 */
+	template <typename ThreadFunction>
+	void launch_linear(int thread_count, int block_size, const ThreadFunction& thread_function);
+
+private:
+	CPUTileScheduler* m_tile_scheduler = nullptr;
+};
+
+template <typename ThreadFunction>
+void CPUKernelExecutor::launch_linear(int thread_count, int block_size, const ThreadFunction& thread_function)
+{
+	int block_count = (thread_count + block_size - 1) / block_size;
+
+#pragma omp parallel for schedule(dynamic)
+	for (int block_index = 0; block_index < block_count; block_index++)
+	{
+		int block_start = block_index * block_size;
+		int block_stop = std::min(block_start + block_size, thread_count);
+		for (int thread_index = block_start; thread_index < block_stop; thread_index++)
+			thread_function(thread_index);
+
+		hippt::flush_block_reduced_atomic_adds();
+	}
+}
+
+#endif
@@ -3,6 +3,7 @@
  * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
  */
 
+#include "Device/kernels/AdaptiveSamplingTileError.h"
 #include "Device/kernels/CameraRays.h"
 #include "Device/kernels/FullPathTracer.h"
 #include "Device/kernels/ReSTIR/DI/LightsPresampling.h"
@@ -10,20 +11,35 @@
 #include "Device/kernels/ReSTIR/DI/TemporalReuse.h"
 #include "Device/kernels/ReSTIR/DI/SpatialReuse.h"
 #include "Device/kernels/ReSTIR/DI/FusedSpatiotemporalReuse.h"
+#include "Device/kernels/ReSTIR/DI/VisibilityRays.h"
+#include "Device/kernels/ReSTIR/GI/TemporalReuse.h"
+#include "Device/kernels/ReSTIR/GI/SpatialReuse.h"
+#include "Device/kernels/ReSTIR/GI/Shading.h"
 
 #include "Renderer/CPURenderer.h"
+#include "Renderer/LightBVHBuilder.h"
+#include "Scene/EmissiveTextureIntegrator.h"
+#include "Scene/TriangleOpacityClassifier.h"
 #include "Threads/ThreadManager.h"
 #include "UI/ApplicationSettings.h"
+#include "Utils/Utils.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <omp.h>
+#include <utility>
 
  // If 1, only the pixel at DEBUG_PIXEL_X and DEBUG_PIXEL_Y will be rendered,
  // allowing for fast step into that pixel with the debugger to see what's happening.
  // Otherwise if 0, all pixels of the image are rendered
 #define DEBUG_PIXEL 1
 
+// If 1, the camera rays are traced in packets of CAMERA_RAYS_TILE_SIZE x CAMERA_RAYS_TILE_SIZE
+// pixels that traverse the BVH together (see BVH::intersect_ray_packet()).
+// Only used when DEBUG_PIXEL is 0
+#define CPU_PACKET_CAMERA_RAYS 1
+
 // If 0, the pixel with coordinates (x, y) = (0, 0) is top left corner.
 // If 1, it's bottom left corner.
 // Useful if you're using an image viewer to get the the coordinates of 
@@ -63,83 +79,238 @@
 // DEBUG_PIXEL_Y coordinates
 #define DEBUG_NEIGHBORHOOD_SIZE 30
 
-CPURenderer::CPURenderer(int width, int height) : m_resolution(make_int2(width, height))
+CPURenderer::CPURenderer(int width, int height) : m_resolution(make_int2(width, height)), m_kernel_executor(&m_tile_scheduler)
 {
     m_framebuffer = Image32Bit(width, height, 3);
-
-    // Resizing buffers + initial value
-    m_pixel_active_buffer.resize(width * height, 0);
-    m_denoiser_albedo.resize(width * height, ColorRGB32F(0.0f));
-    m_denoiser_normals.resize(width * height, float3{ 0.0f, 0.0f, 0.0f });
-    m_pixel_sample_count.resize(width * height, 0);
-    m_pixel_converged_sample_count.resize(width * height, 0);
-    m_pixel_squared_luminance.resize(width * height, 0.0f);
+    m_tile_scheduler.set_resolution(m_resolution);
+
+    // Not written here (see FirstTouchAllocator), the initial values
+    // are written by first_touch_pixel_buffers()
+    m_pixel_status.resize(width * height);
+    m_denoiser_albedo.resize(width * height);
+    m_denoiser_normals.resize(width * height);
+#if PackedDenoiserAOVs == KERNEL_OPTION_TRUE
+    m_packed_denoiser_albedo.resize(width * height);
+    m_packed_denoiser_normals.resize(width * height);
+#endif
+    m_pixel_converged_sample_count.resize(width * height);
+    m_pixel_squared_luminance.resize(width * height);
+    m_pixel_half_luminance.resize(width * height);
     m_restir_di_state.initial_candidates_reservoirs.resize(width * height);
     m_restir_di_state.spatial_output_reservoirs_1.resize(width * height);
     m_restir_di_state.spatial_output_reservoirs_2.resize(width * height);
     m_restir_di_state.presampled_lights_buffer.resize(width * height);
+    m_restir_di_state.visibility_ray_pixel_indices.resize(width * height);
+    m_restir_di_state.visibility_ray_origins.resize(width * height);
+    m_restir_di_state.visibility_ray_directions.resize(width * height);
+    m_restir_di_state.visibility_ray_distances.resize(width * height);
     m_restir_di_state.output_reservoirs = m_restir_di_state.spatial_output_reservoirs_1.data();
-
-    m_g_buffer.materials.resize(width * height);
-    m_g_buffer.geometric_normals.resize(width * height);
-    m_g_buffer.shading_normals.resize(width * height);
-    m_g_buffer.view_directions.resize(width * height);
-    m_g_buffer.first_hits.resize(width * height);
-    m_g_buffer.cameray_ray_hit.resize(width * height);
-    m_g_buffer.ray_volume_states.resize(width * height);
-
-    m_g_buffer_prev_frame.materials.resize(width * height);
-    m_g_buffer_prev_frame.geometric_normals.resize(width * height);
-    m_g_buffer_prev_frame.shading_normals.resize(width * height);
-    m_g_buffer_prev_frame.view_directions.resize(width * height);
-    m_g_buffer_prev_frame.first_hits.resize(width * height);
-    m_g_buffer_prev_frame.cameray_ray_hit.resize(width * height);
-    m_g_buffer_prev_frame.ray_volume_states.resize(width * height);
+    m_restir_gi_state.initial_candidates_reservoirs.resize(width * height);
+    m_restir_gi_state.output_reservoirs_1.resize(width * height);
+    m_restir_gi_state.output_reservoirs_2.resize(width * height);
+
+    int g_buffer_element_count = ::GBuffer::get_storage_element_count(width, height);
+    m_g_buffer.material_indices.resize(g_buffer_element_count);
+    m_g_buffer.texcoords.resize(g_buffer_element_count);
+    m_g_buffer.geometric_normals.resize(g_buffer_element_count);
+    m_g_buffer.shading_normals.resize(g_buffer_element_count);
+    m_g_buffer.view_directions.resize(g_buffer_element_count);
+    m_g_buffer.first_hit_distances.resize(g_buffer_element_count);
+    m_g_buffer.motion_vectors.resize(g_buffer_element_count);
+    m_g_buffer.texture_footprints.resize(g_buffer_element_count);
+    m_g_buffer.ray_cone_spread_angles.resize(g_buffer_element_count);
+    m_g_buffer.cameray_ray_hit.resize(g_buffer_element_count);
+    m_g_buffer.ray_volume_states.resize(g_buffer_element_count);
+
+    m_g_buffer_prev_frame.material_indices.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.texcoords.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.geometric_normals.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.shading_normals.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.view_directions.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.first_hit_distances.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.motion_vectors.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.texture_footprints.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.ray_cone_spread_angles.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.cameray_ray_hit.resize(g_buffer_element_count);
+    m_g_buffer_prev_frame.ray_volume_states.resize(g_buffer_element_count);
+
+    first_touch_pixel_buffers();
 
     m_rng = Xorshift32Generator(42);
 }
 
+/**
+ * Writes 'value' to the elements [begin, end[ of 'buffer'
+ */
+template <typename T>
+static void first_touch_range(FirstTouchVector<T>& buffer, int begin, int end, const T& value = T())
+{
+    for (int i = begin; i < end; i++)
+        buffer[i] = value;
+}
+
+void CPURenderer::first_touch_pixel_buffers()
+{
+    static_assert(CPUTileScheduler::TILE_SIZE % ::GBuffer::GBUFFER_TILE_SIZE == 0, "The tiles of the G-buffer must not straddle two tiles of the scheduler");
+
+    int width = m_resolution.x;
+    int height = m_resolution.y;
+    int g_buffer_element_count = ::GBuffer::get_storage_element_count(width, height);
+
+    auto first_touch_g_buffers = [this](int begin, int end)
+    {
+        for (GBuffer* g_buffer : { &m_g_buffer, &m_g_buffer_prev_frame })
+        {
+            first_touch_range(g_buffer->material_indices, begin, end);
+            first_touch_range(g_buffer->texcoords, begin, end);
+            first_touch_range(g_buffer->geometric_normals, begin, end);
+            first_touch_range(g_buffer->shading_normals, begin, end);
+            first_touch_range(g_buffer->view_directions, begin, end);
+            first_touch_range(g_buffer->first_hit_distances, begin, end);
+            first_touch_range(g_buffer->motion_vectors, begin, end);
+            first_touch_range(g_buffer->texture_footprints, begin, end);
+            first_touch_range(g_buffer->ray_cone_spread_angles, begin, end);
+            first_touch_range(g_buffer->cameray_ray_hit, begin, end);
+            first_touch_range(g_buffer->ray_volume_states, begin, end);
+        }
+    };
+
+    m_tile_scheduler.first_touch([&](int start_x, int start_y, int stop_x, int stop_y)
+    {
+        for (int y = start_y; y < stop_y; y++)
+        {
+            // Row of the tile
+            int begin = start_x + y * width;
+            int end = stop_x + y * width;
+
+            first_touch_range(m_pixel_status, begin, end);
+            first_touch_range(m_denoiser_albedo, begin, end, ColorRGB32F(0.0f));
+            first_touch_range(m_denoiser_normals, begin, end, float3{ 0.0f, 0.0f, 0.0f });
+#if PackedDenoiserAOVs == KERNEL_OPTION_TRUE
+            first_touch_range(m_packed_denoiser_albedo, begin, end, 0u);
+            first_touch_range(m_packed_denoiser_normals, begin, end, 0u);
+#endif
+            first_touch_range(m_pixel_converged_sample_count, begin, end, 0);
+            first_touch_range(m_pixel_squared_luminance, begin, end, 0.0f);
+            first_touch_range(m_pixel_half_luminance, begin, end, 0.0f);
+
+            first_touch_range(m_restir_di_state.initial_candidates_reservoirs, begin, end);
+            first_touch_range(m_restir_di_state.spatial_output_reservoirs_1, begin, end);
+            first_touch_range(m_restir_di_state.spatial_output_reservoirs_2, begin, end);
+            // The visibility rays are queued in no particular order, they
+            // are only spread over the nodes like the pixels
+            first_touch_range(m_restir_di_state.visibility_ray_pixel_indices, begin, end);
+            first_touch_range(m_restir_di_state.visibility_ray_origins, begin, end);
+            first_touch_range(m_restir_di_state.visibility_ray_directions, begin, end);
+            first_touch_range(m_restir_di_state.visibility_ray_distances, begin, end);
+            first_touch_range(m_restir_gi_state.initial_candidates_reservoirs, begin, end);
+            first_touch_range(m_restir_gi_state.output_reservoirs_1, begin, end);
+            first_touch_range(m_restir_gi_state.output_reservoirs_2, begin, end);
+        }
+
+        // The G-buffers are padded to a whole number of G-buffer tiles, the padding
+        // is written by the tiles of the scheduler at the edges of the image
+#if GBufferTiledLayout == KERNEL_OPTION_TRUE
+        constexpr int G_BUFFER_TILE_SIZE = ::GBuffer::GBUFFER_TILE_SIZE;
+        int g_buffer_tile_count_x = (width + G_BUFFER_TILE_SIZE - 1) / G_BUFFER_TILE_SIZE;
+        for (int tile_y = start_y / G_BUFFER_TILE_SIZE; tile_y * G_BUFFER_TILE_SIZE < stop_y; tile_y++)
+        {
+            for (int tile_x = start_x / G_BUFFER_TILE_SIZE; tile_x * G_BUFFER_TILE_SIZE < stop_x; tile_x++)
+            {
+                int begin = (tile_x + tile_y * g_buffer_tile_count_x) * G_BUFFER_TILE_SIZE * G_BUFFER_TILE_SIZE;
+
+                first_touch_g_buffers(begin, begin + G_BUFFER_TILE_SIZE * G_BUFFER_TILE_SIZE);
+            }
+        }
+#else
+        for (int y = start_y; y < stop_y; y++)
+            first_touch_g_buffers(start_x + y * width, stop_x + y * width);
+        if (stop_x == width && stop_y == height)
+            // Padding after the last pixel
+            first_touch_g_buffers(width * height, g_buffer_element_count);
+#endif
+    });
+}
+
 void CPURenderer::set_scene(Scene& parsed_scene)
 {
     m_render_data.geom = nullptr;
 
-    m_render_data.buffers.materials_buffer = parsed_scene.materials.data();
+    if (!parsed_scene.spheres.empty())
+        // The CPU BVH is built over the triangles only
+        std::cout << "The " << parsed_scene.spheres.size() << " analytic spheres of the scene are only rendered by the GPU renderer, ignored." << std::endl;
+
+    m_packed_materials.resize(parsed_scene.materials.size());
+    for (int i = 0; i < parsed_scene.materials.size(); i++)
+        m_packed_materials[i] = PackedRendererMaterial::pack(parsed_scene.materials[i]);
+    m_render_data.buffers.materials_buffer = m_packed_materials.data();
     m_render_data.buffers.material_indices = parsed_scene.material_indices.data();
-    m_render_data.buffers.has_vertex_normals = parsed_scene.has_vertex_normals.data();
     m_render_data.buffers.pixels = m_framebuffer.get_data_as_ColorRGB32F();
     m_render_data.buffers.triangles_indices = parsed_scene.triangle_indices.data();
     m_render_data.buffers.vertices_positions = parsed_scene.vertices_positions.data();
-    m_render_data.buffers.vertex_normals = parsed_scene.vertex_normals.data();
+    m_vertex_normals.resize(parsed_scene.vertex_normals.size());
+    for (int i = 0; i < parsed_scene.vertex_normals.size(); i++)
+        m_vertex_normals[i] = octahedral_encode_32(hippt::normalize(parsed_scene.vertex_normals[i]));
+    m_mesh_vertex_attributes = parsed_scene.get_mesh_vertex_attributes();
+    m_render_data.buffers.mesh_vertex_attributes = m_mesh_vertex_attributes.data();
+    m_render_data.buffers.vertex_normals = m_vertex_normals.data();
     m_render_data.buffers.texcoords = parsed_scene.texcoords.data();
+    m_render_data.buffers.instances = parsed_scene.instances.data();
+    m_render_data.buffers.instance_count = static_cast<int>(parsed_scene.instances.size());
+    m_render_data.world_settings.envmap_portals = parsed_scene.envmap_portals.empty() ? nullptr : parsed_scene.envmap_portals.data();
+    m_render_data.world_settings.envmap_portal_count = static_cast<int>(parsed_scene.envmap_portals.size());
 
     ThreadManager::join_threads(ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY);
-    m_render_data.buffers.material_textures = parsed_scene.textures.data();
+    m_material_textures.resize(parsed_scene.textures.size());
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < parsed_scene.textures.size(); i++)
+        m_material_textures[i] = TiledTexture(parsed_scene.textures[i]);
+    m_render_data.buffers.material_textures = m_material_textures.data();
     m_render_data.buffers.textures_dims = parsed_scene.textures_dims.data();
 
-    m_render_data.aux_buffers.pixel_active = m_pixel_active_buffer.data();
+    std::vector<unsigned char> texture_opacities = TriangleOpacityClassifier::compute_texture_opacities(parsed_scene);
+    TriangleOpacityClassifier::compute_opacity_micromaps(parsed_scene, texture_opacities, m_triangle_opacity_micromap_indices, m_opacity_micromaps);
+    m_triangle_opacities = TriangleOpacityClassifier::compute_triangle_opacities(texture_opacities, m_triangle_opacity_micromap_indices, parsed_scene.material_indices, parsed_scene.materials);
+    m_render_data.buffers.triangle_opacities = m_triangle_opacities.data();
+    m_render_data.buffers.triangle_opacity_micromap_indices = m_triangle_opacity_micromap_indices.empty() ? nullptr : m_triangle_opacity_micromap_indices.data();
+    m_render_data.buffers.opacity_micromaps = m_opacity_micromaps.empty() ? nullptr : m_opacity_micromaps.data();
+
+    m_render_data.aux_buffers.pixel_status = m_pixel_status.data();
     m_render_data.aux_buffers.denoiser_albedo = m_denoiser_albedo.data();
     m_render_data.aux_buffers.denoiser_normals = m_denoiser_normals.data();
-    m_render_data.aux_buffers.pixel_sample_count = m_pixel_sample_count.data();
+    m_render_data.aux_buffers.packed_denoiser_albedo = m_packed_denoiser_albedo.empty() ? nullptr : m_packed_denoiser_albedo.data();
+    m_render_data.aux_buffers.packed_denoiser_normals = m_packed_denoiser_normals.empty() ? nullptr : m_packed_denoiser_normals.data();
     m_render_data.aux_buffers.pixel_converged_sample_count = m_pixel_converged_sample_count.data();
     m_render_data.aux_buffers.pixel_squared_luminance = m_pixel_squared_luminance.data();
+    m_render_data.aux_buffers.pixel_half_luminance = m_pixel_half_luminance.data();
     m_render_data.aux_buffers.still_one_ray_active = &m_still_one_ray_active;
     m_render_data.aux_buffers.stop_noise_threshold_converged_count = &m_stop_noise_threshold_count;
 
-    m_render_data.g_buffer.materials = m_g_buffer.materials.data();
+    m_render_data.g_buffer.material_indices = m_g_buffer.material_indices.data();
+    m_render_data.g_buffer.texcoords = m_g_buffer.texcoords.data();
     m_render_data.g_buffer.geometric_normals = m_g_buffer.geometric_normals.data();
     m_render_data.g_buffer.shading_normals = m_g_buffer.shading_normals.data();
     m_render_data.g_buffer.view_directions = m_g_buffer.view_directions.data();
-    m_render_data.g_buffer.first_hits = m_g_buffer.first_hits.data();
+    m_render_data.g_buffer.first_hit_distances = m_g_buffer.first_hit_distances.data();
+    m_render_data.g_buffer.motion_vectors = m_g_buffer.motion_vectors.data();
+    m_render_data.g_buffer.texture_footprints = m_g_buffer.texture_footprints.data();
+    m_render_data.g_buffer.ray_cone_spread_angles = m_g_buffer.ray_cone_spread_angles.data();
     m_render_data.g_buffer.camera_ray_hit = m_g_buffer.cameray_ray_hit.data();
     m_render_data.g_buffer.ray_volume_states = m_g_buffer.ray_volume_states.data();
+    m_render_data.g_buffer.width = m_resolution.x;
 
-    m_render_data.g_buffer_prev_frame.materials = m_g_buffer_prev_frame.materials.data();
+    m_render_data.g_buffer_prev_frame.material_indices = m_g_buffer_prev_frame.material_indices.data();
+    m_render_data.g_buffer_prev_frame.texcoords = m_g_buffer_prev_frame.texcoords.data();
     m_render_data.g_buffer_prev_frame.geometric_normals = m_g_buffer_prev_frame.geometric_normals.data();
     m_render_data.g_buffer_prev_frame.shading_normals = m_g_buffer_prev_frame.shading_normals.data();
     m_render_data.g_buffer_prev_frame.view_directions = m_g_buffer_prev_frame.view_directions.data();
-    m_render_data.g_buffer_prev_frame.first_hits = m_g_buffer_prev_frame.first_hits.data();
+    m_render_data.g_buffer_prev_frame.first_hit_distances = m_g_buffer_prev_frame.first_hit_distances.data();
+    m_render_data.g_buffer_prev_frame.motion_vectors = m_g_buffer_prev_frame.motion_vectors.data();
+    m_render_data.g_buffer_prev_frame.texture_footprints = m_g_buffer_prev_frame.texture_footprints.data();
+    m_render_data.g_buffer_prev_frame.ray_cone_spread_angles = m_g_buffer_prev_frame.ray_cone_spread_angles.data();
     m_render_data.g_buffer_prev_frame.camera_ray_hit = m_g_buffer_prev_frame.cameray_ray_hit.data();
     m_render_data.g_buffer_prev_frame.ray_volume_states = m_g_buffer_prev_frame.ray_volume_states.data();
+    m_render_data.g_buffer_prev_frame.width = m_resolution.x;
 
     m_render_data.render_settings.restir_di_settings.light_presampling.light_samples = m_restir_di_state.presampled_lights_buffer.data();
     m_render_data.render_settings.restir_di_settings.initial_candidates.output_reservoirs = m_restir_di_state.initial_candidates_reservoirs.data();
@@ -147,12 +318,61 @@ void CPURenderer::set_scene(Scene& parsed_scene)
     m_render_data.aux_buffers.restir_reservoir_buffer_1 = m_restir_di_state.initial_candidates_reservoirs.data();
     m_render_data.aux_buffers.restir_reservoir_buffer_2 = m_restir_di_state.spatial_output_reservoirs_1.data();
     m_render_data.aux_buffers.restir_reservoir_buffer_3 = m_restir_di_state.spatial_output_reservoirs_2.data();
+    m_render_data.render_settings.restir_gi_settings.initial_candidates.output_reservoirs = m_restir_gi_state.initial_candidates_reservoirs.data();
+    m_render_data.render_settings.restir_gi_settings.restir_output_reservoirs = m_restir_gi_state.output_reservoirs_1.data();
+    m_render_data.aux_buffers.restir_gi_reservoir_buffer_1 = m_restir_gi_state.initial_candidates_reservoirs.data();
+    m_render_data.aux_buffers.restir_gi_reservoir_buffer_2 = m_restir_gi_state.output_reservoirs_1.data();
+    m_render_data.aux_buffers.restir_gi_reservoir_buffer_3 = m_restir_gi_state.output_reservoirs_2.data();
+    m_render_data.render_settings.restir_di_settings.visibility_rays.ray_count = &m_restir_di_state.visibility_ray_count;
+    m_render_data.render_settings.restir_di_settings.visibility_rays.pixel_indices = m_restir_di_state.visibility_ray_pixel_indices.data();
+    m_render_data.render_settings.restir_di_settings.visibility_rays.ray_origins = m_restir_di_state.visibility_ray_origins.data();
+    m_render_data.render_settings.restir_di_settings.visibility_rays.ray_directions = m_restir_di_state.visibility_ray_directions.data();
+    m_render_data.render_settings.restir_di_settings.visibility_rays.ray_distances = m_restir_di_state.visibility_ray_distances.data();
     
     ThreadManager::join_threads(ThreadManager::SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES);
     m_render_data.buffers.emissive_triangles_count = parsed_scene.emissive_triangle_indices.size();
     m_render_data.buffers.emissive_triangles_indices = parsed_scene.emissive_triangle_indices.data();
 
+    m_triangle_emission_texture_luminances = EmissiveTextureIntegrator::compute_triangle_texture_luminances(parsed_scene);
+    m_render_data.buffers.triangle_emission_texture_luminances = m_triangle_emission_texture_luminances.empty() ? nullptr : m_triangle_emission_texture_luminances.data();
+
+    std::vector<float> emissive_triangles_power(parsed_scene.emissive_triangle_indices.size());
+    std::vector<float3> emissive_triangles_vertices(parsed_scene.emissive_triangle_indices.size() * 3);
+    for (int i = 0; i < parsed_scene.emissive_triangle_indices.size(); i++)
+    {
+        int triangle_index = parsed_scene.emissive_triangle_indices[i];
+        const SceneInstance& instance = parsed_scene.instances[get_scene_primitive_instance_index(parsed_scene.instances.data(), static_cast<int>(parsed_scene.instances.size()), triangle_index)];
+        int mesh_triangle_index = get_scene_primitive_mesh_triangle(instance, triangle_index);
+        float texture_luminance = m_triangle_emission_texture_luminances.empty() ? 1.0f : m_triangle_emission_texture_luminances[mesh_triangle_index];
+
+        float3 vertex_A, vertex_B, vertex_C;
+        parsed_scene.get_scene_primitive_vertices(triangle_index, vertex_A, vertex_B, vertex_C);
+
+        float area = hippt::length(hippt::cross(vertex_B - vertex_A, vertex_C - vertex_A)) * 0.5f;
+        emissive_triangles_power[i] = area * parsed_scene.materials[parsed_scene.material_indices[mesh_triangle_index]].get_emission_power_luminance(texture_luminance);
+        emissive_triangles_vertices[i * 3 + 0] = vertex_A;
+        emissive_triangles_vertices[i * 3 + 1] = vertex_B;
+        emissive_triangles_vertices[i * 3 + 2] = vertex_C;
+    }
+    Utils::compute_alias_table(emissive_triangles_power, m_emissive_triangles_alias_table_probas, m_emissive_triangles_alias_table_alias, &m_render_data.buffers.emissive_triangles_total_power);
+    m_render_data.buffers.emissive_triangles_alias_table_probas = m_emissive_triangles_alias_table_probas.data();
+    m_render_data.buffers.emissive_triangles_alias_table_alias = m_emissive_triangles_alias_table_alias.data();
+
+    LightBVHBuilder::build(parsed_scene, m_triangle_emission_texture_luminances, m_light_bvh_nodes, m_light_bvh_leaf_indices);
+    m_render_data.buffers.light_bvh_nodes = m_light_bvh_nodes.data();
+    m_render_data.buffers.light_bvh_leaf_indices = m_light_bvh_leaf_indices.data();
+
+    // Built once with the minimum light contribution of the render settings at load time
+    LightClustersBuilder::build(parsed_scene.emissive_triangle_indices, emissive_triangles_vertices, emissive_triangles_power, parsed_scene.scene_bounding_box,
+        m_render_data.render_settings.minimum_light_contribution, m_render_data.buffers.light_clusters, m_light_clusters);
+    m_render_data.buffers.light_clusters.cells_offsets = m_light_clusters.cells_offsets.data();
+    m_render_data.buffers.light_clusters.cells_emissive_triangles = m_light_clusters.cells_emissive_triangles.data();
+    m_render_data.buffers.light_clusters.cells_alias_table_probas = m_light_clusters.cells_alias_table_probas.data();
+    m_render_data.buffers.light_clusters.cells_alias_table_alias = m_light_clusters.cells_alias_table_alias.data();
+    m_render_data.buffers.light_clusters.cells_total_power = m_light_clusters.cells_total_power.data();
+
     std::cout << "Building scene BVH..." << std::endl;
+    // The CPU BVH is built over the world space triangles of all the instances
     m_triangle_buffer = parsed_scene.get_triangles();
     m_bvh = std::make_shared<BVH>(&m_triangle_buffer);
     m_render_data.cpu_only.bvh = m_bvh.get();
@@ -175,24 +395,45 @@ void CPURenderer::set_envmap(Image32Bit& envmap_image)
         m_envmap_cdf = envmap_image.compute_cdf();
         m_render_data.world_settings.envmap_total_sum = m_envmap_cdf.back();
     }
-    else if (EnvmapSamplingStrategy == ESS_ALIAS_TABLE)
+    else if (EnvmapSamplingStrategy == ESS_ALIAS_TABLE || EnvmapSamplingStrategy == ESS_PRODUCT_SAMPLING)
     {
         float total_sum;
 
         envmap_image.compute_alias_table(m_alias_table_probas, m_alias_table_alias, &total_sum);
         m_render_data.world_settings.envmap_total_sum = total_sum;
+
+        if (EnvmapCompactAliasTable == KERNEL_OPTION_TRUE)
+            m_alias_table_probas_16bit = Utils::quantize_unorm16(m_alias_table_probas);
+
+        if (EnvmapSamplingStrategy == ESS_PRODUCT_SAMPLING)
+            m_render_data.world_settings.envmap_luminance_pyramid_leaf_level = envmap_image.compute_luminance_pyramid(m_envmap_luminance_pyramid, 1024);
+    }
+    else if (EnvmapSamplingStrategy == ESS_MARGINAL_CONDITIONAL)
+    {
+        envmap_image.compute_marginal_conditional_cdf(m_envmap_marginal_cdf, m_envmap_conditional_cdfs);
+        m_render_data.world_settings.envmap_total_sum = m_envmap_marginal_cdf.back();
     }
 
     m_render_data.world_settings.envmap = &envmap_image;
     m_render_data.world_settings.envmap_width = envmap_image.width;
     m_render_data.world_settings.envmap_height = envmap_image.height;
+    // The CPU renderer samples the envmap at full resolution
+    m_render_data.world_settings.envmap_sampling_width = envmap_image.width;
+    m_render_data.world_settings.envmap_sampling_height = envmap_image.height;
 
     if (EnvmapSamplingStrategy == ESS_BINARY_SEARCH)
         m_render_data.world_settings.envmap_cdf = m_envmap_cdf.data();
-    else if (EnvmapSamplingStrategy == ESS_ALIAS_TABLE)
+    else if (EnvmapSamplingStrategy == ESS_ALIAS_TABLE || EnvmapSamplingStrategy == ESS_PRODUCT_SAMPLING)
     {
         m_render_data.world_settings.alias_table_probas = m_alias_table_probas.data();
         m_render_data.world_settings.alias_table_alias = m_alias_table_alias.data();
+        m_render_data.world_settings.alias_table_probas_16bit = m_alias_table_probas_16bit.data();
+        m_render_data.world_settings.envmap_luminance_pyramid = m_envmap_luminance_pyramid.data();
+    }
+    else if (EnvmapSamplingStrategy == ESS_MARGINAL_CONDITIONAL)
+    {
+        m_render_data.world_settings.envmap_marginal_cdf = m_envmap_marginal_cdf.data();
+        m_render_data.world_settings.envmap_conditional_cdfs = m_envmap_conditional_cdfs.data();
     }
 }
 
@@ -222,6 +463,7 @@ void CPURenderer::render()
     std::cout << "CPU rendering..." << std::endl;
 
     auto start = std::chrono::high_resolution_clock::now();
+    m_tile_scheduler.reset_tile_timings();
 
     // Using 'samples_per_frame' as the number of samples to render on the CPU
     for (int frame_number = 1; frame_number <= m_render_data.render_settings.samples_per_frame; frame_number++)
@@ -232,23 +474,42 @@ void CPURenderer::render()
         update_render_data(frame_number);
 
         camera_rays_pass();
+        denoiser_AOVs_resolve_pass();
 #if DirectLightSamplingStrategy == LSS_RESTIR_DI
         ReSTIR_DI();
+#elif DirectLightSamplingStrategy == LSS_RIS_BSDF_AND_LIGHT
+        // Only the presampled lights, for the light candidates of RIS
+        launch_ReSTIR_DI_presampling_lights_pass();
 #endif
         tracing_pass();
+#if IndirectLightSamplingStrategy == ILS_RESTIR_GI
+        ReSTIR_GI();
+#endif
+        adaptive_sampling_tile_error_pass();
 
         if (m_render_data.render_settings.accumulate)
             m_render_data.render_settings.sample_number++;
         m_render_data.random_seed = m_rng.xorshift32();
         m_render_data.render_settings.need_to_reset = false;
-        // We want the G Buffer of the frame that we just rendered to go in the "g_buffer_prev_frame"
-        // and then we can re-use the old buffers of to be filled by the current frame render
+        // The G Buffer of the frame that we just rendered goes in the "g_buffer_prev_frame"
+        // at the next update_render_data() and the old buffers are re-used for the next frame render
 
         std::cout << "Frame " << frame_number << ": " << frame_number/ static_cast<float>(m_render_data.render_settings.samples_per_frame) * 100.0f << "%" << std::endl;
     }
 
+    unpack_denoiser_AOVs_pass();
+
     auto stop = std::chrono::high_resolution_clock::now();
     std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "ms" << std::endl;
+
+    const std::vector<double>& tile_timings = m_tile_scheduler.get_tile_timings();
+    if (!tile_timings.empty())
+    {
+        int hottest_tile = static_cast<int>(std::max_element(tile_timings.begin(), tile_timings.end()) - tile_timings.begin());
+        int2 tile_count = m_tile_scheduler.get_tile_count();
+
+        std::cout << "Most expensive tile: (" << hottest_tile % tile_count.x << ", " << hottest_tile / tile_count.x << ") with " << tile_timings[hottest_tile] * 1000.0 << "ms" << std::endl;
+    }
 }
 
 void CPURenderer::update(int frame_number)
@@ -268,10 +529,28 @@ void CPURenderer::update_render_data(int sample)
 {
     m_render_data.prev_camera = m_render_data.current_camera;
     m_render_data.current_camera = m_camera.to_hiprt();
+
+    if (m_render_data.render_settings.use_prev_frame_g_buffer())
+    {
+        // The GBuffer of the last sample becomes the previous frame GBuffer and the
+        // old previous frame GBuffer is filled by the camera rays of this sample.
+        // This avoids copying the whole GBuffer every sample
+        std::swap(m_g_buffer, m_g_buffer_prev_frame);
+        std::swap(m_render_data.g_buffer, m_render_data.g_buffer_prev_frame);
+    }
 }
 
-void CPURenderer::debug_render_pass(std::function<void(int, int)> render_pass_function)
+void CPURenderer::debug_render_pass(const std::string& kernel_function_name)
 {
+#if DEBUG_PIXEL
+    CPUKernelExecutor::PixelKernelFunction kernel_function = CPUKernelExecutor::get_pixel_kernel_function(kernel_function_name);
+    if (kernel_function == nullptr)
+        return;
+
+    auto render_pass_function = [this, kernel_function](int x, int y) {
+        kernel_function(m_render_data, m_resolution, x, y);
+    };
+
     // Center pixel when rendering a neighborhood
     int center_x = 0;
     int center_y = 0;
@@ -281,9 +560,6 @@ void CPURenderer::debug_render_pass(std::function<void(int, int)> render_pass_fu
     int debug_x = -1;
     int debug_y = -1;
 
-#if DEBUG_PIXEL
-
-
 #if DEBUG_FLIP_Y
     center_x = DEBUG_PIXEL_X;
     center_y = DEBUG_PIXEL_Y;
@@ -311,6 +587,7 @@ void CPURenderer::debug_render_pass(std::function<void(int, int)> render_pass_fu
 
     // Debugging the chosen pixel
     render_pass_function(debug_x, debug_y);
+    hippt::flush_block_reduced_atomic_adds();
 
 #if DEBUG_RENDER_NEIGHBORHOOD
     // Rendering the neighborhood
@@ -326,36 +603,81 @@ void CPURenderer::debug_render_pass(std::function<void(int, int)> render_pass_fu
 
             render_pass_function(render_x, render_y);
         }
+
+        hippt::flush_block_reduced_atomic_adds();
     }
 #endif // DEBUG_RENDER_NEIGHBORHOOD
 
 #else // DEBUG_PIXEL
 
-#pragma omp parallel for schedule(dynamic)
-    for (int y = 0; y < m_resolution.y; y++)
-    {
-        for (int x = 0; x < m_resolution.x; x++)
-        {
-            if (x == debug_x && y == debug_y)
-                // Skipping the pixel that we debugged to avoid rendering it twice
-                continue;
-
-            render_pass_function(x, y);
-        }
-}
+    m_kernel_executor.launch_pixel_kernel(kernel_function_name, m_render_data, m_resolution);
 
 #endif // DEBUG_PIXEL
 }
 
 void CPURenderer::camera_rays_pass()
 {
-    debug_render_pass([this](int x, int y) {
-        CameraRays(m_render_data, m_resolution, x, y);
+#if DEBUG_PIXEL || !CPU_PACKET_CAMERA_RAYS
+    debug_render_pass("CameraRays");
+#else
+    packet_camera_rays_pass();
+#endif
+}
+
+void CPURenderer::packet_camera_rays_pass()
+{
+    // Each tile of the scheduler is split in packets of CAMERA_RAYS_TILE_SIZE x CAMERA_RAYS_TILE_SIZE rays
+    bool reuse_primary_hits = can_reuse_primary_hits(m_render_data);
+
+    m_tile_scheduler.run([this, reuse_primary_hits](int start_x, int start_y, int stop_x, int stop_y) {
+        for (int packet_y = start_y; packet_y < stop_y; packet_y += CAMERA_RAYS_TILE_SIZE)
+        {
+            for (int packet_x = start_x; packet_x < stop_x; packet_x += CAMERA_RAYS_TILE_SIZE)
+            {
+                uint32_t pixel_indices[CAMERA_RAYS_TILE_SIZE * CAMERA_RAYS_TILE_SIZE];
+                Xorshift32Generator random_number_generators[CAMERA_RAYS_TILE_SIZE * CAMERA_RAYS_TILE_SIZE];
+                hiprtRay rays[CAMERA_RAYS_TILE_SIZE * CAMERA_RAYS_TILE_SIZE];
+                hiprtHit hits[CAMERA_RAYS_TILE_SIZE * CAMERA_RAYS_TILE_SIZE];
+
+                // Generating the camera rays of the pixels of the packet that need to be sampled
+                int ray_count = 0;
+                for (int y = packet_y; y < hippt::min(packet_y + CAMERA_RAYS_TILE_SIZE, stop_y); y++)
+                    for (int x = packet_x; x < hippt::min(packet_x + CAMERA_RAYS_TILE_SIZE, stop_x); x++)
+                    {
+                        if (!generate_camera_ray(m_render_data, m_resolution, x, y, pixel_indices[ray_count], random_number_generators[ray_count], rays[ray_count]))
+                            continue;
+
+                        if (reuse_primary_hits)
+                            // Not added to the packet
+                            reuse_camera_ray_hit(m_render_data, m_resolution, pixel_indices[ray_count]);
+                        else
+                            ray_count++;
+                    }
+
+                intersect_scene_cpu_packet(m_render_data, rays, ray_count, random_number_generators, hits);
+
+                for (int i = 0; i < ray_count; i++)
+                {
+                    RayPayload ray_payload;
+                    ray_payload.ray_cone.spread_angle = m_render_data.current_camera.get_pixel_spread_angle(m_resolution);
+                    HitInfo closest_hit_info;
+
+                    // The packet traversal gives the first hit, trace_ray() takes care of the rest (materials,
+                    // normals, skipping volume boundaries, ...)
+                    bool intersection_found = trace_ray(m_render_data, rays[i], ray_payload, closest_hit_info, random_number_generators[i], &hits[i]);
+
+                    store_camera_ray_hit(m_render_data, m_resolution, pixel_indices[i], rays[i], intersection_found, ray_payload, closest_hit_info);
+                }
+            }
+        }
     });
 }
 
 void CPURenderer::ReSTIR_DI()
 {
+    // Alternating the half of the checkerboard that runs the passes every frame
+    m_render_data.render_settings.restir_di_settings.checkerboard_parity = m_restir_di_state.odd_frame ? 1 : 0;
+
     launch_ReSTIR_DI_presampling_lights_pass();
     launch_ReSTIR_DI_initial_candidates_pass();
 
@@ -411,9 +733,17 @@ LightPresamplingParameters CPURenderer::configure_ReSTIR_DI_light_presampling_pa
      */
     parameters.emissive_triangles_count = m_render_data.buffers.emissive_triangles_count;
     parameters.emissive_triangles_indices = m_render_data.buffers.emissive_triangles_indices;
+    parameters.emissive_triangles_alias_table_probas = m_render_data.buffers.emissive_triangles_alias_table_probas;
+    parameters.emissive_triangles_alias_table_alias = m_render_data.buffers.emissive_triangles_alias_table_alias;
+    parameters.emissive_triangles_total_power = m_render_data.buffers.emissive_triangles_total_power;
     parameters.triangles_indices = m_render_data.buffers.triangles_indices;
     parameters.vertices_positions = m_render_data.buffers.vertices_positions;
+    parameters.quantized_vertices_positions = m_render_data.buffers.quantized_vertices_positions;
+    parameters.mesh_vertex_attributes = m_render_data.buffers.mesh_vertex_attributes;
     parameters.material_indices = m_render_data.buffers.material_indices;
+    parameters.triangle_emission_texture_luminances = m_render_data.buffers.triangle_emission_texture_luminances;
+    parameters.instances = m_render_data.buffers.instances;
+    parameters.instance_count = m_render_data.buffers.instance_count;
     parameters.materials = m_render_data.buffers.materials_buffer;
 
     // World settings for sampling the envmap
@@ -423,20 +753,35 @@ LightPresamplingParameters CPURenderer::configure_ReSTIR_DI_light_presampling_pa
     parameters.sample_number = m_render_data.render_settings.sample_number;
     parameters.random_seed = m_rng.xorshift32();
 
-    // For each presampled light, the probability that this is going to be an envmap sample
-    parameters.envmap_sampling_probability = m_render_data.render_settings.restir_di_settings.initial_candidates.envmap_candidate_probability;
+    // For each presampled light, the probability that this is going to be an envmap sample.
+    // The RIS light candidates don't sample the envmap, only ReSTIR DI does
+    parameters.envmap_sampling_probability = DirectLightSamplingStrategy == LSS_RESTIR_DI ? m_render_data.render_settings.restir_di_settings.initial_candidates.envmap_candidate_probability : 0.0f;
+
+    // Same probability as the presampling kernel, for the MIS weights of the RIS BSDF candidates
+    float envmap_probability = 0.0f;
+    if (m_render_data.world_settings.ambient_light_type == AmbientLightType::ENVMAP)
+        envmap_probability = m_render_data.buffers.emissive_triangles_count == 0 ? 1.0f : parameters.envmap_sampling_probability;
+    m_render_data.render_settings.restir_di_settings.light_presampling.emissive_triangle_probability = 1.0f - envmap_probability;
 
     return parameters;
 }
 
 void CPURenderer::launch_ReSTIR_DI_presampling_lights_pass()
 {
-    if (ReSTIR_DI_DoLightsPresampling == KERNEL_OPTION_TRUE)
+    bool presampling_for_ReSTIR_DI = DirectLightSamplingStrategy == LSS_RESTIR_DI && ReSTIR_DI_DoLightsPresampling == KERNEL_OPTION_TRUE;
+    if (presampling_for_ReSTIR_DI || m_render_data.render_settings.restir_di_settings.light_presampling.use_for_RIS_light_candidates)
     {
+        LightPresamplingSettings& light_presampling = m_render_data.render_settings.restir_di_settings.light_presampling;
+        light_presampling.update_auto_size(m_render_data.buffers.emissive_triangles_count, m_render_data.world_settings.ambient_light_type == AmbientLightType::ENVMAP, m_resolution);
+        std::size_t presampled_light_count = light_presampling.number_of_subsets * light_presampling.subset_size;
+        if (m_restir_di_state.presampled_lights_buffer.size() < presampled_light_count)
+            m_restir_di_state.presampled_lights_buffer.resize(presampled_light_count);
+
         LightPresamplingParameters launch_parameters = configure_ReSTIR_DI_light_presampling_pass();
 
-        for (int index = 0; index < launch_parameters.number_of_subsets * launch_parameters.subset_size; index++)
+        m_kernel_executor.launch_linear(launch_parameters.number_of_subsets * launch_parameters.subset_size, CPUKernelExecutor::LINEAR_BLOCK_SIZE, [&launch_parameters](int index) {
             ReSTIR_DI_LightsPresampling(launch_parameters, index);
+        });
     }
 }
 
@@ -451,9 +796,10 @@ void CPURenderer::launch_ReSTIR_DI_initial_candidates_pass()
 {
     configure_ReSTIR_DI_initial_pass();
 
-    debug_render_pass([this](int x, int y) {
-        ReSTIR_DI_InitialCandidates(m_render_data, m_resolution, x, y);
-    });
+    debug_render_pass("ReSTIR_DI_InitialCandidates");
+
+    if (ReSTIR_DI_DoVisibilityReuse == KERNEL_OPTION_TRUE)
+        ReSTIR_DI_visibility_rays_pass(m_render_data.render_settings.restir_di_settings.initial_candidates.output_reservoirs);
 }
 
 void CPURenderer::configure_ReSTIR_DI_temporal_pass()
@@ -510,6 +856,8 @@ void CPURenderer::configure_ReSTIR_DI_temporal_pass_for_fused_spatiotemporal()
 void CPURenderer::configure_ReSTIR_DI_spatial_pass(int spatial_pass_index)
 {
     m_render_data.random_seed = m_rng.xorshift32();
+    // All the inputs of the spatial passes were written this frame
+    m_render_data.render_settings.restir_di_settings.spatial_pass.input_checkerboard_parity = m_render_data.render_settings.restir_di_settings.checkerboard_parity;
 
     if (spatial_pass_index == 0)
     {
@@ -555,6 +903,8 @@ void CPURenderer::configure_ReSTIR_DI_spatial_pass_for_fused_spatiotemporal(int
         // 'm_render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs'
         // is the proper pointer
         m_render_data.render_settings.restir_di_settings.spatial_pass.input_reservoirs = m_render_data.render_settings.restir_di_settings.temporal_pass.input_reservoirs;
+        // which was written on the other half of the checkerboard
+        m_render_data.render_settings.restir_di_settings.spatial_pass.input_checkerboard_parity = m_render_data.render_settings.restir_di_settings.checkerboard_parity ^ 1;
 
         if (m_restir_di_state.odd_frame)
             m_render_data.render_settings.restir_di_settings.spatial_pass.output_reservoirs = m_restir_di_state.spatial_output_reservoirs_2.data();
@@ -590,53 +940,183 @@ void CPURenderer::configure_ReSTIR_DI_output_buffer()
 
 void CPURenderer::ReSTIR_DI_temporal_reuse_pass()
 {
-    debug_render_pass([this](int x, int y) {
-        ReSTIR_DI_TemporalReuse(m_render_data, m_resolution, x, y);
-    });
+    debug_render_pass("ReSTIR_DI_TemporalReuse");
 }
 
 void CPURenderer::ReSTIR_DI_spatial_reuse_pass()
 {
-    debug_render_pass([this](int x, int y) {
-        ReSTIR_DI_SpatialReuse(m_render_data, m_resolution, x, y);
-    });
+    debug_render_pass("ReSTIR_DI_SpatialReuse");
+
+    ReSTIR_DI_visibility_rays_pass(m_render_data.render_settings.restir_di_settings.spatial_pass.output_reservoirs);
 }
 
 void CPURenderer::ReSTIR_DI_spatiotemporal_reuse_pass()
 {
-    debug_render_pass([this](int x, int y) {
-        ReSTIR_DI_SpatiotemporalReuse(m_render_data, m_resolution, x, y);
+    debug_render_pass("ReSTIR_DI_SpatiotemporalReuse");
+
+    ReSTIR_DI_visibility_rays_pass(m_render_data.render_settings.restir_di_settings.spatial_pass.output_reservoirs);
+}
+
+void CPURenderer::ReSTIR_DI_visibility_rays_pass(ReSTIRDIPackedReservoir* reservoirs)
+{
+    if (ReSTIR_DI_BatchedVisibilityRays == KERNEL_OPTION_FALSE)
+        return;
+
+    m_render_data.random_seed = m_rng.xorshift32();
+    m_render_data.render_settings.restir_di_settings.visibility_rays.reservoirs = reservoirs;
+
+    unsigned int ray_count = m_restir_di_state.visibility_ray_count;
+    m_kernel_executor.launch_linear(static_cast<int>(ray_count), CPUKernelExecutor::LINEAR_BLOCK_SIZE, [this](int ray_index) {
+        ReSTIR_DI_VisibilityRays(m_render_data, m_resolution, ray_index);
     });
+
+    m_restir_di_state.visibility_ray_count = 0;
 }
 
 void CPURenderer::tracing_pass()
 {
-    debug_render_pass([this](int x, int y) {
-        FullPathTracer(m_render_data, m_resolution, x, y);
+    debug_render_pass("FullPathTracer");
+}
+
+void CPURenderer::adaptive_sampling_tile_error_pass()
+{
+    if (!m_render_data.render_settings.enable_adaptive_sampling || !m_render_data.render_settings.adaptive_sampling_tile_based)
+        return;
+
+    int tile_count_x = (m_resolution.x + ADAPTIVE_SAMPLING_TILE_SIZE - 1) / ADAPTIVE_SAMPLING_TILE_SIZE;
+    int tile_count_y = (m_resolution.y + ADAPTIVE_SAMPLING_TILE_SIZE - 1) / ADAPTIVE_SAMPLING_TILE_SIZE;
+
+    // One block of ADAPTIVE_SAMPLING_TILE_SIZE * ADAPTIVE_SAMPLING_TILE_SIZE threads per tile on the GPU,
+    // one call per tile on the CPU
+    m_kernel_executor.launch_linear(tile_count_x * tile_count_y, 1, [this, tile_count_x](int tile_index) {
+        AdaptiveSamplingTileError(m_render_data, m_resolution, tile_index % tile_count_x, tile_index / tile_count_x);
     });
 }
 
-void CPURenderer::tonemap(float gamma, float exposure)
+void CPURenderer::denoiser_AOVs_resolve_pass()
 {
-#if DEBUG_PIXEL == 0
-#pragma omp parallel for schedule(dynamic)
+#if DenoiserAOVsFromGBuffer == KERNEL_OPTION_TRUE
+    // Same G-buffer for all the samples without jittering
+    if (m_render_data.current_camera.do_jittering || m_render_data.render_settings.sample_number == 0)
+        debug_render_pass("DenoiserAOVsResolve");
+#endif
+}
+
+void CPURenderer::unpack_denoiser_AOVs_pass()
+{
+#if PackedDenoiserAOVs == KERNEL_OPTION_TRUE
+    debug_render_pass("UnpackDenoiserAOVs");
 #endif
-    for (int y = 0; y < m_resolution.y; y++)
+}
+
+void CPURenderer::ReSTIR_GI()
+{
+    if (m_render_data.render_settings.restir_gi_settings.temporal_pass.do_temporal_reuse_pass)
+    {
+        configure_ReSTIR_GI_temporal_pass();
+        ReSTIR_GI_temporal_reuse_pass();
+    }
+
+    if (m_render_data.render_settings.restir_gi_settings.spatial_pass.do_spatial_reuse_pass)
     {
-        for (int x = 0; x < m_resolution.x; x++)
+        configure_ReSTIR_GI_spatial_pass();
+        ReSTIR_GI_spatial_reuse_pass();
+    }
+
+    configure_ReSTIR_GI_output_buffer();
+    ReSTIR_GI_shading_pass();
+}
+
+void CPURenderer::configure_ReSTIR_GI_temporal_pass()
+{
+    ReSTIRGISettings& restir_gi_settings = m_render_data.render_settings.restir_gi_settings;
+    ReSTIRGIReservoir* last_frame_output = restir_gi_settings.restir_output_reservoirs;
+
+    m_render_data.random_seed = m_rng.xorshift32();
+
+    // Same buffers logic as ReSTIRGIRenderPass::configure_temporal_pass()
+    if (last_frame_output == m_restir_gi_state.initial_candidates_reservoirs.data())
+        restir_gi_settings.temporal_pass.input_reservoirs = nullptr;
+    else
+        restir_gi_settings.temporal_pass.input_reservoirs = last_frame_output;
+
+    if (last_frame_output == m_restir_gi_state.output_reservoirs_1.data())
+        restir_gi_settings.temporal_pass.output_reservoirs = m_restir_gi_state.output_reservoirs_2.data();
+    else
+        restir_gi_settings.temporal_pass.output_reservoirs = m_restir_gi_state.output_reservoirs_1.data();
+}
+
+void CPURenderer::configure_ReSTIR_GI_spatial_pass()
+{
+    ReSTIRGISettings& restir_gi_settings = m_render_data.render_settings.restir_gi_settings;
+
+    m_render_data.random_seed = m_rng.xorshift32();
+
+    if (restir_gi_settings.temporal_pass.do_temporal_reuse_pass)
+        restir_gi_settings.spatial_pass.input_reservoirs = restir_gi_settings.temporal_pass.output_reservoirs;
+    else
+        restir_gi_settings.spatial_pass.input_reservoirs = restir_gi_settings.initial_candidates.output_reservoirs;
+
+    if (restir_gi_settings.spatial_pass.input_reservoirs == m_restir_gi_state.output_reservoirs_1.data())
+        restir_gi_settings.spatial_pass.output_reservoirs = m_restir_gi_state.output_reservoirs_2.data();
+    else
+        restir_gi_settings.spatial_pass.output_reservoirs = m_restir_gi_state.output_reservoirs_1.data();
+}
+
+void CPURenderer::configure_ReSTIR_GI_output_buffer()
+{
+    ReSTIRGISettings& restir_gi_settings = m_render_data.render_settings.restir_gi_settings;
+
+    if (restir_gi_settings.spatial_pass.do_spatial_reuse_pass)
+        restir_gi_settings.restir_output_reservoirs = restir_gi_settings.spatial_pass.output_reservoirs;
+    else if (restir_gi_settings.temporal_pass.do_temporal_reuse_pass)
+        restir_gi_settings.restir_output_reservoirs = restir_gi_settings.temporal_pass.output_reservoirs;
+    else
+        restir_gi_settings.restir_output_reservoirs = restir_gi_settings.initial_candidates.output_reservoirs;
+}
+
+void CPURenderer::ReSTIR_GI_temporal_reuse_pass()
+{
+    debug_render_pass("ReSTIR_GI_TemporalReuse");
+}
+
+void CPURenderer::ReSTIR_GI_spatial_reuse_pass()
+{
+    debug_render_pass("ReSTIR_GI_SpatialReuse");
+}
+
+void CPURenderer::ReSTIR_GI_shading_pass()
+{
+    m_render_data.random_seed = m_rng.xorshift32();
+
+    debug_render_pass("ReSTIR_GI_Shading");
+}
+
+void CPURenderer::tonemap(float gamma, float exposure)
+{
+    m_tile_scheduler.run([this, gamma, exposure](int start_x, int start_y, int stop_x, int stop_y) {
+        for (int y = start_y; y < stop_y; y++)
         {
-            int index = x + y * m_resolution.x;
+            for (int x = start_x; x < stop_x; x++)
+            {
+                int index = x + y * m_resolution.x;
 
-            ColorRGB32F hdr_color = m_render_data.buffers.pixels[index];
+                ColorRGB32F hdr_color = m_render_data.buffers.pixels[index];
 
-            if (m_render_data.render_settings.accumulate)
-                // Scaling by sample count
-                hdr_color = hdr_color / float(m_render_data.render_settings.sample_number);
+                if (m_render_data.render_settings.accumulate)
+                    // Scaling by sample count
+                    hdr_color = hdr_color / float(m_render_data.render_settings.sample_number);
 
-            ColorRGB32F tone_mapped = ColorRGB32F(1.0f) - exp(-hdr_color * exposure);
-            tone_mapped = pow(tone_mapped, 1.0f / gamma);
+                ColorRGB32F tone_mapped = ColorRGB32F(1.0f) - exp(-hdr_color * exposure);
+                tone_mapped = pow(tone_mapped, 1.0f / gamma);
 
-            m_render_data.buffers.pixels[index] = tone_mapped;
+                m_render_data.buffers.pixels[index] = tone_mapped;
+            }
         }
-    }
+    });
+}
+
+Image32Bit CPURenderer::get_tile_timings_heatmap() const
+{
+    return m_tile_scheduler.get_tile_timings_heatmap();
 }
@@ -9,10 +9,16 @@
 #include "Device/kernel_parameters/ReSTIR/DI/LightPresamplingParameters.h"
 #include "HostDeviceCommon/RenderData.h"
 #include "Image/Image.h"
+#include "Image/TiledTexture.h"
 #include "Renderer/BVH.h"
+#include "Renderer/CPUKernelExecutor.h"
+#include "Renderer/CPUTileScheduler.h"
+#include "Renderer/FirstTouchAllocator.h"
+#include "Renderer/LightClustersBuilder.h"
 #include "Scene/SceneParser.h"
 #include "Utils/CommandlineArguments.h"
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <vector>
@@ -34,8 +40,18 @@ public:
     void update(int frame_number);
     void update_render_data(int sample);
 
-    void debug_render_pass(std::function<void(int, int)> render_pass_function);
+    /**
+     * Launches the per-pixel kernel whose main function is 'kernel_function_name' (see
+     * CPUKernelExecutor::PIXEL_KERNEL_FUNCTIONS) over the image, or only over the debug pixel
+     * and its neighborhood if DEBUG_PIXEL is 1
+     */
+    void debug_render_pass(const std::string& kernel_function_name);
     void camera_rays_pass();
+    /**
+     * Traces the camera rays of tiles of CAMERA_RAYS_TILE_SIZE x CAMERA_RAYS_TILE_SIZE
+     * pixels as packets of coherent rays
+     */
+    void packet_camera_rays_pass();
 
     void ReSTIR_DI();
 
@@ -55,40 +71,103 @@ public:
     void ReSTIR_DI_temporal_reuse_pass();
     void ReSTIR_DI_spatial_reuse_pass();
     void ReSTIR_DI_spatiotemporal_reuse_pass();
+    void ReSTIR_DI_visibility_rays_pass(ReSTIRDIPackedReservoir* reservoirs);
 
     void tracing_pass();
+    void adaptive_sampling_tile_error_pass();
+    void denoiser_AOVs_resolve_pass();
+    void unpack_denoiser_AOVs_pass();
+
+    /**
+     * Temporal and spatial reuse + shading passes of ReSTIR GI, after the
+     * tracing pass which outputs the initial candidates
+     */
+    void ReSTIR_GI();
+
+    void configure_ReSTIR_GI_temporal_pass();
+    void configure_ReSTIR_GI_spatial_pass();
+    void configure_ReSTIR_GI_output_buffer();
+
+    void ReSTIR_GI_temporal_reuse_pass();
+    void ReSTIR_GI_spatial_reuse_pass();
+    void ReSTIR_GI_shading_pass();
 
     void tonemap(float gamma, float exposure);
 
+    /**
+     * Heatmap of the time spent in each tile of the image by all the passes
+     * run since the beginning of the last call to render(). See CPUTileScheduler
+     */
+    Image32Bit get_tile_timings_heatmap() const;
+
 private:
+    // 8x8 tiles so that a tile fits in a single packet of BVH::intersect_ray_packet()
+    static constexpr int CAMERA_RAYS_TILE_SIZE = 8;
+    static_assert(CAMERA_RAYS_TILE_SIZE * CAMERA_RAYS_TILE_SIZE <= BVHConstants::RAY_PACKET_MAX_SIZE);
+
+    /**
+     * Writes the initial values of the per-pixel buffers, with each tile written by the
+     * thread of the tile scheduler that owns it so that the pages of the buffers are on the
+     * NUMA node of the threads that render them. See FirstTouchAllocator
+     */
+    void first_touch_pixel_buffers();
+
     int2 m_resolution;
 
     Image32Bit m_framebuffer;
-    std::vector<unsigned char> m_pixel_active_buffer;
-    std::vector<ColorRGB32F> m_denoiser_albedo;
-    std::vector<float3> m_denoiser_normals;
-
-    std::vector<int> m_pixel_sample_count;
-    std::vector<int> m_pixel_converged_sample_count;
-    std::vector<float> m_pixel_squared_luminance;
+    // The per-pixel buffers are first written by the threads that render
+    // the pixels, see CPURenderer::first_touch_pixel_buffers()
+    FirstTouchVector<PixelStatus> m_pixel_status;
+    FirstTouchVector<ColorRGB32F> m_denoiser_albedo;
+    FirstTouchVector<float3> m_denoiser_normals;
+    // Only allocated with PackedDenoiserAOVs
+    FirstTouchVector<unsigned int> m_packed_denoiser_albedo;
+    FirstTouchVector<unsigned int> m_packed_denoiser_normals;
+
+    FirstTouchVector<int> m_pixel_converged_sample_count;
+    FirstTouchVector<float> m_pixel_squared_luminance;
+    FirstTouchVector<float> m_pixel_half_luminance;
+    // Same format as the material buffer of the GPU
+    std::vector<PackedRendererMaterial> m_packed_materials;
+    // Octahedral encoded vertex normals of the scene and where the attributes
+    // of each mesh are, same storage as on the GPU
+    std::vector<unsigned int> m_vertex_normals;
+    std::vector<MeshVertexAttributes> m_mesh_vertex_attributes;
+    // The material textures of the scene with their mip chains, in tiles
+    std::vector<TiledTexture> m_material_textures;
+    // See TriangleOpacityClassifier
+    std::vector<unsigned char> m_triangle_opacities;
+    std::vector<int> m_triangle_opacity_micromap_indices;
+    std::vector<unsigned char> m_opacity_micromaps;
     unsigned char m_still_one_ray_active = true;
     AtomicType<unsigned int> m_stop_noise_threshold_count;
 
     std::vector<float> m_envmap_cdf;
     std::vector<float> m_alias_table_probas;
     std::vector<int> m_alias_table_alias;
-
+    // Only used if EnvmapCompactAliasTable is true
+    std::vector<unsigned short> m_alias_table_probas_16bit;
+    std::vector<float> m_envmap_marginal_cdf;
+    std::vector<float> m_envmap_conditional_cdfs;
+    // Only used with the product sampling strategy
+    std::vector<float> m_envmap_luminance_pyramid;
+
+    // Host side storage of the compact GBuffer layout, see the device GBuffer
     struct GBuffer
     {
-        std::vector<SimplifiedRendererMaterial> materials;
-        std::vector<float3> geometric_normals;
-        std::vector<float3> shading_normals;
-        std::vector<float3> view_directions;
-        std::vector<float3> first_hits;
-
-        std::vector<unsigned char> cameray_ray_hit;
-
-        std::vector<RayVolumeState> ray_volume_states;
+        FirstTouchVector<int> material_indices;
+        FirstTouchVector<float2> texcoords;
+        FirstTouchVector<unsigned int> geometric_normals;
+        FirstTouchVector<unsigned int> shading_normals;
+        FirstTouchVector<float2> view_directions;
+        FirstTouchVector<float> first_hit_distances;
+        FirstTouchVector<float2> motion_vectors;
+        FirstTouchVector<float> texture_footprints;
+        FirstTouchVector<float> ray_cone_spread_angles;
+
+        FirstTouchVector<unsigned char> cameray_ray_hit;
+
+        FirstTouchVector<StoredRayVolumeState> ray_volume_states;
     };
 
     GBuffer m_g_buffer;
@@ -99,20 +178,51 @@ private:
 
     struct ReSTIRDIState
     {
-        std::vector<ReSTIRDIReservoir> initial_candidates_reservoirs;
-        std::vector<ReSTIRDIReservoir> spatial_output_reservoirs_1;
-        std::vector<ReSTIRDIReservoir> spatial_output_reservoirs_2;
+        FirstTouchVector<ReSTIRDIPackedReservoir> initial_candidates_reservoirs;
+        FirstTouchVector<ReSTIRDIPackedReservoir> spatial_output_reservoirs_1;
+        FirstTouchVector<ReSTIRDIPackedReservoir> spatial_output_reservoirs_2;
         std::vector<ReSTIRDIPresampledLight> presampled_lights_buffer;
 
-        ReSTIRDIReservoir* output_reservoirs = nullptr;
+        // Queue of the visibility reuse rays if ReSTIR_DI_BatchedVisibilityRays is true
+        std::atomic<unsigned int> visibility_ray_count = 0;
+        FirstTouchVector<int> visibility_ray_pixel_indices;
+        FirstTouchVector<float3> visibility_ray_origins;
+        FirstTouchVector<float3> visibility_ray_directions;
+        FirstTouchVector<float> visibility_ray_distances;
+
+        ReSTIRDIPackedReservoir* output_reservoirs = nullptr;
 
 
         bool odd_frame = false;
     } m_restir_di_state;
 
+    struct ReSTIRGIState
+    {
+        FirstTouchVector<ReSTIRGIReservoir> initial_candidates_reservoirs;
+        FirstTouchVector<ReSTIRGIReservoir> output_reservoirs_1;
+        FirstTouchVector<ReSTIRGIReservoir> output_reservoirs_2;
+    } m_restir_gi_state;
+
+    // See EmissiveTextureIntegrator, empty if no material has an emission texture
+    std::vector<float> m_triangle_emission_texture_luminances;
+    // Alias table for sampling the emissive triangles of the scene proportionally to their power
+    std::vector<float> m_emissive_triangles_alias_table_probas;
+    std::vector<int> m_emissive_triangles_alias_table_alias;
+
+    // Light hierarchy over the emissive triangles of the scene, see LightBVHBuilder
+    std::vector<LightBVHNode> m_light_bvh_nodes;
+    std::vector<int> m_light_bvh_leaf_indices;
+    // Light clusters of the ETSS_LIGHT_CLUSTERS strategy, see LightClustersBuilder
+    LightClustersData m_light_clusters;
+
     std::vector<Triangle> m_triangle_buffer;
     std::shared_ptr<BVH> m_bvh;
 
+    // Distributes the pixels of all the passes over the threads
+    CPUTileScheduler m_tile_scheduler;
+    // Runs the kernels over the tiles of 'm_tile_scheduler'
+    CPUKernelExecutor m_kernel_executor;
+
     Camera m_camera;
     HIPRTRenderData m_render_data;
 };
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/CPUTileScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <omp.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * Interleaves the bits of x and y
+ */
+static uint64_t morton_code_2D(uint32_t x, uint32_t y)
+{
+	uint64_t code = 0;
+	for (int bit = 0; bit < 32; bit++)
+	{
+		code |= static_cast<uint64_t>((x >> bit) & 1) << (2 * bit);
+		code |= static_cast<uint64_t>((y >> bit) & 1) << (2 * bit + 1);
+	}
+
+	return code;
+}
+
+void CPUTileScheduler::set_resolution(int2 resolution)
+{
+	m_resolution = resolution;
+	m_tile_count = make_int2((resolution.x + TILE_SIZE - 1) / TILE_SIZE, (resolution.y + TILE_SIZE - 1) / TILE_SIZE);
+
+	int tile_count = m_tile_count.x * m_tile_count.y;
+	m_morton_ordered_tiles.resize(tile_count);
+	for (int i = 0; i < tile_count; i++)
+		m_morton_ordered_tiles[i] = i;
+
+	std::sort(m_morton_ordered_tiles.begin(), m_morton_ordered_tiles.end(), [this](int tile_a, int tile_b)
+	{
+		return morton_code_2D(tile_a % m_tile_count.x, tile_a / m_tile_count.x) < morton_code_2D(tile_b % m_tile_count.x, tile_b / m_tile_count.x);
+	});
+
+	m_tile_timings.assign(tile_count, 0.0);
+
+	m_thread_cpus.clear();
+#ifdef __linux__
+	// Already bound by the OpenMP runtime if the user asked for it
+	if (omp_get_proc_bind() == omp_proc_bind_false)
+	{
+		cpu_set_t allowed_cpus;
+		if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) == 0)
+			// The CPUs are numbered socket after socket by Linux on the usual NUMA machines
+			// so consecutive threads, which own consecutive ranges of tiles, share a node
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+				if (CPU_ISSET(cpu, &allowed_cpus))
+					m_thread_cpus.push_back(cpu);
+	}
+#endif
+}
+
+void CPUTileScheduler::get_thread_range(int thread, int thread_count, int& range_start, int& range_stop) const
+{
+	int tile_count = static_cast<int>(m_morton_ordered_tiles.size());
+
+	range_start = static_cast<int>(static_cast<long long>(tile_count) * thread / thread_count);
+	range_stop = static_cast<int>(static_cast<long long>(tile_count) * (thread + 1) / thread_count);
+}
+
+void CPUTileScheduler::pin_thread(int thread_index) const
+{
+#ifdef __linux__
+	if (thread_index == 0 || m_thread_cpus.empty())
+		return;
+
+	cpu_set_t cpu;
+	CPU_ZERO(&cpu);
+	CPU_SET(m_thread_cpus[thread_index % m_thread_cpus.size()], &cpu);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+#endif
+}
+
+void CPUTileScheduler::run(const std::function<void(int, int, int, int)>& tile_function)
+{
+	struct TileQueue
+	{
+		std::mutex mutex;
+		std::deque<int> tiles;
+	};
+
+	int thread_count = omp_get_max_threads();
+
+	// Contiguous ranges of the Morton ordered tiles for each thread
+	std::vector<TileQueue> queues(thread_count);
+	for (int thread = 0; thread < thread_count; thread++)
+	{
+		int range_start, range_stop;
+		get_thread_range(thread, thread_count, range_start, range_stop);
+
+		queues[thread].tiles.assign(m_morton_ordered_tiles.begin() + range_start, m_morton_ordered_tiles.begin() + range_stop);
+	}
+
+#pragma omp parallel num_threads(thread_count)
+	{
+		int thread_index = omp_get_thread_num();
+		// The OpenMP runtime may give another system thread that index than in the previous passes
+		pin_thread(thread_index);
+
+		while (true)
+		{
+			int tile_index = -1;
+
+			{
+				// Own tiles first, from the front
+				TileQueue& own_queue = queues[thread_index];
+				std::lock_guard<std::mutex> lock(own_queue.mutex);
+				if (!own_queue.tiles.empty())
+				{
+					tile_index = own_queue.tiles.front();
+					own_queue.tiles.pop_front();
+				}
+			}
+
+			// Stealing from the back of the queues of the other threads. The back of a queue
+			// is the farthest away from the tiles its owner is currently working on
+			for (int i = 1; i < thread_count && tile_index == -1; i++)
+			{
+				TileQueue& victim_queue = queues[(thread_index + i) % thread_count];
+				std::lock_guard<std::mutex> lock(victim_queue.mutex);
+				if (!victim_queue.tiles.empty())
+				{
+					tile_index = victim_queue.tiles.back();
+					victim_queue.tiles.pop_back();
+				}
+			}
+
+			if (tile_index == -1)
+				// No tiles left anywhere
+				break;
+
+			int start_x = (tile_index % m_tile_count.x) * TILE_SIZE;
+			int start_y = (tile_index / m_tile_count.x) * TILE_SIZE;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			tile_function(start_x, start_y, std::min(start_x + TILE_SIZE, m_resolution.x), std::min(start_y + TILE_SIZE, m_resolution.y));
+			// The status counters incremented by the pixels of the tile, see hippt::aggregated_atomic_add()
+			hippt::flush_block_reduced_atomic_adds();
+			auto stop = std::chrono::high_resolution_clock::now();
+
+			// Each tile is processed by exactly one thread per run, no synchronization needed
+			m_tile_timings[tile_index] += std::chrono::duration<double>(stop - start).count();
+		}
+	}
+}
+
+void CPUTileScheduler::first_touch(const std::function<void(int, int, int, int)>& tile_function)
+{
+	int thread_count = omp_get_max_threads();
+
+#pragma omp parallel num_threads(thread_count)
+	{
+		int thread_index = omp_get_thread_num();
+		pin_thread(thread_index);
+
+		int range_start, range_stop;
+		get_thread_range(thread_index, thread_count, range_start, range_stop);
+		for (int i = range_start; i < range_stop; i++)
+		{
+			int tile_index = m_morton_ordered_tiles[i];
+			int start_x = (tile_index % m_tile_count.x) * TILE_SIZE;
+			int start_y = (tile_index / m_tile_count.x) * TILE_SIZE;
+
+			tile_function(start_x, start_y, std::min(start_x + TILE_SIZE, m_resolution.x), std::min(start_y + TILE_SIZE, m_resolution.y));
+		}
+	}
+}
+
+void CPUTileScheduler::reset_tile_timings()
+{
+	std::fill(m_tile_timings.begin(), m_tile_timings.end(), 0.0);
+}
+
+const std::vector<double>& CPUTileScheduler::get_tile_timings() const
+{
+	return m_tile_timings;
+}
+
+int2 CPUTileScheduler::get_tile_count() const
+{
+	return m_tile_count;
+}
+
+Image32Bit CPUTileScheduler::get_tile_timings_heatmap() const
+{
+	Image32Bit heatmap(m_resolution.x, m_resolution.y, 3);
+
+	double max_timing = 0.0;
+	for (double timing : m_tile_timings)
+		max_timing = std::max(max_timing, timing);
+
+	if (max_timing == 0.0)
+		return heatmap;
+
+	for (int y = 0; y < m_resolution.y; y++)
+	{
+		for (int x = 0; x < m_resolution.x; x++)
+		{
+			int tile_index = x / TILE_SIZE + (y / TILE_SIZE) * m_tile_count.x;
+			float normalized_timing = static_cast<float>(m_tile_timings[tile_index] / max_timing);
+
+			int pixel_index = (x + y * m_resolution.x) * 3;
+			heatmap[pixel_index + 0] = normalized_timing;
+			heatmap[pixel_index + 1] = normalized_timing;
+			heatmap[pixel_index + 2] = normalized_timing;
+		}
+	}
+
+	return heatmap;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef CPU_TILE_SCHEDULER_H
+#define CPU_TILE_SCHEDULER_H
+
+#include "HostDeviceCommon/Math.h"
+#include "Image/Image.h"
+
+#include <functional>
+#include <vector>
+
+/**
+ * Distributes the pixels of a render pass of the CPURenderer over the threads
+ * in tiles of TILE_SIZE x TILE_SIZE pixels.
+ * 
+ * The tiles are ordered along a Morton curve (so that consecutive tiles are close in the image
+ * and share their caches) and split in contiguous ranges, one per thread. Each thread processes
+ * the tiles of its own range front to back and, once done, steals tiles from the back
+ * of the ranges of the other threads.
+ * 
+ * The time spent on each tile is accumulated across the passes to be able to
+ * visualize the expensive regions of the image (see get_tile_timings_heatmap())
+ *
+ * On Linux, the worker threads are pinned to the CPUs the process is allowed to run on (unless
+ * OMP_PROC_BIND already binds them) so that a thread keeps rendering from the same core, and the
+ * same NUMA node, as the pixels it wrote first: see first_touch()
+ */
+class CPUTileScheduler
+{
+public:
+	static constexpr int TILE_SIZE = 16;
+
+	void set_resolution(int2 resolution);
+
+	/**
+	 * Calls 'tile_function(start_x, start_y, stop_x, stop_y)' for all the tiles of the image
+	 * with all the OpenMP threads available. 'stop_x' and 'stop_y' are exclusive
+	 */
+	void run(const std::function<void(int, int, int, int)>& tile_function);
+	/**
+	 * Same as run() but each thread only calls 'tile_function' on its own range of tiles, without
+	 * stealing and without timing the tiles.
+	 *
+	 * Used to write the per-pixel buffers for the first time (see FirstTouchAllocator): the pages of a
+	 * tile are then on the NUMA node of the thread that processes that tile first in all the run(),
+	 * the stolen tiles aside
+	 */
+	void first_touch(const std::function<void(int, int, int, int)>& tile_function);
+
+	void reset_tile_timings();
+	/**
+	 * Time in seconds spent in each tile since the last reset, row major
+	 * over the tiles of the image (see get_tile_count())
+	 */
+	const std::vector<double>& get_tile_timings() const;
+	int2 get_tile_count() const;
+
+	/**
+	 * Returns an image at the resolution of the render where the pixels of each tile
+	 * are the time spent in that tile, normalized by the time of the most expensive tile
+	 */
+	Image32Bit get_tile_timings_heatmap() const;
+
+private:
+	/**
+	 * Tiles [range_start, range_stop[ of 'm_morton_ordered_tiles' owned by 'thread'
+	 */
+	void get_thread_range(int thread, int thread_count, int& range_start, int& range_stop) const;
+	/**
+	 * Pins the calling OpenMP thread 'thread_index' to one of 'm_thread_cpus'. The main thread
+	 * (index 0) isn't pinned: the threads that it creates afterwards would inherit its affinity
+	 */
+	void pin_thread(int thread_index) const;
+
+	int2 m_resolution = make_int2(0, 0);
+	int2 m_tile_count = make_int2(0, 0);
+
+	// Indices of the tiles (row major) in Morton order
+	std::vector<int> m_morton_ordered_tiles;
+	std::vector<double> m_tile_timings;
+
+	// CPUs the process was allowed to run on when the resolution was set, in
+	// the order the threads are pinned to. Empty if the threads aren't pinned
+	std::vector<int> m_thread_cpus;
+};
+
+#endif
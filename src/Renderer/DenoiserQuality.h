@@ -0,0 +1,20 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DENOISER_QUALITY_H
+#define DENOISER_QUALITY_H
+
+/**
+ * Quality of the filters of the OpenImageDenoiser, from the fastest to the highest quality.
+ * Maps to oidn::Quality
+ */
+enum DenoiserQuality
+{
+	DENOISER_QUALITY_FAST = 0,
+	DENOISER_QUALITY_BALANCED = 1,
+	DENOISER_QUALITY_HIGH = 2,
+};
+
+#endif
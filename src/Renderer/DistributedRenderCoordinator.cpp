@@ -0,0 +1,216 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+// The socket headers must come before anything that could include windows.h
+#include "Utils/Sockets.h"
+
+#include "Image/EXRWriter.h"
+#include "Image/Image.h"
+#include "Renderer/DistributedRenderCoordinator.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <sstream>
+#include <thread>
+
+extern ImGuiLogger g_imgui_logger;
+
+const std::string DistributedRenderCoordinator::WORKERS_COMMANDLINE_ARGUMENT = "--distribute=";
+
+/**
+ * What a worker sent back for its share of the render
+ */
+struct DistributedWorkerResult
+{
+	bool success = false;
+	// Why the worker failed if not 'success'
+	std::string error;
+
+	int samples = 0;
+	long long render_time_ms = 0;
+	// Average of the samples of the worker in each pixel and the number of these samples
+	std::vector<float> pixels;
+	std::vector<int> sample_counts;
+};
+
+/**
+ * Sends the render request of its share of the samples to the worker 'address' and waits for its result
+ */
+static void render_on_worker(const std::string& address, const CommandlineArguments& arguments, int samples, unsigned int seed, DistributedWorkerResult& out_result)
+{
+	size_t colon_position = address.rfind(':');
+	if (colon_position == std::string::npos)
+	{
+		out_result.error = "Expected host:port";
+
+		return;
+	}
+
+	std::intptr_t worker_socket = connect_to(address.substr(0, colon_position), std::atoi(address.substr(colon_position + 1).c_str()));
+	if (worker_socket == static_cast<std::intptr_t>(INVALID_SOCKET_HANDLE))
+	{
+		out_result.error = "Could not connect";
+
+		return;
+	}
+
+	std::stringstream request;
+	request << "render width=" << arguments.render_width << " height=" << arguments.render_height << " samples=" << samples
+		<< " bounces=" << arguments.bounces << " seed=" << seed << " sample_counts=1";
+
+	int pixel_count = arguments.render_width * arguments.render_height;
+	std::string line;
+	bool received = send_line(worker_socket, request.str());
+	// Skipping the "queued" line, the worker may still be rendering the jobs of other clients
+	while (received && (received = receive_line(worker_socket, line)) && line.starts_with("queued"));
+
+	if (!received)
+		out_result.error = "Disconnected";
+	else if (!line.starts_with("done"))
+		out_result.error = "Unexpected answer \"" + line + "\"";
+	else
+	{
+		std::string command;
+		int job_id, width, height;
+		size_t byte_count;
+		std::stringstream done_line(line);
+		done_line >> command >> job_id >> out_result.samples >> out_result.render_time_ms >> width >> height >> byte_count;
+
+		if (width != arguments.render_width || height != arguments.render_height || byte_count != pixel_count * 3 * sizeof(float))
+			out_result.error = "Unexpected render size in \"" + line + "\"";
+		else
+		{
+			out_result.pixels.resize(pixel_count * 3);
+			out_result.sample_counts.resize(pixel_count);
+
+			if (!receive_all(worker_socket, out_result.pixels.data(), byte_count)
+				|| !receive_line(worker_socket, line)
+				|| !line.starts_with("sample_counts")
+				|| !receive_all(worker_socket, out_result.sample_counts.data(), pixel_count * sizeof(int)))
+				out_result.error = "Could not read the sample counts";
+			else
+				out_result.success = true;
+		}
+	}
+
+	close_socket(static_cast<SocketHandle>(worker_socket));
+}
+
+std::vector<int> DistributedRenderCoordinator::split_samples(int sample_count, int worker_count)
+{
+	std::vector<int> worker_samples(worker_count, sample_count / worker_count);
+	for (int i = 0; i < sample_count % worker_count; i++)
+		worker_samples[i]++;
+
+	return worker_samples;
+}
+
+int DistributedRenderCoordinator::run(const CommandlineArguments& arguments)
+{
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not initialize the sockets of the render coordinator.");
+
+		return 1;
+	}
+#endif
+
+	int worker_count = static_cast<int>(arguments.distributed_workers.size());
+	std::vector<int> worker_samples = DistributedRenderCoordinator::split_samples(arguments.render_samples, worker_count);
+	std::vector<DistributedWorkerResult> results(worker_count);
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Distributing %d samples over %d workers...", arguments.render_samples, worker_count);
+
+	std::chrono::high_resolution_clock::time_point start_render = std::chrono::high_resolution_clock::now();
+	std::vector<std::thread> worker_threads;
+	for (int i = 0; i < worker_count; i++)
+	{
+		if (worker_samples[i] == 0)
+			// More workers than samples
+			continue;
+
+		// Different seeds so that the workers render different samples. A different multiplier
+		// than the one between the devices of a worker (see MultiGPURenderer::set_rng_seed())
+		unsigned int seed = 42 + i * 0x85EBCA6Bu;
+		worker_threads.emplace_back(render_on_worker, std::cref(arguments.distributed_workers[i]), std::cref(arguments), worker_samples[i], seed, std::ref(results[i]));
+	}
+	for (std::thread& worker_thread : worker_threads)
+		worker_thread.join();
+	long long render_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_render).count();
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	int pixel_count = arguments.render_width * arguments.render_height;
+	Image32Bit image(arguments.render_width, arguments.render_height, 3);
+	std::vector<int> total_sample_counts(pixel_count, 0);
+	int total_samples = 0;
+	for (int i = 0; i < worker_count; i++)
+	{
+		if (worker_samples[i] == 0)
+			continue;
+
+		const DistributedWorkerResult& result = results[i];
+		if (!result.success)
+		{
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Worker %s failed, its %d samples are missing: %s", arguments.distributed_workers[i].c_str(), worker_samples[i], result.error.c_str());
+
+			continue;
+		}
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Worker %s: %d samples in %lldms", arguments.distributed_workers[i].c_str(), result.samples, result.render_time_ms);
+
+		// The pixels of the workers are averages, weighted back by their sample counts
+		for (int pixel = 0; pixel < pixel_count; pixel++)
+		{
+			for (int channel = 0; channel < 3; channel++)
+				image[pixel * 3 + channel] += result.pixels[pixel * 3 + channel] * result.sample_counts[pixel];
+
+			total_sample_counts[pixel] += result.sample_counts[pixel];
+		}
+		total_samples += result.samples;
+	}
+
+	if (total_samples == 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "No worker rendered any sample");
+
+		return 1;
+	}
+
+	for (int pixel = 0; pixel < pixel_count; pixel++)
+		for (int channel = 0; channel < 3; channel++)
+			image[pixel * 3 + channel] /= std::max(1, total_sample_counts[pixel]);
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%d samples rendered by the workers in %lldms", total_samples, render_time_ms);
+
+	bool written;
+	if (std::filesystem::path(arguments.output_file_path).extension() == ".exr")
+	{
+		EXRLayer beauty;
+		beauty.channel_names = { "R", "G", "B" };
+		beauty.pixels = image.data();
+
+		written = write_image_exr(arguments.output_file_path.c_str(), image.width, image.height, { beauty });
+	}
+	else
+		written = image.write_image_hdr(arguments.output_file_path.c_str());
+
+	if (!written)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the render to %s", arguments.output_file_path.c_str());
+
+		return 1;
+	}
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Render written to %s", arguments.output_file_path.c_str());
+
+	return 0;
+}
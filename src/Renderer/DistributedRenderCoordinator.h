@@ -0,0 +1,47 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef DISTRIBUTED_RENDER_COORDINATOR_H
+#define DISTRIBUTED_RENDER_COORDINATOR_H
+
+#include "Utils/CommandlineArguments.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Spreads one headless render over several nodes. Each node runs the application as a RenderServer
+ * (--server=) on the same scene, which the nodes load from the binary scene cache if it is on a shared
+ * file system, and the application started with WORKERS_COMMANDLINE_ARGUMENT coordinates them:
+ *	- the samples of the render are split evenly between the workers
+ *	- each worker renders its samples of the full frame with its own seed so that the workers render different samples
+ *	- the renders of the workers are merged weighted, per pixel, by the sample counts of the workers so that the
+ *	  result is the same as if one node had rendered all the samples, adaptive sampling included: a worker may
+ *	  have stopped sampling a pixel long before the others
+ *
+ * The coordinator doesn't load the scene nor needs a GPU. A worker that fails only loses its samples,
+ * the render is written as long as one worker succeeded
+ */
+class DistributedRenderCoordinator
+{
+public:
+	static const std::string WORKERS_COMMANDLINE_ARGUMENT;
+
+	/**
+	 * Renders 'arguments.render_samples' samples at 'arguments.render_width' x 'arguments.render_height'
+	 * with 'arguments.bounces' bounces on the workers 'arguments.distributed_workers' ("host:port")
+	 * and writes the merged render to 'arguments.output_file_path' (EXR or HDR).
+	 *
+	 * Returns the exit code of the application
+	 */
+	static int run(const CommandlineArguments& arguments);
+
+	/**
+	 * Number of samples rendered by each of 'worker_count' workers for a render of 'sample_count' samples
+	 */
+	static std::vector<int> split_samples(int sample_count, int worker_count);
+};
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/EmbeddedRenderer.h"
+#include "Renderer/GPURenderer.h"
+#include "Threads/ThreadFunctions.h"
+#include "Threads/ThreadManager.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <filesystem>
+
+extern ImGuiLogger g_imgui_logger;
+
+EmbeddedRenderer::EmbeddedRenderer(int device_index)
+{
+	m_hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(device_index);
+	m_renderer = std::make_unique<GPURenderer>(m_hiprt_orochi_ctx, /* headless */ true);
+}
+
+EmbeddedRenderer::~EmbeddedRenderer()
+{
+	// The renderer may still be swapping in a scene or reading the envmap on other threads
+	ThreadManager::join_all_threads();
+}
+
+bool EmbeddedRenderer::load_scene(const std::string& scene_file_path, int width, int height, const std::string& envmap_file_path)
+{
+	// The parser falls back to the default scene for files it can't read
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(scene_file_path, error))
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Scene file %s not found.", scene_file_path.c_str());
+
+		return false;
+	}
+
+	SceneParserOptions options;
+	options.nb_texture_threads = std::max(1, ThreadManager::get_worker_count() - 1);
+	// The vertex attributes of cached scenes are uploaded straight from the cache file
+	options.stream_cached_vertex_attributes = true;
+	m_renderer->set_scene_parser_options(options);
+
+	if (m_scene_loaded)
+	{
+		if (width != m_width || height != m_height)
+			resize(width, height);
+
+		// Swapped in by render()
+		m_renderer->load_scene_async(scene_file_path);
+		if (!envmap_file_path.empty())
+			m_renderer->load_envmap_async(envmap_file_path);
+
+		return true;
+	}
+
+	options.override_aspect_ratio = static_cast<float>(width) / height;
+	Assimp::Importer assimp_importer;
+	SceneParser::parse_scene_file(scene_file_path, assimp_importer, m_scene, options);
+
+	// The renderer needs its stream for resizing
+	ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_CREATE);
+
+	if (!envmap_file_path.empty())
+	{
+		m_envmap_file_path = envmap_file_path;
+		ThreadManager::start_thread(ThreadManager::ENVMAP_LOAD_FROM_DISK_THREAD, ThreadFunctions::read_image_hdr, std::ref(m_envmap), m_envmap_file_path, 3, true);
+		m_renderer->set_envmap(m_envmap, m_envmap_file_path);
+	}
+	m_renderer->set_camera(m_scene.camera);
+	m_renderer->resize(width, height);
+	m_renderer->set_scene(m_scene);
+
+	ThreadManager::join_all_threads();
+
+	assimp_importer.FreeScene();
+	m_envmap.free();
+
+	m_width = width;
+	m_height = height;
+	m_scene_loaded = true;
+	reset();
+
+	return true;
+}
+
+bool EmbeddedRenderer::is_scene_loading() const
+{
+	return m_renderer->is_pending_scene_loading();
+}
+
+HIPRTRenderSettings& EmbeddedRenderer::get_render_settings()
+{
+	return m_renderer->get_render_settings();
+}
+
+WorldSettings& EmbeddedRenderer::get_world_settings()
+{
+	return m_renderer->get_world_settings();
+}
+
+Camera& EmbeddedRenderer::get_camera()
+{
+	return m_renderer->get_camera();
+}
+
+std::shared_ptr<GPUKernelCompilerOptions> EmbeddedRenderer::get_kernel_options()
+{
+	return m_renderer->get_global_compiler_options();
+}
+
+void EmbeddedRenderer::recompile_kernels()
+{
+	m_renderer->recompile_kernels();
+}
+
+void EmbeddedRenderer::set_views(const std::vector<Camera>& cameras)
+{
+	m_renderer->synchronize_kernel();
+	m_renderer->set_views(cameras);
+
+	// The views are stacked in the render of the renderer
+	resize(m_width, m_height);
+}
+
+void EmbeddedRenderer::set_material_previews(int target_material_index, const std::vector<RendererMaterial>& preview_materials)
+{
+	m_renderer->set_material_previews(target_material_index, preview_materials);
+
+	// One view per preview material
+	resize(m_width, m_height);
+}
+
+int EmbeddedRenderer::get_view_count() const
+{
+	return m_renderer->get_view_count();
+}
+
+void EmbeddedRenderer::resize(int width, int height)
+{
+	m_renderer->synchronize_kernel();
+	m_renderer->resize(width, height * m_renderer->get_view_count());
+
+	m_width = width;
+	m_height = height;
+	reset();
+}
+
+void EmbeddedRenderer::reset()
+{
+	std::shared_ptr<ApplicationSettings> application_settings = std::make_shared<ApplicationSettings>();
+	m_renderer->reset(application_settings);
+	m_renderer->get_render_settings().samples_per_frame = 1;
+}
+
+void EmbeddedRenderer::render(int frame_count)
+{
+	if (m_renderer->update_pending_scene())
+		reset();
+
+	for (int frame = 0; frame < frame_count; frame++)
+	{
+		m_renderer->update();
+		m_renderer->render();
+	}
+}
+
+void EmbeddedRenderer::synchronize()
+{
+	m_renderer->synchronize_kernel();
+}
+
+int EmbeddedRenderer::get_sample_number()
+{
+	return m_renderer->get_render_settings().sample_number;
+}
+
+int EmbeddedRenderer::get_width() const
+{
+	return m_width;
+}
+
+int EmbeddedRenderer::get_height() const
+{
+	return m_height;
+}
+
+ColorRGB32F* EmbeddedRenderer::get_device_framebuffer()
+{
+	return m_renderer->get_device_framebuffer();
+}
+
+float3* EmbeddedRenderer::get_device_normals_AOV_buffer()
+{
+	return m_renderer->get_device_normals_AOV_buffer();
+}
+
+ColorRGB32F* EmbeddedRenderer::get_device_albedo_AOV_buffer()
+{
+	return m_renderer->get_device_albedo_AOV_buffer();
+}
+
+oroStream_t EmbeddedRenderer::get_stream()
+{
+	return m_renderer->get_main_stream();
+}
+
+RenderLayersDownload EmbeddedRenderer::download_render_layers_async()
+{
+	return m_renderer->download_render_layers_async(/* include_denoised */ false);
+}
+
+GPURenderer& EmbeddedRenderer::get_renderer()
+{
+	return *m_renderer;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef EMBEDDED_RENDERER_H
+#define EMBEDDED_RENDERER_H
+
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/Math.h"
+#include "Image/Image.h"
+#include "Renderer/RenderLayersDownload.h"
+#include "Scene/SceneParser.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Orochi/Orochi.h>
+
+class GPUKernelCompilerOptions;
+class GPURenderer;
+struct Camera;
+struct RendererMaterial;
+struct HIPRTRenderSettings;
+struct WorldSettings;
+
+/**
+ * Entry point of the HIPRTPathTracerLib library for the applications that embed the renderer
+ * (DCC plugins, simulators, ML data generation, ...) instead of running the HIPRTPathTracer executable.
+ *
+ * Wraps a headless GPURenderer: no window, no OpenGL context. The frames are accumulated into plain
+ * GPU buffers whose device pointers are given by get_device_framebuffer() and the AOV getters so that
+ * the host application can consume the render on the same device (its own kernels, a copy into one of
+ * its textures, ...) without any download or disk I/O. download_render_layers_async() is there for
+ * the host applications that need the render on the CPU.
+ *
+ * The frames are queued on get_stream(): the work of the host application that reads the buffers must
+ * be ordered after the frames on that stream (or the renderer synchronized with synchronize()).
+ * The buffers must not be read while render() queues new frames into them.
+ *
+ * Typical use:
+ *	- load_scene()
+ *	- get_render_settings() / get_camera() modifications followed by reset()
+ *	- render() any number of times
+ *	- get_device_framebuffer() / get_sample_number()
+ *
+ * The kernels are read and compiled at runtime from DEVICE_KERNELS_DIRECTORY as with the executable
+ */
+class EmbeddedRenderer
+{
+public:
+	/**
+	 * Creates the renderer on the GPU 'device_index'. The kernels start compiling in the background
+	 */
+	EmbeddedRenderer(int device_index = 0);
+	~EmbeddedRenderer();
+
+	/**
+	 * Loads the scene at 'scene_file_path' with the envmap at 'envmap_file_path' (uniform ambient
+	 * light if empty) and renders it at 'width' * 'height'.
+	 *
+	 * The first scene is parsed and uploaded before this function returns. The next ones are parsed
+	 * in the background while the frames keep rendering the current scene and are swapped in by the
+	 * first render() once they're ready, see GPURenderer::load_scene_async(). The render is then reset.
+	 *
+	 * Returns false if the scene file doesn't exist
+	 */
+	bool load_scene(const std::string& scene_file_path, int width, int height, const std::string& envmap_file_path = "");
+	/**
+	 * Whether a scene given to load_scene() is still loading in the background
+	 */
+	bool is_scene_loading() const;
+
+	/**
+	 * Settings of the render. The render must be reset() after they're modified
+	 */
+	HIPRTRenderSettings& get_render_settings();
+	WorldSettings& get_world_settings();
+	Camera& get_camera();
+	/**
+	 * Options the kernels are compiled with, see GPURenderer::recompile_kernels()
+	 */
+	std::shared_ptr<GPUKernelCompilerOptions> get_kernel_options();
+	void recompile_kernels();
+	/**
+	 * Renders the views of all the 'cameras' in the same frames, see GPURenderer::set_views().
+	 * Each view is rendered at get_width() * get_height(), the buffers of get_device_framebuffer(), ...
+	 * hold the get_view_count() views one after the other.
+	 * 
+	 * Less than 2 cameras goes back to rendering get_camera() only. The render is reset
+	 */
+	void set_views(const std::vector<Camera>& cameras);
+	int get_view_count() const;
+	/**
+	 * Renders one get_width() * get_height() tile per material of 'preview_materials' in the same frames,
+	 * the material 'target_material_index' of the scene being replaced by the material of the tile, see
+	 * GPURenderer::set_material_previews(). The tiles are the views of the render (see set_views()).
+	 * 
+	 * No preview materials stops the previews. The render is reset
+	 */
+	void set_material_previews(int target_material_index, const std::vector<RendererMaterial>& preview_materials);
+	/**
+	 * Resizes the render (and the buffers of get_device_framebuffer(), ...), the resolution of each view
+	 * if several views are rendered. The render is reset
+	 */
+	void resize(int width, int height);
+	/**
+	 * Discards the samples accumulated so far, for the settings modified since the last frame to be used
+	 */
+	void reset();
+
+	/**
+	 * Queues 'frame_count' frames of one sample each on get_stream(). Doesn't wait for the GPU
+	 * beyond the GPURenderer::MAX_QUEUED_FRAME_COUNT frames that can be queued
+	 */
+	void render(int frame_count = 1);
+	/**
+	 * Waits for all the frames queued by render()
+	 */
+	void synchronize();
+
+	/**
+	 * Number of samples accumulated in the render by the frames queued so far
+	 */
+	int get_sample_number();
+	int get_width() const;
+	int get_height() const;
+
+	/**
+	 * Device pointers of the buffers of the render, get_width() * get_height() * get_view_count() elements,
+	 * row major, view after view.
+	 * See GPURenderer::get_device_framebuffer(): the framebuffer holds the sum of get_sample_number()
+	 * samples, the AOVs are averaged.
+	 *
+	 * The pointers stay valid until the next resize() or load_scene() of a scene of another resolution
+	 */
+	ColorRGB32F* get_device_framebuffer();
+	float3* get_device_normals_AOV_buffer();
+	ColorRGB32F* get_device_albedo_AOV_buffer();
+	/**
+	 * Stream the frames are rendered on
+	 */
+	oroStream_t get_stream();
+	/**
+	 * Queues the download of the beauty, the AOVs and the pixel sample counts of the render after
+	 * the frames already queued, see GPURenderer::download_render_layers_async()
+	 */
+	RenderLayersDownload download_render_layers_async();
+
+	/**
+	 * The wrapped renderer, for everything that EmbeddedRenderer doesn't expose
+	 */
+	GPURenderer& get_renderer();
+
+private:
+	std::shared_ptr<HIPRTOrochiCtx> m_hiprt_orochi_ctx = nullptr;
+	std::unique_ptr<GPURenderer> m_renderer = nullptr;
+	int m_width = 0;
+	int m_height = 0;
+
+	// The first scene and its envmap are read by the renderer on other threads
+	// (and by its progressive loading afterwards) so they're kept alive with the renderer
+	bool m_scene_loaded = false;
+	Scene m_scene;
+	Image32Bit m_envmap;
+	std::string m_envmap_file_path;
+};
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef FIRST_TOUCH_ALLOCATOR_H
+#define FIRST_TOUCH_ALLOCATOR_H
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Allocator whose value-initialization (what std::vector::resize(count) does to the new elements)
+ * doesn't write the elements of trivially copyable types.
+ *
+ * The pages of a large allocation are only physically allocated by the OS when they are
+ * first written and, on a NUMA machine, on the memory node of the thread that writes them.
+ * A std::vector resized on the main thread is entirely written by the main thread and ends up
+ * on the node of the main thread. With this allocator, the per-pixel buffers of the CPURenderer
+ * are written for the first time by the threads that render the pixels (see CPUTileScheduler::first_touch())
+ * and are local to them.
+ *
+ * The elements are left uninitialized until then: every element must be assigned before being read
+ */
+template <typename T>
+class FirstTouchAllocator : public std::allocator<T>
+{
+public:
+    template <typename U>
+    struct rebind
+    {
+        using other = FirstTouchAllocator<U>;
+    };
+
+    FirstTouchAllocator() = default;
+    template <typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U>&) noexcept {}
+
+    template <typename U>
+    void construct(U* pointer) noexcept(std::is_nothrow_default_constructible<U>::value)
+    {
+        if constexpr (!std::is_trivially_copyable<U>::value)
+            ::new (static_cast<void*>(pointer)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* pointer, Args&&... args)
+    {
+        ::new (static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T>
+using FirstTouchVector = std::vector<T, FirstTouchAllocator<T>>;
+
+#endif
@@ -4,46 +4,95 @@
  */
 
 #include "Compiler/GPUKernelCompilerOptions.h"
+#include "Compiler/KernelCompileFarm.h"
+#include "Compiler/KernelOptionsUsageHistory.h"
 #include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "HostDeviceCommon/MeshVertexAttributes.h"
+#include "HostDeviceCommon/Octahedral.h"
+#include "HostDeviceCommon/RayStatistics.h"
 #include "Renderer/GPURenderer.h"
+#include "Renderer/LightBVHBuilder.h"
+#include "Scene/EmissiveTextureIntegrator.h"
+#include "Scene/TriangleOpacityClassifier.h"
 #include "Threads/ThreadFunctions.h"
 #include "Threads/ThreadManager.h"
 #include "Threads/ThreadFunctions.h"
+#include "Utils/TraceRecorder.h"
+#include "Utils/Utils.h"
+
+#include "glm/matrix.hpp"
 
 #include <Orochi/OrochiUtils.h>
 
+#include <algorithm>
 #include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <utility>
 
 const std::string GPURenderer::CAMERA_RAYS_KERNEL_ID = "Camera Rays";
+const std::string GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID = "Active Pixel Compaction";
 const std::string GPURenderer::PATH_TRACING_KERNEL_ID = "Path Tracing";
-const std::string GPURenderer::RAY_VOLUME_STATE_SIZE_KERNEL_ID = "Ray Volume State Size";
+const std::string GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID = "Path Tracing Persistent";
+const std::string GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID = "Adaptive Sampling Tile Error";
+const std::string GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID = "Temporal Reprojection";
+const std::string GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID = "Temporal Upscaling";
+const std::string GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID = "Temporal Upscaling Resolve";
+const std::string GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID = "Unpack Denoiser AOVs";
+const std::string GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID = "Denoiser AOVs Resolve";
 
 const std::unordered_map<std::string, std::string> GPURenderer::KERNEL_FUNCTION_NAMES = 
 {
 	{ CAMERA_RAYS_KERNEL_ID, "CameraRays" },
+	{ ACTIVE_PIXEL_COMPACTION_KERNEL_ID, "ActivePixelCompaction" },
 	{ PATH_TRACING_KERNEL_ID, "FullPathTracer" },
-	{ RAY_VOLUME_STATE_SIZE_KERNEL_ID, "RayVolumeStateSize" },
+	{ PATH_TRACING_PERSISTENT_KERNEL_ID, "FullPathTracerPersistent" },
+	{ ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID, "AdaptiveSamplingTileError" },
+	{ TEMPORAL_REPROJECTION_KERNEL_ID, "TemporalReprojection" },
+	{ TEMPORAL_UPSCALING_KERNEL_ID, "TemporalUpscaling" },
+	{ TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID, "TemporalUpscalingResolve" },
+	{ UNPACK_DENOISER_AOVS_KERNEL_ID, "UnpackDenoiserAOVs" },
+	{ DENOISER_AOVS_RESOLVE_KERNEL_ID, "DenoiserAOVsResolve" },
 };
 
 const std::unordered_map<std::string, std::string> GPURenderer::KERNEL_FILES =
 {
 	{ CAMERA_RAYS_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/CameraRays.h" },
+	{ ACTIVE_PIXEL_COMPACTION_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ActivePixelCompaction.h" },
 	{ PATH_TRACING_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/FullPathTracer.h" },
-	{ RAY_VOLUME_STATE_SIZE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Utils/RayVolumeStateSize.h" },
+	{ PATH_TRACING_PERSISTENT_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/FullPathTracer.h" },
+	{ ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/AdaptiveSamplingTileError.h" },
+	{ TEMPORAL_REPROJECTION_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/TemporalReprojection.h" },
+	{ TEMPORAL_UPSCALING_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/TemporalUpscaling.h" },
+	{ TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/TemporalUpscaling.h" },
+	{ UNPACK_DENOISER_AOVS_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/UnpackDenoiserAOVs.h" },
+	{ DENOISER_AOVS_RESOLVE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/DenoiserAOVsResolve.h" },
+};
+
+const std::unordered_set<std::string> GPURenderer::RUNTIME_KERNEL_OPTIONS =
+{
+	GPUKernelCompilerOptions::ENVMAP_SAMPLING_DO_BSDF_MIS,
+	GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE,
 };
 
 const std::string GPURenderer::FULL_FRAME_TIME_KEY = "FullFrameTime";
+const std::string GPURenderer::BVH_BUILD_TIME_KEY = "BVHBuildTime";
+const std::string GPURenderer::BVH_MEMORY_KEY = "BVHMemory";
 
-GPURenderer::GPURenderer(std::shared_ptr<HIPRTOrochiCtx> hiprt_oro_ctx)
+GPURenderer::GPURenderer(std::shared_ptr<HIPRTOrochiCtx> hiprt_oro_ctx, bool headless) : m_headless(headless)
 {
-	m_rng.m_state.seed = 42;
+	m_rng.m_state.seed = m_rng_seed;
 
-	// Creating buffers
-	m_framebuffer = std::make_shared<OpenGLInteropBuffer<ColorRGB32F>>();
-	m_denoised_framebuffer = std::make_shared<OpenGLInteropBuffer<ColorRGB32F>>();
-	m_normals_AOV_buffer = std::make_shared<OpenGLInteropBuffer<float3>>();
-	m_albedo_AOV_buffer = std::make_shared<OpenGLInteropBuffer<ColorRGB32F>>();
-	m_pixels_converged_sample_count_buffer = std::make_shared<OpenGLInteropBuffer<int>>();
+	if (!m_headless)
+	{
+		// Creating buffers. Headless renderers use the plain GPU buffers instead
+		m_framebuffer = std::make_shared<OpenGLInteropBuffer<ColorRGB32F>>();
+		m_denoised_framebuffer = std::make_shared<OpenGLInteropBuffer<ColorRGB32F>>();
+		m_normals_AOV_buffer = std::make_shared<OpenGLInteropBuffer<float3>>();
+		m_albedo_AOV_buffer = std::make_shared<OpenGLInteropBuffer<ColorRGB32F>>();
+		m_pixels_converged_sample_count_buffer = std::make_shared<OpenGLInteropBuffer<int>>();
+		m_pixel_costs_buffer = std::make_shared<OpenGLInteropBuffer<float4>>();
+	}
 	
 	m_hiprt_orochi_ctx = hiprt_oro_ctx;	
 	m_device_properties = m_hiprt_orochi_ctx->device_properties;
@@ -72,6 +121,22 @@ GPURenderer::GPURenderer(std::shared_ptr<HIPRTOrochiCtx> hiprt_oro_ctx)
 	OROCHI_CHECK_ERROR(oroEventCreate(&m_frame_stop_event));
 }
 
+GPURenderer::~GPURenderer()
+{
+	stop_geometry_streaming();
+
+	if (m_progressive_loading_scene != nullptr)
+		// Waiting for the textures of the scene that are still loading
+		ThreadManager::join_threads(ThreadManager::RENDERER_PROGRESSIVE_LOADING);
+
+	if (m_pending_scene_loading)
+	{
+		// The parsing task starts the loading task at its end
+		ThreadManager::join_threads(ThreadManager::RENDERER_SCENE_ASYNC_PARSE);
+		ThreadManager::join_threads(ThreadManager::RENDERER_SCENE_ASYNC_LOAD);
+	}
+}
+
 void GPURenderer::setup_kernels()
 {
 	/*GPUKernel test_kernel;
@@ -80,14 +145,23 @@ void GPURenderer::setup_kernels()
 	test_kernel.get_kernel_options().set_additional_include_directories(GPURenderer::COMMON_ADDITIONAL_KERNEL_INCLUDE_DIRS);
 	test_kernel.compile(m_hiprt_orochi_ctx);*/
 
-	// Function called on intersections for handling alpha testing
+	// Function called on the intersections with the alpha tested meshes. The opaque meshes have
+	// no filter function, HIPRT accepts their hits directly. The analytic spheres have no triangles,
+	// HIPRT calls their intersection function on the bounding boxes of the spheres instead.
+	// Indexed by geometry type (one ray type)
 	hiprtFuncNameSet alpha_testing_func_set = { nullptr, "alpha_testing" };
+	hiprtFuncNameSet opaque_func_set = { nullptr, nullptr };
+	hiprtFuncNameSet spheres_func_set = { "intersect_sphere", nullptr };
 	m_func_name_sets.push_back(alpha_testing_func_set);
+	m_func_name_sets.push_back(opaque_func_set);
+	m_func_name_sets.push_back(spheres_func_set);
 
+	// The functions read the scene from the payload of the traversal, not from the data of the table
 	hiprtFuncDataSet func_data_set;
 	hiprtFuncTable func_table;
-	HIPRT_CHECK_ERROR(hiprtCreateFuncTable(m_hiprt_orochi_ctx->hiprt_ctx, 1, 1, func_table));
-	HIPRT_CHECK_ERROR(hiprtSetFuncTable(m_hiprt_orochi_ctx->hiprt_ctx, func_table, 0, 0, func_data_set));
+	HIPRT_CHECK_ERROR(hiprtCreateFuncTable(m_hiprt_orochi_ctx->hiprt_ctx, HIPRT_GEOMETRY_TYPE_COUNT, 1, func_table));
+	HIPRT_CHECK_ERROR(hiprtSetFuncTable(m_hiprt_orochi_ctx->hiprt_ctx, func_table, HIPRT_GEOMETRY_TYPE_ALPHA_TESTED, 0, func_data_set));
+	HIPRT_CHECK_ERROR(hiprtSetFuncTable(m_hiprt_orochi_ctx->hiprt_ctx, func_table, HIPRT_GEOMETRY_TYPE_SPHERES, 0, func_data_set));
 
 	m_render_data.func_table = func_table;
 
@@ -101,6 +175,7 @@ void GPURenderer::setup_kernels()
 	{
 		GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL,
 		GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE,
+		GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS,
 	};
 
 	// Some default values are set for USE_SHARED_STACK_BVH_TRAVERSAL and SHARED_STACK_BVH_TRAVERSAL_SIZE
@@ -115,50 +190,126 @@ void GPURenderer::setup_kernels()
 	m_kernels[GPURenderer::CAMERA_RAYS_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
 	m_kernels[GPURenderer::CAMERA_RAYS_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 48);
 
+	m_kernels[GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID));
+	m_kernels[GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID));
+	m_kernels[GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
+
 	m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::PATH_TRACING_KERNEL_ID));
 	m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::PATH_TRACING_KERNEL_ID));
 	m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
 	m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
 	m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 48);
 
+	m_kernels[GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID));
+	m_kernels[GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID));
+	m_kernels[GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
+	m_kernels[GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
+	m_kernels[GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 48);
+
+	m_kernels[GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID));
+	m_kernels[GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID));
+	m_kernels[GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
+
+	m_kernels[GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID));
+	m_kernels[GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID));
+	m_kernels[GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
+
+	m_kernels[GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID));
+	m_kernels[GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID));
+	m_kernels[GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
+
+	m_kernels[GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID));
+	m_kernels[GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID));
+	m_kernels[GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
+
+	m_kernels[GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID));
+	m_kernels[GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID));
+	m_kernels[GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
+
+	m_kernels[GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID].set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID));
+	m_kernels[GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID].set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID));
+	m_kernels[GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID].synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
+
 	m_restir_di_render_pass = ReSTIRDIRenderPass(this);
 	m_restir_di_render_pass.compile(m_hiprt_orochi_ctx, options_excluded_from_synchro, m_func_name_sets);
 
-	// Configuring the kernel that will be used to retrieve the size of the RayVolumeState structure.
-	// This size will be needed to resize the 'ray_volume_states' buffer in the GBuffer if the nested dielectrics
-	// stack size changes
-	//
-	// We're compiling it serially so that we're sure that we can retrieve the RayVolumeState size on the GPU after the
-	// GPURenderer is constructed
-	m_ray_volume_state_byte_size_kernel.set_kernel_file_path(GPURenderer::KERNEL_FILES.at(GPURenderer::RAY_VOLUME_STATE_SIZE_KERNEL_ID));
-	m_ray_volume_state_byte_size_kernel.set_kernel_function_name(GPURenderer::KERNEL_FUNCTION_NAMES.at(GPURenderer::RAY_VOLUME_STATE_SIZE_KERNEL_ID));
-	m_ray_volume_state_byte_size_kernel.synchronize_options_with(*m_global_compiler_options, options_excluded_from_synchro);
-	ThreadManager::start_thread(ThreadManager::COMPILE_RAY_VOLUME_STATE_SIZE_KERNEL_KEY, ThreadFunctions::compile_kernel_silent, std::ref(m_ray_volume_state_byte_size_kernel), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	m_restir_gi_render_pass = ReSTIRGIRenderPass(this);
+	m_restir_gi_render_pass.compile(m_hiprt_orochi_ctx, options_excluded_from_synchro, m_func_name_sets);
+
+	m_path_guiding_render_pass = PathGuidingRenderPass(this);
+	m_path_guiding_render_pass.compile(m_hiprt_orochi_ctx, options_excluded_from_synchro, m_func_name_sets);
+
+	m_radiance_cache_render_pass = RadianceCacheRenderPass(this);
+	m_radiance_cache_render_pass.compile(m_hiprt_orochi_ctx, options_excluded_from_synchro, m_func_name_sets);
+
+	m_visibility_cache_render_pass = VisibilityCacheRenderPass(this);
+	m_visibility_cache_render_pass.compile(m_hiprt_orochi_ctx, options_excluded_from_synchro, m_func_name_sets);
+
+	m_wavefront_path_tracing_render_pass = WavefrontPathTracingRenderPass(this);
+	m_wavefront_path_tracing_render_pass.compile(m_hiprt_orochi_ctx, options_excluded_from_synchro, m_func_name_sets);
+
+	m_render_passes = { &m_restir_di_render_pass, &m_restir_gi_render_pass, &m_path_guiding_render_pass, &m_radiance_cache_render_pass, &m_visibility_cache_render_pass, &m_wavefront_path_tracing_render_pass };
 
 	// Compiling kernels
 	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::CAMERA_RAYS_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
 	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID]), m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
 }
 
 void GPURenderer::update()
 {
-	// Launching the background kernels precompilation if not already launched
-	if (!m_kernel_precompilation_launched)
+	// Needed so that frames can be submitted from a thread other than the main thread
+	OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+	// Before the precompilation so that it precompiles the kernels for the materials of the scene
+	internal_update_material_features();
+
+	// Launching the background kernels precompilation if not already launched.
+	// Headless renderers never change their kernel options so they don't need it
+	if (!m_kernel_precompilation_launched && !m_headless)
 	{
 		precompile_kernels();
 
 		m_kernel_precompilation_launched = true;
 	}
 
+	// Swapping in the kernels compiled in the background for the runtime kernel options, if any
+	swap_runtime_kernel_variants();
+
+	internal_update_geometry_types();
+	internal_update_geometry_lods();
 	m_envmap.update(this);
-	m_restir_di_render_pass.update();
+	for (RenderPass* render_pass : m_render_passes)
+		render_pass->update();
+	if (m_render_graph.compile())
+		// The transient buffers have moved
+		invalidate_render_data_buffers();
 
 	internal_update_clear_device_status_buffers();
+	// Before the temporal passes buffers since the temporal passes are disabled with several views
+	internal_update_views();
 	internal_update_prev_frame_g_buffer();
 	internal_update_adaptive_sampling_buffers();
+	internal_update_active_pixel_list_buffers();
+	internal_update_pixel_costs_buffer();
+	internal_update_bounce_active_ray_counts_buffer();
+	internal_update_ray_statistics_buffer();
+	internal_update_temporal_reprojection_buffer();
+	internal_update_temporal_upscaling_buffers();
+	internal_update_packed_denoiser_AOVs_buffers();
 	internal_update_global_stack_buffer();
+	internal_update_light_clusters();
+	m_render_data.render_settings.launch_over_active_pixels = uses_active_pixel_list();
 
 	update_render_data();
+	internal_update_pending_checkpoint();
 
 	// Resetting this flag as this is a new frame
 	m_render_data.render_settings.do_update_status_buffers = false;
@@ -169,24 +320,107 @@ void GPURenderer::update()
 
 void GPURenderer::copy_status_buffers()
 {
-	OROCHI_CHECK_ERROR(oroMemcpy(&m_status_buffers_values.one_ray_active, m_still_one_ray_active_buffer.get_device_pointer(), sizeof(unsigned char), oroMemcpyDeviceToHost));
-	OROCHI_CHECK_ERROR(oroMemcpy(&m_status_buffers_values.pixel_converged_count, m_pixels_converged_count_buffer.get_device_pointer(), sizeof(unsigned int), oroMemcpyDeviceToHost));
+	while (m_queued_frame_count > 0)
+		pop_queued_frame();
+}
+
+void GPURenderer::pop_queued_frame()
+{
+	QueuedFrame& frame = m_queued_frames[m_first_queued_frame];
+
+	frame.one_ray_active_transfer.wait();
+	frame.pixels_converged_count_transfer.wait();
+
+	m_status_buffers_values.one_ray_active = *frame.one_ray_active_transfer.get_downloaded_data<unsigned char>();
+	m_status_buffers_values.pixel_converged_count = *frame.pixels_converged_count_transfer.get_downloaded_data<unsigned int>();
+
+	frame.bounce_active_ray_counts_transfer.wait();
+	const unsigned int* bounce_active_ray_counts = frame.bounce_active_ray_counts_transfer.get_downloaded_data<unsigned int>();
+	int bounce_count = frame.bounce_active_ray_counts_transfer_count / BOUNCE_PATH_EVENT_COUNT;
+	m_status_buffers_values.bounce_active_ray_counts.resize(bounce_count);
+	m_status_buffers_values.bounce_missed_path_counts.resize(bounce_count);
+	m_status_buffers_values.bounce_absorbed_path_counts.resize(bounce_count);
+	for (int bounce = 0; bounce < bounce_count; bounce++)
+	{
+		// The counters of the bounces are interleaved, see AuxiliaryBuffers::bounce_active_ray_counts
+		m_status_buffers_values.bounce_active_ray_counts[bounce] = bounce_active_ray_counts[bounce * BOUNCE_PATH_EVENT_COUNT + BOUNCE_PATH_ALIVE];
+		m_status_buffers_values.bounce_missed_path_counts[bounce] = bounce_active_ray_counts[bounce * BOUNCE_PATH_EVENT_COUNT + BOUNCE_PATH_MISSED];
+		m_status_buffers_values.bounce_absorbed_path_counts[bounce] = bounce_active_ray_counts[bounce * BOUNCE_PATH_EVENT_COUNT + BOUNCE_PATH_ABSORBED];
+	}
+
+	frame.ray_statistics_transfer.wait();
+	const unsigned int* ray_statistics = frame.ray_statistics_transfer.get_downloaded_data<unsigned int>();
+	if (ray_statistics == nullptr)
+		m_status_buffers_values.ray_statistics.clear();
+	else
+		m_status_buffers_values.ray_statistics.assign(ray_statistics, ray_statistics + RAY_STATISTIC_COUNT);
+
+	// Releasing the staging blocks of the downloads
+	frame = QueuedFrame();
+
+	m_first_queued_frame = (m_first_queued_frame + 1) % GPURenderer::MAX_QUEUED_FRAME_COUNT;
+	m_queued_frame_count--;
 }
 
 void GPURenderer::internal_update_clear_device_status_buffers()
 {
 	unsigned char false_data = false;
 	unsigned int zero_data = 0;
-	// Uploading false to reset the flag
-	m_still_one_ray_active_buffer.upload_data(&false_data);
+	ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_CREATE);
+
+	// Uploading false to reset the flag. Queued on the main stream
+	// so that this doesn't wait for the frame currently being rendered
+	m_still_one_ray_active_buffer.upload_data_async(&false_data, m_main_stream, m_staging_pool);
 	// Resetting the counter of pixels converged to 0
-	m_pixels_converged_count_buffer.upload_data(&zero_data);
+	m_pixels_converged_count_buffer.upload_data_async(&zero_data, m_main_stream, m_staging_pool);
+}
+
+void GPURenderer::internal_update_pending_checkpoint()
+{
+	if (m_pending_checkpoint == nullptr)
+		return;
+
+	const RenderCheckpoint& checkpoint = *m_pending_checkpoint;
+	size_t pixel_count = static_cast<size_t>(m_render_resolution.x) * m_render_resolution.y;
+
+	m_device_framebuffer.upload_data(checkpoint.pixels);
+	// The buffers that aren't in the checkpoint or that aren't allocated for the current
+	// settings keep the content reset() gave them
+	if (checkpoint.pixel_status.size() == pixel_count && m_pixel_status.get_element_count() == pixel_count)
+		m_pixel_status.upload_data(checkpoint.pixel_status);
+	if (checkpoint.pixel_squared_luminance.size() == pixel_count && m_pixels_squared_luminance_buffer.get_element_count() == pixel_count)
+		m_pixels_squared_luminance_buffer.upload_data(checkpoint.pixel_squared_luminance);
+	if (checkpoint.pixel_half_luminance.size() == pixel_count && m_pixels_half_luminance_buffer.get_element_count() == pixel_count)
+		m_pixels_half_luminance_buffer.upload_data(checkpoint.pixel_half_luminance);
+	if (checkpoint.pixel_converged_sample_count.size() == pixel_count && m_device_pixels_converged_sample_count_buffer.get_element_count() == pixel_count)
+		m_device_pixels_converged_sample_count_buffer.upload_data(checkpoint.pixel_converged_sample_count);
+
+	// After update_render_data() of the passes which reset the output of the last frame
+	m_restir_di_render_pass.restore_temporal_reservoirs(checkpoint.restir_di_reservoirs, checkpoint.restir_di_odd_frame);
+	m_restir_gi_render_pass.restore_temporal_reservoirs(checkpoint.restir_gi_reservoirs);
+
+	// update_render_data() drew the seed of this frame from the reset generator,
+	// drawing it again from where the checkpointed render stopped
+	m_rng.m_state.seed = checkpoint.rng_state;
+	m_render_data.random_seed = m_rng.xorshift32();
+
+	m_render_data.render_settings.sample_number = checkpoint.sample_number;
+	// The camera rays kernel mustn't clear the restored buffers
+	m_render_data.render_settings.need_to_reset = false;
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Render resumed from its checkpoint at sample %d", checkpoint.sample_number);
+
+	m_pending_checkpoint = nullptr;
 }
 
 void GPURenderer::internal_clear_m_status_buffers()
 {
 	m_status_buffers_values.one_ray_active = true;
 	m_status_buffers_values.pixel_converged_count = 0;
+	m_status_buffers_values.bounce_active_ray_counts.clear();
+	m_status_buffers_values.bounce_missed_path_counts.clear();
+	m_status_buffers_values.bounce_absorbed_path_counts.clear();
+	m_status_buffers_values.ray_statistics.clear();
 }
 
 void GPURenderer::internal_update_prev_frame_g_buffer()
@@ -199,7 +433,7 @@ void GPURenderer::internal_update_prev_frame_g_buffer()
 
 		if (prev_frame_g_buffer_needs_resize)
 		{
-			m_g_buffer_prev_frame.resize(m_render_resolution.x * m_render_resolution.y, get_ray_volume_state_byte_size());
+			m_g_buffer_prev_frame.resize(GBuffer::get_storage_element_count(m_render_resolution.x, m_render_resolution.y), get_ray_volume_state_byte_size());
 			m_render_data_buffers_invalidated = true;
 		}
 	}
@@ -224,10 +458,11 @@ void GPURenderer::internal_update_adaptive_sampling_buffers()
 	if (buffers_needed)
 	{
 		bool pixels_squared_luminance_needs_resize = m_pixels_squared_luminance_buffer.get_element_count() == 0;
-		bool pixels_sample_count_needs_resize = m_pixels_sample_count_buffer.get_element_count() == 0;
-		bool pixels_converged_sample_count_needs_resize = m_pixels_converged_sample_count_buffer->get_element_count() == 0;
+		// Both the device and the interop buffers are allocated when rendering into the device buffers
+		int pixels_converged_sample_count_element_count = renders_into_device_buffers() ? m_device_pixels_converged_sample_count_buffer.get_element_count() : m_pixels_converged_sample_count_buffer->get_element_count();
+		bool pixels_converged_sample_count_needs_resize = pixels_converged_sample_count_element_count == 0;
 
-		if (pixels_squared_luminance_needs_resize || pixels_sample_count_needs_resize || pixels_converged_sample_count_needs_resize)
+		if (pixels_squared_luminance_needs_resize || pixels_converged_sample_count_needs_resize)
 			// At least on buffer is going to be resized so buffers are invalidated
 			m_render_data_buffers_invalidated = true;
 
@@ -235,43 +470,310 @@ void GPURenderer::internal_update_adaptive_sampling_buffers()
 			// Only allocating if it isn't already
 			m_pixels_squared_luminance_buffer.resize(m_render_resolution.x * m_render_resolution.y);
 
-		if (pixels_sample_count_needs_resize)
-			// Only allocating if it isn't already
-			m_pixels_sample_count_buffer.resize(m_render_resolution.x * m_render_resolution.y);
-
 		if (pixels_converged_sample_count_needs_resize)
-			m_pixels_converged_sample_count_buffer->resize(m_render_resolution.x * m_render_resolution.y);
+		{
+			if (renders_into_device_buffers())
+				m_device_pixels_converged_sample_count_buffer.resize(m_render_resolution.x * m_render_resolution.y);
+			if (!m_headless)
+				m_pixels_converged_sample_count_buffer->resize(m_render_resolution.x * m_render_resolution.y);
+		}
+
+		if (m_render_data.render_settings.adaptive_sampling_tile_based && m_pixels_half_luminance_buffer.get_element_count() == 0)
+		{
+			m_pixels_half_luminance_buffer.resize(m_render_resolution.x * m_render_resolution.y);
+			m_render_data_buffers_invalidated = true;
+		}
+		else if (!m_render_data.render_settings.adaptive_sampling_tile_based && m_pixels_half_luminance_buffer.get_element_count() > 0)
+		{
+			m_pixels_half_luminance_buffer.free();
+			m_render_data_buffers_invalidated = true;
+		}
 
 	}
 	else
 	{
-		if (m_pixels_squared_luminance_buffer.get_element_count() > 0 || m_pixels_sample_count_buffer.get_element_count() > 0 || m_pixels_converged_sample_count_buffer->get_element_count() > 0)
+		int pixels_converged_sample_count_element_count = renders_into_device_buffers() ? m_device_pixels_converged_sample_count_buffer.get_element_count() : m_pixels_converged_sample_count_buffer->get_element_count();
+		if (m_pixels_squared_luminance_buffer.get_element_count() > 0 || pixels_converged_sample_count_element_count > 0)
 			m_render_data_buffers_invalidated = true;
 
 		m_pixels_squared_luminance_buffer.free();
-		m_pixels_sample_count_buffer.free();
-		m_pixels_converged_sample_count_buffer->free();
+		m_pixels_half_luminance_buffer.free();
+		m_device_pixels_converged_sample_count_buffer.free();
+		if (!m_headless)
+			m_pixels_converged_sample_count_buffer->free();
+	}
+}
+
+bool GPURenderer::uses_persistent_threads_path_tracing()
+{
+	return m_render_data.render_settings.use_persistent_threads_path_tracing && !m_render_data.render_settings.use_wavefront_path_tracing;
+}
+
+bool GPURenderer::uses_device_resident_render_data()
+{
+	return m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::USE_DEVICE_RESIDENT_RENDER_DATA) == KERNEL_OPTION_TRUE;
+}
+
+bool GPURenderer::uses_active_pixel_list()
+{
+	return m_render_data.render_settings.compact_active_pixels || uses_persistent_threads_path_tracing();
+}
+
+void GPURenderer::internal_update_active_pixel_list_buffers()
+{
+	if (uses_active_pixel_list())
+	{
+		if (m_active_pixel_indices.get_element_count() == 0)
+		{
+			m_active_pixel_indices.resize(m_render_resolution.x * m_render_resolution.y);
+			m_active_pixel_counters.resize(2);
+
+			m_render_data_buffers_invalidated = true;
+		}
+	}
+	else if (m_active_pixel_indices.get_element_count() > 0)
+	{
+		m_active_pixel_indices.free();
+		m_active_pixel_counters.free();
+
+		m_render_data_buffers_invalidated = true;
+	}
+}
+
+bool GPURenderer::uses_pixel_cost_instrumentation()
+{
+	return !m_headless && m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::PIXEL_COST_INSTRUMENTATION) == KERNEL_OPTION_TRUE;
+}
+
+void GPURenderer::internal_update_pixel_costs_buffer()
+{
+	if (m_headless)
+		return;
+
+	if (uses_pixel_cost_instrumentation())
+	{
+		if (m_pixel_costs_buffer->get_element_count() == 0)
+			// Cleared by the camera rays of the first sample of the render
+			m_pixel_costs_buffer->resize(m_render_resolution.x * m_render_resolution.y);
+	}
+	else if (m_pixel_costs_buffer->get_element_count() > 0)
+		m_pixel_costs_buffer->free();
+}
+
+void GPURenderer::internal_update_bounce_active_ray_counts_buffer()
+{
+	if (m_render_data.render_settings.count_bounce_active_rays && m_render_data.render_settings.nb_bounces > 0)
+	{
+		if (m_bounce_active_ray_counts.get_element_count() != m_render_data.render_settings.nb_bounces * BOUNCE_PATH_EVENT_COUNT)
+		{
+			m_bounce_active_ray_counts.resize(m_render_data.render_settings.nb_bounces * BOUNCE_PATH_EVENT_COUNT);
+
+			m_render_data_buffers_invalidated = true;
+		}
+
+		// The rays of the frame are counted from 0
+		OROCHI_CHECK_ERROR(oroMemsetD32Async(reinterpret_cast<oroDeviceptr>(m_bounce_active_ray_counts.get_device_pointer()), 0, m_bounce_active_ray_counts.get_element_count(), m_main_stream));
+	}
+	else if (m_bounce_active_ray_counts.get_element_count() > 0)
+	{
+		m_bounce_active_ray_counts.free();
+
+		m_render_data_buffers_invalidated = true;
+	}
+}
+
+void GPURenderer::internal_update_ray_statistics_buffer()
+{
+	if (m_render_data.render_settings.count_ray_statistics)
+	{
+		if (m_ray_statistics.get_element_count() == 0)
+		{
+			m_ray_statistics.resize(RAY_STATISTIC_COUNT);
+
+			m_render_data_buffers_invalidated = true;
+		}
+
+		// The statistics are those of the frame
+		OROCHI_CHECK_ERROR(oroMemsetD32Async(reinterpret_cast<oroDeviceptr>(m_ray_statistics.get_device_pointer()), 0, RAY_STATISTIC_COUNT, m_main_stream));
+	}
+	else if (m_ray_statistics.get_element_count() > 0)
+	{
+		m_ray_statistics.free();
+
+		m_render_data_buffers_invalidated = true;
+	}
+}
+
+void GPURenderer::internal_update_temporal_reprojection_buffer()
+{
+	if (m_render_data.render_settings.enable_temporal_reprojection)
+	{
+		if (m_temporal_reprojection_history_buffer.get_element_count() == 0)
+		{
+			m_temporal_reprojection_history_buffer.resize(m_render_resolution.x * m_render_resolution.y);
+			// The previous frame G-buffer may have just been allocated too, nothing to reproject from
+			m_render_data.render_settings.temporal_reprojection_history_sample_count = 0;
+
+			m_render_data_buffers_invalidated = true;
+		}
+	}
+	else if (m_temporal_reprojection_history_buffer.get_element_count() > 0)
+	{
+		m_temporal_reprojection_history_buffer.free();
+
+		m_render_data_buffers_invalidated = true;
+	}
+}
+
+void GPURenderer::internal_update_views()
+{
+	if (m_views.size() < 2)
+	{
+		if (m_views_buffer.get_element_count() > 0)
+			m_views_buffer.free();
+
+		m_render_data.views = nullptr;
+		m_render_data.view_count = 1;
+		m_render_data.view_pixel_count = 0;
+
+		return;
+	}
+
+	HIPRTRenderSettings& render_settings = m_render_data.render_settings;
+	render_settings.restir_di_settings.temporal_pass.do_temporal_reuse_pass = false;
+	render_settings.restir_gi_settings.temporal_pass.do_temporal_reuse_pass = false;
+	render_settings.enable_temporal_reprojection = false;
+	render_settings.use_temporal_upscaling = false;
+
+	int view_count = static_cast<int>(m_views.size());
+	int view_height = std::max(1, m_render_resolution.y / view_count);
+
+	std::vector<HIPRTCamera> hiprt_views(view_count);
+	for (int i = 0; i < view_count; i++)
+	{
+		Camera view = m_views[i];
+		view.set_aspect(static_cast<float>(m_render_resolution.x) / view_height);
+		// The reuse of the primary hits is decided for all the views with the jittering of the main camera
+		view.do_jittering = m_camera.do_jittering;
+
+		hiprt_views[i] = view.to_hiprt();
+	}
+
+	if (m_views_buffer.get_element_count() != static_cast<size_t>(view_count))
+		m_views_buffer.resize(view_count);
+	// Queued after the frames that still read the cameras of the last frame
+	m_views_buffer.upload_data_async(hiprt_views.data(), m_main_stream, m_staging_pool);
+
+	m_render_data.views = m_views_buffer.get_device_pointer();
+	m_render_data.view_count = view_count;
+	m_render_data.view_pixel_count = m_render_resolution.x * view_height;
+}
+
+void GPURenderer::internal_update_temporal_upscaling_buffers()
+{
+	if (m_render_data.render_settings.use_temporal_upscaling && m_render_data.render_settings.allow_render_low_resolution)
+	{
+		if (m_temporal_upscaling_output_buffer.get_element_count() == 0)
+		{
+			m_temporal_upscaling_history_buffer.resize(m_render_resolution.x * m_render_resolution.y);
+			m_temporal_upscaling_output_buffer.resize(m_render_resolution.x * m_render_resolution.y);
+			// Nothing in the history yet
+			m_was_last_frame_upscaled = false;
+
+			m_render_data_buffers_invalidated = true;
+		}
+	}
+	else if (m_temporal_upscaling_output_buffer.get_element_count() > 0)
+	{
+		m_temporal_upscaling_history_buffer.free();
+		m_temporal_upscaling_output_buffer.free();
+
+		m_render_data_buffers_invalidated = true;
+	}
+}
+
+bool GPURenderer::uses_packed_denoiser_AOVs()
+{
+	return m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::PACKED_DENOISER_AOVS) == KERNEL_OPTION_TRUE;
+}
+
+void GPURenderer::internal_update_packed_denoiser_AOVs_buffers()
+{
+	if (uses_packed_denoiser_AOVs())
+	{
+		if (m_packed_albedo_AOV_buffer.get_element_count() == 0)
+		{
+			// Filled by the first sample of the render
+			m_packed_albedo_AOV_buffer.resize(m_render_resolution.x * m_render_resolution.y);
+			m_packed_normals_AOV_buffer.resize(m_render_resolution.x * m_render_resolution.y);
+
+			m_render_data_buffers_invalidated = true;
+		}
+	}
+	else if (m_packed_albedo_AOV_buffer.get_element_count() > 0)
+	{
+		m_packed_albedo_AOV_buffer.free();
+		m_packed_normals_AOV_buffer.free();
+
+		m_render_data_buffers_invalidated = true;
+	}
+}
+
+void GPURenderer::update_temporal_upscaling_jitter()
+{
+	HIPRTRenderSettings& render_settings = m_render_data.render_settings;
+	if (!render_settings.use_temporal_upscaling || !render_settings.do_render_low_resolution() || m_temporal_upscaling_output_buffer.get_element_count() == 0)
+	{
+		render_settings.temporal_upscaling_jitter = make_int2(0, 0);
+
+		return;
 	}
+
+	// Halton (2, 3) sequence so that all the pixels of the blocks are rendered
+	// after a few frames without a regular sweep pattern
+	auto radical_inverse = [](unsigned int index, unsigned int base)
+	{
+		float inverse_base = 1.0f / base;
+		float result = 0.0f;
+		for (float factor = inverse_base; index > 0; index /= base, factor *= inverse_base)
+			result += (index % base) * factor;
+
+		return result;
+	};
+
+	m_temporal_upscaling_jitter_index++;
+	int scaling = render_settings.render_low_resolution_scaling;
+	render_settings.temporal_upscaling_jitter.x = std::min(scaling - 1, static_cast<int>(radical_inverse(m_temporal_upscaling_jitter_index, 2) * scaling));
+	render_settings.temporal_upscaling_jitter.y = std::min(scaling - 1, static_cast<int>(radical_inverse(m_temporal_upscaling_jitter_index, 3) * scaling));
+	// The history is only usable if it was upscaled from the same downscale, it may change between frames
+	// with the dynamic resolution scaling
+	render_settings.temporal_upscaling_history_valid = m_was_last_frame_upscaled && m_last_frame_low_resolution_scaling == scaling;
 }
 
 void GPURenderer::internal_update_global_stack_buffer()
 {
 	if (needs_global_bvh_stack_buffer())
 	{
+		unsigned int stack_count = get_global_stack_buffer_stack_count();
+		bool dynamic_stack = uses_dynamic_bvh_traversal_stack();
+
 		bool buffer_needs_update = false;
 		// Buffer isn't allocated
 		buffer_needs_update |= m_render_data.global_traversal_stack_buffer.stackData == nullptr;
 		// Buffer is allocated but the stack size has been changed (through ImGui probably)
 		buffer_needs_update |= m_render_data.global_traversal_stack_buffer_size != m_render_data.global_traversal_stack_buffer.stackSize;
+		// The render resolution changed (only matters for non-dynamic stacks) or the type of stack was switched
+		buffer_needs_update |= stack_count != m_render_data.global_traversal_stack_buffer.stackCount;
+		buffer_needs_update |= dynamic_stack != m_global_stack_buffer_dynamic;
 		if (buffer_needs_update)
 		{
 			// Creating the global stack buffer for BVH traversal if it doesn't exist already
 			hiprtGlobalStackBufferInput stackBufferInput
 			{
-				hiprtStackTypeGlobal,
+				dynamic_stack ? hiprtStackTypeDynamic : hiprtStackTypeGlobal,
 				hiprtStackEntryTypeInteger,
 				static_cast<uint32_t>(m_render_data.global_traversal_stack_buffer_size),
-				static_cast<uint32_t>(std::ceil(m_render_resolution.x / 8.0f) * 8 * 8 * std::ceil(m_render_resolution.y / 8.0f))
+				stack_count
 			};
 
 			if (m_render_data.global_traversal_stack_buffer.stackData != nullptr)
@@ -279,6 +781,9 @@ void GPURenderer::internal_update_global_stack_buffer()
 				HIPRT_CHECK_ERROR(hiprtDestroyGlobalStackBuffer(m_hiprt_orochi_ctx->hiprt_ctx, m_render_data.global_traversal_stack_buffer));
 
 			HIPRT_CHECK_ERROR(hiprtCreateGlobalStackBuffer(m_hiprt_orochi_ctx->hiprt_ctx, stackBufferInput, m_render_data.global_traversal_stack_buffer));
+			m_global_stack_buffer_dynamic = dynamic_stack;
+
+			m_render_data_buffers_invalidated = true;
 		}
 	}
 	else
@@ -292,6 +797,20 @@ void GPURenderer::internal_update_global_stack_buffer()
 	}
 }
 
+bool GPURenderer::uses_dynamic_bvh_traversal_stack()
+{
+	return m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::DYNAMIC_BVH_TRAVERSAL_STACK) == KERNEL_OPTION_TRUE;
+}
+
+unsigned int GPURenderer::get_global_stack_buffer_stack_count()
+{
+	if (uses_dynamic_bvh_traversal_stack())
+		// The stacks are only used by the threads in flight
+		return static_cast<unsigned int>(m_device_properties.multiProcessorCount * m_device_properties.maxThreadsPerMultiProcessor);
+
+	return static_cast<unsigned int>(std::ceil(m_render_resolution.x / 8.0f) * 8 * 8 * std::ceil(m_render_resolution.y / 8.0f));
+}
+
 bool GPURenderer::needs_global_bvh_stack_buffer()
 {
 	for (const auto& name_to_kernel : m_kernels)
@@ -308,6 +827,11 @@ bool GPURenderer::needs_global_bvh_stack_buffer()
 
 void GPURenderer::render()
 {
+	TraceZone trace_zone("Frame submission");
+
+	// Needed so that frames can be submitted from a thread other than the main thread
+	OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
 	// Making sure kernels are compiled
 	ThreadManager::join_threads(ThreadManager::COMPILE_KERNELS_THREAD_KEY);
 
@@ -319,24 +843,72 @@ void GPURenderer::render()
 	nb_groups.y = std::ceil(m_render_resolution.y / (float)tile_size_y);
 
 	map_buffers_for_render();
+	update_temporal_upscaling_jitter();
 	
 	oroEventRecord(m_frame_start_event, m_main_stream);
 
+	// The uploads of the device resident render data are queued on the stream, they wouldn't be part of the graph
+	bool use_sample_graph = m_render_data.render_settings.use_sample_graph && !uses_device_resident_render_data();
+	if (!use_sample_graph)
+		m_sample_graph.invalidate();
+
 	for (int i = 1; i <= m_render_data.render_settings.samples_per_frame; i++)
 	{
 		// Updating the previous and current camera
      	m_render_data.current_camera = m_camera.to_hiprt();
 		m_render_data.prev_camera = m_previous_frame_camera.to_hiprt();
 
+		if (m_render_data.render_settings.use_prev_frame_g_buffer(this))
+		{
+			// The GBuffer of the last sample becomes the previous frame GBuffer and the
+			// old previous frame GBuffer is filled by the camera rays of this sample.
+			// This avoids copying the whole GBuffer every sample
+			std::swap(m_g_buffer, m_g_buffer_prev_frame);
+			std::swap(m_render_data.g_buffer, m_render_data.g_buffer_prev_frame);
+		}
+
 		if (i == m_render_data.render_settings.samples_per_frame)
 			// Last sample of the frame so we are going to enable the update 
 			// of the status buffers (number of pixels converged, how many rays still
 			// active, ...)
 			m_render_data.render_settings.do_update_status_buffers = true;
 
+		if (use_sample_graph)
+			// The kernels launched by the samples can only change between frames (when the settings change),
+			// the first sample of the frame is launched directly and checks that the graph is still up to date
+			m_sample_graph.begin(/* first of batch */ i == 1);
+
+		// The lights presampling doesn't depend on the camera rays, running them at the same time
+		m_stream_scheduler.begin_async(m_main_stream, uses_multiple_streams() && !use_sample_graph);
+		launch_light_presampling();
+		m_stream_scheduler.end_async();
+
 		launch_camera_rays();
 		launch_ReSTIR_DI();
 		launch_path_tracing();
+		launch_ReSTIR_GI();
+		launch_adaptive_sampling_tile_error();
+
+		if (use_sample_graph)
+			m_sample_graph.end(m_main_stream);
+		// Only launched on the first sample after a reset so it isn't part of the graph. Launched
+		// on the same stream, it still runs after the kernels of the sample
+		launch_temporal_reprojection();
+		// Not launched every sample without jittering so not part of the graph either
+		launch_denoiser_AOVs_resolve();
+		if (i == m_render_data.render_settings.samples_per_frame)
+		{
+			// The path guiding and radiance cache updates are only read by
+			// the next frame, they overlap with the end of this frame
+			m_stream_scheduler.begin_async(m_main_stream, uses_multiple_streams());
+			launch_path_guiding_build();
+			launch_radiance_cache_resolve();
+			m_stream_scheduler.end_async();
+
+			launch_temporal_upscaling();
+			launch_unpack_denoiser_AOVs();
+			m_stream_scheduler.join(m_main_stream);
+		}
 
 		m_render_data.render_settings.sample_number++;
 		m_render_data.render_settings.denoiser_AOV_accumulation_counter++;
@@ -353,107 +925,352 @@ void GPURenderer::render()
 		m_previous_frame_camera = m_camera;
 	}
 
+	// Downloading the status buffers behind the frame so that reading
+	// them after the frame doesn't need a synchronous copy
+	if (m_queued_frame_count == GPURenderer::MAX_QUEUED_FRAME_COUNT)
+		// No room left in the queue for this frame
+		pop_queued_frame();
+
+	QueuedFrame& queued_frame = m_queued_frames[(m_first_queued_frame + m_queued_frame_count) % GPURenderer::MAX_QUEUED_FRAME_COUNT];
+	queued_frame.one_ray_active_transfer = m_still_one_ray_active_buffer.download_data_async(m_main_stream, m_staging_pool);
+	queued_frame.pixels_converged_count_transfer = m_pixels_converged_count_buffer.download_data_async(m_main_stream, m_staging_pool);
+	if (m_bounce_active_ray_counts.get_element_count() > 0)
+	{
+		queued_frame.bounce_active_ray_counts_transfer = m_bounce_active_ray_counts.download_data_async(m_main_stream, m_staging_pool);
+		queued_frame.bounce_active_ray_counts_transfer_count = m_bounce_active_ray_counts.get_element_count();
+	}
+	if (m_ray_statistics.get_element_count() > 0)
+		queued_frame.ray_statistics_transfer = m_ray_statistics.download_data_async(m_main_stream, m_staging_pool);
+	m_queued_frame_count++;
+
 	// Recording GPU frame time stop timestamp and computing the frame time
 	oroEventRecord(m_frame_stop_event, m_main_stream);
 
+	// Reading back the tiles sampled by this frame and uploading the
+	// tiles streamed in since the last frame for the next frame
+	m_virtual_texture_streamer.update(m_main_stream);
+
 	m_was_last_frame_low_resolution = m_render_data.render_settings.do_render_low_resolution();
+	m_last_frame_low_resolution_scaling = m_render_data.render_settings.render_low_resolution_scaling;
+	m_was_last_frame_upscaled = m_was_last_frame_low_resolution && m_render_data.render_settings.use_temporal_upscaling && m_temporal_upscaling_output_buffer.get_element_count() > 0;
 }
 
 void GPURenderer::launch_camera_rays()
 {
-	void* launch_args[] = { &m_render_data, &m_render_resolution };
+	// The camera rays start every sample
+	m_launch_timestamps.begin_frame();
 
 	m_render_data.random_seed = m_rng.xorshift32();
-	m_kernels[GPURenderer::CAMERA_RAYS_KERNEL_ID].launch_timed_asynchronous(8, 8, m_render_resolution.x, m_render_resolution.y, launch_args, m_main_stream);
+
+	GPUKernel* camera_rays_kernel = &m_kernels[GPURenderer::CAMERA_RAYS_KERNEL_ID];
+	if (m_restir_di_render_pass.uses_fused_camera_rays())
+	{
+		// The initial candidates of ReSTIR DI are sampled by the camera rays, they read the presampled lights
+		m_stream_scheduler.join(m_main_stream);
+
+		m_restir_di_render_pass.configure_fused_camera_rays_pass();
+		camera_rays_kernel = &m_restir_di_render_pass.m_kernels[ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID];
+	}
+
+	// Only the low resolution pixels when rendering at low resolution
+	int2 launch_resolution = m_render_data.render_settings.get_pixel_launch_resolution(m_render_resolution);
+
+	// The time of the compaction of the active pixels is included in the time of the camera rays
+	m_launch_timestamps.record_start(GPURenderer::CAMERA_RAYS_KERNEL_ID, m_main_stream);
+	if (m_render_data.render_settings.launch_over_active_pixels)
+	{
+		// Emptying the active pixel list before the compaction fills it
+		OrochiKernelGraph::memset_d32_async_current(reinterpret_cast<oroDeviceptr>(m_active_pixel_counters.get_device_pointer()), 0, 2, m_main_stream);
+		m_kernels[GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID].launch(8, 8, launch_resolution.x, launch_resolution.y, get_render_data_launch_args(m_kernels[GPURenderer::ACTIVE_PIXEL_COMPACTION_KERNEL_ID]), m_main_stream);
+
+		// The number of active pixels is only known on the GPU so launching one thread
+		// per pixel, the threads past the end of the list exit right away
+		camera_rays_kernel->launch(64, 1, m_render_resolution.x * m_render_resolution.y, 1, get_render_data_launch_args(*camera_rays_kernel), m_main_stream);
+	}
+	else
+		camera_rays_kernel->launch(8, 8, launch_resolution.x, launch_resolution.y, get_render_data_launch_args(*camera_rays_kernel), m_main_stream);
+	m_launch_timestamps.record_stop(GPURenderer::CAMERA_RAYS_KERNEL_ID, m_main_stream);
 }
 
-void GPURenderer::launch_ReSTIR_DI()
+void GPURenderer::launch_light_presampling()
 {
-	if (m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) == LSS_RESTIR_DI)
-		m_restir_di_render_pass.launch();
+	m_restir_di_render_pass.launch_light_presampling();
 }
 
-void GPURenderer::launch_path_tracing()
+void GPURenderer::launch_ReSTIR_DI()
 {
-	void* launch_args[] = { &m_render_data, &m_render_resolution };
+	// The presampled lights are read by the initial candidates and by the path tracer
+	m_stream_scheduler.join(m_main_stream);
 
-	m_render_data.random_seed = m_rng.xorshift32();
-	m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID].launch_timed_asynchronous(8, 8, m_render_resolution.x, m_render_resolution.y, launch_args, m_main_stream);
+	if (m_restir_di_render_pass.is_enabled())
+		m_restir_di_render_pass.launch();
 }
 
-void GPURenderer::synchronize_kernel()
+void GPURenderer::launch_ReSTIR_GI()
 {
-	ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_CREATE);
-	OROCHI_CHECK_ERROR(oroStreamSynchronize(m_main_stream));
+	// Not enabled with the wavefront path tracer: only the
+	// megakernel path tracer outputs the initial candidates of ReSTIR GI
+	if (m_restir_gi_render_pass.is_enabled())
+		m_restir_gi_render_pass.launch();
 }
 
-bool GPURenderer::frame_render_done()
+void GPURenderer::launch_path_guiding_build()
 {
-	return oroStreamQuery(m_main_stream) == oroSuccess;
+	if (m_path_guiding_render_pass.is_enabled())
+		m_path_guiding_render_pass.launch();
 }
 
-bool GPURenderer::was_last_frame_low_resolution()
+void GPURenderer::launch_radiance_cache_resolve()
 {
-	return m_was_last_frame_low_resolution;
+	if (m_radiance_cache_render_pass.is_enabled())
+		m_radiance_cache_render_pass.launch();
 }
 
-void GPURenderer::resize(int new_width, int new_height, bool also_resize_interop)
+void GPURenderer::launch_denoiser_AOVs_resolve()
 {
-	// Needed so that this function can eventually be called from another thread
-	OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+	if (m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::DENOISER_AOVS_FROM_G_BUFFER) == KERNEL_OPTION_FALSE)
+		return;
 
-	m_render_resolution = make_int2(new_width, new_height);
+	// Without jittering, the camera rays hit the same points for all the samples
+	// so the AOVs of the first sample are already converged
+	if (!m_render_data.current_camera.do_jittering && m_render_data.render_settings.sample_number > 0)
+		return;
 
-	synchronize_kernel();
-	unmap_buffers();
+	m_launch_timestamps.record_start(GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID, m_main_stream);
+	m_kernels[GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID].launch(8, 8, m_render_resolution.x, m_render_resolution.y, get_render_data_launch_args(m_kernels[GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID]), m_main_stream);
+	m_launch_timestamps.record_stop(GPURenderer::DENOISER_AOVS_RESOLVE_KERNEL_ID, m_main_stream);
+}
 
-	if (also_resize_interop)
-		resize_interop_buffers(new_width, new_height);
+void GPURenderer::launch_unpack_denoiser_AOVs()
+{
+	if (m_packed_albedo_AOV_buffer.get_element_count() == 0)
+		return;
 
-	m_g_buffer.resize(new_width * new_height, get_ray_volume_state_byte_size());
+	m_launch_timestamps.record_start(GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID, m_main_stream);
+	m_kernels[GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID].launch(8, 8, m_render_resolution.x, m_render_resolution.y, get_render_data_launch_args(m_kernels[GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID]), m_main_stream);
+	m_launch_timestamps.record_stop(GPURenderer::UNPACK_DENOISER_AOVS_KERNEL_ID, m_main_stream);
+}
 
-	if (m_render_data.render_settings.use_prev_frame_g_buffer(this))
-		m_g_buffer_prev_frame.resize(new_width * new_height, get_ray_volume_state_byte_size());
+void GPURenderer::launch_adaptive_sampling_tile_error()
+{
+	const HIPRTRenderSettings& render_settings = m_render_data.render_settings;
+	if (!render_settings.enable_adaptive_sampling || !render_settings.adaptive_sampling_tile_based || render_settings.do_render_low_resolution())
+		return;
+
+	m_launch_timestamps.record_start(GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID, m_main_stream);
+	// One block per tile
+	m_kernels[GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID].launch(ADAPTIVE_SAMPLING_TILE_SIZE, ADAPTIVE_SAMPLING_TILE_SIZE, m_render_resolution.x, m_render_resolution.y, get_render_data_launch_args(m_kernels[GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID]), m_main_stream);
+	m_launch_timestamps.record_stop(GPURenderer::ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID, m_main_stream);
+}
 
-	if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers())
-	{
-		m_pixels_squared_luminance_buffer.resize(new_width * new_height);
-		m_pixels_sample_count_buffer.resize(new_width * new_height);
-	}
+void GPURenderer::launch_temporal_reprojection()
+{
+	const HIPRTRenderSettings& render_settings = m_render_data.render_settings;
+	if (!render_settings.enable_temporal_reprojection || render_settings.sample_number != 0 || render_settings.temporal_reprojection_history_sample_count == 0)
+		return;
 
-	if (m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) == LSS_RESTIR_DI)
-		m_restir_di_render_pass.resize(new_width, new_height);
+	m_launch_timestamps.record_start(GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID, m_main_stream);
+	m_kernels[GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID].launch(8, 8, m_render_resolution.x, m_render_resolution.y, get_render_data_launch_args(m_kernels[GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID]), m_main_stream);
+	m_launch_timestamps.record_stop(GPURenderer::TEMPORAL_REPROJECTION_KERNEL_ID, m_main_stream);
+}
 
-	m_pixel_active.resize(new_width * new_height);
+void GPURenderer::launch_temporal_upscaling()
+{
+	const HIPRTRenderSettings& render_settings = m_render_data.render_settings;
+	if (!render_settings.use_temporal_upscaling || !render_settings.do_render_low_resolution() || m_temporal_upscaling_output_buffer.get_element_count() == 0)
+		return;
+
+	// The history is the output of the last upscaled frame, which isn't
+	// necessarily the previous sample if there are several samples per frame
+	m_render_data.prev_camera = m_temporal_upscaling_history_camera.to_hiprt();
+
+	m_launch_timestamps.record_start(GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID, m_main_stream);
+	m_kernels[GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID].launch(8, 8, m_render_resolution.x, m_render_resolution.y, get_render_data_launch_args(m_kernels[GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID]), m_main_stream);
+	m_kernels[GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID].launch(8, 8, m_render_resolution.x, m_render_resolution.y, get_render_data_launch_args(m_kernels[GPURenderer::TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID]), m_main_stream);
+	m_launch_timestamps.record_stop(GPURenderer::TEMPORAL_UPSCALING_KERNEL_ID, m_main_stream);
+
+	// The output of this frame is the history of the next one
+	m_temporal_upscaling_history_camera = m_camera;
+	std::swap(m_temporal_upscaling_history_buffer, m_temporal_upscaling_output_buffer);
+	std::swap(m_render_data.aux_buffers.temporal_upscaling_history, m_render_data.aux_buffers.temporal_upscaling_output);
+}
 
-	// Recomputing the perspective projection matrix since the aspect ratio
-	// may have changed
-	float new_aspect = (float)new_width / new_height;
-	m_camera.set_aspect(new_aspect);
+void GPURenderer::launch_path_tracing()
+{
+	if (m_render_data.render_settings.use_wavefront_path_tracing)
+	{
+		m_wavefront_path_tracing_render_pass.launch();
 
-	if (needs_global_bvh_stack_buffer())
+		return;
+	}
+
+	m_render_data.random_seed = m_rng.xorshift32();
+	m_launch_timestamps.record_start(GPURenderer::PATH_TRACING_KERNEL_ID, m_main_stream);
+	if (uses_persistent_threads_path_tracing())
+	{
+		GPUKernel& persistent_kernel = m_kernels[GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID];
+
+		// One row of threads, launched in blocks of the size that the kernel is compiled for
+		int block_size = persistent_kernel.get_kernel_options().get_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE);
+		persistent_kernel.launch(block_size, 1, get_persistent_threads_count(), 1, get_render_data_launch_args(persistent_kernel), m_main_stream);
+	}
+	else
 	{
-		// Resizing the global stack buffer for BVH traversal
-		hiprtGlobalStackBufferInput stackBufferInput
+		GPUKernel& path_tracing_kernel = m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID];
+		void** launch_args = get_render_data_launch_args(path_tracing_kernel);
+
+		if (m_render_data.render_settings.launch_over_active_pixels)
+			path_tracing_kernel.launch(64, 1, m_render_resolution.x * m_render_resolution.y, 1, launch_args, m_main_stream);
+		else
 		{
-			hiprtStackTypeGlobal,
-			hiprtStackEntryTypeInteger,
-			static_cast<uint32_t>(m_render_data.global_traversal_stack_buffer_size),
-			static_cast<uint32_t>(std::ceil(m_render_resolution.x / 8.0f) * 8 * 8 * std::ceil(m_render_resolution.y / 8.0f))
-		};
+			// Only the low resolution pixels, in the top left corner, when rendering at low resolution
+			int2 launch_resolution = m_render_data.render_settings.get_pixel_launch_resolution(m_render_resolution);
+			path_tracing_kernel.launch(8, 8, launch_resolution.x, launch_resolution.y, launch_args, m_main_stream);
+		}
+	}
+	m_launch_timestamps.record_stop(GPURenderer::PATH_TRACING_KERNEL_ID, m_main_stream);
+}
 
-		if (m_render_data.global_traversal_stack_buffer.stackData != nullptr)
-			// Freeing if the buffer already exists
-			HIPRT_CHECK_ERROR(hiprtDestroyGlobalStackBuffer(m_hiprt_orochi_ctx->hiprt_ctx, m_render_data.global_traversal_stack_buffer));
+int GPURenderer::get_persistent_threads_count()
+{
+	GPUKernel& kernel = m_kernels[GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID];
+	int block_size = kernel.get_kernel_options().get_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE);
+
+	if (kernel.get_kernel_function() != m_persistent_threads_occupancy_function)
+	{
+		// The kernel was recompiled, its occupancy may have changed
+		int active_blocks_per_multiprocessor = 0;
+		OROCHI_CHECK_ERROR(oroModuleOccupancyMaxActiveBlocksPerMultiprocessor(&active_blocks_per_multiprocessor, kernel.get_kernel_function(), block_size, 0));
+
+		m_persistent_threads_block_count = std::max(1, active_blocks_per_multiprocessor) * m_device_properties.multiProcessorCount;
+		m_persistent_threads_occupancy_function = kernel.get_kernel_function();
+	}
+
+	// Not launching more threads than there are pixels: the traversal stack buffer
+	// only has enough stacks for one thread per pixel
+	int pixel_count = m_render_resolution.x * m_render_resolution.y;
+	int pixel_block_count = (pixel_count + block_size - 1) / block_size;
+
+	return std::min(m_persistent_threads_block_count, pixel_block_count) * block_size;
+}
+
+void GPURenderer::synchronize_kernel()
+{
+	ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_CREATE);
+	OROCHI_CHECK_ERROR(oroStreamSynchronize(m_main_stream));
+}
+
+bool GPURenderer::frame_render_done()
+{
+	return oroStreamQuery(m_main_stream) == oroSuccess;
+}
+
+int GPURenderer::get_queued_frame_count()
+{
+	// The downloads of the status buffers are the last work of their frame on the main stream
+	while (m_queued_frame_count > 0 && m_queued_frames[m_first_queued_frame].one_ray_active_transfer.is_done()
+		&& m_queued_frames[m_first_queued_frame].pixels_converged_count_transfer.is_done()
+		&& m_queued_frames[m_first_queued_frame].bounce_active_ray_counts_transfer.is_done()
+		&& m_queued_frames[m_first_queued_frame].ray_statistics_transfer.is_done())
+		pop_queued_frame();
+
+	return m_queued_frame_count;
+}
+
+bool GPURenderer::was_last_frame_low_resolution()
+{
+	return m_was_last_frame_low_resolution;
+}
+
+bool GPURenderer::was_last_frame_upscaled()
+{
+	return m_was_last_frame_upscaled;
+}
+
+int GPURenderer::get_last_frame_low_resolution_scaling()
+{
+	return m_last_frame_low_resolution_scaling;
+}
+
+void GPURenderer::resize(int new_width, int new_height, bool also_resize_interop)
+{
+	// Needed so that this function can eventually be called from another thread
+	OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+	m_render_resolution = make_int2(new_width, new_height);
+
+	synchronize_kernel();
+	unmap_buffers();
+
+	if (also_resize_interop)
+		resize_interop_buffers(new_width, new_height);
+
+	m_g_buffer.resize(GBuffer::get_storage_element_count(new_width, new_height), get_ray_volume_state_byte_size());
+
+	if (m_render_data.render_settings.use_prev_frame_g_buffer(this))
+		m_g_buffer_prev_frame.resize(GBuffer::get_storage_element_count(new_width, new_height), get_ray_volume_state_byte_size());
 
-		HIPRT_CHECK_ERROR(hiprtCreateGlobalStackBuffer(m_hiprt_orochi_ctx->hiprt_ctx, stackBufferInput, m_render_data.global_traversal_stack_buffer));
+	if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers())
+	{
+		m_pixels_squared_luminance_buffer.resize(new_width * new_height);
+		if (m_render_data.render_settings.adaptive_sampling_tile_based)
+			m_pixels_half_luminance_buffer.resize(new_width * new_height);
+	}
+
+	if (m_temporal_reprojection_history_buffer.get_element_count() > 0)
+		m_temporal_reprojection_history_buffer.resize(new_width * new_height);
+	if (m_temporal_upscaling_output_buffer.get_element_count() > 0)
+	{
+		m_temporal_upscaling_history_buffer.resize(new_width * new_height);
+		m_temporal_upscaling_output_buffer.resize(new_width * new_height);
+	}
+	m_was_last_frame_upscaled = false;
+	// The framebuffer of the last render was at the old resolution
+	m_render_data.render_settings.temporal_reprojection_history_sample_count = 0;
+	m_temporal_reprojection_history_valid = false;
+
+	// The buffers of the disabled passes are freed, they will be
+	// allocated at the right size by update() when the pass is enabled
+	for (RenderPass* render_pass : m_render_passes)
+		if (render_pass->is_enabled())
+			render_pass->resize(new_width, new_height);
+	m_render_graph.compile();
+
+	m_pixel_status.resize(new_width * new_height);
+	if (m_packed_albedo_AOV_buffer.get_element_count() > 0)
+	{
+		m_packed_albedo_AOV_buffer.resize(new_width * new_height);
+		m_packed_normals_AOV_buffer.resize(new_width * new_height);
 	}
+	if (m_active_pixel_indices.get_element_count() > 0)
+		m_active_pixel_indices.resize(new_width * new_height);
+
+	// Recomputing the perspective projection matrix since the aspect ratio
+	// may have changed
+	float new_aspect = (float)new_width / new_height;
+	m_camera.set_aspect(new_aspect);
+
+	// Resizing the global stack buffer for BVH traversal (nothing to do for dynamic stacks)
+	internal_update_global_stack_buffer();
 
 	m_render_data_buffers_invalidated = true;
 }
 
 void GPURenderer::resize_interop_buffers(int new_width, int new_height)
 {
+	if (renders_into_device_buffers())
+	{
+		m_device_framebuffer.resize(new_width * new_height);
+		m_device_normals_AOV_buffer.resize(new_width * new_height);
+		m_device_albedo_AOV_buffer.resize(new_width * new_height);
+
+		if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers())
+			m_device_pixels_converged_sample_count_buffer.resize(new_width * new_height);
+
+		if (m_headless)
+			return;
+	}
+
 	m_framebuffer->resize(new_width * new_height);
 	m_denoised_framebuffer->resize(new_width * new_height);
 	m_normals_AOV_buffer->resize(new_width * new_height);
@@ -461,23 +1278,127 @@ void GPURenderer::resize_interop_buffers(int new_width, int new_height)
 
 	if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers())
 		m_pixels_converged_sample_count_buffer->resize(new_width * new_height);
+
+	if (m_pixel_costs_buffer->get_element_count() > 0)
+		m_pixel_costs_buffer->resize(new_width * new_height);
+}
+
+void GPURenderer::set_use_device_render_buffers(bool use_device_render_buffers)
+{
+	m_device_render_buffers_requested = use_device_render_buffers;
+}
+
+bool GPURenderer::get_use_device_render_buffers() const
+{
+	return m_device_render_buffers_requested;
+}
+
+bool GPURenderer::renders_into_device_buffers() const
+{
+	return m_headless || m_device_render_buffers_used;
+}
+
+void GPURenderer::internal_update_device_render_buffers()
+{
+	if (m_headless || m_device_render_buffers_requested == m_device_render_buffers_used)
+		return;
+
+	m_device_render_buffers_used = m_device_render_buffers_requested;
+	if (m_device_render_buffers_used)
+	{
+		int pixel_count = m_render_resolution.x * m_render_resolution.y;
+
+		m_device_framebuffer.resize(pixel_count);
+		m_device_normals_AOV_buffer.resize(pixel_count);
+		m_device_albedo_AOV_buffer.resize(pixel_count);
+		if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers())
+			m_device_pixels_converged_sample_count_buffer.resize(pixel_count);
+	}
+	else
+	{
+		m_device_framebuffer.free();
+		m_device_normals_AOV_buffer.free();
+		m_device_albedo_AOV_buffer.free();
+		m_device_pixels_converged_sample_count_buffer.free();
+	}
+
+	m_render_data_buffers_invalidated = true;
+}
+
+/**
+ * Copies the render buffer 'source' into the OpenGL buffer 'destination', on 'stream'.
+ * The OpenGL buffer is left mapped
+ */
+template <typename T>
+static void copy_device_buffer_to_interop(OrochiBuffer<T>& source, std::shared_ptr<OpenGLInteropBuffer<T>> destination, oroStream_t stream)
+{
+	if (source.get_element_count() == 0)
+		return;
+
+	OROCHI_CHECK_ERROR(oroMemcpyAsync(destination->map_no_error(), source.get_device_pointer(), sizeof(T) * source.get_element_count(), oroMemcpyDeviceToDevice, stream));
+}
+
+void GPURenderer::internal_copy_device_render_buffers_to_interop()
+{
+	if (!m_device_render_buffers_used || m_device_render_buffers_copied)
+		// Either rendering straight into the interop buffers or the last
+		// frames have already been copied
+		return;
+
+	copy_device_buffer_to_interop(m_device_framebuffer, m_framebuffer, m_main_stream);
+	copy_device_buffer_to_interop(m_device_normals_AOV_buffer, m_normals_AOV_buffer, m_main_stream);
+	copy_device_buffer_to_interop(m_device_albedo_AOV_buffer, m_albedo_AOV_buffer, m_main_stream);
+	if (m_pixels_converged_sample_count_buffer->get_element_count() > 0)
+		copy_device_buffer_to_interop(m_device_pixels_converged_sample_count_buffer, m_pixels_converged_sample_count_buffer, m_main_stream);
+
+	m_device_render_buffers_copied = true;
 }
 
 void GPURenderer::map_buffers_for_render()
 {
+	// Switching between the interop buffers and the device render buffers here
+	// since the interop buffers are unmapped at this point
+	internal_update_device_render_buffers();
+
+	if (renders_into_device_buffers())
+	{
+		// The copy to the interop buffers, if any, happens on the next unmap_buffers()
+		m_device_render_buffers_copied = false;
+
+		m_render_data.buffers.pixels = m_device_framebuffer.get_device_pointer();
+		m_render_data.aux_buffers.denoiser_normals = m_device_normals_AOV_buffer.get_device_pointer();
+		m_render_data.aux_buffers.denoiser_albedo = m_device_albedo_AOV_buffer.get_device_pointer();
+		if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers())
+			m_render_data.aux_buffers.pixel_converged_sample_count = m_device_pixels_converged_sample_count_buffer.get_device_pointer();
+		if (!m_headless)
+			// The pixel costs are only a debug view, they are still written to their interop buffer directly
+			m_render_data.aux_buffers.pixel_costs = m_pixel_costs_buffer->get_element_count() > 0 ? m_pixel_costs_buffer->map_no_error() : nullptr;
+
+		return;
+	}
+
 	m_render_data.buffers.pixels = m_framebuffer->map_no_error();
 	m_render_data.aux_buffers.denoiser_normals = m_normals_AOV_buffer->map_no_error();
 	m_render_data.aux_buffers.denoiser_albedo = m_albedo_AOV_buffer->map_no_error();
 	if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers())
 		m_render_data.aux_buffers.pixel_converged_sample_count = m_pixels_converged_sample_count_buffer->map_no_error();
+	m_render_data.aux_buffers.pixel_costs = m_pixel_costs_buffer->get_element_count() > 0 ? m_pixel_costs_buffer->map_no_error() : nullptr;
 }
 
 void GPURenderer::unmap_buffers()
 {
+	if (m_headless)
+		// Nothing is shared with OpenGL
+		return;
+
+	// The frames rendered since the last unmap are about to be read by OpenGL
+	internal_copy_device_render_buffers_to_interop();
+
 	m_framebuffer->unmap();
 	m_normals_AOV_buffer->unmap();
 	m_albedo_AOV_buffer->unmap();
 	m_pixels_converged_sample_count_buffer->unmap();
+	m_pixel_costs_buffer->unmap();
 }
 
 
@@ -506,6 +1427,186 @@ std::shared_ptr<OpenGLInteropBuffer<int>>& GPURenderer::get_pixels_converged_sam
 	return m_pixels_converged_sample_count_buffer;
 }
 
+std::shared_ptr<OpenGLInteropBuffer<float4>> GPURenderer::get_pixel_costs_buffer()
+{
+	return m_pixel_costs_buffer;
+}
+
+Image32Bit GPURenderer::download_framebuffer()
+{
+	if (!m_headless)
+		return Image32Bit();
+
+	synchronize_kernel();
+
+	std::vector<ColorRGB32F> pixels = m_device_framebuffer.download_data();
+	int sample_number = hippt::max(1, m_render_data.render_settings.sample_number);
+
+	Image32Bit image(m_render_resolution.x, m_render_resolution.y, 3);
+	for (int i = 0; i < m_render_resolution.x * m_render_resolution.y; i++)
+	{
+		// The framebuffer holds the sum of the samples
+		ColorRGB32F pixel = pixels[i] / static_cast<float>(sample_number);
+
+		image[i * 3 + 0] = pixel.r;
+		image[i * 3 + 1] = pixel.g;
+		image[i * 3 + 2] = pixel.b;
+	}
+
+	return image;
+}
+
+std::vector<int> GPURenderer::download_pixel_sample_counts()
+{
+	if (!m_headless)
+		return std::vector<int>();
+
+	synchronize_kernel();
+
+	int pixel_count = m_render_resolution.x * m_render_resolution.y;
+	std::vector<int> sample_counts(pixel_count, m_render_data.render_settings.sample_number);
+	if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers() && m_pixel_status.get_element_count() == pixel_count)
+	{
+		// Same as the sample count layer of the RenderLayersDownload
+		std::vector<PixelStatus> pixel_statuses = m_pixel_status.download_data();
+		for (int i = 0; i < pixel_count; i++)
+			sample_counts[i] = pixel_statuses[i].get_sample_count();
+	}
+
+	return sample_counts;
+}
+
+ColorRGB32F* GPURenderer::get_device_framebuffer()
+{
+	if (!renders_into_device_buffers())
+		return nullptr;
+
+	return m_device_framebuffer.get_device_pointer();
+}
+
+float3* GPURenderer::get_device_normals_AOV_buffer()
+{
+	if (!renders_into_device_buffers())
+		return nullptr;
+
+	return m_device_normals_AOV_buffer.get_device_pointer();
+}
+
+ColorRGB32F* GPURenderer::get_device_albedo_AOV_buffer()
+{
+	if (!renders_into_device_buffers())
+		return nullptr;
+
+	return m_device_albedo_AOV_buffer.get_device_pointer();
+}
+
+RenderLayersDownload GPURenderer::download_render_layers_async(bool include_denoised)
+{
+	RenderLayersDownload download;
+	download.width = m_render_resolution.x;
+	download.height = m_render_resolution.y;
+	download.sample_number = m_render_data.render_settings.sample_number;
+
+	size_t pixel_count = static_cast<size_t>(m_render_resolution.x) * m_render_resolution.y;
+	if (renders_into_device_buffers())
+	{
+		download.beauty = m_device_framebuffer.download_data_async(m_main_stream, m_staging_pool);
+		download.albedo = m_device_albedo_AOV_buffer.download_data_async(m_main_stream, m_staging_pool);
+		download.normals = m_device_normals_AOV_buffer.download_data_async(m_main_stream, m_staging_pool);
+	}
+	else
+	{
+		// Left mapped, as they are after render()
+		download.beauty = m_staging_pool.download_async(m_framebuffer->map_no_error(), sizeof(ColorRGB32F) * pixel_count, m_main_stream);
+		download.albedo = m_staging_pool.download_async(m_albedo_AOV_buffer->map_no_error(), sizeof(ColorRGB32F) * pixel_count, m_main_stream);
+		download.normals = m_staging_pool.download_async(m_normals_AOV_buffer->map_no_error(), sizeof(float3) * pixel_count, m_main_stream);
+	}
+
+	if (include_denoised && !m_headless)
+	{
+		download.has_denoised = true;
+		download.denoised = m_staging_pool.download_async(m_denoised_framebuffer->map_no_error(), sizeof(ColorRGB32F) * pixel_count, m_main_stream);
+		// The denoiser expects it unmapped when it publishes a new frame
+		m_denoised_framebuffer->unmap();
+	}
+
+	if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers() && m_pixel_status.get_element_count() == pixel_count)
+	{
+		// The sample counts are extracted from the pixel statuses by the RenderLayersDownload
+		download.has_sample_count = true;
+		download.sample_count = m_pixel_status.download_data_async(m_main_stream, m_staging_pool);
+	}
+
+	return download;
+}
+
+RenderCheckpointDownload GPURenderer::download_checkpoint_async()
+{
+	RenderCheckpointDownload download;
+	if (!m_headless)
+		return download;
+
+	download.width = m_render_resolution.x;
+	download.height = m_render_resolution.y;
+	download.sample_number = m_render_data.render_settings.sample_number;
+	download.rng_state = m_rng.m_state.seed;
+	download.restir_di_odd_frame = m_restir_di_render_pass.is_odd_frame();
+
+	size_t pixel_count = static_cast<size_t>(m_render_resolution.x) * m_render_resolution.y;
+	download.pixel_count = pixel_count;
+	download.pixels = m_device_framebuffer.download_data_async(m_main_stream, m_staging_pool);
+
+	// Only the buffers allocated for the current settings
+	if (m_pixel_status.get_element_count() == pixel_count)
+	{
+		download.pixel_status_count = pixel_count;
+		download.pixel_status = m_pixel_status.download_data_async(m_main_stream, m_staging_pool);
+	}
+	if (m_pixels_squared_luminance_buffer.get_element_count() == pixel_count)
+	{
+		download.pixel_squared_luminance_count = pixel_count;
+		download.pixel_squared_luminance = m_pixels_squared_luminance_buffer.download_data_async(m_main_stream, m_staging_pool);
+	}
+	if (m_pixels_half_luminance_buffer.get_element_count() == pixel_count)
+	{
+		download.pixel_half_luminance_count = pixel_count;
+		download.pixel_half_luminance = m_pixels_half_luminance_buffer.download_data_async(m_main_stream, m_staging_pool);
+	}
+	if (m_device_pixels_converged_sample_count_buffer.get_element_count() == pixel_count)
+	{
+		download.pixel_converged_sample_count_count = pixel_count;
+		download.pixel_converged_sample_count = m_device_pixels_converged_sample_count_buffer.download_data_async(m_main_stream, m_staging_pool);
+	}
+
+	download.restir_di_reservoir_count = m_restir_di_render_pass.download_temporal_reservoirs_async(m_main_stream, m_staging_pool, download.restir_di_reservoirs);
+	download.restir_gi_reservoir_count = m_restir_gi_render_pass.download_temporal_reservoirs_async(m_main_stream, m_staging_pool, download.restir_gi_reservoirs);
+
+	return download;
+}
+
+bool GPURenderer::load_checkpoint(const RenderCheckpoint& checkpoint)
+{
+	if (!m_headless || checkpoint.width != m_render_resolution.x || checkpoint.height != m_render_resolution.y)
+		return false;
+
+	if (checkpoint.pixels.size() != static_cast<size_t>(m_render_resolution.x) * m_render_resolution.y)
+		return false;
+
+	m_pending_checkpoint = std::make_unique<RenderCheckpoint>(checkpoint);
+
+	return true;
+}
+
+const std::vector<hiprtFuncNameSet>& GPURenderer::get_func_name_sets() const
+{
+	return m_func_name_sets;
+}
+
+bool GPURenderer::is_headless() const
+{
+	return m_headless;
+}
+
 const StatusBuffersValues& GPURenderer::get_status_buffer_values() const
 {
 	return m_status_buffers_values;
@@ -526,6 +1627,41 @@ HIPRTRenderData& GPURenderer::get_render_data()
 	return m_render_data;
 }
 
+void** GPURenderer::get_render_data_launch_args(const GPUKernel& kernel)
+{
+	if (kernel.get_kernel_options().get_macro_value(GPUKernelCompilerOptions::USE_DEVICE_RESIDENT_RENDER_DATA) == KERNEL_OPTION_FALSE)
+	{
+		m_render_data_launch_args[0] = &m_render_data;
+		m_render_data_launch_args[1] = &m_render_resolution;
+
+		return m_render_data_launch_args;
+	}
+
+	// The per-sample fields are passed as arguments, they don't make the render data change
+	HIPRTRenderData stable_render_data;
+	std::memcpy(&stable_render_data, &m_render_data, sizeof(HIPRTRenderData));
+	set_per_sample_data(stable_render_data, HIPRTPerSampleData());
+
+	if (m_device_render_data.get_element_count() == 0 || std::memcmp(&stable_render_data, &m_uploaded_render_data, sizeof(HIPRTRenderData)) != 0)
+	{
+		if (m_device_render_data.get_element_count() == 0)
+			m_device_render_data.resize(1);
+
+		// Queued on the main stream after the kernels that read the previous render data
+		m_device_render_data.upload_data_async(&stable_render_data, m_main_stream, m_staging_pool);
+		std::memcpy(&m_uploaded_render_data, &stable_render_data, sizeof(HIPRTRenderData));
+	}
+
+	m_device_render_data_pointer = m_device_render_data.get_device_pointer();
+	m_per_sample_data = get_per_sample_data(m_render_data);
+
+	m_render_data_launch_args[0] = &m_device_render_data_pointer;
+	m_render_data_launch_args[1] = &m_per_sample_data;
+	m_render_data_launch_args[2] = &m_render_resolution;
+
+	return m_render_data_launch_args;
+}
+
 HIPRTScene& GPURenderer::get_hiprt_scene()
 {
 	return m_hiprt_scene;
@@ -601,11 +1737,16 @@ std::shared_ptr<GPUKernelCompilerOptions> GPURenderer::get_global_compiler_optio
 extern bool g_main_thread_compiling;
 extern std::condition_variable g_condition_for_compilation;
 
+extern KernelOptionsUsageHistory g_kernel_options_usage_history;
+
 void GPURenderer::recompile_kernels(bool use_cache)
 {
 	synchronize_kernel();
 
 	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Recompiling kernels...");
+	// The user switched to these options, the background precompilation
+	// of the next launches will prioritize them
+	g_kernel_options_usage_history.record(*m_global_compiler_options);
 
 	// Notifying all threads that may be compiling that the main thread wants to
 	// compile. This will block threads other than the main thread from compiling
@@ -613,58 +1754,395 @@ void GPURenderer::recompile_kernels(bool use_cache)
 	g_main_thread_compiling = true;
 	g_condition_for_compilation.notify_all();
 
+	// Only the kernels that use the options that changed are recompiled. Everything
+	// is recompiled without the cache, the kernel files may have been modified
 	for (auto& name_to_kenel : m_kernels)
-		name_to_kenel.second.compile_silent(m_hiprt_orochi_ctx, m_func_name_sets, use_cache);
-	m_restir_di_render_pass.recompile(m_hiprt_orochi_ctx, m_func_name_sets, true, use_cache);
-	m_ray_volume_state_byte_size_kernel.compile_silent(m_hiprt_orochi_ctx, m_func_name_sets, use_cache);
+		if (!use_cache || name_to_kenel.second.needs_recompilation())
+			name_to_kenel.second.compile_silent(m_hiprt_orochi_ctx, m_func_name_sets, use_cache);
+	for (RenderPass* render_pass : m_render_passes)
+		render_pass->recompile(m_hiprt_orochi_ctx, m_func_name_sets, true, use_cache);
 
 	// The main thread is done with the compilation, we can release the other threads
 	// so that they can continue compiling (background compilation of shaders most likely)
 	g_main_thread_compiling = false;
 	g_condition_for_compilation.notify_all();
+
+	// All the kernels are specialized for the new options, the variants that
+	// were compiled (or are being compiled) for the previous options are outdated
+	m_runtime_branches_generation++;
+	m_specialized_generation++;
+	m_runtime_branches_kernel_functions.clear();
+	m_kernels_on_runtime_branches.clear();
+	if (m_runtime_kernel_options_enabled)
+		compile_runtime_kernel_variants(/* runtime branches */ true);
 }
 
-void GPURenderer::precompile_kernels()
+void GPURenderer::set_runtime_kernel_option(const std::string& option_macro_name, int value)
 {
-	g_imgui_logger.add_line_with_name(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, ImGuiLogger::BACKGROUND_KERNEL_PARSING_LINE_NAME, "Parsing kernels in the background... [%d / %d]", 0, 1);
-	g_imgui_logger.add_line_with_name(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, ImGuiLogger::BACKGROUND_KERNEL_COMPILATION_LINE_NAME, "Pre-compiling kernels in the background... [%d / %d]", 0, 1);
+	m_global_compiler_options->set_macro_value(option_macro_name, value);
 
-	// Launching all the threads actually takes some time
-	// so we're launching threads from a thread :D
-	// 
-	// We're not going to join the thread started right below
-	// so we can use a const char* for the key, we don't a constant
-	// defined in ThreadManager. Quick and dirty.
-	ThreadManager::start_thread("GPURendererPrecompileKernelsKey", [this]() {
-		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+	if (!m_runtime_kernel_options_enabled)
+	{
+		recompile_kernels();
 
-		precompile_direct_light_sampling_kernels();
-		precompile_ReSTIR_DI_kernels();
-	});
+		return;
+	}
 
-	ThreadManager::detach_threads("GPURendererPrecompileKernelsKey");
-}
+	std::map<std::string, GPUKernel*> kernels = get_kernels();
+	for (auto& id_to_kernel : kernels)
+	{
+		if (!id_to_kernel.second->uses_macro(option_macro_name))
+			continue;
 
-extern bool g_background_shader_compilation_enabled;
-void GPURenderer::stop_background_shader_compilation()
-{
-	g_background_shader_compilation_enabled = false;
-	g_condition_for_compilation.notify_all();
-}
+		if (m_runtime_branches_kernel_functions.find(id_to_kernel.first) == m_runtime_branches_kernel_functions.end())
+		{
+			// The runtime branches of that kernel are still being compiled, we have to wait for the compilation
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "The kernels with the runtime options are not compiled yet.");
+			recompile_kernels();
 
-void GPURenderer::resume_background_shader_compilation()
-{
-	g_background_shader_compilation_enabled = true;
-	g_condition_for_compilation.notify_all();
-}
+			return;
+		}
+	}
 
-void GPURenderer::precompile_direct_light_sampling_kernels()
-{
-	for (int init_target_function_vis = 0; init_target_function_vis <= 1; init_target_function_vis++)
+	// The option is read from the render settings by the runtime branches so no compilation here
+	for (auto& id_to_kernel : kernels)
 	{
-		for (int use_envmap_mis = 0; use_envmap_mis <= 1; use_envmap_mis++)
-		{
-			for (int envmap_sampling_strategy = ESS_NO_SAMPLING; envmap_sampling_strategy < ESS_ALIAS_TABLE; envmap_sampling_strategy++)
+		if (!id_to_kernel.second->uses_macro(option_macro_name))
+			continue;
+
+		id_to_kernel.second->set_kernel_function(m_runtime_branches_kernel_functions[id_to_kernel.first]);
+		m_kernels_on_runtime_branches.insert(id_to_kernel.first);
+	}
+
+	// The user switched to these options, the kernels specialized for them are going to be
+	// compiled so the background precompilation of the next launches can prioritize them
+	g_kernel_options_usage_history.record(*m_global_compiler_options);
+
+	m_specialized_generation++;
+	compile_runtime_kernel_variants(/* runtime branches */ false);
+}
+
+void GPURenderer::set_runtime_kernel_options_enabled(bool enabled)
+{
+	if (m_runtime_kernel_options_enabled == enabled)
+		return;
+
+	m_runtime_kernel_options_enabled = enabled;
+	if (enabled)
+	{
+		m_runtime_branches_generation++;
+		compile_runtime_kernel_variants(/* runtime branches */ true);
+	}
+	else
+	{
+		// Discarding the variants being compiled
+		m_runtime_branches_generation++;
+		m_runtime_branches_kernel_functions.clear();
+
+		if (!m_kernels_on_runtime_branches.empty())
+			// Some kernels are still waiting for their specialized version, compiling it now
+			recompile_kernels();
+	}
+}
+
+bool GPURenderer::get_runtime_kernel_options_enabled() const
+{
+	return m_runtime_kernel_options_enabled;
+}
+
+bool GPURenderer::uses_runtime_kernel_option(const GPUKernel& kernel) const
+{
+	for (const std::string& option_macro_name : GPURenderer::RUNTIME_KERNEL_OPTIONS)
+		if (kernel.uses_macro(option_macro_name))
+			return true;
+
+	return false;
+}
+
+void GPURenderer::compile_runtime_kernel_variants(bool runtime_branches)
+{
+	int generation = runtime_branches ? m_runtime_branches_generation : m_specialized_generation;
+
+	// Compiling copies of the kernels (with their own copy of the options) so that the background
+	// thread doesn't read the kernels or the options while the main thread modifies them
+	std::shared_ptr<std::map<std::string, GPUKernel>> kernel_copies = std::make_shared<std::map<std::string, GPUKernel>>();
+	GPUKernelCompilerOptions default_options;
+	for (auto& id_to_kernel : get_kernels())
+	{
+		const GPUKernel& kernel = *id_to_kernel.second;
+
+		if (runtime_branches && !uses_runtime_kernel_option(kernel))
+			continue;
+		else if (!runtime_branches && m_kernels_on_runtime_branches.find(id_to_kernel.first) == m_kernels_on_runtime_branches.end())
+			continue;
+
+		GPUKernel& kernel_copy = (*kernel_copies)[id_to_kernel.first] = kernel;
+		if (runtime_branches)
+		{
+			kernel_copy.get_kernel_options().set_macro_value(GPUKernelCompilerOptions::KERNEL_OPTIONS_RUNTIME_BRANCHES, KERNEL_OPTION_TRUE);
+			// The runtime branches don't depend on the values of the macros of the runtime options, always
+			// compiling with the same values so that the binaries are reused from the shader cache
+			for (const std::string& option_macro_name : GPURenderer::RUNTIME_KERNEL_OPTIONS)
+				kernel_copy.get_kernel_options().set_macro_value(option_macro_name, default_options.get_macro_value(option_macro_name));
+		}
+	}
+
+	if (kernel_copies->empty())
+		return;
+
+	// Not joined, the variants are swapped in by swap_runtime_kernel_variants() whenever they're ready
+	ThreadManager::start_thread(ThreadManager::RENDERER_RUNTIME_KERNEL_VARIANTS, [this, kernel_copies, runtime_branches, generation]() {
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+		RuntimeKernelVariants variants;
+		variants.runtime_branches = runtime_branches;
+		variants.generation = generation;
+		for (auto& id_to_kernel : *kernel_copies)
+		{
+			id_to_kernel.second.compile_silent(m_hiprt_orochi_ctx, m_func_name_sets);
+			variants.kernel_functions[id_to_kernel.first] = id_to_kernel.second.get_kernel_function();
+		}
+
+		std::lock_guard<std::mutex> lock(m_compiled_runtime_kernel_variants_mutex);
+		m_compiled_runtime_kernel_variants.push_back(variants);
+	});
+
+	ThreadManager::detach_threads(ThreadManager::RENDERER_RUNTIME_KERNEL_VARIANTS);
+}
+
+void GPURenderer::swap_runtime_kernel_variants()
+{
+	std::lock_guard<std::mutex> lock(m_compiled_runtime_kernel_variants_mutex);
+	if (m_compiled_runtime_kernel_variants.empty())
+		return;
+
+	std::map<std::string, GPUKernel*> kernels = get_kernels();
+	for (RuntimeKernelVariants& variants : m_compiled_runtime_kernel_variants)
+	{
+		if (variants.runtime_branches)
+		{
+			if (variants.generation == m_runtime_branches_generation)
+				m_runtime_branches_kernel_functions = variants.kernel_functions;
+		}
+		else if (variants.generation == m_specialized_generation)
+		{
+			// The specialized kernels give the same image as the runtime branches, only faster,
+			// swapping them in without resetting the render
+			for (auto& id_to_function : variants.kernel_functions)
+			{
+				kernels[id_to_function.first]->set_kernel_function(id_to_function.second);
+				m_kernels_on_runtime_branches.erase(id_to_function.first);
+			}
+
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Specialized kernels swapped in.");
+		}
+	}
+
+	m_compiled_runtime_kernel_variants.clear();
+}
+
+void GPURenderer::set_kernel_hot_reload_enabled(bool enabled)
+{
+	if (enabled && !m_kernel_hot_reload_enabled)
+	{
+		// Only the modifications made from now on are reloaded
+		m_kernel_sources_last_write_time = get_kernel_sources_last_write_time();
+		m_kernel_hot_reload_last_poll = std::chrono::steady_clock::now();
+	}
+
+	m_kernel_hot_reload_enabled = enabled;
+}
+
+bool GPURenderer::get_kernel_hot_reload_enabled() const
+{
+	return m_kernel_hot_reload_enabled;
+}
+
+std::filesystem::file_time_type GPURenderer::get_kernel_sources_last_write_time()
+{
+	std::filesystem::file_time_type last_write_time = std::filesystem::file_time_type::min();
+
+	std::error_code error_code;
+	for (const char* directory : { DEVICE_KERNELS_DIRECTORY, DEVICE_INCLUDES_DIRECTORY })
+	{
+		for (std::filesystem::recursive_directory_iterator it(directory, error_code), end; !error_code && it != end; it.increment(error_code))
+		{
+			if (!it->is_regular_file(error_code) || it->path().extension() != ".h")
+				continue;
+
+			std::filesystem::file_time_type file_write_time = it->last_write_time(error_code);
+			if (!error_code)
+				last_write_time = std::max(last_write_time, file_write_time);
+		}
+	}
+
+	return last_write_time;
+}
+
+bool GPURenderer::update_kernel_hot_reload()
+{
+	bool kernels_swapped = false;
+
+	std::shared_ptr<std::map<std::string, GPUKernel>> hot_reloaded_kernels;
+	{
+		std::lock_guard<std::mutex> lock(m_hot_reloaded_kernels_mutex);
+
+		hot_reloaded_kernels.swap(m_hot_reloaded_kernels);
+	}
+
+	if (hot_reloaded_kernels != nullptr)
+	{
+		// The frame in flight may still be using the previous versions of the kernels
+		synchronize_kernel();
+
+		std::map<std::string, GPUKernel*> kernels = get_kernels();
+		int swapped_count = 0;
+		for (auto& id_to_kernel : *hot_reloaded_kernels)
+		{
+			if (!kernels[id_to_kernel.first]->take_compiled_function(id_to_kernel.second))
+				// Failed to compile or recompiled by the main thread for new options in the meantime
+				continue;
+
+			// The functions compiled for the runtime options are with the previous sources
+			m_kernels_on_runtime_branches.erase(id_to_kernel.first);
+			m_runtime_branches_kernel_functions.erase(id_to_kernel.first);
+			swapped_count++;
+		}
+
+		if (swapped_count > 0)
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%d hot reloaded kernel(s) swapped in.", swapped_count);
+		if (swapped_count < hot_reloaded_kernels->size())
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "%d hot reloaded kernel(s) couldn't be swapped in, the previous version keeps rendering.", static_cast<int>(hot_reloaded_kernels->size()) - swapped_count);
+
+		kernels_swapped = swapped_count > 0;
+	}
+
+	if (!m_kernel_hot_reload_enabled || m_kernel_hot_reload_compiling)
+		return kernels_swapped;
+
+	auto now = std::chrono::steady_clock::now();
+	if (std::chrono::duration_cast<std::chrono::milliseconds>(now - m_kernel_hot_reload_last_poll).count() < GPURenderer::KERNEL_HOT_RELOAD_POLL_INTERVAL_MS)
+		return kernels_swapped;
+	m_kernel_hot_reload_last_poll = now;
+
+	std::filesystem::file_time_type last_write_time = get_kernel_sources_last_write_time();
+	if (last_write_time == m_kernel_sources_last_write_time)
+		return kernels_swapped;
+	m_kernel_sources_last_write_time = last_write_time;
+
+	// Copies of the kernels whose dependencies were modified, compiled in the background
+	// the same way as the runtime kernel variants
+	std::shared_ptr<std::map<std::string, GPUKernel>> kernel_copies = std::make_shared<std::map<std::string, GPUKernel>>();
+	for (auto& id_to_kernel : get_kernels())
+		if (id_to_kernel.second->needs_recompilation())
+			(*kernel_copies)[id_to_kernel.first] = *id_to_kernel.second;
+
+	if (kernel_copies->empty())
+		return kernels_swapped;
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Kernel sources modified, hot reloading %zu kernel(s)...", kernel_copies->size());
+
+	m_kernel_hot_reload_compiling = true;
+	ThreadManager::start_thread(ThreadManager::RENDERER_KERNEL_HOT_RELOAD, [this, kernel_copies]() {
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+		for (auto& id_to_kernel : *kernel_copies)
+		{
+			// The modified sources may not use the same option macros anymore
+			id_to_kernel.second.parse_option_macros_used();
+			id_to_kernel.second.compile_silent(m_hiprt_orochi_ctx, m_func_name_sets);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_hot_reloaded_kernels_mutex);
+
+			m_hot_reloaded_kernels = kernel_copies;
+		}
+		m_kernel_hot_reload_compiling = false;
+	});
+
+	ThreadManager::detach_threads(ThreadManager::RENDERER_KERNEL_HOT_RELOAD);
+
+	return kernels_swapped;
+}
+
+extern KernelCompileFarm g_kernel_compile_farm;
+extern bool g_background_shader_compilation_cancel_unused;
+void GPURenderer::precompile_kernels()
+{
+	g_imgui_logger.add_line_with_name(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, ImGuiLogger::BACKGROUND_KERNEL_PARSING_LINE_NAME, "Parsing kernels in the background... [%d / %d]", 0, 1);
+	g_imgui_logger.add_line_with_name(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, ImGuiLogger::BACKGROUND_KERNEL_COMPILATION_LINE_NAME, "Pre-compiling kernels in the background... [%d / %d]", 0, 1);
+
+	// Nobody waits for the precompilation, it only runs on the workers
+	// of the task pool that the interactive tasks leave free
+	ThreadManager::set_priority(ThreadManager::RENDERER_PRECOMPILE_KERNELS, TASK_PRIORITY_BACKGROUND);
+	ThreadManager::start_thread(ThreadManager::RENDERER_PRECOMPILE_KERNELS, [this]() {
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+		std::vector<GPUKernelCompilerOptions> combinations;
+		get_direct_light_sampling_precompilation_options(combinations);
+		get_ReSTIR_DI_precompilation_options(combinations);
+
+		// Precompiling the combinations that the user switched to the most often first.
+		// The kernels are compiled one after the other on this thread (the compilations are
+		// serialized by the GPUKernelCompiler anyways) so that this order is respected
+		std::vector<std::pair<std::pair<int, int>, size_t>> scores_and_indices;
+		for (size_t i = 0; i < combinations.size(); i++)
+			scores_and_indices.push_back(std::make_pair(g_kernel_options_usage_history.get_usage_score(combinations[i]), i));
+		std::stable_sort(scores_and_indices.begin(), scores_and_indices.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+		for (auto& score_and_index : scores_and_indices)
+		{
+			if (g_background_shader_compilation_cancel_unused && score_and_index.first.first == 0)
+				// The remaining combinations were never used, the user doesn't want them
+				// to be precompiled (see cancel_unused_background_shader_compilation())
+				break;
+
+			GPUKernelCompilerOptions& partial_options = combinations[score_and_index.second];
+			precompile_kernel(GPURenderer::CAMERA_RAYS_KERNEL_ID, partial_options);
+			precompile_kernel(GPURenderer::PATH_TRACING_KERNEL_ID, partial_options);
+			precompile_kernel(GPURenderer::PATH_TRACING_PERSISTENT_KERNEL_ID, partial_options);
+			m_restir_di_render_pass.precompile_kernels(partial_options, m_hiprt_orochi_ctx, m_func_name_sets);
+		}
+
+		if (g_kernel_compile_farm.is_enabled())
+			// The kernels have only been queued in the farm, compiling them now.
+			// This blocks this thread until all the workers are done
+			if (!g_kernel_compile_farm.run(m_hiprt_orochi_ctx->device_index))
+				g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Some kernels couldn't be precompiled in the background. They will be compiled when needed.");
+	});
+
+	ThreadManager::detach_threads(ThreadManager::RENDERER_PRECOMPILE_KERNELS);
+}
+
+extern bool g_background_shader_compilation_enabled;
+void GPURenderer::stop_background_shader_compilation()
+{
+	g_background_shader_compilation_enabled = false;
+	g_condition_for_compilation.notify_all();
+}
+
+void GPURenderer::resume_background_shader_compilation()
+{
+	g_background_shader_compilation_enabled = true;
+	g_condition_for_compilation.notify_all();
+}
+
+void GPURenderer::cancel_unused_background_shader_compilation()
+{
+	g_background_shader_compilation_cancel_unused = true;
+	// Waking up the precompilation so that it stops at the first unused combination
+	// even if it was stopped with stop_background_shader_compilation()
+	resume_background_shader_compilation();
+}
+
+void GPURenderer::get_direct_light_sampling_precompilation_options(std::vector<GPUKernelCompilerOptions>& combinations)
+{
+	for (int init_target_function_vis = 0; init_target_function_vis <= 1; init_target_function_vis++)
+	{
+		for (int use_envmap_mis = 0; use_envmap_mis <= 1; use_envmap_mis++)
+		{
+			for (int envmap_sampling_strategy = ESS_NO_SAMPLING; envmap_sampling_strategy < ESS_ALIAS_TABLE; envmap_sampling_strategy++)
 			{
 				for (int direct_light_sampling_strategy = LSS_NO_DIRECT_LIGHT_SAMPLING; direct_light_sampling_strategy <= LSS_RESTIR_DI - 1; direct_light_sampling_strategy++)
 				{
@@ -678,9 +2156,7 @@ void GPURenderer::precompile_direct_light_sampling_kernels()
 					partials_options.set_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY, envmap_sampling_strategy);
 					partials_options.set_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_DO_BSDF_MIS, use_envmap_mis);
 
-					precompile_kernel(GPURenderer::CAMERA_RAYS_KERNEL_ID, partials_options);
-					precompile_kernel(GPURenderer::PATH_TRACING_KERNEL_ID, partials_options);
-					m_restir_di_render_pass.precompile_kernels(partials_options, m_hiprt_orochi_ctx, m_func_name_sets);
+					combinations.push_back(partials_options);
 
 					if (direct_light_sampling_strategy == LSS_RIS_BSDF_AND_LIGHT)
 					{
@@ -688,9 +2164,7 @@ void GPURenderer::precompile_direct_light_sampling_kernels()
 						// for the value we haven't compiled yet
 						partials_options.set_macro_value(GPUKernelCompilerOptions::RIS_USE_VISIBILITY_TARGET_FUNCTION, 1 - m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::RIS_USE_VISIBILITY_TARGET_FUNCTION));
 
-						precompile_kernel(GPURenderer::CAMERA_RAYS_KERNEL_ID, partials_options);
-						precompile_kernel(GPURenderer::PATH_TRACING_KERNEL_ID, partials_options);
-						m_restir_di_render_pass.precompile_kernels(partials_options, m_hiprt_orochi_ctx, m_func_name_sets);
+						combinations.push_back(partials_options);
 					}
 				}
 			}
@@ -698,7 +2172,7 @@ void GPURenderer::precompile_direct_light_sampling_kernels()
 	}
 }
 
-void GPURenderer::precompile_ReSTIR_DI_kernels()
+void GPURenderer::get_ReSTIR_DI_precompilation_options(std::vector<GPUKernelCompilerOptions>& combinations)
 {
 	for (int init_target_function_vis = 0; init_target_function_vis <= 1; init_target_function_vis++)
 	{
@@ -726,9 +2200,7 @@ void GPURenderer::precompile_ReSTIR_DI_kernels()
 							partials_options.set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING, do_light_presampling);
 							partials_options.set_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY, LSS_RESTIR_DI);
 
-							precompile_kernel(GPURenderer::CAMERA_RAYS_KERNEL_ID, partials_options);
-							precompile_kernel(GPURenderer::PATH_TRACING_KERNEL_ID, partials_options);
-							m_restir_di_render_pass.precompile_kernels(partials_options, m_hiprt_orochi_ctx, m_func_name_sets);
+							combinations.push_back(partials_options);
 						}
 					}
 				}
@@ -742,12 +2214,16 @@ void GPURenderer::precompile_kernel(const std::string& id, GPUKernelCompilerOpti
 	GPUKernelCompilerOptions options = m_kernels[id].get_kernel_options();
 	partial_options.apply_onto(options);
 
-	ThreadManager::start_thread(ThreadManager::RENDERER_PRECOMPILE_KERNELS, ThreadFunctions::precompile_kernel,
-		GPURenderer::KERNEL_FUNCTION_NAMES.at(id),
-		GPURenderer::KERNEL_FILES.at(id),
-		options, m_hiprt_orochi_ctx, std::ref(m_func_name_sets));
+	if (g_kernel_compile_farm.is_enabled())
+	{
+		// Compiled by the worker processes of the farm at the end of precompile_kernels()
+		g_kernel_compile_farm.add_job(GPURenderer::KERNEL_FILES.at(id), GPURenderer::KERNEL_FUNCTION_NAMES.at(id), options);
 
-	ThreadManager::detach_threads(ThreadManager::RENDERER_PRECOMPILE_KERNELS);
+		return;
+	}
+
+	// On the calling thread so that the kernels are compiled in the order of precompile_kernels()
+	ThreadFunctions::precompile_kernel(GPURenderer::KERNEL_FUNCTION_NAMES.at(id), GPURenderer::KERNEL_FILES.at(id), options, m_hiprt_orochi_ctx, m_func_name_sets);
 }
 
 std::map<std::string, GPUKernel*> GPURenderer::get_kernels()
@@ -757,8 +2233,9 @@ std::map<std::string, GPUKernel*> GPURenderer::get_kernels()
 	for (auto& pair : m_kernels)
 		kernels[pair.first] = &pair.second;
 
-	for (auto& pair : m_restir_di_render_pass.m_kernels)
-		kernels[pair.first] = &pair.second;
+	for (RenderPass* render_pass : m_render_passes)
+		for (auto& pair : render_pass->m_kernels)
+			kernels[pair.first] = &pair.second;
 
 	return kernels;
 }
@@ -768,11 +2245,28 @@ oroStream_t GPURenderer::get_main_stream()
 	return m_main_stream;
 }
 
+oroStream_t GPURenderer::get_pass_stream()
+{
+	return m_stream_scheduler.get_stream(m_main_stream);
+}
+
+bool GPURenderer::uses_multiple_streams()
+{
+	// The device resident render data is uploaded on the main stream while
+	// the kernels of the secondary stream could still be reading it
+	return m_render_data.render_settings.use_multiple_streams && !uses_device_resident_render_data();
+}
+
 void GPURenderer::compute_render_pass_times()
 {
-	m_render_pass_times[GPURenderer::CAMERA_RAYS_KERNEL_ID] = m_kernels[GPURenderer::CAMERA_RAYS_KERNEL_ID].get_last_execution_time();
-	m_restir_di_render_pass.compute_render_times(m_render_pass_times);
-	m_render_pass_times[GPURenderer::PATH_TRACING_KERNEL_ID] = m_kernels[GPURenderer::PATH_TRACING_KERNEL_ID].get_last_execution_time();
+	// Never waits for the GPU: the times are those of the last frame that completed,
+	// the previous times are kept if no new frame completed since the last call
+	m_new_launch_times_resolved = m_launch_timestamps.resolve(m_render_pass_times);
+	for (RenderPass* render_pass : m_render_passes)
+		render_pass->compute_render_times(m_render_pass_times);
+	if (m_render_data.render_settings.use_wavefront_path_tracing)
+		// The megakernel isn't launched when using the wavefront path tracer
+		m_render_pass_times[GPURenderer::PATH_TRACING_KERNEL_ID] = 0.0f;
 
 	// The total frame time is the sum of every passes
 	float sum = 0.0f;
@@ -798,10 +2292,27 @@ float GPURenderer::get_last_frame_time()
 
 void GPURenderer::update_perf_metrics(std::shared_ptr<PerformanceMetricsComputer> perf_metrics)
 {
-	// Also adding the times of the various passes
-	perf_metrics->add_value(GPURenderer::CAMERA_RAYS_KERNEL_ID, m_render_pass_times[GPURenderer::CAMERA_RAYS_KERNEL_ID]);
-	m_restir_di_render_pass.update_perf_metrics(perf_metrics);
-	perf_metrics->add_value(GPURenderer::PATH_TRACING_KERNEL_ID, m_render_pass_times[GPURenderer::PATH_TRACING_KERNEL_ID]);
+	// Also adding the times of the various passes. Only the newly resolved times
+	// so that the min / max / average of the metrics are those of distinct frames
+	if (m_new_launch_times_resolved)
+	{
+		perf_metrics->add_value(GPURenderer::CAMERA_RAYS_KERNEL_ID, m_render_pass_times[GPURenderer::CAMERA_RAYS_KERNEL_ID]);
+		if (!m_render_data.render_settings.use_wavefront_path_tracing)
+			perf_metrics->add_value(GPURenderer::PATH_TRACING_KERNEL_ID, m_render_pass_times[GPURenderer::PATH_TRACING_KERNEL_ID]);
+
+		m_new_launch_times_resolved = false;
+	}
+	for (RenderPass* render_pass : m_render_passes)
+		render_pass->update_perf_metrics(perf_metrics);
+
+	if (m_hiprt_scene.bvh_build_count != m_perf_metrics_bvh_build_count)
+	{
+		// The BVH has been (re)built since the last update
+		perf_metrics->add_value(GPURenderer::BVH_BUILD_TIME_KEY, m_hiprt_scene.bvh_last_build_time);
+		perf_metrics->add_value(GPURenderer::BVH_MEMORY_KEY, m_hiprt_scene.bvh_memory_size / 1000000.0);
+
+		m_perf_metrics_bvh_build_count = m_hiprt_scene.bvh_build_count;
+	}
 }
 
 void GPURenderer::reset(std::shared_ptr<ApplicationSettings> application_settings)
@@ -811,14 +2322,22 @@ void GPURenderer::reset(std::shared_ptr<ApplicationSettings> application_setting
 		// Only resetting the seed for deterministic rendering if we're accumulating.
 		// If we're not accumulating, we want each frame of the render to be different
 		// so we don't get into that if block and we don't reset the seed
-		m_rng.m_state.seed = 42;
+		m_rng.m_state.seed = m_rng_seed;
 
-		m_restir_di_render_pass.reset();
+		for (RenderPass* render_pass : m_render_passes)
+			render_pass->reset();
 	
 		if (application_settings->auto_sample_per_frame)
 			m_render_data.render_settings.samples_per_frame = 1;
 	}
 
+	// The accumulation of the render that is being reset is the history of the temporal reprojection
+	bool history_usable = m_render_data.render_settings.enable_temporal_reprojection && m_render_data.render_settings.accumulate && !m_was_last_frame_low_resolution;
+	history_usable &= m_temporal_reprojection_history_valid;
+	m_render_data.render_settings.temporal_reprojection_history_sample_count = history_usable ? m_render_data.render_settings.sample_number : 0;
+	// The render that starts is the history of the next reset
+	m_temporal_reprojection_history_valid = true;
+
 	m_render_data.render_settings.denoiser_AOV_accumulation_counter = 0;
 	m_render_data.render_settings.sample_number = 0;
 	m_render_data.render_settings.need_to_reset = true;
@@ -831,70 +2350,131 @@ Xorshift32Generator& GPURenderer::rng()
 	return m_rng;
 }
 
+void GPURenderer::set_rng_seed(unsigned int seed)
+{
+	m_rng_seed = seed;
+	m_rng.m_state.seed = seed;
+}
+
 void GPURenderer::update_render_data()
 {
 	// Always updating the random seed
 	m_render_data.random_seed = m_rng.xorshift32();
 
+	// Read by the kernels compiled with the runtime branches (see set_runtime_kernel_option())
+	m_render_data.render_settings.runtime_kernel_options.envmap_sampling_do_bsdf_mis = m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_DO_BSDF_MIS);
+	m_render_data.render_settings.runtime_kernel_options.restir_di_do_visibility_reuse = m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE);
+
 	if (m_render_data_buffers_invalidated)
 	{
-		m_render_data.geom = m_hiprt_scene.geometry.m_geometry;
+		m_render_data.geom = m_hiprt_scene.scene;
 
-		m_render_data.buffers.triangles_indices = reinterpret_cast<int*>(m_hiprt_scene.geometry.m_mesh.triangleIndices);
-		m_render_data.buffers.vertices_positions = reinterpret_cast<float3*>(m_hiprt_scene.geometry.m_mesh.vertices);
-		m_render_data.buffers.has_vertex_normals = reinterpret_cast<unsigned char*>(m_hiprt_scene.has_vertex_normals.get_device_pointer());
-		m_render_data.buffers.vertex_normals = reinterpret_cast<float3*>(m_hiprt_scene.vertex_normals.get_device_pointer());
+		m_render_data.buffers.triangles_indices = m_hiprt_scene.triangles_indices.get_device_pointer();
+		m_render_data.buffers.vertices_positions = m_quantized_vertices_positions ? nullptr : m_hiprt_scene.vertices_positions.get_device_pointer();
+		m_render_data.buffers.quantized_vertices_positions = m_quantized_vertices_positions ? m_hiprt_scene.quantized_vertices_positions.get_device_pointer() : nullptr;
+		m_render_data.buffers.mesh_vertex_attributes = m_hiprt_scene.mesh_vertex_attributes.get_device_pointer();
+		m_render_data.buffers.vertex_normals = m_hiprt_scene.vertex_normals.get_device_pointer();
 		m_render_data.buffers.material_indices = reinterpret_cast<int*>(m_hiprt_scene.material_indices.get_device_pointer());
-		m_render_data.buffers.materials_buffer = reinterpret_cast<RendererMaterial*>(m_hiprt_scene.materials_buffer.get_device_pointer());
+		m_render_data.buffers.triangle_opacities = m_hiprt_scene.triangle_opacities.get_device_pointer();
+		m_render_data.buffers.triangle_opacity_micromap_indices = m_hiprt_scene.triangle_opacity_micromap_indices.get_device_pointer();
+		m_render_data.buffers.opacity_micromaps = m_hiprt_scene.opacity_micromaps.get_device_pointer();
+		m_render_data.buffers.triangle_emission_texture_luminances = m_hiprt_scene.triangle_emission_texture_luminances.get_device_pointer();
+		m_render_data.buffers.instances = m_hiprt_scene.instances.get_device_pointer();
+		m_render_data.buffers.instance_count = static_cast<int>(m_hiprt_scene.host_instances.size());
+		m_render_data.buffers.spheres = m_hiprt_scene.spheres.get_device_pointer();
+		// The instance of the spheres is after the ones of the meshes, see HIPRTScene::get_bvh_instances()
+		m_render_data.buffers.sphere_instance_index = m_hiprt_scene.has_spheres() ? static_cast<int>(m_hiprt_scene.host_instances.size()) : -1;
+		m_render_data.buffers.sphere_first_primitive = static_cast<int>(m_hiprt_scene.triangles_indices.get_element_count() / 3);
+		m_render_data.buffers.materials_buffer = m_hiprt_scene.materials_buffer.get_device_pointer();
 		m_render_data.buffers.emissive_triangles_count = m_hiprt_scene.emissive_triangles_count;
 		m_render_data.buffers.emissive_triangles_indices = reinterpret_cast<int*>(m_hiprt_scene.emissive_triangles_indices.get_device_pointer());
+		m_render_data.buffers.emissive_triangles_alias_table_probas = m_hiprt_scene.emissive_triangles_alias_table_probas.get_device_pointer();
+		m_render_data.buffers.emissive_triangles_alias_table_alias = m_hiprt_scene.emissive_triangles_alias_table_alias.get_device_pointer();
+		m_render_data.buffers.emissive_triangles_total_power = m_hiprt_scene.emissive_triangles_total_power;
+		m_render_data.buffers.light_bvh_nodes = m_hiprt_scene.light_bvh_nodes.get_device_pointer();
+		m_render_data.buffers.light_bvh_leaf_indices = m_hiprt_scene.light_bvh_leaf_indices.get_device_pointer();
+		m_render_data.buffers.light_clusters = m_hiprt_scene.light_clusters;
+		m_render_data.buffers.light_clusters.cells_offsets = m_hiprt_scene.light_clusters_cells_offsets.get_device_pointer();
+		m_render_data.buffers.light_clusters.cells_emissive_triangles = m_hiprt_scene.light_clusters_cells_emissive_triangles.get_device_pointer();
+		m_render_data.buffers.light_clusters.cells_alias_table_probas = m_hiprt_scene.light_clusters_cells_alias_table_probas.get_device_pointer();
+		m_render_data.buffers.light_clusters.cells_alias_table_alias = m_hiprt_scene.light_clusters_cells_alias_table_alias.get_device_pointer();
+		m_render_data.buffers.light_clusters.cells_total_power = m_hiprt_scene.light_clusters_cells_total_power.get_device_pointer();
 
 		m_render_data.buffers.material_textures = reinterpret_cast<oroTextureObject_t*>(m_hiprt_scene.gpu_materials_textures.get_device_pointer());
-		m_render_data.buffers.texcoords = reinterpret_cast<float2*>(m_hiprt_scene.texcoords_buffer.get_device_pointer());
+		m_render_data.buffers.texcoords = m_half_precision_texcoords ? nullptr : m_hiprt_scene.texcoords_buffer.get_device_pointer();
+		m_render_data.buffers.texcoords_half = m_half_precision_texcoords ? m_hiprt_scene.texcoords_half_buffer.get_device_pointer() : nullptr;
 		m_render_data.buffers.textures_dims = reinterpret_cast<int2*>(m_hiprt_scene.textures_dims.get_device_pointer());
+		m_render_data.buffers.material_textures_mips = reinterpret_cast<oroTextureObject_t*>(m_hiprt_scene.gpu_materials_textures_mips.get_device_pointer());
+		m_render_data.buffers.material_textures_mip_ranges = m_hiprt_scene.textures_mip_ranges.get_device_pointer();
+		m_render_data.buffers.linearized_srgb_textures = m_hiprt_scene.linearized_srgb_textures;
+		m_render_data.buffers.virtual_textures = m_virtual_texture_streamer.get_device_buffers();
 
-		m_render_data.g_buffer.materials = m_g_buffer.materials.get_device_pointer();
+		m_render_data.g_buffer.material_indices = m_g_buffer.material_indices.get_device_pointer();
+		m_render_data.g_buffer.texcoords = m_g_buffer.texcoords.get_device_pointer();
 		m_render_data.g_buffer.geometric_normals = m_g_buffer.geometric_normals.get_device_pointer();
 		m_render_data.g_buffer.shading_normals = m_g_buffer.shading_normals.get_device_pointer();
 		m_render_data.g_buffer.view_directions = m_g_buffer.view_directions.get_device_pointer();
-		m_render_data.g_buffer.first_hits = m_g_buffer.first_hits.get_device_pointer();
+		m_render_data.g_buffer.first_hit_distances = m_g_buffer.first_hit_distances.get_device_pointer();
+		m_render_data.g_buffer.motion_vectors = m_g_buffer.motion_vectors.get_device_pointer();
+		m_render_data.g_buffer.texture_footprints = m_g_buffer.texture_footprints.get_device_pointer();
+		m_render_data.g_buffer.ray_cone_spread_angles = m_g_buffer.ray_cone_spread_angles.get_device_pointer();
 		m_render_data.g_buffer.camera_ray_hit = m_g_buffer.cameray_ray_hit.get_device_pointer();
 		m_render_data.g_buffer.ray_volume_states = m_g_buffer.ray_volume_states.get_device_pointer();
+		m_render_data.g_buffer.width = m_render_resolution.x;
+		m_render_data.g_buffer_prev_frame.width = m_render_resolution.x;
 
 		if (m_render_data.render_settings.use_prev_frame_g_buffer(this))
 		{
 			// Only setting the pointers of the buffers if we're actually using the g-buffer of the previous frame
 
-			m_render_data.g_buffer_prev_frame.materials = m_g_buffer_prev_frame.materials.get_device_pointer();
+			m_render_data.g_buffer_prev_frame.material_indices = m_g_buffer_prev_frame.material_indices.get_device_pointer();
+		m_render_data.g_buffer_prev_frame.texcoords = m_g_buffer_prev_frame.texcoords.get_device_pointer();
 			m_render_data.g_buffer_prev_frame.geometric_normals = m_g_buffer_prev_frame.geometric_normals.get_device_pointer();
 			m_render_data.g_buffer_prev_frame.shading_normals = m_g_buffer_prev_frame.shading_normals.get_device_pointer();
 			m_render_data.g_buffer_prev_frame.view_directions = m_g_buffer_prev_frame.view_directions.get_device_pointer();
-			m_render_data.g_buffer_prev_frame.first_hits = m_g_buffer_prev_frame.first_hits.get_device_pointer();
+			m_render_data.g_buffer_prev_frame.first_hit_distances = m_g_buffer_prev_frame.first_hit_distances.get_device_pointer();
+			m_render_data.g_buffer_prev_frame.motion_vectors = m_g_buffer_prev_frame.motion_vectors.get_device_pointer();
+			m_render_data.g_buffer_prev_frame.texture_footprints = m_g_buffer_prev_frame.texture_footprints.get_device_pointer();
+			m_render_data.g_buffer_prev_frame.ray_cone_spread_angles = m_g_buffer_prev_frame.ray_cone_spread_angles.get_device_pointer();
 			m_render_data.g_buffer_prev_frame.camera_ray_hit = m_g_buffer_prev_frame.cameray_ray_hit.get_device_pointer();
 			m_render_data.g_buffer_prev_frame.ray_volume_states = m_g_buffer_prev_frame.ray_volume_states.get_device_pointer();
 		}
 		else
 		{
-			m_render_data.g_buffer_prev_frame.materials = nullptr;
+			m_render_data.g_buffer_prev_frame.material_indices = nullptr;
+			m_render_data.g_buffer_prev_frame.texcoords = nullptr;
 			m_render_data.g_buffer_prev_frame.geometric_normals = nullptr;
 			m_render_data.g_buffer_prev_frame.shading_normals = nullptr;
 			m_render_data.g_buffer_prev_frame.view_directions = nullptr;
-			m_render_data.g_buffer_prev_frame.first_hits = nullptr;
+			m_render_data.g_buffer_prev_frame.first_hit_distances = nullptr;
+			m_render_data.g_buffer_prev_frame.motion_vectors = nullptr;
+			m_render_data.g_buffer_prev_frame.texture_footprints = nullptr;
+			m_render_data.g_buffer_prev_frame.ray_cone_spread_angles = nullptr;
 			m_render_data.g_buffer_prev_frame.camera_ray_hit = nullptr;
 			m_render_data.g_buffer_prev_frame.ray_volume_states = nullptr;
 		}
 
 		if (m_render_data.render_settings.has_access_to_adaptive_sampling_buffers())
 		{
-			m_render_data.aux_buffers.pixel_sample_count = m_pixels_sample_count_buffer.get_device_pointer();
 			m_render_data.aux_buffers.pixel_squared_luminance = m_pixels_squared_luminance_buffer.get_device_pointer();
+			m_render_data.aux_buffers.pixel_half_luminance = m_pixels_half_luminance_buffer.get_element_count() > 0 ? m_pixels_half_luminance_buffer.get_device_pointer() : nullptr;
 		}
 
-		m_render_data.aux_buffers.pixel_active = m_pixel_active.get_device_pointer();
+		m_render_data.aux_buffers.temporal_reprojection_history = m_temporal_reprojection_history_buffer.get_element_count() > 0 ? m_temporal_reprojection_history_buffer.get_device_pointer() : nullptr;
+		m_render_data.aux_buffers.temporal_upscaling_history = m_temporal_upscaling_history_buffer.get_element_count() > 0 ? m_temporal_upscaling_history_buffer.get_device_pointer() : nullptr;
+		m_render_data.aux_buffers.packed_denoiser_albedo = m_packed_albedo_AOV_buffer.get_element_count() > 0 ? m_packed_albedo_AOV_buffer.get_device_pointer() : nullptr;
+		m_render_data.aux_buffers.packed_denoiser_normals = m_packed_normals_AOV_buffer.get_element_count() > 0 ? m_packed_normals_AOV_buffer.get_device_pointer() : nullptr;
+		m_render_data.aux_buffers.temporal_upscaling_output = m_temporal_upscaling_output_buffer.get_element_count() > 0 ? m_temporal_upscaling_output_buffer.get_device_pointer() : nullptr;
+		m_render_data.aux_buffers.pixel_status = m_pixel_status.get_device_pointer();
+		m_render_data.aux_buffers.active_pixel_indices = m_active_pixel_indices.get_device_pointer();
+		m_render_data.aux_buffers.active_pixel_counters = reinterpret_cast<AtomicType<unsigned int>*>(m_active_pixel_counters.get_device_pointer());
+		m_render_data.aux_buffers.bounce_active_ray_counts = reinterpret_cast<AtomicType<unsigned int>*>(m_bounce_active_ray_counts.get_device_pointer());
+		m_render_data.aux_buffers.ray_statistics = reinterpret_cast<AtomicType<unsigned int>*>(m_ray_statistics.get_device_pointer());
 		m_render_data.aux_buffers.still_one_ray_active = m_still_one_ray_active_buffer.get_device_pointer();
 		m_render_data.aux_buffers.stop_noise_threshold_converged_count = reinterpret_cast<AtomicType<unsigned int>*>(m_pixels_converged_count_buffer.get_device_pointer());
 
-		m_restir_di_render_pass.update_render_data();
+		for (RenderPass* render_pass : m_render_passes)
+			render_pass->update_render_data();
 
 		m_render_data_buffers_invalidated = false;
 	}
@@ -905,20 +2485,157 @@ void GPURenderer::set_hiprt_scene_from_scene(const Scene& scene)
 	ThreadManager::start_thread(ThreadManager::RENDERER_BUILD_BVH, [this, &scene]() {
 		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
 
-		m_hiprt_scene.geometry.m_hiprt_ctx = m_hiprt_orochi_ctx->hiprt_ctx;
-		m_hiprt_scene.geometry.upload_indices(scene.triangle_indices);
-		m_hiprt_scene.geometry.upload_vertices(scene.vertices_positions);
-		m_hiprt_scene.geometry.build_bvh();
-	});
+		m_hiprt_scene.hiprt_ctx = m_hiprt_orochi_ctx->hiprt_ctx;
+
+		// The geometry is uploaded asynchronously on the main stream (and the BVH is built
+		// on the main stream) so we need it to be created
+		ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_CREATE);
+
+		// Going through pinned staging chunks instead of synchronous copies from pageable memory.
+		// This also allows uploading buffers that aren't in memory as a whole
+		OrochiStagingUploader uploader;
+
+		// Keeping room for the BVH in VRAM, the shading attributes go to host mapped memory otherwise
+		OrochiDeviceMemoryPool::set_device_memory_reserve(HIPRTScene::estimate_bvh_memory_size(scene.triangle_indices.size() / 3));
+
+		m_hiprt_scene.triangles_indices.resize(scene.triangle_indices.size());
+		uploader.upload(m_hiprt_scene.triangles_indices.get_device_pointer(), scene.triangle_indices.data(), sizeof(int) * scene.triangle_indices.size(), m_main_stream);
+
+		m_hiprt_scene.host_mesh_vertex_attributes = scene.get_mesh_vertex_attributes();
+		if (m_quantized_vertices_positions)
+		{
+			// The shaders only read the quantized positions. The BVHs are built from the dequantized positions
+			// so that the triangles intersected are exactly the ones that are shaded. The full precision
+			// positions are freed once the BVH is built
+			std::vector<unsigned short> quantized_positions(scene.vertices_positions.size() * 3);
+#pragma omp parallel for schedule(dynamic)
+			for (int mesh_index = 0; mesh_index < scene.meshes.size(); mesh_index++)
+			{
+				const SceneMesh& mesh = scene.meshes[mesh_index];
+				for (int vertex_index = mesh.first_vertex; vertex_index < mesh.first_vertex + mesh.vertex_count; vertex_index++)
+					quantize_vertex_position(m_hiprt_scene.host_mesh_vertex_attributes[mesh_index], scene.vertices_positions[vertex_index], quantized_positions.data() + vertex_index * 3);
+			}
+
+			m_hiprt_scene.quantized_vertices_positions.resize(quantized_positions.size());
+			uploader.upload(m_hiprt_scene.quantized_vertices_positions.get_device_pointer(), quantized_positions.data(), sizeof(unsigned short) * quantized_positions.size(), m_main_stream);
+			upload_bvh_vertices_positions(quantized_positions, uploader);
+		}
+		else
+		{
+			m_hiprt_scene.quantized_vertices_positions.free();
+			m_hiprt_scene.vertices_positions.resize(scene.vertices_positions.size());
+			uploader.upload(m_hiprt_scene.vertices_positions.get_device_pointer(), scene.vertices_positions.data(), sizeof(float3) * scene.vertices_positions.size(), m_main_stream);
+		}
+
+		upload_vertex_attributes(scene, uploader);
+
+		m_hiprt_scene.geometries.resize(scene.meshes.size());
+		for (int mesh_index = 0; mesh_index < scene.meshes.size(); mesh_index++)
+		{
+			const SceneMesh& mesh = scene.meshes[mesh_index];
+
+			HIPRTGeometry& geometry = m_hiprt_scene.geometries[mesh_index];
+			geometry.m_first_triangle = mesh.first_triangle;
+			geometry.m_triangle_count = mesh.triangle_count;
+			// The textures aren't loaded yet, the textured meshes are alpha tested until
+			// their triangles are classified, see update_triangle_opacities()
+			geometry.m_alpha_tested = false;
+			for (int triangle_index = mesh.first_triangle; triangle_index < mesh.first_triangle + mesh.triangle_count && !geometry.m_alpha_tested; triangle_index++)
+			{
+				const RendererMaterial& material = scene.materials[scene.material_indices[triangle_index]];
+
+				geometry.m_alpha_tested = material.alpha_opacity < 1.0f || material.base_color_texture_index != RendererMaterial::NO_TEXTURE;
+			}
+
+			hiprtTriangleMeshPrimitive& hiprt_mesh = geometry.m_mesh;
+			hiprt_mesh.triangleCount = mesh.triangle_count;
+			hiprt_mesh.triangleStride = sizeof(int3);
+			// The geometries are built from the same global vertex indices as the ones used for shading,
+			// against the vertices of the whole scene, instead of from a copy of the indices local to each mesh
+			hiprt_mesh.triangleIndices = m_hiprt_scene.triangles_indices.get_device_pointer() + mesh.first_triangle * 3;
+			hiprt_mesh.vertexStride = sizeof(float3);
+		}
+
+		// The meshes streamed in by the progressive loading don't have their LODs in the BVH
+		m_hiprt_scene.lod_geometries.clear();
+		if (!m_progressive_loading)
+		{
+			for (const SceneMeshLOD& mesh_lod : scene.mesh_lods)
+			{
+				HIPRTGeometryLOD lod;
+				lod.mesh_index = mesh_lod.mesh_index;
+				lod.level = mesh_lod.level;
+				lod.error = mesh_lod.error;
+
+				// The LODs reuse the vertices of their mesh so they have its bounding box and alpha test
+				lod.geometry.m_first_triangle = mesh_lod.first_triangle;
+				lod.geometry.m_triangle_count = mesh_lod.triangle_count;
+				lod.geometry.m_alpha_tested = m_hiprt_scene.geometries[mesh_lod.mesh_index].m_alpha_tested;
+				lod.geometry.m_mesh.triangleCount = mesh_lod.triangle_count;
+				lod.geometry.m_mesh.triangleStride = sizeof(int3);
+				lod.geometry.m_mesh.triangleIndices = m_hiprt_scene.triangles_indices.get_device_pointer() + mesh_lod.first_triangle * 3;
+				lod.geometry.m_mesh.vertexStride = sizeof(float3);
+
+				m_hiprt_scene.lod_geometries.push_back(lod);
+			}
+		}
 
-	m_hiprt_scene.has_vertex_normals.resize(scene.has_vertex_normals.size());
-	m_hiprt_scene.has_vertex_normals.upload_data(scene.has_vertex_normals.data());
+		m_hiprt_scene.set_geometries_vertices();
+		if (m_progressive_loading)
+			setup_geometry_proxies(scene);
+
+		upload_scene_spheres(scene);
+
+		m_hiprt_scene.host_instances = scene.instances;
+		m_hiprt_scene.set_geometry_lods();
+		std::vector<SceneInstance> device_instances = m_hiprt_scene.get_device_instances();
+		m_hiprt_scene.instances.resize(device_instances.size());
+		m_hiprt_scene.instances.upload_data(device_instances.data());
+
+		std::vector<hiprtFrameMatrix> instance_frames = m_hiprt_scene.get_bvh_instance_frames();
+		m_hiprt_scene.instance_frames.resize(instance_frames.size());
+		m_hiprt_scene.instance_frames.upload_data(instance_frames.data());
+
+		// build_bvh() synchronizes the main stream so all the uploads
+		// are done when it returns
+		m_hiprt_scene.build_bvh(m_bvh_build_quality, m_main_stream, m_compact_bvh);
+		OrochiDeviceMemoryPool::set_device_memory_reserve(0);
+		// The streamed meshes are built from the full precision positions too
+		if (m_quantized_vertices_positions && m_streamed_meshes.empty())
+			m_hiprt_scene.vertices_positions.free();
+	});
 
-	m_hiprt_scene.vertex_normals.resize(scene.vertex_normals.size());
-	m_hiprt_scene.vertex_normals.upload_data(scene.vertex_normals.data());
+	// The materials of the spheres are after the ones of the triangles, see HIPRTRenderData::buffers.spheres
+	std::vector<int> material_indices = scene.material_indices;
+	for (const Sphere& sphere : scene.spheres)
+		material_indices.push_back(sphere.material_index);
+	m_hiprt_scene.material_indices.resize(material_indices.size());
+	m_hiprt_scene.material_indices.upload_data(material_indices.data());
 
-	m_hiprt_scene.material_indices.resize(scene.material_indices.size());
-	m_hiprt_scene.material_indices.upload_data(scene.material_indices.data());
+	if (m_progressive_loading)
+	{
+		m_geometry_streaming = true;
+		ThreadManager::add_dependency(ThreadManager::RENDERER_STREAM_GEOMETRIES, ThreadManager::RENDERER_BUILD_BVH);
+		ThreadManager::start_thread(ThreadManager::RENDERER_STREAM_GEOMETRIES, [this]() {
+			stream_geometries();
+		});
+
+		// Rendering with the materials without their textures until the textures are loaded. The
+		// materials, textures and emissive triangles are then uploaded by update_progressive_loading()
+		// on the thread that renders, between two frames
+		std::vector<PackedRendererMaterial> packed_materials = GPURenderer::pack_materials(scene.placeholder_materials);
+		m_hiprt_scene.materials_buffer.resize(packed_materials.size());
+		m_hiprt_scene.materials_buffer.upload_data(packed_materials.data());
+
+		m_progressive_loading_scene = &scene;
+		ThreadManager::add_dependency(ThreadManager::RENDERER_PROGRESSIVE_LOADING, ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY);
+		ThreadManager::add_dependency(ThreadManager::RENDERER_PROGRESSIVE_LOADING, ThreadManager::SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES);
+		ThreadManager::start_thread(ThreadManager::RENDERER_PROGRESSIVE_LOADING, [this]() {
+			m_progressive_loading_scene_ready = true;
+		});
+
+		return;
+	}
 
 	// Uploading the materials after the textures have been parsed because texture
 	// parsing can modify the materials (emission of constant textures are stored in the
@@ -928,107 +2645,872 @@ void GPURenderer::set_hiprt_scene_from_scene(const Scene& scene)
 	ThreadManager::start_thread(ThreadManager::RENDERER_UPLOAD_MATERIALS, [this, &scene]() {
 		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
 
-		m_hiprt_scene.materials_buffer.resize(scene.materials.size());
-		m_hiprt_scene.materials_buffer.upload_data(scene.materials.data());
-
-		m_hiprt_scene.texcoords_buffer.resize(scene.texcoords.size());
-		m_hiprt_scene.texcoords_buffer.upload_data(scene.texcoords.data());
+		upload_scene_materials(scene);
 	});
 
 	ThreadManager::add_dependency(ThreadManager::RENDERER_UPLOAD_TEXTURES, ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY);
 	ThreadManager::start_thread(ThreadManager::RENDERER_UPLOAD_TEXTURES, [this, &scene]() {
 		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
 
-		if (scene.textures.size() > 0)
-		{
-			std::vector<oroTextureObject_t> oro_textures(scene.textures.size());
-			m_hiprt_scene.orochi_materials_textures.reserve(scene.textures.size());
-			for (int i = 0; i < scene.textures.size(); i++)
-			{
-				if (scene.textures[i].width == 0 || scene.textures[i].height == 0)
-				{
-					// It can happen that for emissive textures for example, we had a texture but its color is constant.
-					// As a result, we have not read the texture but rather just stored the constant emissive color in the
-					// emission filed of the material so we have no texture to read here
-
-					// The shader will never read from that texture (because the texture index of the material has been set to -1)
-					// so we set it to nullptr
-					oro_textures[i] = nullptr;
-
-					continue;
-				}
-
-				// We need to keep the texture alive so they are not destroyed when returning from 
-				// this function so we're adding them to a member buffer
-				m_hiprt_scene.orochi_materials_textures.push_back(OrochiTexture(scene.textures[i]));
-
-				oro_textures[i] = m_hiprt_scene.orochi_materials_textures.back().get_device_texture();
-			}
-
-			m_hiprt_scene.gpu_materials_textures.resize(oro_textures.size());
-			m_hiprt_scene.gpu_materials_textures.upload_data(oro_textures.data());
-
-			m_hiprt_scene.textures_dims.resize(scene.textures_dims.size());
-			m_hiprt_scene.textures_dims.upload_data(scene.textures_dims.data());
-		}
+		upload_scene_textures(scene);
 	});
 
 	ThreadManager::add_dependency(ThreadManager::RENDERER_UPLOAD_EMISSIVE_TRIANGLES, ThreadManager::SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES);
 	ThreadManager::start_thread(ThreadManager::RENDERER_UPLOAD_EMISSIVE_TRIANGLES, [this, &scene]() {
-		m_hiprt_scene.emissive_triangles_count = scene.emissive_triangle_indices.size();
-		if (m_hiprt_scene.emissive_triangles_count > 0)
-		{
-			OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
 
-			m_hiprt_scene.emissive_triangles_indices.resize(scene.emissive_triangle_indices.size());
-			m_hiprt_scene.emissive_triangles_indices.upload_data(scene.emissive_triangle_indices.data());
-		}
+		upload_scene_emissive_triangles(scene);
 	});
 }
 
-void GPURenderer::set_scene(const Scene& scene)
+void GPURenderer::upload_scene_spheres(const Scene& scene)
 {
-	set_hiprt_scene_from_scene(scene);
+	if (scene.spheres.empty())
+	{
+		m_hiprt_scene.spheres.free();
+		m_hiprt_scene.spheres_aabbs.free();
 
-	m_materials = scene.materials;
-	m_material_names = scene.material_names;
-}
+		return;
+	}
 
-void GPURenderer::set_envmap(const Image32Bit& envmap_image, const std::string& envmap_filepath)
-{
-	ThreadManager::add_dependency(ThreadManager::RENDERER_SET_ENVMAP, ThreadManager::ENVMAP_LOAD_FROM_DISK_THREAD);
-	ThreadManager::start_thread(ThreadManager::RENDERER_SET_ENVMAP, [this, &envmap_image, &envmap_filepath]() {
-		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+	std::vector<float4> spheres(scene.spheres.size());
+	std::vector<float4> spheres_aabbs(scene.spheres.size() * 2);
+	for (int i = 0; i < scene.spheres.size(); i++)
+	{
+		const Sphere& sphere = scene.spheres[i];
 
-		if (envmap_image.width == 0 || envmap_image.height == 0)
-		{
-			m_render_data.world_settings.ambient_light_type = AmbientLightType::UNIFORM;
+		spheres[i] = make_float4(sphere.center.x, sphere.center.y, sphere.center.z, sphere.radius);
+		spheres_aabbs[i * 2 + 0] = make_float4(sphere.center.x - sphere.radius, sphere.center.y - sphere.radius, sphere.center.z - sphere.radius, 0.0f);
+		spheres_aabbs[i * 2 + 1] = make_float4(sphere.center.x + sphere.radius, sphere.center.y + sphere.radius, sphere.center.z + sphere.radius, 0.0f);
+	}
 
-			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Empty envmap set on the GPURenderer... Defaulting to uniform ambient light type");
+	m_hiprt_scene.spheres.resize(spheres.size());
+	m_hiprt_scene.spheres.upload_data(spheres.data());
+	m_hiprt_scene.spheres_aabbs.resize(spheres_aabbs.size());
+	m_hiprt_scene.spheres_aabbs.upload_data(spheres_aabbs.data());
+}
 
-			return;
-		}
+void GPURenderer::upload_scene_materials(const Scene& scene)
+{
+	if (scene.textures_dims.size() > PACKED_MATERIAL_MAX_TEXTURE_COUNT)
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The scene has %zu textures but the packed materials can only index %d textures.", scene.textures_dims.size(), PACKED_MATERIAL_MAX_TEXTURE_COUNT);
+
+	std::vector<PackedRendererMaterial> packed_materials = GPURenderer::pack_materials(scene.materials);
+	m_hiprt_scene.materials_buffer.resize(packed_materials.size());
+	m_hiprt_scene.materials_buffer.upload_data(packed_materials.data());
+	// The preview materials were after the materials of the previous scene
+	if (m_render_data.material_preview_target_index != -1)
+	{
+		m_render_data.material_preview_target_index = -1;
+		m_views.clear();
+	}
 
-		m_envmap.init_from_image(envmap_image, envmap_filepath);
-		m_envmap.recompute_sampling_data_structure(this, &envmap_image);
+	// The textures are loaded so the texels under the triangles can be classified
+	m_triangle_texture_opacities = TriangleOpacityClassifier::compute_texture_opacities(scene);
+	m_triangle_material_indices = scene.material_indices;
 
-		m_render_data.world_settings.envmap = m_envmap.get_orochi_envmap().get_device_texture();
-		m_render_data.world_settings.envmap_width = m_envmap.get_orochi_envmap().width;
-		m_render_data.world_settings.envmap_height = m_envmap.get_orochi_envmap().height;
+	std::vector<unsigned char> opacity_micromaps;
+	TriangleOpacityClassifier::compute_opacity_micromaps(scene, m_triangle_texture_opacities, m_triangle_opacity_micromap_indices, opacity_micromaps);
+	if (!opacity_micromaps.empty())
+	{
+		m_hiprt_scene.triangle_opacity_micromap_indices.resize(m_triangle_opacity_micromap_indices.size());
+		m_hiprt_scene.triangle_opacity_micromap_indices.upload_data(m_triangle_opacity_micromap_indices.data());
+		m_hiprt_scene.opacity_micromaps.resize(opacity_micromaps.size());
+		m_hiprt_scene.opacity_micromaps.upload_data(opacity_micromaps.data());
 
-#if EnvmapSamplingStrategy == ESS_BINARY_SEARCH
-		m_render_data.world_settings.envmap_cdf = m_envmap.get_orochi_envmap().get_cdf_device_pointer();
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Opacity micromaps baked for %zu triangles (%.2fMB)", opacity_micromaps.size() / OPACITY_MICROMAP_BYTE_SIZE, opacity_micromaps.size() / 1000000.0f);
+	}
 
-		m_render_data.world_settings.alias_table_probas = nullptr;
-		m_render_data.world_settings.alias_table_alias = nullptr;
-#elif EnvmapSamplingStrategy == ESS_ALIAS_TABLE
-		m_render_data.world_settings.envmap_cdf = nullptr;
+	update_triangle_opacities(scene.materials);
+}
+
+void GPURenderer::upload_scene_textures(const Scene& scene)
+{
+	if (scene.virtual_textures != nullptr)
+	{
+		// Only the tail tiles of the textures are uploaded now, the
+		// other tiles are streamed in as the shaders sample them
+		m_virtual_texture_streamer.init(scene.virtual_textures);
+
+		m_hiprt_scene.textures_dims.resize(scene.textures_dims.size());
+		m_hiprt_scene.textures_dims.upload_data(scene.textures_dims.data());
+	}
+	else if (scene.textures.size() > 0)
+	{
+		std::vector<oroTextureObject_t> oro_textures(scene.textures.size());
+		std::vector<oroTextureObject_t> oro_textures_mips;
+		// Index of the level 1 in 'oro_textures_mips' and number of levels after
+		// the level 0 of each texture
+		std::vector<int2> mip_ranges(scene.textures.size(), make_int2(0, 0));
+		m_hiprt_scene.orochi_materials_textures.reserve(scene.textures.size());
+
+		// The base color textures aren't shared with the other slots of the materials when the
+		// scene is parsed with linearize_srgb_textures, these are stored converted to linear
+		std::vector<bool> srgb_textures(scene.textures.size(), false);
+		if (scene.linearized_srgb_textures)
+			for (const RendererMaterial& material : scene.materials)
+				if (material.base_color_texture_index >= 0)
+					srgb_textures[material.base_color_texture_index] = true;
+		m_hiprt_scene.linearized_srgb_textures = scene.linearized_srgb_textures;
+
+		for (int i = 0; i < scene.textures.size(); i++)
+		{
+			if (scene.textures[i].width == 0 || scene.textures[i].height == 0)
+			{
+				// It can happen that for emissive textures for example, we had a texture but its color is constant.
+				// As a result, we have not read the texture but rather just stored the constant emissive color in the
+				// emission filed of the material so we have no texture to read here
+
+				// The shader will never read from that texture (because the texture index of the material has been set to -1)
+				// so we set it to nullptr
+				oro_textures[i] = nullptr;
+
+				continue;
+			}
+
+			// We need to keep the texture alive so they are not destroyed when returning from 
+			// this function so we're adding them to a member buffer
+			OrochiTexture texture;
+			if (srgb_textures[i])
+				texture.init_from_srgb_image(scene.textures[i]);
+			else
+				texture.init_from_image(scene.textures[i]);
+			m_hiprt_scene.orochi_materials_textures.push_back(std::move(texture));
+
+			oro_textures[i] = m_hiprt_scene.orochi_materials_textures.back().get_device_texture();
+
+			// Mip chain down to 1x1. Each level is its own texture, the shader
+			// does the filtering between the levels
+			mip_ranges[i].x = oro_textures_mips.size();
+			const Image8Bit* previous_level = &scene.textures[i];
+			Image8Bit level;
+			while (previous_level->width > 1 || previous_level->height > 1)
+			{
+				level = previous_level->downsample_2x();
+				previous_level = &level;
+
+				// Downsampled from the sRGB texels, the same levels as without linearized textures
+				OrochiTexture level_texture;
+				if (srgb_textures[i])
+					level_texture.init_from_srgb_image(level);
+				else
+					level_texture.init_from_image(level);
+				m_hiprt_scene.orochi_materials_textures_mips.push_back(std::move(level_texture));
+				oro_textures_mips.push_back(m_hiprt_scene.orochi_materials_textures_mips.back().get_device_texture());
+				mip_ranges[i].y++;
+			}
+		}
+
+		m_hiprt_scene.gpu_materials_textures.resize(oro_textures.size());
+		m_hiprt_scene.gpu_materials_textures.upload_data(oro_textures.data());
+
+		if (oro_textures_mips.size() > 0)
+		{
+			m_hiprt_scene.gpu_materials_textures_mips.resize(oro_textures_mips.size());
+			m_hiprt_scene.gpu_materials_textures_mips.upload_data(oro_textures_mips.data());
+		}
+		m_hiprt_scene.textures_mip_ranges.resize(mip_ranges.size());
+		m_hiprt_scene.textures_mip_ranges.upload_data(mip_ranges.data());
+
+		m_hiprt_scene.textures_dims.resize(scene.textures_dims.size());
+		m_hiprt_scene.textures_dims.upload_data(scene.textures_dims.data());
+	}
+}
+
+void GPURenderer::upload_scene_emissive_triangles(const Scene& scene)
+{
+	// The emissive triangles are parsed after the textures so the emission textures can be integrated
+	m_triangle_emission_texture_luminances = EmissiveTextureIntegrator::compute_triangle_texture_luminances(scene);
+	if (!m_triangle_emission_texture_luminances.empty())
+	{
+		m_hiprt_scene.triangle_emission_texture_luminances.resize(m_triangle_emission_texture_luminances.size());
+		m_hiprt_scene.triangle_emission_texture_luminances.upload_data(m_triangle_emission_texture_luminances.data());
+	}
+
+	m_hiprt_scene.emissive_triangles_count = scene.emissive_triangle_indices.size();
+	if (m_hiprt_scene.emissive_triangles_count > 0)
+	{
+		m_hiprt_scene.emissive_triangles_indices.resize(scene.emissive_triangle_indices.size());
+		m_hiprt_scene.emissive_triangles_indices.upload_data(scene.emissive_triangle_indices.data());
+		m_emissive_triangles_indices = scene.emissive_triangle_indices;
+
+		m_emissive_triangles_areas.resize(m_hiprt_scene.emissive_triangles_count);
+		m_emissive_triangles_material_indices.resize(m_hiprt_scene.emissive_triangles_count);
+		m_emissive_triangles_texture_luminances.resize(m_hiprt_scene.emissive_triangles_count);
+		m_emissive_triangles_instance_indices.resize(m_hiprt_scene.emissive_triangles_count);
+		m_emissive_triangles_object_vertices.resize(m_hiprt_scene.emissive_triangles_count * 3);
+		m_emissive_triangles_world_vertices.resize(m_hiprt_scene.emissive_triangles_count * 3);
+		// Each emissive triangle only writes its own entries
+#pragma omp parallel for
+		for (int i = 0; i < m_hiprt_scene.emissive_triangles_count; i++)
+		{
+			int triangle_index = scene.emissive_triangle_indices[i];
+			int instance_index = get_scene_primitive_instance_index(scene.instances.data(), static_cast<int>(scene.instances.size()), triangle_index);
+			int mesh_triangle_index = get_scene_primitive_mesh_triangle(scene.instances[instance_index], triangle_index);
+
+			float3 vertex_A, vertex_B, vertex_C;
+			scene.get_scene_primitive_vertices(triangle_index, vertex_A, vertex_B, vertex_C);
+
+			m_emissive_triangles_areas[i] = hippt::length(hippt::cross(vertex_B - vertex_A, vertex_C - vertex_A)) * 0.5f;
+			m_emissive_triangles_material_indices[i] = scene.material_indices[mesh_triangle_index];
+			m_emissive_triangles_texture_luminances[i] = m_triangle_emission_texture_luminances.empty() ? 1.0f : m_triangle_emission_texture_luminances[mesh_triangle_index];
+			m_emissive_triangles_instance_indices[i] = instance_index;
+			for (int vertex = 0; vertex < 3; vertex++)
+				m_emissive_triangles_object_vertices[i * 3 + vertex] = scene.vertices_positions[scene.triangle_indices[mesh_triangle_index * 3 + vertex]];
+			m_emissive_triangles_world_vertices[i * 3 + 0] = vertex_A;
+			m_emissive_triangles_world_vertices[i * 3 + 1] = vertex_B;
+			m_emissive_triangles_world_vertices[i * 3 + 2] = vertex_C;
+		}
+
+		// Building the light hierarchy for the LSS_LIGHT_BVH strategy. The emissive triangles
+		// have been parsed after the textures so the emission of the materials is final here
+		LightBVHBuilder::build(scene, m_triangle_emission_texture_luminances, m_light_bvh_nodes, m_light_bvh_leaf_indices);
+		m_hiprt_scene.light_bvh_nodes.resize(m_light_bvh_nodes.size());
+		m_hiprt_scene.light_bvh_leaf_indices.resize(m_light_bvh_leaf_indices.size());
+		m_hiprt_scene.light_bvh_leaf_indices.upload_data(m_light_bvh_leaf_indices.data());
+
+		m_hiprt_scene.emissive_triangles_alias_table_probas.resize(m_hiprt_scene.emissive_triangles_count);
+		m_hiprt_scene.emissive_triangles_alias_table_alias.resize(m_hiprt_scene.emissive_triangles_count);
+
+		// Builds the alias table and uploads the light hierarchy
+		update_emissive_triangles_power(scene.materials);
+	}
+}
+
+void GPURenderer::setup_geometry_proxies(const Scene& scene)
+{
+	// The 8 corners of a box, bit 0 for the maximum X, bit 1 for Y and bit 2 for Z
+	static const int box_triangles_indices[36] = {
+		0, 4, 6, 0, 6, 2,
+		1, 3, 7, 1, 7, 5,
+		0, 1, 5, 0, 5, 4,
+		2, 6, 7, 2, 7, 3,
+		0, 2, 3, 0, 3, 1,
+		4, 5, 7, 4, 7, 6
+	};
+
+	m_streamed_meshes.clear();
+	m_streamed_meshes_swapped_count = 0;
+
+	std::vector<float3> proxy_vertices;
+	for (int mesh_index = 0; mesh_index < scene.meshes.size(); mesh_index++)
+	{
+		if (scene.meshes[mesh_index].triangle_count < PROGRESSIVE_LOADING_MIN_STREAMED_TRIANGLES)
+			continue;
+
+		m_streamed_meshes.push_back(std::make_pair(mesh_index, m_hiprt_scene.geometries[mesh_index].m_mesh));
+
+		const BoundingBox& box = scene.mesh_bounding_boxes[mesh_index];
+		for (int corner = 0; corner < 8; corner++)
+			proxy_vertices.push_back(make_float3(corner & 1 ? box.maxi.x : box.mini.x, corner & 2 ? box.maxi.y : box.mini.y, corner & 4 ? box.maxi.z : box.mini.z));
+	}
+
+	if (m_streamed_meshes.empty())
+		return;
+
+	m_hiprt_scene.proxy_vertices_positions.resize(proxy_vertices.size());
+	m_hiprt_scene.proxy_vertices_positions.upload_data(proxy_vertices.data());
+	m_hiprt_scene.proxy_triangles_indices.resize(36);
+	m_hiprt_scene.proxy_triangles_indices.upload_data(box_triangles_indices);
+
+	// The primitive indices of the rays that hit a box are the indices of its 12 triangles, the first 12 triangles
+	// of the mesh are then shaded instead. Only the silhouette of the boxes is meaningful but the
+	// scene is there, at the right place, until the real triangles are streamed in
+	for (int proxy_index = 0; proxy_index < m_streamed_meshes.size(); proxy_index++)
+	{
+		hiprtTriangleMeshPrimitive& proxy_mesh = m_hiprt_scene.geometries[m_streamed_meshes[proxy_index].first].m_mesh;
+		proxy_mesh.triangleCount = 12;
+		proxy_mesh.triangleIndices = m_hiprt_scene.proxy_triangles_indices.get_device_pointer();
+		proxy_mesh.vertices = m_hiprt_scene.proxy_vertices_positions.get_device_pointer() + proxy_index * 8;
+		proxy_mesh.vertexCount = 8;
+	}
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%zu meshes replaced by their bounding box until their BVH is streamed in", m_streamed_meshes.size());
+}
+
+void GPURenderer::stream_geometries()
+{
+	OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+	// On a stream of its own so that the BVHs are built alongside the frames
+	oroStream_t stream;
+	OROCHI_CHECK_ERROR(oroStreamCreate(&stream));
+	OrochiBuffer<unsigned char> temp_buffer { "BVH build" };
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const std::pair<int, hiprtTriangleMeshPrimitive>& streamed_mesh : m_streamed_meshes)
+	{
+		if (m_stop_geometry_streaming)
+			break;
+
+		hiprtGeometry geometry = m_hiprt_scene.build_geometry(streamed_mesh.second, m_hiprt_scene.geometries[streamed_mesh.first].m_alpha_tested, m_bvh_build_quality, stream, temp_buffer, m_compact_bvh);
+
+		std::lock_guard<std::mutex> lock(m_streamed_geometries_mutex);
+		m_streamed_geometries.push_back(std::make_pair(streamed_mesh.first, geometry));
+	}
+	auto stop = std::chrono::high_resolution_clock::now();
+
+	OROCHI_CHECK_ERROR(oroStreamDestroy(stream));
+
+	if (!m_stop_geometry_streaming && !m_streamed_meshes.empty())
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "BVHs of %zu meshes streamed in %ldms", m_streamed_meshes.size(), std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+}
+
+void GPURenderer::stop_geometry_streaming()
+{
+	if (!m_geometry_streaming)
+		return;
+
+	m_stop_geometry_streaming = true;
+	ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_GEOMETRIES);
+	m_stop_geometry_streaming = false;
+	m_geometry_streaming = false;
+
+	{
+		std::lock_guard<std::mutex> lock(m_streamed_geometries_mutex);
+
+		for (const std::pair<int, hiprtGeometry>& streamed_geometry : m_streamed_geometries)
+			HIPRT_CHECK_ERROR(hiprtDestroyGeometry(m_hiprt_scene.hiprt_ctx, streamed_geometry.second));
+		m_streamed_geometries.clear();
+	}
+
+	// The boxes are destroyed with the rest of the BVH by the next build
+	for (int i = m_streamed_meshes_swapped_count; i < m_streamed_meshes.size(); i++)
+		m_hiprt_scene.geometries[m_streamed_meshes[i].first].m_mesh = m_streamed_meshes[i].second;
+	m_streamed_meshes.clear();
+	m_streamed_meshes_swapped_count = 0;
+}
+
+bool GPURenderer::update_progressive_loading()
+{
+	if (m_progressive_loading_scene == nullptr && !m_geometry_streaming)
+		return false;
+
+	std::vector<std::pair<int, hiprtGeometry>> streamed_geometries;
+	{
+		std::lock_guard<std::mutex> lock(m_streamed_geometries_mutex);
+
+		streamed_geometries.swap(m_streamed_geometries);
+	}
+	bool scene_ready = m_progressive_loading_scene != nullptr && m_progressive_loading_scene_ready.exchange(false);
+	if (streamed_geometries.empty() && !scene_ready)
+		return false;
+
+	OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+	// Waiting for the frame in flight that may still be tracing rays
+	// against the BVH or reading the materials
+	synchronize_kernel();
+
+	if (!streamed_geometries.empty())
+	{
+		// The RENDERER_STREAM_GEOMETRIES thread builds the meshes in the order of 'm_streamed_meshes'
+		for (const std::pair<int, hiprtGeometry>& streamed_geometry : streamed_geometries)
+			m_hiprt_scene.replace_geometry(streamed_geometry.first, m_streamed_meshes[m_streamed_meshes_swapped_count++].second, streamed_geometry.second);
+		m_hiprt_scene.rebuild_top_level(m_main_stream);
+
+		if (m_streamed_meshes_swapped_count == m_streamed_meshes.size())
+		{
+			// All the real meshes are in the BVH
+			ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_GEOMETRIES);
+			m_geometry_streaming = false;
+			m_streamed_meshes.clear();
+			m_streamed_meshes_swapped_count = 0;
+
+			m_hiprt_scene.proxy_vertices_positions.free();
+			m_hiprt_scene.proxy_triangles_indices.free();
+			if (m_quantized_vertices_positions)
+				m_hiprt_scene.vertices_positions.free();
+		}
+	}
+
+	if (scene_ready)
+	{
+		ThreadManager::join_threads(ThreadManager::RENDERER_PROGRESSIVE_LOADING);
+
+		const Scene& scene = *m_progressive_loading_scene;
+		upload_scene_materials(scene);
+		upload_scene_textures(scene);
+		upload_scene_emissive_triangles(scene);
+		m_materials = scene.materials;
+		set_material_features(m_materials, /* only_add */ true);
+
+		m_progressive_loading_scene = nullptr;
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Textures, materials & emissive triangles of the scene uploaded");
+	}
+
+	invalidate_render_data_buffers();
+
+	return true;
+}
+
+void GPURenderer::upload_vertex_attributes(const Scene& scene, OrochiStagingUploader& uploader)
+{
+	m_hiprt_scene.mesh_vertex_attributes.resize(m_hiprt_scene.host_mesh_vertex_attributes.size());
+	m_hiprt_scene.mesh_vertex_attributes.upload_data(m_hiprt_scene.host_mesh_vertex_attributes.data());
+
+	// The vertex attributes may have been left in the scene cache file, they are then
+	// read from the file to the staging chunks instead of from the scene
+	const SceneCacheStreamedBuffers& streamed_buffers = scene.streamed_buffers;
+	std::ifstream cache_file;
+	bool success = true;
+	size_t normal_count = scene.vertex_normals.size();
+	size_t texcoords_count = scene.texcoords.size();
+	if (scene.has_streamed_buffers())
+	{
+		cache_file.open(streamed_buffers.cache_filepath, std::ios::binary);
+		success = cache_file.is_open();
+
+		normal_count = streamed_buffers.vertex_normals.element_count;
+		texcoords_count = streamed_buffers.texcoords.element_count;
+	}
+
+	// Reads the source attributes of the chunk being filled, from the scene or from the cache file
+	auto read_attributes = [&scene, &cache_file](const auto& scene_attributes, auto* out_attributes, size_t first_attribute, size_t attribute_count) {
+		if (!scene.has_streamed_buffers())
+		{
+			std::copy(scene_attributes.begin() + first_attribute, scene_attributes.begin() + first_attribute + attribute_count, out_attributes);
+
+			return true;
+		}
+
+		// The chunks are filled in order so the file is read sequentially
+		cache_file.read(reinterpret_cast<char*>(out_attributes), sizeof(*out_attributes) * attribute_count);
+
+		return static_cast<bool>(cache_file);
+	};
+
+	// The vertex normals are always stored octahedral encoded on the device
+	std::vector<float3> normals_chunk;
+	m_hiprt_scene.vertex_normals.resize(normal_count);
+	if (scene.has_streamed_buffers())
+		cache_file.seekg(streamed_buffers.vertex_normals.file_offset);
+	success = success && uploader.upload(m_hiprt_scene.vertex_normals.get_device_pointer(), sizeof(unsigned int) * normal_count, m_main_stream, [&](void* chunk, size_t byte_offset, size_t byte_count) {
+		unsigned int* chunk_normals = static_cast<unsigned int*>(chunk);
+
+		size_t normal_count_in_chunk = byte_count / sizeof(unsigned int);
+		normals_chunk.resize(normal_count_in_chunk);
+		if (!read_attributes(scene.vertex_normals, normals_chunk.data(), byte_offset / sizeof(unsigned int), normal_count_in_chunk))
+			return false;
+
+		for (size_t i = 0; i < normal_count_in_chunk; i++)
+			chunk_normals[i] = octahedral_encode_32(hippt::normalize(normals_chunk[i]));
+
+		return true;
+	});
+
+	if (scene.has_streamed_buffers())
+		cache_file.seekg(streamed_buffers.texcoords.file_offset);
+	if (m_half_precision_texcoords)
+	{
+		std::vector<float2> texcoords_chunk;
+		m_hiprt_scene.texcoords_buffer.free();
+		m_hiprt_scene.texcoords_half_buffer.resize(texcoords_count);
+		success = success && uploader.upload(m_hiprt_scene.texcoords_half_buffer.get_device_pointer(), sizeof(unsigned int) * texcoords_count, m_main_stream, [&](void* chunk, size_t byte_offset, size_t byte_count) {
+			unsigned int* chunk_texcoords = static_cast<unsigned int*>(chunk);
+
+			size_t texcoords_count_in_chunk = byte_count / sizeof(unsigned int);
+			texcoords_chunk.resize(texcoords_count_in_chunk);
+			if (!read_attributes(scene.texcoords, texcoords_chunk.data(), byte_offset / sizeof(unsigned int), texcoords_count_in_chunk))
+				return false;
+
+			for (size_t i = 0; i < texcoords_count_in_chunk; i++)
+				chunk_texcoords[i] = texcoords_half_encode(texcoords_chunk[i]);
+
+			return true;
+		});
+	}
+	else
+	{
+		m_hiprt_scene.texcoords_half_buffer.free();
+		m_hiprt_scene.texcoords_buffer.resize(texcoords_count);
+		if (scene.has_streamed_buffers())
+			success = success && uploader.upload(m_hiprt_scene.texcoords_buffer.get_device_pointer(), cache_file, sizeof(float2) * texcoords_count, m_main_stream);
+		else
+			uploader.upload(m_hiprt_scene.texcoords_buffer.get_device_pointer(), scene.texcoords.data(), sizeof(float2) * texcoords_count, m_main_stream);
+	}
+
+	if (!success)
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not read the vertex attributes of the scene from the scene cache file %s. Delete the file to rebuild the cache.", streamed_buffers.cache_filepath.c_str());
+}
+
+void GPURenderer::set_scene(const Scene& scene)
+{
+	TraceZone trace_zone("Renderer set scene");
+
+	// Before the emissive triangles are uploaded, for the bounds of the light clusters
+	m_scene_bounding_box = scene.scene_bounding_box;
+	set_hiprt_scene_from_scene(scene);
+	m_path_guiding_render_pass.set_scene_bounds(scene.scene_bounding_box);
+	m_radiance_cache_render_pass.set_scene_bounds(scene.scene_bounding_box);
+	m_visibility_cache_render_pass.set_scene_bounds(scene.scene_bounding_box);
+	m_wavefront_path_tracing_render_pass.set_scene_bounds(scene.scene_bounding_box);
+
+	// The materials with their textures are only final once the textures are loaded, see update_progressive_loading()
+	m_materials = m_progressive_loading ? scene.placeholder_materials : scene.materials;
+	m_material_names = scene.material_names;
+	// The placeholder materials have the same parameters, only their textures may enable more features
+	set_material_features(m_materials, /* only_add */ false);
+
+	m_render_data.world_settings.envmap_portals = nullptr;
+	if (!scene.envmap_portals.empty())
+	{
+		m_envmap_portals.resize(static_cast<int>(scene.envmap_portals.size()));
+		m_envmap_portals.upload_data(scene.envmap_portals);
+		m_render_data.world_settings.envmap_portals = m_envmap_portals.get_device_pointer();
+	}
+	m_render_data.world_settings.envmap_portal_count = static_cast<int>(scene.envmap_portals.size());
+}
+
+void GPURenderer::set_envmap(const Image32Bit& envmap_image, const std::string& envmap_filepath)
+{
+	ThreadManager::add_dependency(ThreadManager::RENDERER_SET_ENVMAP, ThreadManager::ENVMAP_LOAD_FROM_DISK_THREAD);
+	ThreadManager::start_thread(ThreadManager::RENDERER_SET_ENVMAP, [this, &envmap_image, &envmap_filepath]() {
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+		if (envmap_image.width == 0 || envmap_image.height == 0)
+		{
+			m_render_data.world_settings.ambient_light_type = AmbientLightType::UNIFORM;
+
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Empty envmap set on the GPURenderer... Defaulting to uniform ambient light type");
+
+			return;
+		}
+
+		m_envmap.init_from_image(this, envmap_image, envmap_filepath);
+		m_envmap.recompute_sampling_data_structure(this, &envmap_image);
+
+		m_render_data.world_settings.envmap = m_envmap.get_orochi_envmap().get_device_envmap();
+		m_render_data.world_settings.envmap_width = m_envmap.get_orochi_envmap().width;
+		m_render_data.world_settings.envmap_height = m_envmap.get_orochi_envmap().height;
+		m_render_data.world_settings.envmap_sampling_width = m_envmap.get_orochi_envmap().get_importance_map_width();
+		m_render_data.world_settings.envmap_sampling_height = m_envmap.get_orochi_envmap().get_importance_map_height();
+		m_render_data.world_settings.envmap_sampling_luminance = m_envmap.get_orochi_envmap().get_importance_map_luminance_device_pointer();
+
+#if EnvmapSamplingStrategy == ESS_BINARY_SEARCH
+		m_render_data.world_settings.envmap_cdf = m_envmap.get_orochi_envmap().get_cdf_device_pointer();
+
+		m_render_data.world_settings.alias_table_probas = nullptr;
+		m_render_data.world_settings.alias_table_alias = nullptr;
+#elif EnvmapSamplingStrategy == ESS_ALIAS_TABLE || EnvmapSamplingStrategy == ESS_PRODUCT_SAMPLING
+		m_render_data.world_settings.envmap_cdf = nullptr;
 
 		m_envmap.get_orochi_envmap().get_alias_table_device_pointers(m_render_data.world_settings.alias_table_probas, m_render_data.world_settings.alias_table_alias);
+		m_render_data.world_settings.alias_table_probas_16bit = m_envmap.get_orochi_envmap().get_alias_table_16bit_probas_device_pointer();
+#if EnvmapSamplingStrategy == ESS_PRODUCT_SAMPLING
+		m_render_data.world_settings.envmap_luminance_pyramid = m_envmap.get_orochi_envmap().get_luminance_pyramid_device_pointer();
+		m_render_data.world_settings.envmap_luminance_pyramid_leaf_level = m_envmap.get_orochi_envmap().get_luminance_pyramid_leaf_level();
+#endif
+#elif EnvmapSamplingStrategy == ESS_MARGINAL_CONDITIONAL
+		m_render_data.world_settings.envmap_cdf = nullptr;
+
+		m_envmap.get_orochi_envmap().get_marginal_conditional_cdf_device_pointers(m_render_data.world_settings.envmap_marginal_cdf, m_render_data.world_settings.envmap_conditional_cdfs);
 #endif
 	});
 }
 
+void GPURenderer::load_envmap_async(const std::string& envmap_filepath)
+{
+	// Only one envmap is prepared at a time, the pending slot is shared
+	ThreadManager::join_threads(ThreadManager::RENDERER_ENVMAP_ASYNC_LOAD);
+
+	ThreadManager::set_priority(ThreadManager::RENDERER_ENVMAP_ASYNC_LOAD, TASK_PRIORITY_BACKGROUND);
+	ThreadManager::start_thread(ThreadManager::RENDERER_ENVMAP_ASYNC_LOAD, [this, envmap_filepath]() {
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+		m_envmap.prepare_pending_envmap(this, envmap_filepath);
+	});
+}
+
+void GPURenderer::load_scene_async(const std::string& scene_filepath)
+{
+	if (m_pending_scene_loading || m_progressive_loading_scene != nullptr || m_geometry_streaming)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "A scene is already loading, %s not loaded.", scene_filepath.c_str());
+
+		return;
+	}
+
+	// The parser falls back to the default scene for files it can't read, not wanted at runtime
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(scene_filepath, error))
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Scene file %s not found.", scene_filepath.c_str());
+
+		return;
+	}
+
+	m_pending_scene_loading = true;
+	m_pending_scene_ready = false;
+	m_pending_scene_importer = std::make_unique<Assimp::Importer>();
+	m_pending_scene = std::make_unique<Scene>();
+
+	// The scene is ready once its textures and emissive triangles are loaded and once it is
+	// written to the scene cache (the cache write reads the scene). These tasks are started
+	// by the parsing so the loading task is started at the end of the parsing task
+	ThreadManager::add_dependency(ThreadManager::RENDERER_SCENE_ASYNC_LOAD, ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY);
+	ThreadManager::add_dependency(ThreadManager::RENDERER_SCENE_ASYNC_LOAD, ThreadManager::SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES);
+	ThreadManager::add_dependency(ThreadManager::RENDERER_SCENE_ASYNC_LOAD, ThreadManager::SCENE_CACHE_WRITE_THREAD_KEY);
+	ThreadManager::set_priority(ThreadManager::RENDERER_SCENE_ASYNC_PARSE, TASK_PRIORITY_BACKGROUND);
+	ThreadManager::set_priority(ThreadManager::RENDERER_SCENE_ASYNC_LOAD, TASK_PRIORITY_BACKGROUND);
+	ThreadManager::start_thread(ThreadManager::RENDERER_SCENE_ASYNC_PARSE, [this, scene_filepath]() {
+		SceneParserOptions options = m_scene_parser_options;
+		options.override_aspect_ratio = m_render_resolution.x / static_cast<float>(m_render_resolution.y);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		SceneParser::parse_scene_file(scene_filepath, *m_pending_scene_importer, *m_pending_scene, options);
+
+		ThreadManager::start_thread(ThreadManager::RENDERER_SCENE_ASYNC_LOAD, [this, start, scene_filepath]() {
+			auto stop = std::chrono::high_resolution_clock::now();
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Scene %s parsed in the background in %ldms", scene_filepath.c_str(), std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+
+			m_pending_scene_ready = true;
+		});
+	});
+}
+
+bool GPURenderer::is_pending_scene_loading() const
+{
+	return m_pending_scene_loading;
+}
+
+void GPURenderer::set_scene_parser_options(const SceneParserOptions& options)
+{
+	m_scene_parser_options = options;
+}
+
+bool GPURenderer::update_pending_scene()
+{
+	if (!m_pending_scene_ready)
+		return false;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	ThreadManager::join_threads(ThreadManager::RENDERER_SCENE_ASYNC_PARSE);
+	ThreadManager::join_threads(ThreadManager::RENDERER_SCENE_ASYNC_LOAD);
+
+	OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctx->orochi_ctx));
+
+	// Waiting for the frame in flight that may still be reading the current scene
+	synchronize_kernel();
+	release_scene();
+
+	// The previous scene can only be freed once the renderer doesn't read it anymore
+	m_owned_scene = std::move(m_pending_scene);
+	m_pending_scene_importer.reset();
+	const Scene& scene = *m_owned_scene;
+
+	// The runtime scenes are fully uploaded before rendering, the progressive loading only applies to the scene set
+	// at startup. The kernels stay compiled for the material features of the previous scene on top of the new ones
+	// so that they're only recompiled if the new scene uses material features that they weren't compiled for
+	m_progressive_loading = false;
+	int previous_material_features = m_material_features;
+	float aspect_ratio = m_render_resolution.x / static_cast<float>(m_render_resolution.y);
+	set_camera(scene.camera);
+	m_camera.set_aspect(aspect_ratio);
+	set_scene(scene);
+	m_material_features |= previous_material_features;
+
+	ThreadManager::join_threads(ThreadManager::RENDERER_BUILD_BVH);
+	ThreadManager::join_threads(ThreadManager::RENDERER_UPLOAD_MATERIALS);
+	ThreadManager::join_threads(ThreadManager::RENDERER_UPLOAD_TEXTURES);
+	ThreadManager::join_threads(ThreadManager::RENDERER_UPLOAD_EMISSIVE_TRIANGLES);
+
+	m_scene_generation++;
+	m_pending_scene_ready = false;
+	m_pending_scene_loading = false;
+	invalidate_render_data_buffers();
+
+	auto stop = std::chrono::high_resolution_clock::now();
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Scene swapped in in %ldms (BVH build and uploads)", std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+
+	return true;
+}
+
+int GPURenderer::get_scene_generation() const
+{
+	return m_scene_generation;
+}
+
+void GPURenderer::release_scene()
+{
+	m_hiprt_scene.release_scene();
+	m_virtual_texture_streamer.free();
+
+	m_triangle_emission_texture_luminances.clear();
+	m_triangle_texture_opacities.clear();
+	m_triangle_material_indices.clear();
+	m_triangle_opacity_micromap_indices.clear();
+	{
+		std::lock_guard<std::mutex> lock(m_geometries_alpha_tested_mutex);
+
+		m_geometries_alpha_tested.clear();
+		m_geometries_alpha_tested_dirty = false;
+	}
+
+	m_emissive_triangles_areas.clear();
+	m_emissive_triangles_material_indices.clear();
+	m_emissive_triangles_texture_luminances.clear();
+	m_emissive_triangles_indices.clear();
+	m_emissive_triangles_instance_indices.clear();
+	m_emissive_triangles_object_vertices.clear();
+	m_emissive_triangles_world_vertices.clear();
+	m_light_bvh_nodes.clear();
+	m_light_bvh_leaf_indices.clear();
+	m_light_clusters = LightClustersData();
+	// Rebuilt for the new scene by internal_update_light_clusters()
+	m_light_clusters_minimum_light_contribution = -1.0f;
+}
+
+void GPURenderer::set_bvh_build_quality(BVHBuildQuality build_quality)
+{
+	m_bvh_build_quality = build_quality;
+}
+
+BVHBuildQuality GPURenderer::get_bvh_build_quality()
+{
+	return m_bvh_build_quality;
+}
+
+void GPURenderer::set_geometry_lod(bool geometry_lod)
+{
+	m_geometry_lod = geometry_lod;
+}
+
+bool GPURenderer::get_geometry_lod() const
+{
+	return m_geometry_lod;
+}
+
+float& GPURenderer::get_geometry_lod_pixel_error()
+{
+	return m_geometry_lod_pixel_error;
+}
+
+float& GPURenderer::get_geometry_lod_secondary_error_factor()
+{
+	return m_geometry_lod_secondary_error_factor;
+}
+
+bool GPURenderer::has_geometry_lods()
+{
+	return m_hiprt_scene.has_geometry_lods();
+}
+
+void GPURenderer::set_half_precision_texcoords(bool half_precision_texcoords)
+{
+	m_half_precision_texcoords = half_precision_texcoords;
+}
+
+void GPURenderer::set_quantized_vertices_positions(bool quantized_vertices_positions)
+{
+	m_quantized_vertices_positions = quantized_vertices_positions;
+}
+
+void GPURenderer::set_compact_bvh(bool compact_bvh)
+{
+	m_compact_bvh = compact_bvh;
+}
+
+void GPURenderer::set_progressive_loading(bool progressive_loading)
+{
+	m_progressive_loading = progressive_loading;
+}
+
+void GPURenderer::rebuild_bvh()
+{
+	TraceZone trace_zone("BVH rebuild");
+
+	// Waiting for the frame in flight that may still be tracing rays against the BVH
+	synchronize_kernel();
+	// The meshes not streamed in yet are built with the rest of the BVH
+	stop_geometry_streaming();
+
+	if (m_quantized_vertices_positions)
+	{
+		// The full precision positions were freed after the first build, dequantizing them again for the build
+		OrochiStagingUploader uploader;
+		upload_bvh_vertices_positions(m_hiprt_scene.quantized_vertices_positions.download_data(), uploader);
+		m_hiprt_scene.set_geometries_vertices();
+	}
+
+	m_hiprt_scene.build_bvh(m_bvh_build_quality, m_main_stream, m_compact_bvh);
+	m_render_data.geom = m_hiprt_scene.scene;
+
+	if (m_quantized_vertices_positions)
+		m_hiprt_scene.vertices_positions.free();
+}
+
+void GPURenderer::upload_bvh_vertices_positions(const std::vector<unsigned short>& quantized_positions, OrochiStagingUploader& uploader)
+{
+	const std::vector<MeshVertexAttributes>& mesh_attributes = m_hiprt_scene.host_mesh_vertex_attributes;
+	int vertex_count = static_cast<int>(quantized_positions.size() / 3);
+
+	std::vector<float3> positions(vertex_count);
+#pragma omp parallel for schedule(dynamic)
+	for (int mesh_index = 0; mesh_index < mesh_attributes.size(); mesh_index++)
+	{
+		int mesh_vertex_end = mesh_index + 1 < mesh_attributes.size() ? mesh_attributes[mesh_index + 1].first_vertex : vertex_count;
+		for (int vertex_index = mesh_attributes[mesh_index].first_vertex; vertex_index < mesh_vertex_end; vertex_index++)
+			positions[vertex_index] = dequantize_vertex_position(mesh_attributes[mesh_index], quantized_positions.data() + vertex_index * 3);
+	}
+
+	m_hiprt_scene.vertices_positions.resize(vertex_count);
+	uploader.upload(m_hiprt_scene.vertices_positions.get_device_pointer(), positions.data(), sizeof(float3) * vertex_count, m_main_stream);
+}
+
+void GPURenderer::update_instance_transforms(const std::vector<float4x4>& object_to_world_matrices)
+{
+	std::vector<SceneInstance>& instances = m_hiprt_scene.host_instances;
+	if (object_to_world_matrices.size() != instances.size())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "%zu instance transforms given to update_instance_transforms() but the scene has %zu instances", object_to_world_matrices.size(), instances.size());
+
+		return;
+	}
+
+	for (int i = 0; i < instances.size(); i++)
+	{
+		glm::mat4x4 object_to_world = *reinterpret_cast<const glm::mat4x4*>(&object_to_world_matrices[i]);
+		glm::mat4x4 normal_to_world = glm::transpose(glm::inverse(object_to_world));
+
+		instances[i].object_to_world = object_to_world_matrices[i];
+		instances[i].normal_to_world = *reinterpret_cast<float4x4*>(&normal_to_world);
+	}
+
+	// Waiting for the frame in flight that may still be tracing rays against the BVH
+	synchronize_kernel();
+
+	m_hiprt_scene.update_instance_transforms(m_main_stream);
+
+	if (m_hiprt_scene.emissive_triangles_count > 0)
+	{
+		// The emissive triangles moved with their instances, the light sampling
+		// structures need to follow
+		std::vector<float3> world_vertices(m_emissive_triangles_object_vertices.size());
+		for (int i = 0; i < m_hiprt_scene.emissive_triangles_count; i++)
+		{
+			const SceneInstance& instance = instances[m_emissive_triangles_instance_indices[i]];
+			for (int vertex = 0; vertex < 3; vertex++)
+				world_vertices[i * 3 + vertex] = matrix_X_point(instance.object_to_world, m_emissive_triangles_object_vertices[i * 3 + vertex]);
+
+			float3 AB = world_vertices[i * 3 + 1] - world_vertices[i * 3 + 0];
+			float3 AC = world_vertices[i * 3 + 2] - world_vertices[i * 3 + 0];
+			m_emissive_triangles_areas[i] = hippt::length(hippt::cross(AB, AC)) * 0.5f;
+		}
+
+		LightBVHBuilder::refit_bounds(m_light_bvh_nodes, m_light_bvh_leaf_indices, world_vertices);
+		m_emissive_triangles_world_vertices = std::move(world_vertices);
+		// The areas may have changed with the scale of the instances. This also
+		// uploads the refit light hierarchy
+		update_emissive_triangles_power(m_materials);
+	}
+
+	// For the new total power of the emissive triangles to be updated in the render data
+	invalidate_render_data_buffers();
+}
+
 bool GPURenderer::has_envmap()
 {
 	return m_render_data.world_settings.envmap_height != 0 && m_render_data.world_settings.envmap_width != 0;
@@ -1046,31 +3528,517 @@ const std::vector<std::string>& GPURenderer::get_material_names()
 
 void GPURenderer::update_materials(std::vector<RendererMaterial>& materials)
 {
+	if (materials.size() != m_materials.size())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "%zu materials given to update_materials() but the scene has %zu materials", materials.size(), m_materials.size());
+
+		return;
+	}
+
+	ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_CREATE);
+
+	bool emission_changed = false;
+	bool alpha_changed = false;
+	bool emissive_triangles_changed = false;
+
+	// Only the ranges of consecutive modified materials are uploaded, queued behind
+	// the frame being rendered (if any) instead of stalling it
+	int material_count = static_cast<int>(materials.size());
+	for (int range_start = 0; range_start < material_count; range_start++)
+	{
+		if (std::memcmp(&materials[range_start], &m_materials[range_start], sizeof(RendererMaterial)) == 0)
+			continue;
+
+		int range_stop = range_start;
+		while (range_stop < material_count && std::memcmp(&materials[range_stop], &m_materials[range_stop], sizeof(RendererMaterial)) != 0)
+		{
+			const RendererMaterial& old_material = m_materials[range_stop];
+			const RendererMaterial& new_material = materials[range_stop];
+
+			ColorRGB32F old_emission = old_material.get_emission();
+			ColorRGB32F new_emission = new_material.get_emission();
+			emission_changed |= old_emission.r != new_emission.r || old_emission.g != new_emission.g || old_emission.b != new_emission.b;
+			// The emission of the materials with an emission texture only depends on their strength
+			emission_changed |= old_material.emission_strength != new_material.emission_strength;
+			alpha_changed |= old_material.alpha_opacity != new_material.alpha_opacity;
+			emissive_triangles_changed |= old_material.is_light_sampled() != new_material.is_light_sampled();
+
+			range_stop++;
+		}
+
+		std::vector<PackedRendererMaterial> packed_materials(range_stop - range_start);
+		for (int i = range_start; i < range_stop; i++)
+			packed_materials[i - range_start] = PackedRendererMaterial::pack(materials[i]);
+		m_hiprt_scene.materials_buffer.upload_data_partial_async(packed_materials.data(), range_start, packed_materials.size(), m_main_stream, m_staging_pool);
+
+		range_start = range_stop;
+	}
+
 	m_materials = materials;
-	m_hiprt_scene.materials_buffer.upload_data(materials.data());
+	set_material_features(m_materials, /* only_add */ true);
+
+	if (emissive_triangles_changed)
+		// Some materials started or stopped being emissive, the emissive triangles that
+		// the lights are sampled from aren't the same anymore
+		rebuild_emissive_triangles(materials);
+	else if (emission_changed)
+		update_emissive_triangles_power(materials, /* async_upload */ true);
+
+	if (alpha_changed)
+		update_triangle_opacities(materials, /* async_upload */ true);
+
+	// For the new total power of the emissive triangles to be updated in the render data
+	invalidate_render_data_buffers();
 }
 
-size_t GPURenderer::get_ray_volume_state_byte_size()
+void GPURenderer::rebuild_emissive_triangles(const std::vector<RendererMaterial>& materials)
+{
+	// Emissive index of the triangles that were already emissive, their object space vertices are known
+	std::unordered_map<int, int> previous_emissive_indices;
+	for (int i = 0; i < m_emissive_triangles_indices.size(); i++)
+		previous_emissive_indices[m_emissive_triangles_indices[i]] = i;
+
+	// The geometry of the scene is only kept on the GPU, it is only downloaded
+	// if some triangles become emissive
+	std::vector<int> triangles_indices;
+	std::vector<float3> vertices_positions;
+	std::vector<unsigned short> quantized_vertices_positions;
+
+	std::vector<int> emissive_triangles_indices;
+	std::vector<int> emissive_triangles_material_indices;
+	std::vector<float> emissive_triangles_texture_luminances;
+	std::vector<int> emissive_triangles_instance_indices;
+	std::vector<float3> emissive_triangles_object_vertices;
+	const std::vector<SceneInstance>& instances = m_hiprt_scene.host_instances;
+	// Looping over the instances in increasing first scene primitive order, the emissive
+	// triangles are sorted as in load_scene_parse_emissive_triangles()
+	for (int instance_index = 0; instance_index < instances.size(); instance_index++)
+	{
+		const SceneInstance& instance = instances[instance_index];
+		for (int mesh_triangle_index = instance.mesh_first_triangle; mesh_triangle_index < instance.mesh_first_triangle + instance.triangle_count; mesh_triangle_index++)
+		{
+			int material_index = m_triangle_material_indices[mesh_triangle_index];
+			if (!materials[material_index].is_light_sampled())
+				continue;
+
+			int scene_primitive_index = get_scene_primitive_index(instance, mesh_triangle_index);
+			emissive_triangles_indices.push_back(scene_primitive_index);
+			emissive_triangles_material_indices.push_back(material_index);
+			emissive_triangles_texture_luminances.push_back(m_triangle_emission_texture_luminances.empty() ? 1.0f : m_triangle_emission_texture_luminances[mesh_triangle_index]);
+			emissive_triangles_instance_indices.push_back(instance_index);
+
+			auto previous_find = previous_emissive_indices.find(scene_primitive_index);
+			if (previous_find != previous_emissive_indices.end())
+			{
+				for (int vertex = 0; vertex < 3; vertex++)
+					emissive_triangles_object_vertices.push_back(m_emissive_triangles_object_vertices[previous_find->second * 3 + vertex]);
+
+				continue;
+			}
+
+			if (triangles_indices.empty())
+			{
+				triangles_indices = m_hiprt_scene.triangles_indices.download_data();
+				if (m_quantized_vertices_positions)
+					quantized_vertices_positions = m_hiprt_scene.quantized_vertices_positions.download_data();
+				else
+					vertices_positions = m_hiprt_scene.vertices_positions.download_data();
+			}
+
+			for (int vertex = 0; vertex < 3; vertex++)
+				emissive_triangles_object_vertices.push_back(get_vertex_position(vertices_positions.data(), m_quantized_vertices_positions ? quantized_vertices_positions.data() : nullptr,
+					m_hiprt_scene.host_mesh_vertex_attributes.data(), instance.mesh_index, triangles_indices[mesh_triangle_index * 3 + vertex]));
+		}
+	}
+
+	int emissive_triangles_count = static_cast<int>(emissive_triangles_indices.size());
+	std::vector<float3> world_vertices(emissive_triangles_count * 3);
+	std::vector<float> emissive_triangles_areas(emissive_triangles_count);
+	std::vector<float> emissive_triangles_power(emissive_triangles_count);
+	for (int i = 0; i < emissive_triangles_count; i++)
+	{
+		const SceneInstance& instance = instances[emissive_triangles_instance_indices[i]];
+		for (int vertex = 0; vertex < 3; vertex++)
+			world_vertices[i * 3 + vertex] = matrix_X_point(instance.object_to_world, emissive_triangles_object_vertices[i * 3 + vertex]);
+
+		float3 AB = world_vertices[i * 3 + 1] - world_vertices[i * 3 + 0];
+		float3 AC = world_vertices[i * 3 + 2] - world_vertices[i * 3 + 0];
+		emissive_triangles_areas[i] = hippt::length(hippt::cross(AB, AC)) * 0.5f;
+		emissive_triangles_power[i] = M_PI * emissive_triangles_areas[i] * materials[emissive_triangles_material_indices[i]].get_emission_power_luminance(emissive_triangles_texture_luminances[i]);
+	}
+
+	m_emissive_triangles_indices = std::move(emissive_triangles_indices);
+	m_emissive_triangles_areas = std::move(emissive_triangles_areas);
+	m_emissive_triangles_material_indices = std::move(emissive_triangles_material_indices);
+	m_emissive_triangles_texture_luminances = std::move(emissive_triangles_texture_luminances);
+	m_emissive_triangles_instance_indices = std::move(emissive_triangles_instance_indices);
+	m_emissive_triangles_object_vertices = std::move(emissive_triangles_object_vertices);
+	LightBVHBuilder::build(m_emissive_triangles_indices, world_vertices, emissive_triangles_power, m_light_bvh_nodes, m_light_bvh_leaf_indices);
+	m_emissive_triangles_world_vertices = std::move(world_vertices);
+
+	// The buffers are resized so the frame in flight must be done with them
+	synchronize_kernel();
+
+	m_hiprt_scene.emissive_triangles_count = emissive_triangles_count;
+	if (emissive_triangles_count == 0)
+	{
+		m_hiprt_scene.emissive_triangles_total_power = 0.0f;
+		// Emptying the light clusters
+		update_light_clusters(std::vector<float>());
+
+		return;
+	}
+
+	m_hiprt_scene.emissive_triangles_indices.resize(emissive_triangles_count);
+	m_hiprt_scene.emissive_triangles_indices.upload_data(m_emissive_triangles_indices.data());
+	m_hiprt_scene.light_bvh_nodes.resize(m_light_bvh_nodes.size());
+	m_hiprt_scene.light_bvh_leaf_indices.resize(m_light_bvh_leaf_indices.size());
+	m_hiprt_scene.light_bvh_leaf_indices.upload_data(m_light_bvh_leaf_indices.data());
+	m_hiprt_scene.emissive_triangles_alias_table_probas.resize(emissive_triangles_count);
+	m_hiprt_scene.emissive_triangles_alias_table_alias.resize(emissive_triangles_count);
+
+	// Builds the alias table and uploads the light hierarchy
+	update_emissive_triangles_power(materials);
+}
+
+std::vector<PackedRendererMaterial> GPURenderer::pack_materials(const std::vector<RendererMaterial>& materials)
+{
+	std::vector<PackedRendererMaterial> packed_materials(materials.size());
+	for (int i = 0; i < materials.size(); i++)
+		packed_materials[i] = PackedRendererMaterial::pack(materials[i]);
+
+	return packed_materials;
+}
+
+void GPURenderer::update_triangle_opacities(const std::vector<RendererMaterial>& materials, bool async_upload)
+{
+	if (m_triangle_material_indices.empty())
+		return;
+
+	std::vector<unsigned char> triangle_opacities = TriangleOpacityClassifier::compute_triangle_opacities(m_triangle_texture_opacities, m_triangle_opacity_micromap_indices, m_triangle_material_indices, materials);
+	if (async_upload)
+		m_hiprt_scene.triangle_opacities.upload_data_async(triangle_opacities.data(), m_main_stream, m_staging_pool);
+	else
+	{
+		m_hiprt_scene.triangle_opacities.resize(triangle_opacities.size());
+		m_hiprt_scene.triangle_opacities.upload_data(triangle_opacities.data());
+	}
+
+	// A mesh only needs the filter function if one of its triangles isn't opaque.
+	// The BVHs of the meshes that changed are rebuilt by internal_update_geometry_types()
+	std::lock_guard<std::mutex> lock(m_geometries_alpha_tested_mutex);
+	m_geometries_alpha_tested.resize(m_hiprt_scene.geometries.size());
+	for (int mesh_index = 0; mesh_index < m_hiprt_scene.geometries.size(); mesh_index++)
+	{
+		const HIPRTGeometry& geometry = m_hiprt_scene.geometries[mesh_index];
+
+		bool alpha_tested = false;
+		for (int triangle_index = geometry.m_first_triangle; triangle_index < geometry.m_first_triangle + geometry.m_triangle_count && !alpha_tested; triangle_index++)
+			alpha_tested = get_triangle_opacity(triangle_opacities.data(), triangle_index) != TRIANGLE_OPACITY_OPAQUE;
+
+		m_geometries_alpha_tested[mesh_index] = alpha_tested;
+	}
+	m_geometries_alpha_tested_dirty = true;
+}
+
+int GPURenderer::get_material_features(const std::vector<RendererMaterial>& materials)
+{
+	int features = 0;
+	for (const RendererMaterial& material : materials)
+		features |= material.get_features();
+
+	return features;
+}
+
+void GPURenderer::set_material_features(const std::vector<RendererMaterial>& materials, bool only_add)
+{
+	int features = GPURenderer::get_material_features(materials);
+	if (only_add)
+		features |= m_material_features;
+
+	m_material_features = features;
+}
+
+void GPURenderer::internal_update_material_features()
+{
+	if (m_material_features == m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::MATERIAL_FEATURES))
+		return;
+
+	// The kernels compiled in the background since the creation of the
+	// renderer must be done reading the options before they change
+	ThreadManager::join_threads(ThreadManager::COMPILE_KERNELS_THREAD_KEY);
+
+	m_global_compiler_options->set_macro_value(GPUKernelCompilerOptions::MATERIAL_FEATURES, m_material_features);
+	recompile_kernels();
+
+	std::string features_string;
+	if (m_material_features & MATERIAL_FEATURE_CLEARCOAT)
+		features_string += " clearcoat";
+	if (m_material_features & MATERIAL_FEATURE_SHEEN)
+		features_string += " sheen";
+	if (m_material_features & MATERIAL_FEATURE_SPECULAR_TRANSMISSION)
+		features_string += " specular-transmission";
+	if (m_material_features & MATERIAL_FEATURE_ANISOTROPY)
+		features_string += " anisotropy";
+	if (features_string.empty())
+		features_string = " none";
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Kernels specialized for the material features of the scene:%s", features_string.c_str());
+}
+
+void GPURenderer::internal_update_geometry_types()
+{
+	// The meshes still replaced by their bounding box are rebuilt once streamed in
+	if (!m_geometries_alpha_tested_dirty || m_geometry_streaming)
+		return;
+
+	std::vector<int> changed_meshes;
+	{
+		std::lock_guard<std::mutex> lock(m_geometries_alpha_tested_mutex);
+		m_geometries_alpha_tested_dirty = false;
+
+		for (int mesh_index = 0; mesh_index < m_geometries_alpha_tested.size(); mesh_index++)
+		{
+			if (m_hiprt_scene.geometries[mesh_index].m_alpha_tested == static_cast<bool>(m_geometries_alpha_tested[mesh_index]))
+				continue;
+
+			m_hiprt_scene.geometries[mesh_index].m_alpha_tested = m_geometries_alpha_tested[mesh_index];
+			changed_meshes.push_back(mesh_index);
+		}
+	}
+
+	if (changed_meshes.empty())
+		return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Waiting for the frame in flight that may still be tracing rays against the BVH
+	synchronize_kernel();
+
+	if (m_quantized_vertices_positions)
+	{
+		// The full precision positions were freed after the first build, dequantizing them again for the build
+		OrochiStagingUploader uploader;
+		upload_bvh_vertices_positions(m_hiprt_scene.quantized_vertices_positions.download_data(), uploader);
+		m_hiprt_scene.set_geometries_vertices();
+	}
+
+	OrochiBuffer<unsigned char> temp_buffer { "BVH build" };
+	for (int mesh_index : changed_meshes)
+	{
+		HIPRTGeometry& geometry = m_hiprt_scene.geometries[mesh_index];
+		if (geometry.m_mesh.triangleCount == 0)
+			continue;
+
+		hiprtGeometry rebuilt_geometry = m_hiprt_scene.build_geometry(geometry.m_mesh, geometry.m_alpha_tested, m_bvh_build_quality, m_main_stream, temp_buffer, m_compact_bvh);
+		m_hiprt_scene.replace_geometry(mesh_index, geometry.m_mesh, rebuilt_geometry);
+
+		// The LODs of the mesh have the same alpha test as the mesh
+		for (int lod_index : m_hiprt_scene.mesh_lod_indices[mesh_index])
+		{
+			HIPRTGeometry& lod_geometry = m_hiprt_scene.lod_geometries[lod_index].geometry;
+			lod_geometry.m_alpha_tested = geometry.m_alpha_tested;
+
+			hiprtGeometry rebuilt_lod_geometry = m_hiprt_scene.build_geometry(lod_geometry.m_mesh, lod_geometry.m_alpha_tested, m_bvh_build_quality, m_main_stream, temp_buffer, m_compact_bvh);
+			m_hiprt_scene.replace_lod_geometry(lod_index, rebuilt_lod_geometry);
+		}
+	}
+	m_hiprt_scene.rebuild_top_level(m_main_stream);
+
+	if (m_quantized_vertices_positions)
+		m_hiprt_scene.vertices_positions.free();
+
+	auto stop = std::chrono::high_resolution_clock::now();
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Geometry type of %zu meshes updated for the alpha test in %ldms", changed_meshes.size(), std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count());
+}
+
+void GPURenderer::internal_update_geometry_lods()
 {
-	OrochiBuffer<size_t> out_size_buffer(1);
-	size_t* out_size_buffer_pointer = out_size_buffer.get_device_pointer();
+	if (!m_hiprt_scene.has_geometry_lods())
+		return;
 
-	ThreadManager::join_threads(ThreadManager::COMPILE_RAY_VOLUME_STATE_SIZE_KERNEL_KEY);
+	// Focal length in pixels: a length 'l' at a distance 'd' of the camera covers 'l / d * focal' pixels
+	float focal_length_pixels = m_render_resolution.y / (2.0f * std::tan(m_camera.vertical_fov * 0.5f));
+	float3 camera_position = make_float3(m_camera.translation.x, m_camera.translation.y, m_camera.translation.z);
 
-	void* launch_args[] = { &out_size_buffer_pointer };
-	m_ray_volume_state_byte_size_kernel.launch(1, 1, 1, 1, launch_args, 0);
-	oroStreamSynchronize(0);
+	std::vector<int> primary_lods(m_hiprt_scene.host_instances.size(), 0);
+	std::vector<int> secondary_lods(m_hiprt_scene.host_instances.size(), 0);
+	if (m_geometry_lod)
+	{
+		for (int instance_index = 0; instance_index < m_hiprt_scene.host_instances.size(); instance_index++)
+		{
+			const SceneInstance& instance = m_hiprt_scene.host_instances[instance_index];
+			const std::vector<int>& lod_indices = m_hiprt_scene.mesh_lod_indices[instance.mesh_index];
+			if (lod_indices.empty())
+				continue;
+
+			// Bounding sphere of the instance from the quantization box of its mesh
+			const MeshVertexAttributes& mesh_attributes = m_hiprt_scene.host_mesh_vertex_attributes[instance.mesh_index];
+			float3 mesh_extent = mesh_attributes.position_step * 65535.0f;
+			float instance_scale = 0.0f;
+			for (int i = 0; i < 3; i++)
+				instance_scale = hippt::max(instance_scale, hippt::length(make_float3(instance.object_to_world.m[i][0], instance.object_to_world.m[i][1], instance.object_to_world.m[i][2])));
+
+			float3 center = matrix_X_point(instance.object_to_world, mesh_attributes.position_min + mesh_extent * 0.5f);
+			float radius = hippt::length(mesh_extent) * 0.5f * instance_scale;
+			// The camera inside the bounding sphere always sees the full mesh
+			float distance = hippt::length(center - camera_position) - radius;
+			if (distance <= 0.0f)
+				continue;
+
+			float pixels_per_unit = focal_length_pixels / distance * instance_scale;
+			for (int lod_index : lod_indices)
+			{
+				const HIPRTGeometryLOD& lod = m_hiprt_scene.lod_geometries[lod_index];
+				float projected_error = lod.error * pixels_per_unit;
 
-	return out_size_buffer.download_data()[0];
+				if (projected_error <= m_geometry_lod_pixel_error)
+					primary_lods[instance_index] = lod.level;
+				if (projected_error <= m_geometry_lod_pixel_error * m_geometry_lod_secondary_error_factor)
+					secondary_lods[instance_index] = lod.level;
+			}
+		}
+	}
+
+	if (!m_hiprt_scene.set_instance_lods(primary_lods, secondary_lods))
+		return;
+
+	// Waiting for the frame in flight that may still be tracing rays against the BVH
+	synchronize_kernel();
+	m_hiprt_scene.rebuild_top_level(m_main_stream);
+}
+
+void GPURenderer::update_emissive_triangles_power(const std::vector<RendererMaterial>& materials, bool async_upload)
+{
+	if (m_hiprt_scene.emissive_triangles_count == 0)
+		return;
+
+	std::vector<float> emissive_triangles_power(m_hiprt_scene.emissive_triangles_count);
+	for (int i = 0; i < m_hiprt_scene.emissive_triangles_count; i++)
+		emissive_triangles_power[i] = m_emissive_triangles_areas[i] * materials[m_emissive_triangles_material_indices[i]].get_emission_power_luminance(m_emissive_triangles_texture_luminances[i]);
+
+	std::vector<float> alias_table_probas;
+	std::vector<int> alias_table_alias;
+	Utils::compute_alias_table(emissive_triangles_power, alias_table_probas, alias_table_alias, &m_hiprt_scene.emissive_triangles_total_power);
+	if (async_upload)
+	{
+		m_hiprt_scene.emissive_triangles_alias_table_probas.upload_data_async(alias_table_probas.data(), m_main_stream, m_staging_pool);
+		m_hiprt_scene.emissive_triangles_alias_table_alias.upload_data_async(alias_table_alias.data(), m_main_stream, m_staging_pool);
+	}
+	else
+	{
+		m_hiprt_scene.emissive_triangles_alias_table_probas.upload_data(alias_table_probas.data());
+		m_hiprt_scene.emissive_triangles_alias_table_alias.upload_data(alias_table_alias.data());
+	}
+
+	update_light_clusters(emissive_triangles_power);
+
+	// The power of the nodes of the light hierarchy is the radiant flux of
+	// the diffuse emitters, hence the additional PI
+	for (float& power : emissive_triangles_power)
+		power *= M_PI;
+	LightBVHBuilder::refit_power(m_light_bvh_nodes, m_light_bvh_leaf_indices, emissive_triangles_power);
+	if (async_upload)
+		m_hiprt_scene.light_bvh_nodes.upload_data_async(m_light_bvh_nodes.data(), m_main_stream, m_staging_pool);
+	else
+		m_hiprt_scene.light_bvh_nodes.upload_data(m_light_bvh_nodes.data());
+}
+
+void GPURenderer::update_light_clusters(const std::vector<float>& emissive_triangles_power)
+{
+	bool uses_light_clusters = m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::EMISSIVE_TRIANGLES_SAMPLING_STRATEGY) == ETSS_LIGHT_CLUSTERS;
+	if (!uses_light_clusters && m_light_clusters_minimum_light_contribution == -1.0f)
+		// Not built, nothing to free
+		return;
+
+	// The buffers are resized / freed so the frame in flight must be done with them
+	synchronize_kernel();
+
+	if (uses_light_clusters)
+	{
+		float minimum_light_contribution = m_render_data.render_settings.minimum_light_contribution;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		LightClustersBuilder::build(m_emissive_triangles_indices, m_emissive_triangles_world_vertices, emissive_triangles_power, m_scene_bounding_box, minimum_light_contribution, m_hiprt_scene.light_clusters, m_light_clusters);
+		auto stop = std::chrono::high_resolution_clock::now();
+
+		m_light_clusters_minimum_light_contribution = minimum_light_contribution;
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Light clusters built in %ldms (%zu light references)", std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count(), m_light_clusters.cells_emissive_triangles.size());
+	}
+	else
+	{
+		m_light_clusters = LightClustersData();
+		m_hiprt_scene.light_clusters.grid_resolution = 0;
+		m_light_clusters_minimum_light_contribution = -1.0f;
+	}
+
+	if (m_hiprt_scene.light_clusters.grid_resolution > 0)
+	{
+		m_hiprt_scene.light_clusters_cells_offsets.resize(m_light_clusters.cells_offsets.size());
+		m_hiprt_scene.light_clusters_cells_offsets.upload_data(m_light_clusters.cells_offsets.data());
+		m_hiprt_scene.light_clusters_cells_total_power.resize(m_light_clusters.cells_total_power.size());
+		m_hiprt_scene.light_clusters_cells_total_power.upload_data(m_light_clusters.cells_total_power.data());
+	}
+	else
+	{
+		m_hiprt_scene.light_clusters_cells_offsets.free();
+		m_hiprt_scene.light_clusters_cells_total_power.free();
+	}
+
+	if (!m_light_clusters.cells_emissive_triangles.empty())
+	{
+		m_hiprt_scene.light_clusters_cells_emissive_triangles.resize(m_light_clusters.cells_emissive_triangles.size());
+		m_hiprt_scene.light_clusters_cells_emissive_triangles.upload_data(m_light_clusters.cells_emissive_triangles.data());
+		m_hiprt_scene.light_clusters_cells_alias_table_probas.resize(m_light_clusters.cells_alias_table_probas.size());
+		m_hiprt_scene.light_clusters_cells_alias_table_probas.upload_data(m_light_clusters.cells_alias_table_probas.data());
+		m_hiprt_scene.light_clusters_cells_alias_table_alias.resize(m_light_clusters.cells_alias_table_alias.size());
+		m_hiprt_scene.light_clusters_cells_alias_table_alias.upload_data(m_light_clusters.cells_alias_table_alias.data());
+	}
+	else
+	{
+		m_hiprt_scene.light_clusters_cells_emissive_triangles.free();
+		m_hiprt_scene.light_clusters_cells_alias_table_probas.free();
+		m_hiprt_scene.light_clusters_cells_alias_table_alias.free();
+	}
+
+	invalidate_render_data_buffers();
+}
+
+void GPURenderer::internal_update_light_clusters()
+{
+	bool uses_light_clusters = m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::EMISSIVE_TRIANGLES_SAMPLING_STRATEGY) == ETSS_LIGHT_CLUSTERS;
+	if (uses_light_clusters == (m_light_clusters_minimum_light_contribution != -1.0f)
+		&& (!uses_light_clusters || m_light_clusters_minimum_light_contribution == m_render_data.render_settings.minimum_light_contribution))
+		// Up to date
+		return;
+
+	if (m_hiprt_scene.emissive_triangles_count == 0)
+		return;
+
+	std::vector<float> emissive_triangles_power(m_hiprt_scene.emissive_triangles_count);
+	for (int i = 0; i < m_hiprt_scene.emissive_triangles_count; i++)
+		emissive_triangles_power[i] = m_emissive_triangles_areas[i] * m_materials[m_emissive_triangles_material_indices[i]].get_emission_power_luminance(m_emissive_triangles_texture_luminances[i]);
+
+	update_light_clusters(emissive_triangles_power);
+}
+
+size_t GPURenderer::get_ray_volume_state_byte_size()
+{
+	return get_stored_ray_volume_state_byte_size(m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::INTERIOR_STACK_STRATEGY),
+		m_global_compiler_options->get_macro_value(GPUKernelCompilerOptions::NESTED_DIELETRCICS_STACK_SIZE_OPTION));
 }
 
 void GPURenderer::resize_g_buffer_ray_volume_states()
 {
 	synchronize_kernel();
 
-	m_g_buffer.ray_volume_states.resize(m_render_resolution.x * m_render_resolution.y, get_ray_volume_state_byte_size());
+	size_t ray_volume_state_byte_size = get_ray_volume_state_byte_size();
+
+	m_g_buffer.ray_volume_states.resize(m_render_resolution.x * m_render_resolution.y, ray_volume_state_byte_size);
 	if (m_render_data.render_settings.use_prev_frame_g_buffer())
-		m_g_buffer_prev_frame.ray_volume_states.resize(m_render_resolution.x * m_render_resolution.y, get_ray_volume_state_byte_size());
+		m_g_buffer_prev_frame.ray_volume_states.resize(m_render_resolution.x * m_render_resolution.y, ray_volume_state_byte_size);
+	m_wavefront_path_tracing_render_pass.resize_ray_volume_states();
+	m_render_graph.compile();
 
 	m_render_data_buffers_invalidated = true;
 }
@@ -1085,11 +4053,83 @@ RendererEnvmap& GPURenderer::get_envmap()
 	return m_envmap;
 }
 
+RenderGraph& GPURenderer::get_render_graph()
+{
+	return m_render_graph;
+}
+
+PathGuidingRenderPass& GPURenderer::get_path_guiding_render_pass()
+{
+	return m_path_guiding_render_pass;
+}
+
+RadianceCacheRenderPass& GPURenderer::get_radiance_cache_render_pass()
+{
+	return m_radiance_cache_render_pass;
+}
+
+VisibilityCacheRenderPass& GPURenderer::get_visibility_cache_render_pass()
+{
+	return m_visibility_cache_render_pass;
+}
+
 void GPURenderer::set_camera(const Camera& camera)
 {
 	m_camera = camera;
 }
 
+void GPURenderer::set_views(const std::vector<Camera>& cameras)
+{
+	const HIPRTRenderSettings& render_settings = m_render_data.render_settings;
+	bool uses_temporal_passes = render_settings.restir_di_settings.temporal_pass.do_temporal_reuse_pass || render_settings.restir_gi_settings.temporal_pass.do_temporal_reuse_pass
+		|| render_settings.enable_temporal_reprojection || render_settings.use_temporal_upscaling;
+	if (cameras.size() > 1 && uses_temporal_passes)
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "The temporal passes are disabled while several views are rendered.");
+
+	m_views = cameras.size() > 1 ? cameras : std::vector<Camera>();
+}
+
+int GPURenderer::get_view_count() const
+{
+	return m_views.empty() ? 1 : static_cast<int>(m_views.size());
+}
+
+void GPURenderer::set_material_previews(int target_material_index, const std::vector<RendererMaterial>& preview_materials)
+{
+	if (!preview_materials.empty() && (target_material_index < 0 || target_material_index >= static_cast<int>(m_materials.size())))
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Material %d given to set_material_previews() but the scene has %zu materials", target_material_index, m_materials.size());
+
+		return;
+	}
+
+	// The materials buffer is reallocated
+	synchronize_kernel();
+
+	std::vector<RendererMaterial> materials = m_materials;
+	materials.insert(materials.end(), preview_materials.begin(), preview_materials.end());
+	std::vector<PackedRendererMaterial> packed_materials = GPURenderer::pack_materials(materials);
+	m_hiprt_scene.materials_buffer.resize(packed_materials.size());
+	m_hiprt_scene.materials_buffer.upload_data(packed_materials.data());
+
+	if (preview_materials.empty())
+	{
+		m_render_data.material_preview_target_index = -1;
+		set_views({});
+	}
+	else
+	{
+		m_render_data.material_preview_target_index = target_material_index;
+		m_render_data.material_preview_first_index = static_cast<int>(m_materials.size());
+		set_views(std::vector<Camera>(preview_materials.size(), m_camera));
+
+		// For the kernels to be compiled with the features of the preview materials
+		set_material_features(preview_materials, /* only_add */ true);
+	}
+
+	invalidate_render_data_buffers();
+}
+
 void GPURenderer::translate_camera_view(glm::vec3 translation)
 {
 	m_camera.translate(translation);
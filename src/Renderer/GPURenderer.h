@@ -11,19 +11,39 @@
 #include "HIPRT-Orochi/OrochiBuffer.h"
 #include "HIPRT-Orochi/HIPRTScene.h"
 #include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "HIPRT-Orochi/OrochiKernelGraph.h"
+#include "HIPRT-Orochi/OrochiStagingUploader.h"
+#include "HIPRT-Orochi/OrochiStreamScheduler.h"
+#include "HIPRT-Orochi/OrochiTimestampRing.h"
 #include "HostDeviceCommon/RenderData.h"
 #include "Renderer/RendererEnvmap.h"
 #include "Renderer/GPURendererGBuffer.h"
 #include "Renderer/HardwareAccelerationSupport.h"
+#include "Renderer/LightClustersBuilder.h"
 #include "Renderer/OpenImageDenoiser.h"
+#include "Renderer/RenderCheckpoint.h"
+#include "Renderer/RenderLayersDownload.h"
 #include "Renderer/StatusBuffersValues.h"
+#include "Renderer/VirtualTextureStreamer.h"
+#include "Renderer/RenderPasses/RenderGraph.h"
 #include "Renderer/RenderPasses/ReSTIRDIRenderPass.h"
+#include "Renderer/RenderPasses/PathGuidingRenderPass.h"
+#include "Renderer/RenderPasses/RadianceCacheRenderPass.h"
+#include "Renderer/RenderPasses/ReSTIRGIRenderPass.h"
+#include "Renderer/RenderPasses/VisibilityCacheRenderPass.h"
+#include "Renderer/RenderPasses/WavefrontPathTracingRenderPass.h"
 #include "Scene/Camera.h"
 #include "Scene/SceneParser.h"
 #include "UI/ApplicationSettings.h"
 #include "UI/PerformanceMetricsComputer.h"
 
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 template <typename T>
@@ -37,8 +57,15 @@ public:
 	 * or in the 'm_render_pass_times' map
 	 */
 	static const std::string CAMERA_RAYS_KERNEL_ID;
+	static const std::string ACTIVE_PIXEL_COMPACTION_KERNEL_ID;
 	static const std::string PATH_TRACING_KERNEL_ID;
-	static const std::string RAY_VOLUME_STATE_SIZE_KERNEL_ID;
+	static const std::string PATH_TRACING_PERSISTENT_KERNEL_ID;
+	static const std::string ADAPTIVE_SAMPLING_TILE_ERROR_KERNEL_ID;
+	static const std::string TEMPORAL_REPROJECTION_KERNEL_ID;
+	static const std::string TEMPORAL_UPSCALING_KERNEL_ID;
+	static const std::string TEMPORAL_UPSCALING_RESOLVE_KERNEL_ID;
+	static const std::string UNPACK_DENOISER_AOVS_KERNEL_ID;
+	static const std::string DENOISER_AOVS_RESOLVE_KERNEL_ID;
 
 	/**
 	 * This map contains constants that are the name of the main function of the kernels, their entry points.
@@ -61,11 +88,25 @@ public:
 	// This key is for the time of the whole frame
 	static const std::string FULL_FRAME_TIME_KEY;
 
+	// Keys for the performance metrics of the last build of the BVH of the scene.
+	// Time in milliseconds and memory in megabytes
+	static const std::string BVH_BUILD_TIME_KEY;
+	static const std::string BVH_MEMORY_KEY;
+
+	// How many frames can be queued by render() before the oldest one is waited for
+	static constexpr int MAX_QUEUED_FRAME_COUNT = 4;
+
 	/**
 	 * Constructs a renderer that will be using the given HIPRT/Orochi
 	 * context for handling GPU acceleration structures, buffers, textures, etc...
+	 * 
+	 * If 'headless' is true, the renderer doesn't create any OpenGL interop buffer and
+	 * renders into plain GPU buffers instead. No OpenGL context (and so no display server)
+	 * is needed in that mode. The getters of the interop buffers (get_color_framebuffer(), ...)
+	 * return nullptr in headless mode, use download_framebuffer() to read the render instead
 	 */
-	GPURenderer(std::shared_ptr<HIPRTOrochiCtx> hiprt_oro_ctx);
+	GPURenderer(std::shared_ptr<HIPRTOrochiCtx> hiprt_oro_ctx, bool headless = false);
+	~GPURenderer();
 
 	/**
 	 * Initializes and compiles the kernels
@@ -91,16 +132,68 @@ public:
 	 * Returns true if one of the kernels requires the global stack buffer for BVH traversal
 	 */
 	bool needs_global_bvh_stack_buffer();
+	/**
+	 * Number of stacks of the global stack buffer for BVH traversal: one per pixel of the render
+	 * resolution (rounded up to the 8x8 blocks of the kernels) or, if the kernels are compiled with
+	 * DynamicBVHTraversalStack, one per thread that can be resident on the GPU at the same time
+	 */
+	unsigned int get_global_stack_buffer_stack_count();
 
 	/**
 	 * Renders a frame asynchronously. 
 	 * Querry frame_render_done() to know whether or not the frame has completed or not.
+	 * 
+	 * The frame is queued behind the frames that may still be rendering, see get_queued_frame_count().
+	 * update() and render() can be called from a thread other than the main thread, the buffers
+	 * shared with OpenGL must then already be mapped (map_buffers_for_render() on the main thread)
 	 */
 	void render();
 
+	void launch_light_presampling();
 	void launch_camera_rays();
 	void launch_ReSTIR_DI();
+	/**
+	 * Launches the FullPathTracer megakernel or the wavefront
+	 * path tracer depending on render_settings.use_wavefront_path_tracing
+	 */
 	void launch_path_tracing();
+	/**
+	 * Launches the ReSTIR GI passes if IndirectLightSamplingStrategy is ILS_RESTIR_GI.
+	 * Must be launched after the path tracer, that outputs the initial candidates
+	 */
+	void launch_ReSTIR_GI();
+	/**
+	 * Launches the AdaptiveSamplingTileError kernel if the tile
+	 * based adaptive sampling is enabled. Must be launched after the passes
+	 * that accumulate the samples in the framebuffer
+	 */
+	void launch_adaptive_sampling_tile_error();
+	/**
+	 * Launches the TemporalReprojection kernel on the first sample after a reset
+	 * if the temporal reprojection is enabled and there is a history to reproject
+	 */
+	void launch_temporal_reprojection();
+	/**
+	 * Upscales the low resolution frame to the full resolution framebuffer with the TemporalUpscaling
+	 * kernels if the temporal upscaling is used. Launched after the last sample of the frame
+	 */
+	void launch_temporal_upscaling();
+	/**
+	 * Rebuilds the path guiding distributions after the last sample of a training frame
+	 */
+	void launch_path_guiding_build();
+	/**
+	 * Averages the samples of the training paths of the frame in the radiance cache after the last sample of the frame
+	 */
+	void launch_radiance_cache_resolve();
+	/**
+	 * Accumulates the denoiser AOVs from the G-buffer of the camera rays, see DenoiserAOVsFromGBuffer
+	 */
+	void launch_denoiser_AOVs_resolve();
+	/**
+	 * Expands the packed denoiser AOVs into the float AOV buffers after the last sample of the frame, see PackedDenoiserAOVs
+	 */
+	void launch_unpack_denoiser_AOVs();
 
 	/**
 	 * Blocking that waits for all the operations queued on
@@ -114,11 +207,26 @@ public:
 	 * Returns true if the frame is completed
 	 */
 	bool frame_render_done();
+	/**
+	 * Returns how many of the frames queued by render() haven't been rendered by the GPU yet.
+	 * Doesn't wait for the GPU: the status buffers of the frames that are done are read
+	 * in the process (see get_status_buffer_values())
+	 */
+	int get_queued_frame_count();
 	/**
 	 * Returns true if the last frame was rendered with render_settings.wants_render_low_resolution = true.
 	 * False otherwise
 	 */
 	bool was_last_frame_low_resolution();
+	/**
+	 * Whether the last frame was rendered at low resolution and upscaled
+	 * to the full resolution framebuffer by the temporal upscaling
+	 */
+	bool was_last_frame_upscaled();
+	/**
+	 * render_settings.render_low_resolution_scaling of the last frame
+	 */
+	int get_last_frame_low_resolution_scaling();
 
 	/**
 	 * Resizes all the buffers of the renderer to the given new width and height
@@ -146,15 +254,93 @@ public:
 
 	/**
 	 * Unmap the color framebuffer, the denoiser albedo and the
-	 * denoiser normals buffers so that OpenGL can use them
+	 * denoiser normals buffers so that OpenGL can use them.
+	 * 
+	 * When rendering into the device render buffers (see set_use_device_render_buffers()),
+	 * the frames rendered since the last call are first copied into the interop buffers
 	 */
 	void unmap_buffers();
 
+	/**
+	 * If true, the frames are accumulated into plain GPU buffers (the same as the headless
+	 * renderers) instead of the buffers shared with OpenGL. These are then only mapped to copy
+	 * the render into them when the frame is displayed, in unmap_buffers(), instead of around
+	 * every frame.
+	 * 
+	 * Applied on the next map_buffers_for_render()
+	 */
+	void set_use_device_render_buffers(bool use_device_render_buffers);
+	bool get_use_device_render_buffers() const;
+	/**
+	 * Whether the frames are currently rendered into the device render buffers:
+	 * headless renderers or set_use_device_render_buffers(true)
+	 */
+	bool renders_into_device_buffers() const;
+
 	std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> get_color_framebuffer();
 	std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> get_denoised_framebuffer();
 	std::shared_ptr<OpenGLInteropBuffer<float3>> get_denoiser_normals_AOV_buffer();
 	std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> get_denoiser_albedo_AOV_buffer();
 	std::shared_ptr<OpenGLInteropBuffer<int>>& get_pixels_converged_sample_count_buffer();
+	/**
+	 * Clock cycles spent by each pixel in the kernels, see 'aux_buffers.pixel_costs'.
+	 * Only allocated when the kernels are compiled with PixelCostInstrumentation, see uses_pixel_cost_instrumentation()
+	 */
+	std::shared_ptr<OpenGLInteropBuffer<float4>> get_pixel_costs_buffer();
+	/**
+	 * Whether or not the kernels are compiled with PixelCostInstrumentation. Always false for headless renderers,
+	 * the pixel costs are only displayed in the viewport
+	 */
+	bool uses_pixel_cost_instrumentation();
+	/**
+	 * Returns the current render (the accumulated samples divided by the sample count)
+	 * as a 3-channel image.
+	 * 
+	 * Only available for headless renderers, returns an empty image otherwise
+	 */
+	Image32Bit download_framebuffer();
+	/**
+	 * Returns the number of samples accumulated in each pixel of the render, row major. Less than the sample
+	 * number in the pixels that adaptive sampling stopped, the sample number everywhere without adaptive sampling.
+	 *
+	 * Only available for headless renderers, returns an empty vector otherwise
+	 */
+	std::vector<int> download_pixel_sample_counts();
+	/**
+	 * Device pointers of the buffers the frames are accumulated into, for reading the render on the GPU
+	 * without any download (see EmbeddedRenderer). The framebuffer holds the sum of the samples, the
+	 * AOVs are already averaged. The frames are rendered on get_main_stream(): the buffers are only
+	 * complete once the work queued on that stream is done.
+	 *
+	 * nullptr if the frames aren't rendered into the device render buffers, see renders_into_device_buffers()
+	 */
+	ColorRGB32F* get_device_framebuffer();
+	float3* get_device_normals_AOV_buffer();
+	ColorRGB32F* get_device_albedo_AOV_buffer();
+	/**
+	 * Queues on the main stream the download of the beauty, the AOVs, the pixel sample counts and,
+	 * if 'include_denoised' is true, the denoised framebuffer. Doesn't wait for the GPU, the
+	 * downloads start once the frames already queued are done, see RenderLayersDownload::is_done()
+	 */
+	RenderLayersDownload download_render_layers_async(bool include_denoised);
+	/**
+	 * Queues on the main stream the download of the accumulation state of the render: the accumulated
+	 * samples, the adaptive sampling buffers and the reservoirs of the temporal reuse of ReSTIR.
+	 * Doesn't wait for the GPU, see RenderCheckpointDownload::wait().
+	 *
+	 * Only available for headless renderers, returns an empty download otherwise
+	 */
+	RenderCheckpointDownload download_checkpoint_async();
+	/**
+	 * Resumes the render from 'checkpoint'. Must be called after reset(): the buffers are restored
+	 * by the next update(), once they are allocated for the current settings, and that frame then
+	 * continues the accumulation as if the render had never stopped.
+	 *
+	 * Returns false, and the render starts from scratch, if the checkpoint doesn't match the
+	 * resolution of the render. Only available for headless renderers
+	 */
+	bool load_checkpoint(const RenderCheckpoint& checkpoint);
+	bool is_headless() const;
 	/**
 	 * Returns a structure that contains the values of
 	 * various one-variable buffers of the renderer such
@@ -162,46 +348,211 @@ public:
 	 */
 	const StatusBuffersValues& get_status_buffer_values() const;
 	/**
-	 * Memcpy the values of the status buffers to m_status_buffer_values
+	 * Copies the values of the status buffers to m_status_buffer_values.
+	 * 
+	 * The status buffers are downloaded asynchronously at the end of each frame by render()
+	 * so this function only waits for the downloads of the queued frames, which are done if the frames are
 	 */
 	void copy_status_buffers();
 
 	HIPRTRenderSettings& get_render_settings();
 	WorldSettings& get_world_settings();
 	HIPRTRenderData& get_render_data();
+	/**
+	 * Arguments of a launch of 'kernel' with the current render data, for the kernels whose
+	 * parameters are the render data and the render resolution.
+	 * 
+	 * If 'kernel' is compiled with UseDeviceResidentRenderData, the render data is uploaded to
+	 * m_device_render_data if it changed since the last upload (the per-sample fields excepted)
+	 * and the arguments are the pointer to that buffer and the per-sample fields.
+	 * 
+	 * The returned arguments are valid until the next call
+	 */
+	void** get_render_data_launch_args(const GPUKernel& kernel);
 	HIPRTScene& get_hiprt_scene();
 	void invalidate_render_data_buffers();
+	/**
+	 * Intersection / filter functions of the geometry types of the BVH, for compiling the kernels that trace rays
+	 */
+	const std::vector<hiprtFuncNameSet>& get_func_name_sets() const;
 
 	Camera& get_camera();
 	RendererEnvmap& get_envmap();
+	/**
+	 * Transient buffers of the render passes, see RenderGraph
+	 */
+	RenderGraph& get_render_graph();
+	PathGuidingRenderPass& get_path_guiding_render_pass();
+	RadianceCacheRenderPass& get_radiance_cache_render_pass();
+	VisibilityCacheRenderPass& get_visibility_cache_render_pass();
 
 	void set_scene(const Scene& scene);
+	/**
+	 * The build quality must be set before calling set_scene() for it
+	 * to be used when building the BVH of the scene
+	 */
+	void set_bvh_build_quality(BVHBuildQuality build_quality);
+	BVHBuildQuality get_bvh_build_quality();
+	/**
+	 * If true, the rays are traced against the levels of detail of the meshes (see Scene::mesh_lods)
+	 * instead of the full meshes where the difference isn't visible: each instance is seen by the primary
+	 * rays with its coarsest LOD whose error projected on the screen is below get_geometry_lod_pixel_error()
+	 * pixels and by the secondary rays (see HIPRTRenderSettings::geometry_lod_secondary_bounce) with its
+	 * coarsest LOD below that error times get_geometry_lod_secondary_error_factor().
+	 *
+	 * The levels are selected again at each update() from the position of the camera. No effect if
+	 * the scene was parsed without LODs or if it was loaded with the progressive loading
+	 */
+	void set_geometry_lod(bool geometry_lod);
+	bool get_geometry_lod() const;
+	float& get_geometry_lod_pixel_error();
+	float& get_geometry_lod_secondary_error_factor();
+	/**
+	 * Whether the BVH of the scene has LODs that set_geometry_lod() can use
+	 */
+	bool has_geometry_lods();
+	/**
+	 * If true, the texture coordinates of the scene are stored as half floats on the device instead
+	 * of floats. Half the memory but the precision is too coarse for textures larger than ~2048 texels
+	 * or for heavily tiled texture coordinates. Must be set before calling set_scene()
+	 */
+	void set_half_precision_texcoords(bool half_precision_texcoords);
+	/**
+	 * If true, the shaders read the positions of the vertices quantized on 16 bits per axis relative to the
+	 * bounding box of their mesh. The BVH is built from these quantized positions and the full precision positions
+	 * only exist on the device during BVH builds. Must be set before calling set_scene()
+	 */
+	void set_quantized_vertices_positions(bool quantized_vertices_positions);
+	/**
+	 * If true, the BVHs of the meshes are compacted after being built and the temporary build memory is
+	 * released, see HIPRTScene::build_bvh(). Must be set before calling set_scene() or rebuild_bvh()
+	 */
+	void set_compact_bvh(bool compact_bvh);
+	/**
+	 * If true, set_scene() only makes the scene renderable as fast as possible and the rest of the scene
+	 * is brought in while it's being rendered, by update_progressive_loading():
+	 *	- The meshes with at least PROGRESSIVE_LOADING_MIN_STREAMED_TRIANGLES triangles are first replaced
+	 *	  by their bounding box in the BVH. Their BVHs are then built one by one in the background and
+	 *	  swapped in as they're ready
+	 *	- The scene is first rendered with its materials without textures and without its emissive
+	 *	  triangles, until the textures of the scene are loaded
+	 *
+	 * The threads of the textures of the scene (SCENE_TEXTURES_LOADING_THREAD_KEY) and RENDERER_STREAM_GEOMETRIES
+	 * must then not be joined before rendering. Must be set before calling set_scene()
+	 */
+	void set_progressive_loading(bool progressive_loading);
+	/**
+	 * Swaps in the BVHs of the meshes streamed in since the last call and, once the textures of the scene
+	 * are loaded, uploads its materials, textures and emissive triangles, see set_progressive_loading().
+	 * Waits for the frame in flight if there is anything to swap in.
+	 *
+	 * Returns true if the scene changed, the render should then be reset
+	 */
+	bool update_progressive_loading();
+	/**
+	 * Rebuilds the BVH of the scene with the current BVH build quality
+	 */
+	void rebuild_bvh();
+	/**
+	 * Sets the object to world matrices of the instances of the scene (in the order
+	 * of HIPRTScene::host_instances) and refits the BVH of the scene for these new transforms
+	 * instead of rebuilding it. The light sampling structures of the emissive triangles are
+	 * updated too.
+	 * 
+	 * The matrices are column major with the translation in the last column. The render is not reset
+	 * by this function
+	 */
+	void update_instance_transforms(const std::vector<float4x4>& object_to_world_matrices);
 	void set_camera(const Camera& camera);
+	/**
+	 * Renders the views of all the 'cameras' in the same launches instead of only get_camera():
+	 * same BVH, textures, light sampling structures and ReSTIR presampling for all the views.
+	 * 
+	 * The views are stacked vertically in the buffers of the render: the render resolution given to
+	 * resize() is that of the stack, each view being the render width * (render height / view count)
+	 * pixels that follow the pixels of the previous view. As many rows of pixels as the render height
+	 * divided by the number of views so the render height should be a multiple of the number of views.
+	 * The aspect of the cameras is set from that resolution.
+	 * 
+	 * The temporal passes (ReSTIR temporal reuse, temporal reprojection and temporal upscaling)
+	 * reproject with the previous frame camera of a single view and are disabled while several
+	 * views are rendered.
+	 * 
+	 * Less than 2 cameras goes back to rendering get_camera() only. The render must be reset
+	 */
+	void set_views(const std::vector<Camera>& cameras);
+	/**
+	 * Number of views stacked in the render, 1 if only get_camera() is rendered, see set_views()
+	 */
+	int get_view_count() const;
+	/**
+	 * Batched material previews: renders one tile per material of 'preview_materials' in the same frames,
+	 * the tiles being the views (see set_views()) of get_camera() stacked in the render.
+	 * 
+	 * The camera rays of the tile 'i' that hit a surface of the material 'target_material_index'
+	 * of the scene (the material ball of a preview scene for example) see 'preview_materials[i]'
+	 * instead so that dozens of variants of a material are compared in the render of a single frame.
+	 * The preview materials are appended to the materials of the scene on the GPU, their emission
+	 * isn't sampled by the lights.
+	 * 
+	 * No preview materials stops the previews (and goes back to rendering get_camera() only).
+	 * The previews (and their views) are stopped when the scene is replaced. The render must be resized for the
+	 * new number of views and reset
+	 */
+	void set_material_previews(int target_material_index, const std::vector<RendererMaterial>& preview_materials);
 	void set_envmap(const Image32Bit& envmap, const std::string& envmap_filepath);
+	/**
+	 * Reads, uploads and computes the sampling data structure of the envmap at 'envmap_filepath'
+	 * on a background thread while the frames keep rendering with the current envmap.
+	 * 
+	 * The new envmap is swapped in by update() at the first frame boundary once it is ready.
+	 * See RendererEnvmap::is_pending_envmap_loading()
+	 */
+	void load_envmap_async(const std::string& envmap_filepath);
+	/**
+	 * Parses the scene at 'scene_filepath' with the options of set_scene_parser_options() on background
+	 * threads while the frames keep rendering the current scene. Once the new scene is parsed and its
+	 * textures are loaded, update_pending_scene() replaces the current scene with it at a frame boundary.
+	 * The kernels, the denoiser and the interop buffers are kept.
+	 *
+	 * Ignored if a scene is already loading, with this function or with the progressive loading
+	 */
+	void load_scene_async(const std::string& scene_filepath);
+	bool is_pending_scene_loading() const;
+	/**
+	 * Options the scenes of load_scene_async() are parsed with
+	 */
+	void set_scene_parser_options(const SceneParserOptions& options);
+	/**
+	 * Replaces the scene with the one parsed by load_scene_async() if it is ready. The BVH of the new scene
+	 * is built and its materials, textures and emissive triangles are uploaded by this call, the frames
+	 * wait for it. Must be called in between two frames.
+	 *
+	 * Returns true if the scene was replaced, the render should then be reset
+	 */
+	bool update_pending_scene();
+	/**
+	 * Incremented each time update_pending_scene() replaces the scene,
+	 * for the UI that keeps state about the materials of the scene
+	 */
+	int get_scene_generation() const;
 	bool has_envmap();
 
 	const std::vector<RendererMaterial>& get_materials();
 	const std::vector<std::string>& get_material_names();
+	/**
+	 * Uploads the materials that differ from the current materials of the renderer.
+	 * If some materials started or stopped being emissive, the emissive triangles of the
+	 * scene and the light sampling structures are rebuilt, see rebuild_emissive_triangles()
+	 */
 	void update_materials(std::vector<RendererMaterial>& materials);
 
 	/**
-	 * Returns the size of the RayVolumeState struct on the GPU.
+	 * Returns the size of the RayVolumeState struct on the GPU for the current
+	 * interior stack strategy and nested dielectrics stack size of the global compiler options.
 	 * 
-	 * Useful when the size of the struct changes because the nested dielectrics
-	 * stack size changed but we have no easy way to find out what's the new size
-	 * of the struct on the CPU to upload the correct data size.
-	 * 
-	 * There's no easy way to find the new size of the struct on the CPU because
-	 * the RayVolumeState struct includes a InteriorStackImpl struct whose size
-	 * is defined at compilation time. If the nested dielectrics stack size changes
-	 * at runtime (possible through ImGui), then we need to recompute the size of
-	 * the RayVolumeState structure on the CPU to be able to properly resize the
-	 * GPU buffers that use the RayVolumeState (in the GBuffer for example).
-	 * However, again, that size is determined at compilation time so we can't
-	 * know on the CPU what's going to be the new size. To circumvent that, we
-	 * use the fact that shader are recompiled on the GPU and so the shaders know
-	 * the new size. This function thus launches a kernel on the GPU to querry
-	 * the size of the structure.
+	 * The size is computed on the host from the same structure as the kernels,
+	 * see get_stored_ray_volume_state_byte_size()
 	 */
 	size_t get_ray_volume_state_byte_size();
 
@@ -231,9 +582,63 @@ public:
 	void precompile_kernels();
 	void stop_background_shader_compilation();
 	void resume_background_shader_compilation();
+	/**
+	 * Cancels the background precompilation of the option combinations that the user
+	 * never switched to (see KernelOptionsUsageHistory). The others are still precompiled
+	 */
+	void cancel_unused_background_shader_compilation();
+
+	/**
+	 * Option macros that can be toggled with set_runtime_kernel_option()
+	 */
+	static const std::unordered_set<std::string> RUNTIME_KERNEL_OPTIONS;
+
+	/**
+	 * Sets the value of one of the RUNTIME_KERNEL_OPTIONS.
+	 * 
+	 * If the runtime kernel options are enabled, the kernels that use that option are immediately swapped
+	 * for their version compiled with the runtime branches (KernelOptionsRuntimeBranches, see Device/includes/RuntimeOptions.h)
+	 * which reads the option from the render settings. The kernels specialized for the new value of the option are
+	 * compiled in the background and swapped in by update() when they are ready.
+	 * 
+	 * If the runtime kernel options are disabled (or if the version with the runtime branches isn't compiled yet),
+	 * this sets the option and recompiles the kernels
+	 */
+	void set_runtime_kernel_option(const std::string& option_macro_name, int value);
+	/**
+	 * Enabling the runtime kernel options compiles the version with the runtime
+	 * branches of the kernels in the background
+	 */
+	void set_runtime_kernel_options_enabled(bool enabled);
+	bool get_runtime_kernel_options_enabled() const;
+
+	/**
+	 * If enabled, the kernel sources (DEVICE_KERNELS_DIRECTORY and DEVICE_INCLUDES_DIRECTORY) are polled for modifications
+	 * every KERNEL_HOT_RELOAD_POLL_INTERVAL_MS by update_kernel_hot_reload(). The kernels that depend on the modified files
+	 * (found with the dependency graph of the GPUKernelCompiler, see GPUKernel::needs_recompilation()) are compiled in the
+	 * background and swapped in when they're ready, the previous versions of the kernels keep rendering in the meantime
+	 */
+	void set_kernel_hot_reload_enabled(bool enabled);
+	bool get_kernel_hot_reload_enabled() const;
+	/**
+	 * Swaps in the hot reloaded kernels that finished compiling and polls the kernel sources for new
+	 * modifications, see set_kernel_hot_reload_enabled(). Must be called in between two frames.
+	 *
+	 * Returns true if kernels were swapped in, the render should then be reset
+	 */
+	bool update_kernel_hot_reload();
 
 	std::map<std::string, GPUKernel*> get_kernels();
 	oroStream_t get_main_stream();
+	/**
+	 * Stream the render passes must launch their kernels on: the secondary stream of
+	 * m_stream_scheduler in between its begin_async() / end_async(), the main stream otherwise
+	 */
+	oroStream_t get_pass_stream();
+	/**
+	 * Whether the independent passes of the frame run on two streams, see render_settings.use_multiple_streams
+	 */
+	bool uses_multiple_streams();
 
 	void compute_render_pass_times();
 	std::unordered_map<std::string, float>& get_render_pass_times();
@@ -244,27 +649,143 @@ public:
 	void reset(std::shared_ptr<ApplicationSettings> application_settings);
 
 	Xorshift32Generator& rng();
+	/**
+	 * Sets the seed the random number generator of the renderer is reset to when
+	 * the render is reset. The generator produces the 'random_seed' of each sample.
+	 * 
+	 * Renderers with different seeds render independent sets of samples
+	 */
+	void set_rng_seed(unsigned int seed);
 
 	int2 m_render_resolution = make_int2(0, 0);
 
 	Camera m_camera;
 	Camera m_previous_frame_camera;
+	// Cameras of the views stacked in the render, empty if only 'm_camera' is rendered. See set_views()
+	std::vector<Camera> m_views;
+	OrochiBuffer<HIPRTCamera> m_views_buffer;
 
 private:
 	void set_hiprt_scene_from_scene(const Scene& scene);
+	/**
+	 * Uploads the vertex normals and texture coordinates of the scene on the main stream,
+	 * from the streamed buffers of the scene if it has any (see Scene::streamed_buffers)
+	 */
+	void upload_vertex_attributes(const Scene& scene, OrochiStagingUploader& uploader);
+	/**
+	 * Uploads the dequantized 'quantized_positions' to the full precision positions of the HIPRTScene
+	 * that the BVHs are built from, on the main stream
+	 */
+	void upload_bvh_vertices_positions(const std::vector<unsigned short>& quantized_positions, OrochiStagingUploader& uploader);
+	/**
+	 * Uploads the analytic spheres of the scene and their bounding boxes for the BVH of the spheres
+	 */
+	void upload_scene_spheres(const Scene& scene);
+	/**
+	 * Uploads the materials (and the opacities of the triangles for the alpha test), the textures and the
+	 * emissive triangles of the scene. The textures of the scene must have been loaded and its emissive triangles
+	 * parsed. Called by the upload threads of set_hiprt_scene_from_scene() or by update_progressive_loading()
+	 */
+	void upload_scene_materials(const Scene& scene);
+	void upload_scene_textures(const Scene& scene);
+	void upload_scene_emissive_triangles(const Scene& scene);
+	/**
+	 * Points the geometries of the meshes with at least PROGRESSIVE_LOADING_MIN_STREAMED_TRIANGLES triangles
+	 * to their bounding box before the BVH is built and keeps their real triangles for the RENDERER_STREAM_GEOMETRIES thread
+	 */
+	void setup_geometry_proxies(const Scene& scene);
+	/**
+	 * Builds the BVHs of the meshes replaced by their bounding box, one after the other on a stream
+	 * of its own, until they're all built or until stop_geometry_streaming(). Runs on the RENDERER_STREAM_GEOMETRIES thread
+	 */
+	void stream_geometries();
+	/**
+	 * Stops the RENDERER_STREAM_GEOMETRIES thread and gives back to the meshes still replaced by
+	 * their bounding box their real triangles. Their BVHs are built by the next HIPRTScene::build_bvh()
+	 */
+	void stop_geometry_streaming();
 	void update_render_data();
 
 	/**
-	 * Precompiles direct lighting strategy kernels
+	 * Recomputes the power of the emissive triangles of the scene from the emission
+	 * of the given materials, rebuilds the alias table of the emissive triangles from
+	 * these powers, refits the power of the light hierarchy and uploads everything to the GPU.
+	 * 
+	 * If 'async_upload' is true, the uploads are queued on the main stream
+	 * after the frame being rendered instead of waiting for the frame
+	 */
+	void update_emissive_triangles_power(const std::vector<RendererMaterial>& materials, bool async_upload = false);
+	/**
+	 * Rebuilds the light clusters of the ETSS_LIGHT_CLUSTERS strategy (see LightClustersBuilder) from
+	 * the given power of the emissive triangles, their world space vertices and the current
+	 * 'minimum_light_contribution' of the render settings and uploads them to the GPU.
+	 * 
+	 * Frees the light clusters if the kernels aren't compiled with ETSS_LIGHT_CLUSTERS
+	 */
+	void update_light_clusters(const std::vector<float>& emissive_triangles_power);
+	/**
+	 * Recomputes the list of the emissive triangles of the scene from the emission of the given
+	 * materials and rebuilds the alias table and the light hierarchy over these triangles.
+	 *
+	 * The object space vertices of the triangles that were already emissive are reused, the geometry
+	 * of the scene is downloaded from the GPU only if some triangles become emissive
+	 */
+	void rebuild_emissive_triangles(const std::vector<RendererMaterial>& materials);
+	/**
+	 * The materials in the format of the material buffer of the GPU, see PackedRendererMaterial
+	 */
+	static std::vector<PackedRendererMaterial> pack_materials(const std::vector<RendererMaterial>& materials);
+	/**
+	 * Reclassifies the opacity of the triangles for the alpha test (see TriangleOpacityClassifier)
+	 * with the alpha of the given materials and uploads it to the GPU. Same 'async_upload'
+	 * as update_emissive_triangles_power()
+	 */
+	void update_triangle_opacities(const std::vector<RendererMaterial>& materials, bool async_upload = false);
+	/**
+	 * Rebuilds the BVHs of the meshes whose geometry type (alpha tested or opaque, see HIPRTGeometry)
+	 * changed with the last update_triangle_opacities() and the top level BVH over them.
+	 * Waits for the meshes streamed by the progressive loading to be all in the BVH
+	 */
+	void internal_update_geometry_types();
+	/**
+	 * Selects the LOD of each instance for the primary and secondary rays, see set_geometry_lod(), and
+	 * rebuilds the top level BVH with the new instance masks if the selection changed
+	 */
+	void internal_update_geometry_lods();
+	/**
+	 * Frees the BVH, the buffers and the CPU copies of the current scene before
+	 * update_pending_scene() sets a new scene. The frame in flight must be done
 	 */
-	void precompile_direct_light_sampling_kernels();
+	void release_scene();
+	/**
+	 * MATERIAL_FEATURE_XXX flags of the lobes used by the given materials, see MaterialFeatures
+	 */
+	static int get_material_features(const std::vector<RendererMaterial>& materials);
+	/**
+	 * Sets the MaterialFeatures that the kernels are specialized for to the features of the given materials.
+	 * If 'only_add', the features that the materials don't use anymore stay compiled in so that the material
+	 * editor only recompiles the kernels when a lobe is enabled, not when it's disabled.
+	 * The kernels are recompiled by internal_update_material_features()
+	 */
+	void set_material_features(const std::vector<RendererMaterial>& materials, bool only_add);
+	/**
+	 * Recompiles the kernels if they aren't compiled with the MaterialFeatures given by set_material_features()
+	 */
+	void internal_update_material_features();
+
 	/**
-	 * Precompiles ReSTIR DI kernels
+	 * Adds the option combinations of the direct lighting strategies to precompile to 'combinations'
 	 */
-	void precompile_ReSTIR_DI_kernels();
+	void get_direct_light_sampling_precompilation_options(std::vector<GPUKernelCompilerOptions>& combinations);
+	/**
+	 * Adds the option combinations of ReSTIR DI to precompile to 'combinations'
+	 */
+	void get_ReSTIR_DI_precompilation_options(std::vector<GPUKernelCompilerOptions>& combinations);
 	/**
 	 * Precompiles a single kernel given its ID and the options
-	 * that will be overriden when compiling the kernel
+	 * that will be overriden when compiling the kernel.
+	 *
+	 * Blocks until the kernel is compiled (or queues it in the KernelCompileFarm if it is enabled)
 	 */
 	void precompile_kernel(const std::string& id, GPUKernelCompilerOptions partial_options);
 
@@ -291,10 +812,90 @@ private:
 	 */
 	void internal_update_adaptive_sampling_buffers();
 
+	/**
+	 * Whether or not the path tracing pass uses the persistent threads megakernel
+	 * and the active pixel list, see render_settings.use_persistent_threads_path_tracing
+	 */
+	bool uses_persistent_threads_path_tracing();
+	/**
+	 * Whether or not the kernels are compiled with UseDeviceResidentRenderData
+	 */
+	bool uses_device_resident_render_data();
+	/**
+	 * Whether or not the kernels are launched over the list of the active pixels, see
+	 * render_settings.compact_active_pixels
+	 */
+	bool uses_active_pixel_list();
+	/**
+	 * Allocates/frees the active pixel list
+	 */
+	void internal_update_active_pixel_list_buffers();
+	/**
+	 * Allocates/frees the pixel costs buffer, see uses_pixel_cost_instrumentation()
+	 */
+	void internal_update_pixel_costs_buffer();
+	/**
+	 * Allocates/frees the device render buffers if set_use_device_render_buffers() changed
+	 */
+	void internal_update_device_render_buffers();
+	/**
+	 * Copies the device render buffers into the interop buffers if the renderer
+	 * renders into the device render buffers and they haven't been copied already
+	 */
+	void internal_copy_device_render_buffers_to_interop();
+	/**
+	 * Allocates/frees and clears the per-bounce paths counters, see render_settings.count_bounce_active_rays
+	 */
+	void internal_update_bounce_active_ray_counts_buffer();
+	/**
+	 * Allocates/frees and clears the ray statistics counters, see render_settings.count_ray_statistics
+	 */
+	void internal_update_ray_statistics_buffer();
+	/**
+	 * Allocates/frees the history buffer of the temporal reprojection, see render_settings.enable_temporal_reprojection
+	 */
+	void internal_update_temporal_reprojection_buffer();
+	/**
+	 * Uploads the cameras of set_views() for this frame
+	 */
+	void internal_update_views();
+	/**
+	 * Allocates/frees the buffers of the temporal upscaling, see render_settings.use_temporal_upscaling
+	 */
+	void internal_update_temporal_upscaling_buffers();
+	/**
+	 * Whether the kernels accumulate the denoiser AOVs in the packed buffers, see PackedDenoiserAOVs
+	 */
+	bool uses_packed_denoiser_AOVs();
+	/**
+	 * Allocates/frees the packed denoiser AOVs buffers, see uses_packed_denoiser_AOVs()
+	 */
+	void internal_update_packed_denoiser_AOVs_buffers();
+	/**
+	 * Sets the jitter of the low resolution pixels of the temporal upscaling
+	 * for the frame that is about to be rendered and whether the history is valid
+	 */
+	void update_temporal_upscaling_jitter();
+	/**
+	 * Number of threads of the launch of the FullPathTracerPersistent kernel: as many blocks as
+	 * can be resident at the same time on the GPU, but no more threads than pixels
+	 */
+	int get_persistent_threads_count();
+
 	/**
 	 * Allocates/frees the global buffer for BVH traversal when UseSharedStackBVHTraversal is TRUE
 	 */
 	void internal_update_global_stack_buffer();
+	bool uses_dynamic_bvh_traversal_stack();
+	/**
+	 * Rebuilds the light clusters if the emissive triangles sampling strategy was switched to
+	 * ETSS_LIGHT_CLUSTERS or if the 'minimum_light_contribution' they were built with changed
+	 */
+	void internal_update_light_clusters();
+	/**
+	 * Restores the checkpoint given to load_checkpoint(), if any. Called after update_render_data()
+	 */
+	void internal_update_pending_checkpoint();
 
 	//
 	// -------- Functions called by the update() method ---------
@@ -303,6 +904,8 @@ private:
 
 	// Properties of the device
 	oroDeviceProp m_device_properties = { .gcnArchName = "" };
+	// Whether or not the global stack buffer for BVH traversal was created as a dynamic stack buffer
+	bool m_global_stack_buffer_dynamic = false;
 
 	// GPU events to time the frame
 	oroEvent_t m_frame_start_event = nullptr;
@@ -310,6 +913,8 @@ private:
 	// If true, the last call to render() rendered a frame where render_settings.render_low_resoltion was true.
 	// False otherwise
 	bool m_was_last_frame_low_resolution = false;
+	bool m_was_last_frame_upscaled = false;
+	int m_last_frame_low_resolution_scaling = 1;
 	// If true, the buffer pointers of m_render_data will be updated when update() is called.
 	// This boolean is mainly set to true when resizing the renderer since resizing re-creates the 
 	// buffers -> invalidates the pointer -> we need to set them back on render_data
@@ -322,6 +927,16 @@ private:
 	// An additional key GPURenderer::FULL_FRAME_TIME_KEY can be used to index in this map
 	// and retrieve the time for the whole frame
 	std::unordered_map<std::string, float> m_render_pass_times;
+	// Timings of the camera rays and megakernel path tracing launches, resolved a few frames late
+	// without waiting for the GPU. The render passes have their own (see RenderPass)
+	OrochiTimestampRing m_launch_timestamps;
+	// Secondary stream of the passes that overlap with the ones on m_main_stream
+	OrochiStreamScheduler m_stream_scheduler;
+	// Graph of the kernels of one sample, replayed by the samples of a frame
+	// if render_settings.use_sample_graph is true
+	OrochiKernelGraph m_sample_graph;
+	// Whether or not the last compute_render_pass_times() resolved new camera rays / megakernel times
+	bool m_new_launch_times_resolved = false;
 
 	// This buffer holds the * sum * of the samples computed
 	// This is an accumulation buffer. This needs to be divided by the
@@ -335,34 +950,160 @@ private:
 	// Albedo G-buffer
 	std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>>m_albedo_AOV_buffer;
 
+	// Plain GPU buffers used instead of the OpenGL interop buffers above
+	// (and instead of m_pixels_converged_sample_count_buffer) when the renderer is headless
+	// or renders into the device render buffers, see set_use_device_render_buffers()
+	OrochiBuffer<ColorRGB32F> m_device_framebuffer { "Framebuffers" };
+	OrochiBuffer<float3> m_device_normals_AOV_buffer { "Framebuffers" };
+	OrochiBuffer<ColorRGB32F> m_device_albedo_AOV_buffer { "Framebuffers" };
+	OrochiBuffer<int> m_device_pixels_converged_sample_count_buffer { "Adaptive sampling" };
+	// RGB9E5 albedo and octahedral normals in which the AOVs are accumulated
+	// when the kernels are compiled with PackedDenoiserAOVs
+	OrochiBuffer<unsigned int> m_packed_albedo_AOV_buffer { "Framebuffers" };
+	OrochiBuffer<unsigned int> m_packed_normals_AOV_buffer { "Framebuffers" };
+	bool m_headless = false;
+	// Value of set_use_device_render_buffers() and whether the device render buffers are actually
+	// used by the current frames (the requested value is only applied in map_buffers_for_render())
+	bool m_device_render_buffers_requested = false;
+	bool m_device_render_buffers_used = false;
+	// Whether the device render buffers have been copied to the interop buffers since the last map_buffers_for_render()
+	bool m_device_render_buffers_copied = false;
+	// See set_half_precision_texcoords()
+	bool m_half_precision_texcoords = false;
+	// See set_quantized_vertices_positions()
+	bool m_quantized_vertices_positions = false;
+	// See set_compact_bvh()
+	bool m_compact_bvh = false;
+
+	// Meshes with fewer triangles than that are built with the rest of the BVH
+	// instead of being streamed in, see set_progressive_loading()
+	static constexpr int PROGRESSIVE_LOADING_MIN_STREAMED_TRIANGLES = 4096;
+	// See set_progressive_loading()
+	bool m_progressive_loading = false;
+	const Scene* m_progressive_loading_scene = nullptr;
+
+	// See load_scene_async()
+	SceneParserOptions m_scene_parser_options;
+	// The emissive triangles of a scene parsed by Assimp are read from the Assimp
+	// scene in the background so the importer lives as long as the pending scene
+	std::unique_ptr<Assimp::Importer> m_pending_scene_importer;
+	std::unique_ptr<Scene> m_pending_scene;
+	std::atomic<bool> m_pending_scene_loading = false;
+	std::atomic<bool> m_pending_scene_ready = false;
+	// Scene swapped in by update_pending_scene(), kept alive by the renderer. The
+	// scene given to set_scene() is kept alive by the caller
+	std::unique_ptr<Scene> m_owned_scene;
+	int m_scene_generation = 0;
+	// Set by the RENDERER_PROGRESSIVE_LOADING thread once the textures of the scene are loaded
+	// and its emissive triangles parsed. Reset once they're uploaded
+	std::atomic<bool> m_progressive_loading_scene_ready = false;
+	// Real triangles of the meshes that are replaced by their bounding box, in the order they're streamed in
+	std::vector<std::pair<int, hiprtTriangleMeshPrimitive>> m_streamed_meshes;
+	// Number of meshes of 'm_streamed_meshes' swapped in the BVH of the scene
+	int m_streamed_meshes_swapped_count = 0;
+	// BVHs of the meshes of 'm_streamed_meshes' built by the RENDERER_STREAM_GEOMETRIES
+	// thread, waiting to be swapped in by update_progressive_loading()
+	std::vector<std::pair<int, hiprtGeometry>> m_streamed_geometries;
+	std::mutex m_streamed_geometries_mutex;
+	// True while the RENDERER_STREAM_GEOMETRIES thread hasn't been joined
+	bool m_geometry_streaming = false;
+	std::atomic<bool> m_stop_geometry_streaming = false;
+
 	GPURendererGBuffer m_g_buffer;
 	GPURendererGBuffer m_g_buffer_prev_frame;
 
 	// Used to calculate the variance of each pixel for adaptive sampling
-	OrochiBuffer<float> m_pixels_squared_luminance_buffer;
+	OrochiBuffer<float> m_pixels_squared_luminance_buffer { "Adaptive sampling" };
+	// Luminance of every other sample of the pixels, only allocated
+	// for the tile based adaptive sampling. See AdaptiveSamplingTileError
+	OrochiBuffer<float> m_pixels_half_luminance_buffer { "Adaptive sampling" };
+
+	// Average color of the last render for the temporal reprojection
+	OrochiBuffer<ColorRGB32F> m_temporal_reprojection_history_buffer { "Temporal reprojection" };
+	// False if the framebuffer can't be reprojected at the next reset (the render has been resized, ...)
+	bool m_temporal_reprojection_history_valid = false;
+
+	// Full resolution output of the last upscaled frame and of the current one
+	OrochiBuffer<ColorRGB32F> m_temporal_upscaling_history_buffer { "Temporal upscaling" };
+	OrochiBuffer<ColorRGB32F> m_temporal_upscaling_output_buffer { "Temporal upscaling" };
+	// Camera of the last upscaled frame, the history is reprojected from it
+	Camera m_temporal_upscaling_history_camera;
+	// Index in the jitter sequence of the low resolution pixels
+	unsigned int m_temporal_upscaling_jitter_index = 0;
 	// This buffer stores the number of samples accumulated *until* a pixel has converged
 	// ("converged" is according to adaptive sampling or pixel stop noise threshold)
 	std::shared_ptr<OpenGLInteropBuffer<int>> m_pixels_converged_sample_count_buffer;
-	// This buffer is necessary because with adaptive sampling, each pixel
-	// can have accumulated a different number of sample
-	OrochiBuffer<int> m_pixels_sample_count_buffer;
+	// Clock cycles of the pixels per category, see get_pixel_costs_buffer()
+	std::shared_ptr<OpenGLInteropBuffer<float4>> m_pixel_costs_buffer;
 	// A single boolean to indicate whether there is still a ray active in
 	// the kernel or not. Mostly useful when adaptive sampling is on and we
 	// want to know if all pixels have converged or not yet
-	OrochiBuffer<unsigned char> m_still_one_ray_active_buffer;
+	OrochiBuffer<unsigned char> m_still_one_ray_active_buffer { "Status buffers" };
 	// How many pixels have reached the render_settings.stop_pixel_noise_threshold.
 	// Warning: This buffer does not count how many pixels have converged according to
 	// the adaptive sampling noise threshold. This is only for the stop_pixel_noise_threshold
-	OrochiBuffer<unsigned int> m_pixels_converged_count_buffer;
-	// Whether or not the pixel at the given index is active and needs more samples
-	OrochiBuffer<unsigned char> m_pixel_active;
+	OrochiBuffer<unsigned int> m_pixels_converged_count_buffer { "Status buffers" };
+	// Whether or not the pixel at the given index is active and needs more samples, its
+	// sample count (with adaptive sampling, each pixel can have accumulated a different number
+	// of samples) and its converged sample count. See PixelStatus
+	OrochiBuffer<PixelStatus> m_pixel_status { "Adaptive sampling" };
+	// List of the pixels that need a sample and its counters, see AuxiliaryBuffers::active_pixel_indices
+	OrochiBuffer<unsigned int> m_active_pixel_indices { "Adaptive sampling" };
+	OrochiBuffer<unsigned int> m_active_pixel_counters { "Adaptive sampling" };
+	// Number of paths alive / missed / absorbed at each bounce, see AuxiliaryBuffers::bounce_active_ray_counts
+	OrochiBuffer<unsigned int> m_bounce_active_ray_counts { "Status buffers" };
+	// Ray statistics of the frame, see AuxiliaryBuffers::ray_statistics
+	OrochiBuffer<unsigned int> m_ray_statistics { "Status buffers" };
+	// Number of blocks of the persistent threads launches for the occupancy of
+	// the compiled function 'm_persistent_threads_occupancy_function'
+	int m_persistent_threads_block_count = 0;
+	oroFunction m_persistent_threads_occupancy_function = nullptr;
 
 	// Structure that holds the values of the one-variable buffers of the renderer.
 	// These values are 'one_ray_active' or 'pixel_converged_count' for example.
 	// These values are updated when the update() is called
 	StatusBuffersValues m_status_buffers_values;
 
+	/**
+	 * A frame queued by render() whose status buffers haven't been read yet
+	 */
+	struct QueuedFrame
+	{
+		// Downloads of the status buffers queued at the end of the frame
+		OrochiAsyncTransfer one_ray_active_transfer;
+		OrochiAsyncTransfer pixels_converged_count_transfer;
+		OrochiAsyncTransfer bounce_active_ray_counts_transfer;
+		// Number of counters downloaded by 'bounce_active_ray_counts_transfer'
+		int bounce_active_ray_counts_transfer_count = 0;
+		// Only queued if render_settings.count_ray_statistics, RAY_STATISTIC_COUNT counters
+		OrochiAsyncTransfer ray_statistics_transfer;
+	};
+
+	/**
+	 * Reads the status buffers of the oldest queued frame and removes it from the queue.
+	 * Waits for the downloads of the frame if they aren't done
+	 */
+	void pop_queued_frame();
+
+	// Ring of the frames queued on the main stream, oldest first
+	QueuedFrame m_queued_frames[MAX_QUEUED_FRAME_COUNT];
+	int m_first_queued_frame = 0;
+	int m_queued_frame_count = 0;
+
 	ReSTIRDIRenderPass m_restir_di_render_pass;
+	ReSTIRGIRenderPass m_restir_gi_render_pass;
+	PathGuidingRenderPass m_path_guiding_render_pass;
+	RadianceCacheRenderPass m_radiance_cache_render_pass;
+	VisibilityCacheRenderPass m_visibility_cache_render_pass;
+	// Alternative to the FullPathTracer megakernel, used only
+	// if render_settings.use_wavefront_path_tracing is true
+	WavefrontPathTracingRenderPass m_wavefront_path_tracing_render_pass;
+	// All the render passes above. update() / resize() / recompile() / ... of
+	// the renderer are forwarded to all of them
+	std::vector<RenderPass*> m_render_passes;
+	// Compiled after the render passes have declared their transient buffers
+	// in their update() / resize()
+	RenderGraph m_render_graph;
 
 	// The materials are also kept on the CPU side because we want to be able
 	// to modify them interactively with ImGui
@@ -370,8 +1111,51 @@ private:
 	// The material names are used for displaying in the ImGui editor
 	std::vector<std::string> m_material_names;
 
+	// Area, material index and average luminance of the emission texture (see EmissiveTextureIntegrator) of each
+	// emissive triangle of the scene, kept on the CPU to recompute the power of the emissive triangles when the
+	// materials are modified
+	std::vector<float> m_emissive_triangles_areas;
+	std::vector<int> m_emissive_triangles_material_indices;
+	std::vector<float> m_emissive_triangles_texture_luminances;
+	// Average luminance of the emission texture under each triangle of the meshes, empty if no material
+	// has an emission texture. Kept for the triangles that become emissive with rebuild_emissive_triangles()
+	std::vector<float> m_triangle_emission_texture_luminances;
+	// Opacity of the base color texture under each triangle and material index of each
+	// triangle, kept on the CPU to reclassify the triangles when the materials are modified
+	std::vector<unsigned char> m_triangle_texture_opacities;
+	std::vector<int> m_triangle_material_indices;
+	// Empty if no opacity micromap was baked for the scene
+	std::vector<int> m_triangle_opacity_micromap_indices;
+	// Whether each mesh needs the alpha test filter function according to the last
+	// update_triangle_opacities(), applied to the BVH by internal_update_geometry_types()
+	std::vector<unsigned char> m_geometries_alpha_tested;
+	std::mutex m_geometries_alpha_tested_mutex;
+	std::atomic<bool> m_geometries_alpha_tested_dirty = false;
+	// MaterialFeatures that the kernels should be compiled with for the materials
+	// of the scene, see set_material_features()
+	int m_material_features = MATERIAL_FEATURES_ALL;
+	// Scene primitive index, instance and object space vertices of each emissive triangle, for
+	// recomputing the light sampling structures when the instances move or the materials change
+	std::vector<int> m_emissive_triangles_indices;
+	std::vector<int> m_emissive_triangles_instance_indices;
+	std::vector<float3> m_emissive_triangles_object_vertices;
+	// World space vertices of the emissive triangles, for building the light clusters
+	std::vector<float3> m_emissive_triangles_world_vertices;
+	// CPU copy of the light hierarchy whose power is refit when the materials are modified
+	std::vector<LightBVHNode> m_light_bvh_nodes;
+	std::vector<int> m_light_bvh_leaf_indices;
+	// CPU copy of the light clusters, see update_light_clusters()
+	LightClustersData m_light_clusters;
+	// 'minimum_light_contribution' the light clusters were built with, -1.0f if they
+	// weren't built (the kernels aren't compiled with ETSS_LIGHT_CLUSTERS)
+	float m_light_clusters_minimum_light_contribution = -1.0f;
+	// The light clusters grid covers the bounding box of the scene when it was loaded
+	BoundingBox m_scene_bounding_box;
+
 	// Envmap of the renderer
 	RendererEnvmap m_envmap;
+	// See WorldSettings::envmap_portals
+	OrochiBuffer<EnvmapPortal> m_envmap_portals { "Envmap" };
 
 	// Options used for compiling the render passes of this renderer.
 	// 
@@ -391,8 +1175,55 @@ private:
 	// Whether or not kernel precompilation has been launched yet
 	bool m_kernel_precompilation_launched = false;
 
-	// Kernel used for retrieving the size of the RayVolumeState structure on the GPU
-	GPUKernel m_ray_volume_state_byte_size_kernel;
+	/**
+	 * Compiles, in the background, the version with the runtime branches of the kernels that use some
+	 * RUNTIME_KERNEL_OPTIONS if 'runtime_branches' is true. Compiles the specialized version of the kernels
+	 * that are currently launched with their runtime branches otherwise.
+	 * 
+	 * The compiled functions are swapped in by swap_runtime_kernel_variants()
+	 */
+	void compile_runtime_kernel_variants(bool runtime_branches);
+	void swap_runtime_kernel_variants();
+	bool uses_runtime_kernel_option(const GPUKernel& kernel) const;
+
+	bool m_runtime_kernel_options_enabled = false;
+	// Kernel ID to the function of that kernel compiled with the runtime branches
+	std::unordered_map<std::string, oroFunction> m_runtime_branches_kernel_functions;
+	// IDs of the kernels that are currently launched with their runtime branches
+	std::unordered_set<std::string> m_kernels_on_runtime_branches;
+
+	struct RuntimeKernelVariants
+	{
+		bool runtime_branches;
+		// Value of m_runtime_branches_generation or m_specialized_generation
+		// when the compilation of these variants was started
+		int generation;
+		std::unordered_map<std::string, oroFunction> kernel_functions;
+	};
+	// Variants compiled by the background thread, waiting to be swapped in
+	std::vector<RuntimeKernelVariants> m_compiled_runtime_kernel_variants;
+	std::mutex m_compiled_runtime_kernel_variants_mutex;
+	// Incremented whenever the options that the variants were compiled with become outdated
+	// so that these variants are discarded instead of being swapped in when they're ready:
+	// any option for the runtime branches, any option or runtime option for the specialized kernels
+	int m_runtime_branches_generation = 0;
+	int m_specialized_generation = 0;
+
+	static constexpr int KERNEL_HOT_RELOAD_POLL_INTERVAL_MS = 500;
+	/**
+	 * Most recent last write time of the kernel files and of the device includes
+	 */
+	static std::filesystem::file_time_type get_kernel_sources_last_write_time();
+
+	bool m_kernel_hot_reload_enabled = false;
+	// Most recent last write time of the kernel sources when they were last polled
+	std::filesystem::file_time_type m_kernel_sources_last_write_time;
+	std::chrono::steady_clock::time_point m_kernel_hot_reload_last_poll;
+	// Whether or not the background thread is compiling the hot reloaded kernels
+	std::atomic<bool> m_kernel_hot_reload_compiling = false;
+	// Copies of the kernels compiled with the modified sources by the background thread, waiting to be swapped in
+	std::shared_ptr<std::map<std::string, GPUKernel>> m_hot_reloaded_kernels;
+	std::mutex m_hot_reloaded_kernels_mutex;
 
 	// Additional functions called on hits when tracing rays (alpha testing for example)
 	std::vector<hiprtFuncNameSet> m_func_name_sets;
@@ -402,6 +1233,15 @@ private:
 	// Custom stream onto which kernels are dispatched asynchronously
 	oroStream_t m_main_stream;
 
+	BVHBuildQuality m_bvh_build_quality = BVH_BUILD_QUALITY_HIGH;
+	// See set_geometry_lod()
+	bool m_geometry_lod = false;
+	float m_geometry_lod_pixel_error = 1.0f;
+	float m_geometry_lod_secondary_error_factor = 4.0f;
+	// Value of m_hiprt_scene.bvh_build_count the last time the BVH
+	// build metrics were added to the performance metrics
+	int m_perf_metrics_bvh_build_count = 0;
+
 	// Render data passed to the GPU for rendering. Most importantly it contains
 	// 
 	// The WorldSettings: Settings relative to the scene such as the intensity of the uniform light, the
@@ -411,6 +1251,14 @@ private:
 	// of bounces, the number of samples per kernel invocation (samples per frame),
 	// whether or not the adaptive sampling is enabled, ...
 	HIPRTRenderData m_render_data;
+	// Copy of m_render_data in device memory read by the kernels compiled with UseDeviceResidentRenderData
+	// and the last render data uploaded to it, with its per-sample fields cleared (see get_render_data_launch_args())
+	OrochiBuffer<HIPRTRenderData> m_device_render_data { "Render data" };
+	HIPRTRenderData m_uploaded_render_data;
+	// Storage of the arguments returned by get_render_data_launch_args()
+	HIPRTRenderData* m_device_render_data_pointer = nullptr;
+	HIPRTPerSampleData m_per_sample_data;
+	void* m_render_data_launch_args[3] = { nullptr, nullptr, nullptr };
 
 	// Structure containing the data specific to a scene:
 	//	- hiprtGeom
@@ -421,10 +1269,21 @@ private:
 	//
 	// Destroying this structure frees the resources
 	HIPRTScene m_hiprt_scene;
+	// Tiles of the material textures when the scene is loaded with
+	// virtual texturing. Not initialized otherwise
+	VirtualTextureStreamer m_virtual_texture_streamer;
 
 	// Random number generator used to fill the render_data.random_seed argument
 	// in update_render_data().
 	Xorshift32Generator m_rng;
+
+	// Pinned memory for the asynchronous transfers of the renderer
+	OrochiStagingPool m_staging_pool;
+	// Seed m_rng is reset to when the render is reset, see set_rng_seed()
+	unsigned int m_rng_seed = 42;
+
+	// Checkpoint given to load_checkpoint() that the next update() restores, nullptr otherwise
+	std::unique_ptr<RenderCheckpoint> m_pending_checkpoint;
 };
 
 #endif
@@ -6,21 +6,30 @@
 #ifndef GPU_RENDERER_G_BUFFER_H
 #define GPU_RENDERER_G_BUFFER_H
 
+#include "Device/includes/GBuffer.h"
 #include "Device/includes/RayVolumeState.h"
 
 #include "HIPRT-Orochi/OrochiBuffer.h"
-#include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/Math.h"
 
-// GBuffer that stores information about the current frame first hit data
+// GBuffer that stores information about the current frame first hit data.
+// Same compact layout as the device GBuffer
 struct GPURendererGBuffer
 {
+	/**
+	 * 'new_element_count' is the GBuffer::get_storage_element_count() of the render resolution
+	 */
 	void resize(unsigned int new_element_count, size_t ray_volume_state_byte_size)
 	{
-		materials.resize(new_element_count);
+		material_indices.resize(new_element_count);
+		texcoords.resize(new_element_count);
 		geometric_normals.resize(new_element_count);
 		shading_normals.resize(new_element_count);
 		view_directions.resize(new_element_count);
-		first_hits.resize(new_element_count);
+		first_hit_distances.resize(new_element_count);
+		motion_vectors.resize(new_element_count);
+		texture_footprints.resize(new_element_count);
+		ray_cone_spread_angles.resize(new_element_count);
 		cameray_ray_hit.resize(new_element_count);
 
 		// We need to be careful here because the ray volume states contain the nested dielectric stack and the stack size can be changed at runtime through ImGui. However, on the CPU, the stack size is determined at compile time. Changing the stack size through ImGui only resizes the GPU shaders which then adapts to the new stack size thanks to the recompilation. However, on the CPU, we're not recompiling anything. This means that the stack size on the CPU doesn't match the stack size on the GPU anymore and the buffer will not be properly resized --> this is huge undefined behavior.
@@ -30,25 +39,34 @@ struct GPURendererGBuffer
 
 	void free()
 	{
-		materials.free();
+		material_indices.free();
+		texcoords.free();
 		geometric_normals.free();
 		shading_normals.free();
 		view_directions.free();
-		first_hits.free();
+		first_hit_distances.free();
+		motion_vectors.free();
+		texture_footprints.free();
+		ray_cone_spread_angles.free();
 		cameray_ray_hit.free();
 		ray_volume_states.free();
 	}
 
-	OrochiBuffer<SimplifiedRendererMaterial> materials;
+	OrochiBuffer<int> material_indices { "G-buffer" };
+	OrochiBuffer<float2> texcoords { "G-buffer" };
 
-	OrochiBuffer<float3> shading_normals;
-	OrochiBuffer<float3> geometric_normals;
-	OrochiBuffer<float3> view_directions;
-	OrochiBuffer<float3> first_hits;
+	// Octahedral encoded normals, see the device GBuffer
+	OrochiBuffer<unsigned int> shading_normals { "G-buffer" };
+	OrochiBuffer<unsigned int> geometric_normals { "G-buffer" };
+	OrochiBuffer<float2> view_directions { "G-buffer" };
+	OrochiBuffer<float> first_hit_distances { "G-buffer" };
+	OrochiBuffer<float2> motion_vectors { "G-buffer" };
+	OrochiBuffer<float> texture_footprints { "G-buffer" };
+	OrochiBuffer<float> ray_cone_spread_angles { "G-buffer" };
 
-	OrochiBuffer<unsigned char> cameray_ray_hit;
+	OrochiBuffer<unsigned char> cameray_ray_hit { "G-buffer" };
 
-	OrochiBuffer<RayVolumeState> ray_volume_states;
+	OrochiBuffer<StoredRayVolumeState> ray_volume_states { "G-buffer" };
 };
 
 #endif
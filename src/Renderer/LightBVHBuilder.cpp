@@ -0,0 +1,363 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/LightBVHBuilder.h"
+#include "Scene/SceneParser.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+/**
+ * Rotates 'vector' by 'angle' radians around the normalized 'axis' (Rodrigues' rotation formula)
+ */
+static float3 rotate_around_axis(const float3& vector, const float3& axis, float angle)
+{
+	float cos_angle = std::cos(angle);
+	float sin_angle = std::sin(angle);
+
+	return vector * cos_angle + hippt::cross(axis, vector) * sin_angle + axis * hippt::dot(axis, vector) * (1.0f - cos_angle);
+}
+
+void LightBVHBuilder::LightBounds::extend(const LightBounds& other)
+{
+	if (other.empty)
+		return;
+
+	if (empty)
+	{
+		*this = other;
+
+		return;
+	}
+
+	bounds.extend(other.bounds);
+	power += other.power;
+	cos_theta_e = hippt::min(cos_theta_e, other.cos_theta_e);
+
+	// Union of the cones of normals, adapted from pbrt-v4's DirectionCone Union().
+	//
+	// The emissive triangles are two-sided so a cone of normals and its opposite
+	// are equivalent. We're flipping the other cone in the same hemisphere as ours
+	// to get a tighter union
+	float3 other_axis = other.cone_axis;
+	if (hippt::dot(cone_axis, other_axis) < 0.0f)
+		other_axis = -other_axis;
+
+	float theta_a = std::acos(hippt::clamp(-1.0f, 1.0f, cos_theta_o));
+	float theta_b = std::acos(hippt::clamp(-1.0f, 1.0f, other.cos_theta_o));
+	float theta_d = std::acos(hippt::clamp(-1.0f, 1.0f, hippt::dot(cone_axis, other_axis)));
+
+	if (hippt::min(theta_d + theta_b, static_cast<float>(M_PI)) <= theta_a)
+		// Our cone already contains the other cone
+		return;
+
+	if (hippt::min(theta_d + theta_a, static_cast<float>(M_PI)) <= theta_b)
+	{
+		// The other cone contains ours
+		cone_axis = other_axis;
+		cos_theta_o = other.cos_theta_o;
+
+		return;
+	}
+
+	float theta_o = (theta_a + theta_d + theta_b) * 0.5f;
+	float3 rotation_axis = hippt::cross(cone_axis, other_axis);
+	if (theta_o >= M_PI || hippt::length(rotation_axis) == 0.0f)
+	{
+		// The union is the whole sphere of directions
+		cos_theta_o = -1.0f;
+
+		return;
+	}
+
+	// Rotating our axis towards the other axis so that the new cone is centered
+	// between the two cones
+	float theta_r = theta_o - theta_a;
+	cone_axis = hippt::normalize(rotate_around_axis(cone_axis, hippt::normalize(rotation_axis), theta_r));
+	cos_theta_o = std::cos(theta_o);
+}
+
+float LightBVHBuilder::LightBounds::orientation_measure() const
+{
+	float theta_o = std::acos(hippt::clamp(-1.0f, 1.0f, cos_theta_o));
+	float theta_e = std::acos(hippt::clamp(-1.0f, 1.0f, cos_theta_e));
+	float theta_w = hippt::min(theta_o + theta_e, static_cast<float>(M_PI));
+	float sin_theta_o = std::sin(theta_o);
+
+	return M_TWO_PI * (1.0f - cos_theta_o) + M_PI * 0.5f * (2.0f * theta_w * sin_theta_o - std::cos(theta_o - 2.0f * theta_w) - 2.0f * theta_o * sin_theta_o + cos_theta_o);
+}
+
+float LightBVHBuilder::LightBounds::cost() const
+{
+	if (empty)
+		return 0.0f;
+
+	float3 extent = bounds.maxi - bounds.mini;
+	float surface_area = 2.0f * (extent.x * extent.y + extent.x * extent.z + extent.y * extent.z);
+
+	return power * orientation_measure() * surface_area;
+}
+
+void LightBVHBuilder::build(const Scene& scene, const std::vector<float>& triangle_emission_texture_luminances, std::vector<LightBVHNode>& out_nodes, std::vector<int>& out_leaf_indices)
+{
+	int emissive_triangle_count = static_cast<int>(scene.emissive_triangle_indices.size());
+
+	std::vector<float3> emissive_triangles_vertices(emissive_triangle_count * 3);
+	std::vector<float> emissive_triangles_power(emissive_triangle_count);
+	for (int i = 0; i < emissive_triangle_count; i++)
+	{
+		int triangle_index = scene.emissive_triangle_indices[i];
+
+		float3& vertex_A = emissive_triangles_vertices[i * 3 + 0];
+		float3& vertex_B = emissive_triangles_vertices[i * 3 + 1];
+		float3& vertex_C = emissive_triangles_vertices[i * 3 + 2];
+		scene.get_scene_primitive_vertices(triangle_index, vertex_A, vertex_B, vertex_C);
+
+		const SceneInstance& instance = scene.instances[get_scene_primitive_instance_index(scene.instances.data(), static_cast<int>(scene.instances.size()), triangle_index)];
+		int mesh_triangle_index = get_scene_primitive_mesh_triangle(instance, triangle_index);
+		float texture_luminance = triangle_emission_texture_luminances.empty() ? 1.0f : triangle_emission_texture_luminances[mesh_triangle_index];
+
+		float area = hippt::length(hippt::cross(vertex_B - vertex_A, vertex_C - vertex_A)) * 0.5f;
+		// Power of a diffuse emitter. Degenerate triangles get a power of 0 and will never be sampled,
+		// which is consistent with the uniform sampler that cannot sample them either
+		emissive_triangles_power[i] = M_PI * area * scene.materials[scene.material_indices[mesh_triangle_index]].get_emission_power_luminance(texture_luminance);
+	}
+
+	build(scene.emissive_triangle_indices, emissive_triangles_vertices, emissive_triangles_power, out_nodes, out_leaf_indices);
+}
+
+void LightBVHBuilder::build(const std::vector<int>& emissive_triangle_indices, const std::vector<float3>& emissive_triangles_vertices, const std::vector<float>& emissive_triangles_power, std::vector<LightBVHNode>& out_nodes, std::vector<int>& out_leaf_indices)
+{
+	out_nodes.clear();
+	out_leaf_indices.clear();
+
+	int emissive_triangle_count = static_cast<int>(emissive_triangle_indices.size());
+	if (emissive_triangle_count == 0)
+		return;
+
+	std::vector<BuildPrimitive> primitives(emissive_triangle_count);
+	for (int i = 0; i < emissive_triangle_count; i++)
+	{
+		const float3& vertex_A = emissive_triangles_vertices[i * 3 + 0];
+		const float3& vertex_B = emissive_triangles_vertices[i * 3 + 1];
+		const float3& vertex_C = emissive_triangles_vertices[i * 3 + 2];
+
+		BuildPrimitive& primitive = primitives[i];
+		primitive.emissive_index = i;
+		primitive.centroid = (vertex_A + vertex_B + vertex_C) / 3.0f;
+
+		LightBounds& light_bounds = primitive.light_bounds;
+		light_bounds = get_triangle_light_bounds(vertex_A, vertex_B, vertex_C);
+		light_bounds.power = emissive_triangles_power[i];
+	}
+
+	out_nodes.reserve(emissive_triangle_count * 2 - 1);
+	out_leaf_indices.resize(emissive_triangle_count, -1);
+
+	struct BuildTask
+	{
+		int node_index;
+		int parent_index;
+		int begin;
+		int end;
+	};
+
+	// Explicit stack instead of recursion, scenes can have millions of emissive triangles
+	std::vector<BuildTask> tasks;
+	out_nodes.emplace_back();
+	tasks.push_back({ 0, -1, 0, emissive_triangle_count });
+	while (!tasks.empty())
+	{
+		BuildTask task = tasks.back();
+		tasks.pop_back();
+
+		LightBounds node_bounds;
+		for (int i = task.begin; i < task.end; i++)
+			node_bounds.extend(primitives[i].light_bounds);
+
+		LightBVHNode& node = out_nodes[task.node_index];
+		node.bbox_min = node_bounds.bounds.mini;
+		node.bbox_max = node_bounds.bounds.maxi;
+		node.cone_axis = node_bounds.cone_axis;
+		node.cos_theta_o = node_bounds.cos_theta_o;
+		node.cos_theta_e = node_bounds.cos_theta_e;
+		node.power = node_bounds.power;
+		node.parent_index = task.parent_index;
+
+		if (task.end - task.begin == 1)
+		{
+			const BuildPrimitive& primitive = primitives[task.begin];
+
+			node.first_child_index = -1;
+			node.emissive_triangle_index = emissive_triangle_indices[primitive.emissive_index];
+			out_leaf_indices[primitive.emissive_index] = task.node_index;
+
+			continue;
+		}
+
+		int middle = split(primitives, task.begin, task.end, node_bounds);
+
+		// The two children are allocated next to each other
+		int first_child_index = static_cast<int>(out_nodes.size());
+		// Not using 'node' anymore here because emplace_back() may invalidate the reference
+		out_nodes[task.node_index].first_child_index = first_child_index;
+		out_nodes.emplace_back();
+		out_nodes.emplace_back();
+
+		tasks.push_back({ first_child_index + 1, task.node_index, middle, task.end });
+		tasks.push_back({ first_child_index, task.node_index, task.begin, middle });
+	}
+}
+
+void LightBVHBuilder::refit_power(std::vector<LightBVHNode>& nodes, const std::vector<int>& leaf_indices, const std::vector<float>& emissive_triangles_power)
+{
+	for (int i = 0; i < leaf_indices.size(); i++)
+		nodes[leaf_indices[i]].power = emissive_triangles_power[i];
+
+	// The children of a node are always allocated after their parent so iterating
+	// the nodes backwards refits the children before their parent
+	for (int node_index = static_cast<int>(nodes.size()) - 1; node_index >= 0; node_index--)
+	{
+		LightBVHNode& node = nodes[node_index];
+		if (node.first_child_index != -1)
+			node.power = nodes[node.first_child_index].power + nodes[node.first_child_index + 1].power;
+	}
+}
+
+void LightBVHBuilder::refit_bounds(std::vector<LightBVHNode>& nodes, const std::vector<int>& leaf_indices, const std::vector<float3>& emissive_triangles_vertices)
+{
+	std::vector<LightBounds> nodes_bounds(nodes.size());
+	for (int i = 0; i < leaf_indices.size(); i++)
+		nodes_bounds[leaf_indices[i]] = get_triangle_light_bounds(emissive_triangles_vertices[i * 3 + 0], emissive_triangles_vertices[i * 3 + 1], emissive_triangles_vertices[i * 3 + 2]);
+
+	// Same as in refit_power(), the children are refit before their parent
+	for (int node_index = static_cast<int>(nodes.size()) - 1; node_index >= 0; node_index--)
+	{
+		LightBVHNode& node = nodes[node_index];
+		LightBounds& node_bounds = nodes_bounds[node_index];
+		if (node.first_child_index != -1)
+		{
+			node_bounds = nodes_bounds[node.first_child_index];
+			node_bounds.extend(nodes_bounds[node.first_child_index + 1]);
+		}
+
+		node.bbox_min = node_bounds.bounds.mini;
+		node.bbox_max = node_bounds.bounds.maxi;
+		node.cone_axis = node_bounds.cone_axis;
+		node.cos_theta_o = node_bounds.cos_theta_o;
+		node.cos_theta_e = node_bounds.cos_theta_e;
+	}
+}
+
+LightBVHBuilder::LightBounds LightBVHBuilder::get_triangle_light_bounds(const float3& vertex_A, const float3& vertex_B, const float3& vertex_C)
+{
+	float3 normal = hippt::cross(vertex_B - vertex_A, vertex_C - vertex_A);
+	float length_normal = hippt::length(normal);
+
+	LightBounds light_bounds;
+	light_bounds.empty = false;
+	light_bounds.bounds.extend(vertex_A);
+	light_bounds.bounds.extend(vertex_B);
+	light_bounds.bounds.extend(vertex_C);
+	if (length_normal > 0.0f)
+		light_bounds.cone_axis = normal / length_normal;
+	light_bounds.cos_theta_o = 1.0f;
+	// Diffuse emitters
+	light_bounds.cos_theta_e = 0.0f;
+
+	return light_bounds;
+}
+
+int LightBVHBuilder::split(std::vector<BuildPrimitive>& primitives, int begin, int end, const LightBounds& node_bounds)
+{
+	BoundingBox centroid_bounds;
+	for (int i = begin; i < end; i++)
+		centroid_bounds.extend(primitives[i].centroid);
+
+	float3 centroid_extent = centroid_bounds.maxi - centroid_bounds.mini;
+	float3 node_extent = node_bounds.bounds.maxi - node_bounds.bounds.mini;
+	float max_node_extent = hippt::max(node_extent.x, hippt::max(node_extent.y, node_extent.z));
+
+	float best_cost = std::numeric_limits<float>::max();
+	int best_axis = -1;
+	int best_split_bin = -1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float axis_centroid_min = (&centroid_bounds.mini.x)[axis];
+		float axis_centroid_extent = (&centroid_extent.x)[axis];
+		if (axis_centroid_extent <= 0.0f)
+			// All the centroids are at the same position along that axis, cannot split
+			continue;
+
+		std::array<LightBounds, SAOH_BIN_COUNT> bins;
+		for (int i = begin; i < end; i++)
+		{
+			int bin_index = static_cast<int>(SAOH_BIN_COUNT * (((&primitives[i].centroid.x)[axis] - axis_centroid_min) / axis_centroid_extent));
+			bin_index = hippt::min(bin_index, SAOH_BIN_COUNT - 1);
+
+			bins[bin_index].extend(primitives[i].light_bounds);
+		}
+
+		// Bounds of the bins [0, i] and [i + 1, SAOH_BIN_COUNT - 1]
+		std::array<LightBounds, SAOH_BIN_COUNT - 1> left_bounds;
+		std::array<LightBounds, SAOH_BIN_COUNT - 1> right_bounds;
+		LightBounds accumulated;
+		for (int i = 0; i < SAOH_BIN_COUNT - 1; i++)
+		{
+			accumulated.extend(bins[i]);
+			left_bounds[i] = accumulated;
+		}
+		accumulated = LightBounds();
+		for (int i = SAOH_BIN_COUNT - 1; i > 0; i--)
+		{
+			accumulated.extend(bins[i]);
+			right_bounds[i - 1] = accumulated;
+		}
+
+		// Regularization factor of the SAOH that favors splitting thin nodes along their long axis
+		float axis_node_extent = (&node_extent.x)[axis];
+		float regularization = axis_node_extent > 0.0f ? max_node_extent / axis_node_extent : 1.0f;
+
+		for (int i = 0; i < SAOH_BIN_COUNT - 1; i++)
+		{
+			if (left_bounds[i].empty || right_bounds[i].empty)
+				continue;
+
+			float cost = regularization * (left_bounds[i].cost() + right_bounds[i].cost());
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split_bin = i;
+			}
+		}
+	}
+
+	int middle = begin + (end - begin) / 2;
+	if (best_axis != -1)
+	{
+		float axis_centroid_min = (&centroid_bounds.mini.x)[best_axis];
+		float axis_centroid_extent = (&centroid_extent.x)[best_axis];
+
+		auto first_right = std::partition(primitives.begin() + begin, primitives.begin() + end, [=](const BuildPrimitive& primitive)
+		{
+			int bin_index = static_cast<int>(SAOH_BIN_COUNT * (((&primitive.centroid.x)[best_axis] - axis_centroid_min) / axis_centroid_extent));
+			bin_index = hippt::min(bin_index, SAOH_BIN_COUNT - 1);
+
+			return bin_index <= best_split_bin;
+		});
+
+		int partition_middle = static_cast<int>(first_right - primitives.begin());
+		if (partition_middle != begin && partition_middle != end)
+			middle = partition_middle;
+	}
+
+	// If no split could be found (all the centroids are at the same position for example),
+	// 'middle' is the median index and the primitives are split in two halves of equal count
+
+	return middle;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef LIGHT_BVH_BUILDER_H
+#define LIGHT_BVH_BUILDER_H
+
+#include "HostDeviceCommon/LightBVHNode.h"
+#include "Scene/BoundingBox.h"
+
+#include <vector>
+
+struct Scene;
+
+/**
+ * Builds the light hierarchy (see LightBVHNode) over the emissive triangles of a scene.
+ *
+ * The hierarchy is built top-down with binned splits that minimize the surface area
+ * orientation heuristic (SAOH) of [Importance Sampling of Many Lights with Adaptive Tree Splitting,
+ * Conty Estevez, Kulla, 2018]. Each leaf contains exactly one emissive triangle
+ */
+class LightBVHBuilder
+{
+public:
+	/**
+	 * Builds the light hierarchy of the emissive triangles 'scene.emissive_triangle_indices'.
+	 *
+	 * 'out_nodes' is filled with the nodes of the hierarchy, root at index 0.
+	 * 'out_leaf_indices[i]' is filled with the index of the leaf node that contains the triangle
+	 * 'scene.emissive_triangle_indices[i]'
+	 *
+	 * 'triangle_emission_texture_luminances' are the luminances of the emission textures under the triangles
+	 * of the scene returned by EmissiveTextureIntegrator, for the power of the triangles with an emission texture.
+	 *
+	 * Both vectors are left empty if the scene has no emissive triangles
+	 */
+	static void build(const Scene& scene, const std::vector<float>& triangle_emission_texture_luminances, std::vector<LightBVHNode>& out_nodes, std::vector<int>& out_leaf_indices);
+	/**
+	 * Same as above but for the emissive triangles 'emissive_triangle_indices' whose world space vertices are
+	 * 'emissive_triangles_vertices[i * 3 + 0]', '[i * 3 + 1]' and '[i * 3 + 2]' and whose power is
+	 * 'emissive_triangles_power[i]'. Used when the set of emissive triangles changes after the scene was loaded
+	 */
+	static void build(const std::vector<int>& emissive_triangle_indices, const std::vector<float3>& emissive_triangles_vertices, const std::vector<float>& emissive_triangles_power, std::vector<LightBVHNode>& out_nodes, std::vector<int>& out_leaf_indices);
+
+	/**
+	 * Updates the power of the nodes of a hierarchy built by build() without modifying
+	 * its structure. Used when the emission of the materials changes.
+	 *
+	 * 'emissive_triangles_power[i]' is the new power of the triangle 'scene.emissive_triangle_indices[i]'
+	 * of the scene the hierarchy was built from
+	 */
+	static void refit_power(std::vector<LightBVHNode>& nodes, const std::vector<int>& leaf_indices, const std::vector<float>& emissive_triangles_power);
+
+	/**
+	 * Updates the bounds (AABB and cone of normals) of the nodes of a hierarchy built by build()
+	 * without modifying its structure. Used when the instances of the emissive triangles move.
+	 * The power of the nodes is left untouched.
+	 *
+	 * 'emissive_triangles_vertices[i * 3 + 0]', '[i * 3 + 1]' and '[i * 3 + 2]' are the new world
+	 * space vertices of the triangle 'scene.emissive_triangle_indices[i]' of the scene the
+	 * hierarchy was built from
+	 */
+	static void refit_bounds(std::vector<LightBVHNode>& nodes, const std::vector<int>& leaf_indices, const std::vector<float3>& emissive_triangles_vertices);
+
+private:
+	static constexpr int SAOH_BIN_COUNT = 12;
+
+	struct LightBounds
+	{
+		/**
+		 * Extends these bounds with the given bounds (both the AABB and the cone of normals)
+		 */
+		void extend(const LightBounds& other);
+
+		/**
+		 * Returns the orientation measure M_Omega of the SAOH for these bounds
+		 */
+		float orientation_measure() const;
+
+		/**
+		 * Returns the SAOH cost of these bounds, without the regularization factor
+		 */
+		float cost() const;
+
+		BoundingBox bounds;
+
+		float3 cone_axis = { 0.0f, 0.0f, 1.0f };
+		float cos_theta_o = 1.0f;
+		float cos_theta_e = 0.0f;
+
+		float power = 0.0f;
+
+		// Whether or not any light has been added to these bounds yet.
+		// Used to handle the union with empty bounds
+		bool empty = true;
+	};
+
+	/**
+	 * Returns the bounds of a diffuse emissive triangle, without its power
+	 */
+	static LightBounds get_triangle_light_bounds(const float3& vertex_A, const float3& vertex_B, const float3& vertex_C);
+
+	struct BuildPrimitive
+	{
+		LightBounds light_bounds;
+		float3 centroid;
+
+		// Index of the triangle in scene.emissive_triangle_indices
+		int emissive_index;
+	};
+
+	/**
+	 * Partitions the primitives [begin, end[ in two and returns the index of the first
+	 * primitive of the right partition. Both partitions are guaranteed to be non-empty
+	 */
+	static int split(std::vector<BuildPrimitive>& primitives, int begin, int end, const LightBounds& node_bounds);
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/LightClustersBuilder.h"
+#include "Utils/Utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Squared distance between the two axis aligned boxes, 0 if they overlap
+ */
+static float box_box_squared_distance(const float3& min_a, const float3& max_a, const float3& min_b, const float3& max_b)
+{
+	float dx = hippt::max(0.0f, hippt::max(min_a.x - max_b.x, min_b.x - max_a.x));
+	float dy = hippt::max(0.0f, hippt::max(min_a.y - max_b.y, min_b.y - max_a.y));
+	float dz = hippt::max(0.0f, hippt::max(min_a.z - max_b.z, min_b.z - max_a.z));
+
+	return dx * dx + dy * dy + dz * dz;
+}
+
+void LightClustersBuilder::build(const std::vector<int>& emissive_triangle_indices, const std::vector<float3>& emissive_triangles_vertices, const std::vector<float>& emissive_triangles_power,
+	const BoundingBox& grid_bounds, float minimum_light_contribution, LightClustersGrid& out_grid, LightClustersData& out_data)
+{
+	out_data = LightClustersData();
+	out_grid.grid_resolution = 0;
+
+	int emissive_triangle_count = static_cast<int>(emissive_triangle_indices.size());
+	if (emissive_triangle_count == 0 || minimum_light_contribution <= 0.0f)
+		return;
+
+	// Padding the box so that the flat scenes (or a flat dimension of
+	// the scene) still have a non-zero extent on all the axes
+	float padding = hippt::max(1.0e-3f, grid_bounds.get_max_extent() * 1.0e-3f);
+	out_grid.grid_min = grid_bounds.mini - make_float3(padding, padding, padding);
+	out_grid.grid_max = grid_bounds.maxi + make_float3(padding, padding, padding);
+	out_grid.grid_resolution = GRID_RESOLUTION;
+
+	float3 cell_size = (out_grid.grid_max - out_grid.grid_min) / static_cast<float>(GRID_RESOLUTION);
+	int cell_count = GRID_RESOLUTION * GRID_RESOLUTION * GRID_RESOLUTION;
+
+	// Emissive indices (in 'emissive_triangle_indices') of the lights of each cell. The lights
+	// are visited in order so the lists are sorted by scene primitive index if the emissive
+	// triangles are
+	std::vector<std::vector<int>> cells_lights(cell_count);
+	for (int i = 0; i < emissive_triangle_count; i++)
+	{
+		if (emissive_triangles_power[i] <= 0.0f)
+			continue;
+
+		BoundingBox triangle_bounds;
+		for (int vertex = 0; vertex < 3; vertex++)
+			triangle_bounds.extend(emissive_triangles_vertices[i * 3 + vertex]);
+
+		float radius = std::sqrt(emissive_triangles_power[i] / minimum_light_contribution);
+		float3 influence_min = triangle_bounds.mini - make_float3(radius, radius, radius);
+		float3 influence_max = triangle_bounds.maxi + make_float3(radius, radius, radius);
+
+		int min_x = std::clamp(static_cast<int>(std::floor((influence_min.x - out_grid.grid_min.x) / cell_size.x)), 0, GRID_RESOLUTION - 1);
+		int min_y = std::clamp(static_cast<int>(std::floor((influence_min.y - out_grid.grid_min.y) / cell_size.y)), 0, GRID_RESOLUTION - 1);
+		int min_z = std::clamp(static_cast<int>(std::floor((influence_min.z - out_grid.grid_min.z) / cell_size.z)), 0, GRID_RESOLUTION - 1);
+		int max_x = std::clamp(static_cast<int>(std::floor((influence_max.x - out_grid.grid_min.x) / cell_size.x)), 0, GRID_RESOLUTION - 1);
+		int max_y = std::clamp(static_cast<int>(std::floor((influence_max.y - out_grid.grid_min.y) / cell_size.y)), 0, GRID_RESOLUTION - 1);
+		int max_z = std::clamp(static_cast<int>(std::floor((influence_max.z - out_grid.grid_min.z) / cell_size.z)), 0, GRID_RESOLUTION - 1);
+
+		for (int z = min_z; z <= max_z; z++)
+			for (int y = min_y; y <= max_y; y++)
+				for (int x = min_x; x <= max_x; x++)
+				{
+					float3 cell_min = out_grid.grid_min + make_float3(x * cell_size.x, y * cell_size.y, z * cell_size.z);
+					float3 cell_max = cell_min + cell_size;
+					// Distance from the cell to the bounding box of the triangle,
+					// a lower bound of the distance to the triangle itself
+					if (box_box_squared_distance(cell_min, cell_max, triangle_bounds.mini, triangle_bounds.maxi) > radius * radius)
+						continue;
+
+					cells_lights[x + (y + z * GRID_RESOLUTION) * GRID_RESOLUTION].push_back(i);
+				}
+	}
+
+	// The cells with all the lights of the scene are left empty and use the global alias table:
+	// that's the same distribution without duplicating the lights in every cell
+	out_data.cells_offsets.resize(cell_count + 1);
+	out_data.cells_total_power.resize(cell_count, 0.0f);
+	out_data.cells_offsets[0] = 0;
+	for (int cell_index = 0; cell_index < cell_count; cell_index++)
+	{
+		int cell_light_count = static_cast<int>(cells_lights[cell_index].size());
+		if (cell_light_count == emissive_triangle_count)
+		{
+			cells_lights[cell_index].clear();
+			cell_light_count = 0;
+		}
+
+		out_data.cells_offsets[cell_index + 1] = out_data.cells_offsets[cell_index] + cell_light_count;
+	}
+
+	int total_cells_light_count = out_data.cells_offsets[cell_count];
+	out_data.cells_emissive_triangles.resize(total_cells_light_count);
+	out_data.cells_alias_table_probas.resize(total_cells_light_count);
+	out_data.cells_alias_table_alias.resize(total_cells_light_count);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int cell_index = 0; cell_index < cell_count; cell_index++)
+	{
+		std::vector<int>& cell_lights = cells_lights[cell_index];
+		if (cell_lights.empty())
+			continue;
+
+		// Sorted by scene primitive index for the binary search of the PDF evaluation
+		std::sort(cell_lights.begin(), cell_lights.end(), [&emissive_triangle_indices](int a, int b) { return emissive_triangle_indices[a] < emissive_triangle_indices[b]; });
+
+		int cell_offset = out_data.cells_offsets[cell_index];
+		std::vector<float> cell_power(cell_lights.size());
+		for (int i = 0; i < cell_lights.size(); i++)
+		{
+			out_data.cells_emissive_triangles[cell_offset + i] = emissive_triangle_indices[cell_lights[i]];
+			cell_power[i] = emissive_triangles_power[cell_lights[i]];
+		}
+
+		std::vector<float> cell_probas;
+		std::vector<int> cell_alias;
+		Utils::compute_alias_table(cell_power, cell_probas, cell_alias, &out_data.cells_total_power[cell_index]);
+		std::copy(cell_probas.begin(), cell_probas.end(), out_data.cells_alias_table_probas.begin() + cell_offset);
+		std::copy(cell_alias.begin(), cell_alias.end(), out_data.cells_alias_table_alias.begin() + cell_offset);
+	}
+}
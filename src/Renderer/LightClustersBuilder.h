@@ -0,0 +1,54 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef LIGHT_CLUSTERS_BUILDER_H
+#define LIGHT_CLUSTERS_BUILDER_H
+
+#include "HostDeviceCommon/LightClusters.h"
+#include "Scene/BoundingBox.h"
+
+#include <vector>
+
+/**
+ * CPU side buffers of a LightClustersGrid, see the grid for their layout
+ */
+struct LightClustersData
+{
+	std::vector<int> cells_offsets;
+	std::vector<int> cells_emissive_triangles;
+	std::vector<float> cells_alias_table_probas;
+	std::vector<int> cells_alias_table_alias;
+	std::vector<float> cells_total_power;
+};
+
+/**
+ * Builds the world space grid of light clusters (see LightClustersGrid) of the
+ * ETSS_LIGHT_CLUSTERS emissive triangles sampling strategy.
+ *
+ * The irradiance that a diffuse emissive triangle of radiance L and area A gives to a point at
+ * distance d of its nearest point is at most L * A / d^2: the triangle is culled from the cells
+ * farther than sqrt(L * A / minimum_light_contribution) from its bounding box. L * A is the power
+ * of the triangle given to build(), on the luminance of the emission
+ */
+class LightClustersBuilder
+{
+public:
+	static constexpr int GRID_RESOLUTION = 32;
+
+	/**
+	 * Builds the light clusters of the emissive triangles 'emissive_triangle_indices' whose world space
+	 * vertices are 'emissive_triangles_vertices[i * 3 + 0]', '[i * 3 + 1]' and '[i * 3 + 2]' and whose power
+	 * (area * luminance of the emission, as in the alias table of the emissive triangles) is 'emissive_triangles_power[i]'
+	 * over the bounds 'grid_bounds'.
+	 *
+	 * 'out_grid' is given the bounds and the resolution of the grid, its buffer pointers are left untouched.
+	 * The resolution is 0 (no grid, the global alias table is sampled everywhere) if 'minimum_light_contribution'
+	 * is 0 or if there are no emissive triangles
+	 */
+	static void build(const std::vector<int>& emissive_triangle_indices, const std::vector<float3>& emissive_triangles_vertices, const std::vector<float>& emissive_triangles_power,
+		const BoundingBox& grid_bounds, float minimum_light_contribution, LightClustersGrid& out_grid, LightClustersData& out_data);
+};
+
+#endif
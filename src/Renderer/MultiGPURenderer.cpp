@@ -0,0 +1,441 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/MultiGPURenderer.h"
+#include "Threads/ThreadManager.h"
+
+#include <algorithm>
+#include <thread>
+
+extern ImGuiLogger g_imgui_logger;
+
+MultiGPURenderer::MultiGPURenderer(const std::vector<int>& device_indices, SplitMode split_mode) : m_split_mode(split_mode)
+{
+	for (int device_index : device_indices)
+	{
+		std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(device_index);
+
+		m_hiprt_orochi_ctxs.push_back(hiprt_orochi_ctx);
+		m_renderers.push_back(std::make_shared<GPURenderer>(hiprt_orochi_ctx, /* headless */ true));
+	}
+
+	set_rng_seed(42);
+
+	m_device_render_times.resize(m_renderers.size(), 0.0f);
+	m_device_frame_counts.resize(m_renderers.size(), 0);
+	m_device_frame_queued.resize(m_renderers.size(), false);
+	m_perf_metrics_last_sample_counts.resize(m_renderers.size(), 0);
+	m_perf_metrics_last_time = std::chrono::high_resolution_clock::now();
+
+	// The renderers need their stream for resizing
+	ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_CREATE);
+}
+
+void MultiGPURenderer::set_rng_seed(unsigned int seed)
+{
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		if (m_split_mode == SAMPLE_SPLITTING)
+			// Different seeds so that the devices render different samples.
+			// Any odd multiplier works, this one spreads the seeds apart
+			m_renderers[i]->set_rng_seed(seed + i * 0x9E3779B9u);
+		else
+			m_renderers[i]->set_rng_seed(seed);
+	}
+}
+
+void MultiGPURenderer::resize(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+
+	int device_count = get_device_count();
+	m_band_start_rows.resize(device_count);
+	m_band_stop_rows.resize(device_count);
+
+	if (m_split_mode == SAMPLE_SPLITTING)
+	{
+		// All the devices render the full frame with the full camera
+		for (int i = 0; i < device_count; i++)
+		{
+			OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+			m_band_start_rows[i] = 0;
+			m_band_stop_rows[i] = height;
+
+			m_renderers[i]->set_camera(m_camera);
+			m_renderers[i]->resize(width, height);
+		}
+
+		return;
+	}
+
+	for (int i = 0; i < device_count; i++)
+	{
+		m_band_start_rows[i] = height * i / device_count;
+		m_band_stop_rows[i] = height * (i + 1) / device_count;
+	}
+
+	for (int i = 0; i < device_count; i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		// Rows of the framebuffer go upwards in NDC space
+		float ndc_y_min = m_band_start_rows[i] / static_cast<float>(height) * 2.0f - 1.0f;
+		float ndc_y_max = m_band_stop_rows[i] / static_cast<float>(height) * 2.0f - 1.0f;
+
+		Camera band_camera = m_camera;
+		band_camera.set_vertical_crop(ndc_y_min, ndc_y_max);
+		m_renderers[i]->set_camera(band_camera);
+
+		// Resizing recomputes the projection matrix of the camera of the
+		// renderer with the aspect of the band and the crop
+		m_renderers[i]->resize(width, m_band_stop_rows[i] - m_band_start_rows[i]);
+	}
+}
+
+void MultiGPURenderer::set_scene(const Scene& scene)
+{
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		// Each device builds its own copy of the scene and BVH
+		m_renderers[i]->set_scene(scene);
+	}
+}
+
+void MultiGPURenderer::set_camera(const Camera& camera)
+{
+	m_camera = camera;
+
+	for (std::shared_ptr<GPURenderer>& renderer : m_renderers)
+		renderer->set_camera(camera);
+}
+
+void MultiGPURenderer::set_envmap(const Image32Bit& envmap, const std::string& envmap_filepath)
+{
+	for (std::shared_ptr<GPURenderer>& renderer : m_renderers)
+		renderer->set_envmap(envmap, envmap_filepath);
+}
+
+void MultiGPURenderer::set_bvh_build_quality(BVHBuildQuality build_quality)
+{
+	for (std::shared_ptr<GPURenderer>& renderer : m_renderers)
+		renderer->set_bvh_build_quality(build_quality);
+}
+
+void MultiGPURenderer::set_half_precision_texcoords(bool half_precision_texcoords)
+{
+	for (std::shared_ptr<GPURenderer>& renderer : m_renderers)
+		renderer->set_half_precision_texcoords(half_precision_texcoords);
+}
+
+void MultiGPURenderer::set_quantized_vertices_positions(bool quantized_vertices_positions)
+{
+	for (std::shared_ptr<GPURenderer>& renderer : m_renderers)
+		renderer->set_quantized_vertices_positions(quantized_vertices_positions);
+}
+
+void MultiGPURenderer::set_compact_bvh(bool compact_bvh)
+{
+	for (std::shared_ptr<GPURenderer>& renderer : m_renderers)
+		renderer->set_compact_bvh(compact_bvh);
+}
+
+void MultiGPURenderer::for_each_renderer(std::function<void(GPURenderer&)> function)
+{
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		function(*m_renderers[i]);
+	}
+}
+
+void MultiGPURenderer::reset(std::shared_ptr<ApplicationSettings> application_settings)
+{
+	for_each_renderer([&application_settings](GPURenderer& renderer) {
+		renderer.reset(application_settings);
+	});
+
+	std::fill(m_device_render_times.begin(), m_device_render_times.end(), 0.0f);
+	std::fill(m_device_frame_counts.begin(), m_device_frame_counts.end(), 0);
+	std::fill(m_device_frame_queued.begin(), m_device_frame_queued.end(), false);
+	std::fill(m_perf_metrics_last_sample_counts.begin(), m_perf_metrics_last_sample_counts.end(), 0);
+	m_perf_metrics_last_time = std::chrono::high_resolution_clock::now();
+
+	if (m_split_mode == SAMPLE_SPLITTING && m_renderers[0]->get_render_settings().freeze_random)
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Random is frozen: all the devices are going to render the same samples");
+}
+
+bool MultiGPURenderer::render()
+{
+	if (m_split_mode == SAMPLE_SPLITTING)
+		return render_sample_splitting();
+
+	// Queuing the frame on all the devices first so that they all render in parallel
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		m_renderers[i]->update();
+		m_renderers[i]->render();
+	}
+
+	bool one_ray_active = false;
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		m_renderers[i]->synchronize_kernel();
+		m_renderers[i]->copy_status_buffers();
+		m_renderers[i]->compute_render_pass_times();
+
+		m_device_render_times[i] += m_renderers[i]->get_last_frame_time();
+		m_device_frame_counts[i]++;
+		one_ray_active |= m_renderers[i]->get_status_buffer_values().one_ray_active;
+	}
+
+	return one_ray_active;
+}
+
+bool MultiGPURenderer::render_sample_splitting()
+{
+	// Queuing a frame on all the devices that are idle
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		if (m_device_frame_queued[i])
+			continue;
+
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		m_renderers[i]->update();
+		m_renderers[i]->render();
+		m_device_frame_queued[i] = true;
+	}
+
+	// Waiting for at least one device to finish its frame. The other devices keep
+	// rendering in the meantime and are collected by a later call
+	bool one_frame_done = false;
+	while (!one_frame_done)
+	{
+		for (int i = 0; i < get_device_count(); i++)
+		{
+			OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+			if (!m_renderers[i]->frame_render_done())
+				continue;
+
+			m_renderers[i]->copy_status_buffers();
+			m_renderers[i]->compute_render_pass_times();
+
+			m_device_render_times[i] += m_renderers[i]->get_last_frame_time();
+			m_device_frame_counts[i]++;
+			m_device_frame_queued[i] = false;
+
+			one_frame_done = true;
+		}
+
+		if (!one_frame_done)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	// The render is over only once all the devices have converged
+	bool one_ray_active = false;
+	for (int i = 0; i < get_device_count(); i++)
+		one_ray_active |= m_device_frame_queued[i] || m_renderers[i]->get_status_buffer_values().one_ray_active;
+
+	return one_ray_active;
+}
+
+Image32Bit MultiGPURenderer::download_framebuffer()
+{
+	Image32Bit image(m_width, m_height, 3);
+
+	if (m_split_mode == SAMPLE_SPLITTING)
+	{
+		// Average of the renders of the devices weighted, per pixel, by the sample counts of the devices so
+		// that the result is the same as if all the samples had been rendered by one device. The adaptive sampling
+		// of a device may have stopped a pixel long before the other devices did
+		std::vector<int> total_sample_counts(m_width * m_height, 0);
+		for (int i = 0; i < get_device_count(); i++)
+		{
+			OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+			Image32Bit device_render = m_renderers[i]->download_framebuffer();
+			std::vector<int> device_sample_counts = m_renderers[i]->download_pixel_sample_counts();
+
+			for (int pixel = 0; pixel < m_width * m_height; pixel++)
+			{
+				for (int channel = 0; channel < 3; channel++)
+					image[pixel * 3 + channel] += device_render[pixel * 3 + channel] * device_sample_counts[pixel];
+
+				total_sample_counts[pixel] += device_sample_counts[pixel];
+			}
+		}
+
+		for (int pixel = 0; pixel < m_width * m_height; pixel++)
+			for (int channel = 0; channel < 3; channel++)
+				image[pixel * 3 + channel] /= hippt::max(1, total_sample_counts[pixel]);
+
+		return image;
+	}
+
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		Image32Bit band = m_renderers[i]->download_framebuffer();
+
+		// The bands are stored one after the other in the final image
+		std::copy(band.data().begin(), band.data().end(), image.data().begin() + m_band_start_rows[i] * m_width * 3);
+	}
+
+	return image;
+}
+
+std::vector<int> MultiGPURenderer::download_pixel_sample_counts()
+{
+	std::vector<int> sample_counts(m_width * m_height, 0);
+
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		std::vector<int> device_sample_counts = m_renderers[i]->download_pixel_sample_counts();
+		if (m_split_mode == SAMPLE_SPLITTING)
+			for (int pixel = 0; pixel < m_width * m_height; pixel++)
+				sample_counts[pixel] += device_sample_counts[pixel];
+		else
+			std::copy(device_sample_counts.begin(), device_sample_counts.end(), sample_counts.begin() + m_band_start_rows[i] * m_width);
+	}
+
+	return sample_counts;
+}
+
+std::vector<RenderCheckpointDownload> MultiGPURenderer::download_checkpoints_async()
+{
+	std::vector<RenderCheckpointDownload> downloads;
+
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		downloads.push_back(m_renderers[i]->download_checkpoint_async());
+	}
+
+	return downloads;
+}
+
+bool MultiGPURenderer::load_checkpoints(const std::string& checkpoint_path)
+{
+	std::vector<RenderCheckpoint> checkpoints(get_device_count());
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		RenderCheckpoint& checkpoint = checkpoints[i];
+		int2 device_resolution = m_renderers[i]->m_render_resolution;
+
+		if (!checkpoint.read(RenderCheckpoint::get_device_file_path(checkpoint_path, i)))
+			return false;
+		else if (checkpoint.width != device_resolution.x || checkpoint.height != device_resolution.y)
+		{
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "The checkpoint of the device %d is %dx%d, its render is %dx%d", i, checkpoint.width, checkpoint.height, device_resolution.x, device_resolution.y);
+
+			return false;
+		}
+	}
+
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		OROCHI_CHECK_ERROR(oroCtxSetCurrent(m_hiprt_orochi_ctxs[i]->orochi_ctx));
+
+		m_renderers[i]->load_checkpoint(checkpoints[i]);
+	}
+
+	return true;
+}
+
+bool MultiGPURenderer::write_checkpoints(const std::vector<RenderCheckpointDownload>& downloads, const std::string& checkpoint_path)
+{
+	bool success = true;
+	for (int i = 0; i < static_cast<int>(downloads.size()); i++)
+	{
+		downloads[i].wait();
+
+		success &= downloads[i].get_checkpoint().write(RenderCheckpoint::get_device_file_path(checkpoint_path, i));
+	}
+
+	return success;
+}
+
+int MultiGPURenderer::get_device_count() const
+{
+	return static_cast<int>(m_renderers.size());
+}
+
+int MultiGPURenderer::get_sample_number()
+{
+	if (m_split_mode == SAMPLE_SPLITTING)
+	{
+		int total_sample_number = 0;
+		for (std::shared_ptr<GPURenderer>& renderer : m_renderers)
+			total_sample_number += renderer->get_render_settings().sample_number;
+
+		return total_sample_number;
+	}
+
+	return m_renderers[0]->get_render_settings().sample_number;
+}
+
+void MultiGPURenderer::update_perf_metrics(std::shared_ptr<PerformanceMetricsComputer> perf_metrics)
+{
+	std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+	double elapsed_seconds = std::chrono::duration<double>(now - m_perf_metrics_last_time).count();
+	if (elapsed_seconds <= 0.0)
+		return;
+
+	std::vector<int> samples_per_device(get_device_count(), 0);
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		int sample_number = m_renderers[i]->get_render_settings().sample_number;
+
+		// In SPLIT_FRAME mode, the devices each render a band of the same full frame samples
+		// so these samples are only counted once
+		if (m_split_mode == SAMPLE_SPLITTING || i == 0)
+			samples_per_device[i] = sample_number - m_perf_metrics_last_sample_counts[i];
+
+		m_perf_metrics_last_sample_counts[i] = sample_number;
+	}
+
+	perf_metrics->add_combined_samples_per_second(samples_per_device, elapsed_seconds);
+	m_perf_metrics_last_time = now;
+}
+
+const std::vector<float>& MultiGPURenderer::get_device_render_times() const
+{
+	return m_device_render_times;
+}
+
+void MultiGPURenderer::print_device_statistics() const
+{
+	for (int i = 0; i < get_device_count(); i++)
+	{
+		float samples_per_second = m_device_render_times[i] > 0.0f ? m_device_frame_counts[i] / (m_device_render_times[i] / 1000.0f) : 0.0f;
+
+		if (m_split_mode == SAMPLE_SPLITTING)
+		{
+			int sample_number = m_renderers[i]->get_render_settings().sample_number;
+
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Device %d '%s': %d samples in %.1fms (%.1f samples/s)", i, m_hiprt_orochi_ctxs[i]->device_properties.name, sample_number, m_device_render_times[i], samples_per_second);
+		}
+		else
+		{
+			float band_proportion = (m_band_stop_rows[i] - m_band_start_rows[i]) / static_cast<float>(m_height) * 100.0f;
+
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Device %d '%s': %.1f%% of the frame in %.1fms (%.1f frames/s)", i, m_hiprt_orochi_ctxs[i]->device_properties.name, band_proportion, m_device_render_times[i], samples_per_second);
+		}
+	}
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef MULTI_GPU_RENDERER_H
+#define MULTI_GPU_RENDERER_H
+
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "Image/Image.h"
+#include "Renderer/GPURenderer.h"
+#include "Scene/Camera.h"
+#include "Scene/SceneParser.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "UI/PerformanceMetricsComputer.h"
+
+#include <chrono>
+
+/**
+ * Renderer over multiple GPUs. Each device gets its own headless GPURenderer
+ * with a full copy of the scene (and its own BVH).
+ * 
+ * Two modes are available to split the work between the devices, see SplitMode
+ */
+class MultiGPURenderer
+{
+public:
+	enum SplitMode
+	{
+		// Each device renders one horizontal band of the frame. The bands are rendered with a camera
+		// cropped to that band (see Camera::set_vertical_crop()) so that the kernels don't need to know about
+		// the split. The accumulated framebuffers of the devices are then stacked into the final image.
+		// 
+		// Note that the spatial reuse of ReSTIR DI doesn't cross the borders of the bands
+		SPLIT_FRAME,
+
+		// Each device renders independent samples (different seeds) over the full frame.
+		// The devices don't wait for each other: a new frame is queued on a device as soon as its
+		// previous one is done so there is no load imbalance. The framebuffers of the devices are
+		// averaged (weighted by their sample counts) when downloading the final image.
+		// 
+		// Note that the temporal reuse of ReSTIR DI only reuses the samples of the same device
+		SAMPLE_SPLITTING
+	};
+
+	/**
+	 * Creates one headless renderer per given device index
+	 */
+	MultiGPURenderer(const std::vector<int>& device_indices, SplitMode split_mode = SPLIT_FRAME);
+
+	/**
+	 * Resizes the renderers. In SPLIT_FRAME mode, the frame is split in as many bands as there are devices.
+	 * Must be called after set_camera()
+	 */
+	void resize(int width, int height);
+
+	void set_scene(const Scene& scene);
+	void set_camera(const Camera& camera);
+	void set_envmap(const Image32Bit& envmap, const std::string& envmap_filepath);
+	void set_bvh_build_quality(BVHBuildQuality build_quality);
+	void set_half_precision_texcoords(bool half_precision_texcoords);
+	void set_quantized_vertices_positions(bool quantized_vertices_positions);
+	void set_compact_bvh(bool compact_bvh);
+	/**
+	 * Seeds the random number generators of the renderers. In SAMPLE_SPLITTING mode, each device
+	 * gets a different seed derived from 'seed' so that they render different samples
+	 */
+	void set_rng_seed(unsigned int seed);
+
+	/**
+	 * Calls the given function on the renderer of each device with the
+	 * context of that device current. Useful to apply the same render settings on all devices
+	 */
+	void for_each_renderer(std::function<void(GPURenderer&)> function);
+
+	void reset(std::shared_ptr<ApplicationSettings> application_settings);
+
+	/**
+	 * In SPLIT_FRAME mode, renders one frame on all the devices in parallel and waits for all of them.
+	 * 
+	 * In SAMPLE_SPLITTING mode, queues a new frame on every device whose last frame is done
+	 * and returns once at least one device has completed a frame.
+	 * 
+	 * Returns false if none of the devices has any active ray left (all their pixels converged)
+	 */
+	bool render();
+
+	/**
+	 * Returns the composited render (the accumulated samples divided by the
+	 * sample count) of all the devices as a 3-channel image.
+	 * 
+	 * Waits for the frames in flight on all the devices
+	 */
+	Image32Bit download_framebuffer();
+	/**
+	 * Returns the number of samples accumulated in each pixel of the composited render
+	 * (see GPURenderer::download_pixel_sample_counts()), summed over the devices in SAMPLE_SPLITTING mode.
+	 * 
+	 * Waits for the frames in flight on all the devices
+	 */
+	std::vector<int> download_pixel_sample_counts();
+	/**
+	 * Queues the download of the checkpoint of each device (see GPURenderer::download_checkpoint_async()),
+	 * after the frames in flight. Doesn't wait for the devices
+	 */
+	std::vector<RenderCheckpointDownload> download_checkpoints_async();
+	/**
+	 * Resumes the render of every device from its checkpoint file (see RenderCheckpoint::get_device_file_path()).
+	 * Must be called after reset().
+	 *
+	 * Nothing is resumed and false is returned if the checkpoint of one of the devices is missing, invalid or
+	 * doesn't match the resolution of its device: the devices of a render must resume together
+	 */
+	bool load_checkpoints(const std::string& checkpoint_path);
+	/**
+	 * Writes the checkpoints downloaded by download_checkpoints_async(). Waits for the downloads.
+	 * Can be called from any thread
+	 */
+	static bool write_checkpoints(const std::vector<RenderCheckpointDownload>& downloads, const std::string& checkpoint_path);
+
+	int get_device_count() const;
+	/**
+	 * In SPLIT_FRAME mode, returns the sample count of the first device. All devices render the same number of samples.
+	 * In SAMPLE_SPLITTING mode, returns the total number of samples of the devices (including the frames in flight)
+	 */
+	int get_sample_number();
+
+	/**
+	 * Adds the combined samples per second of all the devices since
+	 * the last call to this function to the given metrics
+	 */
+	void update_perf_metrics(std::shared_ptr<PerformanceMetricsComputer> perf_metrics);
+
+	/**
+	 * Returns the total GPU time (in milliseconds) spent by each device
+	 * rendering the frames since the last reset()
+	 */
+	const std::vector<float>& get_device_render_times() const;
+	/**
+	 * Logs the render time of each device and its share of the frame
+	 */
+	void print_device_statistics() const;
+
+private:
+	/**
+	 * render() for the SAMPLE_SPLITTING mode
+	 */
+	bool render_sample_splitting();
+
+	std::vector<std::shared_ptr<HIPRTOrochiCtx>> m_hiprt_orochi_ctxs;
+	std::vector<std::shared_ptr<GPURenderer>> m_renderers;
+
+	// First row (included) and last row (excluded) of the frame rendered by each device
+	std::vector<int> m_band_start_rows;
+	std::vector<int> m_band_stop_rows;
+
+	std::vector<float> m_device_render_times;
+	// Number of frames completed by each device since the last reset()
+	std::vector<int> m_device_frame_counts;
+	// Whether or not a frame has been queued on each device and not collected yet by render()
+	std::vector<bool> m_device_frame_queued;
+
+	// Sample counts of the devices at the last call to update_perf_metrics()
+	std::vector<int> m_perf_metrics_last_sample_counts;
+	std::chrono::high_resolution_clock::time_point m_perf_metrics_last_time;
+
+	SplitMode m_split_mode = SPLIT_FRAME;
+
+	Camera m_camera;
+	int m_width = 0;
+	int m_height = 0;
+};
+
+#endif
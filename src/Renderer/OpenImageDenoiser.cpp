@@ -5,13 +5,31 @@
 
 #include "Renderer/OpenImageDenoiser.h"
 #include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HIPRT-Orochi/OrochiDeviceMemoryPool.h"
 
+#include <chrono>
 #include <iostream>
 
 OpenImageDenoiser::OpenImageDenoiser()
 {
     m_device = nullptr;
-    m_denoised_buffer = nullptr;
+}
+
+OpenImageDenoiser::~OpenImageDenoiser()
+{
+    if (m_device.getHandle() != nullptr)
+        // The filters may still be executing on the stream
+        m_device.sync();
+
+    for (DenoiseSlot& slot : m_slots)
+        for (oroEvent_t event : { slot.snapshot_event, slot.start_event, slot.stop_event })
+            if (event != nullptr)
+                OROCHI_CHECK_ERROR(oroEventDestroy(event));
+
+    if (m_stream != nullptr)
+        OROCHI_CHECK_ERROR(oroStreamDestroy(m_stream));
+
+    OrochiDeviceMemoryPool::remove_external_usage(this);
 }
 
 void OpenImageDenoiser::set_use_normals(bool use_normals)
@@ -34,100 +52,173 @@ void OpenImageDenoiser::set_denoise_albedo(bool denoise_albedo_or_not)
     m_denoise_albedo = denoise_albedo_or_not;
 }
 
+void OpenImageDenoiser::set_quality(DenoiserQuality quality)
+{
+    m_quality = quality;
+}
+
+void OpenImageDenoiser::set_max_memory_MB(int max_memory_MB)
+{
+    m_max_memory_MB = max_memory_MB;
+}
+
 void OpenImageDenoiser::resize(int new_width, int new_height)
 {
     if (!check_valid_state())
         return;
 
+    // The buffers are allocated with the new size by finalize()
     m_width = new_width;
     m_height = new_height;
-
-    m_denoised_buffer = m_device.newBuffer(sizeof(ColorRGB32F) * new_width * new_height, oidn::Storage::Managed);
-    m_input_color_buffer_oidn = m_device.newBuffer(sizeof(ColorRGB32F) * new_width * new_height, oidn::Storage::Managed);
 }
 
-void OpenImageDenoiser::initialize()
+void OpenImageDenoiser::initialize(int device_index)
 {
-    create_device();
+    create_device(device_index);
 }
 
 void OpenImageDenoiser::finalize()
 {
-    if (!check_valid_state())
+    if (!check_valid_state() || m_buffers_released)
         return;
 
-    m_beauty_filter = m_device.newFilter("RT");
-    m_beauty_filter.setImage("color", m_input_color_buffer_oidn, oidn::Format::Float3, m_width, m_height);
-    m_beauty_filter.setImage("output", m_denoised_buffer, oidn::Format::Float3, m_width, m_height);
-    m_beauty_filter.set("cleanAux", m_denoise_albedo && m_denoise_normals);
-    m_beauty_filter.set("hdr", true);
+    release_slots();
 
-    if (m_use_normals)
+    // Creating the buffers here instead of in resize() because we want the creation/destruction
+    // to be dynamic in response to ImGui input so we cannot just wait for a window queue_resize event
+    // that would trigger OpenImageDenoiser::queue_resize()
+    oidn::Storage storage = m_cpu_device ? oidn::Storage::Host : oidn::Storage::Device;
+    for (int i = 0; i < get_slot_count(); i++)
     {
-        // Creating the buffers here instead of in resize() because we want the creation/destruction 
-        // to be dynamic in response to ImGui input so we cannot just wait for a window queue_resize event
-        // that would trigger OpenImageDenoiser::queue_resize()
-        m_normals_buffer_denoised_oidn = m_device.newBuffer(sizeof(float3) * m_width * m_height);
-        
-        m_beauty_filter.setImage("normal", m_normals_buffer_denoised_oidn, oidn::Format::Float3, m_width, m_height);
+        DenoiseSlot& slot = m_slots[i];
+
+        slot.color = m_device.newBuffer(sizeof(ColorRGB32F) * m_width * m_height, storage);
+        slot.output = m_device.newBuffer(sizeof(ColorRGB32F) * m_width * m_height, storage);
+
+        slot.beauty_filter = m_device.newFilter("RT");
+        slot.beauty_filter.setImage("color", slot.color, oidn::Format::Float3, m_width, m_height);
+        slot.beauty_filter.setImage("output", slot.output, oidn::Format::Float3, m_width, m_height);
+        slot.beauty_filter.set("cleanAux", m_denoise_albedo && m_denoise_normals);
+        slot.beauty_filter.set("hdr", true);
+        set_filter_parameters(slot.beauty_filter);
+
+        if (m_use_normals)
+        {
+            slot.normals = m_device.newBuffer(sizeof(float3) * m_width * m_height, storage);
+            slot.beauty_filter.setImage("normal", slot.normals, oidn::Format::Float3, m_width, m_height);
+
+            if (m_denoise_normals)
+            {
+                // The snapshot is denoised in place
+                slot.normals_filter = m_device.newFilter("RT");
+                slot.normals_filter.setImage("normal", slot.normals, oidn::Format::Float3, m_width, m_height);
+                slot.normals_filter.setImage("output", slot.normals, oidn::Format::Float3, m_width, m_height);
+                set_filter_parameters(slot.normals_filter);
+                slot.normals_filter.commit();
+            }
+        }
+
+        if (m_use_albedo)
+        {
+            slot.albedo = m_device.newBuffer(sizeof(ColorRGB32F) * m_width * m_height, storage);
+            slot.beauty_filter.setImage("albedo", slot.albedo, oidn::Format::Float3, m_width, m_height);
+
+            if (m_denoise_albedo)
+            {
+                slot.albedo_filter = m_device.newFilter("RT");
+                slot.albedo_filter.setImage("albedo", slot.albedo, oidn::Format::Float3, m_width, m_height);
+                slot.albedo_filter.setImage("output", slot.albedo, oidn::Format::Float3, m_width, m_height);
+                set_filter_parameters(slot.albedo_filter);
+                slot.albedo_filter.commit();
+            }
+        }
+
+        slot.beauty_filter.commit();
     }
-    else
-        // Destroying the filter & buffer to free memory
-        m_normals_buffer_denoised_oidn = nullptr;
 
-    if (m_denoise_normals && m_use_normals)
+    report_memory_usage();
+}
+
+void OpenImageDenoiser::set_filter_parameters(oidn::FilterRef& filter)
+{
+    switch (m_quality)
     {
-        m_normals_filter = m_device.newFilter("RT");
-        m_normals_filter.setImage("normal", m_normals_buffer_denoised_oidn, oidn::Format::Float3, m_width, m_height);
-        m_normals_filter.setImage("output", m_normals_buffer_denoised_oidn, oidn::Format::Float3, m_width, m_height);
-        m_normals_filter.commit();
+    case DenoiserQuality::DENOISER_QUALITY_FAST:
+        filter.set("quality", oidn::Quality::Fast);
+        break;
+
+    case DenoiserQuality::DENOISER_QUALITY_BALANCED:
+        filter.set("quality", oidn::Quality::Balanced);
+        break;
+
+    case DenoiserQuality::DENOISER_QUALITY_HIGH:
+    default:
+        filter.set("quality", oidn::Quality::High);
+        break;
     }
-    else
-        m_normals_filter = nullptr;
 
-    if (m_use_albedo)
-    {
-        // Creating the buffers here instead of in resize() because we want the creation/destruction 
-        // to be dynamic in response to ImGui input so we cannot just wait for a window queue_resize event
-        // that would trigger OpenImageDenoiser::queue_resize()
-        m_albedo_buffer_denoised_oidn = m_device.newBuffer(sizeof(ColorRGB32F) * m_width * m_height, oidn::Storage::Managed);
+    if (m_max_memory_MB > 0)
+        // OIDN splits the image in overlapping tiles that fit in that memory
+        filter.set("maxMemoryMB", m_max_memory_MB);
+}
 
-        m_beauty_filter.setImage("albedo", m_albedo_buffer_denoised_oidn, oidn::Format::Float3, m_width, m_height);
-    }
-    else
-        // Destroying the filter & buffer to free memory
-        m_albedo_buffer_denoised_oidn = nullptr;
+void OpenImageDenoiser::release_buffers()
+{
+    if (m_buffers_released || !check_valid_state())
+        return;
+
+    release_slots();
+    m_buffers_released = true;
+
+    report_memory_usage();
+}
+
+void OpenImageDenoiser::release_slots()
+{
+    // The buffers may still be used by the filters executing on the stream
+    m_device.sync();
 
-    if (m_denoise_albedo && m_use_albedo)
+    // All the slots, the slot count may have changed with the resolution
+    for (DenoiseSlot& slot : m_slots)
     {
-        m_albedo_filter = m_device.newFilter("RT");
-        m_albedo_filter.setImage("albedo", m_albedo_buffer_denoised_oidn, oidn::Format::Float3, m_width, m_height);
-        m_albedo_filter.setImage("output", m_albedo_buffer_denoised_oidn, oidn::Format::Float3, m_width, m_height);
-        m_albedo_filter.commit();
+        slot.beauty_filter = nullptr;
+        slot.albedo_filter = nullptr;
+        slot.normals_filter = nullptr;
+
+        slot.color = nullptr;
+        slot.normals = nullptr;
+        slot.albedo = nullptr;
+        slot.output = nullptr;
+
+        slot.launched = false;
+        slot.pending_publish = false;
+        slot.prefiltered_aovs_valid = false;
     }
-    else
-        m_albedo_filter = nullptr;
 
-    m_beauty_filter.commit();
+    m_next_slot = 0;
 }
 
-void OpenImageDenoiser::create_device()
+void OpenImageDenoiser::create_device(int device_index)
 {
-    // Create an Open ImageRGB32F Denoise device on the GPU depending
-    // on whether we're running on an NVIDIA or AMD GPU
+    // Create an Open ImageRGB32F Denoise device on the GPU of the renderer
+    // depending on whether we're running on an NVIDIA or AMD GPU.
     //
-    // -1 and nullptr correspond respectively to the default CUDA/HIP device
-    // and the default stream
+    // The stream is non-blocking so that the filters don't synchronize with
+    // the work queued on the default stream (mapping the interop buffers, ...)
+    OROCHI_CHECK_ERROR(oroStreamCreateWithFlags(&m_stream, oroStreamNonBlocking));
 #ifdef OROCHI_ENABLE_CUEW
-    m_device = oidn::newDevice(oidn::DeviceType::CUDA);
+    m_device = oidn::newCUDADevice(device_index, reinterpret_cast<cudaStream_t>(m_stream));
 #else
-    m_device = oidn::newDevice(oidn::DeviceType::HIP);
+    m_device = oidn::newHIPDevice(device_index, reinterpret_cast<hipStream_t>(m_stream));
 #endif
 
-    if (m_device.getError() == oidn::Error::UnsupportedHardware)
+    if (m_device.getHandle() == nullptr || m_device.getError() == oidn::Error::UnsupportedHardware)
     {
         g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not create an OIDN GPU device. Falling back to CPU...");
 
+        OROCHI_CHECK_ERROR(oroStreamDestroy(m_stream));
+        m_stream = nullptr;
+
         m_device = oidn::newDevice(oidn::DeviceType::CPU);
 
         const char* errorMessage;
@@ -142,12 +233,34 @@ void OpenImageDenoiser::create_device()
             // Valid creation of a CPU device
             m_cpu_device = true;
     }
-
-    bool managedMemory = m_device.get<bool>("managedMemorySupported");
+    else
+    {
+        for (DenoiseSlot& slot : m_slots)
+        {
+            OROCHI_CHECK_ERROR(oroEventCreate(&slot.snapshot_event));
+            OROCHI_CHECK_ERROR(oroEventCreate(&slot.start_event));
+            OROCHI_CHECK_ERROR(oroEventCreate(&slot.stop_event));
+        }
+    }
 
     m_device.commit();
 }
 
+void OpenImageDenoiser::report_memory_usage()
+{
+    if (m_cpu_device)
+        // The buffers are in system memory
+        return;
+
+    size_t byte_size = 0;
+    for (DenoiseSlot& slot : m_slots)
+        for (const oidn::BufferRef* buffer : { &slot.color, &slot.normals, &slot.albedo, &slot.output })
+            if (buffer->getHandle() != nullptr)
+                byte_size += buffer->getSize();
+
+    OrochiDeviceMemoryPool::set_external_usage(this, "Denoiser", byte_size);
+}
+
 bool OpenImageDenoiser::check_valid_state()
 {
     if (m_denoiser_invalid)
@@ -174,76 +287,186 @@ bool OpenImageDenoiser::check_device()
 
 bool OpenImageDenoiser::check_buffer_sizes()
 {
-    size_t normals_buffer_size = m_normals_buffer_denoised_oidn.getSize() / sizeof(float3);
-    size_t albedo_buffer_size = m_albedo_buffer_denoised_oidn.getSize() / sizeof(ColorRGB32F);
-    size_t denoised_buffer_size = m_denoised_buffer.getSize() / sizeof(ColorRGB32F);
-    size_t noisy_input_buffer_size = m_input_color_buffer_oidn.getSize() / sizeof(ColorRGB32F);
+    size_t pixel_count = m_width * m_height;
 
-    if (m_use_normals && normals_buffer_size != m_width * m_height)
+    for (int i = 0; i < get_slot_count(); i++)
     {
-        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The denoiser normals buffer isn't the same size as the denoiser. Did you forget to call finalize() after a call to resize()?");
+        DenoiseSlot& slot = m_slots[i];
 
-        return false;
-    }
-    else if (m_use_albedo && albedo_buffer_size != m_width * m_height)
-    {
-        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The denoiser albedo buffer isn't the same size as the denoiser. Did you forget to call finalize() after a call to resize()?");
+        if (m_use_normals && slot.normals.getSize() / sizeof(float3) != pixel_count)
+        {
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The denoiser normals buffer isn't the same size as the denoiser. Did you forget to call finalize() after a call to resize()?");
 
-        return false;
-    }
-    else if (denoised_buffer_size != m_width * m_height || noisy_input_buffer_size != m_width * m_height)
-    {
-        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The denoiser output buffer or input noisy buffer isn't the same size as the denoiser. This has to be an internal error since resize() resizes these two buffers.");
+            return false;
+        }
+        else if (m_use_albedo && slot.albedo.getSize() / sizeof(ColorRGB32F) != pixel_count)
+        {
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The denoiser albedo buffer isn't the same size as the denoiser. Did you forget to call finalize() after a call to resize()?");
 
-        return false;
+            return false;
+        }
+        else if (slot.output.getSize() / sizeof(ColorRGB32F) != pixel_count || slot.color.getSize() / sizeof(ColorRGB32F) != pixel_count)
+        {
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The denoiser output buffer or input noisy buffer isn't the same size as the denoiser. Did you forget to call finalize() after a call to resize()?");
+
+            return false;
+        }
     }
 
     return true;
 }
 
-void OpenImageDenoiser::denoise(std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> data_to_denoise, std::shared_ptr<OpenGLInteropBuffer<float3>> normals_aov, std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> albedo_aov)
+int OpenImageDenoiser::get_slot_count()
+{
+    // The CPU device denoises synchronously, no need for a second snapshot
+    if (m_cpu_device || m_width * m_height > OpenImageDenoiser::DOUBLE_BUFFERING_MAX_PIXEL_COUNT)
+        return 1;
+
+    return OpenImageDenoiser::DENOISE_SLOT_COUNT;
+}
+
+bool OpenImageDenoiser::is_slot_done(DenoiseSlot& slot)
+{
+    if (!slot.launched || m_cpu_device)
+        return true;
+
+    return oroEventQuery(slot.stop_event) == oroSuccess;
+}
+
+bool OpenImageDenoiser::denoise(std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> data_to_denoise, oroStream_t render_stream, std::shared_ptr<OpenGLInteropBuffer<float3>> normals_aov, std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> albedo_aov, bool reuse_prefiltered_aovs)
 {
     if (!check_valid_state())
-        return;
+        return false;
+
+    if (m_buffers_released)
+    {
+        m_buffers_released = false;
+
+        finalize();
+    }
 
     if (!check_buffer_sizes())
-        return;
+        return false;
 
-    oroMemcpyKind memcpyKind = m_cpu_device ? oroMemcpyDeviceToHost : oroMemcpyDeviceToDevice;
+    // The slots are used in the order of the launches so this is the oldest snapshot
+    DenoiseSlot& slot = m_slots[m_next_slot];
+    if (!is_slot_done(slot))
+        // All the snapshots are still being denoised
+        return false;
 
-    if (normals_aov != nullptr)
+    // The AOVs of the snapshot are left as they are if they've already been prefiltered
+    bool snapshot_aovs = !(reuse_prefiltered_aovs && slot.prefiltered_aovs_valid);
+
+    oroMemcpyKind memcpy_kind = m_cpu_device ? oroMemcpyDeviceToHost : oroMemcpyDeviceToDevice;
+    ColorRGB32F* data_to_denoise_pointer = data_to_denoise->map_no_error();
+    OROCHI_CHECK_ERROR(oroMemcpyAsync(slot.color.getData(), data_to_denoise_pointer, sizeof(ColorRGB32F) * m_width * m_height, memcpy_kind, render_stream));
+    if (snapshot_aovs && normals_aov != nullptr && slot.normals)
     {
         float3* normals_pointer = normals_aov->map_no_error();
-        OROCHI_CHECK_ERROR(oroMemcpy(m_normals_buffer_denoised_oidn.getData(), normals_pointer, sizeof(float3) * m_width * m_height, memcpyKind));
-        normals_aov->unmap();
+        OROCHI_CHECK_ERROR(oroMemcpyAsync(slot.normals.getData(), normals_pointer, sizeof(float3) * m_width * m_height, memcpy_kind, render_stream));
+    }
+    if (snapshot_aovs && albedo_aov != nullptr && slot.albedo)
+    {
+        ColorRGB32F* albedo_pointer = albedo_aov->map_no_error();
+        OROCHI_CHECK_ERROR(oroMemcpyAsync(slot.albedo.getData(), albedo_pointer, sizeof(ColorRGB32F) * m_width * m_height, memcpy_kind, render_stream));
+    }
 
-        if (m_denoise_normals)
-            m_normals_filter.execute();
+    if (m_cpu_device)
+    {
+        // The host buffers are read right away
+        OROCHI_CHECK_ERROR(oroStreamSynchronize(render_stream));
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if (snapshot_aovs && slot.normals_filter)
+            slot.normals_filter.execute();
+        if (snapshot_aovs && slot.albedo_filter)
+            slot.albedo_filter.execute();
+        slot.beauty_filter.execute();
+        auto stop = std::chrono::high_resolution_clock::now();
+
+        m_last_denoise_duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0f;
+    }
+    else
+    {
+        // The filters only start once the snapshot is taken, the render stream can go on
+        // with the next samples in the meantime
+        OROCHI_CHECK_ERROR(oroEventRecord(slot.snapshot_event, render_stream));
+        OROCHI_CHECK_ERROR(oroStreamWaitEvent(m_stream, slot.snapshot_event, 0));
+
+        OROCHI_CHECK_ERROR(oroEventRecord(slot.start_event, m_stream));
+        if (snapshot_aovs && slot.normals_filter)
+            slot.normals_filter.executeAsync();
+        if (snapshot_aovs && slot.albedo_filter)
+            slot.albedo_filter.executeAsync();
+        slot.beauty_filter.executeAsync();
+        OROCHI_CHECK_ERROR(oroEventRecord(slot.stop_event, m_stream));
     }
 
+    // Unmapped on the default stream, which waits for the snapshot copies
+    data_to_denoise->unmap();
+    if (normals_aov != nullptr)
+        normals_aov->unmap();
     if (albedo_aov != nullptr)
-    {
-        ColorRGB32F* albedo_pointer = albedo_aov->map_no_error();
-        OROCHI_CHECK_ERROR(oroMemcpy(m_albedo_buffer_denoised_oidn.getData(), albedo_pointer, sizeof(ColorRGB32F) * m_width * m_height, memcpyKind));
         albedo_aov->unmap();
 
-        if (m_denoise_albedo)
-            m_albedo_filter.execute();
+    slot.launched = true;
+    slot.pending_publish = true;
+    // The prefiltered AOVs of this snapshot can be reused by the next denoise() of this slot
+    slot.prefiltered_aovs_valid = reuse_prefiltered_aovs;
+    slot.launch_index = m_launch_count++;
+    m_next_slot = (m_next_slot + 1) % get_slot_count();
+
+    return true;
+}
+
+bool OpenImageDenoiser::publish_denoised(std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> denoised_output)
+{
+    if (!check_valid_state() || m_buffers_released)
+        return false;
+
+    DenoiseSlot* latest_slot = nullptr;
+    for (int i = 0; i < get_slot_count(); i++)
+    {
+        DenoiseSlot& slot = m_slots[i];
+        if (!slot.pending_publish || !is_slot_done(slot))
+            continue;
+
+        if (latest_slot == nullptr || slot.launch_index > latest_slot->launch_index)
+            latest_slot = &slot;
     }
-    
-    ColorRGB32F* data_to_denoise_pointer = data_to_denoise->map_no_error();
-    OROCHI_CHECK_ERROR(oroMemcpy(m_input_color_buffer_oidn.getData(), data_to_denoise_pointer, sizeof(ColorRGB32F) * m_width * m_height, memcpyKind));
-    m_beauty_filter.execute();
-    data_to_denoise->unmap();
+
+    if (latest_slot == nullptr)
+        return false;
+
+    // The older snapshots that are done are superseded by this one
+    for (int i = 0; i < get_slot_count(); i++)
+        if (m_slots[i].launch_index <= latest_slot->launch_index && is_slot_done(m_slots[i]))
+            m_slots[i].pending_publish = false;
+
+    oroMemcpyKind memcpy_kind = m_cpu_device ? oroMemcpyHostToDevice : oroMemcpyDeviceToDevice;
+    ColorRGB32F* denoised_output_pointer = denoised_output->map();
+    OROCHI_CHECK_ERROR(oroMemcpy(denoised_output_pointer, latest_slot->output.getData(), sizeof(ColorRGB32F) * m_width * m_height, memcpy_kind));
+    denoised_output->unmap();
+
+    if (!m_cpu_device)
+        OROCHI_CHECK_ERROR(oroEventElapsedTime(&m_last_denoise_duration, latest_slot->start_event, latest_slot->stop_event));
+
+    return true;
+}
+
+void OpenImageDenoiser::discard_pending_results()
+{
+    for (DenoiseSlot& slot : m_slots)
+        slot.pending_publish = false;
+}
+
+void OpenImageDenoiser::invalidate_prefiltered_aovs()
+{
+    for (DenoiseSlot& slot : m_slots)
+        slot.prefiltered_aovs_valid = false;
 }
 
-void OpenImageDenoiser::copy_denoised_data_to_buffer(std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> out_buffer)
+float OpenImageDenoiser::get_last_denoise_duration()
 {
-    oroMemcpyKind memcpyKind;
-    ColorRGB32F* buffer_pointer;
-    
-    memcpyKind = m_cpu_device ? oroMemcpyHostToDevice : oroMemcpyDeviceToDevice;
-    buffer_pointer= out_buffer->map();
-    OROCHI_CHECK_ERROR(oroMemcpy(buffer_pointer, m_denoised_buffer.getData(), sizeof(ColorRGB32F) * m_width * m_height, memcpyKind));
-    out_buffer->unmap();
+    return m_last_denoise_duration;
 }
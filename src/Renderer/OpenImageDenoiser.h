@@ -8,21 +8,57 @@
 
 #include "HostDeviceCommon/Color.h"
 #include "OpenGL/OpenGLInteropBuffer.h"
+#include "Renderer/DenoiserQuality.h"
 
 #include <OpenImageDenoise/oidn.hpp>
+#include <Orochi/Orochi.h>
 #include <vector>
 
+/**
+ * Denoiser of the framebuffer of the GPURenderer with Open Image Denoise.
+ *
+ * The denoising is asynchronous: denoise() takes a snapshot of the buffers of the renderer
+ * on the stream of the renderer and queues the filters on a stream of the denoiser. The next samples
+ * can then be rendered while the snapshot is being denoised. publish_denoised() copies the
+ * last denoised snapshot to the denoised framebuffer once its filters are done.
+ *
+ * With a GPU OIDN device, the snapshots are double-buffered (DENOISE_SLOT_COUNT) so that the
+ * snapshot of a frame can be taken while the previous one is still being denoised. Outputs larger than
+ * DOUBLE_BUFFERING_MAX_PIXEL_COUNT only use one snapshot to save memory.
+ * With the CPU fallback device, the snapshot is copied to host memory and denoised right away.
+ *
+ * The buffers of the denoiser are only allocated while it is used: see release_buffers()
+ */
 class OpenImageDenoiser
 {
 public:
+	static constexpr int DENOISE_SLOT_COUNT = 2;
+	// 4K with a 2x margin
+	static constexpr int DOUBLE_BUFFERING_MAX_PIXEL_COUNT = 3840 * 2160 * 2;
+
 	OpenImageDenoiser();
+	~OpenImageDenoiser();
 
 	void set_use_albedo(bool use_albedo);
 	void set_denoise_albedo(bool denoise_normals_or_not);
 	void set_use_normals(bool use_normal);
 	void set_denoise_normals(bool denoise_normals_or_not);
+	void set_quality(DenoiserQuality quality);
+	/**
+	 * Maximum memory in MB of the filters for their intermediate data. The filters denoise the image
+	 * in tiles, with an overlap between the tiles, when the full resolution wouldn't fit: the
+	 * final frames of very high resolution renders can then be denoised without the full-resolution
+	 * working memory of the filters.
+	 * 
+	 * 0 or negative for no limit (the default of OIDN)
+	 */
+	void set_max_memory_MB(int max_memory_MB);
 
-	void initialize();
+	/**
+	 * Creates the OIDN device and its stream on the GPU 'device_index'.
+	 * Falls back to a CPU device if the GPU isn't supported by OIDN
+	 */
+	void initialize(int device_index);
 
 	/**
 	 * Resizes the buffers of this denoiser. Don't forget to call finalize() after calling resize()!
@@ -33,31 +69,118 @@ public:
 	 * Function that finalizes the creation of the internal denoising
 	 * filters etc... once everything is setup (set_use_albedo / set_use_normals
 	 * have been called if necessary, subsequent buffers have been provided, ...)
+	 * 
+	 * The snapshots that were being denoised are discarded
 	*/
 	void finalize();
 
-	void denoise(std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> data_to_denoise, 
+	/**
+	 * Frees the buffers and filters of the denoiser (the scratch memory of the filters included).
+	 * They are allocated again by the next call to denoise()
+	 */
+	void release_buffers();
+
+	/**
+	 * Snapshots the given buffers of the renderer on 'render_stream' and queues their
+	 * denoising. The buffers can be modified by the work queued on 'render_stream' after this call.
+	 *
+	 * If 'reuse_prefiltered_aovs' is true, the AOVs are only snapshot and prefiltered if they haven't been yet
+	 * since the last invalidate_prefiltered_aovs(): their prefiltered snapshot is reused as is. That can be
+	 * used once the AOVs have converged, they then don't change anymore.
+	 *
+	 * Returns false without doing anything if all the snapshots are still being denoised
+	 */
+	bool denoise(std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> data_to_denoise,
+				 oroStream_t render_stream,
 				 std::shared_ptr<OpenGLInteropBuffer<float3>> normals_aov = nullptr, 
-				 std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> albedo_aov = nullptr);
+				 std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> albedo_aov = nullptr,
+				 bool reuse_prefiltered_aovs = false);
+	/**
+	 * Copies the most recent snapshot whose denoising is done to 'denoised_output'.
+	 * 
+	 * Returns true if a new denoised snapshot was copied
+	 */
+	bool publish_denoised(std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> denoised_output);
+	/**
+	 * The snapshots being denoised won't be published, after the render has been reset for example
+	 */
+	void discard_pending_results();
 	/**
-	 * Function used to copy the denoiser result after a call to denoise() to a given buffer
+	 * The prefiltered AOVs are snapshot again by the next denoise(), after the render has been reset for example
 	 */
-	void copy_denoised_data_to_buffer(std::shared_ptr<OpenGLInteropBuffer<ColorRGB32F>> out_buffer);
+	void invalidate_prefiltered_aovs();
 
+	/**
+	 * Time in milliseconds of the filters of the last published snapshot
+	 */
+	float get_last_denoise_duration();
 
 private:
-	void create_device();
+	/**
+	 * A snapshot of the buffers of the renderer and the filters that denoise it
+	 */
+	struct DenoiseSlot
+	{
+		// The AOVs are denoised in place. 'normals' and 'albedo' are only allocated if used
+		oidn::BufferRef color = nullptr;
+		oidn::BufferRef normals = nullptr;
+		oidn::BufferRef albedo = nullptr;
+		oidn::BufferRef output = nullptr;
+
+		oidn::FilterRef beauty_filter = nullptr;
+		oidn::FilterRef albedo_filter = nullptr;
+		oidn::FilterRef normals_filter = nullptr;
+
+		// GPU device only. Recorded on the render stream after the snapshot copies
+		// and on the stream of the denoiser around the filters
+		oroEvent_t snapshot_event = nullptr;
+		oroEvent_t start_event = nullptr;
+		oroEvent_t stop_event = nullptr;
+
+		// Whether or not the filters of this slot have been queued since its buffers were allocated
+		bool launched = false;
+		// Whether or not the result of this slot is yet to be published
+		bool pending_publish = false;
+		// Order of the denoise() launches, to publish the most recent snapshot
+		unsigned long long launch_index = 0;
+		// Whether or not 'normals' and 'albedo' hold prefiltered AOVs that can be reused, see denoise()
+		bool prefiltered_aovs_valid = false;
+	};
+
+	void create_device(int device_index);
 
 	bool check_valid_state();
 	bool check_device();
 	bool check_buffer_sizes();
 
+	int get_slot_count();
+	/**
+	 * Returns true if the filters queued for 'slot' are done executing
+	 */
+	bool is_slot_done(DenoiseSlot& slot);
+	/**
+	 * Sets the quality and memory parameters of 'filter'
+	 */
+	void set_filter_parameters(oidn::FilterRef& filter);
+	/**
+	 * Waits for the filters of all the slots and frees their buffers and filters
+	 */
+	void release_slots();
+
+	/**
+	 * Reports the size of the buffers of the denoiser to the OrochiDeviceMemoryPool.
+	 * The scratch memory allocated internally by the OIDN filters isn't included
+	 */
+	void report_memory_usage();
+
 	bool m_use_albedo = false;
 	bool m_denoise_albedo = true;
 	bool m_use_normals = false;
 	bool m_denoise_normals = true;
+	DenoiserQuality m_quality = DenoiserQuality::DENOISER_QUALITY_HIGH;
+	int m_max_memory_MB = 0;
 
-	int m_width, m_height;
+	int m_width = 0, m_height = 0;
 
 	// If true, this means that we couldn't get a device to denoise with
 	bool m_denoiser_invalid = false;
@@ -66,15 +189,19 @@ private:
 	// going to have to use memcpyDeviceToHost instead of memcpyDeviceToDevice
 	bool m_cpu_device = false;
 	oidn::DeviceRef m_device;
+	// Non-blocking stream the filters of the GPU device execute on
+	oroStream_t m_stream = nullptr;
+
+	// True until the next denoise() after release_buffers().
+	// Nothing is allocated before the first denoise()
+	bool m_buffers_released = true;
 
-	oidn::FilterRef m_beauty_filter = nullptr;
-	oidn::FilterRef m_albedo_filter = nullptr;
-	oidn::FilterRef m_normals_filter = nullptr;
+	// Only the first slot is used with the CPU device
+	DenoiseSlot m_slots[DENOISE_SLOT_COUNT];
+	int m_next_slot = 0;
+	unsigned long long m_launch_count = 0;
 
-	oidn::BufferRef m_input_color_buffer_oidn;
-	oidn::BufferRef m_normals_buffer_denoised_oidn = nullptr;
-	oidn::BufferRef m_albedo_buffer_denoised_oidn = nullptr;
-	oidn::BufferRef m_denoised_buffer;
+	float m_last_denoise_duration = 0.0f;
 };
 
 #endif
@@ -0,0 +1,487 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/GPUKernel.h"
+#include "Compiler/GPUKernelCompilerOptions.h"
+#include "Compiler/KernelLaunchAutotuner.h"
+#include "Device/includes/Hash.h"
+#include "Device/includes/Sampling.h"
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HostDeviceCommon/HitInfo.h"
+#include "HostDeviceCommon/Xorshift.h"
+#include "Renderer/BVH.h"
+#include "Renderer/GPURenderer.h"
+#include "Renderer/RayCastingBenchmark.h"
+#include "Renderer/RenderBenchmark.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <unordered_set>
+
+extern ImGuiLogger g_imgui_logger;
+extern KernelLaunchAutotuner g_kernel_launch_autotuner;
+
+const std::string RayCastingBenchmark::RAY_CASTING_BENCHMARK_COMMANDLINE_ARGUMENT = "--ray-casting-benchmark";
+
+// Traversal options of the kernels of the renderer, the build configurations are all traced with these
+static const RayCastingBenchmarkTraversal DEFAULT_TRAVERSAL = { "shared_stack_16_block_64", true, 16, 64, 32 };
+
+/**
+ * Rays of one of the ray sets of the benchmark, in the layout of the inputs of the TraversalBenchmark kernel
+ */
+struct RayCastingBenchmarkRaySet
+{
+	void add_ray(const float3& origin, const float3& direction, float max_distance)
+	{
+		origins.push_back(origin);
+		directions.push_back(direction);
+		max_distances.push_back(max_distance);
+	}
+
+	std::string name;
+	// The rays are traced as shadow rays (stopping at the first hit) if true
+	bool any_hit = false;
+
+	std::vector<float3> origins;
+	std::vector<float3> directions;
+	std::vector<float> max_distances;
+};
+
+/**
+ * RayCastingBenchmarkRaySet uploaded to the GPU
+ */
+struct RayCastingBenchmarkDeviceRaySet
+{
+	int ray_count = 0;
+	bool any_hit = false;
+
+	OrochiBuffer<float3> origins;
+	OrochiBuffer<float3> directions;
+	OrochiBuffer<float> max_distances;
+	// Output of the TraversalBenchmark kernel
+	OrochiBuffer<float> hit_distances;
+};
+
+/**
+ * Result of one configuration on one ray set
+ */
+struct RayCastingBenchmarkMeasure
+{
+	// Rays per second of the mean and of the fastest launch
+	double mean_rays_per_second = 0.0;
+	double max_rays_per_second = 0.0;
+
+	int hit_count = 0;
+};
+
+/**
+ * Generates the primary, diffuse and shadow ray sets of 'scene' at 'width' x 'height'. The primary hits
+ * the bounce and shadow rays start from are found with 'bvh', built over 'triangles'
+ */
+static std::vector<RayCastingBenchmarkRaySet> generate_ray_sets(const Scene& scene, const std::vector<Triangle>& triangles, const BVH& bvh, int width, int height)
+{
+	Camera camera = scene.camera;
+	HIPRTCamera hiprt_camera = camera.to_hiprt();
+
+	// Only read by the alpha testing filter of the BVH, disabled
+	HIPRTRenderData render_data;
+	render_data.render_settings.do_alpha_testing = false;
+
+	int pixel_count = width * height;
+	std::vector<hiprtRay> primary_rays(pixel_count);
+	std::vector<hiprtRay> diffuse_rays(pixel_count);
+	std::vector<hiprtRay> shadow_rays(pixel_count);
+	std::vector<unsigned char> primary_hits(pixel_count, 0);
+
+#pragma omp parallel for
+	for (int pixel_index = 0; pixel_index < pixel_count; pixel_index++)
+	{
+		int x = pixel_index % width;
+		int y = pixel_index / width;
+
+		Xorshift32Generator random_number_generator(wang_hash(pixel_index + 1));
+		AlphaTestingPayload payload;
+		payload.render_data = &render_data;
+		payload.random_number_generator = &random_number_generator;
+
+		primary_rays[pixel_index] = hiprt_camera.get_camera_ray(x + 0.5f, y + 0.5f, make_int2(width, height));
+
+		HitInfo hit_info;
+		if (!bvh.intersect(primary_rays[pixel_index], hit_info, &payload))
+			continue;
+
+		primary_hits[pixel_index] = 1;
+
+		float3 normal = hit_info.geometric_normal;
+		if (hippt::dot(normal, primary_rays[pixel_index].direction) > 0.0f)
+			normal = -normal;
+		float3 origin = hit_info.inter_point + normal * 1.0e-4f;
+
+		diffuse_rays[pixel_index].origin = origin;
+		diffuse_rays[pixel_index].direction = cosine_weighted_sample(normal, random_number_generator);
+
+		// Random point on a random emissive triangle, any triangle of the scene if there are no emissive triangles
+		int triangle_index;
+		if (scene.emissive_triangle_indices.empty())
+			triangle_index = random_number_generator.random_index(static_cast<int>(triangles.size()));
+		else
+			triangle_index = scene.emissive_triangle_indices[random_number_generator.random_index(static_cast<int>(scene.emissive_triangle_indices.size()))];
+
+		const Triangle& light_triangle = triangles[triangle_index];
+		float sqrt_rand_1 = sqrtf(random_number_generator());
+		float rand_2 = random_number_generator();
+		float3 light_point = light_triangle.m_a * (1.0f - sqrt_rand_1) + light_triangle.m_b * (sqrt_rand_1 * (1.0f - rand_2)) + light_triangle.m_c * (sqrt_rand_1 * rand_2);
+
+		float3 to_light = light_point - origin;
+		float distance_to_light = hippt::length(to_light);
+		shadow_rays[pixel_index].origin = origin;
+		shadow_rays[pixel_index].direction = to_light / distance_to_light;
+		shadow_rays[pixel_index].maxT = distance_to_light;
+	}
+
+	std::vector<RayCastingBenchmarkRaySet> ray_sets(3);
+	ray_sets[0].name = "primary";
+	ray_sets[1].name = "diffuse";
+	ray_sets[2].name = "shadow";
+	ray_sets[2].any_hit = true;
+	for (int pixel_index = 0; pixel_index < pixel_count; pixel_index++)
+	{
+		ray_sets[0].add_ray(primary_rays[pixel_index].origin, primary_rays[pixel_index].direction, primary_rays[pixel_index].maxT);
+		if (!primary_hits[pixel_index])
+			continue;
+
+		ray_sets[1].add_ray(diffuse_rays[pixel_index].origin, diffuse_rays[pixel_index].direction, diffuse_rays[pixel_index].maxT);
+		ray_sets[2].add_ray(shadow_rays[pixel_index].origin, shadow_rays[pixel_index].direction, shadow_rays[pixel_index].maxT);
+	}
+
+	return ray_sets;
+}
+
+static void upload_ray_set(const RayCastingBenchmarkRaySet& ray_set, RayCastingBenchmarkDeviceRaySet& out_device_ray_set)
+{
+	out_device_ray_set.ray_count = static_cast<int>(ray_set.origins.size());
+	out_device_ray_set.any_hit = ray_set.any_hit;
+	if (out_device_ray_set.ray_count == 0)
+		return;
+
+	out_device_ray_set.origins.resize(out_device_ray_set.ray_count);
+	out_device_ray_set.directions.resize(out_device_ray_set.ray_count);
+	out_device_ray_set.max_distances.resize(out_device_ray_set.ray_count);
+	out_device_ray_set.hit_distances.resize(out_device_ray_set.ray_count);
+
+	out_device_ray_set.origins.upload_data(ray_set.origins);
+	out_device_ray_set.directions.upload_data(ray_set.directions);
+	out_device_ray_set.max_distances.upload_data(ray_set.max_distances);
+}
+
+/**
+ * Compiles the TraversalBenchmark kernel with the options of 'traversal' and traces every ray set of
+ * 'device_ray_sets' on the scene of 'renderer' with it
+ */
+static std::vector<RayCastingBenchmarkMeasure> measure_gpu(GPURenderer& renderer, std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const RayCastingBenchmarkTraversal& traversal, std::vector<RayCastingBenchmarkDeviceRaySet>& device_ray_sets, const CommandlineArguments& arguments)
+{
+	// The traversal options are the ones benchmarked, not the ones of the renderer
+	std::unordered_set<std::string> options_excluded_from_synchro =
+	{
+		GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL,
+		GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE,
+		GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE,
+		GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS,
+		GPUKernelCompilerOptions::DYNAMIC_BVH_TRAVERSAL_STACK,
+	};
+
+	GPUKernel kernel(DEVICE_KERNELS_DIRECTORY "/TraversalBenchmark.h", "TraversalBenchmark");
+	kernel.synchronize_options_with(*renderer.get_global_compiler_options(), options_excluded_from_synchro);
+	kernel.get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, traversal.use_shared_stack ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+	kernel.get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_BLOCK_SIZE, traversal.block_size);
+	kernel.get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, traversal.shared_stack_size);
+	kernel.get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS, traversal.shared_stack_size);
+	// One global stack per ray of the largest ray set, the dynamic stacks would measure the stack allocation too
+	kernel.get_kernel_options().set_macro_value(GPUKernelCompilerOptions::DYNAMIC_BVH_TRAVERSAL_STACK, KERNEL_OPTION_FALSE);
+	// The launches are all done with 'traversal.block_size' threads per block
+	kernel.set_launch_tuning_allowed(false);
+	kernel.compile(hiprt_orochi_ctx, renderer.get_func_name_sets());
+
+	int max_ray_count = 0;
+	for (const RayCastingBenchmarkDeviceRaySet& device_ray_set : device_ray_sets)
+		max_ray_count = std::max(max_ray_count, device_ray_set.ray_count);
+
+	HIPRTRenderData render_data = renderer.get_render_data();
+	render_data.render_settings.do_alpha_testing = false;
+	render_data.render_settings.count_ray_statistics = false;
+	render_data.global_traversal_stack_buffer_size = traversal.global_stack_size;
+
+	hiprtGlobalStackBufferInput stack_buffer_input
+	{
+		hiprtStackTypeGlobal,
+		hiprtStackEntryTypeInteger,
+		static_cast<uint32_t>(traversal.global_stack_size),
+		static_cast<uint32_t>(std::ceil(max_ray_count / static_cast<float>(traversal.block_size)) * traversal.block_size)
+	};
+	HIPRT_CHECK_ERROR(hiprtCreateGlobalStackBuffer(hiprt_orochi_ctx->hiprt_ctx, stack_buffer_input, render_data.global_traversal_stack_buffer));
+
+	std::vector<RayCastingBenchmarkMeasure> measures(device_ray_sets.size());
+	for (int ray_set_index = 0; ray_set_index < device_ray_sets.size(); ray_set_index++)
+	{
+		RayCastingBenchmarkDeviceRaySet& device_ray_set = device_ray_sets[ray_set_index];
+		if (device_ray_set.ray_count == 0)
+			continue;
+
+		float3* origins = device_ray_set.origins.get_device_pointer();
+		float3* directions = device_ray_set.directions.get_device_pointer();
+		float* max_distances = device_ray_set.max_distances.get_device_pointer();
+		int ray_count = device_ray_set.ray_count;
+		int any_hit = device_ray_set.any_hit;
+		float* hit_distances = device_ray_set.hit_distances.get_device_pointer();
+		void* launch_args[] = { &render_data, &origins, &directions, &max_distances, &ray_count, &any_hit, &hit_distances };
+
+		std::vector<float> launch_times;
+		for (int launch = 0; launch < arguments.benchmark_warmup_frames + arguments.benchmark_frames; launch++)
+		{
+			float launch_time_ms;
+			kernel.launch_timed_synchronous(traversal.block_size, 1, ray_count, 1, launch_args, &launch_time_ms);
+
+			if (launch >= arguments.benchmark_warmup_frames)
+				launch_times.push_back(launch_time_ms);
+		}
+
+		RenderBenchmarkStatistics statistics = RenderBenchmark::compute_statistics(launch_times);
+		measures[ray_set_index].mean_rays_per_second = ray_count / (statistics.mean / 1000.0);
+		measures[ray_set_index].max_rays_per_second = ray_count / (statistics.min / 1000.0);
+
+		std::vector<float> hit_distances_downloaded = device_ray_set.hit_distances.download_data();
+		measures[ray_set_index].hit_count = static_cast<int>(std::count_if(hit_distances_downloaded.begin(), hit_distances_downloaded.end(), [](float distance) { return distance >= 0.0f; }));
+	}
+
+	HIPRT_CHECK_ERROR(hiprtDestroyGlobalStackBuffer(hiprt_orochi_ctx->hiprt_ctx, render_data.global_traversal_stack_buffer));
+
+	return measures;
+}
+
+/**
+ * Traces every ray set of 'ray_sets' once with the CPU BVH 'bvh'
+ */
+static std::vector<RayCastingBenchmarkMeasure> measure_cpu(const BVH& bvh, const std::vector<RayCastingBenchmarkRaySet>& ray_sets)
+{
+	HIPRTRenderData render_data;
+	render_data.render_settings.do_alpha_testing = false;
+
+	std::vector<RayCastingBenchmarkMeasure> measures(ray_sets.size());
+	for (int ray_set_index = 0; ray_set_index < ray_sets.size(); ray_set_index++)
+	{
+		const RayCastingBenchmarkRaySet& ray_set = ray_sets[ray_set_index];
+		int ray_count = static_cast<int>(ray_set.origins.size());
+		if (ray_count == 0)
+			continue;
+
+		int hit_count = 0;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+#pragma omp parallel for reduction(+:hit_count)
+		for (int ray_index = 0; ray_index < ray_count; ray_index++)
+		{
+			Xorshift32Generator random_number_generator(wang_hash(ray_index + 1));
+			AlphaTestingPayload payload;
+			payload.render_data = &render_data;
+			payload.random_number_generator = &random_number_generator;
+
+			hiprtRay ray;
+			ray.origin = ray_set.origins[ray_index];
+			ray.direction = ray_set.directions[ray_index];
+			ray.maxT = ray_set.max_distances[ray_index];
+
+			bool hit;
+			if (ray_set.any_hit)
+				// Same distance as evaluate_shadow_ray()
+				hit = bvh.intersect_any(ray, ray.maxT - 1.0e-4f, &payload);
+			else
+			{
+				HitInfo hit_info;
+				hit = bvh.intersect(ray, hit_info, &payload);
+			}
+
+			hit_count += hit;
+		}
+		double elapsed_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		measures[ray_set_index].mean_rays_per_second = ray_count / elapsed_s;
+		measures[ray_set_index].max_rays_per_second = measures[ray_set_index].mean_rays_per_second;
+		measures[ray_set_index].hit_count = hit_count;
+	}
+
+	return measures;
+}
+
+static void write_measures(std::ofstream& output_file, const std::vector<RayCastingBenchmarkRaySet>& ray_sets, const std::vector<RayCastingBenchmarkMeasure>& measures)
+{
+	output_file << "{";
+	for (int i = 0; i < ray_sets.size(); i++)
+	{
+		output_file << (i == 0 ? " " : ", ") << "\"" << ray_sets[i].name << "\": { ";
+		output_file << "\"mean_rays_per_second\": " << measures[i].mean_rays_per_second << ", ";
+		output_file << "\"max_rays_per_second\": " << measures[i].max_rays_per_second << ", ";
+		output_file << "\"hits\": " << measures[i].hit_count << " }";
+	}
+	output_file << " }";
+}
+
+std::vector<RayCastingBenchmarkTraversal> RayCastingBenchmark::get_traversal_configurations()
+{
+	std::vector<RayCastingBenchmarkTraversal> configurations;
+	configurations.push_back({ "no_shared_stack", false, 0, 64, 0 });
+	for (int block_size : { 64, 128 })
+		for (int shared_stack_size : { 0, 8, 16, 32 })
+			configurations.push_back({ "shared_stack_" + std::to_string(shared_stack_size) + "_block_" + std::to_string(block_size), true, shared_stack_size, block_size, DEFAULT_TRAVERSAL.global_stack_size });
+	for (int global_stack_size : { 16, 64 })
+		configurations.push_back({ DEFAULT_TRAVERSAL.name + "_global_stack_" + std::to_string(global_stack_size), true, DEFAULT_TRAVERSAL.shared_stack_size, DEFAULT_TRAVERSAL.block_size, global_stack_size });
+
+	return configurations;
+}
+
+std::vector<RayCastingBenchmarkBuild> RayCastingBenchmark::get_build_configurations()
+{
+	std::vector<RayCastingBenchmarkBuild> configurations;
+	for (bool compact_bvh : { false, true })
+	{
+		std::string compaction_suffix = compact_bvh ? "_compact" : "";
+
+		configurations.push_back({ "fast" + compaction_suffix, BVHBuildQuality::BVH_BUILD_QUALITY_FAST, compact_bvh });
+		configurations.push_back({ "balanced" + compaction_suffix, BVHBuildQuality::BVH_BUILD_QUALITY_BALANCED, compact_bvh });
+		configurations.push_back({ "high" + compaction_suffix, BVHBuildQuality::BVH_BUILD_QUALITY_HIGH, compact_bvh });
+	}
+
+	return configurations;
+}
+
+int RayCastingBenchmark::run(const CommandlineArguments& arguments, const Image32Bit& envmap)
+{
+	if (arguments.benchmark_frames <= 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The ray casting benchmark needs at least one measured launch.");
+
+		return 1;
+	}
+
+	std::ofstream output_file(arguments.benchmark_output_file_path);
+	if (!output_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the ray casting benchmark results to \"%s\"", arguments.benchmark_output_file_path.c_str());
+
+		return 1;
+	}
+
+	// The block sizes of the launches are the ones of the traversal configurations
+	g_kernel_launch_autotuner.set_enabled(false);
+
+	std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(arguments.gpu_indices[0]);
+	std::vector<RayCastingBenchmarkTraversal> traversals = RayCastingBenchmark::get_traversal_configurations();
+	std::vector<RayCastingBenchmarkBuild> builds = RayCastingBenchmark::get_build_configurations();
+
+	output_file << "{\n";
+	output_file << "\t\"device\": \"" << RenderBenchmark::escape_json_string(hiprt_orochi_ctx->device_properties.name) << "\",\n";
+	output_file << "\t\"width\": " << arguments.render_width << ",\n";
+	output_file << "\t\"height\": " << arguments.render_height << ",\n";
+	output_file << "\t\"warmup_launches\": " << arguments.benchmark_warmup_frames << ",\n";
+	output_file << "\t\"measured_launches\": " << arguments.benchmark_frames << ",\n";
+	output_file << "\t\"scenes\": [";
+
+	for (int scene_index = 0; scene_index < RenderBenchmark::SUITE_SCENES.size(); scene_index++)
+	{
+		const std::string& scene_file = RenderBenchmark::SUITE_SCENES[scene_index];
+
+		Scene scene;
+		Assimp::Importer assimp_importer;
+		RenderBenchmark::parse_suite_scene(arguments, scene_file, assimp_importer, scene);
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Generating the ray sets of \"%s\"...", scene_file.c_str());
+
+		std::vector<Triangle> triangles = scene.get_triangles();
+		BVH cpu_bvh(&triangles);
+		std::vector<RayCastingBenchmarkRaySet> ray_sets = generate_ray_sets(scene, triangles, cpu_bvh, arguments.render_width, arguments.render_height);
+
+		std::vector<RayCastingBenchmarkDeviceRaySet> device_ray_sets(ray_sets.size());
+		for (int i = 0; i < ray_sets.size(); i++)
+			upload_ray_set(ray_sets[i], device_ray_sets[i]);
+
+		output_file << (scene_index == 0 ? "\n" : ",\n");
+		output_file << "\t\t{\n";
+		output_file << "\t\t\t\"scene\": \"" << RenderBenchmark::escape_json_string(scene_file) << "\",\n";
+		output_file << "\t\t\t\"triangles\": " << triangles.size() << ",\n";
+		output_file << "\t\t\t\"rays\": {";
+		for (int i = 0; i < ray_sets.size(); i++)
+			output_file << (i == 0 ? " " : ", ") << "\"" << ray_sets[i].name << "\": " << ray_sets[i].origins.size();
+		output_file << " },\n";
+
+		{
+			// Traversal configurations on the BVH built with the options of the command line
+			GPURenderer renderer(hiprt_orochi_ctx, /* headless */ true);
+			RenderBenchmark::setup_renderer(renderer, arguments, scene, envmap);
+
+			output_file << "\t\t\t\"traversals\": [";
+			for (int traversal_index = 0; traversal_index < traversals.size(); traversal_index++)
+			{
+				const RayCastingBenchmarkTraversal& traversal = traversals[traversal_index];
+
+				g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "\"%s\": traversal %s", scene_file.c_str(), traversal.name.c_str());
+
+				std::vector<RayCastingBenchmarkMeasure> measures = measure_gpu(renderer, hiprt_orochi_ctx, traversal, device_ray_sets, arguments);
+
+				output_file << (traversal_index == 0 ? "\n" : ",\n");
+				output_file << "\t\t\t\t{ \"name\": \"" << traversal.name << "\", ";
+				output_file << "\"use_shared_stack\": " << (traversal.use_shared_stack ? "true" : "false") << ", ";
+				output_file << "\"shared_stack_size\": " << traversal.shared_stack_size << ", ";
+				output_file << "\"block_size\": " << traversal.block_size << ", ";
+				output_file << "\"global_stack_size\": " << traversal.global_stack_size << ", ";
+				output_file << "\"results\": ";
+				write_measures(output_file, ray_sets, measures);
+				output_file << " }";
+			}
+			output_file << "\n\t\t\t],\n";
+		}
+
+		output_file << "\t\t\t\"builds\": [";
+		for (int build_index = 0; build_index < builds.size(); build_index++)
+		{
+			const RayCastingBenchmarkBuild& build = builds[build_index];
+
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "\"%s\": BVH build %s", scene_file.c_str(), build.name.c_str());
+
+			CommandlineArguments build_arguments = arguments;
+			build_arguments.bvh_build_quality = build.build_quality;
+			build_arguments.compact_bvh = build.compact_bvh;
+
+			GPURenderer renderer(hiprt_orochi_ctx, /* headless */ true);
+			RenderBenchmark::setup_renderer(renderer, build_arguments, scene, envmap);
+
+			std::vector<RayCastingBenchmarkMeasure> measures = measure_gpu(renderer, hiprt_orochi_ctx, DEFAULT_TRAVERSAL, device_ray_sets, arguments);
+
+			output_file << (build_index == 0 ? "\n" : ",\n");
+			output_file << "\t\t\t\t{ \"name\": \"" << build.name << "\", ";
+			output_file << "\"traversal\": \"" << DEFAULT_TRAVERSAL.name << "\", ";
+			output_file << "\"results\": ";
+			write_measures(output_file, ray_sets, measures);
+			output_file << " }";
+		}
+		output_file << "\n\t\t\t],\n";
+		assimp_importer.FreeScene();
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "\"%s\": CPU BVH", scene_file.c_str());
+
+		output_file << "\t\t\t\"cpu_bvh\": ";
+		write_measures(output_file, ray_sets, measure_cpu(cpu_bvh, ray_sets));
+		output_file << "\n\t\t}";
+	}
+
+	output_file << "\n\t]\n";
+	output_file << "}\n";
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Ray casting benchmark results written to \"%s\"", arguments.benchmark_output_file_path.c_str());
+
+	return 0;
+}
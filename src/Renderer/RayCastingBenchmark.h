@@ -0,0 +1,81 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RAY_CASTING_BENCHMARK_H
+#define RAY_CASTING_BENCHMARK_H
+
+#include "HIPRT-Orochi/HIPRTScene.h"
+#include "Image/Image.h"
+#include "Utils/CommandlineArguments.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Traversal options the TraversalBenchmark kernel is compiled with for one of the configurations of the benchmark
+ */
+struct RayCastingBenchmarkTraversal
+{
+	std::string name;
+
+	bool use_shared_stack;
+	int shared_stack_size;
+	int block_size;
+	// Number of entries of the global stack of each ray
+	int global_stack_size;
+};
+
+/**
+ * HIPRT build flags of the BVH of one of the configurations of the benchmark
+ */
+struct RayCastingBenchmarkBuild
+{
+	std::string name;
+
+	BVHBuildQuality build_quality;
+	bool compact_bvh;
+};
+
+/**
+ * Microbenchmark of the ray casting alone: no shading, no path, only the traversal of the BVH.
+ *
+ * The application started with RAY_CASTING_BENCHMARK_COMMANDLINE_ARGUMENT loads the RenderBenchmark::SUITE_SCENES
+ * bundled in data/GLTFs and generates, on the CPU and at the render resolution, three ray sets per scene:
+ *	- the primary rays of the camera of the scene, one per pixel
+ *	- diffuse bounce rays, cosine distributed around the normal of the primary hits
+ *	- shadow rays from the primary hits to random points on the emissive triangles (any triangle of the scene
+ *	  if it has no emissive triangles), traced as any hit rays
+ *
+ * The ray sets are uploaded once and traced by the TraversalBenchmark kernel with every traversal configuration
+ * of get_traversal_configurations() (shared stack on / off, shared stack sizes, block sizes, global stack sizes)
+ * on the BVH built with the options of the command line, and with the default traversal of the renderer on the BVH
+ * of every build configuration of get_build_configurations(). The same ray sets are then traced once by the CPU BVH,
+ * on all the threads.
+ *
+ * Each GPU measurement is 'benchmark_warmup_frames' launches not measured followed by 'benchmark_frames' launches
+ * timed with events. The rays per second of the mean and of the min launch time of every ray set are written as
+ * JSON to 'benchmark_output_file_path', with the number of rays of each set that hit something so that
+ * the configurations can be checked against each other. The "RayCastingBenchmark" CMake target runs the benchmark.
+ *
+ * Alpha testing is disabled: its cost depends on the textures, not on the traversal. The analytic spheres aren't
+ * in the CPU BVH so its hit counts differ from the GPU ones on the scenes that have spheres
+ */
+class RayCastingBenchmark
+{
+public:
+	static const std::string RAY_CASTING_BENCHMARK_COMMANDLINE_ARGUMENT;
+
+	/**
+	 * Runs the benchmark on the first device of 'arguments.gpu_indices'.
+	 *
+	 * Returns the exit code of the application
+	 */
+	static int run(const CommandlineArguments& arguments, const Image32Bit& envmap);
+
+	static std::vector<RayCastingBenchmarkTraversal> get_traversal_configurations();
+	static std::vector<RayCastingBenchmarkBuild> get_build_configurations();
+};
+
+#endif
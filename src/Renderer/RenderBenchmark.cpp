@@ -0,0 +1,633 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Compiler/GPUKernelCompilerOptions.h"
+#include "Compiler/KernelLaunchAutotuner.h"
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "HostDeviceCommon/RayStatistics.h"
+#include "Renderer/GPURenderer.h"
+#include "Renderer/RenderBenchmark.h"
+#include "Threads/ThreadManager.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+
+extern ImGuiLogger g_imgui_logger;
+extern KernelLaunchAutotuner g_kernel_launch_autotuner;
+
+const std::string RenderBenchmark::BENCHMARK_COMMANDLINE_ARGUMENT = "--benchmark";
+const std::string RenderBenchmark::WARMUP_FRAMES_COMMANDLINE_ARGUMENT = "--benchmark-warmup=";
+const std::string RenderBenchmark::MEASURED_FRAMES_COMMANDLINE_ARGUMENT = "--benchmark-frames=";
+const std::string RenderBenchmark::OUTPUT_COMMANDLINE_ARGUMENT = "--benchmark-output=";
+const std::string RenderBenchmark::SUITE_COMMANDLINE_ARGUMENT = "--benchmark-suite=";
+const std::string RenderBenchmark::SUITE_MAX_SAMPLES_COMMANDLINE_ARGUMENT = "--benchmark-suite-samples=";
+const std::string RenderBenchmark::REFERENCE_SAMPLES_COMMANDLINE_ARGUMENT = "--benchmark-reference-samples=";
+const std::string RenderBenchmark::COMPARISON_COMMANDLINE_ARGUMENT = "--strategy-comparison=";
+const std::string RenderBenchmark::COMPARISON_TIME_COMMANDLINE_ARGUMENT = "--strategy-comparison-time=";
+const std::string RenderBenchmark::COMPARISON_OUTPUT_COMMANDLINE_ARGUMENT = "--strategy-comparison-output=";
+
+const std::vector<std::string> RenderBenchmark::SUITE_SCENES = { "cornell_pbr.gltf", "nested-dielectrics.gltf", "nested-dielectrics-complex.gltf", "the-white-room-low.gltf" };
+// Relative to a build directory inside the repo root folder, like CommandlineArguments::DEFAULT_SCENE
+const std::string RenderBenchmark::SUITE_SCENES_DIRECTORY = "../data/GLTFs/";
+const RenderBenchmarkConfiguration RenderBenchmark::REFERENCE_CONFIGURATION = { LSS_MIS_LIGHT_BSDF, ESS_ALIAS_TABLE, RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE, ILS_PATH_TRACING };
+const std::vector<float> RenderBenchmark::TIME_TO_QUALITY_RELATIVE_MSE_TARGETS = { 0.1f, 0.03f, 0.01f };
+
+std::string RenderBenchmarkConfiguration::get_name() const
+{
+	static const std::map<int, std::string> direct_light_sampling_names = {
+		{ LSS_UNIFORM_ONE_LIGHT, "UNIFORM_ONE_LIGHT" },
+		{ LSS_BSDF, "BSDF" },
+		{ LSS_MIS_LIGHT_BSDF, "MIS_LIGHT_BSDF" },
+		{ LSS_RIS_BSDF_AND_LIGHT, "RIS_BSDF_AND_LIGHT" },
+		{ LSS_RESTIR_DI, "RESTIR_DI" },
+		{ LSS_LIGHT_BVH, "LIGHT_BVH" },
+	};
+	static const std::map<int, std::string> envmap_sampling_names = {
+		{ ESS_BINARY_SEARCH, "BINARY_SEARCH" },
+		{ ESS_ALIAS_TABLE, "ALIAS_TABLE" },
+		{ ESS_MARGINAL_CONDITIONAL, "MARGINAL_CONDITIONAL" },
+		{ ESS_PRODUCT_SAMPLING, "PRODUCT_SAMPLING" },
+	};
+	static const std::map<int, std::string> bias_correction_names = {
+		{ RESTIR_DI_BIAS_CORRECTION_1_OVER_M, "1_OVER_M" },
+		{ RESTIR_DI_BIAS_CORRECTION_1_OVER_Z, "1_OVER_Z" },
+		{ RESTIR_DI_BIAS_CORRECTION_MIS_LIKE, "MIS_LIKE" },
+		{ RESTIR_DI_BIAS_CORRECTION_MIS_GBH, "MIS_GBH" },
+		{ RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS, "PAIRWISE_MIS" },
+		{ RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE, "PAIRWISE_MIS_DEFENSIVE" },
+	};
+	static const std::map<int, std::string> ggx_sample_function_names = {
+		{ GGX_NO_VNDF, "NO_VNDF" },
+		{ GGX_VNDF_SAMPLING, "VNDF_SAMPLING" },
+		{ GGX_VNDF_SPHERICAL_CAPS, "VNDF_SPHERICAL_CAPS" },
+		{ GGX_VNDF_BOUNDED, "VNDF_BOUNDED" },
+	};
+
+	std::string name = "LSS_" + direct_light_sampling_names.at(direct_light_sampling_strategy) + "/ESS_" + envmap_sampling_names.at(envmap_sampling_strategy);
+	if (direct_light_sampling_strategy == LSS_RESTIR_DI)
+		name += "/BIAS_CORRECTION_" + bias_correction_names.at(restir_di_bias_correction_weights);
+	if (indirect_light_sampling_strategy == ILS_RESTIR_GI)
+		name += "/ILS_RESTIR_GI";
+	if (ggx_sample_function != GGX_VNDF_BOUNDED)
+		name += "/GGX_" + ggx_sample_function_names.at(ggx_sample_function);
+
+	return name;
+}
+
+int RenderBenchmark::run(const CommandlineArguments& arguments, const Scene& scene, const Image32Bit& envmap)
+{
+	if (arguments.benchmark_frames <= 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "The benchmark needs at least one measured frame.");
+
+		return 1;
+	}
+
+	// The shapes tuned while benchmarking would make the launches of the measured frames differ between the runs
+	g_kernel_launch_autotuner.set_enabled(false);
+
+	std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(arguments.gpu_indices[0]);
+	GPURenderer renderer(hiprt_orochi_ctx, /* headless */ true);
+	RenderBenchmark::setup_renderer(renderer, arguments, scene, envmap);
+
+	HIPRTRenderSettings& render_settings = renderer.get_render_settings();
+	render_settings.freeze_random = true;
+	render_settings.count_bounce_active_rays = true;
+	render_settings.count_ray_statistics = true;
+
+	std::shared_ptr<ApplicationSettings> application_settings = std::make_shared<ApplicationSettings>();
+	renderer.reset(application_settings);
+	render_settings.samples_per_frame = 1;
+
+	std::map<std::string, std::vector<float>> pass_times;
+	double measured_time_s = 0.0;
+	double measured_ray_count = 0.0;
+	double measured_ray_statistics[RAY_STATISTIC_COUNT] = { 0.0 };
+
+	int frame_count = arguments.benchmark_warmup_frames + arguments.benchmark_frames;
+	for (int frame = 0; frame < frame_count; frame++)
+	{
+		double frame_time_s = RenderBenchmark::render_frame(renderer);
+		if (frame < arguments.benchmark_warmup_frames)
+			continue;
+
+		measured_time_s += frame_time_s;
+		for (unsigned int bounce_ray_count : renderer.get_status_buffer_values().bounce_active_ray_counts)
+			measured_ray_count += bounce_ray_count;
+		const std::vector<unsigned int>& ray_statistics = renderer.get_status_buffer_values().ray_statistics;
+		for (int statistic = 0; statistic < ray_statistics.size(); statistic++)
+			measured_ray_statistics[statistic] += ray_statistics[statistic];
+
+		renderer.compute_render_pass_times();
+		for (auto& pass_to_time : renderer.get_render_pass_times())
+			pass_times[pass_to_time.first].push_back(pass_to_time.second);
+	}
+
+	double samples_per_second = arguments.benchmark_frames / measured_time_s;
+	double rays_per_second = measured_ray_count / measured_time_s;
+
+	std::ofstream output_file(arguments.benchmark_output_file_path);
+	if (!output_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the benchmark results to \"%s\"", arguments.benchmark_output_file_path.c_str());
+
+		return 1;
+	}
+
+	output_file << "{\n";
+	output_file << "\t\"device\": \"" << RenderBenchmark::escape_json_string(renderer.get_device_properties().name) << "\",\n";
+	output_file << "\t\"scene\": \"" << RenderBenchmark::escape_json_string(arguments.scene_file_path) << "\",\n";
+	output_file << "\t\"width\": " << arguments.render_width << ",\n";
+	output_file << "\t\"height\": " << arguments.render_height << ",\n";
+	output_file << "\t\"bounces\": " << arguments.bounces << ",\n";
+	output_file << "\t\"random_seed\": " << RenderBenchmark::BENCHMARK_RANDOM_SEED << ",\n";
+	output_file << "\t\"warmup_frames\": " << arguments.benchmark_warmup_frames << ",\n";
+	output_file << "\t\"measured_frames\": " << arguments.benchmark_frames << ",\n";
+	output_file << "\t\"samples_per_second\": " << samples_per_second << ",\n";
+	output_file << "\t\"rays_per_second\": " << rays_per_second << ",\n";
+	static const char* ray_statistic_names[RAY_STATISTIC_COUNT] = { "camera_rays", "indirect_rays", "shadow_rays", "alpha_tests", "volume_boundary_skips", "ris_light_candidates", "visibility_cache_skipped_shadow_rays" };
+	output_file << "\t\"ray_statistics_per_second\": { ";
+	for (int statistic = 0; statistic < RAY_STATISTIC_COUNT; statistic++)
+		output_file << (statistic == 0 ? "" : ", ") << "\"" << ray_statistic_names[statistic] << "\": " << measured_ray_statistics[statistic] / measured_time_s;
+	output_file << " },\n";
+	output_file << "\t\"pass_times_ms\": {";
+	bool first_pass = true;
+	for (auto& pass_to_times : pass_times)
+	{
+		RenderBenchmarkStatistics statistics = RenderBenchmark::compute_statistics(pass_to_times.second);
+
+		output_file << (first_pass ? "\n" : ",\n");
+		output_file << "\t\t\"" << RenderBenchmark::escape_json_string(pass_to_times.first) << "\": { ";
+		output_file << "\"min\": " << statistics.min << ", ";
+		output_file << "\"mean\": " << statistics.mean << ", ";
+		output_file << "\"stddev\": " << statistics.standard_deviation << ", ";
+		output_file << "\"p99\": " << statistics.p99 << " }";
+
+		first_pass = false;
+	}
+	output_file << "\n\t}\n";
+	output_file << "}\n";
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Benchmark: %.1f samples/s, %.1f Mrays/s. Results written to \"%s\"", samples_per_second, rays_per_second / 1.0e6, arguments.benchmark_output_file_path.c_str());
+
+	return 0;
+}
+
+int RenderBenchmark::run_suite(const CommandlineArguments& arguments, const Image32Bit& envmap)
+{
+	const std::string& reference_directory = arguments.benchmark_suite_reference_directory;
+	std::filesystem::create_directories(reference_directory);
+
+	std::ofstream output_file(arguments.benchmark_output_file_path);
+	if (!output_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the benchmark suite results to \"%s\"", arguments.benchmark_output_file_path.c_str());
+
+		return 1;
+	}
+
+	// Same reasons as for the single scene benchmark
+	g_kernel_launch_autotuner.set_enabled(false);
+
+	std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(arguments.gpu_indices[0]);
+	std::vector<RenderBenchmarkConfiguration> configurations = RenderBenchmark::get_suite_configurations();
+
+	output_file << "{\n";
+	output_file << "\t\"width\": " << arguments.render_width << ",\n";
+	output_file << "\t\"height\": " << arguments.render_height << ",\n";
+	output_file << "\t\"bounces\": " << arguments.bounces << ",\n";
+	output_file << "\t\"reference_samples\": " << arguments.benchmark_reference_samples << ",\n";
+	output_file << "\t\"relative_MSE_targets\": [";
+	for (int i = 0; i < TIME_TO_QUALITY_RELATIVE_MSE_TARGETS.size(); i++)
+		output_file << (i == 0 ? "" : ", ") << TIME_TO_QUALITY_RELATIVE_MSE_TARGETS[i];
+	output_file << "],\n";
+	output_file << "\t\"scenes\": [";
+
+	for (int scene_index = 0; scene_index < RenderBenchmark::SUITE_SCENES.size(); scene_index++)
+	{
+		const std::string& scene_file = RenderBenchmark::SUITE_SCENES[scene_index];
+
+		Scene scene;
+		Assimp::Importer assimp_importer;
+		RenderBenchmark::parse_suite_scene(arguments, scene_file, assimp_importer, scene);
+
+		GPURenderer renderer(hiprt_orochi_ctx, /* headless */ true);
+		RenderBenchmark::setup_renderer(renderer, arguments, scene, envmap);
+		assimp_importer.FreeScene();
+
+		Image32Bit reference = RenderBenchmark::get_reference(renderer, arguments, reference_directory, scene_file);
+
+		output_file << (scene_index == 0 ? "\n" : ",\n");
+		output_file << "\t\t{\n";
+		output_file << "\t\t\t\"scene\": \"" << RenderBenchmark::escape_json_string(scene_file) << "\",\n";
+		output_file << "\t\t\t\"configurations\": [";
+
+		for (int configuration_index = 0; configuration_index < configurations.size(); configuration_index++)
+		{
+			const RenderBenchmarkConfiguration& configuration = configurations[configuration_index];
+			RenderBenchmark::apply_configuration(renderer, configuration);
+
+			// GPU time to reach each target, negative if never reached
+			std::vector<double> time_to_quality_s(TIME_TO_QUALITY_RELATIVE_MSE_TARGETS.size(), -1.0);
+			std::vector<int> checkpoint_samples;
+			std::vector<double> checkpoint_times_s;
+			std::vector<double> checkpoint_errors;
+
+			double render_time_s = 0.0;
+			int next_checkpoint = 1;
+			while (next_checkpoint <= arguments.benchmark_suite_max_samples)
+			{
+				render_time_s += RenderBenchmark::render_frame(renderer);
+
+				int sample_number = renderer.get_render_settings().sample_number;
+				if (sample_number < next_checkpoint)
+					continue;
+
+				double relative_MSE = RenderBenchmark::compute_relative_MSE(renderer.download_framebuffer(), reference);
+				checkpoint_samples.push_back(sample_number);
+				checkpoint_times_s.push_back(render_time_s);
+				checkpoint_errors.push_back(relative_MSE);
+
+				bool all_targets_reached = true;
+				for (int i = 0; i < TIME_TO_QUALITY_RELATIVE_MSE_TARGETS.size(); i++)
+				{
+					if (time_to_quality_s[i] < 0.0 && relative_MSE <= TIME_TO_QUALITY_RELATIVE_MSE_TARGETS[i])
+						time_to_quality_s[i] = render_time_s;
+
+					all_targets_reached &= time_to_quality_s[i] >= 0.0;
+				}
+
+				if (all_targets_reached)
+					// No need to render more samples, the lowest error target is reached
+					break;
+
+				next_checkpoint *= 2;
+			}
+
+			output_file << (configuration_index == 0 ? "\n" : ",\n");
+			output_file << "\t\t\t\t{\n";
+			output_file << "\t\t\t\t\t\"configuration\": \"" << configuration.get_name() << "\",\n";
+			output_file << "\t\t\t\t\t\"samples_per_second\": " << checkpoint_samples.back() / checkpoint_times_s.back() << ",\n";
+			output_file << "\t\t\t\t\t\"time_to_quality_ms\": [";
+			for (int i = 0; i < time_to_quality_s.size(); i++)
+				output_file << (i == 0 ? "" : ", ") << (time_to_quality_s[i] < 0.0 ? -1.0 : time_to_quality_s[i] * 1000.0);
+			output_file << "],\n";
+			output_file << "\t\t\t\t\t\"checkpoints\": [";
+			for (int i = 0; i < checkpoint_samples.size(); i++)
+				output_file << (i == 0 ? "" : ", ") << "{ \"samples\": " << checkpoint_samples[i] << ", \"time_ms\": " << checkpoint_times_s[i] * 1000.0 << ", \"relative_MSE\": " << checkpoint_errors[i] << " }";
+			output_file << "]\n";
+			output_file << "\t\t\t\t}";
+
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%s, %s: relative MSE %f after %d samples in %.1fms", scene_file.c_str(), configuration.get_name().c_str(),
+				checkpoint_errors.back(), checkpoint_samples.back(), checkpoint_times_s.back() * 1000.0);
+		}
+
+		output_file << "\n\t\t\t]\n";
+		output_file << "\t\t}";
+	}
+
+	output_file << "\n\t]\n";
+	output_file << "}\n";
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Benchmark suite results written to \"%s\"", arguments.benchmark_output_file_path.c_str());
+
+	return 0;
+}
+
+int RenderBenchmark::run_comparison(const CommandlineArguments& arguments, const Image32Bit& envmap)
+{
+	const std::string& reference_directory = arguments.strategy_comparison_reference_directory;
+	const std::string& output_directory = arguments.strategy_comparison_output_directory;
+	std::filesystem::create_directories(reference_directory);
+	std::filesystem::create_directories(output_directory);
+
+	std::string table_file_path = output_directory + "/comparison.md";
+	std::ofstream table_file(table_file_path);
+	if (!table_file.is_open())
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the strategy comparison table to \"%s\"", table_file_path.c_str());
+
+		return 1;
+	}
+
+	g_kernel_launch_autotuner.set_enabled(false);
+
+	std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(arguments.gpu_indices[0]);
+	std::vector<RenderBenchmarkConfiguration> configurations = RenderBenchmark::get_comparison_configurations();
+	double time_budget_s = arguments.strategy_comparison_time_ms / 1000.0;
+
+	table_file << "# Sampling strategies comparison\n\n";
+	table_file << "Equal time: " << arguments.strategy_comparison_time_ms << "ms of GPU time per configuration at " << arguments.render_width << "x" << arguments.render_height << ", " << arguments.bounces << " bounces.\n";
+	table_file << "Equal quality: GPU time needed to reach the relative MSE the baseline (" << configurations[0].get_name() << ") reached in that time, measured every power of 2 samples.\n";
+
+	for (const std::string& scene_file : RenderBenchmark::SUITE_SCENES)
+	{
+		Scene scene;
+		Assimp::Importer assimp_importer;
+		RenderBenchmark::parse_suite_scene(arguments, scene_file, assimp_importer, scene);
+
+		GPURenderer renderer(hiprt_orochi_ctx, /* headless */ true);
+		RenderBenchmark::setup_renderer(renderer, arguments, scene, envmap);
+		assimp_importer.FreeScene();
+
+		Image32Bit reference = RenderBenchmark::get_reference(renderer, arguments, reference_directory, scene_file);
+
+		std::string scene_name = std::filesystem::path(scene_file).stem().string();
+		std::string scene_output_directory = output_directory + "/" + scene_name;
+		std::filesystem::create_directories(scene_output_directory);
+
+		table_file << "\n## " << scene_name << "\n\n";
+		table_file << "| Configuration | Samples | Relative MSE | Time to baseline quality (ms) | Speedup | Images |\n";
+		table_file << "|---|---|---|---|---|---|\n";
+
+		double baseline_relative_MSE = 0.0;
+		double baseline_time_to_quality_s = 0.0;
+		for (int configuration_index = 0; configuration_index < configurations.size(); configuration_index++)
+		{
+			const RenderBenchmarkConfiguration& configuration = configurations[configuration_index];
+			RenderBenchmark::apply_configuration(renderer, configuration);
+
+			std::vector<double> checkpoint_times_s;
+			std::vector<double> checkpoint_errors;
+
+			double render_time_s = 0.0;
+			int next_checkpoint = 1;
+			while (render_time_s < time_budget_s)
+			{
+				render_time_s += RenderBenchmark::render_frame(renderer);
+
+				if (renderer.get_render_settings().sample_number < next_checkpoint)
+					continue;
+
+				checkpoint_times_s.push_back(render_time_s);
+				checkpoint_errors.push_back(RenderBenchmark::compute_relative_MSE(renderer.download_framebuffer(), reference));
+				next_checkpoint *= 2;
+			}
+
+			Image32Bit render = renderer.download_framebuffer();
+			double relative_MSE = RenderBenchmark::compute_relative_MSE(render, reference);
+			checkpoint_times_s.push_back(render_time_s);
+			checkpoint_errors.push_back(relative_MSE);
+
+			if (configuration_index == 0)
+				baseline_relative_MSE = relative_MSE;
+
+			// Negative if the baseline quality wasn't reached in the time budget
+			double time_to_quality_s = -1.0;
+			for (int i = 0; i < checkpoint_errors.size(); i++)
+			{
+				if (checkpoint_errors[i] <= baseline_relative_MSE)
+				{
+					time_to_quality_s = checkpoint_times_s[i];
+
+					break;
+				}
+			}
+
+			if (configuration_index == 0)
+				baseline_time_to_quality_s = time_to_quality_s;
+
+			// The names of the configurations use '/' between their options
+			std::string image_name = configuration.get_name();
+			std::replace(image_name.begin(), image_name.end(), '/', '-');
+			std::string render_file_path = scene_output_directory + "/" + image_name + ".hdr";
+			std::string error_file_path = scene_output_directory + "/" + image_name + "_error.hdr";
+			render.write_image_hdr(render_file_path.c_str());
+			RenderBenchmark::compute_relative_error_image(render, reference).write_image_hdr(error_file_path.c_str());
+
+			table_file << "| " << configuration.get_name() << " | " << renderer.get_render_settings().sample_number << " | " << relative_MSE << " | ";
+			if (time_to_quality_s < 0.0)
+				table_file << "> " << arguments.strategy_comparison_time_ms << " | < 1 | ";
+			else
+				table_file << time_to_quality_s * 1000.0 << " | " << baseline_time_to_quality_s / time_to_quality_s << " | ";
+			table_file << "[render](" << scene_name << "/" << image_name << ".hdr) [error](" << scene_name << "/" << image_name << "_error.hdr) |\n";
+
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%s, %s: relative MSE %f after %d samples", scene_file.c_str(), configuration.get_name().c_str(),
+				relative_MSE, renderer.get_render_settings().sample_number);
+		}
+	}
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Strategy comparison written to \"%s\"", table_file_path.c_str());
+
+	return 0;
+}
+
+std::vector<RenderBenchmarkConfiguration> RenderBenchmark::get_suite_configurations()
+{
+	std::vector<RenderBenchmarkConfiguration> configurations;
+
+	for (int direct_light_sampling_strategy : { LSS_MIS_LIGHT_BSDF, LSS_RIS_BSDF_AND_LIGHT, LSS_LIGHT_BVH, LSS_RESTIR_DI })
+	{
+		for (int envmap_sampling_strategy : { ESS_BINARY_SEARCH, ESS_ALIAS_TABLE })
+		{
+			if (direct_light_sampling_strategy != LSS_RESTIR_DI)
+			{
+				configurations.push_back({ direct_light_sampling_strategy, envmap_sampling_strategy, RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE, ILS_PATH_TRACING });
+
+				continue;
+			}
+
+			// The ReSTIR settings only matter with ReSTIR DI
+			for (int bias_correction_weights : { RESTIR_DI_BIAS_CORRECTION_1_OVER_M, RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE })
+				for (int indirect_light_sampling_strategy : { ILS_PATH_TRACING, ILS_RESTIR_GI })
+					configurations.push_back({ direct_light_sampling_strategy, envmap_sampling_strategy, bias_correction_weights, indirect_light_sampling_strategy });
+		}
+	}
+
+	return configurations;
+}
+
+std::vector<RenderBenchmarkConfiguration> RenderBenchmark::get_comparison_configurations()
+{
+	// The first configuration is the baseline of the comparison
+	std::vector<RenderBenchmarkConfiguration> configurations;
+	configurations.push_back({ LSS_MIS_LIGHT_BSDF, ESS_ALIAS_TABLE, RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE, ILS_PATH_TRACING });
+
+	for (int direct_light_sampling_strategy : { LSS_UNIFORM_ONE_LIGHT, LSS_BSDF, LSS_RIS_BSDF_AND_LIGHT, LSS_LIGHT_BVH })
+		configurations.push_back({ direct_light_sampling_strategy, ESS_ALIAS_TABLE, RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE, ILS_PATH_TRACING });
+
+	// Envmap * BSDF product sampling against the luminance alias table of the baseline
+	configurations.push_back({ LSS_MIS_LIGHT_BSDF, ESS_PRODUCT_SAMPLING, RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE, ILS_PATH_TRACING });
+
+	for (int bias_correction_weights = RESTIR_DI_BIAS_CORRECTION_1_OVER_M; bias_correction_weights <= RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE; bias_correction_weights++)
+		configurations.push_back({ LSS_RESTIR_DI, ESS_ALIAS_TABLE, bias_correction_weights, ILS_PATH_TRACING });
+
+	// GGX_VNDF_BOUNDED is already used by the baseline
+	for (int ggx_sample_function : { GGX_NO_VNDF, GGX_VNDF_SAMPLING, GGX_VNDF_SPHERICAL_CAPS })
+		configurations.push_back({ LSS_MIS_LIGHT_BSDF, ESS_ALIAS_TABLE, RESTIR_DI_BIAS_CORRECTION_PAIRWISE_MIS_DEFENSIVE, ILS_PATH_TRACING, ggx_sample_function });
+
+	return configurations;
+}
+
+double RenderBenchmark::compute_relative_MSE(const Image32Bit& image, const Image32Bit& reference)
+{
+	const std::vector<float>& image_data = image.data();
+	const std::vector<float>& reference_data = reference.data();
+	if (image_data.size() != reference_data.size() || image_data.empty())
+		return 0.0;
+
+	double sum = 0.0;
+	for (size_t i = 0; i < image_data.size(); i++)
+	{
+		double difference = image_data[i] - reference_data[i];
+
+		// The epsilon keeps the black pixels of the reference from dominating the error
+		sum += difference * difference / (reference_data[i] * reference_data[i] + 0.01);
+	}
+
+	return sum / image_data.size();
+}
+
+Image32Bit RenderBenchmark::compute_relative_error_image(const Image32Bit& image, const Image32Bit& reference)
+{
+	Image32Bit error_image(reference.width, reference.height, reference.channels);
+	if (image.data().size() != reference.data().size())
+		return error_image;
+
+	for (size_t i = 0; i < reference.data().size(); i++)
+	{
+		float difference = image[i] - reference[i];
+
+		error_image[i] = difference * difference / (reference[i] * reference[i] + 0.01f);
+	}
+
+	return error_image;
+}
+
+void RenderBenchmark::parse_suite_scene(const CommandlineArguments& arguments, const std::string& scene_file, Assimp::Importer& assimp_importer, Scene& out_scene)
+{
+	SceneParserOptions options;
+	options.nb_texture_threads = std::max(1, ThreadManager::get_worker_count() - 1);
+	options.use_scene_cache = arguments.use_scene_cache;
+	options.stream_cached_vertex_attributes = true;
+	options.virtual_texturing = arguments.virtual_texturing;
+	options.override_aspect_ratio = static_cast<float>(arguments.render_width) / arguments.render_height;
+
+	SceneParser::parse_scene_file(RenderBenchmark::SUITE_SCENES_DIRECTORY + scene_file, assimp_importer, out_scene, options);
+}
+
+Image32Bit RenderBenchmark::get_reference(GPURenderer& renderer, const CommandlineArguments& arguments, const std::string& reference_directory, const std::string& scene_file)
+{
+	std::string reference_file_path = reference_directory + "/" + std::filesystem::path(scene_file).stem().string() + "_reference.hdr";
+	Image32Bit reference;
+	if (std::filesystem::exists(reference_file_path))
+		reference = Image32Bit::read_image_hdr(reference_file_path, 3, true);
+
+	if (reference.width == arguments.render_width && reference.height == arguments.render_height)
+		return reference;
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Rendering the %d samples reference of \"%s\"...", arguments.benchmark_reference_samples, scene_file.c_str());
+
+	RenderBenchmark::apply_configuration(renderer, RenderBenchmark::REFERENCE_CONFIGURATION);
+	while (renderer.get_render_settings().sample_number < arguments.benchmark_reference_samples)
+		RenderBenchmark::render_frame(renderer);
+
+	reference = renderer.download_framebuffer();
+	if (!reference.write_image_hdr(reference_file_path.c_str()))
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not write the reference \"%s\"", reference_file_path.c_str());
+
+	return reference;
+}
+
+void RenderBenchmark::setup_renderer(GPURenderer& renderer, const CommandlineArguments& arguments, const Scene& scene, const Image32Bit& envmap)
+{
+	// The renderer needs its stream for resizing
+	ThreadManager::join_threads(ThreadManager::RENDERER_STREAM_CREATE);
+
+	renderer.set_rng_seed(RenderBenchmark::BENCHMARK_RANDOM_SEED);
+	renderer.set_envmap(envmap, arguments.skysphere_file_path);
+	renderer.set_camera(scene.camera);
+	renderer.resize(arguments.render_width, arguments.render_height);
+	renderer.set_bvh_build_quality(static_cast<BVHBuildQuality>(arguments.bvh_build_quality));
+	renderer.set_half_precision_texcoords(arguments.half_precision_texcoords);
+	renderer.set_quantized_vertices_positions(arguments.quantized_vertices_positions);
+	renderer.set_compact_bvh(arguments.compact_bvh);
+	renderer.set_scene(scene);
+
+	ThreadManager::join_all_threads();
+
+	HIPRTRenderSettings& render_settings = renderer.get_render_settings();
+	render_settings.nb_bounces = arguments.bounces;
+	render_settings.accumulate = true;
+}
+
+void RenderBenchmark::apply_configuration(GPURenderer& renderer, const RenderBenchmarkConfiguration& configuration)
+{
+	std::shared_ptr<GPUKernelCompilerOptions> kernel_options = renderer.get_global_compiler_options();
+	kernel_options->set_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY, configuration.direct_light_sampling_strategy);
+	kernel_options->set_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY, configuration.envmap_sampling_strategy);
+	kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_BIAS_CORRECTION_WEIGHTS, configuration.restir_di_bias_correction_weights);
+	kernel_options->set_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY, configuration.indirect_light_sampling_strategy);
+	kernel_options->set_macro_value(GPUKernelCompilerOptions::GGX_SAMPLE_FUNCTION, configuration.ggx_sample_function);
+	if (renderer.has_envmap())
+		// The sampling data structure of the envmap depends on the envmap sampling strategy
+		renderer.get_envmap().recompute_sampling_data_structure(&renderer);
+	renderer.recompile_kernels();
+
+	std::shared_ptr<ApplicationSettings> application_settings = std::make_shared<ApplicationSettings>();
+	renderer.reset(application_settings);
+	renderer.get_render_settings().samples_per_frame = 1;
+}
+
+double RenderBenchmark::render_frame(GPURenderer& renderer)
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	renderer.update();
+	renderer.render();
+	renderer.synchronize_kernel();
+	renderer.copy_status_buffers();
+
+	std::chrono::high_resolution_clock::time_point stop = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double>(stop - start).count();
+}
+
+RenderBenchmarkStatistics RenderBenchmark::compute_statistics(std::vector<float>& values)
+{
+	RenderBenchmarkStatistics statistics;
+	if (values.empty())
+		return statistics;
+
+	std::sort(values.begin(), values.end());
+
+	double sum = 0.0;
+	for (float value : values)
+		sum += value;
+	double mean = sum / values.size();
+
+	double sum_of_squared_differences = 0.0;
+	for (float value : values)
+		sum_of_squared_differences += (value - mean) * (value - mean);
+
+	statistics.min = values.front();
+	statistics.mean = static_cast<float>(mean);
+	statistics.standard_deviation = static_cast<float>(std::sqrt(sum_of_squared_differences / values.size()));
+	// Nearest rank: the smallest value that is greater or equal to 99% of the values
+	size_t p99_index = static_cast<size_t>(std::ceil(0.99 * values.size())) - 1;
+	statistics.p99 = values[std::min(p99_index, values.size() - 1)];
+
+	return statistics;
+}
+
+std::string RenderBenchmark::escape_json_string(const std::string& string)
+{
+	std::string escaped;
+	for (char character : string)
+	{
+		if (character == '"' || character == '\\')
+			escaped += '\\';
+
+		escaped += character;
+	}
+
+	return escaped;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RENDER_BENCHMARK_H
+#define RENDER_BENCHMARK_H
+
+#include "HostDeviceCommon/KernelOptions.h"
+#include "Image/Image.h"
+#include "Scene/SceneParser.h"
+#include "Utils/CommandlineArguments.h"
+
+#include <string>
+#include <vector>
+
+class GPURenderer;
+
+struct RenderBenchmarkStatistics
+{
+	float min = 0.0f;
+	float mean = 0.0f;
+	float standard_deviation = 0.0f;
+	// 99th percentile (nearest rank)
+	float p99 = 0.0f;
+};
+
+/**
+ * Kernel options of one of the configurations of the scene benchmark suite
+ */
+struct RenderBenchmarkConfiguration
+{
+	int direct_light_sampling_strategy;
+	int envmap_sampling_strategy;
+	int restir_di_bias_correction_weights;
+	int indirect_light_sampling_strategy;
+	int ggx_sample_function = GGX_VNDF_BOUNDED;
+
+	std::string get_name() const;
+};
+
+/**
+ * Reproducible benchmark of the GPU renderer.
+ *
+ * The application started with BENCHMARK_COMMANDLINE_ARGUMENT renders the scene without a window on the first
+ * device of --gpus, with the camera of the scene, a fixed random seed (BENCHMARK_RANDOM_SEED) and
+ * render_settings.freeze_random so that every run renders the same samples. The kernel launch autotuner is
+ * disabled for the same reason: its shapes already tuned are still used.
+ *
+ * 'benchmark_warmup_frames' frames of one sample are rendered first and aren't measured (kernel compilation,
+ * caches, GPU clocks, ...). The 'benchmark_frames' frames that follow are each waited for and the min / mean /
+ * standard deviation / 99th percentile of the time of every pass of GPURenderer::get_render_pass_times() are written as
+ * JSON to 'benchmark_output_file_path' with the samples per second and the rays per second of the measured frames.
+ * The rays are the path segments counted by render_settings.count_bounce_active_rays, shadow rays excluded.
+ * The counters of render_settings.count_ray_statistics (camera / indirect / shadow rays, alpha tests, nested
+ * dielectrics skips, see RayStatistic) are also written per second, in "ray_statistics_per_second"
+ *
+ * The application started with SUITE_COMMANDLINE_ARGUMENT runs the scene benchmark suite instead: the SUITE_SCENES
+ * bundled in data/GLTFs are rendered with every configuration of get_suite_configurations() (direct light sampling
+ * strategy x envmap sampling strategy x ReSTIR settings) and the relative MSE of the render against the reference
+ * of the scene is measured every power of 2 samples, up to 'benchmark_suite_max_samples'. The time-to-quality of a
+ * configuration is the GPU time (frames waited for, the error computations aren't counted) it took to get below each of
+ * the TIME_TO_QUALITY_RELATIVE_MSE_TARGETS. The references are HDR images of 'benchmark_reference_samples' samples rendered
+ * with REFERENCE_CONFIGURATION, stored in the directory given to SUITE_COMMANDLINE_ARGUMENT: a missing reference
+ * is rendered and written by the suite. The "SceneBenchmarkSuite" CMake target runs the suite
+ *
+ * The application started with COMPARISON_COMMANDLINE_ARGUMENT compares the sampling strategies of
+ * get_comparison_configurations() on the same scenes and references instead. Each configuration renders for
+ * 'strategy_comparison_time_ms' of GPU time (equal time) and the time it took to reach the relative MSE the first
+ * configuration of the list reached in that time is measured (equal quality). The table of the results is written as
+ * Markdown to 'strategy_comparison_output_directory'/comparison.md, next to the render and the relative error image
+ * of every configuration. The "StrategyComparison" CMake target runs the comparison
+ */
+class RenderBenchmark
+{
+public:
+	static const std::string BENCHMARK_COMMANDLINE_ARGUMENT;
+	static const std::string WARMUP_FRAMES_COMMANDLINE_ARGUMENT;
+	static const std::string MEASURED_FRAMES_COMMANDLINE_ARGUMENT;
+	static const std::string OUTPUT_COMMANDLINE_ARGUMENT;
+	static const std::string SUITE_COMMANDLINE_ARGUMENT;
+	static const std::string SUITE_MAX_SAMPLES_COMMANDLINE_ARGUMENT;
+	static const std::string REFERENCE_SAMPLES_COMMANDLINE_ARGUMENT;
+	static const std::string COMPARISON_COMMANDLINE_ARGUMENT;
+	static const std::string COMPARISON_TIME_COMMANDLINE_ARGUMENT;
+	static const std::string COMPARISON_OUTPUT_COMMANDLINE_ARGUMENT;
+
+	static constexpr unsigned int BENCHMARK_RANDOM_SEED = 42;
+
+	// Scene files of the suite, relative to SUITE_SCENES_DIRECTORY
+	static const std::vector<std::string> SUITE_SCENES;
+	static const std::string SUITE_SCENES_DIRECTORY;
+	// Unbiased configuration the references are rendered with
+	static const RenderBenchmarkConfiguration REFERENCE_CONFIGURATION;
+	static const std::vector<float> TIME_TO_QUALITY_RELATIVE_MSE_TARGETS;
+
+	/**
+	 * Runs the benchmark on 'scene' and returns the exit code of the application
+	 */
+	static int run(const CommandlineArguments& arguments, const Scene& scene, const Image32Bit& envmap);
+	/**
+	 * Runs the scene benchmark suite and returns the exit code of the application
+	 */
+	static int run_suite(const CommandlineArguments& arguments, const Image32Bit& envmap);
+	/**
+	 * Runs the equal-time / equal-quality comparison of the sampling strategies and returns the exit code of the application
+	 */
+	static int run_comparison(const CommandlineArguments& arguments, const Image32Bit& envmap);
+
+	static std::vector<RenderBenchmarkConfiguration> get_suite_configurations();
+	/**
+	 * Direct light sampling strategies, ReSTIR DI bias correction weights and GGX sample functions
+	 * compared by run_comparison(). The first configuration is the baseline
+	 */
+	static std::vector<RenderBenchmarkConfiguration> get_comparison_configurations();
+	/**
+	 * Relative MSE of 'image' against 'reference': mean over the pixels and channels of (image - reference)^2 / (reference^2 + 0.01)
+	 */
+	static double compute_relative_MSE(const Image32Bit& image, const Image32Bit& reference);
+	/**
+	 * Per pixel and channel terms of compute_relative_MSE()
+	 */
+	static Image32Bit compute_relative_error_image(const Image32Bit& image, const Image32Bit& reference);
+
+	/**
+	 * Statistics of 'values', which is sorted in the process
+	 */
+	static RenderBenchmarkStatistics compute_statistics(std::vector<float>& values);
+
+	/**
+	 * Parses 'scene_file' of SUITE_SCENES_DIRECTORY with the scene options of 'arguments'
+	 */
+	static void parse_suite_scene(const CommandlineArguments& arguments, const std::string& scene_file, Assimp::Importer& assimp_importer, Scene& out_scene);
+	/**
+	 * Gives 'scene' to 'renderer' and resizes it to the resolution of 'arguments'
+	 */
+	static void setup_renderer(GPURenderer& renderer, const CommandlineArguments& arguments, const Scene& scene, const Image32Bit& envmap);
+	static std::string escape_json_string(const std::string& string);
+
+private:
+	/**
+	 * Reads the reference of 'scene_file' from 'reference_directory'. If it's missing or not of the
+	 * resolution of 'arguments', the reference is rendered by 'renderer' and written there
+	 */
+	static Image32Bit get_reference(GPURenderer& renderer, const CommandlineArguments& arguments, const std::string& reference_directory, const std::string& scene_file);
+	/**
+	 * Sets the kernel options of 'configuration' on 'renderer', recompiles its kernels and resets the render
+	 */
+	static void apply_configuration(GPURenderer& renderer, const RenderBenchmarkConfiguration& configuration);
+	/**
+	 * Renders one frame of 'samples_per_frame' samples and waits for it. Returns how long that took in seconds
+	 */
+	static double render_frame(GPURenderer& renderer);
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/RenderCheckpoint.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+// Magic number at the start of the checkpoint files: 'HRC' + 1 byte for the endianness check
+static constexpr std::uint32_t RENDER_CHECKPOINT_MAGIC = 0x48524301;
+
+namespace
+{
+	template <typename T>
+	void write_value(std::ofstream& file, const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be written as raw bytes in a checkpoint");
+
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <typename T>
+	void write_vector(std::ofstream& file, const std::vector<T>& vector)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be written as raw bytes in a checkpoint");
+
+		std::uint64_t size = vector.size();
+		file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		file.write(reinterpret_cast<const char*>(vector.data()), sizeof(T) * size);
+	}
+
+	template <typename T>
+	bool read_value(std::ifstream& file, T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be read as raw bytes from a checkpoint");
+
+		return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+	}
+
+	template <typename T>
+	bool read_vector(std::ifstream& file, std::vector<T>& vector)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be read as raw bytes from a checkpoint");
+
+		std::uint64_t size;
+		if (!read_value(file, size))
+			return false;
+
+		vector.resize(size);
+		return static_cast<bool>(file.read(reinterpret_cast<char*>(vector.data()), sizeof(T) * size));
+	}
+
+	/**
+	 * Copies the 'count' elements downloaded by 'transfer'
+	 */
+	template <typename T>
+	std::vector<T> get_downloaded_vector(const OrochiAsyncTransfer& transfer, size_t count)
+	{
+		if (count == 0)
+			return std::vector<T>();
+
+		const T* data = transfer.get_downloaded_data<T>();
+
+		return std::vector<T>(data, data + count);
+	}
+}
+
+bool RenderCheckpoint::write(const std::string& file_path) const
+{
+	std::string temporary_file_path = file_path + ".tmp";
+
+	{
+		std::ofstream file(temporary_file_path, std::ios::binary);
+		if (!file)
+			return false;
+
+		write_value(file, RENDER_CHECKPOINT_MAGIC);
+		write_value(file, RENDER_CHECKPOINT_VERSION);
+		// The layouts of the buffers, a checkpoint written by a build with different structures is rejected
+		write_value(file, static_cast<std::uint32_t>(sizeof(PixelStatus)));
+		write_value(file, static_cast<std::uint32_t>(sizeof(ReSTIRDIPackedReservoir)));
+		write_value(file, static_cast<std::uint32_t>(sizeof(ReSTIRGIReservoir)));
+
+		write_value(file, width);
+		write_value(file, height);
+		write_value(file, sample_number);
+		write_value(file, rng_state);
+		write_value(file, restir_di_odd_frame);
+
+		write_vector(file, pixels);
+		write_vector(file, pixel_status);
+		write_vector(file, pixel_squared_luminance);
+		write_vector(file, pixel_half_luminance);
+		write_vector(file, pixel_converged_sample_count);
+		write_vector(file, restir_di_reservoirs);
+		write_vector(file, restir_gi_reservoirs);
+
+		if (!file)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary_file_path, file_path, error);
+
+	return !error;
+}
+
+bool RenderCheckpoint::read(const std::string& file_path)
+{
+	std::ifstream file(file_path, std::ios::binary);
+	if (!file)
+		return false;
+
+	std::uint32_t magic, version, pixel_status_size, restir_di_reservoir_size, restir_gi_reservoir_size;
+	if (!read_value(file, magic) || magic != RENDER_CHECKPOINT_MAGIC
+		|| !read_value(file, version) || version != RENDER_CHECKPOINT_VERSION
+		|| !read_value(file, pixel_status_size) || pixel_status_size != sizeof(PixelStatus)
+		|| !read_value(file, restir_di_reservoir_size) || restir_di_reservoir_size != sizeof(ReSTIRDIPackedReservoir)
+		|| !read_value(file, restir_gi_reservoir_size) || restir_gi_reservoir_size != sizeof(ReSTIRGIReservoir))
+		return false;
+
+	bool success = true;
+	success &= read_value(file, width);
+	success &= read_value(file, height);
+	success &= read_value(file, sample_number);
+	success &= read_value(file, rng_state);
+	success &= read_value(file, restir_di_odd_frame);
+
+	success &= read_vector(file, pixels);
+	success &= read_vector(file, pixel_status);
+	success &= read_vector(file, pixel_squared_luminance);
+	success &= read_vector(file, pixel_half_luminance);
+	success &= read_vector(file, pixel_converged_sample_count);
+	success &= read_vector(file, restir_di_reservoirs);
+	success &= read_vector(file, restir_gi_reservoirs);
+
+	return success;
+}
+
+std::string RenderCheckpoint::get_device_file_path(const std::string& checkpoint_path, int device_index)
+{
+	if (device_index == 0)
+		// Same file as a single GPU render
+		return checkpoint_path;
+
+	return checkpoint_path + ".gpu" + std::to_string(device_index);
+}
+
+void RenderCheckpointDownload::wait() const
+{
+	pixels.wait();
+	pixel_status.wait();
+	pixel_squared_luminance.wait();
+	pixel_half_luminance.wait();
+	pixel_converged_sample_count.wait();
+	restir_di_reservoirs.wait();
+	restir_gi_reservoirs.wait();
+}
+
+RenderCheckpoint RenderCheckpointDownload::get_checkpoint() const
+{
+	RenderCheckpoint checkpoint;
+	checkpoint.width = width;
+	checkpoint.height = height;
+	checkpoint.sample_number = sample_number;
+	checkpoint.rng_state = rng_state;
+	checkpoint.restir_di_odd_frame = restir_di_odd_frame;
+
+	checkpoint.pixels = get_downloaded_vector<ColorRGB32F>(pixels, pixel_count);
+	checkpoint.pixel_status = get_downloaded_vector<PixelStatus>(pixel_status, pixel_status_count);
+	checkpoint.pixel_squared_luminance = get_downloaded_vector<float>(pixel_squared_luminance, pixel_squared_luminance_count);
+	checkpoint.pixel_half_luminance = get_downloaded_vector<float>(pixel_half_luminance, pixel_half_luminance_count);
+	checkpoint.pixel_converged_sample_count = get_downloaded_vector<int>(pixel_converged_sample_count, pixel_converged_sample_count_count);
+	checkpoint.restir_di_reservoirs = get_downloaded_vector<ReSTIRDIPackedReservoir>(restir_di_reservoirs, restir_di_reservoir_count);
+	checkpoint.restir_gi_reservoirs = get_downloaded_vector<ReSTIRGIReservoir>(restir_gi_reservoirs, restir_gi_reservoir_count);
+
+	return checkpoint;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RENDER_CHECKPOINT_H
+#define RENDER_CHECKPOINT_H
+
+#include "Device/includes/ReSTIR/DI/Reservoir.h"
+#include "Device/includes/ReSTIR/GI/Reservoir.h"
+#include "HIPRT-Orochi/OrochiStagingPool.h"
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/PixelStatus.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Accumulation state of a headless GPURenderer: what the render needs to continue exactly
+ * where it stopped after the process died or was preempted, see GPURenderer::load_checkpoint().
+ *
+ * The buffers that a render doesn't use (adaptive sampling buffers without adaptive sampling,
+ * reservoirs without ReSTIR, ...) are empty
+ */
+struct RenderCheckpoint
+{
+	// Incremented when the content of the checkpoint files changes
+	static constexpr unsigned int RENDER_CHECKPOINT_VERSION = 1;
+
+	/**
+	 * Writes the checkpoint to 'file_path'. The checkpoint is first written next to it and then renamed
+	 * so that a process killed while writing leaves the previous checkpoint intact
+	 */
+	bool write(const std::string& file_path) const;
+	/**
+	 * Returns false if the file doesn't exist or isn't a checkpoint of this version
+	 */
+	bool read(const std::string& file_path);
+
+	/**
+	 * File of the checkpoint of the device 'device_index' of a MultiGPURenderer
+	 */
+	static std::string get_device_file_path(const std::string& checkpoint_path, int device_index);
+
+	int width = 0;
+	int height = 0;
+	int sample_number = 0;
+	// State of the random number generator of the renderer
+	unsigned int rng_state = 0;
+	// See ReSTIRDIRenderPass::odd_frame
+	bool restir_di_odd_frame = false;
+
+	// Sum of the samples of the pixels
+	std::vector<ColorRGB32F> pixels;
+	std::vector<PixelStatus> pixel_status;
+	std::vector<float> pixel_squared_luminance;
+	std::vector<float> pixel_half_luminance;
+	std::vector<int> pixel_converged_sample_count;
+
+	// Reservoirs output by the last frame, the input of the temporal reuse of the next frame
+	std::vector<ReSTIRDIPackedReservoir> restir_di_reservoirs;
+	std::vector<ReSTIRGIReservoir> restir_gi_reservoirs;
+};
+
+/**
+ * Download of a RenderCheckpoint queued by GPURenderer::download_checkpoint_async(). The scalars
+ * are read when the download is queued, the buffers once the frames already queued are done
+ */
+struct RenderCheckpointDownload
+{
+	void wait() const;
+	/**
+	 * Only valid after wait()
+	 */
+	RenderCheckpoint get_checkpoint() const;
+
+	int width = 0;
+	int height = 0;
+	int sample_number = 0;
+	unsigned int rng_state = 0;
+	bool restir_di_odd_frame = false;
+
+	// Element counts of the downloads, 0 for the buffers not downloaded
+	size_t pixel_count = 0;
+	size_t pixel_status_count = 0;
+	size_t pixel_squared_luminance_count = 0;
+	size_t pixel_half_luminance_count = 0;
+	size_t pixel_converged_sample_count_count = 0;
+	size_t restir_di_reservoir_count = 0;
+	size_t restir_gi_reservoir_count = 0;
+
+	OrochiAsyncTransfer pixels;
+	OrochiAsyncTransfer pixel_status;
+	OrochiAsyncTransfer pixel_squared_luminance;
+	OrochiAsyncTransfer pixel_half_luminance;
+	OrochiAsyncTransfer pixel_converged_sample_count;
+	OrochiAsyncTransfer restir_di_reservoirs;
+	OrochiAsyncTransfer restir_gi_reservoirs;
+};
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/PixelStatus.h"
+#include "Renderer/RenderLayersDownload.h"
+
+#include <algorithm>
+
+bool RenderLayersDownload::is_done() const
+{
+	return beauty.is_done() && albedo.is_done() && normals.is_done() && sample_count.is_done() && denoised.is_done();
+}
+
+void RenderLayersDownload::wait() const
+{
+	beauty.wait();
+	albedo.wait();
+	normals.wait();
+	sample_count.wait();
+	denoised.wait();
+}
+
+/**
+ * Layer with the 3 channels of the RGB buffer 'data', multiplied by 'scale'
+ */
+static EXRLayer make_rgb_layer(const std::string& name, const std::vector<std::string>& channel_names, const float* data, int pixel_count, float scale)
+{
+	EXRLayer layer;
+	layer.name = name;
+	layer.channel_names = channel_names;
+	layer.pixels.resize(pixel_count * 3);
+	for (int i = 0; i < pixel_count * 3; i++)
+		layer.pixels[i] = data[i] * scale;
+
+	return layer;
+}
+
+std::vector<EXRLayer> RenderLayersDownload::get_exr_layers() const
+{
+	int pixel_count = width * height;
+	std::vector<EXRLayer> layers;
+
+	// The framebuffer holds the sum of the samples, the AOVs are already averaged
+	float inverse_sample_number = 1.0f / std::max(1, sample_number);
+	layers.push_back(make_rgb_layer("", { "R", "G", "B" }, reinterpret_cast<const float*>(beauty.get_downloaded_data<ColorRGB32F>()), pixel_count, inverse_sample_number));
+	layers.push_back(make_rgb_layer("albedo", { "R", "G", "B" }, reinterpret_cast<const float*>(albedo.get_downloaded_data<ColorRGB32F>()), pixel_count, 1.0f));
+	layers.push_back(make_rgb_layer("normal", { "X", "Y", "Z" }, normals.get_downloaded_data<float>(), pixel_count, 1.0f));
+	if (has_denoised)
+		layers.push_back(make_rgb_layer("denoised", { "R", "G", "B" }, reinterpret_cast<const float*>(denoised.get_downloaded_data<ColorRGB32F>()), pixel_count, 1.0f));
+
+	EXRLayer sample_count_layer;
+	sample_count_layer.name = "sample_count";
+	sample_count_layer.channel_names = { "Y" };
+	sample_count_layer.unsigned_int = true;
+	sample_count_layer.pixels.resize(pixel_count, static_cast<float>(sample_number));
+	if (has_sample_count)
+	{
+		const PixelStatus* pixel_statuses = sample_count.get_downloaded_data<PixelStatus>();
+		for (int i = 0; i < pixel_count; i++)
+			sample_count_layer.pixels[i] = static_cast<float>(pixel_statuses[i].get_sample_count());
+	}
+	layers.push_back(sample_count_layer);
+
+	return layers;
+}
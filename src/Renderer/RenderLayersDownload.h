@@ -0,0 +1,55 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RENDER_LAYERS_DOWNLOAD_H
+#define RENDER_LAYERS_DOWNLOAD_H
+
+#include "HIPRT-Orochi/OrochiStagingPool.h"
+#include "Image/EXRWriter.h"
+
+#include <vector>
+
+/**
+ * Downloads of the layers of the render (beauty, AOVs, ...) queued by
+ * GPURenderer::download_render_layers_async() for the EXR export
+ */
+struct RenderLayersDownload
+{
+	/**
+	 * Returns true once all the layers are downloaded. Doesn't block
+	 */
+	bool is_done() const;
+	/**
+	 * Blocks until all the layers are downloaded
+	 */
+	void wait() const;
+
+	/**
+	 * Converts the downloaded buffers to the layers of an EXR file: the beauty (R, G, B),
+	 * "albedo", "normal", "sample_count" and "denoised" if it was downloaded.
+	 * Only valid once is_done() returns true
+	 */
+	std::vector<EXRLayer> get_exr_layers() const;
+
+	int width = 0;
+	int height = 0;
+	// The beauty buffer holds the sum of that many samples
+	int sample_number = 0;
+
+	OrochiAsyncTransfer beauty;
+	OrochiAsyncTransfer albedo;
+	OrochiAsyncTransfer normals;
+
+	// The sample count of the pixels is only tracked with adaptive sampling,
+	// all the pixels have 'sample_number' samples otherwise.
+	// These are the PixelStatus of the pixels that contain the sample counts
+	bool has_sample_count = false;
+	OrochiAsyncTransfer sample_count;
+
+	bool has_denoised = false;
+	OrochiAsyncTransfer denoised;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/GPURenderer.h"
+#include "Renderer/RenderPasses/PathGuidingRenderPass.h"
+#include "Threads/ThreadFunctions.h"
+#include "Threads/ThreadManager.h"
+
+const std::string PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID = "Path Guiding Build";
+
+const std::unordered_map<std::string, std::string> PathGuidingRenderPass::KERNEL_FUNCTION_NAMES =
+{
+	{ PATH_GUIDING_BUILD_KERNEL_ID, "PathGuidingBuild" },
+};
+
+const std::unordered_map<std::string, std::string> PathGuidingRenderPass::KERNEL_FILES =
+{
+	{ PATH_GUIDING_BUILD_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/PathGuidingBuild.h" },
+};
+
+PathGuidingRenderPass::PathGuidingRenderPass(GPURenderer* renderer) : RenderPass(renderer) {}
+
+void PathGuidingRenderPass::compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets)
+{
+	std::shared_ptr<GPUKernelCompilerOptions> global_compiler_options = m_renderer->get_global_compiler_options();
+
+	m_kernels[PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID].set_kernel_file_path(PathGuidingRenderPass::KERNEL_FILES.at(PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID));
+	m_kernels[PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID].set_kernel_function_name(PathGuidingRenderPass::KERNEL_FUNCTION_NAMES.at(PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID));
+	m_kernels[PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID].synchronize_options_with(*global_compiler_options, options_excluded_from_synchro);
+
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
+}
+
+bool PathGuidingRenderPass::is_enabled()
+{
+	if (render_data->render_settings.use_wavefront_path_tracing)
+		// Only the megakernel path tracer samples the guiding distributions
+		return false;
+
+	return m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_PATH_GUIDING;
+}
+
+void PathGuidingRenderPass::update()
+{
+	PathGuidingSettings& path_guiding_settings = render_data->render_settings.path_guiding_settings;
+
+	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_PATH_GUIDING)
+	{
+		size_t bin_count = get_cell_count() * PATH_GUIDING_BIN_COUNT;
+		if (m_training_bins.get_element_count() != bin_count)
+		{
+			// Path guiding just got enabled or the resolution of the grid changed
+			m_training_bins.resize(bin_count);
+			m_sampling_cdfs.resize(bin_count);
+			m_training_reset_requested = true;
+
+			m_renderer->invalidate_render_data_buffers();
+		}
+
+		if (m_training_reset_requested)
+		{
+			std::vector<float> zeros(bin_count, 0.0f);
+			m_training_bins.upload_data(zeros);
+			m_sampling_cdfs.upload_data(zeros);
+
+			m_trained_sample_count = 0;
+			m_training_reset_requested = false;
+		}
+	}
+	else if (m_training_bins.get_element_count() > 0)
+	{
+		m_training_bins.free();
+		m_sampling_cdfs.free();
+
+		m_renderer->invalidate_render_data_buffers();
+	}
+
+	path_guiding_settings.do_training = is_enabled() && m_trained_sample_count < path_guiding_settings.training_sample_count;
+}
+
+void PathGuidingRenderPass::update_render_data()
+{
+	PathGuidingSettings& path_guiding_settings = render_data->render_settings.path_guiding_settings;
+
+	if (m_training_bins.get_element_count() > 0)
+	{
+		path_guiding_settings.training_bins = reinterpret_cast<AtomicType<float>*>(m_training_bins.get_device_pointer());
+		path_guiding_settings.sampling_cdfs = m_sampling_cdfs.get_device_pointer();
+	}
+	else
+	{
+		path_guiding_settings.training_bins = nullptr;
+		path_guiding_settings.sampling_cdfs = nullptr;
+	}
+}
+
+void PathGuidingRenderPass::launch()
+{
+	reset_launch_timings();
+
+	if (!render_data->render_settings.path_guiding_settings.do_training)
+		return;
+
+	// One thread per cell
+	launch_kernel_timed(PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID, PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID, make_int2(get_cell_count(), 1), make_int2(64, 1));
+
+	m_trained_sample_count += render_data->render_settings.samples_per_frame;
+}
+
+void PathGuidingRenderPass::set_scene_bounds(const BoundingBox& scene_bounding_box)
+{
+	PathGuidingSettings& path_guiding_settings = render_data->render_settings.path_guiding_settings;
+
+	// Padding the box so that the flat scenes (or a flat dimension of
+	// the scene) still have a non-zero extent on all the axes
+	float padding = hippt::max(1.0e-3f, scene_bounding_box.get_max_extent() * 1.0e-3f);
+	path_guiding_settings.grid_min = scene_bounding_box.mini - make_float3(padding, padding, padding);
+	path_guiding_settings.grid_max = scene_bounding_box.maxi + make_float3(padding, padding, padding);
+
+	reset_training();
+}
+
+void PathGuidingRenderPass::reset_training()
+{
+	m_training_reset_requested = true;
+}
+
+int PathGuidingRenderPass::get_trained_sample_count() const
+{
+	return m_trained_sample_count;
+}
+
+size_t PathGuidingRenderPass::get_grid_byte_size(int grid_resolution)
+{
+	// Training bins + sampling CDFs
+	return static_cast<size_t>(grid_resolution) * grid_resolution * grid_resolution * PATH_GUIDING_BIN_COUNT * sizeof(float) * 2;
+}
+
+int PathGuidingRenderPass::get_cell_count() const
+{
+	int resolution = render_data->render_settings.path_guiding_settings.grid_resolution;
+
+	return resolution * resolution * resolution;
+}
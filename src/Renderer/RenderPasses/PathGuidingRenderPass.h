@@ -0,0 +1,94 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef PATH_GUIDING_RENDER_PASS_H
+#define PATH_GUIDING_RENDER_PASS_H
+
+#include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "Renderer/RenderPasses/RenderPass.h"
+#include "Scene/BoundingBox.h"
+
+class GPURenderer;
+
+/**
+ * Path guiding: owns the spatial grid of directional histograms that the megakernel path tracer samples
+ * when IndirectLightSamplingStrategy is ILS_PATH_GUIDING (see Device/includes/PathGuiding.h).
+ *
+ * The paths of the first 'training_sample_count' samples splat their contributions into the grid
+ * and this pass rebuilds the sampling distributions of the cells after each of these frames
+ * so that the later training samples are already guided. The grid is in world space so it is kept
+ * when the render is reset by a camera move, reset_training() restarts the training
+ */
+class PathGuidingRenderPass : public RenderPass
+{
+public:
+	/**
+	 * These constants here are used to reference kernel objects in the 'm_kernels' map
+	 * or in the 'm_render_pass_times' map
+	 */
+	static const std::string PATH_GUIDING_BUILD_KERNEL_ID;
+
+	/**
+	 * Same as ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES
+	 */
+	static const std::unordered_map<std::string, std::string> KERNEL_FUNCTION_NAMES;
+
+	/**
+	 * Same as 'KERNEL_FUNCTION_NAMES' but for kernel files
+	 */
+	static const std::unordered_map<std::string, std::string> KERNEL_FILES;
+
+	PathGuidingRenderPass() {}
+	PathGuidingRenderPass(GPURenderer* renderer);
+
+	void compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets) override;
+
+	/**
+	 * True if IndirectLightSamplingStrategy is ILS_PATH_GUIDING and the megakernel path tracer is used
+	 */
+	bool is_enabled() override;
+
+	/**
+	 * Allocates/frees the grid depending on whether or not path guiding is used, reallocates it
+	 * if its resolution changed and decides whether or not the paths of the next frame train the grid
+	 */
+	void update() override;
+	void update_render_data() override;
+
+	/**
+	 * Rebuilds the sampling distributions of the grid if the paths of this frame trained it.
+	 * Must be launched after the last sample of the frame
+	 */
+	void launch() override;
+
+	/**
+	 * The grid covers the given bounding box of the scene. Restarts the training
+	 */
+	void set_scene_bounds(const BoundingBox& scene_bounding_box);
+	/**
+	 * Empties the grid so that it is trained again from the next frame
+	 */
+	void reset_training();
+
+	int get_trained_sample_count() const;
+	/**
+	 * VRAM used by the buffers of the grid with the given resolution
+	 */
+	static size_t get_grid_byte_size(int grid_resolution);
+
+private:
+	int get_cell_count() const;
+
+	// Histograms accumulated by the training paths and their normalized CDFs, see PathGuidingSettings
+	OrochiBuffer<float> m_training_bins { "Path guiding" };
+	OrochiBuffer<float> m_sampling_cdfs { "Path guiding" };
+
+	// Number of samples that trained the grid since the last reset of the training
+	int m_trained_sample_count = 0;
+	bool m_training_reset_requested = false;
+};
+
+#endif
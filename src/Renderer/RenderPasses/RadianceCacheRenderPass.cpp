@@ -0,0 +1,123 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/GPURenderer.h"
+#include "Renderer/RenderPasses/RadianceCacheRenderPass.h"
+#include "Threads/ThreadFunctions.h"
+#include "Threads/ThreadManager.h"
+
+const std::string RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID = "Radiance Cache Resolve";
+
+const std::unordered_map<std::string, std::string> RadianceCacheRenderPass::KERNEL_FUNCTION_NAMES =
+{
+	{ RADIANCE_CACHE_RESOLVE_KERNEL_ID, "RadianceCacheResolve" },
+};
+
+const std::unordered_map<std::string, std::string> RadianceCacheRenderPass::KERNEL_FILES =
+{
+	{ RADIANCE_CACHE_RESOLVE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/RadianceCacheResolve.h" },
+};
+
+RadianceCacheRenderPass::RadianceCacheRenderPass(GPURenderer* renderer) : RenderPass(renderer) {}
+
+void RadianceCacheRenderPass::compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets)
+{
+	std::shared_ptr<GPUKernelCompilerOptions> global_compiler_options = m_renderer->get_global_compiler_options();
+
+	m_kernels[RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID].set_kernel_file_path(RadianceCacheRenderPass::KERNEL_FILES.at(RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID));
+	m_kernels[RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID].set_kernel_function_name(RadianceCacheRenderPass::KERNEL_FUNCTION_NAMES.at(RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID));
+	m_kernels[RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID].synchronize_options_with(*global_compiler_options, options_excluded_from_synchro);
+
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
+}
+
+bool RadianceCacheRenderPass::is_enabled()
+{
+	if (render_data->render_settings.use_wavefront_path_tracing)
+		// Only the megakernel path tracer terminates into the cache
+		return false;
+
+	return render_data->render_settings.radiance_cache_settings.use_radiance_cache;
+}
+
+void RadianceCacheRenderPass::update()
+{
+	if (is_enabled())
+	{
+		if (m_keys.get_element_count() == 0)
+		{
+			m_keys.resize(RadianceCacheRenderPass::ENTRY_COUNT);
+			m_frame_accumulation.resize(RadianceCacheRenderPass::ENTRY_COUNT * 4);
+			m_entries.resize(RadianceCacheRenderPass::ENTRY_COUNT);
+			m_clear_requested = true;
+
+			m_renderer->invalidate_render_data_buffers();
+		}
+
+		if (m_clear_requested)
+		{
+			m_keys.upload_data(std::vector<unsigned int>(RadianceCacheRenderPass::ENTRY_COUNT, 0u));
+			m_frame_accumulation.upload_data(std::vector<float>(RadianceCacheRenderPass::ENTRY_COUNT * 4, 0.0f));
+			m_entries.upload_data(std::vector<RadianceCacheEntry>(RadianceCacheRenderPass::ENTRY_COUNT));
+
+			m_clear_requested = false;
+		}
+	}
+	else if (m_keys.get_element_count() > 0)
+	{
+		m_keys.free();
+		m_frame_accumulation.free();
+		m_entries.free();
+
+		m_renderer->invalidate_render_data_buffers();
+	}
+}
+
+void RadianceCacheRenderPass::update_render_data()
+{
+	RadianceCacheSettings& radiance_cache_settings = render_data->render_settings.radiance_cache_settings;
+
+	if (m_keys.get_element_count() > 0)
+	{
+		radiance_cache_settings.keys = reinterpret_cast<AtomicType<unsigned int>*>(m_keys.get_device_pointer());
+		radiance_cache_settings.frame_accumulation = reinterpret_cast<AtomicType<float>*>(m_frame_accumulation.get_device_pointer());
+		radiance_cache_settings.entries = m_entries.get_device_pointer();
+		radiance_cache_settings.entry_count = RadianceCacheRenderPass::ENTRY_COUNT;
+	}
+	else
+	{
+		radiance_cache_settings.keys = nullptr;
+		radiance_cache_settings.frame_accumulation = nullptr;
+		radiance_cache_settings.entries = nullptr;
+		radiance_cache_settings.entry_count = 0;
+	}
+}
+
+void RadianceCacheRenderPass::launch()
+{
+	reset_launch_timings();
+
+	// One thread per entry
+	launch_kernel_timed(RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID, RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID, make_int2(RadianceCacheRenderPass::ENTRY_COUNT, 1), make_int2(64, 1));
+}
+
+void RadianceCacheRenderPass::set_scene_bounds(const BoundingBox& scene_bounding_box)
+{
+	// A few hundred cells along the largest dimension of the scene
+	render_data->render_settings.radiance_cache_settings.cell_size = hippt::max(1.0e-4f, scene_bounding_box.get_max_extent() / 256.0f);
+
+	clear_cache();
+}
+
+void RadianceCacheRenderPass::clear_cache()
+{
+	m_clear_requested = true;
+}
+
+size_t RadianceCacheRenderPass::get_byte_size()
+{
+	// Keys + frame accumulation + entries
+	return static_cast<size_t>(RadianceCacheRenderPass::ENTRY_COUNT) * (sizeof(unsigned int) + sizeof(float) * 4 + sizeof(RadianceCacheEntry));
+}
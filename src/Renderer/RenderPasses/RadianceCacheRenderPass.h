@@ -0,0 +1,91 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RADIANCE_CACHE_RENDER_PASS_H
+#define RADIANCE_CACHE_RENDER_PASS_H
+
+#include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "Renderer/RenderPasses/RenderPass.h"
+#include "Scene/BoundingBox.h"
+
+class GPURenderer;
+
+/**
+ * World space radiance cache: owns the hash table that the paths of the megakernel path tracer
+ * terminate into when RadianceCacheSettings::use_radiance_cache is true (see Device/includes/RadianceCache.h).
+ *
+ * The training paths of each frame accumulate their samples in the table and this pass averages
+ * them in the entries after the last sample of the frame. The cache is in world space and follows
+ * the changes of lighting by itself so it is kept when the render is reset, clear_cache() empties it
+ */
+class RadianceCacheRenderPass : public RenderPass
+{
+public:
+	/**
+	 * These constants here are used to reference kernel objects in the 'm_kernels' map
+	 * or in the 'm_render_pass_times' map
+	 */
+	static const std::string RADIANCE_CACHE_RESOLVE_KERNEL_ID;
+
+	/**
+	 * Same as ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES
+	 */
+	static const std::unordered_map<std::string, std::string> KERNEL_FUNCTION_NAMES;
+
+	/**
+	 * Same as 'KERNEL_FUNCTION_NAMES' but for kernel files
+	 */
+	static const std::unordered_map<std::string, std::string> KERNEL_FILES;
+
+	// Number of entries of the hash table, must be a power of 2
+	static constexpr unsigned int ENTRY_COUNT = 1u << 20;
+
+	RadianceCacheRenderPass() {}
+	RadianceCacheRenderPass(GPURenderer* renderer);
+
+	void compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets) override;
+
+	/**
+	 * True if the radiance cache is used and the megakernel path tracer is used
+	 */
+	bool is_enabled() override;
+
+	/**
+	 * Allocates/frees the hash table depending on whether or not the radiance cache is used
+	 */
+	void update() override;
+	void update_render_data() override;
+
+	/**
+	 * Averages the samples of the training paths of this frame in the cache.
+	 * Must be launched after the last sample of the frame
+	 */
+	void launch() override;
+
+	/**
+	 * Sets the default size of the cells of the cache from the size of the scene. Clears the cache
+	 */
+	void set_scene_bounds(const BoundingBox& scene_bounding_box);
+	/**
+	 * Empties the cache before the next frame
+	 */
+	void clear_cache();
+
+	/**
+	 * VRAM used by the buffers of the cache
+	 */
+	static size_t get_byte_size();
+
+private:
+	// See RadianceCacheSettings
+	OrochiBuffer<unsigned int> m_keys { "Radiance cache" };
+	OrochiBuffer<float> m_frame_accumulation { "Radiance cache" };
+	OrochiBuffer<RadianceCacheEntry> m_entries { "Radiance cache" };
+
+	bool m_clear_requested = false;
+};
+
+#endif
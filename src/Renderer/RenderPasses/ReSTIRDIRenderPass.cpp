@@ -3,16 +3,27 @@
  * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
  */
 
+#include "Compiler/KernelCompileFarm.h"
 #include "Renderer/GPURenderer.h"
 #include "Renderer/RenderPasses/ReSTIRDIRenderPass.h"
 #include "Threads/ThreadFunctions.h"
 #include "Threads/ThreadManager.h"
 
+extern KernelCompileFarm g_kernel_compile_farm;
+
 const std::string ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID = "ReSTIR DI Initial Candidates";
 const std::string ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID = "ReSTIR DI Temporal Reuse";
 const std::string ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID = "ReSTIR DI Spatial Reuse";
 const std::string ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID = "ReSTIR DI Spatiotemporal Reuse";
 const std::string ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID = "ReSTIR DI Lights Presampling";
+const std::string ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID = "ReSTIR DI Visibility Rays";
+const std::string ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID = "ReSTIR DI Camera Rays Initial Candidates";
+
+const std::string ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_BUFFER_ID = "ReSTIR DI initial candidates";
+const std::string ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_PIXEL_INDICES_BUFFER_ID = "ReSTIR DI visibility ray pixel indices";
+const std::string ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_ORIGINS_BUFFER_ID = "ReSTIR DI visibility ray origins";
+const std::string ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DIRECTIONS_BUFFER_ID = "ReSTIR DI visibility ray directions";
+const std::string ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DISTANCES_BUFFER_ID = "ReSTIR DI visibility ray distances";
 
 const std::unordered_map<std::string, std::string> ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES =
 {
@@ -21,6 +32,8 @@ const std::unordered_map<std::string, std::string> ReSTIRDIRenderPass::KERNEL_FU
 	{ RESTIR_DI_SPATIAL_REUSE_KERNEL_ID, "ReSTIR_DI_SpatialReuse" },
 	{ RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID, "ReSTIR_DI_SpatiotemporalReuse" },
 	{ RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID, "ReSTIR_DI_LightsPresampling" },
+	{ RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID, "ReSTIR_DI_VisibilityRays" },
+	{ RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID, "ReSTIR_DI_CameraRaysInitialCandidates" },
 };
 
 const std::unordered_map<std::string, std::string> ReSTIRDIRenderPass::KERNEL_FILES =
@@ -30,13 +43,11 @@ const std::unordered_map<std::string, std::string> ReSTIRDIRenderPass::KERNEL_FI
 	{ RESTIR_DI_SPATIAL_REUSE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ReSTIR/DI/SpatialReuse.h" },
 	{ RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ReSTIR/DI/FusedSpatiotemporalReuse.h" },
 	{ RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ReSTIR/DI/LightsPresampling.h" },
+	{ RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ReSTIR/DI/VisibilityRays.h" },
+	{ RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ReSTIR/DI/CameraRaysInitialCandidates.h" },
 };
 
-ReSTIRDIRenderPass::ReSTIRDIRenderPass(GPURenderer* renderer) : m_renderer(renderer), render_data(&renderer->get_render_data())
-{
-	OROCHI_CHECK_ERROR(oroEventCreate(&spatial_reuse_time_start));
-	OROCHI_CHECK_ERROR(oroEventCreate(&spatial_reuse_time_stop));
-}
+ReSTIRDIRenderPass::ReSTIRDIRenderPass(GPURenderer* renderer) : RenderPass(renderer) {}
 
 void ReSTIRDIRenderPass::compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets)
 {
@@ -72,64 +83,73 @@ void ReSTIRDIRenderPass::compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ct
 	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
 	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 0);
 
+	// The visibility rays kernel only does traversal so it can afford a larger shared stack than the resampling kernels
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID].set_kernel_file_path(ReSTIRDIRenderPass::KERNEL_FILES.at(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID));
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID].set_kernel_function_name(ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID));
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID].synchronize_options_with(*global_compiler_options, options_excluded_from_synchro);
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 32);
+
+	// Same shared stack as the camera rays kernel since the camera rays are the longest traversal of the kernel
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID].set_kernel_file_path(ReSTIRDIRenderPass::KERNEL_FILES.at(ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID));
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID].set_kernel_function_name(ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID));
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID].synchronize_options_with(*global_compiler_options, options_excluded_from_synchro);
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 48);
+
 	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
 	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
 	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
 	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
 	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
 }
 
-void ReSTIRDIRenderPass::recompile(std::shared_ptr<HIPRTOrochiCtx>& hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets, bool silent, bool use_cache)
+void ReSTIRDIRenderPass::precompile_kernels(GPUKernelCompilerOptions partial_options, std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets)
 {
-	for (auto& name_to_kernel : m_kernels)
+	for (const std::string& kernel_id : { ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID,
+										  ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID,
+										  ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID,
+										  ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID,
+										  ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID,
+										  ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID,
+										  ReSTIRDIRenderPass::RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID })
 	{
-		if (silent)
-			name_to_kernel.second.compile_silent(hiprt_orochi_ctx, func_name_sets, use_cache);
+		GPUKernelCompilerOptions options = m_kernels[kernel_id].get_kernel_options();
+		partial_options.apply_onto(options);
+
+		if (g_kernel_compile_farm.is_enabled())
+			// Compiled by the worker processes of the farm at the end of GPURenderer::precompile_kernels()
+			g_kernel_compile_farm.add_job(ReSTIRDIRenderPass::KERNEL_FILES.at(kernel_id), ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(kernel_id), options);
 		else
-			name_to_kernel.second.compile(hiprt_orochi_ctx, func_name_sets, use_cache);
+			// On the calling thread, see GPURenderer::precompile_kernel()
+			ThreadFunctions::precompile_kernel(ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(kernel_id), ReSTIRDIRenderPass::KERNEL_FILES.at(kernel_id), options, hiprt_orochi_ctx, func_name_sets);
 	}
 }
 
-void ReSTIRDIRenderPass::precompile_kernels(GPUKernelCompilerOptions partial_options, std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets)
+void ReSTIRDIRenderPass::recompile(std::shared_ptr<HIPRTOrochiCtx>& hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets, bool silent, bool use_cache)
 {
-	GPUKernelCompilerOptions options;
-
-	options = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID].get_kernel_options();
-	partial_options.apply_onto(options);
-	ThreadManager::start_thread(ThreadManager::RESTIR_DI_PRECOMPILE_KERNELS, ThreadFunctions::precompile_kernel,
-		ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID),
-		ReSTIRDIRenderPass::KERNEL_FILES.at(ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID),
-		options, hiprt_orochi_ctx, std::ref(func_name_sets));
-
-	options = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID].get_kernel_options();
-	partial_options.apply_onto(options);
-	ThreadManager::start_thread(ThreadManager::RESTIR_DI_PRECOMPILE_KERNELS, ThreadFunctions::precompile_kernel,
-		ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID),
-		ReSTIRDIRenderPass::KERNEL_FILES.at(ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID),
-		options, hiprt_orochi_ctx, std::ref(func_name_sets));
-
-	options = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID].get_kernel_options();
-	partial_options.apply_onto(options);
-	ThreadManager::start_thread(ThreadManager::RESTIR_DI_PRECOMPILE_KERNELS, ThreadFunctions::precompile_kernel,
-		ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID),
-		ReSTIRDIRenderPass::KERNEL_FILES.at(ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID),
-		options, hiprt_orochi_ctx, std::ref(func_name_sets));
-
-	options = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID].get_kernel_options();
-	partial_options.apply_onto(options);
-	ThreadManager::start_thread(ThreadManager::RESTIR_DI_PRECOMPILE_KERNELS, ThreadFunctions::precompile_kernel,
-		ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID),
-		ReSTIRDIRenderPass::KERNEL_FILES.at(ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID),
-		options, hiprt_orochi_ctx, std::ref(func_name_sets));
-
-	options = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID].get_kernel_options();
-	partial_options.apply_onto(options);
-	ThreadManager::start_thread(ThreadManager::RESTIR_DI_PRECOMPILE_KERNELS, ThreadFunctions::precompile_kernel,
-		ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID),
-		ReSTIRDIRenderPass::KERNEL_FILES.at(ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID),
-		options, hiprt_orochi_ctx, std::ref(func_name_sets));
-
-	ThreadManager::detach_threads(ThreadManager::RESTIR_DI_PRECOMPILE_KERNELS);
+	if (is_enabled())
+	{
+		RenderPass::recompile(hiprt_orochi_ctx, func_name_sets, silent, use_cache);
+
+		return;
+	}
+
+	GPUKernel& presampling_kernel = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID];
+	if (use_cache && !presampling_kernel.needs_recompilation())
+		return;
+
+	if (silent)
+		presampling_kernel.compile_silent(hiprt_orochi_ctx, func_name_sets, use_cache);
+	else
+		presampling_kernel.compile(hiprt_orochi_ctx, func_name_sets, use_cache);
+}
+
+bool ReSTIRDIRenderPass::is_enabled()
+{
+	return m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) == LSS_RESTIR_DI;
 }
 
 void ReSTIRDIRenderPass::update()
@@ -139,57 +159,141 @@ void ReSTIRDIRenderPass::update()
 	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) == LSS_RESTIR_DI)
 	{
 		// ReSTIR DI enabled
-		bool initial_candidates_reservoir_needs_resize = initial_candidates_reservoirs.get_element_count() == 0;
 		bool spatial_output_1_needs_resize = spatial_output_reservoirs_1.get_element_count() == 0;
 		bool spatial_output_2_needs_resize = spatial_output_reservoirs_2.get_element_count() == 0;
 
-		if (initial_candidates_reservoir_needs_resize || spatial_output_1_needs_resize || spatial_output_2_needs_resize)
+		if (spatial_output_1_needs_resize || spatial_output_2_needs_resize)
 			// At least on buffer is going to be resized so buffers are invalidated
 			m_renderer->invalidate_render_data_buffers();
 
-		if (initial_candidates_reservoir_needs_resize)
-			initial_candidates_reservoirs.resize(render_resolution.x * render_resolution.y);
-
 		if (spatial_output_1_needs_resize)
 			spatial_output_reservoirs_1.resize(render_resolution.x * render_resolution.y);
 
 		if (spatial_output_2_needs_resize)
 			spatial_output_reservoirs_2.resize(render_resolution.x * render_resolution.y);
 
+		// The initial candidates and the visibility rays queue are transient buffers
+		// of the render graph, they are (re)declared every frame because their
+		// lifetime depends on the settings
+		declare_transient_buffers();
 
-
-		// Also allocating / deallocating the presampled lights buffer
-		if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING) == KERNEL_OPTION_TRUE)
+		if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS) == KERNEL_OPTION_TRUE)
 		{
-			ReSTIRDISettings& restir_di_settings = m_renderer->get_render_settings().restir_di_settings;
-			int presampled_light_count = restir_di_settings.light_presampling.number_of_subsets * restir_di_settings.light_presampling.subset_size;
-			bool presampled_lights_needs_allocation = presampled_lights_buffer.get_element_count() != presampled_light_count;
-
-			if (presampled_lights_needs_allocation)
+			if (visibility_ray_count.get_element_count() == 0)
 			{
-				presampled_lights_buffer.resize(presampled_light_count);
+				// The count isn't transient: it is emptied after each launch of the
+				// visibility rays kernel so it is already empty at the next frame
+				visibility_ray_count.resize(1);
+				visibility_ray_count.upload_data(std::vector<unsigned int>(1, 0));
 
-				// At least on buffer is going to be resized so buffers are invalidated
 				m_renderer->invalidate_render_data_buffers();
 			}
 		}
-		else
-			presampled_lights_buffer.free();
+		else if (visibility_ray_count.get_element_count() > 0)
+		{
+			visibility_ray_count.free();
+
+			m_renderer->invalidate_render_data_buffers();
+		}
 	}
 	else
 	{
 		// ReSTIR DI disabled, we're going to free the buffers if that's not already done
-		if (initial_candidates_reservoirs.get_element_count() > 0
-			|| spatial_output_reservoirs_1.get_element_count() > 0 ||
-			spatial_output_reservoirs_2.get_element_count() > 0)
-		{
+		if (spatial_output_reservoirs_1.get_element_count() > 0 || spatial_output_reservoirs_2.get_element_count() > 0)
 			m_renderer->invalidate_render_data_buffers();
-		}
 
-		initial_candidates_reservoirs.free();
 		spatial_output_reservoirs_1.free();
 		spatial_output_reservoirs_2.free();
+
+		visibility_ray_count.free();
+
+		remove_transient_buffers();
+	}
+
+	// Also allocating / deallocating the presampled lights buffer
+	if (is_light_presampling_needed())
+	{
+		ReSTIRDISettings& restir_di_settings = m_renderer->get_render_settings().restir_di_settings;
+		restir_di_settings.light_presampling.update_auto_size(render_data->buffers.emissive_triangles_count, render_data->world_settings.ambient_light_type == AmbientLightType::ENVMAP, render_resolution);
+
+		int presampled_light_count = restir_di_settings.light_presampling.number_of_subsets * restir_di_settings.light_presampling.subset_size;
+		bool presampled_lights_needs_allocation = presampled_lights_buffer.get_element_count() != presampled_light_count;
+
+		if (presampled_lights_needs_allocation)
+		{
+			presampled_lights_buffer.resize(presampled_light_count);
+
+			// At least on buffer is going to be resized so buffers are invalidated
+			m_renderer->invalidate_render_data_buffers();
+		}
 	}
+	else if (presampled_lights_buffer.get_element_count() > 0)
+	{
+		presampled_lights_buffer.free();
+		render_data->render_settings.restir_di_settings.light_presampling.light_samples = nullptr;
+
+		m_renderer->invalidate_render_data_buffers();
+	}
+}
+
+bool ReSTIRDIRenderPass::is_light_presampling_needed()
+{
+	int direct_light_sampling_strategy = m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY);
+	if (direct_light_sampling_strategy == LSS_RESTIR_DI && m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING) == KERNEL_OPTION_TRUE)
+		return true;
+
+	if (!m_renderer->get_render_settings().restir_di_settings.light_presampling.use_for_RIS_light_candidates)
+		return false;
+
+	bool later_bounces_use_RIS = m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_LATER_BOUNCES_SAMPLING_STRATEGY) == RESTIR_DI_LATER_BOUNCES_RIS_BSDF_AND_LIGHT;
+
+	return direct_light_sampling_strategy == LSS_RIS_BSDF_AND_LIGHT || (direct_light_sampling_strategy == LSS_RESTIR_DI && later_bounces_use_RIS);
+}
+
+void ReSTIRDIRenderPass::declare_transient_buffers()
+{
+	RenderGraph& render_graph = m_renderer->get_render_graph();
+	ReSTIRDISettings& restir_di_settings = render_data->render_settings.restir_di_settings;
+	int pixel_count = m_renderer->m_render_resolution.x * m_renderer->m_render_resolution.y;
+
+	// Without any reuse pass, the initial candidates are the output of
+	// ReSTIR DI (see configure_output_buffer()) and are read by the path tracer
+	bool initial_candidates_are_output = !restir_di_settings.do_fused_spatiotemporal && !restir_di_settings.temporal_pass.do_temporal_reuse_pass && !restir_di_settings.spatial_pass.do_spatial_reuse_pass;
+	RenderGraphStep initial_candidates_last_step = initial_candidates_are_output ? RENDER_GRAPH_STEP_PATH_TRACING : RENDER_GRAPH_STEP_RESTIR_DI;
+	// The fused camera rays kernel already writes the initial candidates and queues their visibility rays
+	RenderGraphStep initial_candidates_first_step = restir_di_settings.initial_candidates.fuse_with_camera_rays ? RENDER_GRAPH_STEP_CAMERA_RAYS : RENDER_GRAPH_STEP_RESTIR_DI;
+	render_graph.declare_transient_buffer<ReSTIRDIPackedReservoir>(ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_BUFFER_ID, pixel_count, initial_candidates_first_step, initial_candidates_last_step);
+
+	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS) == KERNEL_OPTION_TRUE)
+	{
+		render_graph.declare_transient_buffer<int>(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_PIXEL_INDICES_BUFFER_ID, pixel_count, initial_candidates_first_step, RENDER_GRAPH_STEP_RESTIR_DI);
+		render_graph.declare_transient_buffer<float3>(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_ORIGINS_BUFFER_ID, pixel_count, initial_candidates_first_step, RENDER_GRAPH_STEP_RESTIR_DI);
+		render_graph.declare_transient_buffer<float3>(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DIRECTIONS_BUFFER_ID, pixel_count, initial_candidates_first_step, RENDER_GRAPH_STEP_RESTIR_DI);
+		render_graph.declare_transient_buffer<float>(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DISTANCES_BUFFER_ID, pixel_count, initial_candidates_first_step, RENDER_GRAPH_STEP_RESTIR_DI);
+	}
+	else
+	{
+		render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_PIXEL_INDICES_BUFFER_ID);
+		render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_ORIGINS_BUFFER_ID);
+		render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DIRECTIONS_BUFFER_ID);
+		render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DISTANCES_BUFFER_ID);
+	}
+}
+
+void ReSTIRDIRenderPass::remove_transient_buffers()
+{
+	RenderGraph& render_graph = m_renderer->get_render_graph();
+
+	render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_BUFFER_ID);
+	render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_PIXEL_INDICES_BUFFER_ID);
+	render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_ORIGINS_BUFFER_ID);
+	render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DIRECTIONS_BUFFER_ID);
+	render_graph.remove_transient_buffer(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DISTANCES_BUFFER_ID);
+}
+
+ReSTIRDIPackedReservoir* ReSTIRDIRenderPass::get_initial_candidates_reservoirs()
+{
+	return m_renderer->get_render_graph().get_transient_buffer<ReSTIRDIPackedReservoir>(ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_BUFFER_ID);
 }
 
 void ReSTIRDIRenderPass::update_render_data()
@@ -197,14 +301,28 @@ void ReSTIRDIRenderPass::update_render_data()
 	// Setting the pointers for use in reset_render() in the camera rays kernel
 	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) == LSS_RESTIR_DI)
 	{
-		render_data->aux_buffers.restir_reservoir_buffer_1 = initial_candidates_reservoirs.get_device_pointer();
+		RenderGraph& render_graph = m_renderer->get_render_graph();
+
+		// The initial candidates are transient and may alias other transient buffers but
+		// none of them is live during the camera rays step so clearing it there is fine
+		// (and when the initial candidates are fused with the camera rays, they are declared
+		// live from the camera rays step, see declare_transient_buffers())
+		render_data->aux_buffers.restir_reservoir_buffer_1 = get_initial_candidates_reservoirs();
 		render_data->aux_buffers.restir_reservoir_buffer_2 = spatial_output_reservoirs_1.get_device_pointer();
 		render_data->aux_buffers.restir_reservoir_buffer_3 = spatial_output_reservoirs_2.get_device_pointer();
 
 		// If we just got ReSTIR enabled back, setting this one arbitrarily and resetting its content
-		std::vector<ReSTIRDIReservoir> empty_reservoirs(m_renderer->m_render_resolution.x * m_renderer->m_render_resolution.y, ReSTIRDIReservoir());
+		std::vector<ReSTIRDIPackedReservoir> empty_reservoirs(m_renderer->m_render_resolution.x * m_renderer->m_render_resolution.y, ReSTIRDIPackedReservoir());
 		render_data->render_settings.restir_di_settings.restir_output_reservoirs = spatial_output_reservoirs_1.get_device_pointer();
 		spatial_output_reservoirs_1.upload_data(empty_reservoirs);
+
+		// nullptr if the visibility rays aren't batched, the buffers aren't allocated then
+		VisibilityRaysSettings& visibility_rays = render_data->render_settings.restir_di_settings.visibility_rays;
+		visibility_rays.ray_count = reinterpret_cast<AtomicType<unsigned int>*>(visibility_ray_count.get_device_pointer());
+		visibility_rays.pixel_indices = render_graph.get_transient_buffer<int>(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_PIXEL_INDICES_BUFFER_ID);
+		visibility_rays.ray_origins = render_graph.get_transient_buffer<float3>(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_ORIGINS_BUFFER_ID);
+		visibility_rays.ray_directions = render_graph.get_transient_buffer<float3>(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DIRECTIONS_BUFFER_ID);
+		visibility_rays.ray_distances = render_graph.get_transient_buffer<float>(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAY_DISTANCES_BUFFER_ID);
 	}
 	else
 	{
@@ -220,9 +338,10 @@ void ReSTIRDIRenderPass::update_render_data()
 
 void ReSTIRDIRenderPass::resize(int new_width, int new_height)
 {
-	initial_candidates_reservoirs.resize(new_width * new_height);
 	spatial_output_reservoirs_2.resize(new_width * new_height);
 	spatial_output_reservoirs_1.resize(new_width * new_height);
+
+	declare_transient_buffers();
 }
 
 void ReSTIRDIRenderPass::reset()
@@ -230,17 +349,58 @@ void ReSTIRDIRenderPass::reset()
 	odd_frame = false;
 }
 
+size_t ReSTIRDIRenderPass::download_temporal_reservoirs_async(oroStream_t stream, OrochiStagingPool& staging_pool, OrochiAsyncTransfer& out_transfer)
+{
+	ReSTIRDIPackedReservoir* last_frame_output = render_data->render_settings.restir_di_settings.restir_output_reservoirs;
+	if (!is_enabled() || last_frame_output == nullptr)
+		return 0;
+
+	size_t reservoir_count = spatial_output_reservoirs_1.get_element_count();
+	out_transfer = staging_pool.download_async(last_frame_output, sizeof(ReSTIRDIPackedReservoir) * reservoir_count, stream);
+
+	return reservoir_count;
+}
+
+bool ReSTIRDIRenderPass::restore_temporal_reservoirs(const std::vector<ReSTIRDIPackedReservoir>& reservoirs, bool odd_frame)
+{
+	if (!is_enabled() || reservoirs.size() != spatial_output_reservoirs_1.get_element_count())
+		return false;
+
+	this->odd_frame = odd_frame;
+
+	// The temporal pass outputs into spatial_output_reservoirs_1 on odd frames (see configure_temporal_pass())
+	// so its input must be in the other buffer
+	OrochiBuffer<ReSTIRDIPackedReservoir>& last_frame_output = odd_frame ? spatial_output_reservoirs_2 : spatial_output_reservoirs_1;
+	last_frame_output.upload_data(reservoirs);
+	render_data->render_settings.restir_di_settings.restir_output_reservoirs = last_frame_output.get_device_pointer();
+
+	return true;
+}
+
+bool ReSTIRDIRenderPass::is_odd_frame() const
+{
+	return odd_frame;
+}
+
 void ReSTIRDIRenderPass::launch()
 {
 	ReSTIRDISettings& restir_di_settings = m_renderer->get_render_data().render_settings.restir_di_settings;
 
-	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) == LSS_RESTIR_DI)
+	// The shared memory tile of the spatial reuse is laid out for blocks of
+	// RESTIR_DI_SPATIAL_TILE_SIZE * RESTIR_DI_SPATIAL_TILE_SIZE threads
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID].set_launch_tuning_allowed(m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_REUSE_SHARED_MEMORY_TILE) == KERNEL_OPTION_FALSE);
+	// Same for the presampled lights of the initial candidates, the blocks must match the presampling tiles
+	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID].set_launch_tuning_allowed(!uses_shared_memory_presampled_lights());
+
+	if (is_enabled())
 	{
 		// If ReSTIR DI is enabled
 
-		if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING) == KERNEL_OPTION_TRUE)
-			launch_presampling_lights_pass();
+		// Alternating the half of the checkerboard that runs the passes every frame
+		restir_di_settings.checkerboard_parity = odd_frame ? 1 : 0;
 
+		// The lights have already been presampled by launch_light_presampling() and, if
+		// uses_fused_camera_rays(), the initial candidates sampled by the camera rays
 		launch_initial_candidates_pass();
 
 		if (render_data->render_settings.restir_di_settings.do_fused_spatiotemporal)
@@ -285,9 +445,17 @@ LightPresamplingParameters ReSTIRDIRenderPass::configure_light_presampling_pass(
 	 */
 	parameters.emissive_triangles_count = render_data->buffers.emissive_triangles_count;
 	parameters.emissive_triangles_indices = render_data->buffers.emissive_triangles_indices;
+	parameters.emissive_triangles_alias_table_probas = render_data->buffers.emissive_triangles_alias_table_probas;
+	parameters.emissive_triangles_alias_table_alias = render_data->buffers.emissive_triangles_alias_table_alias;
+	parameters.emissive_triangles_total_power = render_data->buffers.emissive_triangles_total_power;
 	parameters.triangles_indices = render_data->buffers.triangles_indices;
 	parameters.vertices_positions = render_data->buffers.vertices_positions;
+	parameters.quantized_vertices_positions = render_data->buffers.quantized_vertices_positions;
+	parameters.mesh_vertex_attributes = render_data->buffers.mesh_vertex_attributes;
 	parameters.material_indices = render_data->buffers.material_indices;
+	parameters.triangle_emission_texture_luminances = render_data->buffers.triangle_emission_texture_luminances;
+	parameters.instances = render_data->buffers.instances;
+	parameters.instance_count = render_data->buffers.instance_count;
 	parameters.materials = render_data->buffers.materials_buffer;
 
 	// World settings for sampling the envmap
@@ -297,8 +465,15 @@ LightPresamplingParameters ReSTIRDIRenderPass::configure_light_presampling_pass(
 	parameters.sample_number = render_data->render_settings.sample_number;
 	parameters.random_seed = m_renderer->rng().xorshift32();
 
-	// For each presampled light, the probability that this is going to be an envmap sample
-	parameters.envmap_sampling_probability = render_data->render_settings.restir_di_settings.initial_candidates.envmap_candidate_probability;
+	// For each presampled light, the probability that this is going to be an envmap sample.
+	// The RIS light candidates don't sample the envmap, only ReSTIR DI does
+	parameters.envmap_sampling_probability = is_enabled() ? render_data->render_settings.restir_di_settings.initial_candidates.envmap_candidate_probability : 0.0f;
+
+	// Same probability as the presampling kernel, for the MIS weights of the RIS BSDF candidates
+	float envmap_probability = 0.0f;
+	if (render_data->world_settings.ambient_light_type == AmbientLightType::ENVMAP)
+		envmap_probability = render_data->buffers.emissive_triangles_count == 0 ? 1.0f : parameters.envmap_sampling_probability;
+	render_data->render_settings.restir_di_settings.light_presampling.emissive_triangle_probability = 1.0f - envmap_probability;
 
 	return parameters;
 }
@@ -310,23 +485,78 @@ void ReSTIRDIRenderPass::launch_presampling_lights_pass()
 	void* launch_args[] = { &launch_parameters };
 	int thread_count = render_data->render_settings.restir_di_settings.light_presampling.number_of_subsets * render_data->render_settings.restir_di_settings.light_presampling.subset_size;
 
-	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID].launch_timed_asynchronous(32, 1, thread_count, 1, launch_args, m_renderer->get_main_stream());
+	launch_kernel_timed(ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID, ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID, make_int2(thread_count, 1), make_int2(32, 1), launch_args);
+
+	// For the RIS light candidates of the path tracer
+	render_data->render_settings.restir_di_settings.light_presampling.light_samples = presampled_lights_buffer.get_device_pointer();
+}
+
+void ReSTIRDIRenderPass::launch_light_presampling()
+{
+	if (!is_enabled() && !is_light_presampling_needed())
+		return;
+
+	// First launch of the pass for this sample
+	reset_launch_timings();
+
+	if (is_light_presampling_needed())
+		launch_presampling_lights_pass();
 }
 
 void ReSTIRDIRenderPass::configure_initial_pass()
 {
 	render_data->random_seed = m_renderer->rng().xorshift32();
 	render_data->render_settings.restir_di_settings.light_presampling.light_samples = presampled_lights_buffer.get_device_pointer();
-	render_data->render_settings.restir_di_settings.initial_candidates.output_reservoirs = initial_candidates_reservoirs.get_device_pointer();
+	render_data->render_settings.restir_di_settings.initial_candidates.output_reservoirs = get_initial_candidates_reservoirs();
+}
+
+void ReSTIRDIRenderPass::configure_fused_camera_rays_pass()
+{
+	ReSTIRDISettings& restir_di_settings = render_data->render_settings.restir_di_settings;
+
+	// Set by launch() for the separate initial candidates kernel, needed earlier here
+	restir_di_settings.checkerboard_parity = odd_frame ? 1 : 0;
+	restir_di_settings.initial_candidates.random_seed = m_renderer->rng().xorshift32();
+	restir_di_settings.light_presampling.light_samples = presampled_lights_buffer.get_device_pointer();
+	restir_di_settings.initial_candidates.output_reservoirs = get_initial_candidates_reservoirs();
+}
+
+bool ReSTIRDIRenderPass::uses_fused_camera_rays()
+{
+	// The low resolution pixels are stored at other indices than their pixel coordinates
+	return is_enabled() && render_data->render_settings.restir_di_settings.initial_candidates.fuse_with_camera_rays && !render_data->render_settings.do_render_low_resolution();
 }
 
 void ReSTIRDIRenderPass::launch_initial_candidates_pass()
 {
-	int2 render_resolution = m_renderer->m_render_resolution;
-	void* launch_args[] = { &m_renderer->get_render_data(), &m_renderer->m_render_resolution };
+	if (uses_fused_camera_rays())
+	{
+		// Already sampled by the camera rays, only the queued visibility rays are left
+		if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE) == KERNEL_OPTION_TRUE)
+			launch_visibility_rays_pass(render_data->render_settings.restir_di_settings.initial_candidates.output_reservoirs);
+
+		return;
+	}
 
 	configure_initial_pass();
-	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID].launch_timed_asynchronous(8, 8, render_resolution.x, render_resolution.y, launch_args, m_renderer->get_main_stream());
+	if (uses_shared_memory_presampled_lights())
+		// The presampled lights are loaded by the 2D blocks of the image
+		launch_kernel_timed(ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID, ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID, render_data->render_settings.get_pixel_launch_resolution(m_renderer->m_render_resolution), make_int2(RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE, RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE));
+	else
+		launch_kernel_over_active_pixels_timed(ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID, ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID, make_int2(RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE, RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE));
+
+	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE) == KERNEL_OPTION_TRUE)
+		launch_visibility_rays_pass(render_data->render_settings.restir_di_settings.initial_candidates.output_reservoirs);
+}
+
+bool ReSTIRDIRenderPass::uses_shared_memory_presampled_lights() const
+{
+	std::shared_ptr<GPUKernelCompilerOptions> global_compiler_options = m_renderer->get_global_compiler_options();
+
+	return global_compiler_options->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_SHARED_MEMORY_LIGHTS) == KERNEL_OPTION_TRUE
+		&& global_compiler_options->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING) == KERNEL_OPTION_TRUE
+		&& global_compiler_options->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_USE_LIGHT_BVH) == KERNEL_OPTION_FALSE
+		&& global_compiler_options->get_macro_value(GPUKernelCompilerOptions::EMISSIVE_TRIANGLES_SAMPLING_STRATEGY) != ETSS_LIGHT_CLUSTERS;
 }
 
 void ReSTIRDIRenderPass::configure_temporal_pass()
@@ -351,7 +581,7 @@ void ReSTIRDIRenderPass::configure_temporal_pass()
 		// We're not risking another pixel reading in someone else's
 		// pixel in the initial candidates buffer while we write into
 		// it (that would be a race condition)
-		render_data->render_settings.restir_di_settings.temporal_pass.output_reservoirs = initial_candidates_reservoirs.get_device_pointer();
+		render_data->render_settings.restir_di_settings.temporal_pass.output_reservoirs = get_initial_candidates_reservoirs();
 	else
 	{
 		// Else, no spatial reuse, the output of the temporal pass is going to be in its own buffer (because otherwise, 
@@ -366,11 +596,8 @@ void ReSTIRDIRenderPass::configure_temporal_pass()
 
 void ReSTIRDIRenderPass::launch_temporal_reuse_pass()
 {
-	int2 render_resolution = m_renderer->m_render_resolution;
-	void* launch_args[] = { &m_renderer->get_render_data(), &render_resolution };
-
 	configure_temporal_pass();
-	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID].launch_timed_asynchronous(8, 8, render_resolution.x, render_resolution.y, launch_args, m_renderer->get_main_stream());
+	launch_kernel_over_active_pixels_timed(ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID, ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID);
 }
 
 void ReSTIRDIRenderPass::configure_temporal_pass_for_fused_spatiotemporal()
@@ -391,6 +618,8 @@ void ReSTIRDIRenderPass::configure_spatial_pass(int spatial_pass_index)
 {
 	render_data->random_seed = m_renderer->rng().xorshift32();
 	render_data->render_settings.restir_di_settings.spatial_pass.spatial_pass_index = spatial_pass_index;
+	// All the inputs of the spatial passes were written this frame
+	render_data->render_settings.restir_di_settings.spatial_pass.input_checkerboard_parity = render_data->render_settings.restir_di_settings.checkerboard_parity;
 
 	if (spatial_pass_index == 0)
 	{
@@ -440,11 +669,14 @@ void ReSTIRDIRenderPass::configure_spatial_pass_for_fused_spatiotemporal(int spa
 		// 'restir_settings.temporal_pass.input_reservoirs'
 		// is the proper pointer
 		restir_settings.spatial_pass.input_reservoirs = restir_settings.temporal_pass.input_reservoirs;
+		// which was written on the other half of the checkerboard
+		restir_settings.spatial_pass.input_checkerboard_parity = restir_settings.checkerboard_parity ^ 1;
 	}
 	else
 	{
 		// If this is not the first spatial reuse pass, the input is the output of the previous pass
 		restir_settings.spatial_pass.input_reservoirs = restir_settings.spatial_pass.output_reservoirs;
+		restir_settings.spatial_pass.input_checkerboard_parity = restir_settings.checkerboard_parity;
 	}
 
 	// Outputting in whichever isn't the input
@@ -456,28 +688,21 @@ void ReSTIRDIRenderPass::configure_spatial_pass_for_fused_spatiotemporal(int spa
 
 void ReSTIRDIRenderPass::launch_spatial_reuse_passes()
 {
-	int2 render_resolution = m_renderer->m_render_resolution;
-	void* launch_args[] = { &m_renderer->get_render_data(), &render_resolution};
-
-	// Emitting an event for timing all the spatial reuse passes combined
-	OROCHI_CHECK_ERROR(oroEventRecord(spatial_reuse_time_start, m_renderer->get_main_stream()));
-
 	for (int spatial_reuse_pass = 0; spatial_reuse_pass < render_data->render_settings.restir_di_settings.spatial_pass.number_of_passes; spatial_reuse_pass++)
 	{
 		configure_spatial_pass(spatial_reuse_pass);
-		m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID].launch_timed_asynchronous(8, 8, render_resolution.x, render_resolution.y, launch_args, m_renderer->get_main_stream());
+		launch_spatial_reuse_kernel();
+		launch_visibility_rays_pass(render_data->render_settings.restir_di_settings.spatial_pass.output_reservoirs);
 	}
+}
 
-	// Emitting the stop event
-	OROCHI_CHECK_ERROR(oroEventRecord(spatial_reuse_time_stop, m_renderer->get_main_stream()));
-
-	//GPUKernel::ComputeElapsedTimeCallbackData* elapsed_time_data = new GPUKernel::ComputeElapsedTimeCallbackData;
-	//elapsed_time_data->start = spatial_reuse_time_start;
-	//elapsed_time_data->end = spatial_reuse_time_stop;
-	//elapsed_time_data->elapsed_time_out = &m_renderer->get_render_pass_times()[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID];
-
-	//// Computing the time elapsed for all spatial reuse passes
-	//OROCHI_CHECK_ERROR(oroLaunchHostFunc(m_renderer->get_main_stream(), GPUKernel::compute_elapsed_time_callback, elapsed_time_data));
+void ReSTIRDIRenderPass::launch_spatial_reuse_kernel()
+{
+	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_REUSE_SHARED_MEMORY_TILE) == KERNEL_OPTION_TRUE)
+		// The shared memory tile is loaded by the 2D blocks of the image
+		launch_kernel_timed(ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID, ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID, render_data->render_settings.get_pixel_launch_resolution(m_renderer->m_render_resolution), make_int2(RESTIR_DI_SPATIAL_TILE_SIZE, RESTIR_DI_SPATIAL_TILE_SIZE));
+	else
+		launch_kernel_over_active_pixels_timed(ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID, ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID, make_int2(RESTIR_DI_SPATIAL_TILE_SIZE, RESTIR_DI_SPATIAL_TILE_SIZE));
 }
 
 void ReSTIRDIRenderPass::configure_spatiotemporal_pass()
@@ -491,85 +716,38 @@ void ReSTIRDIRenderPass::configure_spatiotemporal_pass()
 
 void ReSTIRDIRenderPass::launch_spatiotemporal_pass()
 {
-	int2 render_resolution = m_renderer->m_render_resolution;
-	void* launch_args[] = { &m_renderer->get_render_data(), &m_renderer->m_render_resolution };
-
 	configure_spatiotemporal_pass();
-	m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID].launch_timed_asynchronous(8, 8, render_resolution.x, render_resolution.y, launch_args, m_renderer->get_main_stream());
+	launch_kernel_over_active_pixels_timed(ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID, ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID);
+	launch_visibility_rays_pass(render_data->render_settings.restir_di_settings.spatial_pass.output_reservoirs);
 
 	if (render_data->render_settings.restir_di_settings.spatial_pass.number_of_passes > 1)
 	{
 		// We have some more spatial reuse passes to do
-
-		OROCHI_CHECK_ERROR(oroEventRecord(spatial_reuse_time_start, m_renderer->get_main_stream()));
 		for (int spatial_pass_index = 1; spatial_pass_index < render_data->render_settings.restir_di_settings.spatial_pass.number_of_passes; spatial_pass_index++)
 		{
 			configure_spatial_pass_for_fused_spatiotemporal(spatial_pass_index);
-			m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID].launch_timed_asynchronous(8, 8, render_resolution.x, render_resolution.y, launch_args, m_renderer->get_main_stream());
+			launch_spatial_reuse_kernel();
+			launch_visibility_rays_pass(render_data->render_settings.restir_di_settings.spatial_pass.output_reservoirs);
 		}
-
-		// Emitting the stop event
-		OROCHI_CHECK_ERROR(oroEventRecord(spatial_reuse_time_stop, m_renderer->get_main_stream()));
-
-		//GPUKernel::ComputeElapsedTimeCallbackData* elapsed_time_data = new GPUKernel::ComputeElapsedTimeCallbackData;
-		//elapsed_time_data->start = spatial_reuse_time_start;
-		//elapsed_time_data->end = spatial_reuse_time_stop;
-		//elapsed_time_data->elapsed_time_out = &ms_time_per_pass[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID];
-
-		//// Computing the time elapsed for all spatial reuse passes
-		//OROCHI_CHECK_ERROR(oroLaunchHostFunc(m_main_stream, GPUKernel::compute_elapsed_time_callback, elapsed_time_data));
 	}
 }
 
-void ReSTIRDIRenderPass::compute_render_times(std::unordered_map<std::string, float>& times)
+void ReSTIRDIRenderPass::launch_visibility_rays_pass(ReSTIRDIPackedReservoir* reservoirs)
 {
-	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) != LSS_RESTIR_DI)
+	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS) == KERNEL_OPTION_FALSE)
 		return;
 
-	std::unordered_map<std::string, float>& ms_time_per_pass = m_renderer->get_render_pass_times();
-	ReSTIRDISettings& restir_di_settings = render_data->render_settings.restir_di_settings;
-
-	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING) == KERNEL_OPTION_TRUE)
-		ms_time_per_pass[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID] = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID].get_last_execution_time();
-
-	ms_time_per_pass[ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID] = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID].get_last_execution_time();
-	if (restir_di_settings.do_fused_spatiotemporal)
-	{
-		ms_time_per_pass[ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID] = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID].get_last_execution_time();
-		if (restir_di_settings.spatial_pass.number_of_passes > 1)
-			oroEventElapsedTime(&ms_time_per_pass[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID], spatial_reuse_time_start, spatial_reuse_time_stop);
-	}
-	else
-	{
-		ms_time_per_pass[ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID] = m_kernels[ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID].get_last_execution_time();
-		oroEventElapsedTime(&ms_time_per_pass[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID], spatial_reuse_time_start, spatial_reuse_time_stop);
-	}
-}
+	int2 render_resolution = m_renderer->m_render_resolution;
 
-void ReSTIRDIRenderPass::update_perf_metrics(std::shared_ptr<PerformanceMetricsComputer> perf_metrics)
-{
-	std::shared_ptr<GPUKernelCompilerOptions> compiler_options = m_renderer->get_global_compiler_options();
-	std::unordered_map<std::string, float> render_pass_times = m_renderer->get_render_pass_times();
+	render_data->random_seed = m_renderer->rng().xorshift32();
+	render_data->render_settings.restir_di_settings.visibility_rays.reservoirs = reservoirs;
 
-	if (compiler_options->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY) == LSS_RESTIR_DI)
-	{
-		if (compiler_options->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING) == KERNEL_OPTION_TRUE)
-			perf_metrics->add_value(ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID, render_pass_times[ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID]);
-		perf_metrics->add_value(ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID, render_pass_times[ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID]);
+	// The number of queued rays is only known on the GPU so launching one thread per pixel,
+	// the queue is compacted so the threads past the queued rays exit right away
+	launch_kernel_timed(ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID, ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID, make_int2(render_resolution.x * render_resolution.y, 1), make_int2(64, 1));
 
-		ReSTIRDISettings& restir_di_settings = m_renderer->get_render_settings().restir_di_settings;
-		if (restir_di_settings.do_fused_spatiotemporal)
-		{
-			perf_metrics->add_value(ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID, render_pass_times[ReSTIRDIRenderPass::RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID]);
-			if (restir_di_settings.spatial_pass.number_of_passes > 1)
-				perf_metrics->add_value(ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID, render_pass_times[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID]);
-		}
-		else
-		{
-			perf_metrics->add_value(ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID, render_pass_times[ReSTIRDIRenderPass::RESTIR_DI_TEMPORAL_REUSE_KERNEL_ID]);
-			perf_metrics->add_value(ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID, render_pass_times[ReSTIRDIRenderPass::RESTIR_DI_SPATIAL_REUSE_KERNEL_ID]);
-		}
-	}
+	// Emptying the queue for the next pass, after the kernel on the same stream
+	OrochiKernelGraph::memset_d32_async_current(reinterpret_cast<oroDeviceptr>(visibility_ray_count.get_device_pointer()), 0, 1, m_renderer->get_pass_stream());
 }
 
 void ReSTIRDIRenderPass::configure_output_buffer()
@@ -10,11 +10,11 @@
 #include "Device/includes/ReSTIR/DI/PresampledLight.h"
 #include "HIPRT-Orochi/OrochiBuffer.h"
 #include "HostDeviceCommon/RenderData.h"
-#include "UI/PerformanceMetricsComputer.h"
+#include "Renderer/RenderPasses/RenderPass.h"
 
 class GPURenderer;
 
-class ReSTIRDIRenderPass
+class ReSTIRDIRenderPass : public RenderPass
 {
 public:
 	/**
@@ -26,6 +26,17 @@ public:
 	static const std::string RESTIR_DI_SPATIAL_REUSE_KERNEL_ID;
 	static const std::string RESTIR_DI_SPATIOTEMPORAL_REUSE_KERNEL_ID;
 	static const std::string RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID;
+	static const std::string RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID;
+	static const std::string RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID;
+
+	/**
+	 * Names of the transient buffers of the pass in the render graph
+	 */
+	static const std::string RESTIR_DI_INITIAL_CANDIDATES_BUFFER_ID;
+	static const std::string RESTIR_DI_VISIBILITY_RAY_PIXEL_INDICES_BUFFER_ID;
+	static const std::string RESTIR_DI_VISIBILITY_RAY_ORIGINS_BUFFER_ID;
+	static const std::string RESTIR_DI_VISIBILITY_RAY_DIRECTIONS_BUFFER_ID;
+	static const std::string RESTIR_DI_VISIBILITY_RAY_DISTANCES_BUFFER_ID;
 
 	/**
 	 * This map contains constants that are the name of the main function of the kernels, their entry points.
@@ -47,13 +58,20 @@ public:
 	ReSTIRDIRenderPass() {}
 	ReSTIRDIRenderPass(GPURenderer* renderer);
 
-	void compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets);
-	void recompile(std::shared_ptr<HIPRTOrochiCtx>& hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets, bool silent = false, bool use_cache = true);
+	void compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets) override;
+	/**
+	 * Same as RenderPass::recompile() but only the lights presampling kernel (also used by the RIS light candidates)
+	 * is recompiled if the direct lighting strategy isn't LSS_RESTIR_DI. The other kernels are recompiled when
+	 * the strategy switches back to ReSTIR DI since their options changed since their last compilation
+	 */
+	void recompile(std::shared_ptr<HIPRTOrochiCtx>& hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets, bool silent = false, bool use_cache = true) override;
 	/**
 	 * Precompiles all kernels of this render pass to fill to shader cache in advance.
 	 * 
 	 * Kernels will be compiled with their *current* options but with the options contained
-	 * in 'partial_options' overriding the corresponding options of the kernels
+	 * in 'partial_options' overriding the corresponding options of the kernels.
+	 *
+	 * Blocks until the kernels are compiled (or queues them in the KernelCompileFarm if it is enabled)
 	 */
 	void precompile_kernels(GPUKernelCompilerOptions partial_options, std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets);
 
@@ -61,17 +79,30 @@ public:
 	 * Allocates/frees the ReSTIR DI buffers depending on whether or not the renderer
 	 * needs them (whether or not ReSTIR DI is being used basically) respectively.
 	 */
-	void update();
-	void update_render_data();
+	void update() override;
+	void update_render_data() override;
 
-	void resize(int new_width, int new_height);
+	bool is_enabled() override;
+	/**
+	 * Whether or not the lights are presampled this frame: for the initial candidates of ReSTIR DI
+	 * (GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING) or for the light candidates of RIS
+	 * (LightPresamplingSettings::use_for_RIS_light_candidates), even without ReSTIR DI
+	 */
+	bool is_light_presampling_needed();
 
-	void reset();
+	void resize(int new_width, int new_height) override;
 
-	void launch();
+	void reset() override;
+
+	void launch() override;
 
 	LightPresamplingParameters configure_light_presampling_pass();
 	void configure_initial_pass();
+	/**
+	 * Configures the initial candidates sampled by the camera rays kernel, see uses_fused_camera_rays().
+	 * Called by the GPURenderer before the camera rays, before launch()
+	 */
+	void configure_fused_camera_rays_pass();
 	void configure_temporal_pass();
 	void configure_temporal_pass_for_fused_spatiotemporal();
 	void configure_spatial_pass(int spatial_pass_index);
@@ -80,46 +111,100 @@ public:
 	void configure_output_buffer();
 
 	void launch_presampling_lights_pass();
+	/**
+	 * Launches the presampling of the lights if it is needed, for the initial candidates of ReSTIR DI
+	 * or for the light candidates of RIS when ReSTIR DI is disabled. See is_light_presampling_needed().
+	 *
+	 * Doesn't depend on the camera rays of the sample: called before them each sample, before launch().
+	 * The GPURenderer may launch it on its secondary stream, see GPURenderer::get_pass_stream()
+	 */
+	void launch_light_presampling();
+	/**
+	 * Launches the initial candidates pass over the active pixels or, when the blocks load their
+	 * presampled lights in shared memory (see uses_shared_memory_presampled_lights()), over the whole image.
+	 * Only traces the visibility rays queued by the camera rays if uses_fused_camera_rays()
+	 */
 	void launch_initial_candidates_pass();
+	/**
+	 * Whether the camera rays of this sample are traced by the RESTIR_DI_CAMERA_RAYS_INITIAL_CANDIDATES_KERNEL_ID
+	 * kernel, which also samples the initial candidates, instead of the CameraRays kernel of the GPURenderer.
+	 * See 'fuse_with_camera_rays' in InitialCandidatesSettings
+	 */
+	bool uses_fused_camera_rays();
+	/**
+	 * Whether the initial candidates kernel, as currently compiled, loads the presampled lights of its
+	 * blocks in shared memory: ReSTIR_DI_InitialCandidatesSharedMemoryLights and the initial candidates
+	 * drawn from the presampled lights (the same conditions as sample_light_candidates())
+	 */
+	bool uses_shared_memory_presampled_lights() const;
 	void launch_temporal_reuse_pass();
 	void launch_spatial_reuse_passes();
+	/**
+	 * Launches one spatial reuse pass over the active pixels or, with the shared memory
+	 * tile (ReSTIR_DI_SpatialReuseSharedMemoryTile), over the whole image
+	 */
+	void launch_spatial_reuse_kernel();
 	void launch_spatiotemporal_pass();
+	/**
+	 * Traces the visibility reuse rays queued by the pass that just output
+	 * into 'reservoirs' if ReSTIR_DI_BatchedVisibilityRays is true, does nothing otherwise
+	 */
+	void launch_visibility_rays_pass(ReSTIRDIPackedReservoir* reservoirs);
 
-	void compute_render_times(std::unordered_map<std::string, float>& times);
-	void update_perf_metrics(std::shared_ptr<PerformanceMetricsComputer> perf_metrics);
-
-	std::map<std::string, GPUKernel> m_kernels;
+	/**
+	 * Queues on 'stream' the download of the reservoirs output by the last frame, the input of the temporal
+	 * reuse of the next frame, for a RenderCheckpoint. Returns the number of reservoirs downloaded, 0 if
+	 * ReSTIR DI is disabled
+	 */
+	size_t download_temporal_reservoirs_async(oroStream_t stream, OrochiStagingPool& staging_pool, OrochiAsyncTransfer& out_transfer);
+	/**
+	 * Makes 'reservoirs' the output of the last frame and restores 'odd_frame' from a RenderCheckpoint so
+	 * that the temporal reuse of the next frame continues from them.
+	 * 
+	 * Must be called after update_render_data(), which resets the output of the last frame.
+	 * Returns false if ReSTIR DI is disabled or if the reservoirs don't match the resolution
+	 */
+	bool restore_temporal_reservoirs(const std::vector<ReSTIRDIPackedReservoir>& reservoirs, bool odd_frame);
+	bool is_odd_frame() const;
 
 private:
-	// ReSTIR reservoirs for the initial candidates
-	OrochiBuffer<ReSTIRDIReservoir> initial_candidates_reservoirs;
+	/**
+	 * Declares the transient buffers of the pass (initial candidates and the queue of the
+	 * visibility rays) in the render graph with the current resolution and settings
+	 */
+	void declare_transient_buffers();
+	void remove_transient_buffers();
+
+	/**
+	 * ReSTIR reservoirs for the initial candidates. Transient buffer of the render graph,
+	 * nullptr before the render graph is compiled
+	 */
+	ReSTIRDIPackedReservoir* get_initial_candidates_reservoirs();
+
 	// ReSTIR reservoirs for the output of the spatial reuse pass
-	OrochiBuffer<ReSTIRDIReservoir> spatial_output_reservoirs_1;
+	OrochiBuffer<ReSTIRDIPackedReservoir> spatial_output_reservoirs_1 { "ReSTIR DI reservoirs" };
 	// ReSTIR DI final reservoirs of the frame. 
 	// This the output of the spatial reuse passes.
 	// Those are the reservoirs that are carried over between frames for
 	// the temporal reuse pass to feed upon
-	OrochiBuffer<ReSTIRDIReservoir> spatial_output_reservoirs_2;
+	OrochiBuffer<ReSTIRDIPackedReservoir> spatial_output_reservoirs_2 { "ReSTIR DI reservoirs" };
 
 	// Buffer that holds the presampled lights if light presampling is enabled 
 	// (GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING)
 	//
 	// Implementation from the paper
 	// [Rearchitecting Spatiotemporal Resampling for Production] https://research.nvidia.com/publication/2021-07_rearchitecting-spatiotemporal-resampling-production
-	OrochiBuffer<ReSTIRDIPresampledLight> presampled_lights_buffer;
+	OrochiBuffer<ReSTIRDIPresampledLight> presampled_lights_buffer { "ReSTIR DI presampled lights" };
+
+	// Number of rays in the queue of the visibility reuse rays, only allocated if
+	// GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS is true.
+	// The queue itself is made of transient buffers
+	OrochiBuffer<unsigned int> visibility_ray_count { "ReSTIR DI visibility rays" };
 
 	// Whether or not we're currently rendering an odd frame.
 	// This is used to adjust which buffers are used as input/outputs
 	// and ping-pong between them
 	bool odd_frame = false;
-
-	// Events for timing the cumulated render time of all the spatial reuses passes
-	oroEvent_t spatial_reuse_time_start = nullptr;
-	oroEvent_t spatial_reuse_time_stop = nullptr;
-
-	GPURenderer* m_renderer = nullptr;
-	// Quick access to the renderer's render_data
-	HIPRTRenderData* render_data = nullptr;
 };
 
 #endif
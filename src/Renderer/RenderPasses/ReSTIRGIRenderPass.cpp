@@ -0,0 +1,256 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/GPURenderer.h"
+#include "Renderer/RenderPasses/ReSTIRGIRenderPass.h"
+#include "Threads/ThreadFunctions.h"
+#include "Threads/ThreadManager.h"
+
+const std::string ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID = "ReSTIR GI Temporal Reuse";
+const std::string ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID = "ReSTIR GI Spatial Reuse";
+const std::string ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID = "ReSTIR GI Shading";
+
+const std::string ReSTIRGIRenderPass::RESTIR_GI_INITIAL_CANDIDATES_BUFFER_ID = "ReSTIR GI initial candidates";
+
+const std::unordered_map<std::string, std::string> ReSTIRGIRenderPass::KERNEL_FUNCTION_NAMES =
+{
+	{ RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID, "ReSTIR_GI_TemporalReuse" },
+	{ RESTIR_GI_SPATIAL_REUSE_KERNEL_ID, "ReSTIR_GI_SpatialReuse" },
+	{ RESTIR_GI_SHADING_KERNEL_ID, "ReSTIR_GI_Shading" },
+};
+
+const std::unordered_map<std::string, std::string> ReSTIRGIRenderPass::KERNEL_FILES =
+{
+	{ RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ReSTIR/GI/TemporalReuse.h" },
+	{ RESTIR_GI_SPATIAL_REUSE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ReSTIR/GI/SpatialReuse.h" },
+	{ RESTIR_GI_SHADING_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/ReSTIR/GI/Shading.h" },
+};
+
+ReSTIRGIRenderPass::ReSTIRGIRenderPass(GPURenderer* renderer) : RenderPass(renderer) {}
+
+void ReSTIRGIRenderPass::compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets)
+{
+	std::shared_ptr<GPUKernelCompilerOptions> global_compiler_options = m_renderer->get_global_compiler_options();
+
+	// The reuse passes don't trace any ray
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID].set_kernel_file_path(ReSTIRGIRenderPass::KERNEL_FILES.at(ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID));
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID].set_kernel_function_name(ReSTIRGIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID));
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID].synchronize_options_with(*global_compiler_options, options_excluded_from_synchro);
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 0);
+
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID].set_kernel_file_path(ReSTIRGIRenderPass::KERNEL_FILES.at(ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID));
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID].set_kernel_function_name(ReSTIRGIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID));
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID].synchronize_options_with(*global_compiler_options, options_excluded_from_synchro);
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 0);
+
+	// The shading pass traces the final visibility ray only
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID].set_kernel_file_path(ReSTIRGIRenderPass::KERNEL_FILES.at(ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID));
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID].set_kernel_function_name(ReSTIRGIRenderPass::KERNEL_FUNCTION_NAMES.at(ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID));
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID].synchronize_options_with(*global_compiler_options, options_excluded_from_synchro);
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, KERNEL_OPTION_TRUE);
+	m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, 32);
+
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
+	ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(m_kernels[ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID]), hiprt_orochi_ctx, std::ref(func_name_sets));
+}
+
+bool ReSTIRGIRenderPass::is_enabled()
+{
+	if (render_data->render_settings.use_wavefront_path_tracing)
+		// Only the megakernel path tracer outputs the initial candidates of ReSTIR GI
+		return false;
+
+	return m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_RESTIR_GI;
+}
+
+void ReSTIRGIRenderPass::update()
+{
+	int2 render_resolution = m_renderer->m_render_resolution;
+
+	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_RESTIR_GI)
+	{
+		// ReSTIR GI enabled. Also checking the size because the buffers are not resized
+		// with the viewport while the pass is disabled by the wavefront path tracer
+		if (output_reservoirs_1.get_element_count() != static_cast<size_t>(render_resolution.x * render_resolution.y))
+		{
+			output_reservoirs_1.resize(render_resolution.x * render_resolution.y);
+			output_reservoirs_2.resize(render_resolution.x * render_resolution.y);
+
+			m_renderer->invalidate_render_data_buffers();
+		}
+
+		// Written by the path tracer and consumed during the ReSTIR GI step.
+		// Does nothing if already declared
+		m_renderer->get_render_graph().declare_transient_buffer<ReSTIRGIReservoir>(ReSTIRGIRenderPass::RESTIR_GI_INITIAL_CANDIDATES_BUFFER_ID, render_resolution.x * render_resolution.y, RENDER_GRAPH_STEP_PATH_TRACING, RENDER_GRAPH_STEP_RESTIR_GI);
+	}
+	else if (output_reservoirs_1.get_element_count() > 0)
+	{
+		// ReSTIR GI disabled, freeing the buffers
+		output_reservoirs_1.free();
+		output_reservoirs_2.free();
+		m_renderer->get_render_graph().remove_transient_buffer(ReSTIRGIRenderPass::RESTIR_GI_INITIAL_CANDIDATES_BUFFER_ID);
+
+		m_renderer->invalidate_render_data_buffers();
+	}
+}
+
+void ReSTIRGIRenderPass::update_render_data()
+{
+	ReSTIRGISettings& restir_gi_settings = render_data->render_settings.restir_gi_settings;
+
+	if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_RESTIR_GI)
+	{
+		// Setting the pointers for use in reset_render() in the camera rays kernel
+		render_data->aux_buffers.restir_gi_reservoir_buffer_1 = get_initial_candidates_reservoirs();
+		render_data->aux_buffers.restir_gi_reservoir_buffer_2 = output_reservoirs_1.get_device_pointer();
+		render_data->aux_buffers.restir_gi_reservoir_buffer_3 = output_reservoirs_2.get_device_pointer();
+
+		// The path tracer always outputs there
+		restir_gi_settings.initial_candidates.output_reservoirs = get_initial_candidates_reservoirs();
+
+		// If we just got ReSTIR GI enabled back, setting this one arbitrarily and resetting its content
+		std::vector<ReSTIRGIReservoir> empty_reservoirs(m_renderer->m_render_resolution.x * m_renderer->m_render_resolution.y, ReSTIRGIReservoir());
+		restir_gi_settings.restir_output_reservoirs = output_reservoirs_1.get_device_pointer();
+		output_reservoirs_1.upload_data(empty_reservoirs);
+	}
+	else
+	{
+		// nullptr so that the camera rays kernel doesn't try to reset the freed buffers
+		render_data->aux_buffers.restir_gi_reservoir_buffer_1 = nullptr;
+		render_data->aux_buffers.restir_gi_reservoir_buffer_2 = nullptr;
+		render_data->aux_buffers.restir_gi_reservoir_buffer_3 = nullptr;
+
+		restir_gi_settings.initial_candidates.output_reservoirs = nullptr;
+		restir_gi_settings.restir_output_reservoirs = nullptr;
+	}
+}
+
+void ReSTIRGIRenderPass::resize(int new_width, int new_height)
+{
+	output_reservoirs_1.resize(new_width * new_height);
+	output_reservoirs_2.resize(new_width * new_height);
+
+	m_renderer->get_render_graph().declare_transient_buffer<ReSTIRGIReservoir>(ReSTIRGIRenderPass::RESTIR_GI_INITIAL_CANDIDATES_BUFFER_ID, new_width * new_height, RENDER_GRAPH_STEP_PATH_TRACING, RENDER_GRAPH_STEP_RESTIR_GI);
+}
+
+size_t ReSTIRGIRenderPass::download_temporal_reservoirs_async(oroStream_t stream, OrochiStagingPool& staging_pool, OrochiAsyncTransfer& out_transfer)
+{
+	ReSTIRGISettings& restir_gi_settings = render_data->render_settings.restir_gi_settings;
+	ReSTIRGIReservoir* last_frame_output = restir_gi_settings.restir_output_reservoirs;
+	if (!is_enabled() || last_frame_output == nullptr || last_frame_output == restir_gi_settings.initial_candidates.output_reservoirs)
+		// The initial candidates are overwritten by the next frame anyway
+		return 0;
+
+	size_t reservoir_count = output_reservoirs_1.get_element_count();
+	out_transfer = staging_pool.download_async(last_frame_output, sizeof(ReSTIRGIReservoir) * reservoir_count, stream);
+
+	return reservoir_count;
+}
+
+bool ReSTIRGIRenderPass::restore_temporal_reservoirs(const std::vector<ReSTIRGIReservoir>& reservoirs)
+{
+	if (!is_enabled() || reservoirs.size() != output_reservoirs_1.get_element_count())
+		return false;
+
+	// The temporal pass then outputs into output_reservoirs_2, see configure_temporal_pass()
+	output_reservoirs_1.upload_data(reservoirs);
+	render_data->render_settings.restir_gi_settings.restir_output_reservoirs = output_reservoirs_1.get_device_pointer();
+
+	return true;
+}
+
+ReSTIRGIReservoir* ReSTIRGIRenderPass::get_initial_candidates_reservoirs()
+{
+	return m_renderer->get_render_graph().get_transient_buffer<ReSTIRGIReservoir>(ReSTIRGIRenderPass::RESTIR_GI_INITIAL_CANDIDATES_BUFFER_ID);
+}
+
+void ReSTIRGIRenderPass::launch()
+{
+	reset_launch_timings();
+
+	ReSTIRGISettings& restir_gi_settings = render_data->render_settings.restir_gi_settings;
+
+	if (restir_gi_settings.temporal_pass.do_temporal_reuse_pass)
+		launch_temporal_reuse_pass();
+
+	if (restir_gi_settings.spatial_pass.do_spatial_reuse_pass)
+		launch_spatial_reuse_pass();
+
+	configure_output_buffer();
+	launch_shading_pass();
+}
+
+void ReSTIRGIRenderPass::configure_temporal_pass()
+{
+	ReSTIRGISettings& restir_gi_settings = render_data->render_settings.restir_gi_settings;
+	ReSTIRGIReservoir* last_frame_output = restir_gi_settings.restir_output_reservoirs;
+
+	render_data->random_seed = m_renderer->rng().xorshift32();
+
+	if (last_frame_output == restir_gi_settings.initial_candidates.output_reservoirs)
+		// Last frame's output was its initial candidates, they have been overwritten by the path tracer
+		restir_gi_settings.temporal_pass.input_reservoirs = nullptr;
+	else
+		restir_gi_settings.temporal_pass.input_reservoirs = last_frame_output;
+
+	// Never outputting into the input of the temporal pass, other pixels may still read it
+	if (last_frame_output == output_reservoirs_1.get_device_pointer())
+		restir_gi_settings.temporal_pass.output_reservoirs = output_reservoirs_2.get_device_pointer();
+	else
+		restir_gi_settings.temporal_pass.output_reservoirs = output_reservoirs_1.get_device_pointer();
+}
+
+void ReSTIRGIRenderPass::configure_spatial_pass()
+{
+	ReSTIRGISettings& restir_gi_settings = render_data->render_settings.restir_gi_settings;
+
+	render_data->random_seed = m_renderer->rng().xorshift32();
+
+	if (restir_gi_settings.temporal_pass.do_temporal_reuse_pass)
+		restir_gi_settings.spatial_pass.input_reservoirs = restir_gi_settings.temporal_pass.output_reservoirs;
+	else
+		restir_gi_settings.spatial_pass.input_reservoirs = restir_gi_settings.initial_candidates.output_reservoirs;
+
+	// Outputting in whichever of the two output buffers isn't the input. This is last frame's
+	// output if there was a temporal pass, which has been consumed by then
+	if (restir_gi_settings.spatial_pass.input_reservoirs == output_reservoirs_1.get_device_pointer())
+		restir_gi_settings.spatial_pass.output_reservoirs = output_reservoirs_2.get_device_pointer();
+	else
+		restir_gi_settings.spatial_pass.output_reservoirs = output_reservoirs_1.get_device_pointer();
+}
+
+void ReSTIRGIRenderPass::configure_output_buffer()
+{
+	ReSTIRGISettings& restir_gi_settings = render_data->render_settings.restir_gi_settings;
+
+	// Shaded by the shading pass and used as the input to the temporal pass of next frame
+	if (restir_gi_settings.spatial_pass.do_spatial_reuse_pass)
+		restir_gi_settings.restir_output_reservoirs = restir_gi_settings.spatial_pass.output_reservoirs;
+	else if (restir_gi_settings.temporal_pass.do_temporal_reuse_pass)
+		restir_gi_settings.restir_output_reservoirs = restir_gi_settings.temporal_pass.output_reservoirs;
+	else
+		restir_gi_settings.restir_output_reservoirs = restir_gi_settings.initial_candidates.output_reservoirs;
+}
+
+void ReSTIRGIRenderPass::launch_temporal_reuse_pass()
+{
+	configure_temporal_pass();
+	launch_kernel_over_active_pixels_timed(ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID, ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID);
+}
+
+void ReSTIRGIRenderPass::launch_spatial_reuse_pass()
+{
+	configure_spatial_pass();
+	launch_kernel_over_active_pixels_timed(ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID, ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID);
+}
+
+void ReSTIRGIRenderPass::launch_shading_pass()
+{
+	render_data->random_seed = m_renderer->rng().xorshift32();
+	launch_kernel_over_active_pixels_timed(ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID, ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RESTIR_GI_RENDER_PASS_H
+#define RESTIR_GI_RENDER_PASS_H
+
+#include "Device/includes/ReSTIR/GI/Reservoir.h"
+#include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "Renderer/RenderPasses/RenderPass.h"
+
+class GPURenderer;
+
+/**
+ * ReSTIR GI: resamples the second vertex of the paths traced by the megakernel
+ * path tracer temporally and spatially and then shades the visible points with
+ * the resampled vertices.
+ *
+ * The initial candidates are output by the path tracer itself when
+ * IndirectLightSamplingStrategy is ILS_RESTIR_GI so this pass is launched after the path tracer
+ */
+class ReSTIRGIRenderPass : public RenderPass
+{
+public:
+	/**
+	 * These constants here are used to reference kernel objects in the 'm_kernels' map
+	 * or in the 'm_render_pass_times' map
+	 */
+	static const std::string RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID;
+	static const std::string RESTIR_GI_SPATIAL_REUSE_KERNEL_ID;
+	static const std::string RESTIR_GI_SHADING_KERNEL_ID;
+
+	// Name of the initial candidates transient buffer in the render graph
+	static const std::string RESTIR_GI_INITIAL_CANDIDATES_BUFFER_ID;
+
+	/**
+	 * Same as ReSTIRDIRenderPass::KERNEL_FUNCTION_NAMES
+	 */
+	static const std::unordered_map<std::string, std::string> KERNEL_FUNCTION_NAMES;
+
+	/**
+	 * Same as 'KERNEL_FUNCTION_NAMES' but for kernel files
+	 */
+	static const std::unordered_map<std::string, std::string> KERNEL_FILES;
+
+	ReSTIRGIRenderPass() {}
+	ReSTIRGIRenderPass(GPURenderer* renderer);
+
+	void compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets) override;
+
+	/**
+	 * True if IndirectLightSamplingStrategy is ILS_RESTIR_GI and the megakernel
+	 * path tracer (which outputs the initial candidates) is used
+	 */
+	bool is_enabled() override;
+
+	/**
+	 * Allocates/frees the ReSTIR GI buffers depending on whether or not the renderer
+	 * needs them (whether or not ReSTIR GI is being used basically) respectively.
+	 */
+	void update() override;
+	void update_render_data() override;
+
+	void resize(int new_width, int new_height) override;
+
+	void launch() override;
+
+	void configure_temporal_pass();
+	void configure_spatial_pass();
+	void configure_output_buffer();
+
+	void launch_temporal_reuse_pass();
+	void launch_spatial_reuse_pass();
+	void launch_shading_pass();
+
+	/**
+	 * Queues on 'stream' the download of the reservoirs output by the last frame, the input of the temporal
+	 * reuse of the next frame, for a RenderCheckpoint. Returns the number of reservoirs downloaded, 0 if
+	 * ReSTIR GI is disabled or if the last frame only output its initial candidates
+	 */
+	size_t download_temporal_reservoirs_async(oroStream_t stream, OrochiStagingPool& staging_pool, OrochiAsyncTransfer& out_transfer);
+	/**
+	 * Makes 'reservoirs' the output of the last frame so that the temporal reuse of the next frame
+	 * continues from them, see RenderCheckpoint.
+	 *
+	 * Must be called after update_render_data(), which resets the output of the last frame.
+	 * Returns false if ReSTIR GI is disabled or if the reservoirs don't match the resolution
+	 */
+	bool restore_temporal_reservoirs(const std::vector<ReSTIRGIReservoir>& reservoirs);
+
+private:
+	/**
+	 * Reservoirs filled by the path tracer. Transient buffer of the
+	 * render graph, nullptr before the render graph is compiled
+	 */
+	ReSTIRGIReservoir* get_initial_candidates_reservoirs();
+
+	// Outputs of the temporal and spatial passes. The temporal pass always outputs in the buffer
+	// that doesn't hold last frame's output (its input) and the spatial pass outputs in the other one
+	OrochiBuffer<ReSTIRGIReservoir> output_reservoirs_1 { "ReSTIR GI reservoirs" };
+	OrochiBuffer<ReSTIRGIReservoir> output_reservoirs_2 { "ReSTIR GI reservoirs" };
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/RenderPasses/RenderGraph.h"
+
+#include <algorithm>
+#include <vector>
+
+void RenderGraph::declare_transient_buffer(const std::string& name, size_t byte_size, RenderGraphStep first_step, RenderGraphStep last_step)
+{
+	auto find = m_transient_buffers.find(name);
+	if (find != m_transient_buffers.end())
+	{
+		TransientBuffer& buffer = find->second;
+		if (buffer.byte_size == byte_size && buffer.first_step == first_step && buffer.last_step == last_step)
+			// Nothing changed
+			return;
+	}
+
+	TransientBuffer& buffer = m_transient_buffers[name];
+	buffer.byte_size = byte_size;
+	buffer.first_step = first_step;
+	buffer.last_step = last_step;
+
+	m_dirty = true;
+}
+
+void RenderGraph::remove_transient_buffer(const std::string& name)
+{
+	if (m_transient_buffers.erase(name) > 0)
+		m_dirty = true;
+}
+
+bool RenderGraph::has_transient_buffer(const std::string& name)
+{
+	return m_transient_buffers.find(name) != m_transient_buffers.end();
+}
+
+bool RenderGraph::compile()
+{
+	if (!m_dirty)
+		return false;
+
+	m_dirty = false;
+
+	if (m_transient_buffers.empty())
+	{
+		m_memory.free();
+		m_allocation_byte_size = 0;
+
+		return true;
+	}
+
+	// Placing the biggest buffers first, the small ones then fill the gaps
+	std::vector<TransientBuffer*> sorted_buffers;
+	for (auto& name_to_buffer : m_transient_buffers)
+		sorted_buffers.push_back(&name_to_buffer.second);
+	std::stable_sort(sorted_buffers.begin(), sorted_buffers.end(), [](const TransientBuffer* a, const TransientBuffer* b) { return a->byte_size > b->byte_size; });
+
+	std::vector<TransientBuffer*> placed_buffers;
+	size_t allocation_byte_size = 0;
+	for (TransientBuffer* buffer : sorted_buffers)
+	{
+		// The already placed buffers that are live at the same time as this one, by offset
+		std::vector<TransientBuffer*> overlapping_buffers;
+		for (TransientBuffer* placed_buffer : placed_buffers)
+			if (placed_buffer->first_step <= buffer->last_step && buffer->first_step <= placed_buffer->last_step)
+				overlapping_buffers.push_back(placed_buffer);
+		std::sort(overlapping_buffers.begin(), overlapping_buffers.end(), [](const TransientBuffer* a, const TransientBuffer* b) { return a->offset < b->offset; });
+
+		// Lowest offset that doesn't intersect any of the overlapping buffers
+		size_t offset = 0;
+		for (TransientBuffer* overlapping_buffer : overlapping_buffers)
+		{
+			if (offset + buffer->byte_size <= overlapping_buffer->offset)
+				// Fits in the gap before that buffer
+				break;
+
+			offset = std::max(offset, align_byte_size(overlapping_buffer->offset + overlapping_buffer->byte_size));
+		}
+
+		buffer->offset = offset;
+		placed_buffers.push_back(buffer);
+
+		allocation_byte_size = std::max(allocation_byte_size, align_byte_size(offset + buffer->byte_size));
+	}
+
+	// The allocation is never shrunk, same as OrochiBuffer::resize()
+	if (allocation_byte_size > m_allocation_byte_size)
+	{
+		m_memory.resize(static_cast<int>(allocation_byte_size / RenderGraph::TRANSIENT_BUFFER_ALIGNMENT), RenderGraph::TRANSIENT_BUFFER_ALIGNMENT);
+		m_allocation_byte_size = allocation_byte_size;
+	}
+
+	return true;
+}
+
+size_t RenderGraph::get_allocation_byte_size()
+{
+	return m_allocation_byte_size;
+}
+
+size_t RenderGraph::get_unaliased_byte_size()
+{
+	size_t byte_size = 0;
+	for (auto& name_to_buffer : m_transient_buffers)
+		byte_size += align_byte_size(name_to_buffer.second.byte_size);
+
+	return byte_size;
+}
+
+size_t RenderGraph::get_aliasing_saved_byte_size()
+{
+	size_t unaliased_byte_size = get_unaliased_byte_size();
+
+	// The allocation may be bigger than needed because it is never shrunk
+	return unaliased_byte_size - std::min(unaliased_byte_size, m_allocation_byte_size);
+}
+
+size_t RenderGraph::align_byte_size(size_t byte_size)
+{
+	return (byte_size + RenderGraph::TRANSIENT_BUFFER_ALIGNMENT - 1) / RenderGraph::TRANSIENT_BUFFER_ALIGNMENT * RenderGraph::TRANSIENT_BUFFER_ALIGNMENT;
+}
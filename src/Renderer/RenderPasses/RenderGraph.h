@@ -0,0 +1,134 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include "HIPRT-Orochi/OrochiBuffer.h"
+
+#include <map>
+#include <string>
+
+/**
+ * The steps of a frame of the GPURenderer, in the order in which they are launched
+ * (see GPURenderer::render()). The lifetimes of the transient buffers are expressed in these steps
+ */
+enum RenderGraphStep
+{
+	RENDER_GRAPH_STEP_CAMERA_RAYS = 0,
+	RENDER_GRAPH_STEP_RESTIR_DI,
+	// Megakernel or wavefront path tracing
+	RENDER_GRAPH_STEP_PATH_TRACING,
+	RENDER_GRAPH_STEP_RESTIR_GI,
+};
+
+/**
+ * Keeps track of the transient buffers of the render passes: the buffers whose content
+ * doesn't need to survive the frame (the initial candidates of ReSTIR, the queues of
+ * the wavefront path tracer, ...) and the steps of the frame during which they are live.
+ *
+ * All the transient buffers are placed in a single allocation and the buffers whose
+ * lifetimes don't overlap share the same memory. For example, the ReSTIR DI initial candidates
+ * (only live during the ReSTIR DI step) alias the queues of the wavefront path tracer or
+ * the ReSTIR GI initial candidates (live from the path tracing step).
+ *
+ * The buffers that hold data across frames (the reservoirs reused temporally, the G-buffer of the
+ * previous frame, the denoiser AOVs, the adaptive sampling buffers, ...) cannot be aliased and
+ * remain regular OrochiBuffers.
+ *
+ * The render passes declare their transient buffers in their update() / resize() and the GPURenderer
+ * compiles the graph afterwards. The device pointers of the transient buffers are only valid
+ * after compile() and until the next compile() that returns true
+ */
+class RenderGraph
+{
+public:
+	// Alignment in bytes of the transient buffers in the allocation
+	static constexpr size_t TRANSIENT_BUFFER_ALIGNMENT = 256;
+
+	/**
+	 * Declares the transient buffer 'name' of 'byte_size' bytes that is live from the beginning
+	 * of 'first_step' to the end of 'last_step' (inclusive).
+	 *
+	 * Declaring an already declared buffer updates its declaration. The graph needs
+	 * to be compiled again only if the size or the lifetime of the buffer changed
+	 */
+	void declare_transient_buffer(const std::string& name, size_t byte_size, RenderGraphStep first_step, RenderGraphStep last_step);
+	template <typename T>
+	void declare_transient_buffer(const std::string& name, int element_count, RenderGraphStep first_step, RenderGraphStep last_step);
+	/**
+	 * Does nothing if the buffer isn't declared
+	 */
+	void remove_transient_buffer(const std::string& name);
+	bool has_transient_buffer(const std::string& name);
+
+	/**
+	 * Places the transient buffers in the allocation and (re)allocates it if needed.
+	 *
+	 * Returns true if the placement changed (the buffers have been moved so the device pointers
+	 * of the transient buffers must be fetched again), false if the graph was already compiled
+	 */
+	bool compile();
+
+	/**
+	 * Device pointer of the transient buffer 'name', nullptr if that buffer isn't declared
+	 */
+	template <typename T>
+	T* get_transient_buffer(const std::string& name);
+
+	/**
+	 * Size in bytes of the allocation of the transient buffers
+	 */
+	size_t get_allocation_byte_size();
+	/**
+	 * Size in bytes that the transient buffers would take if they were all allocated separately
+	 */
+	size_t get_unaliased_byte_size();
+	/**
+	 * How many bytes the aliasing of the transient buffers saves compared to get_unaliased_byte_size()
+	 */
+	size_t get_aliasing_saved_byte_size();
+
+private:
+	struct TransientBuffer
+	{
+		size_t byte_size = 0;
+		RenderGraphStep first_step = RENDER_GRAPH_STEP_CAMERA_RAYS;
+		RenderGraphStep last_step = RENDER_GRAPH_STEP_CAMERA_RAYS;
+
+		// Offset in bytes in 'm_memory', set by compile()
+		size_t offset = 0;
+	};
+
+	static size_t align_byte_size(size_t byte_size);
+
+	std::map<std::string, TransientBuffer> m_transient_buffers;
+
+	// Only used as raw memory, resized in units of TRANSIENT_BUFFER_ALIGNMENT bytes
+	// so that the element count doesn't overflow at high resolutions
+	OrochiBuffer<unsigned char> m_memory { "Transient buffers" };
+	size_t m_allocation_byte_size = 0;
+
+	// Whether or not the declarations changed since the last compile()
+	bool m_dirty = false;
+};
+
+template <typename T>
+void RenderGraph::declare_transient_buffer(const std::string& name, int element_count, RenderGraphStep first_step, RenderGraphStep last_step)
+{
+	declare_transient_buffer(name, sizeof(T) * static_cast<size_t>(element_count), first_step, last_step);
+}
+
+template <typename T>
+T* RenderGraph::get_transient_buffer(const std::string& name)
+{
+	auto find = m_transient_buffers.find(name);
+	if (find == m_transient_buffers.end() || m_memory.get_device_pointer() == nullptr)
+		return nullptr;
+
+	return reinterpret_cast<T*>(m_memory.get_device_pointer() + find->second.offset);
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/GPURenderer.h"
+#include "Renderer/RenderPasses/RenderPass.h"
+
+RenderPass::RenderPass(GPURenderer* renderer) : m_renderer(renderer), render_data(&renderer->get_render_data()) {}
+
+void RenderPass::recompile(std::shared_ptr<HIPRTOrochiCtx>& hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets, bool silent, bool use_cache)
+{
+	for (auto& name_to_kernel : m_kernels)
+	{
+		if (use_cache && !name_to_kernel.second.needs_recompilation())
+			// Not affected by the options that changed
+			continue;
+
+		if (silent)
+			name_to_kernel.second.compile_silent(hiprt_orochi_ctx, func_name_sets, use_cache);
+		else
+			name_to_kernel.second.compile(hiprt_orochi_ctx, func_name_sets, use_cache);
+	}
+}
+
+void RenderPass::compute_render_times(std::unordered_map<std::string, float>& times)
+{
+	std::unordered_map<std::string, float> new_times;
+	m_new_times_resolved = m_launch_timestamps.resolve(new_times);
+	if (m_new_times_resolved)
+	{
+		// The keys that weren't launched during the resolved launch() are at 0
+		for (auto& key_to_time : m_resolved_times)
+			key_to_time.second = 0.0f;
+		for (auto& key_to_time : new_times)
+			m_resolved_times[key_to_time.first] = key_to_time.second;
+	}
+
+	bool enabled = is_enabled();
+	for (auto& key_to_time : m_resolved_times)
+		// Not contributing to the frame time if the pass isn't used
+		times[key_to_time.first] = enabled ? key_to_time.second : 0.0f;
+}
+
+void RenderPass::update_perf_metrics(std::shared_ptr<PerformanceMetricsComputer> perf_metrics)
+{
+	if (!is_enabled() || !m_new_times_resolved)
+		return;
+
+	for (auto& key_to_time : m_resolved_times)
+	{
+		if (key_to_time.second == 0.0f)
+			// Not launched during the resolved launch(), probably disabled by the settings
+			continue;
+
+		perf_metrics->add_value(key_to_time.first, key_to_time.second);
+	}
+
+	m_new_times_resolved = false;
+}
+
+void RenderPass::reset_launch_timings()
+{
+	m_launch_timestamps.begin_frame();
+}
+
+void RenderPass::launch_kernel_timed(const std::string& kernel_id, const std::string& timing_key, int2 thread_count, int2 block_size, void** launch_args)
+{
+	int2 render_resolution = m_renderer->m_render_resolution;
+	if (thread_count.x == -1)
+		thread_count = render_resolution;
+
+	if (launch_args == nullptr)
+		launch_args = m_renderer->get_render_data_launch_args(m_kernels[kernel_id]);
+
+	oroStream_t stream = m_renderer->get_pass_stream();
+	m_launch_timestamps.record_start(timing_key, stream);
+	m_kernels[kernel_id].launch(block_size.x, block_size.y, thread_count.x, thread_count.y, launch_args, stream);
+	m_launch_timestamps.record_stop(timing_key, stream);
+}
+
+void RenderPass::launch_kernel_over_active_pixels_timed(const std::string& kernel_id, const std::string& timing_key, int2 block_size)
+{
+	if (!render_data->render_settings.launch_over_active_pixels)
+	{
+		// Only the low resolution pixels, in the top left corner, when rendering at low resolution
+		launch_kernel_timed(kernel_id, timing_key, render_data->render_settings.get_pixel_launch_resolution(m_renderer->m_render_resolution), block_size);
+
+		return;
+	}
+
+	// The number of active pixels is only known on the GPU so launching one thread
+	// per pixel, the threads past the end of the list exit right away
+	int2 render_resolution = m_renderer->m_render_resolution;
+	launch_kernel_timed(kernel_id, timing_key, make_int2(render_resolution.x * render_resolution.y, 1), make_int2(block_size.x * block_size.y, 1));
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RENDER_PASS_H
+#define RENDER_PASS_H
+
+#include "Compiler/GPUKernel.h"
+#include "HIPRT-Orochi/HIPRTOrochiCtx.h"
+#include "HIPRT-Orochi/OrochiTimestampRing.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "UI/PerformanceMetricsComputer.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class GPURenderer;
+
+/**
+ * Base class of the render passes of the GPURenderer.
+ *
+ * The GPURenderer holds a list of its render passes and forwards its own
+ * update / resize / recompile / reset / ... to all of them so that a new pass only
+ * has to implement the hooks it needs and be registered in GPURenderer::m_render_passes.
+ *
+ * Kernels launched through launch_kernel_timed() are timed automatically: the time of all
+ * the launches of a given timing key during one launch() of the pass are summed and
+ * reported to the renderer's render pass times and to the performance metrics. The timings
+ * are read back from an OrochiTimestampRing so they lag a few frames behind but reading them
+ * never waits for the GPU.
+ *
+ * The buffers of the passes are OrochiBuffers: their memory comes from the device memory
+ * pool (see OrochiDeviceMemoryPool) so the memory that a pass frees when it gets disabled
+ * is reused by the passes that allocate afterwards without going through the driver
+ */
+class RenderPass
+{
+public:
+	RenderPass() {}
+	RenderPass(GPURenderer* renderer);
+	virtual ~RenderPass() {}
+
+	virtual void compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets) = 0;
+	/**
+	 * Recompiles the kernels of 'm_kernels' whose relevant options changed since their
+	 * last compilation (see GPUKernel::needs_recompilation()), all of them if 'use_cache' is false
+	 */
+	virtual void recompile(std::shared_ptr<HIPRTOrochiCtx>& hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets, bool silent = false, bool use_cache = true);
+
+	/**
+	 * Whether or not the pass is going to be launched with the current render settings / kernel options.
+	 * Disabled passes don't contribute to the frame time and are not resized
+	 */
+	virtual bool is_enabled() = 0;
+
+	/**
+	 * Allocates / frees the buffers of the pass depending on whether or not it is enabled.
+	 * Must call GPURenderer::invalidate_render_data_buffers() if a buffer was (re)allocated
+	 */
+	virtual void update() {}
+	/**
+	 * Sets the device pointers of the buffers of the pass in the render data
+	 */
+	virtual void update_render_data() {}
+
+	virtual void resize(int new_width, int new_height) {}
+	/**
+	 * Called when the render is reset while accumulating
+	 */
+	virtual void reset() {}
+
+	virtual void launch() = 0;
+
+	/**
+	 * Fills 'times' with the execution times of the kernels launched with launch_kernel_timed()
+	 * during the most recent launch() of the pass whose kernels have completed on the GPU
+	 * (0 for the timing keys that weren't launched). Doesn't block
+	 */
+	virtual void compute_render_times(std::unordered_map<std::string, float>& times);
+	/**
+	 * Adds the times fetched by the last compute_render_times() to the performance metrics.
+	 * Nothing is added if compute_render_times() couldn't fetch new times so that the
+	 * min / max / average of the metrics aren't biased by the same times being added multiple times
+	 */
+	virtual void update_perf_metrics(std::shared_ptr<PerformanceMetricsComputer> perf_metrics);
+
+	std::map<std::string, GPUKernel> m_kernels;
+
+protected:
+	/**
+	 * Must be called at the beginning of launch() by the passes that use launch_kernel_timed()
+	 * so that the timings only account for the launches of the current launch()
+	 */
+	void reset_launch_timings();
+
+	/**
+	 * Launches the kernel 'kernel_id' over 'thread_count' threads (whole render resolution if not given)
+	 * and accumulates its execution time under 'timing_key'.
+	 *
+	 * The kernel is launched with the render data and the render resolution as arguments if
+	 * 'launch_args' is nullptr
+	 */
+	void launch_kernel_timed(const std::string& kernel_id, const std::string& timing_key, int2 thread_count = make_int2(-1, -1), int2 block_size = make_int2(8, 8), void** launch_args = nullptr);
+	/**
+	 * Same as launch_kernel_timed() over the whole render resolution (over the low resolution pixels if rendering
+	 * at low resolution, see HIPRTRenderSettings::get_pixel_launch_resolution()) for the per-pixel kernels that
+	 * get their pixel with get_thread_pixel(): if render_settings.launch_over_active_pixels is true, the kernel
+	 * is launched over one row of threads, one per pixel of the active pixel list, in blocks of the
+	 * same number of threads as 'block_size'
+	 */
+	void launch_kernel_over_active_pixels_timed(const std::string& kernel_id, const std::string& timing_key, int2 block_size = make_int2(8, 8));
+
+	GPURenderer* m_renderer = nullptr;
+	// Quick access to the renderer's render_data
+	HIPRTRenderData* render_data = nullptr;
+
+private:
+	// Start/stop events of the kernel launches of the last few launch(). The same kernel may be
+	// launched multiple times during one launch() (once per bounce, once per spatial reuse pass, ...),
+	// the ring sums the time of all the launches of a timing key
+	OrochiTimestampRing m_launch_timestamps;
+	// Times of the most recent launch() resolved from 'm_launch_timestamps'
+	std::unordered_map<std::string, float> m_resolved_times;
+	// Whether or not the last compute_render_times() resolved new times
+	bool m_new_times_resolved = false;
+};
+
+#endif
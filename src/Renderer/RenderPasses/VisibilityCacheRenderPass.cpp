@@ -0,0 +1,91 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/GPURenderer.h"
+#include "Renderer/RenderPasses/VisibilityCacheRenderPass.h"
+
+VisibilityCacheRenderPass::VisibilityCacheRenderPass(GPURenderer* renderer) : RenderPass(renderer) {}
+
+void VisibilityCacheRenderPass::compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets)
+{
+	// No kernel, the cache is updated by the shadow rays of the path tracer
+}
+
+bool VisibilityCacheRenderPass::is_enabled()
+{
+	return render_data->render_settings.visibility_cache_settings.use_visibility_cache;
+}
+
+void VisibilityCacheRenderPass::update()
+{
+	if (is_enabled())
+	{
+		if (m_keys.get_element_count() == 0)
+		{
+			m_keys.resize(VisibilityCacheRenderPass::ENTRY_COUNT);
+			m_bins.resize(VisibilityCacheRenderPass::ENTRY_COUNT * VISIBILITY_CACHE_BIN_COUNT);
+			m_clear_requested = true;
+
+			m_renderer->invalidate_render_data_buffers();
+		}
+
+		if (m_clear_requested)
+		{
+			m_keys.upload_data(std::vector<unsigned int>(VisibilityCacheRenderPass::ENTRY_COUNT, 0u));
+			m_bins.upload_data(std::vector<unsigned int>(VisibilityCacheRenderPass::ENTRY_COUNT * VISIBILITY_CACHE_BIN_COUNT, 0u));
+
+			m_clear_requested = false;
+		}
+	}
+	else if (m_keys.get_element_count() > 0)
+	{
+		m_keys.free();
+		m_bins.free();
+
+		m_renderer->invalidate_render_data_buffers();
+	}
+}
+
+void VisibilityCacheRenderPass::update_render_data()
+{
+	VisibilityCacheSettings& visibility_cache_settings = render_data->render_settings.visibility_cache_settings;
+
+	if (m_keys.get_element_count() > 0)
+	{
+		visibility_cache_settings.keys = reinterpret_cast<AtomicType<unsigned int>*>(m_keys.get_device_pointer());
+		visibility_cache_settings.bins = reinterpret_cast<AtomicType<unsigned int>*>(m_bins.get_device_pointer());
+		visibility_cache_settings.entry_count = VisibilityCacheRenderPass::ENTRY_COUNT;
+	}
+	else
+	{
+		visibility_cache_settings.keys = nullptr;
+		visibility_cache_settings.bins = nullptr;
+		visibility_cache_settings.entry_count = 0;
+	}
+}
+
+void VisibilityCacheRenderPass::launch()
+{
+	// Nothing to launch, see compile()
+}
+
+void VisibilityCacheRenderPass::set_scene_bounds(const BoundingBox& scene_bounding_box)
+{
+	// Same cells as the radiance cache: a few hundred cells along the largest dimension of the scene
+	render_data->render_settings.visibility_cache_settings.cell_size = hippt::max(1.0e-4f, scene_bounding_box.get_max_extent() / 256.0f);
+
+	clear_cache();
+}
+
+void VisibilityCacheRenderPass::clear_cache()
+{
+	m_clear_requested = true;
+}
+
+size_t VisibilityCacheRenderPass::get_byte_size()
+{
+	// Keys + bins
+	return static_cast<size_t>(VisibilityCacheRenderPass::ENTRY_COUNT) * sizeof(unsigned int) * (1 + VISIBILITY_CACHE_BIN_COUNT);
+}
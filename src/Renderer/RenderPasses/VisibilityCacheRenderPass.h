@@ -0,0 +1,66 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef VISIBILITY_CACHE_RENDER_PASS_H
+#define VISIBILITY_CACHE_RENDER_PASS_H
+
+#include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "Renderer/RenderPasses/RenderPass.h"
+#include "Scene/BoundingBox.h"
+
+class GPURenderer;
+
+/**
+ * World space visibility cache: owns the hash table that the shadow rays of the envmap and of the RIS
+ * light sampling train when VisibilityCacheSettings::use_visibility_cache is true (see Device/includes/VisibilityCache.h).
+ *
+ * The shadow rays update the counters of the table themselves so this pass has no kernel. Like the radiance cache,
+ * the cache follows the changes of the scene by itself so it is kept when the render is reset, clear_cache() empties it
+ */
+class VisibilityCacheRenderPass : public RenderPass
+{
+public:
+	// Number of entries of the hash table, must be a power of 2
+	static constexpr unsigned int ENTRY_COUNT = 1u << 18;
+
+	VisibilityCacheRenderPass() {}
+	VisibilityCacheRenderPass(GPURenderer* renderer);
+
+	void compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets) override;
+
+	bool is_enabled() override;
+
+	/**
+	 * Allocates/frees the hash table depending on whether or not the visibility cache is used
+	 */
+	void update() override;
+	void update_render_data() override;
+
+	void launch() override;
+
+	/**
+	 * Sets the default size of the cells of the cache from the size of the scene. Clears the cache
+	 */
+	void set_scene_bounds(const BoundingBox& scene_bounding_box);
+	/**
+	 * Empties the cache before the next frame
+	 */
+	void clear_cache();
+
+	/**
+	 * VRAM used by the buffers of the cache
+	 */
+	static size_t get_byte_size();
+
+private:
+	// See VisibilityCacheSettings
+	OrochiBuffer<unsigned int> m_keys { "Visibility cache" };
+	OrochiBuffer<unsigned int> m_bins { "Visibility cache" };
+
+	bool m_clear_requested = false;
+};
+
+#endif
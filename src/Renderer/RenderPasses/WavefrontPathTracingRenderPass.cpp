@@ -0,0 +1,346 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Renderer/GPURenderer.h"
+#include "Renderer/RenderPasses/WavefrontPathTracingRenderPass.h"
+#include "Threads/ThreadFunctions.h"
+#include "Threads/ThreadManager.h"
+
+#include <algorithm>
+
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_EXTEND_KERNEL_ID = "Wavefront Extend";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_SHADE_KERNEL_ID = "Wavefront Shade";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_SHADOW_RAYS_KERNEL_ID = "Wavefront Shadow Rays";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_ACCUMULATE_KERNEL_ID = "Wavefront Accumulate";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_HISTOGRAM_KERNEL_ID = "Wavefront Material Sort Histogram";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_SCAN_KERNEL_ID = "Wavefront Material Sort Scan";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_SCATTER_KERNEL_ID = "Wavefront Material Sort Scatter";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_RAY_SORT_HISTOGRAM_KERNEL_ID = "Wavefront Ray Sort Histogram";
+
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_TIME_KEY = "Wavefront Material Sort";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_RAY_SORT_TIME_KEY = "Wavefront Ray Sort";
+
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_RAY_ORIGINS_BUFFER_ID = "Wavefront ray origins";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_SORT_KEYS_BUFFER_ID = "Wavefront sort keys";
+const std::string WavefrontPathTracingRenderPass::WAVEFRONT_SORTED_PIXEL_INDICES_BUFFER_ID = "Wavefront sorted pixel indices";
+
+const std::unordered_map<std::string, std::string> WavefrontPathTracingRenderPass::KERNEL_FUNCTION_NAMES =
+{
+	{ WAVEFRONT_EXTEND_KERNEL_ID, "WavefrontExtend" },
+	{ WAVEFRONT_SHADE_KERNEL_ID, "WavefrontShade" },
+	{ WAVEFRONT_SHADOW_RAYS_KERNEL_ID, "WavefrontShadowRays" },
+	{ WAVEFRONT_ACCUMULATE_KERNEL_ID, "WavefrontAccumulate" },
+	{ WAVEFRONT_MATERIAL_SORT_HISTOGRAM_KERNEL_ID, "WavefrontMaterialSortHistogram" },
+	{ WAVEFRONT_MATERIAL_SORT_SCAN_KERNEL_ID, "WavefrontMaterialSortScan" },
+	{ WAVEFRONT_MATERIAL_SORT_SCATTER_KERNEL_ID, "WavefrontMaterialSortScatter" },
+	{ WAVEFRONT_RAY_SORT_HISTOGRAM_KERNEL_ID, "WavefrontRaySortHistogram" },
+};
+
+const std::unordered_map<std::string, std::string> WavefrontPathTracingRenderPass::KERNEL_FILES =
+{
+	{ WAVEFRONT_EXTEND_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Wavefront/Extend.h" },
+	{ WAVEFRONT_SHADE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Wavefront/Shade.h" },
+	{ WAVEFRONT_SHADOW_RAYS_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Wavefront/ShadowRays.h" },
+	{ WAVEFRONT_ACCUMULATE_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Wavefront/Accumulate.h" },
+	{ WAVEFRONT_MATERIAL_SORT_HISTOGRAM_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Wavefront/MaterialSortHistogram.h" },
+	{ WAVEFRONT_MATERIAL_SORT_SCAN_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Wavefront/MaterialSortScan.h" },
+	{ WAVEFRONT_MATERIAL_SORT_SCATTER_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Wavefront/MaterialSortScatter.h" },
+	{ WAVEFRONT_RAY_SORT_HISTOGRAM_KERNEL_ID, DEVICE_KERNELS_DIRECTORY "/Wavefront/RaySortHistogram.h" },
+};
+
+WavefrontPathTracingRenderPass::WavefrontPathTracingRenderPass(GPURenderer* renderer) : RenderPass(renderer) {}
+
+void WavefrontPathTracingRenderPass::compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets)
+{
+	std::shared_ptr<GPUKernelCompilerOptions> global_compiler_options = m_renderer->get_global_compiler_options();
+
+	// Shared stack sizes per kernel. The kernels that trace rays
+	// get a shared stack, the accumulate and sort kernels don't trace anything
+	std::unordered_map<std::string, int> shared_stack_sizes =
+	{
+		{ WAVEFRONT_EXTEND_KERNEL_ID, 48 },
+		{ WAVEFRONT_SHADE_KERNEL_ID, 16 },
+		{ WAVEFRONT_SHADOW_RAYS_KERNEL_ID, 16 },
+		{ WAVEFRONT_ACCUMULATE_KERNEL_ID, 0 },
+		{ WAVEFRONT_MATERIAL_SORT_HISTOGRAM_KERNEL_ID, 0 },
+		{ WAVEFRONT_MATERIAL_SORT_SCAN_KERNEL_ID, 0 },
+		{ WAVEFRONT_MATERIAL_SORT_SCATTER_KERNEL_ID, 0 },
+		{ WAVEFRONT_RAY_SORT_HISTOGRAM_KERNEL_ID, 0 },
+	};
+
+	for (auto& id_to_function_name : WavefrontPathTracingRenderPass::KERNEL_FUNCTION_NAMES)
+	{
+		const std::string& kernel_id = id_to_function_name.first;
+
+		m_kernels[kernel_id].set_kernel_file_path(WavefrontPathTracingRenderPass::KERNEL_FILES.at(kernel_id));
+		m_kernels[kernel_id].set_kernel_function_name(id_to_function_name.second);
+		m_kernels[kernel_id].synchronize_options_with(*global_compiler_options, options_excluded_from_synchro);
+		m_kernels[kernel_id].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::USE_SHARED_STACK_BVH_TRAVERSAL, shared_stack_sizes[kernel_id] > 0 ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+		m_kernels[kernel_id].get_kernel_options().set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE, shared_stack_sizes[kernel_id]);
+	}
+
+	for (auto& id_to_kernel : m_kernels)
+		ThreadManager::start_thread(ThreadManager::COMPILE_KERNELS_THREAD_KEY, ThreadFunctions::compile_kernel, std::ref(id_to_kernel.second), hiprt_orochi_ctx, std::ref(func_name_sets));
+}
+
+bool WavefrontPathTracingRenderPass::is_enabled()
+{
+	return render_data->render_settings.use_wavefront_path_tracing;
+}
+
+void WavefrontPathTracingRenderPass::update()
+{
+	int2 render_resolution = m_renderer->m_render_resolution;
+
+	if (render_data->render_settings.use_wavefront_path_tracing)
+	{
+		if (!is_allocated())
+		{
+			allocate_queues(render_resolution.x * render_resolution.y);
+
+			m_renderer->invalidate_render_data_buffers();
+		}
+		else
+			// Declaring the queues again in case WavefrontDeferredMaterials changed. This does
+			// nothing if the queues didn't change, the GPURenderer compiles the render graph otherwise
+			allocate_queues(render_resolution.x * render_resolution.y);
+	}
+	else if (is_allocated())
+	{
+		// Wavefront disabled, freeing the queues to save some VRAM
+		free_queues();
+
+		m_renderer->invalidate_render_data_buffers();
+	}
+
+	update_sort_buffers();
+}
+
+void WavefrontPathTracingRenderPass::update_render_data()
+{
+	RenderGraph& render_graph = m_renderer->get_render_graph();
+	WavefrontQueues& queues = render_data->wavefront_queues;
+
+	// If the queues are not allocated, all these pointers are going to be nullptr
+	for_each_queue([&render_graph](const std::string& buffer_id, size_t element_byte_size, void** queue_pointer)
+	{
+		*queue_pointer = render_graph.get_transient_buffer<void>(buffer_id);
+	});
+
+	queues.sort_keys = render_graph.get_transient_buffer<unsigned int>(WavefrontPathTracingRenderPass::WAVEFRONT_SORT_KEYS_BUFFER_ID);
+	queues.sort_histogram = reinterpret_cast<AtomicType<unsigned int>*>(sort_histogram.get_device_pointer());
+	queues.sort_offsets = reinterpret_cast<AtomicType<unsigned int>*>(sort_offsets.get_device_pointer());
+	queues.sorted_pixel_indices = render_graph.get_transient_buffer<unsigned int>(WavefrontPathTracingRenderPass::WAVEFRONT_SORTED_PIXEL_INDICES_BUFFER_ID);
+}
+
+void WavefrontPathTracingRenderPass::resize(int new_width, int new_height)
+{
+	allocate_queues(new_width * new_height);
+
+	RenderGraph& render_graph = m_renderer->get_render_graph();
+	if (render_graph.has_transient_buffer(WavefrontPathTracingRenderPass::WAVEFRONT_SORT_KEYS_BUFFER_ID))
+	{
+		render_graph.declare_transient_buffer<unsigned int>(WavefrontPathTracingRenderPass::WAVEFRONT_SORT_KEYS_BUFFER_ID, new_width * new_height, RENDER_GRAPH_STEP_PATH_TRACING, RENDER_GRAPH_STEP_PATH_TRACING);
+		render_graph.declare_transient_buffer<unsigned int>(WavefrontPathTracingRenderPass::WAVEFRONT_SORTED_PIXEL_INDICES_BUFFER_ID, new_width * new_height, RENDER_GRAPH_STEP_PATH_TRACING, RENDER_GRAPH_STEP_PATH_TRACING);
+	}
+}
+
+void WavefrontPathTracingRenderPass::resize_ray_volume_states()
+{
+	if (!is_allocated())
+		return;
+
+	// Declaring the queues again with the new size of the volume states,
+	// the render graph is then compiled by the GPURenderer
+	int2 render_resolution = m_renderer->m_render_resolution;
+	allocate_queues(render_resolution.x * render_resolution.y);
+}
+
+bool WavefrontPathTracingRenderPass::is_allocated()
+{
+	return m_renderer->get_render_graph().has_transient_buffer(WavefrontPathTracingRenderPass::WAVEFRONT_RAY_ORIGINS_BUFFER_ID);
+}
+
+void WavefrontPathTracingRenderPass::allocate_queues(int pixel_count)
+{
+	RenderGraph& render_graph = m_renderer->get_render_graph();
+
+	for_each_queue([&render_graph, pixel_count](const std::string& buffer_id, size_t element_byte_size, void** queue_pointer)
+	{
+		if (element_byte_size == 0)
+			// Queue not used with the current kernel options
+			render_graph.remove_transient_buffer(buffer_id);
+		else
+			render_graph.declare_transient_buffer(buffer_id, element_byte_size * pixel_count, RENDER_GRAPH_STEP_PATH_TRACING, RENDER_GRAPH_STEP_PATH_TRACING);
+	});
+}
+
+void WavefrontPathTracingRenderPass::free_queues()
+{
+	RenderGraph& render_graph = m_renderer->get_render_graph();
+
+	for_each_queue([&render_graph](const std::string& buffer_id, size_t element_byte_size, void** queue_pointer)
+	{
+		render_graph.remove_transient_buffer(buffer_id);
+	});
+}
+
+void WavefrontPathTracingRenderPass::for_each_queue(const std::function<void(const std::string&, size_t, void**)>& function)
+{
+	WavefrontQueues& queues = render_data->wavefront_queues;
+
+	function(WavefrontPathTracingRenderPass::WAVEFRONT_RAY_ORIGINS_BUFFER_ID, sizeof(float3), reinterpret_cast<void**>(&queues.ray_origins));
+	function("Wavefront ray directions", sizeof(float3), reinterpret_cast<void**>(&queues.ray_directions));
+	function("Wavefront throughputs", sizeof(ColorRGB32F), reinterpret_cast<void**>(&queues.throughputs));
+	function("Wavefront ray colors", sizeof(ColorRGB32F), reinterpret_cast<void**>(&queues.ray_colors));
+	function("Wavefront ray states", sizeof(unsigned char), reinterpret_cast<void**>(&queues.ray_states));
+
+	function("Wavefront hit found", sizeof(unsigned char), reinterpret_cast<void**>(&queues.hit_found));
+	function("Wavefront inter points", sizeof(float3), reinterpret_cast<void**>(&queues.inter_points));
+	function("Wavefront shading normals", sizeof(float3), reinterpret_cast<void**>(&queues.shading_normals));
+	function("Wavefront geometric normals", sizeof(float3), reinterpret_cast<void**>(&queues.geometric_normals));
+	// Only the queues of the material layout selected by WavefrontDeferredMaterials are allocated,
+	// the others are given a size of 0
+	bool deferred_materials = m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::WAVEFRONT_DEFERRED_MATERIALS) == KERNEL_OPTION_TRUE;
+	function("Wavefront materials", deferred_materials ? 0 : sizeof(SimplifiedRendererMaterial), reinterpret_cast<void**>(&queues.materials));
+	function("Wavefront texcoords", deferred_materials ? sizeof(float2) : 0, reinterpret_cast<void**>(&queues.texcoords));
+	function("Wavefront texture footprints", deferred_materials ? sizeof(float) : 0, reinterpret_cast<void**>(&queues.texture_footprints));
+	// Same as for the G-buffer, the size of the RayVolumeState on the GPU may not match
+	// the size on the CPU so we're giving the size manually. See GPURendererGBuffer::resize()
+	function("Wavefront volume states", m_renderer->get_ray_volume_state_byte_size(), reinterpret_cast<void**>(&queues.volume_states));
+	function("Wavefront ray cones", sizeof(RayCone), reinterpret_cast<void**>(&queues.ray_cones));
+	function("Wavefront material ids", sizeof(int), reinterpret_cast<void**>(&queues.material_ids));
+
+	function("Wavefront random states", sizeof(unsigned int), reinterpret_cast<void**>(&queues.random_states));
+
+	function("Wavefront shadow ray origins", sizeof(float3), reinterpret_cast<void**>(&queues.shadow_ray_origins));
+	function("Wavefront shadow ray directions", sizeof(float3), reinterpret_cast<void**>(&queues.shadow_ray_directions));
+	function("Wavefront shadow ray distances", sizeof(float), reinterpret_cast<void**>(&queues.shadow_ray_distances));
+	function("Wavefront shadow ray contributions", sizeof(ColorRGB32F), reinterpret_cast<void**>(&queues.shadow_ray_contributions));
+
+	function("Wavefront denoiser albedo", sizeof(ColorRGB32F), reinterpret_cast<void**>(&queues.denoiser_albedo));
+	function("Wavefront denoiser normals", sizeof(float3), reinterpret_cast<void**>(&queues.denoiser_normals));
+}
+
+void WavefrontPathTracingRenderPass::update_sort_buffers()
+{
+	RenderGraph& render_graph = m_renderer->get_render_graph();
+
+	bool sort_enabled = render_data->render_settings.wavefront_material_sort || render_data->render_settings.wavefront_ray_sort;
+	if (!sort_enabled || !is_allocated())
+	{
+		if (render_graph.has_transient_buffer(WavefrontPathTracingRenderPass::WAVEFRONT_SORT_KEYS_BUFFER_ID))
+			m_renderer->invalidate_render_data_buffers();
+
+		render_graph.remove_transient_buffer(WavefrontPathTracingRenderPass::WAVEFRONT_SORT_KEYS_BUFFER_ID);
+		render_graph.remove_transient_buffer(WavefrontPathTracingRenderPass::WAVEFRONT_SORTED_PIXEL_INDICES_BUFFER_ID);
+		sort_histogram.free();
+		sort_offsets.free();
+
+		return;
+	}
+
+	int2 render_resolution = m_renderer->m_render_resolution;
+	int pixel_count = render_resolution.x * render_resolution.y;
+	// The histogram is shared by the two sorts so it must be large enough for both
+	int key_count = 0;
+	if (render_data->render_settings.wavefront_material_sort)
+		key_count = get_material_sort_key_count();
+	if (render_data->render_settings.wavefront_ray_sort)
+		key_count = std::max(key_count, WavefrontQueues::RAY_SORT_KEY_COUNT);
+
+	// Does nothing if already declared with that size
+	render_graph.declare_transient_buffer<unsigned int>(WavefrontPathTracingRenderPass::WAVEFRONT_SORT_KEYS_BUFFER_ID, pixel_count, RENDER_GRAPH_STEP_PATH_TRACING, RENDER_GRAPH_STEP_PATH_TRACING);
+	render_graph.declare_transient_buffer<unsigned int>(WavefrontPathTracingRenderPass::WAVEFRONT_SORTED_PIXEL_INDICES_BUFFER_ID, pixel_count, RENDER_GRAPH_STEP_PATH_TRACING, RENDER_GRAPH_STEP_PATH_TRACING);
+
+	if (sort_histogram.get_element_count() != static_cast<size_t>(key_count))
+	{
+		sort_histogram.resize(key_count);
+		sort_offsets.resize(key_count);
+		// The histogram kernel expects a cleared histogram. It is then
+		// cleared by the scan kernel after each sort
+		sort_histogram.upload_data(std::vector<unsigned int>(key_count, 0));
+
+		m_renderer->invalidate_render_data_buffers();
+	}
+}
+
+int WavefrontPathTracingRenderPass::get_material_sort_key_count()
+{
+	// One key per material + one key for the misses + one key for the terminated paths
+	return static_cast<int>(m_renderer->get_materials().size()) + 2;
+}
+
+void WavefrontPathTracingRenderPass::launch_material_sort()
+{
+	render_data->wavefront_queues.sort_key_count = get_material_sort_key_count();
+
+	launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_HISTOGRAM_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_TIME_KEY);
+	// The scan is done by a single thread
+	launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_SCAN_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_TIME_KEY, make_int2(1, 1));
+	launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_SCATTER_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_TIME_KEY);
+}
+
+void WavefrontPathTracingRenderPass::launch_ray_sort()
+{
+	render_data->wavefront_queues.sort_key_count = WavefrontQueues::RAY_SORT_KEY_COUNT;
+
+	// Only the keys are computed differently, the scan and the scatter are the same as for the material sort
+	launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_RAY_SORT_HISTOGRAM_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_RAY_SORT_TIME_KEY);
+	launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_SCAN_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_RAY_SORT_TIME_KEY, make_int2(1, 1));
+	launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_SCATTER_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_RAY_SORT_TIME_KEY);
+}
+
+void WavefrontPathTracingRenderPass::set_scene_bounds(const BoundingBox& scene_bounding_box)
+{
+	// Padding so that flat scenes don't have a grid of size 0 along one axis
+	float padding = hippt::max(1.0e-3f, scene_bounding_box.get_max_extent() * 1.0e-3f);
+	render_data->wavefront_queues.ray_sort_grid_min = scene_bounding_box.mini - make_float3(padding, padding, padding);
+	render_data->wavefront_queues.ray_sort_grid_max = scene_bounding_box.maxi + make_float3(padding, padding, padding);
+}
+
+void WavefrontPathTracingRenderPass::launch()
+{
+	int nb_bounces = render_data->render_settings.nb_bounces;
+	if (render_data->render_settings.do_render_low_resolution())
+		// Reducing the number of bounces if rendering at low resolution
+		// for better interactivity. Same as in the FullPathTracer megakernel
+		nb_bounces = std::min(render_data->render_settings.render_low_resolution_max_bounces, nb_bounces);
+
+	// The shade kernel reads the number of bounces to know whether it should
+	// sample the next bounce or not so it needs the clamped value
+	int user_nb_bounces = render_data->render_settings.nb_bounces;
+	render_data->render_settings.nb_bounces = nb_bounces;
+
+	reset_launch_timings();
+
+	bool material_sort_available = render_data->render_settings.wavefront_material_sort && render_data->wavefront_queues.sort_keys != nullptr;
+	bool ray_sort_available = render_data->render_settings.wavefront_ray_sort && render_data->wavefront_queues.sort_keys != nullptr;
+
+	render_data->random_seed = m_renderer->rng().xorshift32();
+	for (int bounce = 0; bounce < nb_bounces; bounce++)
+	{
+		render_data->wavefront_queues.current_bounce = bounce;
+		// The hits of the first bounce come from the camera rays and are already coherent.
+		// Also, the G-buffer doesn't have the material indices so we cannot sort them anyways
+		render_data->wavefront_queues.use_material_sort = material_sort_available && bounce > 0;
+		// The extend kernel of the first bounce doesn't trace any ray, the hits come from the G-buffer
+		render_data->wavefront_queues.use_ray_sort = ray_sort_available && bounce > 0;
+
+		if (render_data->wavefront_queues.use_ray_sort)
+			launch_ray_sort();
+		launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_EXTEND_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_EXTEND_KERNEL_ID);
+		if (render_data->wavefront_queues.use_material_sort)
+			launch_material_sort();
+		launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_SHADE_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_SHADE_KERNEL_ID);
+		launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_SHADOW_RAYS_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_SHADOW_RAYS_KERNEL_ID);
+	}
+
+	launch_kernel_timed(WavefrontPathTracingRenderPass::WAVEFRONT_ACCUMULATE_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_ACCUMULATE_KERNEL_ID);
+
+	render_data->render_settings.nb_bounces = user_nb_bounces;
+	render_data->wavefront_queues.use_material_sort = false;
+	render_data->wavefront_queues.use_ray_sort = false;
+}
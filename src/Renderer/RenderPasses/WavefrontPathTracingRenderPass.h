@@ -0,0 +1,164 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef WAVEFRONT_PATH_TRACING_RENDER_PASS_H
+#define WAVEFRONT_PATH_TRACING_RENDER_PASS_H
+
+#include "Compiler/GPUKernel.h"
+#include "Device/includes/RayCone.h"
+#include "Device/includes/RayVolumeState.h"
+#include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HostDeviceCommon/Color.h"
+#include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/RenderData.h"
+#include "Renderer/RenderPasses/RenderPass.h"
+#include "Scene/BoundingBox.h"
+#include "UI/PerformanceMetricsComputer.h"
+
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class GPURenderer;
+
+/**
+ * Wavefront implementation of the path tracing pass.
+ *
+ * Instead of tracing the whole path of a pixel in one megakernel (FullPathTracer),
+ * each bounce is split into an extend kernel (traces the rays), a shade kernel (evaluates
+ * the materials, lights and samples the next bounce) and a shadow rays kernel (traces
+ * the shadow rays queued by the shade kernel). An accumulate kernel finally accumulates
+ * the paths into the framebuffers once all bounces are done.
+ *
+ * The state of the paths between the kernels is stored in ray queues (structure of arrays,
+ * one slot per pixel) that are only allocated when the wavefront path tracer is enabled.
+ * The queues don't outlive the path tracing step of the frame so they are transient
+ * buffers of the render graph (see RenderGraph)
+ */
+class WavefrontPathTracingRenderPass : public RenderPass
+{
+public:
+	/**
+	 * These constants here are used to reference kernel objects in the 'm_kernels' map
+	 * or in the 'm_render_pass_times' map
+	 */
+	static const std::string WAVEFRONT_EXTEND_KERNEL_ID;
+	static const std::string WAVEFRONT_SHADE_KERNEL_ID;
+	static const std::string WAVEFRONT_SHADOW_RAYS_KERNEL_ID;
+	static const std::string WAVEFRONT_ACCUMULATE_KERNEL_ID;
+	static const std::string WAVEFRONT_MATERIAL_SORT_HISTOGRAM_KERNEL_ID;
+	static const std::string WAVEFRONT_MATERIAL_SORT_SCAN_KERNEL_ID;
+	static const std::string WAVEFRONT_MATERIAL_SORT_SCATTER_KERNEL_ID;
+	static const std::string WAVEFRONT_RAY_SORT_HISTOGRAM_KERNEL_ID;
+
+	// Key for indexing m_render_pass_times that contains the time
+	// of the three kernels of the material sort combined
+	static const std::string WAVEFRONT_MATERIAL_SORT_TIME_KEY;
+	// Same for the ray sort (histogram + the scan and scatter kernels of the material sort)
+	static const std::string WAVEFRONT_RAY_SORT_TIME_KEY;
+
+	/**
+	 * Names of some of the transient buffers of the pass in the render graph.
+	 * The names of all the queues are given by for_each_queue()
+	 */
+	static const std::string WAVEFRONT_RAY_ORIGINS_BUFFER_ID;
+	static const std::string WAVEFRONT_SORT_KEYS_BUFFER_ID;
+	static const std::string WAVEFRONT_SORTED_PIXEL_INDICES_BUFFER_ID;
+
+	/**
+	 * Name of the main function of the kernels, see GPURenderer::KERNEL_FUNCTION_NAMES
+	 */
+	static const std::unordered_map<std::string, std::string> KERNEL_FUNCTION_NAMES;
+
+	/**
+	 * Same as 'KERNEL_FUNCTION_NAMES' but for kernel files
+	 */
+	static const std::unordered_map<std::string, std::string> KERNEL_FILES;
+
+	WavefrontPathTracingRenderPass() {}
+	WavefrontPathTracingRenderPass(GPURenderer* renderer);
+
+	void compile(std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::unordered_set<std::string>& options_excluded_from_synchro, std::vector<hiprtFuncNameSet>& func_name_sets) override;
+
+	/**
+	 * True if render_settings.use_wavefront_path_tracing
+	 */
+	bool is_enabled() override;
+
+	/**
+	 * Allocates/frees the ray queues depending on whether or not the
+	 * wavefront path tracer is enabled in the render settings
+	 */
+	void update() override;
+	void update_render_data() override;
+
+	void resize(int new_width, int new_height) override;
+	/**
+	 * Resizes the volume states queue to match the size of the
+	 * RayVolumeState structure on the GPU (that size changes when the
+	 * nested dielectrics stack size changes)
+	 */
+	void resize_ray_volume_states();
+
+	/**
+	 * Returns true if the ray queues are currently allocated
+	 */
+	bool is_allocated();
+
+	/**
+	 * Launches the (ray sort) / extend / (material sort) / shade / shadow rays kernels
+	 * for each bounce and then the accumulate kernel
+	 */
+	void launch() override;
+
+	/**
+	 * Sets the bounds of the grid in which the origins of the rays are quantized for the ray sort
+	 */
+	void set_scene_bounds(const BoundingBox& scene_bounding_box);
+
+private:
+	void allocate_queues(int pixel_count);
+	void free_queues();
+
+	/**
+	 * Calls 'function' with the name of the transient buffer of each ray queue, the size
+	 * in bytes of one element of that queue and the address of the pointer to that queue in the render data
+	 */
+	void for_each_queue(const std::function<void(const std::string&, size_t, void**)>& function);
+
+	/**
+	 * Allocates/frees the buffers of the material sort and of the ray sort depending on
+	 * render_settings.wavefront_material_sort, render_settings.wavefront_ray_sort and the
+	 * number of materials of the scene. Both sorts use the same buffers
+	 */
+	void update_sort_buffers();
+
+	/**
+	 * Number of keys of the material sort: one per material of the scene,
+	 * one for the misses and one for the terminated paths
+	 */
+	int get_material_sort_key_count();
+
+	/**
+	 * Sorts the pixel indices by the material index of their hit
+	 * for the shade kernel of the current bounce
+	 */
+	void launch_material_sort();
+
+	/**
+	 * Sorts the pixel indices by the direction octant and the origin of
+	 * their ray for the extend kernel of the current bounce
+	 */
+	void launch_ray_sort();
+
+	// The histogram and the offsets of the sorts are cleared by the sort kernels
+	// themselves and must stay cleared between frames so they are not transient
+	OrochiBuffer<unsigned int> sort_histogram { "Wavefront path tracing" };
+	OrochiBuffer<unsigned int> sort_offsets { "Wavefront path tracing" };
+};
+
+#endif
@@ -0,0 +1,483 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+// The socket headers must come before anything that could include windows.h
+#include "Utils/Sockets.h"
+
+#include "Image/EXRWriter.h"
+#include "Renderer/GPURenderer.h"
+#include "Renderer/MultiGPURenderer.h"
+#include "Renderer/RenderServer.h"
+#include "Threads/ThreadManager.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <sstream>
+
+#include <glm/gtc/quaternion.hpp>
+
+extern ImGuiLogger g_imgui_logger;
+
+const std::string RenderServer::PORT_COMMANDLINE_ARGUMENT = "--server=";
+const std::string RenderServer::ADDRESS_COMMANDLINE_ARGUMENT = "--server-address=";
+
+// Longest request accepted, the requests are a single line of a few keys
+#define RENDER_SERVER_MAX_REQUEST_SIZE 65536
+
+/**
+ * Sends the "<header> <width> <height> <byte count>" line followed by the pixels of 'image'
+ */
+static bool send_image(std::intptr_t socket, const std::string& header, const Image32Bit& image)
+{
+	size_t byte_count = image.data().size() * sizeof(float);
+
+	std::stringstream line;
+	line << header << " " << image.width << " " << image.height << " " << byte_count;
+	if (!send_line(socket, line.str()))
+		return false;
+
+	return send_all(socket, image.data().data(), byte_count);
+}
+
+static bool parse_floats(const std::string& value, float* out_values, int count)
+{
+	std::stringstream value_stream(value);
+	std::string component;
+	int parsed_count = 0;
+	while (std::getline(value_stream, component, ','))
+	{
+		if (parsed_count == count)
+			return false;
+
+		out_values[parsed_count++] = static_cast<float>(std::atof(component.c_str()));
+	}
+
+	return parsed_count == count;
+}
+
+RenderServer::RenderServer(const CommandlineArguments& arguments, const Scene& scene) : m_arguments(arguments), m_scene(scene) {}
+
+int RenderServer::run(const CommandlineArguments& arguments, const Scene& scene, const Image32Bit& envmap)
+{
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not initialize the sockets of the render server.");
+
+		return 1;
+	}
+#endif
+
+	RenderServer server(arguments, scene);
+
+	SocketHandle listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listen_socket == INVALID_SOCKET_HANDLE)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not create the socket of the render server.");
+
+		return 1;
+	}
+
+	int reuse_address = 1;
+	setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse_address), sizeof(reuse_address));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(static_cast<unsigned short>(arguments.server_port));
+	if (inet_pton(AF_INET, arguments.server_address.c_str(), &address.sin_addr) != 1
+		|| bind(listen_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+		|| listen(listen_socket, SOMAXCONN) != 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not listen on %s:%d.", arguments.server_address.c_str(), arguments.server_port);
+		close_socket(listen_socket);
+
+		return 1;
+	}
+	server.m_listen_socket = static_cast<std::intptr_t>(listen_socket);
+
+	// Building everything once for all the jobs
+	MultiGPURenderer renderer(arguments.gpu_indices, static_cast<MultiGPURenderer::SplitMode>(arguments.multi_gpu_mode));
+	renderer.set_envmap(envmap, arguments.skysphere_file_path);
+	renderer.set_camera(scene.camera);
+	renderer.resize(arguments.render_width, arguments.render_height);
+	renderer.set_bvh_build_quality(static_cast<BVHBuildQuality>(arguments.bvh_build_quality));
+	renderer.set_half_precision_texcoords(arguments.half_precision_texcoords);
+	renderer.set_quantized_vertices_positions(arguments.quantized_vertices_positions);
+	renderer.set_compact_bvh(arguments.compact_bvh);
+	renderer.set_scene(scene);
+	server.m_current_width = arguments.render_width;
+	server.m_current_height = arguments.render_height;
+
+	ThreadManager::join_all_threads();
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Render server listening on %s:%d", arguments.server_address.c_str(), arguments.server_port);
+	ThreadManager::start_dedicated_thread(ThreadManager::RENDER_SERVER_LISTEN_THREAD_KEY, [&server]() { server.listen_loop(); });
+
+	while (true)
+	{
+		RenderServerJob job;
+		{
+			std::unique_lock<std::mutex> lock(server.m_queue_mutex);
+			server.m_queue_condition.wait(lock, [&server]() { return !server.m_job_queue.empty() || server.m_quit_requested; });
+
+			if (server.m_job_queue.empty())
+				// Quit requested and all the jobs are done
+				break;
+
+			job = server.m_job_queue.front();
+			server.m_job_queue.pop_front();
+			server.m_rendering_job_id = job.job_id;
+		}
+
+		if (!server.render_job(renderer, job))
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "The client of the job %d disconnected, job cancelled", job.job_id);
+		close_socket(static_cast<SocketHandle>(job.client_socket));
+
+		std::lock_guard<std::mutex> lock(server.m_queue_mutex);
+		server.m_rendering_job_id = -1;
+	}
+
+	ThreadManager::join_threads(ThreadManager::RENDER_SERVER_LISTEN_THREAD_KEY);
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Render server stopped after %d jobs", server.m_next_job_id);
+
+	return 0;
+}
+
+bool RenderServer::parse_job(const std::string& request, const CommandlineArguments& arguments, RenderServerJob& out_job, std::string& out_error)
+{
+	out_job.width = arguments.render_width;
+	out_job.height = arguments.render_height;
+	out_job.samples = arguments.render_samples;
+	out_job.bounces = arguments.bounces;
+
+	std::stringstream request_stream(request);
+	std::string pair;
+	// Skipping the "render" command
+	request_stream >> pair;
+	while (request_stream >> pair)
+	{
+		size_t equal_position = pair.find('=');
+		if (equal_position == std::string::npos)
+		{
+			out_error = "Expected key=value, got \"" + pair + "\"";
+
+			return false;
+		}
+
+		std::string key = pair.substr(0, equal_position);
+		std::string value = pair.substr(equal_position + 1);
+		bool valid_value = true;
+		if (key == "width")
+			valid_value = (out_job.width = std::atoi(value.c_str())) > 0;
+		else if (key == "height")
+			valid_value = (out_job.height = std::atoi(value.c_str())) > 0;
+		else if (key == "samples")
+			valid_value = (out_job.samples = std::atoi(value.c_str())) > 0;
+		else if (key == "bounces")
+			valid_value = (out_job.bounces = std::atoi(value.c_str())) >= 0;
+		else if (key == "noise_threshold")
+			out_job.noise_threshold = static_cast<float>(std::atof(value.c_str()));
+		else if (key == "camera_position")
+			valid_value = out_job.has_camera_position = parse_floats(value, out_job.camera_position, 3);
+		else if (key == "camera_rotation")
+			valid_value = out_job.has_camera_rotation = parse_floats(value, out_job.camera_rotation, 4);
+		else if (key == "envmap_rotation")
+			out_job.envmap_rotation = static_cast<float>(std::atof(value.c_str()));
+		else if (key == "progress_interval")
+			valid_value = (out_job.progress_interval = std::atoi(value.c_str())) >= 0;
+		else if (key == "stream")
+		{
+			valid_value = value == "raw" || value == "tiles";
+			out_job.stream_tiles = value == "tiles";
+		}
+		else if (key == "jpeg_quality")
+			valid_value = (out_job.jpeg_quality = std::atoi(value.c_str())) >= 1 && out_job.jpeg_quality <= 100;
+		else if (key == "max_bandwidth")
+			valid_value = (out_job.max_bandwidth = static_cast<float>(std::atof(value.c_str()))) >= 0.0f;
+		else if (key == "output")
+			out_job.output_file_path = value;
+		else if (key == "seed")
+		{
+			out_job.has_seed = true;
+			out_job.seed = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+		}
+		else if (key == "sample_counts")
+		{
+			valid_value = value == "0" || value == "1";
+			out_job.send_sample_counts = value == "1";
+		}
+		else
+		{
+			out_error = "Unknown key \"" + key + "\"";
+
+			return false;
+		}
+
+		if (!valid_value)
+		{
+			out_error = "Invalid value \"" + value + "\" for the key \"" + key + "\"";
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void RenderServer::listen_loop()
+{
+	while (true)
+	{
+		SocketHandle client_socket = accept(static_cast<SocketHandle>(m_listen_socket), nullptr, nullptr);
+		if (client_socket == INVALID_SOCKET_HANDLE)
+			continue;
+
+		handle_request(static_cast<std::intptr_t>(client_socket));
+
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		if (m_quit_requested)
+			break;
+	}
+
+	close_socket(static_cast<SocketHandle>(m_listen_socket));
+}
+
+void RenderServer::handle_request(std::intptr_t client_socket)
+{
+	std::string request;
+	char buffer[1024];
+	while (request.find('\n') == std::string::npos && request.size() < RENDER_SERVER_MAX_REQUEST_SIZE)
+	{
+		int received = recv(static_cast<SocketHandle>(client_socket), buffer, sizeof(buffer), 0);
+		if (received <= 0)
+			break;
+
+		request.append(buffer, received);
+	}
+	request = request.substr(0, request.find_first_of("\r\n"));
+
+	std::string command = request.substr(0, request.find(' '));
+	if (command == "render")
+	{
+		RenderServerJob job;
+		std::string error;
+		if (!RenderServer::parse_job(request, m_arguments, job, error))
+		{
+			send_line(client_socket, "error " + error);
+			close_socket(static_cast<SocketHandle>(client_socket));
+
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		if (m_quit_requested)
+		{
+			send_line(client_socket, "error The server is stopping");
+			close_socket(static_cast<SocketHandle>(client_socket));
+
+			return;
+		}
+
+		job.job_id = m_next_job_id++;
+		job.client_socket = client_socket;
+		send_line(client_socket, "queued " + std::to_string(job.job_id) + " " + std::to_string(m_job_queue.size()));
+
+		m_job_queue.push_back(job);
+		m_queue_condition.notify_one();
+
+		// The socket now belongs to the job
+		return;
+	}
+
+	if (command == "status")
+	{
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		send_line(client_socket, "status " + std::to_string(m_job_queue.size()) + " " + std::to_string(m_rendering_job_id));
+	}
+	else if (command == "quit")
+	{
+		std::lock_guard<std::mutex> lock(m_queue_mutex);
+		m_quit_requested = true;
+		m_queue_condition.notify_one();
+
+		send_line(client_socket, "quit");
+	}
+	else
+		send_line(client_socket, "error Unknown command \"" + command + "\"");
+
+	close_socket(static_cast<SocketHandle>(client_socket));
+}
+
+bool RenderServer::send_progress(MultiGPURenderer& renderer, const RenderServerJob& job, ProgressiveTileEncoder& tile_encoder, int sample_number, size_t& out_sent_bytes)
+{
+	Image32Bit image = renderer.download_framebuffer();
+	std::string header_start = std::to_string(job.job_id) + " " + std::to_string(sample_number);
+
+	if (!job.stream_tiles)
+	{
+		out_sent_bytes += image.data().size() * sizeof(float);
+
+		return send_image(job.client_socket, "progress " + header_start, image);
+	}
+
+	std::vector<EncodedTile> tiles = tile_encoder.encode_changed_tiles(image);
+	if (!send_line(job.client_socket, "tiles " + header_start + " " + std::to_string(tiles.size())))
+		return false;
+
+	for (const EncodedTile& tile : tiles)
+	{
+		std::stringstream line;
+		line << "tile " << tile.x << " " << tile.y << " " << tile.width << " " << tile.height << " " << tile.jpeg.size();
+		if (!send_line(job.client_socket, line.str()) || !send_all(job.client_socket, tile.jpeg.data(), tile.jpeg.size()))
+			return false;
+
+		out_sent_bytes += tile.jpeg.size();
+	}
+
+	return true;
+}
+
+void RenderServer::setup_job(MultiGPURenderer& renderer, const RenderServerJob& job)
+{
+	if (job.width != m_current_width || job.height != m_current_height)
+	{
+		// Only reallocating the buffers when the resolution changes, the camera
+		// is given again so that the split frame bands are recomputed
+		renderer.set_camera(m_scene.camera);
+		renderer.resize(job.width, job.height);
+
+		m_current_width = job.width;
+		m_current_height = job.height;
+	}
+
+	glm::vec3 translation = m_scene.camera.translation;
+	glm::quat rotation = m_scene.camera.rotation;
+	if (job.has_camera_position)
+		translation = glm::vec3(job.camera_position[0], job.camera_position[1], job.camera_position[2]);
+	if (job.has_camera_rotation)
+		rotation = glm::normalize(glm::quat(job.camera_rotation[0], job.camera_rotation[1], job.camera_rotation[2], job.camera_rotation[3]));
+
+	// Before the reset() of the job that restarts the random number generators from their seeds
+	renderer.set_rng_seed(job.has_seed ? job.seed : 42);
+
+	renderer.for_each_renderer([&job, &translation, &rotation](GPURenderer& device_renderer) {
+		// The projection and the crop of the band of the device are left untouched
+		Camera& camera = device_renderer.get_camera();
+		camera.translation = translation;
+		camera.rotation = rotation;
+
+		device_renderer.get_envmap().rotation_Y = job.envmap_rotation - std::floor(job.envmap_rotation);
+
+		HIPRTRenderSettings& render_settings = device_renderer.get_render_settings();
+		render_settings.nb_bounces = job.bounces;
+		render_settings.enable_pixel_stop_noise_threshold = job.noise_threshold > 0.0f;
+		render_settings.stop_pixel_noise_threshold = job.noise_threshold;
+	});
+}
+
+bool RenderServer::render_job(MultiGPURenderer& renderer, RenderServerJob& job)
+{
+	setup_job(renderer, job);
+
+	std::shared_ptr<ApplicationSettings> application_settings = std::make_shared<ApplicationSettings>();
+	renderer.reset(application_settings);
+	renderer.for_each_renderer([](GPURenderer& device_renderer) {
+		device_renderer.get_render_settings().samples_per_frame = 1;
+	});
+
+	ProgressiveTileEncoder tile_encoder(job.jpeg_quality);
+
+	std::chrono::high_resolution_clock::time_point start_render = std::chrono::high_resolution_clock::now();
+	std::chrono::high_resolution_clock::time_point next_progress_time = start_render;
+	int last_progress_sample_number = 0;
+	while (renderer.get_sample_number() < job.samples)
+	{
+		if (!renderer.render())
+			// All the pixels have converged (adaptive sampling)
+			break;
+
+		if (job.noise_threshold > 0.0f)
+		{
+			float min_proportion_converged = 100.0f;
+			float stop_percentage = 0.0f;
+			renderer.for_each_renderer([&min_proportion_converged, &stop_percentage](GPURenderer& device_renderer) {
+				int pixel_count = device_renderer.m_render_resolution.x * device_renderer.m_render_resolution.y;
+				float proportion_converged = device_renderer.get_status_buffer_values().pixel_converged_count / static_cast<float>(pixel_count) * 100.0f;
+
+				min_proportion_converged = std::min(min_proportion_converged, proportion_converged);
+				stop_percentage = device_renderer.get_render_settings().stop_pixel_percentage_converged;
+			});
+
+			if (min_proportion_converged > stop_percentage)
+				break;
+		}
+
+		int sample_number = renderer.get_sample_number();
+		bool progress_due = job.progress_interval > 0 && sample_number - last_progress_sample_number >= job.progress_interval && sample_number < job.samples;
+		if (progress_due && std::chrono::high_resolution_clock::now() >= next_progress_time)
+		{
+			std::chrono::high_resolution_clock::time_point start_send = std::chrono::high_resolution_clock::now();
+			size_t sent_bytes = 0;
+			if (!send_progress(renderer, job, tile_encoder, sample_number, sent_bytes))
+				return false;
+			std::chrono::high_resolution_clock::time_point stop_send = std::chrono::high_resolution_clock::now();
+
+			// The socket blocks once its buffer is full so the time spent sending follows the throughput of the connection
+			std::chrono::duration<double> delay = stop_send - start_send;
+			if (job.max_bandwidth > 0.0f)
+				delay = std::chrono::duration<double>(sent_bytes / (job.max_bandwidth * 1024.0));
+			next_progress_time = stop_send + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(delay);
+
+			last_progress_sample_number = sample_number;
+		}
+	}
+
+	Image32Bit final_image = renderer.download_framebuffer();
+	long long render_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_render).count();
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Job %d: %d samples rendered in %lldms", job.job_id, renderer.get_sample_number(), render_time_ms);
+
+	if (!job.output_file_path.empty())
+	{
+		bool written;
+		if (std::filesystem::path(job.output_file_path).extension() == ".exr")
+		{
+			EXRLayer beauty;
+			beauty.channel_names = { "R", "G", "B" };
+			beauty.pixels = final_image.data();
+
+			written = write_image_exr(job.output_file_path.c_str(), final_image.width, final_image.height, { beauty });
+		}
+		else
+			written = final_image.write_image_hdr(job.output_file_path.c_str());
+
+		if (!written)
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the render of the job %d to %s", job.job_id, job.output_file_path.c_str());
+	}
+
+	std::string header = "done " + std::to_string(job.job_id) + " " + std::to_string(renderer.get_sample_number()) + " " + std::to_string(render_time_ms);
+
+	if (!send_image(job.client_socket, header, final_image))
+		return false;
+
+	if (!job.send_sample_counts)
+		return true;
+
+	std::vector<int> sample_counts = renderer.download_pixel_sample_counts();
+	size_t byte_count = sample_counts.size() * sizeof(int);
+
+	std::stringstream line;
+	line << "sample_counts " << job.job_id << " " << final_image.width << " " << final_image.height << " " << byte_count;
+
+	return send_line(job.client_socket, line.str()) && send_all(job.client_socket, sample_counts.data(), byte_count);
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "Image/Image.h"
+#include "Image/ProgressiveTileEncoder.h"
+#include "Scene/SceneParser.h"
+#include "Utils/CommandlineArguments.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+class MultiGPURenderer;
+
+/**
+ * Render job of a client of the RenderServer, parsed from its "render" request
+ */
+struct RenderServerJob
+{
+	int job_id = -1;
+	// Socket of the client the results of the job are sent to.
+	// Owned by the job, closed once the job is done
+	std::intptr_t client_socket = -1;
+
+	int width = 0, height = 0;
+	int samples = 0;
+	int bounces = 0;
+	// If > 0, stop_pixel_percentage_converged of the pixels reaching this threshold stops the job
+	float noise_threshold = 0.0f;
+
+	// The camera of the scene is used for what isn't given by the client
+	bool has_camera_position = false;
+	float camera_position[3] = { 0.0f, 0.0f, 0.0f };
+	bool has_camera_rotation = false;
+	// Quaternion w, x, y, z
+	float camera_rotation[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+	// Rotation of the envmap around the vertical axis in turns
+	float envmap_rotation = 0.0f;
+
+	// Number of samples between two progressive results sent to the client. 0 to only send the final result
+	int progress_interval = 0;
+	// If true, the progressive results are sent as the JPEG tiles that changed since the last
+	// progressive result (see ProgressiveTileEncoder) instead of the full float framebuffer
+	bool stream_tiles = false;
+	int jpeg_quality = 80;
+	// Maximum bandwidth in KB/s of the progressive results. 0 to adapt the rate of the
+	// progressive results to the measured throughput of the connection instead
+	float max_bandwidth = 0.0f;
+	// If not empty, the final result is also written to that path on the server (EXR or HDR)
+	std::string output_file_path;
+
+	// Seed of the random number generators of the renderers, the default one if not given.
+	// Different seeds render different samples, see DistributedRenderCoordinator
+	bool has_seed = false;
+	unsigned int seed = 42;
+	// If true, "done" is followed by the sample count of each pixel
+	bool send_sample_counts = false;
+};
+
+/**
+ * Long-running render server: the scene, its BVH, textures and the kernels are built once
+ * at startup and stay resident on the devices for all the jobs, which only pay for their samples.
+ *
+ * The application started with PORT_COMMANDLINE_ARGUMENT listens on that TCP port (on ADDRESS_COMMANDLINE_ARGUMENT,
+ * 127.0.0.1 by default) for text requests, one per connection, terminated by a new line:
+ *	- "render key=value key=value ...": queues a render job, see parse_job() for the keys
+ *	- "status": replies "status <queued job count> <id of the job rendering or -1>"
+ *	- "quit": stops the server once the queued jobs are done
+ *
+ * A render request is answered on its connection by:
+ *	- "queued <job id> <position in the queue>"
+ *	- "progress <job id> <samples> <width> <height> <byte count>" every 'progress_interval' samples at most
+ *	- or, with 'stream_tiles', "tiles <job id> <samples> <tile count>" followed by one
+ *	  "tile <x> <y> <width> <height> <byte count>" line and the JPEG bytes per changed tile
+ *	- "done <job id> <samples> <render time ms> <width> <height> <byte count>"
+ *	- "error <message>" if the request is invalid
+ *	- with 'send_sample_counts', "sample_counts <job id> <width> <height> <byte count>" after the "done" result
+ * The "progress" and "done" lines are followed by <byte count> bytes of 32 bit float RGB pixels,
+ * rows from the bottom of the image to the top. "sample_counts" is followed by the 32 bit integer sample
+ * count of each pixel, in the same order. The connection is closed after "done" (and its sample counts) or "error".
+ *
+ * The progressive results are rate limited on top of 'progress_interval' so that they don't take more
+ * than 'max_bandwidth' or, if it's 0, so that sending them keeps the connection busy at most half of the time
+ *
+ * The connections are accepted and the requests parsed by a thread while the jobs are rendered one after
+ * the other, in the order they were queued, on the main thread. A job whose client disconnected is cancelled
+ */
+class RenderServer
+{
+public:
+	static const std::string PORT_COMMANDLINE_ARGUMENT;
+	static const std::string ADDRESS_COMMANDLINE_ARGUMENT;
+
+	/**
+	 * Runs the server on 'scene' until a "quit" request and returns the exit code of the application
+	 */
+	static int run(const CommandlineArguments& arguments, const Scene& scene, const Image32Bit& envmap);
+
+	/**
+	 * Parses the "key=value" pairs of a render request into 'out_job'. The keys are:
+	 * width, height, samples, bounces, noise_threshold, camera_position=x,y,z, camera_rotation=w,x,y,z,
+	 * envmap_rotation, progress_interval, stream=raw|tiles, jpeg_quality, max_bandwidth, output, seed and sample_counts=0|1.
+	 * The values not given are the ones of 'arguments'.
+	 *
+	 * Returns false with the reason in 'out_error' if the request is invalid
+	 */
+	static bool parse_job(const std::string& request, const CommandlineArguments& arguments, RenderServerJob& out_job, std::string& out_error);
+
+private:
+	RenderServer(const CommandlineArguments& arguments, const Scene& scene);
+
+	/**
+	 * Accepts the connections and queues their jobs until 'm_quit_requested'. Runs on the RENDER_SERVER_LISTEN_THREAD_KEY thread
+	 */
+	void listen_loop();
+	/**
+	 * Reads the request of 'client_socket' and answers it, queuing its job if it's a render request
+	 */
+	void handle_request(std::intptr_t client_socket);
+
+	/**
+	 * Renders 'job' on 'renderer' and sends its results. Returns false if the client disconnected
+	 */
+	bool render_job(MultiGPURenderer& renderer, RenderServerJob& job);
+	/**
+	 * Sends the progressive result of 'job' at 'sample_number' samples, 'tile_encoder' is used if the job
+	 * streams tiles. The number of bytes sent is added to 'out_sent_bytes'. Returns false if the client disconnected
+	 */
+	bool send_progress(MultiGPURenderer& renderer, const RenderServerJob& job, ProgressiveTileEncoder& tile_encoder, int sample_number, size_t& out_sent_bytes);
+	/**
+	 * Sets the camera, envmap and render settings of 'job' on all the renderers of 'renderer'
+	 */
+	void setup_job(MultiGPURenderer& renderer, const RenderServerJob& job);
+
+	const CommandlineArguments& m_arguments;
+	const Scene& m_scene;
+
+	std::intptr_t m_listen_socket = -1;
+	int m_current_width = 0, m_current_height = 0;
+
+	// Protects everything below
+	std::mutex m_queue_mutex;
+	std::condition_variable m_queue_condition;
+	std::deque<RenderServerJob> m_job_queue;
+	int m_next_job_id = 0;
+	int m_rendering_job_id = -1;
+	bool m_quit_requested = false;
+};
+
+#endif
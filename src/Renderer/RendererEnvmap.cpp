@@ -6,48 +6,174 @@
 #include "Image/Image.h"
 #include "Renderer/GPURenderer.h"
 #include "Renderer/RendererEnvmap.h"
+#include "UI/ImGui/ImGuiLogger.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include "glm/gtx/euler_angles.hpp"
 
-void RendererEnvmap::init_from_image(const Image32Bit& image, const std::string& envmap_filepath)
+extern ImGuiLogger g_imgui_logger;
+
+void RendererEnvmap::init_from_image(GPURenderer* renderer, const Image32Bit& image, const std::string& envmap_filepath)
 {
-	m_orochi_envmap.init_from_image(image);
+	get_orochi_envmap().init_from_image(image, renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_STORAGE_FORMAT));
 	m_envmap_filepath = envmap_filepath;
 }
 
+void RendererEnvmap::reload_envmap_storage(GPURenderer* renderer)
+{
+	get_orochi_envmap().init_from_image(Image32Bit::read_image_hdr(m_envmap_filepath, 3, true), renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_STORAGE_FORMAT));
+
+	update_renderer(renderer);
+}
+
+void RendererEnvmap::prepare_pending_envmap(GPURenderer* renderer, const std::string& envmap_filepath)
+{
+	m_pending_envmap_loading = true;
+	m_pending_envmap_ready = false;
+
+	Image32Bit envmap_image = Image32Bit::read_image_hdr(envmap_filepath, 3, true);
+	if (envmap_image.width == 0 || envmap_image.height == 0)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not read the envmap \"%s\". Keeping the current envmap.", envmap_filepath.c_str());
+
+		m_pending_envmap_loading = false;
+
+		return;
+	}
+
+	GPUKernelCompilerOptions* options = renderer->get_global_compiler_options().get();
+	m_pending_envmap_sampling_strategy = options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY);
+	m_pending_envmap_compact_alias_table = options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_COMPACT_ALIAS_TABLE);
+	m_pending_envmap_storage_format = options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_STORAGE_FORMAT);
+	m_pending_envmap_sampling_downscale = sampling_downscale;
+
+	// The slot that the renderer isn't using. The index doesn't change until
+	// the pending envmap is ready
+	OrochiEnvmap& pending_envmap = m_orochi_envmaps[1 - m_current_envmap_index];
+	pending_envmap.init_from_image(envmap_image, m_pending_envmap_storage_format);
+	compute_sampling_data_structure(renderer, pending_envmap, &envmap_image);
+
+	m_pending_envmap_filepath = envmap_filepath;
+	m_pending_envmap_ready = true;
+}
+
+bool RendererEnvmap::is_pending_envmap_loading() const
+{
+	return m_pending_envmap_loading;
+}
+
 void RendererEnvmap::update(GPURenderer* renderer)
 {
+	// update() is called between two frames so no frame is using
+	// the current envmap anymore
+	if (m_pending_envmap_ready)
+		swap_pending_envmap(renderer);
+
 	do_animation(renderer);
 
 	// Updates the data/pointers in WorldSettings that the shaders will use
 	update_renderer(renderer);
 }
 
+void RendererEnvmap::swap_pending_envmap(GPURenderer* renderer)
+{
+	m_current_envmap_index = 1 - m_current_envmap_index;
+	m_envmap_filepath = m_pending_envmap_filepath;
+
+	m_pending_envmap_ready = false;
+	m_pending_envmap_loading = false;
+
+	// The options of the envmap may have been changed in the UI while the
+	// pending envmap was prepared with the old ones
+	GPUKernelCompilerOptions* options = renderer->get_global_compiler_options().get();
+	if (m_pending_envmap_storage_format != options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_STORAGE_FORMAT))
+		reload_envmap_storage(renderer);
+	if (m_pending_envmap_sampling_strategy != options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY)
+		|| m_pending_envmap_compact_alias_table != options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_COMPACT_ALIAS_TABLE)
+		|| m_pending_envmap_sampling_downscale != sampling_downscale)
+		recompute_sampling_data_structure(renderer);
+
+	// The pointers are set by update_renderer()
+	renderer->get_world_settings().envmap_width = get_orochi_envmap().width;
+	renderer->get_world_settings().envmap_height = get_orochi_envmap().height;
+	renderer->get_world_settings().ambient_light_type = AmbientLightType::ENVMAP;
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Envmap \"%s\" swapped in.", m_envmap_filepath.c_str());
+}
+
 void RendererEnvmap::recompute_sampling_data_structure(GPURenderer* renderer, const Image32Bit* image)
 {
-	if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_NO_SAMPLING)
+	int envmap_sampling_strategy = renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY);
+
+	Image32Bit envmap_image;
+	if (image == nullptr && envmap_sampling_strategy != ESS_NO_SAMPLING)
 	{
-		m_orochi_envmap.free_cdf();
-		m_orochi_envmap.free_alias_table();
+		envmap_image = Image32Bit::read_image_hdr(m_envmap_filepath, 3, true);
+		image = &envmap_image;
 	}
-	else if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_BINARY_SEARCH)
+
+	compute_sampling_data_structure(renderer, get_orochi_envmap(), image);
+}
+
+void RendererEnvmap::compute_sampling_data_structure(GPURenderer* renderer, OrochiEnvmap& orochi_envmap, const Image32Bit* image)
+{
+	int envmap_sampling_strategy = renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY);
+	if (envmap_sampling_strategy == ESS_NO_SAMPLING)
+	{
+		orochi_envmap.free_cdf();
+		orochi_envmap.free_alias_table();
+		orochi_envmap.free_marginal_conditional_cdf();
+		orochi_envmap.free_luminance_pyramid();
+		orochi_envmap.upload_importance_map(nullptr);
+
+		return;
+	}
+
+	// The sampling data structures are computed on the downscaled importance map, if any. The
+	// product sampling pyramid integrates the envmap itself, with its own resolution
+	const Image32Bit* importance_map = image;
+	Image32Bit downscaled_importance_map;
+	if (sampling_downscale > 1)
 	{
-		if (image != nullptr)
-			m_orochi_envmap.compute_cdf(*image);
-		else
-			m_orochi_envmap.compute_cdf(Image32Bit::read_image_hdr(m_envmap_filepath, 4, true));
+		downscaled_importance_map = image->compute_downscaled_luminance(sampling_downscale);
+		importance_map = &downscaled_importance_map;
+	}
+	orochi_envmap.upload_importance_map(sampling_downscale > 1 ? importance_map : nullptr);
+
+	if (envmap_sampling_strategy == ESS_BINARY_SEARCH)
+	{
+		orochi_envmap.compute_cdf(*importance_map);
+
+		orochi_envmap.free_alias_table();
+		orochi_envmap.free_marginal_conditional_cdf();
+		orochi_envmap.free_luminance_pyramid();
+	}
+	else if (envmap_sampling_strategy == ESS_ALIAS_TABLE)
+	{
+		bool compact_probabilities = renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_COMPACT_ALIAS_TABLE) == KERNEL_OPTION_TRUE;
+		orochi_envmap.compute_alias_table(*importance_map, compact_probabilities);
 
-		m_orochi_envmap.free_alias_table();
+		orochi_envmap.free_cdf();
+		orochi_envmap.free_marginal_conditional_cdf();
+		orochi_envmap.free_luminance_pyramid();
 	}
-	else if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_ALIAS_TABLE)
+	else if (envmap_sampling_strategy == ESS_MARGINAL_CONDITIONAL)
 	{
-		if (image != nullptr)
-			m_orochi_envmap.compute_alias_table(*image);
-		else
-			m_orochi_envmap.compute_alias_table(Image32Bit::read_image_hdr(m_envmap_filepath, 4, true));
+		orochi_envmap.compute_marginal_conditional_cdf(*importance_map);
 
-		m_orochi_envmap.free_cdf();
+		orochi_envmap.free_cdf();
+		orochi_envmap.free_alias_table();
+		orochi_envmap.free_luminance_pyramid();
+	}
+	else if (envmap_sampling_strategy == ESS_PRODUCT_SAMPLING)
+	{
+		// The alias table is used for the envmap samples that have no BSDF to do the product with
+		bool compact_probabilities = renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_COMPACT_ALIAS_TABLE) == KERNEL_OPTION_TRUE;
+		orochi_envmap.compute_alias_table(*importance_map, compact_probabilities);
+		orochi_envmap.compute_luminance_pyramid(*image);
+
+		orochi_envmap.free_cdf();
+		orochi_envmap.free_marginal_conditional_cdf();
 	}
 }
 
@@ -100,6 +226,14 @@ void RendererEnvmap::update_renderer(GPURenderer* renderer)
 {
 	renderer->get_world_settings().envmap_to_world_matrix = envmap_to_world_matrix;
 	renderer->get_world_settings().world_to_envmap_matrix = world_to_envmap_matrix;
+	renderer->get_world_settings().envmap = get_orochi_envmap().get_device_envmap();
+	// Only set for the alias table strategy with compact probabilities
+	renderer->get_world_settings().alias_table_probas_16bit = nullptr;
+	// Only set for the product sampling strategy
+	renderer->get_world_settings().envmap_luminance_pyramid = nullptr;
+	renderer->get_world_settings().envmap_sampling_width = get_orochi_envmap().get_importance_map_width();
+	renderer->get_world_settings().envmap_sampling_height = get_orochi_envmap().get_importance_map_height();
+	renderer->get_world_settings().envmap_sampling_luminance = get_orochi_envmap().get_importance_map_luminance_device_pointer();
 
 	if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_NO_SAMPLING)
 	{
@@ -107,25 +241,57 @@ void RendererEnvmap::update_renderer(GPURenderer* renderer)
 
 		renderer->get_world_settings().alias_table_probas = nullptr;
 		renderer->get_world_settings().alias_table_alias = nullptr;
+
+		renderer->get_world_settings().envmap_marginal_cdf = nullptr;
+		renderer->get_world_settings().envmap_conditional_cdfs = nullptr;
 	}
 	else if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_BINARY_SEARCH)
 	{
-		renderer->get_world_settings().envmap_cdf = m_orochi_envmap.get_cdf_device_pointer();
-		renderer->get_world_settings().envmap_total_sum = m_orochi_envmap.get_luminance_total_sum();
+		renderer->get_world_settings().envmap_cdf = get_orochi_envmap().get_cdf_device_pointer();
+		renderer->get_world_settings().envmap_total_sum = get_orochi_envmap().get_luminance_total_sum();
 
 		renderer->get_world_settings().alias_table_probas = nullptr;
 		renderer->get_world_settings().alias_table_alias = nullptr;
+
+		renderer->get_world_settings().envmap_marginal_cdf = nullptr;
+		renderer->get_world_settings().envmap_conditional_cdfs = nullptr;
 	}
-	else if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_ALIAS_TABLE)
+	else if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_ALIAS_TABLE
+		|| renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_PRODUCT_SAMPLING)
 	{
 		renderer->get_world_settings().envmap_cdf = nullptr;
-		renderer->get_world_settings().envmap_total_sum = m_orochi_envmap.get_luminance_total_sum();
+		renderer->get_world_settings().envmap_total_sum = get_orochi_envmap().get_luminance_total_sum();
+
+		get_orochi_envmap().get_alias_table_device_pointers(renderer->get_world_settings().alias_table_probas, renderer->get_world_settings().alias_table_alias);
+		renderer->get_world_settings().alias_table_probas_16bit = get_orochi_envmap().get_alias_table_16bit_probas_device_pointer();
 
-		m_orochi_envmap.get_alias_table_device_pointers(renderer->get_world_settings().alias_table_probas, renderer->get_world_settings().alias_table_alias);
+		renderer->get_world_settings().envmap_marginal_cdf = nullptr;
+		renderer->get_world_settings().envmap_conditional_cdfs = nullptr;
+
+		if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_PRODUCT_SAMPLING)
+		{
+			renderer->get_world_settings().envmap_luminance_pyramid = get_orochi_envmap().get_luminance_pyramid_device_pointer();
+			renderer->get_world_settings().envmap_luminance_pyramid_leaf_level = get_orochi_envmap().get_luminance_pyramid_leaf_level();
+		}
 	}
+	else if (renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_MARGINAL_CONDITIONAL)
+	{
+		renderer->get_world_settings().envmap_cdf = nullptr;
+		renderer->get_world_settings().envmap_total_sum = get_orochi_envmap().get_luminance_total_sum();
+
+		renderer->get_world_settings().alias_table_probas = nullptr;
+		renderer->get_world_settings().alias_table_alias = nullptr;
+
+		get_orochi_envmap().get_marginal_conditional_cdf_device_pointers(renderer->get_world_settings().envmap_marginal_cdf, renderer->get_world_settings().envmap_conditional_cdfs);
+	}
+}
+
+const std::string& RendererEnvmap::get_envmap_filepath() const
+{
+	return m_envmap_filepath;
 }
 
 OrochiEnvmap& RendererEnvmap::get_orochi_envmap()
 {
-	return m_orochi_envmap;
+	return m_orochi_envmaps[m_current_envmap_index];
 }
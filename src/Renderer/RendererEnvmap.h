@@ -8,6 +8,8 @@
 
 #include "HIPRT-Orochi/OrochiEnvmap.h"
 
+#include <atomic>
+
 class GPURenderer;
 
 class RendererEnvmap
@@ -23,6 +25,12 @@ public:
 	float animation_speed_Y = 8.0f;
 	float animation_speed_Z = 0.0f;
 
+	// The CDF / alias table / ... of the envmap are computed on an importance map
+	// downscaled by this factor in each dimension (the luminance of its texels is the average
+	// of the envmap texels they cover). The envmap itself is still looked up at full resolution.
+	// Requires recompute_sampling_data_structure() when changed
+	int sampling_downscale = 4;
+
 	float4x4 envmap_to_world_matrix;
 	float4x4 world_to_envmap_matrix;
 
@@ -32,9 +40,32 @@ public:
 	 * since we do not keep the data of the envmap in memory (envmaps can be quite big), 
 	 * we'll have to read it again from the disk)
 	 */
-	void init_from_image(const Image32Bit& image, const std::string& envmap_filepath);
+	void init_from_image(GPURenderer* renderer, const Image32Bit& image, const std::string& envmap_filepath);
+
+	/**
+	 * Reads the envmap from the disk again and uploads it to the GPU in the
+	 * envmap storage format (EnvmapStorageFormat) currently used by the renderer
+	 * and updates the world settings of the renderer accordingly
+	 */
+	void reload_envmap_storage(GPURenderer* renderer);
 
 	/**
+	 * Reads the envmap at 'envmap_filepath' from the disk, uploads it and computes its sampling
+	 * data structure in the envmap slot that the renderer isn't using.
+	 * 
+	 * Meant to be called on a background thread (see GPURenderer::load_envmap_async()): the frames keep
+	 * rendering with the current envmap in the meantime and update() swaps the two slots at the next
+	 * frame boundary, once the new envmap is ready.
+	 */
+	void prepare_pending_envmap(GPURenderer* renderer, const std::string& envmap_filepath);
+
+	/**
+	 * Whether an envmap is being prepared by prepare_pending_envmap() and hasn't been swapped in yet
+	 */
+	bool is_pending_envmap_loading() const;
+
+	/**
+	 * - Swaps in the envmap prepared by prepare_pending_envmap(), if it is ready
 	 * - Updates the animation of the envmap
 	 * - Recomputes the sampling data structure (CDF for binary search sampling, 
 	 *		alias table for alias table sampling) if necessary
@@ -49,6 +80,8 @@ public:
 	 */
 	void recompute_sampling_data_structure(GPURenderer* renderer, const Image32Bit* = nullptr);
 
+	const std::string& get_envmap_filepath() const;
+
 	OrochiEnvmap& get_orochi_envmap();
 
 private:
@@ -59,6 +92,17 @@ private:
 		*/
 	void do_animation(GPURenderer* renderer);
 
+	/**
+	 * Computes the sampling data structure of 'image' into 'orochi_envmap' for the
+	 * envmap sampling strategy currently used by the renderer
+	 */
+	void compute_sampling_data_structure(GPURenderer* renderer, OrochiEnvmap& orochi_envmap, const Image32Bit& image);
+
+	/**
+	 * Makes the pending envmap the envmap used by the renderer
+	 */
+	void swap_pending_envmap(GPURenderer* renderer);
+
 	/**
 	 * Updates the world settings, envmap itself, etc... of the renderer
 	 */
@@ -72,8 +116,26 @@ private:
 
 	std::string m_envmap_filepath;
 
-	// This object contains the memory data of the envmap
-	OrochiEnvmap m_orochi_envmap;
+	// The memory data of the envmaps. m_orochi_envmaps[m_current_envmap_index] is the envmap
+	// used by the renderer, the other slot is where prepare_pending_envmap() uploads the next envmap
+	// while the frames keep rendering with the current one.
+	//
+	// The previous envmap stays in its slot after a swap and is only freed (reallocated) by the next
+	// prepare_pending_envmap(), once no frame uses it anymore
+	OrochiEnvmap m_orochi_envmaps[2];
+	int m_current_envmap_index = 0;
+
+	std::string m_pending_envmap_filepath;
+	// Envmap sampling strategy, importance map downscale, compact alias table option and storage format
+	// that the pending envmap was prepared with. If one of them changed while the pending envmap was
+	// being prepared, the pending envmap is fixed when swapped in
+	int m_pending_envmap_sampling_strategy = -1;
+	int m_pending_envmap_sampling_downscale = -1;
+	int m_pending_envmap_compact_alias_table = -1;
+	int m_pending_envmap_storage_format = -1;
+
+	std::atomic<bool> m_pending_envmap_loading = false;
+	std::atomic<bool> m_pending_envmap_ready = false;
 };
 
 #endif
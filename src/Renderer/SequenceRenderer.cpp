@@ -0,0 +1,206 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Image/EXRWriter.h"
+#include "Renderer/GPURenderer.h"
+#include "Renderer/MultiGPURenderer.h"
+#include "Renderer/SequenceRenderer.h"
+#include "Threads/ThreadManager.h"
+#include "UI/ImGui/ImGuiLogger.h"
+#include "Utils/Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+
+#include <glm/gtc/quaternion.hpp>
+
+extern ImGuiLogger g_imgui_logger;
+
+const std::string SequenceRenderer::FRAMES_COMMANDLINE_ARGUMENT = "--sequence-frames=";
+const std::string SequenceRenderer::MODE_COMMANDLINE_ARGUMENT = "--sequence-mode=";
+const std::string SequenceRenderer::SWEEP_COMMANDLINE_ARGUMENT = "--sequence-sweep=";
+const std::string SequenceRenderer::OUTPUT_COMMANDLINE_ARGUMENT = "--sequence-output=";
+const std::string SequenceRenderer::NOISE_THRESHOLD_COMMANDLINE_ARGUMENT = "--sequence-noise-threshold=";
+const std::string SequenceRenderer::DENOISE_COMMANDLINE_ARGUMENT = "--sequence-denoise";
+
+int SequenceRenderer::run(const CommandlineArguments& arguments, const Scene& scene, const Image32Bit& envmap)
+{
+	MultiGPURenderer renderer(arguments.gpu_indices, static_cast<MultiGPURenderer::SplitMode>(arguments.multi_gpu_mode));
+	renderer.set_envmap(envmap, arguments.skysphere_file_path);
+	renderer.set_camera(scene.camera);
+	renderer.resize(arguments.render_width, arguments.render_height);
+	renderer.set_bvh_build_quality(static_cast<BVHBuildQuality>(arguments.bvh_build_quality));
+	renderer.set_half_precision_texcoords(arguments.half_precision_texcoords);
+	renderer.set_quantized_vertices_positions(arguments.quantized_vertices_positions);
+	renderer.set_compact_bvh(arguments.compact_bvh);
+	renderer.set_scene(scene);
+	renderer.for_each_renderer([&arguments](GPURenderer& device_renderer) {
+		HIPRTRenderSettings& render_settings = device_renderer.get_render_settings();
+
+		render_settings.nb_bounces = arguments.bounces;
+		if (arguments.sequence_noise_threshold > 0.0f)
+		{
+			render_settings.enable_pixel_stop_noise_threshold = true;
+			render_settings.stop_pixel_noise_threshold = arguments.sequence_noise_threshold;
+		}
+	});
+
+	ThreadManager::join_all_threads();
+
+	std::shared_ptr<ApplicationSettings> application_settings = std::make_shared<ApplicationSettings>();
+
+	std::chrono::high_resolution_clock::time_point start_sequence = std::chrono::high_resolution_clock::now();
+	for (int frame = 0; frame < arguments.sequence_frames; frame++)
+	{
+		// Not repeating the first frame at the end of a full turn so that the sequence loops
+		float angle_degrees = arguments.sequence_sweep_degrees * frame / static_cast<float>(arguments.sequence_frames);
+		if (std::abs(arguments.sequence_sweep_degrees) < 360.0f && arguments.sequence_frames > 1)
+			// Partial sweeps go from one end to the other
+			angle_degrees = arguments.sequence_sweep_degrees * frame / static_cast<float>(arguments.sequence_frames - 1);
+
+		SequenceRenderer::setup_frame(renderer, arguments, scene, angle_degrees);
+
+		renderer.reset(application_settings);
+		renderer.for_each_renderer([](GPURenderer& device_renderer) {
+			device_renderer.get_render_settings().samples_per_frame = 1;
+		});
+
+		std::chrono::high_resolution_clock::time_point start_frame = std::chrono::high_resolution_clock::now();
+		SequenceRenderer::render_frame(renderer, arguments);
+		std::chrono::high_resolution_clock::time_point stop_frame = std::chrono::high_resolution_clock::now();
+
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Frame %d/%d: %d samples rendered in %ldms", frame + 1, arguments.sequence_frames, renderer.get_sample_number(), std::chrono::duration_cast<std::chrono::milliseconds>(stop_frame - start_frame).count());
+
+		Image32Bit frame_image = renderer.download_framebuffer();
+
+		// The previous frame must be written before its thread is reused. This is also what
+		// bounds the memory of the pipeline to one frame in flight
+		ThreadManager::join_threads(ThreadManager::SEQUENCE_FRAME_WRITE_THREAD_KEY);
+		ThreadManager::start_thread(ThreadManager::SEQUENCE_FRAME_WRITE_THREAD_KEY, SequenceRenderer::write_frame, frame_image, SequenceRenderer::get_frame_file_path(arguments.sequence_output_pattern, frame), arguments.sequence_denoise, frame, arguments.sequence_frames);
+	}
+	ThreadManager::join_threads(ThreadManager::SEQUENCE_FRAME_WRITE_THREAD_KEY);
+
+	std::chrono::high_resolution_clock::time_point stop_sequence = std::chrono::high_resolution_clock::now();
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Sequence of %d frames rendered in %lds", arguments.sequence_frames, std::chrono::duration_cast<std::chrono::seconds>(stop_sequence - start_sequence).count());
+
+	return 0;
+}
+
+std::string SequenceRenderer::get_frame_file_path(const std::string& output_pattern, int frame_index)
+{
+	if (output_pattern.find('%') == std::string::npos)
+	{
+		std::filesystem::path path(output_pattern);
+
+		char frame_suffix[16];
+		std::snprintf(frame_suffix, sizeof(frame_suffix), "_%04d", frame_index);
+
+		return (path.parent_path() / (path.stem().string() + frame_suffix + path.extension().string())).string();
+	}
+
+	int length = std::snprintf(nullptr, 0, output_pattern.c_str(), frame_index);
+	std::string file_path(std::max(0, length), '\0');
+	std::snprintf(file_path.data(), file_path.size() + 1, output_pattern.c_str(), frame_index);
+
+	return file_path;
+}
+
+void SequenceRenderer::setup_frame(MultiGPURenderer& renderer, const CommandlineArguments& arguments, const Scene& scene, float angle_degrees)
+{
+	if (arguments.sequence_mode == SEQUENCE_MODE_ENVMAP_ROTATION)
+	{
+		renderer.for_each_renderer([angle_degrees](GPURenderer& device_renderer) {
+			// The rotations of the envmap are in turns, applied by the next GPURenderer::update()
+			float rotation = angle_degrees / 360.0f;
+			device_renderer.get_envmap().rotation_Y = rotation - std::floor(rotation);
+		});
+
+		return;
+	}
+
+	// Orbiting the camera around the vertical axis through the center of the scene
+	float3 scene_center = (scene.scene_bounding_box.mini + scene.scene_bounding_box.maxi) * 0.5f;
+	glm::vec3 pivot = glm::vec3(scene_center.x, scene_center.y, scene_center.z);
+	glm::quat orbit_rotation = glm::angleAxis(glm::radians(angle_degrees), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	glm::vec3 translation = pivot + orbit_rotation * (scene.camera.translation - pivot);
+	glm::quat rotation = orbit_rotation * scene.camera.rotation;
+
+	renderer.for_each_renderer([&translation, &rotation](GPURenderer& device_renderer) {
+		// Only the view changes, the projection and the crop of the band of the device
+		// (split frame) are left untouched so the renderers don't need to be resized
+		Camera& camera = device_renderer.get_camera();
+		camera.translation = translation;
+		camera.rotation = rotation;
+	});
+}
+
+void SequenceRenderer::render_frame(MultiGPURenderer& renderer, const CommandlineArguments& arguments)
+{
+	while (renderer.get_sample_number() < arguments.render_samples)
+	{
+		if (!renderer.render())
+			// All the pixels have converged (adaptive sampling)
+			return;
+
+		if (arguments.sequence_noise_threshold <= 0.0f)
+			continue;
+
+		// The frame is done once enough pixels of every device reached the noise threshold
+		float min_proportion_converged = 100.0f;
+		float stop_percentage = 0.0f;
+		renderer.for_each_renderer([&min_proportion_converged, &stop_percentage](GPURenderer& device_renderer) {
+			int pixel_count = device_renderer.m_render_resolution.x * device_renderer.m_render_resolution.y;
+			float proportion_converged = device_renderer.get_status_buffer_values().pixel_converged_count / static_cast<float>(pixel_count) * 100.0f;
+
+			min_proportion_converged = std::min(min_proportion_converged, proportion_converged);
+			stop_percentage = device_renderer.get_render_settings().stop_pixel_percentage_converged;
+		});
+
+		if (min_proportion_converged > stop_percentage)
+			return;
+	}
+}
+
+void SequenceRenderer::write_frame(Image32Bit frame, std::string file_path, bool denoise, int frame_index, int frame_count)
+{
+	Image32Bit denoised;
+	if (denoise)
+		// Only the denoised image
+		denoised = Utils::OIDN_denoise(frame, frame.width, frame.height, 1.0f);
+
+	bool written;
+	if (std::filesystem::path(file_path).extension() == ".exr")
+	{
+		std::vector<EXRLayer> layers;
+
+		EXRLayer beauty;
+		beauty.channel_names = { "R", "G", "B" };
+		beauty.pixels = frame.data();
+		layers.push_back(beauty);
+
+		if (denoised.width > 0)
+		{
+			EXRLayer denoised_layer;
+			denoised_layer.name = "denoised";
+			denoised_layer.channel_names = { "R", "G", "B" };
+			denoised_layer.pixels = denoised.data();
+			layers.push_back(denoised_layer);
+		}
+
+		written = write_image_exr(file_path.c_str(), frame.width, frame.height, layers);
+	}
+	else
+		// The formats without layers get the denoised image instead of the noisy one
+		written = (denoised.width > 0 ? denoised : frame).write_image_hdr(file_path.c_str());
+
+	if (written)
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Frame %d/%d written to %s", frame_index + 1, frame_count, file_path.c_str());
+	else
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the frame %d to %s", frame_index + 1, file_path.c_str());
+}
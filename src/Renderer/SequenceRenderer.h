@@ -0,0 +1,75 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef SEQUENCE_RENDERER_H
+#define SEQUENCE_RENDERER_H
+
+#include "Image/Image.h"
+#include "Scene/SceneParser.h"
+#include "Utils/CommandlineArguments.h"
+
+#include <string>
+
+class MultiGPURenderer;
+
+/**
+ * Batch rendering of an image sequence without any window: turntables for look-dev and lighting sweeps.
+ *
+ * The application started with --headless and FRAMES_COMMANDLINE_ARGUMENT renders 'sequence_frames' frames of the
+ * scene, on all the devices of --gpus as the single image headless render does. The scene, its BVH, textures and the
+ * kernels are built once and reused by all the frames, only the camera or the envmap change between two frames:
+ *	- SEQUENCE_MODE_CAMERA_ORBIT: the camera of the scene orbits around the vertical axis going through the center of the scene
+ *	- SEQUENCE_MODE_ENVMAP_ROTATION: the envmap rotates around the vertical axis (RendererEnvmap::rotation_Y)
+ *
+ * The frames are spread over 'sequence_sweep_degrees' without repeating the first one at the end so that a 360 degrees
+ * turntable loops.
+ *
+ * Each frame renders until 'render_samples' samples, the convergence of all the pixels (adaptive sampling) or,
+ * if 'sequence_noise_threshold' is > 0, until stop_pixel_percentage_converged of the pixels reached that noise threshold.
+ *
+ * The output of the frames is pipelined with the rendering: once a frame is downloaded, it is denoised (CPU OIDN, if
+ * 'sequence_denoise') and written to disk by a thread while the devices already render the next frame. That thread is
+ * joined before the output of the next frame starts so that at most one frame is kept in memory besides the one rendering
+ */
+class SequenceRenderer
+{
+public:
+	static const std::string FRAMES_COMMANDLINE_ARGUMENT;
+	static const std::string MODE_COMMANDLINE_ARGUMENT;
+	static const std::string SWEEP_COMMANDLINE_ARGUMENT;
+	static const std::string OUTPUT_COMMANDLINE_ARGUMENT;
+	static const std::string NOISE_THRESHOLD_COMMANDLINE_ARGUMENT;
+	static const std::string DENOISE_COMMANDLINE_ARGUMENT;
+
+	static constexpr int SEQUENCE_MODE_CAMERA_ORBIT = 0;
+	static constexpr int SEQUENCE_MODE_ENVMAP_ROTATION = 1;
+
+	/**
+	 * Renders the sequence of 'scene' and returns the exit code of the application
+	 */
+	static int run(const CommandlineArguments& arguments, const Scene& scene, const Image32Bit& envmap);
+
+	/**
+	 * Path of the frame 'frame_index' of the sequence: 'output_pattern' formatted with printf with the index of the
+	 * frame or, if the pattern doesn't contain any '%', the index of the frame appended before the extension
+	 */
+	static std::string get_frame_file_path(const std::string& output_pattern, int frame_index);
+
+private:
+	/**
+	 * Moves the camera or rotates the envmap of all the renderers of 'renderer' for the frame at 'angle_degrees' of the sweep
+	 */
+	static void setup_frame(MultiGPURenderer& renderer, const CommandlineArguments& arguments, const Scene& scene, float angle_degrees);
+	/**
+	 * Renders the samples of the current frame of 'renderer', until one of the stopping conditions of the sequence
+	 */
+	static void render_frame(MultiGPURenderer& renderer, const CommandlineArguments& arguments);
+	/**
+	 * Denoises the frame if asked to and writes it to 'file_path'. Runs on the SEQUENCE_FRAME_WRITE_THREAD_KEY thread
+	 */
+	static void write_frame(Image32Bit frame, std::string file_path, bool denoise, int frame_index, int frame_count);
+};
+
+#endif
@@ -9,9 +9,17 @@
 #include "HostDeviceCommon/HitInfo.h"
 #include <hiprt/hiprt_types.h> // for hiprtRay
 
+/**
+ * Analytic sphere of the scene, in world space. The GPU renderer traces the spheres as a custom
+ * primitive of HIPRT (see intersect_sphere() in Device/functions/SphereIntersection.h) instead
+ * of tessellating them into triangles.
+ *
+ * Trivially copyable, the spheres are stored in the scene cache as raw bytes
+ */
 struct Sphere
 {
-    Sphere(float3 center, float radius, int primitive_index) : center(center), radius(radius), primitive_index(primitive_index) { };
+    Sphere() = default;
+    Sphere(float3 center, float radius, int material_index) : center(center), radius(radius), material_index(material_index) { };
 
     inline bool intersect(const hiprtRay &ray, HitInfo& hit_info) const
     {
@@ -51,16 +59,16 @@ struct Sphere
 
             hit_info.inter_point = ray.origin + ray.direction * hit_info.t;
             hit_info.shading_normal = hippt::normalize(hit_info.inter_point - center);
-            hit_info.primitive_index = primitive_index;
 
             return true;
         }
     }
 
-    float3 center;
-    float radius;
+    float3 center = make_float3(0.0f, 0.0f, 0.0f);
+    float radius = 0.0f;
 
-    int primitive_index;
+    // Index in the materials of the scene
+    int material_index = 0;
 };
 
 #endif
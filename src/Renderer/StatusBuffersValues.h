@@ -6,6 +6,8 @@
 #ifndef STATUS_BUFFERS_VALUES_H
 #define STATUS_BUFFERS_VALUES_H
 
+#include <vector>
+
 struct StatusBuffersValues
 {
 	// Is there at least one pixel that is still active
@@ -18,6 +20,18 @@ struct StatusBuffersValues
 	// (according to the adaptive sampling or the
 	// pixel noise threshold for example)
 	unsigned int pixel_converged_count = 0;
+
+	// Number of rays traced at each bounce of the last sample of the last frame.
+	// Empty if render_settings.count_bounce_active_rays is false
+	std::vector<unsigned int> bounce_active_ray_counts;
+	// Number of paths whose ray missed the scene / that were terminated at a surface at each
+	// bounce of the same sample, same size as 'bounce_active_ray_counts'. See BouncePathEvent
+	std::vector<unsigned int> bounce_missed_path_counts;
+	std::vector<unsigned int> bounce_absorbed_path_counts;
+
+	// Counters of the last frame indexed by RayStatistic, of all the samples of the frame.
+	// Empty if render_settings.count_ray_statistics is false
+	std::vector<unsigned int> ray_statistics;
 };
 
 #endif
@@ -0,0 +1,314 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "HIPRT-Orochi/HIPRTOrochiUtils.h"
+#include "Renderer/VirtualTextureStreamer.h"
+#include "Threads/ThreadManager.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+extern ImGuiLogger g_imgui_logger;
+
+VirtualTextureStreamer::VirtualTextureStreamer()
+{
+	// The ThreadManager keys are global, making the key unique to this streamer
+	m_thread_key = ThreadManager::RENDERER_VIRTUAL_TEXTURE_STREAMING + std::to_string(reinterpret_cast<std::uintptr_t>(this));
+}
+
+VirtualTextureStreamer::~VirtualTextureStreamer()
+{
+	free();
+}
+
+void VirtualTextureStreamer::init(std::shared_ptr<VirtualTextureStore> store)
+{
+	free();
+
+	m_store = store;
+	m_page_count = store->get_page_count();
+	const std::vector<VirtualTextureDesc>& textures = store->get_textures();
+
+	std::vector<int> tail_pages;
+	for (const VirtualTextureDesc& texture : textures)
+		if (texture.level_count > 0)
+			tail_pages.push_back(texture.first_pages[texture.level_count - 1]);
+	m_pinned_tile_count = tail_pages.size();
+
+	// Sizing the tile pool with what's left of the device memory. There must be
+	// room for the pinned tiles plus some streamed tiles for the streaming to be any useful
+	size_t free_memory, total_memory;
+	OROCHI_CHECK_ERROR(oroMemGetInfo(&free_memory, &total_memory));
+
+	size_t tile_pool_size = static_cast<size_t>(free_memory * TILE_POOL_FREE_MEMORY_FRACTION) / sizeof(VirtualTextureTile);
+	tile_pool_size = std::max(tile_pool_size, static_cast<size_t>(m_pinned_tile_count + MAX_TILE_UPLOADS_PER_UPDATE));
+	tile_pool_size = std::min(tile_pool_size, static_cast<size_t>(m_page_count));
+	int tile_count = static_cast<int>(tile_pool_size);
+
+	m_textures_buffer.resize(textures.size());
+	m_textures_buffer.upload_data(textures);
+
+	m_page_table_buffer.resize(m_page_count);
+	m_feedback_buffer.resize(m_page_count);
+	OROCHI_CHECK_ERROR(oroMemsetD8(reinterpret_cast<oroDeviceptr>(m_feedback_buffer.get_device_pointer()), 0, m_page_count));
+	m_tile_pool.resize(tile_count);
+
+	m_page_table.assign(m_page_count, -1);
+	m_page_tiles.assign(m_page_count, -1);
+	m_tile_pages.assign(tile_count, -1);
+	m_tile_last_used.assign(tile_count, -1);
+
+	// The tail tiles go in the first slots of the pool and never move
+	VirtualTextureTile tile;
+	for (int tile_index = 0; tile_index < m_pinned_tile_count; tile_index++)
+	{
+		int page = tail_pages[tile_index];
+		if (!m_store->read_tile(page, tile))
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not read the tail tile (page %d) of a virtual texture", page);
+
+		OROCHI_CHECK_ERROR(oroMemcpy(reinterpret_cast<oroDeviceptr>(m_tile_pool.get_device_pointer() + tile_index), &tile, sizeof(VirtualTextureTile), oroMemcpyHostToDevice));
+
+		m_page_table[page] = tile_index;
+		m_page_tiles[page] = tile_index;
+		m_tile_pages[tile_index] = page;
+	}
+	m_page_table_buffer.upload_data(m_page_table);
+
+	m_lru_tiles.clear();
+	m_lru_positions.assign(tile_count, m_lru_tiles.end());
+	for (int tile_index = m_pinned_tile_count; tile_index < tile_count; tile_index++)
+		m_lru_positions[tile_index] = m_lru_tiles.insert(m_lru_tiles.end(), tile_index);
+
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Virtual textures: %d pages, %d tiles in the tile pool (%.1fMB), %d pinned", m_page_count, tile_count, tile_count * sizeof(VirtualTextureTile) / 1000000.0f, m_pinned_tile_count);
+}
+
+bool VirtualTextureStreamer::is_initialized() const
+{
+	return m_store != nullptr;
+}
+
+VirtualTexturingBuffers VirtualTextureStreamer::get_device_buffers()
+{
+	VirtualTexturingBuffers buffers;
+	if (!is_initialized())
+		return buffers;
+
+	buffers.textures = m_textures_buffer.get_device_pointer();
+	buffers.page_table = m_page_table_buffer.get_device_pointer();
+	buffers.feedback = m_feedback_buffer.get_device_pointer();
+	buffers.tile_pool = m_tile_pool.get_device_pointer();
+
+	return buffers;
+}
+
+void VirtualTextureStreamer::update(oroStream_t stream)
+{
+	if (!is_initialized())
+		return;
+
+	if (!m_thread_started)
+	{
+		// Started here and not in init() because the main function joins all the threads once the scene
+		// is loaded and this thread only stops with the streamer
+		ThreadManager::start_dedicated_thread(m_thread_key, &VirtualTextureStreamer::streaming_thread_function, this);
+		m_thread_started = true;
+	}
+
+	std::vector<StreamedTile> streamed_tiles;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		int upload_count = std::min(static_cast<int>(m_streamed_tiles.size()), MAX_TILE_UPLOADS_PER_UPDATE);
+		streamed_tiles.reserve(upload_count);
+		for (int i = 0; i < upload_count; i++)
+		{
+			streamed_tiles.push_back(std::move(m_streamed_tiles.front()));
+			m_streamed_tiles.pop_front();
+		}
+	}
+
+	if (!streamed_tiles.empty())
+	{
+		std::shared_ptr<OrochiStagingBlock> block = m_staging_pool.acquire(sizeof(VirtualTextureTile) * streamed_tiles.size());
+		VirtualTextureTile* staging_tiles = static_cast<VirtualTextureTile*>(block->host_pointer);
+
+		for (int i = 0; i < streamed_tiles.size(); i++)
+		{
+			const StreamedTile& streamed_tile = streamed_tiles[i];
+
+			std::memcpy(&staging_tiles[i], streamed_tile.texels.get(), sizeof(VirtualTextureTile));
+			OROCHI_CHECK_ERROR(oroMemcpyAsync(m_tile_pool.get_device_pointer() + streamed_tile.tile_index, &staging_tiles[i], sizeof(VirtualTextureTile), oroMemcpyHostToDevice, stream));
+
+			if (streamed_tile.evicted_page != -1)
+				m_page_table[streamed_tile.evicted_page] = -1;
+			m_page_table[streamed_tile.page] = streamed_tile.tile_index;
+		}
+		OROCHI_CHECK_ERROR(oroEventRecord(block->copy_done_event, stream));
+
+		// Same stream as the tiles so the new entries never point to a tile that hasn't been copied yet
+		m_page_table_buffer.upload_data_async(m_page_table.data(), stream, m_staging_pool);
+	}
+
+	if (m_feedback_transfer_pending && m_feedback_transfer.is_done())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			const unsigned char* feedback = m_feedback_transfer.get_downloaded_data<unsigned char>();
+			m_pending_feedback.assign(feedback, feedback + m_page_count);
+			m_has_pending_feedback = true;
+		}
+		m_condition.notify_one();
+
+		m_feedback_transfer = OrochiAsyncTransfer();
+		m_feedback_transfer_pending = false;
+	}
+
+	if (!m_feedback_transfer_pending)
+	{
+		// Reading back the feedback of the frame that was just queued and clearing
+		// it for the next frame. The readback is only done once the previous one has
+		// been handed to the streaming thread so at most one is in flight
+		m_feedback_transfer = m_feedback_buffer.download_data_async(stream, m_staging_pool);
+		OROCHI_CHECK_ERROR(oroMemsetD8Async(reinterpret_cast<oroDeviceptr>(m_feedback_buffer.get_device_pointer()), 0, m_page_count, stream));
+
+		m_feedback_transfer_pending = true;
+	}
+}
+
+void VirtualTextureStreamer::free()
+{
+	if (m_thread_started)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_condition.notify_all();
+
+		ThreadManager::join_threads(m_thread_key);
+		m_thread_started = false;
+	}
+
+	m_stop = false;
+	m_has_pending_feedback = false;
+	m_pending_feedback.clear();
+	m_streamed_tiles.clear();
+
+	// The transfer may still be in flight, the staging pool
+	// doesn't reuse its block before the copy is done
+	m_feedback_transfer = OrochiAsyncTransfer();
+	m_feedback_transfer_pending = false;
+
+	if (!is_initialized())
+		return;
+
+	m_textures_buffer.free();
+	m_page_table_buffer.free();
+	m_feedback_buffer.free();
+	m_tile_pool.free();
+
+	m_store = nullptr;
+	m_page_count = 0;
+	m_pinned_tile_count = 0;
+}
+
+int VirtualTextureStreamer::get_tile_pool_size() const
+{
+	return m_tile_pages.size();
+}
+
+void VirtualTextureStreamer::touch_tile(int tile_index, int feedback_generation)
+{
+	m_tile_last_used[tile_index] = feedback_generation;
+
+	// The pinned tiles aren't in the LRU list
+	if (tile_index < m_pinned_tile_count)
+		return;
+
+	m_lru_tiles.splice(m_lru_tiles.begin(), m_lru_tiles, m_lru_positions[tile_index]);
+}
+
+void VirtualTextureStreamer::streaming_thread_function()
+{
+	// Keeps the upload queue bounded when the feedback asks for more tiles than update() uploads
+	const int max_queued_tiles = MAX_TILE_UPLOADS_PER_UPDATE * 2;
+
+	int feedback_generation = 0;
+	std::vector<unsigned char> feedback;
+	std::vector<int> missing_pages;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this]() { return m_stop || m_has_pending_feedback; });
+
+			if (m_stop)
+				return;
+
+			feedback.swap(m_pending_feedback);
+			m_has_pending_feedback = false;
+		}
+
+		feedback_generation++;
+
+		missing_pages.clear();
+		for (int page = 0; page < feedback.size(); page++)
+		{
+			if (!feedback[page])
+				continue;
+
+			if (m_page_tiles[page] != -1)
+				touch_tile(m_page_tiles[page], feedback_generation);
+			else
+				missing_pages.push_back(page);
+		}
+
+		int queued_tiles;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			queued_tiles = m_streamed_tiles.size();
+		}
+
+		// The coarse levels of a texture come after its fine levels in the pages so
+		// going backwards streams the coarse tiles first: they're needed by more pixels
+		// and they're what the shaders fall back to
+		for (int i = static_cast<int>(missing_pages.size()) - 1; i >= 0 && !m_stop; i--)
+		{
+			if (queued_tiles >= max_queued_tiles || m_lru_tiles.empty())
+				break;
+
+			int tile_index = m_lru_tiles.back();
+			if (m_tile_last_used[tile_index] == feedback_generation)
+				// The least recently used tile is used by this frame, the pool is
+				// full of the tiles of this frame. Not evicting them
+				break;
+
+			StreamedTile streamed_tile;
+			streamed_tile.page = missing_pages[i];
+			streamed_tile.tile_index = tile_index;
+			streamed_tile.evicted_page = m_tile_pages[tile_index];
+			streamed_tile.texels = std::make_unique<VirtualTextureTile>();
+			if (!m_store->read_tile(streamed_tile.page, *streamed_tile.texels))
+			{
+				g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not read the tile of page %d of the virtual textures", streamed_tile.page);
+
+				continue;
+			}
+
+			if (streamed_tile.evicted_page != -1)
+				m_page_tiles[streamed_tile.evicted_page] = -1;
+			m_page_tiles[streamed_tile.page] = tile_index;
+			m_tile_pages[tile_index] = streamed_tile.page;
+			touch_tile(tile_index, feedback_generation);
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_streamed_tiles.push_back(std::move(streamed_tile));
+			queued_tiles++;
+		}
+	}
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef VIRTUAL_TEXTURE_STREAMER_H
+#define VIRTUAL_TEXTURE_STREAMER_H
+
+#include "HIPRT-Orochi/OrochiBuffer.h"
+#include "HIPRT-Orochi/OrochiStagingPool.h"
+#include "HostDeviceCommon/VirtualTexturing.h"
+#include "Scene/VirtualTextureStore.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Keeps the tiles of the virtual textures of a VirtualTextureStore that the shaders
+ * need resident in a fixed size tile pool on the device.
+ *
+ * Every frame, the feedback buffer written by the shaders (pages sampled, see
+ * sample_virtual_texture_rgba()) is read back asynchronously and handed to a streaming thread.
+ * This thread reads the missing tiles from the tile file of the store, evicting the
+ * least recently used tiles of the pool, and the next update() uploads them and their page table entries.
+ *
+ * The tail tile of each texture is pinned in the pool so that the shaders always have
+ * a coarse level to fall back to while the finer tiles are streamed in
+ */
+class VirtualTextureStreamer
+{
+public:
+	// Fraction of the free device memory that the tile pool uses
+	static constexpr float TILE_POOL_FREE_MEMORY_FRACTION = 0.5f;
+	// Bounds the time spent uploading tiles in update(). The tiles that
+	// didn't fit are uploaded by the next calls
+	static constexpr int MAX_TILE_UPLOADS_PER_UPDATE = 256;
+
+	VirtualTextureStreamer();
+	VirtualTextureStreamer(const VirtualTextureStreamer& other) = delete;
+	~VirtualTextureStreamer();
+
+	void operator=(const VirtualTextureStreamer& other) = delete;
+
+	/**
+	 * Allocates the buffers of the virtual textures of 'store' in the current Orochi context and
+	 * uploads the tail tiles of the textures. All the textures must have been added to the store
+	 */
+	void init(std::shared_ptr<VirtualTextureStore> store);
+	bool is_initialized() const;
+
+	/**
+	 * All nullptr if not initialized
+	 */
+	VirtualTexturingBuffers get_device_buffers();
+
+	/**
+	 * Uploads the tiles streamed in since the last call and queues the readback of the
+	 * feedback buffer. Must be called after queuing all the kernels of a frame on 'stream'
+	 * so that the feedback that is read back is the one of the frame.
+	 *
+	 * The streaming thread is started on the first call
+	 */
+	void update(oroStream_t stream);
+
+	/**
+	 * Stops the streaming thread and frees the buffers
+	 */
+	void free();
+
+	int get_tile_pool_size() const;
+
+private:
+	struct StreamedTile
+	{
+		int page;
+		int tile_index;
+		// Page that was in 'tile_index' before, -1 if none
+		int evicted_page;
+
+		std::unique_ptr<VirtualTextureTile> texels;
+	};
+
+	void streaming_thread_function();
+
+	/**
+	 * Moves the tile to the front of the LRU list. Streaming thread only
+	 */
+	void touch_tile(int tile_index, int feedback_generation);
+
+	std::shared_ptr<VirtualTextureStore> m_store = nullptr;
+	int m_page_count = 0;
+	// The first 'm_pinned_tile_count' tiles of the pool are the tail tiles of the textures
+	int m_pinned_tile_count = 0;
+
+	OrochiBuffer<VirtualTextureDesc> m_textures_buffer { "Virtual textures" };
+	OrochiBuffer<int> m_page_table_buffer { "Virtual textures" };
+	OrochiBuffer<unsigned char> m_feedback_buffer { "Virtual textures" };
+	OrochiBuffer<VirtualTextureTile> m_tile_pool { "Virtual textures" };
+
+	// ---- Main thread state ---- //
+	// Page table as uploaded to the device
+	std::vector<int> m_page_table;
+	OrochiStagingPool m_staging_pool;
+	OrochiAsyncTransfer m_feedback_transfer;
+	bool m_feedback_transfer_pending = false;
+
+	// One thread per streamer (there is one streamer per device with the MultiGPURenderer)
+	std::string m_thread_key;
+	bool m_thread_started = false;
+
+	// ---- Streaming thread state ---- //
+	// Residency as decided by the streaming thread. Ahead of 'm_page_table'
+	// by the tiles that haven't been uploaded yet
+	std::vector<int> m_page_tiles;
+	std::vector<int> m_tile_pages;
+	// Unpinned tiles of the pool, most recently used first
+	std::list<int> m_lru_tiles;
+	std::vector<std::list<int>::iterator> m_lru_positions;
+	// Feedback readback in which each tile was last used
+	std::vector<int> m_tile_last_used;
+
+	// ---- Shared state, protected by 'm_mutex' ---- //
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::atomic<bool> m_stop = false;
+
+	std::vector<unsigned char> m_pending_feedback;
+	bool m_has_pending_feedback = false;
+	std::deque<StreamedTile> m_streamed_tiles;
+};
+
+#endif
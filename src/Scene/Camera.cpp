@@ -26,6 +26,7 @@ HIPRTCamera Camera::to_hiprt()
     hiprt_cam.view_projection = *reinterpret_cast<float4x4*>(&view_projection);
 
     hiprt_cam.do_jittering = do_jittering;
+    hiprt_cam.tan_half_vertical_fov = tanf(vertical_fov / 2.0f) * (crop_ndc_y_max - crop_ndc_y_min) / 2.0f;
 
     return hiprt_cam;
 }
@@ -49,7 +50,7 @@ void Camera::set_aspect(float new_aspect)
     aspect = new_aspect;
 
     // Recomputing the projection matrix with the new aspect
-    projection_matrix = glm::transpose(glm::perspective(vertical_fov, new_aspect, near_plane, far_plane));
+    update_projection_matrix();
 }
 
 void Camera::set_FOV(float new_fov)
@@ -57,7 +58,29 @@ void Camera::set_FOV(float new_fov)
     vertical_fov = new_fov;
 
     // Recomputing the projection matrix with the new FOV
-    projection_matrix = glm::transpose(glm::perspective(new_fov, aspect, near_plane, far_plane));
+    update_projection_matrix();
+}
+
+void Camera::set_vertical_crop(float ndc_y_min, float ndc_y_max)
+{
+    crop_ndc_y_min = ndc_y_min;
+    crop_ndc_y_max = ndc_y_max;
+
+    update_projection_matrix();
+}
+
+void Camera::update_projection_matrix()
+{
+    float crop_height = crop_ndc_y_max - crop_ndc_y_min;
+    // 'aspect' is the aspect of the cropped band, the perspective is the one of the full image
+    float full_image_aspect = aspect * crop_height / 2.0f;
+
+    // Maps the band [crop_ndc_y_min, crop_ndc_y_max] of the NDC space of the full image to [-1, 1]
+    glm::mat4x4 crop_matrix = glm::mat4x4(1.0f);
+    crop_matrix[1][1] = 2.0f / crop_height;
+    crop_matrix[3][1] = -(crop_ndc_y_max + crop_ndc_y_min) / crop_height;
+
+    projection_matrix = glm::transpose(crop_matrix * glm::perspective(vertical_fov, full_image_aspect, near_plane, far_plane));
 }
 
 void Camera::auto_adjust_speed(const BoundingBox& scene_bounding_box)
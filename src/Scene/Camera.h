@@ -44,6 +44,15 @@ struct Camera
      */
     void set_FOV(float new_fov);
 
+    /**
+     * Restricts the image rendered with this camera to the horizontal band [ndc_y_min, ndc_y_max]
+     * (in NDC space, [-1, 1] being the full image) of the full image.
+     * 
+     * The aspect of the camera (set_aspect()) is then the aspect of the band, not of the full image.
+     * Used by the MultiGPURenderer to split the frame between the devices
+     */
+    void set_vertical_crop(float ndc_y_min, float ndc_y_max);
+
     /**
      * Adjusts the speed attributes of this camera so that the camera
      */
@@ -68,6 +77,9 @@ struct Camera
     float far_plane = 1000.0f;
     // Aspect ratio
     float aspect = 16.0f / 9.0f;
+    // Band of the full image rendered by this camera, see set_vertical_crop()
+    float crop_ndc_y_min = -1.0f;
+    float crop_ndc_y_max = 1.0f;
 
     // Camera movement speed. In world unit per second
     float camera_movement_speed = 1.0f;
@@ -76,6 +88,12 @@ struct Camera
 
     glm::vec3 translation = glm::vec3(0, 0, 0);
     glm::quat rotation = glm::quat(glm::vec3(0, 0, 0));
+
+private:
+    /**
+     * Recomputes 'projection_matrix' from the FOV, aspect, clip planes and crop of the camera
+     */
+    void update_projection_matrix();
 };
 
 #endif
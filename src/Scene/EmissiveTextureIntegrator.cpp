@@ -0,0 +1,125 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Scene/EmissiveTextureIntegrator.h"
+#include "Scene/SceneParser.h"
+
+#include <algorithm>
+#include <cmath>
+
+// The triangles are integrated on a grid of SAMPLE_SEGMENT_COUNT^2 micro-triangles
+// of equal areas, one sample at the centroid of each micro-triangle
+static constexpr int SAMPLE_SEGMENT_COUNT = 8;
+
+/**
+ * Highest luminance (in [0, 1]) of the texels of 'texture' in the given texel range, in repeat mode
+ */
+static float get_texels_max_luminance(const Image8Bit& texture, int x_min, int x_max, int y_min, int y_max)
+{
+    // The whole texture at most, the range repeats past that
+    x_max = std::min(x_max, x_min + texture.width - 1);
+    y_max = std::min(y_max, y_min + texture.height - 1);
+
+    float max_luminance = 0.0f;
+    for (int y = y_min; y <= y_max; y++)
+    {
+        int texel_y = ((y % texture.height) + texture.height) % texture.height;
+
+        for (int x = x_min; x <= x_max; x++)
+        {
+            int texel_x = ((x % texture.width) + texture.width) % texture.width;
+
+            max_luminance = std::max(max_luminance, texture.luminance_of_pixel(texel_x, texel_y) / 255.0f);
+        }
+    }
+
+    return max_luminance;
+}
+
+/**
+ * Average luminance of 'texture' over the triangle of texture coordinates 'uv_A', 'uv_B' and 'uv_C'
+ */
+static float integrate_texture_luminance(const Image8Bit& texture, float2 uv_A, float2 uv_B, float2 uv_C)
+{
+    float2 uv_min = make_float2(std::min({ uv_A.x, uv_B.x, uv_C.x }), std::min({ uv_A.y, uv_B.y, uv_C.y }));
+    float2 uv_max = make_float2(std::max({ uv_A.x, uv_B.x, uv_C.x }), std::max({ uv_A.y, uv_B.y, uv_C.y }));
+
+    // Same texel range as the classification of the opacities: texel coordinates of the GPU
+    // sampling extended by a texel on each side for the bilinear filtering
+    int x_min = static_cast<int>(std::floor(uv_min.x * (texture.width - 1))) - 1;
+    int x_max = static_cast<int>(std::ceil(uv_max.x * (texture.width - 1))) + 1;
+    int y_min = static_cast<int>(std::floor(uv_min.y * (texture.height - 1))) - 1;
+    int y_max = static_cast<int>(std::ceil(uv_max.y * (texture.height - 1))) + 1;
+
+    // The V axis of the texture is flipped by the GPU sampling but not by the CPU
+    // sampling so both orientations are looked at, as in TriangleOpacityClassifier
+    float max_luminance = std::max(get_texels_max_luminance(texture, x_min, x_max, y_min, y_max),
+                                   get_texels_max_luminance(texture, x_min, x_max, texture.height - 1 - y_max, texture.height - 1 - y_min));
+    if (max_luminance == 0.0f)
+        // No light can be read under that triangle
+        return 0.0f;
+
+    // Texture coordinates at the barycentric coordinates (u, v), same interpolation as uv_interpolate()
+    auto get_texcoords = [&](float u, float v) { return uv_B * u + uv_C * v + uv_A * (1.0f - u - v); };
+    auto get_luminance = [&](float2 uv)
+    {
+        ColorRGBA32F texel = texture.sample_rgba32f(uv);
+        ColorRGBA32F flipped_texel = texture.sample_rgba32f(make_float2(uv.x, 1.0f - uv.y));
+
+        return (ColorRGB32F(texel.r, texel.g, texel.b).luminance() + ColorRGB32F(flipped_texel.r, flipped_texel.g, flipped_texel.b).luminance()) * 0.5f;
+    };
+
+    constexpr int N = SAMPLE_SEGMENT_COUNT;
+
+    float luminance_sum = 0.0f;
+    for (int j = 0; j < N; j++)
+    {
+        for (int i = 0; i < N - j; i++)
+        {
+            // Centroids of the upward and downward micro-triangles
+            luminance_sum += get_luminance(get_texcoords((i + 1.0f / 3.0f) / N, (j + 1.0f / 3.0f) / N));
+            if (i + j < N - 1)
+                luminance_sum += get_luminance(get_texcoords((i + 2.0f / 3.0f) / N, (j + 2.0f / 3.0f) / N));
+        }
+    }
+
+    // The samples may all miss the small bright details of the texture, some probability is kept
+    // for them, otherwise they would only be found by the BSDF samples
+    return std::max(luminance_sum / (N * N), max_luminance * 0.01f);
+}
+
+std::vector<float> EmissiveTextureIntegrator::compute_triangle_texture_luminances(const Scene& scene)
+{
+    bool one_emission_texture = false;
+    for (const RendererMaterial& material : scene.materials)
+        one_emission_texture |= material.has_emission_texture();
+    if (!one_emission_texture)
+        return std::vector<float>();
+
+    int triangle_count = static_cast<int>(scene.material_indices.size());
+    std::vector<float> texture_luminances(triangle_count, 1.0f);
+
+    bool texcoords_in_memory = !scene.has_streamed_buffers();
+#pragma omp parallel for
+    for (int triangle_index = 0; triangle_index < triangle_count; triangle_index++)
+    {
+        const RendererMaterial& material = scene.materials[scene.material_indices[triangle_index]];
+        if (!material.has_emission_texture() || material.emission_texture_index >= scene.textures.size() || !texcoords_in_memory)
+            // Left at the luminance of a white texture
+            continue;
+
+        const Image8Bit& texture = scene.textures[material.emission_texture_index];
+        if (texture.width == 0 || texture.height == 0)
+            // Texture not in memory
+            continue;
+
+        float2 uv_A, uv_B, uv_C;
+        scene.get_triangle_texcoords(triangle_index, uv_A, uv_B, uv_C);
+
+        texture_luminances[triangle_index] = integrate_texture_luminance(texture, uv_A, uv_B, uv_C);
+    }
+
+    return texture_luminances;
+}
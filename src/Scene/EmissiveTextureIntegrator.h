@@ -0,0 +1,41 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef EMISSIVE_TEXTURE_INTEGRATOR_H
+#define EMISSIVE_TEXTURE_INTEGRATOR_H
+
+#include <vector>
+
+struct Scene;
+
+/**
+ * Integrates the emission textures over the triangles of a scene so that the triangles of
+ * the materials with an emission texture can be sampled by the lights sampling structures
+ * (alias table, light hierarchy) proportionally to the light they actually emit.
+ *
+ * The luminance of a triangle is its emission texture averaged over the UVs of the triangle,
+ * the emission strength of the material is applied on top of that by
+ * RendererMaterial::get_emission_power_luminance() so that the textures only have to be
+ * integrated once, when the scene is loaded
+ */
+class EmissiveTextureIntegrator
+{
+public:
+    /**
+     * Average luminance of the emission texture under each triangle of the meshes of 'scene'
+     * (indexed like 'scene.material_indices'). 1.0f for the triangles without emission texture.
+     *
+     * Exactly 0.0f only if all the texels that the filtering of the shaders can read under the
+     * triangle are black: these triangles emit no light and are never sampled.
+     *
+     * If the texels can't be read (virtual texturing, texture coordinates streamed from the scene cache),
+     * the textured triangles get the luminance of a white texture, an upper bound of the 8 bit textures.
+     *
+     * Returns an empty vector if no material of the scene has an emission texture
+     */
+    static std::vector<float> compute_triangle_texture_luminances(const Scene& scene);
+};
+
+#endif
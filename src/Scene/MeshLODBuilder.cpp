@@ -0,0 +1,192 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Scene/MeshLODBuilder.h"
+#include "Scene/SceneParser.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+
+extern ImGuiLogger g_imgui_logger;
+
+namespace
+{
+    /**
+     * Hash of a triangle given by its sorted vertex indices, for removing the duplicate triangles
+     */
+    struct SortedTriangleHash
+    {
+        std::size_t operator()(const std::array<int, 3>& triangle) const
+        {
+            std::uint64_t hash = static_cast<std::uint32_t>(triangle[0]);
+            hash = hash * 0x9E3779B97F4A7C15ull + static_cast<std::uint32_t>(triangle[1]);
+            hash = hash * 0x9E3779B97F4A7C15ull + static_cast<std::uint32_t>(triangle[2]);
+
+            return static_cast<std::size_t>(hash ^ (hash >> 32));
+        }
+    };
+}
+
+void MeshLODBuilder::build_lods(Scene& scene, const std::vector<bool>& emissive_materials)
+{
+    int mesh_count = static_cast<int>(scene.meshes.size());
+
+    // Triangles and source triangles of the LODs of each mesh, coarser and coarser
+    std::vector<std::vector<std::vector<int>>> meshes_lods_triangles(mesh_count);
+    std::vector<std::vector<std::vector<int>>> meshes_lods_sources(mesh_count);
+    std::vector<std::vector<float>> meshes_lods_errors(mesh_count);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int mesh_index = 0; mesh_index < mesh_count; mesh_index++)
+    {
+        const SceneMesh& mesh = scene.meshes[mesh_index];
+        if (mesh.triangle_count < MIN_MESH_TRIANGLE_COUNT || emissive_materials[scene.material_indices[mesh.first_triangle]])
+            continue;
+
+        // On a surface, a grid of resolution R has about R^2 cells crossed by the mesh, each
+        // giving about 2 triangles: the first LOD aims for a quarter of the triangles of the mesh
+        int grid_resolution = static_cast<int>(std::sqrt(mesh.triangle_count / 8.0f));
+        int previous_triangle_count = mesh.triangle_count;
+        for (; grid_resolution >= 2 && meshes_lods_errors[mesh_index].size() < MAX_LOD_LEVEL_COUNT; grid_resolution /= 2)
+        {
+            std::vector<int> lod_triangles;
+            std::vector<int> lod_sources;
+            float error = simplify(scene, mesh_index, grid_resolution, lod_triangles, lod_sources);
+
+            int lod_triangle_count = static_cast<int>(lod_sources.size());
+            if (lod_triangle_count == 0)
+                break;
+            else if (lod_triangle_count > previous_triangle_count * MAX_LEVEL_TRIANGLE_RATIO)
+                // Not simplified enough to be worth a level (the mesh is made of many disconnected
+                // pieces for example), trying with a coarser grid
+                continue;
+
+            meshes_lods_triangles[mesh_index].push_back(std::move(lod_triangles));
+            meshes_lods_sources[mesh_index].push_back(std::move(lod_sources));
+            meshes_lods_errors[mesh_index].push_back(error);
+
+            previous_triangle_count = lod_triangle_count;
+            if (lod_triangle_count < MIN_LOD_TRIANGLE_COUNT)
+                break;
+        }
+    }
+
+    // Appending the LODs mesh after mesh, after the triangles of all the meshes
+    int mesh_triangle_count = static_cast<int>(scene.material_indices.size());
+    int lod_mesh_count = 0;
+    scene.mesh_lods.clear();
+    for (int mesh_index = 0; mesh_index < mesh_count; mesh_index++)
+    {
+        lod_mesh_count += meshes_lods_errors[mesh_index].empty() ? 0 : 1;
+
+        for (int level = 0; level < meshes_lods_errors[mesh_index].size(); level++)
+        {
+            const std::vector<int>& lod_triangles = meshes_lods_triangles[mesh_index][level];
+            const std::vector<int>& lod_sources = meshes_lods_sources[mesh_index][level];
+
+            SceneMeshLOD lod;
+            lod.mesh_index = mesh_index;
+            lod.level = level + 1;
+            lod.first_triangle = static_cast<int>(scene.material_indices.size());
+            lod.triangle_count = static_cast<int>(lod_sources.size());
+            lod.error = meshes_lods_errors[mesh_index][level];
+            scene.mesh_lods.push_back(lod);
+
+            scene.triangle_indices.insert(scene.triangle_indices.end(), lod_triangles.begin(), lod_triangles.end());
+            for (int source_triangle : lod_sources)
+                scene.material_indices.push_back(scene.material_indices[source_triangle]);
+        }
+    }
+
+    if (!scene.mesh_lods.empty())
+    {
+        int lod_triangle_count = static_cast<int>(scene.material_indices.size()) - mesh_triangle_count;
+
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%zu geometry LODs generated for %d meshes (%d triangles, +%.1f%%)", scene.mesh_lods.size(), lod_mesh_count, lod_triangle_count, lod_triangle_count * 100.0f / mesh_triangle_count);
+    }
+}
+
+float MeshLODBuilder::simplify(const Scene& scene, int mesh_index, int grid_resolution, std::vector<int>& out_triangle_indices, std::vector<int>& out_source_triangles)
+{
+    const SceneMesh& mesh = scene.meshes[mesh_index];
+    const BoundingBox& bounds = scene.mesh_bounding_boxes[mesh_index];
+
+    // Cubic cells, the flat meshes (or flat dimensions of a mesh) have a single layer of cells
+    float cell_size = std::max(bounds.get_max_extent(), 1.0e-6f) / grid_resolution;
+    auto get_cell_key = [&bounds, cell_size, grid_resolution](const float3& position)
+    {
+        std::uint64_t x = static_cast<std::uint64_t>(std::clamp(static_cast<int>((position.x - bounds.mini.x) / cell_size), 0, grid_resolution - 1));
+        std::uint64_t y = static_cast<std::uint64_t>(std::clamp(static_cast<int>((position.y - bounds.mini.y) / cell_size), 0, grid_resolution - 1));
+        std::uint64_t z = static_cast<std::uint64_t>(std::clamp(static_cast<int>((position.z - bounds.mini.z) / cell_size), 0, grid_resolution - 1));
+
+        return x + (y + z * grid_resolution) * grid_resolution;
+    };
+
+    // Average of the vertices of each cell
+    std::unordered_map<std::uint64_t, int> cell_clusters;
+    std::vector<int> vertex_clusters(mesh.vertex_count);
+    std::vector<float3> clusters_sum;
+    std::vector<int> clusters_count;
+    for (int i = 0; i < mesh.vertex_count; i++)
+    {
+        const float3& position = scene.vertices_positions[mesh.first_vertex + i];
+
+        auto cluster = cell_clusters.emplace(get_cell_key(position), static_cast<int>(clusters_sum.size()));
+        if (cluster.second)
+        {
+            clusters_sum.push_back(make_float3(0.0f, 0.0f, 0.0f));
+            clusters_count.push_back(0);
+        }
+
+        vertex_clusters[i] = cluster.first->second;
+        clusters_sum[vertex_clusters[i]] += position;
+        clusters_count[vertex_clusters[i]]++;
+    }
+
+    // The vertex of each cell closest to the average of its cell stands for the whole cell
+    std::vector<int> clusters_vertex(clusters_sum.size(), -1);
+    std::vector<float> clusters_distance(clusters_sum.size(), 0.0f);
+    for (int i = 0; i < mesh.vertex_count; i++)
+    {
+        int cluster = vertex_clusters[i];
+        float3 average = clusters_sum[cluster] / static_cast<float>(clusters_count[cluster]);
+        float distance = hippt::length2(scene.vertices_positions[mesh.first_vertex + i] - average);
+        if (clusters_vertex[cluster] == -1 || distance < clusters_distance[cluster])
+        {
+            clusters_vertex[cluster] = mesh.first_vertex + i;
+            clusters_distance[cluster] = distance;
+        }
+    }
+
+    // The duplicates are the triangles folded onto each other, either way around
+    std::unordered_set<std::array<int, 3>, SortedTriangleHash> lod_triangles;
+    for (int triangle_index = mesh.first_triangle; triangle_index < mesh.first_triangle + mesh.triangle_count; triangle_index++)
+    {
+        int vertices[3];
+        for (int vertex = 0; vertex < 3; vertex++)
+            vertices[vertex] = clusters_vertex[vertex_clusters[scene.triangle_indices[triangle_index * 3 + vertex] - mesh.first_vertex]];
+
+        if (vertices[0] == vertices[1] || vertices[0] == vertices[2] || vertices[1] == vertices[2])
+            // Collapsed
+            continue;
+
+        std::array<int, 3> sorted_vertices = { vertices[0], vertices[1], vertices[2] };
+        std::sort(sorted_vertices.begin(), sorted_vertices.end());
+        if (!lod_triangles.insert(sorted_vertices).second)
+            continue;
+
+        // Same winding as the original triangle
+        out_triangle_indices.insert(out_triangle_indices.end(), vertices, vertices + 3);
+        out_source_triangles.push_back(triangle_index);
+    }
+
+    // A vertex moves at most across the diagonal of its cell
+    return cell_size * std::sqrt(3.0f);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef MESH_LOD_BUILDER_H
+#define MESH_LOD_BUILDER_H
+
+#include <vector>
+
+struct Scene;
+
+/**
+ * Generates coarser versions (levels of detail) of the large meshes of a scene at load time, see Scene::mesh_lods.
+ * The GPURenderer traces the rays that don't need the full geometry (the distant instances, the secondary rays)
+ * against them, they are cheaper to traverse and more compact in the caches.
+ *
+ * The meshes are simplified by vertex clustering: the vertices of the mesh are grouped by the cells of a grid
+ * over its bounding box and each group is replaced by the vertex of the group closest to the average of the group.
+ * The triangles whose vertices all end up in different groups are kept, the others collapsed. The vertices of the
+ * LODs are thus original vertices of the mesh: the LODs reuse the vertex normals, texture coordinates and quantized
+ * positions of their mesh and their triangles keep the material of the triangle they come from.
+ *
+ * Each level uses a grid twice as coarse as the previous one (about a quarter of its triangles)
+ */
+class MeshLODBuilder
+{
+public:
+    // The meshes with fewer triangles aren't simplified, their BVH is cheap enough
+    static constexpr int MIN_MESH_TRIANGLE_COUNT = 2048;
+    // Maximum number of LODs of a mesh
+    static constexpr int MAX_LOD_LEVEL_COUNT = 4;
+    // A LOD is only kept if it has at most this fraction of the triangles of the previous level
+    static constexpr float MAX_LEVEL_TRIANGLE_RATIO = 0.5f;
+    // No coarser LOD is generated once a LOD has fewer triangles than this
+    static constexpr int MIN_LOD_TRIANGLE_COUNT = 64;
+
+    /**
+     * Generates the LODs of the meshes of 'scene' and appends their triangles to the triangle buffers of the
+     * scene, after the triangles of all the meshes. Must be called once all the meshes are parsed.
+     *
+     * The emissive meshes, those whose first triangle has a material 'i' for which 'emissive_materials[i]'
+     * is true, aren't simplified: their triangles are the ones that the lights sample
+     */
+    static void build_lods(Scene& scene, const std::vector<bool>& emissive_materials);
+
+private:
+    /**
+     * Simplifies 'mesh' with a grid of 'grid_resolution' cells along the largest axis of its bounding box.
+     * The triangles of the LOD (global vertex indices) are written to 'out_triangle_indices' and the index
+     * of the triangle of the mesh that each one comes from to 'out_source_triangles'.
+     *
+     * Returns the error of the LOD, see SceneMeshLOD::error
+     */
+    static float simplify(const Scene& scene, int mesh_index, int grid_resolution, std::vector<int>& out_triangle_indices, std::vector<int>& out_source_triangles);
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Scene/BoundingBox.h"
+#include "Scene/MeshReorderer.h"
+#include "Scene/SceneParser.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Spreads the 10 low bits of 'value' so that there are two 0 bits between each of them
+ */
+static uint32_t spread_bits_3D(uint32_t value)
+{
+    value &= 0x3FF;
+    value = (value | (value << 16)) & 0x030000FF;
+    value = (value | (value << 8)) & 0x0300F00F;
+    value = (value | (value << 4)) & 0x030C30C3;
+    value = (value | (value << 2)) & 0x09249249;
+
+    return value;
+}
+
+/**
+ * 30 bit Morton code of 'point' on a 1024^3 grid over 'bounding_box'
+ */
+static uint32_t morton_code_3D(const float3& point, const BoundingBox& bounding_box)
+{
+    float3 extent = bounding_box.maxi - bounding_box.mini;
+
+    uint32_t grid_coordinates[3];
+    float point_coordinates[3] = { point.x - bounding_box.mini.x, point.y - bounding_box.mini.y, point.z - bounding_box.mini.z };
+    float extents[3] = { extent.x, extent.y, extent.z };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // Flat along that axis, all the points are at 0
+        float normalized = extents[axis] > 0.0f ? point_coordinates[axis] / extents[axis] : 0.0f;
+
+        grid_coordinates[axis] = static_cast<uint32_t>(std::min(std::max(normalized * 1024.0f, 0.0f), 1023.0f));
+    }
+
+    return spread_bits_3D(grid_coordinates[0]) | (spread_bits_3D(grid_coordinates[1]) << 1) | (spread_bits_3D(grid_coordinates[2]) << 2);
+}
+
+/**
+ * Moves the element 'i' of 'elements' to 'new_indices[i]'
+ */
+template <typename T>
+static void permute(T* elements, const std::vector<int>& new_indices)
+{
+    std::vector<T> permuted(new_indices.size());
+    for (int i = 0; i < new_indices.size(); i++)
+        permuted[new_indices[i]] = elements[i];
+
+    std::copy(permuted.begin(), permuted.end(), elements);
+}
+
+void MeshReorderer::reorder_mesh(Scene& scene, int mesh_index)
+{
+    const SceneMesh& mesh = scene.meshes[mesh_index];
+    if (mesh.triangle_count < 2)
+        return;
+
+    int* triangles = scene.triangle_indices.data() + mesh.first_triangle * 3;
+
+    std::vector<float3> centroids(mesh.triangle_count);
+    BoundingBox centroids_bounding_box;
+    for (int triangle_index = 0; triangle_index < mesh.triangle_count; triangle_index++)
+    {
+        const float3& vertex_A = scene.vertices_positions[triangles[triangle_index * 3 + 0]];
+        const float3& vertex_B = scene.vertices_positions[triangles[triangle_index * 3 + 1]];
+        const float3& vertex_C = scene.vertices_positions[triangles[triangle_index * 3 + 2]];
+
+        centroids[triangle_index] = (vertex_A + vertex_B + vertex_C) / 3.0f;
+        centroids_bounding_box.extend(centroids[triangle_index]);
+    }
+
+    // Sorting by Morton code and then by the original order for a deterministic result
+    std::vector<std::pair<uint32_t, int>> sort_keys(mesh.triangle_count);
+    for (int triangle_index = 0; triangle_index < mesh.triangle_count; triangle_index++)
+        sort_keys[triangle_index] = std::make_pair(morton_code_3D(centroids[triangle_index], centroids_bounding_box), triangle_index);
+    std::sort(sort_keys.begin(), sort_keys.end());
+
+    std::vector<int> sorted_triangles(mesh.triangle_count * 3);
+    for (int i = 0; i < mesh.triangle_count; i++)
+        for (int vertex = 0; vertex < 3; vertex++)
+            sorted_triangles[i * 3 + vertex] = triangles[sort_keys[i].second * 3 + vertex];
+
+    // Vertices numbered in the order the sorted triangles first use them.
+    // The vertices used by no triangle are left at the end
+    std::vector<int> new_vertex_indices(mesh.vertex_count, -1);
+    int next_vertex_index = 0;
+    for (int vertex_index : sorted_triangles)
+    {
+        int& new_vertex_index = new_vertex_indices[vertex_index - mesh.first_vertex];
+        if (new_vertex_index == -1)
+            new_vertex_index = next_vertex_index++;
+    }
+    for (int& new_vertex_index : new_vertex_indices)
+        if (new_vertex_index == -1)
+            new_vertex_index = next_vertex_index++;
+
+    for (int i = 0; i < mesh.triangle_count * 3; i++)
+        triangles[i] = mesh.first_vertex + new_vertex_indices[sorted_triangles[i] - mesh.first_vertex];
+
+    permute(scene.vertices_positions.data() + mesh.first_vertex, new_vertex_indices);
+    if (mesh.first_normal != -1)
+        permute(scene.vertex_normals.data() + mesh.first_normal, new_vertex_indices);
+    if (mesh.first_texcoords != -1)
+        permute(scene.texcoords.data() + mesh.first_texcoords, new_vertex_indices);
+}
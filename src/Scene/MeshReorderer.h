@@ -0,0 +1,35 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef MESH_REORDERER_H
+#define MESH_REORDERER_H
+
+struct Scene;
+
+/**
+ * Reorders the triangles and the vertices of the meshes of a scene at load time for the locality of
+ * the memory accesses of the shading: the rays that hit close triangles read their vertices, vertex
+ * attributes and materials from close addresses instead of from wherever the modeling software put them.
+ *
+ * The triangles of a mesh are sorted along a Morton curve of their centroids and the vertices of the mesh
+ * are then renumbered in the order the sorted triangles first use them
+ */
+class MeshReorderer
+{
+public:
+    /**
+     * Reorders the triangles and vertices of the mesh 'mesh_index' of 'scene'. The vertex normals and
+     * texture coordinates of the mesh follow its vertices.
+     *
+     * Only the ranges of that mesh in the buffers of the scene are modified so different meshes can be
+     * reordered in parallel. All the triangles of a mesh have the same material, 'material_indices' is unchanged.
+     *
+     * Must be called before anything references the triangles of the mesh by index (emissive
+     * triangles, opacity classification, ...): the scene parser does it right after copying the mesh
+     */
+    static void reorder_mesh(Scene& scene, int mesh_index);
+};
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Scene/SceneCache.h"
+#include "Scene/VirtualTextureStore.h"
+#include "Threads/ThreadManager.h"
+#include "UI/ImGui/ImGuiLogger.h"
+#include "Utils/Utils.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <type_traits>
+
+extern ImGuiLogger g_imgui_logger;
+
+const std::string SceneCache::SCENE_CACHE_DIRECTORY = "scene_cache";
+
+// Magic number at the start of the cache files: 'HSC' + 1 byte for the endianness check
+static constexpr std::uint32_t SCENE_CACHE_MAGIC = 0x48534301;
+
+namespace
+{
+    struct SceneCacheHeader
+    {
+        std::uint32_t magic = SCENE_CACHE_MAGIC;
+        std::uint32_t version = SceneCache::SCENE_CACHE_VERSION;
+
+        // Offset in the file of the textures, after all the geometry
+        std::int64_t textures_offset = 0;
+    };
+
+    template <typename T>
+    void write_value(std::ofstream& file, const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be written as raw bytes in the scene cache");
+
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void write_vector(std::ofstream& file, const std::vector<T>& vector)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be written as raw bytes in the scene cache");
+
+        std::uint64_t size = vector.size();
+        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        file.write(reinterpret_cast<const char*>(vector.data()), sizeof(T) * size);
+    }
+
+    template <typename T>
+    bool read_value(std::ifstream& file, T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be read as raw bytes from the scene cache");
+
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    /**
+     * Reads the whole vector with a single read directly into the storage of the vector
+     */
+    template <typename T>
+    bool read_vector(std::ifstream& file, std::vector<T>& vector)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types can be read as raw bytes from the scene cache");
+
+        std::uint64_t size;
+        if (!read_value(file, size))
+            return false;
+
+        vector.resize(size);
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(vector.data()), sizeof(T) * size));
+    }
+
+    /**
+     * Skips over a vector written by write_vector() and stores its location in the file in 'streamed_buffer'
+     */
+    template <typename T>
+    bool skip_vector(std::ifstream& file, SceneCacheStreamedBuffer& streamed_buffer)
+    {
+        std::uint64_t size;
+        if (!read_value(file, size))
+            return false;
+
+        streamed_buffer.file_offset = static_cast<std::int64_t>(file.tellg());
+        streamed_buffer.element_count = size;
+
+        return static_cast<bool>(file.seekg(sizeof(T) * size, std::ios::cur));
+    }
+}
+
+std::string SceneCache::get_cache_filepath(const std::string& scene_filepath, const SceneParserOptions& options)
+{
+    std::ifstream scene_file(scene_filepath, std::ios::binary);
+    if (!scene_file.is_open())
+        return "";
+
+    std::uint64_t hash = Utils::fnv1a_hash(nullptr, 0);
+
+    std::vector<char> chunk(1 << 20);
+    while (scene_file)
+    {
+        scene_file.read(chunk.data(), chunk.size());
+        hash = Utils::fnv1a_hash(chunk.data(), scene_file.gcount(), hash);
+    }
+
+    // The aspect ratio override changes the camera of the parsed scene
+    hash = Utils::fnv1a_hash(&options.override_aspect_ratio, sizeof(options.override_aspect_ratio), hash);
+    // and so do the envmap portals of the user
+    hash = Utils::fnv1a_hash(options.envmap_portals.data(), options.envmap_portals.size() * sizeof(EnvmapPortal), hash);
+    // The order of the triangles and vertices
+    hash = Utils::fnv1a_hash(&options.reorder_triangles, sizeof(options.reorder_triangles), hash);
+    // and the LODs of the meshes
+    hash = Utils::fnv1a_hash(&options.geometry_lods, sizeof(options.geometry_lods), hash);
+    // and the texture indices of the materials
+    hash = Utils::fnv1a_hash(&options.linearize_srgb_textures, sizeof(options.linearize_srgb_textures), hash);
+
+    // The cached structures are written as raw bytes so any change to their
+    // layout must invalidate the cache
+    std::uint64_t layout[] = { SCENE_CACHE_VERSION, sizeof(RendererMaterial), sizeof(SceneInstance), sizeof(SceneMesh), sizeof(SceneMeshLOD), sizeof(BoundingBox), sizeof(Camera), sizeof(EnvmapPortal), sizeof(Sphere) };
+    hash = Utils::fnv1a_hash(layout, sizeof(layout), hash);
+
+    char hash_string[17];
+    std::snprintf(hash_string, sizeof(hash_string), "%016llx", static_cast<unsigned long long>(hash));
+
+    return SCENE_CACHE_DIRECTORY + "/" + std::string(hash_string) + ".bin";
+}
+
+bool SceneCache::load(const std::string& scene_filepath, const SceneParserOptions& options, Scene& parsed_scene)
+{
+    std::string cache_filepath = get_cache_filepath(scene_filepath, options);
+    if (cache_filepath.empty())
+        return false;
+
+    std::ifstream file(cache_filepath, std::ios::binary);
+    if (!file.is_open())
+        // No cache entry for this scene yet
+        return false;
+
+    SceneCacheHeader header;
+    if (!read_value(file, header) || header.magic != SCENE_CACHE_MAGIC || header.version != SCENE_CACHE_VERSION)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Invalid scene cache file %s, ignoring it.", cache_filepath.c_str());
+
+        return false;
+    }
+
+    // Reading in a temporary scene so that 'parsed_scene' is left untouched on failure
+    Scene cached_scene;
+
+    bool success = true;
+    success &= read_vector(file, cached_scene.materials);
+
+    std::uint64_t material_name_count = 0;
+    success &= read_value(file, material_name_count);
+    cached_scene.material_names.resize(success ? material_name_count : 0);
+    for (std::string& material_name : cached_scene.material_names)
+    {
+        std::vector<char> name;
+        success &= read_vector(file, name);
+
+        material_name = std::string(name.begin(), name.end());
+    }
+
+    success &= read_vector(file, cached_scene.mesh_bounding_boxes);
+    success &= read_value(file, cached_scene.scene_bounding_box);
+    success &= read_vector(file, cached_scene.textures_dims);
+    success &= read_vector(file, cached_scene.triangle_indices);
+    success &= read_vector(file, cached_scene.vertices_positions);
+    if (options.stream_cached_vertex_attributes)
+    {
+        cached_scene.streamed_buffers.cache_filepath = cache_filepath;
+
+        success &= skip_vector<float3>(file, cached_scene.streamed_buffers.vertex_normals);
+        success &= skip_vector<float2>(file, cached_scene.streamed_buffers.texcoords);
+    }
+    else
+    {
+        success &= read_vector(file, cached_scene.vertex_normals);
+        success &= read_vector(file, cached_scene.texcoords);
+    }
+    success &= read_vector(file, cached_scene.emissive_triangle_indices);
+    success &= read_vector(file, cached_scene.material_indices);
+    success &= read_vector(file, cached_scene.meshes);
+    success &= read_vector(file, cached_scene.mesh_lods);
+    success &= read_vector(file, cached_scene.instances);
+    success &= read_vector(file, cached_scene.envmap_portals);
+    success &= read_vector(file, cached_scene.spheres);
+    success &= read_value(file, cached_scene.has_camera);
+    success &= read_value(file, cached_scene.camera);
+
+    if (!success)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Truncated scene cache file %s, ignoring it.", cache_filepath.c_str());
+
+        return false;
+    }
+
+    parsed_scene = std::move(cached_scene);
+    parsed_scene.textures.resize(parsed_scene.textures_dims.size());
+    parsed_scene.placeholder_materials.resize(parsed_scene.materials.size());
+    for (int material_index = 0; material_index < parsed_scene.materials.size(); material_index++)
+        parsed_scene.placeholder_materials[material_index] = parsed_scene.materials[material_index].without_textures();
+    if (options.virtual_texturing)
+        SceneParser::open_virtual_texture_store(scene_filepath, parsed_scene.textures_dims.size(), parsed_scene);
+
+    // The textures are the bulk of the cache file so they're read in the background while
+    // the renderer builds the BVH for example, just like when the textures are read
+    // from their original files
+    ThreadManager::start_thread(ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY, SceneCache::load_textures, cache_filepath, static_cast<std::streamoff>(header.textures_offset), std::ref(parsed_scene));
+
+    g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Scene loaded from the scene cache file %s", cache_filepath.c_str());
+
+    return true;
+}
+
+void SceneCache::load_textures(std::string cache_filepath, std::streamoff textures_offset, Scene& parsed_scene)
+{
+    std::ifstream file(cache_filepath, std::ios::binary);
+    file.seekg(textures_offset);
+
+    for (int i = 0; i < parsed_scene.textures.size(); i++)
+    {
+        Image8Bit& texture = parsed_scene.textures[i];
+
+        int dims[3];
+        if (!read_value(file, dims) || !read_vector(file, texture.data()))
+        {
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not read the textures of the scene cache file %s. Delete the file to rebuild the cache.", cache_filepath.c_str());
+
+            return;
+        }
+
+        texture.width = dims[0];
+        texture.height = dims[1];
+        texture.channels = dims[2];
+
+        if (parsed_scene.virtual_textures != nullptr && texture.width > 0 && texture.height > 0)
+        {
+            // Only the tiles are kept
+            parsed_scene.virtual_textures->add_texture(i, texture);
+            texture.free();
+        }
+    }
+}
+
+void SceneCache::save_async(const std::string& scene_filepath, const SceneParserOptions& options, const Scene& parsed_scene)
+{
+    std::string cache_filepath = get_cache_filepath(scene_filepath, options);
+    if (cache_filepath.empty())
+        return;
+
+    // The textures and the emissive triangles of the scene are still being loaded
+    // at this point, the emissive triangles thread itself depends on the textures
+    ThreadManager::add_dependency(ThreadManager::SCENE_CACHE_WRITE_THREAD_KEY, ThreadManager::SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES);
+    ThreadManager::start_thread(ThreadManager::SCENE_CACHE_WRITE_THREAD_KEY, SceneCache::save, cache_filepath, std::cref(parsed_scene));
+}
+
+void SceneCache::save(std::string cache_filepath, const Scene& parsed_scene)
+{
+    std::error_code error;
+    std::filesystem::create_directories(SCENE_CACHE_DIRECTORY, error);
+
+    // Writing to a temporary file first so that an interrupted write
+    // never leaves a truncated cache file behind
+    std::string temporary_filepath = cache_filepath + ".tmp";
+    std::ofstream file(temporary_filepath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not create the scene cache file %s", temporary_filepath.c_str());
+
+        return;
+    }
+
+    SceneCacheHeader header;
+    // Placeholder header, rewritten with the offset of the textures at the end
+    write_value(file, header);
+
+    write_vector(file, parsed_scene.materials);
+
+    write_value(file, static_cast<std::uint64_t>(parsed_scene.material_names.size()));
+    for (const std::string& material_name : parsed_scene.material_names)
+        write_vector(file, std::vector<char>(material_name.begin(), material_name.end()));
+
+    write_vector(file, parsed_scene.mesh_bounding_boxes);
+    write_value(file, parsed_scene.scene_bounding_box);
+    write_vector(file, parsed_scene.textures_dims);
+    write_vector(file, parsed_scene.triangle_indices);
+    write_vector(file, parsed_scene.vertices_positions);
+    write_vector(file, parsed_scene.vertex_normals);
+    write_vector(file, parsed_scene.texcoords);
+    write_vector(file, parsed_scene.emissive_triangle_indices);
+    write_vector(file, parsed_scene.material_indices);
+    write_vector(file, parsed_scene.meshes);
+    write_vector(file, parsed_scene.mesh_lods);
+    write_vector(file, parsed_scene.instances);
+    write_vector(file, parsed_scene.envmap_portals);
+    write_vector(file, parsed_scene.spheres);
+    write_value(file, parsed_scene.has_camera);
+    write_value(file, parsed_scene.camera);
+
+    header.textures_offset = static_cast<std::int64_t>(file.tellp());
+    for (const Image8Bit& texture : parsed_scene.textures)
+    {
+        int dims[3] = { texture.width, texture.height, texture.channels };
+
+        write_value(file, dims);
+        write_vector(file, texture.data());
+    }
+
+    file.seekp(0);
+    write_value(file, header);
+    file.close();
+
+    if (!file)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not write the scene cache file %s", temporary_filepath.c_str());
+        std::filesystem::remove(temporary_filepath, error);
+
+        return;
+    }
+
+    std::filesystem::rename(temporary_filepath, cache_filepath, error);
+    if (error)
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not write the scene cache file %s: %s", cache_filepath.c_str(), error.message().c_str());
+}
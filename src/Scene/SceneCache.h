@@ -0,0 +1,64 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "Scene/SceneParser.h"
+
+#include <fstream>
+#include <string>
+
+/**
+ * On-disk binary cache of the scenes parsed by the SceneParser so that
+ * reloading a scene doesn't go through ASSIMP and the decoding of the textures again.
+ *
+ * The cache files are stored in SCENE_CACHE_DIRECTORY and are keyed by a hash of the content
+ * of the scene file, of the parser options that affect the parsed scene and of the layout
+ * of the cached structures. Modifying the scene file thus invalidates its cache entry.
+ *
+ * Note that the external resources of the scene file (the textures or the .bin buffers of
+ * a GLTF file for example) are not part of the key: the cache directory needs to be cleared
+ * if only these resources are modified
+ */
+class SceneCache
+{
+public:
+    static const std::string SCENE_CACHE_DIRECTORY;
+    // Needs to be bumped whenever the layout of the cache files or the way the scenes are parsed changes
+    static constexpr unsigned int SCENE_CACHE_VERSION = 9;
+
+    /**
+     * Fills 'parsed_scene' from the cache entry of the given scene file.
+     *
+     * The geometry is read before returning but the textures are read asynchronously
+     * with the SCENE_TEXTURES_LOADING_THREAD_KEY key, like when parsing the scene file.
+     *
+     * Returns false, leaving 'parsed_scene' untouched, if there is no valid cache entry for
+     * that scene file
+     */
+    static bool load(const std::string& scene_filepath, const SceneParserOptions& options, Scene& parsed_scene);
+
+    /**
+     * Writes the cache entry of the given scene file asynchronously, once the
+     * textures and emissive triangles of 'parsed_scene' have been loaded.
+     *
+     * 'parsed_scene' must stay alive until the thread with the SCENE_CACHE_WRITE_THREAD_KEY
+     * key is joined
+     */
+    static void save_async(const std::string& scene_filepath, const SceneParserOptions& options, const Scene& parsed_scene);
+
+private:
+    /**
+     * Returns the path of the cache file of the given scene file.
+     * Returns an empty string if the scene file couldn't be read
+     */
+    static std::string get_cache_filepath(const std::string& scene_filepath, const SceneParserOptions& options);
+
+    static void save(std::string cache_filepath, const Scene& parsed_scene);
+    static void load_textures(std::string cache_filepath, std::streamoff textures_offset, Scene& parsed_scene);
+};
+
+#endif
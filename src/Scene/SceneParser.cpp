@@ -4,32 +4,57 @@
  */
 
 #include "Image/Image.h"
+#include "Scene/MeshLODBuilder.h"
+#include "Scene/MeshReorderer.h"
+#include "Scene/SceneCache.h"
 #include "Scene/SceneParser.h"
+#include "Scene/VirtualTextureStore.h"
 #include "Threads/ThreadFunctions.h"
 #include "Threads/ThreadManager.h"
 #include "Threads/ThreadState.h"
 #include "UI/ImGui/ImGuiLogger.h"
 #include "Utils/CommandlineArguments.h"
+#include "Utils/TraceRecorder.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include "glm/gtx/matrix_decompose.hpp"
+#include "glm/gtc/type_ptr.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <filesystem>
 #include <memory>
+#include <numeric>
+#include <unordered_map>
 
 extern ImGuiLogger g_imgui_logger;
 
 void SceneParser::parse_scene_file(const std::string& scene_filepath, Assimp::Importer& assimp_importer, Scene& parsed_scene, SceneParserOptions& options)
 {
+    TraceZone trace_zone("Scene parsing");
+
+    if (options.use_scene_cache && SceneCache::load(scene_filepath, options, parsed_scene))
+    {
+        // The scenes with virtual textures aren't cached
+        parsed_scene.linearized_srgb_textures = options.linearize_srgb_textures;
+
+        return;
+    }
+
     const aiScene* scene;
+    // Only the requested scene is cached, not the default scene we may fall back to
+    bool use_scene_cache = options.use_scene_cache;
 
-    scene = assimp_importer.ReadFile(scene_filepath, aiPostProcessSteps::aiProcess_PreTransformVertices | aiPostProcessSteps::aiProcess_Triangulate | aiPostProcessSteps::aiProcess_RemoveRedundantMaterials | aiPostProcessSteps::aiProcess_GenBoundingBoxes);
+    // The bounding boxes of the meshes aren't generated by ASSIMP (aiProcess_GenBoundingBoxes), one mesh after
+    // the other, but while the meshes are copied in parallel, see the second pass over the meshes below
+    scene = assimp_importer.ReadFile(scene_filepath, aiPostProcessSteps::aiProcess_Triangulate | aiPostProcessSteps::aiProcess_RemoveRedundantMaterials);
     if (scene == nullptr)
     {
         std::cerr << assimp_importer.GetErrorString() << std::endl;
         g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Falling back to default scene...");
+        use_scene_cache = false;
 
-        scene = assimp_importer.ReadFile(CommandlineArguments::DEFAULT_SCENE, aiPostProcessSteps::aiProcess_PreTransformVertices | aiPostProcessSteps::aiProcess_Triangulate | aiPostProcessSteps::aiProcess_RemoveRedundantMaterials);
+        scene = assimp_importer.ReadFile(CommandlineArguments::DEFAULT_SCENE, aiPostProcessSteps::aiProcess_Triangulate | aiPostProcessSteps::aiProcess_RemoveRedundantMaterials);
         if (scene == nullptr)
         {
             // Couldn't even load the default scene either
@@ -53,8 +78,6 @@ void SceneParser::parse_scene_file(const std::string& scene_filepath, Assimp::Im
     std::vector<std::pair<aiTextureType, std::string>> texture_paths;
     // Indices of the texture used by a material
     std::vector<ParsedMaterialTextureIndices> material_texture_indices;
-    // Index of the material associated with the texutre
-    std::vector<int> material_indices;
     // How many textures are used per mesh. This is used later when parsing the geometry
     std::vector<int> texture_per_mesh;
     // By how much to offset the indices of the textures used by a material.
@@ -66,38 +89,54 @@ void SceneParser::parse_scene_file(const std::string& scene_filepath, Assimp::Im
     std::vector<int> texture_indices_offsets;
     int texture_count;
 
-    prepare_textures(scene, texture_paths, material_texture_indices, material_indices, texture_per_mesh, texture_indices_offsets, texture_count);
+    prepare_textures(scene, texture_paths, material_texture_indices, texture_per_mesh, texture_indices_offsets, texture_count);
     parsed_scene.materials.resize(scene->mNumMaterials);
     parsed_scene.material_names.resize(scene->mNumMaterials);
+    assign_material_texture_indices(parsed_scene.materials, material_texture_indices, texture_indices_offsets);
+
+    // The properties of the materials are read before the textures start loading
+    // because the texture threads overwrite the properties of the constant textures
+    for (int material_index = 0; material_index < scene->mNumMaterials; material_index++)
+        read_material_properties(scene->mMaterials[material_index], parsed_scene.materials[material_index]);
+    parsed_scene.placeholder_materials.resize(parsed_scene.materials.size());
+    for (int material_index = 0; material_index < parsed_scene.materials.size(); material_index++)
+        parsed_scene.placeholder_materials[material_index] = parsed_scene.materials[material_index].without_textures();
+    // The emissive meshes aren't simplified by the MeshLODBuilder. Looked up before the
+    // texture threads start modifying the materials of the constant emission textures
+    std::vector<bool> emissive_materials(parsed_scene.materials.size());
+    for (int material_index = 0; material_index < parsed_scene.materials.size(); material_index++)
+        emissive_materials[material_index] = parsed_scene.materials[material_index].is_emissive() || parsed_scene.materials[material_index].has_emission_texture();
+
+    std::shared_ptr<TextureLoadingThreadState> texture_threads_state = std::make_shared<TextureLoadingThreadState>();
+    deduplicate_texture_paths(parsed_scene.materials, texture_paths, options.linearize_srgb_textures, *texture_threads_state);
+    texture_count = texture_threads_state->texture_paths.size();
+
     parsed_scene.textures.resize(texture_count);
     parsed_scene.textures_dims.resize(texture_count);
-    assign_material_texture_indices(parsed_scene.materials, material_texture_indices, texture_indices_offsets);
-    dispatch_texture_loading(parsed_scene, scene_filepath, options.nb_texture_threads, texture_paths, material_indices);
+    if (options.virtual_texturing)
+        open_virtual_texture_store(scene_filepath, texture_count, parsed_scene);
+    // The tiles of the virtual textures are always 8 bits
+    parsed_scene.linearized_srgb_textures = options.linearize_srgb_textures && parsed_scene.virtual_textures == nullptr;
+    dispatch_texture_loading(parsed_scene, scene_filepath, options.nb_texture_threads, options.nb_concurrent_texture_reads, texture_threads_state);
 
     parse_camera(scene, parsed_scene, options.override_aspect_ratio);
 
-    // Used to quickly check whether we've already seen a material based on its
-    // index (because multiple meshes may share the same material, we don't want
-    // to duplicate that material in our material array, we want to use only one).
-    // If we've already seen that material, then there's nothing to do and we can
-    // ignore the material of the mesh being processed since we've already added it
-    // to our materials buffer
-    std::unordered_set<int> material_indices_already_seen;
-
-    // If the scene contains multiple meshes, each mesh will have
-    // its vertices indices starting at 0. We don't want that.
-    // We want indices to be continuously growing (because we don't want
-    // the second mesh (with indices starting at 0, i.e its own indices) to use
-    // the vertices of the first mesh that have been parsed (and that use indices 0!)
-    // The offset thus offsets the indices of the meshes that come after the first one
-    // to account for all the indices of the previously parsed meshes
-    int global_indices_offset = 0;
+    // First pass over the meshes: the ranges of the meshes in the buffers of the scene so that the buffers
+    // are allocated once and the meshes can then be copied in parallel, each in its own range.
+    //
+    // The triangles of a mesh index its own vertices, starting at 0. The vertex indices of
+    // the buffers of the scene are global so they're offset by the first vertex of the mesh
+    parsed_scene.meshes.resize(scene->mNumMeshes);
+    parsed_scene.mesh_bounding_boxes.resize(scene->mNumMeshes);
+    int vertex_count = 0;
+    int triangle_count = 0;
+    int normal_count = 0;
+    int texcoords_count = 0;
     for (int mesh_index = 0; mesh_index < scene->mNumMeshes; mesh_index++)
     {
         aiMesh* mesh = scene->mMeshes[mesh_index];
         int material_index = mesh->mMaterialIndex;
         aiMaterial* mesh_material = scene->mMaterials[material_index];
-        
 
         std::string material_name = std::string(mesh_material->GetName().C_Str());
         std::string mesh_name = std::string(mesh->mName.C_Str());
@@ -109,94 +148,97 @@ void SceneParser::parse_scene_file(const std::string& scene_filepath, Assimp::Im
             final_name += mesh_name + " (" + material_name + ")";
         parsed_scene.material_names[material_index] = final_name;
 
-        RendererMaterial& renderer_material = parsed_scene.materials[material_index];
-        if (material_indices_already_seen.find(mesh->mMaterialIndex) == material_indices_already_seen.end())
+        SceneMesh& scene_mesh = parsed_scene.meshes[mesh_index];
+        scene_mesh.first_triangle = triangle_count;
+        scene_mesh.triangle_count = mesh->mNumFaces;
+        scene_mesh.first_vertex = vertex_count;
+        scene_mesh.vertex_count = mesh->mNumVertices;
+        // Only the meshes that have vertex normals / texcoords get storage for them.
+        // The shaders only do smooth shading on the meshes that have vertex normals.
+        //
+        // Looking at texcoords set 0 because that's where "classical" texcoords are.
+        // Other sets are assumed not interesting here. The texcoords of the meshes without
+        // textures are never read so they aren't kept either
+        if (mesh->HasNormals())
         {
-            // If we haven't seen that material before
-
-            read_material_properties(mesh_material, renderer_material);
-            material_indices_already_seen.insert(mesh->mMaterialIndex);
+            scene_mesh.first_normal = normal_count;
+            normal_count += mesh->mNumVertices;
+        }
+        if (mesh->HasTextureCoords(0) && texture_per_mesh[material_index] > 0)
+        {
+            scene_mesh.first_texcoords = texcoords_count;
+            texcoords_count += mesh->mNumVertices;
         }
 
+        vertex_count += mesh->mNumVertices;
+        triangle_count += mesh->mNumFaces;
+    }
 
-        // Inserting the normals if present
-        if (mesh->HasNormals())
-            parsed_scene.vertex_normals.insert(parsed_scene.vertex_normals.end(),
-                reinterpret_cast<float3*>(mesh->mNormals),
-                reinterpret_cast<float3*>(&mesh->mNormals[mesh->mNumVertices]));
-        else
-            parsed_scene.vertex_normals.insert(parsed_scene.vertex_normals.end(), mesh->mNumVertices, hiprtFloat3{0, 0, 0});
+    parsed_scene.vertices_positions.resize(vertex_count);
+    parsed_scene.vertex_normals.resize(normal_count);
+    parsed_scene.texcoords.resize(texcoords_count);
+    parsed_scene.triangle_indices.resize(triangle_count * 3);
+    parsed_scene.material_indices.resize(triangle_count);
 
-        // Inserting texcoords if present, looking at set 0 because that's where "classical" texcoords are.
-        // Other sets are assumed not interesting here.
-        if (mesh->HasTextureCoords(0) && texture_per_mesh[material_index] > 0)
-            for (int i = 0; i < mesh->mNumVertices; i++)
-                parsed_scene.texcoords.push_back(make_float2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y));
-        else
-            parsed_scene.texcoords.insert(parsed_scene.texcoords.end(), mesh->mNumVertices, float2{0.0f, 0.0f});
+    // Second pass, copying the meshes into their ranges
+#pragma omp parallel for schedule(dynamic)
+    for (int mesh_index = 0; mesh_index < scene->mNumMeshes; mesh_index++)
+    {
+        aiMesh* mesh = scene->mMeshes[mesh_index];
+        int material_index = mesh->mMaterialIndex;
+        const SceneMesh& scene_mesh = parsed_scene.meshes[mesh_index];
+        int first_vertex = scene_mesh.first_vertex;
 
-        // Inserting 0 or 1 depending on whether the normals are present or not.
-        // These values will be used in the shader to determine whether we should do
-        // smooth shading or not
-        parsed_scene.has_vertex_normals.insert(parsed_scene.has_vertex_normals.end(), mesh->mNumVertices, mesh->HasNormals());
+        // Adding the bounding box to the parsed scene on the way
+        BoundingBox mesh_bounding_box;
+        for (int vertex_index = 0; vertex_index < mesh->mNumVertices; vertex_index++)
+        {
+            float3 vertex = make_float3(mesh->mVertices[vertex_index].x, mesh->mVertices[vertex_index].y, mesh->mVertices[vertex_index].z);
 
-        // Inserting all the vertices of the mesh
-        parsed_scene.vertices_positions.insert(parsed_scene.vertices_positions.end(), reinterpret_cast<hiprtFloat3*>(&mesh->mVertices[0]), reinterpret_cast<hiprtFloat3*>(&mesh->mVertices[mesh->mNumVertices]));
+            parsed_scene.vertices_positions[first_vertex + vertex_index] = vertex;
+            mesh_bounding_box.extend(vertex);
+        }
+        parsed_scene.mesh_bounding_boxes[mesh_index] = mesh_bounding_box;
 
-        int max_mesh_index_offset = 0;
-        for (int face_index = 0; face_index < mesh->mNumFaces; face_index++)
-        {
-            aiFace face = mesh->mFaces[face_index];
+        if (scene_mesh.first_normal != -1)
+            std::copy(reinterpret_cast<float3*>(mesh->mNormals), reinterpret_cast<float3*>(mesh->mNormals + mesh->mNumVertices), parsed_scene.vertex_normals.begin() + scene_mesh.first_normal);
 
-            int index_1 = face.mIndices[0];
-            int index_2 = face.mIndices[1];
-            int index_3 = face.mIndices[2];
+        if (scene_mesh.first_texcoords != -1)
+            for (int i = 0; i < mesh->mNumVertices; i++)
+                parsed_scene.texcoords[scene_mesh.first_texcoords + i] = make_float2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
 
-            // Accumulating the maximum index of this mesh, this is to know
-            max_mesh_index_offset = std::max(max_mesh_index_offset, std::max(index_1, std::max(index_2, index_3)));
+        int* triangle_indices = parsed_scene.triangle_indices.data() + scene_mesh.first_triangle * 3;
+        for (int face_index = 0; face_index < mesh->mNumFaces; face_index++)
+        {
+            const aiFace& face = mesh->mFaces[face_index];
 
-            parsed_scene.triangle_indices.push_back(index_1 + global_indices_offset);
-            parsed_scene.triangle_indices.push_back(index_2 + global_indices_offset);
-            parsed_scene.triangle_indices.push_back(index_3 + global_indices_offset);
+            triangle_indices[face_index * 3 + 0] = face.mIndices[0] + first_vertex;
+            triangle_indices[face_index * 3 + 1] = face.mIndices[1] + first_vertex;
+            triangle_indices[face_index * 3 + 2] = face.mIndices[2] + first_vertex;
         }
 
-        // We're pushing the same material index for all the faces of this mesh
+        // We're using the same material index for all the faces of this mesh
         // because all faces of a mesh have the same material (that's how ASSIMP assimp_importer's
         // do things internally). An ASSIMP mesh is basically a set of faces that all have the
         // same material.
         // If you're importing the 3D model of a car, even though you probably think of it as only one "3D mesh",
         // ASSIMP sees it as composed of as many meshes as there are different materials
-        parsed_scene.material_indices.insert(parsed_scene.material_indices.end(), mesh->mNumFaces, material_index);
+        std::fill_n(parsed_scene.material_indices.begin() + scene_mesh.first_triangle, mesh->mNumFaces, material_index);
 
-        // Adding the bounding box to the parsed scene
-        aiAABB mesh_aabb = mesh->mAABB;
-        BoundingBox mesh_bounding_box;
-        mesh_bounding_box.mini = make_float3(mesh_aabb.mMin.x, mesh_aabb.mMin.y, mesh_aabb.mMin.z);
-        mesh_bounding_box.maxi = make_float3(mesh_aabb.mMax.x, mesh_aabb.mMax.y, mesh_aabb.mMax.z);
-        if (mesh_bounding_box.get_max_extent() == 0.0f)
-        {
-            // I've had cases where the bounding box given by ASSIMP was (0, 0, 0), (0, 0, 0).
-            // Don't know why
-            //
-            // To avoid this weird, we fall back to manual computation of the bounding box
-
-            // Resetting the bounding because we just set its min and max to (0, 0, 0) and (0, 0, 0)
-            // because of the situation we're in
-            mesh_bounding_box = BoundingBox();
-            for (int vert_index = 0; vert_index < mesh->mNumVertices; vert_index++)
-                mesh_bounding_box.extend(*(float3*)(&mesh->mVertices[vert_index]));
-        }
+        if (options.reorder_triangles)
+            MeshReorderer::reorder_mesh(parsed_scene, mesh_index);
+    }
 
-        parsed_scene.mesh_bounding_boxes.push_back(mesh_bounding_box);
-        // Extending the bounding box of the scene with the bounding box of the mesh
-        parsed_scene.scene_bounding_box.extend(mesh_bounding_box);
+    // After the reordering, the LODs use the final vertices of their mesh
+    if (options.geometry_lods)
+        MeshLODBuilder::build_lods(parsed_scene, emissive_materials);
 
-        // If the max index of the mesh was 19, we want the next to start
-        // at 20, not 19, so we ++
-        max_mesh_index_offset++;
-        // Adding the maximum index of the mesh to our global indices offset 
-        global_indices_offset += max_mesh_index_offset;
-    }
+    // The meshes are kept in their object space and placed in the world by instances
+    // (the nodes of the scene) instead of being pre-transformed and duplicated
+    parse_instances(scene->mRootNode, aiMatrix4x4(), parsed_scene);
+    if (!parsed_scene.spheres.empty())
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%zu analytic spheres", parsed_scene.spheres.size());
+    parsed_scene.envmap_portals.insert(parsed_scene.envmap_portals.end(), options.envmap_portals.begin(), options.envmap_portals.end());
 
     // Adjusting the speed of the camera so that we can cross the scene in approximately Camera::SCENE_CROSS_TIME
     parsed_scene.camera.auto_adjust_speed(parsed_scene.scene_bounding_box);
@@ -213,6 +255,212 @@ void SceneParser::parse_scene_file(const std::string& scene_filepath, Assimp::Im
     // the information of the potential constant-emission textures
     ThreadManager::add_dependency(ThreadManager::SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES, ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY);
     ThreadManager::start_thread(ThreadManager::SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES, ThreadFunctions::load_scene_parse_emissive_triangles, scene, std::ref(parsed_scene));
+
+    if (use_scene_cache && parsed_scene.virtual_textures == nullptr)
+        SceneCache::save_async(scene_filepath, options, parsed_scene);
+}
+
+void SceneParser::open_virtual_texture_store(const std::string& scene_filepath, int texture_count, Scene& parsed_scene)
+{
+    std::shared_ptr<VirtualTextureStore> store = std::make_shared<VirtualTextureStore>();
+    if (!store->open(scene_filepath, texture_count))
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Virtual texturing disabled, loading the textures in memory instead");
+
+        return;
+    }
+
+    parsed_scene.virtual_textures = store;
+}
+
+void SceneParser::parse_instances(const aiNode* node, const aiMatrix4x4& parent_transform, Scene& parsed_scene)
+{
+    aiMatrix4x4 node_transform = parent_transform * node->mTransformation;
+
+    // ASSIMP matrices are row major, float4x4 is column major like GLM
+    glm::mat4x4 object_to_world = glm::transpose(glm::make_mat4(&node_transform.a1));
+    glm::mat4x4 normal_to_world = glm::transpose(glm::inverse(object_to_world));
+
+    if (is_envmap_portal_node(node) || is_analytic_sphere_node(node))
+    {
+        if (is_envmap_portal_node(node))
+            // The geometry of the portals only tells the renderer where the windows are, it isn't rendered
+            parse_envmap_portal(node, *reinterpret_cast<float4x4*>(&object_to_world), parsed_scene);
+        else
+            // The tessellated geometry of the sphere is rendered as an exact sphere instead
+            parse_analytic_sphere(node, *reinterpret_cast<float4x4*>(&object_to_world), parsed_scene);
+
+        for (int i = 0; i < node->mNumChildren; i++)
+            parse_instances(node->mChildren[i], node_transform, parsed_scene);
+
+        return;
+    }
+
+    for (int i = 0; i < node->mNumMeshes; i++)
+    {
+        int mesh_index = node->mMeshes[i];
+        const SceneMesh& scene_mesh = parsed_scene.meshes[mesh_index];
+        if (scene_mesh.triangle_count == 0)
+            continue;
+
+        SceneInstance instance;
+        instance.object_to_world = *reinterpret_cast<float4x4*>(&object_to_world);
+        instance.normal_to_world = *reinterpret_cast<float4x4*>(&normal_to_world);
+        instance.mesh_index = mesh_index;
+        instance.mesh_first_triangle = scene_mesh.first_triangle;
+        instance.triangle_count = scene_mesh.triangle_count;
+        instance.first_scene_primitive = parsed_scene.get_scene_primitive_count();
+        parsed_scene.instances.push_back(instance);
+
+        // Extending the bounding box of the scene with the world space
+        // bounding box of the mesh of the instance
+        const BoundingBox& mesh_bounding_box = parsed_scene.mesh_bounding_boxes[mesh_index];
+        for (int corner = 0; corner < 8; corner++)
+        {
+            float3 corner_point = make_float3(corner & 1 ? mesh_bounding_box.maxi.x : mesh_bounding_box.mini.x,
+                                              corner & 2 ? mesh_bounding_box.maxi.y : mesh_bounding_box.mini.y,
+                                              corner & 4 ? mesh_bounding_box.maxi.z : mesh_bounding_box.mini.z);
+
+            parsed_scene.scene_bounding_box.extend(matrix_X_point(instance.object_to_world, corner_point));
+        }
+    }
+
+    for (int i = 0; i < node->mNumChildren; i++)
+        parse_instances(node->mChildren[i], node_transform, parsed_scene);
+}
+
+bool SceneParser::is_tagged_node(const aiNode* node, const char* name_prefix, const char* metadata_key)
+{
+    if (std::string(node->mName.C_Str()).starts_with(name_prefix))
+        return true;
+
+    if (node->mMetaData == nullptr)
+        return false;
+
+    // GLTF extras of the node, imported as the metadata of the node by ASSIMP
+    for (unsigned int i = 0; i < node->mMetaData->mNumProperties; i++)
+    {
+        if (std::string(node->mMetaData->mKeys[i].C_Str()) != metadata_key)
+            continue;
+
+        const aiMetadataEntry& entry = node->mMetaData->mValues[i];
+        switch (entry.mType)
+        {
+        case AI_BOOL:
+            return *static_cast<bool*>(entry.mData);
+        case AI_INT32:
+            return *static_cast<std::int32_t*>(entry.mData) != 0;
+        case AI_INT64:
+            return *static_cast<std::int64_t*>(entry.mData) != 0;
+        case AI_FLOAT:
+            return *static_cast<float*>(entry.mData) != 0.0f;
+        case AI_DOUBLE:
+            return *static_cast<double*>(entry.mData) != 0.0;
+        default:
+            return false;
+        }
+    }
+
+    return false;
+}
+
+bool SceneParser::is_envmap_portal_node(const aiNode* node)
+{
+    return is_tagged_node(node, "EnvmapPortal", "envmap_portal");
+}
+
+void SceneParser::parse_envmap_portal(const aiNode* node, const float4x4& object_to_world, Scene& parsed_scene)
+{
+    std::vector<float3> world_vertices;
+    // Area weighted normal of the triangles of the portal
+    float3 normal = make_float3(0.0f, 0.0f, 0.0f);
+    for (int i = 0; i < node->mNumMeshes; i++)
+    {
+        const SceneMesh& scene_mesh = parsed_scene.meshes[node->mMeshes[i]];
+        for (int triangle_index = scene_mesh.first_triangle; triangle_index < scene_mesh.first_triangle + scene_mesh.triangle_count; triangle_index++)
+        {
+            float3 vertex_A = matrix_X_point(object_to_world, parsed_scene.vertices_positions[parsed_scene.triangle_indices[triangle_index * 3 + 0]]);
+            float3 vertex_B = matrix_X_point(object_to_world, parsed_scene.vertices_positions[parsed_scene.triangle_indices[triangle_index * 3 + 1]]);
+            float3 vertex_C = matrix_X_point(object_to_world, parsed_scene.vertices_positions[parsed_scene.triangle_indices[triangle_index * 3 + 2]]);
+
+            normal = normal + hippt::cross(vertex_B - vertex_A, vertex_C - vertex_A);
+            world_vertices.push_back(vertex_A);
+            world_vertices.push_back(vertex_B);
+            world_vertices.push_back(vertex_C);
+        }
+    }
+
+    if (world_vertices.empty() || hippt::length(normal) == 0.0f)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Envmap portal \"%s\" has no area, ignored", node->mName.C_Str());
+
+        return;
+    }
+    normal = hippt::normalize(normal);
+
+    // Fitting a rectangle in the plane of the portal to its vertices: the first edge
+    // of the portal gives the direction of the sides of the rectangle
+    float3 axis_u = world_vertices[1] - world_vertices[0];
+    axis_u = hippt::normalize(axis_u - normal * hippt::dot(axis_u, normal));
+    float3 axis_v = hippt::cross(normal, axis_u);
+
+    float min_u = 1.0e35f, max_u = -1.0e35f;
+    float min_v = 1.0e35f, max_v = -1.0e35f;
+    for (const float3& vertex : world_vertices)
+    {
+        float3 local_vertex = vertex - world_vertices[0];
+
+        min_u = std::min(min_u, hippt::dot(local_vertex, axis_u));
+        max_u = std::max(max_u, hippt::dot(local_vertex, axis_u));
+        min_v = std::min(min_v, hippt::dot(local_vertex, axis_v));
+        max_v = std::max(max_v, hippt::dot(local_vertex, axis_v));
+    }
+
+    EnvmapPortal portal;
+    portal.corner = world_vertices[0] + axis_u * min_u + axis_v * min_v;
+    portal.edge_u = axis_u * (max_u - min_u);
+    portal.edge_v = axis_v * (max_v - min_v);
+    portal.normal = normal;
+    portal.area = (max_u - min_u) * (max_v - min_v);
+    parsed_scene.envmap_portals.push_back(portal);
+
+    g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Envmap portal \"%s\" of area %f", node->mName.C_Str(), portal.area);
+}
+
+bool SceneParser::is_analytic_sphere_node(const aiNode* node)
+{
+    return is_tagged_node(node, "AnalyticSphere", "analytic_sphere");
+}
+
+void SceneParser::parse_analytic_sphere(const aiNode* node, const float4x4& object_to_world, Scene& parsed_scene)
+{
+    BoundingBox world_bounding_box;
+    int material_index = -1;
+    for (int i = 0; i < node->mNumMeshes; i++)
+    {
+        const SceneMesh& scene_mesh = parsed_scene.meshes[node->mMeshes[i]];
+        if (scene_mesh.triangle_count == 0)
+            continue;
+
+        if (material_index == -1)
+            material_index = parsed_scene.material_indices[scene_mesh.first_triangle];
+
+        for (int vertex_index = scene_mesh.first_vertex; vertex_index < scene_mesh.first_vertex + scene_mesh.vertex_count; vertex_index++)
+            world_bounding_box.extend(matrix_X_point(object_to_world, parsed_scene.vertices_positions[vertex_index]));
+    }
+
+    if (material_index == -1)
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Analytic sphere \"%s\" has no geometry, ignored", node->mName.C_Str());
+
+        return;
+    }
+
+    // The tessellation of the sphere is inside the sphere, between its vertices, so the
+    // sphere fits the bounding box of the vertices
+    float3 half_extent = (world_bounding_box.maxi - world_bounding_box.mini) * 0.5f;
+    float radius = (half_extent.x + half_extent.y + half_extent.z) / 3.0f;
+    parsed_scene.add_sphere(world_bounding_box.mini + half_extent, radius, material_index);
 }
 
 void SceneParser::parse_camera(const aiScene* scene, Scene& parsed_scene, float frame_aspect_override)
@@ -222,9 +470,20 @@ void SceneParser::parse_camera(const aiScene* scene, Scene& parsed_scene, float
     {
         aiCamera* camera = scene->mCameras[0];
 
-        glm::vec3 camera_position = *reinterpret_cast<glm::vec3*>(&camera->mPosition);
-        glm::vec3 camera_lookat = *reinterpret_cast<glm::vec3*>(&camera->mLookAt);
-        glm::vec3 camera_up = *reinterpret_cast<glm::vec3*>(&camera->mUp);
+        // The camera is defined in the space of its node, bringing it to world space
+        aiMatrix4x4 camera_transform;
+        for (const aiNode* node = scene->mRootNode->FindNode(camera->mName); node != nullptr; node = node->mParent)
+            camera_transform = node->mTransformation * camera_transform;
+        aiMatrix3x3 camera_rotation(camera_transform);
+
+        // Same transformation as the one aiProcess_PreTransformVertices applied to the camera
+        aiVector3D world_position = camera_transform * camera->mPosition;
+        aiVector3D world_lookat = camera_rotation * camera->mLookAt;
+        aiVector3D world_up = camera_rotation * camera->mUp;
+
+        glm::vec3 camera_position = *reinterpret_cast<glm::vec3*>(&world_position);
+        glm::vec3 camera_lookat = *reinterpret_cast<glm::vec3*>(&world_lookat);
+        glm::vec3 camera_up = *reinterpret_cast<glm::vec3*>(&world_up);
 
         glm::mat4x4 lookat = glm::inverse(glm::lookAt(camera_position, camera_lookat, camera_up));
 
@@ -267,7 +526,7 @@ void SceneParser::parse_camera(const aiScene* scene, Scene& parsed_scene, float
     }
 }
 
-void SceneParser::prepare_textures(const aiScene* scene, std::vector<std::pair<aiTextureType, std::string>>& texture_paths, std::vector<ParsedMaterialTextureIndices>& material_texture_indices, std::vector<int>& material_indices, std::vector<int>& texture_per_mesh, std::vector<int>& texture_indices_offsets, int& texture_count)
+void SceneParser::prepare_textures(const aiScene* scene, std::vector<std::pair<aiTextureType, std::string>>& texture_paths, std::vector<ParsedMaterialTextureIndices>& material_texture_indices, std::vector<int>& texture_per_mesh, std::vector<int>& texture_indices_offsets, int& texture_count)
 {
     std::vector<std::pair<aiTextureType, std::string>> mesh_texture_paths;
     int global_texture_index_offset = 0;
@@ -283,7 +542,6 @@ void SceneParser::prepare_textures(const aiScene* scene, std::vector<std::pair<a
 
         int mesh_texture_count = mesh_texture_paths.size();
 
-        material_indices.insert(material_indices.end(), mesh_texture_count, material_index);
         material_texture_indices.push_back(tex_indices);
         texture_paths.insert(texture_paths.end(), mesh_texture_paths.begin(), mesh_texture_paths.end());
         texture_per_mesh.push_back(mesh_texture_count);
@@ -329,22 +587,125 @@ void SceneParser::assign_material_texture_indices(std::vector<RendererMaterial>&
     }
 }
 
-void SceneParser::dispatch_texture_loading(Scene& parsed_scene, const std::string& scene_path, int nb_threads, const std::vector<std::pair<aiTextureType, std::string>>& texture_paths, const std::vector<int>& material_indices)
+void SceneParser::deduplicate_texture_paths(std::vector<RendererMaterial>& materials, const std::vector<std::pair<aiTextureType, std::string>>& texture_paths, bool separate_srgb_textures, TextureLoadingThreadState& texture_state)
 {
+    // Texture slots filled by assign_material_texture_indices()
+    static const int RendererMaterial::* const TEXTURE_INDEX_MEMBERS[] =
+    {
+        &RendererMaterial::base_color_texture_index,
+        &RendererMaterial::emission_texture_index,
+        &RendererMaterial::roughness_texture_index,
+        &RendererMaterial::metallic_texture_index,
+        &RendererMaterial::roughness_metallic_texture_index,
+        &RendererMaterial::specular_texture_index,
+        &RendererMaterial::clearcoat_texture_index,
+        &RendererMaterial::sheen_texture_index,
+        &RendererMaterial::specular_transmission_texture_index,
+        &RendererMaterial::normal_map_texture_index,
+    };
+
+    // The same file loaded with a different number of channels
+    // (packed roughness/metallic or not for example) is a different texture
+    std::unordered_map<std::string, int> unique_texture_indices;
+    for (int material_index = 0; material_index < materials.size(); material_index++)
+    {
+        RendererMaterial& material = materials[material_index];
+        for (int RendererMaterial::* texture_index_member : TEXTURE_INDEX_MEMBERS)
+        {
+            int& texture_index = material.*texture_index_member;
+            if (texture_index < 0)
+                continue;
+
+            const std::pair<aiTextureType, std::string>& type_and_path = texture_paths[texture_index];
+            int channel_count = get_texture_channel_count(type_and_path.first, texture_index_member == &RendererMaterial::roughness_metallic_texture_index);
+            std::string key = type_and_path.second + "|" + std::to_string(channel_count);
+            if (separate_srgb_textures && texture_index_member == &RendererMaterial::base_color_texture_index)
+                // Stored linearized by the GPURenderer, can't be read as is by the other slots
+                key += "|sRGB";
+
+            auto find = unique_texture_indices.find(key);
+            if (find == unique_texture_indices.end())
+            {
+                find = unique_texture_indices.emplace(key, static_cast<int>(texture_state.texture_paths.size())).first;
+
+                texture_state.texture_paths.push_back(type_and_path);
+                texture_state.texture_channel_counts.push_back(channel_count);
+                texture_state.texture_slots.emplace_back();
+            }
+
+            texture_index = find->second;
+            texture_state.texture_slots[texture_index].push_back({ material_index, texture_index_member });
+        }
+    }
+
+    int duplicate_count = static_cast<int>(texture_paths.size() - texture_state.texture_paths.size());
+    if (duplicate_count > 0)
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%d textures referenced by multiple materials, loaded only once", duplicate_count);
+}
+
+int SceneParser::get_texture_channel_count(aiTextureType type, bool packed_roughness_metallic)
+{
+    switch (type)
+    {
+    case aiTextureType_BASE_COLOR:
+    case aiTextureType_DIFFUSE:
+        // 4 Channels because we may want the alpha for transparency handling
+        return 4;
+
+    case aiTextureType_NORMALS:
+    case aiTextureType_HEIGHT:
+        // Don't need the alpha
+        // TODO we only need 3 channels here but it's tricky to handle 3 channels texture with HIP/CUDA. Supported formats are only 1, 2, 4 channels, not three
+        return 4;
+
+    case aiTextureType_DIFFUSE_ROUGHNESS:
+        // 2 channels for a packed metallic/roughness texture (only the G and B channels of the
+        // file are kept, see ThreadFunctions::load_scene_texture()), otherwise 1 channel just for the roughness
+        return packed_roughness_metallic ? 2 : 1;
+
+    case aiTextureType_EMISSIVE:
+        // TODO we only need 3 channels here but it's tricky to handle 3 channels texture with HIP/CUDA. Supported formats are only 1, 2, 4 channels, not three
+        return 4;
+
+    default:
+        return 1;
+    }
+}
+
+void SceneParser::dispatch_texture_loading(Scene& parsed_scene, const std::string& scene_path, int nb_threads, int nb_concurrent_reads, std::shared_ptr<TextureLoadingThreadState> texture_threads_state)
+{
+    int texture_count = texture_threads_state->texture_paths.size();
     if (nb_threads == -1)
         // As many threads as there are textures if -1 was given
-        nb_threads = texture_paths.size();
+        nb_threads = texture_count;
+    // No need for more threads than textures but at least one thread is started because
+    // the renderers join the texture threads
+    nb_threads = std::max(1, std::min(nb_threads, texture_count));
 
-    // Creating a state to keep the data that the threads need alive
-    std::shared_ptr<TextureLoadingThreadState> texture_threads_state = std::make_shared<TextureLoadingThreadState>();
+    // Keeping the data that the threads need alive
     texture_threads_state->scene_filepath = scene_path;
-    texture_threads_state->texture_paths = texture_paths;
-    texture_threads_state->material_indices = material_indices;
+    texture_threads_state->max_concurrent_reads = std::max(1, nb_concurrent_reads);
+
+    // Loading the biggest files first: they take the longest to decode and starting them
+    // last would leave all the other threads idle while they finish
+    std::string scene_directory = scene_path.substr(0, scene_path.rfind('/') + 1);
+    std::vector<std::uintmax_t> file_sizes(texture_count);
+    for (int i = 0; i < texture_count; i++)
+    {
+        std::error_code error;
+        file_sizes[i] = std::filesystem::file_size(scene_directory + texture_threads_state->texture_paths[i].second, error);
+        if (error)
+            file_sizes[i] = 0;
+    }
+
+    texture_threads_state->loading_order.resize(texture_count);
+    std::iota(texture_threads_state->loading_order.begin(), texture_threads_state->loading_order.end(), 0);
+    std::stable_sort(texture_threads_state->loading_order.begin(), texture_threads_state->loading_order.end(), [&file_sizes](int a, int b) { return file_sizes[a] > file_sizes[b]; });
 
     ThreadManager::set_thread_data(ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY, texture_threads_state);
 
     for (int i = 0; i < nb_threads; i++)
-        ThreadManager::start_thread(ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY, ThreadFunctions::load_scene_texture, std::ref(parsed_scene), texture_threads_state->scene_filepath, std::ref(texture_threads_state->texture_paths), std::ref(texture_threads_state->material_indices), i, nb_threads);
+        ThreadManager::start_thread(ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY, ThreadFunctions::load_scene_texture, std::ref(parsed_scene), std::ref(*texture_threads_state));
 }
 
 void SceneParser::read_material_properties(aiMaterial* mesh_material, RendererMaterial& renderer_material)
@@ -10,16 +10,26 @@
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 
+#include "Device/includes/SceneInstances.h"
+#include "HostDeviceCommon/EnvmapPortal.h"
 #include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/MeshVertexAttributes.h"
+#include "HostDeviceCommon/SceneInstance.h"
 #include "Image/Image.h"
 #include "Scene/BoundingBox.h"
 #include "Scene/Camera.h"
 #include "Renderer/Sphere.h"
 #include "Renderer/Triangle.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <memory>
 #include <thread>
 #include <vector>
 
+class VirtualTextureStore;
+struct TextureLoadingThreadState;
+
 /**
  * Structure that holds the indices of the textures of a material during scene parsing
  */
@@ -44,30 +54,138 @@ struct SceneParserOptions
 {
     float override_aspect_ratio;
 
-    // How many CPU threads to use when loading the textures of the scene.
+    // Envmap portals defined by the user, added to the portals
+    // of the geometry of the scene (see Scene::envmap_portals)
+    std::vector<EnvmapPortal> envmap_portals;
+
+    // How many CPU threads decode the textures of the scene. The threads pick
+    // the textures from a shared queue, largest files first, so that a few huge
+    // textures don't leave the other threads idle.
+    //
+    // -1 to use one thread per texture.
+    int nb_texture_threads = 16;
+
+    // How many of the texture threads can read texture files from the disk at the same time.
+    // The decoding of the textures isn't limited, only the reads are.
+    //
+    // Reading all the textures at the same time causes A LOT of random read accesses
+    // on the drive that can SIGNIFICANTLY degrade performance. This is mostly applicable to HDDs
+    // but to SSDs too to some extent. You may want a higher count for fast SSDs.
+    int nb_concurrent_texture_reads = 4;
+
+    // Whether or not to load the scene from the SceneCache if it has already been
+    // parsed before and to write it to the SceneCache otherwise
+    bool use_scene_cache = true;
+
+    // If true and the scene is loaded from the SceneCache, the vertex normals and
+    // texture coordinates of the scene are not read in memory. The GPURenderer instead uploads them
+    // directly from the cache file, see Scene::streamed_buffers.
     // 
-    // Note that blindly defaulting to 1 thread per texture may not be the
-    // best idea, especially on HDDs. This is because with one thread per texture,
-    // all textures will be loading at the same time. Although this may utilize the
-    // CPU very well, this will cause A LOT of random read accesses on the drive
-    // can SIGNIFICANTLY degrade performance. This is mostly applicable to HDDs but
-    // to SSDs too to some extent. You may want to use a higher thread count for SSDs
-    // though to be sure to feed enough work to the CPU to keep up with the fast SSD.
+    // Only supported by the GPURenderer
+    bool stream_cached_vertex_attributes = false;
+
+    // If true, the material textures are not kept in memory but cut in tiles and written
+    // to a VirtualTextureStore as they are loaded. The GPURenderer then streams the tiles
+    // that the shaders need into a fixed size tile pool, see VirtualTextureStreamer.
+    // For scenes whose textures don't fit in VRAM (or RAM).
     // 
-    // -1 to use one thread per texture.
+    // Only supported by the GPURenderer. Scenes loaded with virtual texturing aren't written
+    // to the SceneCache (there are no textures in memory to write)
+    bool virtual_texturing = false;
+
+    // If true, the triangles and vertices of each mesh are reordered along a Morton curve for
+    // the memory locality of the shading, see MeshReorderer. Changes the scene cache entry of the scene
+    bool reorder_triangles = false;
+
+    // If true, coarser versions of the large meshes are generated at load time for the rays that don't
+    // need the full geometry, see MeshLODBuilder and Scene::mesh_lods. Changes the scene cache entry of the scene
+    bool geometry_lods = false;
+
+    // If true, the base color textures (the only sRGB textures of the materials) are never shared with
+    // another texture slot so that the GPURenderer can store them converted to linear in half floats instead
+    // of converting every texture fetch in the shaders, see Scene::linearized_srgb_textures.
+    // Changes the scene cache entry of the scene
     //
-    // 16 seemed to be a good arbitrary number to avoid trashing the disks on my setup 
-    // (tested on the Amazon Lumberyard Bistro on both HDD and SSD)
-    int nb_texture_threads = 16;
+    // Only supported by the GPURenderer, ignored with virtual texturing
+    bool linearize_srgb_textures = false;
+};
+
+/**
+ * Range of the triangles and vertices of a mesh in the buffers of the scene
+ */
+struct SceneMesh
+{
+    int first_triangle = 0;
+    int triangle_count = 0;
+    int first_vertex = 0;
+    int vertex_count = 0;
+
+    // Index of the normal of the first vertex of the mesh in Scene::vertex_normals.
+    // -1 if the mesh has no vertex normals, its triangles are then flat shaded
+    int first_normal = -1;
+    // Same in Scene::texcoords. -1 if the mesh has no texture coordinates or no textures
+    int first_texcoords = -1;
+};
+
+/**
+ * Coarser version of a mesh generated by the MeshLODBuilder. Its triangles use the vertices
+ * (and thus the vertex normals and texture coordinates) of the mesh it simplifies
+ */
+struct SceneMeshLOD
+{
+    int mesh_index = -1;
+    // 1 for the first coarser version of the mesh, increasing with the simplification
+    int level = 1;
+
+    // Range of the triangles of the LOD in the triangle buffers of the scene
+    int first_triangle = 0;
+    int triangle_count = 0;
+
+    // Object space distance up to which the vertices of the LOD are away from the
+    // vertices they replace: the size of the details that the LOD lost
+    float error = 0.0f;
+};
+
+/**
+ * Location of a buffer of the scene in a SceneCache file
+ */
+struct SceneCacheStreamedBuffer
+{
+    std::int64_t file_offset = 0;
+    std::uint64_t element_count = 0;
+};
+
+/**
+ * Buffers of the scene that were left in the SceneCache file instead of being
+ * read in memory (see SceneParserOptions::stream_cached_vertex_attributes)
+ */
+struct SceneCacheStreamedBuffers
+{
+    // Empty if the buffers of the scene are all in memory
+    std::string cache_filepath;
+
+    SceneCacheStreamedBuffer vertex_normals;
+    SceneCacheStreamedBuffer texcoords;
 };
 
 struct Scene
 {
     std::vector<RendererMaterial> materials;
+    // 'materials' without their textures, copied before the textures start loading (the texture loading
+    // threads modify 'materials'). Used to render the scene while its textures are still loading
+    std::vector<RendererMaterial> placeholder_materials;
     // The material names are used for displaying in the material editor of ImGui
     std::vector<std::string> material_names;
     // Material textures. Needs to be index by a material index. 
+    // Empty images if the scene was loaded with virtual texturing
     std::vector<Image8Bit> textures;
+    // Tiles of the material textures if the scene was loaded with
+    // SceneParserOptions::virtual_texturing, nullptr otherwise
+    std::shared_ptr<VirtualTextureStore> virtual_textures;
+    // True if the scene was parsed with SceneParserOptions::linearize_srgb_textures (and without
+    // virtual texturing): the textures read by the base color slots of the materials aren't read
+    // by any other slot and can be stored already converted to linear
+    bool linearized_srgb_textures = false;
 
     std::vector<BoundingBox> mesh_bounding_boxes;
     BoundingBox scene_bounding_box;
@@ -79,38 +197,164 @@ struct Scene
     // and heights to convert UV coordinates [0, 1] to the right range
     std::vector<int2> textures_dims;
 
+    // Triangles of all the meshes of the scene, one mesh after the other.
+    // The vertex indices are global (they index 'vertices_positions' directly)
     std::vector<int> triangle_indices;
+    // Object space positions of the vertices of the meshes
     std::vector<float3> vertices_positions;
-    std::vector<unsigned char> has_vertex_normals;
+    // Vertex normals and texture coordinates of only the meshes that have them,
+    // see SceneMesh::first_normal and SceneMesh::first_texcoords
     std::vector<float3> vertex_normals;
     std::vector<float2> texcoords;
+    // If the scene was loaded from the SceneCache with streamed vertex attributes,
+    // 'vertex_normals' and 'texcoords' are empty and are in the cache file instead
+    SceneCacheStreamedBuffers streamed_buffers;
+    // Scene primitive indices (see SceneInstance) of the emissive triangles, sorted
     std::vector<int> emissive_triangle_indices;
+    // Material index of each triangle of the meshes
     std::vector<int> material_indices;
 
+    std::vector<SceneMesh> meshes;
+    // Levels of detail of the meshes (see SceneParserOptions::geometry_lods), mesh after mesh and level after level.
+    // Their triangles are after the triangles of all the meshes in 'triangle_indices' and 'material_indices', in the
+    // same order. The instances never reference them directly, only the GPURenderer traces rays against them
+    std::vector<SceneMeshLOD> mesh_lods;
+    // Instances of the meshes in the world, sorted by increasing 'first_scene_primitive'
+    std::vector<SceneInstance> instances;
+    // Analytic spheres of the scene, from the geometry of the scene tagged as
+    // sphere (see SceneParser::is_analytic_sphere_node()). Only traced by the GPU renderer
+    std::vector<Sphere> spheres;
+    // Portals of the envmap, from the geometry of the scene tagged as portal
+    // (see SceneParser::is_envmap_portal_node()) and from the commandline
+    std::vector<EnvmapPortal> envmap_portals;
+
     bool has_camera = false;
     Camera camera;
 
-    Sphere add_sphere(const float3& center, float radius, const RendererMaterial& material, int primitive_index)
+    /**
+     * Adds an analytic sphere of the material 'material_index' to the scene, see 'spheres'
+     */
+    const Sphere& add_sphere(const float3& center, float radius, int material_index)
+    {
+        spheres.push_back(Sphere(center, radius, material_index));
+
+        scene_bounding_box.extend(center - make_float3(radius, radius, radius));
+        scene_bounding_box.extend(center + make_float3(radius, radius, radius));
+
+        return spheres.back();
+    }
+
+    bool has_streamed_buffers() const
     {
-        int material_index = materials.size();
+        return !streamed_buffers.cache_filepath.empty();
+    }
 
-        materials.push_back(material);
-        material_indices.push_back(material_index);
+    /**
+     * Where the vertex attributes of each mesh are in 'vertex_normals' and 'texcoords',
+     * for the shaders. Indexed by SceneInstance::mesh_index
+     */
+    std::vector<MeshVertexAttributes> get_mesh_vertex_attributes() const
+    {
+        std::vector<MeshVertexAttributes> mesh_attributes(meshes.size());
+        for (int mesh_index = 0; mesh_index < meshes.size(); mesh_index++)
+        {
+            mesh_attributes[mesh_index].first_vertex = meshes[mesh_index].first_vertex;
+            mesh_attributes[mesh_index].first_normal = meshes[mesh_index].first_normal;
+            mesh_attributes[mesh_index].first_texcoords = meshes[mesh_index].first_texcoords;
 
-        Sphere sphere(center, radius, primitive_index);
+            // The quantization steps of the positions of the vertices span the bounding box of the mesh
+            const BoundingBox& bounding_box = mesh_bounding_boxes[mesh_index];
+            mesh_attributes[mesh_index].position_min = bounding_box.mini;
+            mesh_attributes[mesh_index].position_step = (bounding_box.maxi - bounding_box.mini) / 65535.0f;
+        }
 
-        return sphere;
+        return mesh_attributes;
     }
 
-    std::vector<Triangle> get_triangles()
+    /**
+     * Index of the mesh that contains the triangle 'triangle_index' of the triangle buffers, the mesh
+     * that a LOD simplifies for the triangles of the LODs. The meshes and the LODs are sorted by
+     * increasing 'first_triangle' so this is a binary search
+     */
+    int get_triangle_mesh_index(int triangle_index) const
+    {
+        if (!mesh_lods.empty() && triangle_index >= mesh_lods.front().first_triangle)
+        {
+            auto lod_after = std::upper_bound(mesh_lods.begin(), mesh_lods.end(), triangle_index, [](int index, const SceneMeshLOD& lod) { return index < lod.first_triangle; });
+
+            return (lod_after - 1)->mesh_index;
+        }
+
+        auto mesh_after = std::upper_bound(meshes.begin(), meshes.end(), triangle_index, [](int index, const SceneMesh& mesh) { return index < mesh.first_triangle; });
+
+        return static_cast<int>(mesh_after - meshes.begin()) - 1;
+    }
+
+    /**
+     * Texture coordinates of the 3 vertices of the triangle 'triangle_index' of the meshes, (0, 0)
+     * if its mesh has no texture coordinates, as in the shaders.
+     *
+     * 'texcoords' must be in memory i.e. not streamed from the scene cache, see has_streamed_buffers()
+     */
+    void get_triangle_texcoords(int triangle_index, float2& out_uv_A, float2& out_uv_B, float2& out_uv_C) const
+    {
+        const SceneMesh& mesh = meshes[get_triangle_mesh_index(triangle_index)];
+        if (mesh.first_texcoords == -1)
+        {
+            out_uv_A = out_uv_B = out_uv_C = make_float2(0.0f, 0.0f);
+
+            return;
+        }
+
+        int texcoords_offset = mesh.first_texcoords - mesh.first_vertex;
+        out_uv_A = texcoords[texcoords_offset + triangle_indices[triangle_index * 3 + 0]];
+        out_uv_B = texcoords[texcoords_offset + triangle_indices[triangle_index * 3 + 1]];
+        out_uv_C = texcoords[texcoords_offset + triangle_indices[triangle_index * 3 + 2]];
+    }
+
+    /**
+     * Number of triangles of all the instances of the scene i.e. the number of scene primitives
+     */
+    int get_scene_primitive_count() const
+    {
+        if (instances.empty())
+            return 0;
+
+        return instances.back().first_scene_primitive + instances.back().triangle_count;
+    }
+
+    /**
+     * World space positions of the vertices of the given scene primitive
+     */
+    void get_scene_primitive_vertices(int scene_primitive_index, float3& out_vertex_A, float3& out_vertex_B, float3& out_vertex_C) const
+    {
+        ::get_scene_primitive_vertices(instances.data(), static_cast<int>(instances.size()), triangle_indices.data(), vertices_positions.data(), nullptr, nullptr, scene_primitive_index, out_vertex_A, out_vertex_B, out_vertex_C);
+    }
+
+    int get_scene_primitive_material_index(int scene_primitive_index) const
+    {
+        return ::get_scene_primitive_material_index(instances.data(), static_cast<int>(instances.size()), material_indices.data(), scene_primitive_index);
+    }
+
+    /**
+     * Returns the world space triangles of all the instances of the scene,
+     * in scene primitive order
+     */
+    std::vector<Triangle> get_triangles() const
     {
         std::vector<Triangle> triangles;
+        triangles.reserve(get_scene_primitive_count());
 
-        for (int i = 0; i < triangle_indices.size(); i += 3)
+        for (const SceneInstance& instance : instances)
         {
-            triangles.push_back(Triangle(*reinterpret_cast<float3*>(&vertices_positions[triangle_indices[i + 0]]),
-                                         *reinterpret_cast<float3*>(&vertices_positions[triangle_indices[i + 1]]),
-                                         *reinterpret_cast<float3*>(&vertices_positions[triangle_indices[i + 2]])));
+            for (int i = 0; i < instance.triangle_count; i++)
+            {
+                int triangle_index = instance.mesh_first_triangle + i;
+
+                triangles.push_back(Triangle(matrix_X_point(instance.object_to_world, vertices_positions[triangle_indices[triangle_index * 3 + 0]]),
+                                             matrix_X_point(instance.object_to_world, vertices_positions[triangle_indices[triangle_index * 3 + 1]]),
+                                             matrix_X_point(instance.object_to_world, vertices_positions[triangle_indices[triangle_index * 3 + 2]])));
+            }
         }
 
         return triangles;
@@ -132,10 +376,48 @@ public:
      */
     static void parse_scene_file(const std::string& filepath, Assimp::Importer& assimp_importer, Scene& parsed_scene, SceneParserOptions& options);
 
+    /**
+     * Creates the VirtualTextureStore of 'parsed_scene' for 'texture_count' textures (see
+     * SceneParserOptions::virtual_texturing). If the tile file couldn't be created,
+     * 'parsed_scene.virtual_textures' is left to nullptr and the textures are loaded in memory as usual
+     */
+    static void open_virtual_texture_store(const std::string& scene_filepath, int texture_count, Scene& parsed_scene);
+
 private:
 
     static void parse_camera(const aiScene* scene, Scene& parsed_scene, float frame_aspect_override);
 
+    /**
+     * Walks the node hierarchy of the scene and adds one instance to 'parsed_scene.instances'
+     * for each mesh referenced by a node, with the accumulated transformation of the node
+     */
+    static void parse_instances(const aiNode* node, const aiMatrix4x4& parent_transform, Scene& parsed_scene);
+
+    /**
+     * Whether the node has a 'metadata_key' metadata (GLTF extras) that is true or its name starts with 'name_prefix'
+     */
+    static bool is_tagged_node(const aiNode* node, const char* name_prefix, const char* metadata_key);
+    /**
+     * Whether the geometry of 'node' is an envmap portal: the node has an "envmap_portal"
+     * metadata (GLTF extras) that is true or its name starts with "EnvmapPortal"
+     */
+    static bool is_envmap_portal_node(const aiNode* node);
+    /**
+     * Adds to 'parsed_scene.envmap_portals' the world space rectangle that bounds the
+     * triangles of the meshes of the portal node 'node' in their plane
+     */
+    static void parse_envmap_portal(const aiNode* node, const float4x4& object_to_world, Scene& parsed_scene);
+    /**
+     * Whether the geometry of 'node' stands for an analytic sphere: the node has an "analytic_sphere"
+     * metadata (GLTF extras) that is true or its name starts with "AnalyticSphere"
+     */
+    static bool is_analytic_sphere_node(const aiNode* node);
+    /**
+     * Replaces the geometry of the sphere node 'node' by the analytic sphere that fits the world space
+     * bounding box of its meshes, with the material of its first mesh, see Scene::spheres
+     */
+    static void parse_analytic_sphere(const aiNode* node, const float4x4& object_to_world, Scene& parsed_scene);
+
     /** 
      * Prepares all the necessary data for multithreaded texture-loading
      * 
@@ -146,10 +428,6 @@ private:
      *      by that material. -1 if the material doesn't have that type of texture
      *      (if structure.base_color_texture_index == RendererMaterial::NO_TEXTURE for example, that means
      *      that the material doesn't have a base color texture)
-     * @ material_indices is a vector which is 'number of textures' long and contains the
-     *      index of the material that the texture belongs to.
-     *      If material_indices[3] == 2, this means that the texture 3 (the fourth texure)
-     *      is used by material 2 (which is the third material)
      * @ texture_per_mesh is a list that is 'number of mesh' long and that gives the number
      *      of textures used per mesh
      * @ texture_indices_offset /By how much to offset the indices of the textures used by a material.
@@ -160,9 +438,25 @@ private:
      *      the offsets that are going to be used so that each material has proper texture indices.
      * @ texture_count How many texture are in the scene
      */
-    static void prepare_textures(const aiScene* scene, std::vector<std::pair<aiTextureType, std::string>>& texture_paths, std::vector<ParsedMaterialTextureIndices>& material_texture_indices, std::vector<int>& material_indices, std::vector<int>& texture_per_mesh, std::vector<int>& texture_indices_offsets, int& texture_count);
+    static void prepare_textures(const aiScene* scene, std::vector<std::pair<aiTextureType, std::string>>& texture_paths, std::vector<ParsedMaterialTextureIndices>& material_texture_indices, std::vector<int>& texture_per_mesh, std::vector<int>& texture_indices_offsets, int& texture_count);
     static void assign_material_texture_indices(std::vector<RendererMaterial>& materials, const std::vector<ParsedMaterialTextureIndices>& material_tex_indices, const std::vector<int>& material_textures_offsets);
-    static void dispatch_texture_loading(Scene& parsed_scene, const std::string& scene_path, int nb_threads, const std::vector<std::pair<aiTextureType, std::string>>& texture_paths, const std::vector<int>& material_indices);
+    /**
+     * Merges the textures of 'texture_paths' that are the same file loaded with the same number of
+     * channels and remaps the texture indices of the materials to the merged textures. If 'separate_srgb_textures'
+     * is true, the base color slots never share their texture with the other slots (and the other way around)
+     * 
+     * Fills the unique textures to load and the material slots that use them in 'texture_state'
+     */
+    static void deduplicate_texture_paths(std::vector<RendererMaterial>& materials, const std::vector<std::pair<aiTextureType, std::string>>& texture_paths, bool separate_srgb_textures, TextureLoadingThreadState& texture_state);
+    /**
+     * Number of channels a texture is loaded with depending on its type
+     */
+    static int get_texture_channel_count(aiTextureType type, bool packed_roughness_metallic);
+    /**
+     * Starts the threads that load the textures of 'texture_threads_state'
+     * in order of decreasing file size
+     */
+    static void dispatch_texture_loading(Scene& parsed_scene, const std::string& scene_path, int nb_threads, int nb_concurrent_reads, std::shared_ptr<TextureLoadingThreadState> texture_threads_state);
 
     static void read_material_properties(aiMaterial* mesh_material, RendererMaterial& renderer_material);
     /**
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Scene/SceneParser.h"
+#include "Scene/TriangleOpacityClassifier.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Min and max alpha of the texels of 'texture' in the given texel range, in repeat mode
+ */
+static void get_texels_alpha_range(const Image8Bit& texture, int x_min, int x_max, int y_min, int y_max, unsigned char& out_min_alpha, unsigned char& out_max_alpha)
+{
+    const std::vector<unsigned char>& data = texture.data();
+
+    // The whole texture at most, the range repeats past that
+    x_max = std::min(x_max, x_min + texture.width - 1);
+    y_max = std::min(y_max, y_min + texture.height - 1);
+
+    for (int y = y_min; y <= y_max; y++)
+    {
+        int texel_y = ((y % texture.height) + texture.height) % texture.height;
+
+        for (int x = x_min; x <= x_max; x++)
+        {
+            int texel_x = ((x % texture.width) + texture.width) % texture.width;
+            unsigned char alpha = data[(texel_x + texel_y * texture.width) * texture.channels + 3];
+
+            out_min_alpha = std::min(out_min_alpha, alpha);
+            out_max_alpha = std::max(out_max_alpha, alpha);
+            if (out_min_alpha == 0 && out_max_alpha == 255)
+                // The triangle needs the test whatever the other texels are
+                return;
+        }
+    }
+}
+
+/**
+ * Opacity (TRIANGLE_OPACITY_NEEDS_TEST / OPAQUE / TRANSPARENT) of the texels of 'texture' under the
+ * triangle of texture coordinates 'uv_A', 'uv_B' and 'uv_C'
+ */
+static int get_texels_opacity(const Image8Bit& texture, float2 uv_A, float2 uv_B, float2 uv_C)
+{
+    float2 uv_min = make_float2(std::min({ uv_A.x, uv_B.x, uv_C.x }), std::min({ uv_A.y, uv_B.y, uv_C.y }));
+    float2 uv_max = make_float2(std::max({ uv_A.x, uv_B.x, uv_C.x }), std::max({ uv_A.y, uv_B.y, uv_C.y }));
+
+    // Texel coordinates of the GPU sampling (u * (width - 1)), extended by a texel
+    // on each side for the bilinear filtering
+    int x_min = static_cast<int>(std::floor(uv_min.x * (texture.width - 1))) - 1;
+    int x_max = static_cast<int>(std::ceil(uv_max.x * (texture.width - 1))) + 1;
+    int y_min = static_cast<int>(std::floor(uv_min.y * (texture.height - 1))) - 1;
+    int y_max = static_cast<int>(std::ceil(uv_max.y * (texture.height - 1))) + 1;
+
+    unsigned char min_alpha = 255;
+    unsigned char max_alpha = 0;
+    get_texels_alpha_range(texture, x_min, x_max, y_min, y_max, min_alpha, max_alpha);
+    // The V axis of the texture is flipped by the GPU sampling but not by the CPU sampling
+    // so both orientations are looked at for the classification to hold for both renderers
+    get_texels_alpha_range(texture, x_min, x_max, texture.height - 1 - y_max, texture.height - 1 - y_min, min_alpha, max_alpha);
+
+    if (min_alpha == 255)
+        return TRIANGLE_OPACITY_OPAQUE;
+    else if (max_alpha == 0)
+        return TRIANGLE_OPACITY_TRANSPARENT;
+    else
+        return TRIANGLE_OPACITY_NEEDS_TEST;
+}
+
+std::vector<unsigned char> TriangleOpacityClassifier::compute_texture_opacities(const Scene& scene)
+{
+    size_t triangle_count = scene.material_indices.size();
+    std::vector<unsigned char> texture_opacities(get_packed_size(triangle_count), 0);
+
+    // Alpha range of each base color texture as a whole to avoid looking at
+    // the texels of the textures that are entirely opaque
+    std::vector<int> texture_min_alpha(scene.textures.size(), -1);
+    std::vector<int> texture_max_alpha(scene.textures.size(), -1);
+    for (int i = 0; i < scene.textures.size(); i++)
+    {
+        const Image8Bit& texture = scene.textures[i];
+        if (texture.width == 0 || texture.height == 0)
+            // Texture not in memory, the range stays unknown
+            continue;
+
+        if (texture.channels < 4)
+        {
+            texture_min_alpha[i] = 255;
+            texture_max_alpha[i] = 255;
+
+            continue;
+        }
+
+        unsigned char min_alpha = 255;
+        unsigned char max_alpha = 0;
+        get_texels_alpha_range(texture, 0, texture.width - 1, 0, texture.height - 1, min_alpha, max_alpha);
+        texture_min_alpha[i] = min_alpha;
+        texture_max_alpha[i] = max_alpha;
+    }
+
+    bool texcoords_in_memory = !scene.has_streamed_buffers();
+    for (int triangle_index = 0; triangle_index < triangle_count; triangle_index++)
+    {
+        int texture_index = scene.materials[scene.material_indices[triangle_index]].base_color_texture_index;
+
+        int opacity = TRIANGLE_OPACITY_NEEDS_TEST;
+        if (texture_index == RendererMaterial::NO_TEXTURE)
+            opacity = TRIANGLE_OPACITY_OPAQUE;
+        else if (texture_min_alpha[texture_index] == 255)
+            opacity = TRIANGLE_OPACITY_OPAQUE;
+        else if (texture_max_alpha[texture_index] == 0)
+            opacity = TRIANGLE_OPACITY_TRANSPARENT;
+        else if (texture_min_alpha[texture_index] != -1 && texcoords_in_memory)
+        {
+            float2 uv_A, uv_B, uv_C;
+            scene.get_triangle_texcoords(triangle_index, uv_A, uv_B, uv_C);
+
+            opacity = get_texels_opacity(scene.textures[texture_index], uv_A, uv_B, uv_C);
+        }
+
+        set_triangle_opacity(texture_opacities.data(), triangle_index, opacity);
+    }
+
+    return texture_opacities;
+}
+
+void TriangleOpacityClassifier::compute_opacity_micromaps(const Scene& scene, const std::vector<unsigned char>& texture_opacities, std::vector<int>& out_micromap_indices, std::vector<unsigned char>& out_micromaps)
+{
+    out_micromap_indices.clear();
+    out_micromaps.clear();
+    if (scene.texcoords.empty())
+        // Streamed texcoords or no mesh with textures
+        return;
+
+    constexpr int N = OPACITY_MICROMAP_SEGMENT_COUNT;
+
+    std::vector<unsigned char> micromap(OPACITY_MICROMAP_BYTE_SIZE);
+    for (int triangle_index = 0; triangle_index < scene.material_indices.size(); triangle_index++)
+    {
+        if (get_triangle_opacity(texture_opacities.data(), triangle_index) != TRIANGLE_OPACITY_NEEDS_TEST)
+            continue;
+
+        int texture_index = scene.materials[scene.material_indices[triangle_index]].base_color_texture_index;
+        const Image8Bit& texture = scene.textures[texture_index];
+        if (texture.width == 0 || texture.height == 0)
+            continue;
+
+        float2 uv_A, uv_B, uv_C;
+        scene.get_triangle_texcoords(triangle_index, uv_A, uv_B, uv_C);
+        // Texture coordinates at the barycentric coordinates (u, v), same interpolation as uv_interpolate()
+        auto get_texcoords = [&](float u, float v) { return uv_B * u + uv_C * v + uv_A * (1.0f - u - v); };
+
+        std::fill(micromap.begin(), micromap.end(), 0);
+        bool one_micro_triangle_classified = false;
+        for (int j = 0; j < N; j++)
+        {
+            for (int i = 0; i < N - j; i++)
+            {
+                float u0 = static_cast<float>(i) / N, u1 = static_cast<float>(i + 1) / N;
+                float v0 = static_cast<float>(j) / N, v1 = static_cast<float>(j + 1) / N;
+
+                int upward_opacity = get_texels_opacity(texture, get_texcoords(u0, v0), get_texcoords(u1, v0), get_texcoords(u0, v1));
+                set_triangle_opacity(micromap.data(), j * (2 * N - j) + 2 * i, upward_opacity);
+                one_micro_triangle_classified |= upward_opacity != TRIANGLE_OPACITY_NEEDS_TEST;
+
+                if (i + j < N - 1)
+                {
+                    int downward_opacity = get_texels_opacity(texture, get_texcoords(u1, v0), get_texcoords(u0, v1), get_texcoords(u1, v1));
+                    set_triangle_opacity(micromap.data(), j * (2 * N - j) + 2 * i + 1, downward_opacity);
+                    one_micro_triangle_classified |= downward_opacity != TRIANGLE_OPACITY_NEEDS_TEST;
+                }
+            }
+        }
+
+        if (!one_micro_triangle_classified)
+            // The micromap wouldn't save any texture fetch
+            continue;
+
+        if (out_micromap_indices.empty())
+            out_micromap_indices.resize(scene.material_indices.size(), -1);
+        out_micromap_indices[triangle_index] = static_cast<int>(out_micromaps.size() / OPACITY_MICROMAP_BYTE_SIZE);
+        out_micromaps.insert(out_micromaps.end(), micromap.begin(), micromap.end());
+    }
+}
+
+std::vector<unsigned char> TriangleOpacityClassifier::compute_triangle_opacities(const std::vector<unsigned char>& texture_opacities, const std::vector<int>& micromap_indices, const std::vector<int>& material_indices, const std::vector<RendererMaterial>& materials)
+{
+    std::vector<unsigned char> triangle_opacities(get_packed_size(material_indices.size()), 0);
+
+    for (int triangle_index = 0; triangle_index < material_indices.size(); triangle_index++)
+    {
+        float material_alpha = materials[material_indices[triangle_index]].alpha_opacity;
+        int texture_opacity = get_triangle_opacity(texture_opacities.data(), triangle_index);
+
+        int opacity = TRIANGLE_OPACITY_NEEDS_TEST;
+        if (material_alpha <= 0.0f || texture_opacity == TRIANGLE_OPACITY_TRANSPARENT)
+            opacity = TRIANGLE_OPACITY_TRANSPARENT;
+        else if (material_alpha >= 1.0f && texture_opacity == TRIANGLE_OPACITY_OPAQUE)
+            opacity = TRIANGLE_OPACITY_OPAQUE;
+        else if (material_alpha >= 1.0f && !micromap_indices.empty() && micromap_indices[triangle_index] != -1)
+            // The micromaps only know about the alpha of the texture
+            opacity = TRIANGLE_OPACITY_MICROMAP;
+
+        set_triangle_opacity(triangle_opacities.data(), triangle_index, opacity);
+    }
+
+    return triangle_opacities;
+}
+
+size_t TriangleOpacityClassifier::get_packed_size(size_t triangle_count)
+{
+    return (triangle_count + 3) / 4;
+}
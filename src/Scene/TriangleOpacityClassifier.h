@@ -0,0 +1,62 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef TRIANGLE_OPACITY_CLASSIFIER_H
+#define TRIANGLE_OPACITY_CLASSIFIER_H
+
+#include "HostDeviceCommon/Material.h"
+#include "HostDeviceCommon/TriangleOpacity.h"
+
+#include <vector>
+
+struct Scene;
+
+/**
+ * Classifies the triangles of a scene as opaque / transparent / needing the alpha test
+ * (see HostDeviceCommon/TriangleOpacity.h) so that the alpha test filter function can
+ * skip the material and the base color texture of most of the triangles.
+ *
+ * The classification is done in two steps:
+ *	- compute_texture_opacities() looks at the alpha of the texels of the base color texture
+ *	  covered by the UVs of each triangle (bounding box of the UVs, extended by a texel for the bilinear
+ *	  filtering). This is only done once, when the scene is loaded.
+ *	- compute_opacity_micromaps() then bakes an opacity micromap of the texture for each triangle that
+ *	  still needs the test. Also only done once.
+ *	- compute_triangle_opacities() combines these texture opacities with the 'alpha_opacity' of
+ *	  the materials. Cheap enough to be redone every time the materials are modified
+ */
+class TriangleOpacityClassifier
+{
+public:
+    /**
+     * Opacity of the base color texture under each triangle of 'scene', packed on 2 bits.
+     * Triangles without base color texture are opaque.
+     *
+     * If the texels can't be read (virtual texturing, texture coordinates streamed from the scene cache),
+     * the textured triangles are left as needing the test
+     */
+    static std::vector<unsigned char> compute_texture_opacities(const Scene& scene);
+
+    /**
+     * Bakes the opacity micromaps (see HostDeviceCommon/TriangleOpacity.h) of the triangles of 'scene' that
+     * need the test according to 'texture_opacities'. The micromaps that wouldn't classify any micro-triangle
+     * (textures with noisy alpha, ...) aren't kept.
+     *
+     * 'out_micromap_indices' receives the index of the micromap of each triangle, -1 for the triangles
+     * without micromap, and stays empty if no micromap was baked. 'out_micromaps' receives the
+     * micromaps, OPACITY_MICROMAP_BYTE_SIZE bytes each
+     */
+    static void compute_opacity_micromaps(const Scene& scene, const std::vector<unsigned char>& texture_opacities, std::vector<int>& out_micromap_indices, std::vector<unsigned char>& out_micromaps);
+
+    /**
+     * Opacity of each triangle for the alpha test given the texture opacities returned by
+     * compute_texture_opacities(), the micromap indices of compute_opacity_micromaps() and the materials of the triangles
+     */
+    static std::vector<unsigned char> compute_triangle_opacities(const std::vector<unsigned char>& texture_opacities, const std::vector<int>& micromap_indices, const std::vector<int>& material_indices, const std::vector<RendererMaterial>& materials);
+
+    static size_t get_packed_size(size_t triangle_count);
+};
+
+#endif
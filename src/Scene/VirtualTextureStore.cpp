@@ -0,0 +1,180 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Scene/VirtualTextureStore.h"
+#include "UI/ImGui/ImGuiLogger.h"
+
+#include <algorithm>
+#include <filesystem>
+
+extern ImGuiLogger g_imgui_logger;
+
+const std::string VirtualTextureStore::TILE_FILES_DIRECTORY = "virtual_texture_tiles";
+
+namespace
+{
+    unsigned int pack_texel(const unsigned char* texel, int channels)
+    {
+        // Alpha defaults to 255, the other missing channels to 0
+        unsigned int packed = channels < 4 ? 0xFF000000u : 0u;
+        for (int i = 0; i < channels; i++)
+            packed |= static_cast<unsigned int>(texel[i]) << (8 * i);
+
+        return packed;
+    }
+
+    int get_tile_count(int texel_count)
+    {
+        return (texel_count + VirtualTextureTile::TILE_SIZE - 1) / VirtualTextureTile::TILE_SIZE;
+    }
+}
+
+VirtualTextureStore::~VirtualTextureStore()
+{
+    if (!m_file.is_open())
+        return;
+
+    m_file.close();
+
+    std::error_code error;
+    std::filesystem::remove(m_filepath, error);
+}
+
+bool VirtualTextureStore::open(const std::string& scene_filepath, int texture_count)
+{
+    std::error_code error;
+    std::filesystem::create_directories(TILE_FILES_DIRECTORY, error);
+
+    m_filepath = TILE_FILES_DIRECTORY + "/" + std::filesystem::path(scene_filepath).stem().string() + ".tiles";
+    m_file.open(m_filepath, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+    if (!m_file.is_open())
+    {
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not create the virtual texture tile file %s", m_filepath.c_str());
+
+        return false;
+    }
+
+    m_textures.resize(texture_count);
+    m_page_count = 0;
+
+    return true;
+}
+
+void VirtualTextureStore::add_texture(int texture_index, const Image8Bit& texture)
+{
+    VirtualTextureDesc desc;
+    desc.dims = make_int2(texture.width, texture.height);
+
+    // The mip chain stops at the first level that fits in one tile
+    int page_count = 0;
+    int level_width = texture.width;
+    int level_height = texture.height;
+    while (true)
+    {
+        page_count += get_tile_count(level_width) * get_tile_count(level_height);
+        desc.level_count++;
+
+        if ((level_width <= VirtualTextureTile::TILE_SIZE && level_height <= VirtualTextureTile::TILE_SIZE) || desc.level_count == VIRTUAL_TEXTURE_MAX_LEVELS)
+            break;
+
+        level_width = std::max(1, level_width / 2);
+        level_height = std::max(1, level_height / 2);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Reserving the pages of the texture, they're written without holding the lock
+        int first_page = m_page_count;
+        m_page_count += page_count;
+
+        level_width = texture.width;
+        level_height = texture.height;
+        for (int level = 0; level < desc.level_count; level++)
+        {
+            desc.first_pages[level] = first_page;
+            first_page += get_tile_count(level_width) * get_tile_count(level_height);
+
+            level_width = std::max(1, level_width / 2);
+            level_height = std::max(1, level_height / 2);
+        }
+    }
+
+    Image8Bit downsampled_level;
+    const Image8Bit* level_image = &texture;
+    for (int level = 0; level < desc.level_count; level++)
+    {
+        if (level > 0)
+        {
+            downsampled_level = level_image->downsample_2x();
+            level_image = &downsampled_level;
+        }
+
+        int width = level_image->width;
+        int height = level_image->height;
+        int channels = level_image->channels;
+        const std::vector<unsigned char>& pixels = level_image->data();
+
+        int tiles_per_row = get_tile_count(width);
+        std::vector<VirtualTextureTile> tiles_row(tiles_per_row);
+        for (int tile_y = 0; tile_y < get_tile_count(height); tile_y++)
+        {
+#pragma omp parallel for
+            for (int tile_x = 0; tile_x < tiles_per_row; tile_x++)
+            {
+                // The border texels wrap around the texture, like the sampling in repeat mode
+                for (int y = 0; y < VirtualTextureTile::TILE_STRIDE; y++)
+                {
+                    int texture_y = (tile_y * VirtualTextureTile::TILE_SIZE + y) % height;
+                    for (int x = 0; x < VirtualTextureTile::TILE_STRIDE; x++)
+                    {
+                        int texture_x = (tile_x * VirtualTextureTile::TILE_SIZE + x) % width;
+
+                        tiles_row[tile_x].texels[y * VirtualTextureTile::TILE_STRIDE + x] = pack_texel(&pixels[(texture_x + texture_y * width) * channels], channels);
+                    }
+                }
+            }
+
+            // The tiles of a row are consecutive pages
+            int first_row_page = desc.first_pages[level] + tile_y * tiles_per_row;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_file.seekp(static_cast<std::streamoff>(first_row_page) * sizeof(VirtualTextureTile));
+            m_file.write(reinterpret_cast<const char*>(tiles_row.data()), sizeof(VirtualTextureTile) * tiles_per_row);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file.good())
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the tiles of texture %d to the virtual texture tile file %s", texture_index, m_filepath.c_str());
+
+    m_textures[texture_index] = desc;
+}
+
+bool VirtualTextureStore::read_tile(int page, VirtualTextureTile& out_tile)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_file.seekg(static_cast<std::streamoff>(page) * sizeof(VirtualTextureTile));
+    m_file.read(reinterpret_cast<char*>(&out_tile), sizeof(VirtualTextureTile));
+    if (!m_file.good())
+    {
+        m_file.clear();
+
+        return false;
+    }
+
+    return true;
+}
+
+const std::vector<VirtualTextureDesc>& VirtualTextureStore::get_textures() const
+{
+    return m_textures;
+}
+
+int VirtualTextureStore::get_page_count() const
+{
+    return m_page_count;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef VIRTUAL_TEXTURE_STORE_H
+#define VIRTUAL_TEXTURE_STORE_H
+
+#include "HostDeviceCommon/VirtualTexturing.h"
+#include "Image/Image.h"
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * On-disk storage of the tiles of the material textures of a scene loaded
+ * with SceneParserOptions::virtual_texturing.
+ *
+ * The mip chains of the textures are cut into VirtualTextureTile as the textures are loaded
+ * and written to a scratch tile file so that the textures never have to be in memory all at once.
+ * The tiles are then read back on demand by the VirtualTextureStreamer of the GPURenderer.
+ *
+ * The tile file is deleted when the store is destroyed
+ */
+class VirtualTextureStore
+{
+public:
+    static const std::string TILE_FILES_DIRECTORY;
+
+    VirtualTextureStore() {}
+    VirtualTextureStore(const VirtualTextureStore& other) = delete;
+    ~VirtualTextureStore();
+
+    void operator=(const VirtualTextureStore& other) = delete;
+
+    /**
+     * Creates the tile file for the textures of the given scene.
+     * Must be called before add_texture(). Returns false if the file couldn't be created
+     */
+    bool open(const std::string& scene_filepath, int texture_count);
+
+    /**
+     * Writes the tiles of the mip chain of 'texture' to the tile file.
+     *
+     * Thread safe: the texture loading threads add their textures in any order
+     */
+    void add_texture(int texture_index, const Image8Bit& texture);
+
+    /**
+     * Reads the tile of the given page from the tile file. Thread safe
+     */
+    bool read_tile(int page, VirtualTextureTile& out_tile);
+
+    /**
+     * One for each texture of the scene. The textures that weren't added (constant
+     * emissive textures for example) have no levels.
+     *
+     * Complete once all the textures have been added
+     */
+    const std::vector<VirtualTextureDesc>& get_textures() const;
+    int get_page_count() const;
+
+private:
+    std::mutex m_mutex;
+
+    std::string m_filepath;
+    std::fstream m_file;
+
+    std::vector<VirtualTextureDesc> m_textures;
+    int m_page_count = 0;
+};
+
+#endif
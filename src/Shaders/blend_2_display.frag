@@ -24,14 +24,19 @@ uniform int u_do_tonemapping;
 
 #ifdef COMPUTE_SCREENSHOTER
 uniform layout(binding = 2, rgba8ui) writeonly uimage2D u_output_image;
+#elif defined(COMPUTE_DISPLAY_FROM_BUFFER)
+// Noisy and denoised framebuffers (3 floats per pixel) read directly from their interop buffers
+layout(std430, binding = 0) readonly buffer FramebufferBuffer1 { float u_framebuffer_1[]; };
+layout(std430, binding = 1) readonly buffer FramebufferBuffer2 { float u_framebuffer_2[]; };
+uniform layout(binding = 3, rgba8) writeonly image2D u_output_image;
 #else
 in vec2 vs_tex_coords;
 out vec4 out_color;
 #endif // COMPUTE_SCREENSHOTER
 
-#ifdef COMPUTE_SCREENSHOTER
+#if defined(COMPUTE_SCREENSHOTER) || defined(COMPUTE_DISPLAY_FROM_BUFFER)
 layout(local_size_x = 8, local_size_y = 8) in;
-#endif // COMPUTE_SCREENSHOTER
+#endif // COMPUTE_SCREENSHOTER || COMPUTE_DISPLAY_FROM_BUFFER
 
 void main()
 {
@@ -43,6 +48,16 @@ void main()
 
 	vec4 hdr_color_1 = texelFetch(u_texture_1, thread_id / u_resolution_scaling, 0);
 	vec4 hdr_color_2 = texelFetch(u_texture_2, thread_id / u_resolution_scaling, 0);
+#elif defined(COMPUTE_DISPLAY_FROM_BUFFER)
+	// Same texels as the display textures, the resolution scaling is applied when displaying
+	ivec2 dims = imageSize(u_output_image);
+	ivec2 thread_id = ivec2(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y);
+	if (thread_id.x >= dims.x || thread_id.y >= dims.y)
+		return;
+
+	int pixel_index = thread_id.x + thread_id.y * dims.x;
+	vec4 hdr_color_1 = vec4(u_framebuffer_1[pixel_index * 3 + 0], u_framebuffer_1[pixel_index * 3 + 1], u_framebuffer_1[pixel_index * 3 + 2], 1.0f);
+	vec4 hdr_color_2 = vec4(u_framebuffer_2[pixel_index * 3 + 0], u_framebuffer_2[pixel_index * 3 + 1], u_framebuffer_2[pixel_index * 3 + 2], 1.0f);
 #else
 	vec4 hdr_color_1 = texture(u_texture_1, vs_tex_coords / u_resolution_scaling);
 	vec4 hdr_color_2 = texture(u_texture_2, vs_tex_coords / u_resolution_scaling);
@@ -71,6 +86,8 @@ void main()
 #ifdef COMPUTE_SCREENSHOTER
 	uvec4 ublended_color = uvec4(blended_color * 255);
 	imageStore(u_output_image, thread_id, ublended_color);
+#elif defined(COMPUTE_DISPLAY_FROM_BUFFER)
+	imageStore(u_output_image, thread_id, blended_color);
 #else
 	out_color = blended_color;
 #endif // COMPUTE_SCREENSHOTER
@@ -15,14 +15,18 @@ uniform int u_do_tonemapping;
 
 #ifdef COMPUTE_SCREENSHOTER
 uniform layout(binding = 2, rgba8ui) writeonly uimage2D u_output_image;
+#elif defined(COMPUTE_DISPLAY_FROM_BUFFER)
+// Framebuffer of the renderer (3 floats per pixel) read directly from its interop buffer
+layout(std430, binding = 0) readonly buffer FramebufferBuffer { float u_framebuffer[]; };
+uniform layout(binding = 3, rgba8) writeonly image2D u_output_image;
 #else
 in vec2 vs_tex_coords;
 out vec4 out_color;
 #endif // COMPUTE_SCREENSHOTER
 
-#ifdef COMPUTE_SCREENSHOTER
+#if defined(COMPUTE_SCREENSHOTER) || defined(COMPUTE_DISPLAY_FROM_BUFFER)
 layout(local_size_x = 8, local_size_y = 8) in;
-#endif // COMPUTE_SCREENSHOTER
+#endif // COMPUTE_SCREENSHOTER || COMPUTE_DISPLAY_FROM_BUFFER
 
 void main()
 {
@@ -33,6 +37,15 @@ void main()
 		return;
 
 	vec4 hdr_color = texelFetch(u_texture, thread_id / u_resolution_scaling, 0);
+#elif defined(COMPUTE_DISPLAY_FROM_BUFFER)
+	// Same texels as the display texture, the resolution scaling is applied when displaying
+	ivec2 dims = imageSize(u_output_image);
+	ivec2 thread_id = ivec2(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y);
+	if (thread_id.x >= dims.x || thread_id.y >= dims.y)
+		return;
+
+	int pixel_index = thread_id.x + thread_id.y * dims.x;
+	vec4 hdr_color = vec4(u_framebuffer[pixel_index * 3 + 0], u_framebuffer[pixel_index * 3 + 1], u_framebuffer[pixel_index * 3 + 2], 1.0f);
 #else
 	vec4 hdr_color = texture(u_texture, vs_tex_coords / u_resolution_scaling);
 #endif
@@ -51,6 +64,8 @@ void main()
 
 #ifdef COMPUTE_SCREENSHOTER
 	imageStore(u_output_image, thread_id, uvec4(final_color * 255));
+#elif defined(COMPUTE_DISPLAY_FROM_BUFFER)
+	imageStore(u_output_image, thread_id, final_color);
 #else
 	out_color = final_color;
 #endif // COMPUTE_SCREENSHOTER
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+ #version 430
+
+// Clock cycles of the pixels summed over the samples of the render, one category
+// per channel: camera rays, ReSTIR, path tracing traversal, path tracing shading
+uniform sampler2D u_texture;
+uniform int u_resolution_scaling;
+uniform int u_sample_number;
+
+// 1.0f for the categories that are summed in the displayed cost, 0.0f for the others
+uniform vec4 u_category_weights;
+
+// Same color stops as heatmap_int.frag
+uniform vec3 u_color_stops[16];
+uniform int u_nb_stops;
+
+// Cycles per sample displayed with the last color stop
+uniform float u_max_val;
+
+#ifdef COMPUTE_SCREENSHOTER
+uniform layout(binding = 2, rgba8ui) writeonly uimage2D u_output_image;
+#else
+in vec2 vs_tex_coords;
+out vec4 out_color;
+#endif // COMPUTE_SCREENSHOTER
+
+#ifdef COMPUTE_SCREENSHOTER
+layout(local_size_x = 8, local_size_y = 8) in;
+#endif // COMPUTE_SCREENSHOTER
+void main()
+{
+#ifdef COMPUTE_SCREENSHOTER
+	ivec2 dims = textureSize(u_texture, 0);
+	ivec2 thread_id = ivec2(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y);
+	if (thread_id.x >= dims.x || thread_id.y >= dims.y)
+		return;
+
+	vec4 costs = texelFetch(u_texture, thread_id / u_resolution_scaling, 0);
+#else
+	vec4 costs = texture(u_texture, vs_tex_coords / u_resolution_scaling);
+#endif
+
+	// Average cost of a sample of the pixel. The pixels converged by the adaptive sampling
+	// don't cost anything anymore and get cooler as the render goes on
+	float cost = dot(costs, u_category_weights) / float(u_sample_number);
+	float normalized = clamp(cost / max(u_max_val, 1.0f), 0.0f, 1.0f);
+
+	float stop = normalized * (u_nb_stops - 1);
+	int low_stop = int(floor(stop));
+	int high_stop = int(ceil(stop));
+	float fraction_of_high_stop = stop - low_stop;
+
+	vec4 final_color = vec4(mix(u_color_stops[low_stop], u_color_stops[high_stop], fraction_of_high_stop), 1.0f);
+#ifdef COMPUTE_SCREENSHOTER
+	uvec4 ufinal_color = uvec4(final_color * 255.0f);
+	imageStore(u_output_image, thread_id, ufinal_color);
+#else
+	out_color = final_color;
+#endif // COMPUTE_SCREENSHOTER
+};
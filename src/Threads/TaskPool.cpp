@@ -0,0 +1,263 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Threads/TaskPool.h"
+#include "Utils/TraceRecorder.h"
+
+#include <algorithm>
+#include <thread>
+
+// Index of the worker of the pool running on this thread, -1 for
+// the temporary workers and for the threads that aren't workers
+static thread_local int t_worker_index = -1;
+static thread_local bool t_pool_thread = false;
+static thread_local Task* t_current_task = nullptr;
+
+TaskPool::TaskPool(int worker_count) : m_worker_count(std::max(1, worker_count))
+{
+	m_max_background_tasks = std::max(1, m_worker_count / 2);
+
+	for (int i = 0; i < m_worker_count; i++)
+		m_worker_queues.push_back(std::make_unique<TaskQueues>());
+
+	// The pool lives until the application exits (see ThreadManager::get_task_pool()), the workers
+	// are never joined, the same way as the background threads who were detached before
+	for (int i = 0; i < m_worker_count; i++)
+		std::thread(&TaskPool::worker_loop, this, i).detach();
+}
+
+void TaskPool::add_dependency(const std::shared_ptr<Task>& task, const std::shared_ptr<Task>& predecessor)
+{
+	std::lock_guard<std::mutex> lock(predecessor->mutex);
+	if (predecessor->done)
+		return;
+
+	task->remaining_dependencies++;
+	predecessor->successors.push_back(task);
+}
+
+void TaskPool::submit(const std::shared_ptr<Task>& task)
+{
+	// Releasing the dependency that was held while the dependencies were being added
+	release(task);
+}
+
+void TaskPool::release(const std::shared_ptr<Task>& task)
+{
+	if (--task->remaining_dependencies == 0)
+		enqueue(task);
+}
+
+void TaskPool::enqueue(const std::shared_ptr<Task>& task)
+{
+	task->queued_time = std::chrono::steady_clock::now();
+
+	if (task->dedicated)
+	{
+		std::thread([this, task]() { g_trace_recorder.set_current_thread_name(task->key); execute(task); }).detach();
+
+		return;
+	}
+
+	TaskQueues& queues = t_worker_index >= 0 ? *m_worker_queues[t_worker_index] : m_shared_queues;
+	{
+		std::lock_guard<std::mutex> lock(queues.mutex);
+
+		queues.tasks[task->priority].push_back(task);
+	}
+
+	{
+		// Under the lock so that a worker checking for tasks right before going to sleep can't miss this one
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+
+		m_queued_task_counts[task->priority]++;
+	}
+	m_sleep_condition.notify_one();
+}
+
+void TaskPool::execute(const std::shared_ptr<Task>& task)
+{
+	Task* previous_task = t_current_task;
+	t_current_task = task.get();
+	{
+		TraceZone zone(task->key, task->priority == TASK_PRIORITY_BACKGROUND ? "Background task" : "Task");
+		task->function();
+	}
+	t_current_task = previous_task;
+
+	if (task->priority == TASK_PRIORITY_BACKGROUND && !task->dedicated)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_sleep_mutex);
+
+			m_running_background_tasks--;
+		}
+		// A background task waiting for a slot may now run
+		m_sleep_condition.notify_all();
+	}
+
+	std::vector<std::shared_ptr<Task>> successors;
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+
+		task->done = true;
+		successors.swap(task->successors);
+	}
+	task->promise.set_value();
+
+	for (const std::shared_ptr<Task>& successor : successors)
+		release(successor);
+}
+
+void TaskPool::wait(const std::shared_ptr<Task>& task)
+{
+	if (task->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		return;
+
+	if (!t_pool_thread)
+	{
+		task->future.wait();
+
+		return;
+	}
+
+	// This worker is going to block, another worker takes its place until it's done waiting
+	bool background = t_current_task != nullptr && t_current_task->priority == TASK_PRIORITY_BACKGROUND && !t_current_task->dedicated;
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+
+		m_blocked_workers++;
+		if (background)
+			// Not counted against the background tasks while blocked, the task that
+			// this one is waiting for may be a background task itself
+			m_running_background_tasks--;
+
+		if (m_temporary_workers < m_blocked_workers)
+		{
+			m_temporary_workers++;
+			std::thread(&TaskPool::worker_loop, this, -1).detach();
+		}
+	}
+	m_sleep_condition.notify_all();
+
+	task->future.wait();
+
+	std::lock_guard<std::mutex> lock(m_sleep_mutex);
+	m_blocked_workers--;
+	if (background)
+		m_running_background_tasks++;
+}
+
+int TaskPool::get_worker_count() const
+{
+	return m_worker_count;
+}
+
+std::shared_ptr<Task> TaskPool::pop_task(int worker_index)
+{
+	for (int priority = TASK_PRIORITY_INTERACTIVE; priority <= TASK_PRIORITY_BACKGROUND; priority++)
+	{
+		if (m_queued_task_counts[priority] == 0)
+			continue;
+
+		if (priority == TASK_PRIORITY_BACKGROUND)
+		{
+			std::lock_guard<std::mutex> lock(m_sleep_mutex);
+			if (m_running_background_tasks >= m_max_background_tasks)
+				return nullptr;
+
+			// Reserving the slot before looking for the task
+			m_running_background_tasks++;
+		}
+
+		std::shared_ptr<Task> task = nullptr;
+		if (worker_index >= 0)
+		{
+			// Own queue from the back (the last queued task is the most likely to have its data in the caches)
+			TaskQueues& own_queues = *m_worker_queues[worker_index];
+			std::lock_guard<std::mutex> lock(own_queues.mutex);
+			if (!own_queues.tasks[priority].empty())
+			{
+				task = own_queues.tasks[priority].back();
+				own_queues.tasks[priority].pop_back();
+			}
+		}
+
+		if (task == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(m_shared_queues.mutex);
+			if (!m_shared_queues.tasks[priority].empty())
+			{
+				task = m_shared_queues.tasks[priority].front();
+				m_shared_queues.tasks[priority].pop_front();
+			}
+		}
+
+		// Stealing from the front of the queues of the other workers, starting with the next one
+		for (int i = 1; i <= m_worker_count && task == nullptr; i++)
+		{
+			int victim_index = (std::max(0, worker_index) + i) % m_worker_count;
+			if (victim_index == worker_index)
+				continue;
+
+			TaskQueues& victim_queues = *m_worker_queues[victim_index];
+			std::lock_guard<std::mutex> lock(victim_queues.mutex);
+			if (!victim_queues.tasks[priority].empty())
+			{
+				task = victim_queues.tasks[priority].front();
+				victim_queues.tasks[priority].pop_front();
+			}
+		}
+
+		if (task != nullptr)
+		{
+			m_queued_task_counts[priority]--;
+
+			return task;
+		}
+
+		if (priority == TASK_PRIORITY_BACKGROUND)
+		{
+			// Another worker took the task first
+			std::lock_guard<std::mutex> lock(m_sleep_mutex);
+
+			m_running_background_tasks--;
+		}
+	}
+
+	return nullptr;
+}
+
+bool TaskPool::has_runnable_task()
+{
+	return m_queued_task_counts[TASK_PRIORITY_INTERACTIVE] > 0 || (m_queued_task_counts[TASK_PRIORITY_BACKGROUND] > 0 && m_running_background_tasks < m_max_background_tasks);
+}
+
+void TaskPool::worker_loop(int worker_index)
+{
+	t_worker_index = worker_index;
+	t_pool_thread = true;
+	g_trace_recorder.set_current_thread_name(worker_index == -1 ? "Task pool temporary worker" : "Task pool worker " + std::to_string(worker_index));
+
+	bool temporary = worker_index == -1;
+	while (true)
+	{
+		std::shared_ptr<Task> task = pop_task(worker_index);
+		if (task != nullptr)
+			execute(task);
+
+		std::unique_lock<std::mutex> lock(m_sleep_mutex);
+		if (temporary && m_temporary_workers > m_blocked_workers)
+		{
+			// The worker that this one replaced is done waiting
+			m_temporary_workers--;
+
+			return;
+		}
+
+		if (task == nullptr)
+			m_sleep_condition.wait(lock, [this, temporary]() { return has_runnable_task() || (temporary && m_temporary_workers > m_blocked_workers); });
+	}
+}
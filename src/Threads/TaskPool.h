@@ -0,0 +1,127 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum TaskPriority
+{
+	// Work that the user is waiting for: scene loading, BVH build, kernels of the current render, ...
+	TASK_PRIORITY_INTERACTIVE = 0,
+	// Work that nobody is waiting for, the background kernel precompilation for example. Only runs
+	// when no interactive task is waiting for a worker and on half of the workers at most
+	TASK_PRIORITY_BACKGROUND = 1,
+};
+
+struct Task
+{
+	// ThreadManager key the task was started with
+	std::string key;
+	TaskPriority priority = TASK_PRIORITY_INTERACTIVE;
+	// If true, the task runs on a thread of its own instead of on a worker of the pool.
+	// For the loops that live as long as their owner (render submission, streaming threads, ...)
+	bool dedicated = false;
+	std::function<void()> function;
+
+	// When the task was queued, once all its dependencies completed
+	std::chrono::steady_clock::time_point queued_time;
+
+	// Number of tasks that must complete before this one is queued. Starts at 1 so
+	// that the task isn't queued while its dependencies are being added, see TaskPool::submit()
+	std::atomic<int> remaining_dependencies = 1;
+
+	// Protects 'done' and 'successors'
+	std::mutex mutex;
+	bool done = false;
+	// Tasks that depend on this one
+	std::vector<std::shared_ptr<Task>> successors;
+
+	std::promise<void> promise;
+	std::shared_future<void> future = promise.get_future().share();
+};
+
+/**
+ * Fixed-size pool of worker threads executing a DAG of tasks.
+ *
+ * Each worker has its own queue where the tasks it queues go and the idle workers steal from the queues
+ * of the other workers. The tasks queued by threads that aren't workers go to a shared queue.
+ *
+ * A worker that waits for a task with wait() lends its place to a temporary worker until the
+ * task completes so that tasks waiting for other tasks can't starve the pool.
+ */
+class TaskPool
+{
+public:
+	TaskPool(int worker_count);
+
+	/**
+	 * 'task' will only be queued once 'predecessor' completed. Must be called before submit()
+	 */
+	void add_dependency(const std::shared_ptr<Task>& task, const std::shared_ptr<Task>& predecessor);
+	/**
+	 * Queues 'task' once its dependencies (if any) are completed
+	 */
+	void submit(const std::shared_ptr<Task>& task);
+	/**
+	 * Returns once 'task' is completed
+	 */
+	void wait(const std::shared_ptr<Task>& task);
+
+	int get_worker_count() const;
+
+private:
+	struct TaskQueues
+	{
+		std::mutex mutex;
+		// Indexed by TaskPriority
+		std::deque<std::shared_ptr<Task>> tasks[2];
+	};
+
+	/**
+	 * Decrements the remaining dependencies of 'task' and queues it if there are none left
+	 */
+	void release(const std::shared_ptr<Task>& task);
+	void enqueue(const std::shared_ptr<Task>& task);
+	void execute(const std::shared_ptr<Task>& task);
+	/**
+	 * Highest priority task that this worker can run, from its own queue first, then from
+	 * the shared queue and then stolen from the queues of the other workers.
+	 * 'worker_index' is -1 for the temporary workers, they don't have a queue
+	 */
+	std::shared_ptr<Task> pop_task(int worker_index);
+	bool has_runnable_task();
+
+	void worker_loop(int worker_index);
+
+	int m_worker_count;
+	int m_max_background_tasks;
+
+	std::vector<std::unique_ptr<TaskQueues>> m_worker_queues;
+	TaskQueues m_shared_queues;
+
+	// Indexed by TaskPriority
+	std::atomic<int> m_queued_task_counts[2] = { 0, 0 };
+	std::atomic<int> m_running_background_tasks = 0;
+
+	// Protects the counts of the blocked and temporary workers
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_sleep_condition;
+	// Number of workers waiting in wait() and number of temporary workers replacing them
+	int m_blocked_workers = 0;
+	int m_temporary_workers = 0;
+};
+
+#endif
@@ -5,7 +5,17 @@
 
 #include "Image/Image.h"
 #include "Compiler/GPUKernel.h"
+#include "Scene/VirtualTextureStore.h"
 #include "Threads/ThreadFunctions.h"
+#include "UI/ImGui/ImGuiLogger.h"
+#include "Utils/Utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+
+extern ImGuiLogger g_imgui_logger;
 
 void ThreadFunctions::compile_kernel(GPUKernel& kernel, std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets)
 {
@@ -27,118 +37,237 @@ void ThreadFunctions::precompile_kernel(const std::string& kernel_function_name,
     kernel.compile_silent(hiprt_orochi_ctx, func_name_sets);
 }
 
-void ThreadFunctions::load_scene_texture(Scene& parsed_scene, std::string scene_path, const std::vector<std::pair<aiTextureType, std::string>>& tex_paths, const std::vector<int>& material_indices, int thread_index, int nb_threads)
+/**
+ * Keeps the texture in memory or only its tiles if the scene is loaded with virtual texturing
+ */
+static void store_scene_texture(Scene& parsed_scene, int texture_index, Image8Bit& texture)
 {
-    // Preparing the scene_filepath so that it's ready to be appended with the texture name
-    std::string corrected_filepath;
-    corrected_filepath = scene_path;
-    corrected_filepath = corrected_filepath.substr(0, corrected_filepath.rfind('/') + 1);
+    if (parsed_scene.virtual_textures != nullptr)
+        parsed_scene.virtual_textures->add_texture(texture_index, texture);
+    else
+        parsed_scene.textures[texture_index] = std::move(texture);
+}
 
-    // While loop here so that a single thread can parse multiple textures
-    while (thread_index < parsed_scene.textures.size())
+/**
+ * Whether or not the constant color 'rgba' of a texture can replace
+ * the texture in the given material slot
+ */
+static bool can_fold_constant_texture(int RendererMaterial::* texture_index, const ColorRGBA32F& rgba)
+{
+    if (texture_index == &RendererMaterial::base_color_texture_index)
+        // The alpha of the base color is only read from the texture
+        return rgba.a > 0.99f;
+    else if (texture_index == &RendererMaterial::normal_map_texture_index)
+        // Only a flat normal map can be dropped, a constant but tilted
+        // normal map still perturbs the shading normal
+        return std::abs(rgba.r - 0.5f) < 0.01f && std::abs(rgba.g - 0.5f) < 0.01f;
+
+    return true;
+}
+
+/**
+ * Replaces a constant color texture with the material properties it would have given,
+ * read the same way as the shaders read the texture (see get_intersection_material()).
+ * 
+ * Returns false if the texture isn't constant or if one of the materials that use it needs the texture
+ */
+static bool fold_constant_texture(Scene& parsed_scene, const std::vector<MaterialTextureSlot>& texture_slots, const Image8Bit& texture)
+{
+    if (!texture.is_constant_color(/* threshold */ 5))
+        return false;
+
+    ColorRGBA32F rgba = texture.sample_rgba32f(make_float2(0, 0));
+    for (const MaterialTextureSlot& slot : texture_slots)
+        if (!can_fold_constant_texture(slot.texture_index, rgba))
+            return false;
+
+    for (const MaterialTextureSlot& slot : texture_slots)
     {
-        std::string full_path = corrected_filepath + tex_paths[thread_index].second;
-        aiTextureType type = tex_paths[thread_index].first;
-        int nb_channels;
+        // The other threads only write the slots of their own textures
+        // (and the properties of these slots) so there's no data race on the materials
+        RendererMaterial& material = parsed_scene.materials[slot.material_index];
+        material.*slot.texture_index = RendererMaterial::NO_TEXTURE;
 
-        switch (type)
+        if (slot.texture_index == &RendererMaterial::base_color_texture_index)
+            material.base_color = pow(ColorRGB32F(rgba.r, rgba.g, rgba.b), 2.2f);
+        else if (slot.texture_index == &RendererMaterial::emission_texture_index)
         {
-        case aiTextureType_BASE_COLOR:
-        case aiTextureType_DIFFUSE:
-            // 4 Channels because we may want the alpha for transparency handling
-            nb_channels = 4;
-            break;
-
-        case aiTextureType_NORMALS:
-        case aiTextureType_HEIGHT:
-            // Don't need the alpha
-            // TODO we only need 3 channels here but it's tricky to handle 3 channels texture with HIP/CUDA. Supported formats are only 1, 2, 4 channels, not three
-            nb_channels = 4;
-            break;
-
-        case aiTextureType_DIFFUSE_ROUGHNESS:
-            if (parsed_scene.materials[material_indices[thread_index]].roughness_metallic_texture_index != RendererMaterial::NO_TEXTURE)
-            {
-                // This means we have a packed metallic/roughness texture
-                nb_channels = 2;
-
-                break;
-            }
-            else
-            {
-                // Otherwise, we don't have a packed metallic/roughness texture so only 1 channel just for the roughness
-                nb_channels = 1;
-
-                break;
-            }
-
-        case aiTextureType_EMISSIVE:
-            // TODO we only need 3 channels here but it's tricky to handle 3 channels texture with HIP/CUDA. Supported formats are only 1, 2, 4 channels, not three
-            nb_channels = 4;
-            break;
-
-        default:
-            nb_channels = 1;
-            break;
+            // Using the emission field of the material to store the emission of the texture
+            material.emission_texture_index = RendererMaterial::CONSTANT_EMISSIVE_TEXTURE;
+            material.set_emission(ColorRGB32F(rgba.r, rgba.g, rgba.b));
         }
+        else if (slot.texture_index == &RendererMaterial::roughness_metallic_texture_index)
+        {
+            // Only the G (roughness) and B (metallic) channels of the file are loaded, in R and G
+            material.roughness = rgba.r;
+            material.metallic = rgba.g;
+            material.precompute_anisotropic();
+        }
+        else if (slot.texture_index == &RendererMaterial::roughness_texture_index)
+        {
+            material.roughness = rgba.r;
+            material.precompute_anisotropic();
+        }
+        else if (slot.texture_index == &RendererMaterial::metallic_texture_index)
+            material.metallic = rgba.r;
+        else if (slot.texture_index == &RendererMaterial::specular_texture_index)
+            material.specular = rgba.r;
+        else if (slot.texture_index == &RendererMaterial::clearcoat_texture_index)
+            material.clearcoat = rgba.r;
+        else if (slot.texture_index == &RendererMaterial::sheen_texture_index)
+            material.sheen = rgba.r;
+        else if (slot.texture_index == &RendererMaterial::specular_transmission_texture_index)
+            material.specular_transmission = rgba.r;
+        // Nothing to store for a flat normal map
+    }
+
+    return true;
+}
+
+/**
+ * If a texture with the same content as 'texture' has already been loaded, points the material
+ * slots of 'texture_index' to that texture and returns true. Registers the texture otherwise
+ */
+static bool deduplicate_texture_content(Scene& parsed_scene, TextureLoadingThreadState& texture_state, int texture_index, const Image8Bit& texture)
+{
+    // The dimensions are hashed too so that two textures with the same hash
+    // are, short of a 64 bit collision, the same texture
+    int dims[3] = { texture.width, texture.height, texture.channels };
+    std::uint64_t hash = Utils::fnv1a_hash(dims, sizeof(dims));
+    hash = Utils::fnv1a_hash(texture.data().data(), texture.data().size(), hash);
 
-        Image8Bit texture = Image8Bit::read_image(full_path, nb_channels, false);
+    int existing_texture_index;
+    {
+        std::lock_guard<std::mutex> lock(texture_state.content_hashes_mutex);
 
-        if (type == aiTextureType_EMISSIVE)
+        auto find = texture_state.content_hashes.find(hash);
+        if (find == texture_state.content_hashes.end())
         {
-            if (texture.is_constant_color(/* threshold */ 5))
-            {
-                // The emissive texture is constant color, we can then just not use that texture and use 
-                // the emission filed of the material to store the emission of the texture
-                parsed_scene.materials[material_indices[thread_index]].emission_texture_index = RendererMaterial::CONSTANT_EMISSIVE_TEXTURE;
-
-                ColorRGBA32F emission_rgba = texture.sample_rgba32f(make_float2(0, 0));
-                parsed_scene.materials[material_indices[thread_index]].set_emission(ColorRGB32F(emission_rgba.r, emission_rgba.g, emission_rgba.b));
-            }
-            else
-            {
-                // If not emissive texture special case, we can actually read the texture
-                parsed_scene.textures_dims[thread_index] = make_int2(texture.width, texture.height);
-                parsed_scene.textures[thread_index] = texture;
-            }
+            texture_state.content_hashes[hash] = texture_index;
+
+            return false;
         }
-        else
+
+        existing_texture_index = find->second;
+    }
+
+    for (const MaterialTextureSlot& slot : texture_state.texture_slots[texture_index])
+        parsed_scene.materials[slot.material_index].*slot.texture_index = existing_texture_index;
+
+    return true;
+}
+
+/**
+ * Reads the whole file in memory, waiting for a free read slot of 'texture_state' first
+ */
+static std::vector<unsigned char> read_texture_file(TextureLoadingThreadState& texture_state, const std::string& filepath)
+{
+    {
+        std::unique_lock<std::mutex> lock(texture_state.reads_mutex);
+        texture_state.reads_condition.wait(lock, [&texture_state]() { return texture_state.reads_in_flight < texture_state.max_concurrent_reads; });
+
+        texture_state.reads_in_flight++;
+    }
+
+    std::vector<unsigned char> file_data;
+    std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+    if (file.is_open())
+    {
+        file_data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(file_data.data()), file_data.size());
+        if (!file)
+            file_data.clear();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(texture_state.reads_mutex);
+        texture_state.reads_in_flight--;
+    }
+    texture_state.reads_condition.notify_one();
+
+    return file_data;
+}
+
+void ThreadFunctions::load_scene_texture(Scene& parsed_scene, TextureLoadingThreadState& texture_state)
+{
+    // Preparing the scene_filepath so that it's ready to be appended with the texture name
+    std::string corrected_filepath;
+    corrected_filepath = texture_state.scene_filepath;
+    corrected_filepath = corrected_filepath.substr(0, corrected_filepath.rfind('/') + 1);
+
+    int texture_count = texture_state.loading_order.size();
+    // Logging the progress every 10% of the textures
+    int progress_step = std::max(1, texture_count / 10);
+
+    // Each thread picks the next texture in the queue as soon as it's done with its
+    // texture so the threads stay busy even if a few textures take much longer than the others
+    for (int order_index = texture_state.next_texture++; order_index < texture_count; order_index = texture_state.next_texture++)
+    {
+        int texture_index = texture_state.loading_order[order_index];
+        std::string full_path = corrected_filepath + texture_state.texture_paths[texture_index].second;
+
+        // The disk reads are bounded but the decoding isn't: a thread decodes its
+        // texture while the other threads are reading theirs
+        std::vector<unsigned char> file_data = read_texture_file(texture_state, full_path);
+        int channel_count = texture_state.texture_channel_counts[texture_index];
+        // Reading 2 channels with stb_image gives the grey and alpha channels but the packed
+        // roughness/metallic textures have the roughness in G and the metallic in B: all the
+        // channels are read and only G and B are kept
+        Image8Bit texture = Image8Bit::read_image_from_memory(file_data, full_path, channel_count == 2 ? 4 : channel_count, false);
+        if (channel_count == 2)
+            texture = texture.extract_channels(1, 2);
+        file_data = std::vector<unsigned char>();
+
+        // The constant and duplicate textures aren't kept, their dimensions stay 0
+        // and no material uses them anymore
+        if (!fold_constant_texture(parsed_scene, texture_state.texture_slots[texture_index], texture)
+            && !deduplicate_texture_content(parsed_scene, texture_state, texture_index, texture))
         {
-            // If not emissive texture special case, we can actually read the texture
-            parsed_scene.textures_dims[thread_index] = make_int2(texture.width, texture.height);
-            parsed_scene.textures[thread_index] = texture;
+            parsed_scene.textures_dims[texture_index] = make_int2(texture.width, texture.height);
+            store_scene_texture(parsed_scene, texture_index, texture);
         }
 
-        thread_index += nb_threads;
+        int loaded_count = ++texture_state.loaded_texture_count;
+        if (loaded_count % progress_step == 0 || loaded_count == texture_count)
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Loaded %d/%d textures", loaded_count, texture_count);
     }
 }
 
 void ThreadFunctions::load_scene_parse_emissive_triangles(const aiScene* scene, Scene& parsed_scene)
 {
-    // Looping over all the meshes
-    int current_triangle_index = 0;
-    for (int mesh_index = 0; mesh_index < scene->mNumMeshes; mesh_index++)
+    // Compaction of the triangles of the emissive instances: the emissive triangles of each instance
+    // are counted, the counts are scanned into the offset of each instance in the list and the
+    // instances then fill their range of the list in parallel.
+    //
+    // The instances are sorted by increasing first scene primitive so the emissive triangles indices are sorted too
+    int instance_count = static_cast<int>(parsed_scene.instances.size());
+    std::vector<int> instance_offsets(instance_count + 1, 0);
+    for (int instance_index = 0; instance_index < instance_count; instance_index++)
     {
-        aiMesh* mesh = scene->mMeshes[mesh_index];
-        int material_index = mesh->mMaterialIndex;
-
-        RendererMaterial& renderer_material = parsed_scene.materials[material_index];
+        const SceneInstance& instance = parsed_scene.instances[instance_index];
+        const RendererMaterial& renderer_material = parsed_scene.materials[scene->mMeshes[instance.mesh_index]->mMaterialIndex];
 
         // If the mesh is emissive, we're going to add the indices of its faces to the emissive triangles
         // of the scene such that the triangles can be importance sampled (direct lighting estimation / next-event estimation)
         //
-        // We are not importance sampling emissive texture so if the mesh has an emissive texture attached, we're
-        // not adding its triangles to the list of emissive triangles
-        bool is_mesh_emissive = renderer_material.is_emissive() && !renderer_material.emissive_texture_used;
+        // The meshes with an emission texture are sampled too, the power of their triangles is integrated
+        // from the texture by EmissiveTextureIntegrator
+        bool is_mesh_emissive = renderer_material.is_light_sampled();
 
-        if (is_mesh_emissive)
-        {
-            for (int face_index = 0; face_index < mesh->mNumFaces; face_index++, current_triangle_index++)
-                // Pushing the index of the current triangle if we're looping on an emissive mesh
-                parsed_scene.emissive_triangle_indices.push_back(current_triangle_index);
-        }
-        else
-            current_triangle_index += mesh->mNumFaces;
+        instance_offsets[instance_index + 1] = instance_offsets[instance_index] + (is_mesh_emissive ? instance.triangle_count : 0);
+    }
+
+    parsed_scene.emissive_triangle_indices.resize(instance_offsets.back());
+
+#pragma omp parallel for schedule(dynamic)
+    for (int instance_index = 0; instance_index < instance_count; instance_index++)
+    {
+        // Pushing the scene primitive indices of the triangles if the instance is emissive
+        int* instance_emissive_indices = parsed_scene.emissive_triangle_indices.data() + instance_offsets[instance_index];
+        int emissive_count = instance_offsets[instance_index + 1] - instance_offsets[instance_index];
+
+        std::iota(instance_emissive_indices, instance_emissive_indices + emissive_count, parsed_scene.instances[instance_index].first_scene_primitive);
     }
 }
 
@@ -7,6 +7,7 @@
 #define THREAD_FUNCTIONS_H
 
 #include "Renderer/GPURenderer.h"
+#include "Threads/ThreadState.h"
 
 class ThreadFunctions
 {
@@ -15,7 +16,12 @@ public:
 	static void compile_kernel_silent(GPUKernel& kernel, std::shared_ptr<HIPRTOrochiCtx> hiprt_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets);
 	static void precompile_kernel(const std::string& kernel_function_name, const std::string& kernel_filepath, GPUKernelCompilerOptions options, std::shared_ptr<HIPRTOrochiCtx> hiprt_ctx, const std::vector<hiprtFuncNameSet>& func_name_sets);
 
-	static void load_scene_texture(Scene& parsed_scene, std::string scene_path, const std::vector<std::pair<aiTextureType, std::string>>& tex_paths, const std::vector<int>& material_indices, int thread_index, int nb_threads);
+	/**
+	 * Loads the textures of 'texture_state' until there are no more textures in its queue.
+	 * The constant textures are folded into the properties of the materials that use them
+	 * and the textures with the same content as an already loaded texture are deduplicated
+	 */
+	static void load_scene_texture(Scene& parsed_scene, TextureLoadingThreadState& texture_state);
 
 	/**
 	 * Frees the memory allocated by the aiScene needed when parsing the scene
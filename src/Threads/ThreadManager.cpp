@@ -5,35 +5,190 @@
 
 #include "Threads/ThreadManager.h"
 
-#include <deque>
+#include <algorithm>
 #include <memory>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-std::string ThreadManager::COMPILE_RAY_VOLUME_STATE_SIZE_KERNEL_KEY = "CompileRayVolumeStateSizeKernelKey";
 std::string ThreadManager::COMPILE_KERNELS_THREAD_KEY = "CompileKernelPassesKey";
 
 std::string ThreadManager::RENDER_WINDOW_CONSTRUCTOR = "RenderWindowConstructor";
 std::string ThreadManager::RENDER_WINDOW_RENDERER_INITIAL_RESIZE = "RenderWindowRendererInitialResize";
+std::string ThreadManager::RENDER_WINDOW_RENDER_SUBMISSION = "RenderWindowRenderSubmission";
 
 std::string ThreadManager::RENDERER_STREAM_CREATE = "RendererStreamCreate";
 std::string ThreadManager::RENDERER_SET_ENVMAP = "RendererSetEnvmapKey";
+std::string ThreadManager::RENDERER_ENVMAP_ASYNC_LOAD = "RendererEnvmapAsyncLoad";
+std::string ThreadManager::RENDERER_SCENE_ASYNC_PARSE = "RendererSceneAsyncParse";
+std::string ThreadManager::RENDERER_SCENE_ASYNC_LOAD = "RendererSceneAsyncLoad";
 std::string ThreadManager::RENDERER_BUILD_BVH = "RendererBuildBVH";
 std::string ThreadManager::RENDERER_UPLOAD_MATERIALS = "RendererUploadMaterials";
 std::string ThreadManager::RENDERER_UPLOAD_TEXTURES = "RendererUploadTextures";
 std::string ThreadManager::RENDERER_UPLOAD_EMISSIVE_TRIANGLES = "RendererUploadEmissiveTriangles";
-
-std::string ThreadManager::RENDERER_PRECOMPILE_KERNELS = "RendererPrecompileKernel";
-std::string ThreadManager::RESTIR_DI_PRECOMPILE_KERNELS = "ReSTIRDIPrecompileKernel";
+std::string ThreadManager::RENDERER_VIRTUAL_TEXTURE_STREAMING = "RendererVirtualTextureStreaming";
+std::string ThreadManager::RENDERER_STREAM_GEOMETRIES = "RendererStreamGeometries";
+std::string ThreadManager::RENDERER_PROGRESSIVE_LOADING = "RendererProgressiveLoading";
+std::string ThreadManager::RENDERER_PRECOMPILE_KERNELS = "RendererPrecompileKernels";
+std::string ThreadManager::RENDERER_RUNTIME_KERNEL_VARIANTS = "RendererRuntimeKernelVariants";
+std::string ThreadManager::RENDERER_KERNEL_HOT_RELOAD = "RendererKernelHotReload";
 
 std::string ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY = "TextureThreadsKey";
 std::string ThreadManager::SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES = "ParseEmissiveTrianglesKey";
+std::string ThreadManager::SCENE_CACHE_WRITE_THREAD_KEY = "SceneCacheWriteKey";
+std::string ThreadManager::SCREENSHOT_WRITE_THREAD_KEY = "ScreenshotWriteKey";
+std::string ThreadManager::SEQUENCE_FRAME_WRITE_THREAD_KEY = "SequenceFrameWriteKey";
+std::string ThreadManager::CHECKPOINT_WRITE_THREAD_KEY = "CheckpointWriteKey";
+std::string ThreadManager::RENDER_SERVER_LISTEN_THREAD_KEY = "RenderServerListenKey";
 std::string ThreadManager::ENVMAP_LOAD_FROM_DISK_THREAD = "EnvmapLoadThreadsKey";
 
 bool ThreadManager::m_monothread = false;
+std::mutex ThreadManager::m_mutex;
 std::unordered_map<std::string, std::shared_ptr<void>> ThreadManager::m_threads_states;
-std::unordered_map<std::string, std::vector<std::thread>> ThreadManager::m_threads_map;
-std::unordered_map<std::string, std::mutex> ThreadManager::m_join_mutexes;
+std::unordered_map<std::string, std::vector<std::shared_ptr<Task>>> ThreadManager::m_tasks_map;
 std::unordered_map<std::string, std::unordered_set<std::string>> ThreadManager::m_dependencies;
+std::unordered_map<std::string, TaskPriority> ThreadManager::m_priorities;
+std::unordered_map<std::string, ThreadManager::KeyTimes> ThreadManager::m_key_times;
+
+TaskPool& ThreadManager::get_task_pool()
+{
+	static TaskPool* task_pool = new TaskPool(std::max(4, static_cast<int>(std::thread::hardware_concurrency())));
+
+	return *task_pool;
+}
+
+std::shared_future<void> ThreadManager::start_task(const std::string& key, std::function<void()> function, bool dedicated)
+{
+	std::shared_ptr<Task> task = std::make_shared<Task>();
+	task->key = key;
+	task->dedicated = dedicated;
+
+	// The task is kept alive by the pool while it runs
+	Task* task_pointer = task.get();
+	task->function = [task_pointer, function]() {
+		auto start = std::chrono::steady_clock::now();
+		function();
+		auto stop = std::chrono::steady_clock::now();
+
+		float queued_time_ms = std::chrono::duration_cast<std::chrono::microseconds>(start - task_pointer->queued_time).count() / 1000.0f;
+		float run_time_ms = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0f;
+		record_task_time(task_pointer->key, queued_time_ms, run_time_ms);
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto find_priority = m_priorities.find(key);
+		if (find_priority != m_priorities.end())
+			task->priority = find_priority->second;
+
+		KeyTimes& key_times = m_key_times[key];
+		if (key_times.started_count == key_times.done_count)
+			key_times.first_start_time = std::chrono::steady_clock::now();
+		key_times.started_count++;
+
+		if (!m_monothread)
+		{
+			auto find_dependencies = m_dependencies.find(key);
+			if (find_dependencies != m_dependencies.end())
+			{
+				for (const std::string& dependency : find_dependencies->second)
+				{
+					auto find_dependency_tasks = m_tasks_map.find(dependency);
+					if (find_dependency_tasks == m_tasks_map.end())
+						continue;
+
+					for (const std::shared_ptr<Task>& dependency_task : find_dependency_tasks->second)
+						get_task_pool().add_dependency(task, dependency_task);
+				}
+			}
+		}
+
+		m_tasks_map[key].push_back(task);
+	}
+
+	if (m_monothread)
+	{
+		// The tasks of the dependencies already ran on this thread when they were started
+		task->queued_time = std::chrono::steady_clock::now();
+		task->function();
+		task->done = true;
+		task->promise.set_value();
+	}
+	else
+		get_task_pool().submit(task);
+
+	return task->future;
+}
+
+void ThreadManager::record_task_time(const std::string& key, float queued_time_ms, float run_time_ms)
+{
+	KeyTimes finished_key_times;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		KeyTimes& key_times = m_key_times[key];
+		key_times.done_count++;
+		key_times.run_time_ms += run_time_ms;
+		key_times.queued_time_ms += std::max(0.0f, queued_time_ms);
+		if (key_times.done_count != key_times.started_count)
+			return;
+
+		finished_key_times = key_times;
+		m_key_times.erase(key);
+	}
+
+	float wall_time_ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - finished_key_times.first_start_time).count() / 1000.0f;
+	g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Tasks \"%s\": %d done in %.1fms (%.1fms of work, %.1fms waiting for a worker)", key.c_str(), finished_key_times.done_count, wall_time_ms, finished_key_times.run_time_ms, finished_key_times.queued_time_ms);
+}
+
+void ThreadManager::join_threads(const std::string& key)
+{
+	std::vector<std::shared_ptr<Task>> tasks;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto find = m_tasks_map.find(key);
+		if (find == m_tasks_map.end())
+		{
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Trying to joing threads with key \"%s\" but no threads have been started with this key.", key.c_str());
+
+			return;
+		}
+
+		tasks = find->second;
+	}
+
+	for (const std::shared_ptr<Task>& task : tasks)
+		get_task_pool().wait(task);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// Tasks may have been started with the same key while waiting, only the ones waited for are removed
+	std::erase_if(m_tasks_map[key], [&tasks](const std::shared_ptr<Task>& task) { return std::find(tasks.begin(), tasks.end(), task) != tasks.end(); });
+}
+
+void ThreadManager::join_all_threads_except(const std::unordered_set<std::string>& excluded_keys)
+{
+	std::vector<std::string> keys_to_join;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (const auto& key_to_tasks : m_tasks_map)
+			if (!depends_on(key_to_tasks.first, excluded_keys))
+				keys_to_join.push_back(key_to_tasks.first);
+	}
+
+	// The tasks wait for their dependencies so the keys can be joined in any order
+	for (const std::string& key : keys_to_join)
+		join_threads(key);
+}
+
+void ThreadManager::detach_threads(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto find = m_tasks_map.find(key);
+	if (find != m_tasks_map.end())
+		find->second.clear();
+}
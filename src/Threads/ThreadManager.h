@@ -6,16 +6,21 @@
 #ifndef THREAD_MANAGER_H
 #define THREAD_MANAGER_H
 
+#include <chrono>
 #include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "Threads/TaskPool.h"
 #include "UI/ImGui/ImGuiLogger.h"
 
 extern ImGuiLogger g_imgui_logger;
@@ -23,39 +28,55 @@ extern ImGuiLogger g_imgui_logger;
 // TODO make this class not a singleton but a global variable instead
 
 /**
- * Singleton class so that threads are accessible everywhere to be .join()
+ * Singleton class so that tasks are accessible everywhere to be joined
  * whenever we want without having to pass them around in function calls etc...
  * 
- * This class works by creating threads and storing them in std::vectors.
- * Which std::vector is the thread going to be stored in depends on the key that is given.
- * Keys are basically used to give some kind of "name" to threads. The main use for that
- * is that all threads with the same key can be joined at the same time. So for example,
- * if you add 2 threads, both with the key 'MY_THREAD_KEY', they will both be added to
- * the same std::vector (these std::vectors are in the thread_map which is an attribute
- * of this class). Then, when you decide to join threads with the 'MY_THREAD_KEY' key,
- * all threads of the corresponding std::vector will be .join()
+ * The functions given to start_thread() are run as tasks by a pool of worker threads shared by the whole
+ * application (see TaskPool) instead of by a thread of their own. Keys are basically used to give some kind
+ * of "name" to tasks. The main use for that is that all tasks with the same key can be joined at the same time.
+ * So for example, if you start 2 tasks, both with the key 'MY_THREAD_KEY', joining the 'MY_THREAD_KEY' key
+ * waits for both of them.
+ * 
+ * The tasks of a key that depends on other keys (see add_dependency()) only start once all the tasks
+ * of these keys are done, which themselves wait for their own dependencies.
+ * 
+ * The loops that only return when their owner stops them must be started with start_dedicated_thread(),
+ * they would otherwise keep a worker of the pool for themselves.
+ * 
+ * Once all the tasks started with a key are done, the time they took is written to the log
  */
 class ThreadManager
 {
 public:
-	static std::string COMPILE_RAY_VOLUME_STATE_SIZE_KERNEL_KEY;
 	static std::string COMPILE_KERNELS_THREAD_KEY;
 
 	static std::string RENDER_WINDOW_CONSTRUCTOR;
 	static std::string RENDER_WINDOW_RENDERER_INITIAL_RESIZE;
+	static std::string RENDER_WINDOW_RENDER_SUBMISSION;
 
 	static std::string RENDERER_STREAM_CREATE;
 	static std::string RENDERER_SET_ENVMAP;
+	static std::string RENDERER_ENVMAP_ASYNC_LOAD;
+	static std::string RENDERER_SCENE_ASYNC_PARSE;
+	static std::string RENDERER_SCENE_ASYNC_LOAD;
 	static std::string RENDERER_BUILD_BVH;
 	static std::string RENDERER_UPLOAD_MATERIALS;
 	static std::string RENDERER_UPLOAD_TEXTURES;
 	static std::string RENDERER_UPLOAD_EMISSIVE_TRIANGLES;
-
+	static std::string RENDERER_VIRTUAL_TEXTURE_STREAMING;
+	static std::string RENDERER_STREAM_GEOMETRIES;
+	static std::string RENDERER_PROGRESSIVE_LOADING;
 	static std::string RENDERER_PRECOMPILE_KERNELS;
-	static std::string RESTIR_DI_PRECOMPILE_KERNELS;
+	static std::string RENDERER_RUNTIME_KERNEL_VARIANTS;
+	static std::string RENDERER_KERNEL_HOT_RELOAD;
 		
 	static std::string SCENE_TEXTURES_LOADING_THREAD_KEY;
 	static std::string SCENE_LOADING_PARSE_EMISSIVE_TRIANGLES;
+	static std::string SCENE_CACHE_WRITE_THREAD_KEY;
+	static std::string SCREENSHOT_WRITE_THREAD_KEY;
+	static std::string SEQUENCE_FRAME_WRITE_THREAD_KEY;
+	static std::string CHECKPOINT_WRITE_THREAD_KEY;
+	static std::string RENDER_SERVER_LISTEN_THREAD_KEY;
 	static std::string ENVMAP_LOAD_FROM_DISK_THREAD;
 
 	/**
@@ -70,182 +91,189 @@ public:
 	template <typename T>
 	static void set_thread_data(const std::string& key, std::shared_ptr<T> state)
 	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
 		m_threads_states[key] = std::static_pointer_cast<void>(state);
 	}
 
-	template <class _Fn, class... _Args>
-	static void start_thread(std::string key, _Fn function, _Args... args)
+	/**
+	 * The tasks started with 'key' after this call are run with that priority.
+	 * TASK_PRIORITY_INTERACTIVE by default
+	 */
+	static void set_priority(const std::string& key, TaskPriority priority)
 	{
-		const std::unordered_set<std::string>& dependencies = m_dependencies[key];
-		if (!dependencies.empty())
-			start_with_dependencies(dependencies, key, function, args...);
-		else
-		{
-			if (m_monothread)
-			{
-				start_serial_thread(key, function, args...);
-
-				// Creates the entry in the map if it doesn't exist. Doesn't do anything if it already exists.
-				// This is so that other parts of the ThreadManager don't scream when trying to join threads
-				// that haven't been started ("started" meaning that there is an entry in the map) for example
-				bool empty = m_threads_map[key].empty();
-			}
-			else
-				// Starting the thread and adding it to the list of threads for the given key
-				m_threads_map[key].push_back(std::thread(function, args...));
-		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_priorities[key] = priority;
 	}
 
 	/**
-	 * This function starts a thread on the main thread i.e. not asynchronously and waits for
-	 * the completion of the given function before returning
+	 * Number of workers of the task pool, the number of tasks that can run at the same time
 	 */
-	template <class _Fn, class... _Args>
-	static void start_serial_thread(std::string key, _Fn function, _Args... args)
+	static int get_worker_count()
 	{
-		// Creating an entry in the map to 'fake' that we've started a thread
-		bool empty = m_threads_map[key].empty();
-
-		function(args...);
+		return get_task_pool().get_worker_count();
 	}
 
-	static void join_threads(const std::string& key)
+	/**
+	 * Runs 'function(args...)' as a task of the pool once the tasks of the dependencies of 'key' are
+	 * done. The arguments are copied, std::ref() must be used to pass references.
+	 * 
+	 * The returned future is ready once the task is done
+	 */
+	template <class _Fn, class... _Args>
+	static std::shared_future<void> start_thread(std::string key, _Fn function, _Args... args)
 	{
-		std::lock_guard<std::mutex> lock(m_join_mutexes[key]);
+		return start_task(key, bind_task_function(std::move(function), std::move(args)...), /* dedicated */ false);
+	}
 
-		auto find = m_threads_map.find(key);
-		if (find != m_threads_map.end())
-		{
-			if (find->second.empty())
-				// No threads to wait for
-				return;
+	/**
+	 * Same as start_thread() but 'function' runs on a thread of its own instead of on a worker of the
+	 * pool. For the functions that loop until their owner stops them
+	 */
+	template <class _Fn, class... _Args>
+	static std::shared_future<void> start_dedicated_thread(std::string key, _Fn function, _Args... args)
+	{
+		return start_task(key, bind_task_function(std::move(function), std::move(args)...), /* dedicated */ true);
+	}
 
-			for (std::thread& thread : find->second)
-				if (thread.joinable())
-					thread.join();
-		}
-		else
+	/**
+	 * This function starts a thread on the main thread i.e. not asynchronously and waits for
+	 * the completion of the given function before returning
+	 */
+	template <class _Fn, class... _Args>
+	static void start_serial_thread(std::string key, _Fn function, _Args... args)
+	{
 		{
-			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Trying to joing threads with key \"%s\" but no threads have been started with this key.", key.c_str());
+			// Creating an entry in the map to 'fake' that we've started a thread
+			std::lock_guard<std::mutex> lock(m_mutex);
 
-			return;
+			m_tasks_map[key];
 		}
 
-		m_threads_map[key].clear();
+		function(args...);
 	}
 
+	/**
+	 * Waits for all the tasks started with 'key' (and so for their dependencies)
+	 */
+	static void join_threads(const std::string& key);
+
 	static void join_all_threads()
 	{
-		// Joining all the threads and their dependencies
-		for (const auto& key_to_threads : m_threads_map)
-		{
-			std::deque<std::string> dependencies_to_wait_for;
-			std::deque<std::string> dependencies_to_analyze;
-
-			const std::string& thread_key = key_to_threads.first;
-			if (!m_dependencies[thread_key].empty())
-				for (const std::string& dependency : m_dependencies[thread_key])
-					dependencies_to_analyze.push_back(dependency);
-			// Pushing the thread key itself we want to wait for and then we'll
-			// push its dependencies in front of it so that we wait for the dependencies first
-			dependencies_to_wait_for.push_front(thread_key);
-
-			while (!dependencies_to_analyze.empty())
-			{
-				std::string new_dependency = dependencies_to_analyze.front();
-				dependencies_to_analyze.pop_front();
-				dependencies_to_wait_for.push_front(new_dependency);
-
-				const std::unordered_set<std::string>& dependencies = m_dependencies[new_dependency];
-				for (const std::string& dependency : dependencies)
-					dependencies_to_analyze.push_front(dependency);
-			}
-
-			std::unordered_set<std::string> dependencies_already_joined;
-			for (const std::string& dependency : dependencies_to_wait_for)
-			{
-				if (dependencies_already_joined.find(dependency) == dependencies_already_joined.end())
-				{
-					// Dependency not joined yet
-					dependencies_already_joined.insert(dependency);
-					join_threads(dependency);
-				}
-			}
-		}
+		join_all_threads_except({});
 	}
 
-	static void detach_threads(const std::string& key)
-	{
-		auto find = m_threads_map.find(key);
-		if (find == m_threads_map.end())
-			return;
+	/**
+	 * Same as join_all_threads() but the threads started with one of the 'excluded_keys'
+	 * are left running, as well as the threads that depend on them, even indirectly
+	 */
+	static void join_all_threads_except(const std::unordered_set<std::string>& excluded_keys);
 
-		for (std::thread& thread : find->second)
-			if (thread.joinable())
-				thread.detach();
-	}
+	/**
+	 * The tasks started with 'key' so far keep running but won't be waited for by join_threads(),
+	 * nor by the tasks that depend on 'key'
+	 */
+	static void detach_threads(const std::string& key);
 
 	/**
 	 * Adds a dependecy on 'dependency_key' from 'key' such that all the threads started with key
-	 * 'key' only start after all threads from 'dependency_key' are finished
+	 * 'key' only start after all threads from 'dependency_key' are finished.
+	 * 
+	 * Only the threads of 'dependency_key' started before the threads of 'key' are waited for
 	 */
 	static void add_dependency(const std::string& key, const std::string& dependency_key)
 	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
 		m_dependencies[key].insert(dependency_key);
 	}
 
 private:
 	template <class _Fn, class... _Args>
-	static void start_with_dependencies(const std::unordered_set<std::string>& dependencies, const std::string& thread_key_to_start, _Fn function, _Args... args)
+	static std::function<void()> bind_task_function(_Fn function, _Args... args)
 	{
-		// These threads have a dependency
+		// Through a shared pointer because std::function needs a copyable
+		// callable and some arguments can only be moved
+		auto callable = std::make_shared<std::tuple<_Fn, _Args...>>(std::move(function), std::move(args)...);
 
-		// Executing the given function after waiting for the dependencies
-		if (m_monothread)
-		{
-			// Waiting for the dependencies before starting the thread
-			wait_for_dependencies(dependencies);
+		// Called once so the arguments are given as rvalues, as std::thread does
+		return [callable]() { std::apply([](auto&... function_and_args) { std::invoke(std::move(function_and_args)...); }, *callable); };
+	}
 
-			start_serial_thread(thread_key_to_start, function, args...);
-		}
-		else
-		{
-			// Starting a thread that will wait for the dependencies before calling the given function
-			m_threads_map[thread_key_to_start].push_back(std::thread([dependencies, function, args...]() {
-				wait_for_dependencies(dependencies);
+	static std::shared_future<void> start_task(const std::string& key, std::function<void()> function, bool dedicated);
 
-				std::thread function_thread(function, args...);
-				function_thread.join();
-			}));
+	/**
+	 * Accumulates the time spent by a task of 'key' and logs the times
+	 * of the tasks of 'key' if all the tasks started with 'key' are done
+	 */
+	static void record_task_time(const std::string& key, float queued_time_ms, float run_time_ms);
+
+	/**
+	 * Whether 'key' is one of 'keys' or depends on one of them, even indirectly.
+	 * 'm_mutex' must be locked
+	 */
+	static bool depends_on(const std::string& key, const std::unordered_set<std::string>& keys)
+	{
+		if (keys.empty())
+			return false;
+
+		std::deque<std::string> keys_to_analyze = { key };
+		std::unordered_set<std::string> keys_analyzed;
+		while (!keys_to_analyze.empty())
+		{
+			std::string analyzed_key = keys_to_analyze.front();
+			keys_to_analyze.pop_front();
+
+			if (keys.find(analyzed_key) != keys.end())
+				return true;
+			if (!keys_analyzed.insert(analyzed_key).second)
+				continue;
+
+			auto find = m_dependencies.find(analyzed_key);
+			if (find != m_dependencies.end())
+				for (const std::string& dependency : find->second)
+					keys_to_analyze.push_back(dependency);
 		}
+
+		return false;
 	}
 
-	static void wait_for_dependencies(const std::unordered_set<std::string>& dependencies)
+	/**
+	 * Created on first use and never destroyed so that the tasks still running when
+	 * the application exits (detached ones for example) don't hold the exit
+	 */
+	static TaskPool& get_task_pool();
+
+	struct KeyTimes
 	{
-		for (const std::string& dependency : dependencies)
-			join_threads(dependency);
-	}
+		int started_count = 0;
+		int done_count = 0;
+		std::chrono::steady_clock::time_point first_start_time;
+		// Sum over the tasks of the time they ran and of the time they waited for a worker once ready
+		float run_time_ms = 0.0f;
+		float queued_time_ms = 0.0f;
+	};
 
 private:
 	// If true, the ThreadManager will execute all threads serially
 	static bool m_monothread;
 
+	// Protects all the maps below
+	static std::mutex m_mutex;
+
 	// The states are used to keep the data that the threads need alive
 	static std::unordered_map<std::string, std::shared_ptr<void>> m_threads_states;
 
-	// The ThreadManager can hold as many thread as we want and to find the thread
-	// we want amongst all the threads stored, we use keys, hence the unordered_map
-	static std::unordered_map<std::string, std::vector<std::thread>> m_threads_map;
-
-	// Because of the dependency management system, it may be possible that we call .join()
-	// on the same thread (or threads with the same thread key) from multiple threads.
-	// Calling .join() concurrently on the same thread is likely to result in a race condition
-	// so we need a synchronization system, using mutexes
-	static std::unordered_map<std::string, std::mutex> m_join_mutexes;
+	// Tasks started with each key that haven't been joined yet
+	static std::unordered_map<std::string, std::vector<std::shared_ptr<Task>>> m_tasks_map;
 
 	// For each thread key, maps to a vector of the dependencies of these threads
 	// (thread with the thread key given as key to the map)
 	static std::unordered_map<std::string, std::unordered_set<std::string>> m_dependencies;
+
+	static std::unordered_map<std::string, TaskPriority> m_priorities;
+	static std::unordered_map<std::string, KeyTimes> m_key_times;
 };
 
 #endif
@@ -6,10 +6,54 @@
 #ifndef THREAD_STATE_H
 #define THREAD_STATE_H
 
+#include "assimp/material.h"
+
+#include "HostDeviceCommon/Material.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Texture slot of a material that references a texture: the texture
+ * index stored in 'materials[material_index].*texture_index'
+ */
+struct MaterialTextureSlot
+{
+    int material_index;
+    int RendererMaterial::* texture_index;
+};
+
 struct TextureLoadingThreadState
 {
+    // One per unique texture of the scene
     std::vector<std::pair<aiTextureType, std::string>> texture_paths;
-    std::vector<int> material_indices;
+    std::vector<int> texture_channel_counts;
+    // All the material slots that use each texture. The textures that are
+    // folded into constants or deduplicated are removed from these slots
+    std::vector<std::vector<MaterialTextureSlot>> texture_slots;
+
+    // Content hash of the textures already loaded to their index, for deduplicating the
+    // textures that are at different paths but have the same texels
+    std::mutex content_hashes_mutex;
+    std::unordered_map<std::uint64_t, int> content_hashes;
+
+    // Indices of the textures in the order they're loaded. The threads pop
+    // the next texture to load with 'next_texture'
+    std::vector<int> loading_order;
+    std::atomic<int> next_texture = 0;
+    std::atomic<int> loaded_texture_count = 0;
+
+    // Bounds how many threads read from the disk at the same time, the decoding isn't bounded
+    int max_concurrent_reads = 1;
+    int reads_in_flight = 0;
+    std::mutex reads_mutex;
+    std::condition_variable reads_condition;
 
     std::string scene_filepath;
 };
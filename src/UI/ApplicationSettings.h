@@ -9,6 +9,8 @@
 #include <string>
 #include <vector>
 
+#include "Image/EXRWriter.h"
+#include "Renderer/DenoiserQuality.h"
 #include "UI/DisplayView/DisplayViewEnum.h"
 
 struct ApplicationSettings
@@ -20,6 +22,9 @@ struct ApplicationSettings
 	bool denoiser_denoise_normals = true;
 	// How many samples were we at when we last denoised a frame
 	int last_denoised_sample_count = -1;
+	// Whether or not a frame of the current render has been denoised into the denoised framebuffer.
+	// The denoising is asynchronous so that's a few frames after the first denoised sample count
+	bool denoised_frame_available = false;
 	// How many microseconds did it take to denoise (last time we denoised)?
 	float last_denoised_duration = 0.0f;
 	// Denoise only when that maximum sample count is reached
@@ -38,6 +43,14 @@ struct ApplicationSettings
 	float blend_override = -1.0f;
 	// If the denoiser settings changed since last frame
 	bool denoiser_settings_changed = false;
+	// Quality of the filters of the denoiser
+	DenoiserQuality denoiser_quality = DenoiserQuality::DENOISER_QUALITY_HIGH;
+	// Maximum memory of the filters of the denoiser, see OpenImageDenoiser::set_max_memory_MB(). 0 for no limit
+	int denoiser_max_memory_MB = 0;
+	// After how many accumulated samples the albedo / normals AOVs are considered converged:
+	// their prefiltered version is then reused by the next denoising steps of the render.
+	// 0 to never reuse them
+	int denoiser_AOV_converged_sample_count = 64;
 
 	// How much to divide the rotation by when the mouse
 	// has been dragged over the window to move the camera
@@ -67,6 +80,24 @@ struct ApplicationSettings
 	// time taken to render the last frame). This feature is only there to help limit GPU heating
 	// at the cost of longer render times
 	float GPU_stall_percentage = 0.0f;
+	// The frames are submitted to the GPU by a thread of their own and the UI presents the latest
+	// one at this rate. Above that, the GPU renders the frames back to back
+	float target_present_framerate = 30.0f;
+	// If > 0, the latest frame is presented every time that many samples have been accumulated
+	// since the last present instead of at target_present_framerate. The display is refreshed after
+	// every frame when interacting with the camera regardless
+	int display_refresh_sample_interval = 0;
+	// How many frames the render submission thread keeps queued on the GPU
+	int render_queue_depth = 2;
+
+	// If true, the downscale and the number of bounces of the low resolution rendering
+	// (render_settings.render_low_resolution_scaling and render_low_resolution_max_bounces) are
+	// adjusted while interacting so that the GPU takes dynamic_resolution_target_frame_time
+	// milliseconds per frame. The render goes back to full resolution when the interaction stops
+	bool dynamic_resolution_scaling = false;
+	float dynamic_resolution_target_frame_time = 33.3f;
+	// Maximum number of bounces the dynamic resolution scaling goes back up to
+	int dynamic_resolution_max_bounces = 3;
 
 	// Whether or not to keep the same resolution on
 	// viewport rescale. This means that the render resolution
@@ -102,6 +133,28 @@ struct ApplicationSettings
 	float tone_mapping_gamma = 2.2f;
 	// Tone mapping exposure
 	float tone_mapping_exposure = 1.8f;
+	// If true, the default and denoiser blend display views are tonemapped by a compute shader
+	// that reads the framebuffers straight from their interop buffers and writes RGBA8 colors to
+	// the display texture. This avoids copying the float framebuffers to the display textures every frame
+	bool gpu_tonemapping = false;
+
+	// If true, the region of interest of the renderer (render_settings.enable_region_of_interest)
+	// is a square of 'region_of_interest_cursor_size' pixels of the viewport centered on the mouse
+	// when it is over the viewport
+	bool region_of_interest_follow_cursor = true;
+	int region_of_interest_cursor_size = 256;
+
+	// Categories of the pixel costs summed in the pixel cost heatmap display view:
+	// camera rays, ReSTIR, path tracing traversal, path tracing shading. See PixelCostCategory
+	bool pixel_cost_heatmap_categories[4] = { true, true, true, true };
+	// Cost of a sample of a pixel, in clock cycles, displayed with the hottest color of the pixel cost heatmap
+	float pixel_cost_heatmap_max_cycles = 100000.0f;
+
+	// Chrome trace JSON file written when the recording of the TraceRecorder is stopped from the UI
+	std::string trace_file_path = "trace.json";
+
+	// Storage of the linear EXR exports of the render, see Screenshoter::write_to_exr()
+	EXRWriteOptions exr_write_options;
 };
 
 #endif
\ No newline at end of file
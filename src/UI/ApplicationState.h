@@ -9,8 +9,10 @@
 struct ApplicationState
 {
 	float last_delta_time_ms = 0.0f;
-	// GLFW timestamp of when was the last time that we submitted a frame to render to the GPU.
-	uint64_t last_GPU_submit_time = 0;
+	// GLFW timestamp of when was the last time that we presented the render in the viewport
+	uint64_t last_present_time = 0;
+	// How many samples were submitted to the GPU since the render was last presented
+	int samples_since_last_present = 0;
 	// How long the current render has been running for in milliseconds
 	float current_render_time_ms = 0.0f;
 	// Samples per second (computed at each frame based on the number of
@@ -23,8 +25,13 @@ struct ApplicationState
 	// at last frame
 	bool interacting_last_frame = false;
 
-	// How long in milliseconds do we still have to stall the GPU for
-	float GPU_stall_duration_left = 0;
+	// Number of presents that the dynamic resolution scaling waits for before adjusting the
+	// low resolution rendering again so that the frame times it reads are those of the frames
+	// rendered with its last adjustment
+	int dynamic_resolution_cooldown = 0;
+
+	// GLFW timestamp of when the GPU started stalling, 0 if it isn't stalling
+	uint64_t GPU_stall_start_time = 0;
 };
 
 #endif
\ No newline at end of file
@@ -15,7 +15,10 @@ public:
 	{
 		UNINITIALIZED,
 		FLOAT3,
-		INT
+		FLOAT4,
+		INT,
+		// Already tonemapped colors, see ApplicationSettings::gpu_tonemapping
+		RGBA8
 	};
 
 	constexpr DisplayTextureType() : m_value(Value::FLOAT3) { }
@@ -28,9 +31,15 @@ public:
 		case DisplayTextureType::FLOAT3:
 			return GL_RGB32F;
 
+		case DisplayTextureType::FLOAT4:
+			return GL_RGBA32F;
+
 		case DisplayTextureType::INT:
 			return GL_R32I;
 
+		case DisplayTextureType::RGBA8:
+			return GL_RGBA8;
+
 		default:
 			throw std::runtime_error("Invalid value of DisplayTextureType");
 		}
@@ -43,6 +52,10 @@ public:
 		case DisplayTextureType::FLOAT3:
 			return GL_RGB;
 
+		case DisplayTextureType::FLOAT4:
+		case DisplayTextureType::RGBA8:
+			return GL_RGBA;
+
 		case DisplayTextureType::INT:
 			return GL_RED_INTEGER;
 
@@ -56,11 +69,15 @@ public:
 		switch (m_value)
 		{
 		case DisplayTextureType::FLOAT3:
+		case DisplayTextureType::FLOAT4:
 			return GL_FLOAT;
 
 		case DisplayTextureType::INT:
 			return GL_INT;
 
+		case DisplayTextureType::RGBA8:
+			return GL_UNSIGNED_BYTE;
+
 		default:
 			throw std::runtime_error("Invalid value of DisplayTextureType");
 		}
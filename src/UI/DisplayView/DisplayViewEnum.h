@@ -19,6 +19,7 @@ enum DisplayViewType
 	DISPLAY_DENOISED_ALBEDO,
 	PIXEL_CONVERGENCE_HEATMAP,
 	PIXEL_CONVERGED_MAP,
+	PIXEL_COST_HEATMAP,
 	UNDEFINED
 };
 
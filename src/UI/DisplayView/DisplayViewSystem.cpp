@@ -32,6 +32,7 @@ DisplayViewSystem::DisplayViewSystem(std::shared_ptr<GPURenderer> renderer, Rend
 	OpenGLShader albedo_display_fragment_shader = OpenGLShader(GLSL_SHADERS_DIRECTORY "/albedo_display.frag", OpenGLShader::FRAGMENT_SHADER);
 	OpenGLShader adaptive_display_fragment_shader = OpenGLShader(GLSL_SHADERS_DIRECTORY "/heatmap_int.frag", OpenGLShader::FRAGMENT_SHADER);
 	OpenGLShader pixel_converged_display_fragment_shader = OpenGLShader(GLSL_SHADERS_DIRECTORY "/boolmap_int.frag", OpenGLShader::FRAGMENT_SHADER);
+	OpenGLShader pixel_cost_display_fragment_shader = OpenGLShader(GLSL_SHADERS_DIRECTORY "/heatmap_pixel_cost.frag", OpenGLShader::FRAGMENT_SHADER);
 
 	// Making shared_ptr<OpenGLProgram>s here because multiple display views may share the same OpenGLProgram
 	std::shared_ptr<OpenGLProgram> default_display_program = std::make_shared<OpenGLProgram>(fullscreen_quad_vertex_shader, default_display_fragment_shader);
@@ -40,6 +41,7 @@ DisplayViewSystem::DisplayViewSystem(std::shared_ptr<GPURenderer> renderer, Rend
 	std::shared_ptr<OpenGLProgram> albedo_display_program = std::make_shared<OpenGLProgram>(fullscreen_quad_vertex_shader, albedo_display_fragment_shader);
 	std::shared_ptr<OpenGLProgram> pixel_convergence_heatmap_display_program = std::make_shared<OpenGLProgram>(fullscreen_quad_vertex_shader, adaptive_display_fragment_shader);
 	std::shared_ptr<OpenGLProgram> pixel_converged_display_program = std::make_shared<OpenGLProgram>(fullscreen_quad_vertex_shader, pixel_converged_display_fragment_shader);
+	std::shared_ptr<OpenGLProgram> pixel_cost_heatmap_display_program = std::make_shared<OpenGLProgram>(fullscreen_quad_vertex_shader, pixel_cost_display_fragment_shader);
 
 	// Creating all the texture views
 	DisplayView default_display_view = DisplayView(DisplayViewType::DEFAULT, default_display_program);
@@ -50,6 +52,7 @@ DisplayViewSystem::DisplayViewSystem(std::shared_ptr<GPURenderer> renderer, Rend
 	DisplayView albedo_denoised_display_view = DisplayView(DisplayViewType::DISPLAY_DENOISED_ALBEDO, albedo_display_program);
 	DisplayView pixel_convergence_heatmap_display_view = DisplayView(DisplayViewType::PIXEL_CONVERGENCE_HEATMAP, pixel_convergence_heatmap_display_program);
 	DisplayView pixel_converged_display_view = DisplayView(DisplayViewType::PIXEL_CONVERGED_MAP, pixel_converged_display_program);
+	DisplayView pixel_cost_heatmap_display_view = DisplayView(DisplayViewType::PIXEL_COST_HEATMAP, pixel_cost_heatmap_display_program);
 
 	// Adding the display views to the map
 	m_display_views[DisplayViewType::DEFAULT] = default_display_view;
@@ -60,6 +63,21 @@ DisplayViewSystem::DisplayViewSystem(std::shared_ptr<GPURenderer> renderer, Rend
 	m_display_views[DisplayViewType::DISPLAY_DENOISED_ALBEDO] = albedo_denoised_display_view;
 	m_display_views[DisplayViewType::PIXEL_CONVERGENCE_HEATMAP] = pixel_convergence_heatmap_display_view;
 	m_display_views[DisplayViewType::PIXEL_CONVERGED_MAP] = pixel_converged_display_view;
+	m_display_views[DisplayViewType::PIXEL_COST_HEATMAP] = pixel_cost_heatmap_display_view;
+
+	// Tonemapping compute programs writing the display texture from the framebuffers
+	std::vector<std::string> tonemapping_macro = { "#define COMPUTE_DISPLAY_FROM_BUFFER" };
+	std::shared_ptr<OpenGLProgram> default_tonemapping_program = std::make_shared<OpenGLProgram>();
+	std::shared_ptr<OpenGLProgram> denoise_blend_tonemapping_program = std::make_shared<OpenGLProgram>();
+	default_tonemapping_program->attach(OpenGLShader(GLSL_SHADERS_DIRECTORY "/default_display.frag", OpenGLShader::COMPUTE_SHADER, tonemapping_macro));
+	default_tonemapping_program->link();
+	denoise_blend_tonemapping_program->attach(OpenGLShader(GLSL_SHADERS_DIRECTORY "/blend_2_display.frag", OpenGLShader::COMPUTE_SHADER, tonemapping_macro));
+	denoise_blend_tonemapping_program->link();
+	m_tonemapping_compute_programs[DisplayViewType::DEFAULT] = default_tonemapping_program;
+	m_tonemapping_compute_programs[DisplayViewType::DENOISED_BLEND] = denoise_blend_tonemapping_program;
+
+	// The tonemapped texture only needs to be displayed, same as the albedo
+	m_tonemapped_display_program = albedo_display_program;
 
 	// Denoiser blend by default if denoising enabled. Default view otherwise
 	DisplayViewType default_display_view_type;
@@ -135,6 +153,10 @@ bool DisplayViewSystem::update_selected_display_view()
 		// view because we don't have the buffers to display it anymore
 		m_queued_display_view_change = DisplayViewType::DEFAULT;
 
+	if (get_current_display_view_type() == DisplayViewType::PIXEL_COST_HEATMAP && !m_renderer->uses_pixel_cost_instrumentation())
+		// Same if the kernels are not instrumented anymore
+		m_queued_display_view_change = DisplayViewType::DEFAULT;
+
 	if (m_queued_display_view_change != DisplayViewType::UNDEFINED)
 	{
 		// Adjusting the denoiser setting according to the selected view
@@ -183,9 +205,48 @@ const DisplayView* DisplayViewSystem::get_current_display_view() const
 
 std::shared_ptr<OpenGLProgram> DisplayViewSystem::get_active_display_program()
 {
+	if (m_gpu_tonemapping)
+		return m_tonemapped_display_program;
+
 	return m_current_display_view->get_display_program();
 }
 
+bool DisplayViewSystem::uses_gpu_tonemapping() const
+{
+	return m_gpu_tonemapping;
+}
+
+/**
+ * Sets the sample count and tonemapping uniforms of the programs of the DEFAULT
+ * and DENOISED_BLEND display views (fragment or compute variants)
+ */
+static void set_tonemapping_program_uniforms(std::shared_ptr<OpenGLProgram> program, DisplayViewType display_view_type, const HIPRTRenderSettings& render_settings, std::shared_ptr<ApplicationSettings> application_settings)
+{
+	if (display_view_type == DisplayViewType::DEFAULT)
+	{
+		int sample_number;
+		if (application_settings->enable_denoising && application_settings->last_denoised_sample_count != -1)
+			sample_number = application_settings->last_denoised_sample_count;
+		else
+			sample_number = render_settings.sample_number;
+
+		program->set_uniform("u_sample_number", sample_number);
+	}
+	else
+	{
+		if (application_settings->blend_override != -1.0f)
+			program->set_uniform("u_blend_factor", application_settings->blend_override);
+		else
+			program->set_uniform("u_blend_factor", application_settings->denoiser_blend);
+		program->set_uniform("u_sample_number_1", render_settings.sample_number);
+		program->set_uniform("u_sample_number_2", application_settings->last_denoised_sample_count);
+	}
+
+	program->set_uniform("u_do_tonemapping", application_settings->do_tonemapping);
+	program->set_uniform("u_gamma", application_settings->tone_mapping_gamma);
+	program->set_uniform("u_exposure", application_settings->tone_mapping_exposure);
+}
+
 void DisplayViewSystem::update_display_program_uniforms(const DisplayViewSystem* display_view_system, std::shared_ptr<OpenGLProgram> program, std::shared_ptr<GPURenderer> renderer, std::shared_ptr<ApplicationSettings> application_settings)
 {
 	const DisplayView* display_view = display_view_system->get_current_display_view();
@@ -194,53 +255,37 @@ void DisplayViewSystem::update_display_program_uniforms(const DisplayViewSystem*
 	render_settings.sample_number = std::max(1, render_settings.sample_number); 
 
 	bool display_low_resolution = display_view_system->get_render_low_resolution();
-	int render_low_resolution_scaling = display_low_resolution ? render_settings.render_low_resolution_scaling : 1;
+	int render_low_resolution_scaling = display_low_resolution ? display_view_system->get_render_low_resolution_scaling() : 1;
+	// Only the framebuffer is upscaled by the temporal upscaling, not the AOVs
+	int framebuffer_resolution_scaling = display_view_system->get_render_upscaled() ? 1 : render_low_resolution_scaling;
 
 	program->use();
 
-	switch (display_view->get_display_view_type())
-	{
-	case DisplayViewType::DEFAULT:
+	if (display_view_system->uses_gpu_tonemapping())
 	{
-		int sample_number;
-		if (application_settings->enable_denoising && application_settings->last_denoised_sample_count != -1)
-			sample_number = application_settings->last_denoised_sample_count;
-		else
-			sample_number = render_settings.sample_number;
-
+		// The display texture is already tonemapped, it is only displayed
 		program->set_uniform("u_texture", DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1);
-		program->set_uniform("u_sample_number", sample_number);
-		program->set_uniform("u_do_tonemapping", application_settings->do_tonemapping);
-		program->set_uniform("u_resolution_scaling", render_low_resolution_scaling);
-		program->set_uniform("u_gamma", application_settings->tone_mapping_gamma);
-		program->set_uniform("u_exposure", application_settings->tone_mapping_exposure);
+		program->set_uniform("u_resolution_scaling", framebuffer_resolution_scaling);
 
-		break;
+		return;
 	}
 
-	case DisplayViewType::DENOISED_BLEND:
+	switch (display_view->get_display_view_type())
 	{
-		int noisy_sample_number;
-		int denoised_sample_number;
+	case DisplayViewType::DEFAULT:
+		set_tonemapping_program_uniforms(program, DisplayViewType::DEFAULT, render_settings, application_settings);
+		program->set_uniform("u_texture", DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1);
+		program->set_uniform("u_resolution_scaling", framebuffer_resolution_scaling);
 
-		noisy_sample_number = render_settings.sample_number;
-		denoised_sample_number = application_settings->last_denoised_sample_count;
+		break;
 
-		if (application_settings->blend_override != -1.0f)
-			program->set_uniform("u_blend_factor", application_settings->blend_override);
-		else
-			program->set_uniform("u_blend_factor", application_settings->denoiser_blend);
+	case DisplayViewType::DENOISED_BLEND:
+		set_tonemapping_program_uniforms(program, DisplayViewType::DENOISED_BLEND, render_settings, application_settings);
 		program->set_uniform("u_texture_1", DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1);
 		program->set_uniform("u_texture_2", DisplayViewSystem::DISPLAY_TEXTURE_UNIT_2);
-		program->set_uniform("u_sample_number_1", noisy_sample_number);
-		program->set_uniform("u_sample_number_2", denoised_sample_number);
-		program->set_uniform("u_do_tonemapping", application_settings->do_tonemapping);
-		program->set_uniform("u_resolution_scaling", render_low_resolution_scaling);
-		program->set_uniform("u_gamma", application_settings->tone_mapping_gamma);
-		program->set_uniform("u_exposure", application_settings->tone_mapping_exposure);
+		program->set_uniform("u_resolution_scaling", framebuffer_resolution_scaling);
 
 		break;
-	}
 
 	case DisplayViewType::DISPLAY_ALBEDO:
 	case DisplayViewType::DISPLAY_DENOISED_ALBEDO:
@@ -266,8 +311,10 @@ void DisplayViewSystem::update_display_program_uniforms(const DisplayViewSystem*
 		// If we don't have adaptive sampling enabled, we want to display the convergence
 		// of pixels as soon as possible so we set the min_val to 1. Otherwise, if we're using
 		// adaptive sampling, we only have the convergence information after the minimum
-		// adaptive sampling samples have been reached so we set that as the min_val
-		float min_val = render_settings.enable_adaptive_sampling ? (float)render_settings.adaptive_sampling_min_samples : 1;
+		// adaptive sampling samples have been reached so we set that as the min_val.
+		// The tile based adaptive sampling starts evaluating the convergence earlier
+		int adaptive_sampling_min_samples = render_settings.adaptive_sampling_tile_based ? render_settings.adaptive_sampling_tile_min_samples : render_settings.adaptive_sampling_min_samples;
+		float min_val = render_settings.enable_adaptive_sampling ? (float)adaptive_sampling_min_samples : 1;
 		float max_val = std::max((float)render_settings.sample_number, min_val);
 
 		program->set_uniform("u_texture", DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1);
@@ -293,6 +340,24 @@ void DisplayViewSystem::update_display_program_uniforms(const DisplayViewSystem*
 		break;
 	}
 
+	case DisplayViewType::PIXEL_COST_HEATMAP:
+	{
+		std::vector<ColorRGB32F> color_stops = { ColorRGB32F(0.0f, 0.0f, 1.0f), ColorRGB32F(0.0f, 1.0f, 0.0f), ColorRGB32F(1.0f, 1.0f, 0.0f), ColorRGB32F(1.0f, 0.0f, 0.0f) };
+
+		const bool* categories = application_settings->pixel_cost_heatmap_categories;
+		float4 category_weights = make_float4(categories[0] ? 1.0f : 0.0f, categories[1] ? 1.0f : 0.0f, categories[2] ? 1.0f : 0.0f, categories[3] ? 1.0f : 0.0f);
+
+		program->set_uniform("u_texture", DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1);
+		program->set_uniform("u_resolution_scaling", render_low_resolution_scaling);
+		program->set_uniform("u_sample_number", render_settings.sample_number);
+		program->set_uniform("u_category_weights", category_weights);
+		program->set_uniform("u_color_stops", 4, (float*)color_stops.data());
+		program->set_uniform("u_nb_stops", 4);
+		program->set_uniform("u_max_val", application_settings->pixel_cost_heatmap_max_cycles);
+
+		break;
+	}
+
 	case DisplayViewType::UNDEFINED:
 		break;
 	}
@@ -300,6 +365,10 @@ void DisplayViewSystem::update_display_program_uniforms(const DisplayViewSystem*
 
 void DisplayViewSystem::update_current_display_program_uniforms()
 {
+	if (m_gpu_tonemapping)
+		// Tonemapping again since the uniforms (exposure, denoiser blend, ...) may have changed
+		internal_tonemap_displayed_buffers();
+
 	DisplayViewSystem::update_display_program_uniforms(this, get_active_display_program(), m_renderer, m_render_window->get_application_settings());
 }
 
@@ -307,6 +376,17 @@ void DisplayViewSystem::upload_relevant_buffers_to_texture()
 {
 	DisplayViewType current_display_view_type = get_current_display_view_type();
 
+	if (m_gpu_tonemapping)
+	{
+		// Nothing to copy, the framebuffers are read by the tonemapping compute shaders from
+		// their interop buffers when the uniforms are updated. They only need to be accessible to OpenGL
+		m_renderer->get_color_framebuffer()->unmap();
+		if (current_display_view_type == DisplayViewType::DENOISED_BLEND)
+			m_renderer->get_denoised_framebuffer()->unmap();
+
+		return;
+	}
+
 	switch (current_display_view_type)
 	{
 	case DisplayViewType::DENOISED_BLEND:
@@ -340,6 +420,12 @@ void DisplayViewSystem::upload_relevant_buffers_to_texture()
 		internal_upload_buffer_to_texture(m_renderer->get_pixels_converged_sample_count_buffer(), m_display_texture_1, DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1);
 		break;
 
+	case DisplayViewType::PIXEL_COST_HEATMAP:
+		if (m_renderer->get_pixel_costs_buffer()->get_element_count() > 0)
+			// The buffer is only allocated by the renderer on the frame after the instrumentation is enabled
+			internal_upload_buffer_to_texture(m_renderer->get_pixel_costs_buffer(), m_display_texture_1, DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1);
+		break;
+
 	case DisplayViewType::DEFAULT:
 	default:
 		internal_upload_buffer_to_texture(m_renderer->get_color_framebuffer(), m_display_texture_1, DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1);
@@ -362,6 +448,26 @@ bool DisplayViewSystem::get_render_low_resolution() const
 	return m_displaying_low_resolution;
 }
 
+void DisplayViewSystem::set_render_upscaled(bool upscaled_or_not)
+{
+	m_displaying_upscaled = upscaled_or_not;
+}
+
+bool DisplayViewSystem::get_render_upscaled() const
+{
+	return m_displaying_upscaled;
+}
+
+void DisplayViewSystem::set_render_low_resolution_scaling(int scaling)
+{
+	m_displaying_low_resolution_scaling = scaling;
+}
+
+int DisplayViewSystem::get_render_low_resolution_scaling() const
+{
+	return m_displaying_low_resolution_scaling;
+}
+
 void DisplayViewSystem::resize(int new_render_width, int new_render_height)
 {
 	resize_framebuffer();
@@ -369,11 +475,40 @@ void DisplayViewSystem::resize(int new_render_width, int new_render_height)
 	internal_recreate_display_texture(m_display_texture_2, DisplayViewSystem::DISPLAY_TEXTURE_UNIT_2, m_display_texture_2.second, new_render_width, new_render_height);
 }
 
+void DisplayViewSystem::internal_tonemap_displayed_buffers()
+{
+	DisplayViewType current_display_view_type = get_current_display_view_type();
+	std::shared_ptr<OpenGLProgram> tonemapping_program = m_tonemapping_compute_programs[current_display_view_type];
+
+	HIPRTRenderSettings render_settings = m_renderer->get_render_settings();
+	render_settings.sample_number = std::max(1, render_settings.sample_number);
+
+	tonemapping_program->use();
+	set_tonemapping_program_uniforms(tonemapping_program, current_display_view_type, render_settings, m_render_window->get_application_settings());
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_renderer->get_color_framebuffer()->get_opengl_buffer());
+	if (current_display_view_type == DisplayViewType::DENOISED_BLEND)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_renderer->get_denoised_framebuffer()->get_opengl_buffer());
+	glBindImageTexture(DisplayViewSystem::DISPLAY_TONEMAPPING_IMAGE_UNIT, m_display_texture_1.first, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+	GLint threads[3];
+	tonemapping_program->get_compute_threads(threads);
+	int nb_groups_x = std::ceil(m_renderer->m_render_resolution.x / (float)threads[0]);
+	int nb_groups_y = std::ceil(m_renderer->m_render_resolution.y / (float)threads[1]);
+	glDispatchCompute(nb_groups_x, nb_groups_y, 1);
+
+	// The display program samples the texture right after
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
 void DisplayViewSystem::internal_recreate_display_textures_from_display_view(DisplayViewType display_view)
 {
 	DisplayTextureType texture_1_type_needed = DisplayTextureType::UNINITIALIZED;
 	DisplayTextureType texture_2_type_needed = DisplayTextureType::UNINITIALIZED;
 
+	m_gpu_tonemapping = m_render_window->get_application_settings()->gpu_tonemapping
+		&& (display_view == DisplayViewType::DEFAULT || display_view == DisplayViewType::DENOISED_BLEND);
+
 	switch (display_view)
 	{
 	case DisplayViewType::DEFAULT:
@@ -389,6 +524,10 @@ void DisplayViewSystem::internal_recreate_display_textures_from_display_view(Dis
 		texture_1_type_needed = DisplayTextureType::INT;
 		break;
 
+	case DisplayViewType::PIXEL_COST_HEATMAP:
+		texture_1_type_needed = DisplayTextureType::FLOAT4;
+		break;
+
 	case DisplayViewType::DENOISED_BLEND:
 		texture_1_type_needed = DisplayTextureType::FLOAT3;
 		texture_2_type_needed = DisplayTextureType::FLOAT3;
@@ -402,6 +541,13 @@ void DisplayViewSystem::internal_recreate_display_textures_from_display_view(Dis
 		break;
 	}
 
+	if (m_gpu_tonemapping)
+	{
+		// Only the tonemapped colors are displayed
+		texture_1_type_needed = DisplayTextureType::RGBA8;
+		texture_2_type_needed = DisplayTextureType::UNINITIALIZED;
+	}
+
 	if (m_display_texture_1.second != texture_1_type_needed)
 		internal_recreate_display_texture(m_display_texture_1, DisplayViewSystem::DISPLAY_TEXTURE_UNIT_1, texture_1_type_needed, m_renderer->m_render_resolution.x, m_renderer->m_render_resolution.y);
 
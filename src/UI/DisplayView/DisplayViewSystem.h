@@ -24,6 +24,9 @@ public:
 	static constexpr int DISPLAY_TEXTURE_UNIT_2 = 2;
 	// Texture unit reserved for the compute shader screenshoter
 	static constexpr int DISPLAY_COMPUTE_IMAGE_UNIT = 3;
+	// Image unit the tonemapping compute shaders write the display texture through
+	// (binding of 'u_output_image' in the COMPUTE_DISPLAY_FROM_BUFFER shaders)
+	static constexpr int DISPLAY_TONEMAPPING_IMAGE_UNIT = 3;
 
 	DisplayViewSystem(std::shared_ptr<GPURenderer> renderer, RenderWindow* render_window);
 	~DisplayViewSystem();
@@ -48,6 +51,13 @@ public:
 	 */
 	bool current_display_view_needs_adaptive_sampling_buffers();
 
+	/**
+	 * Returns true if the current display texture holds colors already tonemapped by the
+	 * tonemapping compute shaders (see ApplicationSettings::gpu_tonemapping) instead of the
+	 * HDR framebuffers
+	 */
+	bool uses_gpu_tonemapping() const;
+
 	/**
 	 * Displays the currently active texture view onto the viewport
 	 */
@@ -65,6 +75,21 @@ public:
 	 */
 	void set_render_low_resolution(bool low_resolution_or_not);
 
+	bool get_render_upscaled() const;
+	/**
+	 * Sets whether or not the low resolution render of the next display() call was
+	 * upscaled to the full resolution by the temporal upscaling of the renderer.
+	 * The framebuffer is then displayed at full resolution
+	 */
+	void set_render_upscaled(bool upscaled_or_not);
+
+	int get_render_low_resolution_scaling() const;
+	/**
+	 * Sets the downscale of the low resolution render of the next display() call. The resolution
+	 * scaling can change between frames with the dynamic resolution scaling of the render window
+	 */
+	void set_render_low_resolution_scaling(int scaling);
+
 	void resize(int new_render_width, int new_render_height);
 
 	/**
@@ -99,6 +124,13 @@ private:
 	void internal_recreate_display_textures_from_display_view(DisplayViewType display_view);
 	void internal_recreate_display_texture(std::pair<GLuint, DisplayTextureType>& display_texture, GLenum display_texture_unit, DisplayTextureType new_texture_type, int width, int height);
 
+	/**
+	 * Tonemaps the framebuffers of the current display view into the RGBA8 display texture
+	 * with the tonemapping compute shaders. The framebuffers are read from their interop buffers
+	 * so they are not copied to a texture first
+	 */
+	void internal_tonemap_displayed_buffers();
+
 
 
 
@@ -124,6 +156,19 @@ private:
 
 	// Whether or not the DisplayView used is going to be displaying at low resolution or not
 	bool m_displaying_low_resolution = false;
+	// Whether or not the low resolution framebuffer was upscaled by the temporal upscaling
+	bool m_displaying_upscaled = false;
+	// render_settings.render_low_resolution_scaling of the displayed low resolution frame
+	int m_displaying_low_resolution_scaling = 1;
+
+	// Whether or not the display textures were created for the GPU tonemapping.
+	// Only changes with the display textures, when a display view change is applied
+	bool m_gpu_tonemapping = false;
+	// Compute programs (COMPUTE_DISPLAY_FROM_BUFFER variants of the display shaders) for
+	// the display views that can be tonemapped on the GPU
+	std::unordered_map<DisplayViewType, std::shared_ptr<OpenGLProgram>> m_tonemapping_compute_programs;
+	// Program displaying the tonemapped display texture as is
+	std::shared_ptr<OpenGLProgram> m_tonemapped_display_program;
 
 	// Display textures & their display type
 	// 
@@ -7,27 +7,47 @@ const char* ImGuiLogger::BACKGROUND_KERNEL_COMPILATION_LINE_NAME = "BackgroundKe
 
 ImGuiLogger::ImGuiLogger()
 {
+    for (int i = 0; i < ImGuiLogger::QUEUE_CAPACITY; i++)
+    {
+        m_records[i].sequence = i;
+        m_records[i].heap_text = nullptr;
+    }
+
     clear();
 }
 
+ImGuiLogger::~ImGuiLogger()
+{
+    // Printing what's left in the ring
+    flush();
+}
+
 void ImGuiLogger::add_line_with_name(ImGuiLoggerSeverity severity, const char* line_name, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    add_line_internal(severity, line_name, fmt, args);
+    enqueue_record(severity, line_name, /* update */ false, fmt, args);
     va_end(args);
+
+    try_drain();
 }
 
 void ImGuiLogger::add_line(ImGuiLoggerSeverity severity, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    add_line_internal(severity, nullptr, fmt, args);
+    enqueue_record(severity, nullptr, /* update */ false, fmt, args);
     va_end(args);
+
+    try_drain();
 }
 
 void ImGuiLogger::draw(const char* title, bool* p_open)
 {
+    // The lines can only be read by the thread draining. Waiting here is fine, this is the UI thread
+    std::lock_guard<std::mutex> lock(m_drain_mutex);
+    drain_locked();
+
     if (!ImGui::Begin(title, p_open))
     {
         ImGui::End();
@@ -38,6 +58,11 @@ void ImGuiLogger::draw(const char* title, bool* p_open)
     if (ImGui::BeginPopup("Options"))
     {
         ImGui::Checkbox("Auto-scroll", &m_auto_scroll);
+
+        const char* severity_items[] = { "Info", "Warning", "Error" };
+        int minimum_severity = m_minimum_severity;
+        if (ImGui::Combo("Minimum severity", &minimum_severity, severity_items, IM_ARRAYSIZE(severity_items)))
+            m_minimum_severity = minimum_severity;
         ImGui::EndPopup();
     }
 
@@ -142,6 +167,7 @@ void ImGuiLogger::draw(const char* title, bool* p_open)
 
 void ImGuiLogger::clear()
 {
+    // Only called by the constructor and by draw(), with the drain lock held
     m_log_lines.clear();
     m_actual_lines.clear();
     m_index_in_actual_lines.clear();
@@ -152,22 +178,163 @@ void ImGuiLogger::clear()
 
 void ImGuiLogger::update_line(const char* line_name, const char* fmt, ...)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    va_list args;
+    va_start(args, fmt);
+    // The severity of the line is the one it was added with
+    enqueue_record(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, line_name, /* update */ true, fmt, args);
+    va_end(args);
+
+    try_drain();
+}
+
+void ImGuiLogger::set_minimum_severity(ImGuiLoggerSeverity severity)
+{
+    m_minimum_severity = severity;
+}
+
+ImGuiLoggerSeverity ImGuiLogger::get_minimum_severity() const
+{
+    return static_cast<ImGuiLoggerSeverity>(m_minimum_severity.load());
+}
+
+void ImGuiLogger::flush()
+{
+    std::lock_guard<std::mutex> lock(m_drain_mutex);
+    drain_locked();
+}
+
+void ImGuiLogger::enqueue_record(ImGuiLoggerSeverity severity, const char* line_name, bool update, const char* fmt, va_list args)
+{
+    if (!update && severity < m_minimum_severity.load(std::memory_order_relaxed))
+        return;
+
+    bool drain_attempted = false;
+    size_t position = m_enqueue_position.load(std::memory_order_relaxed);
+    LogRecord* record;
+    while (true)
+    {
+        record = &m_records[position & (ImGuiLogger::QUEUE_CAPACITY - 1)];
+
+        size_t sequence = record->sequence.load(std::memory_order_acquire);
+        long long int difference = static_cast<long long int>(sequence) - static_cast<long long int>(position);
+        if (difference == 0)
+        {
+            // The record is free, claiming it
+            if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0)
+        {
+            // The ring is full
+            if (drain_attempted)
+            {
+                m_dropped_line_count.fetch_add(1, std::memory_order_relaxed);
+
+                return;
+            }
+
+            drain_attempted = true;
+            try_drain();
+            position = m_enqueue_position.load(std::memory_order_relaxed);
+        }
+        else
+            // Another producer claimed that record first
+            position = m_enqueue_position.load(std::memory_order_relaxed);
+    }
 
+    record->severity = severity;
+    record->line_name = line_name;
+    record->update = update;
+
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int string_length = vsnprintf(record->inline_text, ImGuiLogger::RECORD_INLINE_TEXT_SIZE, fmt, args_copy);
+    va_end(args_copy);
+
+    if (string_length >= ImGuiLogger::RECORD_INLINE_TEXT_SIZE)
+        record->heap_text = new std::string(compute_formatted_string(fmt, args));
+    else
+        record->heap_text = nullptr;
+
+    // Publishing the record to the consumer
+    record->sequence.store(position + 1, std::memory_order_release);
+}
+
+void ImGuiLogger::try_drain()
+{
+    do
+    {
+        std::unique_lock<std::mutex> lock(m_drain_mutex, std::try_to_lock);
+        if (!lock.owns_lock())
+            // Someone else is draining
+            return;
+
+        drain_locked();
+    // A record may have been published right after the drain, by
+    // a thread that couldn't get the lock because we were holding it
+    } while (has_pending_record());
+}
+
+void ImGuiLogger::drain_locked()
+{
+    while (true)
+    {
+        size_t position = m_dequeue_position.load(std::memory_order_relaxed);
+        LogRecord& record = m_records[position & (ImGuiLogger::QUEUE_CAPACITY - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != position + 1)
+            // Not published yet
+            break;
+
+        process_record(record);
+
+        // Freeing the record for the producers of the next round of the ring
+        record.sequence.store(position + ImGuiLogger::QUEUE_CAPACITY, std::memory_order_release);
+        m_dequeue_position.store(position + 1, std::memory_order_release);
+    }
+
+    unsigned int dropped_line_count = m_dropped_line_count.exchange(0);
+    if (dropped_line_count > 0)
+        store_new_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, nullptr, std::to_string(dropped_line_count) + " log lines were dropped, the log queue was full");
+}
+
+bool ImGuiLogger::has_pending_record() const
+{
+    size_t position = m_dequeue_position.load(std::memory_order_acquire);
+
+    return m_records[position & (ImGuiLogger::QUEUE_CAPACITY - 1)].sequence.load(std::memory_order_acquire) == position + 1;
+}
+
+void ImGuiLogger::process_record(LogRecord& record)
+{
+    std::string text;
+    if (record.heap_text != nullptr)
+    {
+        text = std::move(*record.heap_text);
+
+        delete record.heap_text;
+        record.heap_text = nullptr;
+    }
+    else
+        text = record.inline_text;
+
+    if (record.update)
+        store_updated_line(record.line_name, text);
+    else
+        store_new_line(record.severity, record.line_name, text);
+}
+
+void ImGuiLogger::store_updated_line(const char* line_name, const std::string& text)
+{
     auto find = m_names_to_lines.find(line_name);
     if (find == m_names_to_lines.end())
     {
-        add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Cannot update line with name %s. There is no such line. Did you forget to call add_line(severity, LINE_NAME, ...)?", line_name);
+        store_new_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, nullptr, std::string("Cannot update line with name ") + line_name + ". There is no such line. Did you forget to call add_line(severity, LINE_NAME, ...)?");
         return;
     }
 
     std::shared_ptr<ImGuiLoggerLine> line = find->second;
     std::string prefix = ImGuiLogger::get_severity_prefix(line->severity);
-
-    va_list args;
-    va_start(args, fmt);
-    std::string formatted_string = prefix + compute_formatted_string(fmt, args) + "\n";
-    va_end(args);
+    std::string formatted_string = prefix + text + "\n";
 
     // Updating the line
     line->string = formatted_string;
@@ -222,13 +389,10 @@ std::string ImGuiLogger::get_severity_prefix(ImGuiLoggerSeverity severity)
     }
 }
 
-void ImGuiLogger::add_line_internal(ImGuiLoggerSeverity severity, const char* line_name, const char* fmt, va_list args)
+void ImGuiLogger::store_new_line(ImGuiLoggerSeverity severity, const char* line_name, const std::string& text)
 {
-    // For logger's thread safety
-    std::lock_guard<std::mutex> lock(m_mutex);
-
     std::string prefix = ImGuiLogger::get_severity_prefix(severity);
-    std::string formatted_string = prefix + compute_formatted_string(fmt, args) + "\n";
+    std::string formatted_string = prefix + text + "\n";
     std::cout << formatted_string; // Also printing to the console
 
     int line_index = m_log_lines.size();
@@ -11,6 +11,8 @@
 
 #include "imgui.h"
 
+#include <atomic>
+#include <cstdarg>
 #include <iostream>
 #include <memory>
 #include <mutex>
@@ -21,15 +23,30 @@
 
 /**
  * Class derived from imgui_demo.cpp "ExampleAppLog"
+ *
+ * The threads that log only format their line into a slot of a lock-free ring of records (QUEUE_CAPACITY
+ * records, bounded MPMC queue). The records are consumed by whichever thread gets the drain lock first
+ * without waiting for it: the UI thread when drawing the log window, or the thread that logged if nobody
+ * else is draining (headless renders, benchmarks). Storing the lines, splitting them and printing them to
+ * the console are only done by the thread draining so the logging threads never wait for the UI thread.
+ *
+ * If the ring is full and the thread that logs can't drain it, the line is dropped and counted. The lines
+ * whose severity is below the minimum severity (see set_minimum_severity()) aren't even formatted
  */
-
 class ImGuiLogger
 {
 public:
     static const char* BACKGROUND_KERNEL_PARSING_LINE_NAME;
     static const char* BACKGROUND_KERNEL_COMPILATION_LINE_NAME;
 
+    // Number of records of the ring, must be a power of 2
+    static constexpr int QUEUE_CAPACITY = 1024;
+    // Lines of a record formatted without any allocation. The longer lines (compiler errors
+    // for example) are formatted on the heap
+    static constexpr int RECORD_INLINE_TEXT_SIZE = 256;
+
     ImGuiLogger();
+    ~ImGuiLogger();
 
     void add_line_with_name(ImGuiLoggerSeverity severity, const char* line_name, const char* fmt, ...) IM_FMTARGS(4);
     void add_line(ImGuiLoggerSeverity severity, const char* fmt, ...) IM_FMTARGS(3);
@@ -39,10 +56,50 @@ public:
 
     void update_line(const char* line_name, const char* fmt, ...);
 
+    /**
+     * The lines added with a lesser severity are discarded without being formatted
+     */
+    void set_minimum_severity(ImGuiLoggerSeverity severity);
+    ImGuiLoggerSeverity get_minimum_severity() const;
+
+    /**
+     * Stores and prints all the records of the ring, waiting for the thread currently draining if any
+     */
+    void flush();
+
     static ImU32 get_severity_color(ImGuiLoggerSeverity severity);
 
 private:
-    void add_line_internal(ImGuiLoggerSeverity severity, const char* line_name, const char* fmt, va_list args);
+    struct LogRecord
+    {
+        // Vyukov's bounded queue sequence number: equal to the position of the record in the queue when the
+        // record is free for that position, position + 1 once a producer published it
+        std::atomic<size_t> sequence;
+
+        ImGuiLoggerSeverity severity;
+        const char* line_name;
+        // If true, the record updates the line 'line_name' instead of adding a new one
+        bool update;
+
+        char inline_text[RECORD_INLINE_TEXT_SIZE];
+        // Not nullptr if the line didn't fit in 'inline_text'
+        std::string* heap_text;
+    };
+
+    void enqueue_record(ImGuiLoggerSeverity severity, const char* line_name, bool update, const char* fmt, va_list args);
+    /**
+     * Drains the ring if no other thread is draining it. Doesn't wait
+     */
+    void try_drain();
+    /**
+     * 'm_drain_mutex' must be held
+     */
+    void drain_locked();
+    bool has_pending_record() const;
+
+    void process_record(LogRecord& record);
+    void store_new_line(ImGuiLoggerSeverity severity, const char* line_name, const std::string& text);
+    void store_updated_line(const char* line_name, const std::string& text);
 
     void set_line_name(std::shared_ptr<ImGuiLoggerLine> line, const char* line_name);
 
@@ -87,8 +144,15 @@ private:
 
     bool m_auto_scroll = true;  // Keep scrolling if already at the bottom.
 
-    // For logger thread safety
-    std::mutex m_mutex;
+    LogRecord m_records[QUEUE_CAPACITY];
+    std::atomic<size_t> m_enqueue_position = 0;
+    std::atomic<size_t> m_dequeue_position = 0;
+    // Lines that didn't fit in the ring since the last drain
+    std::atomic<unsigned int> m_dropped_line_count = 0;
+    std::atomic<int> m_minimum_severity = IMGUI_LOGGER_INFO;
+
+    // Held by the thread consuming the records. Everything above 'm_records' is only accessed under this lock
+    std::mutex m_drain_mutex;
 };
 
 #endif
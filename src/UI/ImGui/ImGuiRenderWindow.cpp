@@ -27,6 +27,16 @@ void ImGuiRenderWindow::draw()
 	ImVec2 current_size = ImVec2(content_max.x - content_min.x, content_max.y - content_min.y);
 
 	ImGui::Image((void*)(intptr_t)m_render_window->get_display_view_system()->m_fbo_texture, current_size, ImVec2(0, 1), ImVec2(1, 0));
+	if (ImGui::IsItemHovered())
+	{
+		ImVec2 image_min = ImGui::GetItemRectMin();
+		ImVec2 mouse_position = ImGui::GetMousePos();
+
+		// The image is displayed flipped vertically
+		m_mouse_position_in_image = ImVec2(mouse_position.x - image_min.x, current_size.y - (mouse_position.y - image_min.y));
+	}
+	else
+		m_mouse_position_in_image = ImVec2(-1.0f, -1.0f);
 
 	if (current_size.x != m_current_size.x || current_size.y != m_current_size.y)
 		m_render_window->resize(current_size.x, current_size.y);
@@ -47,3 +57,8 @@ ImVec2 ImGuiRenderWindow::get_size() const
 {
 	return m_current_size;
 }
+
+ImVec2 ImGuiRenderWindow::get_mouse_position_in_image() const
+{
+	return m_mouse_position_in_image;
+}
@@ -21,12 +21,20 @@ public:
 
 	bool is_hovered() const;
 	ImVec2 get_size() const;
+	/**
+	 * Position of the mouse in the displayed image, in pixels of the viewport from
+	 * the bottom left corner of the image (same convention as the framebuffer of the renderer).
+	 * 
+	 * (-1, -1) if the mouse isn't over the image
+	 */
+	ImVec2 get_mouse_position_in_image() const;
 
 private:
 	RenderWindow* m_render_window;
 
 	ImVec2 m_current_size;
 	bool m_is_hovered = false;
+	ImVec2 m_mouse_position_in_image = ImVec2(-1.0f, -1.0f);
 };
 
 #endif
@@ -4,16 +4,23 @@
  */
 
 #include "Compiler/GPUKernelCompiler.h"
+#include "Compiler/KernelLaunchAutotuner.h"
+#include "Compiler/KernelResourceReport.h"
+#include "HIPRT-Orochi/OrochiDeviceMemoryPool.h"
+#include "HostDeviceCommon/RayStatistics.h"
 #include "HostDeviceCommon/RenderSettings.h"
 #include "Renderer/GPURenderer.h"
 #include "Threads/ThreadManager.h"
 #include "UI/ImGui/ImGuiRenderer.h"
 #include "UI/ImGui/ImGuiSettingsWindow.h"
 #include "UI/RenderWindow.h"
+#include "Utils/TraceRecorder.h"
 
+#include <algorithm>
 #include <iostream>
 
 extern GPUKernelCompiler g_gpu_kernel_compiler;
+extern KernelLaunchAutotuner g_kernel_launch_autotuner;
 
 const char* ImGuiSettingsWindow::TITLE = "Settings";
 const float ImGuiSettingsWindow::BASE_SIZE = 630.0f;
@@ -115,6 +122,20 @@ void ImGuiSettingsWindow::draw_header()
 
 	if (ImGui::Button("Save viewport to PNG"))
 		m_render_window->get_screenshoter()->write_to_png();
+	ImGui::SameLine();
+	if (ImGui::Button("Save render to EXR"))
+		m_render_window->get_screenshoter()->write_to_exr();
+	ImGuiRenderer::show_help_marker("Writes the linear render, without tone mapping, with its albedo, normals, "
+		"sample count and denoised (if denoising) layers to a multi-layer EXR file.");
+
+	EXRWriteOptions& exr_write_options = m_application_settings->exr_write_options;
+	ImGui::Checkbox("EXR half floats", &exr_write_options.half_float);
+	ImGuiRenderer::show_help_marker("Stores the channels of the EXR as 16 bit floats instead of 32 bit floats. "
+		"The sample count is always stored as 32 bit integers.");
+	bool exr_rle_compression = exr_write_options.compression == EXR_COMPRESSION_RLE;
+	if (ImGui::Checkbox("EXR lossless compression", &exr_rle_compression))
+		exr_write_options.compression = exr_rle_compression ? EXR_COMPRESSION_RLE : EXR_COMPRESSION_NONE;
+	ImGuiRenderer::show_help_marker("Run length encoding of the EXR scanlines.");
 
 	ImGui::Separator();
 
@@ -138,15 +159,44 @@ void ImGuiSettingsWindow::draw_render_settings_panel()
 	ImGui::Dummy(ImVec2(0.0f, 20.0f));
 	ImGui::SeparatorText("Viewport Settings");
 	std::vector<const char*> items = { "- Default", "- Denoiser blend", "- Denoiser - Normals", "- Denoiser - Denoised normals", "- Denoiser - Albedo", "- Denoiser - Denoised albedo" };
+	// Display view of each item of the combo, the items are only the views that can currently be displayed
+	std::vector<DisplayViewType> item_display_views = { DisplayViewType::DEFAULT, DisplayViewType::DENOISED_BLEND, DisplayViewType::DISPLAY_NORMALS, DisplayViewType::DISPLAY_DENOISED_NORMALS, DisplayViewType::DISPLAY_ALBEDO, DisplayViewType::DISPLAY_DENOISED_ALBEDO };
 	if (render_settings.has_access_to_adaptive_sampling_buffers())
 	{
 		items.push_back("- Pixel convergence heatmap");
 		items.push_back("- Converged pixels map");
+		item_display_views.push_back(DisplayViewType::PIXEL_CONVERGENCE_HEATMAP);
+		item_display_views.push_back(DisplayViewType::PIXEL_CONVERGED_MAP);
+	}
+	if (m_renderer->uses_pixel_cost_instrumentation())
+	{
+		items.push_back("- Pixel cost heatmap");
+		item_display_views.push_back(DisplayViewType::PIXEL_COST_HEATMAP);
 	}
 
-	int display_view_selected = m_render_window->get_display_view_system()->get_current_display_view_type();
+	DisplayViewType current_display_view = m_render_window->get_display_view_system()->get_current_display_view_type();
+	int display_view_selected = static_cast<int>(std::find(item_display_views.begin(), item_display_views.end(), current_display_view) - item_display_views.begin());
 	if (ImGui::Combo("Display View", &display_view_selected, items.data(), items.size()))
-		m_render_window->get_display_view_system()->queue_display_view_change(static_cast<DisplayViewType>(display_view_selected));
+		m_render_window->get_display_view_system()->queue_display_view_change(item_display_views[display_view_selected]);
+
+	if (current_display_view == DisplayViewType::PIXEL_COST_HEATMAP)
+	{
+		ImGui::TreePush("Pixel cost heatmap tree");
+
+		ImGui::Checkbox("Camera rays", &m_application_settings->pixel_cost_heatmap_categories[0]);
+		ImGui::SameLine();
+		ImGui::Checkbox("ReSTIR", &m_application_settings->pixel_cost_heatmap_categories[1]);
+		ImGui::Checkbox("Path traversal", &m_application_settings->pixel_cost_heatmap_categories[2]);
+		ImGui::SameLine();
+		ImGui::Checkbox("Path shading", &m_application_settings->pixel_cost_heatmap_categories[3]);
+		ImGuiRenderer::show_help_marker("Which costs are summed in the heatmap. \"Path traversal\" is the tracing of the bounce rays "
+			"of the path tracer, \"Path shading\" is the rest of the path tracer, shadow rays included.");
+		ImGui::SliderFloat("Max cycles per sample", &m_application_settings->pixel_cost_heatmap_max_cycles, 1000.0f, 10000000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+		ImGuiRenderer::show_help_marker("Average clock cycles of a sample of a pixel that is displayed in red. The pixels converged "
+			"by the adaptive sampling don't cost anything anymore and cool down as the render goes on.");
+
+		ImGui::TreePop();
+	}
 
 	static float resolution_scaling_current_widget_value = m_application_settings->render_resolution_scale;
 	ImGui::BeginDisabled(m_application_settings->keep_same_resolution);
@@ -224,6 +274,105 @@ void ImGuiSettingsWindow::draw_render_settings_panel()
 		m_render_window->set_render_dirty(true);
 	}
 
+	if (ImGui::Checkbox("Russian roulette", &render_settings.do_russian_roulette))
+		m_render_window->set_render_dirty(true);
+	ImGuiRenderer::show_help_marker("Randomly terminates the paths whose throughput is low. "
+		"The surviving paths are weighted accordingly so this doesn't bias the render. "
+		"Saves the cost of the long paths that don't bring much light to the pixel.");
+	if (render_settings.do_russian_roulette)
+	{
+		ImGui::TreePush("Russian roulette tree");
+
+		if (ImGui::InputInt("Start bounce", &render_settings.russian_roulette_min_bounce))
+		{
+			// The paths can't be terminated before their first bounce
+			render_settings.russian_roulette_min_bounce = std::max(render_settings.russian_roulette_min_bounce, 1);
+			m_render_window->set_render_dirty(true);
+		}
+		ImGuiRenderer::show_help_marker("First bounce at which paths can be terminated by the russian roulette.");
+
+		if (ImGui::SliderFloat("Min survival probability", &render_settings.russian_roulette_min_survival_probability, 0.01f, 1.0f))
+			m_render_window->set_render_dirty(true);
+		ImGuiRenderer::show_help_marker("Paths always survive the russian roulette with at least this probability. "
+			"Lower values terminate more paths but increase variance.");
+
+		ImGui::TreePop();
+	}
+
+	if (ImGui::InputFloat("Indirect rays max distance", &render_settings.indirect_rays_max_distance))
+	{
+		render_settings.indirect_rays_max_distance = std::max(0.0f, render_settings.indirect_rays_max_distance);
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("Maximum distance of the rays of the bounces after the first hit. "
+		"The surfaces further away than that aren't hit and the ray misses (it sees the envmap).\n\n"
+		"Saves the traversal cost of long secondary rays in large scenes but biases the render.\n"
+		"0 to disable.");
+	if (render_settings.indirect_rays_max_distance > 0.0f)
+	{
+		ImGui::TreePush("Indirect rays max distance tree");
+
+		if (ImGui::SliderFloat("Bounce factor", &render_settings.indirect_rays_max_distance_bounce_factor, 0.0f, 1.0f))
+			m_render_window->set_render_dirty(true);
+		ImGuiRenderer::show_help_marker("The max distance is multiplied by this factor at each bounce after the first one.");
+
+		ImGui::TreePop();
+	}
+
+	if (ImGui::InputFloat("Shadow rays roulette distance", &render_settings.shadow_rays_roulette_distance))
+	{
+		render_settings.shadow_rays_roulette_distance = std::max(0.0f, render_settings.shadow_rays_roulette_distance);
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("The shadow rays of the light samples further away than this distance are randomly "
+		"not traced, with a probability that follows the falloff of the light with the distance. "
+		"The light samples that survive are weighted accordingly so this doesn't bias the render.\n"
+		"0 to disable.");
+	if (render_settings.shadow_rays_roulette_distance > 0.0f)
+	{
+		ImGui::TreePush("Shadow rays roulette tree");
+
+		if (ImGui::SliderFloat("Min survival probability##shadow_rays", &render_settings.shadow_rays_roulette_min_survival_probability, 0.01f, 1.0f))
+			m_render_window->set_render_dirty(true);
+		ImGuiRenderer::show_help_marker("Light samples always survive the roulette with at least this probability. "
+			"Lower values trace fewer shadow rays but increase variance.");
+
+		ImGui::TreePop();
+	}
+
+	ImGui::Checkbox("Count active paths per bounce", &render_settings.count_bounce_active_rays);
+	ImGuiRenderer::show_help_marker("Counts the number of paths alive at each bounce of the last sample of each frame "
+		"and how many of them missed the scene (envmap / sky) or were absorbed (russian roulette, invalid BSDF sample) at that bounce.");
+	if (render_settings.count_bounce_active_rays)
+	{
+		ImGui::TreePush("Bounce active rays tree");
+
+		const StatusBuffersValues& status_buffers_values = m_renderer->get_status_buffer_values();
+		const std::vector<unsigned int>& bounce_active_ray_counts = status_buffers_values.bounce_active_ray_counts;
+		if (!bounce_active_ray_counts.empty())
+		{
+			std::vector<float> alive_paths(bounce_active_ray_counts.begin(), bounce_active_ray_counts.end());
+			std::vector<float> missed_paths(status_buffers_values.bounce_missed_path_counts.begin(), status_buffers_values.bounce_missed_path_counts.end());
+			std::vector<float> absorbed_paths(status_buffers_values.bounce_absorbed_path_counts.begin(), status_buffers_values.bounce_absorbed_path_counts.end());
+
+			// Same scale for the three histograms, the camera rays are the most paths there can be
+			float scale_max = static_cast<float>(bounce_active_ray_counts[0]);
+			ImGui::PlotHistogram("Alive", alive_paths.data(), static_cast<int>(alive_paths.size()), 0, nullptr, 0.0f, scale_max, ImVec2(0, 60));
+			ImGui::PlotHistogram("Missed", missed_paths.data(), static_cast<int>(missed_paths.size()), 0, nullptr, 0.0f, scale_max, ImVec2(0, 60));
+			ImGui::PlotHistogram("Absorbed", absorbed_paths.data(), static_cast<int>(absorbed_paths.size()), 0, nullptr, 0.0f, scale_max, ImVec2(0, 60));
+		}
+
+		for (int bounce = 0; bounce < bounce_active_ray_counts.size(); bounce++)
+		{
+			float percentage_of_camera_rays = bounce_active_ray_counts[0] == 0 ? 0.0f : bounce_active_ray_counts[bounce] / static_cast<float>(bounce_active_ray_counts[0]) * 100.0f;
+
+			ImGui::Text("Bounce %d: %u alive - %.1f%% | %u missed | %u absorbed", bounce, bounce_active_ray_counts[bounce], percentage_of_camera_rays,
+				status_buffers_values.bounce_missed_path_counts[bounce], status_buffers_values.bounce_absorbed_path_counts[bounce]);
+		}
+
+		ImGui::TreePop();
+	}
+
 	ImGui::Dummy(ImVec2(0.0f, 20.0f));
 	if (ImGui::CollapsingHeader("Render stopping condition"))
 	{
@@ -349,6 +498,8 @@ void ImGuiSettingsWindow::draw_render_settings_panel()
 		if (ImGui::Combo("Nested dielectrics strategy", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::INTERIOR_STACK_STRATEGY), items, IM_ARRAYSIZE(items)))
 		{
 			m_renderer->recompile_kernels();
+			// The entries of the interior stack aren't the same size with the two strategies
+			m_renderer->resize_g_buffer_ray_volume_states();
 			m_render_window->set_render_dirty(true);
 		}
 
@@ -370,6 +521,18 @@ void ImGuiSettingsWindow::draw_render_settings_panel()
 			ImGui::TreePop();
 		}
 
+		static bool stack_use_shared_memory = NestedDielectricsStackUseSharedMemory;
+		if (ImGui::Checkbox("Stack in shared memory", &stack_use_shared_memory))
+		{
+			global_kernel_options->set_macro_value(GPUKernelCompilerOptions::NESTED_DIELECTRICS_STACK_USE_SHARED_MEMORY, stack_use_shared_memory ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+			m_renderer->recompile_kernels();
+			m_render_window->set_render_dirty(true);
+		}
+		ImGuiRenderer::show_help_marker("If checked, the nested dielectrics stack of the paths is kept in shared memory instead of "
+			"registers / local memory. The registers, shared memory and occupancy of the kernels "
+			"can be compared in the performance metrics.");
+
 		ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
 		ImGui::TreePop();
@@ -489,6 +652,13 @@ void ImGuiSettingsWindow::draw_camera_panel()
 		if (ImGui::Checkbox("Do ray jittering", &camera.do_jittering))
 			m_render_window->set_render_dirty(true);
 
+		ImGui::BeginDisabled(camera.do_jittering);
+		if (ImGui::Checkbox("Reuse primary hits", &render_settings.reuse_primary_hits))
+			m_render_window->set_render_dirty(true);
+		ImGuiRenderer::add_tooltip("Without jittering, the camera rays hit the same points every sample. If checked, "
+			"they are only traced by the first samples and the following samples reuse their first hits, until the camera or the scene changes.");
+		ImGui::EndDisabled();
+
 		static float camera_fov = camera.vertical_fov / M_PI * 180.0f;
 		if (ImGui::SliderFloat("FOV", &camera_fov, 0.0f, 180.0f, "%.3fdeg", ImGuiSliderFlags_AlwaysClamp))
 		{
@@ -506,10 +676,92 @@ void ImGuiSettingsWindow::draw_camera_panel()
 		if (!render_settings.accumulate)
 			ImGuiRenderer::add_tooltip("Cannot render at low resolution when not accumulating. If you want to render at "
 				"a lower resolution, you can use the resolution scale in \"Render Settings\"for that.");
+		ImGui::BeginDisabled(m_application_settings->dynamic_resolution_scaling);
 		ImGui::SliderInt("Render low resolution downscale", &render_settings.render_low_resolution_scaling, 1, 8);
 		if (!render_settings.accumulate)
 			ImGuiRenderer::add_tooltip("Cannot render at low resolution when not accumulating. If you want to render at "
 				"a lower resolution, you can use the resolution scale in \"Render Settings\"for that.");
+		ImGui::SliderInt("Render low resolution max bounces", &render_settings.render_low_resolution_max_bounces, 1, 8);
+		ImGui::EndDisabled();
+		ImGui::BeginDisabled(!render_settings.allow_render_low_resolution);
+		ImGui::Checkbox("Dynamic resolution scaling", &m_application_settings->dynamic_resolution_scaling);
+		ImGuiRenderer::show_help_marker("If checked, the downscale and the number of bounces of the low resolution "
+			"rendering are adjusted while interacting so that the GPU frame time stays around the target below.\n\n"
+			"The resolution is lowered first and the bounces once at the lowest resolution. The render goes back "
+			"to full resolution when the interaction stops.");
+		if (m_application_settings->dynamic_resolution_scaling)
+		{
+			ImGui::TreePush("Dynamic resolution scaling tree");
+			if (ImGui::InputFloat("Target frame time (ms)", &m_application_settings->dynamic_resolution_target_frame_time))
+				m_application_settings->dynamic_resolution_target_frame_time = std::max(1.0f, m_application_settings->dynamic_resolution_target_frame_time);
+			ImGui::SliderInt("Max bounces", &m_application_settings->dynamic_resolution_max_bounces, 1, 8);
+			ImGui::TreePop();
+		}
+		ImGui::EndDisabled();
+		ImGui::BeginDisabled(!render_settings.allow_render_low_resolution);
+		ImGui::Checkbox("Temporal upscaling", &render_settings.use_temporal_upscaling);
+		ImGuiRenderer::show_help_marker("Instead of stretching the low resolution pixels over the blocks of the "
+			"downscale, the low resolution frame is upscaled to the full resolution with the history of the last "
+			"frames reprojected in the current view.\n\n"
+			"The pixel rendered in each block changes every frame so that the history gathers all the pixels of the "
+			"image and the history is clamped to the colors of the low resolution neighborhood to limit ghosting.");
+		ImGui::BeginDisabled(!render_settings.use_temporal_upscaling);
+		ImGui::SliderFloat("Current sample weight", &render_settings.temporal_upscaling_current_weight, 0.0f, 1.0f);
+		ImGuiRenderer::show_help_marker("How much the new low resolution sample weighs in the upscaled pixel "
+			"against the history. Lower values are smoother but ghost more when the lighting changes.");
+		ImGui::EndDisabled();
+		ImGui::EndDisabled();
+		ImGui::EndDisabled();
+
+		ImGui::Dummy(ImVec2(0.0f, 20.0f));
+		ImGui::BeginDisabled(!render_settings.accumulate);
+		ImGui::Checkbox("Temporal reprojection", &render_settings.enable_temporal_reprojection);
+		ImGuiRenderer::show_help_marker("Instead of restarting from scratch when the camera moves, the first sample "
+			"after the reset is blended with the last render reprojected in the new view. The disoccluded "
+			"pixels only get the new sample.\n\n"
+			"The low resolution rendering when interacting is disabled when the temporal reprojection is used.");
+		if (render_settings.enable_temporal_reprojection)
+		{
+			ImGui::TreePush("Temporal reprojection tree");
+
+			ImGui::SliderFloat("History weight", &render_settings.temporal_reprojection_history_weight, 0.0f, 0.99f);
+			ImGuiRenderer::show_help_marker("Weight of the reprojected history in the first sample after a reset. "
+				"Higher is less noisy in motion but has more ghosting.");
+			ImGui::SliderFloat("Plane distance threshold", &render_settings.temporal_reprojection_plane_distance_threshold, 0.0f, 1.0f);
+			ImGui::SliderFloat("Normal similarity threshold", &render_settings.temporal_reprojection_normal_similarity_threshold, -1.0f, 1.0f);
+			ImGuiRenderer::show_help_marker("Minimum cosine between the current and the reprojected normals.");
+
+			ImGui::TreePop();
+		}
+		ImGui::EndDisabled();
+
+		ImGui::Dummy(ImVec2(0.0f, 20.0f));
+		ImGui::BeginDisabled(!render_settings.accumulate || render_settings.has_access_to_adaptive_sampling_buffers());
+		ImGui::Checkbox("Region of interest", &render_settings.enable_region_of_interest);
+		ImGuiRenderer::show_help_marker("Pixels outside of the region of interest only get one sample every "
+			"N samples so that most of the samples go into the region of interest.\n\n"
+			"Cannot be used with adaptive sampling or the pixel noise threshold.");
+		if (render_settings.enable_region_of_interest)
+		{
+			ImGui::TreePush("Region of interest tree");
+
+			ImGui::SliderInt("Outside sample interval", &render_settings.region_of_interest_outside_sample_interval, 1, 64);
+			ImGui::Checkbox("Follow cursor", &m_application_settings->region_of_interest_follow_cursor);
+			if (m_application_settings->region_of_interest_follow_cursor)
+			{
+				if (ImGui::InputInt("Size", &m_application_settings->region_of_interest_cursor_size))
+					m_application_settings->region_of_interest_cursor_size = std::max(1, m_application_settings->region_of_interest_cursor_size);
+				ImGuiRenderer::show_help_marker("Size in pixels of the viewport of the square region of interest around the mouse.");
+			}
+			else
+			{
+				ImGui::InputInt2("Region min", &render_settings.region_of_interest_min.x);
+				ImGui::InputInt2("Region max", &render_settings.region_of_interest_max.x);
+				ImGuiRenderer::show_help_marker("In pixels of the render resolution, from the bottom left corner of the image.");
+			}
+
+			ImGui::TreePop();
+		}
 		ImGui::EndDisabled();
 
 		ImGui::Dummy(ImVec2(0.0f, 20.0f));
@@ -535,6 +787,23 @@ void ImGuiSettingsWindow::draw_environment_panel()
 			ImGuiRenderer::show_help_marker("No envmap loaded.");
 		ImGui::EndDisabled();
 
+		static char envmap_filepath[512] = "";
+		static bool envmap_was_loading = false;
+		bool envmap_loading = m_renderer->get_envmap().is_pending_envmap_loading();
+		if (envmap_was_loading && !envmap_loading)
+			// The new envmap was swapped in
+			m_render_window->set_render_dirty(true);
+		envmap_was_loading = envmap_loading;
+
+		ImGui::InputText("Envmap file", envmap_filepath, IM_ARRAYSIZE(envmap_filepath));
+		ImGui::BeginDisabled(envmap_loading || envmap_filepath[0] == '\0');
+		if (ImGui::Button(envmap_loading ? "Loading envmap..." : "Load envmap"))
+			m_renderer->load_envmap_async(envmap_filepath);
+		ImGui::EndDisabled();
+		ImGuiRenderer::show_help_marker("Reads the HDR envmap at that path and computes its sampling data structure "
+			"in the background while the render continues with the current envmap. The new envmap is swapped in "
+			"between two frames once it is ready.");
+
 		if (m_renderer->get_world_settings().ambient_light_type == AmbientLightType::UNIFORM)
 		{
 			render_made_piggy |= ImGui::ColorEdit3("Uniform light color", (float*)&m_renderer->get_world_settings().uniform_light_color, ImGuiColorEditFlags_HDR | ImGuiColorEditFlags_Float);
@@ -588,6 +857,21 @@ void ImGuiSettingsWindow::draw_environment_panel()
 			ImGui::TreePush("Envmap intensity tree");
 			render_made_piggy |= ImGui::Checkbox("Scale background intensity", (bool*)&m_renderer->get_world_settings().envmap_scale_background_intensity);
 			ImGui::TreePop();
+
+			ImGui::Dummy(ImVec2(0.0f, 20.0f));
+			WorldSettings& world_settings = m_renderer->get_world_settings();
+			ImGui::Text("Envmap portals: %d", world_settings.envmap_portal_count);
+			ImGuiRenderer::show_help_marker("Rectangles (the windows of an interior) that the envmap is sampled through. "
+				"The nodes of the scene named \"EnvmapPortal...\" or with an \"envmap_portal\" GLTF extra are portals, "
+				"more can be given with --envmap-portal=.");
+			ImGui::BeginDisabled(world_settings.envmap_portal_count == 0);
+			ImGui::TreePush("Envmap portals tree");
+			render_made_piggy |= ImGui::SliderFloat("Portal sampling probability", &world_settings.envmap_portal_sampling_probability, 0.0f, 1.0f);
+			ImGuiRenderer::show_help_marker("Probability of sampling the envmap through a portal instead of by luminance. "
+				"The directions that aren't seen through a portal are still sampled by luminance below 1.0 so "
+				"openings without a portal stay unbiased.");
+			ImGui::TreePop();
+			ImGui::EndDisabled();
 		}
 
 		// Ensuring no negative light color
@@ -611,6 +895,17 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 	{
 		ImGui::TreePush("Sampling tree");
 
+		const char* sampler_items[] = { "- Xorshift32 (white noise)", "- Owen scrambled Sobol", "- Blue noise rank-1 lattice" };
+		if (ImGui::Combo("Sampler", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::PATH_SAMPLER), sampler_items, IM_ARRAYSIZE(sampler_items)))
+		{
+			m_renderer->recompile_kernels();
+			m_render_window->set_render_dirty(true);
+		}
+		ImGuiRenderer::show_help_marker("Random numbers of the camera rays and of the bounces of the paths. "
+			"The low discrepancy samplers stratify the samples of each pixel better than white noise: "
+			"lower noise at the same number of samples. The ReSTIR passes and the wavefront path tracer "
+			"always use white noise.");
+
 		if (ImGui::CollapsingHeader("Adaptive sampling"))
 		{
 
@@ -644,6 +939,54 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 				m_render_window->set_render_dirty(true);
 			}
 
+			ImGui::BeginDisabled(render_settings.adaptive_sampling_tile_based);
+			if (ImGui::Checkbox("Perceptual", &render_settings.adaptive_sampling_perceptual))
+				m_render_window->set_render_dirty(true);
+			ImGuiRenderer::show_help_marker("Weights the noise of the pixels by the sensitivity of the eye at their "
+				"tonemapped luminance (with the gamma and exposure of the post-processing). Very dark and "
+				"very bright pixels whose noise isn't visible converge earlier.\n\n"
+				"The resulting distribution of the samples can be seen with the pixel convergence heatmap display view.");
+			if (render_settings.adaptive_sampling_perceptual)
+			{
+				ImGui::TreePush("Adaptive sampling perceptual tree");
+
+				if (ImGui::SliderFloat("Minimum sensitivity", &render_settings.adaptive_sampling_perceptual_min_sensitivity, 0.01f, 1.0f))
+					m_render_window->set_render_dirty(true);
+				ImGuiRenderer::show_help_marker("The noise threshold of the black and white pixels is the noise threshold divided by this value.");
+
+				ImGui::TreePop();
+			}
+			ImGui::EndDisabled();
+
+			if (ImGui::Checkbox("Tile based", &render_settings.adaptive_sampling_tile_based))
+				m_render_window->set_render_dirty(true);
+			ImGuiRenderer::show_help_marker("Instead of the per pixel variance, stops sampling whole tiles of "
+				+ std::to_string(ADAPTIVE_SAMPLING_TILE_SIZE) + "x" + std::to_string(ADAPTIVE_SAMPLING_TILE_SIZE) + " pixels "
+				"when the estimated error of the tile and of its 4 quadrants is below the error threshold.\n\n"
+				"The error is estimated from the difference between the image and a buffer that only "
+				"accumulates every other sample.");
+			if (render_settings.adaptive_sampling_tile_based)
+			{
+				ImGui::TreePush("Adaptive sampling tile based tree");
+
+				if (ImGui::InputInt("Tile minimum samples", &render_settings.adaptive_sampling_tile_min_samples))
+				{
+					render_settings.adaptive_sampling_tile_min_samples = std::max(2, render_settings.adaptive_sampling_tile_min_samples);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Minimum number of samples of all the pixels of a tile before its error is evaluated.");
+				if (ImGui::InputFloat("Tile error threshold", &render_settings.adaptive_sampling_tile_error_threshold))
+				{
+					render_settings.adaptive_sampling_tile_error_threshold = std::max(0.0f, render_settings.adaptive_sampling_tile_error_threshold);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Relative error under which a tile isn't sampled anymore.");
+
+				ImGui::TreePop();
+			}
+
 			// !Cannot use adaptive sampling without accumulation
 			ImGui::EndDisabled();
 
@@ -658,14 +1001,44 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 		{
 			ImGui::TreePush("Direct lighting sampling tree");
 
-			const char* items[] = { "- No direct light sampling", "- Uniform one light", "- BSDF Sampling", "- MIS (1 Light + 1 BSDF)", "- RIS BDSF + Light candidates", "- ReSTIR DI (Primary Hit Only)" };
+			const char* items[] = { "- No direct light sampling", "- Uniform one light", "- BSDF Sampling", "- MIS (1 Light + 1 BSDF)", "- RIS BDSF + Light candidates", "- ReSTIR DI (Primary Hit Only)", "- Light BVH (1 Light + 1 BSDF)" };
 			if (ImGui::Combo("Direct light sampling strategy", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY), items, IM_ARRAYSIZE(items)))
 			{
 				m_renderer->recompile_kernels();
 				m_render_window->set_render_dirty(true);
 			}
+
+			const char* emissive_items[] = { "- Uniform", "- Power (Alias Table)", "- Light clusters" };
+			if (ImGui::Combo("Emissive triangles sampling", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::EMISSIVE_TRIANGLES_SAMPLING_STRATEGY), emissive_items, IM_ARRAYSIZE(emissive_items)))
+			{
+				m_renderer->recompile_kernels();
+				m_render_window->set_render_dirty(true);
+			}
+			ImGuiRenderer::show_help_marker("How an emissive triangle is chosen when sampling a light. "
+				"Not used by the light BVH that accounts for the power of the lights on its own.\n\n"
+				"The light clusters only sample, proportionally to their power, the lights whose contribution at the "
+				"shading point can be above the 'Minimum Light Contribution': bounds the cost of the scenes with many "
+				"local lights. The presampled lights of ReSTIR DI aren't used with light clusters.");
 			ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
+			int direct_light_sampling_strategy = global_kernel_options->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY);
+			if (direct_light_sampling_strategy == LSS_MIS_LIGHT_BSDF || direct_light_sampling_strategy == LSS_LIGHT_BVH || direct_light_sampling_strategy == LSS_RIS_BSDF_AND_LIGHT)
+			{
+				static bool reuse_mis_bsdf_sample_for_bounce = ReuseMISBSDFSampleForBounce;
+				if (ImGui::Checkbox("Reuse BSDF sample for the next bounce", &reuse_mis_bsdf_sample_for_bounce))
+				{
+					global_kernel_options->set_macro_value(GPUKernelCompilerOptions::REUSE_MIS_BSDF_SAMPLE_FOR_BOUNCE, reuse_mis_bsdf_sample_for_bounce ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+					m_renderer->recompile_kernels();
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("If checked, the BSDF sample traced by the direct lighting (the BSDF ray of the MIS "
+					"or the first BSDF candidate of RIS) is traced against the whole scene and its hit becomes the next bounce "
+					"of the path. Saves one closest hit traversal per bounce.\n\n"
+					"Megakernel only, not with path guiding. With the MIS, only if the BSDF ray intersects the whole scene.");
+				ImGui::Dummy(ImVec2(0.0f, 20.0f));
+			}
+
 			// Display additional widgets to control the parameters of the direct light
 			// sampling strategy chosen (the number of candidates for RIS for example)
 			switch (global_kernel_options->get_macro_value(GPUKernelCompilerOptions::DIRECT_LIGHT_SAMPLING_STRATEGY))
@@ -677,7 +1050,23 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 				break;
 
 			case LSS_MIS_LIGHT_BSDF:
+			case LSS_LIGHT_BVH:
+			{
+				const char* bsdf_ray_items[] = { "- Whole scene", "- Chosen light only", "- Light BVH" };
+				if (ImGui::Combo("MIS BSDF ray intersection", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::MIS_BSDF_RAY_INTERSECTION), bsdf_ray_items, IM_ARRAYSIZE(bsdf_ray_items)))
+				{
+					m_renderer->recompile_kernels();
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("How the BSDF ray of the MIS finds the light it hits.\n\n"
+					"Whole scene: closest hit traversal of the scene.\n"
+					"Chosen light only: only the light chosen for the light sample is intersected and an any-hit "
+					"shadow ray is traced to it. Cheapest but noisier in scenes with many lights.\n"
+					"Light BVH: the closest light is found with the light hierarchy and an any-hit "
+					"shadow ray is traced to it. Same result as the whole scene, no ray is traced if no light is hit.");
+
 				break;
+			}
 
 			case LSS_RIS_BSDF_AND_LIGHT:
 			{
@@ -706,6 +1095,38 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 					m_render_window->set_render_dirty(true);
 				}
 
+				if (ImGui::Checkbox("Light candidates from presampled lights", &render_settings.restir_di_settings.light_presampling.use_for_RIS_light_candidates))
+					m_render_window->set_render_dirty(true);
+				ImGuiRenderer::show_help_marker("If checked, the lights are presampled in a pre-process pass (the light presampling "
+					"pass of ReSTIR DI) and all the pixels of a tile draw their light candidates from the same subset of presampled lights.\n\n"
+					"This improves performance in scenes with many lights by replacing the random reads all over the "
+					"emissive triangles with coherent reads. The subsets are the ones of ReSTIR DI, sized automatically by default.");
+
+				if (ImGui::Checkbox("Adapt light candidates to roughness", &render_settings.ris_settings.adapt_light_candidates_to_roughness))
+					m_render_window->set_render_dirty(true);
+				ImGuiRenderer::show_help_marker("Uses fewer light candidates on the near-specular surfaces (smooth metals and glass) "
+					"where the BSDF candidates find the lights anyways. The number of candidates is the maximum over the warp so "
+					"that the lanes of a warp stay coherent.\n\n"
+					"Enable \"Count rays\" in the performance settings to compare the number of light candidates "
+					"sampled per second against the fixed count.");
+				if (render_settings.ris_settings.adapt_light_candidates_to_roughness)
+				{
+					ImGui::TreePush("Adaptive RIS candidates tree");
+
+					if (ImGui::SliderFloat("Specular roughness", &render_settings.ris_settings.adaptive_candidates_specular_roughness, 0.0f, 0.5f))
+						m_render_window->set_render_dirty(true);
+					ImGuiRenderer::show_help_marker("Specular lobes below that roughness only get the minimum number of light candidates. "
+						"The candidates grow linearly up to the full count until twice that roughness.");
+					if (ImGui::SliderInt("Minimum light candidates", &render_settings.ris_settings.minimum_light_candidates, 0, render_settings.ris_settings.number_of_light_candidates))
+					{
+						render_settings.ris_settings.minimum_light_candidates = std::max(0, render_settings.ris_settings.minimum_light_candidates);
+
+						m_render_window->set_render_dirty(true);
+					}
+
+					ImGui::TreePop();
+				}
+
 				break;
 			}
 
@@ -733,6 +1154,23 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 							m_render_window->set_render_dirty(true);
 						}
 
+						if (ImGui::Checkbox("Checkerboard", &render_settings.restir_di_settings.do_checkerboard))
+							m_render_window->set_render_dirty(true);
+						ImGuiRenderer::show_help_marker("If checked, the ReSTIR DI passes only run on half of the pixels each frame, in "
+							"a checkerboard pattern that alternates every frame. The other pixels shade the reservoir of their "
+							"most similar direct neighbor.\n\n"
+							"Roughly halves the cost of ReSTIR DI at the cost of some bias and of a blurrier direct lighting.");
+
+						ImGui::BeginDisabled(!render_settings.has_access_to_adaptive_sampling_buffers() || render_settings.adaptive_sampling_tile_based);
+						if (ImGui::SliderFloat("Fallback noise threshold", &render_settings.restir_di_settings.fallback_noise_threshold, 0.0f, 2.0f))
+							m_render_window->set_render_dirty(true);
+						ImGui::EndDisabled();
+						ImGuiRenderer::show_help_marker("If > 0, the pixels whose noise (estimated as for the adaptive sampling) goes below this "
+							"threshold stop running the ReSTIR DI passes and use the sampling strategy of the later bounces for "
+							"their first bounce too. Should be larger than the adaptive sampling noise threshold so that the pixels "
+							"spend their last samples before converging with the cheaper strategy.\n\n"
+							"Needs the adaptive sampling or the pixel stop noise threshold. Not used with the tile-based adaptive sampling.");
+
 						ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
 						static bool use_heuristics_at_all = true;
@@ -828,6 +1266,26 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 
 					{
 						static bool do_light_presampling = ReSTIR_DI_DoLightsPresampling;
+						static bool use_light_bvh = ReSTIR_DI_InitialCandidatesUseLightBVH;
+						if (ImGui::Checkbox("Sample lights with light BVH", &use_light_bvh))
+						{
+							global_kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_USE_LIGHT_BVH, use_light_bvh ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+							if (use_light_bvh)
+							{
+								// The light BVH samples lights per shading point, presampled lights cannot be used
+								do_light_presampling = false;
+								global_kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING, KERNEL_OPTION_FALSE);
+							}
+
+							m_renderer->recompile_kernels();
+							m_render_window->set_render_dirty(true);
+						}
+						ImGuiRenderer::show_help_marker("If checked, the light candidates are sampled with a light hierarchy "
+							"that accounts for the power, distance and orientation of the lights relative to the "
+							"shading point instead of being sampled uniformly.\n\n"
+							"This is incompatible with light presampling.");
+
+						ImGui::BeginDisabled(use_light_bvh);
 						if (ImGui::Checkbox("Do Light Presampling", &do_light_presampling))
 						{
 							global_kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_LIGHTS_PRESAMPLING, do_light_presampling ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
@@ -841,6 +1299,57 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 							" lights by avoiding cache trashing because of the memory random walk that"
 							" light sampling becomes with that many lights");
 
+						if (do_light_presampling && !use_light_bvh)
+						{
+							ImGui::TreePush("ReSTIR DI - Light Presampling Tree");
+
+							LightPresamplingSettings& light_presampling = render_settings.restir_di_settings.light_presampling;
+							if (ImGui::Checkbox("Auto size subsets", &light_presampling.auto_size))
+								m_render_window->set_render_dirty(true);
+							ImGuiRenderer::show_help_marker("If checked, the number of subsets and their size are computed from "
+								"the number of emissive triangles of the scene and from the render resolution.");
+
+							ImGui::BeginDisabled(light_presampling.auto_size);
+							if (ImGui::SliderInt("Number of subsets", &light_presampling.number_of_subsets, 1, 512))
+							{
+								light_presampling.number_of_subsets = std::max(1, light_presampling.number_of_subsets);
+								m_render_window->set_render_dirty(true);
+							}
+							if (ImGui::SliderInt("Subset size", &light_presampling.subset_size, 1, 4096))
+							{
+								light_presampling.subset_size = std::max(1, light_presampling.subset_size);
+								m_render_window->set_render_dirty(true);
+							}
+							ImGui::EndDisabled();
+
+							if (ImGui::SliderInt("Tile size", &light_presampling.tile_size, 1, 32))
+							{
+								light_presampling.tile_size = std::max(1, light_presampling.tile_size);
+								m_render_window->set_render_dirty(true);
+							}
+							ImGuiRenderer::show_help_marker("All the pixels of a tile of tile size * tile size pixels sample "
+								"their light candidates from the same subset.");
+
+							static bool use_shared_memory_lights = ReSTIR_DI_InitialCandidatesSharedMemoryLights;
+							if (ImGui::Checkbox("Load subsets in shared memory", &use_shared_memory_lights))
+							{
+								global_kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_INITIAL_CANDIDATES_SHARED_MEMORY_LIGHTS, use_shared_memory_lights ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+								m_renderer->recompile_kernels();
+								m_render_window->set_render_dirty(true);
+							}
+							ImGuiRenderer::show_help_marker("If checked, the threads of each block of the initial candidates pass load the subset "
+								"of presampled lights of the block (or a window of " + std::to_string(RESTIR_DI_SHARED_PRESAMPLED_LIGHT_COUNT) + " lights of it "
+								"if it is larger) in shared memory and draw their light candidates from there.\n\n"
+								"Only effective if the tile size is a multiple of " + std::to_string(RESTIR_DI_INITIAL_CANDIDATES_BLOCK_SIZE) + ".");
+
+							ImGui::Text("%d presampled lights: %.3fms", light_presampling.number_of_subsets * light_presampling.subset_size,
+								m_render_window_perf_metrics->get_current_value(ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID));
+
+							ImGui::TreePop();
+						}
+						ImGui::EndDisabled();
+
 						static bool use_initial_target_function_visibility = ReSTIR_DI_InitialTargetFunctionVisibility;
 						if (ImGui::Checkbox("Use visibility in target function", &use_initial_target_function_visibility))
 						{
@@ -852,6 +1361,25 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 						ImGuiRenderer::show_help_marker("Whether or not to use the visibility term in the target function used for "
 							"resampling initial candidates");
 
+						bool target_function_packed_half = global_kernel_options->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_TARGET_FUNCTION_PACKED_HALF) == KERNEL_OPTION_TRUE;
+						if (ImGui::Checkbox("Half precision target function", &target_function_packed_half))
+						{
+							global_kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_TARGET_FUNCTION_PACKED_HALF, target_function_packed_half ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+							m_renderer->recompile_kernels();
+
+							m_render_window->set_render_dirty(true);
+						}
+						ImGuiRenderer::show_help_marker("If checked, the color products of the target function of all the passes "
+							"of ReSTIR DI are computed with packed half precision math.\n\n"
+							"Faster on the GPUs with double rate half precision, the resampling weights are slightly less precise.");
+
+						if (ImGui::Checkbox("Fuse with camera rays", &render_settings.restir_di_settings.initial_candidates.fuse_with_camera_rays))
+							m_render_window->set_render_dirty(true);
+						ImGuiRenderer::show_help_marker("If checked, the initial candidates are sampled by the camera rays kernel "
+							"on the first hit it just traced instead of reading it back from the G-buffer in a separate kernel.\n\n"
+							"The time of the initial candidates is then included in the time of the camera rays. Not used when "
+							"rendering at low resolution. The presampled lights aren't loaded in shared memory by the fused kernel.");
+
 						if (ImGui::SliderInt("# of BSDF initial candidates", &render_settings.restir_di_settings.initial_candidates.number_of_initial_bsdf_candidates, 0, 16))
 						{
 							// Clamping to 0
@@ -895,11 +1423,22 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 						static bool do_visibility_reuse = ReSTIR_DI_DoVisibilityReuse;
 						if (ImGui::Checkbox("Do visibility reuse", &do_visibility_reuse))
 						{
-							global_kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE, do_visibility_reuse ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+							m_renderer->set_runtime_kernel_option(GPUKernelCompilerOptions::RESTIR_DI_DO_VISIBILITY_REUSE, do_visibility_reuse ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+							m_render_window->set_render_dirty(true);
+						}
+
+						static bool batched_visibility_rays = ReSTIR_DI_BatchedVisibilityRays;
+						if (ImGui::Checkbox("Batch visibility rays", &batched_visibility_rays))
+						{
+							global_kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS, batched_visibility_rays ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
 							m_renderer->recompile_kernels();
 
 							m_render_window->set_render_dirty(true);
 						}
+						ImGuiRenderer::show_help_marker("If checked, the visibility reuse rays of the initial candidates, spatial and spatiotemporal "
+							"passes are queued and traced by a dedicated kernel after each pass instead of being traced inline "
+							"by the resampling kernels.");
 					}
 
 					ImGui::TreePop();
@@ -1077,6 +1616,19 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 								m_render_window->set_render_dirty(true);
 							}
 
+							static bool use_shared_memory_tile = ReSTIR_DI_SpatialReuseSharedMemoryTile;
+							if (ImGui::Checkbox("Use shared memory tile", &use_shared_memory_tile))
+							{
+								global_kernel_options->set_macro_value(GPUKernelCompilerOptions::RESTIR_DI_SPATIAL_REUSE_SHARED_MEMORY_TILE, use_shared_memory_tile ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+								m_renderer->recompile_kernels();
+								m_render_window->set_render_dirty(true);
+							}
+							ImGuiRenderer::show_help_marker("If checked, the reservoirs and surfaces of the pixels of each thread block "
+								"and of an apron of " + std::to_string(RESTIR_DI_SPATIAL_TILE_APRON) + " pixels around them are loaded in shared memory "
+								"and the neighbors are read from there.\n\n"
+								"The spatial reuse radius is limited to " + std::to_string(RESTIR_DI_SPATIAL_TILE_APRON) + " pixels when this is enabled.");
+
 							// Checking the value before the "Neighbor Reuse Count" slider is modified
 							// so that we know whether or not we'll have to keep the
 							// 'partial_visibility_neighbor_count' value updated for the "Partial Neighbor Visibility" slider
@@ -1167,6 +1719,27 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 								}
 							}
 
+							if (ImGui::Checkbox("Adaptive Neighbor Count", &render_settings.restir_di_settings.spatial_pass.do_adaptive_neighbor_count))
+								m_render_window->set_render_dirty(true);
+							ImGuiRenderer::show_help_marker("If checked, the pixels reuse fewer neighbors as their temporal history grows: "
+								"from \"Neighbor Reuse Count\" for the pixels without history down to the minimum below for "
+								"the pixels whose reservoir reached the M-cap.\n\n"
+								"Not used if the M-cap is 0.");
+							if (render_settings.restir_di_settings.spatial_pass.do_adaptive_neighbor_count)
+							{
+								ImGui::TreePush("Adaptive neighbor count tree");
+
+								if (ImGui::SliderInt("Min Neighbor Reuse Count", &render_settings.restir_di_settings.spatial_pass.adaptive_min_neighbor_count, 1, render_settings.restir_di_settings.spatial_pass.reuse_neighbor_count))
+								{
+									render_settings.restir_di_settings.spatial_pass.adaptive_min_neighbor_count = std::max(1, render_settings.restir_di_settings.spatial_pass.adaptive_min_neighbor_count);
+
+									m_render_window->set_render_dirty(true);
+								}
+								ImGuiRenderer::show_help_marker("How many neighbors the pixels whose reservoir reached the M-cap reuse.");
+
+								ImGui::TreePop();
+							}
+
 							if (ImGui::Checkbox("Neighbor Samples Random Rotation", &render_settings.restir_di_settings.spatial_pass.do_neighbor_rotation))
 								m_render_window->set_render_dirty(true);
 							ImGuiRenderer::show_help_marker("If checked, spatial neighbors sampled (using the Hammersley point set) "
@@ -1197,10 +1770,13 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 							}
 							ImGui::EndDisabled();
 
+							ImGui::BeginDisabled(global_kernel_options->get_macro_value(GPUKernelCompilerOptions::KERNEL_DIAGNOSTICS) == KERNEL_OPTION_FALSE);
 							if (ImGui::Checkbox("Debug Neighbor Reuse Positions", &render_settings.restir_di_settings.spatial_pass.debug_neighbor_location))
 								m_render_window->set_render_dirty(true);
 							ImGuiRenderer::show_help_marker("If checked, neighbor in the spatial reuse pass will be hardcoded to always be "
-								"15 pixels to the right, not in a circle. This makes spotting bias easier when debugging.");
+								"15 pixels to the right, not in a circle. This makes spotting bias easier when debugging.\n\n"
+								"Requires the kernel diagnostics (Debug panel).");
+							ImGui::EndDisabled();
 						}
 					}
 
@@ -1317,6 +1893,11 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 								m_render_window->set_render_dirty(true);
 							}
 
+							if (ImGui::Checkbox("Light candidates from presampled lights", &render_settings.restir_di_settings.light_presampling.use_for_RIS_light_candidates))
+								m_render_window->set_render_dirty(true);
+							ImGuiRenderer::show_help_marker("If checked, the RIS light candidates of the later bounces are taken from the same "
+								"presampled light subsets as the initial candidates of ReSTIR DI, per tile of pixels, for coherent memory reads.");
+
 							break;
 						}
 
@@ -1341,37 +1922,370 @@ void ImGuiSettingsWindow::draw_sampling_panel()
 			ImGui::TreePop();
 		}
 
-		if (ImGui::CollapsingHeader("Envmap lighting"))
+		if (ImGui::CollapsingHeader("Indirect lighting"))
 		{
-			ImGui::TreePush("Envmap sampling tree");
+			ImGui::TreePush("Indirect lighting sampling tree");
 
-			const char* items[] = { "- No envmap importance sampling", "- Importance Sampling - Binary Search", "- Importance Sampling - Alias Table " };
-			if (ImGui::Combo("Envmap sampling strategy", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY), items, IM_ARRAYSIZE(items)))
+			const char* items[] = { "- Path tracing", "- ReSTIR GI (Second Vertex Resampling)", "- Path guiding" };
+			if (ImGui::Combo("Indirect light sampling strategy", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY), items, IM_ARRAYSIZE(items)))
 			{
-				ThreadManager::start_thread("RecomputeEnvmapSamplingStructure", [this]() {
-					m_renderer->get_envmap().recompute_sampling_data_structure(m_renderer.get());
-					});
-
 				m_renderer->recompile_kernels();
 				m_render_window->set_render_dirty(true);
-
-				ThreadManager::join_threads("RecomputeEnvmapSamplingStructure");
 			}
+			ImGuiRenderer::show_help_marker("ReSTIR GI resamples the second vertex of the paths of the pixels "
+				"temporally and spatially before shading the first hits with the resampled vertices.\n\n"
+				"Path guiding learns the incident radiance in a grid over the scene from the paths of the first "
+				"samples and samples the bounces with that learnt distribution in addition to the BSDF.\n\n"
+				"Both are only used by the megakernel path tracer, not by the wavefront path tracer.");
 
-			if (global_kernel_options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) != ESS_NO_SAMPLING)
+			if (global_kernel_options->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_RESTIR_GI)
 			{
-				// If we do have an importance sampling strategy
-				static bool do_envmap_bsdf_mis = EnvmapSamplingDoBSDFMIS;
-				if (ImGui::Checkbox("Do MIS with BSDF", &do_envmap_bsdf_mis))
-				{
-					global_kernel_options->set_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_DO_BSDF_MIS, do_envmap_bsdf_mis ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
-					m_renderer->recompile_kernels();
-					m_render_window->set_render_dirty(true);
-				}
-				ImGuiRenderer::show_help_marker("");
-			}
+				ReSTIRGISettings& restir_gi_settings = render_settings.restir_gi_settings;
 
-			ImGui::Dummy(ImVec2(0.0f, 20.0f));
+				if (render_settings.use_wavefront_path_tracing)
+					ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "ReSTIR GI is not used by the wavefront path tracer");
+
+				if (ImGui::Checkbox("Do temporal reuse", &restir_gi_settings.temporal_pass.do_temporal_reuse_pass))
+					m_render_window->set_render_dirty(true);
+				if (ImGui::Checkbox("Do spatial reuse", &restir_gi_settings.spatial_pass.do_spatial_reuse_pass))
+					m_render_window->set_render_dirty(true);
+
+				ImGui::BeginDisabled(!restir_gi_settings.spatial_pass.do_spatial_reuse_pass);
+				if (ImGui::SliderInt("Spatial reuse radius (px)", &restir_gi_settings.spatial_pass.reuse_radius, 1, 64))
+					m_render_window->set_render_dirty(true);
+				if (ImGui::SliderInt("Spatial reuse neighbor count", &restir_gi_settings.spatial_pass.reuse_neighbor_count, 1, 16))
+					m_render_window->set_render_dirty(true);
+				ImGui::EndDisabled();
+
+				if (ImGui::SliderInt("M-cap", &restir_gi_settings.m_cap, 0, 64))
+				{
+					restir_gi_settings.m_cap = std::max(0, restir_gi_settings.m_cap);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("0 for no M-cap.");
+
+				if (ImGui::SliderFloat("Jacobian rejection threshold", &restir_gi_settings.jacobian_rejection_threshold, 1.0f, 50.0f))
+				{
+					restir_gi_settings.jacobian_rejection_threshold = std::max(1.0f, restir_gi_settings.jacobian_rejection_threshold);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Neighbors whose sample would be reconnected to the center pixel with a "
+					"jacobian above this threshold (or below its inverse) are not reused. Lower values reduce the fireflies "
+					"of the reuse but also reduce the amount of reuse.");
+
+				if (ImGui::Checkbox("Final shading visibility", &restir_gi_settings.do_final_shading_visibility))
+					m_render_window->set_render_dirty(true);
+				ImGuiRenderer::show_help_marker("Traces a shadow ray from the first hit to the resampled vertex when "
+					"shading. Without it, indirect lighting leaks through occluders.");
+			}
+			else if (global_kernel_options->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_PATH_GUIDING)
+			{
+				PathGuidingSettings& path_guiding_settings = render_settings.path_guiding_settings;
+				PathGuidingRenderPass& path_guiding_render_pass = m_renderer->get_path_guiding_render_pass();
+
+				if (render_settings.use_wavefront_path_tracing)
+					ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Path guiding is not used by the wavefront path tracer");
+
+				if (ImGui::SliderFloat("Guiding probability", &path_guiding_settings.guiding_probability, 0.0f, 1.0f))
+				{
+					path_guiding_settings.guiding_probability = hippt::clamp(0.0f, 1.0f, path_guiding_settings.guiding_probability);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Probability of sampling a bounce with the learnt distribution instead of "
+					"the BSDF. Both samplings are combined with MIS so any value is unbiased.");
+
+				if (ImGui::SliderFloat("Minimum roughness", &path_guiding_settings.minimum_roughness, 0.0f, 1.0f))
+					m_render_window->set_render_dirty(true);
+				ImGuiRenderer::show_help_marker("The materials smoother than this roughness are not guided: their lobes "
+					"are sharper than the bins of the learnt distribution so the BSDF samples them better.");
+
+				if (ImGui::SliderInt("Training samples", &path_guiding_settings.training_sample_count, 0, 1024))
+					path_guiding_settings.training_sample_count = std::max(0, path_guiding_settings.training_sample_count);
+				ImGuiRenderer::show_help_marker("Number of samples whose paths train the grid. The grid is in world space "
+					"so it is kept when the camera moves.");
+
+				static int grid_resolution = path_guiding_settings.grid_resolution;
+				ImGui::SliderInt("Grid resolution", &grid_resolution, 1, 64);
+				ImGui::SameLine();
+				if (ImGui::Button("Apply"))
+				{
+					path_guiding_settings.grid_resolution = std::max(1, grid_resolution);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Number of cells of the grid along each axis of the bounding box of the scene. "
+					"Changing the resolution restarts the training.");
+				ImGui::Text("Grid memory: %.2fMB", PathGuidingRenderPass::get_grid_byte_size(grid_resolution) / 1000000.0f);
+
+				ImGui::Text("Trained samples: %d / %d", std::min(path_guiding_render_pass.get_trained_sample_count(), path_guiding_settings.training_sample_count), path_guiding_settings.training_sample_count);
+				if (ImGui::Button("Restart training"))
+				{
+					path_guiding_render_pass.reset_training();
+
+					m_render_window->set_render_dirty(true);
+				}
+			}
+
+			ImGui::Dummy(ImVec2(0.0f, 20.0f));
+			ImGui::SeparatorText("Radiance cache");
+			RadianceCacheSettings& radiance_cache_settings = render_settings.radiance_cache_settings;
+			if (ImGui::Checkbox("Use radiance cache", &radiance_cache_settings.use_radiance_cache))
+				m_render_window->set_render_dirty(true);
+			ImGuiRenderer::show_help_marker("Terminates most of the paths into a world space cache of the radiance "
+				"reflected by the surfaces of the scene. Much faster indirect lighting but biased: meant for the preview.");
+
+			if (radiance_cache_settings.use_radiance_cache)
+			{
+				ImGui::TreePush("Radiance cache tree");
+
+				if (render_settings.use_wavefront_path_tracing)
+					ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "The radiance cache is not used by the wavefront path tracer");
+
+				if (ImGui::SliderInt("Termination bounce", &radiance_cache_settings.termination_bounce, 1, std::max(1, render_settings.nb_bounces - 1)))
+				{
+					radiance_cache_settings.termination_bounce = std::max(1, radiance_cache_settings.termination_bounce);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Bounce at which the paths terminate with the cached radiance of the surface they hit.");
+
+				if (ImGui::SliderFloat("Training path probability", &radiance_cache_settings.training_path_probability, 0.0f, 1.0f))
+				{
+					radiance_cache_settings.training_path_probability = hippt::clamp(0.0f, 1.0f, radiance_cache_settings.training_path_probability);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Probability for a path to be traced completely to update the cache "
+					"instead of terminating into it.");
+
+				if (ImGui::SliderFloat("Cell size", &radiance_cache_settings.cell_size, 1.0e-3f, 1.0f, "%.4f", ImGuiSliderFlags_Logarithmic))
+				{
+					radiance_cache_settings.cell_size = std::max(1.0e-4f, radiance_cache_settings.cell_size);
+					m_renderer->get_radiance_cache_render_pass().clear_cache();
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Size of the cells of the cache in world units. Smaller cells are more "
+					"accurate but need more samples to converge. Changing the size clears the cache.");
+
+				if (ImGui::SliderInt("Min samples", &radiance_cache_settings.min_sample_count, 1, 128))
+				{
+					radiance_cache_settings.min_sample_count = std::max(1, radiance_cache_settings.min_sample_count);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("The paths only terminate into the entries that have accumulated that many samples.");
+
+				if (ImGui::SliderInt("Max accumulated samples", &radiance_cache_settings.max_accumulated_samples, 1, 4096))
+					radiance_cache_settings.max_accumulated_samples = std::max(1, radiance_cache_settings.max_accumulated_samples);
+				ImGuiRenderer::show_help_marker("Lower values follow the changes of lighting faster but are noisier.");
+
+				if (ImGui::SliderInt("Max entry age", &radiance_cache_settings.max_entry_age, 1, 1024))
+					radiance_cache_settings.max_entry_age = std::max(1, radiance_cache_settings.max_entry_age);
+				ImGuiRenderer::show_help_marker("Number of frames without samples after which an entry is evicted from the cache.");
+
+				ImGui::Text("Cache memory: %.2fMB", RadianceCacheRenderPass::get_byte_size() / 1000000.0f);
+				if (ImGui::Button("Clear cache"))
+				{
+					m_renderer->get_radiance_cache_render_pass().clear_cache();
+
+					m_render_window->set_render_dirty(true);
+				}
+
+				ImGui::TreePop();
+			}
+
+			ImGui::Dummy(ImVec2(0.0f, 20.0f));
+			ImGui::TreePop();
+		}
+
+		if (ImGui::CollapsingHeader("Envmap lighting"))
+		{
+			ImGui::TreePush("Envmap sampling tree");
+
+			const char* items[] = { "- No envmap importance sampling", "- Importance Sampling - Binary Search", "- Importance Sampling - Alias Table ", "- Importance Sampling - Marginal/Conditional CDF", "- Importance Sampling - Envmap * BSDF Product" };
+			if (ImGui::Combo("Envmap sampling strategy", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY), items, IM_ARRAYSIZE(items)))
+			{
+				ThreadManager::start_thread("RecomputeEnvmapSamplingStructure", [this]() {
+					m_renderer->get_envmap().recompute_sampling_data_structure(m_renderer.get());
+					});
+
+				m_renderer->recompile_kernels();
+				m_render_window->set_render_dirty(true);
+
+				ThreadManager::join_threads("RecomputeEnvmapSamplingStructure");
+			}
+
+			if (global_kernel_options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) != ESS_NO_SAMPLING)
+			{
+				if (ImGui::SliderInt("Importance map downscale", &m_renderer->get_envmap().sampling_downscale, 1, 16))
+				{
+					m_renderer->get_envmap().sampling_downscale = std::max(1, m_renderer->get_envmap().sampling_downscale);
+
+					ThreadManager::start_thread("RecomputeEnvmapSamplingStructure", [this]() {
+						m_renderer->get_envmap().recompute_sampling_data_structure(m_renderer.get());
+						});
+
+					m_render_window->set_render_dirty(true);
+
+					ThreadManager::join_threads("RecomputeEnvmapSamplingStructure");
+				}
+				ImGuiRenderer::show_help_marker("The CDF / alias table of the envmap are computed on a version of the envmap downscaled "
+					"by this factor in each dimension (the average luminance of the texels). Divides their size by the square "
+					"of the factor for better cache hit rates. The background and the lighting still use the full resolution envmap. Unbiased.");
+			}
+
+			if (global_kernel_options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_PRODUCT_SAMPLING)
+			{
+				WorldSettings& world_settings = m_renderer->get_world_settings();
+				if (ImGui::SliderInt("Product sampling BSDF levels", &world_settings.envmap_product_sampling_lobe_levels, 0, 10))
+					m_render_window->set_render_dirty(true);
+				ImGuiRenderer::show_help_marker("How many levels of the luminance pyramid of the envmap (from the coarsest) "
+					"are importance sampled by the product of the envmap luminance and of an approximation of the BSDF. "
+					"The finer levels are sampled by luminance only. More levels follow the BSDF more closely "
+					"but evaluate the approximation 4 more times per level, for the sample and for its PDF.");
+			}
+
+			if (global_kernel_options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_ALIAS_TABLE
+				|| global_kernel_options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) == ESS_PRODUCT_SAMPLING)
+			{
+				static bool compact_alias_table = EnvmapCompactAliasTable;
+				if (ImGui::Checkbox("Compact alias table", &compact_alias_table))
+				{
+					global_kernel_options->set_macro_value(GPUKernelCompilerOptions::ENVMAP_COMPACT_ALIAS_TABLE, compact_alias_table ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+					ThreadManager::start_thread("RecomputeEnvmapSamplingStructure", [this]() {
+						m_renderer->get_envmap().recompute_sampling_data_structure(m_renderer.get());
+						});
+
+					m_renderer->recompile_kernels();
+					m_render_window->set_render_dirty(true);
+
+					ThreadManager::join_threads("RecomputeEnvmapSamplingStructure");
+				}
+				ImGuiRenderer::show_help_marker("Stores the probabilities of the alias table on 16 bits instead of 32. "
+					"Halves the memory footprint (and bandwidth) of the probabilities at the cost of a very slight quantization of the sampling distribution (unbiased).");
+			}
+
+			const char* storage_items[] = { "- RGBA32F", "- RGBA16F", "- RGB9E5", "- RGB32F" };
+			if (ImGui::Combo("Envmap storage format", global_kernel_options->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::ENVMAP_STORAGE_FORMAT), storage_items, IM_ARRAYSIZE(storage_items)))
+			{
+				if (m_renderer->has_envmap())
+					m_renderer->get_envmap().reload_envmap_storage(m_renderer.get());
+
+				m_renderer->recompile_kernels();
+				m_render_window->set_render_dirty(true);
+			}
+			ImGuiRenderer::show_help_marker("Format of the envmap texture on the GPU. RGBA16F halves the "
+				"memory footprint of the envmap, RGB9E5 divides it by 4 (shared exponent, decoded and filtered in the shader). "
+				"RGB32F is lossless without the unused alpha channel of RGBA32F (filtered in the shader).");
+
+			if (global_kernel_options->get_macro_value(GPUKernelCompilerOptions::ENVMAP_SAMPLING_STRATEGY) != ESS_NO_SAMPLING)
+			{
+				// If we do have an importance sampling strategy
+				static bool do_envmap_bsdf_mis = EnvmapSamplingDoBSDFMIS;
+				if (ImGui::Checkbox("Do MIS with BSDF", &do_envmap_bsdf_mis))
+				{
+					m_renderer->set_runtime_kernel_option(GPUKernelCompilerOptions::ENVMAP_SAMPLING_DO_BSDF_MIS, do_envmap_bsdf_mis ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("");
+			}
+
+			ImGui::Dummy(ImVec2(0.0f, 20.0f));
+			ImGui::TreePop();
+		}
+
+		if (ImGui::CollapsingHeader("Visibility cache"))
+		{
+			ImGui::TreePush("Visibility cache tree");
+
+			VisibilityCacheSettings& visibility_cache_settings = render_settings.visibility_cache_settings;
+			if (ImGui::Checkbox("Use visibility cache", &visibility_cache_settings.use_visibility_cache))
+				m_render_window->set_render_dirty(true);
+			ImGuiRenderer::show_help_marker("World space cache of the visibility of the envmap and of the lights "
+				"trained by the shadow rays. The envmap sampling and the RIS light sampling favor the candidates "
+				"that are visible from the nearby shading points so less shadow rays are wasted on occluded samples. Unbiased.");
+
+			if (visibility_cache_settings.use_visibility_cache)
+			{
+				ImGui::TreePush("Visibility cache settings tree");
+
+				if (ImGui::SliderInt("Envmap candidates", &visibility_cache_settings.envmap_candidates, 1, 16))
+				{
+					visibility_cache_settings.envmap_candidates = std::max(1, visibility_cache_settings.envmap_candidates);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Number of envmap samples that the envmap sampling resamples "
+					"one direction from with the visibility of the cache. Only one shadow ray is traced.");
+
+				if (ImGui::SliderFloat("Min sampling weight", &visibility_cache_settings.min_sampling_weight, 0.01f, 1.0f))
+				{
+					visibility_cache_settings.min_sampling_weight = hippt::clamp(0.01f, 1.0f, visibility_cache_settings.min_sampling_weight);
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Minimum weight of the directions that the cache sees as occluded. "
+					"Higher values are more robust to the changes of the scene but favor the visible directions less.");
+
+				if (ImGui::SliderFloat("Cell size", &visibility_cache_settings.cell_size, 1.0e-3f, 1.0f, "%.4f", ImGuiSliderFlags_Logarithmic))
+				{
+					visibility_cache_settings.cell_size = std::max(1.0e-4f, visibility_cache_settings.cell_size);
+					m_renderer->get_visibility_cache_render_pass().clear_cache();
+
+					m_render_window->set_render_dirty(true);
+				}
+				ImGuiRenderer::show_help_marker("Size of the cells of the cache in world units. Changing the size clears the cache.");
+
+				if (ImGui::SliderInt("Max accumulated samples", &visibility_cache_settings.max_accumulated_samples, 2, 4096))
+					visibility_cache_settings.max_accumulated_samples = std::max(2, visibility_cache_settings.max_accumulated_samples);
+				ImGuiRenderer::show_help_marker("Lower values follow the changes of the scene faster but are noisier.");
+
+				if (ImGui::Checkbox("Skip occluded shadow rays", &visibility_cache_settings.skip_occluded_shadow_rays))
+					m_render_window->set_render_dirty(true);
+				ImGuiRenderer::show_help_marker("Doesn't trace the shadow rays towards the directions that the cache "
+					"confidently sees as occluded. Biased: meant for the preview.");
+
+				if (visibility_cache_settings.skip_occluded_shadow_rays)
+				{
+					ImGui::TreePush("Skip occluded shadow rays tree");
+
+					if (ImGui::SliderFloat("Occluded threshold", &visibility_cache_settings.occluded_threshold, 0.0f, 0.5f))
+						m_render_window->set_render_dirty(true);
+					ImGuiRenderer::show_help_marker("A direction is confidently occluded if less than that fraction of its shadow rays were unoccluded...");
+
+					if (ImGui::SliderInt("Min samples", &visibility_cache_settings.min_sample_count, 1, 256))
+					{
+						visibility_cache_settings.min_sample_count = std::max(1, visibility_cache_settings.min_sample_count);
+
+						m_render_window->set_render_dirty(true);
+					}
+					ImGuiRenderer::show_help_marker("... over at least that many shadow rays.");
+
+					if (ImGui::SliderFloat("Retest probability", &visibility_cache_settings.occluded_retest_probability, 0.0f, 1.0f))
+						m_render_window->set_render_dirty(true);
+					ImGuiRenderer::show_help_marker("Probability to still trace the shadow rays of the confidently occluded directions "
+						"so that the cache notices when they become visible.");
+
+					ImGui::TreePop();
+				}
+
+				ImGui::Text("Cache memory: %.2fMB", VisibilityCacheRenderPass::get_byte_size() / 1000000.0f);
+				if (ImGui::Button("Clear cache"))
+				{
+					m_renderer->get_visibility_cache_render_pass().clear_cache();
+
+					m_render_window->set_render_dirty(true);
+				}
+
+				ImGui::TreePop();
+			}
+
+			ImGui::Dummy(ImVec2(0.0f, 20.0f));
 			ImGui::TreePop();
 		}
 
@@ -1505,6 +2419,18 @@ void ImGuiSettingsWindow::draw_objects_panel()
 		return;
 	ImGui::TreePush("Objects tree");
 
+	static char scene_filepath[512] = "";
+	bool scene_loading = m_renderer->is_pending_scene_loading();
+	ImGui::InputText("Scene file", scene_filepath, IM_ARRAYSIZE(scene_filepath));
+	ImGui::BeginDisabled(scene_loading || scene_filepath[0] == '\0');
+	if (ImGui::Button(scene_loading ? "Loading scene..." : "Load scene"))
+		m_renderer->load_scene_async(scene_filepath);
+	ImGui::EndDisabled();
+	ImGuiRenderer::show_help_marker("Parses the scene at that path and loads its textures in the background while "
+		"the render continues with the current scene. The new scene replaces the current one between two frames "
+		"once it is loaded, the frames only wait for the build of its BVH. The kernels stay compiled.");
+	ImGui::Dummy(ImVec2(0.0f, 20.0f));
+
 	// Keeping a backup of the materials. Useful when modifying the global emissive factor
 	// of objects in the scene because we want the global factor to affect the original
 	// emission of the materials, not the emission that has already been multiplied by
@@ -1516,6 +2442,14 @@ void ImGuiSettingsWindow::draw_objects_panel()
 
 	bool material_changed = false;
 	static int currently_selected_material = 0;
+	static int scene_generation = m_renderer->get_scene_generation();
+	if (scene_generation != m_renderer->get_scene_generation())
+	{
+		// The scene was replaced, see GPURenderer::load_scene_async()
+		original_materials = materials;
+		currently_selected_material = 0;
+		scene_generation = m_renderer->get_scene_generation();
+	}
 
 	std::vector<const char*> items = { "- None", "- Lambertian BRDF", "- Oren Nayar BRDF", "- Disney BSDF" };
 	if (ImGui::Combo("All Objects BSDF Override", m_renderer->get_global_compiler_options()->get_raw_pointer_to_macro_value(GPUKernelCompilerOptions::BSDF_OVERRIDE), items.data(), items.size()))
@@ -1524,6 +2458,40 @@ void ImGuiSettingsWindow::draw_objects_panel()
 
 		m_render_window->set_render_dirty(true);
 	}
+
+	static bool use_simplified_bsdf = DeepBouncesSimplifiedBSDF;
+	if (ImGui::Checkbox("Simplified BSDF for deep bounces", &use_simplified_bsdf))
+	{
+		m_renderer->get_global_compiler_options()->set_macro_value(GPUKernelCompilerOptions::DEEP_BOUNCES_SIMPLIFIED_BSDF, use_simplified_bsdf ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+		m_renderer->recompile_kernels();
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the materials hit after a given bounce use a cheaper Lambertian + GGX BSDF "
+		"instead of the Disney BSDF (glass materials excepted). This is biased.");
+	if (use_simplified_bsdf)
+	{
+		ImGui::TreePush("Simplified BSDF tree");
+
+		HIPRTRenderSettings& render_settings = m_renderer->get_render_settings();
+		if (ImGui::SliderInt("Start bounce", &render_settings.simplified_bsdf_start_bounce, 1, render_settings.nb_bounces))
+			m_render_window->set_render_dirty(true);
+		ImGuiRenderer::show_help_marker("First bounce where the simplified BSDF is used. 1 uses it for all the hits after the camera ray hit.");
+
+		ImGui::TreePop();
+	}
+
+	static bool use_ray_cones_lod = MaterialTexturesRayConesLOD;
+	if (ImGui::Checkbox("Textures level of detail", &use_ray_cones_lod))
+	{
+		m_renderer->get_global_compiler_options()->set_macro_value(GPUKernelCompilerOptions::MATERIAL_TEXTURES_RAY_CONES_LOD, use_ray_cones_lod ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+		m_renderer->recompile_kernels();
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the material textures are sampled from their mip levels "
+		"based on the footprint of ray cones traced along the paths. Reduces texture aliasing "
+		"and noise at a distance and after rough bounces.");
 	ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
 	if (ImGui::CollapsingHeader("All objects"))
@@ -1567,7 +2535,6 @@ void ImGuiSettingsWindow::draw_objects_panel()
 				}
 			}
 
-			// TODO we would need to recompute the alias table for the emissive lights here
 			m_renderer->update_materials(materials);
 			m_render_window->set_render_dirty(true);
 		}
@@ -1725,8 +2692,59 @@ void ImGuiSettingsWindow::draw_denoiser_panel()
 			m_render_window_denoiser->finalize();
 		}
 		ImGui::EndDisabled();
+		ImGui::SliderInt("AOVs converged after", &m_application_settings->denoiser_AOV_converged_sample_count, 0, 1024, "%d samples");
+		ImGuiRenderer::show_help_marker("After that many samples, the albedo and normals AOVs are considered converged: "
+			"they are prefiltered once more and their prefiltered version is reused by the next denoising steps of the render. "
+			"0 to prefilter them every time.");
+
+		std::shared_ptr<GPUKernelCompilerOptions> global_kernel_options = m_renderer->get_global_compiler_options();
+		bool packed_AOVs = global_kernel_options->get_macro_value(GPUKernelCompilerOptions::PACKED_DENOISER_AOVS) == KERNEL_OPTION_TRUE;
+		if (ImGui::Checkbox("Packed AOVs accumulation", &packed_AOVs))
+		{
+			global_kernel_options->set_macro_value(GPUKernelCompilerOptions::PACKED_DENOISER_AOVS, packed_AOVs ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+			m_renderer->recompile_kernels();
+			m_render_window->set_render_dirty(true);
+		}
+		ImGuiRenderer::show_help_marker("If checked, the albedo and normals AOVs are accumulated in 32 bits per pixel "
+			"(RGB9E5 albedo and octahedral normals) instead of 12 bytes per pixel and are only expanded "
+			"to the buffers of the denoiser once per frame.\n\n"
+			"Less memory traffic per sample for slightly less precise AOVs.");
+
+		bool AOVs_from_G_buffer = global_kernel_options->get_macro_value(GPUKernelCompilerOptions::DENOISER_AOVS_FROM_G_BUFFER) == KERNEL_OPTION_TRUE;
+		if (ImGui::Checkbox("AOVs from the G-buffer", &AOVs_from_G_buffer))
+		{
+			global_kernel_options->set_macro_value(GPUKernelCompilerOptions::DENOISER_AOVS_FROM_G_BUFFER, AOVs_from_G_buffer ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+			m_renderer->recompile_kernels();
+			m_render_window->set_render_dirty(true);
+		}
+		ImGuiRenderer::show_help_marker("If checked, the albedo and normals AOVs are computed by a separate kernel from the "
+			"G-buffer of the camera rays instead of by the path tracing kernel.\n\n"
+			"The AOVs are only averaged over the samples if the camera rays are jittered.");
 		ImGui::TreePop();
 	}
+
+	const char* quality_items[] = { "- Fast", "- Balanced", "- High" };
+	int denoiser_quality = m_application_settings->denoiser_quality;
+	if (ImGui::Combo("Quality", &denoiser_quality, quality_items, IM_ARRAYSIZE(quality_items)))
+	{
+		m_application_settings->denoiser_quality = static_cast<DenoiserQuality>(denoiser_quality);
+		m_application_settings->denoiser_settings_changed = true;
+
+		m_render_window_denoiser->set_quality(m_application_settings->denoiser_quality);
+		m_render_window_denoiser->finalize();
+	}
+	if (ImGui::InputInt("Max memory (MB)", &m_application_settings->denoiser_max_memory_MB))
+	{
+		m_application_settings->denoiser_max_memory_MB = std::max(0, m_application_settings->denoiser_max_memory_MB);
+		m_application_settings->denoiser_settings_changed = true;
+
+		m_render_window_denoiser->set_max_memory_MB(m_application_settings->denoiser_max_memory_MB);
+		m_render_window_denoiser->finalize();
+	}
+	ImGuiRenderer::show_help_marker("Maximum memory used by the denoiser for its intermediate data. If the full "
+		"resolution doesn't fit, the image is denoised in overlapping tiles. Useful for denoising very high "
+		"resolution renders. 0 for no limit.");
+
 	ImGui::Checkbox("Only denoise when rendering is done", &m_application_settings->denoise_when_rendering_done);
 	ImGui::SliderInt("Denoise Sample Skip", &m_application_settings->denoiser_sample_skip, 1, 128);
 	ImGui::SliderFloat("Denoiser blend", &m_application_settings->denoiser_blend, 0.0f, 1.0f);
@@ -1747,6 +2765,12 @@ void ImGuiSettingsWindow::draw_post_process_panel()
 	ImGui::Checkbox("Do tonemapping", &m_application_settings->do_tonemapping);
 	ImGui::InputFloat("Gamma", &m_application_settings->tone_mapping_gamma);
 	ImGui::InputFloat("Exposure", &m_application_settings->tone_mapping_exposure);
+	if (ImGui::Checkbox("GPU tonemapping", &m_application_settings->gpu_tonemapping))
+		// Recreating the display textures for the new mode
+		m_render_window->get_display_view_system()->queue_display_view_change(m_render_window->get_display_view_system()->get_current_display_view_type());
+	ImGuiRenderer::show_help_marker("If checked, the default and denoised views are tonemapped by a compute shader "
+		"reading the framebuffers straight from their interop buffers instead of copying the HDR "
+		"framebuffers to the display textures every frame.");
 
 	ImGui::TreePop();
 	ImGui::Dummy(ImVec2(0.0f, 20.0f));
@@ -1802,6 +2826,194 @@ void ImGuiSettingsWindow::draw_performance_settings_panel()
 		" This feature is basically only meant for GPUs that get too hot to avoid burning your GPUs during long renders if you have"
 		" time to spare.");
 
+	if (ImGui::InputFloat("Target present framerate", &m_application_settings->target_present_framerate))
+		m_application_settings->target_present_framerate = std::max(1.0f, m_application_settings->target_present_framerate);
+	ImGuiRenderer::show_help_marker("How many times per second the viewport is updated with the latest frame rendered. "
+		"The frames are submitted to the GPU by a thread of their own: between two updates of the viewport, "
+		"the GPU renders the frames back to back and the interface keeps running at its own framerate.");
+	if (ImGui::InputInt("Refresh every N samples", &m_application_settings->display_refresh_sample_interval))
+		m_application_settings->display_refresh_sample_interval = std::max(0, m_application_settings->display_refresh_sample_interval);
+	ImGuiRenderer::show_help_marker("If > 0, the viewport is updated every time that many samples have been accumulated "
+		"instead of at the target present framerate. Uploading the render to the display textures is skipped for the "
+		"frames in between. The viewport is updated after every frame when moving the camera regardless.");
+	if (ImGui::SliderInt("Render queue depth", &m_application_settings->render_queue_depth, 1, GPURenderer::MAX_QUEUED_FRAME_COUNT))
+		m_application_settings->render_queue_depth = std::max(1, std::min(m_application_settings->render_queue_depth, GPURenderer::MAX_QUEUED_FRAME_COUNT));
+	ImGuiRenderer::show_help_marker("How many frames are queued on the GPU at the same time. With more than 1, "
+		"the next frame is already queued when a frame completes so the GPU never waits for the CPU to submit it.");
+	bool use_device_render_buffers = m_renderer->get_use_device_render_buffers();
+	if (ImGui::Checkbox("Render into device buffers", &use_device_render_buffers))
+	{
+		m_renderer->set_use_device_render_buffers(use_device_render_buffers);
+
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the frames are accumulated into GPU buffers of the renderer instead of the "
+		"buffers shared with OpenGL. The render is only copied to the OpenGL buffers when the viewport is updated so the "
+		"shared buffers are not mapped/unmapped around the frames.");
+
+	bool tune_kernel_launches = g_kernel_launch_autotuner.is_enabled();
+	if (ImGui::Checkbox("Tune kernel launches", &tune_kernel_launches))
+		g_kernel_launch_autotuner.set_enabled(tune_kernel_launches);
+	ImGuiRenderer::show_help_marker("If checked, the first launches of each kernel are timed with different block shapes "
+		"(same number of threads) and the fastest shape is used afterwards. The shapes found are kept per device in \""
+		+ KernelLaunchAutotuner::CONFIGURATIONS_FILE_PATH + "\".");
+	ImGui::SameLine();
+	if (ImGui::Button("Retune"))
+		g_kernel_launch_autotuner.reset();
+
+	if (ImGui::Checkbox("Compact active pixels", &render_settings.compact_active_pixels))
+		m_render_window->set_render_dirty(true);
+	ImGuiRenderer::show_help_marker("If checked, the pixels that still need samples are gathered in a list at the "
+		"beginning of each sample and the camera rays, ReSTIR and megakernel path tracing kernels are launched over "
+		"that list instead of over the whole image. With the adaptive sampling, the pixels that have converged then "
+		"don't cost anything.\n\n"
+		"The time of the compaction is included in the time of the camera rays pass.");
+
+	ImGui::BeginDisabled(render_settings.use_wavefront_path_tracing);
+	if (ImGui::Checkbox("Use persistent threads", &render_settings.use_persistent_threads_path_tracing))
+		m_render_window->set_render_dirty(true);
+	ImGui::EndDisabled();
+	ImGuiRenderer::show_help_marker("If checked, the megakernel path tracer only launches enough threads to fill the GPU and "
+		"the threads fetch the pixels to trace from a list of the active pixels of the sample. The threads whose path "
+		"ended early start another pixel instead of idling and the pixels converged by the adaptive sampling "
+		"don't cost anything.\n\n"
+		"Always compacts the active pixels. Not used by the wavefront path tracer.");
+
+	ImGui::Checkbox("Submit samples as a graph", &render_settings.use_sample_graph);
+	ImGuiRenderer::show_help_marker("If checked, the kernels of the samples of a frame are submitted to the GPU as a single graph "
+		"per sample instead of being launched one by one. This saves the CPU cost of the kernel launches, which "
+		"limits the sample rate at low resolution with many samples per frame.\n\n"
+		"Only the first sample of each frame is timed per kernel.\n\n"
+		"Not used with a device resident render data.");
+
+	ImGui::Checkbox("Multiple streams", &render_settings.use_multiple_streams);
+	ImGuiRenderer::show_help_marker("If checked, the passes that don't depend on each other are launched on two GPU streams "
+		"so that they can run at the same time: the lights presampling of ReSTIR DI / RIS alongside the camera rays, "
+		"and the path guiding / radiance cache updates alongside the temporal upscaling at the end of the frame.\n\n"
+		"The lights presampling stays on the main stream with \"Submit samples as a graph\". "
+		"Not used with a device resident render data.");
+
+	std::shared_ptr<GPUKernelCompilerOptions> global_kernel_options = m_renderer->get_global_compiler_options();
+	bool use_device_resident_render_data = global_kernel_options->get_macro_value(GPUKernelCompilerOptions::USE_DEVICE_RESIDENT_RENDER_DATA) == KERNEL_OPTION_TRUE;
+	if (ImGui::Checkbox("Device resident render data", &use_device_resident_render_data))
+	{
+		global_kernel_options->set_macro_value(GPUKernelCompilerOptions::USE_DEVICE_RESIDENT_RENDER_DATA, use_device_resident_render_data ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+		m_renderer->recompile_kernels();
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the render data is kept in VRAM and only uploaded when it changes. "
+		"The kernels then receive a pointer to it and the few values that change every sample as arguments "
+		"instead of the whole render data (a few kilobytes) at each launch.");
+
+	bool pixel_cost_instrumentation = global_kernel_options->get_macro_value(GPUKernelCompilerOptions::PIXEL_COST_INSTRUMENTATION) == KERNEL_OPTION_TRUE;
+	if (ImGui::Checkbox("Pixel cost instrumentation", &pixel_cost_instrumentation))
+	{
+		global_kernel_options->set_macro_value(GPUKernelCompilerOptions::PIXEL_COST_INSTRUMENTATION, pixel_cost_instrumentation ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+		m_renderer->recompile_kernels();
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the camera rays, ReSTIR and megakernel path tracing kernels measure the clock cycles "
+		"spent by each pixel, which can then be displayed with the \"Pixel cost heatmap\" display view of the viewport settings "
+		"to find the materials and regions of the scene that cost the most.\n\n"
+		"The instrumentation itself costs some performance. The wavefront path tracer isn't instrumented.");
+
+	if (ImGui::Checkbox("Use wavefront path tracing", &render_settings.use_wavefront_path_tracing))
+		m_render_window->set_render_dirty(true);
+	ImGuiRenderer::show_help_marker("If checked, the path tracing pass is split into separate extend / shade / shadow rays / accumulate "
+		"kernels that communicate through ray queues in VRAM instead of the single FullPathTracer megakernel. "
+		"This reduces register pressure and improves occupancy at the cost of some memory traffic.");
+
+	ImGui::BeginDisabled(!render_settings.use_wavefront_path_tracing);
+	ImGui::TreePush("Wavefront settings tree");
+	if (ImGui::Checkbox("Sort hits by material", &render_settings.wavefront_material_sort))
+		m_render_window->set_render_dirty(true);
+	ImGuiRenderer::show_help_marker("If checked, the hits of the wavefront path tracer are sorted by material before "
+		"shading (from the second bounce on) so that the threads of a warp evaluate the same BSDF. "
+		"The cost of the sort can be found in the performance metrics.");
+
+	if (ImGui::Checkbox("Sort rays by origin and direction", &render_settings.wavefront_ray_sort))
+		m_render_window->set_render_dirty(true);
+	ImGuiRenderer::show_help_marker("If checked, the rays of the wavefront path tracer are sorted by direction octant "
+		"and by the position of their origin in the scene (from the second bounce on) before being traced so that the "
+		"threads of a warp traverse the same parts of the BVH.\n\n"
+		"This mostly helps with the incoherent rays of diffuse bounces. Compare the time of the sort with the time "
+		"saved by the \"Wavefront Extend\" kernel in the performance metrics to know if it pays off in a given scene.");
+
+	static bool deferred_materials = WavefrontDeferredMaterials;
+	if (ImGui::Checkbox("Deferred materials", &deferred_materials))
+	{
+		m_renderer->get_global_compiler_options()->set_macro_value(GPUKernelCompilerOptions::WAVEFRONT_DEFERRED_MATERIALS, deferred_materials ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+		m_renderer->recompile_kernels();
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the queues of the wavefront path tracer only store the material index "
+		"and the texture coordinates of the hits and the shade kernel evaluates the textures of the materials. "
+		"Less VRAM and memory traffic than storing the whole material of the hits but more texture fetches in the shade kernel. "
+		"Compare the \"Wavefront Extend\" and \"Wavefront Shade\" times of the performance metrics.");
+	ImGui::TreePop();
+	ImGui::EndDisabled();
+
+	static bool g_buffer_tiled_layout = GBufferTiledLayout;
+	if (ImGui::Checkbox("Tiled G-buffer layout", &g_buffer_tiled_layout))
+	{
+		m_renderer->get_global_compiler_options()->set_macro_value(GPUKernelCompilerOptions::GBUFFER_TILED_LAYOUT, g_buffer_tiled_layout ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+
+		m_renderer->recompile_kernels();
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the G-buffer stores the pixels by 8x8 tiles (the thread blocks of the kernels) "
+		"instead of row by row so that a block of threads reads contiguous memory. "
+		"The framebuffer and the other buffers read by the display and the denoiser stay row-major.");
+
+	const char* bvh_quality_items[] = { "- Fast build", "- Balanced", "- High quality" };
+	int bvh_build_quality = m_renderer->get_bvh_build_quality();
+	if (ImGui::Combo("BVH build quality", &bvh_build_quality, bvh_quality_items, IM_ARRAYSIZE(bvh_quality_items)))
+	{
+		m_renderer->set_bvh_build_quality(static_cast<BVHBuildQuality>(bvh_build_quality));
+		m_renderer->rebuild_bvh();
+
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("Trade-off between the time it takes to build the BVH of the scene and the "
+		"ray tracing performance. Changing the quality rebuilds the BVH. Build time and memory "
+		"can be found in the performance metrics.");
+
+	ImGui::BeginDisabled(!m_renderer->has_geometry_lods());
+	bool geometry_lod = m_renderer->get_geometry_lod();
+	if (ImGui::Checkbox("Geometry LODs", &geometry_lod))
+	{
+		m_renderer->set_geometry_lod(geometry_lod);
+
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the rays are traced against coarser versions of the large meshes "
+		"where the difference isn't visible: the distant instances and the secondary bounces. "
+		"The levels of detail are generated when the scene is parsed with the --geometry-lod commandline argument.");
+	if (geometry_lod)
+	{
+		ImGui::TreePush("Geometry LODs tree");
+
+		if (ImGui::SliderFloat("Max error (pixels)", &m_renderer->get_geometry_lod_pixel_error(), 0.1f, 16.0f, "%.1f", ImGuiSliderFlags_Logarithmic))
+			m_render_window->set_render_dirty(true);
+		ImGuiRenderer::show_help_marker("Each instance is seen by the primary rays with its coarsest level of detail "
+			"whose error projected on the screen is below this many pixels.");
+		if (ImGui::SliderFloat("Secondary rays error factor", &m_renderer->get_geometry_lod_secondary_error_factor(), 1.0f, 64.0f, "%.1f", ImGuiSliderFlags_Logarithmic))
+			m_render_window->set_render_dirty(true);
+		ImGuiRenderer::show_help_marker("The secondary rays accept this many times the error of the primary rays.");
+		if (ImGui::InputInt("First secondary bounce", &render_settings.geometry_lod_secondary_bounce))
+		{
+			render_settings.geometry_lod_secondary_bounce = std::max(0, render_settings.geometry_lod_secondary_bounce);
+
+			m_render_window->set_render_dirty(true);
+		}
+		ImGuiRenderer::show_help_marker("The rays of this bounce and of the next ones are the secondary rays. "
+			"0 for tracing the camera rays with the secondary levels of detail too.");
+
+		ImGui::TreePop();
+	}
+	ImGui::EndDisabled();
+
 	ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
 	ImGui::SeparatorText("Kernel Settings");
@@ -1809,7 +3021,9 @@ void ImGuiSettingsWindow::draw_performance_settings_panel()
 
 	{
 		// List of exceptions because these kernels do not trace any rays
-		static std::unordered_set<std::string> exceptions = { ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID };
+		static std::unordered_set<std::string> exceptions = { ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_ACCUMULATE_KERNEL_ID,
+			WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_HISTOGRAM_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_SCAN_KERNEL_ID,
+			WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_SCATTER_KERNEL_ID, WavefrontPathTracingRenderPass::WAVEFRONT_RAY_SORT_HISTOGRAM_KERNEL_ID };
 		static std::vector<std::string> kernel_names;
 		static std::map<std::string, GPUKernel*> kernels = m_renderer->get_kernels();
 		if (kernel_names.empty())
@@ -1900,6 +3114,31 @@ void ImGuiSettingsWindow::draw_performance_settings_panel()
 					}
 					ImGui::TreePop();
 				}
+
+				static std::unordered_map<std::string, int> pending_shadow_rays_stack_size_changes;
+				if (pending_shadow_rays_stack_size_changes.find(selected_kernel_name) == pending_shadow_rays_stack_size_changes.end())
+					pending_shadow_rays_stack_size_changes[selected_kernel_name] = selected_kernel_options->get_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS);
+				int& pending_shadow_rays_stack_size = pending_shadow_rays_stack_size_changes[selected_kernel_name];
+
+				if (ImGui::InputInt("Shadow rays shared stack size", &pending_shadow_rays_stack_size))
+					pending_shadow_rays_stack_size = std::max(-1, pending_shadow_rays_stack_size);
+
+				ImGuiRenderer::show_help_marker("Size of the shared memory stack of the BVH traversal of the shadow rays of this kernel.\n\n"
+					"Shadow rays stop at the first opaque hit (any-hit traversal) and usually need a smaller stack "
+					"than the closest hit traversals.\n\n"
+					"-1 to use the same size as the \"Shared stack size\" above.");
+
+				if (pending_shadow_rays_stack_size != selected_kernel_options->get_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS))
+				{
+					ImGui::TreePush("Apply button shadow rays shared stack size");
+					if (ImGui::Button("Apply##shadow_rays_stack_size"))
+					{
+						selected_kernel_options->set_macro_value(GPUKernelCompilerOptions::SHARED_STACK_BVH_TRAVERSAL_SIZE_SHADOW_RAYS, pending_shadow_rays_stack_size);
+						m_renderer->recompile_kernels();
+						m_render_window->set_render_dirty(true);
+					}
+					ImGui::TreePop();
+				}
 			}
 		}
 
@@ -1921,8 +3160,20 @@ void ImGuiSettingsWindow::draw_performance_settings_panel()
 			"means that the BVH traversal is starting to suffer (the traversal is incomplete --> improved performance) "
 			"and rendering artifacts will start to show up.");
 
+		bool dynamic_bvh_traversal_stack = global_kernel_options->get_macro_value(GPUKernelCompilerOptions::DYNAMIC_BVH_TRAVERSAL_STACK) == KERNEL_OPTION_TRUE;
+		if (ImGui::Checkbox("Dynamic global stack", &dynamic_bvh_traversal_stack))
+		{
+			global_kernel_options->set_macro_value(GPUKernelCompilerOptions::DYNAMIC_BVH_TRAVERSAL_STACK, dynamic_bvh_traversal_stack ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+			m_renderer->recompile_kernels();
+			m_render_window->set_render_dirty(true);
+		}
+		ImGuiRenderer::show_help_marker("If checked, the global stack buffer only has as many stacks as there can be threads resident "
+			"on the GPU at the same time instead of one stack per pixel. The warps acquire a free stack when they start "
+			"traversing the BVH and release it when they're done.\n\n"
+			"This uses much less VRAM at high resolutions but acquiring and releasing the stacks costs a few atomic operations per traversal.");
+
 		std::string size_string = "Global Stack Buffer VRAM Usage: ";
-		size_string += std::to_string(m_renderer->get_render_data().global_traversal_stack_buffer_size * std::ceil(m_renderer->m_render_resolution.x / 8.0f) * 8.0f * std::ceil(m_renderer->m_render_resolution.y / 8.0f) * 8.0f * sizeof(int) / 1000000.0f);
+		size_string += std::to_string(m_renderer->get_render_data().global_traversal_stack_buffer_size * static_cast<float>(m_renderer->get_global_stack_buffer_stack_count()) * sizeof(int) / 1000000.0f);
 		size_string += " MB";
 		ImGui::Text("%s", size_string.c_str());
 
@@ -1961,6 +3212,23 @@ void ImGuiSettingsWindow::draw_performance_metrics_panel()
 
 	ImGui::Text("Device: %s", m_renderer->get_device_properties().name);
 	ImGui::Dummy(ImVec2(0.0f, 20.0f));
+	if (!g_trace_recorder.is_recording())
+	{
+		if (ImGui::Button("Record trace"))
+			g_trace_recorder.start();
+	}
+	else if (ImGui::Button("Stop & write trace"))
+	{
+		const std::string& trace_file_path = m_application_settings->trace_file_path;
+		if (g_trace_recorder.stop_and_write(trace_file_path))
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Trace written to %s", trace_file_path.c_str());
+		else
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the trace to %s", trace_file_path.c_str());
+	}
+	ImGuiRenderer::show_help_marker("Records a timeline of the tasks of the CPU threads and of the GPU passes, written as a Chrome trace "
+		"JSON file (" + m_application_settings->trace_file_path + ") that can be opened in chrome://tracing or ui.perfetto.dev.\n\n"
+		"The GPU passes are added to the trace a few frames after they ran, the first pass of the recording waits for the GPU once.");
+	ImGui::Dummy(ImVec2(0.0f, 20.0f));
 	if (ImGui::Button("Apply benchmark settings"))
 	{
 		render_settings.freeze_random = true;
@@ -1992,6 +3260,8 @@ void ImGuiSettingsWindow::draw_performance_metrics_panel()
 			draw_perf_metric_specific_panel(m_render_window_perf_metrics, ReSTIRDIRenderPass::RESTIR_DI_LIGHTS_PRESAMPLING_KERNEL_ID, "ReSTIR Light Presampling");
 
 		draw_perf_metric_specific_panel(m_render_window_perf_metrics, ReSTIRDIRenderPass::RESTIR_DI_INITIAL_CANDIDATES_KERNEL_ID, "ReSTIR Initial Candidates");
+		if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::RESTIR_DI_BATCHED_VISIBILITY_RAYS) == KERNEL_OPTION_TRUE)
+			draw_perf_metric_specific_panel(m_render_window_perf_metrics, ReSTIRDIRenderPass::RESTIR_DI_VISIBILITY_RAYS_KERNEL_ID, "ReSTIR Visibility Rays");
 
 		if (render_settings.restir_di_settings.do_fused_spatiotemporal)
 		{
@@ -2013,10 +3283,128 @@ void ImGuiSettingsWindow::draw_performance_metrics_panel()
 				}
 		}
 	}
-	draw_perf_metric_specific_panel(m_render_window_perf_metrics, GPURenderer::PATH_TRACING_KERNEL_ID, "Path Tracing Pass");
+	if (render_settings.use_wavefront_path_tracing)
+	{
+		if (render_settings.wavefront_ray_sort)
+			draw_perf_metric_specific_panel(m_render_window_perf_metrics, WavefrontPathTracingRenderPass::WAVEFRONT_RAY_SORT_TIME_KEY, "Wavefront Ray Sort");
+		draw_perf_metric_specific_panel(m_render_window_perf_metrics, WavefrontPathTracingRenderPass::WAVEFRONT_EXTEND_KERNEL_ID, "Wavefront Extend");
+		if (render_settings.wavefront_material_sort)
+			draw_perf_metric_specific_panel(m_render_window_perf_metrics, WavefrontPathTracingRenderPass::WAVEFRONT_MATERIAL_SORT_TIME_KEY, "Wavefront Material Sort");
+		draw_perf_metric_specific_panel(m_render_window_perf_metrics, WavefrontPathTracingRenderPass::WAVEFRONT_SHADE_KERNEL_ID, "Wavefront Shade");
+		draw_perf_metric_specific_panel(m_render_window_perf_metrics, WavefrontPathTracingRenderPass::WAVEFRONT_SHADOW_RAYS_KERNEL_ID, "Wavefront Shadow Rays");
+		draw_perf_metric_specific_panel(m_render_window_perf_metrics, WavefrontPathTracingRenderPass::WAVEFRONT_ACCUMULATE_KERNEL_ID, "Wavefront Accumulate");
+	}
+	else
+	{
+		draw_perf_metric_specific_panel(m_render_window_perf_metrics, GPURenderer::PATH_TRACING_KERNEL_ID, "Path Tracing Pass");
+
+		if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_RESTIR_GI)
+		{
+			if (render_settings.restir_gi_settings.temporal_pass.do_temporal_reuse_pass)
+				draw_perf_metric_specific_panel(m_render_window_perf_metrics, ReSTIRGIRenderPass::RESTIR_GI_TEMPORAL_REUSE_KERNEL_ID, "ReSTIR GI Temporal Reuse");
+			if (render_settings.restir_gi_settings.spatial_pass.do_spatial_reuse_pass)
+				draw_perf_metric_specific_panel(m_render_window_perf_metrics, ReSTIRGIRenderPass::RESTIR_GI_SPATIAL_REUSE_KERNEL_ID, "ReSTIR GI Spatial Reuse");
+			draw_perf_metric_specific_panel(m_render_window_perf_metrics, ReSTIRGIRenderPass::RESTIR_GI_SHADING_KERNEL_ID, "ReSTIR GI Shading");
+		}
+		else if (m_renderer->get_global_compiler_options()->get_macro_value(GPUKernelCompilerOptions::INDIRECT_LIGHT_SAMPLING_STRATEGY) == ILS_PATH_GUIDING)
+		{
+			// The training itself is done by the path tracing pass, only the build of the distributions is separate
+			draw_perf_metric_specific_panel(m_render_window_perf_metrics, PathGuidingRenderPass::PATH_GUIDING_BUILD_KERNEL_ID, "Path Guiding Build");
+			ImGui::Text("Path guiding grid: %.2fMB, %d / %d training samples", PathGuidingRenderPass::get_grid_byte_size(render_settings.path_guiding_settings.grid_resolution) / 1000000.0f,
+				std::min(m_renderer->get_path_guiding_render_pass().get_trained_sample_count(), render_settings.path_guiding_settings.training_sample_count), render_settings.path_guiding_settings.training_sample_count);
+		}
+		if (render_settings.radiance_cache_settings.use_radiance_cache)
+			draw_perf_metric_specific_panel(m_render_window_perf_metrics, RadianceCacheRenderPass::RADIANCE_CACHE_RESOLVE_KERNEL_ID, "Radiance Cache Resolve");
+	}
 	ImGui::Separator();
 	draw_perf_metric_specific_panel(m_render_window_perf_metrics, GPURenderer::FULL_FRAME_TIME_KEY, "Total Sample Time");
 
+	ImGui::Dummy(ImVec2(0.0f, 20.0f));
+	ImGui::SeparatorText("Ray statistics");
+	ImGui::Text("%.2f samples/s", m_render_window->get_samples_per_second());
+	ImGui::Checkbox("Count rays", &render_settings.count_ray_statistics);
+	ImGuiRenderer::show_help_marker("Counts the rays traced by all the samples of each frame to compute the number of rays "
+		"traced per second. The counters are atomics aggregated per warp, this slightly slows the render down.\n\n"
+		"The number of BVH nodes visited isn't available, HIPRT doesn't expose it.");
+	const std::vector<unsigned int>& ray_statistics = m_renderer->get_status_buffer_values().ray_statistics;
+	if (render_settings.count_ray_statistics && ray_statistics.size() == RAY_STATISTIC_COUNT)
+	{
+		ImGui::TreePush("Ray statistics tree");
+
+		static const char* ray_statistic_names[RAY_STATISTIC_COUNT] = { "Camera rays", "Indirect rays", "Shadow rays", "Alpha tests", "Nested dielectrics skips", "RIS light candidates", "Visibility cache skipped shadow rays" };
+		float frame_time_s = m_render_window_perf_metrics->get_current_value(GPURenderer::FULL_FRAME_TIME_KEY) / 1000.0f;
+
+		unsigned int total_ray_count = 0;
+		for (int statistic = 0; statistic < RAY_STATISTIC_COUNT; statistic++)
+		{
+			if (statistic <= RAY_STATISTIC_SHADOW_RAYS)
+				total_ray_count += ray_statistics[statistic];
+
+			float per_second = frame_time_s > 0.0f ? ray_statistics[statistic] / frame_time_s : 0.0f;
+			ImGui::Text("%s: %u - %.2fM/s", ray_statistic_names[statistic], ray_statistics[statistic], per_second / 1.0e6f);
+		}
+		ImGui::Text("Total rays: %u - %.2fMrays/s", total_ray_count, frame_time_s > 0.0f ? total_ray_count / frame_time_s / 1.0e6f : 0.0f);
+		ImGuiRenderer::show_help_marker("Camera + indirect + shadow rays of the last frame. The nested dielectrics skips "
+			"re-trace the ray from the boundary skipped and aren't counted in the rays.");
+
+		ImGui::TreePop();
+	}
+
+	ImGui::Dummy(ImVec2(0.0f, 20.0f));
+	if (ImGui::CollapsingHeader("Kernel resources"))
+	{
+		ImGui::TreePush("Kernel resources tree");
+
+		for (auto& id_to_kernel : m_renderer->get_kernels())
+		{
+			if (id_to_kernel.second->get_kernel_function() == nullptr)
+				// Not compiled, the pass isn't used
+				continue;
+
+			KernelResourceUsage usage = KernelResourceReport::get_resource_usage(*id_to_kernel.second, m_renderer->get_device_properties());
+			ImGui::Text("%s: %d reg, %dB shared, %dB local, %.0f%% occupancy", id_to_kernel.first.c_str(), usage.registers, usage.shared_bytes, usage.local_bytes, usage.theoretical_occupancy * 100.0f);
+		}
+		ImGuiRenderer::show_help_marker("Registers per thread, shared memory per block and local memory per thread (mostly "
+			"registers spilled by the compiler) of the compiled kernels.\n\n"
+			"The occupancy is the theoretical fraction of the maximum threads of a multiprocessor "
+			"that can be resident at the same time with these resources, for the block size that the kernels are compiled for.");
+
+		ImGui::TreePop();
+	}
+
+	ImGui::Dummy(ImVec2(0.0f, 20.0f));
+	ImGui::SeparatorText("Scene BVH");
+	ImGui::Text("Last BVH build time: %.3fms", m_render_window_perf_metrics->get_current_value(GPURenderer::BVH_BUILD_TIME_KEY));
+	ImGui::Text("BVH memory: %.2fMB", m_render_window_perf_metrics->get_current_value(GPURenderer::BVH_MEMORY_KEY));
+
+	ImGui::Dummy(ImVec2(0.0f, 20.0f));
+	ImGui::SeparatorText("VRAM usage");
+	size_t pooled_byte_size;
+	std::map<std::string, size_t> vram_usage = OrochiDeviceMemoryPool::get_usage(pooled_byte_size);
+	for (const auto& category_and_byte_size : vram_usage)
+		ImGui::Text("%s: %.2fMB", category_and_byte_size.first.c_str(), category_and_byte_size.second / 1000000.0f);
+	ImGui::Text("Pooled (unused): %.2fMB", pooled_byte_size / 1000000.0f);
+	ImGui::Text("Saved by aliasing transient buffers: %.2fMB", m_renderer->get_render_graph().get_aliasing_saved_byte_size() / 1000000.0f);
+	ImGuiRenderer::show_help_marker("The buffers of the render passes whose content doesn't need to survive the frame "
+		"(the initial candidates of ReSTIR, the queues of the wavefront path tracer, ...) share the same memory "
+		"when they are not used during the same steps of the frame. This is how much memory that saves.");
+
+	size_t total_vram_usage = pooled_byte_size;
+	for (const auto& category_and_byte_size : vram_usage)
+		total_vram_usage += category_and_byte_size.second;
+	size_t device_total_memory = m_renderer->get_device_properties().totalGlobalMem;
+	ImGui::Text("Total: %.2fMB / %.2fMB", total_vram_usage / 1000000.0f, device_total_memory / 1000000.0f);
+	if (total_vram_usage > device_total_memory * OrochiDeviceMemoryPool::BUDGET_WARNING_THRESHOLD)
+		ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Warning: more than %d%% of the device memory is used", static_cast<int>(OrochiDeviceMemoryPool::BUDGET_WARNING_THRESHOLD * 100.0f));
+
+	if (ImGui::Button("Free pooled memory"))
+		OrochiDeviceMemoryPool::trim();
+	ImGuiRenderer::show_help_marker("Buffers that are freed give their memory back to a pool so that "
+		"it can be reused when they are reallocated (when resizing the viewport for example). "
+		"This frees that unused memory.\n\n"
+		"The OpenGL interop buffers, the traversal stacks of HIPRT and the internal memory of the "
+		"denoiser filters are not included in this breakdown.");
+
 	ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
 	ImGui::TreePop();
@@ -2105,14 +3493,31 @@ std::string ImGuiSettingsWindow::format_perf_metrics_tooltip_line(const std::str
 }
 
 extern bool g_background_shader_compilation_enabled;
+extern bool g_background_shader_compilation_cancel_unused;
 void ImGuiSettingsWindow::draw_debug_panel()
 {
 	if (!ImGui::CollapsingHeader("Debug"))
 		return;
 
+	std::shared_ptr<GPUKernelCompilerOptions> global_kernel_options = m_renderer->get_global_compiler_options();
+
+	bool kernel_diagnostics = global_kernel_options->get_macro_value(GPUKernelCompilerOptions::KERNEL_DIAGNOSTICS) == KERNEL_OPTION_TRUE;
+	if (ImGui::Checkbox("Kernel diagnostics", &kernel_diagnostics))
+	{
+		global_kernel_options->set_macro_value(GPUKernelCompilerOptions::KERNEL_DIAGNOSTICS, kernel_diagnostics ? KERNEL_OPTION_TRUE : KERNEL_OPTION_FALSE);
+		m_renderer->recompile_kernels();
+		m_render_window->set_render_dirty(true);
+	}
+	ImGuiRenderer::show_help_marker("If checked, the kernels are compiled with their sanity checks and debug code paths "
+		"(NaNs display, logging of the invalid samples on the CPU, ReSTIR DI neighbor reuse positions debugging).\n\n"
+		"Unchecked, these are compiled out of the kernels and the invalid samples are only discarded.");
+
+	ImGui::BeginDisabled(!kernel_diagnostics);
 	if (ImGui::Checkbox("Show NaNs", &m_renderer->get_render_settings().display_NaNs))
 		m_render_window->set_render_dirty(true);
-	ImGuiRenderer::show_help_marker("If true, NaNs that occur during the rendering will show up as pink pixels.");
+	ImGuiRenderer::show_help_marker("If true, NaNs that occur during the rendering will show up as pink pixels.\n\n"
+		"Requires the kernel diagnostics.");
+	ImGui::EndDisabled();
 
 	ImGui::Dummy(ImVec2(0.0f, 20.0f));
 	std::string background_shader_compilation_button_string;
@@ -2129,6 +3534,27 @@ void ImGuiSettingsWindow::draw_debug_panel()
 			m_renderer->resume_background_shader_compilation();
 	}
 	ImGuiRenderer::show_help_marker("Click to " + (g_background_shader_compilation_enabled ? std::string("stop") : std::string("resume")) + " background shaders precompilation");
+	if (!g_background_shader_compilation_cancel_unused)
+	{
+		if (ImGui::Button("Cancel unused shaders precompilation"))
+			m_renderer->cancel_unused_background_shader_compilation();
+		ImGuiRenderer::show_help_marker("The background precompilation compiles the option combinations that you switched to the most often first "
+			"(the history is kept in \"shader_cache_usage.txt\"). Click to skip the combinations that you never switched to.");
+	}
+
+	bool runtime_kernel_options = m_renderer->get_runtime_kernel_options_enabled();
+	if (ImGui::Checkbox("Toggle options without recompiling", &runtime_kernel_options))
+		m_renderer->set_runtime_kernel_options_enabled(runtime_kernel_options);
+	ImGuiRenderer::show_help_marker("If checked, \"Do MIS with BSDF\" (envmap) and \"Do visibility reuse\" (ReSTIR DI) "
+		"switch immediately to kernels that read them at runtime while the kernels specialized for the new values "
+		"are compiled in the background. The specialized kernels are swapped in when they are ready.");
+
+	bool kernel_hot_reload = m_renderer->get_kernel_hot_reload_enabled();
+	if (ImGui::Checkbox("Hot reload modified kernels", &kernel_hot_reload))
+		m_renderer->set_kernel_hot_reload_enabled(kernel_hot_reload);
+	ImGuiRenderer::show_help_marker("If checked, the kernels whose sources (or includes) are modified on the disk "
+		"are recompiled in the background and swapped in when they're ready. The previous version of the kernels "
+		"keeps rendering until then.");
 
 	if (ImGui::Button("Force shaders reload"))
 	{
@@ -2136,9 +3562,42 @@ void ImGuiSettingsWindow::draw_debug_panel()
 		m_render_window->set_render_dirty(true);
 	}
 	if (ImGui::Button("Clear shader cache"))
-		std::filesystem::remove_all("shader_cache");
+		g_gpu_kernel_compiler.get_shader_cache().clear();
 	ImGuiRenderer::show_help_marker("Completely clears the shader cache on the disk.");
 
+	if (ImGui::CollapsingHeader("Shader cache statistics"))
+	{
+		ImGui::TreePush("Shader cache statistics tree");
+
+		ShaderCacheManager& shader_cache = g_gpu_kernel_compiler.get_shader_cache();
+		ShaderCacheStatistics statistics = shader_cache.get_statistics();
+
+		int compilation_count = statistics.hit_count + statistics.miss_count;
+		ImGui::Text("Hit rate: %.1f%% (%d / %d compilations, %d from the shared cache)", compilation_count == 0 ? 0.0f : 100.0f * statistics.hit_count / compilation_count, statistics.hit_count, compilation_count, statistics.shared_hit_count);
+		ImGui::Text("Size: %.1fMB in %d files", statistics.size_bytes / (1024.0f * 1024.0f), statistics.file_count);
+		ImGui::Text("Evicted files: %d", statistics.evicted_file_count);
+		if (!shader_cache.get_shared_directory().empty())
+			ImGui::Text("Shared cache: %s", shader_cache.get_shared_directory().c_str());
+
+		static int size_limit_mb = static_cast<int>(shader_cache.get_size_limit() / (1024 * 1024));
+		if (ImGui::InputInt("Size limit (MB)", &size_limit_mb, 256, 1024, ImGuiInputTextFlags_EnterReturnsTrue))
+		{
+			size_limit_mb = std::max(0, size_limit_mb);
+			shader_cache.set_size_limit(static_cast<std::uint64_t>(size_limit_mb) * 1024 * 1024);
+		}
+		ImGuiRenderer::show_help_marker("The least recently used files of the shader cache are evicted when its size is above "
+			"that limit. 0 for no limit.");
+
+		ImGui::Text("Entries per kernel:");
+		ImGui::TreePush("Entries per kernel tree");
+		for (auto& kernel_to_count : statistics.entries_per_kernel)
+			ImGui::Text("%s: %d", kernel_to_count.first.c_str(), kernel_to_count.second);
+		ImGui::TreePop();
+
+		// Shader cache statistics tree
+		ImGui::TreePop();
+	}
+
 	static GPUKernelCompiler::ShaderCacheUsageOverride shader_cache_use_override = g_gpu_kernel_compiler.get_shader_cache_usage_override();
 	std::vector<const char*> shader_cache_override_values = { "No override", "Do not use shader cache", "Always use shader cache" };
 	if (ImGui::Combo("Shader cache use override", (int*)&shader_cache_use_override, shader_cache_override_values.data(), shader_cache_override_values.size()))
@@ -8,6 +8,8 @@
 #include <cmath>
 #include <iostream>
 
+const std::string PerformanceMetricsComputer::COMBINED_SAMPLES_PER_SECOND_KEY = "CombinedSamplesPerSecond";
+
 float PerformanceMetricsComputer::data_getter(void* data, int index)
 {
 	return static_cast<double*>(data)[index];
@@ -101,6 +103,18 @@ void PerformanceMetricsComputer::add_value(const std::string& key, double new_va
 	multiset.insert(new_value);
 }
 
+void PerformanceMetricsComputer::add_combined_samples_per_second(const std::vector<int>& samples_per_device, double elapsed_seconds)
+{
+	if (elapsed_seconds <= 0.0)
+		return;
+
+	int total_samples = 0;
+	for (int device_samples : samples_per_device)
+		total_samples += device_samples;
+
+	add_value(COMBINED_SAMPLES_PER_SECOND_KEY, total_samples / elapsed_seconds);
+}
+
 double PerformanceMetricsComputer::get_current_value(const std::string& key)
 {
 	if (m_values_count[key] == 0)
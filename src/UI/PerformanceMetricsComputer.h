@@ -14,6 +14,10 @@
 class PerformanceMetricsComputer
 {
 public:
+	// Key of the total samples per second of several devices rendering
+	// the same frame in parallel, see add_combined_samples_per_second()
+	static const std::string COMBINED_SAMPLES_PER_SECOND_KEY;
+
 	static float data_getter(void* data, int index);
 
 	void init_key(const std::string& key);
@@ -22,6 +26,11 @@ public:
 	int get_data_index(const std::string& key);
 
 	void add_value(const std::string& key, double value);
+	/**
+	 * Adds a value to the COMBINED_SAMPLES_PER_SECOND_KEY key. 'samples_per_device[i]'
+	 * is the number of samples rendered by the device i in the last 'elapsed_seconds'
+	 */
+	void add_combined_samples_per_second(const std::vector<int>& samples_per_device, double elapsed_seconds);
 
 	double get_current_value(const std::string& key);
 	double get_average(const std::string& key);
@@ -53,7 +53,6 @@ extern ImGuiLogger g_imgui_logger;
 // - we don't need the full HitInfo 'closest_hit_info' structure everywhere, only the inter point and the two normals for the most part so maybe have a simplified structure 
 // - only the material index can be stored in the pixel states of the wavefront path tracer, don't need to store the whole material (is that correct though? Because then we need to re-evaluate the textures at the hit point)
 // - use 3x3 matrix for envmap matrices
-// - free denoiser buffers if not using denoising
 // - refactor ImGuiRenderer in several sub classes that each draw a panel
 // - refactor closestHitTypes with something like 'hiprtGeomTraversalClosestHitType<UseSharedStackBVHTraversal>' to avoid the big #if #elif blocks
 // glViewport() to avoid managing the resolution scaling in the display shaders ourselves?
@@ -61,9 +60,7 @@ extern ImGuiLogger g_imgui_logger;
 
 
 // TODO Features:
-// - try dynamic stack for better memory usage than full brute force global stack buffer and see performance impact
 // - better disney sheen lobe as in Blender --> Practical Multiple-Scattering Sheen Using Linearly Transformed Cosines
-// - use shared memory for nested dielectrics stack?
 // - opacity micromaps
 // - use anyhits for shadow rays
 // - cache opacity of materials textures? --> analyze the texture when loading it from the texture and if there isn't a single transparent pixel, then we know that we won't have to fetch the material / texture in the alpha test filter function because the alpha is going to be 1.0f anyways
@@ -75,10 +72,7 @@ extern ImGuiLogger g_imgui_logger;
 // - reload shaders button
 // - pack ray payload
 // - pack HDR as color as 9/9/9/5 RGBE? https://github.com/microsoft/DirectX-Graphics-Samples/blob/master/MiniEngine/Core/Shaders/PixelPacking_RGBE.hlsli
-// - presample lights per each tile of pixels the same as for ReSTIR DI and use that for second bounces sampling?
 // - next event estimation++?
-// - Exploiting Visibility Correlation in Direct Illumination
-// - Progressive Visibility Caching for Fast Indirect Illumination
 // - performance/bias tradeoff by ignoring alpha tests (either for global rays or only shadow rays) after N bounce?
 // - performance/bias tradeoff by ignoring direct lighting occlusion after N bounce? --> strong bias but maybe something to do by reducing the length of shadow rays instead of just hard-disabling occlusion
 // - experiment with a feature that ignores really dark pixel in the variance estimation of the adaptive 
@@ -86,8 +80,6 @@ extern ImGuiLogger g_imgui_logger;
 //		noisy / very high variance and they take a very long time to converge (always red on the heatmap) 
 //		even though they are very dark regions and we don't even noise in them. If our eyes can't see 
 //		the noise, why bother? Same with very bright regions
-// - maybe not precompute stuff in the material structure? like anisotropic / oren nayar parameters? Is it even expensive to recompute it? Because that takes space and bandwidth
-// - pack material parameters that are between 0 and 1 into 8 bits, 1/256 is enough precision for parameters in 0-1
 // - Reuse MIS BSDF sample as path next bounce if the ray didn't hit anything
 // - RIS: do no use BSDF samples for rough surfaces (have a BSDF ray roughness treshold basically
 //		We may have to do something with the lobes of the BSDF specifically for this one. A coated diffuse cannot always ignore light samples for example because the diffuse lobe benefits from light samples even if the surface is not smooth (coating) 
@@ -123,10 +115,7 @@ extern ImGuiLogger g_imgui_logger;
 // - Cool colored thread-safe logger singleton class --> loguru lib
 // - portal envmap sampling --> choose portals with ImGui
 // - recursive trace through transmissive / reflective materials for caustics
-// - find a way to not fill the texcoords buffer for meshes that don't have textures
-// - pack RendererMaterial informations such as texture indices (we can probably use 16 bit for a texture index --> 2 texture indices in one 32 bit register)
 // - use 8 bit textures for material properties instead of float
-// - use fixed point 8 bit for materials parameters in [0, 1], should be good enough
 // - log size of buffers used: vertices, indices, normals, ...
 // - log memory size of buffers used: vertices, indices, normals, ...
 // - able / disable normal mapping
@@ -152,19 +141,12 @@ extern ImGuiLogger g_imgui_logger;
 // - image comparator slider (to have adaptive sampling view + default view on the same viewport for example)
 // - Maybe look at better Disney sampling (luminance?)
 // - thin materials
-// - Have the UI run at its own framerate to avoid having the UI come to a crawl when the path tracing is expensive
-// - When modifying the emission of a material with the material editor, it should be reflected in the scene and allow the direct sampling of the geometry so the emissive triangles buffer should be updated
 // - Ray differentials for texture mipampping (better bandwidth utilization since sampling potentially smaller texture --> fit better in cache)
 // - Ray reordering for performance
 // - Starting rays further away from the camera for performance
 // - Visualizing ray depth (only 1 frame otherwise it would flicker a lot [or choose the option to have it flicker] )
-// - Visualizing pixel time with the clock() instruction. Pixel heatmap:
-//		- https://developer.nvidia.com/blog/profiling-dxr-shaders-with-timer-instrumentation/
-//		- https://github.com/libigl/libigl/issues/1388
-//		- https://github.com/libigl/libigl/issues/1534
 // - Visualizing russian roulette depth termination
 // - Add tooltips when hovering over a parameter in the UI
-// - Statistics on russian roulette efficiency
 // - feature to disable ReSTIR after a certain percentage of convergence --> we don't want to pay the full price of resampling and everything only for a few difficult isolated pixels (especially true with adaptive sampling where neighbors don't get sampled --> no new samples added to their reservoir --> no need to resample)
 // - Better ray origin offset to avoid self intersections --> Use ray TMin
 // - Realistic Camera Model
@@ -172,8 +154,6 @@ extern ImGuiLogger g_imgui_logger;
 // - Flakes BRDF (maybe look at OSPRay implementation for a reference ?)
 // - ImGuizmo for moving objects in the scene
 // - Paths roughness regularization
-// - choose denoiser quality in imgui
-// - try async buffer copy for the denoiser (maybe run a kernel to generate normals and another to generate albedo buffer before the path tracing kernel to be able to async copy while the path tracing kernel is running?)
 // - write scene details to imgui (nb vertices, triangles, ...)
 // - ImGui to choose the BVH flags at runtime and be able to compare the performance
 // - ImGui widgets for SBVH / LBVH
@@ -294,12 +274,14 @@ RenderWindow::RenderWindow(int renderer_width, int renderer_height, std::shared_
 	m_application_settings->auto_sample_per_frame = m_renderer->get_render_settings().accumulate ? m_application_settings->auto_sample_per_frame : false;
 	m_application_state = std::make_shared<ApplicationState>();
 
-	ThreadManager::start_thread(ThreadManager::RENDER_WINDOW_CONSTRUCTOR, [this, renderer_width, renderer_height]() {
+	ThreadManager::start_thread(ThreadManager::RENDER_WINDOW_CONSTRUCTOR, [this, renderer_width, renderer_height, hiprt_oro_ctx]() {
 		m_denoiser = std::make_shared<OpenImageDenoiser>();
-		m_denoiser->initialize();
+		m_denoiser->initialize(hiprt_oro_ctx->device_index);
 		m_denoiser->resize(renderer_width, renderer_height);
 		m_denoiser->set_use_albedo(m_application_settings->denoiser_use_albedo);
 		m_denoiser->set_use_normals(m_application_settings->denoiser_use_normals);
+		m_denoiser->set_quality(m_application_settings->denoiser_quality);
+		m_denoiser->set_max_memory_MB(m_application_settings->denoiser_max_memory_MB);
 		m_denoiser->finalize();
 
 		m_perf_metrics = std::make_shared<PerformanceMetricsComputer>();
@@ -597,6 +579,10 @@ bool RenderWindow::is_rendering_done()
 void RenderWindow::reset_render()
 {
 	m_application_settings->last_denoised_sample_count = -1;
+	// The frames being denoised are those of the previous render
+	m_application_settings->denoised_frame_available = false;
+	m_denoiser->discard_pending_results();
+	m_denoiser->invalidate_prefiltered_aovs();
 
 	m_application_state->current_render_time_ms = 0.0f;
 	m_application_state->render_dirty = false;
@@ -621,16 +607,14 @@ float RenderWindow::get_samples_per_second()
 
 float RenderWindow::compute_samples_per_second()
 {
-	float samples_per_frame = m_renderer->get_render_settings().do_render_low_resolution() ? 1.0f : m_renderer->get_render_settings().samples_per_frame;
-
-	// Frame time divided by the number of samples per frame
-	// 1 sample per frame assumed if rendering at low resolution
-	if (m_application_state->last_GPU_submit_time > 0)
+	// Samples rendered since the render was last presented divided
+	// by the time elapsed since then
+	if (m_application_state->last_present_time > 0)
 	{
 		uint64_t current_time = glfwGetTimerValue();
-		float difference_ms = (current_time - m_application_state->last_GPU_submit_time) / static_cast<float>(glfwGetTimerFrequency()) * 1000.0f;
+		float difference_ms = (current_time - m_application_state->last_present_time) / static_cast<float>(glfwGetTimerFrequency()) * 1000.0f;
 
-		return 1000.0f / (difference_ms / samples_per_frame);
+		return 1000.0f / (difference_ms / m_application_state->samples_since_last_present);
 	}
 	else
 		return 0.0f;
@@ -681,27 +665,50 @@ std::shared_ptr<ImGuiRenderer> RenderWindow::get_imgui_renderer()
 
 void RenderWindow::run()
 {
-	HIPRTRenderSettings& render_settings = m_renderer->get_render_settings();
-
 	uint64_t time_frequency = glfwGetTimerFrequency();
 	uint64_t frame_start_time = 0;
+
+	// The frames are submitted to the GPU by a thread of their own, the main
+	// thread only presents them so that the UI doesn't wait for the GPU
+	m_stop_render_submission = false;
+	ThreadManager::start_dedicated_thread(ThreadManager::RENDER_WINDOW_RENDER_SUBMISSION, [this]() {
+		render_submission_loop();
+	});
+
 	while (!glfwWindowShouldClose(m_glfw_window))
 	{
 		frame_start_time = glfwGetTimerValue();
 
-		glfwPollEvents();
-		glClear(GL_COLOR_BUFFER_BIT);
-
-		m_application_state->render_dirty |= is_interacting();
-		m_application_state->render_dirty |= m_application_state->interacting_last_frame != is_interacting();
-
-		render();
-		m_display_view_system->display();
-		
-		m_imgui_renderer->draw_interface();
+		{
+			// The renderer and the settings are shared with the render submission
+			// thread. It submits frames while this thread waits for the swap
+			std::lock_guard<std::mutex> lock(m_render_mutex);
+
+			glfwPollEvents();
+			glClear(GL_COLOR_BUFFER_BIT);
+
+			m_application_state->render_dirty |= is_interacting();
+			m_application_state->render_dirty |= m_application_state->interacting_last_frame != is_interacting();
+			// Parts of the scene still loading may have been brought in
+			m_application_state->render_dirty |= m_renderer->update_progressive_loading();
+			// Scene loaded in the background with GPURenderer::load_scene_async()
+			m_application_state->render_dirty |= m_renderer->update_pending_scene();
+			// Kernels recompiled in the background for their modified sources
+			m_application_state->render_dirty |= m_renderer->update_kernel_hot_reload();
+
+			render();
+			m_display_view_system->display();
+
+			m_imgui_renderer->draw_interface();
+			// Writes the screenshots taken in the previous frames whose readback completed
+			m_screenshoter->update();
+		}
+		m_render_submission_condition.notify_one();
 
 		glfwSwapBuffers(m_glfw_window);
 
+		std::lock_guard<std::mutex> lock(m_render_mutex);
+
 		float delta_time_ms = (glfwGetTimerValue() - frame_start_time) / static_cast<float>(time_frequency) * 1000.0f;
 		m_application_state->last_delta_time_ms = delta_time_ms;
 
@@ -709,6 +716,66 @@ void RenderWindow::run()
 			m_application_state->current_render_time_ms += delta_time_ms;
 		m_keyboard_interactor.poll_keyboard_inputs();
 	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_render_mutex);
+
+		m_stop_render_submission = true;
+	}
+	m_render_submission_condition.notify_one();
+	ThreadManager::join_threads(ThreadManager::RENDER_WINDOW_RENDER_SUBMISSION);
+}
+
+void RenderWindow::render_submission_loop()
+{
+	std::unique_lock<std::mutex> lock(m_render_mutex);
+	while (!m_stop_render_submission)
+	{
+		if (!can_submit_frame())
+		{
+			// Checking again once the main thread is done with its frame or,
+			// at the latest, shortly after in case the GPU is done with a frame
+			m_render_submission_condition.wait_for(lock, std::chrono::milliseconds(1));
+
+			continue;
+		}
+
+		m_renderer->update();
+		m_renderer->render();
+
+		// Only one sample per frame is assumed if rendering at low resolution
+		HIPRTRenderSettings& render_settings = m_renderer->get_render_settings();
+		m_application_state->samples_since_last_present += render_settings.do_render_low_resolution() ? 1 : render_settings.samples_per_frame;
+		m_frames_to_present = true;
+	}
+}
+
+bool RenderWindow::can_submit_frame()
+{
+	if (m_render_submission_paused || m_application_state->render_dirty || is_rendering_done())
+		// Waiting for the main thread to present the frames or to reset the render
+		return false;
+
+	if (m_application_settings->GPU_stall_percentage > 0.0f)
+	{
+		// The GPU idles after each frame so the frames are rendered one at a time
+		if (m_renderer->get_queued_frame_count() > 0)
+			return false;
+
+		uint64_t current_time = glfwGetTimerValue();
+		if (m_application_state->GPU_stall_start_time == 0)
+			m_application_state->GPU_stall_start_time = current_time;
+
+		float stall_duration_ms = (current_time - m_application_state->GPU_stall_start_time) / static_cast<float>(glfwGetTimerFrequency()) * 1000.0f;
+		if (stall_duration_ms < compute_GPU_stall_duration())
+			return false;
+
+		m_application_state->GPU_stall_start_time = 0;
+
+		return true;
+	}
+
+	return m_renderer->get_queued_frame_count() < m_application_settings->render_queue_depth;
 }
 
 void RenderWindow::render()
@@ -719,105 +786,233 @@ void RenderWindow::render()
 	// the frame result to OpenGL for displaying
 	static bool buffer_upload_necessary = true;
 
-	if (m_renderer->frame_render_done())
+	bool present_due;
+	if (m_application_settings->display_refresh_sample_interval > 0)
+		present_due = m_application_state->samples_since_last_present >= m_application_settings->display_refresh_sample_interval;
+	else
 	{
-		// ------
-		// Everything that is in there is synchronous with the renderer
-		// ------
-		m_renderer->copy_status_buffers();
+		uint64_t current_time = glfwGetTimerValue();
+		float time_since_present_ms = (current_time - m_application_state->last_present_time) / static_cast<float>(glfwGetTimerFrequency()) * 1000.0f;
 
-		if (m_application_state->GPU_stall_duration_left > 0 && !is_rendering_done())
-		{
-			// If we're stalling the GPU.
-			// We're whether or not the rendering is done because we don't need to
-			// stall the GPU if the rendering is done
+		present_due = time_since_present_ms >= 1000.0f / m_application_settings->target_present_framerate;
+	}
+	// The frames of the render not presented yet don't touch the buffers shared with OpenGL
+	// which are only unmapped / uploaded to the display textures / mapped again when presenting
+	present_due &= m_frames_to_present;
 
-			if (m_application_state->GPU_stall_duration_left > 0.0f)
-				// Updating the duration left to stall the GPU.
-				m_application_state->GPU_stall_duration_left -= m_application_state->last_delta_time_ms;
-		}
-		else if (!is_rendering_done() || m_application_state->render_dirty)
-		{
-			//// We can unmap the renderer's buffers so that OpenGL can use them for displaying
-			m_renderer->unmap_buffers();
+	if (m_application_state->render_dirty || present_due)
+		// No new frames are submitted so that the GPU completes the frames it
+		// has queued. They are presented by one of the next calls
+		m_render_submission_paused = true;
 
-			// Update the display view system so that the display view is changed to the
-			// one that we want to use (in the DisplayViewSystem's queue)
-			m_display_view_system->update_selected_display_view();
-			
-			// Denoising to fill the buffers with denoised data (if denoising is enabled)
-			denoise();
+	if (!m_renderer->frame_render_done())
+		// The viewport keeps displaying the last presented frame in the meantime
+		return;
 
-			//// We upload the data to the OpenGL textures for displaying
-			m_display_view_system->upload_relevant_buffers_to_texture();
+	// ------
+	// Everything that is in there is synchronous with the renderer
+	// ------
+	m_renderer->copy_status_buffers();
 
-			// We want the next frame to be displayed with the same 'wants_render_low_resolution' setting
-			// as it was queued with. This is only useful for first frames when getting in low resolution
-			// (when we start moving the camera for example) or first frames when getting out of low resolution
-			// (when we stop moving the camera). In such situations, the last kernel launch in the GPU queue is
-			// a "first frame" that was queued with the corresponding wants_render_low_resolution (getting in or out of low resolution).
-			// and so we want to display it the same way.
-			m_display_view_system->set_render_low_resolution(m_renderer->was_last_frame_low_resolution());
-			// Updating the uniforms so that next time we display, we display correctly
-			m_display_view_system->update_current_display_program_uniforms();
-
-			// We got a frame rendered --> We can compute the samples per second
+	if (m_application_state->render_dirty || (m_frames_to_present && (m_render_submission_paused || is_rendering_done())))
+	{
+		//// We can unmap the renderer's buffers so that OpenGL can use them for displaying
+		m_renderer->unmap_buffers();
+
+		// Update the display view system so that the display view is changed to the
+		// one that we want to use (in the DisplayViewSystem's queue)
+		m_display_view_system->update_selected_display_view();
+			
+		// Denoising to fill the buffers with denoised data (if denoising is enabled)
+		denoise();
+
+		//// We upload the data to the OpenGL textures for displaying
+		m_display_view_system->upload_relevant_buffers_to_texture();
+
+		// We want the next frame to be displayed with the same 'wants_render_low_resolution' setting
+		// as it was queued with. This is only useful for first frames when getting in low resolution
+		// (when we start moving the camera for example) or first frames when getting out of low resolution
+		// (when we stop moving the camera). In such situations, the last kernel launch in the GPU queue is
+		// a "first frame" that was queued with the corresponding wants_render_low_resolution (getting in or out of low resolution).
+		// and so we want to display it the same way.
+		m_display_view_system->set_render_low_resolution(m_renderer->was_last_frame_low_resolution());
+		m_display_view_system->set_render_upscaled(m_renderer->was_last_frame_upscaled());
+		m_display_view_system->set_render_low_resolution_scaling(m_renderer->get_last_frame_low_resolution_scaling());
+		// Updating the uniforms so that next time we display, we display correctly
+		m_display_view_system->update_current_display_program_uniforms();
+
+		if (m_frames_to_present)
+		{
+			// We got frames rendered --> We can compute the samples per second
 			m_application_state->samples_per_second = compute_samples_per_second();
 
 			// Adding the time for *one* sample to the performance metrics counter
 			if (!m_renderer->was_last_frame_low_resolution() && m_application_state->samples_per_second > 0.0f)
 				update_perf_metrics();
+		}
 
-			render_settings.wants_render_low_resolution = is_interacting();
-			if (m_application_settings->auto_sample_per_frame && (render_settings.do_render_low_resolution() || m_renderer->was_last_frame_low_resolution()) && render_settings.accumulate)
-				// Only one sample when low resolution rendering.
-				// Also, we only want to apply this if we're accumulating. If we're not accumulating, 
-				// (so we the renderer in "interactive mode" we may want more than 1 sample per frame
-				// to experiment
-				render_settings.samples_per_frame = 1;
-			else if (m_application_settings->auto_sample_per_frame)
-				render_settings.samples_per_frame = std::min(std::max(1, static_cast<int>(m_application_state->samples_per_second / m_application_settings->target_GPU_framerate)), 65536);
-
-			m_application_state->interacting_last_frame = is_interacting();
-			m_application_state->GPU_stall_duration_left = compute_GPU_stall_duration();
-			if (m_application_state->render_dirty)
-				reset_render();
-			
-			// Otherwise, if we're not stalling, queuing a new frame for the GPU to render
-			m_application_state->last_GPU_submit_time = glfwGetTimerValue();
-			m_renderer->update();
-			m_renderer->render();
+		render_settings.wants_render_low_resolution = is_interacting();
+		// The perceptual adaptive sampling evaluates the noise as displayed
+		render_settings.adaptive_sampling_perceptual_gamma = m_application_settings->tone_mapping_gamma;
+		render_settings.adaptive_sampling_perceptual_exposure = m_application_settings->tone_mapping_exposure;
+		update_region_of_interest();
+		update_dynamic_resolution_scaling();
+		if (m_application_settings->auto_sample_per_frame && (render_settings.do_render_low_resolution() || m_renderer->was_last_frame_low_resolution()) && render_settings.accumulate)
+			// Only one sample when low resolution rendering.
+			// Also, we only want to apply this if we're accumulating. If we're not accumulating, 
+			// (so we the renderer in "interactive mode" we may want more than 1 sample per frame
+			// to experiment
+			render_settings.samples_per_frame = 1;
+		else if (m_application_settings->auto_sample_per_frame && m_frames_to_present)
+			render_settings.samples_per_frame = std::min(std::max(1, static_cast<int>(m_application_state->samples_per_second / m_application_settings->target_GPU_framerate)), 65536);
+
+		m_application_state->interacting_last_frame = is_interacting();
+		if (m_application_state->render_dirty)
+			reset_render();
+
+		// The buffers shared with OpenGL are (re)allocated by update() when the settings change, which
+		// always goes through here: updating on the main thread, which has the OpenGL context, so that
+		// the submission thread only renders. The buffers are then mapped for the next frames
+		m_renderer->update();
+		m_renderer->map_buffers_for_render();
+
+		m_application_state->last_present_time = glfwGetTimerValue();
+		m_application_state->samples_since_last_present = 0;
+		m_frames_to_present = false;
+		// The submission thread can queue the next frames
+		m_render_submission_paused = false;
+
+		buffer_upload_necessary = true;
+	}
+	else if (is_rendering_done())
+	{
+		// The rendering is done
 
-			buffer_upload_necessary = true;
-		}
-		else
+		// The buffers may still be mapped if the render got done without a new frame
+		// (max render time reached for example)
+		m_renderer->unmap_buffers();
+
+		buffer_upload_necessary |= m_display_view_system->update_selected_display_view();
+
+		if (m_application_settings->enable_denoising)
+			// We may still want to denoise on the final frame
+			if (denoise())
+				buffer_upload_necessary = true;
+
+		if (buffer_upload_necessary)
 		{
-			// The rendering is done
+			// Re-uploading only if necessary
+			m_display_view_system->upload_relevant_buffers_to_texture();
 
-			buffer_upload_necessary |= m_display_view_system->update_selected_display_view();
+			buffer_upload_necessary = false;
+		}
 
-			if (m_application_settings->enable_denoising)
-				// We may still want to denoise on the final frame
-				if (denoise())
-					buffer_upload_necessary = true;
+		m_display_view_system->set_render_low_resolution(m_renderer->was_last_frame_low_resolution());
+		m_display_view_system->set_render_upscaled(m_renderer->was_last_frame_upscaled());
+		m_display_view_system->set_render_low_resolution_scaling(m_renderer->get_last_frame_low_resolution_scaling());
+		// Updating the uniforms if the user touches the post processing parameters
+		// or something else (denoiser blend, ...)
+		m_display_view_system->update_current_display_program_uniforms();
 
-			if (buffer_upload_necessary)
-			{
-				// Re-uploading only if necessary
-				m_display_view_system->upload_relevant_buffers_to_texture();
+		// Sleeping so that we don't burn the CPU and GPU
+		std::this_thread::sleep_for(std::chrono::milliseconds(3));
+	}
+}
 
-				buffer_upload_necessary = false;
-			}
+void RenderWindow::update_region_of_interest()
+{
+	HIPRTRenderSettings& render_settings = m_renderer->get_render_settings();
+	if (!render_settings.enable_region_of_interest || !m_application_settings->region_of_interest_follow_cursor)
+		return;
+
+	ImVec2 mouse_position = m_imgui_renderer->get_imgui_render_window().get_mouse_position_in_image();
+	if (mouse_position.x < 0.0f || mouse_position.y < 0.0f)
+		// Keeping the last region of interest when the mouse leaves the viewport
+		return;
+
+	// From viewport pixels to render pixels
+	float resolution_scale = m_application_settings->render_resolution_scale;
+	int center_x = static_cast<int>(mouse_position.x * resolution_scale);
+	int center_y = static_cast<int>(mouse_position.y * resolution_scale);
+	int half_size = static_cast<int>(m_application_settings->region_of_interest_cursor_size * resolution_scale * 0.5f);
+
+	render_settings.region_of_interest_min = make_int2(std::max(0, center_x - half_size), std::max(0, center_y - half_size));
+	render_settings.region_of_interest_max = make_int2(std::min(m_renderer->m_render_resolution.x, center_x + half_size), std::min(m_renderer->m_render_resolution.y, center_y + half_size));
+}
+
+void RenderWindow::update_dynamic_resolution_scaling()
+{
+	static constexpr int MAX_LOW_RESOLUTION_SCALING = 8;
+	// Margins around the target frame time so that the controller doesn't oscillate
+	static constexpr float TOO_SLOW_FACTOR = 1.1f;
+	static constexpr float FAST_ENOUGH_FACTOR = 0.9f;
+
+	HIPRTRenderSettings& render_settings = m_renderer->get_render_settings();
+	if (!m_application_settings->dynamic_resolution_scaling || !render_settings.allow_render_low_resolution || !render_settings.accumulate)
+		return;
+
+	if (!is_interacting() || !m_renderer->was_last_frame_low_resolution())
+		// Full resolution when not interacting, the downscale found is kept
+		// as the starting point of the next interaction
+		return;
 
-			m_display_view_system->set_render_low_resolution(m_renderer->was_last_frame_low_resolution());
-			// Updating the uniforms if the user touches the post processing parameters
-			// or something else (denoiser blend, ...)
-			m_display_view_system->update_current_display_program_uniforms();
+	if (m_application_state->dynamic_resolution_cooldown > 0)
+	{
+		m_application_state->dynamic_resolution_cooldown--;
 
-			// Sleeping so that we don't burn the CPU and GPU
-			std::this_thread::sleep_for(std::chrono::milliseconds(3));
+		return;
+	}
+
+	// Doesn't wait for the GPU, these are the times of the last frame that completed
+	m_renderer->compute_render_pass_times();
+	float frame_time = m_renderer->get_last_frame_time();
+	if (frame_time <= 0.0f)
+		return;
+
+	float target_frame_time = m_application_settings->dynamic_resolution_target_frame_time;
+	int& scaling = render_settings.render_low_resolution_scaling;
+	int max_bounces = std::max(1, std::min(m_application_settings->dynamic_resolution_max_bounces, render_settings.nb_bounces));
+	int bounces = std::min(render_settings.render_low_resolution_max_bounces, max_bounces);
+
+	bool adjusted = false;
+	if (frame_time > target_frame_time * TOO_SLOW_FACTOR)
+	{
+		// Too slow: reducing the resolution first and the number of bounces once the resolution is at its lowest
+		if (scaling < MAX_LOW_RESOLUTION_SCALING)
+		{
+			scaling++;
+			adjusted = true;
+		}
+		else if (bounces > 1)
+		{
+			render_settings.render_low_resolution_max_bounces = bounces - 1;
+			adjusted = true;
 		}
 	}
+	else
+	{
+		// Going back up in the reverse order, only if the frame time predicted for the next
+		// step is under the target. The cost of the frame is proportional to the number of
+		// pixels and roughly to the number of bounces
+		if (bounces < max_bounces && frame_time * (bounces + 1) / bounces < target_frame_time * FAST_ENOUGH_FACTOR)
+		{
+			render_settings.render_low_resolution_max_bounces = bounces + 1;
+			adjusted = true;
+		}
+		else if (bounces >= max_bounces && scaling > 1)
+		{
+			float pixel_count_ratio = (scaling * scaling) / static_cast<float>((scaling - 1) * (scaling - 1));
+			if (frame_time * pixel_count_ratio < target_frame_time * FAST_ENOUGH_FACTOR)
+			{
+				scaling--;
+				adjusted = true;
+			}
+		}
+	}
+
+	if (adjusted)
+		// The frames already queued were rendered with the previous settings
+		m_application_state->dynamic_resolution_cooldown = m_application_settings->render_queue_depth + 1;
 }
 
 void RenderWindow::update_perf_metrics()
@@ -837,6 +1032,12 @@ bool RenderWindow::denoise()
 
 	if (m_application_settings->enable_denoising)
 	{
+		// The frames are denoised asynchronously while the next frames are rendered.
+		// Displaying the last frame that is done being denoised
+		bool denoised_frame_published = m_denoiser->publish_denoised(m_renderer->get_denoised_framebuffer());
+		m_application_settings->denoised_frame_available |= denoised_frame_published;
+		m_application_settings->last_denoised_duration = m_denoiser->get_last_denoise_duration() * 1000.0f;
+
 		// Evaluating all the conditions for whether or not we want to denoise
 		// the current color framebuffer and whether or not we want to display
 		// the denoised framebuffer to the viewport (we may want NOT to display
@@ -890,7 +1091,10 @@ bool RenderWindow::denoise()
 		display_noisy |= !rendering_done && denoise_when_done;
 		display_noisy |= !sample_skip_threshold_reached && m_application_settings->last_denoised_sample_count == -1 && !rendering_done;
 		display_noisy |= is_interacting();
+		//	- No frame of this render is done being denoised yet
+		display_noisy |= !m_application_settings->denoised_frame_available;
 
+		bool denoising_queued = false;
 		if (need_denoising)
 		{
 			std::shared_ptr<OpenGLInteropBuffer<float3>> normals_buffer = nullptr;
@@ -902,14 +1106,15 @@ bool RenderWindow::denoise()
 			if (m_application_settings->denoiser_use_albedo)
 				albedo_buffer = m_renderer->get_denoiser_albedo_AOV_buffer();
 
-			auto start = std::chrono::high_resolution_clock::now();
-			m_denoiser->denoise(m_renderer->get_color_framebuffer(), normals_buffer, albedo_buffer);
-			auto stop = std::chrono::high_resolution_clock::now();
-
-			m_denoiser->copy_denoised_data_to_buffer(m_renderer->get_denoised_framebuffer());
+			// The AOVs barely change after a while, their prefiltered snapshot is kept from then on
+			int AOV_converged_sample_count = m_application_settings->denoiser_AOV_converged_sample_count;
+			bool AOVs_converged = AOV_converged_sample_count > 0 && render_settings.denoiser_AOV_accumulation_counter >= AOV_converged_sample_count;
 
-			m_application_settings->last_denoised_duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-			m_application_settings->last_denoised_sample_count = render_settings.sample_number;
+			// Snapshot taken on the main stream before the next frame is queued.
+			// If the denoiser is still busy with the previous frames, trying again next frame
+			denoising_queued = m_denoiser->denoise(m_renderer->get_color_framebuffer(), m_renderer->get_main_stream(), normals_buffer, albedo_buffer, AOVs_converged);
+			if (denoising_queued)
+				m_application_settings->last_denoised_sample_count = render_settings.sample_number;
 		}
 
 		if (display_noisy)
@@ -917,10 +1122,14 @@ bool RenderWindow::denoise()
 			// choose the first view out of the two that are going to be blend (and the first view is the noisy view)
 			m_application_settings->blend_override = 0.0f;
 
-		m_application_settings->denoiser_settings_changed = false;
+		if (!need_denoising || denoising_queued)
+			m_application_settings->denoiser_settings_changed = false;
 
-		return need_denoising && !display_noisy;
+		return denoised_frame_published && !display_noisy;
 	}
+	else
+		// Not keeping the buffers of the denoiser around while it isn't used
+		m_denoiser->release_buffers();
 
 	return false;
 }
@@ -24,6 +24,9 @@
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
 
+#include <condition_variable>
+#include <mutex>
+
 class RenderWindow
 {
 public:
@@ -79,7 +82,9 @@ public:
 	float get_samples_per_second();
 	/**
 	 * Computes the number of samples per second as seen from the render window. "As seen by the render window"
-	 * means that the GPU stall percentage is taken into account for example
+	 * means that the GPU stall percentage is taken into account for example.
+	 * 
+	 * Computed over the frames rendered since the render was last presented
 	 */
 	float compute_samples_per_second();
 	/**
@@ -92,8 +97,27 @@ public:
 	 */
 	float get_UI_delta_time();
 
+	/**
+	 * Starts the render submission thread and runs the UI until the window is closed
+	 */
 	void run();
+	/**
+	 * Presents the latest frame rendered if the target present framerate allows it
+	 * (or if the render needs to be reset). Doesn't wait for the GPU: the frames queued
+	 * by the render submission thread are presented by a later call if they aren't done yet
+	 */
 	void render();
+	/**
+	 * Moves the region of interest of the renderer under the mouse if the region
+	 * of interest is enabled and follows the cursor
+	 */
+	void update_region_of_interest();
+	/**
+	 * Adjusts the downscale and the number of bounces of the low resolution rendering
+	 * if the dynamic resolution scaling is enabled and the user is interacting,
+	 * see ApplicationSettings::dynamic_resolution_scaling
+	 */
+	void update_dynamic_resolution_scaling();
 	void update_perf_metrics();
 	/**
 	 * Denoises the color framebuffer if necessary (according to ImGui
@@ -121,8 +145,28 @@ public:
 	}
 
 private:
+	/**
+	 * Loop of the render submission thread: keeps application_settings.render_queue_depth
+	 * frames queued on the GPU until the main thread pauses the submissions to present
+	 */
+	void render_submission_loop();
+	/**
+	 * Returns true if the render submission thread can queue a new frame
+	 */
+	bool can_submit_frame();
+
 	int m_viewport_width, m_viewport_height;
 
+	// Held by the main thread for everything but the buffer swap and by the
+	// render submission thread while it submits a frame
+	std::mutex m_render_mutex;
+	std::condition_variable m_render_submission_condition;
+	// Set by the main thread when it waits for the queued frames to present them
+	bool m_render_submission_paused = true;
+	// Whether or not frames were submitted since the last present
+	bool m_frames_to_present = false;
+	bool m_stop_render_submission = false;
+
 
 	// All the settings of the application (that can, for the most part, be controlled
 	// through ImGui)
@@ -5,11 +5,14 @@
 
 #include "GL/glew.h"
 #include "stb_image_write.h"
+#include "Threads/ThreadManager.h"
 #include "UI/ImGui/ImGuiLogger.h"
 #include "UI/RenderWindow.h"
 #include "UI/Screenshoter.h"
 #include "Utils/Utils.h"
 
+#include <cstring>
+
 extern ImGuiLogger g_imgui_logger;
 
 Screenshoter::Screenshoter()
@@ -21,12 +24,14 @@ Screenshoter::Screenshoter()
 	OpenGLShader normal_display_shader = OpenGLShader(GLSL_SHADERS_DIRECTORY "/normal_display.frag", OpenGLShader::COMPUTE_SHADER, macro);
 	OpenGLShader albedo_display_shader = OpenGLShader(GLSL_SHADERS_DIRECTORY "/albedo_display.frag", OpenGLShader::COMPUTE_SHADER, macro);
 	OpenGLShader adaptive_display_shader = OpenGLShader(GLSL_SHADERS_DIRECTORY "/heatmap_int.frag", OpenGLShader::COMPUTE_SHADER, macro);
+	OpenGLShader pixel_cost_display_shader = OpenGLShader(GLSL_SHADERS_DIRECTORY "/heatmap_pixel_cost.frag", OpenGLShader::COMPUTE_SHADER, macro);
 
 	std::shared_ptr<OpenGLProgram> default_display_program = std::make_shared<OpenGLProgram>();
 	std::shared_ptr<OpenGLProgram> blend_2_display_program = std::make_shared<OpenGLProgram>();
 	std::shared_ptr<OpenGLProgram> normal_display_program = std::make_shared<OpenGLProgram>();
 	std::shared_ptr<OpenGLProgram> albedo_display_program = std::make_shared<OpenGLProgram>();
 	std::shared_ptr<OpenGLProgram> pixel_convergence_heatmap_display_program = std::make_shared<OpenGLProgram>();
+	std::shared_ptr<OpenGLProgram> pixel_cost_heatmap_display_program = std::make_shared<OpenGLProgram>();
 
 	default_display_program->attach(default_display_shader);
 	default_display_program->link();
@@ -43,6 +48,9 @@ Screenshoter::Screenshoter()
 	pixel_convergence_heatmap_display_program->attach(adaptive_display_shader);
 	pixel_convergence_heatmap_display_program->link();
 
+	pixel_cost_heatmap_display_program->attach(pixel_cost_display_shader);
+	pixel_cost_heatmap_display_program->link();
+
 	m_compute_programs[DisplayViewType::DEFAULT] = default_display_program;
 	m_compute_programs[DisplayViewType::DENOISED_BLEND] = blend_2_display_program;
 	m_compute_programs[DisplayViewType::DISPLAY_ALBEDO] = albedo_display_program;
@@ -50,10 +58,17 @@ Screenshoter::Screenshoter()
 	m_compute_programs[DisplayViewType::DISPLAY_NORMALS] = normal_display_program;
 	m_compute_programs[DisplayViewType::DISPLAY_DENOISED_NORMALS] = normal_display_program;
 	m_compute_programs[DisplayViewType::PIXEL_CONVERGENCE_HEATMAP] = pixel_convergence_heatmap_display_program;
+	m_compute_programs[DisplayViewType::PIXEL_COST_HEATMAP] = pixel_cost_heatmap_display_program;
 
 	select_compute_program(DisplayViewType::DEFAULT);
 }
 
+Screenshoter::~Screenshoter()
+{
+	// Not losing the screenshots that were just taken when the application closes
+	wait_for_pending_screenshots();
+}
+
 void Screenshoter::set_renderer(std::shared_ptr<GPURenderer> renderer)
 {
 	m_renderer = renderer;
@@ -70,14 +85,24 @@ void Screenshoter::select_compute_program(DisplayViewType display_view)
 }
 
 void Screenshoter::write_to_png()
+{
+	write_to_png(generate_filename(".png").c_str());
+}
+
+void Screenshoter::write_to_exr()
+{
+	write_to_exr(generate_filename(".exr").c_str());
+}
+
+std::string Screenshoter::generate_filename(const char* extension)
 {
 	std::stringstream filename;
 	std::time_t t = std::time(0);
 	std::tm* now = std::localtime(&t);
 
-	filename << std::put_time(now, "%m.%d.%Y.%H.%M.%S - ") << m_renderer->get_render_settings().sample_number << "sp @ " << m_renderer->m_render_resolution.x << "x" << m_renderer->m_render_resolution.y << " - " << m_render_window->get_current_render_time() / 1000.0f << "s" << ".png";
+	filename << std::put_time(now, "%m.%d.%Y.%H.%M.%S - ") << m_renderer->get_render_settings().sample_number << "sp @ " << m_renderer->m_render_resolution.x << "x" << m_renderer->m_render_resolution.y << " - " << m_render_window->get_current_render_time() / 1000.0f << "s" << extension;
 
-	write_to_png(filename.str().c_str());
+	return filename.str();
 }
 
 void Screenshoter::resize_output_image(int width, int height)
@@ -120,13 +145,10 @@ void Screenshoter::write_to_png(const char* filepath)
 		// Fast path when no resolution scaling, we can just dump the viewport to a file
 		// because the viewport is the same resolution as the render resolution so the viewport
 		// is exactly what we should have in the screenshot
-		std::vector<unsigned char> mapped_data(width * height * 3);
+		PendingReadback readback = begin_readback(filepath, width, height, 3);
 		glPixelStorei(GL_PACK_ALIGNMENT, 1);
-		glReadnPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, mapped_data.size(), mapped_data.data());
-
-		stbi_flip_vertically_on_write(true);
-		if (stbi_write_png(filepath, width, height, 3, mapped_data.data(), width * sizeof(unsigned char) * 3))
-			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Screenshot written to \"%s\"", filepath);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+		end_readback(readback);
 	}
 	else
 	{
@@ -147,7 +169,12 @@ void Screenshoter::write_to_png(const char* filepath)
 		m_renderer->unmap_buffers();
 
 		resize_output_image(width, height);
-		select_compute_program(m_render_window->get_display_view_system()->get_current_display_view_type());
+		std::shared_ptr<DisplayViewSystem> display_view_system = m_render_window->get_display_view_system();
+		if (display_view_system->uses_gpu_tonemapping())
+			// The display texture is already tonemapped, the albedo program only copies it
+			select_compute_program(DisplayViewType::DISPLAY_ALBEDO);
+		else
+			select_compute_program(display_view_system->get_current_display_view_type());
 
 		GLint threads[3];
 		m_active_compute_program->get_compute_threads(threads);
@@ -158,14 +185,147 @@ void Screenshoter::write_to_png(const char* filepath)
 		DisplayViewSystem::update_display_program_uniforms(m_render_window->get_display_view_system().get(), m_active_compute_program, m_renderer, m_render_window->get_application_settings());
 
 		glDispatchCompute(nb_groups_x, nb_groups_y, 1);
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		// The texture is read back through a pixel buffer
+		glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
 
-		std::vector<unsigned char> mapped_data(width * height * 4);
-		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, mapped_data.data());
+		PendingReadback readback = begin_readback(filepath, width, height, 4);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+		end_readback(readback);
+	}
+}
 
-		stbi_flip_vertically_on_write(true);
-		if (stbi_write_png(filepath, width, height, 4, mapped_data.data(), width * sizeof(unsigned char) * 4))
-			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Screenshot written to \"%s\"", filepath);
+void Screenshoter::write_to_exr(const char* filepath)
+{
+	std::shared_ptr<ApplicationSettings> application_settings = m_render_window->get_application_settings();
+	bool include_denoised = application_settings->enable_denoising && application_settings->denoised_frame_available;
+
+	PendingEXRExport exr_export;
+	exr_export.download = m_renderer->download_render_layers_async(include_denoised);
+	exr_export.options = application_settings->exr_write_options;
+	exr_export.filepath = filepath;
+
+	m_pending_exr_exports.push_back(exr_export);
+}
+
+void Screenshoter::update()
+{
+	// The readbacks complete in order so stopping at the first one that is still in flight
+	int completed_count = 0;
+	for (PendingReadback& readback : m_pending_readbacks)
+	{
+		GLenum wait_status = glClientWaitSync(readback.fence, 0, 0);
+		if (wait_status != GL_ALREADY_SIGNALED && wait_status != GL_CONDITION_SATISFIED)
+			break;
+
+		finish_readback(readback);
+		completed_count++;
 	}
+
+	m_pending_readbacks.erase(m_pending_readbacks.begin(), m_pending_readbacks.begin() + completed_count);
+
+	completed_count = 0;
+	for (PendingEXRExport& exr_export : m_pending_exr_exports)
+	{
+		if (!exr_export.download.is_done())
+			break;
+
+		finish_exr_export(exr_export);
+		completed_count++;
+	}
+
+	m_pending_exr_exports.erase(m_pending_exr_exports.begin(), m_pending_exr_exports.begin() + completed_count);
 }
 
+void Screenshoter::wait_for_pending_screenshots()
+{
+	for (PendingReadback& readback : m_pending_readbacks)
+	{
+		// 1 second timeout, in nanoseconds
+		if (glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Timed out waiting for the readback of the screenshot \"%s\", writing it anyway.", readback.filepath.c_str());
+
+		finish_readback(readback);
+	}
+
+	m_pending_readbacks.clear();
+
+	for (PendingEXRExport& exr_export : m_pending_exr_exports)
+	{
+		exr_export.download.wait();
+
+		finish_exr_export(exr_export);
+	}
+
+	m_pending_exr_exports.clear();
+}
+
+void Screenshoter::finish_exr_export(PendingEXRExport& exr_export)
+{
+	// The download holds the pinned memory of the layers until the thread is done with them
+	ThreadManager::start_thread(ThreadManager::SCREENSHOT_WRITE_THREAD_KEY, [](std::string filepath, RenderLayersDownload download, EXRWriteOptions options) {
+		if (write_image_exr(filepath.c_str(), download.width, download.height, download.get_exr_layers(), options))
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "EXR written to \"%s\"", filepath.c_str());
+		else
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the EXR \"%s\".", filepath.c_str());
+	}, exr_export.filepath, exr_export.download, exr_export.options);
+}
+
+Screenshoter::PendingReadback Screenshoter::begin_readback(const char* filepath, int width, int height, int channels)
+{
+	PendingReadback readback;
+	readback.width = width;
+	readback.height = height;
+	readback.channels = channels;
+	readback.filepath = filepath;
+
+	glGenBuffers(1, &readback.pixel_buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixel_buffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * channels, nullptr, GL_STREAM_READ);
+
+	return readback;
+}
+
+void Screenshoter::end_readback(PendingReadback& readback)
+{
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	// Making sure that the fence reaches the GPU, update() never flushes
+	glFlush();
+
+	m_pending_readbacks.push_back(readback);
+}
+
+void Screenshoter::finish_readback(PendingReadback& readback)
+{
+	size_t byte_size = static_cast<size_t>(readback.width) * readback.height * readback.channels;
+	std::shared_ptr<std::vector<unsigned char>> pixels = std::make_shared<std::vector<unsigned char>>(byte_size);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pixel_buffer);
+	void* mapped_data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, byte_size, GL_MAP_READ_BIT);
+	if (mapped_data != nullptr)
+	{
+		std::memcpy(pixels->data(), mapped_data, byte_size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	glDeleteBuffers(1, &readback.pixel_buffer);
+	glDeleteSync(readback.fence);
+
+	if (mapped_data == nullptr)
+	{
+		g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not read back the screenshot \"%s\".", readback.filepath.c_str());
+
+		return;
+	}
+
+	// The PNG encoding takes hundreds of milliseconds at high resolutions, not blocking the rendering for it
+	ThreadManager::start_thread(ThreadManager::SCREENSHOT_WRITE_THREAD_KEY, [](std::string filepath, int width, int height, int channels, std::shared_ptr<std::vector<unsigned char>> pixels) {
+		stbi_flip_vertically_on_write(true);
+		if (stbi_write_png(filepath.c_str(), width, height, channels, pixels->data(), width * sizeof(unsigned char) * channels))
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Screenshot written to \"%s\"", filepath.c_str());
+		else
+			g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the screenshot \"%s\".", filepath.c_str());
+	}, readback.filepath, readback.width, readback.height, readback.channels, pixels);
+}
@@ -10,7 +10,9 @@
 #include "OpenGL/OpenGLProgram.h"
 #include "Renderer/GPURenderer.h"
 
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 class RenderWindow;
 
@@ -18,6 +20,7 @@ class Screenshoter
 {
 public:
 	Screenshoter();
+	~Screenshoter();
 
 	void set_renderer(std::shared_ptr<GPURenderer> renderer);
 	void set_render_window(RenderWindow* render_window);
@@ -34,9 +37,87 @@ public:
 	 * for example
 	 */
 	void write_to_png();
+	/**
+	 * Queues the readback of the screenshot in a pixel buffer and returns without waiting for it.
+	 * The image is encoded and written to the disk on a thread of its own once the readback is
+	 * complete, see update()
+	 */
 	void write_to_png(const char* filepath);
 
+	/**
+	 * Same as write_to_png() but writes the linear render and its AOVs (albedo, normals,
+	 * sample count, denoised frame if available) to a multi-layer EXR file, without
+	 * the post-processing of the viewport. The filename is generated the same way
+	 */
+	void write_to_exr();
+	/**
+	 * Queues the download of the layers from the buffers of the renderer and returns without waiting
+	 * for it. The file is written on a thread of its own once the download is complete, see update()
+	 */
+	void write_to_exr(const char* filepath);
+
+	/**
+	 * Hands the screenshots and the EXR exports whose readback is complete to the threads that write them.
+	 * Must be called on the thread of the OpenGL context, once per frame
+	 */
+	void update();
+	/**
+	 * Same as update() but waits for the readbacks that are still in flight
+	 */
+	void wait_for_pending_screenshots();
+
 private:
+	/**
+	 * Readback of a screenshot from the GPU that hasn't been handed to a writing thread yet
+	 */
+	struct PendingReadback
+	{
+		GLuint pixel_buffer = 0;
+		// Signaled when the copy to 'pixel_buffer' is complete
+		GLsync fence = nullptr;
+
+		int width = 0;
+		int height = 0;
+		int channels = 0;
+		std::string filepath;
+	};
+
+	/**
+	 * EXR export whose download from the renderer hasn't been handed to a writing thread yet
+	 */
+	struct PendingEXRExport
+	{
+		RenderLayersDownload download;
+		EXRWriteOptions options;
+		std::string filepath;
+	};
+
+	/**
+	 * Starts the thread that writes a complete EXR export to the disk
+	 */
+	void finish_exr_export(PendingEXRExport& exr_export);
+
+	/**
+	 * Filename with a time stamp, the sample count and the render resolution, see write_to_png()
+	 */
+	std::string generate_filename(const char* extension);
+
+	/**
+	 * Creates the pixel buffer of a readback and binds it to GL_PIXEL_PACK_BUFFER
+	 * so that the next read of pixels is copied to it
+	 */
+	PendingReadback begin_readback(const char* filepath, int width, int height, int channels);
+	/**
+	 * Fences the readback and queues it
+	 */
+	void end_readback(PendingReadback& readback);
+	/**
+	 * Copies the pixels of a complete readback to the memory, frees its OpenGL objects and
+	 * starts the thread that writes it to the disk
+	 */
+	void finish_readback(PendingReadback& readback);
+
+
 	std::shared_ptr<GPURenderer> m_renderer = nullptr;
 	RenderWindow* m_render_window = nullptr;
 
@@ -52,6 +133,11 @@ private:
 	GLuint m_output_image = 0;
 	int m_compute_output_image_width = -1;
 	int m_compute_output_image_height = -1;
+
+	// Screenshots whose readback is still in flight, oldest first
+	std::vector<PendingReadback> m_pending_readbacks;
+	// EXR exports whose download is still in flight, oldest first
+	std::vector<PendingEXRExport> m_pending_exr_exports;
 };
 
 #endif
\ No newline at end of file
@@ -3,8 +3,21 @@
  * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
  */
 
+#include "Compiler/KernelBinaryBundle.h"
+#include "Compiler/KernelCompileFarm.h"
+#include "Compiler/KernelResourceReport.h"
+#include "Compiler/ShaderCacheManager.h"
+#include "Renderer/BSDFMicrobenchmark.h"
+#include "Renderer/DistributedRenderCoordinator.h"
+#include "Renderer/RayCastingBenchmark.h"
+#include "Renderer/RenderBenchmark.h"
+#include "Renderer/RenderServer.h"
+#include "Renderer/SequenceRenderer.h"
 #include "Utils/CommandlineArguments.h"
 
+#include <algorithm>
+#include <sstream>
+
 const std::string CommandlineArguments::DEFAULT_SCENE = "../data/GLTFs/the-white-room-low.gltf";
 const std::string CommandlineArguments::DEFAULT_SKYSPHERE = "../data/Skyspheres/evening_road_01_puresky_2k.hdr";
 
@@ -29,6 +42,179 @@ CommandlineArguments CommandlineArguments::process_command_line_args(int argc, c
             arguments.render_height = std::atoi(string_argv.substr(4).c_str());
         else if (string_argv.starts_with("--height="))
             arguments.render_height = std::atoi(string_argv.substr(9).c_str());
+        else if (string_argv.starts_with("--bvh-quality="))
+        {
+            std::string quality = string_argv.substr(14);
+            if (quality == "fast")
+                arguments.bvh_build_quality = 0;
+            else if (quality == "balanced")
+                arguments.bvh_build_quality = 1;
+            else if (quality == "high")
+                arguments.bvh_build_quality = 2;
+            else
+                std::cerr << "Unknown BVH build quality \"" << quality << "\". Expected fast, balanced or high. Using high." << std::endl;
+        }
+        else if (string_argv == "--half-texcoords")
+            arguments.half_precision_texcoords = true;
+        else if (string_argv == "--quantized-positions")
+            arguments.quantized_vertices_positions = true;
+        else if (string_argv == "--compact-bvh")
+            arguments.compact_bvh = true;
+        else if (string_argv == "--progressive-loading")
+            arguments.progressive_loading = true;
+        else if (string_argv == "--no-scene-cache")
+            arguments.use_scene_cache = false;
+        else if (string_argv == "--virtual-textures")
+            arguments.virtual_texturing = true;
+        else if (string_argv == "--reorder-triangles")
+            arguments.reorder_triangles = true;
+        else if (string_argv == "--geometry-lod")
+            arguments.geometry_lods = true;
+        else if (string_argv == "--linearize-srgb-textures")
+            arguments.linearize_srgb_textures = true;
+        else if (string_argv.starts_with("--envmap-portal="))
+        {
+            // Corner of the portal and its two edges: cx,cy,cz,ux,uy,uz,vx,vy,vz
+            std::vector<float> values;
+            std::stringstream values_stream(string_argv.substr(16));
+            std::string value;
+            while (std::getline(values_stream, value, ','))
+                values.push_back(static_cast<float>(std::atof(value.c_str())));
+
+            if (values.size() != 9)
+            {
+                std::cerr << "Invalid envmap portal \"" << string_argv.substr(16) << "\". Expected cx,cy,cz,ux,uy,uz,vx,vy,vz. Ignoring it." << std::endl;
+
+                continue;
+            }
+
+            EnvmapPortal portal;
+            portal.corner = make_float3(values[0], values[1], values[2]);
+            portal.edge_u = make_float3(values[3], values[4], values[5]);
+            portal.edge_v = make_float3(values[6], values[7], values[8]);
+
+            float3 normal = hippt::cross(portal.edge_u, portal.edge_v);
+            portal.area = hippt::length(normal);
+            if (portal.area == 0.0f)
+            {
+                std::cerr << "Envmap portal \"" << string_argv.substr(16) << "\" has no area. Ignoring it." << std::endl;
+
+                continue;
+            }
+            portal.normal = normal / portal.area;
+
+            arguments.envmap_portals.push_back(portal);
+        }
+        else if (string_argv == "--headless")
+            arguments.headless = true;
+        else if (string_argv.starts_with("--output="))
+            arguments.output_file_path = string_argv.substr(9);
+        else if (string_argv.starts_with("--timeout="))
+            arguments.timeout = static_cast<float>(std::atof(string_argv.substr(10).c_str()));
+        else if (string_argv.starts_with("--gpus="))
+        {
+            // Comma separated list of device indices
+            arguments.gpu_indices.clear();
+
+            std::stringstream indices_stream(string_argv.substr(7));
+            std::string index;
+            while (std::getline(indices_stream, index, ','))
+                arguments.gpu_indices.push_back(std::atoi(index.c_str()));
+
+            if (arguments.gpu_indices.empty())
+                arguments.gpu_indices.push_back(0);
+        }
+        else if (string_argv.starts_with("--multi-gpu-mode="))
+        {
+            std::string mode = string_argv.substr(17);
+            if (mode == "split-frame")
+                arguments.multi_gpu_mode = 0;
+            else if (mode == "sample-splitting")
+                arguments.multi_gpu_mode = 1;
+            else
+                std::cerr << "Unknown multi-GPU mode \"" << mode << "\". Expected split-frame or sample-splitting. Using split-frame." << std::endl;
+        }
+        else if (string_argv.starts_with("--reduce-interval="))
+            arguments.reduce_interval = static_cast<float>(std::atof(string_argv.substr(18).c_str()));
+        else if (string_argv.starts_with("--checkpoint="))
+            arguments.checkpoint_file_path = string_argv.substr(13);
+        else if (string_argv.starts_with("--checkpoint-interval="))
+            arguments.checkpoint_interval = static_cast<float>(std::atof(string_argv.substr(22).c_str()));
+        else if (string_argv.starts_with(SequenceRenderer::FRAMES_COMMANDLINE_ARGUMENT))
+            arguments.sequence_frames = std::max(0, std::atoi(string_argv.substr(SequenceRenderer::FRAMES_COMMANDLINE_ARGUMENT.length()).c_str()));
+        else if (string_argv.starts_with(SequenceRenderer::MODE_COMMANDLINE_ARGUMENT))
+        {
+            std::string mode = string_argv.substr(SequenceRenderer::MODE_COMMANDLINE_ARGUMENT.length());
+            if (mode == "orbit")
+                arguments.sequence_mode = SequenceRenderer::SEQUENCE_MODE_CAMERA_ORBIT;
+            else if (mode == "envmap")
+                arguments.sequence_mode = SequenceRenderer::SEQUENCE_MODE_ENVMAP_ROTATION;
+            else
+                std::cerr << "Unknown sequence mode \"" << mode << "\". Expected orbit or envmap. Using orbit." << std::endl;
+        }
+        else if (string_argv.starts_with(SequenceRenderer::SWEEP_COMMANDLINE_ARGUMENT))
+            arguments.sequence_sweep_degrees = static_cast<float>(std::atof(string_argv.substr(SequenceRenderer::SWEEP_COMMANDLINE_ARGUMENT.length()).c_str()));
+        else if (string_argv.starts_with(SequenceRenderer::OUTPUT_COMMANDLINE_ARGUMENT))
+            arguments.sequence_output_pattern = string_argv.substr(SequenceRenderer::OUTPUT_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(SequenceRenderer::NOISE_THRESHOLD_COMMANDLINE_ARGUMENT))
+            arguments.sequence_noise_threshold = static_cast<float>(std::atof(string_argv.substr(SequenceRenderer::NOISE_THRESHOLD_COMMANDLINE_ARGUMENT.length()).c_str()));
+        else if (string_argv == SequenceRenderer::DENOISE_COMMANDLINE_ARGUMENT)
+            arguments.sequence_denoise = true;
+        else if (string_argv.starts_with(RenderServer::PORT_COMMANDLINE_ARGUMENT))
+            arguments.server_port = std::atoi(string_argv.substr(RenderServer::PORT_COMMANDLINE_ARGUMENT.length()).c_str());
+        else if (string_argv.starts_with(RenderServer::ADDRESS_COMMANDLINE_ARGUMENT))
+            arguments.server_address = string_argv.substr(RenderServer::ADDRESS_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(DistributedRenderCoordinator::WORKERS_COMMANDLINE_ARGUMENT))
+        {
+            // Comma separated list of host:port
+            std::stringstream workers_stream(string_argv.substr(DistributedRenderCoordinator::WORKERS_COMMANDLINE_ARGUMENT.length()));
+            std::string worker;
+            while (std::getline(workers_stream, worker, ','))
+                if (!worker.empty())
+                    arguments.distributed_workers.push_back(worker);
+        }
+        else if (string_argv.starts_with("--trace="))
+            arguments.trace_file_path = string_argv.substr(8);
+        else if (string_argv.starts_with("--compile-workers="))
+            arguments.compile_workers = std::atoi(string_argv.substr(18).c_str());
+        else if (string_argv.starts_with(KernelCompileFarm::WORKER_COMMANDLINE_ARGUMENT))
+            arguments.compile_worker_job_file = string_argv.substr(KernelCompileFarm::WORKER_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(KernelCompileFarm::WORKER_DEVICE_COMMANDLINE_ARGUMENT))
+            arguments.compile_worker_device = std::atoi(string_argv.substr(KernelCompileFarm::WORKER_DEVICE_COMMANDLINE_ARGUMENT.length()).c_str());
+        else if (string_argv.starts_with(ShaderCacheManager::SIZE_LIMIT_COMMANDLINE_ARGUMENT))
+            arguments.shader_cache_size_mb = std::max(0, std::atoi(string_argv.substr(ShaderCacheManager::SIZE_LIMIT_COMMANDLINE_ARGUMENT.length()).c_str()));
+        else if (string_argv.starts_with(ShaderCacheManager::SHARED_DIRECTORY_COMMANDLINE_ARGUMENT))
+            arguments.shared_shader_cache_directory = string_argv.substr(ShaderCacheManager::SHARED_DIRECTORY_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(KernelBinaryBundle::BUILD_COMMANDLINE_ARGUMENT))
+            arguments.kernel_bundle_build_directory = string_argv.substr(KernelBinaryBundle::BUILD_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(KernelResourceReport::BENCH_COMMANDLINE_ARGUMENT))
+            arguments.kernel_resource_bench_baseline = string_argv.substr(KernelResourceReport::BENCH_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(KernelResourceReport::THRESHOLD_COMMANDLINE_ARGUMENT))
+            arguments.kernel_resource_bench_threshold = std::atof(string_argv.substr(KernelResourceReport::THRESHOLD_COMMANDLINE_ARGUMENT.length()).c_str());
+        else if (string_argv == RenderBenchmark::BENCHMARK_COMMANDLINE_ARGUMENT)
+            arguments.benchmark = true;
+        else if (string_argv.starts_with(RenderBenchmark::WARMUP_FRAMES_COMMANDLINE_ARGUMENT))
+            arguments.benchmark_warmup_frames = std::max(0, std::atoi(string_argv.substr(RenderBenchmark::WARMUP_FRAMES_COMMANDLINE_ARGUMENT.length()).c_str()));
+        else if (string_argv.starts_with(RenderBenchmark::MEASURED_FRAMES_COMMANDLINE_ARGUMENT))
+            arguments.benchmark_frames = std::atoi(string_argv.substr(RenderBenchmark::MEASURED_FRAMES_COMMANDLINE_ARGUMENT.length()).c_str());
+        else if (string_argv.starts_with(RenderBenchmark::OUTPUT_COMMANDLINE_ARGUMENT))
+            arguments.benchmark_output_file_path = string_argv.substr(RenderBenchmark::OUTPUT_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(RenderBenchmark::SUITE_COMMANDLINE_ARGUMENT))
+            arguments.benchmark_suite_reference_directory = string_argv.substr(RenderBenchmark::SUITE_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(RenderBenchmark::SUITE_MAX_SAMPLES_COMMANDLINE_ARGUMENT))
+            arguments.benchmark_suite_max_samples = std::max(1, std::atoi(string_argv.substr(RenderBenchmark::SUITE_MAX_SAMPLES_COMMANDLINE_ARGUMENT.length()).c_str()));
+        else if (string_argv.starts_with(RenderBenchmark::REFERENCE_SAMPLES_COMMANDLINE_ARGUMENT))
+            arguments.benchmark_reference_samples = std::max(1, std::atoi(string_argv.substr(RenderBenchmark::REFERENCE_SAMPLES_COMMANDLINE_ARGUMENT.length()).c_str()));
+        else if (string_argv.starts_with(RenderBenchmark::COMPARISON_COMMANDLINE_ARGUMENT))
+            arguments.strategy_comparison_reference_directory = string_argv.substr(RenderBenchmark::COMPARISON_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv.starts_with(RenderBenchmark::COMPARISON_TIME_COMMANDLINE_ARGUMENT))
+            arguments.strategy_comparison_time_ms = std::max(1, std::atoi(string_argv.substr(RenderBenchmark::COMPARISON_TIME_COMMANDLINE_ARGUMENT.length()).c_str()));
+        else if (string_argv.starts_with(RenderBenchmark::COMPARISON_OUTPUT_COMMANDLINE_ARGUMENT))
+            arguments.strategy_comparison_output_directory = string_argv.substr(RenderBenchmark::COMPARISON_OUTPUT_COMMANDLINE_ARGUMENT.length());
+        else if (string_argv == RayCastingBenchmark::RAY_CASTING_BENCHMARK_COMMANDLINE_ARGUMENT)
+            arguments.ray_casting_benchmark = true;
+        else if (string_argv == BSDFMicrobenchmark::BSDF_BENCHMARK_COMMANDLINE_ARGUMENT)
+            arguments.bsdf_benchmark = true;
         else
             //Assuming scene file path
             arguments.scene_file_path = string_argv;
@@ -6,7 +6,10 @@
 #ifndef COMMANDLINE_ARGUMENTS_H
 #define COMMANDLINE_ARGUMENTS_H
 
+#include "HostDeviceCommon/EnvmapPortal.h"
+
 #include <iostream>
+#include <vector>
 
 struct CommandlineArguments
 {
@@ -24,6 +27,132 @@ struct CommandlineArguments
 
     int render_samples = 64;
     int bounces = 8;
+
+    // BVHBuildQuality used for building the BVH of the scene: 0 = fast, 1 = balanced, 2 = high quality
+    int bvh_build_quality = 2;
+    // If true, the texture coordinates of the scene are stored as half floats by the
+    // GPU renderer, see GPURenderer::set_half_precision_texcoords()
+    bool half_precision_texcoords = false;
+    // If true, the GPU renderer stores the positions of the vertices on 16 bits
+    // per axis, see GPURenderer::set_quantized_vertices_positions()
+    bool quantized_vertices_positions = false;
+    // If true, the BVHs of the meshes are compacted after being built, see GPURenderer::set_compact_bvh()
+    bool compact_bvh = false;
+    // If true, the interactive renderer starts rendering before the scene is fully
+    // loaded and streams the rest in, see GPURenderer::set_progressive_loading()
+    bool progressive_loading = false;
+
+    // If true, the GPU renderer renders 'render_samples' samples without creating
+    // a window (no OpenGL context needed) and writes the render to 'output_file_path'
+    bool headless = false;
+    std::string output_file_path = "GPU_RT_output.hdr";
+    // Maximum render time in seconds of a headless render. 0 for no limit
+    float timeout = 0.0f;
+    // Indices of the GPUs the headless render is split between
+    std::vector<int> gpu_indices = { 0 };
+    // MultiGPURenderer::SplitMode used to split the headless render between the GPUs: 0 = split frame, 1 = sample splitting
+    int multi_gpu_mode = 0;
+    // Interval in seconds at which the headless render is written to 'output_file_path'
+    // while rendering. 0 to only write the final render
+    float reduce_interval = 0.0f;
+    // File the accumulation state of the headless render is checkpointed to every 'checkpoint_interval'
+    // seconds, and resumed from if it exists when the render starts. Empty for no checkpoints
+    std::string checkpoint_file_path;
+    float checkpoint_interval = 300.0f;
+
+    // If > 0, the headless render renders an image sequence of that many frames instead, see SequenceRenderer
+    int sequence_frames = 0;
+    // What changes between the frames of the sequence: 0 = camera orbit, 1 = envmap rotation
+    int sequence_mode = 0;
+    // Angle the sequence sweeps over
+    float sequence_sweep_degrees = 360.0f;
+    // Path of the frames, formatted with printf with the index of the frame. EXR or HDR
+    std::string sequence_output_pattern = "frame_%04d.exr";
+    // If > 0, a frame of the sequence stops once stop_pixel_percentage_converged of its pixels reached this noise threshold
+    float sequence_noise_threshold = 0.0f;
+    // Whether or not the frames of the sequence are denoised (CPU) before being written
+    bool sequence_denoise = false;
+
+    // If > 0, the application runs as a RenderServer listening on that port and
+    // on 'server_address' instead, with the scene resident for all the jobs
+    int server_port = 0;
+    std::string server_address = "127.0.0.1";
+    // If not empty, the render is split between these RenderServers ("host:port") by the
+    // DistributedRenderCoordinator instead of being rendered by this application
+    std::vector<std::string> distributed_workers;
+
+    // Whether or not to use the SceneCache to skip the parsing of scenes that have already been parsed
+    bool use_scene_cache = true;
+    // If true, the material textures are cut into tiles written to disk and the GPU renderer
+    // only keeps the tiles that the render needs in VRAM. For scenes whose textures don't fit in VRAM
+    bool virtual_texturing = false;
+    // If true, the triangles and vertices of the meshes are reordered at load time
+    // for memory locality, see SceneParserOptions::reorder_triangles
+    bool reorder_triangles = false;
+    // If true, levels of detail of the large meshes are generated at load time and the GPU renderer
+    // traces the distant and secondary rays against them, see SceneParserOptions::geometry_lods
+    bool geometry_lods = false;
+    // If true, the GPU renderer stores the sRGB textures converted to linear instead of
+    // converting them in the shaders, see SceneParserOptions::linearize_srgb_textures
+    bool linearize_srgb_textures = false;
+    // Envmap portals given with --envmap-portal=, see SceneParserOptions::envmap_portals
+    std::vector<EnvmapPortal> envmap_portals;
+
+    // How many processes compile the kernels of the background precompilation (see KernelCompileFarm).
+    // 0 to compile them in the background threads of the application. Number of cores / 2 by default
+    int compile_workers = -1;
+    // If not empty, the application only runs as a worker of the KernelCompileFarm
+    // on the jobs of that file and on the device 'compile_worker_device'
+    std::string compile_worker_job_file;
+    int compile_worker_device = 0;
+    // Size in MB above which the least recently used files of the shader cache are evicted, see ShaderCacheManager. 0 for no limit
+    int shader_cache_size_mb = 0;
+    // Read-only shader cache (a copy of the shader cache of another machine) looked up before compiling. Empty for none
+    std::string shared_shader_cache_directory;
+    // If not empty, the application only builds a KernelBinaryBundle in that directory
+    // for the devices 'gpu_indices' and exits
+    std::string kernel_bundle_build_directory;
+    // If not empty, the application only compiles the kernels on the first device of 'gpu_indices', compares
+    // their registers and spills with that baseline file (see KernelResourceReport) and exits
+    std::string kernel_resource_bench_baseline;
+    // Percentage of registers / spilled bytes above the baseline that fails the kernel resource bench.
+    // Negative for KernelResourceReport::DEFAULT_REGRESSION_THRESHOLD
+    float kernel_resource_bench_threshold = -1.0f;
+
+    // If not empty, the TraceRecorder records from the start of the application. The trace is written to that
+    // file when the recording is stopped from the UI or at the end of the interactive / headless render
+    std::string trace_file_path;
+
+    // If true, the application only runs the RenderBenchmark on the first device of 'gpu_indices',
+    // writes its results to 'benchmark_output_file_path' and exits
+    bool benchmark = false;
+    int benchmark_warmup_frames = 16;
+    int benchmark_frames = 128;
+    std::string benchmark_output_file_path = "benchmark.json";
+
+    // If not empty, the application runs the scene benchmark suite of RenderBenchmark::run_suite() instead, with
+    // the references of the scenes in this directory, and exits
+    std::string benchmark_suite_reference_directory;
+    // Number of samples after which a configuration of the suite that didn't reach all its quality targets is stopped
+    int benchmark_suite_max_samples = 1024;
+    // Number of samples of the references rendered by the suite when they are missing
+    int benchmark_reference_samples = 8192;
+
+    // If not empty, the application runs the sampling strategies comparison of RenderBenchmark::run_comparison()
+    // with the references of the scenes in this directory (shared with the benchmark suite) and exits
+    std::string strategy_comparison_reference_directory;
+    // GPU time each configuration of the comparison renders for
+    int strategy_comparison_time_ms = 5000;
+    // Directory the comparison table and images are written to
+    std::string strategy_comparison_output_directory = "strategy_comparison";
+
+    // If true, the application runs the RayCastingBenchmark on the first device of 'gpu_indices' with the
+    // warmup / measured launch counts of the benchmark, writes its results to 'benchmark_output_file_path' and exits
+    bool ray_casting_benchmark = false;
+
+    // If true, the application runs the BSDFMicrobenchmark on the first device of 'gpu_indices' and on the CPU with
+    // the warmup / measured launch counts of the benchmark, writes its results to 'benchmark_output_file_path' and exits
+    bool bsdf_benchmark = false;
 };
 
 #endif
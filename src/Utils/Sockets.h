@@ -0,0 +1,134 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef UTILS_SOCKETS_H
+#define UTILS_SOCKETS_H
+
+// TCP sockets of the RenderServer and of the DistributedRenderCoordinator.
+// Must be included before anything that could include windows.h
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+typedef SOCKET SocketHandle;
+#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#define close_socket closesocket
+#define SOCKET_SEND_FLAGS 0
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef int SocketHandle;
+#define INVALID_SOCKET_HANDLE -1
+#define close_socket close
+// A peer that disconnected mustn't kill the application with SIGPIPE
+#define SOCKET_SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+inline bool send_all(std::intptr_t socket, const void* data, size_t size)
+{
+    const char* bytes = reinterpret_cast<const char*>(data);
+    while (size > 0)
+    {
+        int sent = send(static_cast<SocketHandle>(socket), bytes, static_cast<int>(std::min<size_t>(size, 1 << 30)), SOCKET_SEND_FLAGS);
+        if (sent <= 0)
+            return false;
+
+        bytes += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+inline bool send_line(std::intptr_t socket, const std::string& line)
+{
+    std::string terminated_line = line + "\n";
+
+    return send_all(socket, terminated_line.data(), terminated_line.size());
+}
+
+/**
+ * Reads exactly 'size' bytes. Returns false if the connection was closed before
+ */
+inline bool receive_all(std::intptr_t socket, void* out_data, size_t size)
+{
+    char* bytes = reinterpret_cast<char*>(out_data);
+    while (size > 0)
+    {
+        int received = recv(static_cast<SocketHandle>(socket), bytes, static_cast<int>(std::min<size_t>(size, 1 << 30)), 0);
+        if (received <= 0)
+            return false;
+
+        bytes += received;
+        size -= received;
+    }
+
+    return true;
+}
+
+/**
+ * Reads a line without its new line character. The line is read byte per byte so that nothing after
+ * it is consumed: the lines of the render server protocol are followed by binary data.
+ * Returns false if the connection was closed before the end of the line
+ */
+inline bool receive_line(std::intptr_t socket, std::string& out_line)
+{
+    out_line.clear();
+
+    char character;
+    while (receive_all(socket, &character, 1))
+    {
+        if (character == '\n')
+            return true;
+
+        if (character != '\r')
+            out_line.push_back(character);
+    }
+
+    return false;
+}
+
+/**
+ * Opens a TCP connection to 'host' (name or numerical address) on 'port'.
+ * Returns INVALID_SOCKET_HANDLE if the host can't be reached
+ */
+inline std::intptr_t connect_to(const std::string& host, int port)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+        return static_cast<std::intptr_t>(INVALID_SOCKET_HANDLE);
+
+    SocketHandle connected_socket = INVALID_SOCKET_HANDLE;
+    for (addrinfo* address = addresses; address != nullptr && connected_socket == INVALID_SOCKET_HANDLE; address = address->ai_next)
+    {
+        connected_socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (connected_socket == INVALID_SOCKET_HANDLE)
+            continue;
+
+        if (connect(connected_socket, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0)
+        {
+            close_socket(connected_socket);
+            connected_socket = INVALID_SOCKET_HANDLE;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    return static_cast<std::intptr_t>(connected_socket);
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#include "Utils/TraceRecorder.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+TraceRecorder g_trace_recorder;
+
+// Trace thread id of the calling thread, -1 until the thread records its first zone or gets a name
+static thread_local int t_trace_thread_id = -1;
+
+void TraceRecorder::start()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // The names of the threads are kept, the threads still exist
+    m_events.clear();
+    m_gpu_track_ids.clear();
+
+    m_recording_index++;
+    m_recording = true;
+}
+
+bool TraceRecorder::stop_and_write(const std::string& file_path)
+{
+    m_recording = false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::ofstream output_file(file_path);
+    if (!output_file.is_open())
+        return false;
+
+    // Microseconds, fixed so that the late zones of long recordings keep their precision
+    output_file << std::fixed << std::setprecision(3);
+    output_file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    output_file << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"CPU\"}},\n";
+    output_file << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": {\"name\": \"GPU\"}}";
+    for (int i = 0; i < m_thread_names.size(); i++)
+        output_file << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i << ", \"args\": {\"name\": \"" << escape_json_string(m_thread_names[i]) << "\"}}";
+    for (auto& track_to_id : m_gpu_track_ids)
+        output_file << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 2, \"tid\": " << track_to_id.second << ", \"args\": {\"name\": \"" << escape_json_string(track_to_id.first) << "\"}}";
+
+    // Complete events, the viewers don't need them sorted
+    for (const TraceEvent& event : m_events)
+        output_file << ",\n{\"name\": \"" << escape_json_string(event.name) << "\", \"cat\": \"" << event.category << "\", \"ph\": \"X\", \"pid\": " << event.process_id
+            << ", \"tid\": " << event.thread_id << ", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us << "}";
+    output_file << "\n]}\n";
+
+    return true;
+}
+
+bool TraceRecorder::is_recording() const
+{
+    return m_recording;
+}
+
+unsigned int TraceRecorder::get_recording_index() const
+{
+    return m_recording_index;
+}
+
+double TraceRecorder::to_trace_time(std::chrono::steady_clock::time_point time_point) const
+{
+    return std::chrono::duration<double, std::micro>(time_point - m_origin).count();
+}
+
+double TraceRecorder::now() const
+{
+    return to_trace_time(std::chrono::steady_clock::now());
+}
+
+void TraceRecorder::set_current_thread_name(const std::string& name)
+{
+    int thread_id = get_current_thread_id();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_thread_names[thread_id] = name;
+}
+
+void TraceRecorder::add_host_zone(const std::string& name, const char* category, double start_us, double end_us)
+{
+    if (!m_recording)
+        return;
+
+    int thread_id = get_current_thread_id();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_events.push_back({ name, category, 1, thread_id, start_us, end_us - start_us });
+}
+
+void TraceRecorder::add_gpu_zone(const std::string& name, const std::string& track_name, double start_us, double end_us)
+{
+    if (!m_recording)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto track_find = m_gpu_track_ids.find(track_name);
+    int track_id;
+    if (track_find == m_gpu_track_ids.end())
+    {
+        track_id = static_cast<int>(m_gpu_track_ids.size());
+        m_gpu_track_ids[track_name] = track_id;
+    }
+    else
+        track_id = track_find->second;
+
+    m_events.push_back({ name, "GPU", 2, track_id, start_us, end_us - start_us });
+}
+
+int TraceRecorder::get_current_thread_id()
+{
+    if (t_trace_thread_id == -1)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        t_trace_thread_id = static_cast<int>(m_thread_names.size());
+        m_thread_names.push_back("Thread " + std::to_string(t_trace_thread_id));
+    }
+
+    return t_trace_thread_id;
+}
+
+std::string TraceRecorder::escape_json_string(const std::string& string)
+{
+    std::string escaped;
+    for (char character : string)
+    {
+        if (character == '"' || character == '\\')
+        {
+            escaped += '\\';
+            escaped += character;
+        }
+        else if (static_cast<unsigned char>(character) < 0x20)
+        {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", character);
+            escaped += code;
+        }
+        else
+            escaped += character;
+    }
+
+    return escaped;
+}
+
+TraceZone::TraceZone(const std::string& name, const char* category) : m_category(category)
+{
+    if (!g_trace_recorder.is_recording())
+        return;
+
+    m_name = name;
+    m_start_us = g_trace_recorder.now();
+}
+
+TraceZone::~TraceZone()
+{
+    if (m_name.empty())
+        return;
+
+    g_trace_recorder.add_host_zone(m_name, m_category, m_start_us, g_trace_recorder.now());
+}
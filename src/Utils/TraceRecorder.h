@@ -0,0 +1,108 @@
+/*
+ * Copyright 2024 Tom Clabault. GNU GPL3 license.
+ * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Timeline of the work of the CPU threads and of the GPU streams, written as a Chrome trace
+ * JSON file (chrome://tracing, https://ui.perfetto.dev) to see what overlaps with what during the
+ * startup and the frames.
+ *
+ * The zones are only recorded between start() and stop_and_write(), recording nothing otherwise costs
+ * one atomic load per zone. The host zones are scoped (see TraceZone), the tasks of the TaskPool are
+ * all zones named after their ThreadManager key. The GPU zones are the intervals of the OrochiTimestampRing
+ * of the renderer and of the render passes, added once their events are resolved
+ */
+class TraceRecorder
+{
+public:
+    /**
+     * Starts a new recording, the zones of the previous one are discarded
+     */
+    void start();
+    /**
+     * Stops the recording and writes its zones to 'file_path'. Returns false if the file couldn't be written
+     */
+    bool stop_and_write(const std::string& file_path);
+
+    bool is_recording() const;
+    /**
+     * Index of the current recording, starting at 1, 0 if start() was never called.
+     * The GPU clocks are calibrated again for each recording, see OrochiTimestampRing
+     */
+    unsigned int get_recording_index() const;
+
+    /**
+     * Time of the trace in microseconds of 'time_point'
+     */
+    double to_trace_time(std::chrono::steady_clock::time_point time_point) const;
+    double now() const;
+
+    /**
+     * Name of the calling thread in the trace ("Main thread", "Task pool worker 3", ...)
+     */
+    void set_current_thread_name(const std::string& name);
+
+    void add_host_zone(const std::string& name, const char* category, double start_us, double end_us);
+    /**
+     * 'track_name' is the GPU timeline that the zone goes to (one per stream)
+     */
+    void add_gpu_zone(const std::string& name, const std::string& track_name, double start_us, double end_us);
+
+private:
+    struct TraceEvent
+    {
+        std::string name;
+        const char* category;
+        // 1 for the host threads, 2 for the GPU tracks
+        int process_id;
+        int thread_id;
+        double start_us;
+        double duration_us;
+    };
+
+    int get_current_thread_id();
+
+    static std::string escape_json_string(const std::string& string);
+
+    std::atomic<bool> m_recording = false;
+    std::atomic<unsigned int> m_recording_index = 0;
+    std::chrono::steady_clock::time_point m_origin = std::chrono::steady_clock::now();
+
+    // Protects everything below
+    std::mutex m_mutex;
+    std::vector<TraceEvent> m_events;
+    // Names of the threads, indexed by the trace thread ids of the host threads
+    std::vector<std::string> m_thread_names;
+    std::unordered_map<std::string, int> m_gpu_track_ids;
+};
+
+/**
+ * Host zone from its construction to its destruction on the calling thread
+ */
+class TraceZone
+{
+public:
+    TraceZone(const std::string& name, const char* category = "Host");
+    ~TraceZone();
+
+private:
+    // Empty if the recorder wasn't recording when the zone was constructed
+    std::string m_name;
+    const char* m_category;
+    double m_start_us = 0.0;
+};
+
+extern TraceRecorder g_trace_recorder;
+
+#endif
@@ -9,7 +9,9 @@
 #include "UI/ImGui/ImGuiLogger.h"
 #include "Utils/Utils.h"
 
+#include <algorithm>
 #include <iostream>
+#include <omp.h>
 #include <OpenImageDenoise/oidn.hpp>
 #include <string>
 #include <sstream>
@@ -158,6 +160,231 @@ Image32Bit Utils::OIDN_denoise(const Image32Bit& image, int width, int height, f
     return output_image;
 }
 
+/**
+ * Inclusive prefix sum of 'data' in place. The array is split in one block per thread:
+ * each block is scanned independently, the sums of the blocks are then scanned
+ * and added back to the blocks
+ */
+template <typename T>
+static void parallel_inclusive_scan_impl(T* data, size_t count)
+{
+    if (count == 0)
+        return;
+
+    int block_count = omp_get_max_threads();
+    size_t block_size = (count + block_count - 1) / block_count;
+    std::vector<T> block_sums(block_count + 1, static_cast<T>(0));
+
+#pragma omp parallel for
+    for (int block = 0; block < block_count; block++)
+    {
+        size_t begin = block * block_size;
+        size_t end = std::min(begin + block_size, count);
+
+        T sum = static_cast<T>(0);
+        for (size_t i = begin; i < end; i++)
+        {
+            sum += data[i];
+            data[i] = sum;
+        }
+
+        block_sums[block + 1] = sum;
+    }
+
+    for (int block = 1; block <= block_count; block++)
+        block_sums[block] += block_sums[block - 1];
+
+#pragma omp parallel for
+    for (int block = 1; block < block_count; block++)
+    {
+        size_t begin = block * block_size;
+        size_t end = std::min(begin + block_size, count);
+
+        T offset = block_sums[block];
+        for (size_t i = begin; i < end; i++)
+            data[i] += offset;
+    }
+}
+
+void Utils::parallel_inclusive_scan(std::vector<float>& data)
+{
+    parallel_inclusive_scan_impl(data.data(), data.size());
+}
+
+void Utils::parallel_inclusive_scan(std::vector<double>& data)
+{
+    parallel_inclusive_scan_impl(data.data(), data.size());
+}
+
+/**
+ * The alias table is built with the sweeping formulation of Vose's method
+ * in which the lights (elements with a weight below the average) fill the excess
+ * of the heavies (elements above the average) in order.
+ * 
+ * With E(j) the excess of the heavies [0, j] and D(i) the deficit of the lights [0, i - 1],
+ * light 'i' is aliased to the first heavy 'j' such that E(j) > D(i) and heavy 'j' is aliased
+ * to the next heavy with a probability 1 - (D(k) - E(j)), 'k' being the first light such
+ * that D(k) >= E(j). Every element can then be processed independently with a binary search
+ * in these prefix sums, which are themselves computed in parallel.
+ * 
+ * References:
+ * [1] Vose's Alias Method [https://www.keithschwarz.com/darts-dice-coins/]
+ * [2] [Parallel Weighted Random Sampling, Hubschle-Schneider, Sanders, 2019]
+ */
+void Utils::compute_alias_table(const std::vector<float>& weights, std::vector<float>& out_probas, std::vector<int>& out_alias, float* out_weights_total_sum)
+{
+    // TODO try using floats here to reduce memory usage during the construction and see if precision is an issue or not
+
+    int element_count = static_cast<int>(weights.size());
+
+    double weights_sum = 0.0;
+#pragma omp parallel for reduction(+:weights_sum)
+    for (int i = 0; i < element_count; i++)
+        weights_sum += static_cast<double>(weights[i]);
+
+    if (out_weights_total_sum != nullptr)
+        *out_weights_total_sum = static_cast<float>(weights_sum);
+
+    out_probas.resize(element_count);
+    out_alias.resize(element_count);
+    if (element_count == 0)
+        return;
+
+    // The weights normalized such that the average of the elements of this vector is 1
+    std::vector<double> normalized_weights(element_count);
+#pragma omp parallel for
+    for (int i = 0; i < element_count; i++)
+    {
+        if (weights_sum > 0.0)
+            normalized_weights[i] = static_cast<double>(weights[i]) / weights_sum * element_count;
+        else
+            // Degenerate distribution, falling back to uniform
+            normalized_weights[i] = 1.0;
+    }
+
+    // Stable partition of the indices in lights and heavies, done per block
+    // of elements in parallel to keep the order of the elements
+    int block_count = omp_get_max_threads();
+    int block_size = (element_count + block_count - 1) / block_count;
+    std::vector<int> block_light_offsets(block_count + 1, 0);
+    std::vector<int> block_heavy_offsets(block_count + 1, 0);
+#pragma omp parallel for
+    for (int block = 0; block < block_count; block++)
+    {
+        int begin = block * block_size;
+        int end = std::min(begin + block_size, element_count);
+        for (int i = begin; i < end; i++)
+        {
+            if (normalized_weights[i] < 1.0)
+                block_light_offsets[block + 1]++;
+            else
+                block_heavy_offsets[block + 1]++;
+        }
+    }
+    for (int block = 1; block <= block_count; block++)
+    {
+        block_light_offsets[block] += block_light_offsets[block - 1];
+        block_heavy_offsets[block] += block_heavy_offsets[block - 1];
+    }
+
+    int light_count = block_light_offsets[block_count];
+    int heavy_count = block_heavy_offsets[block_count];
+    std::vector<int> lights(light_count);
+    std::vector<int> heavies(heavy_count);
+    // 'lights_deficit[k]' is the sum of the deficits of the lights [0, k - 1]
+    std::vector<double> lights_deficit(light_count + 1);
+    // 'heavies_excess[j]' is the sum of the excesses of the heavies [0, j]
+    std::vector<double> heavies_excess(heavy_count);
+    lights_deficit[0] = 0.0;
+#pragma omp parallel for
+    for (int block = 0; block < block_count; block++)
+    {
+        int light_index = block_light_offsets[block];
+        int heavy_index = block_heavy_offsets[block];
+
+        int begin = block * block_size;
+        int end = std::min(begin + block_size, element_count);
+        for (int i = begin; i < end; i++)
+        {
+            if (normalized_weights[i] < 1.0)
+            {
+                lights_deficit[light_index + 1] = 1.0 - normalized_weights[i];
+                lights[light_index++] = i;
+            }
+            else
+            {
+                heavies_excess[heavy_index] = normalized_weights[i] - 1.0;
+                heavies[heavy_index++] = i;
+            }
+        }
+    }
+    parallel_inclusive_scan(lights_deficit);
+    parallel_inclusive_scan(heavies_excess);
+
+#pragma omp parallel for
+    for (int light = 0; light < light_count; light++)
+    {
+        int element_index = lights[light];
+
+        auto heavy = std::upper_bound(heavies_excess.begin(), heavies_excess.end(), lights_deficit[light]);
+        if (heavy == heavies_excess.end())
+        {
+            // Can only happen because of floating point imprecisions
+            out_probas[element_index] = 1.0f;
+            out_alias[element_index] = element_index;
+        }
+        else
+        {
+            out_probas[element_index] = static_cast<float>(normalized_weights[element_index]);
+            out_alias[element_index] = heavies[heavy - heavies_excess.begin()];
+        }
+    }
+
+#pragma omp parallel for
+    for (int heavy = 0; heavy < heavy_count; heavy++)
+    {
+        int element_index = heavies[heavy];
+
+        auto light = std::lower_bound(lights_deficit.begin(), lights_deficit.end(), heavies_excess[heavy]);
+        if (light == lights_deficit.end() || heavy == heavy_count - 1)
+        {
+            // The lights aren't enough to cover the excess of this heavy, it stays a heavy
+            out_probas[element_index] = 1.0f;
+            out_alias[element_index] = element_index;
+        }
+        else
+        {
+            // The lights overfilled this heavy, it is completed by the next heavy
+            double overflow = *light - heavies_excess[heavy];
+            out_probas[element_index] = static_cast<float>(hippt::clamp(0.0, 1.0, 1.0 - overflow));
+            out_alias[element_index] = heavies[heavy + 1];
+        }
+    }
+}
+
+std::vector<unsigned short> Utils::quantize_unorm16(const std::vector<float>& values)
+{
+    std::vector<unsigned short> quantized(values.size());
+
+#pragma omp parallel for
+    for (int i = 0; i < values.size(); i++)
+        quantized[i] = static_cast<unsigned short>(hippt::clamp(0.0f, 1.0f, values[i]) * 65535.0f + 0.5f);
+
+    return quantized;
+}
+
+std::uint64_t Utils::fnv1a_hash(const void* data, size_t size, std::uint64_t hash)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
 void Utils::debugbreak()
 {
 #if defined( _WIN32 )
@@ -9,7 +9,9 @@
 #include "HostDeviceCommon/Color.h"
 #include "Image/Image.h"
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 class Utils
 {
@@ -22,6 +24,35 @@ public:
 
     static std::string file_to_string(const char* filepath);
 
+    /**
+     * Builds the alias table of the given discrete distribution for O(1) sampling
+     * with Vose's alias method. The weights don't need to be normalized.
+     * The construction is parallelized with OpenMP.
+     * 
+     * 'out_probas' and 'out_alias' are resized to the number of weights. If all the weights
+     * are 0, the table built samples all the elements uniformly.
+     * 
+     * If not nullptr, 'out_weights_total_sum' is filled with the sum of the weights
+     */
+    static void compute_alias_table(const std::vector<float>& weights, std::vector<float>& out_probas, std::vector<int>& out_alias, float* out_weights_total_sum = nullptr);
+
+    /**
+     * Quantizes values in [0, 1] to 16-bit unsigned normalized integers
+     */
+    static std::vector<unsigned short> quantize_unorm16(const std::vector<float>& values);
+
+    /**
+     * Computes the inclusive prefix sum of 'data' in place using all the threads
+     * available to OpenMP
+     */
+    static void parallel_inclusive_scan(std::vector<float>& data);
+    static void parallel_inclusive_scan(std::vector<double>& data);
+
+    /**
+     * 64 bit FNV-1a hash, can be chained by passing the previous hash as 'hash'
+     */
+    static std::uint64_t fnv1a_hash(const void* data, size_t size, std::uint64_t hash = 0xcbf29ce484222325ull);
+
     /*
      * A blend factor of 1 gives only the noisy image. 0 only the denoised image
      */
@@ -3,31 +3,120 @@
  * GNU GPL3 license copy: https://www.gnu.org/licenses/gpl-3.0.txt
  */
 
+#include "Compiler/GPUKernelCompiler.h"
+#include "Compiler/KernelBinaryBundle.h"
+#include "Compiler/KernelCompileFarm.h"
+#include "Compiler/KernelResourceReport.h"
 #include "Image/Image.h"
+#include "Renderer/BSDFMicrobenchmark.h"
 #include "Renderer/BVH.h"
 #include "Renderer/CPURenderer.h"
+#include "Renderer/DistributedRenderCoordinator.h"
 #include "Renderer/GPURenderer.h"
+#include "Renderer/MultiGPURenderer.h"
+#include "Renderer/RayCastingBenchmark.h"
+#include "Renderer/RenderBenchmark.h"
+#include "Renderer/RenderServer.h"
+#include "Renderer/SequenceRenderer.h"
 #include "Scene/Camera.h"
 #include "Scene/SceneParser.h"
 #include "Threads/ThreadFunctions.h"
 #include "Threads/ThreadManager.h"
 #include "UI/RenderWindow.h"
 #include "Utils/CommandlineArguments.h"
+#include "Utils/TraceRecorder.h"
 #include "Utils/Utils.h"
 
 #include "stb_image_write.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <filesystem>
+#include <future>
 #include <iostream>
+#include <thread>
 
 extern ImGuiLogger g_imgui_logger;
+extern GPUKernelCompiler g_gpu_kernel_compiler;
+extern KernelCompileFarm g_kernel_compile_farm;
 
 #define GPU_RENDER 1
 
+/**
+ * Writes the trace recorded since the start of the application if it is still recording (--trace)
+ */
+void write_startup_trace(const std::string& trace_file_path)
+{
+    if (!g_trace_recorder.is_recording())
+        return;
+
+    if (g_trace_recorder.stop_and_write(trace_file_path))
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Trace written to %s", trace_file_path.c_str());
+    else
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the trace to %s", trace_file_path.c_str());
+}
+
 int main(int argc, char* argv[])
 {   
     CommandlineArguments cmd_arguments = CommandlineArguments::process_command_line_args(argc, argv);
+    g_trace_recorder.set_current_thread_name("Main thread");
+    if (!cmd_arguments.trace_file_path.empty())
+        // Recording the startup
+        g_trace_recorder.start();
+    if (!cmd_arguments.kernel_bundle_build_directory.empty())
+        // "KernelBundle" CMake target
+        return KernelBinaryBundle::build(cmd_arguments.kernel_bundle_build_directory, cmd_arguments.gpu_indices);
+    if (!cmd_arguments.kernel_resource_bench_baseline.empty())
+    {
+        // "KernelResourceBench" CMake target
+        float threshold = cmd_arguments.kernel_resource_bench_threshold;
+        if (threshold < 0.0f)
+            threshold = KernelResourceReport::DEFAULT_REGRESSION_THRESHOLD;
+
+        return KernelResourceReport::run_bench(cmd_arguments.kernel_resource_bench_baseline, threshold, cmd_arguments.gpu_indices[0]);
+    }
+
+    // Binaries precompiled for deployment, if shipped with the application
+    g_gpu_kernel_compiler.load_kernel_bundle(KERNEL_BUNDLE_DIRECTORY);
+    g_gpu_kernel_compiler.get_shader_cache().set_shared_directory(cmd_arguments.shared_shader_cache_directory);
+
+    if (!cmd_arguments.compile_worker_job_file.empty())
+        // Started by the KernelCompileFarm of another instance of the application
+        return KernelCompileFarm::run_worker(cmd_arguments.compile_worker_job_file, cmd_arguments.compile_worker_device);
+
+    int compile_workers = cmd_arguments.compile_workers;
+    if (compile_workers < 0)
+        // Leaving half of the cores for the interactive process
+        compile_workers = std::max(1u, std::thread::hardware_concurrency() / 2);
+    // Not for the workers: only the interactive process evicts
+    g_gpu_kernel_compiler.get_shader_cache().set_size_limit(static_cast<std::uint64_t>(cmd_arguments.shader_cache_size_mb) * 1024 * 1024);
+    g_kernel_compile_farm.set_executable_path(argv[0]);
+    g_kernel_compile_farm.set_worker_count(compile_workers);
+
+#if GPU_RENDER
+    if (cmd_arguments.bsdf_benchmark)
+        // No scene needed
+        return BSDFMicrobenchmark::run(cmd_arguments);
+
+    if (!cmd_arguments.benchmark_suite_reference_directory.empty() || !cmd_arguments.strategy_comparison_reference_directory.empty() || cmd_arguments.ray_casting_benchmark)
+    {
+        // The suite, the comparison and the ray casting benchmark parse their own scenes, only the envmap is shared by all of them
+        Image32Bit suite_envmap_image;
+        ThreadManager::start_thread(ThreadManager::ENVMAP_LOAD_FROM_DISK_THREAD, ThreadFunctions::read_image_hdr, std::ref(suite_envmap_image), cmd_arguments.skysphere_file_path, 3, true);
+
+        if (cmd_arguments.ray_casting_benchmark)
+            return RayCastingBenchmark::run(cmd_arguments, suite_envmap_image);
+        else if (!cmd_arguments.strategy_comparison_reference_directory.empty())
+            return RenderBenchmark::run_comparison(cmd_arguments, suite_envmap_image);
+        else
+            return RenderBenchmark::run_suite(cmd_arguments, suite_envmap_image);
+    }
+#endif
+
+    if (!cmd_arguments.distributed_workers.empty())
+        // Only coordinating the render servers of the nodes, the scene is loaded by them
+        return DistributedRenderCoordinator::run(cmd_arguments);
 
     const int width = cmd_arguments.render_width;
     const int height = cmd_arguments.render_height;
@@ -39,7 +128,21 @@ int main(int argc, char* argv[])
     Scene parsed_scene;
     SceneParserOptions options;
 
-    options.nb_texture_threads = 10;
+    // The disk reads are bounded by 'nb_concurrent_texture_reads' so all the workers of the task pool
+    // but one can be used for decoding the textures. The last one is left for the kernel compilations
+    // and the BVH build that start while the textures are loading
+    options.nb_texture_threads = std::max(1, ThreadManager::get_worker_count() - 1);
+    options.use_scene_cache = cmd_arguments.use_scene_cache;
+    options.envmap_portals = cmd_arguments.envmap_portals;
+    options.reorder_triangles = cmd_arguments.reorder_triangles;
+    options.geometry_lods = cmd_arguments.geometry_lods;
+#if GPU_RENDER
+    // The GPU renderer uploads the vertex attributes of cached scenes straight from the
+    // cache file so these attributes never need to be in memory
+    options.stream_cached_vertex_attributes = true;
+    options.virtual_texturing = cmd_arguments.virtual_texturing;
+    options.linearize_srgb_textures = cmd_arguments.linearize_srgb_textures;
+#endif
     options.override_aspect_ratio = (float)width / height;
     start_scene = std::chrono::high_resolution_clock::now();
     start_full = std::chrono::high_resolution_clock::now();
@@ -50,30 +153,173 @@ int main(int argc, char* argv[])
     g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Scene geometry parsed in %ldms", std::chrono::duration_cast<std::chrono::milliseconds>(stop_scene - start_scene).count());
     g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Reading envmap %s...", cmd_arguments.skysphere_file_path.c_str());
 
-    // TODO we only need 3 channels for the envmap but the only supported formats are 1, 2, 4 channels in HIP/CUDA, not 3
+    // Only RGB, the GPU storage formats that need an alpha channel pad it (see OrochiEnvmap::init_from_image())
     Image32Bit envmap_image;
-    ThreadManager::start_thread(ThreadManager::ENVMAP_LOAD_FROM_DISK_THREAD, ThreadFunctions::read_image_hdr, std::ref(envmap_image), cmd_arguments.skysphere_file_path, 4, true);
+    ThreadManager::start_thread(ThreadManager::ENVMAP_LOAD_FROM_DISK_THREAD, ThreadFunctions::read_image_hdr, std::ref(envmap_image), cmd_arguments.skysphere_file_path, 3, true);
 #if GPU_RENDER
+    if (cmd_arguments.benchmark)
+        // Reproducible benchmark without any window, for the regression dashboards
+        return RenderBenchmark::run(cmd_arguments, parsed_scene, envmap_image);
+
+    if (cmd_arguments.server_port > 0)
+        // Long-running server, the scene stays resident for all the jobs
+        return RenderServer::run(cmd_arguments, parsed_scene, envmap_image);
+
+    if (cmd_arguments.headless && cmd_arguments.sequence_frames > 0)
+        // Turntable / envmap sweep, the scene is built once for all the frames
+        return SequenceRenderer::run(cmd_arguments, parsed_scene, envmap_image);
+
+    if (cmd_arguments.headless)
+    {
+        // Batch rendering without any window / OpenGL context, split
+        // between all the given devices
+        MultiGPURenderer renderer(cmd_arguments.gpu_indices, static_cast<MultiGPURenderer::SplitMode>(cmd_arguments.multi_gpu_mode));
+        renderer.set_envmap(envmap_image, cmd_arguments.skysphere_file_path);
+        renderer.set_camera(parsed_scene.camera);
+        renderer.resize(width, height);
+        renderer.set_bvh_build_quality(static_cast<BVHBuildQuality>(cmd_arguments.bvh_build_quality));
+        renderer.set_half_precision_texcoords(cmd_arguments.half_precision_texcoords);
+        renderer.set_quantized_vertices_positions(cmd_arguments.quantized_vertices_positions);
+        renderer.set_compact_bvh(cmd_arguments.compact_bvh);
+        renderer.set_scene(parsed_scene);
+        renderer.for_each_renderer([&cmd_arguments](GPURenderer& device_renderer) {
+            device_renderer.get_render_settings().nb_bounces = cmd_arguments.bounces;
+            device_renderer.set_geometry_lod(cmd_arguments.geometry_lods);
+        });
+
+        ThreadManager::join_all_threads();
+
+        stop_full = std::chrono::high_resolution_clock::now();
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Full scene parsed & built in %ldms", std::chrono::duration_cast<std::chrono::milliseconds>(stop_full - start_full).count());
+
+        assimp_importer.FreeScene();
+        envmap_image.free();
+
+        std::shared_ptr<ApplicationSettings> application_settings = std::make_shared<ApplicationSettings>();
+        renderer.reset(application_settings);
+        renderer.for_each_renderer([](GPURenderer& device_renderer) {
+            device_renderer.get_render_settings().samples_per_frame = 1;
+        });
+
+        bool checkpointing = !cmd_arguments.checkpoint_file_path.empty();
+        if (checkpointing && std::filesystem::exists(cmd_arguments.checkpoint_file_path))
+        {
+            if (!renderer.load_checkpoints(cmd_arguments.checkpoint_file_path))
+                g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not resume from the checkpoint %s, starting the render from scratch", cmd_arguments.checkpoint_file_path.c_str());
+        }
+
+        std::shared_ptr<PerformanceMetricsComputer> perf_metrics = std::make_shared<PerformanceMetricsComputer>();
+        perf_metrics->init_key(PerformanceMetricsComputer::COMBINED_SAMPLES_PER_SECOND_KEY);
+
+        std::chrono::high_resolution_clock::time_point start_render = std::chrono::high_resolution_clock::now();
+        float last_reduce_time_s = 0.0f;
+        float last_checkpoint_time_s = 0.0f;
+        std::shared_future<void> checkpoint_write;
+        while (renderer.get_sample_number() < cmd_arguments.render_samples)
+        {
+            if (!renderer.render())
+                // All the pixels have converged (adaptive sampling)
+                break;
+
+            float render_time_s = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_render).count() / 1000.0f;
+            if (cmd_arguments.reduce_interval > 0.0f && render_time_s - last_reduce_time_s >= cmd_arguments.reduce_interval)
+            {
+                // Writing the render so far
+                renderer.update_perf_metrics(perf_metrics);
+                renderer.download_framebuffer().write_image_hdr(cmd_arguments.output_file_path.c_str());
+
+                last_reduce_time_s = render_time_s;
+            }
+
+            // A checkpoint is skipped if the previous one is still being written, the render never waits for the disk
+            bool checkpoint_write_done = !checkpoint_write.valid() || checkpoint_write.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            if (checkpointing && checkpoint_write_done && render_time_s - last_checkpoint_time_s >= cmd_arguments.checkpoint_interval)
+            {
+                // The downloads are queued after the frames in flight and waited for by the write thread
+                checkpoint_write = ThreadManager::start_thread(ThreadManager::CHECKPOINT_WRITE_THREAD_KEY, [](std::vector<RenderCheckpointDownload> downloads, std::string checkpoint_path) {
+                    if (!MultiGPURenderer::write_checkpoints(downloads, checkpoint_path))
+                        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not write the checkpoint %s", checkpoint_path.c_str());
+                }, renderer.download_checkpoints_async(), cmd_arguments.checkpoint_file_path);
+
+                last_checkpoint_time_s = render_time_s;
+            }
+
+            if (cmd_arguments.timeout > 0.0f && render_time_s >= cmd_arguments.timeout)
+            {
+                g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Render timed out after %.1fs at %d samples", render_time_s, renderer.get_sample_number());
+
+                break;
+            }
+        }
+
+        ThreadManager::join_threads(ThreadManager::CHECKPOINT_WRITE_THREAD_KEY);
+        if (checkpointing && renderer.get_sample_number() < cmd_arguments.render_samples)
+        {
+            // Timed out, the next run continues from there
+            if (!MultiGPURenderer::write_checkpoints(renderer.download_checkpoints_async(), cmd_arguments.checkpoint_file_path))
+                g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_WARNING, "Could not write the checkpoint %s", cmd_arguments.checkpoint_file_path.c_str());
+        }
+
+        std::chrono::high_resolution_clock::time_point stop_render = std::chrono::high_resolution_clock::now();
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "%d samples rendered in %ldms", renderer.get_sample_number(), std::chrono::duration_cast<std::chrono::milliseconds>(stop_render - start_render).count());
+        renderer.update_perf_metrics(perf_metrics);
+        renderer.print_device_statistics();
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Combined: %.1f samples/s", perf_metrics->get_average(PerformanceMetricsComputer::COMBINED_SAMPLES_PER_SECOND_KEY));
+
+        if (!renderer.download_framebuffer().write_image_hdr(cmd_arguments.output_file_path.c_str()))
+        {
+            g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_ERROR, "Could not write the render to %s", cmd_arguments.output_file_path.c_str());
+
+            return 1;
+        }
+
+        g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Render written to %s", cmd_arguments.output_file_path.c_str());
+        write_startup_trace(cmd_arguments.trace_file_path);
+
+        return 0;
+    }
+
     std::shared_ptr<HIPRTOrochiCtx> hiprt_orochi_ctx = std::make_shared<HIPRTOrochiCtx>(0);
 
     RenderWindow render_window(width, height, hiprt_orochi_ctx);
+    if (!cmd_arguments.trace_file_path.empty())
+        // Stopping the recording from the UI writes the trace to the same file
+        render_window.get_application_settings()->trace_file_path = cmd_arguments.trace_file_path;
 
     std::shared_ptr<GPURenderer> renderer = render_window.get_renderer();
     renderer->set_envmap(envmap_image, cmd_arguments.skysphere_file_path);
     renderer->set_camera(parsed_scene.camera);
+    renderer->set_bvh_build_quality(static_cast<BVHBuildQuality>(cmd_arguments.bvh_build_quality));
+    renderer->set_half_precision_texcoords(cmd_arguments.half_precision_texcoords);
+    renderer->set_quantized_vertices_positions(cmd_arguments.quantized_vertices_positions);
+    renderer->set_compact_bvh(cmd_arguments.compact_bvh);
+    renderer->set_progressive_loading(cmd_arguments.progressive_loading);
+    renderer->set_geometry_lod(cmd_arguments.geometry_lods);
+    renderer->set_scene_parser_options(options);
     renderer->set_scene(parsed_scene);
 
-    // Joining everyone before starting the render
-    ThreadManager::join_all_threads();
+    if (cmd_arguments.progressive_loading)
+        // The textures and the BVHs of the meshes keep loading while rendering, the renderer brings them in
+        ThreadManager::join_all_threads_except({ ThreadManager::SCENE_TEXTURES_LOADING_THREAD_KEY, ThreadManager::RENDERER_STREAM_GEOMETRIES });
+    else
+        // Joining everyone before starting the render
+        ThreadManager::join_all_threads();
 
     stop_full = std::chrono::high_resolution_clock::now();
     g_imgui_logger.add_line(ImGuiLoggerSeverity::IMGUI_LOGGER_INFO, "Full scene parsed & built in %ldms", std::chrono::duration_cast<std::chrono::milliseconds>(stop_full - start_full).count());
     renderer->get_hiprt_scene().print_statistics(std::cout);
 
-    // We don't need the scene anymore, we can free it now
-    assimp_importer.FreeScene();
+    // We don't need the scene anymore, we can free it now. Unless the
+    // textures are still loading, they may be embedded in the scene
+    if (!cmd_arguments.progressive_loading)
+        assimp_importer.FreeScene();
     envmap_image.free();
     render_window.run();
+    write_startup_trace(cmd_arguments.trace_file_path);
+
+    if (cmd_arguments.progressive_loading)
+        // What was left running when the render started, the scene cache may still be being written for example
+        ThreadManager::join_all_threads();
 #else
 
     std::cout << "[" << width << "x" << height << "]: " << cmd_arguments.render_samples << " samples ; " << cmd_arguments.bounces << " bounces" << std::endl << std::endl;
@@ -95,6 +341,7 @@ int main(int argc, char* argv[])
     Image32Bit image_denoised_05 = Utils::OIDN_denoise(cpu_renderer.get_framebuffer(), width, height, 0.5f);
 
     cpu_renderer.get_framebuffer().write_image_png("CPU_RT_output.png");
+    cpu_renderer.get_tile_timings_heatmap().write_image_png("CPU_RT_tile_timings.png");
     image_denoised_1.write_image_png("CPU_RT_output_denoised_1.png");
     image_denoised_075.write_image_png("CPU_RT_output_denoised_075.png");
     image_denoised_05.write_image_png("CPU_RT_output_denoised_05.png");